@@ -47,6 +47,14 @@
     "src/agent/SpawnPreparer/SpawnPreparerMain.cpp"
 }
 
+# Generated sources are in source control so that users don't have to
+# build them; see the comment for Constants.h in build/common_library.rb.
+dependencies = ['src/agent/Core/ControllerOptions.h.cxxcodebuilder']
+file 'src/agent/Core/ControllerOptions.h' => dependencies do
+  template = CxxCodeTemplateRenderer.new('src/agent/Core/ControllerOptions.h.cxxcodebuilder')
+  template.render_to('src/agent/Core/ControllerOptions.h')
+end
+
 # Define compilation tasks for object files.
 AGENT_OBJECTS.each_pair do |object, source|
   define_cxx_object_compilation_task(
@@ -89,6 +97,7 @@
       libuv_libs,
       PlatformInfo.curl_libs,
       PlatformInfo.zlib_libs,
+      PlatformInfo.ssl_libs,
       PlatformInfo.crypto_libs,
       PlatformInfo.portability_cxx_ldflags,
       AGENT_LDFLAGS
@@ -81,7 +81,7 @@
     APACHE2_OUTPUT_DIR + "module_libboost_oxt",
     PlatformInfo.apache2_module_cflags)
 APACHE2_MODULE_COMMON_LIBRARIES  = COMMON_LIBRARY.
-  only(:base, :bas64, 'AppTypes.o').
+  only(:base, :bas64, 'AppTypes.o', 'Utils/StaticAssetManifest.o', 'jsoncpp.o').
   set_namespace("apache2").
   set_output_dir(APACHE2_OUTPUT_DIR + "module_libpassenger_common").
   define_tasks(PlatformInfo.apache2_module_cflags).
@@ -132,6 +132,7 @@
 [EXTRA_CFLAGS, EXTRA_CXXFLAGS].each do |flags|
   flags << " -fno-omit-frame-pointers" if USE_ASAN
   flags << " -DPASSENGER_DISABLE_THREAD_LOCAL_STORAGE" if !boolean_option('PASSENGER_THREAD_LOCAL_STORAGE', true)
+  flags << " -DOXT_LIGHTWEIGHT_BACKTRACES" if boolean_option('LIGHTWEIGHT_BACKTRACES')
 end
 
 # Extra linker flags that should always be passed to the linker.
@@ -0,0 +1,47 @@
+#  Phusion Passenger - https://www.phusionpassenger.com/
+#  Copyright (c) 2016 Phusion Holding B.V.
+#
+#  "Passenger", "Phusion Passenger" and "Union Station" are registered
+#  trademarks of Phusion Holding B.V.
+#
+#  Permission is hereby granted, free of charge, to any person obtaining a copy
+#  of this software and associated documentation files (the "Software"), to deal
+#  in the Software without restriction, including without limitation the rights
+#  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#  copies of the Software, and to permit persons to whom the Software is
+#  furnished to do so, subject to the following conditions:
+#
+#  The above copyright notice and this permission notice shall be included in
+#  all copies or substantial portions of the Software.
+#
+#  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+#  THE SOFTWARE.
+
+### Benchmarks ###
+
+desc "Run the Core load benchmarks (see dev/benchmark_core --help)"
+task 'benchmark:core' => AGENT_TARGET do
+  require 'shellwords'
+  command = "#{PlatformInfo.ruby_command} dev/benchmark_core --agent #{AGENT_TARGET}"
+  {
+    'URL'         => '--url',
+    'MODE'        => '--mode',
+    'SCENARIOS'   => '--scenarios',
+    'DURATION'    => '--duration',
+    'CONCURRENCY' => '--concurrency',
+    'OUTPUT'      => '--output',
+    'BASELINE'    => '--baseline',
+    'TOLERANCE'   => '--tolerance',
+    'REPLAY'      => '--replay'
+  }.each_pair do |name, flag|
+    if !ENV[name].to_s.empty?
+      command << " #{flag} #{Shellwords.escape(ENV[name])}"
+    end
+  end
+  sh(command)
+end
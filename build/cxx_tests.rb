@@ -37,10 +37,16 @@
     "test/cxx/Core/ApplicationPool/ProcessTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/PoolTest.o" =>
     "test/cxx/Core/ApplicationPool/PoolTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/ProcessStateDeltaTest.o" =>
+    "test/cxx/Core/ApplicationPool/ProcessStateDeltaTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/DirectSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/DirectSpawnerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/SmartSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/SmartSpawnerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/UserDatabaseCacheTest.o" =>
+    "test/cxx/Core/SpawningKit/UserDatabaseCacheTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/CpuPlacementTest.o" =>
+    "test/cxx/Core/SpawningKit/CpuPlacementTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/Core/UnionStationTest.o" =>
     "test/cxx/Core/UnionStationTest.cpp",
@@ -50,12 +56,20 @@
       "test/cxx/Core/SecurityUpdateCheckerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ControllerTest.o" =>
     "test/cxx/Core/ControllerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/MetricsTest.o" =>
+    "test/cxx/Core/MetricsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/RequestTraceRecorderTest.o" =>
+    "test/cxx/Core/RequestTraceRecorderTest.cpp",
 
+  "#{TEST_OUTPUT_DIR}cxx/UstRouter/SpillQueueTest.o" =>
+    "test/cxx/UstRouter/SpillQueueTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/UstRouter/TransactionTest.o" =>
     "test/cxx/UstRouter/TransactionTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/ChannelTest.o" =>
     "test/cxx/ServerKit/ChannelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/MessageChannelTest.o" =>
+    "test/cxx/ServerKit/MessageChannelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/FileBufferedChannelTest.o" =>
     "test/cxx/ServerKit/FileBufferedChannelTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/HeaderTableTest.o" =>
@@ -66,6 +80,10 @@
     "test/cxx/ServerKit/HttpServerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/ServerKit/CookieUtilsTest.o" =>
     "test/cxx/ServerKit/CookieUtilsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/TimerWheelTest.o" =>
+    "test/cxx/ServerKit/TimerWheelTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/ServerKit/ShmRingTest.o" =>
+    "test/cxx/ServerKit/ShmRingTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/MemoryKit/MbufTest.o" =>
     "test/cxx/MemoryKit/MbufTest.cpp",
@@ -89,6 +107,10 @@
     "test/cxx/FilterSupportTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/CachedFileStatTest.o" =>
     "test/cxx/CachedFileStatTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/RandomGeneratorTest.o" =>
+    "test/cxx/RandomGeneratorTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/StaticAssetManifestTest.o" =>
+    "test/cxx/StaticAssetManifestTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/BufferedIOTest.o" =>
     "test/cxx/BufferedIOTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/MessageIOTest.o" =>
@@ -107,12 +129,28 @@
     "test/cxx/UtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Utils/StrIntUtilsTest.o" =>
     "test/cxx/Utils/StrIntUtilsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/HasherTest.o" =>
+    "test/cxx/Utils/HasherTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/MpmcQueueTest.o" =>
+    "test/cxx/Utils/MpmcQueueTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/ThreadCachedObjectPoolTest.o" =>
+    "test/cxx/Utils/ThreadCachedObjectPoolTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/JsonWriterTest.o" =>
+    "test/cxx/Utils/JsonWriterTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/SystemMetricsHistoryTest.o" =>
+    "test/cxx/Utils/SystemMetricsHistoryTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Utils/FileSystemWatcherTest.o" =>
+    "test/cxx/Utils/FileSystemWatcherTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/IOUtilsTest.o" =>
     "test/cxx/IOUtilsTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/TemplateTest.o" =>
     "test/cxx/TemplateTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Base64DecodingTest.o" =>
-    "test/cxx/Base64DecodingTest.cpp"
+    "test/cxx/Base64DecodingTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/LatencyHistogramTest.o" =>
+    "test/cxx/LatencyHistogramTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/LoggingTest.o" =>
+    "test/cxx/LoggingTest.cpp"
 }
 
 def basic_test_cxx_flags
@@ -151,6 +189,7 @@ def test_cxx_ldflags
       "#{TEST_BOOST_OXT_LIBRARY} #{libev_libs} #{libuv_libs} " <<
       "#{PlatformInfo.curl_libs} " <<
       "#{PlatformInfo.zlib_libs} " <<
+      "#{PlatformInfo.ssl_libs} " <<
       "#{PlatformInfo.crypto_libs} " <<
       "#{PlatformInfo.portability_cxx_ldflags}"
     result << " #{PlatformInfo.dmalloc_ldflags}" if USE_DMALLOC
@@ -241,3 +280,86 @@ def test_cxx_ldflags
     ].flatten
   )
 end
+
+
+### C++ micro-benchmarks ###
+
+TEST_CXX_BENCH_TARGET = "#{TEST_OUTPUT_DIR}cxx/bench/main"
+TEST_CXX_BENCH_OBJECTS = {
+  "#{TEST_OUTPUT_DIR}cxx/bench/BenchMain.o" =>
+    "test/cxx/bench/BenchMain.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/bench/MemoryKitBench.o" =>
+    "test/cxx/bench/MemoryKitBench.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/bench/DataStructuresBench.o" =>
+    "test/cxx/bench/DataStructuresBench.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/bench/ServerKitBench.o" =>
+    "test/cxx/bench/ServerKitBench.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/bench/ResponseCacheBench.o" =>
+    "test/cxx/bench/ResponseCacheBench.cpp"
+}
+
+TEST_CXX_BENCH_OBJECTS.each_pair do |object, source|
+  # The benchmarked code is mostly header-only, so it is compiled
+  # with optimizations regardless of the OPTIMIZE setting.
+  define_cxx_object_compilation_task(
+    object,
+    source,
+    :include_paths => test_cxx_include_paths,
+    :flags => ["-O2", basic_test_cxx_flags].flatten
+  )
+end
+
+dependencies = [
+  TEST_CXX_BENCH_OBJECTS.keys,
+  LIBEV_TARGET,
+  LIBUV_TARGET,
+  TEST_BOOST_OXT_LIBRARY,
+  TEST_COMMON_LIBRARY.link_objects,
+  AGENT_OBJECTS.keys - [AGENT_MAIN_OBJECT]
+].flatten.compact
+file(TEST_CXX_BENCH_TARGET => dependencies) do
+  create_cxx_executable(
+    TEST_CXX_BENCH_TARGET,
+    TEST_CXX_BENCH_OBJECTS.keys + AGENT_OBJECTS.keys - [AGENT_MAIN_OBJECT],
+    :flags => test_cxx_ldflags
+  )
+end
+
+desc "Run the C++ micro-benchmarks (pass arguments with BENCH_ARGS, e.g. BENCH_ARGS='-f HeaderTable -j')"
+task 'test:cxx:bench' => TEST_CXX_BENCH_TARGET do
+  sh "#{File.expand_path(TEST_CXX_BENCH_TARGET)} #{ENV['BENCH_ARGS']}".strip
+end
+
+
+### Application pool simulator ###
+
+TEST_CXX_POOL_SIMULATOR_TARGET = "#{TEST_OUTPUT_DIR}cxx/bench/pool_simulator"
+TEST_CXX_POOL_SIMULATOR_OBJECT = "#{TEST_OUTPUT_DIR}cxx/bench/PoolSimulator.o"
+
+define_cxx_object_compilation_task(
+  TEST_CXX_POOL_SIMULATOR_OBJECT,
+  "test/cxx/bench/PoolSimulator.cpp",
+  :include_paths => test_cxx_include_paths,
+  :flags => basic_test_cxx_flags
+)
+
+dependencies = [
+  TEST_CXX_POOL_SIMULATOR_OBJECT,
+  LIBEV_TARGET,
+  LIBUV_TARGET,
+  TEST_BOOST_OXT_LIBRARY,
+  TEST_COMMON_LIBRARY.link_objects,
+  AGENT_OBJECTS.keys - [AGENT_MAIN_OBJECT]
+].flatten.compact
+file(TEST_CXX_POOL_SIMULATOR_TARGET => dependencies) do
+  create_cxx_executable(
+    TEST_CXX_POOL_SIMULATOR_TARGET,
+    [TEST_CXX_POOL_SIMULATOR_OBJECT] + AGENT_OBJECTS.keys - [AGENT_MAIN_OBJECT],
+    :flags => test_cxx_ldflags
+  )
+end
+
+desc "Replay a request trace against a simulated application pool (pass arguments with SIM_ARGS, e.g. SIM_ARGS='--rate 100 --max-pool-size 4')"
+task 'test:cxx:pool_simulator' => TEST_CXX_POOL_SIMULATOR_TARGET do
+  sh "#{File.expand_path(TEST_CXX_POOL_SIMULATOR_TARGET)} #{ENV['SIM_ARGS']}".strip
+end
@@ -192,6 +192,7 @@ def format_paragraph(text)
         libuv_libs,
         PlatformInfo.curl_libs,
         PlatformInfo.zlib_libs,
+        PlatformInfo.ssl_libs,
         PlatformInfo.crypto_libs,
         PlatformInfo.portability_cxx_ldflags
       ]
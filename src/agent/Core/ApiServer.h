@@ -37,6 +37,7 @@
 #include <modp_b64.h>
 
 #include <Core/Controller.h>
+#include <Core/Metrics.h>
 #include <Core/ApplicationPool/Pool.h>
 #include <Shared/ApiServerUtils.h>
 #include <ServerKit/HttpServer.h>
@@ -46,6 +47,7 @@
 #include <Logging.h>
 #include <Constants.h>
 #include <Utils/StrIntUtils.h>
+#include <Utils/JsonWriter.h>
 #include <Utils/BufferedIO.h>
 #include <Utils/MessageIO.h>
 
@@ -62,7 +64,8 @@ public:
 	Json::Value jsonBody;
 	Authorization authorization;
 	unsigned int controllerStatesGathered;
-	vector<Json::Value> controllerStates;
+	vector<string> controllerStates;
+	vector<ControllerMetrics> controllerMetrics;
 
 	DEFINE_SERVER_KIT_BASE_HTTP_REQUEST_FOOTER(Passenger::Core::ApiServer::Request);
 };
@@ -101,8 +104,14 @@ private:
 			processServerStatus(client, req);
 		} else if (regex_match(path, serverConnectionPath)) {
 			processServerConnectionOperation(client, req);
+		} else if (path == P_STATIC_STRING("/metrics")) {
+			processMetrics(client, req);
 		} else if (path == P_STATIC_STRING("/pool.xml")) {
 			processPoolStatusXml(client, req);
+		} else if (path == P_STATIC_STRING("/pool.json")) {
+			processPoolStatusJson(client, req);
+		} else if (path == P_STATIC_STRING("/system_metrics.json")) {
+			processSystemMetrics(client, req);
 		} else if (path == P_STATIC_STRING("/pool.txt")) {
 			processPoolStatusTxt(client, req);
 		} else if (path == P_STATIC_STRING("/pool/restart_app_group.json")) {
@@ -122,8 +131,12 @@ private:
 			apiServerProcessShutdown(this, client, req);
 		} else if (path == P_STATIC_STRING("/gc.json")) {
 			processGc(client, req);
+		} else if (path == P_STATIC_STRING("/mbuf_pool/trim.json")) {
+			processMbufPoolTrim(client, req);
 		} else if (path == P_STATIC_STRING("/config.json")) {
 			processConfig(client, req);
+		} else if (path == P_STATIC_STRING("/turbocache/purge.json")) {
+			processTurboCachePurge(client, req);
 		} else if (path == P_STATIC_STRING("/reinherit_logs.json")) {
 			apiServerProcessReinheritLogs(this, client, req,
 				instanceDir, fdPassingPassword);
@@ -177,13 +190,21 @@ private:
 	void gatherControllerState(Client *client, Request *req,
 		Controller *controller, unsigned int i)
 	{
-		Json::Value state = controller->inspectStateAsJson();
+		// Mbufs belong to a specific thread's pool, so the state is
+		// serialized into a string here and copied into this thread's
+		// mbufs later. It's written at depth 1 so that it can be embedded
+		// as-is in the response document.
+		string state;
+		JsonWriter writer(state, true, 1);
+		writer.beginObject();
+		controller->writeStateAsJson(writer);
+		writer.endObject();
 		getContext()->libev->runLater(boost::bind(&ApiServer::controllerStateGathered,
 			this, client, req, i, state));
 	}
 
 	void controllerStateGathered(Client *client, Request *req,
-		unsigned int i, Json::Value state)
+		unsigned int i, const string &state)
 	{
 		if (req->ended()) {
 			unrefRequest(req, __FILE__, __LINE__);
@@ -194,19 +215,28 @@ private:
 		req->controllerStates[i] = state;
 
 		if (req->controllerStatesGathered == controllers.size()) {
-			HeaderTable headers;
-			headers.insert(req->pool, "Content-Type", "application/json");
-
-			Json::Value response;
-			response["threads"] = (Json::UInt) controllers.size();
-
+			JsonWriter writer(&getContext()->mbuf_pool);
+			writer.beginObject();
+			writer.member("threads", (unsigned int) controllers.size());
 			for (unsigned int i = 0; i < controllers.size(); i++) {
-				string key = "thread" + toString(i + 1);
-				response[key] = req->controllerStates[i];
+				char key[sizeof("thread") + 10];
+				int size = snprintf(key, sizeof(key), "thread%u", i + 1);
+				writer.key(StaticString(key, size));
+				writer.rawValue(req->controllerStates[i]);
 			}
+			writer.endObject();
+			writer.rawValue("\n");
+			writer.finish();
 
-			writeSimpleResponse(client, 200, &headers,
-				psg_pstrdup(req->pool, response.toStyledString()));
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "application/json");
+			writeSimpleResponseHeader(client, 200, &headers, writer.size());
+			if (req->method != HTTP_HEAD) {
+				vector<MemoryKit::mbuf>::const_iterator it, end = writer.buffers.end();
+				for (it = writer.buffers.begin(); it != end && !req->ended(); it++) {
+					writeResponse(client, *it);
+				}
+			}
 			if (!req->ended()) {
 				Request *req2 = req;
 				endRequest(&client, &req2);
@@ -230,6 +260,371 @@ private:
 		}
 	}
 
+	void processMetrics(Client *client, Request *req) {
+		if (authorizeStateInspectionOperation(this, client, req)) {
+			req->controllerMetrics.resize(controllers.size());
+			for (unsigned int i = 0; i < controllers.size(); i++) {
+				refRequest(req, __FILE__, __LINE__);
+				controllers[i]->getContext()->libev->runLater(boost::bind(
+					&ApiServer::gatherControllerMetrics, this,
+					client, req, controllers[i], i));
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
+	void gatherControllerMetrics(Client *client, Request *req,
+		Controller *controller, unsigned int i)
+	{
+		ControllerMetrics metrics;
+		controller->collectMetrics(metrics);
+		getContext()->libev->runLater(boost::bind(&ApiServer::controllerMetricsGathered,
+			this, client, req, i, metrics));
+	}
+
+	void controllerMetricsGathered(Client *client, Request *req,
+		unsigned int i, ControllerMetrics metrics)
+	{
+		if (req->ended()) {
+			unrefRequest(req, __FILE__, __LINE__);
+			return;
+		}
+
+		req->controllerStatesGathered++;
+		req->controllerMetrics[i] = metrics;
+
+		if (req->controllerStatesGathered == controllers.size()) {
+			MetricsWriter writer(&getContext()->mbuf_pool);
+			writeControllerMetrics(writer, req->controllerMetrics);
+			if (appPool != NULL) {
+				ApplicationPool2::Pool::Metrics poolMetrics;
+				appPool->collectMetrics(poolMetrics);
+				writePoolMetrics(writer, poolMetrics);
+			}
+			writer.finish();
+
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "text/plain; version=0.0.4");
+			writeSimpleResponseHeader(client, 200, &headers, writer.size());
+			if (req->method != HTTP_HEAD) {
+				vector<MemoryKit::mbuf>::const_iterator it, end = writer.buffers.end();
+				for (it = writer.buffers.begin(); it != end && !req->ended(); it++) {
+					writeResponse(client, *it);
+				}
+			}
+			if (!req->ended()) {
+				Request *req2 = req;
+				endRequest(&client, &req2);
+			}
+		}
+
+		unrefRequest(req, __FILE__, __LINE__);
+	}
+
+	static void writeControllerMetrics(MetricsWriter &writer,
+		const vector<ControllerMetrics> &metrics)
+	{
+		static const char * const statusClasses[] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+		vector<string> threads;
+		unsigned int i, j;
+
+		for (i = 0; i < metrics.size(); i++) {
+			threads.push_back(toString(i + 1));
+		}
+
+		writer.writeHeader("passenger_requests_total", "counter",
+			"Requests received, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_requests_total", "thread", threads[i],
+				metrics[i].totalRequestsBegun);
+		}
+
+		writer.writeHeader("passenger_responses_total", "counter",
+			"Responses sent, per Core thread and status class.");
+		for (i = 0; i < metrics.size(); i++) {
+			for (j = 0; j < 5; j++) {
+				writer.writeSample("passenger_responses_total",
+					"thread", threads[i], "status", statusClasses[j],
+					metrics[i].responsesByStatusClass[j]);
+			}
+		}
+
+		writer.writeHeader("passenger_clients", "gauge",
+			"Clients currently connected, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_clients", "thread", threads[i],
+				metrics[i].activeClientCount);
+		}
+
+		writer.writeHeader("passenger_clients_accepted_total", "counter",
+			"Clients accepted, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_clients_accepted_total", "thread", threads[i],
+				metrics[i].totalClientsAccepted);
+		}
+
+		writer.writeHeader("passenger_turbocache_fetches_total", "counter",
+			"Turbocache lookups, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_turbocache_fetches_total", "thread", threads[i],
+				metrics[i].turboCacheFetches);
+		}
+
+		writer.writeHeader("passenger_turbocache_hits_total", "counter",
+			"Turbocache lookups that were answered from the cache, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_turbocache_hits_total", "thread", threads[i],
+				metrics[i].turboCacheHits);
+		}
+
+		writer.writeHeader("passenger_mbuf_blocks", "gauge",
+			"Buffer blocks, per Core thread and state.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_mbuf_blocks",
+				"thread", threads[i], "state", "active",
+				metrics[i].mbufActiveBlocks);
+			writer.writeSample("passenger_mbuf_blocks",
+				"thread", threads[i], "state", "free",
+				metrics[i].mbufFreeBlocks);
+		}
+
+		writer.writeHeader("passenger_mbuf_bytes", "gauge",
+			"Memory held by buffer blocks, per Core thread and state.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_mbuf_bytes",
+				"thread", threads[i], "state", "active",
+				metrics[i].mbufActiveBytes);
+			writer.writeSample("passenger_mbuf_bytes",
+				"thread", threads[i], "state", "free",
+				metrics[i].mbufFreeBytes);
+		}
+
+		writer.writeHeader("passenger_event_loop_iterations_total", "counter",
+			"Event loop iterations, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_event_loop_iterations_total", "thread", threads[i],
+				metrics[i].eventLoopIterations);
+		}
+
+		writer.writeHeader("passenger_event_loop_time_microseconds_total", "counter",
+			"Time that the event loop spent running callbacks (busy) or waiting "
+			"for events (blocked), per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_event_loop_time_microseconds_total",
+				"thread", threads[i], "state", "busy",
+				metrics[i].eventLoopBusyTime);
+			writer.writeSample("passenger_event_loop_time_microseconds_total",
+				"thread", threads[i], "state", "blocked",
+				metrics[i].eventLoopBlockedTime);
+		}
+
+		writer.writeHeader("passenger_event_loop_callbacks_total", "counter",
+			"Event callbacks invoked by the event loop, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_event_loop_callbacks_total", "thread", threads[i],
+				metrics[i].eventLoopCallbacks);
+		}
+
+		writer.writeHeader("passenger_event_loop_max_iteration_microseconds", "gauge",
+			"The longest event loop iteration in the last 5 to 10 seconds, per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_event_loop_max_iteration_microseconds",
+				"thread", threads[i], metrics[i].eventLoopMaxIterationTime);
+		}
+
+		writer.writeHeader("passenger_event_loop_pending_commands", "gauge",
+			"Callbacks scheduled from other threads that the event loop has not run yet, "
+			"per Core thread.");
+		for (i = 0; i < metrics.size(); i++) {
+			writer.writeSample("passenger_event_loop_pending_commands",
+				"thread", threads[i], metrics[i].eventLoopPendingCommands);
+		}
+
+		writer.writeHeader("passenger_log_messages_dropped_total", "counter",
+			"Log messages dropped because a log buffer was full.");
+		writer.writeSample("passenger_log_messages_dropped_total",
+			getDroppedLogEntryCount());
+	}
+
+	static void writePoolMetrics(MetricsWriter &writer,
+		const ApplicationPool2::Pool::Metrics &metrics)
+	{
+		typedef ApplicationPool2::Pool::Metrics::GroupMetrics GroupMetrics;
+		vector<GroupMetrics>::const_iterator it, end = metrics.groups.end();
+
+		writer.writeHeader("passenger_pool_max_processes", "gauge",
+			"The maximum number of application processes.");
+		writer.writeSample("passenger_pool_max_processes", metrics.max);
+		writer.writeHeader("passenger_pool_capacity_used", "gauge",
+			"The number of application processes, including those being spawned.");
+		writer.writeSample("passenger_pool_capacity_used", metrics.capacityUsed);
+		writer.writeHeader("passenger_pool_queue_length", "gauge",
+			"Requests waiting for pool capacity to become available.");
+		writer.writeSample("passenger_pool_queue_length", metrics.getWaitlistSize);
+
+		// Only known when the Core runs in a cgroup with limits.
+		if (metrics.cgroupMemoryLimit >= 0) {
+			writer.writeHeader("passenger_cgroup_memory_limit_bytes", "gauge",
+				"The memory limit of the cgroup that the Core runs in.");
+			writer.writeSample("passenger_cgroup_memory_limit_bytes",
+				(boost::uint64_t) metrics.cgroupMemoryLimit * 1024);
+		}
+		if (metrics.cgroupMemoryUsage >= 0) {
+			writer.writeHeader("passenger_cgroup_memory_usage_bytes", "gauge",
+				"The memory usage of the cgroup that the Core runs in.");
+			writer.writeSample("passenger_cgroup_memory_usage_bytes",
+				(boost::uint64_t) metrics.cgroupMemoryUsage * 1024);
+		}
+		if (metrics.cgroupCpuQuota >= 0) {
+			writer.writeHeader("passenger_cgroup_cpu_quota_millicores", "gauge",
+				"The CPU quota of the cgroup that the Core runs in, in thousandths of a CPU.");
+			writer.writeSample("passenger_cgroup_cpu_quota_millicores",
+				(boost::uint64_t) (metrics.cgroupCpuQuota * 1000 + 0.5));
+		}
+
+		writer.writeHeader("passenger_group_processes", "gauge",
+			"Application processes, per application group and state.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			writer.writeSample("passenger_group_processes",
+				"group", it->name, "state", "enabled", it->enabledProcessCount);
+			writer.writeSample("passenger_group_processes",
+				"group", it->name, "state", "disabling", it->disablingProcessCount);
+			writer.writeSample("passenger_group_processes",
+				"group", it->name, "state", "disabled", it->disabledProcessCount);
+			writer.writeSample("passenger_group_processes",
+				"group", it->name, "state", "spawning", it->processesBeingSpawned);
+		}
+
+		writer.writeHeader("passenger_group_busy_processes", "gauge",
+			"Enabled application processes that cannot accept more sessions.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			writer.writeSample("passenger_group_busy_processes",
+				"group", it->name, it->totallyBusyProcessCount);
+		}
+
+		writer.writeHeader("passenger_group_sessions", "gauge",
+			"Requests currently being handled by application processes.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			writer.writeSample("passenger_group_sessions",
+				"group", it->name, it->sessions);
+		}
+
+		writer.writeHeader("passenger_group_queue_length", "gauge",
+			"Requests waiting for a process of this application group.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			writer.writeSample("passenger_group_queue_length",
+				"group", it->name, it->getWaitlistSize);
+		}
+
+		writer.writeHeader("passenger_group_spawns_total", "counter",
+			"Spawn attempts, per application group and result.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			writer.writeSample("passenger_group_spawns_total",
+				"group", it->name, "result", "success", it->spawnsSucceeded);
+			writer.writeSample("passenger_group_spawns_total",
+				"group", it->name, "result", "failure", it->spawnsFailed);
+		}
+
+		writer.writeHeader("passenger_group_cgroup_memory_bytes", "gauge",
+			"The memory usage of the cgroup of an application group, if it has one.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->cgroupMemoryUsage >= 0) {
+				writer.writeSample("passenger_group_cgroup_memory_bytes",
+					"group", it->name, (boost::uint64_t) it->cgroupMemoryUsage * 1024);
+			}
+		}
+
+		// Only known for application processes that publish metrics
+		// about themselves.
+		writer.writeHeader("passenger_group_app_processes_collecting_garbage", "gauge",
+			"Application processes that are collecting garbage.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->appMetricsProcessCount > 0) {
+				writer.writeSample("passenger_group_app_processes_collecting_garbage",
+					"group", it->name, it->collectingGarbageProcessCount);
+			}
+		}
+
+		writer.writeHeader("passenger_group_app_gc_runs_total", "counter",
+			"Garbage collection runs of the current application processes.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->appMetricsProcessCount > 0) {
+				writer.writeSample("passenger_group_app_gc_runs_total",
+					"group", it->name, it->gcCount);
+			}
+		}
+
+		writer.writeHeader("passenger_group_app_gc_time_microseconds_total", "counter",
+			"Time that the current application processes spent collecting garbage.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->appMetricsProcessCount > 0) {
+				writer.writeSample("passenger_group_app_gc_time_microseconds_total",
+					"group", it->name, it->gcTime);
+			}
+		}
+
+		writer.writeHeader("passenger_group_app_heap_bytes", "gauge",
+			"The heap size of the application processes, as reported by themselves.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->appMetricsProcessCount > 0) {
+				writer.writeSample("passenger_group_app_heap_bytes",
+					"group", it->name, it->heapSize);
+			}
+		}
+
+		writer.writeHeader("passenger_group_app_threads", "gauge",
+			"Request handling threads of the application processes, per state.");
+		for (it = metrics.groups.begin(); it != end; it++) {
+			if (it->appMetricsProcessCount > 0) {
+				writer.writeSample("passenger_group_app_threads",
+					"group", it->name, "state", "busy", it->threadsBusy);
+				writer.writeSample("passenger_group_app_threads",
+					"group", it->name, "state", "idle",
+					it->threadsTotal - std::min(it->threadsBusy, it->threadsTotal));
+			}
+		}
+	}
+
+	void processSystemMetrics(Client *client, Request *req) {
+		if (authorizeStateInspectionOperation(this, client, req)) {
+			VariantMap params = parseQueryString(req->getQueryString());
+			// In seconds.
+			unsigned int maxAge = params.getUint("max_age", false, 10 * 60);
+
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "application/json");
+			writeSimpleResponse(client, 200, &headers,
+				psg_pstrdup(req->pool, stringifyJson(
+					appPool->inspectSystemMetricsHistoryAsJson(maxAge))));
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
+	void processPoolStatusJson(Client *client, Request *req) {
+		Authorization auth(authorize(this, client, req));
+		if (auth.canReadPool) {
+			ApplicationPool2::Pool::ToXmlOptions options(
+				parseQueryString(req->getQueryString()));
+			options.uid = auth.uid;
+			options.apiKey = auth.apiKey;
+
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "application/json");
+			writeSimpleResponse(client, 200, &headers,
+				psg_pstrdup(req->pool, appPool->toJson(options)));
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
 	void processPoolStatusXml(Client *client, Request *req) {
 		Authorization auth(authorize(this, client, req));
 		if (auth.canReadPool) {
@@ -435,6 +830,35 @@ private:
 		}
 	}
 
+	static void trimMbufPool(Controller *controller) {
+		unsigned int count = controller->getContext()->trimMbufPool();
+		SKS_NOTICE_FROM_STATIC(controller, "Trimmed " << count << " mbufs");
+	}
+
+	/**
+	 * Trims the mbuf pools right away instead of waiting for the next
+	 * periodic trim. The trimming statistics are part of /server.json.
+	 */
+	void processMbufPoolTrim(Client *client, Request *req) {
+		if (req->method != HTTP_PUT) {
+			apiServerRespondWith405(this, client, req);
+		} else if (authorizeAdminOperation(this, client, req)) {
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "application/json");
+			for (unsigned int i = 0; i < controllers.size(); i++) {
+				controllers[i]->getContext()->libev->runLater(boost::bind(
+					trimMbufPool, controllers[i]));
+			}
+			getContext()->trimMbufPool();
+			writeSimpleResponse(client, 200, &headers, "{ \"status\": \"ok\" }");
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
 	void processConfig(Client *client, Request *req) {
 		if (req->method == HTTP_GET) {
 			if (!authorizeStateInspectionOperation(this, client, req)) {
@@ -479,6 +903,13 @@ private:
 		string fileDescriptorLogFile = getFileDescriptorLogFile();
 
 		headers.insert(req->pool, "Content-Type", "application/json");
+		if (appPool != NULL) {
+			Json::Value poolConfig = appPool->getConfigAsJson();
+			Json::Value::Members members = poolConfig.getMemberNames();
+			for (unsigned int i = 0; i < members.size(); i++) {
+				config[members[i]] = poolConfig[members[i]];
+			}
+		}
 		config["log_level"] = getLogLevel();
 		if (!logFile.empty()) {
 			config["log_file"] = logFile;
@@ -501,6 +932,49 @@ private:
 		controller->configure(json);
 	}
 
+	/**
+	 * Settings are applied in the Controllers' event loops, where an
+	 * exception would crash the Core, so check their types beforehand.
+	 * Returns the name of the first invalid setting, or NULL.
+	 */
+	static const char *findInvalidConfigOption(const Json::Value &json) {
+		static const char *uintOptions[] = {
+			"accept_burst_count",
+			"min_spare_clients",
+			"client_freelist_limit",
+			"request_freelist_limit",
+			"stat_throttle_rate",
+			"file_buffer_threshold",
+			"response_buffer_high_watermark",
+			"response_buffer_full_buffering_size",
+			"request_body_prebuffer_size",
+			"request_body_slow_rate",
+			"turbocache_max_body_size",
+			"turbocache_coalescing_timeout",
+			"websocket_drain_time",
+			"client_header_timeout",
+			"client_keepalive_timeout",
+			"client_body_min_rate",
+			"max_pool_size",
+			"pool_idle_time",
+			"spawn_worker_threads",
+			NULL
+		};
+
+		if (!json.isObject()) {
+			return "(document)";
+		}
+		for (const char **name = uintOptions; *name != NULL; name++) {
+			if (json.isMember(*name) && !json[*name].isConvertibleTo(Json::uintValue)) {
+				return *name;
+			}
+		}
+		if (json.isMember("max_pool_size") && json["max_pool_size"].asUInt() == 0) {
+			return "max_pool_size";
+		}
+		return NULL;
+	}
+
 	void processConfigBody(Client *client, Request *req) {
 		HeaderTable headers;
 		Json::Value &json = req->jsonBody;
@@ -508,6 +982,20 @@ private:
 		headers.insert(req->pool, "Content-Type", "application/json");
 		headers.insert(req->pool, "Cache-Control", "no-cache, no-store, must-revalidate");
 
+		const char *invalidOption = findInvalidConfigOption(json);
+		if (invalidOption != NULL) {
+			unsigned int bufsize = 1024;
+			char *message = (char *) psg_pnalloc(req->pool, bufsize);
+			snprintf(message, bufsize, "{ \"status\": \"error\", "
+				"\"message\": \"Invalid value for %s\" }",
+				invalidOption);
+			writeSimpleResponse(client, 400, &headers, message);
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+			return;
+		}
+
 		if (json.isMember("log_level")) {
 			setLogLevel(json["log_level"].asInt());
 		}
@@ -543,6 +1031,17 @@ private:
 			}
 			P_NOTICE("Log file opened.");
 		}
+		if (appPool != NULL) {
+			if (json.isMember("max_pool_size")) {
+				appPool->setMax(json["max_pool_size"].asUInt());
+			}
+			if (json.isMember("pool_idle_time")) {
+				appPool->setMaxIdleTime(json["pool_idle_time"].asUInt() * 1000000ULL);
+			}
+			if (json.isMember("spawn_worker_threads")) {
+				appPool->setSpawnWorkerCount(json["spawn_worker_threads"].asUInt());
+			}
+		}
 		for (unsigned int i = 0; i < controllers.size(); i++) {
 			controllers[i]->getContext()->libev->runLater(boost::bind(
 				configureController, controllers[i], json));
@@ -554,6 +1053,55 @@ private:
 		}
 	}
 
+	/**
+	 * Purges turbocache entries in all Controllers. The body is a JSON
+	 * object with optional "host" and "path" members; omitting them
+	 * matches all hosts or all paths. See ResponseCache::purge().
+	 */
+	void processTurboCachePurge(Client *client, Request *req) {
+		if (req->method != HTTP_PUT && req->method != HTTP_POST) {
+			apiServerRespondWith405(this, client, req);
+		} else if (!authorizeAdminOperation(this, client, req)) {
+			apiServerRespondWith401(this, client, req);
+		} else if (!req->hasBody()) {
+			endAsBadRequest(&client, &req, "Body required");
+		} else if (requestBodyExceedsLimit(client, req)) {
+			apiServerRespondWith413(this, client, req);
+		}
+		// Continues in processTurboCachePurgeBody().
+	}
+
+	static void purgeTurboCacheOnController(Controller *controller, string host,
+		string path)
+	{
+		controller->purgeTurboCache(host, path);
+	}
+
+	void processTurboCachePurgeBody(Client *client, Request *req) {
+		HeaderTable headers;
+		Json::Value &json = req->jsonBody;
+
+		headers.insert(req->pool, "Content-Type", "application/json");
+		headers.insert(req->pool, "Cache-Control", "no-cache, no-store, must-revalidate");
+
+		if (!json.isObject()) {
+			endAsBadRequest(&client, &req, "JSON object required");
+			return;
+		}
+
+		string host = json.get("host", "").asString();
+		string path = json.get("path", "").asString();
+		for (unsigned int i = 0; i < controllers.size(); i++) {
+			controllers[i]->getContext()->libev->runLater(boost::bind(
+				purgeTurboCacheOnController, controllers[i], host, path));
+		}
+
+		writeSimpleResponse(client, 200, &headers, "{ \"status\": \"ok\" }");
+		if (!req->ended()) {
+			endRequest(&client, &req);
+		}
+	}
+
 	bool requestBodyExceedsLimit(Client *client, Request *req, unsigned int limit = 1024 * 128) {
 		return (req->bodyType == Request::RBT_CONTENT_LENGTH
 				&& req->aux.bodyInfo.contentLength > limit)
@@ -602,6 +1150,8 @@ protected:
 						processPoolDetachProcessBody(client, req);
 					} else if (path == P_STATIC_STRING("/config.json")) {
 						processConfigBody(client, req);
+					} else if (path == P_STATIC_STRING("/turbocache/purge.json")) {
+						processTurboCachePurgeBody(client, req);
 					} else {
 						P_BUG("Unknown path for body processing: " << path);
 					}
@@ -634,6 +1184,7 @@ protected:
 		}
 		req->authorization = Authorization();
 		req->controllerStates.clear();
+		req->controllerMetrics.clear();
 		ParentClass::deinitializeRequest(client, req);
 	}
 
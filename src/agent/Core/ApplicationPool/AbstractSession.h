@@ -33,8 +33,13 @@
 #include <Shared/ApplicationPoolApiKey.h>
 
 namespace Passenger {
+
+class ShmRingSlot;
+
 namespace ApplicationPool2 {
 
+class SessionCloseBatch;
+
 
 /**
  * An abstract base class for Session so that unit tests can work with
@@ -50,9 +55,15 @@ public:
 	virtual pid_t getPid() const = 0;
 	virtual StaticString getGupid() const = 0;
 	virtual StaticString getProtocol() const = 0;
+	virtual bool acceptsRequestBodyFd() const { return false; }
 	virtual unsigned int getStickySessionId() const = 0;
 	virtual const ApiKey &getApiKey() const = 0;
 	virtual int fd() const = 0;
+	/**
+	 * The shared memory rings through which the session data goes instead
+	 * of through fd(), if any. See ShmRingFile.
+	 */
+	virtual ShmRingSlot *shmRingSlot() const { return NULL; }
 	virtual bool isClosed() const = 0;
 
 	virtual void initiate(bool blocking = true) = 0;
@@ -63,6 +74,15 @@ public:
 	 * This Session object becomes fully unsable after closing.
 	 */
 	virtual void close(bool success, bool wantKeepAlive = false) = 0;
+
+	/**
+	 * Like `close()`, but allows the pool's bookkeeping for this session to be
+	 * deferred until `batch` is passed to `Pool::closeSessions()`. The
+	 * connection itself is released immediately.
+	 */
+	virtual void closeInBatch(bool success, bool wantKeepAlive, SessionCloseBatch &batch) {
+		close(success, wantKeepAlive);
+	}
 };
 
 
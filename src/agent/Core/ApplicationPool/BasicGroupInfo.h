@@ -64,6 +64,12 @@ public:
 	 */
 	std::string name;
 
+	/**
+	 * The key under which the Pool stores this Group. Equal to `name`
+	 * unless the Group belongs to a tenant; see `Options::getGroupKey()`.
+	 */
+	std::string key;
+
 	/**
 	 * This Group's unique API key.
 	 */
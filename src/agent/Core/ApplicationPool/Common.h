@@ -28,6 +28,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/intrusive_ptr.hpp>
 #include <boost/function.hpp>
 #include <oxt/tracable_exception.hpp>
@@ -37,6 +38,7 @@
 #include <MemoryKit/palloc.h>
 #include <DataStructures/StringKeyTable.h>
 #include <Utils/VariantMap.h>
+#include <Utils/SystemTime.h>
 #include <Core/ApplicationPool/Options.h>
 #include <Core/SpawningKit/Config.h>
 #include <Core/UnionStation/Context.h>
@@ -162,6 +164,28 @@ enum RestartMethod {
 	RM_ROLLING
 };
 
+/**
+ * Determines how Group::route() picks an enabled process for requests that
+ * are not bound to a process through a sticky session ID. Configured through
+ * Options::routingPolicy.
+ */
+enum RoutingPolicy {
+	// Pick the process with the lowest busyness().
+	RP_LEAST_BUSY,
+	// Sample two random enabled processes and pick the less busy of the two.
+	// Avoids herding onto a single process when busyness levels are stale
+	// or equal.
+	RP_P2C,
+	// Pick the process with the lowest number of open sessions weighted by
+	// its moving average response time, so that slow processes (e.g. ones
+	// that are garbage collecting) receive fewer requests.
+	RP_EWMA,
+	// Route requests with the same Options::routingHash to the same process,
+	// using a consistent-hash ring with bounded load. Requests without a
+	// routing hash are routed like with RP_LEAST_BUSY.
+	RP_CONSISTENT_HASH
+};
+
 typedef boost::shared_ptr<Pool> PoolPtr;
 typedef boost::shared_ptr<Group> GroupPtr;
 typedef boost::intrusive_ptr<Process> ProcessPtr;
@@ -175,25 +199,63 @@ typedef boost::function<void ()> Callback;
 struct GetCallback {
 	void (*func)(const AbstractSessionPtr &session, const ExceptionPtr &e, void *userData);
 	mutable void *userData;
+	/**
+	 * Optional. Called with the pool lock held, possibly from another thread,
+	 * to find out whether the requester is no longer interested in a session
+	 * (e.g. because the client disconnected). If so, the request is removed
+	 * from the wait list without being routed to a process.
+	 */
+	bool (*isCancelled)(void *userData);
+	/**
+	 * Whether the Options passed to Pool::asyncGet() are guaranteed to stay
+	 * alive and unmodified until `func` has been called. If so, a request
+	 * that has to wait for a process references them instead of copying
+	 * them, so that queuing it doesn't allocate any memory.
+	 */
+	bool optionsOutliveCallback;
+
+	GetCallback()
+		: func(NULL),
+		  userData(NULL),
+		  isCancelled(NULL),
+		  optionsOutliveCallback(false)
+		{ }
 
 	void operator()(const AbstractSessionPtr &session, const ExceptionPtr &e) const {
 		func(session, e, userData);
 	}
 
+	bool cancelled() const {
+		return isCancelled != NULL && isCancelled(userData);
+	}
+
 	static void call(GetCallback cb, const AbstractSessionPtr &session, const ExceptionPtr &e) {
 		cb(session, e);
 	}
 };
 
 struct GetWaiter {
-	Options options;
+	/**
+	 * The caller's Options if `callback.optionsOutliveCallback`,
+	 * otherwise a persisted copy of them in `ownOptions`.
+	 */
+	const Options *options;
 	GetCallback callback;
+	/** When this waiter was put on the wait list, in microseconds. */
+	unsigned long long enqueueTime;
+	boost::shared_ptr<Options> ownOptions;
 
 	GetWaiter(const Options &o, const GetCallback &cb)
-		: options(o),
-		  callback(cb)
+		: options(&o),
+		  callback(cb),
+		  enqueueTime(o.currentTime != 0 ? o.currentTime : SystemTime::getUsec())
 	{
-		options.persist(o);
+		if (!cb.optionsOutliveCallback) {
+			ownOptions = boost::make_shared<Options>(o);
+			ownOptions->persist(o);
+			ownOptions->detachFromUnionStationTransaction();
+			options = ownOptions.get();
+		}
 	}
 };
 
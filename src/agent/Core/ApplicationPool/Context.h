@@ -30,6 +30,7 @@
 #include <boost/pool/object_pool.hpp>
 #include <Exceptions.h>
 #include <Utils/ClassUtils.h>
+#include <Utils/ThreadCachedObjectPool.h>
 #include <Core/SpawningKit/Factory.h>
 
 namespace Passenger {
@@ -56,8 +57,10 @@ class Context {
 private:
 	/****** Memory management objects *****/
 
+	/** Guards ProcessObjectPool. */
 	P_RO_PROPERTY_REF(private, boost::mutex, MmSyncher);
-	P_RO_PROPERTY_REF(private, object_pool<Session>, SessionObjectPool);
+	/** Thread-safe on its own; Sessions are allocated and freed once per request. */
+	P_RO_PROPERTY_REF(private, ThreadCachedObjectPool<Session>, SessionObjectPool);
 	P_RO_PROPERTY_REF(private, object_pool<Process>, ProcessObjectPool);
 
 
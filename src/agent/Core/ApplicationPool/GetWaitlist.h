@@ -0,0 +1,228 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_GET_WAITLIST_H_
+#define _PASSENGER_APPLICATION_POOL2_GET_WAITLIST_H_
+
+#include <deque>
+#include <iterator>
+#include <cstddef>
+#include <cassert>
+#include <Core/ApplicationPool/Common.h>
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+/**
+ * A queue of get() requests that are waiting for a process, as used for
+ * `Group::getWaitlist` and `Pool::getWaitlist`.
+ *
+ * Waiters are kept in one FIFO queue per priority class (see
+ * `Options::priority`). Waiters in a higher class are always taken before
+ * waiters in a lower class. Adding a waiter, and taking the next one,
+ * are O(1) operations.
+ *
+ * Iteration goes over the waiters in the order in which they are taken.
+ */
+class GetWaitlist {
+public:
+	/** Priority classes range from 0 (the default) to PRIORITY_CLASSES - 1. */
+	static const unsigned int PRIORITY_CLASSES = 4;
+
+	class const_iterator {
+	private:
+		const GetWaitlist *list;
+		int priorityClass;
+		deque<GetWaiter>::const_iterator it;
+
+		void skipExhaustedQueues() {
+			while (priorityClass >= 0 && it == list->queues[priorityClass].end()) {
+				priorityClass--;
+				if (priorityClass >= 0) {
+					it = list->queues[priorityClass].begin();
+				}
+			}
+		}
+
+	public:
+		typedef forward_iterator_tag iterator_category;
+		typedef GetWaiter value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const GetWaiter *pointer;
+		typedef const GetWaiter &reference;
+
+		const_iterator()
+			: list(NULL),
+			  priorityClass(-1)
+			{ }
+
+		const_iterator(const GetWaitlist *_list, int _priorityClass)
+			: list(_list),
+			  priorityClass(_priorityClass)
+		{
+			if (priorityClass >= 0) {
+				it = list->queues[priorityClass].begin();
+				skipExhaustedQueues();
+			}
+		}
+
+		reference operator*() const {
+			return *it;
+		}
+
+		pointer operator->() const {
+			return &(*it);
+		}
+
+		const_iterator &operator++() {
+			it++;
+			skipExhaustedQueues();
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+			const_iterator copy(*this);
+			operator++();
+			return copy;
+		}
+
+		bool operator==(const const_iterator &other) const {
+			return priorityClass == other.priorityClass
+				&& (priorityClass < 0 || it == other.it);
+		}
+
+		bool operator!=(const const_iterator &other) const {
+			return !operator==(other);
+		}
+	};
+
+	typedef const_iterator iterator;
+
+private:
+	deque<GetWaiter> queues[PRIORITY_CLASSES];
+
+public:
+	static unsigned int getPriorityClass(const Options &options) {
+		if (options.priority < PRIORITY_CLASSES) {
+			return options.priority;
+		} else {
+			return PRIORITY_CLASSES - 1;
+		}
+	}
+
+	bool empty() const {
+		for (unsigned int i = 0; i < PRIORITY_CLASSES; i++) {
+			if (!queues[i].empty()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t size() const {
+		size_t result = 0;
+		for (unsigned int i = 0; i < PRIORITY_CLASSES; i++) {
+			result += queues[i].size();
+		}
+		return result;
+	}
+
+	void push_back(const GetWaiter &waiter) {
+		queues[getPriorityClass(*waiter.options)].push_back(waiter);
+	}
+
+	/** The waiter that is to be taken next. The waitlist must not be empty. */
+	GetWaiter &front() {
+		return getQueue(getHighestNonEmptyPriorityClass()).front();
+	}
+
+	void pop_front() {
+		getQueue(getHighestNonEmptyPriorityClass()).pop_front();
+	}
+
+	deque<GetWaiter> &getQueue(unsigned int priorityClass) {
+		assert(priorityClass < PRIORITY_CLASSES);
+		return queues[priorityClass];
+	}
+
+	/** Returns -1 if the waitlist is empty. */
+	int getHighestNonEmptyPriorityClass() const {
+		for (int i = PRIORITY_CLASSES - 1; i >= 0; i--) {
+			if (!queues[i].empty()) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	/** Returns -1 if the waitlist is empty. */
+	int getLowestNonEmptyPriorityClass() const {
+		for (unsigned int i = 0; i < PRIORITY_CLASSES; i++) {
+			if (!queues[i].empty()) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	/**
+	 * When the waiter that has been waiting for the longest time was
+	 * enqueued. Returns 0 if the waitlist is empty.
+	 */
+	unsigned long long getOldestEnqueueTime() const {
+		unsigned long long result = 0;
+		for (unsigned int i = 0; i < PRIORITY_CLASSES; i++) {
+			if (!queues[i].empty()
+			 && (result == 0 || queues[i].front().enqueueTime < result))
+			{
+				result = queues[i].front().enqueueTime;
+			}
+		}
+		return result;
+	}
+
+	const_iterator begin() const {
+		return const_iterator(this, PRIORITY_CLASSES - 1);
+	}
+
+	const_iterator end() const {
+		return const_iterator(this, -1);
+	}
+
+	void swap(GetWaitlist &other) {
+		for (unsigned int i = 0; i < PRIORITY_CLASSES; i++) {
+			queues[i].swap(other.queues[i]);
+		}
+	}
+};
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_GET_WAITLIST_H_ */
@@ -48,11 +48,14 @@
 #include <MemoryKit/palloc.h>
 #include <Hooks.h>
 #include <Utils.h>
+#include <Utils/SpeedMeter.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/BasicGroupInfo.h>
 #include <Core/ApplicationPool/Process.h>
+#include <Core/ApplicationPool/ProcessRoutingTable.h>
 #include <Core/ApplicationPool/Options.h>
+#include <Core/ApplicationPool/GetWaitlist.h>
 #include <Core/SpawningKit/Factory.h>
 #include <Core/SpawningKit/UserSwitchingRules.h>
 #include <Shared/ApplicationPoolApiKey.h>
@@ -77,6 +80,7 @@ public:
 	struct GetAction {
 		GetCallback callback;
 		SessionPtr session;
+		ExceptionPtr exception;
 	};
 
 	struct DisableWaiter {
@@ -99,6 +103,137 @@ public:
 			{ }
 	};
 
+	/** A virtual node on the consistent-hash ring. See `hashRing`. */
+	struct HashRingNode {
+		boost::uint32_t hash;
+		Process *process;
+
+		HashRingNode(boost::uint32_t _hash, Process *_process)
+			: hash(_hash),
+			  process(_process)
+			{ }
+
+		bool operator<(const HashRingNode &other) const {
+			return hash < other.hash;
+		}
+	};
+
+	/**
+	 * State of the predictive autoscaler, which is active when
+	 * `options.targetUtilization` is nonzero. See Group/Autoscaling.cpp.
+	 */
+	struct AutoscalerState {
+		/** Number of get() requests received so far. */
+		unsigned long long arrivals;
+		/** Samples `arrivals` in order to measure the arrival rate. */
+		SpeedMeter<unsigned long long, 8, 1000000, 60 * 1000000, 1000000> arrivalRateMeter;
+		/** Arrivals per second, or -1 if not yet known. */
+		double arrivalRate;
+		/** How fast `arrivalRate` changes, in arrivals per second per second. */
+		double arrivalRateTrend;
+		/** The arrival rate that we expect by the time a new process has been spawned. */
+		double predictedArrivalRate;
+		/** Moving average of the session durations in usec, or -1 if not yet known. */
+		double avgServiceTime;
+		/** Moving average of the process spawn times in usec, or -1 if not yet known. */
+		double avgSpawnTime;
+		unsigned long long lastUpdateTime;
+		/** The number of processes needed to stay at the target utilization. */
+		unsigned int desiredProcessCount;
+		/**
+		 * Since when there have been more enabled processes than desired, or 0
+		 * if there haven't. Used for scale down hysteresis.
+		 */
+		unsigned long long scaleDownPendingSince;
+
+		AutoscalerState()
+			: arrivals(0),
+			  arrivalRate(-1),
+			  arrivalRateTrend(0),
+			  predictedArrivalRate(-1),
+			  avgServiceTime(-1),
+			  avgSpawnTime(-1),
+			  lastUpdateTime(0),
+			  desiredProcessCount(0),
+			  scaleDownPendingSince(0)
+			{ }
+	};
+
+	/** Minimum interval at which the garbage collector updates the autoscaler. */
+	static const unsigned long long AUTOSCALER_UPDATE_INTERVAL = 5 * 1000000;
+	/**
+	 * How long the predicted demand must stay below the number of enabled
+	 * processes before the autoscaler shuts down idle processes.
+	 */
+	static const unsigned long long AUTOSCALER_SCALE_DOWN_DELAY = 30 * 1000000;
+	/**
+	 * How soon the garbage collector looks again for processes to offer an
+	 * out-of-band work idle window to, if there were due processes that
+	 * could not get one yet. See offerIdleOobwWindows().
+	 */
+	static const unsigned long long OOBW_IDLE_WINDOW_RETRY_INTERVAL = 1000000;
+
+	static const unsigned int QUEUE_TIME_HISTORY_SIZE = 256;
+
+	/**
+	 * Request queue time statistics, and the state of the queue delay
+	 * shedder which is active when `options.requestQueueTargetDelay` is
+	 * nonzero. See Group/RequestQueueing.cpp.
+	 */
+	struct RequestQueueState {
+		/**
+		 * Ring buffer containing how long (in usec) the most recent requests
+		 * waited for a session. Requests that didn't wait count as 0.
+		 */
+		unsigned int queueTimeHistory[QUEUE_TIME_HISTORY_SIZE];
+		unsigned long long queueTimeSamples;
+		/** Number of waiters rejected because they waited too long. */
+		unsigned long long shedCount;
+
+		RequestQueueState()
+			: queueTimeSamples(0),
+			  shedCount(0)
+			{ }
+	};
+
+	/**
+	 * How long the oldest waiter must stay over the target delay before
+	 * waiters that are over it are rejected.
+	 */
+	static const unsigned long long REQUEST_QUEUE_SHED_INTERVAL = 100000;
+
+	static const unsigned int SPAWN_PHASE_HISTOGRAM_BUCKETS = 16;
+
+	/**
+	 * Histogram of the times spent in one SpawningKit::SpawnPhase. Bucket i
+	 * counts the times of at most 2^i msec, except for the last bucket,
+	 * which counts all times that are longer than that.
+	 */
+	struct SpawnPhaseHistogram {
+		unsigned int buckets[SPAWN_PHASE_HISTOGRAM_BUCKETS];
+		unsigned long long count;
+		/** Sum of all recorded times, in usec. */
+		unsigned long long totalTime;
+		/** Longest recorded time, in usec. */
+		unsigned int maxTime;
+
+		SpawnPhaseHistogram()
+			: count(0),
+			  totalTime(0),
+			  maxTime(0)
+		{
+			memset(buckets, 0, sizeof(buckets));
+		}
+	};
+
+	/** Number of nodes per enabled process on the consistent-hash ring. */
+	static const unsigned int HASH_RING_VIRTUAL_NODES = 64;
+	/**
+	 * The "consistent-hash" routing policy skips processes with more than
+	 * this many times (in percent) the average number of sessions.
+	 */
+	static const unsigned int HASH_RING_LOAD_FACTOR = 125;
+
 	enum LifeStatus {
 		/** Up and operational. */
 		ALIVE,
@@ -140,6 +275,36 @@ public:
 	 *     if processesBeingSpawned > 0: m_spawning
 	 */
 	short processesBeingSpawned;
+	/**
+	 * The number of successors that are being spawned for outdated processes
+	 * during a rolling restart. Every process that is attached while this is
+	 * nonzero replaces one outdated process.
+	 */
+	unsigned short rollingRestartSuccessorsPending;
+	/**
+	 * The number of processes that the Pool's prespawn manifest asked for
+	 * after the Core was restarted. Counts as a lower process limit until
+	 * the spawn loop is done.
+	 */
+	unsigned short prespawnTarget;
+	/**
+	 * Time at which the most recently attached process has finished warming
+	 * up, as determined by `options.warmupTime`. Until then, `route()` takes
+	 * the warm-up weights of the processes into account.
+	 * Microseconds resolution.
+	 */
+	unsigned long long warmupEndTime;
+	/**
+	 * The earliest time at which the garbage collector may have work to do
+	 * for this group, as determined by the last garbage collection pass.
+	 * Until then, the garbage collector skips this group. 0 means that the
+	 * group must be examined during the next pass; set it to 0 whenever
+	 * something happens that may make work due earlier, such as attaching
+	 * a process or changing the relevant options. This works because
+	 * process and spawner expiry times only ever move forward.
+	 * Microseconds resolution.
+	 */
+	unsigned long long nextGarbageCollectionTime;
 	/**
 	 * A Group object progresses through a life.
 	 *
@@ -154,10 +319,11 @@ public:
 	 */
 	boost::atomic<boost::uint8_t> lifeStatus;
 	/**
-	 * Whether the spawner thread is currently working. Note that even
-	 * if it's working, it doesn't necessarily mean that processes are
-	 * being spawned (i.e. that processesBeingSpawned > 0). After the
-	 * thread is done spawning a process, it will attempt to attach
+	 * Whether any spawner threads are currently working. There may be up
+	 * to `options.spawnConcurrency` of them, each spawning one process at
+	 * a time. Note that even if they're working, it doesn't necessarily
+	 * mean that processes are being spawned (i.e. that processesBeingSpawned > 0).
+	 * After a thread is done spawning a process, it will attempt to attach
 	 * the newly-spawned process to the group. During that time it's not
 	 * technically spawning anything.
 	 */
@@ -174,10 +340,26 @@ public:
 	 */
 	bool m_restarting: 1;
 	bool alwaysRestartFileExists: 1;
+	/**
+	 * Whether `restartFileDir` is watched by the Pool's restart file watcher.
+	 * If so, needsRestart() only stats the restart files after the watcher
+	 * has set `restartFileChanged`, instead of every `options.statThrottleRate`
+	 * seconds.
+	 */
+	bool restartFileWatched: 1;
+	bool restartFileChanged: 1;
+	/**
+	 * Whether a successor is being spawned for a process that is being
+	 * recycled, because it went over `options.memoryLimit` or reached
+	 * `options.maxRequests`. The next process that is attached will
+	 * replace it.
+	 */
+	bool recycleSuccessorPending: 1;
 
-	/** Contains the spawn loop thread and the restarter thread. */
+	/** Contains the spawn loop threads and the restarter thread. */
 	dynamic_thread_group interruptableThreads;
 
+	string restartFileDir;
 	string restartFile;
 	string alwaysRestartFile;
 	ProcessPtr nullProcess;
@@ -190,6 +372,25 @@ public:
 	Callback shutdownCallback;
 	GroupPtr selfPointer;
 
+	AutoscalerState autoscaler;
+	RequestQueueState requestQueue;
+	SpawnPhaseHistogram spawnPhaseHistograms[SpawningKit::SPAWN_PHASE_COUNT];
+	/** Number of spawned processes that were attached to this group. */
+	unsigned long long spawnsSucceeded;
+	/** Number of spawn attempts that failed with an exception. */
+	unsigned long long spawnsFailed;
+	/**
+	 * The cgroup that this group's processes are placed in, or the empty
+	 * string if they stay in the Core's cgroup. See Group/Cgroups.cpp.
+	 * Immutable after construction.
+	 */
+	string cgroupPath;
+	/**
+	 * Memory usage of `cgroupPath` in KB, as measured by the analytics
+	 * collector. -1 if unknown.
+	 */
+	ssize_t cgroupMemoryUsage;
+
 
 	/****** Initialization and shutdown ******/
 
@@ -207,6 +408,8 @@ public:
 	static void _onSessionClose(Session *session);
 	OXT_FORCE_INLINE void onSessionInitiateFailure(Process *process, Session *session);
 	OXT_FORCE_INLINE void onSessionClose(Process *process, Session *session);
+	bool onSessionCloseUnlocked(Process *process, Session *session,
+		boost::container::vector<Callback> &postLockActions);
 
 	/****** Spawning and restarting ******/
 
@@ -214,17 +417,52 @@ public:
 		unsigned int restartsInitiated);
 	void spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner, const Options &options,
 		unsigned int restartsInitiated);
+	bool runSpawnLoopIteration(const SpawningKit::SpawnerPtr &spawner, const Options &options,
+		unsigned int restartsInitiated);
+	void finishSpawnLoop();
 	void finalizeRestart(GroupPtr self, Options oldOptions, Options newOptions,
 		RestartMethod method, SpawningKit::FactoryPtr spawningKitFactory,
 		unsigned int restartsInitiated, boost::container::vector<Callback> postLockActions);
+	bool shouldSpawnConcurrently() const;
+	void markAllProcessesOutdated();
+	void recordSpawnPhaseTimes(const ProcessPtr &process);
+	void inspectSpawnPhasesXml(std::ostream &stream) const;
+
+	/****** Autoscaling ******/
+
+	void recordRequestArrival(unsigned long long now);
+	void recordServiceTime(Session *session, unsigned long long now);
+	void recordSpawnTime(const ProcessPtr &process);
+	unsigned int calculateDesiredProcessCount() const;
+	void inspectAutoscalerXml(std::ostream &stream) const;
+
+	/****** Cgroups ******/
+
+	static string getCgroupName(const StaticString &groupName);
+	void placeInCgroup(pid_t pid, const Options &options);
+	void restrictCgroupCpus(const Options &options);
+	void removeCgroup();
+
+	/****** Request queueing ******/
+
+	void recordQueueTime(unsigned long long queueTime);
+	unsigned int getQueueTimePercentile(unsigned int percentile) const;
+	void inspectRequestQueueXml(std::ostream &stream) const;
 
 	/****** Process list management ******/
 
 	Process *findProcessWithStickySessionId(unsigned int id) const;
 	Process *findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const;
-	Process *findProcessWithLowestBusyness(const ProcessList &processes) const;
+	Process *findDisablingProcessWithLowestBusyness() const;
 	Process *findEnabledProcessWithLowestBusyness() const;
-
+	Process *findEnabledProcessByPowerOfTwoChoices() const;
+	Process *findEnabledProcessWithLowestWeightedResponseTime() const;
+	Process *findEnabledProcessWithLowestWarmupAdjustedLoad(unsigned long long now) const;
+	Process *findEnabledProcessByConsistentHash(boost::uint32_t hash) const;
+	Process *findEnabledProcessNotCollectingGarbage() const;
+	void rebuildHashRing();
+
+	void addProcessToRoutingTable(const ProcessPtr &process, ProcessRoutingTable &table);
 	void addProcessToList(const ProcessPtr &process, ProcessList &destination);
 	void removeProcessFromList(const ProcessPtr &process, ProcessList &source);
 	void removeFromDisableWaitlist(const ProcessPtr &p, DisableResult result,
@@ -232,6 +470,16 @@ public:
 	void clearDisableWaitlist(DisableResult result,
 		boost::container::vector<Callback> &postLockActions);
 	void enableAllDisablingProcesses(boost::container::vector<Callback> &postLockActions);
+	Process *findEnabledProcessToRecycle() const;
+	bool replacingRecycledProcess() const;
+	void recycleNextProcess(boost::container::vector<Callback> &postLockActions);
+	unsigned long getMaxRequests(const Process *process) const;
+	bool replaceProcessAtMaxRequests(Process *process,
+		boost::container::vector<Callback> &postLockActions);
+	Process *findEnabledOutdatedProcess() const;
+	unsigned int countOutdatedProcessesBeingReplaced() const;
+	void disableReplacedProcess(Process *process, bool spawnReplacement,
+		boost::container::vector<Callback> &postLockActions);
 
 	void startCheckingDetachedProcesses(bool immediately);
 	void detachedProcessesCheckerMain(GroupPtr self);
@@ -239,12 +487,18 @@ public:
 	/****** Out-of-band work ******/
 
 	bool oobwAllowed() const;
+	bool oobwDeferredByLoad() const;
 	bool shouldInitiateOobw(Process *process) const;
 	void maybeInitiateOobw(Process *process);
 	void lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result, GroupPtr self);
 	void initiateOobw(const ProcessPtr &process);
 	void spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process);
 	void initiateNextOobwRequest();
+	unsigned long long offerIdleOobwWindows(unsigned long long now);
+
+	/****** Health checking ******/
+
+	static void ejectedProcessDisabled(const ProcessPtr &process, DisableResult result);
 
 	/****** Internal utilities ******/
 
@@ -252,6 +506,9 @@ public:
 	static void interruptAndJoinAllThreads(GroupPtr self);
 	static void doCleanupSpawner(SpawningKit::SpawnerPtr spawner);
 
+	static RoutingPolicy parseRoutingPolicy(const StaticString &name);
+	static const char *getRoutingPolicyName(RoutingPolicy policy);
+
 	void resetOptions(const Options &newOptions, Options *destination = NULL);
 	void mergeOptions(const Options &other);
 
@@ -269,6 +526,8 @@ public:
 	Group *findOtherGroupWaitingForCapacity() const;
 	bool pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 		boost::container::vector<Callback> &postLockActions);
+	bool makeRoomInGetWaitlist(const Options &newOptions,
+		boost::container::vector<Callback> &postLockActions);
 	template<typename Lock> void assignSessionsToGetWaitersQuickly(Lock &lock);
 	void assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions);
 	bool testOverflowRequestQueue() const;
@@ -280,6 +539,8 @@ public:
 	void verifyInvariants() const;
 	void verifyExpensiveInvariants() const;
 	#ifndef NDEBUG
+		void verifyRoutingTableEntry(const ProcessPtr &process,
+			const ProcessRoutingTable &table) const;
 		bool verifyNoRequestsOnGetWaitlistAreRoutable() const;
 	#endif
 
@@ -346,6 +607,12 @@ public:
 	int disablingCount;
 	int disabledCount;
 	int nEnabledProcessesTotallyBusy;
+	/**
+	 * The total number of sessions of the enabled processes. Maintained
+	 * alongside `nEnabledProcessesTotallyBusy`, and used to bound the load
+	 * of the "consistent-hash" routing policy.
+	 */
+	unsigned int nEnabledProcessSessions;
 	ProcessList enabledProcesses;
 	ProcessList disablingProcesses;
 	ProcessList disabledProcesses;
@@ -360,11 +627,30 @@ public:
 	ProcessList detachedProcesses;
 
 	/**
-	 * A cache of the processes' busyness. It's in a compact structure
-	 * so that `findProcessWithLowestBusyness()` can work very quickly
-	 * when there are a large number of processes.
+	 * The routing state of `enabledProcesses` and `disablingProcesses`, in
+	 * the same order as those lists, so that routing and garbage collection
+	 * work very quickly when there are a large number of processes.
+	 * Maintained by addProcessToList() and removeProcessFromList(); the
+	 * Processes keep their own entries up to date. The busyness levels are
+	 * atomics stored inline in the table, so routing reads them from one
+	 * contiguous array instead of following a pointer per process.
+	 */
+	ProcessRoutingTable enabledProcessRoutingTable;
+	ProcessRoutingTable disablingProcessRoutingTable;
+
+	/**
+	 * The parsed version of `options.routingPolicy`. Updated by resetOptions().
+	 */
+	RoutingPolicy routingPolicy;
+
+	/**
+	 * The consistent-hash ring for the "consistent-hash" routing policy:
+	 * `HASH_RING_VIRTUAL_NODES` nodes per enabled process, sorted by hash,
+	 * so that a lookup is a binary search. It's rebuilt whenever the enabled
+	 * process list changes, but only when that routing policy is in use.
+	 * Empty otherwise.
 	 */
-	boost::container::vector<int> enabledProcessBusynessLevels;
+	boost::container::vector<HashRingNode> hashRing;
 
 	/**
 	 * get() requests for this group that cannot be immediately satisfied are
@@ -397,7 +683,7 @@ public:
 	 *    if getWaitlist is non-empty:
 	 *       !enabledProcesses.empty() || m_spawning || restarting() || poolAtFullCapacity()
 	 */
-	deque<GetWaiter> getWaitlist;
+	GetWaitlist getWaitlist;
 	/**
 	 * Disable() commands that couldn't finish immediately will put their callbacks
 	 * in this queue. Note that there may be multiple DisableWaiters pointing to the
@@ -429,6 +715,7 @@ public:
 	OXT_FORCE_INLINE LifeStatus getLifeStatus() const;
 
 	StaticString getName() const;
+	StaticString getKey() const;
 	const BasicGroupInfo &getInfo();
 	const ApiKey &getApiKey() const;
 
@@ -454,6 +741,33 @@ public:
 	bool shouldSpawnForGetAction() const;
 	bool allowSpawn() const;
 
+	/****** Cgroups ******/
+
+	static ssize_t readCgroupMemoryUsage(const string &path);
+
+	/****** Autoscaling ******/
+
+	void updateAutoscaler(unsigned long long now);
+	bool autoscalerWantsMoreProcesses() const;
+	Process *findIdleEnabledProcessToScaleDown() const;
+
+	/****** Health checking ******/
+
+	bool healthCheckingEnabled() const;
+	bool processUnresponsive(const Process *process, unsigned long long now) const;
+	unsigned int countEjectedProcesses() const;
+	bool ejectProcess(const ProcessPtr &process, unsigned long long now,
+		const char *reason, boost::container::vector<Callback> &postLockActions);
+	void readmitProcess(const ProcessPtr &process, unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
+	void healthCheckFinished(const ProcessPtr &process, bool healthy,
+		unsigned long long now, boost::container::vector<Callback> &postLockActions);
+
+	/****** Request queueing ******/
+
+	void shedDelayedGetWaiters(unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
+
 	/****** Process list management ******/
 
 	AttachResult attach(const ProcessPtr &process,
@@ -465,6 +779,8 @@ public:
 	void enable(const ProcessPtr &process,
 		boost::container::vector<Callback> &postLockActions);
 	DisableResult disable(const ProcessPtr &process, const DisableCallback &callback);
+	void recycleProcessesOverMemoryLimit(boost::container::vector<Callback> &postLockActions);
+	void replaceOutdatedProcesses(boost::container::vector<Callback> &postLockActions);
 
 	/****** State inspection ******/
 
@@ -490,6 +806,48 @@ public:
 	bool authorizeByApiKey(const ApiKey &key) const;
 };
 
+/**
+ * A copy of the parts of a Group's state that the state inspection
+ * functions show, including snapshots of all its processes. See
+ * ProcessSnapshot.
+ */
+struct GroupSnapshot {
+	string name;
+	string appRoot;
+	string appType;
+	string environment;
+	const char *routingPolicy;
+	string uuid;
+	unsigned int enabledCount;
+	unsigned int disablingCount;
+	unsigned int disabledCount;
+	unsigned int capacityUsed;
+	ssize_t cgroupMemoryUsage;
+	unsigned int getWaitlistSize;
+	unsigned int disableWaitlistSize;
+	unsigned int processesBeingSpawned;
+	bool spawning;
+	bool restarting;
+	Group::LifeStatus lifeStatus;
+	ApiKey apiKey;
+	string user;
+	uid_t uid;
+	string group;
+	gid_t gid;
+	/** These parts are small and rendered while taking the snapshot. */
+	string optionsXml;
+	string autoscalerXml;
+	string requestQueueXml;
+	string spawnPhasesXml;
+	/** Enabled, disabling, disabled and detached processes, in that order. */
+	vector<ProcessSnapshot> processes;
+	/** Filled in by Pool::takeSnapshot(). */
+	unsigned int fairCapacityShare;
+
+	GroupSnapshot(const Group &group);
+	void inspectXml(std::ostream &stream, bool includeSecrets = true) const;
+};
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
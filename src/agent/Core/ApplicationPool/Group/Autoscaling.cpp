@@ -0,0 +1,215 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+#include <cmath>
+
+/*************************************************************************
+ *
+ * Predictive autoscaling functions for ApplicationPool2::Group
+ *
+ * When `options.targetUtilization` is nonzero, the Group measures the
+ * request arrival rate and the average service time, and uses Little's
+ * law to calculate how many processes it needs to keep them busy for
+ * the target percentage of the time. The arrival rate is extrapolated
+ * over the average spawn time using its recent trend, so that processes
+ * are spawned before a ramp up has filled the get wait list.
+ *
+ * Scaling up happens through shouldSpawn(). Scaling down is done by the
+ * garbage collector (Pool::autoscaleProcessesInGroup()), and only after
+ * the predicted demand has been lower than the number of processes for
+ * AUTOSCALER_SCALE_DOWN_DELAY.
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+void
+Group::recordRequestArrival(unsigned long long now) {
+	if (now == 0) {
+		now = SystemTime::getUsec();
+	}
+	autoscaler.arrivals++;
+	updateAutoscaler(now);
+}
+
+void
+Group::recordServiceTime(Session *session, unsigned long long now) {
+	if (session->startTime != 0 && now >= session->startTime) {
+		autoscaler.avgServiceTime = expMovingAverage(autoscaler.avgServiceTime,
+			now - session->startTime, 0.1);
+	}
+}
+
+void
+Group::recordSpawnTime(const ProcessPtr &process) {
+	if (process->getSpawnEndTime() > process->getSpawnStartTime()) {
+		autoscaler.avgSpawnTime = expMovingAverage(autoscaler.avgSpawnTime,
+			process->getSpawnEndTime() - process->getSpawnStartTime(), 0.3);
+	}
+}
+
+/**
+ * Calculates the number of processes needed to serve the predicted arrival
+ * rate at the target utilization. Returns 0 if that is not known yet, or if
+ * the processes can handle an unlimited number of concurrent requests.
+ */
+unsigned int
+Group::calculateDesiredProcessCount() const {
+	if (options.targetUtilization == 0
+	 || autoscaler.predictedArrivalRate < 0
+	 || autoscaler.avgServiceTime < 0)
+	{
+		return 0;
+	}
+
+	int concurrency = enabledProcesses.empty()
+		? 1
+		: enabledProcesses.front()->getConcurrency();
+	if (concurrency == 0) {
+		return 0;
+	}
+
+	// By Little's law, the average number of requests being served at the same
+	// time is the arrival rate times the average time it takes to serve one.
+	double load = autoscaler.predictedArrivalRate * autoscaler.avgServiceTime / 1000000.0;
+	double utilization = std::min(options.targetUtilization, 100u) / 100.0;
+	double count = ceil(load / (concurrency * utilization));
+
+	if (options.maxProcesses > 0 && count > options.maxProcesses) {
+		return options.maxProcesses;
+	} else {
+		return (unsigned int) count;
+	}
+}
+
+void
+Group::inspectAutoscalerXml(std::ostream &stream) const {
+	stream << "<autoscaler>";
+	stream << "<target_utilization>" << options.targetUtilization << "</target_utilization>";
+	if (autoscaler.arrivalRate >= 0) {
+		stream << "<arrival_rate>" << autoscaler.arrivalRate << "</arrival_rate>";
+		stream << "<arrival_rate_trend>" << autoscaler.arrivalRateTrend << "</arrival_rate_trend>";
+		stream << "<predicted_arrival_rate>" << autoscaler.predictedArrivalRate << "</predicted_arrival_rate>";
+	}
+	if (autoscaler.avgServiceTime >= 0) {
+		stream << "<avg_service_time>" << (unsigned long long) autoscaler.avgServiceTime << "</avg_service_time>";
+	}
+	if (autoscaler.avgSpawnTime >= 0) {
+		stream << "<avg_spawn_time>" << (unsigned long long) autoscaler.avgSpawnTime << "</avg_spawn_time>";
+	}
+	stream << "<desired_process_count>" << autoscaler.desiredProcessCount << "</desired_process_count>";
+	if (autoscaler.scaleDownPendingSince != 0) {
+		stream << "<scale_down_pending_since>" << autoscaler.scaleDownPendingSince << "</scale_down_pending_since>";
+	}
+	stream << "</autoscaler>";
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Samples the number of arrivals and recalculates the desired number of
+ * processes. Does nothing if the last sample was taken less than a second
+ * ago, so this is cheap enough to call on every get().
+ */
+void
+Group::updateAutoscaler(unsigned long long now) {
+	if (!autoscaler.arrivalRateMeter.addSample(autoscaler.arrivals, now)) {
+		return;
+	}
+
+	double rate = autoscaler.arrivalRateMeter.currentSpeed();
+	if (rate == (double) SpeedMeter<unsigned long long>::unknownSpeed() || rate < 0) {
+		return;
+	}
+
+	if (autoscaler.arrivalRate >= 0 && now > autoscaler.lastUpdateTime) {
+		double slope = (rate - autoscaler.arrivalRate)
+			/ ((now - autoscaler.lastUpdateTime) / 1000000.0);
+		autoscaler.arrivalRateTrend = 0.7 * autoscaler.arrivalRateTrend + 0.3 * slope;
+	}
+	autoscaler.arrivalRate = rate;
+	autoscaler.lastUpdateTime = now;
+
+	// Only a rising trend is extrapolated: scaling down is already delayed
+	// by the hysteresis, so there's no point in anticipating it.
+	double horizon = std::max(autoscaler.avgSpawnTime, 0.0) / 1000000.0;
+	autoscaler.predictedArrivalRate = rate
+		+ std::max(autoscaler.arrivalRateTrend, 0.0) * horizon;
+	autoscaler.desiredProcessCount = calculateDesiredProcessCount();
+}
+
+/**
+ * Whether the autoscaler predicts that more processes are needed than
+ * there are enabled or being spawned.
+ */
+bool
+Group::autoscalerWantsMoreProcesses() const {
+	return options.targetUtilization > 0
+		&& autoscaler.desiredProcessCount
+			> (unsigned int) (enabledCount + processesBeingSpawned);
+}
+
+/**
+ * Returns the enabled process without sessions that has been idle
+ * the longest, or NULL if there is none.
+ */
+Process *
+Group::findIdleEnabledProcessToScaleDown() const {
+	Process *result = NULL;
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		if (process->sessions == 0
+		 && (result == NULL || process->lastUsed < result->lastUsed))
+		{
+			result = process;
+		}
+	}
+	return result;
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -0,0 +1,214 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+#include <Utils/Hasher.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+/*************************************************************************
+ *
+ * Cgroup placement functions for ApplicationPool2::Group
+ *
+ * When the pool has an application cgroup root (a cgroup directory that
+ * has been delegated to the Core, see Pool::setAppCgroupRoot()), each
+ * Group gets a child cgroup of its own, and every process that it spawns
+ * is moved into it. Processes that the application forks inherit the
+ * cgroup. That allows the analytics collector to read the real memory
+ * usage of the whole application, including page cache and memory that
+ * is shared between processes, instead of summing the processes' RSS.
+ *
+ * If the group has a CPU affinity policy and the cpuset controller is
+ * enabled for the cgroup, the cgroup is also restricted to the CPUs that
+ * the policy may place processes on, so that processes that the app
+ * forks can't escape to the Core's CPUs either.
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+/**
+ * Returns a cgroup directory name for the given group name. Group names
+ * can contain slashes and spaces, so those characters are replaced. A
+ * hash of the full name is appended to keep the result unique.
+ */
+string
+Group::getCgroupName(const StaticString &groupName) {
+	string result;
+	JenkinsHash hash;
+	char suffix[16];
+
+	result.reserve(std::min<size_t>(groupName.size(), 64) + sizeof(suffix));
+	for (size_t i = 0; i < groupName.size() && i < 64; i++) {
+		char ch = groupName[i];
+		if (isalnum((unsigned char) ch) || ch == '-' || ch == '_' || ch == '.') {
+			result.append(1, ch);
+		} else {
+			result.append(1, '_');
+		}
+	}
+
+	hash.update(groupName.data(), groupName.size());
+	snprintf(suffix, sizeof(suffix), "-%08x", (unsigned int) hash.finalize());
+	result.append(suffix);
+	return result;
+}
+
+/**
+ * Moves the given process into this Group's cgroup, creating the cgroup
+ * if necessary. Called from the spawn thread, without holding the lock.
+ * Failures are logged, but otherwise ignored: the process then simply
+ * stays in the Core's cgroup.
+ */
+void
+Group::placeInCgroup(pid_t pid, const Options &options) {
+	TRACE_POINT();
+	string procsPath = cgroupPath + "/cgroup.procs";
+	string pidString = toString(pid);
+	int fd, e;
+
+	if (mkdir(cgroupPath.c_str(), 0755) == -1 && errno != EEXIST) {
+		e = errno;
+		P_WARN_RATE_LIMITED(60, "Cannot create cgroup " << cgroupPath << ": " <<
+			strerror(e) << " (errno=" << e << ")");
+		return;
+	}
+	if (SpawningKit::parseCpuAffinityPolicy(options.cpuAffinity) != SpawningKit::CPU_AFFINITY_NONE) {
+		restrictCgroupCpus(options);
+	}
+
+	fd = syscalls::open(procsPath.c_str(), O_WRONLY);
+	if (fd == -1) {
+		e = errno;
+		P_WARN_RATE_LIMITED(60, "Cannot open " << procsPath << ": " <<
+			strerror(e) << " (errno=" << e << ")");
+		return;
+	}
+
+	FdGuard guard(fd, __FILE__, __LINE__);
+	if (syscalls::write(fd, pidString.data(), pidString.size()) == -1) {
+		e = errno;
+		P_WARN_RATE_LIMITED(60, "Cannot move process " << pid << " into cgroup " <<
+			cgroupPath << ": " << strerror(e) << " (errno=" << e << ")");
+	}
+}
+
+/**
+ * Writes the CPUs that the CPU affinity policy may place processes on to
+ * the cgroup's cpuset. Does nothing if the cpuset controller isn't enabled
+ * for the cgroup.
+ */
+void
+Group::restrictCgroupCpus(const Options &options) {
+	string path = cgroupPath + "/cpuset.cpus";
+	string cpus = SpawningKit::formatCpuList(SpawningKit::getAllowedCpus(
+		SpawningKit::CpuTopology::detect(), getContext()->getSpawningKitConfig()->coreCpus));
+	int fd, e;
+
+	if (cpus.empty()) {
+		return;
+	}
+	fd = syscalls::open(path.c_str(), O_WRONLY);
+	if (fd == -1) {
+		e = errno;
+		if (e != ENOENT) {
+			P_WARN_RATE_LIMITED(60, "Cannot open " << path << ": " <<
+				strerror(e) << " (errno=" << e << ")");
+		}
+		return;
+	}
+
+	FdGuard guard(fd, __FILE__, __LINE__);
+	if (syscalls::write(fd, cpus.data(), cpus.size()) == -1) {
+		e = errno;
+		P_WARN_RATE_LIMITED(60, "Cannot restrict cgroup " << cgroupPath <<
+			" to CPUs " << cpus << ": " << strerror(e) << " (errno=" << e << ")");
+	}
+}
+
+/**
+ * Removes this Group's cgroup. That only succeeds once all of its processes
+ * have exited. If it fails, the cgroup is reused when a Group with the same
+ * name is created later.
+ */
+void
+Group::removeCgroup() {
+	if (!cgroupPath.empty()) {
+		rmdir(cgroupPath.c_str());
+	}
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Reads the memory usage of the given cgroup, in KB. Supports both cgroup
+ * v2 (memory.current) and v1 (memory.usage_in_bytes). Returns -1 if the
+ * memory usage cannot be read.
+ */
+ssize_t
+Group::readCgroupMemoryUsage(const string &path) {
+	string contents;
+	try {
+		contents = readAll(path + "/memory.current");
+	} catch (const SystemException &) {
+		try {
+			contents = readAll(path + "/memory.usage_in_bytes");
+		} catch (const SystemException &) {
+			return -1;
+		}
+	}
+
+	char *end;
+	long long usage = strtoll(contents.c_str(), &end, 10);
+	if (end == contents.c_str() || usage < 0) {
+		return -1;
+	} else {
+		return usage / 1024;
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -0,0 +1,205 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+
+/*************************************************************************
+ *
+ * Health checking functions for ApplicationPool2::Group
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+// The number of health checks in a row that an enabled process must fail
+// before it's ejected.
+static const unsigned int HEALTH_CHECK_FAILURE_THRESHOLD = 2;
+// The number of times in a row that a process may be ejected. A process that
+// becomes unhealthy again after that is detached and replaced.
+static const unsigned int MAX_CONSECUTIVE_EJECTIONS = 3;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+void
+Group::ejectedProcessDisabled(const ProcessPtr &process, DisableResult result) {
+	// Nothing to do: ejected processes stay disabled until
+	// Pool::realCheckHealth() readmits them.
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+bool
+Group::healthCheckingEnabled() const {
+	return !options.healthCheckPath.empty() || options.unresponsiveProcessTimeout > 0;
+}
+
+/**
+ * Passive health check: whether the given process has had sessions open for
+ * longer than `options.unresponsiveProcessTimeout` without finishing any.
+ */
+bool
+Group::processUnresponsive(const Process *process, unsigned long long now) const {
+	return options.unresponsiveProcessTimeout > 0
+		&& process->sessions > 0
+		&& now > process->lastProgressTime
+			+ (unsigned long long) options.unresponsiveProcessTimeout * 1000000;
+}
+
+unsigned int
+Group::countEjectedProcesses() const {
+	unsigned int result = 0;
+	ProcessList::const_iterator it, end = disablingProcesses.end();
+	for (it = disablingProcesses.begin(); it != end; it++) {
+		if ((*it)->ejectedUntil != 0) {
+			result++;
+		}
+	}
+	end = disabledProcesses.end();
+	for (it = disabledProcesses.begin(); it != end; it++) {
+		if ((*it)->ejectedUntil != 0) {
+			result++;
+		}
+	}
+	return result;
+}
+
+/**
+ * Takes an unhealthy process out of routing until `ejectedUntil`, by disabling
+ * it. If this is the sole enabled process then disable() spawns a replacement
+ * first. Calling this on a process that is already ejected extends its ejection.
+ *
+ * To avoid ejecting a whole group because of a problem that isn't specific to
+ * a few processes, at most half of the processes are ejected at the same time.
+ * A process that was already ejected `MAX_CONSECUTIVE_EJECTIONS` times in a
+ * row is detached instead, so that it gets replaced.
+ *
+ * Returns whether the process is no longer routable. Be sure to fix up the
+ * invariants afterwards.
+ */
+bool
+Group::ejectProcess(const ProcessPtr &process, unsigned long long now,
+	const char *reason, boost::container::vector<Callback> &postLockActions)
+{
+	if (process->consecutiveEjections >= MAX_CONSECUTIVE_EJECTIONS) {
+		P_WARN("Process " << process->inspect() << " is " << reason <<
+			", and has already been ejected " << process->consecutiveEjections <<
+			" times in a row. Detaching it from the pool.");
+		pool->detachProcessUnlocked(process, postLockActions);
+		return true;
+	}
+
+	if (process->ejectedUntil == 0) {
+		unsigned int ejected = countEjectedProcesses();
+		if (ejected > 0 && (ejected + 1) * 2 > (unsigned int) enabledCount + ejected) {
+			P_DEBUG("Process " << process->inspect() << " is " << reason <<
+				", but it's not ejected because half of the group's " <<
+				"processes are already ejected");
+			return false;
+		}
+		if (disable(process, ejectedProcessDisabled) == DR_ERROR) {
+			return false;
+		}
+	}
+
+	process->consecutiveEjections++;
+	process->ejectionCount++;
+	process->healthCheckFailures = 0;
+	process->ejectedUntil = now + (unsigned long long) options.healthCheckEjectionTime
+		* 1000000 * process->consecutiveEjections;
+	P_WARN("Process " << process->inspect() << " is " << reason <<
+		". Ejecting it for " << options.healthCheckEjectionTime *
+		process->consecutiveEjections << " seconds.");
+	return true;
+}
+
+/**
+ * Lets an ejected process serve requests again. This function fixes the
+ * getWaitlist invariants.
+ */
+void
+Group::readmitProcess(const ProcessPtr &process, unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	P_NOTICE("Readmitting process " << process->inspect() <<
+		", which was ejected because it was unhealthy");
+	process->ejectedUntil = 0;
+	process->healthCheckFailures = 0;
+	process->processedAtReadmission = process->processed;
+	process->lastProgressTime = now;
+	enable(process, postLockActions);
+	assignSessionsToGetWaiters(postLockActions);
+}
+
+/**
+ * Called by Pool::realCheckHealth() with the outcome of an active health check.
+ * An ejected process is readmitted if it passed, and ejected for longer if it
+ * failed. An enabled process is ejected after failing
+ * `HEALTH_CHECK_FAILURE_THRESHOLD` checks in a row.
+ */
+void
+Group::healthCheckFinished(const ProcessPtr &process, bool healthy,
+	unsigned long long now, boost::container::vector<Callback> &postLockActions)
+{
+	if (process->enabled == Process::ENABLED) {
+		if (healthy) {
+			process->healthCheckFailures = 0;
+			process->consecutiveEjections = 0;
+		} else {
+			process->healthCheckFailures++;
+			P_DEBUG("Process " << process->inspect() << " failed a health check (" <<
+				process->healthCheckFailures << " in a row)");
+			if (process->healthCheckFailures >= HEALTH_CHECK_FAILURE_THRESHOLD) {
+				ejectProcess(process, now, "failing health checks", postLockActions);
+			}
+		}
+	} else if (process->ejectedUntil != 0) {
+		if (healthy) {
+			readmitProcess(process, now, postLockActions);
+		} else {
+			ejectProcess(process, now, "still failing health checks", postLockActions);
+		}
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -100,34 +100,50 @@ Group::Group(Pool *_pool, const Options &_options)
 	: pool(_pool),
 	  uuid(generateUuid(_pool))
 {
+	string key;
+
 	info.context = _pool->getContext();
 	info.group   = this;
 	info.name    = _options.getAppGroupName().toString();
+	info.key     = _options.getGroupKey(key).toString();
 	info.apiKey  = generateApiKey(_pool);
 	resetOptions(_options);
 	enabledCount   = 0;
 	disablingCount = 0;
 	disabledCount  = 0;
 	nEnabledProcessesTotallyBusy = 0;
+	nEnabledProcessSessions = 0;
 	spawner        = getContext()->getSpawningKitFactory()->create(options);
 	restartsInitiated = 0;
 	processesBeingSpawned = 0;
+	spawnsSucceeded = 0;
+	spawnsFailed = 0;
+	cgroupMemoryUsage = -1;
+	if (!_pool->appCgroupRoot.empty()) {
+		cgroupPath = _pool->appCgroupRoot + "/" + getCgroupName(info.name);
+	}
+	rollingRestartSuccessorsPending = 0;
+	prespawnTarget = 0;
+	warmupEndTime = 0;
+	nextGarbageCollectionTime = 0;
 	m_spawning     = false;
 	m_restarting   = false;
 	lifeStatus.store(ALIVE, boost::memory_order_relaxed);
 	lastRestartFileMtime = 0;
 	lastRestartFileCheckTime = 0;
 	alwaysRestartFileExists = false;
+	restartFileWatched = false;
+	restartFileChanged = false;
+	recycleSuccessorPending = false;
 	if (options.restartDir.empty()) {
-		restartFile = options.appRoot + "/tmp/restart.txt";
-		alwaysRestartFile = options.appRoot + "/tmp/always_restart.txt";
+		restartFileDir = options.appRoot + "/tmp";
 	} else if (options.restartDir[0] == '/') {
-		restartFile = options.restartDir + "/restart.txt";
-		alwaysRestartFile = options.restartDir + "/always_restart.txt";
+		restartFileDir = options.restartDir;
 	} else {
-		restartFile = options.appRoot + "/" + options.restartDir + "/restart.txt";
-		alwaysRestartFile = options.appRoot + "/" + options.restartDir + "/always_restart.txt";
+		restartFileDir = options.appRoot + "/" + options.restartDir;
 	}
+	restartFile = restartFileDir + "/restart.txt";
+	alwaysRestartFile = restartFileDir + "/always_restart.txt";
 
 	detachedProcessesCheckerActive = false;
 }
@@ -140,6 +156,7 @@ Group::~Group() {
 	assert(lifeStatus == SHUT_DOWN);
 	assert(!detachedProcessesCheckerActive);
 	assert(getWaitlist.empty());
+	removeCgroup();
 }
 
 bool
@@ -67,10 +67,44 @@ Group::doCleanupSpawner(SpawningKit::SpawnerPtr spawner) {
  * Persists options into this Group. Called at creation time and at restart time.
  * Values will be persisted into `destination`. Or if it's NULL, into `this->options`.
  */
+RoutingPolicy
+Group::parseRoutingPolicy(const StaticString &name) {
+	if (name == P_STATIC_STRING("p2c")) {
+		return RP_P2C;
+	} else if (name == P_STATIC_STRING("ewma")) {
+		return RP_EWMA;
+	} else if (name == P_STATIC_STRING("consistent-hash")) {
+		return RP_CONSISTENT_HASH;
+	} else {
+		if (!name.empty() && name != P_STATIC_STRING("least-busy")) {
+			P_WARN("Unknown routing policy '" << name << "', using 'least-busy'");
+		}
+		return RP_LEAST_BUSY;
+	}
+}
+
+const char *
+Group::getRoutingPolicyName(RoutingPolicy policy) {
+	switch (policy) {
+	case RP_LEAST_BUSY:
+		return "least-busy";
+	case RP_P2C:
+		return "p2c";
+	case RP_EWMA:
+		return "ewma";
+	case RP_CONSISTENT_HASH:
+		return "consistent-hash";
+	default:
+		return "unknown";
+	}
+}
+
 void
 Group::resetOptions(const Options &newOptions, Options *destination) {
 	if (destination == NULL) {
 		destination = &this->options;
+		routingPolicy = parseRoutingPolicy(newOptions.routingPolicy);
+		rebuildHashRing();
 	}
 	*destination = newOptions;
 	destination->persist(newOptions);
@@ -84,10 +118,31 @@ Group::resetOptions(const Options &newOptions, Options *destination) {
  */
 void
 Group::mergeOptions(const Options &other) {
+	if (options.minProcesses != other.minProcesses
+	 || options.targetUtilization != other.targetUtilization
+	 || options.maxPreloaderIdleTime != other.maxPreloaderIdleTime)
+	{
+		nextGarbageCollectionTime = 0;
+	}
 	options.maxRequests      = other.maxRequests;
 	options.minProcesses     = other.minProcesses;
+	options.targetUtilization = other.targetUtilization;
+	options.capacityWeight = other.capacityWeight;
+	options.memoryLimit = other.memoryLimit;
+	options.recycleJitter = other.recycleJitter;
+	options.warmupTime = other.warmupTime;
+	options.rollingRestart = other.rollingRestart;
+	options.rollingRestartBatchSize = other.rollingRestartBatchSize;
+	options.requestQueueTargetDelay = other.requestQueueTargetDelay;
 	options.statThrottleRate = other.statThrottleRate;
 	options.maxPreloaderIdleTime = other.maxPreloaderIdleTime;
+	options.maxOutOfBandWorkPercentage = other.maxOutOfBandWorkPercentage;
+	options.outOfBandWorkMaxUtilization = other.outOfBandWorkMaxUtilization;
+	options.outOfBandWorkIdleInterval = other.outOfBandWorkIdleInterval;
+	options.healthCheckInterval = other.healthCheckInterval;
+	options.healthCheckTimeout = other.healthCheckTimeout;
+	options.unresponsiveProcessTimeout = other.unresponsiveProcessTimeout;
+	options.healthCheckEjectionTime = other.healthCheckEjectionTime;
 }
 
 /* Given a hook name like "queue_full_error", we return HookScriptOptions filled in with this name and a spec
@@ -218,13 +273,16 @@ bool
 Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 	boost::container::vector<Callback> &postLockActions)
 {
+	if (options.requestQueueTargetDelay > 0) {
+		shedDelayedGetWaiters(SystemTime::getUsec(), postLockActions);
+	}
+
 	if (OXT_LIKELY(!testOverflowRequestQueue()
 		&& (newOptions.maxRequestQueueSize == 0
-		    || getWaitlist.size() < newOptions.maxRequestQueueSize)))
+		    || getWaitlist.size() < newOptions.maxRequestQueueSize
+		    || makeRoomInGetWaitlist(newOptions, postLockActions))))
 	{
-		getWaitlist.push_back(GetWaiter(
-			newOptions.copyAndPersist().detachFromUnionStationTransaction(),
-			callback));
+		getWaitlist.push_back(GetWaiter(newOptions, callback));
 		return true;
 	} else {
 		postLockActions.push_back(boost::bind(GetCallback::call,
@@ -240,6 +298,37 @@ Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 	}
 }
 
+/**
+ * Called when the get wait list is full. Makes room for a waiter with the
+ * given options by removing cancelled waiters or, failing that, by rejecting
+ * the newest waiter of the lowest priority class if that class is lower than
+ * that of the new waiter. Returns whether there is room now.
+ */
+bool
+Group::makeRoomInGetWaitlist(const Options &newOptions,
+	boost::container::vector<Callback> &postLockActions)
+{
+	Pool::removeCancelledGetWaiters(getWaitlist, postLockActions);
+	if (getWaitlist.size() < newOptions.maxRequestQueueSize) {
+		return true;
+	}
+
+	int lowestPriorityClass = getWaitlist.getLowestNonEmptyPriorityClass();
+	if (lowestPriorityClass >= 0
+	 && (unsigned int) lowestPriorityClass < GetWaitlist::getPriorityClass(newOptions))
+	{
+		deque<GetWaiter> &queue = getWaitlist.getQueue(lowestPriorityClass);
+		P_DEBUG("Request queue of group " << info.name << " is full; rejecting a "
+			"waiting request with priority " << lowestPriorityClass <<
+			" in favor of a request with priority " << newOptions.priority);
+		postLockActions.push_back(boost::bind(GetCallback::call,
+			queue.back().callback, SessionPtr(),
+			boost::make_shared<RequestQueueFullException>(newOptions.maxRequestQueueSize)));
+		queue.pop_back();
+	}
+	return getWaitlist.size() < newOptions.maxRequestQueueSize;
+}
+
 template<typename Lock>
 void
 Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
@@ -250,24 +339,42 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	}
 
 	SmallVector<GetAction, 8> actions;
-	unsigned int i = 0;
+	boost::container::vector<Callback> shedActions;
+	unsigned long long now = SystemTime::getUsec();
 	bool done = false;
 
+	shedDelayedGetWaiters(now, shedActions);
 	actions.reserve(getWaitlist.size());
 
-	while (!done && i < getWaitlist.size()) {
-		const GetWaiter &waiter = getWaitlist[i];
-		RouteResult result = route(waiter.options);
-		if (result.process != NULL) {
-			GetAction action;
-			action.callback = waiter.callback;
-			action.session  = newSession(result.process);
-			getWaitlist.erase(getWaitlist.begin() + i);
-			actions.push_back(action);
-		} else {
-			done = result.finished;
-			if (!result.finished) {
-				i++;
+	for (int p = GetWaitlist::PRIORITY_CLASSES - 1; p >= 0 && !done; p--) {
+		deque<GetWaiter> &queue = getWaitlist.getQueue(p);
+		unsigned int i = 0;
+
+		while (!done && i < queue.size()) {
+			const GetWaiter &waiter = queue[i];
+			if (waiter.callback.cancelled()) {
+				GetAction action;
+				action.callback  = waiter.callback;
+				action.exception = boost::make_shared<GetAbortedException>(
+					"The request was cancelled while waiting for a process");
+				queue.erase(queue.begin() + i);
+				actions.push_back(action);
+				continue;
+			}
+
+			RouteResult result = route(*waiter.options);
+			if (result.process != NULL) {
+				GetAction action;
+				action.callback = waiter.callback;
+				action.session  = newSession(result.process, now);
+				recordQueueTime(now > waiter.enqueueTime ? now - waiter.enqueueTime : 0);
+				queue.erase(queue.begin() + i);
+				actions.push_back(action);
+			} else {
+				done = result.finished;
+				if (!result.finished) {
+					i++;
+				}
 			}
 		}
 	}
@@ -276,29 +383,50 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	lock.unlock();
 	SmallVector<GetAction, 50>::const_iterator it, end = actions.end();
 	for (it = actions.begin(); it != end; it++) {
-		it->callback(it->session, ExceptionPtr());
+		it->callback(it->session, it->exception);
 	}
+	runAllActions(shedActions);
 }
 
+/**
+ * Routes waiters to processes in order of priority, and within the same
+ * priority in order of arrival. Only the waiters at the front of each
+ * priority class are looked at, except for sticky session waiters whose
+ * process is busy: those are skipped.
+ */
 void
 Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions) {
-	unsigned int i = 0;
+	unsigned long long now = SystemTime::getUsec();
 	bool done = false;
 
-	while (!done && i < getWaitlist.size()) {
-		const GetWaiter &waiter = getWaitlist[i];
-		RouteResult result = route(waiter.options);
-		if (result.process != NULL) {
-			postLockActions.push_back(boost::bind(
-				GetCallback::call,
-				waiter.callback,
-				newSession(result.process),
-				ExceptionPtr()));
-			getWaitlist.erase(getWaitlist.begin() + i);
-		} else {
-			done = result.finished;
-			if (!result.finished) {
-				i++;
+	shedDelayedGetWaiters(now, postLockActions);
+
+	for (int p = GetWaitlist::PRIORITY_CLASSES - 1; p >= 0 && !done; p--) {
+		deque<GetWaiter> &queue = getWaitlist.getQueue(p);
+		unsigned int i = 0;
+
+		while (!done && i < queue.size()) {
+			const GetWaiter &waiter = queue[i];
+			if (waiter.callback.cancelled()) {
+				Pool::rejectCancelledGetWaiter(waiter, postLockActions);
+				queue.erase(queue.begin() + i);
+				continue;
+			}
+
+			RouteResult result = route(*waiter.options);
+			if (result.process != NULL) {
+				postLockActions.push_back(boost::bind(
+					GetCallback::call,
+					waiter.callback,
+					newSession(result.process, now),
+					ExceptionPtr()));
+				recordQueueTime(now > waiter.enqueueTime ? now - waiter.enqueueTime : 0);
+				queue.erase(queue.begin() + i);
+			} else {
+				done = result.finished;
+				if (!result.finished) {
+					i++;
+				}
 			}
 		}
 	}
@@ -321,7 +449,7 @@ Group::callAbortLongRunningConnectionsCallback(const ProcessPtr &process) {
 	Pool::AbortLongRunningConnectionsCallback callback =
 		getPool()->abortLongRunningConnectionsCallback;
 	if (callback != NULL) {
-		callback(process);
+		callback(process, true);
 	}
 }
 
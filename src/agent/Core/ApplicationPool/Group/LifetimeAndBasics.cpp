@@ -64,6 +64,11 @@ Group::getName() const {
 	return info.name;
 }
 
+StaticString
+Group::getKey() const {
+	return info.key;
+}
+
 const BasicGroupInfo &
 Group::getInfo() {
 	return info;
@@ -46,6 +46,21 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * Returns the duration of the out-of-band work in microseconds, as reported
+ * in an OOBW response of the form "oobw done <usec>". Returns 0 if the
+ * response does not include it.
+ */
+static unsigned long long
+parseOobwResponseDuration(const StaticString &response) {
+	StaticString prefix = P_STATIC_STRING("oobw done ");
+	if (startsWith(response, prefix)) {
+		return stringToULL(response.substr(prefix.size()));
+	} else {
+		return 0;
+	}
+}
+
 /** Returns whether it is allowed to perform a new OOBW in this group. */
 bool
 Group::oobwAllowed() const {
@@ -60,7 +75,41 @@ Group::oobwAllowed() const {
 			oobwInstances += 1;
 		}
 	}
-	return oobwInstances < options.maxOutOfBandWorkInstances;
+	unsigned int maxInstances = options.maxOutOfBandWorkInstances;
+	if (options.maxOutOfBandWorkPercentage > 0) {
+		maxInstances = std::max(maxInstances,
+			(unsigned int) getProcessCount() * options.maxOutOfBandWorkPercentage / 100);
+	}
+	return oobwInstances < maxInstances;
+}
+
+/**
+ * Returns whether new out-of-band work should be postponed because this
+ * group is under load: taking a process out of rotation then makes queueing
+ * worse. That is the case while there are queued requests, or while the
+ * utilization of the enabled processes is above
+ * `options.outOfBandWorkMaxUtilization`. Processes with unlimited
+ * concurrency count as fully utilized while they have any sessions.
+ */
+bool
+Group::oobwDeferredByLoad() const {
+	if (!getWaitlist.empty()) {
+		return true;
+	}
+	if (options.outOfBandWorkMaxUtilization == 0 || enabledCount == 0) {
+		return false;
+	}
+
+	double utilization = 0;
+	foreach (const ProcessPtr &process, enabledProcesses) {
+		int concurrency = process->getConcurrency();
+		if (concurrency == 0) {
+			utilization += (process->sessions > 0) ? 1 : 0;
+		} else {
+			utilization += std::min(1.0, process->sessions / (double) concurrency);
+		}
+	}
+	return utilization * 100 > (double) options.outOfBandWorkMaxUtilization * enabledCount;
 }
 
 /** Returns whether a new OOBW should be initiated for this process. */
@@ -75,6 +124,11 @@ Group::shouldInitiateOobw(Process *process) const {
 void
 Group::maybeInitiateOobw(Process *process) {
 	if (shouldInitiateOobw(process)) {
+		if (oobwDeferredByLoad()) {
+			P_TRACE(2, "Deferring out-of-band work for process " << process->inspect() <<
+				" because group " << info.name << " is under load");
+			return;
+		}
 		// We keep an extra reference to prevent premature destruction.
 		ProcessPtr p = process->shared_from_this();
 		initiateOobw(p);
@@ -161,6 +215,7 @@ Group::initiateOobw(const ProcessPtr &process) {
 	assert(process->sessions == 0);
 
 	P_DEBUG("Initiating OOBW request for process " << process->inspect());
+	process->lastOobwStartTime = SystemTime::getUsec();
 	interruptableThreads.create_thread(
 		boost::bind(&Group::spawnThreadOOBWRequest, this, shared_from_this(), process),
 		"OOBW request thread for process " + process->inspect(),
@@ -214,6 +269,7 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 
 	UPDATE_TRACE_POINT();
 	unsigned long long timeout = 1000 * 1000 * 60; // 1 min
+	unsigned long long reportedDuration = 0;
 	try {
 		boost::this_thread::restore_interruption ri(di);
 		boost::this_thread::restore_syscall_interruption rsi(dsi);
@@ -246,9 +302,18 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 
 		gatheredWrite(connection.fd, &data[0], data.size(), &timeout);
 
-		// We do not care what the actual response is ... just wait for it.
+		// The response is "oobw done", optionally followed by how long the
+		// out-of-band work took in microseconds. It's small enough to arrive
+		// in a single read.
 		UPDATE_TRACE_POINT();
 		waitUntilReadable(connection.fd, &timeout);
+		char response[64];
+		ssize_t ret = syscalls::read(connection.fd, response, sizeof(response));
+		if (ret == -1) {
+			int e = errno;
+			throw SystemException("Cannot read OOBW response", e);
+		}
+		reportedDuration = parseOobwResponseDuration(StaticString(response, ret));
 	} catch (const SystemException &e) {
 		P_ERROR("*** ERROR: " << e.what() << "\n" << e.backtrace());
 	} catch (const TimeoutException &e) {
@@ -266,6 +331,11 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 		}
 
 		process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+		process->lastOobwEndTime = SystemTime::getUsec();
+		if (reportedDuration != 0) {
+			process->lastOobwDuration = reportedDuration;
+		}
+		process->oobwCount++;
 		if (process->enabled == Process::DISABLED) {
 			enable(process, actions);
 			assignSessionsToGetWaiters(actions);
@@ -288,6 +358,10 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 
 void
 Group::initiateNextOobwRequest() {
+	if (oobwDeferredByLoad()) {
+		return;
+	}
+
 	ProcessList::const_iterator it, end = enabledProcesses.end();
 	for (it = enabledProcesses.begin(); it != end; it++) {
 		const ProcessPtr &process = *it;
@@ -301,6 +375,79 @@ Group::initiateNextOobwRequest() {
 }
 
 
+/**
+ * Gives idle processes out-of-band work without them having requested it,
+ * if `options.outOfBandWorkIdleInterval` is set. A process is due for
+ * such an "idle window" once that interval has passed since it was spawned
+ * or since its last out-of-band work ended.
+ *
+ * A due process is only given one while the group is not under load, while
+ * another enabled process remains to serve requests, and once the process
+ * has been idle for at least as long as its previous out-of-band work took
+ * according to itself: a process that has been idle for that long will
+ * likely remain unneeded until the work is done.
+ *
+ * Returns the time at which this should be called again, or 0 if idle
+ * windows are disabled.
+ */
+unsigned long long
+Group::offerIdleOobwWindows(unsigned long long now) {
+	if (options.outOfBandWorkIdleInterval == 0) {
+		return 0;
+	}
+
+	unsigned long long interval = options.outOfBandWorkIdleInterval * 1000000ull;
+	unsigned long long nextCheckTime = now + interval;
+	ProcessList candidates;
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		const ProcessPtr &process = *it;
+		if (process->oobwStatus != Process::OOBW_NOT_ACTIVE) {
+			continue;
+		}
+
+		unsigned long long dueTime = std::max(process->lastOobwEndTime,
+			process->getSpawnEndTime()) + interval;
+		if (now < dueTime) {
+			nextCheckTime = std::min(nextCheckTime, dueTime);
+		} else if (process->sessions == 0
+			&& now >= process->lastUsed + process->lastOobwDuration)
+		{
+			candidates.push_back(process);
+		} else {
+			nextCheckTime = std::min(nextCheckTime, now + OOBW_IDLE_WINDOW_RETRY_INTERVAL);
+		}
+	}
+
+	// Initiating out-of-band work disables the process, which modifies
+	// enabledProcesses, so we do that in a separate pass.
+	end = candidates.end();
+	for (it = candidates.begin(); it != end; it++) {
+		const ProcessPtr &process = *it;
+		if (enabledCount <= 1 || oobwDeferredByLoad()) {
+			nextCheckTime = std::min(nextCheckTime, now + OOBW_IDLE_WINDOW_RETRY_INTERVAL);
+			break;
+		}
+
+		process->oobwStatus = Process::OOBW_REQUESTED;
+		if (!shouldInitiateOobw(process.get())) {
+			// Too many processes are performing out-of-band work already.
+			// We don't leave the request pending, because by the time that
+			// it can be served, the process may not be idle anymore.
+			process->oobwStatus = Process::OOBW_NOT_ACTIVE;
+			nextCheckTime = std::min(nextCheckTime, now + OOBW_IDLE_WINDOW_RETRY_INTERVAL);
+			break;
+		}
+		P_DEBUG("Offering out-of-band work idle window to process " << process->inspect());
+		process->oobwRequestTime = now;
+		initiateOobw(process);
+	}
+
+	return nextCheckTime;
+}
+
+
 /****************************
  *
  * Public methods
@@ -316,6 +463,7 @@ Group::requestOOBW(const ProcessPtr &process) {
 	boost::unique_lock<boost::mutex> lock(pool->syncher);
 	if (isAlive() && process->isAlive() && process->oobwStatus == Process::OOBW_NOT_ACTIVE) {
 		process->oobwStatus = Process::OOBW_REQUESTED;
+		process->oobwRequestTime = SystemTime::getUsec();
 	}
 }
 
@@ -47,82 +47,279 @@ using namespace boost;
 
 Process *
 Group::findProcessWithStickySessionId(unsigned int id) const {
-	ProcessList::const_iterator it, end = enabledProcesses.end();
-	for (it = enabledProcesses.begin(); it != end; it++) {
-		Process *process = it->get();
-		if (process->getStickySessionId() == id) {
-			return process;
-		}
+	int index = enabledProcessRoutingTable.findStickySessionId(id);
+	if (index == -1) {
+		return NULL;
+	} else {
+		return enabledProcesses[index].get();
 	}
-	return NULL;
 }
 
 Process *
 Group::findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const {
-	int leastBusyProcessIndex = -1;
-	int lowestBusyness = 0;
-	unsigned int i, size = enabledProcessBusynessLevels.size();
-	const int *enabledProcessBusynessLevels = &this->enabledProcessBusynessLevels[0];
+	int index = enabledProcessRoutingTable.findStickySessionId(id);
+	if (index == -1) {
+		index = enabledProcessRoutingTable.findLowestBusyness();
+	}
+	if (index == -1) {
+		return NULL;
+	} else {
+		return enabledProcesses[index].get();
+	}
+}
+
+Process *
+Group::findDisablingProcessWithLowestBusyness() const {
+	int index = disablingProcessRoutingTable.findLowestBusyness();
+	if (index == -1) {
+		return NULL;
+	} else {
+		return disablingProcesses[index].get();
+	}
+}
+
+/**
+ * The routing policy for the common case.
+ *
+ * This is called for every routed request while holding the pool lock, so
+ * it only scans the busyness array of `enabledProcessRoutingTable`, using
+ * relaxed loads of its atomics, and stops as soon as it encounters an idle process: a busyness of 0 is the
+ * lowest possible value, and because ties are resolved in favor of the
+ * earliest process, stopping there yields the same result as a full scan.
+ */
+Process *
+Group::findEnabledProcessWithLowestBusyness() const {
+	int index = enabledProcessRoutingTable.findLowestBusyness();
+	if (index == -1) {
+		return NULL;
+	} else {
+		return enabledProcesses[index].get();
+	}
+}
+
+/**
+ * Implements the "p2c" routing policy: samples two distinct enabled processes
+ * at random and returns the less busy one. If both samples are totally busy
+ * then we fall back to scanning all enabled processes, so that we never
+ * report the group as totally busy while a process still has capacity.
+ */
+Process *
+Group::findEnabledProcessByPowerOfTwoChoices() const {
+	const ProcessRoutingTable &table = enabledProcessRoutingTable;
+	unsigned int size = table.size();
+	if (size <= 2) {
+		return findEnabledProcessWithLowestBusyness();
+	}
+
+	unsigned int i = (unsigned int) rand() % size;
+	unsigned int j = (unsigned int) rand() % (size - 1);
+	if (j >= i) {
+		j++;
+	}
+	if (table.getBusyness(j) < table.getBusyness(i)) {
+		std::swap(i, j);
+	}
+
+	if (table.routable[i]) {
+		return enabledProcesses[i].get();
+	} else {
+		return findEnabledProcessWithLowestBusyness();
+	}
+}
+
+/**
+ * Implements the "ewma" routing policy: returns the enabled process, that is
+ * not totally busy, with the lowest `(sessions + 1) * avgResponseTime`.
+ * Processes that haven't finished any requests yet have no response time
+ * average and are preferred, so that new processes warm up quickly.
+ * Returns a totally busy process only if all enabled processes are totally busy.
+ */
+Process *
+Group::findEnabledProcessWithLowestWeightedResponseTime() const {
+	Process *bestProcess = NULL;
+	double lowestScore = 0;
+	unsigned int i, size = enabledProcessRoutingTable.size();
+	const boost::uint8_t *routable = enabledProcessRoutingTable.routable.data();
 
 	for (i = 0; i < size; i++) {
+		if (!routable[i]) {
+			continue;
+		}
+
 		Process *process = enabledProcesses[i].get();
-		if (process->getStickySessionId() == id) {
-			return process;
-		} else if (leastBusyProcessIndex == -1 || enabledProcessBusynessLevels[i] < lowestBusyness) {
-			leastBusyProcessIndex = i;
-			lowestBusyness = enabledProcessBusynessLevels[i];
+		double score;
+		if (process->avgResponseTime < 0) {
+			score = process->sessions;
+		} else {
+			score = (process->sessions + 1) * process->avgResponseTime;
+		}
+		if (bestProcess == NULL || score < lowestScore) {
+			bestProcess = process;
+			lowestScore = score;
 		}
 	}
 
-	if (leastBusyProcessIndex == -1) {
-		return NULL;
+	if (bestProcess == NULL) {
+		return findEnabledProcessWithLowestBusyness();
 	} else {
-		return enabledProcesses[leastBusyProcessIndex].get();
+		return bestProcess;
 	}
 }
 
+/**
+ * Used by route() while processes are warming up (see `options.warmupTime`).
+ * Returns the enabled process, that is not totally busy, with the lowest
+ * `(sessions + 1) / weight`. A process's weight grows linearly from
+ * `minWeight` right after it was spawned, to 1 once it has been alive
+ * for `options.warmupTime` seconds. This way a warming up process gets a
+ * ramped share of the traffic relative to the warm processes.
+ * Returns a totally busy process only if all enabled processes are totally busy.
+ */
 Process *
-Group::findProcessWithLowestBusyness(const ProcessList &processes) const {
-	if (processes.empty()) {
-		return NULL;
-	}
+Group::findEnabledProcessWithLowestWarmupAdjustedLoad(unsigned long long now) const {
+	const double minWeight = 0.05;
+	Process *bestProcess = NULL;
+	double lowestLoad = 0;
+	double warmupTime = options.warmupTime * 1000000.0;
+	unsigned int i, size = enabledProcessRoutingTable.size();
+	const boost::uint8_t *routable = enabledProcessRoutingTable.routable.data();
 
-	int lowestBusyness = -1;
-	Process *leastBusyProcess = NULL;
-	ProcessList::const_iterator it;
-	ProcessList::const_iterator end = processes.end();
-	for (it = processes.begin(); it != end; it++) {
-		Process *process = (*it).get();
-		int busyness = process->busyness();
-		if (lowestBusyness == -1 || lowestBusyness > busyness) {
-			lowestBusyness = busyness;
-			leastBusyProcess = process;
+	for (i = 0; i < size; i++) {
+		if (!routable[i]) {
+			continue;
+		}
+
+		Process *process = enabledProcesses[i].get();
+		unsigned long long spawnEndTime = process->getSpawnEndTime();
+		double weight = 1;
+		if (now < spawnEndTime + (unsigned long long) warmupTime) {
+			if (now > spawnEndTime) {
+				weight = (now - spawnEndTime) / warmupTime;
+			} else {
+				weight = 0;
+			}
+			weight = std::max(weight, minWeight);
+		}
+
+		double load = (process->sessions + 1) / weight;
+		if (bestProcess == NULL || load < lowestLoad) {
+			bestProcess = process;
+			lowestLoad = load;
 		}
 	}
-	return leastBusyProcess;
+
+	if (bestProcess == NULL) {
+		return findEnabledProcessWithLowestBusyness();
+	} else {
+		return bestProcess;
+	}
 }
 
 /**
- * Cache-optimized version of findProcessWithLowestBusyness() for the common case.
+ * Implements the "consistent-hash" routing policy: returns the first process
+ * at or after `hash` on the hash ring that is not totally busy, skipping
+ * processes that have more than `HASH_RING_LOAD_FACTOR` percent of the
+ * average number of sessions, so that a popular key can't overload a single
+ * process. Keys keep mapping to the same process as long as it's enabled and
+ * not overloaded, while adding or removing a process only remaps the keys
+ * of its neighbors on the ring.
+ *
+ * Returns a totally busy process only if all enabled processes are totally busy.
  */
 Process *
-Group::findEnabledProcessWithLowestBusyness() const {
-	if (enabledProcesses.empty()) {
-		return NULL;
+Group::findEnabledProcessByConsistentHash(boost::uint32_t hash) const {
+	if (hashRing.empty()) {
+		return findEnabledProcessWithLowestBusyness();
+	}
+
+	unsigned int divisor = 100 * enabledCount;
+	unsigned int maxSessions = ((nEnabledProcessSessions + 1) * HASH_RING_LOAD_FACTOR
+		+ divisor - 1) / divisor;
+	boost::container::vector<HashRingNode>::const_iterator begin = hashRing.begin(),
+		end = hashRing.end(), it;
+	it = std::lower_bound(begin, end, HashRingNode(hash, NULL));
+
+	for (unsigned int i = 0; i < hashRing.size(); i++, it++) {
+		if (it == end) {
+			it = begin;
+		}
+		Process *process = it->process;
+		if (process->sessions < (int) maxSessions && process->canBeRoutedTo()) {
+			return process;
+		}
 	}
+	return findEnabledProcessWithLowestBusyness();
+}
 
-	int leastBusyProcessIndex = -1;
+/**
+ * Used by route() when the process picked by the routing policy is collecting
+ * garbage. Returns the enabled process, that is neither totally busy nor
+ * collecting garbage, with the lowest busyness. Returns NULL if there is none.
+ */
+Process *
+Group::findEnabledProcessNotCollectingGarbage() const {
+	const ProcessRoutingTable &table = enabledProcessRoutingTable;
+	Process *leastBusyProcess = NULL;
 	int lowestBusyness = 0;
-	unsigned int i, size = enabledProcessBusynessLevels.size();
-	const int *enabledProcessBusynessLevels = &this->enabledProcessBusynessLevels[0];
+	unsigned int i, size = table.size();
 
 	for (i = 0; i < size; i++) {
-		if (leastBusyProcessIndex == -1 || enabledProcessBusynessLevels[i] < lowestBusyness) {
-			leastBusyProcessIndex = i;
-			lowestBusyness = enabledProcessBusynessLevels[i];
+		if (!table.routable[i]) {
+			continue;
+		}
+
+		int busyness = table.getBusyness(i);
+		if (leastBusyProcess != NULL && busyness >= lowestBusyness) {
+			continue;
+		}
+
+		Process *process = enabledProcesses[i].get();
+		if (!process->isCollectingGarbage()) {
+			leastBusyProcess = process;
+			lowestBusyness = busyness;
 		}
 	}
-	return enabledProcesses[leastBusyProcessIndex].get();
+	return leastBusyProcess;
+}
+
+/**
+ * Rebuilds `hashRing` from `enabledProcesses`. The virtual nodes of a process
+ * are derived from its GUPID, so that its position on the ring doesn't depend
+ * on which other processes exist.
+ */
+void
+Group::rebuildHashRing() {
+	hashRing.clear();
+	if (routingPolicy != RP_CONSISTENT_HASH) {
+		hashRing.shrink_to_fit();
+		return;
+	}
+
+	hashRing.reserve(enabledProcesses.size() * HASH_RING_VIRTUAL_NODES);
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		StaticString gupid = process->getGupid();
+		for (unsigned int i = 0; i < HASH_RING_VIRTUAL_NODES; i++) {
+			Hasher h;
+			h.update(gupid.data(), gupid.size());
+			h.update((const char *) &i, sizeof(i));
+			hashRing.push_back(HashRingNode(h.finalize(), process));
+		}
+	}
+	std::sort(hashRing.begin(), hashRing.end());
+}
+
+/**
+ * Appends an entry for the given process, which must have just been appended
+ * to the process list that `table` belongs to.
+ */
+void
+Group::addProcessToRoutingTable(const ProcessPtr &process, ProcessRoutingTable &table) {
+	assert(table.size() == process->getIndex());
+	table.add(process->getStickySessionId(), process->busyness(),
+		process->canBeRoutedTo(), process->lastUsed);
+	process->setRoutingTable(&table);
 }
 
 /**
@@ -138,13 +335,17 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 	if (&destination == &enabledProcesses) {
 		process->enabled = Process::ENABLED;
 		enabledCount++;
-		enabledProcessBusynessLevels.push_back(process->busyness());
+		nextGarbageCollectionTime = 0;
+		addProcessToRoutingTable(process, enabledProcessRoutingTable);
+		nEnabledProcessSessions += process->sessions;
 		if (process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy++;
 		}
+		rebuildHashRing();
 	} else if (&destination == &disablingProcesses) {
 		process->enabled = Process::DISABLING;
 		disablingCount++;
+		addProcessToRoutingTable(process, disablingProcessRoutingTable);
 	} else if (&destination == &disabledProcesses) {
 		assert(process->sessions == 0);
 		process->enabled = Process::DISABLED;
@@ -174,12 +375,17 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 	ProcessPtr p = process; // Keep an extra reference count just in case.
 
 	source.erase(source.begin() + process->getIndex());
+	if (process->getRoutingTable() != NULL) {
+		process->getRoutingTable()->remove(process->getIndex());
+		process->setRoutingTable(NULL);
+	}
 	process->setIndex(-1);
 
 	switch (process->enabled) {
 	case Process::ENABLED:
 		assert(&source == &enabledProcesses);
 		enabledCount--;
+		nEnabledProcessSessions -= process->sessions;
 		if (process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy--;
 		}
@@ -207,14 +413,8 @@ Group::removeProcessFromList(const ProcessPtr &process, ProcessList &source) {
 		process->setIndex(i);
 	}
 
-	// Rebuild enabledProcessBusynessLevels
 	if (&source == &enabledProcesses) {
-		enabledProcessBusynessLevels.clear();
-		for (it = source.begin(); it != end; it++, i++) {
-			const ProcessPtr &process = *it;
-			enabledProcessBusynessLevels.push_back(process->busyness());
-		}
-		enabledProcessBusynessLevels.shrink_to_fit();
+		rebuildHashRing();
 	}
 }
 
@@ -387,6 +587,175 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 	}
 }
 
+/**
+ * Returns an enabled process that is waiting to be recycled, because it went
+ * over the memory limit or reached its maximum number of requests.
+ */
+Process *
+Group::findEnabledProcessToRecycle() const {
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		if (process->overMemoryLimit || process->reachedMaxRequests) {
+			return process;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Whether a process that is being recycled is currently being replaced:
+ * either its successor is being spawned, or it is being disabled.
+ */
+bool
+Group::replacingRecycledProcess() const {
+	if (recycleSuccessorPending) {
+		return true;
+	}
+
+	ProcessList::const_iterator it, end = disablingProcesses.end();
+	for (it = disablingProcesses.begin(); it != end; it++) {
+		if ((*it)->overMemoryLimit || (*it)->reachedMaxRequests) {
+			return true;
+		}
+	}
+	end = disabledProcesses.end();
+	for (it = disabledProcesses.begin(); it != end; it++) {
+		if ((*it)->overMemoryLimit || (*it)->reachedMaxRequests) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Replaces the next process that is waiting to be recycled, unless another
+ * one is already being replaced, without lowering capacity: a successor is
+ * spawned first, and the old process is only disabled after the successor
+ * has been attached. If the upper process limits have been reached then
+ * there's no room for a successor, so the old process is disabled right away
+ * and replaced after it has been detached.
+ */
+void
+Group::recycleNextProcess(boost::container::vector<Callback> &postLockActions) {
+	if (recycleSuccessorPending && !m_spawning) {
+		// Spawning the successor failed. Try again.
+		recycleSuccessorPending = false;
+	}
+	if (restarting() || replacingRecycledProcess()) {
+		return;
+	}
+
+	Process *process = findEnabledProcessToRecycle();
+	if (process == NULL) {
+		return;
+	} else if (allowSpawn()) {
+		P_DEBUG("Spawning a successor for process " << process->inspect());
+		recycleSuccessorPending = true;
+		spawn();
+	} else if (enabledCount > 1) {
+		disableReplacedProcess(process, true, postLockActions);
+	}
+	// Otherwise this is the sole process and it cannot be replaced
+	// until spawning is allowed again.
+}
+
+/**
+ * The number of requests after which the given process is recycled:
+ * `options.maxRequests`, lowered by the process's `recycleThreshold`.
+ */
+unsigned long
+Group::getMaxRequests(const Process *process) const {
+	unsigned long long result = (unsigned long long) options.maxRequests
+		* process->recycleThreshold / 100;
+	return std::max<unsigned long>(result, 1);
+}
+
+/**
+ * Called when the given process has reached its maximum number of requests.
+ * If it can be replaced without lowering capacity, then it's marked so that
+ * `recycleNextProcess()` spawns its successor before shutting it down, and it
+ * keeps serving requests in the meantime. Returns whether that's the case;
+ * if not, the caller should detach the process right away.
+ */
+bool
+Group::replaceProcessAtMaxRequests(Process *process,
+	boost::container::vector<Callback> &postLockActions)
+{
+	if (process->reachedMaxRequests && process->enabled != Process::ENABLED) {
+		// Already being replaced. Shutting it down is now up to
+		// `Pool::detachReplacedProcess()`.
+		return true;
+	} else if (process->enabled != Process::ENABLED || restarting()
+		|| (enabledCount == 1 && !allowSpawn()))
+	{
+		return false;
+	}
+
+	if (!process->reachedMaxRequests) {
+		P_DEBUG("Process " << process->inspect() <<
+			" has reached its maximum number of requests (" <<
+			getMaxRequests(process) << "); replacing it");
+		process->reachedMaxRequests = true;
+	}
+	recycleNextProcess(postLockActions);
+	return true;
+}
+
+/**
+ * Gracefully disables the given process, which is being replaced because it
+ * is being recycled or because of a rolling restart. Once its sessions have
+ * finished, `Pool::detachReplacedProcess()` detaches it.
+ */
+void
+Group::disableReplacedProcess(Process *process, bool spawnReplacement,
+	boost::container::vector<Callback> &postLockActions)
+{
+	ProcessPtr processPtr = process->shared_from_this();
+	DisableResult result = disable(processPtr,
+		boost::bind(&Pool::detachReplacedProcess, pool, _1, _2,
+			spawnReplacement));
+	if (result == DR_SUCCESS || result == DR_NOOP) {
+		postLockActions.push_back(boost::bind(&Pool::detachReplacedProcess,
+			pool, processPtr, result, spawnReplacement));
+	}
+}
+
+Process *
+Group::findEnabledOutdatedProcess() const {
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		if (process->outdated) {
+			return process;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the number of outdated processes that are currently being replaced
+ * during a rolling restart: those whose successor is being spawned, plus those
+ * that are being disabled.
+ */
+unsigned int
+Group::countOutdatedProcessesBeingReplaced() const {
+	unsigned int result = rollingRestartSuccessorsPending;
+	ProcessList::const_iterator it, end = disablingProcesses.end();
+	for (it = disablingProcesses.begin(); it != end; it++) {
+		if ((*it)->outdated) {
+			result++;
+		}
+	}
+	end = disabledProcesses.end();
+	for (it = disabledProcesses.begin(); it != end; it++) {
+		if ((*it)->outdated) {
+			result++;
+		}
+	}
+	return result;
+}
+
 
 /****************************
  *
@@ -423,6 +792,10 @@ Group::attach(const ProcessPtr &process,
 	}
 
 	P_DEBUG("Attaching process " << process->inspect());
+	if (options.recycleJitter > 0) {
+		process->recycleThreshold = 100 - (unsigned int) rand()
+			% (std::min(options.recycleJitter, 99u) + 1);
+	}
 	addProcessToList(process, enabledProcesses);
 
 	/* Now that there are enough resources, relevant processes in
@@ -453,6 +826,36 @@ Group::attach(const ProcessPtr &process,
 	}
 	disableWaitlist = newDisableWaitlist;
 
+	if (recycleSuccessorPending) {
+		recycleSuccessorPending = false;
+		Process *oldProcess = findEnabledProcessToRecycle();
+		if (oldProcess != NULL) {
+			P_INFO("Process " << process->inspect() << " is ready to replace process " <<
+				oldProcess->inspect() << ", which " << (oldProcess->overMemoryLimit
+					? "went over the memory limit"
+					: "reached its maximum number of requests"));
+			disableReplacedProcess(oldProcess, false, postLockActions);
+		}
+	} else if (rollingRestartSuccessorsPending > 0) {
+		rollingRestartSuccessorsPending--;
+		Process *oldProcess = findEnabledOutdatedProcess();
+		if (oldProcess != NULL) {
+			P_DEBUG("Process " << process->inspect() << " is ready to replace " <<
+				"outdated process " << oldProcess->inspect());
+			disableReplacedProcess(oldProcess, false, postLockActions);
+		}
+	}
+	if (findEnabledOutdatedProcess() != NULL) {
+		// There is one more enabled process now, so it may be possible
+		// to replace more outdated processes.
+		replaceOutdatedProcesses(postLockActions);
+	}
+
+	if (options.warmupTime > 0) {
+		warmupEndTime = std::max(warmupEndTime,
+			process->getSpawnEndTime() + options.warmupTime * 1000000ull);
+	}
+
 	// Update GC sleep timer.
 	wakeUpGarbageCollector();
 
@@ -512,9 +915,11 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	P_DEBUG("Detaching all processes in group " << info.name);
 
 	foreach (ProcessPtr process, enabledProcesses) {
+		process->setRoutingTable(NULL);
 		addProcessToList(process, detachedProcesses);
 	}
 	foreach (ProcessPtr process, disablingProcesses) {
+		process->setRoutingTable(NULL);
 		addProcessToList(process, detachedProcesses);
 	}
 	foreach (ProcessPtr process, disabledProcesses) {
@@ -524,11 +929,14 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	enabledProcesses.clear();
 	disablingProcesses.clear();
 	disabledProcesses.clear();
-	enabledProcessBusynessLevels.clear();
+	enabledProcessRoutingTable.clear();
+	disablingProcessRoutingTable.clear();
+	hashRing.clear();
 	enabledCount = 0;
 	disablingCount = 0;
 	disabledCount = 0;
 	nEnabledProcessesTotallyBusy = 0;
+	nEnabledProcessSessions = 0;
 	clearDisableWaitlist(DR_NOOP, postLockActions);
 	startCheckingDetachedProcesses(false);
 }
@@ -613,6 +1021,35 @@ Group::disable(const ProcessPtr &process, const DisableCallback &callback) {
 	}
 }
 
+/**
+ * Called after process metrics have been collected. Marks enabled processes
+ * that use more than `options.memoryLimit` (lowered by their
+ * `recycleThreshold`), and replaces them one at a time with
+ * `recycleNextProcess()`.
+ */
+void
+Group::recycleProcessesOverMemoryLimit(boost::container::vector<Callback> &postLockActions) {
+	if (options.memoryLimit == 0 || restarting()) {
+		return;
+	}
+
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		Process *process = it->get();
+		// ProcessMetrics::realMemory() is in KB.
+		size_t limit = (size_t) options.memoryLimit * 1024
+			* process->recycleThreshold / 100;
+		if (!process->overMemoryLimit && process->metrics.realMemory() > limit) {
+			P_NOTICE("Process " << process->inspect() << " is using " <<
+				process->metrics.realMemory() / 1024 << " MB of memory, which is more " <<
+				"than its limit of " << limit / 1024 << " MB. Replacing it.");
+			process->overMemoryLimit = true;
+		}
+	}
+
+	recycleNextProcess(postLockActions);
+}
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
@@ -0,0 +1,159 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Group.h>
+#include <algorithm>
+
+/*************************************************************************
+ *
+ * Request queueing functions for ApplicationPool2::Group
+ *
+ * The Group keeps track of how long requests wait for a session, so that
+ * the queue time percentiles can be inspected.
+ *
+ * When `options.requestQueueTargetDelay` is nonzero, waiters are also
+ * shed in the manner of CoDel: a queue that only briefly goes over the
+ * target delay is left alone, but once its oldest waiter has been over
+ * the target for REQUEST_QUEUE_SHED_INTERVAL, all waiters that are over
+ * it are rejected with a RequestQueueFullException. Their clients then
+ * get a quick error response instead of one that comes long after they
+ * have given up. This happens whenever waiters are added or served, and
+ * from the garbage collector.
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+void
+Group::recordQueueTime(unsigned long long queueTime) {
+	if (queueTime > (unsigned int) -1) {
+		queueTime = (unsigned int) -1;
+	}
+	requestQueue.queueTimeHistory[requestQueue.queueTimeSamples % QUEUE_TIME_HISTORY_SIZE] =
+		(unsigned int) queueTime;
+	requestQueue.queueTimeSamples++;
+}
+
+/**
+ * Returns the given percentile of the recent queue times, in usec.
+ */
+unsigned int
+Group::getQueueTimePercentile(unsigned int percentile) const {
+	unsigned int samples[QUEUE_TIME_HISTORY_SIZE];
+	unsigned int count = QUEUE_TIME_HISTORY_SIZE;
+	if (requestQueue.queueTimeSamples < count) {
+		count = (unsigned int) requestQueue.queueTimeSamples;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	unsigned int index = (count - 1) * percentile / 100;
+
+	std::copy(requestQueue.queueTimeHistory, requestQueue.queueTimeHistory + count, samples);
+	std::nth_element(samples, samples + index, samples + count);
+	return samples[index];
+}
+
+void
+Group::inspectRequestQueueXml(std::ostream &stream) const {
+	stream << "<request_queue>";
+	stream << "<target_delay>" << options.requestQueueTargetDelay << "</target_delay>";
+	stream << "<shed>" << requestQueue.shedCount << "</shed>";
+	if (requestQueue.queueTimeSamples > 0) {
+		stream << "<queue_time_p50>" << getQueueTimePercentile(50) << "</queue_time_p50>";
+		stream << "<queue_time_p90>" << getQueueTimePercentile(90) << "</queue_time_p90>";
+		stream << "<queue_time_p99>" << getQueueTimePercentile(99) << "</queue_time_p99>";
+	}
+	stream << "</request_queue>";
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Rejects the waiters that waited for longer than the target delay,
+ * provided that the queue has been over it for a while. A no-op if
+ * `options.requestQueueTargetDelay` is zero.
+ */
+void
+Group::shedDelayedGetWaiters(unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	if (options.requestQueueTargetDelay == 0) {
+		return;
+	}
+
+	// The oldest waiter alone has kept the queue over the target since
+	// it reached the target delay.
+	unsigned long long target = options.requestQueueTargetDelay * 1000ull;
+	if (getWaitlist.empty()
+	 || now < getWaitlist.getOldestEnqueueTime() + target + REQUEST_QUEUE_SHED_INTERVAL)
+	{
+		return;
+	}
+
+	ExceptionPtr exception;
+	unsigned int shed = 0;
+
+	for (unsigned int p = 0; p < GetWaitlist::PRIORITY_CLASSES; p++) {
+		deque<GetWaiter> &queue = getWaitlist.getQueue(p);
+		while (!queue.empty() && now >= queue.front().enqueueTime + target) {
+			if (exception == NULL) {
+				exception = boost::make_shared<RequestQueueFullException>(
+					"Request queue delay exceeded (configured target: "
+					+ toString(options.requestQueueTargetDelay) + " msec)");
+			}
+			postLockActions.push_back(boost::bind(GetCallback::call,
+				queue.front().callback, SessionPtr(), exception));
+			queue.pop_front();
+			shed++;
+		}
+	}
+
+	requestQueue.shedCount += shed;
+	P_DEBUG("Rejected " << shed << " requests in group " << info.name <<
+		" that waited for longer than " << options.requestQueueTargetDelay << " msec");
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -53,12 +53,50 @@ using namespace boost;
  * If there are no enabled process, then waiting for one to spawn is too
  * expensive. The next best thing is to route to disabling processes
  * until more processes have been spawned.
+ *
+ * Which enabled process is picked depends on `routingPolicy`. Processes that
+ * reported that they're collecting garbage are avoided if possible. Whatever
+ * the policy, a totally busy process is only returned if all enabled processes
+ * are totally busy, so that the getWaitlist invariants keep holding.
  */
 Group::RouteResult
 Group::route(const Options &options) const {
 	if (OXT_LIKELY(enabledCount > 0)) {
 		if (options.stickySessionId == 0) {
-			Process *process = findEnabledProcessWithLowestBusyness();
+			Process *process = NULL;
+			if (routingPolicy == RP_CONSISTENT_HASH && options.routingHash != 0) {
+				process = findEnabledProcessByConsistentHash(options.routingHash);
+			} else if (warmupEndTime != 0 && enabledCount > 1) {
+				// Some processes may still be warming up. The routing policy
+				// takes over again once they're all warm.
+				unsigned long long now = (options.currentTime != 0)
+					? options.currentTime
+					: SystemTime::getUsec();
+				if (now < warmupEndTime) {
+					process = findEnabledProcessWithLowestWarmupAdjustedLoad(now);
+				}
+			}
+			if (process == NULL) {
+				switch (routingPolicy) {
+				case RP_P2C:
+					process = findEnabledProcessByPowerOfTwoChoices();
+					break;
+				case RP_EWMA:
+					process = findEnabledProcessWithLowestWeightedResponseTime();
+					break;
+				default:
+					process = findEnabledProcessWithLowestBusyness();
+					break;
+				}
+			}
+			if (process->isCollectingGarbage() && enabledCount > 1) {
+				// The process can't serve the request until it's done
+				// collecting garbage, so prefer one that can.
+				Process *alternative = findEnabledProcessNotCollectingGarbage();
+				if (alternative != NULL) {
+					process = alternative;
+				}
+			}
 			if (process->canBeRoutedTo()) {
 				return RouteResult(process);
 			} else {
@@ -78,7 +116,7 @@ Group::route(const Options &options) const {
 			}
 		}
 	} else {
-		Process *process = findProcessWithLowestBusyness(disablingProcesses);
+		Process *process = findDisablingProcessWithLowestBusyness();
 		if (process->canBeRoutedTo()) {
 			return RouteResult(process);
 		} else {
@@ -94,7 +132,7 @@ Group::newSession(Process *process, unsigned long long now) {
 	session->onInitiateFailure = _onSessionInitiateFailure;
 	session->onClose   = _onSessionClose;
 	if (process->enabled == Process::ENABLED) {
-		enabledProcessBusynessLevels[process->getIndex()] = process->busyness();
+		nEnabledProcessSessions++;
 		if (!wasTotallyBusy && process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy++;
 		}
@@ -140,10 +178,34 @@ Group::onSessionInitiateFailure(Process *process, Session *session) {
 
 OXT_FORCE_INLINE void
 Group::onSessionClose(Process *process, Session *session) {
+	boost::container::vector<Callback> actions;
+
 	TRACE_POINT();
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
 	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	if (onSessionCloseUnlocked(process, session, actions)) {
+		// Already calls verifyInvariants() and unlocks.
+		assignSessionsToGetWaitersQuickly(lock);
+	} else {
+		lock.unlock();
+	}
+	runAllActions(actions);
+}
+
+/**
+ * Updates the bookkeeping for a session that has been closed. Must be called
+ * while holding the pool lock. Returns whether this group has get waiters
+ * that can now be assigned a session; the caller is responsible for doing
+ * that, so that callers that close many sessions at once (see
+ * `Pool::closeSessions()`) only need to do it once per group.
+ */
+bool
+Group::onSessionCloseUnlocked(Process *process, Session *session,
+	boost::container::vector<Callback> &postLockActions)
+{
+	TRACE_POINT();
+	Pool *pool = getPool();
 	assert(process->isAlive());
 	assert(isAlive() || getLifeStatus() == SHUTTING_DOWN);
 
@@ -152,6 +214,9 @@ Group::onSessionClose(Process *process, Session *session) {
 	UPDATE_TRACE_POINT();
 
 	/* Update statistics. */
+	if (options.targetUtilization > 0) {
+		recordServiceTime(session, SystemTime::getUsec());
+	}
 	bool wasTotallyBusy = process->isTotallyBusy();
 	process->sessionClosed(session);
 	assert(process->getLifeStatus() == Process::ALIVE);
@@ -159,7 +224,8 @@ Group::onSessionClose(Process *process, Session *session) {
 		|| process->enabled == Process::DISABLING
 		|| process->enabled == Process::DETACHED);
 	if (process->enabled == Process::ENABLED) {
-		enabledProcessBusynessLevels[process->getIndex()] = process->busyness();
+		assert(nEnabledProcessSessions >= 1);
+		nEnabledProcessSessions--;
 		if (wasTotallyBusy) {
 			assert(nEnabledProcessesTotallyBusy >= 1);
 			nEnabledProcessesTotallyBusy--;
@@ -176,7 +242,8 @@ Group::onSessionClose(Process *process, Session *session) {
 	bool shouldDetach =
 		( detachingBecauseOfMaxRequests = (
 			options.maxRequests > 0
-			&& process->processed >= options.maxRequests
+			&& process->processed >= getMaxRequests(process)
+			&& !replaceProcessAtMaxRequests(process, postLockActions)
 		)) || (
 			detachingBecauseCapacityNeeded = (
 				process->sessions == 0
@@ -194,7 +261,6 @@ Group::onSessionClose(Process *process, Session *session) {
 
 	if (shouldDetach || shouldDisable) {
 		UPDATE_TRACE_POINT();
-		boost::container::vector<Callback> actions;
 
 		if (shouldDetach) {
 			if (detachingBecauseCapacityNeeded) {
@@ -212,20 +278,19 @@ Group::onSessionClose(Process *process, Session *session) {
 				 */
 				P_DEBUG("Process " << process->inspect() <<
 					" has reached its maximum number of requests (" <<
-					options.maxRequests << "); detaching it");
+					getMaxRequests(process) << "); detaching it");
 			}
-			pool->detachProcessUnlocked(process->shared_from_this(), actions);
+			pool->detachProcessUnlocked(process->shared_from_this(), postLockActions);
 		} else {
 			ProcessPtr processPtr = process->shared_from_this();
 			removeProcessFromList(processPtr, disablingProcesses);
 			addProcessToList(processPtr, disabledProcesses);
-			removeFromDisableWaitlist(processPtr, DR_SUCCESS, actions);
+			removeFromDisableWaitlist(processPtr, DR_SUCCESS, postLockActions);
 			maybeInitiateOobw(process);
 		}
 
 		pool->fullVerifyInvariants();
-		lock.unlock();
-		runAllActions(actions);
+		return false;
 
 	} else {
 		UPDATE_TRACE_POINT();
@@ -233,14 +298,10 @@ Group::onSessionClose(Process *process, Session *session) {
 		// This could change process->enabled.
 		maybeInitiateOobw(process);
 
-		if (!getWaitlist.empty() && process->enabled == Process::ENABLED) {
-			/* If there are clients on this group waiting for a process to
-			 * become available then call them now.
-			 */
-			UPDATE_TRACE_POINT();
-			// Already calls verifyInvariants().
-			assignSessionsToGetWaitersQuickly(lock);
-		}
+		/* If there are clients on this group waiting for a process to
+		 * become available then they should be called now.
+		 */
+		return !getWaitlist.empty() && process->enabled == Process::ENABLED;
 	}
 }
 
@@ -258,6 +319,10 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 {
 	assert(isAlive());
 
+	if (options.targetUtilization > 0 && !newOptions.noop) {
+		recordRequestArrival(newOptions.currentTime);
+	}
+
 	if (OXT_LIKELY(!restarting())) {
 		if (OXT_UNLIKELY(needsRestart(newOptions))) {
 			restart(newOptions);
@@ -304,9 +369,10 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 		assert(m_spawning || restarting() || poolAtFullCapacity());
 
 		if (disablingCount > 0 && !restarting()) {
-			Process *process = findProcessWithLowestBusyness(disablingProcesses);
+			Process *process = findDisablingProcessWithLowestBusyness();
 			assert(process != NULL);
 			if (!process->isTotallyBusy()) {
+				recordQueueTime(0);
 				return newSession(process, newOptions.currentTime);
 			}
 		}
@@ -328,6 +394,7 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 			return SessionPtr();
 		} else {
 			P_DEBUG("Session checked out from process " << result.process->inspect());
+			recordQueueTime(0);
 			return newSession(result.process, newOptions.currentTime);
 		}
 	}
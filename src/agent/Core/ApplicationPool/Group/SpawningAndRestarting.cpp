@@ -24,6 +24,7 @@
  *  THE SOFTWARE.
  */
 #include <Core/ApplicationPool/Group.h>
+#include <Probes.h>
 
 /*************************************************************************
  *
@@ -56,6 +57,22 @@ Group::spawnThreadMain(GroupPtr self, SpawningKit::SpawnerPtr spawner,
 void
 Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 	const Options &options, unsigned int restartsInitiated)
+{
+	while (!runSpawnLoopIteration(spawner, options, restartsInitiated)) {
+		// Continue spawning.
+	}
+	finishSpawnLoop();
+}
+
+/**
+ * Spawns one process and attaches it, or hands the spawn error to the
+ * get waiters. Returns whether the spawn loop is done. A spawn loop either
+ * runs in a thread of its own (`spawnThreadRealMain()`), or is scheduled
+ * one iteration at a time on the Pool's spawn workers.
+ */
+bool
+Group::runSpawnLoopIteration(const SpawningKit::SpawnerPtr &spawner,
+	const Options &options, unsigned int restartsInitiated)
 {
 	TRACE_POINT();
 	boost::this_thread::disable_interruption di;
@@ -65,144 +82,186 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 	Pool::DebugSupportPtr debug = pool->debugSupport;
 
 	bool done = false;
-	while (!done) {
-		bool shouldFail = false;
-		if (debug != NULL && debug->spawning) {
-			UPDATE_TRACE_POINT();
-			boost::this_thread::restore_interruption ri(di);
-			boost::this_thread::restore_syscall_interruption rsi(dsi);
-			boost::this_thread::interruption_point();
-			string iteration;
-			{
-				LockGuard g(debug->syncher);
-				debug->spawnLoopIteration++;
-				iteration = toString(debug->spawnLoopIteration);
-			}
-			P_DEBUG("Begin spawn loop iteration " << iteration);
-			debug->debugger->send("Begin spawn loop iteration " +
-				iteration);
-
-			vector<string> cases;
-			cases.push_back("Proceed with spawn loop iteration " + iteration);
-			cases.push_back("Fail spawn loop iteration " + iteration);
-			MessagePtr message = debug->messages->recvAny(cases);
-			shouldFail = message->name == "Fail spawn loop iteration " + iteration;
+	bool shouldFail = false;
+	if (debug != NULL && debug->spawning) {
+		UPDATE_TRACE_POINT();
+		boost::this_thread::restore_interruption ri(di);
+		boost::this_thread::restore_syscall_interruption rsi(dsi);
+		boost::this_thread::interruption_point();
+		string iteration;
+		{
+			LockGuard g(debug->syncher);
+			debug->spawnLoopIteration++;
+			iteration = toString(debug->spawnLoopIteration);
 		}
+		P_DEBUG("Begin spawn loop iteration " << iteration);
+		debug->debugger->send("Begin spawn loop iteration " +
+			iteration);
+
+		vector<string> cases;
+		cases.push_back("Proceed with spawn loop iteration " + iteration);
+		cases.push_back("Fail spawn loop iteration " + iteration);
+		MessagePtr message = debug->messages->recvAny(cases);
+		shouldFail = message->name == "Fail spawn loop iteration " + iteration;
+	}
 
-		ProcessPtr process;
-		ExceptionPtr exception;
-		try {
-			UPDATE_TRACE_POINT();
-			boost::this_thread::restore_interruption ri(di);
-			boost::this_thread::restore_syscall_interruption rsi(dsi);
-			if (shouldFail) {
-				SpawnException e("Simulated failure");
-				processAndLogNewSpawnException(e, options, pool->getSpawningKitConfig());
-				throw e;
-			} else {
-				process = createProcessObject(spawner->spawn(options));
-			}
-		} catch (const thread_interrupted &) {
-			break;
-		} catch (const tracable_exception &e) {
-			exception = copyException(e);
-			// Let other (unexpected) exceptions crash the program so
-			// gdb can generate a backtrace.
+	ProcessPtr process;
+	ExceptionPtr exception;
+	try {
+		UPDATE_TRACE_POINT();
+		boost::this_thread::restore_interruption ri(di);
+		boost::this_thread::restore_syscall_interruption rsi(dsi);
+		if (shouldFail) {
+			SpawnException e("Simulated failure");
+			processAndLogNewSpawnException(e, options, pool->getSpawningKitConfig());
+			throw e;
+		} else {
+			P_PROBE1(spawn__begin, info.name.c_str());
+			process = createProcessObject(spawner->spawn(options));
 		}
+	} catch (const thread_interrupted &) {
+		return true;
+	} catch (const tracable_exception &e) {
+		exception = copyException(e);
+		// Let other (unexpected) exceptions crash the program so
+		// gdb can generate a backtrace.
+	}
+	P_PROBE2(spawn__end, info.name.c_str(),
+		(process != NULL) ? (int) process->getPid() : -1);
+	if (process != NULL && !cgroupPath.empty()) {
+		placeInCgroup(process->getPid(), options);
+	}
 
-		UPDATE_TRACE_POINT();
-		ScopeGuard guard(boost::bind(Process::forceTriggerShutdownAndCleanup, process));
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
+	UPDATE_TRACE_POINT();
+	ScopeGuard guard(boost::bind(Process::forceTriggerShutdownAndCleanup, process));
+	boost::unique_lock<boost::mutex> lock(pool->syncher);
 
-		if (!isAlive()) {
-			if (process != NULL) {
-				P_DEBUG("Group is being shut down so dropping process " <<
-					process->inspect() << " which we just spawned and exiting spawn loop");
-			} else {
-				P_DEBUG("The group is being shut down. A process failed "
-					"to be spawned anyway, so ignoring this error and exiting "
-					"spawn loop");
-			}
-			// We stop immediately because any previously assumed invariants
-			// may have been violated.
-			break;
-		} else if (restartsInitiated != this->restartsInitiated) {
-			if (process != NULL) {
-				P_DEBUG("A restart was issued for the group, so dropping process " <<
-					process->inspect() << " which we just spawned and exiting spawn loop");
-			} else {
-				P_DEBUG("A restart was issued for the group. A process failed "
-					"to be spawned anyway, so ignoring this error and exiting "
-					"spawn loop");
-			}
-			// We stop immediately because any previously assumed invariants
-			// may have been violated.
-			break;
+	if (!isAlive()) {
+		if (process != NULL) {
+			P_DEBUG("Group is being shut down so dropping process " <<
+				process->inspect() << " which we just spawned and exiting spawn loop");
+		} else {
+			P_DEBUG("The group is being shut down. A process failed "
+				"to be spawned anyway, so ignoring this error and exiting "
+				"spawn loop");
+		}
+		// We stop immediately because any previously assumed invariants
+		// may have been violated.
+		return true;
+	} else if (restartsInitiated != this->restartsInitiated) {
+		if (process != NULL) {
+			P_DEBUG("A restart was issued for the group, so dropping process " <<
+				process->inspect() << " which we just spawned and exiting spawn loop");
+		} else {
+			P_DEBUG("A restart was issued for the group. A process failed "
+				"to be spawned anyway, so ignoring this error and exiting "
+				"spawn loop");
 		}
+		// We stop immediately because any previously assumed invariants
+		// may have been violated.
+		return true;
+	}
 
-		verifyInvariants();
-		assert(m_spawning);
-		assert(processesBeingSpawned > 0);
+	verifyInvariants();
+	assert(m_spawning);
+	assert(processesBeingSpawned > 0);
 
-		processesBeingSpawned--;
-		assert(processesBeingSpawned == 0);
+	processesBeingSpawned--;
+	assert(processesBeingSpawned >= 0);
 
-		UPDATE_TRACE_POINT();
-		boost::container::vector<Callback> actions;
-		if (process != NULL) {
-			AttachResult result = attach(process, actions);
-			if (result == AR_OK) {
-				guard.clear();
-				if (getWaitlist.empty()) {
-					pool->assignSessionsToGetWaiters(actions);
-				} else {
-					assignSessionsToGetWaiters(actions);
-				}
-				P_DEBUG("New process count = " << enabledCount <<
-					", remaining get waiters = " << getWaitlist.size());
+	UPDATE_TRACE_POINT();
+	boost::container::vector<Callback> actions;
+	if (process != NULL) {
+		AttachResult result = attach(process, actions);
+		if (result == AR_OK) {
+			guard.clear();
+			spawnsSucceeded++;
+			recordSpawnTime(process);
+			recordSpawnPhaseTimes(process);
+			if (getWaitlist.empty()) {
+				pool->assignSessionsToGetWaiters(actions);
 			} else {
-				done = true;
-				P_DEBUG("Unable to attach spawned process " << process->inspect());
-				if (result == AR_ANOTHER_GROUP_IS_WAITING_FOR_CAPACITY) {
-					pool->possiblySpawnMoreProcessesForExistingGroups();
-				}
+				assignSessionsToGetWaiters(actions);
 			}
+			P_DEBUG("New process count = " << enabledCount <<
+				", remaining get waiters = " << getWaitlist.size());
 		} else {
-			// TODO: sure this is the best thing? if there are
-			// processes currently alive we should just use them.
-			if (enabledCount == 0) {
-				enableAllDisablingProcesses(actions);
-			}
-			Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
-			pool->assignSessionsToGetWaiters(actions);
 			done = true;
+			P_DEBUG("Unable to attach spawned process " << process->inspect());
+			if (result == AR_ANOTHER_GROUP_IS_WAITING_FOR_CAPACITY) {
+				pool->possiblySpawnMoreProcessesForExistingGroups();
+			}
 		}
-
-		done = done
-			|| (processLowerLimitsSatisfied() && getWaitlist.empty())
-			|| processUpperLimitsReached()
-			|| pool->atFullCapacityUnlocked();
-		m_spawning = !done;
-		if (done) {
-			P_DEBUG("Spawn loop done");
-		} else {
-			processesBeingSpawned++;
-			P_DEBUG("Continue spawning");
+	} else {
+		spawnsFailed++;
+		// TODO: sure this is the best thing? if there are
+		// processes currently alive we should just use them.
+		if (enabledCount == 0) {
+			enableAllDisablingProcesses(actions);
 		}
+		Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
+		pool->assignSessionsToGetWaiters(actions);
+		done = true;
+	}
 
-		UPDATE_TRACE_POINT();
-		pool->fullVerifyInvariants();
-		lock.unlock();
-		UPDATE_TRACE_POINT();
-		runAllActions(actions);
-		UPDATE_TRACE_POINT();
+	// Other spawn loops may be running concurrently. Their processes
+	// will take care of some of the get waiters.
+	done = done
+		|| (processLowerLimitsSatisfied()
+			&& getWaitlist.size() <= (unsigned int) processesBeingSpawned
+			&& !autoscalerWantsMoreProcesses()
+			&& rollingRestartSuccessorsPending <= processesBeingSpawned)
+		|| processUpperLimitsReached()
+		|| pool->atFullCapacityUnlocked();
+	if (done) {
+		P_DEBUG("Spawn loop done");
+	} else {
+		processesBeingSpawned++;
+		P_DEBUG("Continue spawning");
+	}
+	m_spawning = processesBeingSpawned > 0;
+	if (!m_spawning) {
+		prespawnTarget = 0;
 	}
 
+	UPDATE_TRACE_POINT();
+	pool->fullVerifyInvariants();
+	lock.unlock();
+	UPDATE_TRACE_POINT();
+	runAllActions(actions);
+	UPDATE_TRACE_POINT();
+
+	return done;
+}
+
+void
+Group::finishSpawnLoop() {
+	Pool::DebugSupportPtr debug = getPool()->debugSupport;
 	if (debug != NULL && debug->spawning) {
 		debug->debugger->send("Spawn loop done");
 	}
 }
 
+/**
+ * Marks all processes as outdated, so that `replaceOutdatedProcesses()`
+ * replaces them with processes that are spawned by the new spawner.
+ */
+void
+Group::markAllProcessesOutdated() {
+	ProcessList::iterator it, end;
+	for (it = enabledProcesses.begin(), end = enabledProcesses.end(); it != end; it++) {
+		(*it)->outdated = true;
+	}
+	for (it = disablingProcesses.begin(), end = disablingProcesses.end(); it != end; it++) {
+		(*it)->outdated = true;
+	}
+	for (it = disabledProcesses.begin(), end = disabledProcesses.end(); it != end; it++) {
+		(*it)->outdated = true;
+	}
+	// Let the garbage collector pick up the rolling restart if it gets stuck.
+	nextGarbageCollectionTime = 0;
+}
+
 // The 'self' parameter is for keeping the current Group object alive while this thread is running.
 void
 Group::finalizeRestart(GroupPtr self,
@@ -255,7 +314,7 @@ Group::finalizeRestart(GroupPtr self,
 
 	// Run some sanity checks.
 	pool->fullVerifyInvariants();
-	assert(m_restarting);
+	assert(method == RM_ROLLING || m_restarting);
 	UPDATE_TRACE_POINT();
 
 	// Atomically swap the new spawner with the old one.
@@ -263,7 +322,20 @@ Group::finalizeRestart(GroupPtr self,
 	oldSpawner = spawner;
 	spawner    = newSpawner;
 
-	m_restarting = false;
+	if (method == RM_ROLLING) {
+		// Processes that are being spawned right now use the old spawner,
+		// so make the spawn loops drop them.
+		this->restartsInitiated++;
+		processesBeingSpawned = 0;
+		m_spawning = false;
+		markAllProcessesOutdated();
+		P_INFO("Rolling restarting group " << getName() << ": replacing " <<
+			getProcessCount() << " processes, " <<
+			std::max(options.rollingRestartBatchSize, 1u) << " at a time");
+		replaceOutdatedProcesses(postLockActions);
+	} else {
+		m_restarting = false;
+	}
 	if (shouldSpawn()) {
 		spawn();
 	} else if (isWaitingForCapacity()) {
@@ -288,6 +360,62 @@ Group::finalizeRestart(GroupPtr self,
 }
 
 
+void
+Group::recordSpawnPhaseTimes(const ProcessPtr &process) {
+	if (!process->hasSpawnPhaseTimes()) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < SpawningKit::SPAWN_PHASE_COUNT; i++) {
+		SpawnPhaseHistogram &histogram = spawnPhaseHistograms[i];
+		unsigned int time = process->getSpawnPhaseTime((SpawningKit::SpawnPhase) i);
+		unsigned int bucket = 0;
+
+		while (bucket < SPAWN_PHASE_HISTOGRAM_BUCKETS - 1
+		 && time > (1000ull << bucket))
+		{
+			bucket++;
+		}
+		histogram.buckets[bucket]++;
+		histogram.count++;
+		histogram.totalTime += time;
+		histogram.maxTime = std::max(histogram.maxTime, time);
+	}
+}
+
+void
+Group::inspectSpawnPhasesXml(std::ostream &stream) const {
+	stream << "<spawn_phases>";
+	for (unsigned int i = 0; i < SpawningKit::SPAWN_PHASE_COUNT; i++) {
+		const SpawnPhaseHistogram &histogram = spawnPhaseHistograms[i];
+		if (histogram.count == 0) {
+			continue;
+		}
+
+		stream << "<phase>";
+		stream << "<name>" << SpawningKit::getSpawnPhaseName((SpawningKit::SpawnPhase) i) << "</name>";
+		stream << "<count>" << histogram.count << "</count>";
+		stream << "<avg_time>" << histogram.totalTime / histogram.count << "</avg_time>";
+		stream << "<max_time>" << histogram.maxTime << "</max_time>";
+		stream << "<histogram>";
+		for (unsigned int j = 0; j < SPAWN_PHASE_HISTOGRAM_BUCKETS; j++) {
+			if (histogram.buckets[j] == 0) {
+				continue;
+			}
+			stream << "<bucket>";
+			if (j < SPAWN_PHASE_HISTOGRAM_BUCKETS - 1) {
+				stream << "<max_time>" << (1000ull << j) << "</max_time>";
+			}
+			stream << "<count>" << histogram.buckets[j] << "</count>";
+			stream << "</bucket>";
+		}
+		stream << "</histogram>";
+		stream << "</phase>";
+	}
+	stream << "</spawn_phases>";
+}
+
+
 /****************************
  *
  * Public methods
@@ -300,17 +428,33 @@ Group::restart(const Options &options, RestartMethod method) {
 	boost::container::vector<Callback> actions;
 
 	assert(isAlive());
-	P_DEBUG("Restarting group " << getName());
+	if (method == RM_DEFAULT) {
+		method = this->options.rollingRestart ? RM_ROLLING : RM_BLOCKING;
+	}
+	if (method == RM_ROLLING && enabledCount == 0) {
+		// There are no processes that can keep handling requests
+		// while the new ones are being spawned.
+		method = RM_BLOCKING;
+	}
+	P_DEBUG("Restarting group " << getName() <<
+		(method == RM_ROLLING ? " (rolling)" : ""));
 
 	// If there is currently a restarter thread or a spawner thread active,
 	// the following tells them to abort their current work as soon as possible.
 	restartsInitiated++;
 
 	processesBeingSpawned = 0;
+	rollingRestartSuccessorsPending = 0;
+	recycleSuccessorPending = false;
+	prespawnTarget = 0;
 	m_spawning   = false;
-	m_restarting = true;
 	uuid         = generateUuid(pool);
-	detachAll(actions);
+	if (method == RM_BLOCKING) {
+		// A rolling restart keeps the current processes around
+		// until finalizeRestart() replaces them.
+		m_restarting = true;
+		detachAll(actions);
+	}
 	getPool()->interruptableThreads.create_thread(
 		boost::bind(&Group::finalizeRestart, this, shared_from_this(),
 			this->options.copyAndPersist().clearPerRequestFields(),
@@ -327,6 +471,61 @@ Group::restarting() const {
 	return m_restarting;
 }
 
+/**
+ * Drives a rolling restart: replaces outdated processes with processes that
+ * run the new code, at most `options.rollingRestartBatchSize` at a time. Like
+ * in `recycleProcessesOverMemoryLimit()`, a successor is spawned first, and
+ * the outdated process is only disabled after the successor has been
+ * attached. If the upper process limits have been reached then outdated
+ * processes are disabled right away (except for the last enabled process),
+ * and replaced after they have been detached.
+ *
+ * Called when a rolling restart is finalized, after a replaced process has
+ * been detached, and by the garbage collector, so that the rolling restart
+ * continues even if spawning a successor failed.
+ */
+void
+Group::replaceOutdatedProcesses(boost::container::vector<Callback> &postLockActions) {
+	if (restarting()) {
+		return;
+	}
+	if (rollingRestartSuccessorsPending > 0 && !m_spawning) {
+		// Spawning the successors failed. Try again.
+		rollingRestartSuccessorsPending = 0;
+	}
+
+	unsigned int batchSize = std::max(options.rollingRestartBatchSize, 1u);
+	unsigned int replacing = countOutdatedProcessesBeingReplaced();
+	unsigned int remaining = 0;
+	ProcessList::const_iterator it, end = enabledProcesses.end();
+	for (it = enabledProcesses.begin(); it != end; it++) {
+		if ((*it)->outdated) {
+			remaining++;
+		}
+	}
+	// Outdated processes that a successor is being spawned for are still enabled.
+	if (remaining > rollingRestartSuccessorsPending) {
+		remaining -= rollingRestartSuccessorsPending;
+	} else {
+		remaining = 0;
+	}
+
+	while (replacing < batchSize && remaining > 0) {
+		if (allowSpawn()) {
+			rollingRestartSuccessorsPending++;
+			spawn();
+		} else if (enabledCount > 1) {
+			disableReplacedProcess(findEnabledOutdatedProcess(), true, postLockActions);
+		} else {
+			// This is the sole enabled process and it cannot be
+			// replaced until spawning is allowed again.
+			break;
+		}
+		replacing++;
+		remaining--;
+	}
+}
+
 bool
 Group::needsRestart(const Options &options) {
 	if (m_restarting) {
@@ -351,12 +550,17 @@ Group::needsRestart(const Options &options) {
 			lastRestartFileCheckTime = now;
 			return false;
 
-		} else if (lastRestartFileCheckTime <= now - (time_t) options.statThrottleRate) {
+		} else if (restartFileWatched
+			? restartFileChanged
+			: lastRestartFileCheckTime <= now - (time_t) options.statThrottleRate)
+		{
 			// Not first time we call needsRestart() for this group.
-			// Stat throttle time has passed.
+			// The restart file watcher noticed a change, or the stat
+			// throttle time has passed.
 			bool restart;
 
 			lastRestartFileCheckTime = now;
+			restartFileChanged = false;
 
 			if (lastRestartFileMtime > 0) {
 				// restart.txt existed before
@@ -391,6 +595,11 @@ Group::needsRestart(const Options &options) {
 
 			return restart;
 
+		} else if (restartFileWatched) {
+			// Not first time we call needsRestart() for this group.
+			// Nothing changed in the restart directory since the last check.
+			return alwaysRestartFileExists;
+
 		} else {
 			// Not first time we call needsRestart() for this group.
 			// Still within stat throttling window.
@@ -412,11 +621,18 @@ Group::needsRestart(const Options &options) {
  * resource limits. That is, this method will ensure that there are at least
  * `minProcesses` processes, but no more than `maxProcesses` processes, and no
  * more than `pool->max` processes in the entire pool.
+ *
+ * If a spawn loop is already running, then another one is only started if
+ * `options.spawnConcurrency` allows it and if the processes that are
+ * already being spawned are not enough.
+ *
+ * The spawn loop runs in a thread of its own, unless the Pool has spawn
+ * workers, in which case it is scheduled on them.
  */
 SpawnResult
 Group::spawn() {
 	assert(isAlive());
-	if (m_spawning) {
+	if (m_spawning && !shouldSpawnConcurrently()) {
 		return SR_IN_PROGRESS;
 	} else if (restarting()) {
 		return SR_ERR_RESTARTING;
@@ -426,13 +642,23 @@ Group::spawn() {
 		return SR_ERR_POOL_AT_FULL_CAPACITY;
 	} else {
 		P_DEBUG("Requested spawning of new process for group " << info.name);
-		interruptableThreads.create_thread(
-			boost::bind(&Group::spawnThreadMain,
-				this, shared_from_this(), spawner,
-				options.copyAndPersist().clearPerRequestFields(),
-				restartsInitiated),
-			"Group process spawner: " + info.name,
-			POOL_HELPER_THREAD_STACK_SIZE);
+		Pool *pool = getPool();
+		if (pool->spawnWorkerCount > 0) {
+			Pool::SpawnJob job;
+			job.group = shared_from_this();
+			job.spawner = spawner;
+			job.options = options.copyAndPersist().clearPerRequestFields();
+			job.restartsInitiated = restartsInitiated;
+			pool->scheduleSpawnJob(job);
+		} else {
+			interruptableThreads.create_thread(
+				boost::bind(&Group::spawnThreadMain,
+					this, shared_from_this(), spawner,
+					options.copyAndPersist().clearPerRequestFields(),
+					restartsInitiated),
+				"Group process spawner: " + info.name,
+				POOL_HELPER_THREAD_STACK_SIZE);
+		}
 		m_spawning = true;
 		processesBeingSpawned++;
 		return SR_OK;
@@ -444,6 +670,19 @@ Group::spawning() const {
 	return m_spawning;
 }
 
+/**
+ * Whether another spawn loop should be started while one is already
+ * running, because more processes are needed than are being spawned.
+ */
+bool
+Group::shouldSpawnConcurrently() const {
+	return (unsigned int) processesBeingSpawned < std::max(options.spawnConcurrency, 1u)
+		&& (!processLowerLimitsSatisfied()
+			|| getWaitlist.size() > (unsigned int) processesBeingSpawned
+			|| autoscalerWantsMoreProcesses()
+			|| rollingRestartSuccessorsPending > processesBeingSpawned);
+}
+
 /** Whether a new process should be spawned for this group. */
 bool
 Group::shouldSpawn() const {
@@ -452,6 +691,7 @@ Group::shouldSpawn() const {
 			!processLowerLimitsSatisfied()
 			|| allEnabledProcessesAreTotallyBusy()
 			|| !getWaitlist.empty()
+			|| autoscalerWantsMoreProcesses()
 		);
 }
 
@@ -57,7 +57,7 @@ Group::getProcessCount() const {
  */
 bool
 Group::processLowerLimitsSatisfied() const {
-	return capacityUsed() >= options.minProcesses;
+	return capacityUsed() >= std::max<unsigned int>(options.minProcesses, prespawnTarget);
 }
 
 /**
@@ -67,7 +67,14 @@ Group::processLowerLimitsSatisfied() const {
  */
 bool
 Group::processUpperLimitsReached() const {
-	return options.maxProcesses != 0 && capacityUsed() >= options.maxProcesses;
+	if (options.maxProcesses != 0 && capacityUsed() >= options.maxProcesses) {
+		return true;
+	}
+	// The tenant limit is a soft limit: every group may always have one
+	// process, so that an app is never starved by its tenant's other apps.
+	return !options.tenant.empty()
+		&& capacityUsed() > 0
+		&& getPool()->tenantAtFullCapacityUnlocked(options.tenant);
 }
 
 /**
@@ -117,82 +124,136 @@ Group::garbageCollectable(unsigned long long now) const {
 
 void
 Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
+	GroupSnapshot(*this).inspectXml(stream, includeSecrets);
+}
+
+
+GroupSnapshot::GroupSnapshot(const Group &group)
+	: name(group.info.name),
+	  appRoot(group.options.appRoot.data(), group.options.appRoot.size()),
+	  appType(group.options.appType.data(), group.options.appType.size()),
+	  environment(group.options.environment.data(), group.options.environment.size()),
+	  routingPolicy(Group::getRoutingPolicyName(group.routingPolicy)),
+	  uuid(toString(group.uuid)),
+	  enabledCount(group.enabledCount),
+	  disablingCount(group.disablingCount),
+	  disabledCount(group.disabledCount),
+	  capacityUsed(group.capacityUsed()),
+	  cgroupMemoryUsage(group.cgroupMemoryUsage),
+	  getWaitlistSize(group.getWaitlist.size()),
+	  disableWaitlistSize(group.disableWaitlist.size()),
+	  processesBeingSpawned(group.processesBeingSpawned),
+	  spawning(group.m_spawning),
+	  restarting(group.restarting()),
+	  lifeStatus((Group::LifeStatus) group.lifeStatus.load(boost::memory_order_relaxed)),
+	  apiKey(group.getApiKey()),
+	  fairCapacityShare(0)
+{
+	SpawningKit::UserSwitchingInfo usInfo(SpawningKit::prepareUserSwitching(group.options,
+		*group.getPool()->getSpawningKitConfig()->userDatabaseCache));
 	ProcessList::const_iterator it;
+	stringstream stream;
+
+	user = usInfo.username;
+	uid = usInfo.uid;
+	this->group = usInfo.groupname;
+	gid = usInfo.gid;
+
+	group.options.toXml(stream, group.getResourceLocator());
+	optionsXml = stream.str();
+	if (group.options.targetUtilization > 0) {
+		stream.str(string());
+		group.inspectAutoscalerXml(stream);
+		autoscalerXml = stream.str();
+	}
+	stream.str(string());
+	group.inspectRequestQueueXml(stream);
+	requestQueueXml = stream.str();
+	stream.str(string());
+	group.inspectSpawnPhasesXml(stream);
+	spawnPhasesXml = stream.str();
+
+	processes.reserve(group.enabledProcesses.size() + group.disablingProcesses.size()
+		+ group.disabledProcesses.size() + group.detachedProcesses.size());
+	for (it = group.enabledProcesses.begin(); it != group.enabledProcesses.end(); it++) {
+		processes.push_back(ProcessSnapshot(**it));
+	}
+	for (it = group.disablingProcesses.begin(); it != group.disablingProcesses.end(); it++) {
+		processes.push_back(ProcessSnapshot(**it));
+	}
+	for (it = group.disabledProcesses.begin(); it != group.disabledProcesses.end(); it++) {
+		processes.push_back(ProcessSnapshot(**it));
+	}
+	for (it = group.detachedProcesses.begin(); it != group.detachedProcesses.end(); it++) {
+		processes.push_back(ProcessSnapshot(**it));
+	}
+}
+
+void
+GroupSnapshot::inspectXml(std::ostream &stream, bool includeSecrets) const {
+	vector<ProcessSnapshot>::const_iterator it;
 
-	stream << "<name>" << escapeForXml(info.name) << "</name>";
-	stream << "<component_name>" << escapeForXml(info.name) << "</component_name>";
-	stream << "<app_root>" << escapeForXml(options.appRoot) << "</app_root>";
-	stream << "<app_type>" << escapeForXml(options.appType) << "</app_type>";
-	stream << "<environment>" << escapeForXml(options.environment) << "</environment>";
-	stream << "<uuid>" << toString(uuid) << "</uuid>";
+	stream << "<name>" << escapeForXml(name) << "</name>";
+	stream << "<component_name>" << escapeForXml(name) << "</component_name>";
+	stream << "<app_root>" << escapeForXml(appRoot) << "</app_root>";
+	stream << "<app_type>" << escapeForXml(appType) << "</app_type>";
+	stream << "<environment>" << escapeForXml(environment) << "</environment>";
+	stream << "<routing_policy>" << routingPolicy << "</routing_policy>";
+	stream << "<uuid>" << uuid << "</uuid>";
 	stream << "<enabled_process_count>" << enabledCount << "</enabled_process_count>";
 	stream << "<disabling_process_count>" << disablingCount << "</disabling_process_count>";
 	stream << "<disabled_process_count>" << disabledCount << "</disabled_process_count>";
-	stream << "<capacity_used>" << capacityUsed() << "</capacity_used>";
-	stream << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
-	stream << "<disable_wait_list_size>" << disableWaitlist.size() << "</disable_wait_list_size>";
+	stream << "<capacity_used>" << capacityUsed << "</capacity_used>";
+	if (cgroupMemoryUsage != -1) {
+		stream << "<cgroup_memory_usage>" << cgroupMemoryUsage << "</cgroup_memory_usage>";
+	}
+	stream << "<get_wait_list_size>" << getWaitlistSize << "</get_wait_list_size>";
+	stream << "<disable_wait_list_size>" << disableWaitlistSize << "</disable_wait_list_size>";
 	stream << "<processes_being_spawned>" << processesBeingSpawned << "</processes_being_spawned>";
-	if (m_spawning) {
+	if (spawning) {
 		stream << "<spawning/>";
 	}
-	if (restarting()) {
+	if (restarting) {
 		stream << "<restarting/>";
 	}
+	stream << autoscalerXml;
+	stream << requestQueueXml;
+	stream << spawnPhasesXml;
 	if (includeSecrets) {
-		stream << "<secret>" << escapeForXml(getApiKey().toStaticString()) << "</secret>";
-		stream << "<api_key>" << escapeForXml(getApiKey().toStaticString()) << "</api_key>";
+		stream << "<secret>" << escapeForXml(apiKey.toStaticString()) << "</secret>";
+		stream << "<api_key>" << escapeForXml(apiKey.toStaticString()) << "</api_key>";
 	}
-	LifeStatus lifeStatus = (LifeStatus) this->lifeStatus.load(boost::memory_order_relaxed);
 	switch (lifeStatus) {
-	case ALIVE:
+	case Group::ALIVE:
 		stream << "<life_status>ALIVE</life_status>";
 		break;
-	case SHUTTING_DOWN:
+	case Group::SHUTTING_DOWN:
 		stream << "<life_status>SHUTTING_DOWN</life_status>";
 		break;
-	case SHUT_DOWN:
+	case Group::SHUT_DOWN:
 		stream << "<life_status>SHUT_DOWN</life_status>";
 		break;
 	default:
 		P_BUG("Unknown 'lifeStatus' state " << lifeStatus);
 	}
 
-	SpawningKit::UserSwitchingInfo usInfo(SpawningKit::prepareUserSwitching(options));
-	stream << "<user>" << escapeForXml(usInfo.username) << "</user>";
-	stream << "<uid>" << usInfo.uid << "</uid>";
-	stream << "<group>" << escapeForXml(usInfo.groupname) << "</group>";
-	stream << "<gid>" << usInfo.gid << "</gid>";
+	stream << "<user>" << escapeForXml(user) << "</user>";
+	stream << "<uid>" << uid << "</uid>";
+	stream << "<group>" << escapeForXml(group) << "</group>";
+	stream << "<gid>" << gid << "</gid>";
 
 	stream << "<options>";
-	options.toXml(stream, getResourceLocator());
+	stream << optionsXml;
 	stream << "</options>";
 
 	stream << "<processes>";
-
-	for (it = enabledProcesses.begin(); it != enabledProcesses.end(); it++) {
-		stream << "<process>";
-		(*it)->inspectXml(stream, includeSecrets);
-		stream << "</process>";
-	}
-	for (it = disablingProcesses.begin(); it != disablingProcesses.end(); it++) {
-		stream << "<process>";
-		(*it)->inspectXml(stream, includeSecrets);
-		stream << "</process>";
-	}
-	for (it = disabledProcesses.begin(); it != disabledProcesses.end(); it++) {
+	for (it = processes.begin(); it != processes.end(); it++) {
 		stream << "<process>";
-		(*it)->inspectXml(stream, includeSecrets);
+		it->inspectXml(stream, includeSecrets);
 		stream << "</process>";
 	}
-	for (it = detachedProcesses.begin(); it != detachedProcesses.end(); it++) {
-		stream << "<process>";
-		(*it)->inspectXml(stream, includeSecrets);
-		stream << "</process>";
-	}
-
 	stream << "</processes>";
 }
 
-
 } // namespace ApplicationPool2
 } // namespace Passenger
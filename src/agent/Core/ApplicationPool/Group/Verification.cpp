@@ -87,6 +87,7 @@ Group::verifyInvariants() const {
 		assert(disablingCount == 0);
 		assert(disabledCount == 0);
 		assert(nEnabledProcessesTotallyBusy == 0);
+		assert(nEnabledProcessSessions == 0);
 	}
 
 	// Verify list sizes.
@@ -94,6 +95,8 @@ Group::verifyInvariants() const {
 	assert((int) disablingProcesses.size() == disablingCount);
 	assert((int) disabledProcesses.size() == disabledCount);
 	assert(nEnabledProcessesTotallyBusy <= enabledCount);
+	assert(enabledProcessRoutingTable.size() == enabledProcesses.size());
+	assert(disablingProcessRoutingTable.size() == disablingProcesses.size());
 	#endif
 }
 
@@ -115,6 +118,7 @@ Group::verifyExpensiveInvariants() const {
 		assert(process->isAlive());
 		assert(process->oobwStatus == Process::OOBW_NOT_ACTIVE
 			|| process->oobwStatus == Process::OOBW_REQUESTED);
+		verifyRoutingTableEntry(process, enabledProcessRoutingTable);
 	}
 
 	end = disablingProcesses.end();
@@ -124,6 +128,7 @@ Group::verifyExpensiveInvariants() const {
 		assert(process->isAlive());
 		assert(process->oobwStatus == Process::OOBW_NOT_ACTIVE
 			|| process->oobwStatus == Process::OOBW_IN_PROGRESS);
+		verifyRoutingTableEntry(process, disablingProcessRoutingTable);
 	}
 
 	end = disabledProcesses.end();
@@ -142,12 +147,24 @@ Group::verifyExpensiveInvariants() const {
 }
 
 #ifndef NDEBUG
+void
+Group::verifyRoutingTableEntry(const ProcessPtr &process,
+	const ProcessRoutingTable &table) const
+{
+	unsigned int index = process->getIndex();
+	assert(process->getRoutingTable() == &table);
+	assert(table.stickySessionIds[index] == process->getStickySessionId());
+	assert(table.getBusyness(index) == process->busyness());
+	assert((bool) table.routable[index] == process->canBeRoutedTo());
+	assert(table.lastUsed[index] == process->lastUsed);
+}
+
 bool
 Group::verifyNoRequestsOnGetWaitlistAreRoutable() const {
-	deque<GetWaiter>::const_iterator it, end = getWaitlist.end();
+	GetWaitlist::const_iterator it, end = getWaitlist.end();
 
 	for (it = getWaitlist.begin(); it != end; it++) {
-		if (route(it->options).process != NULL) {
+		if (route(*it->options).process != NULL) {
 			return false;
 		}
 	}
@@ -28,6 +28,7 @@
 #include <utility>
 #include <cstdio>
 #include <sstream>
+#include <limits>
 #include <limits.h>
 #include <unistd.h>
 #include <boost/make_shared.hpp>
@@ -49,6 +50,10 @@
 #include <Core/ApplicationPool/Pool/InitializationAndShutdown.cpp>
 #include <Core/ApplicationPool/Pool/AnalyticsCollection.cpp>
 #include <Core/ApplicationPool/Pool/GarbageCollection.cpp>
+#include <Core/ApplicationPool/Pool/HealthChecking.cpp>
+#include <Core/ApplicationPool/Pool/SpawnWorkers.cpp>
+#include <Core/ApplicationPool/Pool/PrespawnManifest.cpp>
+#include <Core/ApplicationPool/Pool/RestartFileWatching.cpp>
 #include <Core/ApplicationPool/Pool/GeneralUtils.cpp>
 #include <Core/ApplicationPool/Pool/GroupUtils.cpp>
 #include <Core/ApplicationPool/Pool/ProcessUtils.cpp>
@@ -58,8 +63,12 @@
 #include <Core/ApplicationPool/Group/LifetimeAndBasics.cpp>
 #include <Core/ApplicationPool/Group/SessionManagement.cpp>
 #include <Core/ApplicationPool/Group/SpawningAndRestarting.cpp>
+#include <Core/ApplicationPool/Group/Autoscaling.cpp>
+#include <Core/ApplicationPool/Group/Cgroups.cpp>
+#include <Core/ApplicationPool/Group/RequestQueueing.cpp>
 #include <Core/ApplicationPool/Group/ProcessListManagement.cpp>
 #include <Core/ApplicationPool/Group/OutOfBandWork.cpp>
+#include <Core/ApplicationPool/Group/HealthChecking.cpp>
 #include <Core/ApplicationPool/Group/Miscellaneous.cpp>
 #include <Core/ApplicationPool/Group/InternalUtils.cpp>
 #include <Core/ApplicationPool/Group/StateInspection.cpp>
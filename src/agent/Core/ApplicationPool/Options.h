@@ -30,6 +30,7 @@
 #include <vector>
 #include <utility>
 #include <boost/shared_array.hpp>
+#include <jsoncpp/json.h>
 #include <AppTypes.h>
 #include <DataStructures/HashedStaticString.h>
 #include <Constants.h>
@@ -45,6 +46,23 @@ namespace ApplicationPool2 {
 using namespace std;
 using namespace boost;
 
+class Group;
+
+/**
+ * Remembers which Group an Options object's app group name refers to. See
+ * `Options::groupLookupCache`.
+ */
+struct GroupLookupCache {
+	Group *group;
+	/** The value of `Pool::groupsGeneration` when `group` was looked up. */
+	unsigned int generation;
+
+	GroupLookupCache()
+		: group(NULL),
+		  generation(0)
+		{ }
+};
+
 /**
  * This struct encapsulates information for ApplicationPool::get() and for
  * Spawner::spawn(), such as which application is to be spawned.
@@ -75,7 +93,25 @@ using namespace boost;
  */
 class Options {
 private:
+	/**
+	 * Persisted string data. This data is immutable once created, so
+	 * persisting an Options object whose strings already live here shares
+	 * this area (by reference count) instead of copying it.
+	 */
 	shared_array<char> storage;
+	size_t storageSize;
+	/**
+	 * Persisted copies of strings that did not live in `storage` at the time
+	 * of persisting, typically per-request fields such as `hostName` and `uri`.
+	 */
+	shared_array<char> extraStorage;
+
+	bool isInStorage(const StaticString &str) const {
+		const char *start = storage.get();
+		return start != NULL
+			&& str.data() >= start
+			&& str.data() + str.size() <= start + storageSize;
+	}
 
 	template<typename OptionsClass, typename StaticStringClass>
 	static vector<StaticStringClass *> getStringFields(OptionsClass &options) {
@@ -84,6 +120,7 @@ private:
 
 		result.push_back(&options.appRoot);
 		result.push_back(&options.appGroupName);
+		result.push_back(&options.tenant);
 		result.push_back(&options.appType);
 		result.push_back(&options.startCommand);
 		result.push_back(&options.startupFile);
@@ -98,6 +135,7 @@ private:
 		result.push_back(&options.defaultUser);
 		result.push_back(&options.defaultGroup);
 		result.push_back(&options.restartDir);
+		result.push_back(&options.preloaderWarmupScript);
 
 		result.push_back(&options.preexecChroot);
 		result.push_back(&options.postexecChroot);
@@ -117,10 +155,63 @@ private:
 		result.push_back(&options.hostName);
 		result.push_back(&options.uri);
 		result.push_back(&options.unionStationKey);
+		result.push_back(&options.routingPolicy);
+		result.push_back(&options.healthCheckPath);
+		result.push_back(&options.cpuAffinity);
 
 		return result;
 	}
 
+	/**
+	 * The JSON keys of the fields returned by `getStringFields()`, in the
+	 * same order. Per-request fields have no key.
+	 */
+	static const char **getStringFieldNames() {
+		static const char *names[] = {
+			"app_root",
+			"app_group_name",
+			"tenant",
+			"app_type",
+			"start_command",
+			"startup_file",
+			"process_title",
+
+			"environment",
+			"base_uri",
+			"spawn_method",
+
+			"user",
+			"group",
+			"default_user",
+			"default_group",
+			"restart_dir",
+			"preloader_warmup_script",
+
+			"preexec_chroot",
+			"postexec_chroot",
+
+			"integration_mode",
+
+			"ruby",
+			"python",
+			"nodejs",
+			"meteor_app_settings",
+
+			"environment_variables",
+			"ust_router_address",
+			"ust_router_username",
+			"ust_router_password",
+			"api_key",
+			NULL, // hostName
+			NULL, // uri
+			"union_station_key",
+			"routing_policy",
+			"health_check_path",
+			"cpu_affinity"
+		};
+		return names;
+	}
+
 	static inline void
 	appendKeyValue(vector<string> &vec, const char *key, const StaticString &value) {
 		if (!value.empty()) {
@@ -176,6 +267,15 @@ public:
 	 */
 	HashedStaticString appGroupName;
 
+	/**
+	 * The tenant that this application belongs to, if the Core serves
+	 * multiple tenants (see `Pool::setTenantMaxProcesses()`). Tenants have
+	 * separate groups even if they use the same app group name (see
+	 * `getGroupKey()`), and the groups of a tenant share its process limit.
+	 * Empty if tenants are not used.
+	 */
+	StaticString tenant;
+
 	/** The application's type, used for determining the command to invoke to
 	 * spawn an application process as well as determining the startup file's
 	 * filename. It can be one of the app type names in AppType.cpp, or the
@@ -246,6 +346,14 @@ public:
 	 */
 	StaticString restartDir;
 
+	/**
+	 * A script that the preloader loads after loading the application and
+	 * before forking any processes, e.g. to eager load constants or to prime
+	 * caches. Relative paths are relative to the application root. An empty
+	 * string means that no warm-up script is run.
+	 */
+	StaticString preloaderWarmupScript;
+
 	StaticString preexecChroot;
 	StaticString postexecChroot;
 
@@ -303,6 +411,14 @@ public:
 	 */
 	bool loadShellEnvvars;
 
+	/** Whether the preloader should compact its heap before forking a
+	 * process, in addition to garbage collecting it. Compaction packs the
+	 * objects that survive into fewer pages, so that forked processes write
+	 * to fewer pages that are shared with the preloader. Only supported on
+	 * Ruby versions that implement GC.compact.
+	 */
+	bool preloaderCompactHeap;
+
 	bool userSwitching;
 
 	/** Whether Union Station logging should be enabled. Enabling this option will
@@ -349,27 +465,198 @@ public:
 	 */
 	unsigned int maxProcesses;
 
+	/**
+	 * This group's weight when the capacity of a full pool is shared between
+	 * groups. Each group's fair share of the pool is `max` processes times its
+	 * weight, divided by the sum of the weights of all groups. When capacity
+	 * has to be freed, idle processes are taken from the groups that are the
+	 * furthest over their share, and freed capacity goes to the groups that
+	 * are the furthest below theirs first.
+	 */
+	unsigned int capacityWeight;
+
+	/**
+	 * The maximum number of processes for this group that may be spawned
+	 * at the same time. Values higher than 1 speed up scaling a group up
+	 * by many processes at once, for example after a traffic surge.
+	 */
+	unsigned int spawnConcurrency;
+
+	/**
+	 * The percentage of time that this group's processes should be busy.
+	 * If nonzero, processes are spawned ahead of demand based on the
+	 * request arrival rate and the average service time, and shut down
+	 * again after the predicted demand has stayed lower for a while.
+	 *
+	 * A value of 0 means disabled: processes are only spawned when
+	 * requests have to wait for one.
+	 */
+	unsigned int targetUtilization;
+
+	/**
+	 * The maximum amount of memory, in MB, that a process may use. Processes
+	 * that go over it are replaced with a freshly spawned successor, and
+	 * shut down after their sessions have finished.
+	 *
+	 * A value of 0 means no limit.
+	 */
+	unsigned int memoryLimit;
+
+	/**
+	 * Spreads out the recycling of processes because of `maxRequests` or
+	 * `memoryLimit`: each process's limits are lowered by a random
+	 * percentage between 0 and this value, so that processes that were
+	 * spawned at the same time don't all reach their limits at the same time.
+	 */
+	unsigned int recycleJitter;
+
+	/**
+	 * The number of seconds during which a newly attached process receives a
+	 * ramped share of the traffic. Its routing weight grows linearly from a
+	 * small fraction to full weight, so that it can warm up its caches
+	 * before it takes a full share of the requests.
+	 *
+	 * A value of 0 means disabled: new processes take full traffic at once.
+	 */
+	unsigned int warmupTime;
+
+	/**
+	 * Whether restarting this group should replace the processes one batch
+	 * at a time, so that old processes keep serving requests until their
+	 * successors are ready. Only applies to RM_DEFAULT restarts.
+	 */
+	bool rollingRestart;
+
+	/**
+	 * The maximum number of processes that are being replaced at the same
+	 * time during a rolling restart.
+	 */
+	unsigned int rollingRestartBatchSize;
+
 	/** The number of seconds that preloader processes may stay alive idling. */
 	long maxPreloaderIdleTime;
 
+	/**
+	 * The number of processes that the preloader should keep forked ahead of
+	 * time. Such standby processes have already been forked but wait for the
+	 * spawn handshake, so spawning a process only needs to activate one of
+	 * them. While nonzero, the preloader is never shut down for being idle.
+	 * Standby processes don't count towards any process limits.
+	 *
+	 * Only applies to smart spawning.
+	 */
+	unsigned int preloaderStandbyProcesses;
+
 	/**
 	 * The maximum number of processes inside a group that may be performing
 	 * out-of-band work at the same time.
 	 */
 	unsigned int maxOutOfBandWorkInstances;
 
+	/**
+	 * The percentage of a group's processes that may be performing out-of-band
+	 * work at the same time. If this allows more processes than
+	 * `maxOutOfBandWorkInstances` then this takes precedence. 0 means that only
+	 * `maxOutOfBandWorkInstances` applies.
+	 */
+	unsigned int maxOutOfBandWorkPercentage;
+
+	/**
+	 * Out-of-band work is deferred while the group's utilization, as a
+	 * percentage of the capacity of its enabled processes, is above this value.
+	 * 0 means that out-of-band work is only deferred while requests are queued.
+	 */
+	unsigned int outOfBandWorkMaxUtilization;
+
+	/**
+	 * If nonzero, processes are also given out-of-band work without having
+	 * requested it: whenever the group is not under load, each idle process
+	 * gets an "idle window" at most once per this many seconds. This lets
+	 * apps move work such as garbage collection to times at which they are
+	 * not needed, instead of guessing when that is. See
+	 * Group::offerIdleOobwWindows().
+	 */
+	unsigned int outOfBandWorkIdleInterval;
+
+	/**
+	 * The path that the pool's health checker periodically requests from each
+	 * of this group's processes. A process that fails to respond with a 2xx or
+	 * 3xx status within `healthCheckTimeout` seconds is ejected: it's taken
+	 * out of routing for `healthCheckEjectionTime` seconds, and only allowed
+	 * back after it has passed a health check again.
+	 *
+	 * An empty value means that no health check requests are sent.
+	 */
+	StaticString healthCheckPath;
+
+	/** The number of seconds between health checks of a process. */
+	unsigned int healthCheckInterval;
+
+	/** The number of seconds that a health check request may take. */
+	unsigned int healthCheckTimeout;
+
+	/**
+	 * If a process has had requests in progress for this many seconds without
+	 * finishing any of them, then it is considered unresponsive and ejected,
+	 * just like a process that fails a health check.
+	 *
+	 * A value of 0 means disabled.
+	 */
+	unsigned int unresponsiveProcessTimeout;
+
+	/**
+	 * The number of seconds that an unhealthy process is ejected for. This is
+	 * multiplied by the number of times that the process has been ejected in
+	 * a row, which is capped at 3; a process that becomes unhealthy again
+	 * after that is detached and replaced.
+	 */
+	unsigned int healthCheckEjectionTime;
+
 	/**
 	 * The maximum number of requests that may live in the Group.getWaitlist queue.
 	 * A value of 0 means unlimited.
 	 */
 	unsigned int maxRequestQueueSize;
 
+	/**
+	 * The target time, in milliseconds, that requests may wait in the
+	 * Group.getWaitlist queue. When the oldest waiter has been over this
+	 * target for a while, waiters that are over it are rejected with a
+	 * RequestQueueFullException. A value of 0 means no limit.
+	 */
+	unsigned int requestQueueTargetDelay;
+
+	/**
+	 * The token bucket rate limit, in requests per second, and the cap on
+	 * the number of requests in flight that the Controller enforces per
+	 * rate limit key of this group (see Controller::enforceRateLimit()).
+	 * They default to the Core's global limits, and a value of 0 means
+	 * no limit. A burst of 0 means the same as the rate.
+	 */
+	unsigned int rateLimit;
+	unsigned int rateLimitBurst;
+	unsigned int maxRequestsInFlight;
+
 	/**
 	 * Whether websocket connections should be aborted on process shutdown
 	 * or restart.
 	 */
 	bool abortWebsocketsOnProcessShutdown;
 
+	/**
+	 * How Group::route() picks a process among the enabled processes when
+	 * the request has no sticky session ID. One of "least-busy" (default),
+	 * "p2c", "ewma" or "consistent-hash". See Group::parseRoutingPolicy().
+	 */
+	StaticString routingPolicy;
+
+	/**
+	 * On which CPUs the group's processes are placed when they are spawned.
+	 * One of "none" (default, also used when empty), "round-robin",
+	 * "numa-node" or "exclude-core". See SpawningKit::CpuAffinityPolicy.
+	 */
+	StaticString cpuAffinity;
+
 	/**
 	 * The Union Station key to use in case analytics logging is enabled.
 	 * It is used by Pool::collectAnalytics() and other administrative
@@ -415,6 +702,20 @@ public:
 	 */
 	unsigned int stickySessionId;
 
+	/**
+	 * A hash of the request's routing key, for the "consistent-hash" routing
+	 * policy. Requests with the same hash are routed to the same process
+	 * if it isn't overloaded. 0 if the request has no routing key.
+	 */
+	boost::uint32_t routingHash;
+
+	/**
+	 * If this request has to wait for a process, then it is queued in front
+	 * of waiting requests with a lower priority. Values above
+	 * `GetWaitlist::PRIORITY_CLASSES - 1` are treated as that value.
+	 */
+	unsigned int priority;
+
 	/**
 	 * A throttling rate for file stats. When set to a non-zero value N,
 	 * restart.txt and other files which are usually stat()ted on every
@@ -444,6 +745,16 @@ public:
 	 */
 	bool noop;
 
+	/**
+	 * If non-NULL, `Pool::findMatchingGroup()` caches the result of looking
+	 * up `getAppGroupName()` here, so that lookups with copies of this object
+	 * can skip the group table. Only accessed while holding the pool lock.
+	 * See `enableGroupLookupCache()`. Not carried over by `persist()`.
+	 */
+	GroupLookupCache *groupLookupCache;
+	/** Storage for `groupLookupCache`, used by `enableGroupLookupCache()`. */
+	GroupLookupCache ownGroupLookupCache;
+
 	/*-----------------*/
 	/*-----------------*/
 
@@ -471,7 +782,8 @@ public:
 	 * One must still set appRoot manually, after having used this constructor.
 	 */
 	Options()
-		: logLevel(DEFAULT_LOG_LEVEL),
+		: storageSize(0),
+		  logLevel(DEFAULT_LOG_LEVEL),
 		  startTimeout(90 * 1000),
 		  environment(DEFAULT_APP_ENV, sizeof(DEFAULT_APP_ENV) - 1),
 		  baseURI("/", 1),
@@ -486,22 +798,47 @@ public:
 		  forceMaxConcurrentRequestsPerProcess(-1),
 		  debugger(false),
 		  loadShellEnvvars(true),
+		  preloaderCompactHeap(false),
 		  userSwitching(true),
 		  analytics(false),
 		  raiseInternalError(false),
 
 		  minProcesses(1),
 		  maxProcesses(0),
+		  capacityWeight(1),
+		  spawnConcurrency(1),
+		  targetUtilization(0),
+		  memoryLimit(0),
+		  recycleJitter(0),
+		  warmupTime(0),
+		  rollingRestart(false),
+		  rollingRestartBatchSize(1),
 		  maxPreloaderIdleTime(-1),
+		  preloaderStandbyProcesses(0),
 		  maxOutOfBandWorkInstances(1),
+		  maxOutOfBandWorkPercentage(0),
+		  outOfBandWorkMaxUtilization(0),
+		  outOfBandWorkIdleInterval(0),
+		  healthCheckInterval(10),
+		  healthCheckTimeout(5),
+		  unresponsiveProcessTimeout(0),
+		  healthCheckEjectionTime(30),
 		  maxRequestQueueSize(100),
+		  requestQueueTargetDelay(0),
+		  rateLimit(0),
+		  rateLimitBurst(0),
+		  maxRequestsInFlight(0),
 		  abortWebsocketsOnProcessShutdown(true),
+		  routingPolicy(DEFAULT_ROUTING_POLICY, sizeof(DEFAULT_ROUTING_POLICY) - 1),
 
 		  stickySessionId(0),
+		  routingHash(0),
+		  priority(0),
 		  statThrottleRate(DEFAULT_STAT_THROTTLE_RATE),
 		  maxRequests(0),
 		  currentTime(0),
-		  noop(false)
+		  noop(false),
+		  groupLookupCache(NULL)
 		  /*********************************/
 	{
 		/*********************************/
@@ -521,12 +858,21 @@ public:
 	 * Assign <em>other</em>'s string fields' values into this Option
 	 * object, and store the data in this Option object's internal storage
 	 * area.
+	 *
+	 * String fields that already live in <em>other</em>'s internal storage
+	 * area are not copied: that area is shared instead. So persisting an
+	 * Options object that was copied from a persisted one (e.g. the
+	 * Controller's cached per-app options) only copies the fields that were
+	 * changed since, such as the per-request fields.
 	 */
 	Options &persist(const Options &other) {
 		vector<StaticString *> strings = getStringFields<Options, StaticString>(*this);
 		const vector<const StaticString *> otherStrings =
 			getStringFields<const Options, const StaticString>(other);
-		unsigned int i;
+		// `other` may be this object.
+		shared_array<char> otherStorage = other.storage;
+		size_t otherStorageSize = other.storageSize;
+		unsigned int i, nshared = 0;
 		size_t otherLen = 0;
 		char *end;
 
@@ -535,18 +881,31 @@ public:
 		// Calculate the desired length of the internal storage area.
 		// All strings are NULL-terminated.
 		for (i = 0; i < otherStrings.size(); i++) {
-			otherLen += otherStrings[i]->size() + 1;
+			if (other.isInStorage(*otherStrings[i])) {
+				nshared++;
+			} else {
+				otherLen += otherStrings[i]->size() + 1;
+			}
 		}
 
-		shared_array<char> data(new char[otherLen]);
+		shared_array<char> data;
+		if (otherLen > 0) {
+			data.reset(new char[otherLen]);
+		}
 		end = data.get();
 
 		// Copy string fields into the internal storage area.
 		for (i = 0; i < otherStrings.size(); i++) {
-			const char *pos = end;
 			StaticString *str = strings[i];
 			const StaticString *otherStr = otherStrings[i];
 
+			if (other.isInStorage(*otherStr)) {
+				*str = *otherStr;
+				continue;
+			}
+
+			const char *pos = end;
+
 			// Copy over the string data.
 			memcpy(end, otherStr->c_str(), otherStr->size());
 			end += otherStr->size();
@@ -558,12 +917,36 @@ public:
 			*str = StaticString(pos, end - pos - 1);
 		}
 
-		storage = data;
+		if (nshared > 0) {
+			storage = otherStorage;
+			storageSize = otherStorageSize;
+			extraStorage = data;
+		} else {
+			storage = data;
+			storageSize = otherLen;
+			extraStorage.reset();
+		}
 
 		// Fix up HashedStaticStrings' hashes.
 		appRoot.setHash(other.appRoot.hash());
 		appGroupName.setHash(other.appGroupName.hash());
 
+		// The cache may belong to an object that doesn't live as long as
+		// this one.
+		groupLookupCache = NULL;
+
+		return *this;
+	}
+
+	/**
+	 * Makes this object, and all objects that are later copied from it,
+	 * share a group lookup cache that's stored in this object. This object
+	 * must outlive all those copies, so only call this on long-lived Options
+	 * objects with immutable app group names, such as those in the
+	 * Controller's per-app options cache.
+	 */
+	Options &enableGroupLookupCache() {
+		groupLookupCache = &ownGroupLookupCache;
 		return *this;
 	}
 
@@ -571,6 +954,8 @@ public:
 		hostName = StaticString();
 		uri      = StaticString();
 		stickySessionId = 0;
+		routingHash     = 0;
+		priority        = 0;
 		currentTime     = 0;
 		noop     = false;
 		return detachFromUnionStationTransaction();
@@ -612,6 +997,7 @@ public:
 			appendKeyValue (vec, "default_user",       defaultUser);
 			appendKeyValue (vec, "default_group",      defaultGroup);
 			appendKeyValue (vec, "restart_dir",        restartDir);
+			appendKeyValue (vec, "preloader_warmup_script", preloaderWarmupScript);
 			appendKeyValue (vec, "preexec_chroot",     preexecChroot);
 			appendKeyValue (vec, "postexec_chroot",    postexecChroot);
 			appendKeyValue (vec, "integration_mode",   integrationMode);
@@ -623,6 +1009,7 @@ public:
 			appendKeyValue (vec, "ust_router_username", ustRouterUsername);
 			appendKeyValue (vec, "ust_router_password", ustRouterPassword);
 			appendKeyValue4(vec, "debugger",           debugger);
+			appendKeyValue4(vec, "preloader_compact_heap", preloaderCompactHeap);
 			appendKeyValue4(vec, "analytics",          analytics);
 			appendKeyValue (vec, "api_key",            apiKey);
 
@@ -631,8 +1018,32 @@ public:
 		if (fields & PER_GROUP_POOL_OPTIONS) {
 			appendKeyValue3(vec, "min_processes",       minProcesses);
 			appendKeyValue3(vec, "max_processes",       maxProcesses);
+			appendKeyValue (vec, "tenant",              tenant);
+			appendKeyValue3(vec, "capacity_weight",     capacityWeight);
+			appendKeyValue3(vec, "spawn_concurrency",   spawnConcurrency);
+			appendKeyValue3(vec, "target_utilization",  targetUtilization);
+			appendKeyValue3(vec, "memory_limit",        memoryLimit);
+			appendKeyValue3(vec, "recycle_jitter",      recycleJitter);
+			appendKeyValue3(vec, "warmup_time",         warmupTime);
+			appendKeyValue4(vec, "rolling_restart",     rollingRestart);
+			appendKeyValue3(vec, "rolling_restart_batch_size", rollingRestartBatchSize);
+			appendKeyValue3(vec, "request_queue_target_delay", requestQueueTargetDelay);
+			appendKeyValue3(vec, "rate_limit",          rateLimit);
+			appendKeyValue3(vec, "rate_limit_burst",    rateLimitBurst);
+			appendKeyValue3(vec, "max_requests_in_flight", maxRequestsInFlight);
 			appendKeyValue2(vec, "max_preloader_idle_time", maxPreloaderIdleTime);
+			appendKeyValue3(vec, "preloader_standby_processes", preloaderStandbyProcesses);
 			appendKeyValue3(vec, "max_out_of_band_work_instances", maxOutOfBandWorkInstances);
+			appendKeyValue3(vec, "max_out_of_band_work_percentage", maxOutOfBandWorkPercentage);
+			appendKeyValue3(vec, "out_of_band_work_max_utilization", outOfBandWorkMaxUtilization);
+			appendKeyValue3(vec, "out_of_band_work_idle_interval", outOfBandWorkIdleInterval);
+			appendKeyValue (vec, "health_check_path",   healthCheckPath);
+			appendKeyValue3(vec, "health_check_interval", healthCheckInterval);
+			appendKeyValue3(vec, "health_check_timeout", healthCheckTimeout);
+			appendKeyValue3(vec, "unresponsive_process_timeout", unresponsiveProcessTimeout);
+			appendKeyValue3(vec, "health_check_ejection_time", healthCheckEjectionTime);
+			appendKeyValue (vec, "routing_policy",      routingPolicy);
+			appendKeyValue (vec, "cpu_affinity",        cpuAffinity);
 		}
 		if ((fields & SPAWN_OPTIONS) || (fields & PER_GROUP_POOL_OPTIONS)) {
 			appendKeyValue (vec, "union_station_key",   unionStationKey);
@@ -656,6 +1067,146 @@ public:
 		}
 	}
 
+	/**
+	 * Stores the options that are needed to recreate this app's group into
+	 * `doc`, so that the group can be prespawned after a restart of the Core.
+	 * Per-request fields are not included.
+	 */
+	void toJson(Json::Value &doc) const {
+		vector<const StaticString *> strings =
+			getStringFields<const Options, const StaticString>(*this);
+		const char **names = getStringFieldNames();
+		unsigned int i;
+
+		for (i = 0; i < strings.size(); i++) {
+			if (names[i] != NULL && !strings[i]->empty()) {
+				doc[names[i]] = strings[i]->toString();
+			}
+		}
+		doc["log_level"] = logLevel;
+		doc["start_timeout"] = startTimeout;
+		doc["lve_min_uid"] = lveMinUid;
+		doc["file_descriptor_ulimit"] = fileDescriptorUlimit;
+		doc["force_max_concurrent_requests_per_process"] = forceMaxConcurrentRequestsPerProcess;
+		doc["debugger"] = debugger;
+		doc["load_shell_envvars"] = loadShellEnvvars;
+		doc["preloader_compact_heap"] = preloaderCompactHeap;
+		doc["user_switching"] = userSwitching;
+		doc["analytics"] = analytics;
+		doc["min_processes"] = minProcesses;
+		doc["max_processes"] = maxProcesses;
+		doc["capacity_weight"] = capacityWeight;
+		doc["spawn_concurrency"] = spawnConcurrency;
+		doc["target_utilization"] = targetUtilization;
+		doc["memory_limit"] = memoryLimit;
+		doc["recycle_jitter"] = recycleJitter;
+		doc["warmup_time"] = warmupTime;
+		doc["rolling_restart"] = rollingRestart;
+		doc["rolling_restart_batch_size"] = rollingRestartBatchSize;
+		doc["max_preloader_idle_time"] = (Json::Int) maxPreloaderIdleTime;
+		doc["preloader_standby_processes"] = preloaderStandbyProcesses;
+		doc["max_out_of_band_work_instances"] = maxOutOfBandWorkInstances;
+		doc["max_out_of_band_work_percentage"] = maxOutOfBandWorkPercentage;
+		doc["out_of_band_work_max_utilization"] = outOfBandWorkMaxUtilization;
+		doc["out_of_band_work_idle_interval"] = outOfBandWorkIdleInterval;
+		doc["health_check_interval"] = healthCheckInterval;
+		doc["health_check_timeout"] = healthCheckTimeout;
+		doc["unresponsive_process_timeout"] = unresponsiveProcessTimeout;
+		doc["health_check_ejection_time"] = healthCheckEjectionTime;
+		doc["max_request_queue_size"] = maxRequestQueueSize;
+		doc["request_queue_target_delay"] = requestQueueTargetDelay;
+		doc["rate_limit"] = rateLimit;
+		doc["rate_limit_burst"] = rateLimitBurst;
+		doc["max_requests_in_flight"] = maxRequestsInFlight;
+		doc["abort_websockets_on_process_shutdown"] = abortWebsocketsOnProcessShutdown;
+		doc["stat_throttle_rate"] = (Json::UInt) statThrottleRate;
+		doc["max_requests"] = (Json::UInt) maxRequests;
+	}
+
+	/**
+	 * The inverse of `toJson()`. Fields that are missing from `doc` keep
+	 * their default values. The result is persisted.
+	 */
+	static Options fromJson(const Json::Value &doc) {
+		Options options;
+		vector<StaticString *> strings = getStringFields<Options, StaticString>(options);
+		const char **names = getStringFieldNames();
+		unsigned int i;
+
+		for (i = 0; i < strings.size(); i++) {
+			if (names[i] != NULL && doc.isMember(names[i])) {
+				*strings[i] = doc[names[i]].asCString();
+			}
+		}
+		options.appRoot.rehash();
+		options.appGroupName.rehash();
+		options.logLevel = doc.get("log_level", options.logLevel).asInt();
+		options.startTimeout = doc.get("start_timeout", options.startTimeout).asUInt();
+		options.lveMinUid = doc.get("lve_min_uid", options.lveMinUid).asUInt();
+		options.fileDescriptorUlimit = doc.get("file_descriptor_ulimit",
+			options.fileDescriptorUlimit).asUInt();
+		options.forceMaxConcurrentRequestsPerProcess = doc.get(
+			"force_max_concurrent_requests_per_process",
+			options.forceMaxConcurrentRequestsPerProcess).asInt();
+		options.debugger = doc.get("debugger", options.debugger).asBool();
+		options.loadShellEnvvars = doc.get("load_shell_envvars",
+			options.loadShellEnvvars).asBool();
+		options.preloaderCompactHeap = doc.get("preloader_compact_heap",
+			options.preloaderCompactHeap).asBool();
+		options.userSwitching = doc.get("user_switching", options.userSwitching).asBool();
+		options.analytics = doc.get("analytics", options.analytics).asBool();
+		options.minProcesses = doc.get("min_processes", options.minProcesses).asUInt();
+		options.maxProcesses = doc.get("max_processes", options.maxProcesses).asUInt();
+		options.capacityWeight = doc.get("capacity_weight", options.capacityWeight).asUInt();
+		options.spawnConcurrency = doc.get("spawn_concurrency",
+			options.spawnConcurrency).asUInt();
+		options.targetUtilization = doc.get("target_utilization",
+			options.targetUtilization).asUInt();
+		options.memoryLimit = doc.get("memory_limit", options.memoryLimit).asUInt();
+		options.recycleJitter = doc.get("recycle_jitter", options.recycleJitter).asUInt();
+		options.warmupTime = doc.get("warmup_time", options.warmupTime).asUInt();
+		options.rollingRestart = doc.get("rolling_restart", options.rollingRestart).asBool();
+		options.rollingRestartBatchSize = doc.get("rolling_restart_batch_size",
+			options.rollingRestartBatchSize).asUInt();
+		options.maxPreloaderIdleTime = doc.get("max_preloader_idle_time",
+			(Json::Int) options.maxPreloaderIdleTime).asInt();
+		options.preloaderStandbyProcesses = doc.get("preloader_standby_processes",
+			options.preloaderStandbyProcesses).asUInt();
+		options.maxOutOfBandWorkInstances = doc.get("max_out_of_band_work_instances",
+			options.maxOutOfBandWorkInstances).asUInt();
+		options.maxOutOfBandWorkPercentage = doc.get("max_out_of_band_work_percentage",
+			options.maxOutOfBandWorkPercentage).asUInt();
+		options.outOfBandWorkMaxUtilization = doc.get("out_of_band_work_max_utilization",
+			options.outOfBandWorkMaxUtilization).asUInt();
+		options.outOfBandWorkIdleInterval = doc.get("out_of_band_work_idle_interval",
+			options.outOfBandWorkIdleInterval).asUInt();
+		options.healthCheckInterval = doc.get("health_check_interval",
+			options.healthCheckInterval).asUInt();
+		options.healthCheckTimeout = doc.get("health_check_timeout",
+			options.healthCheckTimeout).asUInt();
+		options.unresponsiveProcessTimeout = doc.get("unresponsive_process_timeout",
+			options.unresponsiveProcessTimeout).asUInt();
+		options.healthCheckEjectionTime = doc.get("health_check_ejection_time",
+			options.healthCheckEjectionTime).asUInt();
+		options.maxRequestQueueSize = doc.get("max_request_queue_size",
+			options.maxRequestQueueSize).asUInt();
+		options.requestQueueTargetDelay = doc.get("request_queue_target_delay",
+			options.requestQueueTargetDelay).asUInt();
+		options.rateLimit = doc.get("rate_limit", options.rateLimit).asUInt();
+		options.rateLimitBurst = doc.get("rate_limit_burst",
+			options.rateLimitBurst).asUInt();
+		options.maxRequestsInFlight = doc.get("max_requests_in_flight",
+			options.maxRequestsInFlight).asUInt();
+		options.abortWebsocketsOnProcessShutdown = doc.get(
+			"abort_websockets_on_process_shutdown",
+			options.abortWebsocketsOnProcessShutdown).asBool();
+		options.statThrottleRate = doc.get("stat_throttle_rate",
+			(Json::UInt) options.statThrottleRate).asUInt();
+		options.maxRequests = doc.get("max_requests",
+			(Json::UInt) options.maxRequests).asUInt();
+		return options.copyAndPersist();
+	}
+
 	/**
 	 * Returns the app group name. If there is no explicitly set app group name
 	 * then the app root is considered to be the app group name.
@@ -668,6 +1219,26 @@ public:
 		}
 	}
 
+	/**
+	 * Returns the key under which the Pool stores the group of this
+	 * application. That's the app group name, unless the application
+	 * belongs to a tenant: then it's the tenant, a NUL byte and the app
+	 * group name, so that the groups of different tenants never collide.
+	 * In that case the key is built in `storage`.
+	 */
+	HashedStaticString getGroupKey(string &storage) const {
+		if (tenant.empty()) {
+			return getAppGroupName();
+		} else {
+			const HashedStaticString &name = getAppGroupName();
+			storage.reserve(tenant.size() + 1 + name.size());
+			storage.assign(tenant.data(), tenant.size());
+			storage.append(1, '\0');
+			storage.append(name.data(), name.size());
+			return storage;
+		}
+	}
+
 	string getStartCommand(const ResourceLocator &resourceLocator) const {
 		if (appType == P_STATIC_STRING("rack")) {
 			return ruby + "\t" + resourceLocator.getHelperScriptsDir() + "/rack-loader.rb";
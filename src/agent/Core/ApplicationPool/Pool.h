@@ -28,6 +28,8 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
 #include <algorithm>
 #include <utility>
 #include <sstream>
@@ -38,6 +40,7 @@
 #include <boost/make_shared.hpp>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/pool/object_pool.hpp>
 // We use boost::container::vector instead of std::vector, because the
 // former does not allocate memory in its default constructor. This is
@@ -58,11 +61,15 @@
 #include <Utils/VariantMap.h>
 #include <Utils/ProcessMetricsCollector.h>
 #include <Utils/SystemMetricsCollector.h>
+#include <Utils/SystemMetricsHistory.h>
+#include <Utils/FileSystemWatcher.h>
 #include <Core/UnionStation/StopwatchLog.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/Process.h>
 #include <Core/ApplicationPool/Group.h>
+#include <Core/ApplicationPool/ProcessStateDelta.h>
+#include <Core/ApplicationPool/GetWaitlist.h>
 #include <Core/ApplicationPool/Session.h>
 #include <Core/ApplicationPool/Options.h>
 #include <Core/SpawningKit/Factory.h>
@@ -151,6 +158,67 @@ public:
 		}
 	};
 
+	/**
+	 * A copy of the pool's state, as shown by `inspect()`, `toXml()` and
+	 * `toJson()`. takeSnapshot() holds the lock only while copying, so
+	 * that formatting, which takes milliseconds for pools with hundreds
+	 * of processes, does not block request routing.
+	 */
+	struct Snapshot {
+		unsigned int max;
+		unsigned int groupCount;
+		unsigned int processCount;
+		unsigned int capacityUsed;
+		/** The app group names of the requests in the top-level queue. */
+		vector<string> getWaitlist;
+		/** Only the groups that the caller is authorized to see. */
+		vector<GroupSnapshot> groups;
+	};
+
+	/**
+	 * Counters for metrics exposition. collectMetrics() only copies them
+	 * while holding the lock, so that they can be formatted without it.
+	 */
+	struct Metrics {
+		struct GroupMetrics {
+			string name;
+			unsigned int enabledProcessCount;
+			unsigned int disablingProcessCount;
+			unsigned int disabledProcessCount;
+			unsigned int processesBeingSpawned;
+			unsigned int totallyBusyProcessCount;
+			unsigned int sessions;
+			unsigned int capacityUsed;
+			unsigned int getWaitlistSize;
+			unsigned long long spawnsSucceeded;
+			unsigned long long spawnsFailed;
+			/** In KB. -1 if the group has no cgroup of its own. */
+			ssize_t cgroupMemoryUsage;
+			/**
+			 * The sums of the metrics that the group's processes published
+			 * about themselves. Only processes that publish metrics count.
+			 */
+			unsigned int appMetricsProcessCount;
+			unsigned int collectingGarbageProcessCount;
+			unsigned long long gcCount;
+			/** In usec. */
+			unsigned long long gcTime;
+			/** In bytes. */
+			unsigned long long heapSize;
+			unsigned long long threadsBusy;
+			unsigned long long threadsTotal;
+		};
+
+		unsigned int max;
+		unsigned int capacityUsed;
+		unsigned int getWaitlistSize;
+		/** The limits of the Core's own cgroup. See SystemMetrics. */
+		ssize_t cgroupMemoryLimit;
+		ssize_t cgroupMemoryUsage;
+		double cgroupCpuQuota;
+		vector<GroupMetrics> groups;
+	};
+
 
 // Actually private, but marked public so that unit tests can access the fields.
 public:
@@ -161,6 +229,8 @@ public:
 	mutable boost::mutex syncher;
 	unsigned int max;
 	unsigned long long maxIdleTime;
+	/** Maximum number of processes per tenant. See `setTenantMaxProcesses()`. */
+	std::map<string, unsigned int> tenantMaxProcesses;
 	bool selfchecking;
 
 	Context context;
@@ -185,6 +255,12 @@ public:
 	} lifeStatus;
 
 	mutable GroupMap groups;
+	/**
+	 * Incremented every time a group is added to or removed from `groups`.
+	 * Allows `findMatchingGroup()` to tell whether a GroupLookupCache is
+	 * still valid.
+	 */
+	unsigned int groupsGeneration;
 	psg_pool_t *palloc;
 
 	/**
@@ -214,7 +290,7 @@ public:
 	 *
 	 * Invariant 1:
 	 *    for all options in getWaitlist:
-	 *       options.getAppGroupName() is not in 'groups'.
+	 *       options.getGroupKey() is not in 'groups'.
 	 *
 	 * Invariant 2:
 	 *    if getWaitlist is non-empty:
@@ -223,7 +299,7 @@ public:
 	 *    if !atFullCapacity():
 	 *       getWaitlist is empty.
 	 */
-	vector<GetWaiter> getWaitlist;
+	GetWaitlist getWaitlist;
 
 	const VariantMap *agentsOptions;
 
@@ -272,10 +348,17 @@ public:
 		const char *category;
 		string key;
 		string data;
+		/** If set, `data` is encoded from this after the lock is released. */
+		boost::shared_ptr<GroupStateRecord> groupState;
 	};
 
+	/** Only accessed by the analytics collector thread. */
+	ProcessMetricsCollector processMetricsCollector;
 	SystemMetricsCollector systemMetricsCollector;
 	SystemMetrics systemMetrics;
+	ProcessStateDeltaEncoder processStateDeltaEncoder;
+	/** Protected by `syncher`. Sampled by the analytics collector. */
+	SystemMetricsHistory systemMetricsHistory;
 
 	void initializeAnalyticsCollection();
 	static void collectAnalytics(PoolPtr self);
@@ -283,6 +366,8 @@ public:
 	static void updateProcessMetrics(const ProcessList &processes,
 		const ProcessMetricMap &allMetrics,
 		vector<ProcessPtr> &processesToDetach);
+	static void collectProcessStates(const ProcessList &processes,
+		vector<ProcessStateRecord> &records);
 	void prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntries,
 		const GroupPtr &group) const;
 	void prepareUnionStationSystemMetricsLogs(vector<UnionStationLogEntry> &logEntries,
@@ -290,11 +375,115 @@ public:
 	void realCollectAnalytics();
 
 
+	/****** Health checking ******/
+
+	struct HealthCheck {
+		ProcessPtr process;
+		string address;
+		string protocol;
+		string path;
+		string connectPassword;
+		unsigned long long timeout;
+		/** Whether the process expects a ring slot index first. See ShmRingFile. */
+		bool sendShmRingSlot;
+		bool healthy;
+	};
+
+	void initializeHealthChecking();
+	static void checkHealth(PoolPtr self);
+	void scheduleHealthChecksInGroup(unsigned long long now, const GroupPtr &group,
+		vector<HealthCheck> &checks, boost::container::vector<Callback> &actions);
+	static HealthCheck createHealthCheck(const GroupPtr &group, const ProcessPtr &process);
+	static bool performHealthCheck(const HealthCheck &check);
+	static int parseHealthCheckResponseStatus(const StaticString &response);
+	void realCheckHealth();
+
+
+	/****** Spawn workers ******/
+
+	/**
+	 * One iteration of a Group's spawn loop, as scheduled on the spawn
+	 * workers. Holds a reference to the group to keep it alive.
+	 */
+	struct SpawnJob {
+		GroupPtr group;
+		SpawningKit::SpawnerPtr spawner;
+		Options options;
+		unsigned int restartsInitiated;
+	};
+
+	/**
+	 * The number of spawn workers. If 0, then every spawn loop runs in a
+	 * thread of its own. Otherwise, spawn loops are run by this many shared
+	 * threads, one iteration at a time. A spawn loop that isn't done yet is
+	 * put back at the end of the queue, so that the groups take turns.
+	 */
+	unsigned int spawnWorkerCount;
+	boost::mutex spawnJobsSyncher;
+	boost::condition_variable spawnJobsCond;
+	deque<SpawnJob> spawnJobs;
+	bool spawnWorkersStopping;
+
+	static void spawnWorkerMain(PoolPtr self);
+	void scheduleSpawnJob(const SpawnJob &job);
+	void stopSpawnWorkers();
+
+
+	/****** Prespawn manifest ******/
+
+	/**
+	 * If nonzero, the groups and their process counts are periodically
+	 * saved to the prespawn manifest in the instance directory. When the
+	 * Core is restarted, the groups in the manifest are spawned again, at
+	 * most this many groups at a time.
+	 */
+	unsigned int prespawnConcurrency;
+	/**
+	 * Prespawning pauses while the 1 minute load average per CPU is higher
+	 * than this percentage. 0 means that there is no limit.
+	 */
+	unsigned int prespawnMaxLoad;
+	/**
+	 * The cgroup directory under which groups create their own cgroups,
+	 * or the empty string. Immutable after the first group is created.
+	 */
+	string appCgroupRoot;
+	/** Whether the manifest is being replayed. It isn't saved in the meantime. */
+	bool prespawnReplaying;
+	/** Only accessed by the analytics collector thread. */
+	string lastPrespawnManifest;
+
+	string getPrespawnManifestPath() const;
+	Json::Value createPrespawnManifest() const;
+	void savePrespawnManifest();
+	static void replayPrespawnManifest(PoolPtr self, Json::Value manifest);
+	bool prespawnThrottled() const;
+	bool prespawnGroup(const Json::Value &entry);
+
+
+	/****** Restart file watching ******/
+
+	/**
+	 * If set, the directories that contain the groups' restart.txt and
+	 * always_restart.txt are watched for changes, so that the groups don't
+	 * have to poll those files with stat(). Groups whose restart directory
+	 * cannot be watched, e.g. because it doesn't exist, keep polling.
+	 */
+	boost::scoped_ptr<FileSystemWatcher> restartFileWatcher;
+
+	static void watchRestartFiles(PoolPtr self);
+	void processRestartFileEvents(const vector<FileSystemWatcher::Event> &events);
+	void startWatchingRestartFiles(Group *group);
+	void stopWatchingRestartFiles(Group *group);
+
+
 	/****** Garbage collection ******/
 
 	struct GarbageCollectorState {
 		unsigned long long now;
 		unsigned long long nextGcRunTime;
+		/** Like nextGcRunTime, but only for the group that is being examined. */
+		unsigned long long groupNextGcRunTime;
 		boost::container::vector<Callback> actions;
 	};
 
@@ -304,10 +493,15 @@ public:
 	static void garbageCollect(PoolPtr self);
 	void maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candidate);
 	void checkWhetherProcessCanBeGarbageCollected(GarbageCollectorState &state,
-		const GroupPtr &group, const ProcessPtr &process, ProcessList &output);
+		const GroupPtr &group, unsigned int index, ProcessList &output);
 	void garbageCollectProcessesInGroup(GarbageCollectorState &state,
 		const GroupPtr &group);
+	void autoscaleProcessesInGroup(GarbageCollectorState &state,
+		const GroupPtr &group);
+	void shedDelayedGetWaitersInGroup(GarbageCollectorState &state,
+		const GroupPtr &group);
 	void maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group);
+	void garbageCollectGroup(GarbageCollectorState &state, const GroupPtr &group);
 	unsigned long long realGarbageCollect();
 	void wakeupGarbageCollector();
 
@@ -327,6 +521,10 @@ public:
 	template<typename Queue> static void assignExceptionToGetWaiters(Queue &getWaitlist,
 		const ExceptionPtr &exception,
 		boost::container::vector<Callback> &postLockActions);
+	static void rejectCancelledGetWaiter(const GetWaiter &waiter,
+		boost::container::vector<Callback> &postLockActions);
+	static void removeCancelledGetWaiters(GetWaitlist &getWaitlist,
+		boost::container::vector<Callback> &postLockActions);
 	static void syncGetCallback(const AbstractSessionPtr &session, const ExceptionPtr &e,
 		void *userData);
 
@@ -368,26 +566,38 @@ public:
 		}
 	};
 
-	ProcessPtr findOldestIdleProcess(const Group *exclude = NULL) const;
+	ProcessPtr findProcessToFreeCapacity(const Group *exclude = NULL) const;
 	ProcessPtr findBestProcessToTrash() const;
 	ProcessPtr forceFreeCapacity(const Group *exclude,
 		boost::container::vector<Callback> &postLockActions);
 	bool detachProcessUnlocked(const ProcessPtr &process,
 		boost::container::vector<Callback> &postLockActions);
+	void detachReplacedProcess(const ProcessPtr &process, DisableResult result,
+		bool spawnReplacement);
 	static void syncDisableProcessCallback(const ProcessPtr &process, DisableResult result,
 		boost::shared_ptr<DisableWaitTicket> ticket);
 	void possiblySpawnMoreProcessesForExistingGroups();
+	static bool usesLessCapacityByWeight(const Group *a, const Group *b);
 
 
 	/****** State inspection ******/
 
 	unsigned int capacityUsedUnlocked() const;
 	bool atFullCapacityUnlocked() const;
-	void inspectProcessList(const InspectOptions &options, stringstream &result,
-		const Group *group, const ProcessList &processes) const;
+	unsigned int tenantCapacityUsedUnlocked(const StaticString &tenant) const;
+	bool tenantAtFullCapacityUnlocked(const StaticString &tenant) const;
+	unsigned int totalCapacityWeightUnlocked() const;
+	unsigned int fairCapacityShare(const Group *group, unsigned int totalWeight) const;
+	static void inspectProcessList(const InspectOptions &options, stringstream &result,
+		const GroupSnapshot &group);
+	static void collectAppMetrics(const ProcessList &processes,
+		Metrics::GroupMetrics &groupMetrics);
 
 public:
-	typedef void (*AbortLongRunningConnectionsCallback)(const ProcessPtr &process);
+	/** Called with the Pool lock held when a process is detached (`drain`
+	 * is true) and when the Pool prepares for shutdown (`drain` is false). */
+	typedef void (*AbortLongRunningConnectionsCallback)(const ProcessPtr &process,
+		bool drain);
 	AbortLongRunningConnectionsCallback abortLongRunningConnectionsCallback;
 
 
@@ -440,19 +650,37 @@ public:
 	unsigned int capacityUsed() const;
 	bool atFullCapacity() const;
 	unsigned int getProcessCount(bool lock = true) const;
+	unsigned int getEnabledProcessCount(const HashedStaticString &groupKey) const;
 	unsigned int getGroupCount() const;
 	string inspect(const InspectOptions &options = InspectOptions::makeAuthorized(),
 		bool lock = true) const;
 	string toXml(const ToXmlOptions &options = ToXmlOptions::makeAuthorized(),
 		bool lock = true) const;
+	string toJson(const ToXmlOptions &options = ToXmlOptions::makeAuthorized(),
+		bool lock = true) const;
+	void takeSnapshot(Snapshot &snapshot,
+		const AuthenticationOptions &options = AuthenticationOptions::makeAuthorized(),
+		bool lock = true) const;
+	static string inspect(const Snapshot &snapshot, const InspectOptions &options);
+	static string toXml(const Snapshot &snapshot, const ToXmlOptions &options);
+	static string toJson(const Snapshot &snapshot, const ToXmlOptions &options);
+	void collectMetrics(Metrics &metrics) const;
+	Json::Value inspectSystemMetricsHistoryAsJson(unsigned int maxAge) const;
+	Json::Value getConfigAsJson() const;
 
 
 	/****** Miscellaneous ******/
 
 	void asyncGet(const Options &options, const GetCallback &callback, bool lockNow = true, UnionStation::StopwatchLog **stopwatchLog = NULL);
 	SessionPtr get(const Options &options, Ticket *ticket);
+	void closeSessions(SessionCloseBatch &batch);
 	void setMax(unsigned int max);
 	void setMaxIdleTime(unsigned long long value);
+	void setTenantMaxProcesses(const string &tenant, unsigned int max);
+	void setSpawnWorkerCount(unsigned int count);
+	void enablePrespawnManifest(unsigned int concurrency, unsigned int maxLoad);
+	void setAppCgroupRoot(const string &path);
+	bool enableRestartFileWatching();
 	void enableSelfChecking(bool enabled);
 	bool isSpawning(bool lock = true) const;
 	bool authorizeByApiKey(const ApiKey &key, bool lock = true) const;
@@ -24,6 +24,7 @@
  *  THE SOFTWARE.
  */
 #include <Core/ApplicationPool/Pool.h>
+#include <modp_b64.h>
 
 /*************************************************************************
  *
@@ -55,6 +56,8 @@ Pool::collectAnalytics(PoolPtr self) {
 		try {
 			UPDATE_TRACE_POINT();
 			self->realCollectAnalytics();
+			UPDATE_TRACE_POINT();
+			self->savePrespawnManifest();
 		} catch (const thread_interrupted &) {
 			break;
 		} catch (const tracable_exception &e) {
@@ -94,6 +97,9 @@ Pool::updateProcessMetrics(const ProcessList &processes,
 			allMetrics.find(process->getPid());
 		if (metrics_it != allMetrics.end()) {
 			process->metrics = metrics_it->second;
+			if (!process->initialMetrics.isValid()) {
+				process->initialMetrics = metrics_it->second;
+			}
 		// If the process is missing from 'allMetrics' then either 'ps'
 		// failed or the process really is gone. We double check by sending
 		// it a signal.
@@ -105,6 +111,46 @@ Pool::updateProcessMetrics(const ProcessList &processes,
 	}
 }
 
+void
+Pool::collectProcessStates(const ProcessList &processes,
+	vector<ProcessStateRecord> &records)
+{
+	foreach (const ProcessPtr &process, processes) {
+		records.push_back(ProcessStateRecord());
+		ProcessStateRecord &record = records.back();
+		boost::int64_t *fields = record.fields;
+
+		record.gupid.assign(process->getGupid().data(), process->getGupid().size());
+		fields[ProcessStateRecord::PID] = process->getPid();
+		fields[ProcessStateRecord::STICKY_SESSION_ID] = process->getStickySessionId();
+		fields[ProcessStateRecord::ENABLED] = process->enabled;
+		fields[ProcessStateRecord::LIFE_STATUS] = process->lifeStatus;
+		fields[ProcessStateRecord::FLAGS] =
+			(process->overMemoryLimit ? ProcessStateRecord::OVER_MEMORY_LIMIT : 0)
+			| (process->reachedMaxRequests ? ProcessStateRecord::REACHED_MAX_REQUESTS : 0)
+			| (process->outdated ? ProcessStateRecord::OUTDATED : 0);
+		fields[ProcessStateRecord::CONCURRENCY] = process->getConcurrency();
+		fields[ProcessStateRecord::SESSIONS] = process->sessions;
+		fields[ProcessStateRecord::BUSYNESS] = process->busyness();
+		fields[ProcessStateRecord::PROCESSED] = process->processed;
+		fields[ProcessStateRecord::AVG_RESPONSE_TIME] = (boost::int64_t) process->avgResponseTime;
+		fields[ProcessStateRecord::SPAWN_END_TIME] = process->getSpawnEndTime();
+		fields[ProcessStateRecord::LAST_USED] = process->lastUsed;
+		fields[ProcessStateRecord::OOBW_COUNT] = process->oobwCount;
+		fields[ProcessStateRecord::EJECTED_UNTIL] = process->ejectedUntil;
+		fields[ProcessStateRecord::EJECTION_COUNT] = process->ejectionCount;
+		fields[ProcessStateRecord::HEALTH_CHECK_FAILURES] = process->healthCheckFailures;
+		fields[ProcessStateRecord::DRAINING_CONNECTIONS] =
+			process->drainingConnections.load(boost::memory_order_relaxed);
+		fields[ProcessStateRecord::CPU] = process->metrics.cpu;
+		fields[ProcessStateRecord::RSS] = process->metrics.rss;
+		fields[ProcessStateRecord::PSS] = process->metrics.pss;
+		fields[ProcessStateRecord::PRIVATE_DIRTY] = process->metrics.privateDirty;
+		fields[ProcessStateRecord::SWAP] = process->metrics.swap;
+		fields[ProcessStateRecord::VMSIZE] = process->metrics.vmsize;
+	}
+}
+
 void
 Pool::prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntries,
 	const GroupPtr &group) const
@@ -113,16 +159,31 @@ Pool::prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntri
 	if (group->options.analytics && unionStationContext != NULL) {
 		logEntries.push_back(UnionStationLogEntry());
 		UnionStationLogEntry &entry = logEntries.back();
-		stringstream stream;
-
-		stream << "Group: <group>";
-		group->inspectXml(stream, false);
-		stream << "</group>";
+		entry.groupState = boost::make_shared<GroupStateRecord>();
+		GroupStateRecord &state = *entry.groupState;
+		boost::int64_t *fields = state.fields;
 
 		entry.groupName = group->options.getAppGroupName();
-		entry.category  = "processes";
+		entry.category  = "process_states";
 		entry.key       = group->options.unionStationKey;
-		entry.data      = stream.str();
+
+		// Only copy what's needed to encode the record. The encoding
+		// itself happens after the lock is released.
+		fields[GroupStateRecord::ENABLED_COUNT] = group->enabledCount;
+		fields[GroupStateRecord::DISABLING_COUNT] = group->disablingCount;
+		fields[GroupStateRecord::DISABLED_COUNT] = group->disabledCount;
+		fields[GroupStateRecord::CAPACITY_USED] = group->capacityUsed();
+		fields[GroupStateRecord::GET_WAITLIST_SIZE] = group->getWaitlist.size();
+		fields[GroupStateRecord::DISABLE_WAITLIST_SIZE] = group->disableWaitlist.size();
+		fields[GroupStateRecord::PROCESSES_BEING_SPAWNED] = group->processesBeingSpawned;
+		fields[GroupStateRecord::CGROUP_MEMORY_USAGE] = group->cgroupMemoryUsage;
+		fields[GroupStateRecord::LIFE_STATUS] =
+			group->lifeStatus.load(boost::memory_order_relaxed);
+		state.processes.reserve(group->getProcessCount() + group->detachedProcesses.size());
+		collectProcessStates(group->enabledProcesses, state.processes);
+		collectProcessStates(group->disablingProcesses, state.processes);
+		collectProcessStates(group->disabledProcesses, state.processes);
+		collectProcessStates(group->detachedProcesses, state.processes);
 	}
 }
 
@@ -152,6 +213,8 @@ Pool::realCollectAnalytics() {
 	boost::this_thread::disable_interruption di;
 	boost::this_thread::disable_syscall_interruption dsi;
 	vector<pid_t> pids;
+	vector<GroupPtr> cgroupGroups;
+	vector<ssize_t> cgroupMemoryUsages;
 	unsigned int max;
 
 	P_DEBUG("Analytics collection time...");
@@ -172,6 +235,9 @@ Pool::realCollectAnalytics() {
 			collectPids(group->enabledProcesses, pids);
 			collectPids(group->disablingProcesses, pids);
 			collectPids(group->disabledProcesses, pids);
+			if (!group->cgroupPath.empty()) {
+				cgroupGroups.push_back(group);
+			}
 			g_it.next();
 		}
 	}
@@ -182,9 +248,12 @@ Pool::realCollectAnalytics() {
 	try {
 		UPDATE_TRACE_POINT();
 		P_DEBUG("Collecting process metrics");
-		processMetrics = ProcessMetricsCollector().collect(pids);
+		processMetrics = processMetricsCollector.collect(pids);
 	} catch (const ParseException &) {
-		P_WARN("Unable to collect process metrics: cannot parse 'ps' output.");
+		P_WARN("Unable to collect process metrics: cannot parse 'ps' output or /proc.");
+		return;
+	} catch (const RuntimeException &e) {
+		P_WARN("Unable to collect process metrics: " << e.what());
 		return;
 	}
 	try {
@@ -195,6 +264,12 @@ Pool::realCollectAnalytics() {
 		P_WARN("Unable to collect system metrics: " << e.what());
 		return;
 	}
+	// Group::cgroupPath is immutable, so we can read it without the lock.
+	UPDATE_TRACE_POINT();
+	cgroupMemoryUsages.reserve(cgroupGroups.size());
+	foreach (const GroupPtr &group, cgroupGroups) {
+		cgroupMemoryUsages.push_back(Group::readCgroupMemoryUsage(group->cgroupPath));
+	}
 
 	{
 		UPDATE_TRACE_POINT();
@@ -204,12 +279,20 @@ Pool::realCollectAnalytics() {
 		ScopedLock l(syncher);
 		GroupMap::ConstIterator g_it(groups);
 
+		systemMetricsHistory.add(systemMetrics, SystemTime::get());
+		for (unsigned int i = 0; i < cgroupGroups.size(); i++) {
+			cgroupGroups[i]->cgroupMemoryUsage = cgroupMemoryUsages[i];
+		}
+
 		UPDATE_TRACE_POINT();
 		while (*g_it != NULL) {
 			const GroupPtr &group = g_it.getValue();
 			updateProcessMetrics(group->enabledProcesses, processMetrics, processesToDetach);
 			updateProcessMetrics(group->disablingProcesses, processMetrics, processesToDetach);
 			updateProcessMetrics(group->disabledProcesses, processMetrics, processesToDetach);
+			if (group->options.memoryLimit > 0 && group->isAlive()) {
+				group->recycleProcessesOverMemoryLimit(actions);
+			}
 			prepareUnionStationProcessStateLogs(logEntries, group);
 			prepareUnionStationSystemMetricsLogs(logEntries, group);
 			g_it.next();
@@ -227,8 +310,21 @@ Pool::realCollectAnalytics() {
 		if (!logEntries.empty()) {
 			const UnionStation::ContextPtr &unionStationContext = getUnionStationContext();
 			P_DEBUG("Sending process and system metrics to Union Station");
+			string record;
 			while (!logEntries.empty()) {
 				UnionStationLogEntry &entry = logEntries.back();
+				if (entry.groupState != NULL) {
+					// Process states are sent as deltas against the
+					// previous cycle. Nothing is sent if nothing changed.
+					if (!processStateDeltaEncoder.encode(entry.groupName,
+						*entry.groupState, record))
+					{
+						logEntries.pop_back();
+						continue;
+					}
+					entry.data = "Process states: " + modp::b64_encode(record.data(),
+						record.size());
+				}
 				UnionStation::TransactionPtr transaction =
 					unionStationContext->newTransaction(
 						entry.groupName,
@@ -238,6 +334,7 @@ Pool::realCollectAnalytics() {
 				logEntries.pop_back();
 			}
 		}
+		processStateDeltaEncoder.endCycle();
 
 		UPDATE_TRACE_POINT();
 		runAllActions(actions);
@@ -76,21 +76,28 @@ Pool::maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candi
 	if (state.nextGcRunTime == 0 || candidate < state.nextGcRunTime) {
 		state.nextGcRunTime = candidate;
 	}
+	if (state.groupNextGcRunTime == 0 || candidate < state.groupNextGcRunTime) {
+		state.groupNextGcRunTime = candidate;
+	}
 }
 
 void
 Pool::checkWhetherProcessCanBeGarbageCollected(GarbageCollectorState &state,
-	const GroupPtr &group, const ProcessPtr &process, ProcessList &output)
+	const GroupPtr &group, unsigned int index, ProcessList &output)
 {
+	// Only looks at the routing table, so that this doesn't have to touch
+	// the Process objects that aren't garbage collected. A busyness of 0
+	// means that the process has no sessions.
+	const ProcessRoutingTable &table = group->enabledProcessRoutingTable;
 	assert(maxIdleTime > 0);
-	unsigned long long processGcTime = process->lastUsed + maxIdleTime;
-	if (process->sessions == 0
+	unsigned long long processGcTime = table.lastUsed[index] + maxIdleTime;
+	if (table.getBusyness(index) == 0
 	 && state.now >= processGcTime)
 	{
 		if (output.capacity() == 0) {
 			output.reserve(group->enabledCount);
 		}
-		output.push_back(process);
+		output.push_back(group->enabledProcesses[index]);
 	} else {
 		maybeUpdateNextGcRuntime(state, processGcTime);
 	}
@@ -100,20 +107,21 @@ void
 Pool::garbageCollectProcessesInGroup(GarbageCollectorState &state,
 	const GroupPtr &group)
 {
-	ProcessList &processes = group->enabledProcesses;
 	ProcessList processesToGc;
-	ProcessList::iterator p_it, p_end = processes.end();
+	ProcessList::iterator p_it, p_end;
+	unsigned int i, size = group->enabledProcessRoutingTable.size();
 
-	for (p_it = processes.begin(); p_it != p_end; p_it++) {
-		const ProcessPtr &process = *p_it;
-		checkWhetherProcessCanBeGarbageCollected(state, group, process,
+	for (i = 0; i < size; i++) {
+		checkWhetherProcessCanBeGarbageCollected(state, group, i,
 			processesToGc);
 	}
 
 	p_it  = processesToGc.begin();
 	p_end = processesToGc.end();
 	while (p_it != p_end
-	 && (unsigned long) group->getProcessCount() > group->options.minProcesses)
+	 && (unsigned long) group->getProcessCount() > group->options.minProcesses
+	 && (group->options.targetUtilization == 0
+	     || (unsigned int) group->getProcessCount() > group->autoscaler.desiredProcessCount))
 	{
 		ProcessPtr process = *p_it;
 		P_DEBUG("Garbage collect idle process: " << process->inspect() <<
@@ -123,9 +131,69 @@ Pool::garbageCollectProcessesInGroup(GarbageCollectorState &state,
 	}
 }
 
+/**
+ * Lets the autoscaler of the given group catch up with the absence of
+ * arrivals, spawns processes in case it wants more, and shuts down idle
+ * processes once it has wanted fewer for at least
+ * Group::AUTOSCALER_SCALE_DOWN_DELAY.
+ */
+void
+Pool::autoscaleProcessesInGroup(GarbageCollectorState &state,
+	const GroupPtr &group)
+{
+	Group::AutoscalerState &autoscaler = group->autoscaler;
+	group->updateAutoscaler(state.now);
+
+	unsigned int keep = std::max(autoscaler.desiredProcessCount,
+		group->options.minProcesses);
+	if ((unsigned int) group->enabledCount <= keep) {
+		autoscaler.scaleDownPendingSince = 0;
+	} else if (autoscaler.scaleDownPendingSince == 0) {
+		autoscaler.scaleDownPendingSince = state.now;
+		maybeUpdateNextGcRuntime(state, state.now + Group::AUTOSCALER_SCALE_DOWN_DELAY);
+	} else if (state.now >= autoscaler.scaleDownPendingSince + Group::AUTOSCALER_SCALE_DOWN_DELAY) {
+		Process *process;
+		while ((unsigned int) group->enabledCount > keep
+		    && (process = group->findIdleEnabledProcessToScaleDown()) != NULL)
+		{
+			P_DEBUG("Autoscaler shuts down idle process: " << process->inspect() <<
+				", group=" << group->getName() << ", desired process count=" <<
+				autoscaler.desiredProcessCount);
+			group->detach(process->shared_from_this(), state.actions);
+		}
+		autoscaler.scaleDownPendingSince = 0;
+	} else {
+		maybeUpdateNextGcRuntime(state,
+			autoscaler.scaleDownPendingSince + Group::AUTOSCALER_SCALE_DOWN_DELAY);
+	}
+
+	if (group->autoscalerWantsMoreProcesses() && group->allowSpawn()) {
+		P_DEBUG("Autoscaler spawns a process for group " << group->getName() <<
+			", desired process count=" << autoscaler.desiredProcessCount);
+		group->spawn();
+	}
+	maybeUpdateNextGcRuntime(state, state.now + Group::AUTOSCALER_UPDATE_INTERVAL);
+}
+
+void
+Pool::shedDelayedGetWaitersInGroup(GarbageCollectorState &state,
+	const GroupPtr &group)
+{
+	group->shedDelayedGetWaiters(state.now, state.actions);
+	if (!group->getWaitlist.empty()) {
+		// Check again when the oldest remaining waiter is to be rejected.
+		maybeUpdateNextGcRuntime(state, group->getWaitlist.getOldestEnqueueTime()
+			+ group->options.requestQueueTargetDelay * 1000ull
+			+ Group::REQUEST_QUEUE_SHED_INTERVAL);
+	}
+}
+
 void
 Pool::maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group) {
-	if (group->spawner->cleanable() && group->options.getMaxPreloaderIdleTime() != 0) {
+	// A preloader with standby processes is kept warm on purpose.
+	if (group->spawner->cleanable() && group->options.getMaxPreloaderIdleTime() != 0
+	 && group->options.preloaderStandbyProcesses == 0)
+	{
 		unsigned long long spawnerGcTime =
 			group->spawner->lastUsed() +
 			group->options.getMaxPreloaderIdleTime() * 1000000;
@@ -138,6 +206,53 @@ Pool::maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group) {
 	}
 }
 
+/**
+ * Performs the garbage collection work for a group that is due, and
+ * records when it will be due next.
+ */
+void
+Pool::garbageCollectGroup(GarbageCollectorState &state, const GroupPtr &group) {
+	state.groupNextGcRunTime = 0;
+
+	if (maxIdleTime > 0) {
+		// ...detach processes that have been idle for more than maxIdleTime.
+		garbageCollectProcessesInGroup(state, group);
+	}
+
+	if (group->options.targetUtilization > 0) {
+		// ...scale the number of processes according to the predicted demand.
+		autoscaleProcessesInGroup(state, group);
+	}
+
+	if (group->findEnabledOutdatedProcess() != NULL) {
+		// ...continue a rolling restart that got stuck.
+		group->replaceOutdatedProcesses(state.actions);
+		if (group->findEnabledOutdatedProcess() != NULL) {
+			maybeUpdateNextGcRuntime(state, state.now);
+		}
+	}
+
+	// ...start out-of-band work that was deferred while the group was under
+	// load, in case no sessions have been closed since.
+	group->initiateNextOobwRequest();
+
+	if (group->options.outOfBandWorkIdleInterval > 0) {
+		// ...give idle processes out-of-band work while the load is low.
+		maybeUpdateNextGcRuntime(state, group->offerIdleOobwWindows(state.now));
+	}
+
+	// ...cleanup the spawner if it's been idle for more than preloaderIdleTime.
+	maybeCleanPreloader(state, group);
+
+	if (state.groupNextGcRunTime == 0) {
+		// Nothing is due until something happens that resets
+		// nextGarbageCollectionTime.
+		group->nextGarbageCollectionTime = std::numeric_limits<unsigned long long>::max();
+	} else {
+		group->nextGarbageCollectionTime = state.groupNextGcRunTime;
+	}
+}
+
 unsigned long long
 Pool::realGarbageCollect() {
 	TRACE_POINT();
@@ -146,6 +261,7 @@ Pool::realGarbageCollect() {
 	GarbageCollectorState state;
 	state.now = SystemTime::getUsec();
 	state.nextGcRunTime = 0;
+	state.groupNextGcRunTime = 0;
 
 	P_DEBUG("Garbage collection time...");
 	verifyInvariants();
@@ -154,16 +270,23 @@ Pool::realGarbageCollect() {
 	while (*g_it != NULL) {
 		const GroupPtr group = g_it.getValue();
 
-		if (maxIdleTime > 0) {
-			// ...detach processes that have been idle for more than maxIdleTime.
-			garbageCollectProcessesInGroup(state, group);
+		if (state.now >= group->nextGarbageCollectionTime) {
+			// ...that have work due, do that work. Other groups are only
+			// looked at once they become due, so that a pass over many
+			// mostly-idle groups stays cheap.
+			garbageCollectGroup(state, group);
+		} else if (group->nextGarbageCollectionTime
+			!= std::numeric_limits<unsigned long long>::max())
+		{
+			maybeUpdateNextGcRuntime(state, group->nextGarbageCollectionTime);
 		}
 
-		group->verifyInvariants();
-
-		// ...cleanup the spawner if it's been idle for more than preloaderIdleTime.
-		maybeCleanPreloader(state, group);
+		if (group->options.requestQueueTargetDelay > 0 && !group->getWaitlist.empty()) {
+			// ...reject requests that have been queued for too long.
+			shedDelayedGetWaitersInGroup(state, group);
+		}
 
+		group->verifyInvariants();
 		g_it.next();
 	}
 
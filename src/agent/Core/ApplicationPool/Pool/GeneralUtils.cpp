@@ -116,11 +116,12 @@ Pool::verifyExpensiveInvariants() const {
 	if (!selfchecking) {
 		return;
 	}
-	vector<GetWaiter>::const_iterator it, end = getWaitlist.end();
+	GetWaitlist::const_iterator it, end = getWaitlist.end();
 	for (it = getWaitlist.begin(); it != end; it++) {
 		const GetWaiter &waiter = *it;
 		const GroupPtr *group;
-		assert(!groups.lookup(waiter.options.getAppGroupName(), &group));
+		string key;
+		assert(!groups.lookup(waiter.options->getGroupKey(key), &group));
 	}
 	#endif
 }
@@ -149,16 +150,23 @@ Pool::fullVerifyInvariants() const {
  */
 void
 Pool::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions) {
-	bool done = false;
-	vector<GetWaiter>::iterator it, end = getWaitlist.end();
-	vector<GetWaiter> newWaitlist;
+	GetWaitlist waitlist;
 
-	for (it = getWaitlist.begin(); it != end && !done; it++) {
-		GetWaiter &waiter = *it;
+	// Waiters that still cannot be satisfied are put back in getWaitlist,
+	// in the same order.
+	waitlist.swap(getWaitlist);
 
-		Group *group = findMatchingGroup(waiter.options);
+	for (; !waitlist.empty(); waitlist.pop_front()) {
+		GetWaiter &waiter = waitlist.front();
+
+		if (waiter.callback.cancelled()) {
+			rejectCancelledGetWaiter(waiter, postLockActions);
+			continue;
+		}
+
+		Group *group = findMatchingGroup(*waiter.options);
 		if (group != NULL) {
-			SessionPtr session = group->get(waiter.options, waiter.callback,
+			SessionPtr session = group->get(*waiter.options, waiter.callback,
 				postLockActions);
 			if (session != NULL) {
 				postLockActions.push_back(boost::bind(GetCallback::call,
@@ -168,17 +176,15 @@ Pool::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockAct
 			 *       the group's get wait list.
 			 */
 		} else if (!atFullCapacityUnlocked()) {
-			createGroupAndAsyncGetFromIt(waiter.options, waiter.callback,
+			createGroupAndAsyncGetFromIt(*waiter.options, waiter.callback,
 				postLockActions);
 		} else {
 			/* Still cannot satisfy this get request. Keep it on the get
 			 * wait list and try again later.
 			 */
-			newWaitlist.push_back(waiter);
+			getWaitlist.push_back(waiter);
 		}
 	}
-
-	std::swap(getWaitlist, newWaitlist);
 }
 
 template<typename Queue>
@@ -195,6 +201,47 @@ Pool::assignExceptionToGetWaiters(Queue &getWaitlist,
 	}
 }
 
+/**
+ * Calls the callback of a waiter whose requester is no longer interested in
+ * a session. The caller is responsible for removing it from its wait list.
+ */
+void
+Pool::rejectCancelledGetWaiter(const GetWaiter &waiter,
+	boost::container::vector<Callback> &postLockActions)
+{
+	postLockActions.push_back(boost::bind(GetCallback::call,
+		waiter.callback, SessionPtr(),
+		boost::make_shared<GetAbortedException>(
+			"The request was cancelled while waiting for a process")));
+}
+
+/**
+ * Removes all waiters whose requesters are no longer interested
+ * in a session, preserving the order of the others.
+ */
+void
+Pool::removeCancelledGetWaiters(GetWaitlist &getWaitlist,
+	boost::container::vector<Callback> &postLockActions)
+{
+	for (unsigned int i = 0; i < GetWaitlist::PRIORITY_CLASSES; i++) {
+		deque<GetWaiter> &queue = getWaitlist.getQueue(i);
+		deque<GetWaiter>::iterator it, end = queue.end();
+		deque<GetWaiter>::iterator dest = queue.begin();
+
+		for (it = queue.begin(); it != end; it++) {
+			if (it->callback.cancelled()) {
+				rejectCancelledGetWaiter(*it, postLockActions);
+			} else {
+				if (dest != it) {
+					*dest = *it;
+				}
+				dest++;
+			}
+		}
+		queue.erase(dest, end);
+	}
+}
+
 void
 Pool::syncGetCallback(const AbstractSessionPtr &session, const ExceptionPtr &e,
 	void *userData)
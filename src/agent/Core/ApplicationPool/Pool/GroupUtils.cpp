@@ -58,19 +58,33 @@ Pool::getGroup(const char *name) {
 
 Group *
 Pool::findMatchingGroup(const Options &options) {
+	GroupLookupCache *cache = options.groupLookupCache;
+	if (cache != NULL && cache->generation == groupsGeneration) {
+		return cache->group;
+	}
+
 	GroupPtr *group;
-	if (groups.lookup(options.getAppGroupName(), &group)) {
-		return group->get();
+	Group *result;
+	string key;
+	if (groups.lookup(options.getGroupKey(key), &group)) {
+		result = group->get();
 	} else {
-		return NULL;
+		result = NULL;
+	}
+	if (cache != NULL) {
+		cache->group = result;
+		cache->generation = groupsGeneration;
 	}
+	return result;
 }
 
 GroupPtr
 Pool::createGroup(const Options &options) {
 	GroupPtr group = boost::make_shared<Group>(this, options);
 	group->initialize();
-	groups.insert(options.getAppGroupName(), group);
+	startWatchingRestartFiles(group.get());
+	groups.insert(group->getKey(), group);
+	groupsGeneration++;
 	wakeupGarbageCollector();
 	return group;
 }
@@ -109,9 +123,11 @@ Pool::forceDetachGroup(const GroupPtr &group,
 {
 	assert(group->getWaitlist.empty());
 	const GroupPtr p = group; // Prevent premature destruction.
-	bool removed = groups.erase(group->getName());
+	bool removed = groups.erase(group->getKey());
+	groupsGeneration++;
 	assert(removed);
 	(void) removed; // Shut up compiler warning.
+	stopWatchingRestartFiles(group.get());
 	group->shutdown(callback, postLockActions);
 }
 
@@ -147,7 +163,8 @@ Pool::findOrCreateGroup(const Options &options) {
 	{
 		LockGuard l(syncher);
 		GroupPtr *group;
-		if (!groups.lookup(options.getAppGroupName(), &group)) {
+		string key;
+		if (!groups.lookup(options.getGroupKey(key), &group)) {
 			// Forcefully create Group, don't care whether resource limits
 			// actually allow it.
 			createGroup(options);
@@ -170,6 +187,10 @@ Pool::findGroupByApiKey(const StaticString &value, bool lock) const {
 	return GroupPtr();
 }
 
+/**
+ * Detaches the group with the given key (see `Group::getKey()`), which is
+ * its name unless the group belongs to a tenant.
+ */
 bool
 Pool::detachGroupByName(const HashedStaticString &name) {
 	TRACE_POINT();
@@ -177,7 +198,7 @@ Pool::detachGroupByName(const HashedStaticString &name) {
 	GroupPtr group = groups.lookupCopy(name);
 
 	if (OXT_LIKELY(group != NULL)) {
-		P_ASSERT_EQ(group->getName(), name);
+		P_ASSERT_EQ(group->getKey(), name);
 		UPDATE_TRACE_POINT();
 		verifyInvariants();
 		verifyExpensiveInvariants();
@@ -219,10 +240,10 @@ Pool::detachGroupByApiKey(const StaticString &value) {
 	ScopedLock l(syncher);
 	GroupPtr group = findGroupByApiKey(value, false);
 	if (group != NULL) {
-		string name = group->getName();
+		string key = group->getKey();
 		group.reset();
 		l.unlock();
-		return detachGroupByName(name);
+		return detachGroupByName(key);
 	} else {
 		return false;
 	}
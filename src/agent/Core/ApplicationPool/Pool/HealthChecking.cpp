@@ -0,0 +1,334 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * Health checking functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+void
+Pool::initializeHealthChecking() {
+	interruptableThreads.create_thread(
+		boost::bind(checkHealth, shared_from_this()),
+		"Pool health checker",
+		POOL_HELPER_THREAD_STACK_SIZE
+	);
+}
+
+void
+Pool::checkHealth(PoolPtr self) {
+	TRACE_POINT();
+	while (!boost::this_thread::interruption_requested()) {
+		try {
+			UPDATE_TRACE_POINT();
+			syscalls::usleep(1000000);
+			UPDATE_TRACE_POINT();
+			self->realCheckHealth();
+		} catch (const thread_interrupted &) {
+			break;
+		} catch (const tracable_exception &e) {
+			P_WARN("ERROR: " << e.what() << "\n  Backtrace:\n" << e.backtrace());
+		}
+	}
+}
+
+/**
+ * Ejects the group's unresponsive processes, readmits processes whose ejection
+ * has expired if the group has no active health checks, and adds the active
+ * health checks that are due to `checks`. Enabled processes that are totally
+ * busy are not actively checked, because the check would have to wait for
+ * their other requests; the passive check covers them.
+ */
+void
+Pool::scheduleHealthChecksInGroup(unsigned long long now, const GroupPtr &group,
+	vector<HealthCheck> &checks, boost::container::vector<Callback> &actions)
+{
+	if (!group->isAlive() || group->restarting() || !group->healthCheckingEnabled()) {
+		return;
+	}
+
+	bool active = !group->options.healthCheckPath.empty();
+	unsigned long long interval = (unsigned long long)
+		group->options.healthCheckInterval * 1000000;
+	vector<ProcessPtr> processesToEject, processesToReadmit;
+	ProcessList::const_iterator it, end = group->enabledProcesses.end();
+
+	for (it = group->enabledProcesses.begin(); it != end; it++) {
+		const ProcessPtr &process = *it;
+		// The process may have been enabled by something else than
+		// readmitProcess(), e.g. an admin command.
+		process->ejectedUntil = 0;
+		if (process->processed > process->processedAtReadmission) {
+			process->consecutiveEjections = 0;
+		}
+
+		if (group->processUnresponsive(process.get(), now)) {
+			processesToEject.push_back(process);
+		} else if (active && now >= process->nextHealthCheckTime
+			&& !process->isDummy() && !process->isTotallyBusy())
+		{
+			process->nextHealthCheckTime = now + interval;
+			checks.push_back(createHealthCheck(group, process));
+		}
+	}
+
+	const ProcessList *lists[] = { &group->disablingProcesses, &group->disabledProcesses };
+	for (unsigned int i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		end = lists[i]->end();
+		for (it = lists[i]->begin(); it != end; it++) {
+			const ProcessPtr &process = *it;
+			if (process->ejectedUntil == 0 || now < process->ejectedUntil) {
+				continue;
+			}
+			if (!active || process->isDummy()) {
+				processesToReadmit.push_back(process);
+			} else if (now >= process->nextHealthCheckTime) {
+				process->nextHealthCheckTime = now + interval;
+				checks.push_back(createHealthCheck(group, process));
+			}
+		}
+	}
+
+	foreach (const ProcessPtr &process, processesToEject) {
+		if (process->isAlive() && process->enabled == Process::ENABLED) {
+			group->ejectProcess(process, now, "not responding to requests", actions);
+		}
+	}
+	foreach (const ProcessPtr &process, processesToReadmit) {
+		if (process->isAlive() && process->enabled != Process::DETACHED) {
+			group->readmitProcess(process, now, actions);
+		}
+	}
+}
+
+Pool::HealthCheck
+Pool::createHealthCheck(const GroupPtr &group, const ProcessPtr &process) {
+	const Socket *socket = process->findSessionSocketWithLowestBusyness();
+	HealthCheck check;
+	check.process = process;
+	check.sendShmRingSlot = false;
+	if (socket != NULL) {
+		check.address = socket->address;
+		check.protocol = socket->protocol;
+		check.sendShmRingSlot = socket->shmRingFile != NULL;
+	}
+	check.path = group->options.healthCheckPath;
+	check.connectPassword = group->getApiKey().toStaticString();
+	check.timeout = (unsigned long long) group->options.healthCheckTimeout * 1000000;
+	check.healthy = false;
+	return check;
+}
+
+/**
+ * Sends a GET request for the health check path to the process, and returns
+ * whether it responded with a 2xx or 3xx status within the timeout. Must be
+ * called without holding the lock.
+ */
+bool
+Pool::performHealthCheck(const HealthCheck &check) {
+	TRACE_POINT();
+	if (check.address.empty()) {
+		return false;
+	}
+
+	unsigned long long timeout = check.timeout;
+	try {
+		NConnect_State state;
+		setupNonBlockingSocket(state, check.address, __FILE__, __LINE__);
+		int fd = (state.type == SAT_UNIX) ? (int) state.s_unix.fd : (int) state.s_tcp.fd;
+		if (!connectToServer(state)) {
+			// A Unix socket whose backlog is full isn't accepting
+			// connections, so there's nothing to wait for.
+			if (state.type == SAT_UNIX
+			 || !waitUntilWritable(fd, &timeout)
+			 || !connectToServer(state))
+			{
+				return false;
+			}
+		}
+
+		UPDATE_TRACE_POINT();
+		if (check.sendShmRingSlot) {
+			// We don't use a ring.
+			writeExact(fd, "\xFF\xFF\xFF\xFF", 4, &timeout);
+		}
+		if (check.protocol == "session") {
+			string data;
+			#define PUSH_PAIR(key, value) \
+				do { \
+					data.append(key); \
+					data.append(1, '\0'); \
+					data.append(value); \
+					data.append(1, '\0'); \
+				} while (false)
+			PUSH_PAIR("REQUEST_URI", check.path);
+			PUSH_PAIR("PATH_INFO", check.path);
+			PUSH_PAIR("SCRIPT_NAME", "");
+			PUSH_PAIR("QUERY_STRING", "");
+			PUSH_PAIR("REQUEST_METHOD", "GET");
+			PUSH_PAIR("SERVER_NAME", "localhost");
+			PUSH_PAIR("SERVER_PORT", "80");
+			PUSH_PAIR("SERVER_SOFTWARE", PROGRAM_NAME);
+			PUSH_PAIR("SERVER_PROTOCOL", "HTTP/1.1");
+			PUSH_PAIR("REMOTE_ADDR", "127.0.0.1");
+			PUSH_PAIR("REMOTE_PORT", "0");
+			PUSH_PAIR("HTTP_HOST", "localhost");
+			PUSH_PAIR("PASSENGER_CONNECT_PASSWORD", check.connectPassword);
+			#undef PUSH_PAIR
+
+			char sizeBuf[sizeof(boost::uint32_t)];
+			Uint32Message::generate(sizeBuf, data.size());
+			writeExact(fd, sizeBuf, sizeof(sizeBuf), &timeout);
+			writeExact(fd, data, &timeout);
+		} else {
+			writeExact(fd, "GET " + check.path + " HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n\r\n",
+				&timeout);
+		}
+
+		UPDATE_TRACE_POINT();
+		char buf[1024];
+		string response;
+		while (response.size() < sizeof(buf) && response.find("\r\n\r\n") == string::npos) {
+			if (!waitUntilReadable(fd, &timeout)) {
+				return false;
+			}
+			ssize_t ret = syscalls::read(fd, buf, sizeof(buf));
+			if (ret == -1) {
+				if (errno == EAGAIN) {
+					continue;
+				}
+				return false;
+			} else if (ret == 0) {
+				break;
+			}
+			response.append(buf, ret);
+		}
+
+		int status = parseHealthCheckResponseStatus(response);
+		return status >= 200 && status < 400;
+	} catch (const tracable_exception &e) {
+		P_DEBUG("Health check of process " << check.process->inspect() <<
+			" failed: " << e.what());
+		return false;
+	}
+}
+
+/**
+ * Returns the status code in the given response header, which is either an
+ * HTTP status line or a CGI-style "Status" header. Returns -1 if there is none.
+ */
+int
+Pool::parseHealthCheckResponseStatus(const StaticString &response) {
+	string::size_type pos = 0;
+	while (pos < response.size()) {
+		string::size_type lineEnd = response.find("\r\n", pos);
+		if (lineEnd == string::npos) {
+			lineEnd = response.size();
+		}
+		StaticString line = response.substr(pos, lineEnd - pos);
+		if (line.empty()) {
+			break;
+		} else if (startsWith(line, "HTTP/") && pos == 0) {
+			string::size_type space = line.find(' ');
+			if (space != string::npos) {
+				return atoi(line.substr(space + 1).toString().c_str());
+			}
+		} else if (line.size() > 7 && equalsCaseInsensitive(line.substr(0, 7), "Status:")) {
+			return atoi(line.substr(7).toString().c_str());
+		}
+		pos = lineEnd + 2;
+	}
+	return -1;
+}
+
+void
+Pool::realCheckHealth() {
+	TRACE_POINT();
+	boost::this_thread::disable_interruption di;
+	boost::this_thread::disable_syscall_interruption dsi;
+	vector<HealthCheck> checks;
+	boost::container::vector<Callback> actions;
+
+	{
+		UPDATE_TRACE_POINT();
+		ScopedLock l(syncher);
+		unsigned long long now = SystemTime::getUsec();
+		GroupMap::ConstIterator g_it(groups);
+		while (*g_it != NULL) {
+			scheduleHealthChecksInGroup(now, g_it.getValue(), checks, actions);
+			g_it.next();
+		}
+		if (!actions.empty()) {
+			fullVerifyInvariants();
+		}
+		l.unlock();
+		runAllActions(actions);
+		actions.clear();
+	}
+
+	if (checks.empty()) {
+		return;
+	}
+
+	UPDATE_TRACE_POINT();
+	P_DEBUG("Performing " << checks.size() << " health checks");
+	foreach (HealthCheck &check, checks) {
+		check.healthy = performHealthCheck(check);
+	}
+
+	{
+		UPDATE_TRACE_POINT();
+		ScopedLock l(syncher);
+		unsigned long long now = SystemTime::getUsec();
+		foreach (const HealthCheck &check, checks) {
+			const ProcessPtr &process = check.process;
+			Group *group = process->getGroup();
+			if (process->isAlive() && process->enabled != Process::DETACHED
+			 && group != NULL && group->isAlive())
+			{
+				group->healthCheckFinished(process, check.healthy, now, actions);
+			}
+		}
+		fullVerifyInvariants();
+		l.unlock();
+		runAllActions(actions);
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -57,6 +57,12 @@ Pool::Pool(const SpawningKit::FactoryPtr &spawningKitFactory,
 	max          = 6;
 	maxIdleTime  = 60 * 1000000;
 	selfchecking = true;
+	groupsGeneration = 1;
+	spawnWorkerCount = 0;
+	spawnWorkersStopping = false;
+	prespawnConcurrency = 0;
+	prespawnMaxLoad = 0;
+	prespawnReplaying = false;
 	palloc       = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 
 	// The following code only serve to instantiate certain inline methods
@@ -79,6 +85,7 @@ Pool::initialize() {
 	LockGuard l(syncher);
 	initializeAnalyticsCollection();
 	initializeGarbageCollection();
+	initializeHealthChecking();
 }
 
 void
@@ -105,7 +112,7 @@ Pool::prepareForShutdown() {
 		foreach (ProcessPtr process, processes) {
 			// Ensure that the process is not immediately respawned.
 			process->getGroup()->options.minProcesses = 0;
-			abortLongRunningConnectionsCallback(process);
+			abortLongRunningConnectionsCallback(process, false);
 		}
 	}
 }
@@ -122,15 +129,16 @@ Pool::destroy() {
 	while (!groups.empty()) {
 		GroupPtr *group;
 		groups.lookupRandom(NULL, &group);
-		string name = group->get()->getName().toString();
+		string key = group->get()->getKey().toString();
 		lock.unlock();
-		detachGroupByName(name);
+		detachGroupByName(key);
 		lock.lock();
 	}
 
 	UPDATE_TRACE_POINT();
 	lock.unlock();
 	P_DEBUG("Shutting down ApplicationPool background threads...");
+	stopSpawnWorkers();
 	interruptableThreads.interrupt_and_join_all();
 	nonInterruptableThreads.join_all();
 	lock.lock();
@@ -38,8 +38,43 @@ using namespace std;
 using namespace boost;
 
 
+static UnionStation::StopwatchLog *
+createGetStopwatchLog(const Options &options, bool groupExists, size_t queueSize,
+	int queueMax, bool spawning)
+{
+	// Log some essentials stats about what this request is facing in its upcoming journey through the queue:
+	// 1) position in the queue upon entry, and 2) whether spawning activity is occurring (which takes cycles
+	// but also indicates the server has headroom to handle the load).
+	Json::Value data;
+	if (!groupExists) {
+		data["message"] = "spawning.."; // the first of this group, so keep it simple (also: we don't know maxQ yet)
+	} else {
+		char queueMaxStr[10];
+		if (queueMax > 0) {
+			snprintf(queueMaxStr, sizeof(queueMaxStr), "%d", queueMax);
+		}
+		char message[50];
+		snprintf(message, sizeof(message), "queue: %zu / %s, spawning: %s", queueSize,
+				(queueMax == 0 ? "inf" : queueMaxStr),
+				(spawning ? "yes" : "no"));
+		data["message"] = message;
+	}
+	Json::Value json;
+	json["data"] = data;
+	json["data_type"] = "generic";
+	json["name"] = "Await available process";
+
+	return new UnionStation::StopwatchLog(options.transaction, "Pool::asyncGet", stringifyJson(json).c_str());
+}
+
 // 'lockNow == false' may only be used during unit tests. Normally we
 // should never call the callback while holding the lock.
+//
+// The pool lock is shared by all Core threads, so this function keeps
+// the critical section as short as possible: only the group lookup and
+// the routing decision happen under the lock. Creating the stopwatch log
+// (JSON formatting and memory allocation) happens after unlocking, but
+// before the callback may be invoked.
 void
 Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow, UnionStation::StopwatchLog **stopwatchLog) {
 	DynamicScopedLock lock(syncher, lockNow);
@@ -50,31 +85,13 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 	boost::container::vector<Callback> actions;
 
 	Group *existingGroup = findMatchingGroup(options);
-	if (stopwatchLog != NULL) {
-		// Log some essentials stats about what this request is facing in its upcoming journey through the queue:
-		// 1) position in the queue upon entry, and 2) whether spawning activity is occurring (which takes cycles
-		// but also indicates the server has headroom to handle the load).
-		Json::Value data;
-		if (!existingGroup) {
-			data["message"] = "spawning.."; // the first of this group, so keep it simple (also: we don't know maxQ yet)
-		} else {
-			char queueMaxStr[10];
-			int queueMax = existingGroup->options.maxRequestQueueSize;
-			if (queueMax > 0) {
-				snprintf(queueMaxStr, sizeof(queueMaxStr), "%d", queueMax);
-			}
-			char message[50];
-			snprintf(message, sizeof(message), "queue: %zu / %s, spawning: %s", existingGroup->getWaitlist.size(),
-					(queueMax == 0 ? "inf" : queueMaxStr),
-					(existingGroup->processesBeingSpawned == 0 ? "no" : "yes"));
-			data["message"] = message;
-		}
-		Json::Value json;
-		json["data"] = data;
-		json["data_type"] = "generic";
-		json["name"] = "Await available process";
-
-		*stopwatchLog = new UnionStation::StopwatchLog(options.transaction, "Pool::asyncGet", stringifyJson(json).c_str());
+	size_t queueSize = 0;
+	int queueMax = 0;
+	bool spawning = false;
+	if (stopwatchLog != NULL && existingGroup != NULL) {
+		queueSize = existingGroup->getWaitlist.size();
+		queueMax = existingGroup->options.maxRequestQueueSize;
+		spawning = existingGroup->processesBeingSpawned > 0;
 	}
 
 	if (OXT_LIKELY(existingGroup != NULL)) {
@@ -88,6 +105,10 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 		if (lockNow) {
 			lock.unlock();
 		}
+		if (stopwatchLog != NULL) {
+			*stopwatchLog = createGetStopwatchLog(options, true, queueSize,
+				queueMax, spawning);
+		}
 		if (session != NULL) {
 			callback(session, ExceptionPtr());
 		}
@@ -118,9 +139,7 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 			 * become available.
 			 */
 			P_DEBUG("Could not free a process; putting request to top-level getWaitlist");
-			getWaitlist.push_back(GetWaiter(
-				options.copyAndPersist().detachFromUnionStationTransaction(),
-				callback));
+			getWaitlist.push_back(GetWaiter(options, callback));
 		} else {
 			/* Now that a process has been trashed we can create
 			 * the missing Group.
@@ -149,6 +168,16 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 		P_TRACE(2, "asyncGet() finished");
 	}
 
+	if (existingGroup == NULL && stopwatchLog != NULL) {
+		// Callbacks for waiters that are satisfied from another thread are
+		// not run before this function returns, because Controller
+		// dispatches them back to our event loop.
+		if (lockNow && lock.owns_lock()) {
+			lock.unlock();
+		}
+		*stopwatchLog = createGetStopwatchLog(options, false, 0, 0, false);
+	}
+
 	if (!actions.empty()) {
 		if (lockNow) {
 			if (lock.owns_lock()) {
@@ -173,6 +202,8 @@ Pool::get(const Options &options, Ticket *ticket) {
 	GetCallback callback;
 	callback.func = syncGetCallback;
 	callback.userData = ticket;
+	// We wait for the callback below.
+	callback.optionsOutliveCallback = true;
 	asyncGet(options, callback);
 
 	ScopedLock lock(ticket->syncher);
@@ -191,6 +222,51 @@ Pool::get(const Options &options, Ticket *ticket) {
 	}
 }
 
+/**
+ * Does the pool bookkeeping for all sessions in `batch`, which were closed
+ * with `Session::closeInBatch()`, under a single lock acquisition. Get
+ * waiters are assigned once per affected group rather than once per
+ * session. Empties the batch.
+ */
+void
+Pool::closeSessions(SessionCloseBatch &batch) {
+	if (batch.empty()) {
+		return;
+	}
+
+	TRACE_POINT();
+	boost::container::vector<Callback> actions;
+	boost::container::vector<Group *> groupsWithGetWaiters;
+	boost::container::vector<SessionPtr>::const_iterator it, end = batch.sessions.end();
+	ScopedLock l(syncher);
+
+	for (it = batch.sessions.begin(); it != end; it++) {
+		Session *session = it->get();
+		Process *process = session->getProcess();
+		Group *group = process->getGroup();
+		if (group->onSessionCloseUnlocked(process, session, actions)
+		 && std::find(groupsWithGetWaiters.begin(), groupsWithGetWaiters.end(), group)
+			== groupsWithGetWaiters.end())
+		{
+			groupsWithGetWaiters.push_back(group);
+		}
+		session->finishBatchedClose();
+	}
+
+	UPDATE_TRACE_POINT();
+	boost::container::vector<Group *>::const_iterator g_it, g_end = groupsWithGetWaiters.end();
+	for (g_it = groupsWithGetWaiters.begin(); g_it != g_end; g_it++) {
+		(*g_it)->assignSessionsToGetWaiters(actions);
+	}
+
+	fullVerifyInvariants();
+	l.unlock();
+	runAllActions(actions);
+	// Release our references outside the lock, because that may
+	// destroy the Session objects.
+	batch.sessions.clear();
+}
+
 void
 Pool::setMax(unsigned int max) {
 	ScopedLock l(syncher);
@@ -220,13 +296,54 @@ Pool::setMax(unsigned int max) {
 	}
 }
 
+/**
+ * Limits the number of processes that the groups of the given tenant may
+ * have together (see `Options::tenant`). The limit is soft: a group can
+ * always have one process. 0 removes the limit.
+ */
+void
+Pool::setTenantMaxProcesses(const string &tenant, unsigned int max) {
+	ScopedLock l(syncher);
+	if (max == 0) {
+		tenantMaxProcesses.erase(tenant);
+	} else {
+		tenantMaxProcesses[tenant] = max;
+	}
+
+	boost::container::vector<Callback> actions;
+	assignSessionsToGetWaiters(actions);
+	possiblySpawnMoreProcessesForExistingGroups();
+	fullVerifyInvariants();
+	l.unlock();
+	runAllActions(actions);
+}
+
 void
 Pool::setMaxIdleTime(unsigned long long value) {
 	LockGuard l(syncher);
+	GroupMap::ConstIterator g_it(groups);
 	maxIdleTime = value;
+	// Process expiry times have changed, so all groups must be examined again.
+	while (*g_it != NULL) {
+		g_it.getValue()->nextGarbageCollectionTime = 0;
+		g_it.next();
+	}
 	wakeupGarbageCollector();
 }
 
+/**
+ * Makes every group place its processes in a cgroup of its own, created
+ * under the given cgroup directory. That directory must be writable by
+ * the Core (for example because it has been delegated to it). Must be
+ * called before any groups are created. See Group/Cgroups.cpp.
+ */
+void
+Pool::setAppCgroupRoot(const string &path) {
+	LockGuard l(syncher);
+	assert(groups.empty());
+	appCgroupRoot = path;
+}
+
 void
 Pool::enableSelfChecking(bool enabled) {
 	LockGuard l(syncher);
@@ -0,0 +1,260 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+
+/*************************************************************************
+ *
+ * Prespawn manifest functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+string
+Pool::getPrespawnManifestPath() const {
+	const string &instanceDir = getSpawningKitConfig()->instanceDir;
+	if (instanceDir.empty()) {
+		return string();
+	} else {
+		return instanceDir + "/prespawn_manifest.json";
+	}
+}
+
+/**
+ * Lists the groups, the options that they were created with, and their
+ * current process counts. Groups without processes and without a
+ * `minProcesses` are left out, because there's nothing to prespawn for them.
+ */
+Json::Value
+Pool::createPrespawnManifest() const {
+	Json::Value doc;
+	Json::Value &groupsDoc = doc["groups"] = Json::Value(Json::arrayValue);
+	GroupMap::ConstIterator g_it(groups);
+
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		unsigned int count = group->getProcessCount();
+		if (group->isAlive() && (count > 0 || group->options.minProcesses > 0)) {
+			Json::Value entry;
+			group->options.toJson(entry["options"]);
+			entry["process_count"] = count;
+			groupsDoc.append(entry);
+		}
+		g_it.next();
+	}
+
+	return doc;
+}
+
+/**
+ * Called periodically by the analytics collector. Only writes the manifest
+ * if it has changed.
+ */
+void
+Pool::savePrespawnManifest() {
+	string path, data;
+	{
+		LockGuard l(syncher);
+		if (prespawnConcurrency == 0 || prespawnReplaying || lifeStatus != ALIVE) {
+			return;
+		}
+		path = getPrespawnManifestPath();
+		if (path.empty()) {
+			return;
+		}
+		data = createPrespawnManifest().toStyledString();
+	}
+
+	if (data == lastPrespawnManifest) {
+		return;
+	}
+
+	// The manifest contains secrets such as API keys, so only we may read it.
+	// Replace it atomically so that a crash never leaves a truncated manifest.
+	string tempPath = path + ".tmp";
+	createFile(tempPath, data, S_IRUSR | S_IWUSR);
+	if (rename(tempPath.c_str(), path.c_str()) == -1) {
+		int e = errno;
+		throw FileSystemException("Cannot rename " + tempPath + " to " + path,
+			e, path);
+	}
+	lastPrespawnManifest = data;
+	P_DEBUG("Prespawn manifest saved to " << path);
+}
+
+void
+Pool::replayPrespawnManifest(PoolPtr self, Json::Value manifest) {
+	TRACE_POINT();
+	const Json::Value &entries = manifest["groups"];
+	P_NOTICE("Prespawning " << entries.size() << " application groups from the "
+		"prespawn manifest, " << self->prespawnConcurrency << " at a time");
+
+	try {
+		for (Json::ArrayIndex i = 0; i < entries.size(); i++) {
+			UPDATE_TRACE_POINT();
+			while (self->prespawnThrottled()) {
+				syscalls::usleep(100000);
+			}
+			UPDATE_TRACE_POINT();
+			if (!self->prespawnGroup(entries[i])) {
+				break;
+			}
+		}
+	} catch (const thread_interrupted &) {
+		// Fall through.
+	} catch (const tracable_exception &e) {
+		P_WARN("ERROR: " << e.what() << "\n  Backtrace:\n" << e.backtrace());
+	}
+
+	LockGuard l(self->syncher);
+	self->prespawnReplaying = false;
+}
+
+/**
+ * Whether the next group in the manifest must wait, either because
+ * `prespawnConcurrency` groups are already spawning, or because the load
+ * average is too high. The load average includes processes that wait for
+ * disk I/O, so this throttles on I/O as well as on CPU.
+ */
+bool
+Pool::prespawnThrottled() const {
+	{
+		LockGuard l(syncher);
+		GroupMap::ConstIterator g_it(groups);
+		unsigned int spawning = 0;
+
+		while (*g_it != NULL) {
+			if (g_it.getValue()->spawning()) {
+				spawning++;
+			}
+			g_it.next();
+		}
+		if (spawning >= prespawnConcurrency) {
+			return true;
+		}
+	}
+
+	if (prespawnMaxLoad > 0) {
+		double load;
+		unsigned int ncpus = std::max(boost::thread::hardware_concurrency(), 1u);
+		if (getloadavg(&load, 1) == 1 && load * 100 > (double) prespawnMaxLoad * ncpus) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Creates the group of a manifest entry if it doesn't exist yet, and spawns
+ * processes for it until it has as many as are listed in the entry. Returns
+ * false if the Pool is shutting down.
+ */
+bool
+Pool::prespawnGroup(const Json::Value &entry) {
+	Options options = Options::fromJson(entry["options"]);
+	unsigned int count = entry.get("process_count", 0).asUInt();
+	LockGuard l(syncher);
+
+	if (lifeStatus != ALIVE) {
+		return false;
+	}
+
+	GroupPtr *groupPtr;
+	GroupPtr group;
+	string key;
+	if (groups.lookup(options.getGroupKey(key), &groupPtr)) {
+		group = *groupPtr;
+	} else if (atFullCapacityUnlocked()) {
+		// There may be get waiters on the pool for this group.
+		P_INFO("Not prespawning group " << options.getAppGroupName() <<
+			" because the pool is at full capacity");
+		return true;
+	} else {
+		group = createGroup(options);
+	}
+
+	P_DEBUG("Prespawning " << count << " processes for group " << group->getName());
+	group->prespawnTarget = std::max<unsigned int>(group->prespawnTarget,
+		std::min<unsigned int>(count, USHRT_MAX));
+	if (group->shouldSpawn()) {
+		group->spawn();
+	}
+	fullVerifyInvariants();
+	return true;
+}
+
+/**
+ * Enables the prespawn manifest (see `prespawnConcurrency`), and replays
+ * the manifest that was saved before the Core was restarted, if any.
+ * Must be called right after `initialize()`.
+ */
+void
+Pool::enablePrespawnManifest(unsigned int concurrency, unsigned int maxLoad) {
+	LockGuard l(syncher);
+	string path = getPrespawnManifestPath();
+
+	prespawnConcurrency = concurrency;
+	prespawnMaxLoad = maxLoad;
+	if (concurrency == 0 || path.empty() || !fileExists(path)) {
+		return;
+	}
+
+	Json::Value manifest;
+	Json::Reader reader;
+	string content;
+	try {
+		content = readAll(path);
+	} catch (const SystemException &e) {
+		P_WARN("Cannot read prespawn manifest " << path << ": " << e.what());
+		return;
+	}
+	if (!reader.parse(content, manifest) || !manifest["groups"].isArray()) {
+		P_WARN("Cannot parse prespawn manifest " << path << ": " <<
+			reader.getFormattedErrorMessages());
+		return;
+	}
+
+	prespawnReplaying = true;
+	interruptableThreads.create_thread(
+		boost::bind(replayPrespawnManifest, shared_from_this(), manifest),
+		"Pool prespawn manifest replayer",
+		POOL_HELPER_THREAD_STACK_SIZE
+	);
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
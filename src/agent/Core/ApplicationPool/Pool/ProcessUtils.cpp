@@ -45,9 +45,20 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * Finds the idle process to shut down when capacity has to be freed. Processes
+ * are taken from the group that is the furthest over its fair share of the pool
+ * (see `fairCapacityShare()`), and the one that was used least recently within
+ * it. Groups that use no more than their reserved minimum, which is the lower
+ * of their `minProcesses` and their fair share, are only picked if no other
+ * group has an idle process.
+ */
 ProcessPtr
-Pool::findOldestIdleProcess(const Group *exclude) const {
-	ProcessPtr oldestIdleProcess;
+Pool::findProcessToFreeCapacity(const Group *exclude) const {
+	ProcessPtr result;
+	bool resultReserved = false;
+	int resultExcess = 0;
+	unsigned int totalWeight = totalCapacityWeightUnlocked();
 
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
@@ -56,21 +67,39 @@ Pool::findOldestIdleProcess(const Group *exclude) const {
 			g_it.next();
 			continue;
 		}
+
+		unsigned int used = group->capacityUsed();
+		unsigned int share = fairCapacityShare(group.get(), totalWeight);
+		bool reserved = used <= std::min(group->options.minProcesses, share);
+		int excess = (int) used - (int) share;
+		bool better = result == NULL
+			|| (resultReserved && !reserved)
+			|| (resultReserved == reserved && excess > resultExcess);
+		bool equal = result != NULL
+			&& resultReserved == reserved
+			&& excess == resultExcess;
+		if (!better && !equal) {
+			g_it.next();
+			continue;
+		}
+
 		const ProcessList &processes = group->enabledProcesses;
 		ProcessList::const_iterator p_it, p_end = processes.end();
 		for (p_it = processes.begin(); p_it != p_end; p_it++) {
 			const ProcessPtr process = *p_it;
 			if (process->busyness() == 0
-			     && (oldestIdleProcess == NULL
-			         || process->lastUsed < oldestIdleProcess->lastUsed)
-			) {
-				oldestIdleProcess = process;
+			     && (better || process->lastUsed < result->lastUsed))
+			{
+				result = process;
+				resultReserved = reserved;
+				resultExcess = excess;
+				better = false;
 			}
 		}
 		g_it.next();
 	}
 
-	return oldestIdleProcess;
+	return result;
 }
 
 ProcessPtr
@@ -103,7 +132,7 @@ ProcessPtr
 Pool::forceFreeCapacity(const Group *exclude,
 	boost::container::vector<Callback> &postLockActions)
 {
-	ProcessPtr process = findOldestIdleProcess(exclude);
+	ProcessPtr process = findProcessToFreeCapacity(exclude);
 	if (process != NULL) {
 		P_DEBUG("Forcefully detaching process " << process->inspect() <<
 			" in order to free capacity in the pool");
@@ -140,6 +169,41 @@ Pool::detachProcessUnlocked(const ProcessPtr &process,
 	}
 }
 
+/**
+ * Disable callback for processes that are being replaced, because they went
+ * over the memory limit or because of a rolling restart. Detaches the process
+ * now that its sessions have finished, spawns a replacement if it has no
+ * successor yet, and continues the rolling restart if there is one.
+ */
+void
+Pool::detachReplacedProcess(const ProcessPtr &process, DisableResult result,
+	bool spawnReplacement)
+{
+	ScopedLock l(syncher);
+	if ((result != DR_SUCCESS && result != DR_NOOP)
+	 || !process->isAlive()
+	 || process->enabled != Process::DISABLED)
+	{
+		return;
+	}
+
+	boost::container::vector<Callback> actions;
+	GroupPtr group = process->getGroup()->shared_from_this();
+	P_INFO("Detaching process " << process->inspect() << ", which is being " <<
+		"replaced, now that its requests have finished");
+	detachProcessUnlocked(process, actions);
+	if (group->isAlive()) {
+		if (spawnReplacement && group->allowSpawn()) {
+			group->spawn();
+		}
+		group->replaceOutdatedProcesses(actions);
+		group->recycleNextProcess(actions);
+	}
+	fullVerifyInvariants();
+	l.unlock();
+	runAllActions(actions);
+}
+
 void
 Pool::syncDisableProcessCallback(const ProcessPtr &process, DisableResult result,
 	boost::shared_ptr<DisableWaitTicket> ticket)
@@ -168,20 +232,36 @@ Pool::possiblySpawnMoreProcessesForExistingGroups() {
 		g_it.next();
 	}
 	/* Now look for Groups that haven't maximized their allowed capacity
-	 * yet, and spawn processes in those groups.
+	 * yet, and spawn processes in those groups. The groups that use the
+	 * least capacity relative to their weight go first, so that a single
+	 * busy group cannot take all capacity that becomes available.
 	 */
+	SmallVector<Group *, 16> candidates;
 	g_it = GroupMap::ConstIterator(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
 		if (group->shouldSpawn()) {
-			P_DEBUG("Group " << group->getName() << " requests more processes to be spawned");
-			group->spawn();
-			if (atFullCapacityUnlocked()) {
-				return;
-			}
+			candidates.push_back(group.get());
 		}
 		g_it.next();
 	}
+	std::stable_sort(candidates.begin(), candidates.end(), usesLessCapacityByWeight);
+
+	SmallVector<Group *, 16>::const_iterator it, end = candidates.end();
+	for (it = candidates.begin(); it != end; it++) {
+		Group *group = *it;
+		P_DEBUG("Group " << group->getName() << " requests more processes to be spawned");
+		group->spawn();
+		if (atFullCapacityUnlocked()) {
+			return;
+		}
+	}
+}
+
+bool
+Pool::usesLessCapacityByWeight(const Group *a, const Group *b) {
+	return (unsigned long long) a->capacityUsed() * std::max(b->options.capacityWeight, 1u)
+		< (unsigned long long) b->capacityUsed() * std::max(a->options.capacityWeight, 1u);
 }
 
 
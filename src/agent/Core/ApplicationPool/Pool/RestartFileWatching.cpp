@@ -0,0 +1,184 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+#include <cstdlib>
+
+/*************************************************************************
+ *
+ * Restart file watching functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+void
+Pool::watchRestartFiles(PoolPtr self) {
+	TRACE_POINT();
+	vector<FileSystemWatcher::Event> events;
+
+	while (!boost::this_thread::interruption_requested()) {
+		try {
+			UPDATE_TRACE_POINT();
+			events.clear();
+			if (self->restartFileWatcher->waitForEvents(events)) {
+				UPDATE_TRACE_POINT();
+				self->processRestartFileEvents(events);
+			}
+		} catch (const thread_interrupted &) {
+			break;
+		} catch (const tracable_exception &e) {
+			P_WARN("Error watching restart files, polling them from now on: " <<
+				e.what() << "\n  Backtrace:\n" << e.backtrace());
+			boost::this_thread::disable_interruption di;
+			boost::this_thread::disable_syscall_interruption dsi;
+			LockGuard l(self->syncher);
+			GroupMap::ConstIterator g_it(self->groups);
+			while (*g_it != NULL) {
+				g_it.getValue()->restartFileWatched = false;
+				g_it.next();
+			}
+			self->restartFileWatcher.reset();
+			break;
+		}
+	}
+}
+
+/**
+ * Tells the groups whose restart directory changed to check their
+ * restart files on their next request.
+ */
+void
+Pool::processRestartFileEvents(const vector<FileSystemWatcher::Event> &events) {
+	LockGuard l(syncher);
+	vector<FileSystemWatcher::Event>::const_iterator it, end = events.end();
+
+	for (it = events.begin(); it != end; it++) {
+		const FileSystemWatcher::Event &event = *it;
+		if (!event.filename.empty()
+		 && event.filename != "restart.txt"
+		 && event.filename != "always_restart.txt")
+		{
+			continue;
+		}
+
+		GroupMap::ConstIterator g_it(groups);
+		while (*g_it != NULL) {
+			Group *group = g_it.getValue().get();
+			if (group->restartFileWatched && group->restartFileDir == event.dir) {
+				group->restartFileChanged = true;
+				if (event.watchLost) {
+					P_DEBUG("Restart directory " << event.dir << " is no longer watched; "
+						"polling the restart files of group " << group->getName() <<
+						" from now on");
+					group->restartFileWatched = false;
+				}
+			}
+			g_it.next();
+		}
+	}
+}
+
+/**
+ * Watches the group's restart directory if restart file watching is enabled
+ * and possible. Otherwise the group keeps polling its restart files.
+ *
+ * Directories whose path contains a symlink are not watched: the watch would
+ * keep following the old target after the symlink is changed, which is how
+ * many deployment tools activate a new release.
+ */
+void
+Pool::startWatchingRestartFiles(Group *group) {
+	if (restartFileWatcher == NULL) {
+		return;
+	}
+
+	char *realDir = realpath(group->restartFileDir.c_str(), NULL);
+	bool watchable = realDir != NULL && group->restartFileDir == realDir;
+	free(realDir);
+
+	if (watchable && restartFileWatcher->watchDirectory(group->restartFileDir)) {
+		group->restartFileWatched = true;
+	} else {
+		P_DEBUG("Cannot watch restart directory " << group->restartFileDir <<
+			"; polling the restart files of group " << group->getName());
+	}
+}
+
+void
+Pool::stopWatchingRestartFiles(Group *group) {
+	if (group->restartFileWatched) {
+		group->restartFileWatched = false;
+		restartFileWatcher->unwatchDirectory(group->restartFileDir);
+	}
+}
+
+
+/****************************
+ *
+ * Public methods
+ *
+ ****************************/
+
+
+/**
+ * Makes groups that are created from now on watch their restart directory
+ * for changes, instead of polling restart.txt and always_restart.txt every
+ * `statThrottleRate` seconds. Returns false if this platform doesn't
+ * support watching for file changes, in which case polling continues.
+ */
+bool
+Pool::enableRestartFileWatching() {
+	LockGuard l(syncher);
+	if (restartFileWatcher != NULL) {
+		return true;
+	} else if (!FileSystemWatcher::isSupported()) {
+		return false;
+	}
+
+	try {
+		restartFileWatcher.reset(new FileSystemWatcher());
+	} catch (const SystemException &e) {
+		P_WARN("Cannot watch restart files for changes, polling them instead: " <<
+			e.what());
+		return false;
+	}
+
+	interruptableThreads.create_thread(
+		boost::bind(watchRestartFiles, shared_from_this()),
+		"Pool restart file watcher",
+		POOL_HELPER_THREAD_STACK_SIZE
+	);
+	return true;
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -0,0 +1,128 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * Spawn worker functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+void
+Pool::spawnWorkerMain(PoolPtr self) {
+	TRACE_POINT();
+	while (true) {
+		SpawnJob job;
+		{
+			boost::unique_lock<boost::mutex> l(self->spawnJobsSyncher);
+			try {
+				while (self->spawnJobs.empty() && !self->spawnWorkersStopping) {
+					self->spawnJobsCond.wait(l);
+				}
+			} catch (const thread_interrupted &) {
+				break;
+			}
+			if (self->spawnWorkersStopping) {
+				break;
+			}
+			job = self->spawnJobs.front();
+			self->spawnJobs.pop_front();
+		}
+
+		UPDATE_TRACE_POINT();
+		bool done;
+		if (!job.group->isAlive()) {
+			// The group was detached while the job was queued.
+			// There is no thread to interrupt, so drop the job here.
+			done = true;
+		} else {
+			try {
+				done = job.group->runSpawnLoopIteration(job.spawner,
+					job.options, job.restartsInitiated);
+			} catch (const thread_interrupted &) {
+				break;
+			}
+		}
+
+		UPDATE_TRACE_POINT();
+		if (done) {
+			job.group->finishSpawnLoop();
+		} else {
+			self->scheduleSpawnJob(job);
+		}
+	}
+}
+
+/**
+ * Queues an iteration of a spawn loop for the spawn workers. May be called
+ * with or without holding the lock on `syncher`.
+ */
+void
+Pool::scheduleSpawnJob(const SpawnJob &job) {
+	boost::lock_guard<boost::mutex> l(spawnJobsSyncher);
+	spawnJobs.push_back(job);
+	spawnJobsCond.notify_one();
+}
+
+/**
+ * Tells the spawn workers to exit after their current spawn loop iteration.
+ * Queued iterations are dropped.
+ */
+void
+Pool::stopSpawnWorkers() {
+	boost::lock_guard<boost::mutex> l(spawnJobsSyncher);
+	spawnWorkersStopping = true;
+	spawnJobs.clear();
+	spawnJobsCond.notify_all();
+}
+
+/**
+ * Starts spawn workers until there are `count` of them. The number of
+ * spawn workers can only be increased.
+ */
+void
+Pool::setSpawnWorkerCount(unsigned int count) {
+	LockGuard l(syncher);
+	while (spawnWorkerCount < count) {
+		spawnWorkerCount++;
+		interruptableThreads.create_thread(
+			boost::bind(spawnWorkerMain, shared_from_this()),
+			"Pool spawn worker " + toString(spawnWorkerCount),
+			POOL_HELPER_THREAD_STACK_SIZE
+		);
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -68,21 +68,77 @@ Pool::atFullCapacityUnlocked() const {
 	return capacityUsedUnlocked() >= max;
 }
 
+unsigned int
+Pool::tenantCapacityUsedUnlocked(const StaticString &tenant) const {
+	GroupMap::ConstIterator g_it(groups);
+	unsigned int result = 0;
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		if (group->options.tenant == tenant) {
+			result += group->capacityUsed();
+		}
+		g_it.next();
+	}
+	return result;
+}
+
+/**
+ * Returns whether the groups of the given tenant together use the
+ * maximum number of processes that was set with `setTenantMaxProcesses()`.
+ * Always false for the empty tenant and for tenants without a limit.
+ */
+bool
+Pool::tenantAtFullCapacityUnlocked(const StaticString &tenant) const {
+	if (tenant.empty() || tenantMaxProcesses.empty()) {
+		return false;
+	}
+	std::map<string, unsigned int>::const_iterator it =
+		tenantMaxProcesses.find(tenant.toString());
+	return it != tenantMaxProcesses.end()
+		&& tenantCapacityUsedUnlocked(tenant) >= it->second;
+}
+
+unsigned int
+Pool::totalCapacityWeightUnlocked() const {
+	GroupMap::ConstIterator g_it(groups);
+	unsigned int result = 0;
+	while (*g_it != NULL) {
+		result += std::max(g_it.getValue()->options.capacityWeight, 1u);
+		g_it.next();
+	}
+	return result;
+}
+
+/**
+ * The number of processes that `group` is entitled to when the pool is full,
+ * given the sum of the capacity weights of all groups.
+ */
+unsigned int
+Pool::fairCapacityShare(const Group *group, unsigned int totalWeight) const {
+	if (totalWeight == 0) {
+		return max;
+	} else {
+		return (unsigned int) ((unsigned long long) max
+			* std::max(group->options.capacityWeight, 1u)
+			/ totalWeight);
+	}
+}
+
 void
 Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
-	const Group *group, const ProcessList &processes) const
+	const GroupSnapshot &group)
 {
-	ProcessList::const_iterator p_it;
-	for (p_it = processes.begin(); p_it != processes.end(); p_it++) {
-		const ProcessPtr &process = *p_it;
+	vector<ProcessSnapshot>::const_iterator p_it;
+	for (p_it = group.processes.begin(); p_it != group.processes.end(); p_it++) {
+		const ProcessSnapshot &process = *p_it;
 		char buf[128];
 		char cpubuf[10];
 		char membuf[10];
 
-		 if (process->metrics.isValid()) {
-			snprintf(cpubuf, sizeof(cpubuf), "%d%%", (int) process->metrics.cpu);
+		if (process.metrics.isValid()) {
+			snprintf(cpubuf, sizeof(cpubuf), "%d%%", (int) process.metrics.cpu);
 			snprintf(membuf, sizeof(membuf), "%ldM",
-				(unsigned long) (process->metrics.realMemory() / 1024));
+				(unsigned long) (process.metrics.realMemory() / 1024));
 		} else {
 			snprintf(cpubuf, sizeof(cpubuf), "0%%");
 			snprintf(membuf, sizeof(membuf), "0M");
@@ -90,31 +146,143 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 		snprintf(buf, sizeof(buf),
 			"  * PID: %-5lu   Sessions: %-2u      Processed: %-5u   Uptime: %s\n"
 			"    CPU: %-5s   Memory  : %-5s   Last used: %s ago",
-			(unsigned long) process->getPid(),
-			process->sessions,
-			process->processed,
-			process->uptime().c_str(),
+			(unsigned long) process.pid,
+			process.sessions,
+			process.processed,
+			process.uptime().c_str(),
 			cpubuf,
 			membuf,
-			distanceOfTimeInWords(process->lastUsed / 1000000).c_str());
+			distanceOfTimeInWords(process.lastUsed / 1000000).c_str());
 		result << buf << endl;
 
-		if (process->enabled == Process::DISABLING) {
+		if (process.enabled == Process::DISABLING) {
 			result << "    Disabling..." << endl;
-		} else if (process->enabled == Process::DISABLED) {
+		} else if (process.enabled == Process::DISABLED) {
 			result << "    DISABLED" << endl;
-		} else if (process->enabled == Process::DETACHED) {
+		} else if (process.enabled == Process::DETACHED) {
 			result << "    Shutting down..." << endl;
 		}
 
-		const Socket *socket;
-		if (options.verbose && (socket = process->getSockets().findSocketWithName("http")) != NULL) {
+		const ProcessSnapshot::SocketInfo *socket;
+		if (options.verbose && (socket = process.findSocketWithName("http")) != NULL) {
 			result << "    URL     : http://" << replaceString(socket->address, "tcp://", "") << endl;
-			result << "    Password: " << group->getApiKey().toStaticString() << endl;
+			result << "    Password: " << group.apiKey.toStaticString() << endl;
+		}
+		if (options.verbose && process.metrics.sharedMemory() != -1
+		 && process.initialMetrics.sharedMemory() != -1)
+		{
+			result << "    Shared  : " << process.metrics.sharedMemory() / 1024 <<
+				"M (" << process.initialMetrics.sharedMemory() / 1024 <<
+				"M after spawning)" << endl;
 		}
 	}
 }
 
+static void
+processSnapshotToJson(const ProcessSnapshot &process, Json::Value &doc) {
+	doc["pid"] = (Json::Int) process.pid;
+	doc["sticky_session_id"] = process.stickySessionId;
+	doc["gupid"] = process.gupid;
+	doc["concurrency"] = process.concurrency;
+	doc["sessions"] = process.sessions;
+	doc["busyness"] = process.busyness;
+	doc["processed"] = process.processed;
+	if (process.avgResponseTime >= 0) {
+		doc["avg_response_time"] = (Json::UInt64) process.avgResponseTime;
+	}
+	doc["spawn_start_time"] = (Json::UInt64) process.spawnStartTime;
+	doc["spawn_end_time"] = (Json::UInt64) process.spawnEndTime;
+	doc["last_used"] = (Json::UInt64) process.lastUsed;
+	doc["uptime"] = process.uptime();
+	if (!process.codeRevision.empty()) {
+		doc["code_revision"] = process.codeRevision;
+	}
+	if (!process.cpuAffinity.empty()) {
+		doc["cpu_affinity"] = process.cpuAffinity;
+	}
+	if (process.numaNode != -1) {
+		doc["numa_node"] = process.numaNode;
+	}
+	switch (process.lifeStatus) {
+	case Process::ALIVE:
+		doc["life_status"] = "ALIVE";
+		break;
+	case Process::SHUTDOWN_TRIGGERED:
+		doc["life_status"] = "SHUTDOWN_TRIGGERED";
+		break;
+	case Process::DEAD:
+		doc["life_status"] = "DEAD";
+		break;
+	}
+	switch (process.enabled) {
+	case Process::ENABLED:
+		doc["enabled"] = "ENABLED";
+		break;
+	case Process::DISABLING:
+		doc["enabled"] = "DISABLING";
+		break;
+	case Process::DISABLED:
+		doc["enabled"] = "DISABLED";
+		break;
+	case Process::DETACHED:
+		doc["enabled"] = "DETACHED";
+		break;
+	}
+	doc["over_memory_limit"] = process.overMemoryLimit;
+	doc["reached_max_requests"] = process.reachedMaxRequests;
+	doc["outdated"] = process.outdated;
+	doc["oobw_count"] = process.oobwCount;
+	doc["ejection_count"] = process.ejectionCount;
+	doc["health_check_failures"] = process.healthCheckFailures;
+	if (process.metrics.isValid()) {
+		doc["cpu"] = (int) process.metrics.cpu;
+		doc["rss"] = (Json::Int64) process.metrics.rss;
+		doc["pss"] = (Json::Int64) process.metrics.pss;
+		doc["private_dirty"] = (Json::Int64) process.metrics.privateDirty;
+		doc["swap"] = (Json::Int64) process.metrics.swap;
+		doc["real_memory"] = (Json::Int64) process.metrics.realMemory();
+		doc["vmsize"] = (Json::Int64) process.metrics.vmsize;
+	}
+}
+
+static void
+groupSnapshotToJson(const GroupSnapshot &group, Json::Value &doc, bool includeSecrets) {
+	vector<ProcessSnapshot>::const_iterator it;
+
+	doc["name"] = group.name;
+	doc["app_root"] = group.appRoot;
+	doc["app_type"] = group.appType;
+	doc["environment"] = group.environment;
+	doc["routing_policy"] = group.routingPolicy;
+	doc["uuid"] = group.uuid;
+	doc["enabled_process_count"] = group.enabledCount;
+	doc["disabling_process_count"] = group.disablingCount;
+	doc["disabled_process_count"] = group.disabledCount;
+	doc["capacity_used"] = group.capacityUsed;
+	if (group.cgroupMemoryUsage != -1) {
+		doc["cgroup_memory_usage"] = (Json::Int64) group.cgroupMemoryUsage;
+	}
+	doc["fair_capacity_share"] = group.fairCapacityShare;
+	doc["get_wait_list_size"] = group.getWaitlistSize;
+	doc["disable_wait_list_size"] = group.disableWaitlistSize;
+	doc["processes_being_spawned"] = group.processesBeingSpawned;
+	doc["spawning"] = group.spawning;
+	doc["restarting"] = group.restarting;
+	doc["user"] = group.user;
+	doc["uid"] = (Json::UInt) group.uid;
+	doc["group"] = group.group;
+	doc["gid"] = (Json::UInt) group.gid;
+	if (includeSecrets) {
+		doc["secret"] = group.apiKey.toStaticString().toString();
+	}
+
+	doc["processes"] = Json::Value(Json::arrayValue);
+	for (it = group.processes.begin(); it != group.processes.end(); it++) {
+		Json::Value process;
+		processSnapshotToJson(*it, process);
+		doc["processes"].append(process);
+	}
+}
 
 /****************************
  *
@@ -123,12 +291,11 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
  ****************************/
 
 
-string
-Pool::inspect(const InspectOptions &options, bool lock) const {
+void
+Pool::takeSnapshot(Snapshot &snapshot, const AuthenticationOptions &options, bool lock) const {
 	DynamicScopedLock l(syncher, lock);
-	stringstream result;
-	const char *headerColor = maybeColorize(options, ANSI_COLOR_YELLOW ANSI_COLOR_BLUE_BG ANSI_COLOR_BOLD);
-	const char *resetColor  = maybeColorize(options, ANSI_COLOR_RESET);
+	GroupMap::ConstIterator g_it(groups);
+	unsigned int totalWeight = totalCapacityWeightUnlocked();
 
 	if (!authorizeByUid(options.uid, false)
 	 && !authorizeByApiKey(options.apiKey, false))
@@ -136,121 +303,136 @@ Pool::inspect(const InspectOptions &options, bool lock) const {
 		throw SecurityException("Operation unauthorized");
 	}
 
-	result << headerColor << "----------- General information -----------" << resetColor << endl;
-	result << "Max pool size : " << max << endl;
-	result << "App groups    : " << groups.size() << endl;
-	result << "Processes     : " << getProcessCount(false) << endl;
-	result << "Requests in top-level queue : " << getWaitlist.size() << endl;
-	if (options.verbose) {
-		unsigned int i = 0;
-		foreach (const GetWaiter &waiter, getWaitlist) {
-			result << "  " << i << ": " << waiter.options.getAppGroupName() << endl;
-			i++;
-		}
+	snapshot.max = max;
+	snapshot.groupCount = groups.size();
+	snapshot.processCount = getProcessCount(false);
+	snapshot.capacityUsed = capacityUsedUnlocked();
+	snapshot.getWaitlist.clear();
+	snapshot.getWaitlist.reserve(getWaitlist.size());
+	foreach (const GetWaiter &waiter, getWaitlist) {
+		snapshot.getWaitlist.push_back(waiter.options->getAppGroupName());
 	}
-	result << endl;
 
-	result << headerColor << "----------- Application groups -----------" << resetColor << endl;
-	GroupMap::ConstIterator g_it(groups);
+	snapshot.groups.clear();
+	snapshot.groups.reserve(groups.size());
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
-		if (!group->authorizeByUid(options.uid)
-		 && !group->authorizeByApiKey(options.apiKey))
+		if (group->authorizeByUid(options.uid)
+		 || group->authorizeByApiKey(options.apiKey))
 		{
-			g_it.next();
-			continue;
+			snapshot.groups.push_back(GroupSnapshot(*group));
+			snapshot.groups.back().fairCapacityShare =
+				fairCapacityShare(group.get(), totalWeight);
 		}
+		g_it.next();
+	}
+}
 
-		ProcessList::const_iterator p_it;
+string
+Pool::inspect(const InspectOptions &options, bool lock) const {
+	Snapshot snapshot;
+	takeSnapshot(snapshot, options, lock);
+	return inspect(snapshot, options);
+}
 
-		result << group->getName() << ":" << endl;
-		result << "  App root: " << group->options.appRoot << endl;
-		if (group->restarting()) {
+string
+Pool::inspect(const Snapshot &snapshot, const InspectOptions &options) {
+	stringstream result;
+	const char *headerColor = maybeColorize(options, ANSI_COLOR_YELLOW ANSI_COLOR_BLUE_BG ANSI_COLOR_BOLD);
+	const char *resetColor  = maybeColorize(options, ANSI_COLOR_RESET);
+	vector<GroupSnapshot>::const_iterator g_it;
+
+	result << headerColor << "----------- General information -----------" << resetColor << endl;
+	result << "Max pool size : " << snapshot.max << endl;
+	result << "App groups    : " << snapshot.groupCount << endl;
+	result << "Processes     : " << snapshot.processCount << endl;
+	result << "Requests in top-level queue : " << snapshot.getWaitlist.size() << endl;
+	if (options.verbose) {
+		for (unsigned int i = 0; i < snapshot.getWaitlist.size(); i++) {
+			result << "  " << i << ": " << snapshot.getWaitlist[i] << endl;
+		}
+	}
+	result << endl;
+
+	result << headerColor << "----------- Application groups -----------" << resetColor << endl;
+	for (g_it = snapshot.groups.begin(); g_it != snapshot.groups.end(); g_it++) {
+		const GroupSnapshot &group = *g_it;
+
+		result << group.name << ":" << endl;
+		result << "  App root: " << group.appRoot << endl;
+		if (group.restarting) {
 			result << "  (restarting...)" << endl;
 		}
-		if (group->spawning()) {
-			if (group->processesBeingSpawned == 0) {
+		if (group.spawning) {
+			if (group.processesBeingSpawned == 0) {
 				result << "  (spawning...)" << endl;
 			} else {
-				result << "  (spawning " << group->processesBeingSpawned << " new " <<
-					maybePluralize(group->processesBeingSpawned, "process", "processes") <<
+				result << "  (spawning " << group.processesBeingSpawned << " new " <<
+					maybePluralize(group.processesBeingSpawned, "process", "processes") <<
 					"...)" << endl;
 			}
 		}
-		result << "  Requests in queue: " << group->getWaitlist.size() << endl;
-		inspectProcessList(options, result, group.get(), group->enabledProcesses);
-		inspectProcessList(options, result, group.get(), group->disablingProcesses);
-		inspectProcessList(options, result, group.get(), group->disabledProcesses);
-		inspectProcessList(options, result, group.get(), group->detachedProcesses);
+		result << "  Requests in queue: " << group.getWaitlistSize << endl;
+		inspectProcessList(options, result, group);
 		result << endl;
-
-		g_it.next();
 	}
 	return result.str();
 }
 
 string
 Pool::toXml(const ToXmlOptions &options, bool lock) const {
-	DynamicScopedLock l(syncher, lock);
-	stringstream result;
-	GroupMap::ConstIterator g_it(groups);
-	ProcessList::const_iterator p_it;
+	Snapshot snapshot;
+	takeSnapshot(snapshot, options, lock);
+	return toXml(snapshot, options);
+}
 
-	if (!authorizeByUid(options.uid, false)
-	 && !authorizeByApiKey(options.apiKey, false))
-	{
-		throw SecurityException("Operation unauthorized");
-	}
+string
+Pool::toXml(const Snapshot &snapshot, const ToXmlOptions &options) {
+	stringstream result;
+	vector<GroupSnapshot>::const_iterator g_it;
 
 	result << "<?xml version=\"1.0\" encoding=\"iso8859-1\" ?>\n";
 	result << "<info version=\"3\">";
 
 	result << "<passenger_version>" << PASSENGER_VERSION << "</passenger_version>";
-	result << "<group_count>" << groups.size() << "</group_count>";
-	result << "<process_count>" << getProcessCount(false) << "</process_count>";
-	result << "<max>" << max << "</max>";
-	result << "<capacity_used>" << capacityUsedUnlocked() << "</capacity_used>";
-	result << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
+	result << "<group_count>" << snapshot.groupCount << "</group_count>";
+	result << "<process_count>" << snapshot.processCount << "</process_count>";
+	result << "<max>" << snapshot.max << "</max>";
+	result << "<capacity_used>" << snapshot.capacityUsed << "</capacity_used>";
+	result << "<get_wait_list_size>" << snapshot.getWaitlist.size() << "</get_wait_list_size>";
 
 	if (options.secrets) {
-		vector<GetWaiter>::const_iterator w_it, w_end = getWaitlist.end();
+		vector<string>::const_iterator w_it, w_end = snapshot.getWaitlist.end();
 
 		result << "<get_wait_list>";
-		for (w_it = getWaitlist.begin(); w_it != w_end; w_it++) {
-			const GetWaiter &waiter = *w_it;
+		for (w_it = snapshot.getWaitlist.begin(); w_it != w_end; w_it++) {
 			result << "<item>";
-			result << "<app_group_name>" << escapeForXml(waiter.options.getAppGroupName()) << "</app_group_name>";
+			result << "<app_group_name>" << escapeForXml(*w_it) << "</app_group_name>";
 			result << "</item>";
 		}
 		result << "</get_wait_list>";
 	}
 
 	result << "<supergroups>";
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		if (!group->authorizeByUid(options.uid)
-		 && !group->authorizeByApiKey(options.apiKey))
-		{
-			g_it.next();
-			continue;
-		}
+	for (g_it = snapshot.groups.begin(); g_it != snapshot.groups.end(); g_it++) {
+		const GroupSnapshot &group = *g_it;
 
 		result << "<supergroup>";
-		result << "<name>" << escapeForXml(group->getName()) << "</name>";
+		result << "<name>" << escapeForXml(group.name) << "</name>";
 		result << "<state>READY</state>";
 		result << "<get_wait_list_size>0</get_wait_list_size>";
-		result << "<capacity_used>" << group->capacityUsed() << "</capacity_used>";
+		result << "<capacity_used>" << group.capacityUsed << "</capacity_used>";
+		result << "<fair_capacity_share>" << group.fairCapacityShare
+			<< "</fair_capacity_share>";
 		if (options.secrets) {
-			result << "<secret>" << escapeForXml(group->getApiKey().toStaticString()) << "</secret>";
+			result << "<secret>" << escapeForXml(group.apiKey.toStaticString()) << "</secret>";
 		}
 
 		result << "<group default=\"true\">";
-		group->inspectXml(result, options.secrets);
+		group.inspectXml(result, options.secrets);
 		result << "</group>";
 
 		result << "</supergroup>";
-
-		g_it.next();
 	}
 	result << "</supergroups>";
 
@@ -258,6 +440,47 @@ Pool::toXml(const ToXmlOptions &options, bool lock) const {
 	return result.str();
 }
 
+string
+Pool::toJson(const ToXmlOptions &options, bool lock) const {
+	Snapshot snapshot;
+	takeSnapshot(snapshot, options, lock);
+	return toJson(snapshot, options);
+}
+
+/**
+ * Like toXml(), but without the group options, autoscaler, request queue
+ * and spawn phase details.
+ */
+string
+Pool::toJson(const Snapshot &snapshot, const ToXmlOptions &options) {
+	Json::Value doc;
+	vector<GroupSnapshot>::const_iterator g_it;
+
+	doc["passenger_version"] = PASSENGER_VERSION;
+	doc["group_count"] = snapshot.groupCount;
+	doc["process_count"] = snapshot.processCount;
+	doc["max"] = snapshot.max;
+	doc["capacity_used"] = snapshot.capacityUsed;
+	doc["get_wait_list_size"] = (Json::UInt) snapshot.getWaitlist.size();
+	if (options.secrets) {
+		vector<string>::const_iterator w_it, w_end = snapshot.getWaitlist.end();
+		doc["get_wait_list"] = Json::Value(Json::arrayValue);
+		for (w_it = snapshot.getWaitlist.begin(); w_it != w_end; w_it++) {
+			Json::Value item;
+			item["app_group_name"] = *w_it;
+			doc["get_wait_list"].append(item);
+		}
+	}
+
+	doc["groups"] = Json::Value(Json::arrayValue);
+	for (g_it = snapshot.groups.begin(); g_it != snapshot.groups.end(); g_it++) {
+		Json::Value group;
+		groupSnapshotToJson(*g_it, group, options.secrets);
+		doc["groups"].append(group);
+	}
+
+	return stringifyJson(doc);
+}
 
 unsigned int
 Pool::capacityUsed() const {
@@ -289,12 +512,131 @@ Pool::getProcessCount(bool lock) const {
 	return result;
 }
 
+/**
+ * Returns the number of enabled processes in the group with the given key
+ * (see `Options::getGroupKey()`), or 0 if there is no such group.
+ */
+unsigned int
+Pool::getEnabledProcessCount(const HashedStaticString &groupKey) const {
+	LockGuard l(syncher);
+	GroupPtr *group;
+	if (groups.lookup(groupKey, &group)) {
+		return (*group)->enabledCount;
+	} else {
+		return 0;
+	}
+}
+
 unsigned int
 Pool::getGroupCount() const {
 	LockGuard l(syncher);
 	return groups.size();
 }
 
+/**
+ * Returns the system metrics samples of the past `maxAge` seconds,
+ * as sampled by the analytics collector every 5 seconds.
+ */
+Json::Value
+Pool::inspectSystemMetricsHistoryAsJson(unsigned int maxAge) const {
+	LockGuard l(syncher);
+	return systemMetricsHistory.inspectAsJson(SystemTime::get() - maxAge);
+}
+
+/**
+ * Returns the settings that can be changed while the pool is running,
+ * i.e. through setMax(), setMaxIdleTime() and setSpawnWorkerCount().
+ */
+Json::Value
+Pool::getConfigAsJson() const {
+	LockGuard l(syncher);
+	Json::Value doc;
+	doc["max_pool_size"] = max;
+	doc["pool_idle_time"] = (Json::UInt64) (maxIdleTime / 1000000);
+	doc["spawn_worker_threads"] = spawnWorkerCount;
+	if (!tenantMaxProcesses.empty()) {
+		std::map<string, unsigned int>::const_iterator it;
+		for (it = tenantMaxProcesses.begin(); it != tenantMaxProcesses.end(); it++) {
+			doc["tenant_max_pool_size"][it->first] = it->second;
+		}
+	}
+	return doc;
+}
+
+void
+Pool::collectAppMetrics(const ProcessList &processes, Metrics::GroupMetrics &groupMetrics) {
+	ProcessList::const_iterator it, end = processes.end();
+	SpawningKit::AppMetrics appMetrics;
+
+	for (it = processes.begin(); it != end; it++) {
+		if ((*it)->getAppMetrics(appMetrics)) {
+			groupMetrics.appMetricsProcessCount++;
+			if (appMetrics.gcInProgress) {
+				groupMetrics.collectingGarbageProcessCount++;
+			}
+			groupMetrics.gcCount += appMetrics.gcCount;
+			groupMetrics.gcTime += appMetrics.gcTime;
+			groupMetrics.heapSize += appMetrics.heapSize;
+			groupMetrics.threadsBusy += appMetrics.threadsBusy;
+			groupMetrics.threadsTotal += appMetrics.threadsTotal;
+		}
+	}
+}
+
+void
+Pool::collectMetrics(Metrics &metrics) const {
+	LockGuard l(syncher);
+	GroupMap::ConstIterator g_it(groups);
+
+	metrics.max = max;
+	metrics.capacityUsed = capacityUsedUnlocked();
+	metrics.getWaitlistSize = getWaitlist.size();
+	if (systemMetricsHistory.size() > 0) {
+		const SystemMetricsHistory::Sample &sample =
+			systemMetricsHistory.get(systemMetricsHistory.size() - 1);
+		metrics.cgroupMemoryLimit = sample.cgroupMemoryLimit;
+		metrics.cgroupMemoryUsage = sample.cgroupMemoryUsage;
+		metrics.cgroupCpuQuota = sample.cgroupCpuQuota;
+	} else {
+		metrics.cgroupMemoryLimit = -1;
+		metrics.cgroupMemoryUsage = -1;
+		metrics.cgroupCpuQuota = -1;
+	}
+	metrics.groups.clear();
+	metrics.groups.reserve(groups.size());
+
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		ProcessList::const_iterator p_it;
+
+		metrics.groups.push_back(Metrics::GroupMetrics());
+		Metrics::GroupMetrics &groupMetrics = metrics.groups.back();
+		groupMetrics.name = group->getName();
+		groupMetrics.enabledProcessCount = group->enabledCount;
+		groupMetrics.disablingProcessCount = group->disablingCount;
+		groupMetrics.disabledProcessCount = group->disabledCount;
+		groupMetrics.processesBeingSpawned = group->processesBeingSpawned;
+		groupMetrics.totallyBusyProcessCount = group->nEnabledProcessesTotallyBusy;
+		groupMetrics.sessions = group->nEnabledProcessSessions;
+		for (p_it = group->disablingProcesses.begin(); p_it != group->disablingProcesses.end(); p_it++) {
+			groupMetrics.sessions += (*p_it)->sessions;
+		}
+		for (p_it = group->disabledProcesses.begin(); p_it != group->disabledProcesses.end(); p_it++) {
+			groupMetrics.sessions += (*p_it)->sessions;
+		}
+		groupMetrics.capacityUsed = group->capacityUsed();
+		groupMetrics.getWaitlistSize = group->getWaitlist.size();
+		groupMetrics.spawnsSucceeded = group->spawnsSucceeded;
+		groupMetrics.spawnsFailed = group->spawnsFailed;
+		groupMetrics.cgroupMemoryUsage = group->cgroupMemoryUsage;
+		collectAppMetrics(group->enabledProcesses, groupMetrics);
+		collectAppMetrics(group->disablingProcesses, groupMetrics);
+		collectAppMetrics(group->disabledProcesses, groupMetrics);
+
+		g_it.next();
+	}
+}
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
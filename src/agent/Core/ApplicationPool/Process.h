@@ -32,6 +32,7 @@
 #include <boost/intrusive_ptr.hpp>
 #include <boost/move/core.hpp>
 #include <boost/container/vector.hpp>
+#include <boost/atomic.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/spin_lock.hpp>
 #include <oxt/macros.hpp>
@@ -47,9 +48,11 @@
 #include <Utils/StrIntUtils.h>
 #include <Utils/Lock.h>
 #include <Utils/ProcessMetricsCollector.h>
+#include <Algorithms/MovingAverage.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Socket.h>
 #include <Core/ApplicationPool/Session.h>
+#include <Core/ApplicationPool/ProcessRoutingTable.h>
 #include <Core/SpawningKit/PipeWatcher.h>
 #include <Core/SpawningKit/Result.h>
 #include <Shared/ApplicationPoolApiKey.h>
@@ -102,6 +105,8 @@ typedef boost::container::vector<ProcessPtr> ProcessList;
  */
 class Process {
 public:
+	friend struct ProcessSnapshot;
+
 	static const unsigned int MAX_SESSION_SOCKETS = 3;
 
 private:
@@ -137,6 +142,18 @@ private:
 	 */
 	FileDescriptor errorPipe;
 
+	/**
+	 * The page through which this process publishes metrics about itself,
+	 * such as garbage collection activity. NULL if it doesn't.
+	 */
+	SpawningKit::AppMetricsPagePtr appMetricsPage;
+
+	/**
+	 * The shared memory rings that the sockets that accept them use for
+	 * session data. NULL if none do.
+	 */
+	ShmRingFilePtr shmRingFile;
+
 	/**
 	 * The code revision of the application, inferred through various means.
 	 * See Spawner::prepareSpawn() to learn how this is determined.
@@ -144,6 +161,16 @@ private:
 	 */
 	StaticString codeRevision;
 
+	/**
+	 * The CPUs that this process was pinned to when it was spawned, as a
+	 * list like "0-3,8". Empty if it inherited the Core's CPU affinity.
+	 * See Options::cpuAffinity.
+	 */
+	StaticString cpuAffinity;
+	/** The NUMA node that `cpuAffinity` belongs to, or -1 if the CPU
+	 * affinity policy didn't pick a node. */
+	int numaNode;
+
 	/**
 	 * Time at which the Spawner that created this process was created.
 	 * Microseconds resolution.
@@ -159,6 +186,13 @@ private:
 	 */
 	unsigned long long spawnEndTime;
 
+	/**
+	 * Time spent in each SpawningKit::SpawnPhase, in usec. Only
+	 * meaningful if `spawnPhasesKnown`, i.e. if the Spawner reported them.
+	 */
+	unsigned int spawnPhaseTimes[SpawningKit::SPAWN_PHASE_COUNT];
+	bool spawnPhasesKnown;
+
 	/**
 	 * If true, then indicates that this Process does not refer to a real OS
 	 * process. The sockets in the socket list are fake and need not be deleted,
@@ -186,6 +220,9 @@ private:
 
 	/** The index inside the associated Group's process list. */
 	unsigned int index;
+	/** The routing table of that process list, in which this process's
+	 * entry is at `index`. NULL if that list has no routing table. */
+	ProcessRoutingTable *routingTable;
 
 
 	/*************************************************************
@@ -208,6 +245,7 @@ private:
 
 		vector<SocketStringOffsets> socketStringOffsets;
 		String codeRevision;
+		String cpuAffinity;
 	};
 
 	void appendJsonFieldToBuffer(std::string &buffer, const Json::Value &json,
@@ -248,6 +286,9 @@ private:
 		if (json.isMember("code_revision")) {
 			appendJsonFieldToBuffer(buffer, json, "code_revision", log.codeRevision);
 		}
+		if (json.isMember("cpu_affinity")) {
+			appendJsonFieldToBuffer(buffer, json, "cpu_affinity", log.cpuAffinity);
+		}
 
 
 		// Step 2: allocate the real buffer.
@@ -273,7 +314,9 @@ private:
 					log.socketStringOffsets[i].address.size),
 				StaticString(base + log.socketStringOffsets[i].protocol.offset,
 					log.socketStringOffsets[i].protocol.size),
-				getJsonIntField(socket, "concurrency")
+				getJsonIntField(socket, "concurrency"),
+				getJsonBoolField(socket, "accepts_request_body_fd", false),
+				getJsonBoolField(socket, "accepts_shm_ring", false)
 			);
 		}
 
@@ -281,6 +324,10 @@ private:
 			codeRevision = StaticString(base + log.codeRevision.offset,
 				log.codeRevision.size);
 		}
+		if (json.isMember("cpu_affinity")) {
+			cpuAffinity = StaticString(base + log.cpuAffinity.offset,
+				log.cpuAffinity.size);
+		}
 	}
 
 	void indexSessionSockets() {
@@ -360,7 +407,8 @@ public:
 	 * isn't concurrently modifying.
 	 *************************************************************/
 
-	/** Last time when a session was opened for this Process. */
+	/** Last time when a session was opened for this Process. Change it
+	 * through `setLastUsed()`, which keeps `routingTable` up to date. */
 	unsigned long long lastUsed;
 	/** Number of sessions currently open.
 	 * @invariant session >= 0
@@ -368,6 +416,10 @@ public:
 	int sessions;
 	/** Number of sessions opened so far. */
 	unsigned int processed;
+	/** Exponential moving average of the session duration, in microseconds.
+	 * -1 if no session has been closed yet. Used by the "ewma" routing policy.
+	 */
+	double avgResponseTime;
 	/** Do not access directly, always use `isAlive()`/`isDead()`/`getLifeStatus()` or
 	 * through `lifetimeSyncher`. */
 	enum LifeStatus {
@@ -416,18 +468,70 @@ public:
 		 * out-of-band work can be performed. */
 		OOBW_IN_PROGRESS,
 	} oobwStatus;
+	/** Out-of-band work timeline, in microseconds. 0 if it didn't happen yet.
+	 * `oobwRequestTime` is when the process last requested out-of-band work;
+	 * the request may have been deferred until some time later because
+	 * of the group's load. */
+	unsigned long long oobwRequestTime;
+	unsigned long long lastOobwStartTime;
+	unsigned long long lastOobwEndTime;
+	/** How long the last out-of-band work took according to the process
+	 * itself, in microseconds. 0 if unknown. */
+	unsigned long long lastOobwDuration;
+	/** Number of out-of-band work requests performed so far. */
+	unsigned int oobwCount;
+	/** Health checking state, see Pool::realCheckHealth(). `lastProgressTime`
+	 * is the last time at which a session was started while the process was
+	 * idle, or at which one of its sessions was closed. `ejectedUntil` is
+	 * nonzero while the process is ejected. */
+	unsigned long long lastProgressTime;
+	unsigned long long nextHealthCheckTime;
+	unsigned long long ejectedUntil;
+	/** The value of `processed` when the process was last readmitted. */
+	unsigned int processedAtReadmission;
+	unsigned int healthCheckFailures;
+	unsigned int consecutiveEjections;
+	unsigned int ejectionCount;
+	/** The percentage of `options.maxRequests` and `options.memoryLimit` at
+	 * which this process is recycled. Lowered randomly by up to
+	 * `options.recycleJitter` percent when the process is attached, so that
+	 * processes that were spawned together aren't recycled together. */
+	unsigned int recycleThreshold;
 	/** Caches whether or not the OS process still exists. */
 	mutable bool m_osProcessExists: 1;
 	bool longRunningConnectionsAborted: 1;
+	/** Whether this process is being replaced because it went over
+	 * `options.memoryLimit`. */
+	bool overMemoryLimit: 1;
+	/** Whether this process is being replaced because it reached
+	 * `options.maxRequests`. It keeps serving requests until its successor
+	 * has been attached. */
+	bool reachedMaxRequests: 1;
+	/** Whether this process was spawned before the current rolling restart,
+	 * and is waiting to be replaced by a process that runs the new code. */
+	bool outdated: 1;
 	/** Time at which shutdown began. */
 	time_t shutdownStartTime;
 	/** Collected by Pool::collectAnalytics(). */
 	ProcessMetrics metrics;
+	/** The first metrics that were collected for this process, shortly
+	 * after it was spawned. Comparing them with `metrics` shows how much
+	 * of the memory shared with the preloader has been unshared since. */
+	ProcessMetrics initialMetrics;
+	/** Progress of disconnecting this process's long-running connections
+	 * after it was detached, see Core::Controller::disconnectLongRunningConnections().
+	 * Maintained by the Controllers without holding the Pool lock.
+	 * `drainingConnections` is the number of connections that are waiting
+	 * for their turn, `drainedConnections` the number that have been
+	 * closed so far. */
+	boost::atomic<unsigned int> drainingConnections;
+	boost::atomic<unsigned int> drainedConnections;
 
 
 	Process(const BasicGroupInfo *groupInfo, const Json::Value &json)
 		: info(this, groupInfo, json),
 		  sessionSocketCount(0),
+		  numaNode(getJsonIntField(json, "numa_node", -1)),
 		  spawnerCreationTime(getJsonUint64Field(json, "spawner_creation_time")),
 		  spawnStartTime(getJsonUint64Field(json, "spawn_start_time")),
 		  spawnEndTime(SystemTime::getUsec()),
@@ -435,37 +539,77 @@ public:
 		  requiresShutdown(false),
 		  refcount(1),
 		  index(-1),
+		  routingTable(NULL),
 		  lastUsed(spawnEndTime),
 		  sessions(0),
 		  processed(0),
+		  avgResponseTime(-1),
 		  lifeStatus(ALIVE),
 		  enabled(ENABLED),
 		  oobwStatus(OOBW_NOT_ACTIVE),
+		  oobwRequestTime(0),
+		  lastOobwStartTime(0),
+		  lastOobwEndTime(0),
+		  lastOobwDuration(0),
+		  oobwCount(0),
+		  lastProgressTime(spawnEndTime),
+		  nextHealthCheckTime(0),
+		  ejectedUntil(0),
+		  processedAtReadmission(0),
+		  healthCheckFailures(0),
+		  consecutiveEjections(0),
+		  ejectionCount(0),
+		  recycleThreshold(100),
 		  m_osProcessExists(true),
 		  longRunningConnectionsAborted(false),
-		  shutdownStartTime(0)
+		  overMemoryLimit(false),
+		  reachedMaxRequests(false),
+		  outdated(false),
+		  shutdownStartTime(0),
+		  drainingConnections(0),
+		  drainedConnections(0)
 	{
 		initializeSocketsAndStringFields(json);
 		indexSessionSockets();
+		initializeSpawnPhaseTimes(json);
 
 		const SpawningKit::Result *skResult = dynamic_cast<const SpawningKit::Result *>(&json);
 		if (skResult != NULL) {
 			adminSocket = skResult->adminSocket;
 			errorPipe = skResult->errorPipe;
+			appMetricsPage = skResult->appMetricsPage;
+			shmRingFile = skResult->shmRingFile;
+			if (shmRingFile != NULL) {
+				SocketList::iterator it, end = sockets.end();
+				for (it = sockets.begin(); it != end; it++) {
+					if (it->acceptsShmRing) {
+						it->shmRingFile = shmRingFile.get();
+					}
+				}
+			}
 
+			const SpawningKit::ConfigPtr &config = getContext()->getSpawningKitConfig();
 			if (adminSocket != -1) {
-				SpawningKit::PipeWatcherPtr watcher = boost::make_shared<SpawningKit::PipeWatcher>(
-					getContext()->getSpawningKitConfig(), adminSocket, "stdout", info.pid);
-				watcher->initialize();
-				watcher->start();
+				config->pipeWatcher->watch(adminSocket, "stdout", info.pid,
+					&config->outputHandler);
 			}
-
 			if (errorPipe != -1) {
-				SpawningKit::PipeWatcherPtr watcher = boost::make_shared<SpawningKit::PipeWatcher>(
-					getContext()->getSpawningKitConfig(), errorPipe, "stderr", info.pid);
-				watcher->initialize();
-				watcher->start();
+				config->pipeWatcher->watch(errorPipe, "stderr", info.pid,
+					&config->outputHandler);
+			}
+		}
+	}
+
+	void initializeSpawnPhaseTimes(const Json::Value &json) {
+		const Json::Value &phases = json["spawn_phases"];
+		spawnPhasesKnown = phases.isObject();
+		for (unsigned int i = 0; i < SpawningKit::SPAWN_PHASE_COUNT; i++) {
+			unsigned long long time = 0;
+			if (spawnPhasesKnown) {
+				time = getJsonUint64Field(phases,
+					SpawningKit::getSpawnPhaseName((SpawningKit::SpawnPhase) i), 0);
 			}
+			spawnPhaseTimes[i] = (unsigned int) std::min<unsigned long long>(time, UINT_MAX);
 		}
 	}
 
@@ -486,6 +630,7 @@ public:
 		for (unsigned i = 0; i < sessionSocketCount; i++) {
 			sessionSockets[i]->concurrency = concurrency;
 		}
+		updateRoutingTableEntry();
 	}
 
 	void shutdownNotRequired() {
@@ -629,6 +774,48 @@ public:
 		return spawnerCreationTime;
 	}
 
+	unsigned long long getSpawnStartTime() const {
+		return spawnStartTime;
+	}
+
+	unsigned long long getSpawnEndTime() const {
+		return spawnEndTime;
+	}
+
+	bool hasSpawnPhaseTimes() const {
+		return spawnPhasesKnown;
+	}
+
+	/** The time spent in the given spawn phase, in usec. */
+	unsigned int getSpawnPhaseTime(SpawningKit::SpawnPhase phase) const {
+		return spawnPhaseTimes[phase];
+	}
+
+	bool hasAppMetrics() const {
+		return appMetricsPage != NULL;
+	}
+
+	/**
+	 * Reads the metrics that this process published about itself. Returns
+	 * false if it doesn't publish any, or if they were being updated.
+	 */
+	bool getAppMetrics(SpawningKit::AppMetrics &appMetrics) const {
+		return appMetricsPage != NULL && appMetricsPage->read(appMetrics);
+	}
+
+	/**
+	 * Whether this process reported that it is collecting garbage. Such a
+	 * process cannot serve requests until it is done.
+	 */
+	bool isCollectingGarbage() const {
+		return appMetricsPage != NULL && appMetricsPage->gcInProgress();
+	}
+
+	/** The maximum number of concurrent sessions. 0 means unlimited. */
+	int getConcurrency() const {
+		return concurrency;
+	}
+
 	bool isDummy() const {
 		return dummy;
 	}
@@ -644,6 +831,23 @@ public:
 		index = i;
 	}
 
+	ProcessRoutingTable *getRoutingTable() const {
+		return routingTable;
+	}
+
+	/**
+	 * Sets the routing table of the process list that this process is in.
+	 * The caller must add or remove this process's entry as well.
+	 */
+	void setRoutingTable(ProcessRoutingTable *table) {
+		routingTable = table;
+	}
+
+	void setLastUsed(unsigned long long value) {
+		lastUsed = value;
+		updateRoutingTableEntry();
+	}
+
 	const SocketList &getSockets() const {
 		return sockets;
 	}
@@ -657,7 +861,7 @@ public:
 			int leastBusySessionSocketIndex = 0;
 			int lowestBusyness = sessionSockets[0]->busyness();
 
-			for (unsigned i = 1; i < sessionSocketCount; i++) {
+			for (unsigned i = 1; i < sessionSocketCount && lowestBusyness > 0; i++) {
 				if (sessionSockets[i]->busyness() < lowestBusyness) {
 					leastBusySessionSocketIndex = i;
 					lowestBusyness = sessionSockets[i]->busyness();
@@ -719,6 +923,14 @@ public:
 		}
 	}
 
+	/** Writes the state that is mirrored in `routingTable` through to it.
+	 * The busyness is written with a relaxed atomic store. */
+	void updateRoutingTableEntry() {
+		if (routingTable != NULL) {
+			routingTable->update(index, busyness(), canBeRoutedTo(), lastUsed);
+		}
+	}
+
 	/**
 	 * Whether we've reached the maximum number of concurrent sessions for this
 	 * process.
@@ -760,7 +972,13 @@ public:
 			} else {
 				lastUsed = SystemTime::getUsec();
 			}
-			return createSessionObject(socket);
+			updateRoutingTableEntry();
+			if (sessions == 1) {
+				lastProgressTime = lastUsed;
+			}
+			SessionPtr session = createSessionObject(socket);
+			session->startTime = lastUsed;
+			return session;
 		}
 	}
 
@@ -786,7 +1004,6 @@ public:
 		};
 
 		Context *context = getContext();
-		LockGuard l(context->getMmSyncher());
 		Session *session = context->getSessionObjectPool().malloc();
 		Guard guard(context, session);
 		session = new (session) Session(context, &info, socket);
@@ -802,8 +1019,16 @@ public:
 
 		socket->sessions--;
 		this->sessions--;
+		updateRoutingTableEntry();
 		processed++;
 		assert(!isTotallyBusy());
+
+		unsigned long long now = SystemTime::getUsec();
+		lastProgressTime = now;
+		if (session->startTime != 0 && now >= session->startTime) {
+			avgResponseTime = expMovingAverage(avgResponseTime,
+				now - session->startTime, 0.1);
+		}
 	}
 
 	/**
@@ -820,53 +1045,231 @@ public:
 		return result.str();
 	}
 
+	template<typename Stream>
+	void inspectXml(Stream &stream, bool includeSockets = true) const;
+};
+
+
+/**
+ * A copy of the parts of a Process's state that the state inspection
+ * functions show. It is taken while holding the Pool lock, so that
+ * formatting, which is much slower than copying, can happen after
+ * releasing it.
+ */
+struct ProcessSnapshot {
+	struct SocketInfo {
+		string name;
+		string address;
+		string protocol;
+		int concurrency;
+		int sessions;
+	};
+
+	pid_t pid;
+	unsigned int stickySessionId;
+	string gupid;
+	int concurrency;
+	int sessions;
+	int busyness;
+	unsigned int processed;
+	double avgResponseTime;
+	unsigned long long spawnerCreationTime;
+	unsigned long long spawnStartTime;
+	unsigned long long spawnEndTime;
+	bool spawnPhasesKnown;
+	unsigned int spawnPhaseTimes[SpawningKit::SPAWN_PHASE_COUNT];
+	unsigned long long lastUsed;
+	string codeRevision;
+	string cpuAffinity;
+	int numaNode;
+	Process::LifeStatus lifeStatus;
+	Process::EnabledStatus enabled;
+	bool overMemoryLimit;
+	bool reachedMaxRequests;
+	bool outdated;
+	unsigned int recycleThreshold;
+	unsigned int oobwCount;
+	unsigned long long oobwRequestTime;
+	unsigned long long lastOobwStartTime;
+	unsigned long long lastOobwEndTime;
+	unsigned long long lastOobwDuration;
+	unsigned long long ejectedUntil;
+	unsigned int ejectionCount;
+	unsigned int healthCheckFailures;
+	unsigned int drainingConnections;
+	unsigned int drainedConnections;
+	ProcessMetrics metrics;
+	ProcessMetrics initialMetrics;
+	SpawningKit::AppMetrics appMetrics;
+	bool appMetricsKnown;
+	vector<SocketInfo> sockets;
+
+	ProcessSnapshot(const Process &process)
+		: pid(process.getPid()),
+		  stickySessionId(process.getStickySessionId()),
+		  gupid(process.getGupid().data(), process.getGupid().size()),
+		  concurrency(process.concurrency),
+		  sessions(process.sessions),
+		  busyness(process.busyness()),
+		  processed(process.processed),
+		  avgResponseTime(process.avgResponseTime),
+		  spawnerCreationTime(process.spawnerCreationTime),
+		  spawnStartTime(process.spawnStartTime),
+		  spawnEndTime(process.spawnEndTime),
+		  spawnPhasesKnown(process.spawnPhasesKnown),
+		  lastUsed(process.lastUsed),
+		  codeRevision(process.codeRevision.data(), process.codeRevision.size()),
+		  cpuAffinity(process.cpuAffinity.data(), process.cpuAffinity.size()),
+		  numaNode(process.numaNode),
+		  lifeStatus(process.lifeStatus),
+		  enabled(process.enabled),
+		  overMemoryLimit(process.overMemoryLimit),
+		  reachedMaxRequests(process.reachedMaxRequests),
+		  outdated(process.outdated),
+		  recycleThreshold(process.recycleThreshold),
+		  oobwCount(process.oobwCount),
+		  oobwRequestTime(process.oobwRequestTime),
+		  lastOobwStartTime(process.lastOobwStartTime),
+		  lastOobwEndTime(process.lastOobwEndTime),
+		  lastOobwDuration(process.lastOobwDuration),
+		  ejectedUntil(process.ejectedUntil),
+		  ejectionCount(process.ejectionCount),
+		  healthCheckFailures(process.healthCheckFailures),
+		  drainingConnections(process.drainingConnections.load(boost::memory_order_relaxed)),
+		  drainedConnections(process.drainedConnections.load(boost::memory_order_relaxed)),
+		  metrics(process.metrics),
+		  initialMetrics(process.initialMetrics),
+		  appMetricsKnown(process.getAppMetrics(appMetrics))
+	{
+		SocketList::const_iterator it;
+
+		memcpy(spawnPhaseTimes, process.spawnPhaseTimes, sizeof(spawnPhaseTimes));
+		sockets.reserve(process.sockets.size());
+		for (it = process.sockets.begin(); it != process.sockets.end(); it++) {
+			sockets.push_back(SocketInfo());
+			SocketInfo &info = sockets.back();
+			info.name.assign(it->name.data(), it->name.size());
+			info.address.assign(it->address.data(), it->address.size());
+			info.protocol.assign(it->protocol.data(), it->protocol.size());
+			info.concurrency = it->concurrency;
+			info.sessions = it->sessions;
+		}
+	}
+
+	string uptime() const {
+		return distanceOfTimeInWords(spawnEndTime / 1000000);
+	}
+
+	const SocketInfo *findSocketWithName(const StaticString &name) const {
+		vector<SocketInfo>::const_iterator it;
+		for (it = sockets.begin(); it != sockets.end(); it++) {
+			if (it->name == name) {
+				return &(*it);
+			}
+		}
+		return NULL;
+	}
+
 	template<typename Stream>
 	void inspectXml(Stream &stream, bool includeSockets = true) const {
-		stream << "<pid>" << getPid() << "</pid>";
-		stream << "<sticky_session_id>" << getStickySessionId() << "</sticky_session_id>";
-		stream << "<gupid>" << getGupid() << "</gupid>";
+		stream << "<pid>" << pid << "</pid>";
+		stream << "<sticky_session_id>" << stickySessionId << "</sticky_session_id>";
+		stream << "<gupid>" << gupid << "</gupid>";
 		stream << "<concurrency>" << concurrency << "</concurrency>";
 		stream << "<sessions>" << sessions << "</sessions>";
-		stream << "<busyness>" << busyness() << "</busyness>";
+		stream << "<busyness>" << busyness << "</busyness>";
 		stream << "<processed>" << processed << "</processed>";
+		if (avgResponseTime >= 0) {
+			stream << "<avg_response_time>" << (unsigned long long) avgResponseTime << "</avg_response_time>";
+		}
 		stream << "<spawner_creation_time>" << spawnerCreationTime << "</spawner_creation_time>";
 		stream << "<spawn_start_time>" << spawnStartTime << "</spawn_start_time>";
 		stream << "<spawn_end_time>" << spawnEndTime << "</spawn_end_time>";
+		if (spawnPhasesKnown) {
+			stream << "<spawn_phases>";
+			for (unsigned int i = 0; i < SpawningKit::SPAWN_PHASE_COUNT; i++) {
+				const char *name = SpawningKit::getSpawnPhaseName((SpawningKit::SpawnPhase) i);
+				stream << "<" << name << ">" << spawnPhaseTimes[i] << "</" << name << ">";
+			}
+			stream << "</spawn_phases>";
+		}
 		stream << "<last_used>" << lastUsed << "</last_used>";
 		stream << "<last_used_desc>" << distanceOfTimeInWords(lastUsed / 1000000).c_str() << " ago</last_used_desc>";
 		stream << "<uptime>" << uptime() << "</uptime>";
 		if (!codeRevision.empty()) {
 			stream << "<code_revision>" << escapeForXml(codeRevision) << "</code_revision>";
 		}
+		if (!cpuAffinity.empty()) {
+			stream << "<cpu_affinity>" << cpuAffinity << "</cpu_affinity>";
+		}
+		if (numaNode != -1) {
+			stream << "<numa_node>" << numaNode << "</numa_node>";
+		}
 		switch (lifeStatus) {
-		case ALIVE:
+		case Process::ALIVE:
 			stream << "<life_status>ALIVE</life_status>";
 			break;
-		case SHUTDOWN_TRIGGERED:
+		case Process::SHUTDOWN_TRIGGERED:
 			stream << "<life_status>SHUTDOWN_TRIGGERED</life_status>";
 			break;
-		case DEAD:
+		case Process::DEAD:
 			stream << "<life_status>DEAD</life_status>";
 			break;
 		default:
 			P_BUG("Unknown 'lifeStatus' state " << (int) lifeStatus);
 		}
 		switch (enabled) {
-		case ENABLED:
+		case Process::ENABLED:
 			stream << "<enabled>ENABLED</enabled>";
 			break;
-		case DISABLING:
+		case Process::DISABLING:
 			stream << "<enabled>DISABLING</enabled>";
 			break;
-		case DISABLED:
+		case Process::DISABLED:
 			stream << "<enabled>DISABLED</enabled>";
 			break;
-		case DETACHED:
+		case Process::DETACHED:
 			stream << "<enabled>DETACHED</enabled>";
 			break;
 		default:
 			P_BUG("Unknown 'enabled' state " << (int) enabled);
 		}
+		if (overMemoryLimit) {
+			stream << "<over_memory_limit/>";
+		}
+		if (reachedMaxRequests) {
+			stream << "<reached_max_requests/>";
+		}
+		if (recycleThreshold < 100) {
+			stream << "<recycle_threshold>" << recycleThreshold << "</recycle_threshold>";
+		}
+		if (outdated) {
+			stream << "<outdated/>";
+		}
+		stream << "<oobw_count>" << oobwCount << "</oobw_count>";
+		if (oobwRequestTime != 0) {
+			stream << "<oobw_request_time>" << oobwRequestTime << "</oobw_request_time>";
+		}
+		if (lastOobwStartTime != 0) {
+			stream << "<last_oobw_start_time>" << lastOobwStartTime << "</last_oobw_start_time>";
+		}
+		if (lastOobwEndTime != 0) {
+			stream << "<last_oobw_end_time>" << lastOobwEndTime << "</last_oobw_end_time>";
+		}
+		if (lastOobwDuration != 0) {
+			stream << "<last_oobw_duration>" << lastOobwDuration << "</last_oobw_duration>";
+		}
+		if (ejectedUntil != 0) {
+			stream << "<ejected_until>" << ejectedUntil << "</ejected_until>";
+		}
+		stream << "<ejection_count>" << ejectionCount << "</ejection_count>";
+		if (healthCheckFailures > 0) {
+			stream << "<health_check_failures>" << healthCheckFailures << "</health_check_failures>";
+		}
+		if (drainingConnections > 0 || drainedConnections > 0) {
+			stream << "<draining_connections>" << drainingConnections << "</draining_connections>";
+			stream << "<drained_connections>" << drainedConnections << "</drained_connections>";
+		}
 		if (metrics.isValid()) {
 			stream << "<has_metrics>true</has_metrics>";
 			stream << "<cpu>" << (int) metrics.cpu << "</cpu>";
@@ -878,13 +1281,33 @@ public:
 			stream << "<vmsize>" << metrics.vmsize << "</vmsize>";
 			stream << "<process_group_id>" << metrics.processGroupId << "</process_group_id>";
 			stream << "<command>" << escapeForXml(metrics.command) << "</command>";
+			if (metrics.sharedMemory() != -1) {
+				stream << "<shared_memory>" << metrics.sharedMemory() << "</shared_memory>";
+			}
+			if (initialMetrics.sharedMemory() != -1) {
+				stream << "<initial_shared_memory>" << initialMetrics.sharedMemory() << "</initial_shared_memory>";
+				stream << "<initial_private_dirty>" << initialMetrics.privateDirty << "</initial_private_dirty>";
+			}
+		}
+		if (appMetricsKnown) {
+			stream << "<app_metrics>";
+			stream << "<updated_at>" << appMetrics.updatedAt << "</updated_at>";
+			stream << "<gc_count>" << appMetrics.gcCount << "</gc_count>";
+			stream << "<gc_time>" << appMetrics.gcTime << "</gc_time>";
+			stream << "<heap_size>" << appMetrics.heapSize << "</heap_size>";
+			stream << "<threads_busy>" << appMetrics.threadsBusy << "</threads_busy>";
+			stream << "<threads_total>" << appMetrics.threadsTotal << "</threads_total>";
+			if (appMetrics.gcInProgress) {
+				stream << "<gc_in_progress/>";
+			}
+			stream << "</app_metrics>";
 		}
 		if (includeSockets) {
-			SocketList::const_iterator it;
+			vector<SocketInfo>::const_iterator it;
 
 			stream << "<sockets>";
 			for (it = sockets.begin(); it != sockets.end(); it++) {
-				const Socket &socket = *it;
+				const SocketInfo &socket = *it;
 				stream << "<socket>";
 				stream << "<name>" << escapeForXml(socket.name) << "</name>";
 				stream << "<address>" << escapeForXml(socket.address) << "</address>";
@@ -898,6 +1321,12 @@ public:
 	}
 };
 
+template<typename Stream>
+inline void
+Process::inspectXml(Stream &stream, bool includeSockets) const {
+	ProcessSnapshot(*this).inspectXml(stream, includeSockets);
+}
+
 
 inline void
 intrusive_ptr_add_ref(const Process *process) {
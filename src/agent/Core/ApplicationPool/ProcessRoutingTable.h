@@ -0,0 +1,185 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL_PROCESS_ROUTING_TABLE_H_
+#define _PASSENGER_APPLICATION_POOL_PROCESS_ROUTING_TABLE_H_
+
+#include <boost/container/vector.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <cassert>
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+
+/**
+ * The state of the processes in one of a Group's process lists that the
+ * routing and garbage collection scans look at, stored as a structure of
+ * arrays in the same order as that list. A scan over many processes then
+ * walks a few contiguous arrays instead of dereferencing every Process
+ * object, which live scattered over the heap and are much larger than a
+ * cache line.
+ *
+ * A Process that is in a list with a routing table writes its state through
+ * to its entry whenever it changes (see `Process::updateRoutingTableEntry()`).
+ * Like the process lists themselves, entries may only be added, removed or
+ * looked up while holding the Pool lock.
+ *
+ * The busyness column is the exception: its values are atomics that are
+ * stored and loaded with relaxed ordering through `setBusyness()` and
+ * `getBusyness()`, so that a session close path that does not hold the Pool
+ * lock can update the busyness of its process in place. Such a writer must
+ * still make sure that the entry's index doesn't change underneath it.
+ * The atomics are packed next to each other instead of padded to a cache
+ * line each, because the routing scans read them all in a row.
+ */
+class ProcessRoutingTable {
+public:
+	/**
+	 * A `boost::atomic<int>` that can be stored in a vector. Copying is only
+	 * done while the vector is resized, which happens under the Pool lock.
+	 */
+	struct BusynessLevel {
+		boost::atomic<int> value;
+
+		BusynessLevel(int _value = 0)
+			: value(_value)
+			{ }
+
+		BusynessLevel(const BusynessLevel &other)
+			: value(other.value.load(boost::memory_order_relaxed))
+			{ }
+
+		BusynessLevel &operator=(const BusynessLevel &other) {
+			value.store(other.value.load(boost::memory_order_relaxed),
+				boost::memory_order_relaxed);
+			return *this;
+		}
+	};
+
+	boost::container::vector<unsigned int> stickySessionIds;
+	/** The values of `Process::busyness()`. Access through `getBusyness()`
+	 * and `setBusyness()`. */
+	boost::container::vector<BusynessLevel> busyness;
+	/** The values of `Process::canBeRoutedTo()`. */
+	boost::container::vector<boost::uint8_t> routable;
+	/** The values of `Process::lastUsed`. */
+	boost::container::vector<unsigned long long> lastUsed;
+
+	unsigned int size() const {
+		return busyness.size();
+	}
+
+	bool empty() const {
+		return busyness.empty();
+	}
+
+	void add(unsigned int stickySessionId, int busynessValue, bool canBeRoutedTo,
+		unsigned long long lastUsedValue)
+	{
+		stickySessionIds.push_back(stickySessionId);
+		busyness.push_back(busynessValue);
+		routable.push_back(canBeRoutedTo);
+		lastUsed.push_back(lastUsedValue);
+	}
+
+	void update(unsigned int index, int busynessValue, bool canBeRoutedTo,
+		unsigned long long lastUsedValue)
+	{
+		assert(index < size());
+		setBusyness(index, busynessValue);
+		routable[index] = canBeRoutedTo;
+		lastUsed[index] = lastUsedValue;
+	}
+
+	int getBusyness(unsigned int index) const {
+		assert(index < size());
+		return busyness[index].value.load(boost::memory_order_relaxed);
+	}
+
+	void setBusyness(unsigned int index, int value) {
+		assert(index < size());
+		busyness[index].value.store(value, boost::memory_order_relaxed);
+	}
+
+	void remove(unsigned int index) {
+		assert(index < size());
+		stickySessionIds.erase(stickySessionIds.begin() + index);
+		busyness.erase(busyness.begin() + index);
+		routable.erase(routable.begin() + index);
+		lastUsed.erase(lastUsed.begin() + index);
+	}
+
+	void clear() {
+		stickySessionIds.clear();
+		busyness.clear();
+		routable.clear();
+		lastUsed.clear();
+	}
+
+	/** Returns the index of the entry with the given sticky session ID, or -1. */
+	int findStickySessionId(unsigned int id) const {
+		unsigned int i, count = size();
+		const unsigned int *ids = stickySessionIds.data();
+
+		for (i = 0; i < count; i++) {
+			if (ids[i] == id) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	/**
+	 * Returns the index of the entry with the lowest busyness, or -1 if the
+	 * table is empty. Ties are resolved in favor of the earliest entry, so
+	 * the scan stops at the first idle entry: nothing can be less busy.
+	 */
+	int findLowestBusyness() const {
+		int leastBusyIndex = -1;
+		int lowestBusyness = 0;
+		unsigned int i, count = size();
+		const BusynessLevel *values = busyness.data();
+
+		for (i = 0; i < count; i++) {
+			int value = values[i].value.load(boost::memory_order_relaxed);
+			if (leastBusyIndex == -1 || value < lowestBusyness) {
+				leastBusyIndex = i;
+				lowestBusyness = value;
+				if (lowestBusyness == 0) {
+					break;
+				}
+			}
+		}
+		return leastBusyIndex;
+	}
+};
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL_PROCESS_ROUTING_TABLE_H_ */
@@ -0,0 +1,463 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_PROCESS_STATE_DELTA_H_
+#define _PASSENGER_APPLICATION_POOL2_PROCESS_STATE_DELTA_H_
+
+#include <boost/cstdint.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <StaticString.h>
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+/**
+ * The state of a process as reported to Union Station by the analytics
+ * collector. Unlike ProcessSnapshot, this is cheap to copy out of a
+ * Process while holding the pool lock: a handful of integers and the gupid.
+ */
+struct ProcessStateRecord {
+	enum Field {
+		PID,
+		STICKY_SESSION_ID,
+		ENABLED,
+		LIFE_STATUS,
+		FLAGS,
+		CONCURRENCY,
+		SESSIONS,
+		BUSYNESS,
+		PROCESSED,
+		AVG_RESPONSE_TIME,
+		SPAWN_END_TIME,
+		LAST_USED,
+		OOBW_COUNT,
+		EJECTED_UNTIL,
+		EJECTION_COUNT,
+		HEALTH_CHECK_FAILURES,
+		DRAINING_CONNECTIONS,
+		CPU,
+		RSS,
+		PSS,
+		PRIVATE_DIRTY,
+		SWAP,
+		VMSIZE,
+
+		FIELD_COUNT
+	};
+
+	/** Bits in the FLAGS field. */
+	enum Flag {
+		OVER_MEMORY_LIMIT    = 1 << 0,
+		REACHED_MAX_REQUESTS = 1 << 1,
+		OUTDATED             = 1 << 2
+	};
+
+	string gupid;
+	boost::int64_t fields[FIELD_COUNT];
+
+	ProcessStateRecord() {
+		memset(fields, 0, sizeof(fields));
+	}
+};
+
+/** The state of a group and its processes, see ProcessStateRecord. */
+struct GroupStateRecord {
+	enum Field {
+		ENABLED_COUNT,
+		DISABLING_COUNT,
+		DISABLED_COUNT,
+		CAPACITY_USED,
+		GET_WAITLIST_SIZE,
+		DISABLE_WAITLIST_SIZE,
+		PROCESSES_BEING_SPAWNED,
+		CGROUP_MEMORY_USAGE,
+		LIFE_STATUS,
+
+		FIELD_COUNT
+	};
+
+	boost::int64_t fields[FIELD_COUNT];
+	vector<ProcessStateRecord> processes;
+
+	GroupStateRecord() {
+		memset(fields, 0, sizeof(fields));
+	}
+};
+
+
+/**
+ * Encodes GroupStateRecords as compact binary records that only contain
+ * what changed since the previous record of the same group: processes
+ * that were added or removed, and the fields that changed in the others.
+ * Every FULL_RECORD_INTERVAL records, and whenever the encoder hasn't seen
+ * the group before, a full record is produced instead, so that a consumer
+ * that missed a record (or started late) can resynchronize.
+ *
+ * Format. All integers are varints; fields are zigzag encoded because
+ * some of them (e.g. memory metrics) may be -1.
+ *
+ *   record     := VERSION type field-mask field* process* END
+ *   type       := FULL | DELTA
+ *   process    := (ADDED | CHANGED) gupid field-mask field*
+ *               | REMOVED gupid
+ *   gupid      := length byte*
+ *
+ * In a full record, all processes are ADDED and all fields are present.
+ *
+ * Not thread-safe. The analytics collector thread owns it.
+ */
+class ProcessStateDeltaEncoder {
+public:
+	static const unsigned char VERSION = 1;
+	static const unsigned int FULL_RECORD_INTERVAL = 12;
+
+	enum RecordType {
+		FULL,
+		DELTA
+	};
+
+	enum Tag {
+		END,
+		ADDED,
+		CHANGED,
+		REMOVED
+	};
+
+private:
+	struct Entry {
+		GroupStateRecord state;
+		unsigned int recordsSinceFull;
+		unsigned long long cycle;
+	};
+
+	typedef map<string, Entry> EntryMap;
+	typedef map<StaticString, const ProcessStateRecord *> ProcessIndex;
+
+	EntryMap entries;
+	unsigned long long cycle;
+
+	static void appendVarint(string &output, boost::uint64_t value) {
+		while (value >= 0x80) {
+			output.append(1, (char) ((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		output.append(1, (char) value);
+	}
+
+	static void appendField(string &output, boost::int64_t value) {
+		appendVarint(output, ((boost::uint64_t) value << 1) ^ (boost::uint64_t) (value >> 63));
+	}
+
+	static void appendString(string &output, const string &value) {
+		appendVarint(output, value.size());
+		output.append(value);
+	}
+
+	static void appendFields(string &output, const boost::int64_t *fields,
+		const boost::int64_t *oldFields, unsigned int count)
+	{
+		boost::uint64_t mask = 0;
+		unsigned int i;
+
+		for (i = 0; i < count; i++) {
+			if (oldFields == NULL || fields[i] != oldFields[i]) {
+				mask |= (boost::uint64_t) 1 << i;
+			}
+		}
+		appendVarint(output, mask);
+		for (i = 0; i < count; i++) {
+			if (mask & ((boost::uint64_t) 1 << i)) {
+				appendField(output, fields[i]);
+			}
+		}
+	}
+
+	static bool fieldsEqual(const boost::int64_t *a, const boost::int64_t *b,
+		unsigned int count)
+	{
+		return memcmp(a, b, count * sizeof(boost::int64_t)) == 0;
+	}
+
+	static void encodeFull(const GroupStateRecord &state, string &output) {
+		vector<ProcessStateRecord>::const_iterator it;
+
+		output.append(1, (char) FULL);
+		appendFields(output, state.fields, NULL, GroupStateRecord::FIELD_COUNT);
+		for (it = state.processes.begin(); it != state.processes.end(); it++) {
+			output.append(1, (char) ADDED);
+			appendString(output, it->gupid);
+			appendFields(output, it->fields, NULL, ProcessStateRecord::FIELD_COUNT);
+		}
+	}
+
+	/** Returns whether anything changed. */
+	static bool encodeDelta(const GroupStateRecord &oldState, const GroupStateRecord &state,
+		string &output)
+	{
+		vector<ProcessStateRecord>::const_iterator it;
+		ProcessIndex oldProcesses;
+		ProcessIndex::iterator p_it;
+		bool changed = !fieldsEqual(state.fields, oldState.fields,
+			GroupStateRecord::FIELD_COUNT);
+
+		for (it = oldState.processes.begin(); it != oldState.processes.end(); it++) {
+			oldProcesses.insert(make_pair(StaticString(it->gupid), &(*it)));
+		}
+
+		output.append(1, (char) DELTA);
+		appendFields(output, state.fields, oldState.fields, GroupStateRecord::FIELD_COUNT);
+		for (it = state.processes.begin(); it != state.processes.end(); it++) {
+			p_it = oldProcesses.find(it->gupid);
+			if (p_it == oldProcesses.end()) {
+				output.append(1, (char) ADDED);
+				appendString(output, it->gupid);
+				appendFields(output, it->fields, NULL, ProcessStateRecord::FIELD_COUNT);
+				changed = true;
+			} else {
+				if (!fieldsEqual(it->fields, p_it->second->fields,
+					ProcessStateRecord::FIELD_COUNT))
+				{
+					output.append(1, (char) CHANGED);
+					appendString(output, it->gupid);
+					appendFields(output, it->fields, p_it->second->fields,
+						ProcessStateRecord::FIELD_COUNT);
+					changed = true;
+				}
+				oldProcesses.erase(p_it);
+			}
+		}
+		for (p_it = oldProcesses.begin(); p_it != oldProcesses.end(); p_it++) {
+			output.append(1, (char) REMOVED);
+			appendString(output, p_it->second->gupid);
+			changed = true;
+		}
+		return changed;
+	}
+
+public:
+	ProcessStateDeltaEncoder()
+		: cycle(0)
+		{ }
+
+	/**
+	 * Encodes the state of the given group into `output`, which is cleared
+	 * first. Returns false, and leaves `output` empty, if nothing changed
+	 * since the group's previous record: then there's nothing to send.
+	 */
+	bool encode(const string &groupName, const GroupStateRecord &state, string &output) {
+		EntryMap::iterator it = entries.find(groupName);
+		bool result = true;
+
+		output.clear();
+		output.append(1, (char) VERSION);
+		if (it == entries.end() || it->second.recordsSinceFull + 1 >= FULL_RECORD_INTERVAL) {
+			encodeFull(state, output);
+			if (it == entries.end()) {
+				it = entries.insert(make_pair(groupName, Entry())).first;
+			}
+			it->second.recordsSinceFull = 0;
+		} else if (encodeDelta(it->second.state, state, output)) {
+			it->second.recordsSinceFull++;
+		} else {
+			// Unchanged records still count, so that a full
+			// record goes out every FULL_RECORD_INTERVAL cycles.
+			it->second.recordsSinceFull++;
+			result = false;
+		}
+
+		if (result) {
+			output.append(1, (char) END);
+			it->second.state = state;
+		} else {
+			output.clear();
+		}
+		it->second.cycle = cycle;
+		return result;
+	}
+
+	/**
+	 * Marks the end of an analytics collection cycle. Forgets about the
+	 * groups that weren't encoded during the cycle, e.g. because they
+	 * were removed, so that they get a full record if they come back.
+	 */
+	void endCycle() {
+		EntryMap::iterator it = entries.begin();
+
+		while (it != entries.end()) {
+			if (it->second.cycle != cycle) {
+				entries.erase(it++);
+			} else {
+				it++;
+			}
+		}
+		cycle++;
+	}
+
+	unsigned int getGroupCount() const {
+		return entries.size();
+	}
+};
+
+
+/**
+ * Applies records produced by ProcessStateDeltaEncoder to a GroupStateRecord,
+ * for consumers of the records (and tests).
+ */
+class ProcessStateDeltaDecoder {
+private:
+	static bool readVarint(const char *&pos, const char *end, boost::uint64_t &value) {
+		unsigned int shift = 0;
+
+		value = 0;
+		while (pos < end && shift < 64) {
+			unsigned char byte = (unsigned char) *pos;
+			pos++;
+			value |= (boost::uint64_t) (byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+			shift += 7;
+		}
+		return false;
+	}
+
+	static bool readString(const char *&pos, const char *end, string &value) {
+		boost::uint64_t size;
+
+		if (!readVarint(pos, end, size) || size > (boost::uint64_t) (end - pos)) {
+			return false;
+		}
+		value.assign(pos, size);
+		pos += size;
+		return true;
+	}
+
+	static bool readFields(const char *&pos, const char *end, boost::int64_t *fields,
+		unsigned int count)
+	{
+		boost::uint64_t mask, value;
+
+		if (!readVarint(pos, end, mask)) {
+			return false;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			if (mask & ((boost::uint64_t) 1 << i)) {
+				if (!readVarint(pos, end, value)) {
+					return false;
+				}
+				fields[i] = (boost::int64_t) (value >> 1) ^ -(boost::int64_t) (value & 1);
+			}
+		}
+		return true;
+	}
+
+	static ProcessStateRecord *findProcess(GroupStateRecord &state, const string &gupid) {
+		vector<ProcessStateRecord>::iterator it;
+		for (it = state.processes.begin(); it != state.processes.end(); it++) {
+			if (it->gupid == gupid) {
+				return &(*it);
+			}
+		}
+		return NULL;
+	}
+
+public:
+	/**
+	 * Applies the given record to `state`. A delta record must be applied to
+	 * the state that the previous record of the same group produced.
+	 * Returns false if the record is malformed, in which case `state`
+	 * is undefined until the next full record.
+	 */
+	static bool apply(const StaticString &data, GroupStateRecord &state) {
+		const char *pos = data.data();
+		const char *end = data.data() + data.size();
+		string gupid;
+		ProcessStateRecord *process;
+
+		if (end - pos < 2 || (unsigned char) pos[0] != ProcessStateDeltaEncoder::VERSION) {
+			return false;
+		}
+		if (pos[1] == (char) ProcessStateDeltaEncoder::FULL) {
+			state = GroupStateRecord();
+		} else if (pos[1] != (char) ProcessStateDeltaEncoder::DELTA) {
+			return false;
+		}
+		pos += 2;
+
+		if (!readFields(pos, end, state.fields, GroupStateRecord::FIELD_COUNT)) {
+			return false;
+		}
+		while (pos < end) {
+			char tag = *pos;
+			pos++;
+			if (tag == (char) ProcessStateDeltaEncoder::END) {
+				return pos == end;
+			} else if (!readString(pos, end, gupid)) {
+				return false;
+			}
+
+			switch (tag) {
+			case ProcessStateDeltaEncoder::ADDED:
+				state.processes.push_back(ProcessStateRecord());
+				process = &state.processes.back();
+				process->gupid = gupid;
+				break;
+			case ProcessStateDeltaEncoder::CHANGED:
+				process = findProcess(state, gupid);
+				if (process == NULL) {
+					return false;
+				}
+				break;
+			case ProcessStateDeltaEncoder::REMOVED:
+				process = findProcess(state, gupid);
+				if (process == NULL) {
+					return false;
+				}
+				state.processes.erase(state.processes.begin()
+					+ (process - &state.processes[0]));
+				continue;
+			default:
+				return false;
+			}
+
+			if (!readFields(pos, end, process->fields, ProcessStateRecord::FIELD_COUNT)) {
+				return false;
+			}
+		}
+		return false;
+	}
+};
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_PROCESS_STATE_DELTA_H_ */
@@ -28,11 +28,11 @@
 
 #include <sys/types.h>
 #include <boost/atomic.hpp>
+#include <boost/container/vector.hpp>
 #include <oxt/macros.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 #include <Utils/ScopeGuard.h>
-#include <Utils/Lock.h>
 #include <Core/ApplicationPool/Context.h>
 #include <Core/ApplicationPool/BasicProcessInfo.h>
 #include <Core/ApplicationPool/BasicGroupInfo.h>
@@ -87,6 +87,8 @@ private:
 	Connection connection;
 	mutable boost::atomic<int> refcount;
 	bool closed;
+	/** Whether closeInBatch() was called, but the batch hasn't been processed yet. */
+	bool closeQueued;
 
 	void deinitiate(bool success, bool wantKeepAlive) {
 		connection.fail = !success;
@@ -110,13 +112,15 @@ private:
 
 	void destroySelf() const {
 		this->~Session();
-		LockGuard l(context->getMmSyncher());
 		context->getSessionObjectPool().free(const_cast<Session *>(this));
 	}
 
 public:
 	Callback onInitiateFailure;
 	Callback onClose;
+	/** The time, in microseconds, at which Process::newSession() opened
+	 * this session. 0 if unknown. */
+	unsigned long long startTime;
 
 	Session(Context *_context, const BasicProcessInfo *_processInfo, Socket *_socket)
 		: context(_context),
@@ -124,8 +128,10 @@ public:
 		  socket(_socket),
 		  refcount(1),
 		  closed(false),
+		  closeQueued(false),
 		  onInitiateFailure(NULL),
-		  onClose(NULL)
+		  onClose(NULL),
+		  startTime(0)
 		{ }
 
 	~Session() {
@@ -180,11 +186,15 @@ public:
 		return getSocket()->protocol;
 	}
 
+	virtual bool acceptsRequestBodyFd() const {
+		return getSocket()->acceptsRequestBodyFd;
+	}
+
 
 	virtual void initiate(bool blocking = true) {
 		assert(!closed);
 		ScopeGuard g(boost::bind(&Session::callOnInitiateFailure, this));
-		Connection connection = socket->checkoutConnection();
+		Connection connection = socket->checkoutConnection(blocking, true);
 		connection.fail = true;
 		if (connection.blocking && !blocking) {
 			FdGuard g2(connection.fd, NULL, 0);
@@ -205,6 +215,11 @@ public:
 		return connection.fd;
 	}
 
+	virtual ShmRingSlot *shmRingSlot() const {
+		assert(!closed);
+		return connection.shmRingSlot;
+	}
+
 	/**
 	 * This Session object becomes fully unsable after closing.
 	 */
@@ -212,6 +227,10 @@ public:
 		if (OXT_LIKELY(initiated())) {
 			deinitiate(success, wantKeepAlive);
 		}
+		if (OXT_UNLIKELY(closeQueued)) {
+			// The batch still needs processInfo and socket.
+			return;
+		}
 		if (OXT_LIKELY(!closed)) {
 			callOnClose();
 		}
@@ -219,8 +238,23 @@ public:
 		socket = NULL;
 	}
 
+	virtual void closeInBatch(bool success, bool wantKeepAlive, SessionCloseBatch &batch);
+
+	/**
+	 * Called by `Pool::closeSessions()` after it has processed a session that
+	 * was queued by `closeInBatch()`. The pool has then already done the work
+	 * that `onClose` would otherwise do.
+	 */
+	void finishBatchedClose() {
+		assert(closeQueued);
+		closeQueued = false;
+		closed = true;
+		processInfo = NULL;
+		socket = NULL;
+	}
+
 	virtual bool isClosed() const {
-		return closed;
+		return closed || closeQueued;
 	}
 
 	virtual void requestOOBW();
@@ -239,6 +273,39 @@ public:
 };
 
 
+/**
+ * Sessions that have been closed with `Session::closeInBatch()`, but whose
+ * pool bookkeeping hasn't been done yet. Pass it to `Pool::closeSessions()`
+ * to do that for all of them with a single pool lock acquisition. The
+ * batch holds a reference to each session, so the Processes that they
+ * belong to stay around until then.
+ *
+ * Not thread-safe; each thread should have its own batch.
+ */
+class SessionCloseBatch {
+public:
+	boost::container::vector<SessionPtr> sessions;
+
+	bool empty() const {
+		return sessions.empty();
+	}
+};
+
+
+inline void
+Session::closeInBatch(bool success, bool wantKeepAlive, SessionCloseBatch &batch) {
+	if (OXT_LIKELY(initiated())) {
+		deinitiate(success, wantKeepAlive);
+	}
+	if (OXT_LIKELY(!closed && !closeQueued && onClose != NULL)) {
+		closeQueued = true;
+		batch.sessions.push_back(SessionPtr(this));
+	} else {
+		close(success, wantKeepAlive);
+	}
+}
+
+
 } // namespace ApplicationPool2
 } // namespace Passenger
 
@@ -31,13 +31,20 @@
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
 #include <climits>
 #include <cassert>
+#include <cerrno>
 #include <SmallVector.h>
 #include <Logging.h>
 #include <StaticString.h>
 #include <MemoryKit/palloc.h>
 #include <Utils/IOUtils.h>
+#include <Utils/ScopeGuard.h>
+#include <Utils/ShmRing.h>
+#include <Utils/SystemTime.h>
 #include <Core/ApplicationPool/Common.h>
 
 namespace Passenger {
@@ -49,15 +56,21 @@ using namespace boost;
 
 struct Connection {
 	int fd;
+	/** The slot through which the data goes, if any. See ShmRingFile. */
+	ShmRingSlot *shmRingSlot;
 	bool wantKeepAlive: 1;
 	bool fail: 1;
 	bool blocking: 1;
+	/** When this connection was last checked into the connection pool. */
+	unsigned long long lastCheckinTime;
 
 	Connection()
 		: fd(-1),
+		  shmRingSlot(NULL),
 		  wantKeepAlive(false),
 		  fail(false),
-		  blocking(true)
+		  blocking(true),
+		  lastCheckinTime(0)
 		{ }
 
 	void close() {
@@ -68,6 +81,16 @@ struct Connection {
 			safelyClose(fd2);
 			P_LOG_FILE_DESCRIPTOR_CLOSE(fd2);
 		}
+		if (shmRingSlot != NULL) {
+			if (OXT_UNLIKELY(shmRingSlot->outgoing.isCorrupted()
+				|| shmRingSlot->incoming.isCorrupted()))
+			{
+				P_WARN("An application process corrupted a shared memory ring. "
+					"Its sessions go over its sockets from now on");
+			}
+			shmRingSlot->checkin();
+			shmRingSlot = NULL;
+		}
 	}
 };
 
@@ -80,22 +103,134 @@ private:
 	boost::mutex connectionPoolLock;
 	vector<Connection> idleConnections;
 
+	/**
+	 * The maximum number of idle connections to keep around. Sockets with
+	 * unlimited concurrency (concurrency == 0, e.g. Node.js apps) handle many
+	 * requests at once over separate keep-alive connections, so we keep a
+	 * bounded number of those around instead of reconnecting for every request.
+	 */
 	OXT_FORCE_INLINE
 	int connectionPoolLimit() const {
-		return concurrency;
+		if (concurrency == 0) {
+			return 64;
+		} else {
+			return concurrency;
+		}
 	}
 
-	Connection connect() const {
+	/** Idle connections older than this (in microseconds) are not reused. */
+	OXT_FORCE_INLINE
+	unsigned long long connectionPoolIdleTimeout() const {
+		return 30 * 1000000ull;
+	}
+
+	Connection connect(bool blocking, bool wantShmRing) const {
 		Connection connection;
 		P_TRACE(3, "Connecting to " << address);
-		connection.fd = connectToServer(address, __FILE__, __LINE__);
+		if (blocking) {
+			connection.fd = connectToServer(address, __FILE__, __LINE__);
+			connection.blocking = true;
+		} else {
+			connection.fd = connectNonBlocking();
+			connection.blocking = false;
+		}
 		connection.fail = true;
 		connection.wantKeepAlive = false;
-		connection.blocking = true;
 		P_LOG_FILE_DESCRIPTOR_PURPOSE(connection.fd, "App " << pid << " connection");
+		if (shmRingFile != NULL) {
+			try {
+				sendShmRingSlot(connection, wantShmRing);
+			} catch (...) {
+				connection.close();
+				throw;
+			}
+		}
 		return connection;
 	}
 
+	/**
+	 * Tells the app which ring slot a new connection uses, if any. See
+	 * ShmRingFile. The data goes over the connection itself if the caller
+	 * doesn't want a ring, or if all slots are in use.
+	 */
+	void sendShmRingSlot(Connection &connection, bool wantShmRing) const {
+		boost::uint32_t index = 0xFFFFFFFF;
+		ssize_t ret;
+
+		if (wantShmRing) {
+			connection.shmRingSlot = shmRingFile->checkoutSlot();
+		}
+		if (connection.shmRingSlot != NULL) {
+			index = connection.shmRingSlot->index;
+		} else if (wantShmRing && shmRingFile->isDisabled()) {
+			P_TRACE(3, "Socket " << address << ": shared memory rings are disabled; "
+				"sending data over the socket");
+		} else if (wantShmRing) {
+			P_TRACE(3, "Socket " << address << ": all shared memory ring slots "
+				"are in use; sending data over the socket");
+		}
+		index = htonl(index);
+		// A new Unix domain socket connection always has room for this.
+		do {
+			ret = ::send(connection.fd, &index, sizeof(index), MSG_NOSIGNAL);
+		} while (ret == -1 && errno == EINTR);
+		if (ret != (ssize_t) sizeof(index)) {
+			int e = (ret == -1) ? errno : EAGAIN;
+			throw SystemException("Cannot send the shared memory ring slot to "
+				+ address, e);
+		}
+		if (connection.shmRingSlot != NULL && connection.blocking) {
+			// The ring's doorbells are read without blocking.
+			setNonBlocking(connection.fd);
+			connection.blocking = false;
+		}
+	}
+
+	/**
+	 * Connects without blocking the calling (event loop) thread. A TCP
+	 * connection that is still in progress is returned as-is: writes fail
+	 * with EAGAIN until the connection is established, so the caller's
+	 * writability watcher completes the connect for us. Unix domain sockets
+	 * fail with EAGAIN instead when the app's backlog is full; in that case
+	 * there is nothing to wait for, so we fall back to a blocking connect.
+	 */
+	int connectNonBlocking() const {
+		NConnect_State state;
+
+		setupNonBlockingSocket(state, address, __FILE__, __LINE__);
+		if (state.type == SAT_UNIX) {
+			if (connectToServer(state)) {
+				return state.s_unix.fd.detach();
+			} else {
+				P_TRACE(3, "Socket " << address << ": backlog full, falling back "
+					"to a blocking connect");
+				int fd = connectToServer(address, __FILE__, __LINE__);
+				FdGuard guard(fd, NULL, 0);
+				setNonBlocking(fd);
+				guard.clear();
+				return fd;
+			}
+		} else {
+			connectToServer(state);
+			return state.s_tcp.fd.detach();
+		}
+	}
+
+	/**
+	 * Checks whether an idle connection can still be used. The app is not
+	 * supposed to send anything on an idle connection, so reading EOF or data
+	 * means that the app closed it or that it's in a bad state.
+	 */
+	static bool idleConnectionIsHealthy(const Connection &connection) {
+		char buf;
+		ssize_t ret;
+
+		do {
+			ret = ::recv(connection.fd, &buf, 1, MSG_PEEK | MSG_DONTWAIT);
+		} while (ret == -1 && errno == EINTR);
+		return ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+
 public:
 	// Socket properties. Read-only.
 	StaticString name;
@@ -103,6 +238,22 @@ public:
 	StaticString protocol;
 	pid_t pid;
 	int concurrency;
+	/**
+	 * Whether the app accepts the request body as a file descriptor that
+	 * is passed after the session protocol header, instead of over the
+	 * connection. Only applicable to Unix domain sockets.
+	 */
+	bool acceptsRequestBodyFd;
+	/**
+	 * Whether the app can exchange session data through shared memory
+	 * rings. Only applicable to Unix domain sockets.
+	 */
+	bool acceptsShmRing;
+	/**
+	 * The rings to use for connections, if the app accepts them. Owned by
+	 * the Process.
+	 */
+	ShmRingFile *shmRingFile;
 
 	// Private. In public section as alignment optimization.
 	int totalConnections;
@@ -113,16 +264,23 @@ public:
 
 	Socket()
 		: pid(-1),
-		  concurrency(0)
+		  concurrency(0),
+		  acceptsRequestBodyFd(false),
+		  acceptsShmRing(false),
+		  shmRingFile(NULL)
 		{ }
 
 	Socket(pid_t _pid, const StaticString &_name, const StaticString &_address,
-		const StaticString &_protocol, int _concurrency)
+		const StaticString &_protocol, int _concurrency,
+		bool _acceptsRequestBodyFd = false, bool _acceptsShmRing = false)
 		: name(_name),
 		  address(_address),
 		  protocol(_protocol),
 		  pid(_pid),
 		  concurrency(_concurrency),
+		  acceptsRequestBodyFd(_acceptsRequestBodyFd),
+		  acceptsShmRing(_acceptsShmRing),
+		  shmRingFile(NULL),
 		  totalConnections(0),
 		  totalIdleConnections(0),
 		  sessions(0)
@@ -135,6 +293,9 @@ public:
 		  protocol(other.protocol),
 		  pid(other.pid),
 		  concurrency(other.concurrency),
+		  acceptsRequestBodyFd(other.acceptsRequestBodyFd),
+		  acceptsShmRing(other.acceptsShmRing),
+		  shmRingFile(other.shmRingFile),
 		  totalConnections(other.totalConnections),
 		  totalIdleConnections(other.totalIdleConnections),
 		  sessions(other.sessions)
@@ -149,6 +310,9 @@ public:
 		protocol = other.protocol;
 		pid = other.pid;
 		concurrency = other.concurrency;
+		acceptsRequestBodyFd = other.acceptsRequestBodyFd;
+		acceptsShmRing = other.acceptsShmRing;
+		shmRingFile = other.shmRingFile;
 		sessions = other.sessions;
 		return *this;
 	}
@@ -156,34 +320,66 @@ public:
 	/**
 	 * Connect to this socket or reuse an existing connection.
 	 *
+	 * Idle connections are reused most-recently-used first. Connections that
+	 * have been idle for longer than connectionPoolIdleTimeout(), or that the
+	 * app has closed in the meantime, are discarded. New connections are
+	 * established outside the connection pool lock. If `blocking` is false,
+	 * then the connect is non-blocking where the socket type allows it (see
+	 * connectNonBlocking()). If `wantShmRing` is true, then a new connection
+	 * may come with a ring slot, through which the data must go instead.
+	 * Pooled connections never have one.
+	 *
 	 * One MUST call checkinConnection() when one's done using the Connection.
 	 * Failure to do so will result in a resource leak.
 	 */
-	Connection checkoutConnection() {
+	Connection checkoutConnection(bool blocking = true, bool wantShmRing = false) {
 		boost::unique_lock<boost::mutex> l(connectionPoolLock);
+		unsigned long long now = 0;
 
-		if (!idleConnections.empty()) {
-			P_TRACE(3, "Socket " << address << ": checking out connection from connection pool (" <<
-				idleConnections.size() << " -> " << (idleConnections.size() - 1) <<
-				" items). Current total number of connections: " << totalConnections);
+		while (!idleConnections.empty()) {
 			Connection connection = idleConnections.back();
 			idleConnections.pop_back();
 			totalIdleConnections--;
-			return connection;
-		} else {
-			Connection connection = connect();
-			totalConnections++;
-			P_TRACE(3, "Socket " << address << ": there are now " <<
-				totalConnections << " total connections");
-			l.unlock();
-			return connection;
+
+			if (now == 0) {
+				now = SystemTime::getUsec();
+			}
+			if (now - connection.lastCheckinTime <= connectionPoolIdleTimeout()
+			 && idleConnectionIsHealthy(connection))
+			{
+				P_TRACE(3, "Socket " << address << ": checking out connection from connection pool (" <<
+					(idleConnections.size() + 1) << " -> " << idleConnections.size() <<
+					" items). Current total number of connections: " << totalConnections);
+				return connection;
+			}
+
+			totalConnections--;
+			assert(totalConnections >= 0);
+			P_TRACE(3, "Socket " << address << ": discarding stale pooled connection. "
+				"There are now " << totalConnections << " connections in total");
+			connection.close();
+		}
+
+		totalConnections++;
+		P_TRACE(3, "Socket " << address << ": there are now " <<
+			totalConnections << " total connections");
+		l.unlock();
+		try {
+			return connect(blocking, wantShmRing);
+		} catch (...) {
+			l.lock();
+			totalConnections--;
+			throw;
 		}
 	}
 
 	void checkinConnection(Connection &connection) {
 		boost::unique_lock<boost::mutex> l(connectionPoolLock);
 
-		if (connection.fail || !connection.wantKeepAlive || totalIdleConnections >= connectionPoolLimit()) {
+		// Apps close ring connections after every session.
+		if (connection.fail || !connection.wantKeepAlive || connection.shmRingSlot != NULL
+		 || totalIdleConnections >= connectionPoolLimit())
+		{
 			totalConnections--;
 			assert(totalConnections >= 0);
 			P_TRACE(3, "Socket " << address << ": connection not checked back into "
@@ -196,6 +392,7 @@ public:
 				totalIdleConnections << " -> " << (totalIdleConnections + 1) <<
 				" items). Current total number of connections: " << totalConnections);
 			totalIdleConnections++;
+			connection.lastCheckinTime = SystemTime::getUsec();
 			idleConnections.push_back(connection);
 		}
 	}
@@ -256,9 +453,11 @@ public:
 class SocketList: public SmallVector<Socket, 1> {
 public:
 	void add(pid_t pid, const StaticString &name, const StaticString &address,
-		const StaticString &protocol, int concurrency)
+		const StaticString &protocol, int concurrency,
+		bool acceptsRequestBodyFd = false, bool acceptsShmRing = false)
 	{
-		push_back(Socket(pid, name, address, protocol, concurrency));
+		push_back(Socket(pid, name, address, protocol, concurrency,
+			acceptsRequestBodyFd, acceptsShmRing));
 	}
 
 	const Socket *findSocketWithName(const StaticString &name) const {
@@ -50,6 +50,7 @@ private:
 	pid_t pid;
 	string gupid;
 	string protocol;
+	bool bodyFdAccepted;
 	ApiKey apiKey;
 	SocketPair connection;
 	BufferedIO peerBufferedIO;
@@ -64,6 +65,7 @@ public:
 		  pid(123),
 		  gupid("gupid-123"),
 		  protocol("session"),
+		  bodyFdAccepted(false),
 		  stickySessionId(0),
 		  closed(false),
 		  success(false),
@@ -119,6 +121,16 @@ public:
 		protocol = v;
 	}
 
+	virtual bool acceptsRequestBodyFd() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return bodyFdAccepted;
+	}
+
+	void setAcceptsRequestBodyFd(bool v) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		bodyFdAccepted = v;
+	}
+
 	virtual unsigned int getStickySessionId() const {
 		boost::lock_guard<boost::mutex> l(syncher);
 		return stickySessionId;
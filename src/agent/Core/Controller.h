@@ -53,6 +53,10 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <utility>
 #include <typeinfo>
 #include <cstdio>
@@ -62,11 +66,13 @@
 #include <cctype>
 
 #include <Logging.h>
+#include <Probes.h>
 #include <MessageReadersWriters.h>
 #include <Constants.h>
 #include <ServerKit/Errors.h>
 #include <ServerKit/HttpServer.h>
 #include <ServerKit/HttpHeaderParser.h>
+#include <ServerKit/CookieUtils.h>
 #include <MemoryKit/palloc.h>
 #include <DataStructures/LString.h>
 #include <DataStructures/StringKeyTable.h>
@@ -78,10 +84,17 @@
 #include <Utils/HttpConstants.h>
 #include <Utils/VariantMap.h>
 #include <Utils/Timer.h>
+#include <Utils/CachedFileStat.hpp>
+#include <Algorithms/LatencyHistogram.h>
 #include <Core/ApplicationPool/ErrorRenderer.h>
 #include <Core/Controller/Client.h>
 #include <Core/Controller/AppResponse.h>
 #include <Core/Controller/TurboCaching.h>
+#include <Core/ControllerOptions.h>
+#include <Core/Metrics.h>
+#include <Core/RateLimiter.h>
+#include <Core/RequestTraceRecorder.h>
+#include <Core/SharedResponseCache.h>
 #include <Core/UnionStation/Context.h>
 
 namespace Passenger {
@@ -111,6 +124,43 @@ public:
 		BM_UNKNOWN
 	};
 
+	enum RoutingKeySource {
+		RKS_NONE,
+		RKS_HEADER,
+		RKS_COOKIE,
+		RKS_PATH_PREFIX
+	};
+
+	enum RateLimitKeySource {
+		RLKS_APP_GROUP,
+		RLKS_HEADER,
+		RLKS_REMOTE_ADDR,
+		RLKS_PATH_PREFIX
+	};
+
+	/**
+	 * The request processing stages whose durations are recorded in
+	 * per-application group latency histograms.
+	 */
+	enum RequestStage {
+		// From the first request header byte until the header is parsed.
+		RS_HEADER_PARSE,
+		// Waiting for the pool to check out a session, including any spawning.
+		RS_SESSION_CHECKOUT,
+		// Connecting to the application process.
+		RS_APP_CONNECT,
+		// From connecting until the application sends its first response byte.
+		RS_APP_FIRST_BYTE,
+		// From the first application response byte until the request ends.
+		RS_RESPONSE_TRANSFER,
+
+		REQUEST_STAGE_COUNT
+	};
+
+	struct RequestStageHistograms {
+		LatencyHistogram stages[REQUEST_STAGE_COUNT];
+	};
+
 private:
 	typedef ServerKit::HttpServer<Controller, Client> ParentClass;
 	typedef ServerKit::Channel Channel;
@@ -122,18 +172,165 @@ private:
 	// If you change this value, make sure that Request::sessionCheckoutTry
 	// has enough bits.
 	static const unsigned int MAX_SESSION_CHECKOUT_TRY = 10;
+	// App response bodies larger than this are read in bursts of
+	// LARGE_RESPONSE_BODY_BURST_READ_COUNT mbufs per readability event.
+	static const unsigned int LARGE_RESPONSE_BODY_SIZE = 1024 * 1024;
+	static const unsigned int LARGE_RESPONSE_BODY_BURST_READ_COUNT = 8;
+	// Response compression settings. Responses with a Content-Length
+	// smaller than MIN_COMPRESSED_RESPONSE_BODY_SIZE are not worth compressing.
+	// The deflate state takes about 256 KB per compressed response with the
+	// default window size and memory level.
+	static const unsigned int MIN_COMPRESSED_RESPONSE_BODY_SIZE = 256;
+	static const int RESPONSE_COMPRESSION_LEVEL = 5;
+	static const unsigned int RESPONSE_BUFFER_DRAIN_TIME = 5;
+	// When at most this many bytes of an app response body remain, they are
+	// read even while the client output is throttled, so that the session
+	// can be released without waiting for the client.
+	static const unsigned int APP_RESPONSE_REMAINDER_BUFFER_SIZE = 256 * 1024;
+	// On Linux, once this many bytes of a Content-Length request body remain,
+	// the rest is spliced from the client socket to the application socket
+	// through a pipe, in chunks of at most the default pipe capacity.
+	static const unsigned int REQUEST_BODY_SPLICE_THRESHOLD = 128 * 1024;
+	static const unsigned int REQUEST_BODY_SPLICE_CHUNK_SIZE = 64 * 1024;
+	static const unsigned int REQUEST_BODY_SPLICE_BURST_COUNT = 4;
+	// How long probe requests may be answered from a cached check of
+	// whether the app group has an enabled process, in seconds.
+	static const unsigned int PROBE_STATUS_CACHE_TIME = 1;
+	// Maximum number of static file descriptors that are kept open.
+	static const unsigned int STATIC_FILE_CACHE_SIZE = 256;
+	// How often unused rate limiter leases are returned, in seconds.
+	static const unsigned int RATE_LIMIT_RECONCILE_INTERVAL = 1;
+
+	struct DocumentRootSymlink {
+		string path;
+		string target;
+		ev_tstamp lastCheckTime;
+	};
+
+	/**
+	 * A listen address that was configured with --tenant. Clients that
+	 * connect to it are served as that tenant. `path` is set for Unix
+	 * domain sockets, `host` and `port` for TCP sockets.
+	 */
+	struct Tenant {
+		StaticString name;
+		string path;
+		string host;
+		unsigned short port;
+	};
+
+	struct ProbeStatus {
+		bool hasEnabledProcess;
+		ev_tstamp lastCheckTime;
+	};
+
+	struct OpenStaticFile {
+		int fd;
+		dev_t dev;
+		ino_t ino;
+		time_t mtime;
+		off_t size;
+	};
+
+	/**
+	 * The tokens and in-flight slots that this Controller leased from
+	 * rateLimiter for one key, and how many of those slots are taken by
+	 * requests.
+	 */
+	struct RateLimitBucket {
+		unsigned int tokens;
+		unsigned int slots;
+		unsigned int inFlight;
+
+		RateLimitBucket()
+			: tokens(0),
+			  slots(0),
+			  inFlight(0)
+			{ }
+	};
 
 	unsigned int statThrottleRate;
 	unsigned int responseBufferHighWatermark;
+	// Responses up to this size are buffered completely. Beyond it, the
+	// high watermark follows the client's drain rate, so that at most
+	// RESPONSE_BUFFER_DRAIN_TIME seconds worth of data is buffered, but
+	// never less than this size. 0 always uses responseBufferHighWatermark.
+	unsigned int responseBufferFullBufferingSize;
+	// When buffering a request body, a session is checked out once this
+	// many bytes have been buffered, and the rest of the body is streamed
+	// through the body buffer, unless the client sent those bytes slower
+	// than requestBodySlowRate bytes per second. 0 buffers whole bodies.
+	unsigned int requestBodyPrebufferSize;
+	unsigned int requestBodySlowRate;
 	BenchmarkMode benchmarkMode: 3;
 	bool singleAppMode: 1;
 	bool showVersionInHeader: 1;
 	bool stickySessions: 1;
 	bool gracefulExit: 1;
+	bool serveXSendfile: 1;
+	bool serveStaticFiles: 1;
+	bool responseCompression: 1;
+	// Cleared when the kernel turns out not to support splicing
+	// from client sockets.
+	bool spliceRequestBodies: 1;
+	bool probeRequiresProcess: 1;
+	// Whether the web server in front may hand off client connections to
+	// us. See takeOverHandedOffClient().
+	bool acceptClientHandoff: 1;
 
 	const VariantMap *agentsOptions;
+	/** agentsOptions, parsed into typed fields for use after startup. */
+	ControllerOptions controllerOptions;
 	psg_pool_t *stringPool;
+	/** Keyed by group key; see Options::getGroupKey(). */
 	StringKeyTable< boost::shared_ptr<Options> > poolOptionsCache;
+	/**
+	 * For app groups whose cached pool options were derived from a
+	 * symlinked document root: the symlink, the path that it referred to
+	 * at the time, and when that was last checked. Keyed by group key, like
+	 * poolOptionsCache. Allows initializePoolOptions() to notice deploys
+	 * that switch the symlink without calling readlink() on every request.
+	 */
+	StringKeyTable<DocumentRootSymlink> documentRootSymlinks;
+	/**
+	 * Empty unless the Core serves multiple tenants. Their app groups
+	 * share the application pool, but a request is only routed to an app
+	 * group of its own tenant, because app groups are keyed by tenant and
+	 * app group name; see Options::getGroupKey().
+	 */
+	vector<Tenant> tenants;
+	/**
+	 * Paths of load balancer health checks and similar probes, which the
+	 * Controller answers itself instead of forwarding them to the app.
+	 * If probeRequiresProcess is set, the answer depends on whether the
+	 * app group has an enabled process, which is cached per app group in
+	 * probeStatuses so that probes don't take the pool lock every time.
+	 */
+	vector<string> probePaths;
+	StringKeyTable<ProbeStatus> probeStatuses;
+	/**
+	 * If serveStaticFiles is set, files in the app's public directory are
+	 * served by the Controller. Their stat() results are throttled by
+	 * statThrottleRate, and their file descriptors are kept open for as
+	 * long as the file doesn't change. See serveStaticFile().
+	 */
+	CachedFileStat staticFileStat;
+	StringKeyTable<OpenStaticFile> openStaticFiles;
+	/**
+	 * If rateLimiter is set, requests are limited per key, as configured
+	 * with --rate-limit-key, to the limits of their app group (see
+	 * Options::rateLimit). The leases that this Controller holds are kept
+	 * in rateLimitBuckets, which is only touched from this Controller's
+	 * event loop. See enforceRateLimit().
+	 */
+	RateLimitKeySource rateLimitKeySource;
+	// The header name (in lowercase) for RLKS_HEADER, and the number of
+	// path segments for RLKS_PATH_PREFIX.
+	HashedStaticString rateLimitKeyName;
+	unsigned int rateLimitKeyPathSegments;
+	StringKeyTable<RateLimitBucket> rateLimitBuckets;
+	struct ev_timer rateLimitReconcileTimer;
+	unsigned int rateLimitedRequestCount;
 
 	StaticString defaultRuby;
 	StaticString ustRouterAddress;
@@ -154,12 +351,15 @@ private:
 	HashedStaticString PASSENGER_STICKY_SESSIONS_COOKIE_NAME;
 	HashedStaticString PASSENGER_REQUEST_OOB_WORK;
 	HashedStaticString UNION_STATION_SUPPORT;
+	HashedStaticString UNION_STATION_SAMPLE_RATE;
 	HashedStaticString REMOTE_ADDR;
 	HashedStaticString REMOTE_PORT;
 	HashedStaticString REMOTE_USER;
 	HashedStaticString FLAGS;
 	HashedStaticString HTTP_COOKIE;
 	HashedStaticString HTTP_DATE;
+	HashedStaticString HTTP_ACCEPT_ENCODING;
+	HashedStaticString HTTP_CONTENT_ENCODING;
 	HashedStaticString HTTP_HOST;
 	HashedStaticString HTTP_CONTENT_LENGTH;
 	HashedStaticString HTTP_CONTENT_TYPE;
@@ -167,28 +367,124 @@ private:
 	HashedStaticString HTTP_CONNECTION;
 	HashedStaticString HTTP_STATUS;
 	HashedStaticString HTTP_TRANSFER_ENCODING;
+	HashedStaticString HTTP_RANGE;
+	HashedStaticString HTTP_X_PASSENGER_PURGE;
+	HashedStaticString HTTP_X_PASSENGER_FILE;
+	// Name of the request header that sets Options::priority, in
+	// lowercase. Empty if request priorities are disabled.
+	HashedStaticString requestPriorityHeader;
+	// What Options::routingHash is computed from, for the "consistent-hash"
+	// routing policy. Configured with --routing-key.
+	RoutingKeySource routingKeySource;
+	// The header name (in lowercase) or cookie name for RKS_HEADER and
+	// RKS_COOKIE, and the number of path segments for RKS_PATH_PREFIX.
+	HashedStaticString routingKeyName;
+	unsigned int routingKeyPathSegments;
 
 	unsigned int threadNumber;
 	StaticString serverLogName;
+	// The Date header only changes once per second, so we cache it,
+	// including its trailing CRLF.
+	time_t dateHeaderTime;
+	unsigned int dateHeaderSize;
+	char dateHeader[60];
+	// See getPrecompiledStatusLine(). Indexed by HTTP minor version
+	// and by status code minus 100.
+	static const unsigned int STATUS_LINE_CACHE_SIZE = 500;
+	StaticString statusLineCache[2][STATUS_LINE_CACHE_SIZE];
 
 	friend class TurboCaching<Request>;
 	friend class ResponseCache<Request>;
 	struct ev_check checkWatcher;
 	TurboCaching<Request> turboCaching;
 
+	LIST_HEAD(CoalescingRequestList, Request);
+	// Turbocacheable requests that are fetching a response from the
+	// application, and for which identical requests may wait.
+	CoalescingRequestList coalescingLeaders;
+	// Requests that are waiting for one of coalescingLeaders.
+	CoalescingRequestList coalescedRequests;
+	struct ev_timer coalescingTimer;
+	// In seconds. 0 if request coalescing is disabled.
+	ev_tstamp coalescingTimeout;
+	unsigned int coalescedRequestCount;
+	// Keyed by application group name. Only touched from this
+	// Controller's event loop, so per-thread by construction.
+	StringKeyTable<RequestStageHistograms> requestStageHistograms;
+	// Number of requests until the next one is recorded by
+	// requestTraceRecorder.
+	unsigned int requestTraceCountdown;
+	// Where the turbocache is saved on shutdown. Empty if it isn't.
+	string turboCacheSnapshotPath;
+	// Percentage (0-100) of requests that are logged to Union Station.
+	// Applications can override this with !~UNION_STATION_SAMPLE_RATE.
+	double unionStationSampleRate;
+	// In seconds. Requests that were not sampled are still logged to
+	// Union Station if they fail or take at least this long.
+	// 0 if only failed requests are logged.
+	ev_tstamp unionStationSlowRequestThreshold;
+
+	// Long-running connections of detached processes that are waiting to
+	// be disconnected, sorted so that the one that is due first is at the
+	// back. See disconnectLongRunningConnections().
+	struct DrainingConnection {
+		Client *client;
+		ProcessPtr process;
+		ev_tstamp disconnectAt;
+
+		bool operator<(const DrainingConnection &other) const {
+			return disconnectAt > other.disconnectAt;
+		}
+	};
+	vector<DrainingConnection> drainingConnections;
+	struct ev_timer drainTimer;
+	// In seconds. 0 if long-running connections are disconnected right away.
+	ev_tstamp websocketDrainTime;
+
+	// Sessions of finished requests, whose pool bookkeeping is done in
+	// one go right before the event loop blocks.
+	SessionCloseBatch sessionCloseBatch;
+	struct ev_prepare prepareWatcher;
+
+	// Event loop utilization, measured by the prepare and check watchers.
+	// An iteration is busy from the moment the loop wakes up (check) until
+	// it is about to block again (prepare). Times are in microseconds.
+	MonotonicTimeUsec loopWakeupTime;
+	MonotonicTimeUsec loopBlockTime;
+	boost::uint64_t loopIterations;
+	boost::uint64_t loopBusyTime;
+	boost::uint64_t loopBlockedTime;
+	boost::uint64_t loopCallbacks;
+	// The longest iteration in the current and in the previous
+	// statistics interval.
+	unsigned int loopMaxIterationTime;
+	unsigned int lastLoopMaxIterationTime;
+	LatencyHistogram loopIterationTimes;
+
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
-		struct ev_prepare prepareWatcher;
 		ev_tstamp timeBeforeBlocking;
 	#endif
 
 
+	/****** Initialization and shutdown ******/
+
+	void loadTurboCacheSnapshot();
+	void parseTenants();
+	void saveTurboCacheSnapshot();
+
+
 	/****** Stage: initialize request ******/
 
 	struct RequestAnalysis;
 
 	void initializeFlags(Client *client, Request *req, RequestAnalysis &analysis);
-	bool respondFromTurboCache(Client *client, Request *req);
+	void takeOverHandedOffClient(Client *client, Request *req);
+	bool respondFromTurboCache(Client *client, Request *req, RequestAnalysis &analysis);
+	StaticString getAppGroupNameForTurboCaching(Request *req, RequestAnalysis &analysis);
+	bool writeTurboCachedResponse(Client *client, Request *req,
+		const StaticString &appGroupName);
 	void initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis);
+	void updatePoolOptionsFromRequest(Request *req, boost::shared_ptr<Options> &options);
 	void fillPoolOptionsFromAgentsOptions(Options &options);
 	static void fillPoolOption(Request *req, StaticString &field,
 		const HashedStaticString &name);
@@ -205,25 +501,50 @@ private:
 	static void fillPoolOptionSecToMsec(Request *req, unsigned int &field,
 		const HashedStaticString &name);
 	void createNewPoolOptions(Client *client, Request *req,
-		const HashedStaticString &appGroupName);
+		const HashedStaticString &appGroupName, const HashedStaticString &groupKey);
+	bool documentRootSymlinkChanged(Client *client, Request *req,
+		const HashedStaticString &groupKey);
 	void initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis);
+	bool shouldSampleUnionStationRequest(Request *req);
+	void logUnsampledRequestToUnionStation(Client *client, Request *req);
 	void setStickySessionId(Client *client, Request *req);
 	const LString *getStickySessionCookieName(Request *req);
+	void setRequestPriority(Client *client, Request *req);
+	void setRoutingHash(Client *client, Request *req);
+	StaticString getRoutingKey(Request *req);
+	static StaticString getPathPrefix(Request *req, unsigned int segments);
+	bool isProbeRequest(Request *req) const;
+	bool appGroupHasEnabledProcess(Client *client, Request *req);
+	bool enforceRateLimit(Client *client, Request *req);
+	StaticString getRateLimitKey(Client *client, Request *req);
+	void releaseRateLimitSlot(Request *req);
+	static void onRateLimitReconcileTimeout(EV_P_ struct ev_timer *w, int revents);
+	void reconcileRateLimitBuckets();
 
 
 	/****** Stage: buffering body ******/
 
 	void beginBufferingBody(Client *client, Request *req);
+	bool shouldStreamBufferedBody(Client *client, Request *req,
+		unsigned int bytesJustBuffered);
+	void beginStreamingBufferedBody(Client *client, Request *req);
 	Channel::Result whenBufferingBody_onRequestBody(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer, int errcode);
 	static void _bodyBufferFlushed(FileBufferedChannel *_channel);
+	static void _bodyBufferFlushedAtEnd(FileBufferedChannel *_channel);
 
 
 	/****** Stage: checkout session ******/
 
+	bool coalesceWithIdenticalRequest(Client *client, Request *req);
+	void releaseCoalescedRequests(Request *leader);
+	static void resumeCoalescedRequestLater(Request *req);
+	static void onCoalescingTimeout(EV_P_ struct ev_timer *w, int revents);
+	void expireCoalescedRequests(ev_tstamp now);
 	void checkoutSession(Client *client, Request *req);
 	static void sessionCheckedOut(const AbstractSessionPtr &session,
 		const ExceptionPtr &e, void *userData);
+	static bool sessionCheckoutCancelled(void *userData);
 	void sessionCheckedOutFromAnotherThread(Client *client, Request *req,
 		AbstractSessionPtr session, ExceptionPtr e);
 	void sessionCheckedOutFromEventLoopThread(Client *client, Request *req,
@@ -252,10 +573,11 @@ private:
 	void sendHeaderToApp(Client *client, Request *req);
 	void sendHeaderToAppWithSessionProtocol(Client *client, Request *req);
 	static void sendBodyToAppWhenAppSinkIdle(Channel *_channel, unsigned int size);
-	unsigned int determineHeaderSizeForSessionProtocol(Request *req,
-		SessionProtocolWorkingState &state, string delta_monotonic);
-	bool constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-		unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic);
+	void initializeSessionProtocolWorkingState(Request *req,
+		SessionProtocolWorkingState &state);
+	bool constructHeaderBuffersForSessionProtocol(Request *req, struct iovec *buffers,
+		unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
+		unsigned int & restrict_ref dataSize, SessionProtocolWorkingState &state);
 	void sendHeaderToAppWithHttpProtocol(Client *client, Request *req);
 	bool constructHeaderBuffersForHttpProtocol(Request *req, struct iovec *buffers,
 		unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
@@ -273,6 +595,14 @@ private:
 	void startBodyChannel(Client *client, Request *req);
 	void stopBodyChannel(Client *client, Request *req);
 	void logAppSocketWriteError(Client *client, int errcode);
+	bool canSpliceRequestBody(Client *client, Request *req);
+	void beginSplicingRequestBody(Client *client, Request *req);
+	static void onRequestBodySpliceEvent(EV_P_ ev_io *io, int revents);
+	void spliceRequestBody(Client *client, Request *req);
+	void waitForRequestBodySpliceEvent(Request *req, int fd, int events);
+	void endSplicingRequestBody(Client *client, Request *req);
+	bool canPassRequestBodyFd(Client *client, Request *req);
+	void passRequestBodyFdToApp(Client *client, Request *req);
 
 
 	/****** Stage: forward application response to client ******/
@@ -282,8 +612,23 @@ private:
 	Channel::Result onAppSourceData(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer, int errcode);
 	void onAppResponseBegin(Client *client, Request *req);
+	bool prepareXSendfileResponse(Client *client, Request *req,
+		const LString *path);
+	void sendXSendfileBody(Client *client, Request *req);
+	bool delegateFileBody(Client *client, Request *req,
+		ServerKit::HeaderTable &headers, const StaticString &filename,
+		boost::uint64_t start, boost::uint64_t size);
 	void prepareAppResponseCaching(Client *client, Request *req);
+	void processTurboCachePurgeHeader(Client *client, Request *req,
+		const LString *value);
+	bool shouldCompressResponse(Request *req);
+	void beginResponseCompression(Client *client, Request *req);
+	void compressResponseBody(Client *client, Request *req,
+		const char *data, unsigned int size, int flush);
+	void endResponseCompression(Client *client, Request *req);
 	void onAppResponse100Continue(Client *client, Request *req);
+	StaticString getPrecompiledStatusLine(unsigned int httpMajor,
+		unsigned int httpMinor, int statusCode);
 	bool constructHeaderBuffersForResponse(Request *req, struct iovec *buffers,
 		unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
 		unsigned int & restrict_ref dataSize,
@@ -309,7 +654,11 @@ private:
 		const MemoryKit::mbuf &buffer);
 	void markResponsePartForTurboCaching(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer);
+	boost::uint64_t getResponseBufferHighWatermark(Client *client) const;
+	bool appResponseRemainderIsSmall(const Request *req) const;
 	void maybeThrottleAppSource(Client *client, Request *req);
+	void updateResponseDrainRate(Client *client, Request *req);
+	void maybeEnterTunnelMode(Client *client, Request *req);
 	static void _outputBuffersFlushed(FileBufferedChannel *_channel);
 	void outputBuffersFlushed(Client *client, Request *req);
 	static void _outputDataFlushed(FileBufferedChannel *_channel);
@@ -324,9 +673,7 @@ private:
 
 	static Channel::Result onBodyBufferData(Channel *_channel,
 		const MemoryKit::mbuf &buffer, int errcode);
-	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
-		static void onEventLoopPrepare(EV_P_ struct ev_prepare *w, int revents);
-	#endif
+	static void onEventLoopPrepare(EV_P_ struct ev_prepare *w, int revents);
 	static void onEventLoopCheck(EV_P_ struct ev_check *w, int revents);
 
 
@@ -335,6 +682,9 @@ private:
 	static TurboCaching<Request>::State getTurboCachingInitialState(
 		const VariantMap *agentsOptions);
 	void generateServerLogName(unsigned int number);
+	StaticString lookupClientTenant(Client *client);
+	HashedStaticString getGroupKey(Client *client, Request *req,
+		const HashedStaticString &appGroupName);
 	void disconnectWithClientSocketWriteError(Client **client, int e);
 	void disconnectWithAppSocketIncompleteResponseError(Client **client);
 	void disconnectWithAppSocketReadError(Client **client, int e);
@@ -348,6 +698,12 @@ private:
 	void endRequestAsBadGateway(Client **client, Request **req);
 	void writeBenchmarkResponse(Client **client, Request **req,
 		bool end = true);
+	void respondToProbe(Client **client, Request **req, bool healthy);
+	void respondWithTooManyRequests(Client **client, Request **req);
+	bool serveStaticFile(Client *client, Request *req);
+	OpenStaticFile *openStaticFile(Client *client, Request *req,
+		const string &filename, const struct stat &buf);
+	void closeOpenStaticFiles();
 	bool getBoolOption(Request *req, const HashedStaticString &name,
 		bool defaultValue = false);
 	template<typename Number> static Number clamp(Number value,
@@ -355,14 +711,21 @@ private:
 	static void gatherBuffers(char * restrict dest, unsigned int size,
 		const struct iovec *buffers, unsigned int nbuffers);
 	static LString *resolveSymlink(const StaticString &path, psg_pool_t *pool);
-	void parseCookieHeader(psg_pool_t *pool, const LString *headerValue,
-		vector< pair<StaticString, StaticString> > &cookies) const;
+	static const LString *lookupAndFlattenHeader(Request *req,
+		const HashedStaticString &name);
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		void reportLargeTimeDiff(Client *client, const char *name,
 			ev_tstamp fromTime, ev_tstamp toTime);
 	#endif
 
 
+	/****** Miscellaneous ******/
+
+	void logLongRunningConnectionDisconnect(Client *client, Request *req);
+	static void onDrainTimeout(EV_P_ struct ev_timer *w, int revents);
+	void disconnectDrainingConnections(bool all);
+
+
 protected:
 	/****** Stage: initialize request ******/
 
@@ -372,17 +735,25 @@ protected:
 	/****** Hooks ******/
 
 	virtual void onClientAccepted(Client *client);
+	virtual Channel::Result onClientDataReceived(Client *client,
+		const MemoryKit::mbuf &buffer, int errcode);
 	virtual void onRequestObjectCreated(Client *client, Request *req);
 	virtual void deinitializeClient(Client *client);
 	virtual void reinitializeRequest(Client *client, Request *req);
 	virtual void deinitializeRequest(Client *client, Request *req);
 	void reinitializeAppResponse(Client *client, Request *req);
 	void deinitializeAppResponse(Client *client, Request *req);
+	void deinitializeAppResponseHeaders(Request *req);
+	virtual void compactRequestForTunnel(Client *client, Request *req);
+	void recordRequestStageTimes(Request *req);
+	void recordRequestTrace(Request *req);
 	virtual Channel::Result onRequestBody(Client *client, Request *req,
 		const MemoryKit::mbuf &buffer, int errcode);
 	virtual void onNextRequestEarlyReadError(Client *client, Request *req, int errcode);
 	virtual bool shouldDisconnectClientOnShutdown(Client *client);
+	virtual void onShutdown(bool forceDisconnect);
 	virtual bool supportsUpgrade(Client *client, Request *req);
+	virtual void onUpdateStatistics();
 
 
 	/****** Marked virtual so that unit tests can mock these ******/
@@ -395,6 +766,17 @@ public:
 	ResourceLocator *resourceLocator;
 	PoolPtr appPool;
 	UnionStation::ContextPtr unionStationContext;
+	// Optional. Shared by all Controllers.
+	SharedResponseCachePtr sharedResponseCache;
+	// Optional. Shared by all Controllers.
+	RequestTraceRecorderPtr requestTraceRecorder;
+	// Optional. Shared by all Controllers.
+	RateLimiterPtr rateLimiter;
+	// Called when an application response contains an X-Passenger-Purge
+	// header. Should call purgeTurboCache() on all Controllers, from their
+	// own event loops. If NULL, only this Controller's turbocache is purged.
+	typedef void (*TurboCachePurgeCallback)(const string &host, const string &path);
+	TurboCachePurgeCallback turboCachePurgeCallback;
 
 
 	/****** Initialization and shutdown ******/
@@ -415,15 +797,20 @@ public:
 
 	virtual Json::Value getConfigAsJson() const;
 	virtual void configure(const Json::Value &doc);
-	virtual Json::Value inspectStateAsJson() const;
-	virtual Json::Value inspectClientStateAsJson(const Client *client) const;
-	virtual Json::Value inspectRequestStateAsJson(const Request *req) const;
+	virtual void writeStateAsJson(JsonWriter &writer) const;
+	virtual void writeClientStateAsJson(JsonWriter &writer, const Client *client) const;
+	virtual void writeRequestStateAsJson(JsonWriter &writer, const Request *req) const;
+	Json::Value inspectRequestStagesAsJson() const;
+	Json::Value inspectEventLoopAsJson() const;
+	void collectMetrics(ControllerMetrics &metrics) const;
 
 
 	/****** Miscellaneous *******/
 
 	static BenchmarkMode parseBenchmarkMode(const StaticString mode);
-	void disconnectLongRunningConnections(const StaticString &gupid);
+	static const char *getRequestStageName(RequestStage stage);
+	void disconnectLongRunningConnections(const ProcessPtr &process, bool drain);
+	void purgeTurboCache(const StaticString &host, const StaticString &path);
 };
 
 
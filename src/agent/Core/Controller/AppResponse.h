@@ -126,6 +126,7 @@ public:
 	LString *cacheControl;
 	LString *expiresHeader;
 	LString *lastModifiedHeader;
+	LString *varyHeader;
 
 	/* If the response is eligible for turbocaching, then the buffers
 	 * that contain the part of the response that can be cached, will be
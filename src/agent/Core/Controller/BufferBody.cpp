@@ -53,7 +53,52 @@ Controller::beginBufferingBody(Client *client, Request *req) {
 	req->bodyChannel.start();
 	req->bodyBuffer.reinitialize();
 	req->bodyBuffer.stop();
-	req->beginStopwatchLog(&req->stopwatchLogs.bufferingRequestBody, "buffering request body");
+	req->beginStopwatchLog(RequestColdState::SWL_BUFFERING_REQUEST_BODY, "buffering request body");
+}
+
+/**
+ * Buffering the whole request body protects application processes from
+ * slow uploads, but makes large uploads by fast clients wait for the entire
+ * body to be spooled (possibly to disk) before the app sees any of it. So
+ * once the first `requestBodyPrebufferSize` bytes are in, we look at how
+ * fast the client sent them. Clients that are fast enough get a session
+ * right away, and the rest of their body is streamed to the app through
+ * the body buffer. Slow clients keep having their whole body buffered.
+ *
+ * Only bodies with a Content-Length qualify: for chunked bodies, the
+ * header that we send to the app depends on the total body size.
+ */
+bool
+Controller::shouldStreamBufferedBody(Client *client, Request *req,
+	unsigned int bytesJustBuffered)
+{
+	if (requestBodyPrebufferSize == 0
+	 || req->bodyType != Request::RBT_CONTENT_LENGTH
+	 || req->bodyBytesBuffered < requestBodyPrebufferSize
+	 || req->bodyBytesBuffered - bytesJustBuffered >= requestBodyPrebufferSize)
+	{
+		// Either not enabled, not reached yet, or already decided.
+		return false;
+	}
+
+	ev_tstamp duration = ev_now(getLoop()) - req->startedAt;
+	if (duration <= 0 || req->bodyBytesBuffered / duration >= requestBodySlowRate) {
+		return true;
+	} else {
+		SKC_TRACE(client, 2, "Client uploads request body at " <<
+			(unsigned long long) (req->bodyBytesBuffered / duration) <<
+			" bytes/sec; buffering the entire request body");
+		return false;
+	}
+}
+
+void
+Controller::beginStreamingBufferedBody(Client *client, Request *req) {
+	TRACE_POINT();
+	SKC_TRACE(client, 2, "Streaming the rest of the request body to the application");
+	req->streamingBufferedBody = true;
+	req->endStopwatchLog(RequestColdState::SWL_BUFFERING_REQUEST_BODY);
+	checkoutSession(client, req);
 }
 
 /**
@@ -69,6 +114,24 @@ Controller::_bodyBufferFlushed(FileBufferedChannel *channel) {
 	req->bodyChannel.start();
 }
 
+/**
+ * Relevant when the end of the request body was reached while the tail of the body
+ * was still being moved to bodyBuffer's buffer file (by whenBufferingBody_onRequestBody).
+ * Called when the buffer file contains the entire body.
+ */
+void
+Controller::_bodyBufferFlushedAtEnd(FileBufferedChannel *channel) {
+	Request *req = static_cast<Request *>(static_cast<
+		ServerKit::BaseHttpRequest *>(channel->getHooks()->userData));
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	SKC_LOG_EVENT_FROM_STATIC(self, Controller, client, "_bodyBufferFlushedAtEnd");
+
+	req->bodyBuffer.clearBuffersFlushedCallback();
+	req->bodyBuffer.feed(MemoryKit::mbuf());
+	self->checkoutSession(client, req);
+}
+
 /**
  * Receives data (buffer) originating from the bodyChannel, to be passed on to the bodyBuffer.
  * Backpressure is applied when the bodyBuffer in-memory part exceeds a threshold.
@@ -96,11 +159,22 @@ Controller::whenBufferingBody_onRequestBody(Client *client, Request *req,
 			req->bodyBuffer.setBuffersFlushedCallback(_bodyBufferFlushed);
 		}
 
+		if (!req->streamingBufferedBody
+		 && shouldStreamBufferedBody(client, req, buffer.size()))
+		{
+			beginStreamingBufferedBody(client, req);
+		}
+
 		return Channel::Result(buffer.size(), false);
 	} else if (errcode == 0 || errcode == ECONNRESET) {
 		// EOF
 		SKC_TRACE(client, 2, "End of request body encountered");
-		req->bodyBuffer.feed(MemoryKit::mbuf());
+		if (req->streamingBufferedBody) {
+			// A session has already been checked out, and bodyBuffer
+			// passes the end of the body on to the app.
+			req->bodyBuffer.feed(MemoryKit::mbuf());
+			return Channel::Result(0, true);
+		}
 		if (req->bodyType == Request::RBT_CHUNKED) {
 			// The data that we've stored in the body buffer is dechunked, so when forwarding
 			// the buffered body to the app we must advertise it as being a fixed-length,
@@ -128,8 +202,20 @@ Controller::whenBufferingBody_onRequestBody(Client *client, Request *req,
 			req->headers.erase(HTTP_TRANSFER_ENCODING);
 			req->headers.insert(&header, req->pool);
 		}
-		req->endStopwatchLog(&req->stopwatchLogs.bufferingRequestBody);
-		checkoutSession(client, req);
+		req->endStopwatchLog(RequestColdState::SWL_BUFFERING_REQUEST_BODY);
+		if (req->bodyBuffer.getMode() == FileBufferedChannel::IN_FILE_MODE
+		 && req->bodyBuffer.getBytesBuffered() > 0)
+		{
+			// Wait until the tail of the body has been moved to the buffer file,
+			// so that the file can be passed to the app (see canPassRequestBodyFd()).
+			// The end of the body is fed afterwards, because bodyBuffer doesn't
+			// report its buffers as flushed while an end marker is queued.
+			SKC_TRACE(client, 2, "Waiting until the request body buffer file is complete");
+			req->bodyBuffer.setBuffersFlushedCallback(_bodyBufferFlushedAtEnd);
+		} else {
+			req->bodyBuffer.feed(MemoryKit::mbuf());
+			checkoutSession(client, req);
+		}
 		return Channel::Result(0, true);
 	} else {
 		const unsigned int BUFSIZE = 1024;
@@ -46,14 +46,153 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * If an identical turbocacheable request is already being forwarded to
+ * the application, makes this request wait for that one's response
+ * instead of sending another request to the application. Returns whether
+ * that is the case. Otherwise, this request becomes the one that others
+ * may wait for.
+ *
+ * Waiting requests are resumed by releaseCoalescedRequests(). They are
+ * then served from the turbocache, or forwarded to the application after
+ * all if the response could not be cached. If the response takes longer
+ * than `coalescingTimeout`, they are forwarded to the application too.
+ */
+bool
+Controller::coalesceWithIdenticalRequest(Client *client, Request *req) {
+	if (coalescingTimeout == 0
+	 || !turboCaching.isEnabled()
+	 || req->cacheKey.empty()
+	 || req->hasBody()
+	 || !turboCaching.responseCache.requestAllowsStoring(req))
+	{
+		return false;
+	}
+
+	Request *leader;
+	LIST_FOREACH(leader, &coalescingLeaders, nextCoalescingRequest) {
+		if (leader->cacheKey.hash() == req->cacheKey.hash()
+		 && leader->cacheKey == req->cacheKey)
+		{
+			break;
+		}
+	}
+
+	if (leader == NULL) {
+		req->leadsCoalescing = true;
+		LIST_INSERT_HEAD(&coalescingLeaders, req, nextCoalescingRequest);
+		return false;
+	}
+
+	SKC_DEBUG(client, "Turbocaching: waiting for an identical request that is"
+		" already being forwarded to the application");
+	req->state = Request::WAITING_FOR_COALESCED_RESPONSE;
+	req->coalescingLeader = leader;
+	LIST_INSERT_HEAD(&coalescedRequests, req, nextCoalescingRequest);
+	coalescedRequestCount++;
+	if (!ev_is_active(&coalescingTimer)) {
+		ev_timer_set(&coalescingTimer, coalescingTimeout, 0);
+		ev_timer_start(getLoop(), &coalescingTimer);
+	}
+	return true;
+}
+
+/**
+ * Called when `leader` has stored its response in the turbocache, or
+ * when it turns out that it won't. Resumes all requests waiting for it.
+ */
+void
+Controller::releaseCoalescedRequests(Request *leader) {
+	Request *req, *next;
+
+	assert(leader->leadsCoalescing);
+	LIST_REMOVE(leader, nextCoalescingRequest);
+	leader->leadsCoalescing = false;
+
+	req = LIST_FIRST(&coalescedRequests);
+	while (req != NULL) {
+		next = LIST_NEXT(req, nextCoalescingRequest);
+		if (req->coalescingLeader == leader) {
+			LIST_REMOVE(req, nextCoalescingRequest);
+			req->coalescingLeader = NULL;
+			// Resume from the event loop rather than from within
+			// the leader's response processing.
+			refRequest(req, __FILE__, __LINE__);
+			getContext()->libev->runLater(boost::bind(
+				resumeCoalescedRequestLater, req));
+		}
+		req = next;
+	}
+}
+
+void
+Controller::resumeCoalescedRequestLater(Request *req) {
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(
+		Controller::getServerFromClient(client));
+	SKC_LOG_EVENT_FROM_STATIC(self, Controller, client, "resumeCoalescedRequestLater");
+
+	if (!req->ended()) {
+		if (!self->turboCaching.isEnabled()
+		 || !self->writeTurboCachedResponse(client, req, req->options->appGroupName))
+		{
+			SKC_DEBUG_FROM_STATIC(self, client, "Turbocaching: identical request"
+				" did not yield a cached response; forwarding request to application");
+			self->checkoutSession(client, req);
+		}
+	}
+	self->unrefRequest(req, __FILE__, __LINE__);
+}
+
+void
+Controller::onCoalescingTimeout(EV_P_ struct ev_timer *w, int revents) {
+	Controller *self = static_cast<Controller *>(w->data);
+	self->expireCoalescedRequests(ev_now(EV_A));
+}
+
+void
+Controller::expireCoalescedRequests(ev_tstamp now) {
+	Request *req, *next;
+	ev_tstamp nextDeadline = 0;
+
+	req = LIST_FIRST(&coalescedRequests);
+	while (req != NULL) {
+		next = LIST_NEXT(req, nextCoalescingRequest);
+		ev_tstamp deadline = req->startedAt + coalescingTimeout;
+		if (deadline <= now) {
+			Client *client = static_cast<Client *>(req->client);
+			SKC_DEBUG(client, "Turbocaching: timed out waiting for an identical"
+				" request; forwarding request to application");
+			LIST_REMOVE(req, nextCoalescingRequest);
+			req->coalescingLeader = NULL;
+			refRequest(req, __FILE__, __LINE__);
+			getContext()->libev->runLater(boost::bind(
+				checkoutSessionLater, req));
+		} else if (nextDeadline == 0 || deadline < nextDeadline) {
+			nextDeadline = deadline;
+		}
+		req = next;
+	}
+
+	if (nextDeadline != 0) {
+		ev_timer_set(&coalescingTimer, nextDeadline - now, 0);
+		ev_timer_start(getLoop(), &coalescingTimer);
+	}
+}
+
 void
 Controller::checkoutSession(Client *client, Request *req) {
 	GetCallback callback;
-	Options &options = req->options;
 
 	CC_BENCHMARK_POINT(client, req, BM_BEFORE_CHECKOUT);
-	SKC_TRACE(client, 2, "Checking out session: appRoot=" << options.appRoot);
+	SKC_TRACE(client, 2, "Checking out session: appRoot=" << req->options->appRoot);
 	req->state = Request::CHECKING_OUT_SESSION;
+	if (req->stageTimes.checkoutBegun == 0) {
+		// Retries after failing to initiate a session count
+		// towards the same checkout.
+		req->stageTimes.checkoutBegun = SystemTime::getMonotonicUsec();
+	}
+	P_PROBE1(session__checkout__begin, req);
 
 	if (req->requestBodyBuffering) {
 		assert(!req->bodyBuffer.isStarted());
@@ -63,8 +202,10 @@ Controller::checkoutSession(Client *client, Request *req) {
 
 	callback.func = sessionCheckedOut;
 	callback.userData = req;
-
-	options.currentTime = SystemTime::getUsec();
+	callback.isCancelled = sessionCheckoutCancelled;
+	// The request is kept alive until sessionCheckedOut() is called,
+	// and with it the Options passed to the pool.
+	callback.optionsOutliveCallback = true;
 
 	refRequest(req, __FILE__, __LINE__);
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
@@ -83,10 +224,20 @@ Controller::checkoutSession(Client *client, Request *req) {
 
 void
 Controller::asyncGetFromApplicationPool(Request *req, ApplicationPool2::GetCallback callback) {
-	appPool->asyncGet(req->options, callback, true,
-		req->useUnionStation()
-		? &req->stopwatchLogs.getFromPool
-		: NULL);
+	UnionStation::StopwatchLog **stopwatchLog =
+		req->getStopwatchLogSlot(RequestColdState::SWL_GET_FROM_POOL);
+
+	if (req->poolOptions.empty()) {
+		// The common case: the application's shared pool options can be
+		// used as they are.
+		appPool->asyncGet(*req->options, callback, true, stopwatchLog);
+	} else {
+		Options &options = req->getColdState()->checkoutOptions;
+		options = *req->options;
+		req->poolOptions.applyTo(options);
+		options.currentTime = SystemTime::getCachedUsec();
+		appPool->asyncGet(options, callback, true, stopwatchLog);
+	}
 }
 
 void
@@ -107,6 +258,16 @@ Controller::sessionCheckedOut(const AbstractSessionPtr &session, const Exception
 	}
 }
 
+/**
+ * Called by the pool, possibly from another thread, for requests that
+ * are waiting for a process. Lets it drop requests whose client is gone.
+ */
+bool
+Controller::sessionCheckoutCancelled(void *userData) {
+	Request *req = static_cast<Request *>(userData);
+	return req->checkoutCancelled.load(boost::memory_order_relaxed);
+}
+
 void
 Controller::sessionCheckedOutFromAnotherThread(Client *client, Request *req,
 	AbstractSessionPtr session, ExceptionPtr e)
@@ -140,13 +301,16 @@ Controller::sessionCheckedOutFromEventLoopThread(Client *client, Request *req,
 		SKC_DEBUG(client, "Session checked out: pid=" << session->getPid() <<
 			", gupid=" << session->getGupid());
 		req->session = session;
+		req->stageTimes.sessionCheckedOut = SystemTime::getMonotonicUsec();
+		P_PROBE2(session__checkout__end, req, (int) session->getPid());
 		UPDATE_TRACE_POINT();
 		maybeSend100Continue(client, req);
 		UPDATE_TRACE_POINT();
 		initiateSession(client, req);
 	} else {
 		UPDATE_TRACE_POINT();
-		req->endStopwatchLog(&req->stopwatchLogs.getFromPool, false);
+		P_PROBE2(session__checkout__end, req, -1);
+		req->endStopwatchLog(RequestColdState::SWL_GET_FROM_POOL, false);
 		reportSessionCheckoutError(client, req, e);
 	}
 }
@@ -196,19 +360,23 @@ Controller::initiateSession(Client *client, Request *req) {
 		return;
 	}
 
+	req->stageTimes.sessionInitiated = SystemTime::getMonotonicUsec();
+	P_PROBE2(app__connect, req, (int) req->session->getPid());
+
 	UPDATE_TRACE_POINT();
 	if (req->useUnionStation()) {
-		req->endStopwatchLog(&req->stopwatchLogs.getFromPool);
+		req->endStopwatchLog(RequestColdState::SWL_GET_FROM_POOL);
 		req->logMessage("Application PID: " +
 			toString(req->session->getPid()) +
 			" (GUPID: " + req->session->getGupid() + ")");
-		req->beginStopwatchLog(&req->stopwatchLogs.requestProxying, "request proxying");
+		req->beginStopwatchLog(RequestColdState::SWL_REQUEST_PROXYING, "request proxying");
 	}
 
 	UPDATE_TRACE_POINT();
 	SKC_DEBUG(client, "Session initiated: fd=" << req->session->fd());
-	req->appSink.reinitialize(req->session->fd());
-	req->appSource.reinitialize(req->session->fd());
+	req->appSink.reinitialize(req->session->fd(), req->session->shmRingSlot());
+	req->appSource.reinitialize(req->session->fd(), req->session->shmRingSlot());
+	req->appSource.burstReadCount = 1;
 	/***************/
 	/***************/
 	reinitializeAppResponse(client, req);
@@ -355,7 +523,7 @@ Controller::endRequestWithErrorResponse(Client **c, Request **r, const StaticStr
 
 	if (friendlyErrorPagesEnabled(req)) {
 		try {
-			data = renderer.renderWithDetails(message, req->options, e);
+			data = renderer.renderWithDetails(message, *req->options, e);
 		} catch (const SystemException &e2) {
 			SKC_ERROR(client, "Cannot render an error page: " << e2.what() <<
 				"\n" << e2.backtrace());
@@ -377,9 +545,9 @@ Controller::endRequestWithErrorResponse(Client **c, Request **r, const StaticStr
 bool
 Controller::friendlyErrorPagesEnabled(Request *req) {
 	bool defaultValue;
-	string defaultStr = agentsOptions->get("friendly_error_pages");
+	const string &defaultStr = controllerOptions.friendlyErrorPages;
 	if (defaultStr == "auto") {
-		defaultValue = (req->options.environment == "development");
+		defaultValue = (req->options->environment == "development");
 	} else {
 		defaultValue = defaultStr == "true";
 	}
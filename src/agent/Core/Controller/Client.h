@@ -42,6 +42,14 @@ using namespace ApplicationPool2;
 class Client: public ServerKit::BaseHttpClient<Request> {
 public:
 	ev_tstamp connectedAt;
+	// How fast the client receives response data, in bytes per second,
+	// as measured while the app source was throttled. -1 if unknown.
+	double responseDrainRate;
+	/**
+	 * The tenant that this client connected as, or the empty string.
+	 * See Controller::lookupClientTenant().
+	 */
+	StaticString tenant;
 
 	Client(void *server)
 		: ServerKit::BaseHttpClient<Request>(server)
@@ -23,6 +23,14 @@
  *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *  THE SOFTWARE.
  */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <Core/Controller.h>
 
 /*************************************************************************
@@ -70,6 +78,9 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 			// Data
 			UPDATE_TRACE_POINT();
 			size_t ret;
+			if (req->stageTimes.appResponseBegun == 0) {
+				req->stageTimes.appResponseBegun = SystemTime::getMonotonicUsec();
+			}
 			SKC_TRACE(client, 3, "Processing " << buffer.size() <<
 				" bytes of application data: \"" << cEscapeString(StaticString(
 					buffer.start, buffer.size())) << "\"");
@@ -208,7 +219,7 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 				.feed(buffer));
 			resp->bodyAlreadyRead += event.consumed;
 
-			if (req->dechunkResponse) {
+			if (req->dechunkResponse || req->compressResponse) {
 				UPDATE_TRACE_POINT();
 				switch (event.type) {
 				case ServerKit::HttpChunkedEvent::NONE:
@@ -288,6 +299,11 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 				" bytes of application data: \"" << cEscapeString(StaticString(
 					buffer.start, buffer.size())) << "\"");
 			resp->bodyAlreadyRead += buffer.size();
+			if (resp->httpState == AppResponse::UPGRADED && !req->tunneling) {
+				// The response header may not have been flushed back
+				// when the app response began.
+				maybeEnterTunnelMode(client, req);
+			}
 			writeResponseAndMarkForTurboCaching(client, req, buffer);
 			maybeThrottleAppSource(client, req);
 			return Channel::Result(buffer.size(), false);
@@ -296,7 +312,10 @@ Controller::onAppSourceData(Client *client, Request *req, const MemoryKit::mbuf
 			UPDATE_TRACE_POINT();
 			SKC_TRACE(client, 2, "Application sent EOF");
 			SKC_TRACE(client, 2, "Not keep-aliving application session connection");
-			req->session->close(true, false);
+			req->session->closeInBatch(true, false, sessionCloseBatch);
+			if (req->compressResponse) {
+				endResponseCompression(client, req);
+			}
 			endRequest(&client, &req);
 			return Channel::Result(0, false);
 		} else {
@@ -316,9 +335,12 @@ void
 Controller::onAppResponseBegin(Client *client, Request *req) {
 	TRACE_POINT();
 	AppResponse *resp = &req->appResponse;
+	const LString *xSendfile, *purge;
 	ssize_t bytesWritten;
 	bool oobw;
 
+	P_PROBE2(app__response__begin, req, (int) resp->statusCode);
+
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		req->timeOnRequestHeaderSent = ev_now(getLoop());
 		reportLargeTimeDiff(client,
@@ -348,6 +370,11 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 	}
 	resp->headers.erase(HTTP_CONNECTION);
 	resp->headers.erase(HTTP_STATUS);
+	purge = resp->headers.lookup(HTTP_X_PASSENGER_PURGE);
+	if (purge != NULL) {
+		processTurboCachePurgeHeader(client, req, purge);
+		resp->headers.erase(HTTP_X_PASSENGER_PURGE);
+	}
 	if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH) {
 		resp->headers.erase(HTTP_CONTENT_LENGTH);
 	}
@@ -357,7 +384,19 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 			req->wantKeepAlive = false;
 		}
 	}
-	if (resp->headers.lookup(ServerKit::HTTP_X_SENDFILE) != NULL
+	// Only we may tell the web server in front to send a file on our
+	// behalf, so never forward this header from the app.
+	resp->headers.erase(HTTP_X_PASSENGER_FILE);
+	xSendfile = resp->headers.lookup(ServerKit::HTTP_X_SENDFILE);
+	if (xSendfile != NULL && serveXSendfile
+	 && req->state == Request::WAITING_FOR_APP_OUTPUT)
+	{
+		// We serve the file ourselves and we output a Content-Length,
+		// so keep-alive can stay enabled.
+		if (!prepareXSendfileResponse(client, req, xSendfile)) {
+			return;
+		}
+	} else if (xSendfile != NULL
 	 || resp->headers.lookup(ServerKit::HTTP_X_ACCEL_REDIRECT) != NULL)
 	{
 		// If X-Sendfile or X-Accel-Redirect is set, then HttpHeaderParser
@@ -368,8 +407,23 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 		req->wantKeepAlive = false;
 	}
 
+	if (shouldCompressResponse(req)) {
+		beginResponseCompression(client, req);
+	}
+
 	prepareAppResponseCaching(client, req);
 
+	if (resp->bodyType == AppResponse::RBT_UNTIL_EOF
+	 || (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH
+	  && resp->aux.bodyInfo.contentLength > LARGE_RESPONSE_BODY_SIZE))
+	{
+		// For large downloads, drain several mbufs from the app socket per
+		// readability event instead of going back to the event loop poller
+		// after every mbuf. The burst still stops early when the app has no
+		// more data or when maybeThrottleAppSource() stops the source.
+		req->appSource.burstReadCount = LARGE_RESPONSE_BODY_BURST_READ_COUNT;
+	}
+
 	if (OXT_UNLIKELY(oobw)) {
 		SKC_TRACE(client, 2, "Response with OOBW detected");
 		if (req->session != NULL) {
@@ -377,6 +431,7 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 		}
 	}
 
+	recordResponseStatus(resp->statusCode);
 	UPDATE_TRACE_POINT();
 	if (!sendResponseHeaderWithWritev(client, req, bytesWritten)) {
 		UPDATE_TRACE_POINT();
@@ -392,7 +447,426 @@ Controller::onAppResponseBegin(Client *client, Request *req) {
 	if (!req->ended() && !resp->hasBody() && !resp->upgraded()) {
 		UPDATE_TRACE_POINT();
 		handleAppResponseBodyEnd(client, req);
-		endRequest(&client, &req);
+		if (req->xSendfileFd == -1) {
+			endRequest(&client, &req);
+		} else {
+			// The application session has been closed, so the app
+			// connection may already be in use by another request.
+			req->appSink.deinitialize();
+			req->appSource.deinitialize();
+			sendXSendfileBody(client, req);
+		}
+	} else if (resp->upgraded()) {
+		maybeEnterTunnelMode(client, req);
+	}
+}
+
+/**
+ * Called when the app responded with an X-Sendfile header and serve_x_sendfile
+ * is enabled. Makes sure that the file resides inside the application root
+ * (after resolving symlinks, because the Core may be running with more
+ * privileges than the app), opens it, and turns the app response into a
+ * response for the file, honoring a single-range Range request header.
+ * The file's contents are sent by sendXSendfileBody() after the response
+ * header has been sent.
+ *
+ * Returns false if the request has been ended with an error response.
+ */
+bool
+Controller::prepareXSendfileResponse(Client *client, Request *req,
+	const LString *path)
+{
+	TRACE_POINT();
+	AppResponse *resp = &req->appResponse;
+	string filename, appRoot;
+	struct stat buf;
+	boost::uint64_t start, end;
+	const LString *range;
+	char *resolved;
+	int fd, e, rangeResult = 0;
+
+	path = psg_lstr_make_contiguous(path, req->pool);
+	filename.assign(path->start->data, path->size);
+
+	resolved = realpath(filename.c_str(), NULL);
+	if (resolved == NULL) {
+		e = errno;
+		SKC_WARN(client, "Cannot resolve X-Sendfile path " << filename <<
+			": " << strerror(e) << " (errno=" << e << ")");
+		endRequestWithSimpleResponse(&client, &req, "<h2>Not Found</h2>", 404);
+		return false;
+	}
+	filename = resolved;
+	free(resolved);
+
+	resolved = realpath(string(req->options->appRoot).c_str(), NULL);
+	if (resolved != NULL) {
+		appRoot = resolved;
+		free(resolved);
+	}
+	if (appRoot.empty() || !startsWith(filename, appRoot + "/")) {
+		SKC_WARN(client, "Refusing to serve X-Sendfile path " << filename <<
+			" because it is not inside the application root " <<
+			req->options->appRoot);
+		endRequestWithSimpleResponse(&client, &req, "<h2>Forbidden</h2>", 403);
+		return false;
+	}
+
+	do {
+		fd = open(filename.c_str(), O_RDONLY | O_NOFOLLOW);
+	} while (fd == -1 && errno == EINTR);
+	if (fd == -1) {
+		e = errno;
+		SKC_WARN(client, "Cannot open X-Sendfile path " << filename <<
+			": " << strerror(e) << " (errno=" << e << ")");
+		endRequestWithSimpleResponse(&client, &req, "<h2>Not Found</h2>", 404);
+		return false;
+	}
+	P_LOG_FILE_DESCRIPTOR_OPEN4(fd, __FILE__, __LINE__, "X-Sendfile file");
+	req->xSendfileFd = fd;
+
+	if (fstat(fd, &buf) == -1 || !S_ISREG(buf.st_mode)) {
+		SKC_WARN(client, "Refusing to serve X-Sendfile path " << filename <<
+			" because it is not a regular file");
+		endRequestWithSimpleResponse(&client, &req, "<h2>Not Found</h2>", 404);
+		return false;
+	}
+
+	start = 0;
+	end = (buf.st_size > 0) ? buf.st_size - 1 : 0;
+	range = req->headers.lookup(HTTP_RANGE);
+	if (range != NULL && resp->statusCode == 200) {
+		range = psg_lstr_make_contiguous(range, req->pool);
+		rangeResult = ResponseCache<Request>::parseByteRange(
+			StaticString(range->start->data, range->size),
+			buf.st_size, start, end);
+	}
+
+	SKC_DEBUG(client, "Serving X-Sendfile path " << filename);
+	resp->headers.erase(ServerKit::HTTP_X_SENDFILE);
+	resp->headers.erase(HTTP_CONTENT_LENGTH);
+	resp->headers.erase("content-range");
+	resp->headers.insert(req->pool, "Accept-Ranges", "bytes");
+
+	// The response body never passes through the turbocache.
+	req->cacheKey = HashedStaticString();
+
+	const unsigned int BUFSIZE = 64;
+	char *contentLength = (char *) psg_pnalloc(req->pool, BUFSIZE);
+	char *contentRange = (char *) psg_pnalloc(req->pool, BUFSIZE);
+	boost::uint64_t size;
+
+	if (rangeResult == -1) {
+		resp->statusCode = 416;
+		snprintf(contentRange, BUFSIZE, "bytes */%llu",
+			(unsigned long long) buf.st_size);
+		resp->headers.insert(req->pool, "Content-Range", contentRange);
+		size = 0;
+	} else if (rangeResult == 1) {
+		resp->statusCode = 206;
+		snprintf(contentRange, BUFSIZE, "bytes %llu-%llu/%llu",
+			(unsigned long long) start, (unsigned long long) end,
+			(unsigned long long) buf.st_size);
+		resp->headers.insert(req->pool, "Content-Range", contentRange);
+		size = end - start + 1;
+	} else {
+		size = buf.st_size;
+	}
+
+	// The app response has no body as far as the rest of the response
+	// forwarding code is concerned, so we output the Content-Length header
+	// ourselves.
+	snprintf(contentLength, BUFSIZE, "%llu", (unsigned long long) size);
+	resp->headers.insert(req->pool, "Content-Length", contentLength);
+
+	if (size == 0 || req->method == HTTP_HEAD
+	 || delegateFileBody(client, req, resp->headers, filename, start, size))
+	{
+		req->xSendfileFd = -1;
+		safelyClose(fd, true);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
+	} else {
+		req->xSendfileOffset = start;
+		req->xSendfileRemaining = size;
+	}
+	return true;
+}
+
+/**
+ * Sends the remainder of the X-Sendfile file to the client. Reads data into
+ * mbufs until the client socket can't keep up, at which point it waits until
+ * the client output channel has flushed everything (see outputDataFlushed()),
+ * so that at most one buffer's worth of file data is in memory per request.
+ */
+void
+Controller::sendXSendfileBody(Client *client, Request *req) {
+	TRACE_POINT();
+
+	while (req->xSendfileRemaining > 0) {
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&getContext()->mbuf_pool));
+		size_t size = (size_t) std::min<boost::uint64_t>(buffer.size(),
+			req->xSendfileRemaining);
+		ssize_t ret;
+
+		do {
+			ret = pread(req->xSendfileFd, buffer.start, size,
+				req->xSendfileOffset);
+		} while (ret == -1 && errno == EINTR);
+		if (ret <= 0) {
+			if (ret == -1) {
+				int e = errno;
+				SKC_WARN(client, "Error reading X-Sendfile file: " <<
+					strerror(e) << " (errno=" << e << ")");
+			} else {
+				SKC_WARN(client, "X-Sendfile file was truncated while it was being sent");
+			}
+			disconnectWithError(&client, "X-Sendfile file read error");
+			return;
+		}
+
+		req->xSendfileOffset += ret;
+		req->xSendfileRemaining -= ret;
+		writeResponse(client, MemoryKit::mbuf(buffer, 0, ret));
+		if (req->ended()) {
+			return;
+		}
+
+		if (req->xSendfileRemaining > 0 && client->output.getTotalBytesBuffered() > 0) {
+			SKC_TRACE(client, 2, "Client socket is not keeping up. Waiting until "
+				"buffered X-Sendfile data is flushed");
+			client->output.setDataFlushedCallback(_outputDataFlushed);
+			return;
+		}
+	}
+
+	UPDATE_TRACE_POINT();
+	SKC_TRACE(client, 2, "X-Sendfile file sent");
+	endRequest(&client, &req);
+}
+
+/**
+ * If the web server in front announced that it can send files itself (the
+ * 'F' flag), adds an X-Passenger-File header to `headers` which tells it to
+ * send `size` bytes of the given file, starting at offset `start`, as the
+ * response body. The web server can then sendfile() the file to the client
+ * directly instead of us copying it over the connection. The header value
+ * has the format "<start> <size> <filename>".
+ *
+ * Returns whether the body was delegated. If so, the caller must end the
+ * request right after the response header without sending a body.
+ */
+bool
+Controller::delegateFileBody(Client *client, Request *req,
+	ServerKit::HeaderTable &headers, const StaticString &filename,
+	boost::uint64_t start, boost::uint64_t size)
+{
+	if (!req->fileBodyDelegation) {
+		return false;
+	}
+
+	const unsigned int BUFSIZE = 2 * sizeof("18446744073709551615") + 1;
+	char *value = (char *) psg_pnalloc(req->pool, BUFSIZE + filename.size());
+	int len = snprintf(value, BUFSIZE, "%llu %llu ",
+		(unsigned long long) start, (unsigned long long) size);
+	memcpy(value + len, filename.data(), filename.size());
+	headers.insert(req->pool, "X-Passenger-File",
+		StaticString(value, len + filename.size()));
+	SKC_DEBUG(client, "Delegating file body to the web server: " << filename);
+	return true;
+}
+
+/**
+ * Returns whether the given Content-Type header value names a textual
+ * media type that is worth compressing. Event streams are excluded
+ * because they are long-lived, and would hold on to the compression
+ * state for the lifetime of the connection.
+ */
+static bool
+isCompressibleContentType(const LString *value) {
+	StaticString type(value->start->data, value->size);
+	string::size_type pos;
+	char buf[64];
+
+	// Only look at the media type, not at parameters such as the charset.
+	pos = type.find(';');
+	if (pos != string::npos) {
+		type = type.substr(0, pos);
+	}
+	while (!type.empty() && (type[type.size() - 1] == ' ' || type[type.size() - 1] == '\t')) {
+		type = type.substr(0, type.size() - 1);
+	}
+	if (type.empty() || type.size() > sizeof(buf)) {
+		return false;
+	}
+	convertLowerCase((const unsigned char *) type.data(), (unsigned char *) buf,
+		type.size());
+	type = StaticString(buf, type.size());
+
+	if (startsWith(type, P_STATIC_STRING("text/"))) {
+		return type != P_STATIC_STRING("text/event-stream");
+	} else {
+		return type == P_STATIC_STRING("application/json")
+			|| type == P_STATIC_STRING("application/javascript")
+			|| type == P_STATIC_STRING("application/x-javascript")
+			|| type == P_STATIC_STRING("application/xml")
+			|| type == P_STATIC_STRING("image/svg+xml")
+			|| (type.size() > 5 && type.substr(type.size() - 5) == P_STATIC_STRING("+json"))
+			|| (type.size() > 4 && type.substr(type.size() - 4) == P_STATIC_STRING("+xml"));
+	}
+}
+
+/**
+ * Returns whether the app response body should be gzip-compressed. That is
+ * the case if response compression is enabled, if the client accepts gzip,
+ * and if the response has a textual body that isn't already encoded.
+ * Compressed bodies are always sent with the chunked transfer-encoding,
+ * so the client must speak HTTP/1.1 and the web server in front (if any)
+ * must not have asked us to dechunk responses.
+ */
+bool
+Controller::shouldCompressResponse(Request *req) {
+	AppResponse *resp = &req->appResponse;
+	const LString *value;
+
+	if (!req->acceptsGzip
+	 || req->dechunkResponse
+	 || req->method == HTTP_HEAD
+	 || req->httpMajor * 1000 + req->httpMinor * 10 < 1010
+	 || !resp->hasBody()
+	 || (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH
+	  && resp->aux.bodyInfo.contentLength < MIN_COMPRESSED_RESPONSE_BODY_SIZE)
+	 || resp->headers.lookup(HTTP_CONTENT_ENCODING) != NULL
+	 || resp->headers.lookup("content-range") != NULL)
+	{
+		return false;
+	}
+
+	value = resp->headers.lookup("cache-control");
+	if (value != NULL && value->size > 0) {
+		value = psg_lstr_make_contiguous(value, req->pool);
+		if (StaticString(value->start->data, value->size).find(
+			P_STATIC_STRING("no-transform")) != string::npos)
+		{
+			return false;
+		}
+	}
+
+	value = resp->headers.lookup(HTTP_CONTENT_TYPE);
+	if (value == NULL || value->size == 0) {
+		return false;
+	}
+	return isCompressibleContentType(psg_lstr_make_contiguous(value, req->pool));
+}
+
+/**
+ * Sets up the deflate state for compressing the app response body. The
+ * response header will then announce a gzip Content-Encoding and a chunked
+ * Transfer-Encoding. If the deflate state cannot be allocated, then the
+ * response is sent uncompressed.
+ */
+void
+Controller::beginResponseCompression(Client *client, Request *req) {
+	TRACE_POINT();
+	AppResponse *resp = &req->appResponse;
+	z_stream *stream = new z_stream();
+	const LString *etag;
+	int ret;
+
+	// A window of 15 bits plus 16 makes zlib write a gzip header and trailer.
+	ret = deflateInit2(stream, RESPONSE_COMPRESSION_LEVEL, Z_DEFLATED,
+		15 + 16, 8, Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK) {
+		SKC_WARN(client, "Cannot initialize response compression (zlib error " <<
+			ret << "); sending response uncompressed");
+		delete stream;
+		return;
+	}
+
+	SKC_TRACE(client, 2, "Compressing application response body with gzip");
+	req->compressionStream = stream;
+	req->compressResponse = true;
+
+	// The compressed body is not byte-for-byte identical to the one that
+	// the app described, so a strong ETag must become a weak one.
+	etag = resp->headers.lookup("etag");
+	if (etag != NULL && etag->size > 0 && psg_lstr_first_byte(etag) != 'W') {
+		etag = psg_lstr_make_contiguous(etag, req->pool);
+		char *weakEtag = (char *) psg_pnalloc(req->pool, etag->size + 3);
+		memcpy(weakEtag, "W/", 2);
+		memcpy(weakEtag + 2, etag->start->data, etag->size);
+		weakEtag[etag->size + 2] = '\0';
+		resp->headers.erase("etag");
+		resp->headers.insert(req->pool, "ETag", weakEtag);
+	}
+}
+
+/**
+ * Feeds app response body data to the compressor, and sends any compressed
+ * output to the client as chunks, one mbuf at a time. The compressed data
+ * is also marked for turbocaching, so that the compressed variant of the
+ * response can be served from the cache.
+ *
+ * `flush` is a zlib flush mode. Use Z_FINISH to write out the gzip trailer.
+ */
+void
+Controller::compressResponseBody(Client *client, Request *req,
+	const char *data, unsigned int size, int flush)
+{
+	// Space for the chunk size line in front of the compressed data
+	// (at most 8 hex digits plus CRLF), and for the CRLF after it.
+	const unsigned int CHUNK_HEADER_SPACE = 10;
+	const unsigned int CHUNK_TRAILER_SPACE = 2;
+	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
+	z_stream *stream = req->compressionStream;
+
+	stream->next_in = (Bytef *) data;
+	stream->avail_in = size;
+
+	do {
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
+		unsigned int capacity = buffer.size() - CHUNK_HEADER_SPACE
+			- CHUNK_TRAILER_SPACE;
+		unsigned int compressedSize, sizeStrSize;
+		char sizeStr[2 * sizeof(unsigned int) + 1];
+		char *pos;
+
+		stream->next_out = (Bytef *) buffer.start + CHUNK_HEADER_SPACE;
+		stream->avail_out = capacity;
+		deflate(stream, flush);
+		compressedSize = capacity - stream->avail_out;
+		if (compressedSize == 0) {
+			continue;
+		}
+
+		sizeStrSize = integerToHex<unsigned int>(compressedSize, sizeStr);
+		pos = buffer.start + CHUNK_HEADER_SPACE - sizeStrSize - 2;
+		memcpy(pos, sizeStr, sizeStrSize);
+		memcpy(pos + sizeStrSize, "\r\n", 2);
+		memcpy(buffer.start + CHUNK_HEADER_SPACE + compressedSize, "\r\n", 2);
+
+		writeResponse(client, MemoryKit::mbuf(buffer, pos - buffer.start,
+			sizeStrSize + 2 + compressedSize + 2));
+		markResponsePartForTurboCaching(client, req,
+			MemoryKit::mbuf(buffer, CHUNK_HEADER_SPACE, compressedSize));
+		if (req->ended()) {
+			return;
+		}
+	} while (stream->avail_out == 0);
+}
+
+/**
+ * Flushes the remaining compressed data and the gzip trailer, terminates
+ * the chunked response body, and frees the deflate state.
+ */
+void
+Controller::endResponseCompression(Client *client, Request *req) {
+	TRACE_POINT();
+	compressResponseBody(client, req, NULL, 0, Z_FINISH);
+	deflateEnd(req->compressionStream);
+	delete req->compressionStream;
+	req->compressionStream = NULL;
+	if (!req->ended()) {
+		writeResponse(client, P_STATIC_STRING("0\r\n\r\n"));
 	}
 }
 
@@ -401,31 +875,79 @@ Controller::prepareAppResponseCaching(Client *client, Request *req) {
 	if (turboCaching.isEnabled() && !req->cacheKey.empty()) {
 		TRACE_POINT();
 		AppResponse *resp = &req->appResponse;
+		ResponseCache<Request>::StoreFailureReason reason =
+			ResponseCache<Request>::UNCACHEABLE_REQUEST;
 		SKC_TRACE(client, 2, "Turbocache: preparing response caching");
 		if (turboCaching.responseCache.requestAllowsStoring(req)
-		 && turboCaching.responseCache.prepareRequestForStoring(req))
+		 && turboCaching.responseCache.prepareRequestForStoring(req, &reason))
 		{
 			if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH
-			 && resp->aux.bodyInfo.contentLength > ResponseCache<Request>::MAX_BODY_SIZE)
+			 && resp->aux.bodyInfo.contentLength > turboCaching.responseCache.getMaxBodySize())
 			{
 				SKC_DEBUG(client, "Response body larger than " <<
-					ResponseCache<Request>::MAX_BODY_SIZE <<
+					turboCaching.responseCache.getMaxBodySize() <<
 					" bytes, so response is not eligible for turbocaching");
 				// Decrease store success ratio.
 				turboCaching.responseCache.incStores();
+				turboCaching.recordStoreFailure(req->options->appGroupName, req,
+					ResponseCache<Request>::BODY_TOO_LARGE);
 				req->cacheKey = HashedStaticString();
 			}
 		} else if (turboCaching.responseCache.requestAllowsInvalidating(req)) {
 			SKC_DEBUG(client, "Processing turbocache invalidation based on response");
+			turboCaching.recordStoreFailure(req->options->appGroupName, req, reason);
 			turboCaching.responseCache.invalidate(req);
 			req->cacheKey = HashedStaticString();
 			SKC_TRACE(client, 2, "Turbocache entries:\n" << turboCaching.responseCache.inspect());
 		} else {
-			SKC_TRACE(client, 2, "Turbocache: response not eligible for turbocaching");
+			SKC_TRACE(client, 2, "Turbocache: response not eligible for turbocaching: " <<
+				ResponseCache<Request>::getStoreFailureReasonString(reason));
 			// Decrease store success ratio.
 			turboCaching.responseCache.incStores();
+			turboCaching.recordStoreFailure(req->options->appGroupName, req, reason);
 			req->cacheKey = HashedStaticString();
 		}
+
+		if (req->leadsCoalescing && req->cacheKey.empty()) {
+			// Identical requests needn't wait for a response that
+			// won't be cached.
+			releaseCoalescedRequests(req);
+		}
+	}
+}
+
+/**
+ * Processes an X-Passenger-Purge header, which contains a comma-separated
+ * list of paths on the request's host whose turbocache entries should be
+ * purged.
+ */
+void
+Controller::processTurboCachePurgeHeader(Client *client, Request *req,
+	const LString *value)
+{
+	if (req->host == NULL || req->host->size == 0 || value->size == 0) {
+		return;
+	}
+
+	const LString *hostValue = psg_lstr_make_contiguous(req->host, req->pool);
+	string host(hostValue->start->data, hostValue->size);
+	value = psg_lstr_make_contiguous(value, req->pool);
+	vector<StaticString> paths;
+	split(StaticString(value->start->data, value->size), ',', paths);
+
+	vector<StaticString>::const_iterator it, end = paths.end();
+	for (it = paths.begin(); it != end; it++) {
+		string path = strip(*it);
+		if (path.empty()) {
+			continue;
+		}
+
+		SKC_DEBUG(client, "Purging turbocache entries for " << host << path);
+		if (turboCachePurgeCallback != NULL) {
+			turboCachePurgeCallback(host, path);
+		} else {
+			purgeTurboCache(host, path);
+		}
 	}
 }
 
@@ -450,6 +972,41 @@ Controller::onAppResponse100Continue(Client *client, Request *req) {
 	}
 }
 
+/**
+ * Returns the complete status line, plus the CGI-style Status header that
+ * Passenger has always sent, for the given HTTP version and status code,
+ * e.g. "HTTP/1.1 200 OK\r\nStatus: 200 OK\r\n". Lines are built on first
+ * use and then live in `stringPool`, so that most responses start with a
+ * single constant buffer. Returns an empty string for HTTP versions other
+ * than 1.0 and 1.1, and for status codes without a known reason phrase.
+ */
+StaticString
+Controller::getPrecompiledStatusLine(unsigned int httpMajor, unsigned int httpMinor,
+	int statusCode)
+{
+	if (OXT_UNLIKELY(httpMajor != 1 || httpMinor > 1
+		|| statusCode < 100 || (unsigned int) statusCode >= 100 + STATUS_LINE_CACHE_SIZE))
+	{
+		return StaticString();
+	}
+
+	StaticString &statusLine = statusLineCache[httpMinor][statusCode - 100];
+	if (OXT_UNLIKELY(statusLine.empty())) {
+		const char *statusAndReason = getStatusCodeAndReasonPhrase(statusCode);
+		if (statusAndReason == NULL) {
+			return StaticString();
+		}
+
+		string str = (httpMinor == 0) ? "HTTP/1.0 " : "HTTP/1.1 ";
+		str.append(statusAndReason);
+		str.append("\r\nStatus: ");
+		str.append(statusAndReason);
+		str.append("\r\n");
+		statusLine = psg_pstrdup(stringPool, str);
+	}
+	return statusLine;
+}
+
 /**
  * Construct an array of buffers, which together contain the HTTP response
  * data that should be sent to the client. This method does not copy any data:
@@ -492,100 +1049,132 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 			INC_BUFFER_ITER(i); \
 			dataSize += sizeof(str) - 1; \
 		} while (false)
+	#ifdef PASSENGER_IS_ENTERPRISE
+		#define X_POWERED_BY_WITH_VERSION \
+			"X-Powered-By: " PROGRAM_NAME " Enterprise " PASSENGER_VERSION "\r\n\r\n"
+		#define X_POWERED_BY_WITHOUT_VERSION \
+			"X-Powered-By: " PROGRAM_NAME " Enterprise\r\n\r\n"
+	#else
+		#define X_POWERED_BY_WITH_VERSION \
+			"X-Powered-By: " PROGRAM_NAME " " PASSENGER_VERSION "\r\n\r\n"
+		#define X_POWERED_BY_WITHOUT_VERSION \
+			"X-Powered-By: " PROGRAM_NAME "\r\n\r\n"
+	#endif
+	#define PUSH_CONNECTION_AND_END_OF_HEADER(connectionHeader) \
+		do { \
+			if (req->showVersionInHeader) { \
+				PUSH_STATIC_BUFFER(connectionHeader X_POWERED_BY_WITH_VERSION); \
+			} else { \
+				PUSH_STATIC_BUFFER(connectionHeader X_POWERED_BY_WITHOUT_VERSION); \
+			} \
+		} while (false)
 
 	AppResponse *resp = &req->appResponse;
 	ServerKit::HeaderTable::Iterator it(resp->headers);
 	const LString::Part *part;
 	const char *statusAndReason;
+	StaticString statusLine;
 	unsigned int i = 0;
 
 	nbuffers = 0;
 	dataSize = 0;
 
-	PUSH_STATIC_BUFFER("HTTP/");
-
-	if (buffers != NULL) {
-		BEGIN_PUSH_NEXT_BUFFER();
-		const unsigned int BUFSIZE = 16;
-		char *buf = (char *) psg_pnalloc(req->pool, BUFSIZE);
-		const char *end = buf + BUFSIZE;
-		char *pos = buf;
-		pos += uintToString(req->httpMajor, pos, end - pos);
-		pos = appendData(pos, end, ".", 1);
-		pos += uintToString(req->httpMinor, pos, end - pos);
-		buffers[i].iov_base = (void *) buf;
-		buffers[i].iov_len  = pos - buf;
-		dataSize += pos - buf;
-	} else {
-		char buf[16];
-		const char *end = buf + sizeof(buf);
-		char *pos = buf;
-		pos += uintToString(req->httpMajor, pos, end - pos);
-		pos = appendData(pos, end, ".", 1);
-		pos += uintToString(req->httpMinor, pos, end - pos);
-		dataSize += pos - buf;
-	}
-	INC_BUFFER_ITER(i);
-
-	PUSH_STATIC_BUFFER(" ");
-
-	statusAndReason = getStatusCodeAndReasonPhrase(resp->statusCode);
-	if (statusAndReason != NULL) {
-		size_t len = strlen(statusAndReason);
-		BEGIN_PUSH_NEXT_BUFFER();
-		if (buffers != NULL) {
-			BEGIN_PUSH_NEXT_BUFFER();
-			buffers[i].iov_base = (void *) statusAndReason;
-			buffers[i].iov_len  = len;
-		}
-		INC_BUFFER_ITER(i);
-		dataSize += len;
-
-		PUSH_STATIC_BUFFER("\r\nStatus: ");
+	statusLine = getPrecompiledStatusLine(req->httpMajor, req->httpMinor,
+		resp->statusCode);
+	if (OXT_LIKELY(!statusLine.empty())) {
 		if (buffers != NULL) {
 			BEGIN_PUSH_NEXT_BUFFER();
-			buffers[i].iov_base = (void *) statusAndReason;
-			buffers[i].iov_len  = len;
+			buffers[i].iov_base = (void *) statusLine.data();
+			buffers[i].iov_len  = statusLine.size();
 		}
 		INC_BUFFER_ITER(i);
-		dataSize += len;
-
-		PUSH_STATIC_BUFFER("\r\n");
+		dataSize += statusLine.size();
 	} else {
+		PUSH_STATIC_BUFFER("HTTP/");
+
 		if (buffers != NULL) {
 			BEGIN_PUSH_NEXT_BUFFER();
-			const unsigned int BUFSIZE = 8;
+			const unsigned int BUFSIZE = 16;
 			char *buf = (char *) psg_pnalloc(req->pool, BUFSIZE);
 			const char *end = buf + BUFSIZE;
 			char *pos = buf;
-			unsigned int size = uintToString(resp->statusCode, pos, end - pos);
+			pos += uintToString(req->httpMajor, pos, end - pos);
+			pos = appendData(pos, end, ".", 1);
+			pos += uintToString(req->httpMinor, pos, end - pos);
 			buffers[i].iov_base = (void *) buf;
-			buffers[i].iov_len  = size;
-			INC_BUFFER_ITER(i);
-			dataSize += size;
+			buffers[i].iov_len  = pos - buf;
+			dataSize += pos - buf;
+		} else {
+			char buf[16];
+			const char *end = buf + sizeof(buf);
+			char *pos = buf;
+			pos += uintToString(req->httpMajor, pos, end - pos);
+			pos = appendData(pos, end, ".", 1);
+			pos += uintToString(req->httpMinor, pos, end - pos);
+			dataSize += pos - buf;
+		}
+		INC_BUFFER_ITER(i);
+
+		PUSH_STATIC_BUFFER(" ");
 
-			PUSH_STATIC_BUFFER(" Unknown Reason-Phrase\r\nStatus: ");
+		statusAndReason = getStatusCodeAndReasonPhrase(resp->statusCode);
+		if (statusAndReason != NULL) {
+			size_t len = strlen(statusAndReason);
 			BEGIN_PUSH_NEXT_BUFFER();
-			buffers[i].iov_base = (void *) buf;
-			buffers[i].iov_len  = size;
+			if (buffers != NULL) {
+				BEGIN_PUSH_NEXT_BUFFER();
+				buffers[i].iov_base = (void *) statusAndReason;
+				buffers[i].iov_len  = len;
+			}
 			INC_BUFFER_ITER(i);
-			dataSize += size;
+			dataSize += len;
+
+			PUSH_STATIC_BUFFER("\r\nStatus: ");
+			if (buffers != NULL) {
+				BEGIN_PUSH_NEXT_BUFFER();
+				buffers[i].iov_base = (void *) statusAndReason;
+				buffers[i].iov_len  = len;
+			}
+			INC_BUFFER_ITER(i);
+			dataSize += len;
 
 			PUSH_STATIC_BUFFER("\r\n");
 		} else {
-			char buf[8];
-			const char *end = buf + sizeof(buf);
-			char *pos = buf;
-			unsigned int size = uintToString(resp->statusCode, pos, end - pos);
-			INC_BUFFER_ITER(i);
-			dataSize += size;
+			if (buffers != NULL) {
+				BEGIN_PUSH_NEXT_BUFFER();
+				const unsigned int BUFSIZE = 8;
+				char *buf = (char *) psg_pnalloc(req->pool, BUFSIZE);
+				const char *end = buf + BUFSIZE;
+				char *pos = buf;
+				unsigned int size = uintToString(resp->statusCode, pos, end - pos);
+				buffers[i].iov_base = (void *) buf;
+				buffers[i].iov_len  = size;
+				INC_BUFFER_ITER(i);
+				dataSize += size;
 
-			dataSize += sizeof(" Unknown Reason-Phrase\r\nStatus: ") - 1;
-			INC_BUFFER_ITER(i);
-			dataSize += size;
-			INC_BUFFER_ITER(i);
-			dataSize += sizeof("\r\n");
-			INC_BUFFER_ITER(i);
+				PUSH_STATIC_BUFFER(" Unknown Reason-Phrase\r\nStatus: ");
+				BEGIN_PUSH_NEXT_BUFFER();
+				buffers[i].iov_base = (void *) buf;
+				buffers[i].iov_len  = size;
+				INC_BUFFER_ITER(i);
+				dataSize += size;
+
+				PUSH_STATIC_BUFFER("\r\n");
+			} else {
+				char buf[8];
+				const char *end = buf + sizeof(buf);
+				char *pos = buf;
+				unsigned int size = uintToString(resp->statusCode, pos, end - pos);
+				INC_BUFFER_ITER(i);
+				dataSize += size;
+
+				dataSize += sizeof(" Unknown Reason-Phrase\r\nStatus: ") - 1;
+				INC_BUFFER_ITER(i);
+				dataSize += size;
+				INC_BUFFER_ITER(i);
+				dataSize += sizeof("\r\n");
+				INC_BUFFER_ITER(i);
+			}
 		}
 	}
 
@@ -647,8 +1236,6 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 		}
 		INC_BUFFER_ITER(i);
 		dataSize += size;
-
-		PUSH_STATIC_BUFFER("\r\n");
 	}
 
 	if (resp->setCookie != NULL) {
@@ -672,9 +1259,15 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 		PUSH_STATIC_BUFFER("\r\n");
 	}
 
+	if (req->compressResponse) {
+		PUSH_STATIC_BUFFER("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+	}
+
 	nCacheableBuffers = i;
 
-	if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH) {
+	if (req->compressResponse) {
+		PUSH_STATIC_BUFFER("Transfer-Encoding: chunked\r\n");
+	} else if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH) {
 		PUSH_STATIC_BUFFER("Content-Length: ");
 		if (buffers != NULL) {
 			BEGIN_PUSH_NEXT_BUFFER();
@@ -695,24 +1288,8 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 		PUSH_STATIC_BUFFER("Transfer-Encoding: chunked\r\n");
 	}
 
-	if (resp->bodyType == AppResponse::RBT_UPGRADE) {
-		PUSH_STATIC_BUFFER("Connection: upgrade\r\n");
-	} else if (canKeepAlive(req)) {
-		unsigned int httpVersion = req->httpMajor * 1000 + req->httpMinor * 10;
-		if (httpVersion < 1010) {
-			// HTTP < 1.1 defaults to "Connection: close"
-			PUSH_STATIC_BUFFER("Connection: keep-alive\r\n");
-		}
-	} else {
-		unsigned int httpVersion = req->httpMajor * 1000 + req->httpMinor * 10;
-		if (httpVersion >= 1010) {
-			// HTTP 1.1 defaults to "Connection: keep-alive"
-			PUSH_STATIC_BUFFER("Connection: close\r\n");
-		}
-	}
-
 	if (req->stickySession) {
-		StaticString baseURI = req->options.baseURI;
+		StaticString baseURI = req->options->baseURI;
 		if (baseURI.empty()) {
 			baseURI = P_STATIC_STRING("/");
 		}
@@ -741,8 +1318,8 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 
 		stickySessionId = req->session->getStickySessionId();
 		stickySessionIdSize = uintSizeAsString(stickySessionId);
-		stickySessionIdStr = (char *) psg_pnalloc(req->pool, stickySessionIdSize + 1);
-		uintToString(stickySessionId, stickySessionIdStr, stickySessionIdSize + 1);
+		stickySessionIdStr = (char *) psg_pnalloc(req->pool, stickySessionIdSize);
+		uintToStringWithSize(stickySessionId, stickySessionIdStr, stickySessionIdSize);
 
 		PUSH_STATIC_BUFFER("=");
 
@@ -767,18 +1344,26 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 		PUSH_STATIC_BUFFER("\r\n");
 	}
 
-	if (req->showVersionInHeader) {
-		#ifdef PASSENGER_IS_ENTERPRISE
-			PUSH_STATIC_BUFFER("X-Powered-By: " PROGRAM_NAME " Enterprise " PASSENGER_VERSION "\r\n\r\n");
-		#else
-			PUSH_STATIC_BUFFER("X-Powered-By: " PROGRAM_NAME " " PASSENGER_VERSION "\r\n\r\n");
-		#endif
+	// The Connection header and the X-Powered-By header, which ends the
+	// response header, are joined into a single static buffer.
+	if (resp->bodyType == AppResponse::RBT_UPGRADE) {
+		PUSH_CONNECTION_AND_END_OF_HEADER("Connection: upgrade\r\n");
+	} else if (canKeepAlive(req)) {
+		unsigned int httpVersion = req->httpMajor * 1000 + req->httpMinor * 10;
+		if (httpVersion < 1010) {
+			// HTTP < 1.1 defaults to "Connection: close"
+			PUSH_CONNECTION_AND_END_OF_HEADER("Connection: keep-alive\r\n");
+		} else {
+			PUSH_CONNECTION_AND_END_OF_HEADER("");
+		}
 	} else {
-		#ifdef PASSENGER_IS_ENTERPRISE
-			PUSH_STATIC_BUFFER("X-Powered-By: " PROGRAM_NAME " Enterprise\r\n\r\n");
-		#else
-			PUSH_STATIC_BUFFER("X-Powered-By: " PROGRAM_NAME "\r\n\r\n");
-		#endif
+		unsigned int httpVersion = req->httpMajor * 1000 + req->httpMinor * 10;
+		if (httpVersion >= 1010) {
+			// HTTP 1.1 defaults to "Connection: keep-alive"
+			PUSH_CONNECTION_AND_END_OF_HEADER("Connection: close\r\n");
+		} else {
+			PUSH_CONNECTION_AND_END_OF_HEADER("");
+		}
 	}
 
 	nbuffers = i;
@@ -787,19 +1372,31 @@ Controller::constructHeaderBuffersForResponse(Request *req, struct iovec *buffer
 	#undef BEGIN_PUSH_NEXT_BUFFER
 	#undef INC_BUFFER_ITER
 	#undef PUSH_STATIC_BUFFER
+	#undef X_POWERED_BY_WITH_VERSION
+	#undef X_POWERED_BY_WITHOUT_VERSION
+	#undef PUSH_CONNECTION_AND_END_OF_HEADER
 }
 
 unsigned int
 Controller::constructDateHeaderBuffersForResponse(char *dateStr, unsigned int bufsize) {
-	char *pos = dateStr;
-	const char *end = dateStr + bufsize - 1;
 	time_t the_time = (time_t) ev_now(getContext()->libev->getLoop());
-	struct tm the_tm;
 
-	pos = appendData(pos, end, "Date: ");
-	gmtime_r(&the_time, &the_tm);
-	pos += strftime(pos, end - pos, "%a, %d %b %Y %H:%M:%S GMT", &the_tm);
-	return pos - dateStr;
+	if (OXT_UNLIKELY(the_time != dateHeaderTime)) {
+		char *pos = dateHeader;
+		const char *end = dateHeader + sizeof(dateHeader) - 1;
+		struct tm the_tm;
+
+		pos = appendData(pos, end, "Date: ");
+		gmtime_r(&the_time, &the_tm);
+		pos += strftime(pos, end - pos, "%a, %d %b %Y %H:%M:%S GMT", &the_tm);
+		pos = appendData(pos, end, "\r\n");
+		dateHeaderSize = pos - dateHeader;
+		dateHeaderTime = the_time;
+	}
+
+	unsigned int size = std::min(dateHeaderSize, bufsize - 1);
+	memcpy(dateStr, dateHeader, size);
+	return size;
 }
 
 bool
@@ -812,6 +1409,17 @@ Controller::sendResponseHeaderWithWritev(Client *client, Request *req,
 		writeBenchmarkResponse(&client, &req, false);
 		return true;
 	}
+	if (!client->output.flushed()) {
+		// The previous pipelined response is still being written out, so
+		// the header must be queued behind it. See HttpServer::endRequest().
+		bytesWritten = 0;
+		return false;
+	}
+	if (client->tlsSession != NULL) {
+		// The header must be encrypted by the output channel.
+		bytesWritten = 0;
+		return false;
+	}
 
 	unsigned int maxbuffers = std::min<unsigned int>(
 		8 + req->appResponse.headers.size() * 4 + 11, IOV_MAX);
@@ -832,7 +1440,10 @@ Controller::sendResponseHeaderWithWritev(Client *client, Request *req,
 			ret = writev(client->getFd(), buffers, nbuffers);
 		} while (ret == -1 && errno == EINTR);
 		bytesWritten = ret;
-		req->responseBegun |= ret > 0;
+		if (ret > 0) {
+			req->responseBegun = true;
+			req->responseBytesWritten += ret;
+		}
 		return ret == (ssize_t) dataSize;
 	} else {
 		UPDATE_TRACE_POINT();
@@ -940,6 +1551,8 @@ Controller::markHeaderBuffersForTurboCaching(Client *client, Request *req,
 				" bytes, so response is not eligible for turbocaching");
 			// Decrease store success ratio.
 			turboCaching.responseCache.incStores();
+			turboCaching.recordStoreFailure(req->options->appGroupName, req,
+				ResponseCache<Request>::HEADER_TOO_LARGE);
 			req->cacheKey = HashedStaticString();
 		} else {
 			req->appResponse.headerCacheBuffers = buffers;
@@ -983,6 +1596,16 @@ void
 Controller::writeResponseAndMarkForTurboCaching(Client *client, Request *req,
 	const MemoryKit::mbuf &buffer)
 {
+	if (req->compressResponse) {
+		// Bodies of known length are compressed as a whole. Other bodies
+		// may be streamed by the app, so flush after every piece of data
+		// in order not to hold back data that the client may be waiting for.
+		compressResponseBody(client, req, buffer.start, buffer.size(),
+			(req->appResponse.bodyType == AppResponse::RBT_CONTENT_LENGTH)
+				? Z_NO_FLUSH
+				: Z_SYNC_FLUSH);
+		return;
+	}
 	if (OXT_LIKELY(benchmarkMode != BM_RESPONSE_BEGIN)) {
 		writeResponse(client, buffer);
 	}
@@ -995,12 +1618,14 @@ Controller::markResponsePartForTurboCaching(Client *client, Request *req,
 {
 	if (!req->ended() && turboCaching.isEnabled() && !req->cacheKey.empty()) {
 		unsigned int totalSize = req->appResponse.bodyCacheBuffer.size + buffer.size();
-		if (totalSize > ResponseCache<Request>::MAX_BODY_SIZE) {
+		if (totalSize > turboCaching.responseCache.getMaxBodySize()) {
 			SKC_DEBUG(client, "Response body larger than " <<
-				ResponseCache<Request>::MAX_HEADER_SIZE <<
+				turboCaching.responseCache.getMaxBodySize() <<
 				" bytes, so response is not eligible for turbocaching");
 			// Decrease store success ratio.
 			turboCaching.responseCache.incStores();
+			turboCaching.recordStoreFailure(req->options->appGroupName, req,
+				ResponseCache<Request>::BODY_TOO_LARGE);
 			req->cacheKey = HashedStaticString();
 			psg_lstr_deinit(&req->appResponse.bodyCacheBuffer);
 		} else {
@@ -1010,16 +1635,63 @@ Controller::markResponsePartForTurboCaching(Client *client, Request *req,
 	}
 }
 
+/**
+ * Returns how much response data may be buffered for the given client
+ * before the app source is throttled. Responses up to
+ * `responseBufferFullBufferingSize` are always buffered completely, so
+ * that the app process is released as soon as possible, even for slow
+ * clients. Beyond that, the watermark follows the client's measured
+ * drain rate: fast clients are allowed to buffer more, while slow
+ * clients do not pile up large disk buffers.
+ */
+boost::uint64_t
+Controller::getResponseBufferHighWatermark(Client *client) const {
+	if (responseBufferHighWatermark == 0 || responseBufferFullBufferingSize == 0) {
+		return responseBufferHighWatermark;
+	}
+
+	boost::uint64_t result = responseBufferFullBufferingSize;
+	if (client->responseDrainRate > 0) {
+		result = std::max<boost::uint64_t>(result,
+			client->responseDrainRate * RESPONSE_BUFFER_DRAIN_TIME);
+	}
+	return std::min<boost::uint64_t>(result, responseBufferHighWatermark);
+}
+
+/**
+ * Whether the rest of the app response body is small enough to be read
+ * into the client output buffer regardless of throttling. Once it has been
+ * read, handleAppResponseBodyEnd() releases the session, instead of the
+ * app process staying busy until a slow client has caught up.
+ */
+bool
+Controller::appResponseRemainderIsSmall(const Request *req) const {
+	const AppResponse *resp = &req->appResponse;
+	return resp->httpState == AppResponse::PARSING_BODY_WITH_LENGTH
+		&& resp->aux.bodyInfo.contentLength - resp->bodyAlreadyRead
+			<= APP_RESPONSE_REMAINDER_BUFFER_SIZE;
+}
+
 void
 Controller::maybeThrottleAppSource(Client *client, Request *req) {
 	if (!req->ended()) {
 		assert(client->output.getBuffersFlushedCallback() == NULL);
 		assert(client->output.getDataFlushedCallback() == getClientOutputDataFlushedCallback());
-		if (responseBufferHighWatermark > 0
-		 && client->output.getTotalBytesBuffered() >= responseBufferHighWatermark)
+		if (appResponseRemainderIsSmall(req)) {
+			SKC_TRACE(client, 3, "Not throttling application socket because only "
+				<< (req->appResponse.aux.bodyInfo.contentLength - req->appResponse.bodyAlreadyRead)
+				<< " bytes of the response body remain");
+			return;
+		}
+
+		boost::uint64_t highWatermark = getResponseBufferHighWatermark(client);
+		if (highWatermark > 0
+		 && client->output.getTotalBytesBuffered() >= highWatermark)
 		{
 			SKC_TRACE(client, 2, "Application is sending response data quicker than the client "
 				"can keep up with. Throttling application socket");
+			req->appSourceThrottledAt = ev_now(getLoop());
+			req->bytesBufferedWhenThrottled = client->output.getTotalBytesBuffered();
 			client->output.setDataFlushedCallback(_outputDataFlushed);
 			req->appSource.stop();
 		} else if (client->output.passedThreshold()) {
@@ -1032,6 +1704,30 @@ Controller::maybeThrottleAppSource(Client *client, Request *req) {
 	}
 }
 
+/**
+ * Once the response header of an upgraded request has been written out,
+ * puts the request in tunnel mode so that its header data and most of its
+ * pool are freed (see HttpServer::enterTunnelMode()). That is only safe
+ * when neither the client output nor the app sink still refer to buffers
+ * in the request pool, so until then this is retried whenever the app
+ * sends data. Requests that are logged to Union Station keep their state,
+ * because logging needs it when the request ends.
+ */
+void
+Controller::maybeEnterTunnelMode(Client *client, Request *req) {
+	if (!req->ended()
+	 && req->upgraded()
+	 && !req->tunneling
+	 && !req->compressResponse
+	 && !req->unionStationUnsampled
+	 && !req->useUnionStation()
+	 && client->output.getTotalBytesBuffered() == 0
+	 && req->appSink.acceptingInput())
+	{
+		enterTunnelMode(client, req);
+	}
+}
+
 void
 Controller::_outputBuffersFlushed(FileBufferedChannel *_channel) {
 	FileBufferedFdSinkChannel *channel = reinterpret_cast<FileBufferedFdSinkChannel *>(_channel);
@@ -1070,16 +1766,54 @@ Controller::_outputDataFlushed(FileBufferedChannel *_channel) {
 
 void
 Controller::outputDataFlushed(Client *client, Request *req) {
-	if (!req->ended()) {
+	if (!req->ended() && req->xSendfileFd != -1) {
+		SKC_TRACE(client, 2, "The client is ready to receive more data. Resuming X-Sendfile body");
+		client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
+		sendXSendfileBody(client, req);
+	} else if (!req->ended()) {
 		assert(!req->appSource.isStarted());
 		SKC_TRACE(client, 2, "The client is ready to receive more data. Resuming application socket");
+		updateResponseDrainRate(client, req);
 		client->output.setDataFlushedCallback(getClientOutputDataFlushedCallback());
 		req->appSource.start();
 	}
 }
 
+/**
+ * Called when the client has received all data that was buffered when the
+ * app source was throttled. Updates the client's drain rate, which is a
+ * moving average so that one stall does not shrink the watermark for good.
+ */
+void
+Controller::updateResponseDrainRate(Client *client, Request *req) {
+	if (req->appSourceThrottledAt == 0) {
+		return;
+	}
+
+	ev_tstamp duration = ev_now(getLoop()) - req->appSourceThrottledAt;
+	req->appSourceThrottledAt = 0;
+	if (duration <= 0) {
+		return;
+	}
+
+	double rate = req->bytesBufferedWhenThrottled / duration;
+	if (client->responseDrainRate < 0) {
+		client->responseDrainRate = rate;
+	} else {
+		client->responseDrainRate = (client->responseDrainRate + rate) / 2;
+	}
+	SKC_TRACE(client, 2, "Client response drain rate: " <<
+		(unsigned long long) client->responseDrainRate << " bytes/sec");
+}
+
 void
 Controller::handleAppResponseBodyEnd(Client *client, Request *req) {
+	if (req->compressResponse) {
+		endResponseCompression(client, req);
+		if (req->ended()) {
+			return;
+		}
+	}
 	keepAliveAppConnection(client, req);
 	storeAppResponseInTurboCache(client, req);
 	finalizeUnionStationWithSuccess(client, req);
@@ -1091,7 +1825,7 @@ Controller::keepAliveAppConnection(Client *client, Request *req) {
 	if (req->halfClosePolicy == Request::HALF_CLOSE_PERFORMED) {
 		SKC_TRACE(client, 2, "Not keep-aliving application session connection"
 			" because it had been half-closed before");
-		req->session->close(true, false);
+		req->session->closeInBatch(true, false, sessionCloseBatch);
 	} else {
 		// halfClosePolicy is initialized in sendHeaderToApp(). That method is
 		// called immediately after checking out a session, before any events
@@ -1099,11 +1833,11 @@ Controller::keepAliveAppConnection(Client *client, Request *req) {
 		assert(req->halfClosePolicy != Request::HALF_CLOSE_POLICY_UNINITIALIZED);
 		if (req->appResponse.wantKeepAlive) {
 			SKC_TRACE(client, 2, "Keep-aliving application session connection");
-			req->session->close(true, true);
+			req->session->closeInBatch(true, true, sessionCloseBatch);
 		} else {
 			SKC_TRACE(client, 2, "Not keep-aliving application session connection"
 				" because application did not allow it");
-			req->session->close(true, false);
+			req->session->closeInBatch(true, false, sessionCloseBatch);
 		}
 	}
 }
@@ -1133,22 +1867,33 @@ Controller::storeAppResponseInTurboCache(Client *client, Request *req) {
 
 			char *pos = entry.body->httpBodyData;
 			const char *end = entry.body->httpBodyData
-				+ ResponseCache<Request>::MAX_BODY_SIZE;
+				+ entry.body->httpBodyCapacity;
 			const LString::Part *part = resp->bodyCacheBuffer.start;
 			while (part != NULL) {
 				pos = appendData(pos, end, part->data, part->size);
 				part = part->next;
 			}
+
+			turboCaching.responseCache.storeInSharedCache(entry);
+			turboCaching.recordStoreSuccess(req->options->appGroupName);
 		} else {
-			SKC_DEBUG(client, "Could not store app response for turbocaching");
+			SKC_DEBUG(client, "Could not store app response for turbocaching: " <<
+				ResponseCache<Request>::getStoreFailureReasonString(
+					entry.storeFailureReason));
+			turboCaching.recordStoreFailure(req->options->appGroupName, req,
+				entry.storeFailureReason);
 		}
 	}
+
+	if (req->leadsCoalescing) {
+		releaseCoalescedRequests(req);
+	}
 }
 
 void
 Controller::finalizeUnionStationWithSuccess(Client *client, Request *req) {
-	req->endStopwatchLog(&req->stopwatchLogs.requestProxying, true);
-	req->endStopwatchLog(&req->stopwatchLogs.requestProcessing, true);
+	req->endStopwatchLog(RequestColdState::SWL_REQUEST_PROXYING, true);
+	req->endStopwatchLog(RequestColdState::SWL_REQUEST_PROCESSING, true);
 }
 
 
@@ -60,18 +60,36 @@ Controller::onBodyBufferData(Channel *_channel, const MemoryKit::mbuf &buffer, i
 	return self->whenSendingRequest_onRequestBody(client, req, buffer, errcode);
 }
 
-#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
-	void
-	Controller::onEventLoopPrepare(EV_P_ struct ev_prepare *w, int revents) {
-		Controller *self = static_cast<Controller *>(w->data);
+void
+Controller::onEventLoopPrepare(EV_P_ struct ev_prepare *w, int revents) {
+	Controller *self = static_cast<Controller *>(w->data);
+	if (!self->sessionCloseBatch.empty()) {
+		self->appPool->closeSessions(self->sessionCloseBatch);
+	}
+
+	self->loopBlockTime = SystemTime::getMonotonicUsec();
+	if (self->loopWakeupTime != 0) {
+		unsigned int busyTime = self->loopBlockTime - self->loopWakeupTime;
+		self->loopIterations++;
+		self->loopBusyTime += busyTime;
+		self->loopIterationTimes.record(busyTime);
+		self->loopMaxIterationTime = std::max(self->loopMaxIterationTime, busyTime);
+	}
+	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		ev_now_update(EV_A);
 		self->timeBeforeBlocking = ev_now(EV_A);
-	}
-#endif
+	#endif
+}
 
 void
 Controller::onEventLoopCheck(EV_P_ struct ev_check *w, int revents) {
 	Controller *self = static_cast<Controller *>(w->data);
+	SystemTime::updateCache();
+	self->loopWakeupTime = SystemTime::getCachedMonotonicUsec();
+	if (self->loopBlockTime != 0) {
+		self->loopBlockedTime += self->loopWakeupTime - self->loopBlockTime;
+	}
+	self->loopCallbacks += ev_pending_count(EV_A);
 	self->turboCaching.updateState(ev_now(EV_A));
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		self->reportLargeTimeDiff(NULL, "Event loop slept",
@@ -87,10 +105,40 @@ Controller::onEventLoopCheck(EV_P_ struct ev_check *w, int revents) {
  ****************************/
 
 
+void
+Controller::onUpdateStatistics() {
+	ParentClass::onUpdateStatistics();
+	lastLoopMaxIterationTime = loopMaxIterationTime;
+	loopMaxIterationTime = 0;
+}
+
 void
 Controller::onClientAccepted(Client *client) {
 	ParentClass::onClientAccepted(client);
 	client->connectedAt = ev_now(getLoop());
+	client->responseDrainRate = -1;
+	if (tenants.empty()) {
+		client->tenant = StaticString();
+	} else {
+		client->tenant = lookupClientTenant(client);
+	}
+	if (acceptClientHandoff && client->tlsSession == NULL && isOnUnixSocket(client)) {
+		client->input.setReceivesFds(true);
+	}
+}
+
+ServerKit::Channel::Result
+Controller::onClientDataReceived(Client *client, const MemoryKit::mbuf &buffer,
+	int errcode)
+{
+	Request *req = client->currentRequest;
+	if (req->httpState == Request::PARSING_HEADERS
+	 && req->stageTimes.headerBegun == 0
+	 && buffer.size() > 0)
+	{
+		req->stageTimes.headerBegun = SystemTime::getMonotonicUsec();
+	}
+	return ParentClass::onClientDataReceived(client, buffer, errcode);
 }
 
 void
@@ -127,19 +175,37 @@ Controller::reinitializeRequest(Client *client, Request *req) {
 	req->state = Request::ANALYZING_REQUEST;
 	req->dechunkResponse = false;
 	req->requestBodyBuffering = false;
+	req->streamingBufferedBody = false;
+	req->requestBodyFdPassing = false;
 	req->https = false;
 	req->stickySession = false;
 	req->sessionCheckoutTry = 0;
 	req->halfClosePolicy = Request::HALF_CLOSE_POLICY_UNINITIALIZED;
 	req->appResponseInitialized = false;
 	req->strip100ContinueHeader = false;
+	req->fileBodyDelegation = false;
 	req->hasPragmaHeader = false;
+	req->acceptsGzip = false;
+	req->compressResponse = false;
+	req->leadsCoalescing = false;
+	req->unionStationUnsampled = false;
+	req->holdsRateLimitSlot = false;
 	req->host = NULL;
+	req->tenant = client->tenant;
 	req->bodyBytesBuffered = 0;
+	req->appSourceThrottledAt = 0;
+	req->bytesBufferedWhenThrottled = 0;
 	req->cacheKey = HashedStaticString();
 	req->cacheControl = NULL;
 	req->varyCookie = NULL;
 	req->envvars = NULL;
+	req->unionStationFilters = NULL;
+	req->xSendfileFd = -1;
+	req->xSendfileOffset = 0;
+	req->xSendfileRemaining = 0;
+	req->coalescingLeader = NULL;
+	req->checkoutCancelled.store(false, boost::memory_order_relaxed);
+	memset(&req->stageTimes, 0, sizeof(req->stageTimes));
 
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		req->timedAppPoolGet = false;
@@ -153,14 +219,43 @@ Controller::reinitializeRequest(Client *client, Request *req) {
 
 void
 Controller::deinitializeRequest(Client *client, Request *req) {
+	P_PROBE1(request__end, req);
+	if (req->leadsCoalescing) {
+		releaseCoalescedRequests(req);
+	}
+	if (req->coalescingLeader != NULL) {
+		LIST_REMOVE(req, nextCoalescingRequest);
+		req->coalescingLeader = NULL;
+	}
+	if (req->holdsRateLimitSlot) {
+		releaseRateLimitSlot(req);
+	}
+
+	endSplicingRequestBody(client, req);
+	if (OXT_UNLIKELY(requestTraceRecorder != NULL)
+	 && req->stageTimes.requestBegun != 0)
+	{
+		recordRequestTrace(req);
+	}
 	req->session.reset();
+	// In case the request is still waiting for a session, tell the
+	// pool that it need not bother anymore.
+	req->checkoutCancelled.store(true, boost::memory_order_relaxed);
 
-	req->endStopwatchLog(&req->stopwatchLogs.getFromPool, false);
-	req->endStopwatchLog(&req->stopwatchLogs.bufferingRequestBody, false);
-	req->endStopwatchLog(&req->stopwatchLogs.requestProxying, false);
-	req->endStopwatchLog(&req->stopwatchLogs.requestProcessing, false);
+	req->endStopwatchLog(RequestColdState::SWL_GET_FROM_POOL, false);
+	req->endStopwatchLog(RequestColdState::SWL_BUFFERING_REQUEST_BODY, false);
+	req->endStopwatchLog(RequestColdState::SWL_REQUEST_PROXYING, false);
+	req->endStopwatchLog(RequestColdState::SWL_REQUEST_PROCESSING, false);
 
-	req->options.transaction.reset();
+	if (req->unionStationUnsampled) {
+		logUnsampledRequestToUnionStation(client, req);
+	}
+	recordRequestStageTimes(req);
+	req->options.reset();
+	req->poolOptions.reset();
+	if (req->cold != NULL) {
+		req->cold->checkoutOptions.detachFromUnionStationTransaction();
+	}
 
 	req->appSink.setConsumedCallback(NULL);
 	req->appSink.deinitialize();
@@ -168,6 +263,18 @@ Controller::deinitializeRequest(Client *client, Request *req) {
 	req->bodyBuffer.clearBuffersFlushedCallback();
 	req->bodyBuffer.deinitialize();
 
+	if (req->xSendfileFd != -1) {
+		safelyClose(req->xSendfileFd, true);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(req->xSendfileFd);
+		req->xSendfileFd = -1;
+	}
+
+	if (req->compressionStream != NULL) {
+		deflateEnd(req->compressionStream);
+		delete req->compressionStream;
+		req->compressionStream = NULL;
+	}
+
 	/***************/
 	/***************/
 
@@ -200,6 +307,7 @@ Controller::reinitializeAppResponse(Client *client, Request *req) {
 	resp->cacheControl = NULL;
 	resp->expiresHeader = NULL;
 	resp->lastModifiedHeader = NULL;
+	resp->varyHeader = NULL;
 
 	resp->headerCacheBuffers = NULL;
 	resp->nHeaderCacheBuffers = 0;
@@ -219,6 +327,13 @@ Controller::deinitializeAppResponse(Client *client, Request *req) {
 		resp->parserState.headerParser = NULL;
 	}
 
+	deinitializeAppResponseHeaders(req);
+}
+
+void
+Controller::deinitializeAppResponseHeaders(Request *req) {
+	AppResponse *resp = &req->appResponse;
+
 	ServerKit::HeaderTable::Iterator it(resp->headers);
 	while (*it != NULL) {
 		psg_lstr_deinit(&it->header->key);
@@ -244,10 +359,160 @@ Controller::deinitializeAppResponse(Client *client, Request *req) {
 	psg_lstr_deinit(&resp->bodyCacheBuffer);
 }
 
+void
+Controller::compactRequestForTunnel(Client *client, Request *req) {
+	AppResponse *resp = &req->appResponse;
+
+	// Keep the host around for logging, e.g. when the connection
+	// is aborted because the app process shuts down.
+	if (req->host != NULL) {
+		req->host = psg_lstr_null_terminate(req->host, req->pool);
+	}
+	req->cacheKey = HashedStaticString();
+	req->cacheControl = NULL;
+	req->varyCookie = NULL;
+	req->envvars = NULL;
+	req->unionStationFilters = NULL;
+
+	if (req->appResponseInitialized) {
+		deinitializeAppResponseHeaders(req);
+		resp->date = NULL;
+		resp->setCookie = NULL;
+		resp->cacheControl = NULL;
+		resp->expiresHeader = NULL;
+		resp->lastModifiedHeader = NULL;
+		resp->varyHeader = NULL;
+		resp->headerCacheBuffers = NULL;
+		resp->nHeaderCacheBuffers = 0;
+	}
+
+	ParentClass::compactRequestForTunnel(client, req);
+	req->appSource.setReleaseBufferWhenIdle(true);
+}
+
+/**
+ * Adds the durations of the stages that this request went through to
+ * the latency histograms of its application group.
+ */
+void
+Controller::recordRequestStageTimes(Request *req) {
+	const Request::StageTimes &times = req->stageTimes;
+
+	if (times.checkoutBegun == 0 || req->options == NULL) {
+		// The request never made it to the application pool, e.g.
+		// because it was served from the turbocache.
+		return;
+	}
+
+	const HashedStaticString &appGroupName = req->options->getAppGroupName();
+
+	RequestStageHistograms *histograms;
+	if (!requestStageHistograms.lookup(appGroupName, &histograms)) {
+		requestStageHistograms.insert(appGroupName, RequestStageHistograms());
+		requestStageHistograms.lookup(appGroupName, &histograms);
+	}
+
+	#define RECORD_STAGE(stage, begin, end) \
+		do { \
+			if ((begin) != 0 && (end) >= (begin)) { \
+				histograms->stages[stage].record((end) - (begin)); \
+			} \
+		} while (false)
+
+	RECORD_STAGE(RS_HEADER_PARSE, times.headerBegun, times.requestBegun);
+	RECORD_STAGE(RS_SESSION_CHECKOUT, times.checkoutBegun, times.sessionCheckedOut);
+	if (times.sessionInitiated != 0) {
+		RECORD_STAGE(RS_APP_CONNECT, times.sessionCheckedOut, times.sessionInitiated);
+		RECORD_STAGE(RS_APP_FIRST_BYTE, times.sessionInitiated, times.appResponseBegun);
+	}
+	if (times.appResponseBegun != 0) {
+		RECORD_STAGE(RS_RESPONSE_TRANSFER, times.appResponseBegun,
+			SystemTime::getMonotonicUsec());
+	}
+
+	#undef RECORD_STAGE
+}
+
+/**
+ * Records 1 in `requestTraceRecorder->getSampleRate()` requests into the
+ * request trace. Must be called before the request's session is released.
+ */
+void
+Controller::recordRequestTrace(Request *req) {
+	if (requestTraceCountdown > 1) {
+		requestTraceCountdown--;
+		return;
+	}
+	requestTraceCountdown = requestTraceRecorder->getSampleRate();
+
+	const Request::StageTimes &times = req->stageTimes;
+	MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+	MonotonicTimeUsec begun = (times.headerBegun != 0)
+		? times.headerBegun
+		: times.requestBegun;
+	RequestTraceRecord record;
+
+	#define DURATION(begin, end) \
+		(((begin) != 0 && (end) >= (begin)) \
+			? (boost::uint32_t) std::min<MonotonicTimeUsec>((end) - (begin), 0xFFFFFFFFu) \
+			: 0)
+
+	record.arrivalTime = SystemTime::getUsec() - (now - begun);
+	record.requestBodySize = req->bodyAlreadyRead;
+	record.responseSize = req->responseBytesWritten;
+	if (req->path.size > 0) {
+		record.pathHash = requestTraceRecorder->hash(req->path.start->data,
+			(req->queryStringIndex == -1) ? req->path.size : req->queryStringIndex);
+	} else {
+		record.pathHash = 0;
+	}
+	if (req->options != NULL) {
+		const HashedStaticString &appGroupName = req->options->getAppGroupName();
+		record.appGroupHash = requestTraceRecorder->hash(appGroupName.data(),
+			appGroupName.size());
+	} else {
+		record.appGroupHash = 0;
+	}
+	record.headerSize = req->headerBytesRead;
+	record.queueTime = DURATION(times.checkoutBegun, times.sessionCheckedOut);
+	record.serviceTime = DURATION(times.sessionInitiated, times.appResponseBegun);
+	record.totalTime = DURATION(begun, now);
+	record.pid = (req->session != NULL) ? req->session->getPid() : 0;
+	record.statusCode = req->appResponseInitialized
+		? req->appResponse.statusCode
+		: 0;
+	record.method = req->method;
+
+	#undef DURATION
+
+	record.flags = 0;
+	if (times.checkoutBegun != 0) {
+		record.flags |= RequestTraceRecorder::RTF_CHECKED_OUT;
+	}
+	if (times.appResponseBegun != 0) {
+		record.flags |= RequestTraceRecorder::RTF_APP_RESPONDED;
+	}
+	if (req->wantKeepAlive) {
+		record.flags |= RequestTraceRecorder::RTF_KEEP_ALIVE;
+	}
+	if (req->https) {
+		record.flags |= RequestTraceRecorder::RTF_HTTPS;
+	}
+	if (req->upgraded()) {
+		record.flags |= RequestTraceRecorder::RTF_UPGRADED;
+	}
+
+	requestTraceRecorder->record(record);
+}
+
 ServerKit::Channel::Result
 Controller::onRequestBody(Client *client, Request *req, const MemoryKit::mbuf &buffer,
 	int errcode)
 {
+	if (req->streamingBufferedBody) {
+		return whenBufferingBody_onRequestBody(client, req, buffer, errcode);
+	}
+
 	switch (req->state) {
 	case Request::BUFFERING_REQUEST_BODY:
 		return whenBufferingBody_onRequestBody(client, req, buffer, errcode);
@@ -268,7 +533,7 @@ Controller::onNextRequestEarlyReadError(Client *client, Request *req, int errcod
 			<< ServerKit::getErrorDesc(errcode) << " (errno=" << errcode << ")");
 		req->halfClosePolicy = Request::HALF_CLOSE_PERFORMED;
 		assert(req->session != NULL);
-		::shutdown(req->session->fd(), SHUT_WR);
+		req->appSink.halfClose();
 	}
 }
 
@@ -277,6 +542,16 @@ Controller::shouldDisconnectClientOnShutdown(Client *client) {
 	return ParentClass::shouldDisconnectClientOnShutdown(client) || !gracefulExit;
 }
 
+void
+Controller::onShutdown(bool forceDisconnect) {
+	ParentClass::onShutdown(forceDisconnect);
+	// Shutdown waits for all clients, so don't let them linger until
+	// their turn in the drain window.
+	disconnectDrainingConnections(true);
+	saveTurboCacheSnapshot();
+	closeOpenStaticFiles();
+}
+
 bool
 Controller::supportsUpgrade(Client *client, Request *req) {
 	return true;
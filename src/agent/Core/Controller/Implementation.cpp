@@ -29,6 +29,7 @@
 #include <Core/Controller/BufferBody.cpp>
 #include <Core/Controller/CheckoutSession.cpp>
 #include <Core/Controller/SendRequest.cpp>
+#include <Core/Controller/StaticFiles.cpp>
 #include <Core/Controller/ForwardResponse.cpp>
 #include <Core/Controller/Hooks.cpp>
 #include <Core/Controller/InitializationAndShutdown.cpp>
@@ -53,8 +53,91 @@ struct Controller::RequestAnalysis {
 };
 
 
+/**
+ * Returns whether the given Accept-Encoding header value allows a
+ * gzip-compressed response. That is the case if it lists `gzip`, `x-gzip`
+ * or `*` with a non-zero quality value, and doesn't explicitly refuse gzip
+ * with `gzip;q=0`.
+ */
+static bool
+acceptEncodingAllowsGzip(const LString *value) {
+	if (value == NULL || value->size == 0) {
+		return false;
+	}
+
+	const char *pos = value->start->data;
+	const char *end = value->start->data + value->size;
+	int gzip = -1, wildcard = -1;
+
+	while (pos < end) {
+		const char *codingEnd;
+		StaticString coding;
+		bool accepted = true;
+
+		while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ',')) {
+			pos++;
+		}
+		codingEnd = pos;
+		while (codingEnd < end && *codingEnd != ',' && *codingEnd != ';'
+			&& *codingEnd != ' ' && *codingEnd != '\t')
+		{
+			codingEnd++;
+		}
+		coding = StaticString(pos, codingEnd - pos);
+		pos = codingEnd;
+
+		// Parse parameters. Only the quality value is relevant.
+		while (pos < end && *pos != ',') {
+			if (*pos == ';') {
+				pos++;
+				while (pos < end && (*pos == ' ' || *pos == '\t')) {
+					pos++;
+				}
+				if (end - pos >= 2 && (pos[0] == 'q' || pos[0] == 'Q') && pos[1] == '=') {
+					// The quality value is zero if it only consists of
+					// zeroes, optionally with a decimal point.
+					pos += 2;
+					accepted = false;
+					while (pos < end && *pos != ',' && *pos != ';'
+						&& *pos != ' ' && *pos != '\t')
+					{
+						if (*pos != '0' && *pos != '.') {
+							accepted = true;
+						}
+						pos++;
+					}
+					continue;
+				}
+			}
+			pos++;
+		}
+
+		if (equalsCaseInsensitive(coding, P_STATIC_STRING("gzip"))
+		 || equalsCaseInsensitive(coding, P_STATIC_STRING("x-gzip")))
+		{
+			gzip = accepted;
+		} else if (coding == "*") {
+			wildcard = accepted;
+		}
+	}
+
+	if (gzip != -1) {
+		return gzip;
+	} else {
+		return wildcard == 1;
+	}
+}
+
+
 void
 Controller::initializeFlags(Client *client, Request *req, RequestAnalysis &analysis) {
+	bool handedOff = false;
+
+	// Requests on TLS connections that we terminate ourselves are HTTPS,
+	// just like requests that the web server in front flags as such.
+	if (client->tlsSession != NULL) {
+		req->https = true;
+	}
 	if (analysis.flags != NULL) {
 		const LString::Part *part = analysis.flags->start;
 		while (part != NULL) {
@@ -74,6 +157,12 @@ Controller::initializeFlags(Client *client, Request *req, RequestAnalysis &analy
 				case 'C':
 					req->strip100ContinueHeader = true;
 					break;
+				case 'F':
+					req->fileBodyDelegation = true;
+					break;
+				case 'H':
+					handedOff = true;
+					break;
 				default:
 					break;
 				}
@@ -95,12 +184,68 @@ Controller::initializeFlags(Client *client, Request *req, RequestAnalysis &analy
 			if (req->strip100ContinueHeader) {
 				SKC_TRACE(client, 2, "Stripping 100 Continue header");
 			}
+			if (req->fileBodyDelegation) {
+				SKC_TRACE(client, 2, "File body delegation enabled");
+			}
+		}
+	}
+
+	if (handedOff) {
+		takeOverHandedOffClient(client, req);
+	}
+}
+
+/**
+ * The web server can hand off a request to us together with the HTTP
+ * client's connection, so that it doesn't have to tie up a thread while
+ * we forward the response to a slow client. It then passes the client
+ * socket along with the request header ('H' flag), and closes its
+ * connection to us without reading the response.
+ *
+ * We put the client socket in the place of the web server's connection,
+ * so that the rest of the request is handled as if the client had
+ * connected to us directly. The connection can't be kept alive though:
+ * the client's next request wouldn't carry the web server's secure headers.
+ */
+void
+Controller::takeOverHandedOffClient(Client *client, Request *req) {
+	int fd = client->input.takePassedFd();
+	int ret;
+
+	if (fd == -1) {
+		disconnectWithError(&client, "the web server handed off a client "
+			"connection without passing its socket");
+		return;
+	}
+
+	try {
+		// Apache's sockets are usually, but not necessarily, non-blocking.
+		setNonBlocking(fd);
+		do {
+			ret = dup2(fd, client->getFd());
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			int e = errno;
+			throw SystemException("dup2() failed", e);
 		}
+	} catch (const SystemException &e) {
+		safelyClose(fd, true);
+		disconnectWithError(&client, string("cannot take over a handed off "
+			"client connection: ") + e.what());
+		return;
 	}
+	safelyClose(fd, true);
+
+	client->input.setReceivesFds(false);
+	client->input.watchReplacedFd();
+	client->output.watchReplacedFd();
+	client->onUnixSocket = 0;
+	req->wantKeepAlive = false;
+	SKC_DEBUG(client, "Took over the client connection that the web server handed off");
 }
 
 bool
-Controller::respondFromTurboCache(Client *client, Request *req) {
+Controller::respondFromTurboCache(Client *client, Request *req, RequestAnalysis &analysis) {
 	if (!turboCaching.isEnabled() || !turboCaching.responseCache.prepareRequest(this, req)) {
 		return false;
 	}
@@ -110,36 +255,87 @@ Controller::respondFromTurboCache(Client *client, Request *req) {
 	SKC_TRACE(client, 2, "Turbocache entries:\n" << turboCaching.responseCache.inspect());
 
 	if (turboCaching.responseCache.requestAllowsFetching(req)) {
-		ResponseCache<Request>::Entry entry(turboCaching.responseCache.fetch(req,
-			ev_now(getLoop())));
-		if (entry.valid()) {
-			SKC_TRACE(client, 2, "Turbocaching: cache hit (key \"" <<
-				cEscapeString(req->cacheKey) << "\")");
-			turboCaching.writeResponse(this, client, req, entry);
-			if (!req->ended()) {
-				endRequest(&client, &req);
-			}
-			return true;
+		return writeTurboCachedResponse(client, req,
+			getAppGroupNameForTurboCaching(req, analysis));
+	} else {
+		SKC_TRACE(client, 2, "Turbocaching: request not eligible for caching");
+		return false;
+	}
+}
+
+/**
+ * req->options is not set yet when the request is first looked up
+ * in the turbocache, so this determines the application group name for
+ * the turbocaching statistics in the same way that
+ * initializePoolOptions() does.
+ */
+StaticString
+Controller::getAppGroupNameForTurboCaching(Request *req, RequestAnalysis &analysis) {
+	if (singleAppMode) {
+		boost::shared_ptr<Options> *options;
+		poolOptionsCache.lookupRandom(NULL, &options);
+		return (*options)->appGroupName;
+	} else if (analysis.appGroupNameCell != NULL) {
+		const LString *appGroupName = psg_lstr_make_contiguous(
+			&analysis.appGroupNameCell->header->val,
+			req->pool);
+		return StaticString(appGroupName->start->data, appGroupName->size);
+	} else {
+		return StaticString();
+	}
+}
+
+// @pre turboCaching.responseCache.requestAllowsFetching(req)
+bool
+Controller::writeTurboCachedResponse(Client *client, Request *req,
+	const StaticString &appGroupName)
+{
+	ResponseCache<Request>::Entry entry(turboCaching.responseCache.fetch(req,
+		ev_now(getLoop())));
+	if (entry.valid()) {
+		P_PROBE1(turbocache__hit, req);
+		SKC_TRACE(client, 2, "Turbocaching: cache hit (key \"" <<
+			cEscapeString(req->cacheKey) << "\")");
+		bool notModified = turboCaching.responseCache.requestIsNotModified(req, entry);
+		boost::uint64_t start = 0, end = 0;
+		int range = notModified ? 0
+			: turboCaching.responseCache.getRequestedByteRange(req, entry, start, end);
+		turboCaching.recordFetch(appGroupName, entry, notModified);
+		if (notModified) {
+			SKC_TRACE(client, 2, "Turbocaching: client's copy is still valid, "
+				"responding with 304 Not Modified");
+			recordResponseStatus(304);
+			turboCaching.writeNotModifiedResponse(this, client, req, entry);
+		} else if (range != 0) {
+			SKC_TRACE(client, 2, "Turbocaching: responding with a byte range");
+			recordResponseStatus(range == 1 ? 206 : 416);
+			turboCaching.writePartialResponse(this, client, req, entry,
+				range == 1, start, end);
 		} else {
-			SKC_TRACE(client, 2, "Turbocaching: cache miss: " <<
-				entry.getCacheMissReasonString() <<
-				" (key \"" << cEscapeString(req->cacheKey) << "\")");
-			return false;
+			recordResponseStatus(entry.body->statusCode);
+			turboCaching.writeResponse(this, client, req, entry);
+		}
+		if (!req->ended()) {
+			endRequest(&client, &req);
 		}
+		return true;
 	} else {
-		SKC_TRACE(client, 2, "Turbocaching: request not eligible for caching");
+		P_PROBE1(turbocache__miss, req);
+		turboCaching.recordFetch(appGroupName, entry, false);
+		SKC_TRACE(client, 2, "Turbocaching: cache miss: " <<
+			entry.getCacheMissReasonString() <<
+			" (key \"" << cEscapeString(req->cacheKey) << "\")");
 		return false;
 	}
 }
 
 void
 Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis &analysis) {
-	boost::shared_ptr<Options> *options;
+	boost::shared_ptr<Options> *options = NULL;
 
 	if (singleAppMode) {
 		P_ASSERT_EQ(poolOptionsCache.size(), 1);
 		poolOptionsCache.lookupRandom(NULL, &options);
-		req->options = **options;
 	} else {
 		ServerKit::HeaderTable::Cell *appGroupNameCell = analysis.appGroupNameCell;
 		if (appGroupNameCell != NULL && appGroupNameCell->header->val.size > 0) {
@@ -148,13 +344,20 @@ Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis
 				req->pool);
 			HashedStaticString hAppGroupName(appGroupName->start->data,
 				appGroupName->size);
+			HashedStaticString groupKey = getGroupKey(client, req, hAppGroupName);
 
-			poolOptionsCache.lookup(hAppGroupName, &options);
+			poolOptionsCache.lookup(groupKey, &options);
+			if (options != NULL && OXT_UNLIKELY(!documentRootSymlinks.empty())
+			 && documentRootSymlinkChanged(client, req, groupKey))
+			{
+				options = NULL;
+			}
 
-			if (options != NULL) {
-				req->options = **options;
-			} else {
-				createNewPoolOptions(client, req, hAppGroupName);
+			if (options == NULL) {
+				createNewPoolOptions(client, req, hAppGroupName, groupKey);
+				if (!req->ended()) {
+					poolOptionsCache.lookup(groupKey, &options);
+				}
 			}
 		} else {
 			disconnectWithError(&client, "the !~PASSENGER_APP_GROUP_NAME header must be set");
@@ -163,55 +366,98 @@ Controller::initializePoolOptions(Client *client, Request *req, RequestAnalysis
 
 	if (!req->ended()) {
 		// See comment for req->envvars to learn how it is different
-		// from req->options.environmentVariables.
+		// from req->options->environmentVariables.
 		req->envvars = req->secureHeaders.lookup(PASSENGER_ENV_VARS);
 		if (req->envvars != NULL && req->envvars->size > 0) {
 			req->envvars = psg_lstr_make_contiguous(req->envvars, req->pool);
-			req->options.environmentVariables = StaticString(
-				req->envvars->start->data,
-				req->envvars->size);
 		}
 
-		fillPoolOption(req, req->options.maxRequests, PASSENGER_MAX_REQUESTS);
+		updatePoolOptionsFromRequest(req, *options);
+		req->options = *options;
 	}
 }
 
+/**
+ * The environment variables and the maximum number of requests are sent
+ * along with every request, instead of only with the request that creates
+ * the pool options. They normally never change, so instead of applying
+ * them to a copy of the pool options for every request, we replace the
+ * shared pool options in the cache when they do change. Requests that
+ * still refer to the old pool options keep them alive.
+ */
 void
-Controller::fillPoolOptionsFromAgentsOptions(Options &options) {
-	options.ruby = defaultRuby;
-	if (agentsOptions->has("default_nodejs")) {
-		options.nodejs = agentsOptions->get("default_nodejs");
-	}
-	if (agentsOptions->has("default_python")) {
-		options.python = agentsOptions->get("default_python");
-	}
-	if (agentsOptions->has("meteor_app_settings")) {
-		options.meteorAppSettings = agentsOptions->get("meteor_app_settings");
+Controller::updatePoolOptionsFromRequest(Request *req, boost::shared_ptr<Options> &options) {
+	StaticString environmentVariables = options->environmentVariables;
+	unsigned long maxRequests = options->maxRequests;
+
+	if (req->envvars != NULL && req->envvars->size > 0) {
+		environmentVariables = StaticString(req->envvars->start->data,
+			req->envvars->size);
 	}
-	if (agentsOptions->has("app_file_descriptor_ulimit")) {
-		options.fileDescriptorUlimit = agentsOptions->getUint("app_file_descriptor_ulimit");
+	fillPoolOption(req, maxRequests, PASSENGER_MAX_REQUESTS);
+
+	if (environmentVariables != options->environmentVariables
+	 || maxRequests != options->maxRequests)
+	{
+		boost::shared_ptr<Options> newOptions = boost::make_shared<Options>(*options);
+		newOptions->environmentVariables = environmentVariables;
+		newOptions->maxRequests = maxRequests;
+		newOptions->persist(*newOptions);
+		newOptions->enableGroupLookupCache();
+		options = newOptions;
 	}
+}
+
+void
+Controller::fillPoolOptionsFromAgentsOptions(Options &options) {
+	const ControllerOptions &o = controllerOptions;
+
+	options.ruby = defaultRuby;
+	options.nodejs = o.defaultNodejs;
+	options.python = o.defaultPython;
+	options.meteorAppSettings = o.meteorAppSettings;
+	options.fileDescriptorUlimit = o.appFileDescriptorUlimit;
 
 	options.logLevel = getLogLevel();
-	options.integrationMode = agentsOptions->get("integration_mode",
-		false, DEFAULT_INTEGRATION_MODE);
+	options.integrationMode = o.integrationMode;
 	options.ustRouterAddress = ustRouterAddress;
 	options.ustRouterUsername = P_STATIC_STRING("logging");
 	options.ustRouterPassword = ustRouterPassword;
-	options.userSwitching = agentsOptions->getBool("user_switching");
-	if (agentsOptions->has("default_user")) {
-		options.defaultUser = agentsOptions->get("default_user");
-	}
-	if (agentsOptions->has("default_group")) {
-		options.defaultGroup = agentsOptions->get("default_group");
-	}
-	options.minProcesses = agentsOptions->getInt("min_instances");
-	options.maxPreloaderIdleTime = agentsOptions->getInt("max_preloader_idle_time");
-	options.maxRequestQueueSize = agentsOptions->getInt("max_request_queue_size");
-	options.abortWebsocketsOnProcessShutdown = agentsOptions->getBool("abort_websockets_on_process_shutdown");
-	options.forceMaxConcurrentRequestsPerProcess = agentsOptions->getInt("force_max_concurrent_requests_per_process");
-	options.spawnMethod = agentsOptions->get("spawn_method");
-	options.loadShellEnvvars = agentsOptions->getBool("load_shell_envvars");
+	options.userSwitching = o.userSwitching;
+	options.defaultUser = o.defaultUser;
+	options.defaultGroup = o.defaultGroup;
+	options.minProcesses = o.minInstances;
+	options.spawnConcurrency = o.spawnConcurrency;
+	options.targetUtilization = o.targetUtilization;
+	options.preloaderStandbyProcesses = o.preloaderStandbyProcesses;
+	options.recycleJitter = o.recycleJitter;
+	options.capacityWeight = o.capacityWeight;
+	options.maxOutOfBandWorkPercentage = o.maxOutOfBandWorkPercentage;
+	options.outOfBandWorkMaxUtilization = o.outOfBandWorkMaxUtilization;
+	options.outOfBandWorkIdleInterval = o.outOfBandWorkIdleInterval;
+	options.memoryLimit = o.memoryLimit;
+	options.warmupTime = o.warmupTime;
+	options.rollingRestart = o.rollingRestarts;
+	options.rollingRestartBatchSize = o.rollingRestartBatchSize;
+	options.maxPreloaderIdleTime = o.maxPreloaderIdleTime;
+	options.maxRequestQueueSize = o.maxRequestQueueSize;
+	options.requestQueueTargetDelay = o.requestQueueTargetDelay;
+	options.rateLimit = o.rateLimit;
+	options.rateLimitBurst = o.rateLimitBurst;
+	options.maxRequestsInFlight = o.maxRequestsInFlight;
+	options.abortWebsocketsOnProcessShutdown = o.abortWebsocketsOnProcessShutdown;
+	options.forceMaxConcurrentRequestsPerProcess = o.forceMaxConcurrentRequestsPerProcess;
+	options.spawnMethod = o.spawnMethod;
+	options.routingPolicy = o.routingPolicy;
+	options.cpuAffinity = o.appCpuAffinity;
+	options.healthCheckPath = o.healthCheckPath;
+	options.healthCheckInterval = o.healthCheckInterval;
+	options.healthCheckTimeout = o.healthCheckTimeout;
+	options.unresponsiveProcessTimeout = o.unresponsiveProcessTimeout;
+	options.healthCheckEjectionTime = o.healthCheckEjectionTime;
+	options.loadShellEnvvars = o.loadShellEnvvars;
+	options.preloaderCompactHeap = o.preloaderCompactHeap;
+	options.preloaderWarmupScript = o.preloaderWarmupScript;
 	options.statThrottleRate = statThrottleRate;
 
 	/******************************/
@@ -293,17 +539,53 @@ Controller::fillPoolOptionSecToMsec(Request *req, unsigned int &field,
 	}
 }
 
+/**
+ * Checks whether the document root symlink that the cached pool options
+ * of the given app group were derived from now refers to a different
+ * path, for example because a deploy switched a `current` symlink.
+ * The symlink is read at most once per `statThrottleRate` seconds, so
+ * that this costs nothing on most requests. If the symlink cannot be
+ * read then the cached pool options are kept.
+ */
+bool
+Controller::documentRootSymlinkChanged(Client *client, Request *req,
+	const HashedStaticString &groupKey)
+{
+	DocumentRootSymlink *symlink;
+	ev_tstamp now = ev_now(getLoop());
+
+	if (!documentRootSymlinks.lookup(groupKey, &symlink)
+	 || now - symlink->lastCheckTime < statThrottleRate)
+	{
+		return false;
+	}
+
+	symlink->lastCheckTime = now;
+	try {
+		const LString *target = resolveSymlink(symlink->path, req->pool);
+		if (StaticString(target->start->data, target->size) == symlink->target) {
+			return false;
+		}
+		SKC_NOTICE(client, "Document root " << symlink->path << " now refers to "
+			<< StaticString(target->start->data, target->size)
+			<< " instead of " << symlink->target
+			<< "; recomputing pool options");
+		return true;
+	} catch (const FileSystemException &e) {
+		SKC_WARN(client, e.what());
+		return false;
+	}
+}
+
 void
 Controller::createNewPoolOptions(Client *client, Request *req,
-	const HashedStaticString &appGroupName)
+	const HashedStaticString &appGroupName, const HashedStaticString &groupKey)
 {
 	ServerKit::HeaderTable &secureHeaders = req->secureHeaders;
-	Options &options = req->options;
+	Options options;
 
 	SKC_TRACE(client, 2, "Creating new pool options: app group name=" << appGroupName);
 
-	options = Options();
-
 	const LString *scriptName = secureHeaders.lookup("!~SCRIPT_NAME");
 	const LString *appRoot = secureHeaders.lookup("!~PASSENGER_APP_ROOT");
 	if (scriptName == NULL || scriptName->size == 0) {
@@ -331,8 +613,18 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 			}
 
 			documentRoot = psg_lstr_null_terminate(documentRoot, req->pool);
-			documentRoot = resolveSymlink(StaticString(documentRoot->start->data,
-				documentRoot->size), req->pool);
+			StaticString symlinkPath(documentRoot->start->data, documentRoot->size);
+			documentRoot = resolveSymlink(symlinkPath, req->pool);
+			if (symlinkPath != StaticString(documentRoot->start->data, documentRoot->size)) {
+				DocumentRootSymlink symlink;
+				symlink.path = symlinkPath;
+				symlink.target = StaticString(documentRoot->start->data,
+					documentRoot->size);
+				symlink.lastCheckTime = ev_now(getLoop());
+				documentRootSymlinks.insert(groupKey, symlink);
+			} else if (!documentRootSymlinks.empty()) {
+				documentRootSymlinks.erase(groupKey);
+			}
 			appRoot = psg_lstr_create(req->pool,
 				extractDirNameStatic(StaticString(documentRoot->start->data,
 					documentRoot->size)));
@@ -360,6 +652,7 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	}
 
 	options.appGroupName = appGroupName;
+	options.tenant = client->tenant;
 
 	fillPoolOption(req, options.appType, "!~PASSENGER_APP_TYPE");
 	fillPoolOption(req, options.environment, "!~PASSENGER_APP_ENV");
@@ -371,16 +664,41 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	fillPoolOption(req, options.group, "!~PASSENGER_GROUP");
 	fillPoolOption(req, options.minProcesses, "!~PASSENGER_MIN_PROCESSES");
 	fillPoolOption(req, options.maxProcesses, "!~PASSENGER_MAX_PROCESSES");
+	fillPoolOption(req, options.spawnConcurrency, "!~PASSENGER_SPAWN_CONCURRENCY");
+	fillPoolOption(req, options.targetUtilization, "!~PASSENGER_TARGET_UTILIZATION");
+	fillPoolOption(req, options.preloaderStandbyProcesses, "!~PASSENGER_PRELOADER_STANDBY_PROCESSES");
+	fillPoolOption(req, options.recycleJitter, "!~PASSENGER_RECYCLE_JITTER");
+	fillPoolOption(req, options.capacityWeight, "!~PASSENGER_CAPACITY_WEIGHT");
+	fillPoolOption(req, options.maxOutOfBandWorkPercentage, "!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE");
+	fillPoolOption(req, options.outOfBandWorkMaxUtilization, "!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION");
+	fillPoolOption(req, options.outOfBandWorkIdleInterval, "!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL");
+	fillPoolOption(req, options.memoryLimit, "!~PASSENGER_MEMORY_LIMIT");
+	fillPoolOption(req, options.warmupTime, "!~PASSENGER_WARMUP_TIME");
+	fillPoolOption(req, options.rollingRestart, "!~PASSENGER_ROLLING_RESTARTS");
+	fillPoolOption(req, options.rollingRestartBatchSize, "!~PASSENGER_ROLLING_RESTART_BATCH_SIZE");
 	fillPoolOption(req, options.spawnMethod, "!~PASSENGER_SPAWN_METHOD");
+	fillPoolOption(req, options.routingPolicy, "!~PASSENGER_ROUTING_POLICY");
+	fillPoolOption(req, options.cpuAffinity, "!~PASSENGER_APP_CPU_AFFINITY");
+	fillPoolOption(req, options.healthCheckPath, "!~PASSENGER_HEALTH_CHECK_PATH");
+	fillPoolOption(req, options.healthCheckInterval, "!~PASSENGER_HEALTH_CHECK_INTERVAL");
+	fillPoolOption(req, options.healthCheckTimeout, "!~PASSENGER_HEALTH_CHECK_TIMEOUT");
+	fillPoolOption(req, options.unresponsiveProcessTimeout, "!~PASSENGER_UNRESPONSIVE_PROCESS_TIMEOUT");
+	fillPoolOption(req, options.healthCheckEjectionTime, "!~PASSENGER_HEALTH_CHECK_EJECTION_TIME");
 	fillPoolOption(req, options.startCommand, "!~PASSENGER_START_COMMAND");
 	fillPoolOptionSecToMsec(req, options.startTimeout, "!~PASSENGER_START_TIMEOUT");
 	fillPoolOption(req, options.maxPreloaderIdleTime, "!~PASSENGER_MAX_PRELOADER_IDLE_TIME");
 	fillPoolOption(req, options.maxRequestQueueSize, "!~PASSENGER_MAX_REQUEST_QUEUE_SIZE");
+	fillPoolOption(req, options.requestQueueTargetDelay, "!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY");
+	fillPoolOption(req, options.rateLimit, "!~PASSENGER_RATE_LIMIT");
+	fillPoolOption(req, options.rateLimitBurst, "!~PASSENGER_RATE_LIMIT_BURST");
+	fillPoolOption(req, options.maxRequestsInFlight, "!~PASSENGER_MAX_REQUESTS_IN_FLIGHT");
 	fillPoolOption(req, options.abortWebsocketsOnProcessShutdown, "!~PASSENGER_ABORT_WEBSOCKETS_ON_PROCESS_SHUTDOWN");
 	fillPoolOption(req, options.forceMaxConcurrentRequestsPerProcess, "!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS");
 	fillPoolOption(req, options.restartDir, "!~PASSENGER_RESTART_DIR");
 	fillPoolOption(req, options.startupFile, "!~PASSENGER_STARTUP_FILE");
 	fillPoolOption(req, options.loadShellEnvvars, "!~PASSENGER_LOAD_SHELL_ENVVARS");
+	fillPoolOption(req, options.preloaderCompactHeap, "!~PASSENGER_PRELOADER_COMPACT_HEAP");
+	fillPoolOption(req, options.preloaderWarmupScript, "!~PASSENGER_PRELOADER_WARMUP_SCRIPT");
 	fillPoolOption(req, options.fileDescriptorUlimit, "!~PASSENGER_APP_FILE_DESCRIPTOR_ULIMIT");
 	fillPoolOption(req, options.raiseInternalError, "!~PASSENGER_RAISE_INTERNAL_ERROR");
 	fillPoolOption(req, options.lveMinUid, "!~PASSENGER_LVE_MIN_UID");
@@ -390,13 +708,14 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	optionsCopy->persist(options);
 	optionsCopy->clearPerRequestFields();
 	optionsCopy->detachFromUnionStationTransaction();
-	poolOptionsCache.insert(options.getAppGroupName(), optionsCopy);
+	optionsCopy->enableGroupLookupCache();
+	poolOptionsCache.insert(groupKey, optionsCopy);
 }
 
 void
 Controller::initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis) {
 	if (analysis.unionStationSupport) {
-		Options &options = req->options;
+		RequestPoolOptions &options = req->poolOptions;
 		ServerKit::HeaderTable &headers = req->secureHeaders;
 
 		const LString *key = headers.lookup("!~UNION_STATION_KEY");
@@ -411,8 +730,20 @@ Controller::initializeUnionStation(Client *client, Request *req, RequestAnalysis
 			filters = psg_lstr_make_contiguous(filters, req->pool);
 		}
 
+		if (!shouldSampleUnionStationRequest(req)) {
+			// Skip all per-request logging. Group-level analytics and
+			// spawn error logging still need the key, and
+			// logUnsampledRequestToUnionStation() may still log the
+			// request once it has ended.
+			options.analytics = true;
+			options.unionStationKey = StaticString(key->start->data, key->size);
+			req->unionStationUnsampled = true;
+			req->unionStationFilters = filters;
+			return;
+		}
+
 		options.transaction = unionStationContext->newTransaction(
-			options.getAppGroupName(), "requests",
+			req->options->getAppGroupName(), "requests",
 			string(key->start->data, key->size),
 			(filters != NULL)
 				? string(filters->start->data, filters->size)
@@ -422,31 +753,98 @@ Controller::initializeUnionStation(Client *client, Request *req, RequestAnalysis
 			options.unionStationKey = StaticString(key->start->data, key->size);
 		}
 
-		req->beginStopwatchLog(&req->stopwatchLogs.requestProcessing, "request processing");
+		req->beginStopwatchLog(RequestColdState::SWL_REQUEST_PROCESSING, "request processing");
 		req->logMessage(string("Request method: ") + http_method_str(req->method));
 		req->logMessage("URI: " + StaticString(req->path.start->data, req->path.size));
 	}
 }
 
+/**
+ * Decides, once per request, whether the request is logged to Union Station
+ * in full. The decision is made at random according to the sample rate, so
+ * that busy applications don't pay for logging every single request.
+ */
+bool
+Controller::shouldSampleUnionStationRequest(Request *req) {
+	double sampleRate = unionStationSampleRate;
+	const LString *value = req->secureHeaders.lookup(UNION_STATION_SAMPLE_RATE);
+	if (value != NULL && value->size > 0) {
+		value = psg_lstr_make_contiguous(value, req->pool);
+		sampleRate = atof(string(value->start->data, value->size).c_str());
+	}
+
+	if (sampleRate >= 100) {
+		return true;
+	} else if (sampleRate <= 0) {
+		return false;
+	} else {
+		return rand() < sampleRate / 100 * ((double) RAND_MAX + 1);
+	}
+}
+
+/**
+ * Called when a request that was not sampled ends. Failed and slow requests
+ * are logged anyway, with the information that is still available by then,
+ * so that sampling never hides them.
+ */
+void
+Controller::logUnsampledRequestToUnionStation(Client *client, Request *req) {
+	TRACE_POINT();
+	unsigned int statusCode = req->appResponseInitialized
+		? req->appResponse.statusCode
+		: 0;
+	ev_tstamp duration = ev_now(getLoop()) - req->startedAt;
+
+	if (statusCode < 500
+	 && (unionStationSlowRequestThreshold == 0
+	     || duration < unionStationSlowRequestThreshold))
+	{
+		return;
+	}
+
+	try {
+		UnionStation::TransactionPtr transaction =
+			unionStationContext->newTransaction(
+				req->options->getAppGroupName(), "requests",
+				req->poolOptions.unionStationKey,
+				(req->unionStationFilters != NULL)
+					? string(req->unionStationFilters->start->data,
+						req->unionStationFilters->size)
+					: string());
+		transaction->message(string("Request method: ") + http_method_str(req->method));
+		transaction->message("URI: " + StaticString(req->path.start->data, req->path.size));
+		if (statusCode != 0) {
+			const char *status = getStatusCodeAndReasonPhrase(statusCode);
+			if (status != NULL) {
+				transaction->message("Status: " + StaticString(status));
+			} else {
+				transaction->message("Status: " + toString(statusCode));
+			}
+		}
+		transaction->message("Request duration: " +
+			toString((unsigned long long) (duration * 1000000)) + " usec");
+	} catch (const tracable_exception &e) {
+		SKC_WARN(client, "Cannot log request to Union Station: " << e.what());
+	}
+}
+
 void
 Controller::setStickySessionId(Client *client, Request *req) {
 	if (req->stickySession) {
 		// TODO: This is not entirely correct. Clients MAY send multiple Cookie
 		// headers, although this is in practice extremely rare.
 		// http://stackoverflow.com/questions/16305814/are-multiple-cookie-headers-allowed-in-an-http-request
-		const LString *cookieHeader = req->headers.lookup(HTTP_COOKIE);
+		const LString *cookieHeader = lookupAndFlattenHeader(req, HTTP_COOKIE);
 		if (cookieHeader != NULL && cookieHeader->size > 0) {
-			const LString *cookieName = getStickySessionCookieName(req);
-			vector< pair<StaticString, StaticString> > cookies;
-			pair<StaticString, StaticString> cookie;
-
-			parseCookieHeader(req->pool, cookieHeader, cookies);
-			foreach (cookie, cookies) {
-				if (psg_lstr_cmp(cookieName, cookie.first)) {
-					// This cookie matches the one we're looking for.
-					req->options.stickySessionId = stringToUint(cookie.second);
-					return;
-				}
+			const LString *cookieName = psg_lstr_make_contiguous(
+				getStickySessionCookieName(req), req->pool);
+			ServerKit::CookieTarget cookie(StaticString(cookieName->start->data,
+				cookieName->size));
+
+			if (ServerKit::findCookies(cookieHeader->start->data,
+				cookieHeader->size, &cookie, 1) > 0)
+			{
+				req->poolOptions.stickySessionId = stringToUint(cookie.value);
 			}
 		}
 	}
@@ -463,6 +861,309 @@ Controller::getStickySessionCookieName(Request *req) {
 	}
 }
 
+void
+Controller::setRequestPriority(Client *client, Request *req) {
+	if (!requestPriorityHeader.empty()) {
+		const LString *value = lookupAndFlattenHeader(req, requestPriorityHeader);
+		if (value != NULL && value->size > 0) {
+			req->poolOptions.priority = stringToUint(
+				StaticString(value->start->data, value->size));
+		}
+	}
+}
+
+void
+Controller::setRoutingHash(Client *client, Request *req) {
+	if (routingKeySource != RKS_NONE) {
+		StaticString key = getRoutingKey(req);
+		if (!key.empty()) {
+			Hasher h;
+			h.update(key.data(), key.size());
+			req->poolOptions.routingHash = h.finalize();
+			if (req->poolOptions.routingHash == 0) {
+				// 0 means that there's no routing key.
+				req->poolOptions.routingHash = 1;
+			}
+		}
+	}
+}
+
+/**
+ * Returns the part of the request that Options::routingHash is computed
+ * from, or the empty string if the request doesn't have it.
+ */
+StaticString
+Controller::getRoutingKey(Request *req) {
+	switch (routingKeySource) {
+	case RKS_HEADER: {
+		const LString *value = lookupAndFlattenHeader(req, routingKeyName);
+		if (value != NULL && value->size > 0) {
+			return StaticString(value->start->data, value->size);
+		} else {
+			return StaticString();
+		}
+	}
+	case RKS_COOKIE: {
+		const LString *cookieHeader = lookupAndFlattenHeader(req, HTTP_COOKIE);
+		if (cookieHeader != NULL && cookieHeader->size > 0) {
+			ServerKit::CookieTarget cookie(routingKeyName);
+
+			if (ServerKit::findCookies(cookieHeader->start->data,
+				cookieHeader->size, &cookie, 1) > 0)
+			{
+				return cookie.value;
+			}
+		}
+		return StaticString();
+	}
+	case RKS_PATH_PREFIX:
+		return getPathPrefix(req, routingKeyPathSegments);
+	default:
+		return StaticString();
+	}
+}
+
+/**
+ * Returns the first `segments` segments of the request path, e.g.
+ * "/users/123" for "/users/123/posts" and 2 segments.
+ */
+StaticString
+Controller::getPathPrefix(Request *req, unsigned int segments) {
+	StaticString path = req->getPathWithoutQueryString();
+	unsigned int found = 0;
+	string::size_type i;
+	for (i = 1; i < path.size(); i++) {
+		if (path[i] == '/' && ++found == segments) {
+			break;
+		}
+	}
+	return path.substr(0, i);
+}
+
+/**
+ * Whether the request is a GET or HEAD request for one of the probe paths,
+ * which the Controller answers itself. See respondToProbe().
+ */
+bool
+Controller::isProbeRequest(Request *req) const {
+	if (req->method != HTTP_GET && req->method != HTTP_HEAD) {
+		return false;
+	}
+
+	StaticString path = req->getPathWithoutQueryString();
+	vector<string>::const_iterator it, end = probePaths.end();
+	for (it = probePaths.begin(); it != end; it++) {
+		if (path == *it) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Whether the app group of the request has at least one enabled process.
+ * Processes that fail their health checks are disabled, so this tells
+ * whether the app can currently serve requests. The answer is cached for
+ * PROBE_STATUS_CACHE_TIME seconds, so that frequent probes take the pool
+ * lock only occasionally.
+ */
+bool
+Controller::appGroupHasEnabledProcess(Client *client, Request *req) {
+	const HashedStaticString &appGroupName = req->options->getAppGroupName();
+	string storage;
+	HashedStaticString groupKey = req->options->getGroupKey(storage);
+	ProbeStatus *status;
+	ev_tstamp now = ev_now(getLoop());
+
+	if (probeStatuses.lookup(groupKey, &status)
+	 && now - status->lastCheckTime < PROBE_STATUS_CACHE_TIME)
+	{
+		return status->hasEnabledProcess;
+	}
+
+	ProbeStatus newStatus;
+	newStatus.hasEnabledProcess = appPool->getEnabledProcessCount(groupKey) > 0;
+	newStatus.lastCheckTime = now;
+	probeStatuses.insert(groupKey, newStatus, true);
+	SKC_TRACE(client, 2, "App group " << appGroupName << " has " <<
+		(newStatus.hasEnabledProcess ? "an" : "no") << " enabled process");
+	return newStatus.hasEnabledProcess;
+}
+
+/**
+ * Enforces the rate limit and the cap on requests in flight (see
+ * RateLimiter) of the request's app group for the request's rate limit
+ * key. If the request exceeds either of them, answers it with 429 Too
+ * Many Requests and returns true.
+ *
+ * Tokens and slots are taken from this Controller's leases in
+ * rateLimitBuckets. Only when those run out do we lease more from the
+ * shared rateLimiter, which takes a lock. Unused leases are returned by
+ * reconcileRateLimitBuckets().
+ */
+bool
+Controller::enforceRateLimit(Client *client, Request *req) {
+	const Options *options = req->options.get();
+	if (options->rateLimit == 0 && options->maxRequestsInFlight == 0) {
+		return false;
+	}
+
+	StaticString key = getRateLimitKey(client, req);
+	if (key.empty()) {
+		return false;
+	}
+
+	HashedStaticString hkey(key.data(), std::min<string::size_type>(key.size(),
+		StringKeyTable<RateLimitBucket>::MAX_KEY_LENGTH));
+	MonotonicTimeUsec now = SystemTime::getCachedMonotonicUsec();
+	RateLimitBucket *bucket;
+
+	if (!rateLimitBuckets.lookup(hkey, &bucket)) {
+		rateLimitBuckets.insert(hkey, RateLimitBucket());
+		rateLimitBuckets.lookup(hkey, &bucket);
+		if (!ev_is_active(&rateLimitReconcileTimer)) {
+			ev_timer_set(&rateLimitReconcileTimer, RATE_LIMIT_RECONCILE_INTERVAL,
+				RATE_LIMIT_RECONCILE_INTERVAL);
+			ev_timer_start(getLoop(), &rateLimitReconcileTimer);
+		}
+	}
+
+	if (options->maxRequestsInFlight > 0 && bucket->inFlight == bucket->slots) {
+		bucket->slots += rateLimiter->leaseSlots(hkey, options->maxRequestsInFlight, now);
+		if (bucket->inFlight == bucket->slots) {
+			SKC_DEBUG(client, "Too many requests in flight for rate limit key " << hkey);
+			respondWithTooManyRequests(&client, &req);
+			return true;
+		}
+	}
+	if (options->rateLimit > 0) {
+		if (bucket->tokens == 0) {
+			bucket->tokens = rateLimiter->leaseTokens(hkey, options->rateLimit,
+				(options->rateLimitBurst > 0) ? options->rateLimitBurst : options->rateLimit,
+				now);
+			if (bucket->tokens == 0) {
+				SKC_DEBUG(client, "Rate limit exceeded for rate limit key " << hkey);
+				respondWithTooManyRequests(&client, &req);
+				return true;
+			}
+		}
+		bucket->tokens--;
+	}
+	if (options->maxRequestsInFlight > 0) {
+		StaticString keyCopy = psg_pstrdup(req->pool, hkey);
+		bucket->inFlight++;
+		req->holdsRateLimitSlot = true;
+		req->getColdState()->rateLimitKey = HashedStaticString(keyCopy.data(),
+			keyCopy.size(), hkey.hash());
+	}
+	return false;
+}
+
+/**
+ * Returns the key that the request is rate limited by, or the empty
+ * string if the request isn't rate limited. Keys other than the app
+ * group are followed by the app group key, because each app group has
+ * its own limits. The app group key comes last so that, if the key is
+ * too long for rateLimitBuckets, it is what gets cut off.
+ */
+StaticString
+Controller::getRateLimitKey(Client *client, Request *req) {
+	HashedStaticString groupKey = getGroupKey(client, req,
+		req->options->getAppGroupName());
+	StaticString value;
+
+	switch (rateLimitKeySource) {
+	case RLKS_APP_GROUP:
+		return groupKey;
+	case RLKS_HEADER: {
+		const LString *header = lookupAndFlattenHeader(req, rateLimitKeyName);
+		if (header != NULL && header->size > 0) {
+			value = StaticString(header->start->data, header->size);
+		}
+		break;
+	}
+	case RLKS_REMOTE_ADDR: {
+		// As passed by the web server. Direct clients aren't limited.
+		const LString *header = req->secureHeaders.lookup(REMOTE_ADDR);
+		if (header != NULL && header->size > 0) {
+			header = psg_lstr_make_contiguous(header, req->pool);
+			value = StaticString(header->start->data, header->size);
+		}
+		break;
+	}
+	case RLKS_PATH_PREFIX:
+		value = getPathPrefix(req, rateLimitKeyPathSegments);
+		break;
+	default:
+		break;
+	}
+
+	if (value.empty()) {
+		return StaticString();
+	}
+
+	size_t size = value.size() + 1 + groupKey.size();
+	char *key = (char *) psg_pnalloc(req->pool, size);
+	memcpy(key, value.data(), value.size());
+	key[value.size()] = '\0';
+	memcpy(key + value.size() + 1, groupKey.data(), groupKey.size());
+	return StaticString(key, size);
+}
+
+void
+Controller::releaseRateLimitSlot(Request *req) {
+	RateLimitBucket *bucket;
+
+	if (rateLimitBuckets.lookup(req->cold->rateLimitKey, &bucket)) {
+		bucket->inFlight--;
+	}
+	req->holdsRateLimitSlot = false;
+	req->cold->rateLimitKey = HashedStaticString();
+}
+
+void
+Controller::onRateLimitReconcileTimeout(EV_P_ struct ev_timer *w, int revents) {
+	Controller *self = static_cast<Controller *>(w->data);
+	self->reconcileRateLimitBuckets();
+}
+
+/**
+ * Returns the tokens and slots that this Controller leased but didn't use
+ * to rateLimiter, so that other threads can use them, and forgets about
+ * keys that have no requests in flight.
+ */
+void
+Controller::reconcileRateLimitBuckets() {
+	StringKeyTable<RateLimitBucket>::Iterator it(rateLimitBuckets);
+	vector< pair<string, RateLimitBucket> > remaining;
+	MonotonicTimeUsec now = SystemTime::getCachedMonotonicUsec();
+
+	while (*it != NULL) {
+		RateLimitBucket &bucket = it.getValue();
+		if (bucket.tokens > 0 || bucket.slots > bucket.inFlight) {
+			rateLimiter->returnLeases(it.getKey(), bucket.tokens,
+				bucket.slots - bucket.inFlight, now);
+			bucket.tokens = 0;
+			bucket.slots = bucket.inFlight;
+		}
+		if (bucket.inFlight > 0) {
+			remaining.push_back(make_pair(string(it.getKey()), bucket));
+		}
+		it.next();
+	}
+
+	// Rebuilding the table, instead of erasing keys from it, also frees
+	// the storage of the erased keys.
+	rateLimitBuckets.clear();
+	vector< pair<string, RateLimitBucket> >::const_iterator r_it, r_end = remaining.end();
+	for (r_it = remaining.begin(); r_it != r_end; r_it++) {
+		rateLimitBuckets.insert(r_it->first, r_it->second);
+	}
+	if (rateLimitBuckets.empty()) {
+		ev_timer_stop(getLoop(), &rateLimitReconcileTimer);
+	}
+}
+
 
 /****************************
  *
@@ -473,9 +1174,18 @@ Controller::getStickySessionCookieName(Request *req) {
 
 void
 Controller::onRequestBegin(Client *client, Request *req) {
+	req->stageTimes.requestBegun = SystemTime::getMonotonicUsec();
+	P_PROBE2(request__begin, req, (int) req->method);
 	ParentClass::onRequestBegin(client, req);
 
 	CC_BENCHMARK_POINT(client, req, BM_AFTER_ACCEPT);
+	if (OXT_UNLIKELY(!probePaths.empty())
+	 && !probeRequiresProcess
+	 && isProbeRequest(req))
+	{
+		respondToProbe(&client, &req, true);
+		return;
+	}
 
 	{
 		// Perform hash table operations as close to header parsing as possible,
@@ -491,7 +1201,9 @@ Controller::onRequestBegin(Client *client, Request *req) {
 			this->stickySessions);
 		req->showVersionInHeader = getBoolOption(req, PASSENGER_SHOW_VERSION_IN_HEADER,
 			this->showVersionInHeader);
-		req->host = req->headers.lookup(HTTP_HOST);
+		req->host = lookupAndFlattenHeader(req, HTTP_HOST);
+		req->acceptsGzip = responseCompression && acceptEncodingAllowsGzip(
+			lookupAndFlattenHeader(req, HTTP_ACCEPT_ENCODING));
 
 		/***************/
 		/***************/
@@ -501,23 +1213,43 @@ Controller::onRequestBegin(Client *client, Request *req) {
 		req->bodyChannel.stop();
 
 		initializeFlags(client, req, analysis);
-		if (respondFromTurboCache(client, req)) {
+		if (req->ended()) {
+			return;
+		}
+		if (respondFromTurboCache(client, req, analysis)) {
 			return;
 		}
 		initializePoolOptions(client, req, analysis);
 		if (req->ended()) {
 			return;
 		}
+		if (OXT_UNLIKELY(!probePaths.empty())
+		 && probeRequiresProcess
+		 && isProbeRequest(req))
+		{
+			respondToProbe(&client, &req, appGroupHasEnabledProcess(client, req));
+			return;
+		}
+		if (OXT_UNLIKELY(serveStaticFiles) && serveStaticFile(client, req)) {
+			return;
+		}
+		if (OXT_UNLIKELY(rateLimiter != NULL) && enforceRateLimit(client, req)) {
+			return;
+		}
 		initializeUnionStation(client, req, analysis);
 		if (req->ended()) {
 			return;
 		}
 		setStickySessionId(client, req);
+		setRequestPriority(client, req);
+		setRoutingHash(client, req);
 	}
 
 	if (!req->hasBody() || !req->requestBodyBuffering) {
 		req->requestBodyBuffering = false;
-		checkoutSession(client, req);
+		if (!coalesceWithIdenticalRequest(client, req)) {
+			checkoutSession(client, req);
+		}
 	} else {
 		beginBufferingBody(client, req);
 	}
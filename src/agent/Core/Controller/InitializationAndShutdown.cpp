@@ -51,15 +51,35 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 
 	  statThrottleRate(_agentsOptions->getInt("stat_throttle_rate")),
 	  responseBufferHighWatermark(_agentsOptions->getInt("response_buffer_high_watermark")),
+	  responseBufferFullBufferingSize(_agentsOptions->getUint(
+		"response_buffer_full_buffering_size", false,
+		DEFAULT_RESPONSE_BUFFER_FULL_BUFFERING_SIZE)),
+	  requestBodyPrebufferSize(_agentsOptions->getUint("request_body_prebuffer_size",
+		false, DEFAULT_REQUEST_BODY_PREBUFFER_SIZE)),
+	  requestBodySlowRate(_agentsOptions->getUint("request_body_slow_rate",
+		false, DEFAULT_REQUEST_BODY_SLOW_RATE)),
 	  benchmarkMode(parseBenchmarkMode(_agentsOptions->get("benchmark_mode", false))),
 	  singleAppMode(false),
 	  showVersionInHeader(_agentsOptions->getBool("show_version_in_header")),
 	  stickySessions(_agentsOptions->getBool("sticky_sessions")),
 	  gracefulExit(_agentsOptions->getBool("core_graceful_exit")),
+	  serveXSendfile(_agentsOptions->getBool("serve_x_sendfile")),
+	  serveStaticFiles(_agentsOptions->getBool("serve_static_files",
+		false, false)),
+	  responseCompression(_agentsOptions->getBool("response_compression")),
+	  spliceRequestBodies(true),
+	  probeRequiresProcess(_agentsOptions->getBool("probe_requires_process",
+		false, false)),
+	  acceptClientHandoff(_agentsOptions->getBool("accept_client_handoff",
+		false, false)),
 
 	  agentsOptions(_agentsOptions),
+	  controllerOptions(*_agentsOptions),
 	  stringPool(psg_create_pool(1024 * 4)),
 	  poolOptionsCache(4),
+	  probePaths(_agentsOptions->getStrSet("probe_paths", false)),
+	  staticFileStat(STATIC_FILE_CACHE_SIZE * 2),
+	  rateLimitedRequestCount(0),
 
 	  PASSENGER_APP_GROUP_NAME("!~PASSENGER_APP_GROUP_NAME"),
 	  PASSENGER_ENV_VARS("!~PASSENGER_ENV_VARS"),
@@ -69,12 +89,15 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  PASSENGER_STICKY_SESSIONS_COOKIE_NAME("!~PASSENGER_STICKY_SESSIONS_COOKIE_NAME"),
 	  PASSENGER_REQUEST_OOB_WORK("!~Request-OOB-Work"),
 	  UNION_STATION_SUPPORT("!~UNION_STATION_SUPPORT"),
+	  UNION_STATION_SAMPLE_RATE("!~UNION_STATION_SAMPLE_RATE"),
 	  REMOTE_ADDR("!~REMOTE_ADDR"),
 	  REMOTE_PORT("!~REMOTE_PORT"),
 	  REMOTE_USER("!~REMOTE_USER"),
 	  FLAGS("!~FLAGS"),
 	  HTTP_COOKIE("cookie"),
 	  HTTP_DATE("date"),
+	  HTTP_ACCEPT_ENCODING("accept-encoding"),
+	  HTTP_CONTENT_ENCODING("content-encoding"),
 	  HTTP_HOST("host"),
 	  HTTP_CONTENT_LENGTH("content-length"),
 	  HTTP_CONTENT_TYPE("content-type"),
@@ -82,10 +105,31 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  HTTP_CONNECTION("connection"),
 	  HTTP_STATUS("status"),
 	  HTTP_TRANSFER_ENCODING("transfer-encoding"),
+	  HTTP_RANGE("range"),
+	  HTTP_X_PASSENGER_PURGE("x-passenger-purge"),
+	  HTTP_X_PASSENGER_FILE("x-passenger-file"),
 
 	  threadNumber(_threadNumber),
-	  turboCaching(getTurboCachingInitialState(_agentsOptions))
+	  dateHeaderTime((time_t) -1),
+	  dateHeaderSize(0),
+	  turboCaching(getTurboCachingInitialState(_agentsOptions),
+		_agentsOptions->getUint("turbocache_entries", false,
+			ResponseCache<Request>::DEFAULT_MAX_ENTRIES),
+		_agentsOptions->getUint("turbocache_max_body_size", false,
+			ResponseCache<Request>::DEFAULT_MAX_BODY_SIZE),
+		_agentsOptions->getUint("huge_page_arena_size", false, 0) > 0),
+	  coalescingTimeout(_agentsOptions->getUint("turbocache_coalescing_timeout",
+		false, 0) / 1000.0),
+	  coalescedRequestCount(0),
+	  websocketDrainTime(_agentsOptions->getUint("websocket_drain_time",
+		false, 0))
 {
+	headerReadTimeout = agentsOptions->getUint("client_header_timeout",
+		false, DEFAULT_CLIENT_HEADER_TIMEOUT);
+	keepAliveTimeout = agentsOptions->getUint("client_keepalive_timeout",
+		false, 0);
+	minRequestBodyRate = agentsOptions->getUint("client_body_min_rate",
+		false, 0);
 	defaultRuby = psg_pstrdup(stringPool,
 		agentsOptions->get("default_ruby"));
 	ustRouterAddress = psg_pstrdup(stringPool,
@@ -104,6 +148,73 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 		agentsOptions->get("server_software"));
 	defaultStickySessionsCookieName = psg_pstrdup(stringPool,
 		agentsOptions->get("sticky_sessions_cookie_name"));
+	unionStationSampleRate = atof(agentsOptions->get(
+		"union_station_sample_rate", false, "100").c_str());
+	unionStationSlowRequestThreshold = agentsOptions->getUint(
+		"union_station_slow_request_threshold", false,
+		DEFAULT_UNION_STATION_SLOW_REQUEST_THRESHOLD) / 1000.0;
+	requestTraceCountdown = 0;
+
+	if (!agentsOptions->get("request_priority_header", false).empty()) {
+		string name = agentsOptions->get("request_priority_header");
+		for (string::size_type i = 0; i < name.size(); i++) {
+			name[i] = tolower(name[i]);
+		}
+		requestPriorityHeader = psg_pstrdup(stringPool, name);
+	}
+
+	routingKeySource = RKS_NONE;
+	routingKeyPathSegments = 0;
+	if (!agentsOptions->get("routing_key", false).empty()) {
+		string spec = agentsOptions->get("routing_key");
+		if (startsWith(spec, "header:") && spec.size() > sizeof("header:") - 1) {
+			string name = spec.substr(sizeof("header:") - 1);
+			for (string::size_type i = 0; i < name.size(); i++) {
+				name[i] = tolower(name[i]);
+			}
+			routingKeySource = RKS_HEADER;
+			routingKeyName = psg_pstrdup(stringPool, name);
+		} else if (startsWith(spec, "cookie:") && spec.size() > sizeof("cookie:") - 1) {
+			routingKeySource = RKS_COOKIE;
+			routingKeyName = psg_pstrdup(stringPool,
+				spec.substr(sizeof("cookie:") - 1));
+		} else if (startsWith(spec, "path-prefix:")
+			&& stringToUint(spec.substr(sizeof("path-prefix:") - 1)) > 0)
+		{
+			routingKeySource = RKS_PATH_PREFIX;
+			routingKeyPathSegments = stringToUint(spec.substr(sizeof("path-prefix:") - 1));
+		} else {
+			P_WARN("Unknown routing key '" << spec << "', ignoring it. It must " <<
+				"be 'header:NAME', 'cookie:NAME' or 'path-prefix:SEGMENTS'");
+		}
+	}
+
+	rateLimitKeySource = RLKS_APP_GROUP;
+	rateLimitKeyPathSegments = 0;
+	if (!agentsOptions->get("rate_limit_key", false).empty()) {
+		string spec = agentsOptions->get("rate_limit_key");
+		if (spec == "app-group") {
+			rateLimitKeySource = RLKS_APP_GROUP;
+		} else if (spec == "remote-addr") {
+			rateLimitKeySource = RLKS_REMOTE_ADDR;
+		} else if (startsWith(spec, "header:") && spec.size() > sizeof("header:") - 1) {
+			string name = spec.substr(sizeof("header:") - 1);
+			for (string::size_type i = 0; i < name.size(); i++) {
+				name[i] = tolower(name[i]);
+			}
+			rateLimitKeySource = RLKS_HEADER;
+			rateLimitKeyName = psg_pstrdup(stringPool, name);
+		} else if (startsWith(spec, "path-prefix:")
+			&& stringToUint(spec.substr(sizeof("path-prefix:") - 1)) > 0)
+		{
+			rateLimitKeySource = RLKS_PATH_PREFIX;
+			rateLimitKeyPathSegments = stringToUint(spec.substr(sizeof("path-prefix:") - 1));
+		} else {
+			P_WARN("Unknown rate limit key '" << spec << "', limiting by app group " <<
+				"instead. It must be 'app-group', 'remote-addr', 'header:NAME' or " <<
+				"'path-prefix:SEGMENTS'");
+		}
+	}
 
 	if (agentsOptions->has("vary_turbocache_by_cookie")) {
 		defaultVaryTurbocacheByCookie = psg_pstrdup(stringPool,
@@ -126,7 +237,10 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 			agentsOptions->get("app_type"));
 		options->startupFile = psg_pstrdup(stringPool,
 			agentsOptions->get("startup_file"));
+		options->enableGroupLookupCache();
 		poolOptionsCache.insert(options->getAppGroupName(), options);
+	} else {
+		parseTenants();
 	}
 
 	ev_check_init(&checkWatcher, onEventLoopCheck);
@@ -134,17 +248,53 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	ev_check_start(getLoop(), &checkWatcher);
 	checkWatcher.data = this;
 
-	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
-		ev_prepare_init(&prepareWatcher, onEventLoopPrepare);
-		ev_prepare_start(getLoop(), &prepareWatcher);
-		prepareWatcher.data = this;
+	LIST_INIT(&coalescingLeaders);
+	LIST_INIT(&coalescedRequests);
+	ev_timer_init(&coalescingTimer, onCoalescingTimeout, 0, 0);
+	coalescingTimer.data = this;
+
+	ev_timer_init(&drainTimer, onDrainTimeout, 0, 0);
+	drainTimer.data = this;
+
+	ev_timer_init(&rateLimitReconcileTimer, onRateLimitReconcileTimeout, 0, 0);
+	rateLimitReconcileTimer.data = this;
+
+	turboCachePurgeCallback = NULL;
+
+	// Each thread has its own turbocache, and thus its own snapshot file.
+	if (!agentsOptions->get("turbocache_snapshot", false).empty()) {
+		turboCacheSnapshotPath = agentsOptions->get("turbocache_snapshot")
+			+ "." + toString(threadNumber);
+	}
+
+	ev_prepare_init(&prepareWatcher, onEventLoopPrepare);
+	ev_prepare_start(getLoop(), &prepareWatcher);
+	prepareWatcher.data = this;
+
+	loopWakeupTime = 0;
+	loopBlockTime = 0;
+	loopIterations = 0;
+	loopBusyTime = 0;
+	loopBlockedTime = 0;
+	loopCallbacks = 0;
+	loopMaxIterationTime = 0;
+	lastLoopMaxIterationTime = 0;
 
+	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		timeBeforeBlocking = 0;
 	#endif
 }
 
 Controller::~Controller() {
+	if (!sessionCloseBatch.empty()) {
+		appPool->closeSessions(sessionCloseBatch);
+	}
 	ev_check_stop(getLoop(), &checkWatcher);
+	ev_prepare_stop(getLoop(), &prepareWatcher);
+	closeOpenStaticFiles();
+	ev_timer_stop(getLoop(), &coalescingTimer);
+	ev_timer_stop(getLoop(), &drainTimer);
+	ev_timer_stop(getLoop(), &rateLimitReconcileTimer);
 	psg_destroy_pool(stringPool);
 }
 
@@ -160,6 +310,84 @@ Controller::initialize() {
 	if (unionStationContext == NULL) {
 		unionStationContext = appPool->getUnionStationContext();
 	}
+	turboCaching.responseCache.setSharedCache(sharedResponseCache.get());
+	loadTurboCacheSnapshot();
+}
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+/**
+ * Parses the NAME=ADDRESS pairs that were configured with --tenant.
+ * The addresses are among the addresses that the Core listens on.
+ */
+void
+Controller::parseTenants() {
+	vector<string> specs = agentsOptions->getStrSet("core_tenants", false);
+	string spec;
+
+	foreach (spec, specs) {
+		string::size_type pos = spec.find('=');
+		string address = spec.substr(pos + 1);
+		Tenant tenant;
+
+		tenant.name = psg_pstrdup(stringPool, spec.substr(0, pos));
+		tenant.port = 0;
+		if (getSocketAddressType(address) == SAT_UNIX) {
+			tenant.path = parseUnixSocketAddress(address);
+		} else {
+			parseTcpSocketAddress(address, tenant.host, tenant.port);
+			if (tenant.host == "0.0.0.0" || tenant.host == "::") {
+				tenant.host.clear();
+			}
+		}
+		tenants.push_back(tenant);
+	}
+}
+
+void
+Controller::loadTurboCacheSnapshot() {
+	if (turboCacheSnapshotPath.empty() || !fileExists(turboCacheSnapshotPath)) {
+		return;
+	}
+
+	try {
+		unsigned int count = turboCaching.responseCache.loadSnapshot(
+			readAll(turboCacheSnapshotPath), ev_now(getLoop()));
+		SKS_INFO("Loaded " << count << " turbocache entries from " << turboCacheSnapshotPath);
+	} catch (const SystemException &e) {
+		SKS_WARN("Cannot load turbocache snapshot " << turboCacheSnapshotPath
+			<< ": " << e.what());
+	}
+	// The snapshot becomes stale as soon as the turbocache changes, so
+	// make sure that it is not loaded again after an unclean restart.
+	if (unlink(turboCacheSnapshotPath.c_str()) == -1 && errno != ENOENT) {
+		int e = errno;
+		SKS_WARN("Cannot remove turbocache snapshot " << turboCacheSnapshotPath
+			<< ": " << strerror(e) << " (errno=" << e << ")");
+	}
+}
+
+void
+Controller::saveTurboCacheSnapshot() {
+	if (turboCacheSnapshotPath.empty() || !turboCaching.isEnabled()) {
+		return;
+	}
+
+	try {
+		createFile(turboCacheSnapshotPath,
+			turboCaching.responseCache.saveSnapshot(ev_now(getLoop())),
+			S_IRUSR | S_IWUSR);
+		SKS_INFO("Saved turbocache snapshot to " << turboCacheSnapshotPath);
+	} catch (const SystemException &e) {
+		SKS_WARN("Cannot save turbocache snapshot " << turboCacheSnapshotPath
+			<< ": " << e.what());
+	}
 }
 
 
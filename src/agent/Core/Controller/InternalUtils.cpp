@@ -61,6 +61,83 @@ Controller::generateServerLogName(unsigned int number) {
 	serverLogName = psg_pstrdup(stringPool, name);
 }
 
+/**
+ * Determines the tenant of a newly accepted client from the local
+ * address of its connection, which is the address of the listening
+ * socket that it connected to. Returns the empty string if the client
+ * did not connect to a tenant's address.
+ */
+StaticString
+Controller::lookupClientTenant(Client *client) {
+	union {
+		struct sockaddr generic;
+		struct sockaddr_un un;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
+	} addr;
+	socklen_t len = sizeof(addr);
+	char host[INET6_ADDRSTRLEN];
+	unsigned short port;
+	vector<Tenant>::const_iterator it, end = tenants.end();
+
+	memset(&addr, 0, sizeof(addr));
+	if (getsockname(client->getFd(), &addr.generic, &len) == -1) {
+		return StaticString();
+	}
+
+	switch (addr.generic.sa_family) {
+	case AF_UNIX:
+		for (it = tenants.begin(); it != end; it++) {
+			if (!it->path.empty() && it->path == addr.un.sun_path) {
+				return it->name;
+			}
+		}
+		return StaticString();
+	case AF_INET:
+		inet_ntop(AF_INET, &addr.in.sin_addr, host, sizeof(host));
+		port = ntohs(addr.in.sin_port);
+		break;
+	case AF_INET6:
+		inet_ntop(AF_INET6, &addr.in6.sin6_addr, host, sizeof(host));
+		port = ntohs(addr.in6.sin6_port);
+		break;
+	default:
+		return StaticString();
+	}
+
+	for (it = tenants.begin(); it != end; it++) {
+		if (it->path.empty() && it->port == port
+		 && (it->host.empty() || it->host == host))
+		{
+			return it->name;
+		}
+	}
+	return StaticString();
+}
+
+/**
+ * Returns the key of the given app group in the pool and in
+ * poolOptionsCache: the same key as `Options::getGroupKey()`, but built
+ * in the request's pool. Tenants have separate app groups even if they
+ * use the same app group name.
+ */
+HashedStaticString
+Controller::getGroupKey(Client *client, Request *req,
+	const HashedStaticString &appGroupName)
+{
+	const StaticString &tenant = client->tenant;
+	if (OXT_LIKELY(tenant.empty())) {
+		return appGroupName;
+	}
+
+	size_t size = tenant.size() + 1 + appGroupName.size();
+	char *key = (char *) psg_pnalloc(req->pool, size);
+	memcpy(key, tenant.data(), tenant.size());
+	key[tenant.size()] = '\0';
+	memcpy(key + tenant.size() + 1, appGroupName.data(), appGroupName.size());
+	return HashedStaticString(key, size);
+}
+
 void
 Controller::disconnectWithClientSocketWriteError(Client **client, int e) {
 	stringstream message;
@@ -185,6 +262,119 @@ Controller::writeBenchmarkResponse(Client **client, Request **req, bool end) {
 	}
 }
 
+/**
+ * Answers a probe request (see isProbeRequest()) from a precomputed
+ * response, without involving the application.
+ */
+void
+Controller::respondToProbe(Client **client, Request **req, bool healthy) {
+	StaticString response;
+	unsigned int bodySize;
+
+	if (healthy) {
+		bodySize = sizeof("ok\n") - 1;
+		if (canKeepAlive(*req)) {
+			response = P_STATIC_STRING(
+				"HTTP/1.1 200 OK\r\n"
+				"Status: 200 OK\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 3\r\n"
+				"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+				"Connection: keep-alive\r\n"
+				"\r\n"
+				"ok\n");
+		} else {
+			response = P_STATIC_STRING(
+				"HTTP/1.1 200 OK\r\n"
+				"Status: 200 OK\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 3\r\n"
+				"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+				"Connection: close\r\n"
+				"\r\n"
+				"ok\n");
+		}
+	} else {
+		bodySize = sizeof("unavailable\n") - 1;
+		if (canKeepAlive(*req)) {
+			response = P_STATIC_STRING(
+				"HTTP/1.1 503 Service Unavailable\r\n"
+				"Status: 503 Service Unavailable\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 12\r\n"
+				"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+				"Connection: keep-alive\r\n"
+				"\r\n"
+				"unavailable\n");
+		} else {
+			response = P_STATIC_STRING(
+				"HTTP/1.1 503 Service Unavailable\r\n"
+				"Status: 503 Service Unavailable\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 12\r\n"
+				"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+				"Connection: close\r\n"
+				"\r\n"
+				"unavailable\n");
+		}
+	}
+	if ((*req)->method == HTTP_HEAD) {
+		response = StaticString(response.data(), response.size() - bodySize);
+	}
+
+	SKC_TRACE(*client, 2, "Answering probe request directly with status " <<
+		(healthy ? 200 : 503));
+	recordResponseStatus(healthy ? 200 : 503);
+	writeResponse(*client, response);
+	if (!(*req)->ended()) {
+		endRequest(client, req);
+	}
+}
+
+/**
+ * Answers a request that exceeds its rate limit (see enforceRateLimit())
+ * from a precomputed response.
+ */
+void
+Controller::respondWithTooManyRequests(Client **client, Request **req) {
+	StaticString response;
+
+	if (canKeepAlive(*req)) {
+		response = P_STATIC_STRING(
+			"HTTP/1.1 429 Too Many Requests\r\n"
+			"Status: 429 Too Many Requests\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 18\r\n"
+			"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+			"Retry-After: 1\r\n"
+			"Connection: keep-alive\r\n"
+			"\r\n"
+			"Too many requests\n");
+	} else {
+		response = P_STATIC_STRING(
+			"HTTP/1.1 429 Too Many Requests\r\n"
+			"Status: 429 Too Many Requests\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 18\r\n"
+			"Cache-Control: no-cache, no-store, must-revalidate\r\n"
+			"Retry-After: 1\r\n"
+			"Connection: close\r\n"
+			"\r\n"
+			"Too many requests\n");
+	}
+	if ((*req)->method == HTTP_HEAD) {
+		response = StaticString(response.data(),
+			response.size() - (sizeof("Too many requests\n") - 1));
+	}
+
+	rateLimitedRequestCount++;
+	recordResponseStatus(429);
+	writeResponse(*client, response);
+	if (!(*req)->ended()) {
+		endRequest(client, req);
+	}
+}
+
 bool
 Controller::getBoolOption(Request *req, const HashedStaticString &name,
 	bool defaultValue)
@@ -270,46 +460,17 @@ Controller::resolveSymlink(const StaticString &path, psg_pool_t *pool) {
 	}
 }
 
-void
-Controller::parseCookieHeader(psg_pool_t *pool, const LString *headerValue,
-	vector< pair<StaticString, StaticString> > &cookies) const
-{
-	// See http://stackoverflow.com/questions/6108207/definite-guide-to-valid-cookie-values
-	// for syntax grammar.
-	vector<StaticString> parts;
-	vector<StaticString>::const_iterator it, it_end;
-
-	assert(headerValue->size > 0);
-	headerValue = psg_lstr_make_contiguous(headerValue, pool);
-	split(StaticString(headerValue->start->data, headerValue->size),
-		';', parts);
-	cookies.reserve(parts.size());
-	it_end = parts.end();
-
-	for (it = parts.begin(); it != it_end; it++) {
-		const char *begin = it->data();
-		const char *end = it->data() + it->size();
-		const char *sep;
-
-		skipLeadingWhitespaces(&begin, end);
-		skipTrailingWhitespaces(begin, &end);
-
-		// Find the separator ('=').
-		sep = (const char *) memchr(begin, '=', end - begin);
-		if (sep != NULL) {
-			// Valid cookie. Otherwise, ignore it.
-			const char *nameEnd = sep;
-			const char *valueBegin = sep + 1;
-
-			skipTrailingWhitespaces(begin, &nameEnd);
-			skipLeadingWhitespaces(&valueBegin, end);
-
-			cookies.push_back(make_pair(
-				StaticString(begin, nameEnd - begin),
-				StaticString(valueBegin, end - valueBegin)
-			));
-		}
+/**
+ * Looks up a request header and flattens it in place, so that all later
+ * users of the header get its contiguous version without copying.
+ */
+const LString *
+Controller::lookupAndFlattenHeader(Request *req, const HashedStaticString &name) {
+	LString *value = req->headers.lookup(name);
+	if (value != NULL) {
+		psg_lstr_flatten(value, req->pool);
 	}
+	return value;
 }
 
 #ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
@@ -23,6 +23,8 @@
  *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *  THE SOFTWARE.
  */
+#include <algorithm>
+#include <cstdlib>
 #include <Core/Controller.h>
 
 /*************************************************************************
@@ -38,6 +40,71 @@ using namespace std;
 using namespace boost;
 
 
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+void
+Controller::logLongRunningConnectionDisconnect(Client *client, Request *req) {
+	if (getLogLevel() >= LVL_INFO) {
+		char clientName[32];
+		unsigned int size;
+		const LString *host;
+		StaticString hostStr;
+
+		size = getClientName(client, clientName, sizeof(clientName));
+		if (req->host != NULL && req->host->size > 0) {
+			host = psg_lstr_make_contiguous(req->host, req->pool);
+			hostStr = StaticString(host->start->data, host->size);
+		}
+		P_INFO("[" << getServerName() << "] Disconnecting client " <<
+			StaticString(clientName, size) << ": " <<
+			hostStr << StaticString(req->path.start->data, req->path.size));
+	}
+}
+
+void
+Controller::onDrainTimeout(EV_P_ struct ev_timer *w, int revents) {
+	Controller *self = static_cast<Controller *>(w->data);
+	self->disconnectDrainingConnections(false);
+}
+
+/**
+ * Disconnects the draining connections whose turn has come, or all of them
+ * if `all` is true, and reschedules the drain timer for the next one.
+ */
+void
+Controller::disconnectDrainingConnections(bool all) {
+	ev_tstamp now = ev_now(getLoop());
+
+	while (!drainingConnections.empty()
+	 && (all || drainingConnections.back().disconnectAt <= now))
+	{
+		DrainingConnection conn = drainingConnections.back();
+		Client *client = conn.client;
+
+		drainingConnections.pop_back();
+		// The connection may have been closed by either side in the meantime.
+		if (client->connected()) {
+			logLongRunningConnectionDisconnect(client, client->currentRequest);
+			disconnect(&client);
+		}
+		conn.process->drainingConnections.fetch_sub(1, boost::memory_order_relaxed);
+		conn.process->drainedConnections.fetch_add(1, boost::memory_order_relaxed);
+		unrefClient(conn.client, __FILE__, __LINE__);
+	}
+
+	ev_timer_stop(getLoop(), &drainTimer);
+	if (!drainingConnections.empty()) {
+		ev_timer_set(&drainTimer, drainingConnections.back().disconnectAt - now, 0);
+		ev_timer_start(getLoop(), &drainTimer);
+	}
+}
+
+
 /****************************
  *
  * Public methods
@@ -45,12 +112,24 @@ using namespace boost;
  ****************************/
 
 
+/**
+ * Disconnects the upgraded (e.g. WebSocket) connections to the given process,
+ * which has been detached. Disconnecting them all at once makes all their
+ * clients reconnect at the same time, so if `drain` is set and
+ * `websocketDrainTime` is configured, each connection is instead disconnected
+ * at a random point within the drain window. The detached process no longer
+ * receives new requests in the meantime. Progress is reported through the
+ * process's `drainingConnections` and `drainedConnections`.
+ */
 void
-Controller::disconnectLongRunningConnections(const StaticString &gupid) {
+Controller::disconnectLongRunningConnections(const ProcessPtr &process, bool drain) {
+	StaticString gupid = process->getGupid();
 	vector<Client *> clients;
 	vector<Client *>::iterator v_it, v_end;
 	Client *client;
 
+	drain = drain && websocketDrainTime > 0;
+
 	// We collect all clients in a vector so that we don't have to worry about
 	// `activeClients` being mutated while we work.
 	TAILQ_FOREACH (client, &activeClients, nextClient.activeOrDisconnectedClient) {
@@ -59,24 +138,12 @@ Controller::disconnectLongRunningConnections(const StaticString &gupid) {
 			Request *req = client->currentRequest;
 			if (req->httpState >= Request::COMPLETE
 			 && req->upgraded()
-			 && req->options.abortWebsocketsOnProcessShutdown
+			 && req->options->abortWebsocketsOnProcessShutdown
 			 && req->session != NULL
 			 && req->session->getGupid() == gupid)
 			{
-				if (getLogLevel() >= LVL_INFO) {
-					char clientName[32];
-					unsigned int size;
-					const LString *host;
-					StaticString hostStr;
-
-					size = getClientName(client, clientName, sizeof(clientName));
-					if (req->host != NULL && req->host->size > 0) {
-						host = psg_lstr_make_contiguous(req->host, req->pool);
-						hostStr = StaticString(host->start->data, host->size);
-					}
-					P_INFO("[" << getServerName() << "] Disconnecting client " <<
-						StaticString(clientName, size) << ": " <<
-						hostStr << StaticString(req->path.start->data, req->path.size));
+				if (!drain) {
+					logLongRunningConnectionDisconnect(client, req);
 				}
 				refClient(client, __FILE__, __LINE__);
 				clients.push_back(client);
@@ -84,6 +151,32 @@ Controller::disconnectLongRunningConnections(const StaticString &gupid) {
 		}
 	}
 
+	if (drain) {
+		if (clients.empty()) {
+			return;
+		}
+
+		ev_tstamp now = ev_now(getLoop());
+		v_end = clients.end();
+		for (v_it = clients.begin(); v_it != v_end; v_it++) {
+			DrainingConnection conn;
+			conn.client = *v_it;
+			conn.process = process;
+			conn.disconnectAt = now + websocketDrainTime * (rand() / ((double) RAND_MAX + 1));
+			drainingConnections.push_back(conn);
+		}
+		std::sort(drainingConnections.begin(), drainingConnections.end());
+		process->drainingConnections.fetch_add(clients.size(), boost::memory_order_relaxed);
+
+		P_INFO("[" << getServerName() << "] Disconnecting " << clients.size() <<
+			" long-running connections to process " << process->getPid() <<
+			" over the next " << websocketDrainTime << " seconds");
+		ev_timer_stop(getLoop(), &drainTimer);
+		ev_timer_set(&drainTimer, drainingConnections.back().disconnectAt - now, 0);
+		ev_timer_start(getLoop(), &drainTimer);
+		return;
+	}
+
 	// Disconnect each eligible client.
 	v_end = clients.end();
 	for (v_it = clients.begin(); v_it != v_end; v_it++) {
@@ -94,6 +187,18 @@ Controller::disconnectLongRunningConnections(const StaticString &gupid) {
 	}
 }
 
+/**
+ * Purges this Controller's turbocache entries for the given host and path.
+ * See ResponseCache::purge() for the matching rules.
+ */
+void
+Controller::purgeTurboCache(const StaticString &host, const StaticString &path) {
+	unsigned int count = turboCaching.responseCache.purge(host, path);
+	SKS_DEBUG("Purged " << count << " turbocache entries for " <<
+		(host.empty() ? StaticString("any host") : host) << " " <<
+		(path.empty() ? StaticString("(all paths)") : path));
+}
+
 Controller::BenchmarkMode
 Controller::parseBenchmarkMode(const StaticString mode) {
 	if (mode.empty()) {
@@ -111,6 +216,24 @@ Controller::parseBenchmarkMode(const StaticString mode) {
 	}
 }
 
+const char *
+Controller::getRequestStageName(RequestStage stage) {
+	switch (stage) {
+	case RS_HEADER_PARSE:
+		return "header_parse";
+	case RS_SESSION_CHECKOUT:
+		return "session_checkout";
+	case RS_APP_CONNECT:
+		return "app_connect";
+	case RS_APP_FIRST_BYTE:
+		return "app_first_byte";
+	case RS_RESPONSE_TRANSFER:
+		return "response_transfer";
+	default:
+		return "unknown";
+	}
+}
+
 
 } // namespace Core
 } // namespace Passenger
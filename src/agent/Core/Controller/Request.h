@@ -27,13 +27,16 @@
 #define _PASSENGER_REQUEST_HANDLER_REQUEST_H_
 
 #include <ev++.h>
+#include <zlib.h>
 #include <string>
 #include <cstring>
+#include <boost/atomic.hpp>
 
 #include <ServerKit/HttpRequest.h>
 #include <ServerKit/FdSinkChannel.h>
 #include <ServerKit/FdSourceChannel.h>
 #include <Logging.h>
+#include <Utils/SystemTime.h>
 #include <Core/ApplicationPool/Pool.h>
 #include <Core/UnionStation/Context.h>
 #include <Core/UnionStation/Transaction.h>
@@ -48,15 +51,118 @@ using namespace boost;
 using namespace ApplicationPool2;
 
 
+/**
+ * The pool options that can differ between requests to the same application.
+ * Requests share the pool options of their application (`Request::options`)
+ * and only store these on top of them, so that initializing a request does
+ * not involve copying a whole Options object.
+ */
+struct RequestPoolOptions {
+	UnionStation::TransactionPtr transaction;
+	StaticString unionStationKey;
+	unsigned int stickySessionId;
+	unsigned int priority;
+	boost::uint32_t routingHash;
+	bool analytics;
+
+	RequestPoolOptions()
+		: stickySessionId(0),
+		  priority(0),
+		  routingHash(0),
+		  analytics(false)
+		{ }
+
+	/** Whether applyTo() would change anything. */
+	bool empty() const {
+		return transaction == NULL
+			&& !analytics
+			&& stickySessionId == 0
+			&& priority == 0
+			&& routingHash == 0;
+	}
+
+	void applyTo(Options &options) const {
+		options.transaction = transaction;
+		if (analytics) {
+			options.analytics = true;
+			options.unionStationKey = unionStationKey;
+		}
+		options.stickySessionId = stickySessionId;
+		options.priority = priority;
+		options.routingHash = routingHash;
+	}
+
+	void reset() {
+		transaction.reset();
+		unionStationKey = StaticString();
+		stickySessionId = 0;
+		priority = 0;
+		routingHash = 0;
+		analytics = false;
+	}
+};
+
+
+/**
+ * Request state that most requests never touch. It lives in a separate
+ * block so that it doesn't take up space between the fields that every
+ * request uses, which keeps the memory that a request brings into the
+ * CPU cache small. The block is allocated the first time a request needs
+ * it (see `Request::getColdState()`) and then stays attached to the
+ * Request object while that object is on the request freelist, so it is
+ * only allocated once per Request object.
+ */
+struct RequestColdState {
+	enum StopwatchLogType {
+		SWL_REQUEST_PROCESSING,
+		SWL_BUFFERING_REQUEST_BODY,
+		SWL_GET_FROM_POOL,
+		SWL_REQUEST_PROXYING,
+		SWL_COUNT
+	};
+
+	// `Request::options` with `Request::poolOptions` applied, for requests
+	// whose poolOptions aren't empty. The pool references the Options of a
+	// request that is waiting for a process, so they must stay alive until
+	// checkout is done.
+	Options checkoutOptions;
+
+	// Only used if the request has a Union Station transaction.
+	UnionStation::StopwatchLog *stopwatchLogs[SWL_COUNT];
+
+	// Used while the rest of the request body is spliced from the client
+	// socket to the application socket, bypassing appSink. See
+	// Controller::beginSplicingRequestBody(). bodySplicePipe[0] is -1 otherwise.
+	int bodySplicePipe[2];
+	unsigned int bodySplicePipeBytes;
+	ev_io bodySpliceWatcher;
+
+	// The rate limit key whose in-flight slot the request holds, allocated
+	// from the request's pool. Only valid if Request::holdsRateLimitSlot.
+	HashedStaticString rateLimitKey;
+
+	RequestColdState()
+		: bodySplicePipeBytes(0)
+	{
+		memset(stopwatchLogs, 0, sizeof(stopwatchLogs));
+		bodySplicePipe[0] = -1;
+		bodySplicePipe[1] = -1;
+	}
+};
+
+
 class Request: public ServerKit::BaseHttpRequest {
 public:
+	typedef RequestColdState::StopwatchLogType StopwatchLogType;
+
 	enum State {
 		ANALYZING_REQUEST,
 		BUFFERING_REQUEST_BODY,
 		CHECKING_OUT_SESSION,
 		SENDING_HEADER_TO_APP,
 		FORWARDING_BODY_TO_APP,
-		WAITING_FOR_APP_OUTPUT
+		WAITING_FOR_APP_OUTPUT,
+		WAITING_FOR_COALESCED_RESPONSE
 	};
 
 	enum HalfClosePolicy {
@@ -71,6 +177,14 @@ public:
 	State state: 3;
 	bool dechunkResponse: 1;
 	bool requestBodyBuffering: 1;
+	// Whether a session was checked out before the buffered request body
+	// was complete. The rest of the body then still goes through
+	// bodyBuffer, which streams it to the app.
+	bool streamingBufferedBody: 1;
+	// Whether the buffered request body is passed to the app as a file
+	// descriptor instead of being sent over the app socket.
+	// See Controller::passRequestBodyFdToApp().
+	bool requestBodyFdPassing: 1;
 	bool https: 1;
 	bool showVersionInHeader: 1;
 	bool stickySession: 1;
@@ -80,36 +194,104 @@ public:
 	HalfClosePolicy halfClosePolicy: 2;
 	bool appResponseInitialized: 1;
 	bool strip100ContinueHeader: 1;
+	// Whether the web server in front can send file bodies itself,
+	// so that we only have to tell it which file to send.
+	// See Controller::delegateFileBody().
+	bool fileBodyDelegation: 1;
 	bool hasPragmaHeader: 1;
+	// Whether response compression is enabled and the client accepts
+	// a gzip-compressed response.
+	bool acceptsGzip: 1;
+	// Whether the response body is being gzip-compressed. If so,
+	// compressionStream holds the deflate state.
+	bool compressResponse: 1;
+	// Whether identical turbocacheable requests may wait for this
+	// request's response instead of going to the application.
+	// If so, this request is in Controller::coalescingLeaders.
+	bool leadsCoalescing: 1;
+	// Whether Union Station is enabled for this request, but the request
+	// was not picked by sampling. Such a request is only logged, after the
+	// fact, if it fails or turns out to be slow.
+	bool unionStationUnsampled: 1;
+	// Whether this request takes up one of the in-flight slots of
+	// its rate limit key. See Controller::enforceRateLimit().
+	bool holdsRateLimitSlot: 1;
 
-	Options options;
+	// The pool options of the application that this request belongs to.
+	// Shared with other requests to the same application through
+	// Controller::poolOptionsCache, so never modified. NULL until
+	// Controller::initializePoolOptions() has run.
+	boost::shared_ptr<Options> options;
+	RequestPoolOptions poolOptions;
 	AbstractSessionPtr session;
 	const LString *host;
+	/**
+	 * The tenant of the client (see Client::tenant). Part of the
+	 * turbocache key.
+	 */
+	StaticString tenant;
+
+	// Monotonic times at which the request reached the boundaries of the
+	// stages that Controller::recordRequestStageTimes() measures. 0 if the
+	// request has not reached that point (yet).
+	struct StageTimes {
+		MonotonicTimeUsec headerBegun;
+		MonotonicTimeUsec requestBegun;
+		MonotonicTimeUsec checkoutBegun;
+		MonotonicTimeUsec sessionCheckedOut;
+		MonotonicTimeUsec sessionInitiated;
+		MonotonicTimeUsec appResponseBegun;
+	} stageTimes;
 
 	ServerKit::FdSinkChannel appSink;
 	ServerKit::FdSourceChannel appSource;
 	AppResponse appResponse;
 
-	ServerKit::FileBufferedChannel bodyBuffer;
-	boost::uint64_t bodyBytesBuffered; // After dechunking
-
-	struct {
-		UnionStation::StopwatchLog *requestProcessing;
-		UnionStation::StopwatchLog *bufferingRequestBody;
-		UnionStation::StopwatchLog *getFromPool;
-		UnionStation::StopwatchLog *requestProxying;
-	} stopwatchLogs;
+	// When the app source was last stopped because the client output
+	// reached its high watermark, and how much the client output had
+	// buffered at that time. Used to measure the client's drain rate.
+	ev_tstamp appSourceThrottledAt;
+	boost::uint64_t bytesBufferedWhenThrottled;
 
 	HashedStaticString cacheKey;
 	LString *cacheControl;
 	LString *varyCookie;
 	// Value of the `!~PASSENGER_ENV_VARS` header. This is different
-	// from `options.environmentVariables`. If `!~PASSENGER_ENV_VARS`
+	// from `options->environmentVariables`. If `!~PASSENGER_ENV_VARS`
 	// is not set or is empty, then `envvars` is NULL, while
-	// `options.environmentVariables` retains a previous value.
+	// `options->environmentVariables` retains a previous value.
 	//
 	// This value is guaranteed to be contiguous.
 	LString *envvars;
+	// Value of the `!~UNION_STATION_FILTERS` header, for logging
+	// unsampled requests. Contiguous, or NULL if not set.
+	const LString *unionStationFilters;
+
+	// If the app responded with an X-Sendfile header and serve_x_sendfile
+	// is enabled, then these describe the part of the file that still has
+	// to be sent to the client. xSendfileFd is -1 otherwise.
+	int xSendfileFd;
+	boost::uint64_t xSendfileOffset;
+	boost::uint64_t xSendfileRemaining;
+
+	z_stream *compressionStream;
+
+	// Only used if requestBodyBuffering.
+	ServerKit::FileBufferedChannel bodyBuffer;
+	boost::uint64_t bodyBytesBuffered; // After dechunking
+
+	// Set while this request is waiting for an identical request to
+	// fetch the response from the application. If so, this request is
+	// in Controller::coalescedRequests.
+	Request *coalescingLeader;
+	LIST_ENTRY(Request) nextCoalescingRequest;
+
+	// Set when the request ends. Read by the pool, possibly from another
+	// thread, to drop this request from the get wait list if it is on it.
+	boost::atomic<bool> checkoutCancelled;
+
+	// NULL until getColdState() is first called.
+	RequestColdState *cold;
 
 	#ifdef DEBUG_CC_EVENT_LOOP_BLOCKING
 		bool timedAppPoolGet;
@@ -120,9 +302,28 @@ public:
 
 
 	Request()
-		: BaseHttpRequest()
+		: BaseHttpRequest(),
+		  xSendfileFd(-1),
+		  compressionStream(NULL),
+		  coalescingLeader(NULL),
+		  cold(NULL)
 	{
-		memset(&stopwatchLogs, 0, sizeof(stopwatchLogs));
+		memset(&stageTimes, 0, sizeof(stageTimes));
+	}
+
+	~Request() {
+		delete cold;
+	}
+
+	RequestColdState *getColdState() {
+		if (OXT_UNLIKELY(cold == NULL)) {
+			cold = new RequestColdState();
+		}
+		return cold;
+	}
+
+	bool splicingRequestBody() const {
+		return cold != NULL && cold->bodySplicePipe[0] != -1;
 	}
 
 	const char *getStateString() const {
@@ -139,31 +340,58 @@ public:
 			return "FORWARDING_BODY_TO_APP";
 		case WAITING_FOR_APP_OUTPUT:
 			return "WAITING_FOR_APP_OUTPUT";
+		case WAITING_FOR_COALESCED_RESPONSE:
+			return "WAITING_FOR_COALESCED_RESPONSE";
 		default:
 			return "UNKNOWN";
 		}
 	}
 
 	bool useUnionStation() const {
-		return options.transaction != NULL;
+		return poolOptions.transaction != NULL;
 	}
 
-	void beginStopwatchLog(UnionStation::StopwatchLog **stopwatchLog, const char *id, const char *nameAndData = NULL) {
-		if (options.transaction != NULL) {
-			*stopwatchLog = new UnionStation::StopwatchLog(options.transaction, id, nameAndData);
+	/**
+	 * Whether the application should log this request to Union Station
+	 * as well, under this request's transaction ID.
+	 */
+	bool appUsesUnionStation() const {
+		return poolOptions.analytics && poolOptions.transaction != NULL;
+	}
+
+	/**
+	 * Where Pool::asyncGet() should store its stopwatch log, or NULL if
+	 * this request doesn't use Union Station.
+	 */
+	UnionStation::StopwatchLog **getStopwatchLogSlot(StopwatchLogType type) {
+		if (poolOptions.transaction != NULL) {
+			return &getColdState()->stopwatchLogs[type];
+		} else {
+			return NULL;
+		}
+	}
+
+	void beginStopwatchLog(StopwatchLogType type, const char *id, const char *nameAndData = NULL) {
+		if (poolOptions.transaction != NULL) {
+			getColdState()->stopwatchLogs[type] = new UnionStation::StopwatchLog(
+				poolOptions.transaction, id, nameAndData);
 		}
 	}
 
-	void endStopwatchLog(UnionStation::StopwatchLog **stopwatchLog, bool success = true) {
-		if (success && *stopwatchLog != NULL) {
-			(*stopwatchLog)->success();
+	void endStopwatchLog(StopwatchLogType type, bool success = true) {
+		if (cold == NULL || cold->stopwatchLogs[type] == NULL) {
+			return;
+		}
+		UnionStation::StopwatchLog *&stopwatchLog = cold->stopwatchLogs[type];
+		if (success) {
+			stopwatchLog->success();
 		}
-		delete *stopwatchLog;
-		*stopwatchLog = NULL;
+		delete stopwatchLog;
+		stopwatchLog = NULL;
 	}
 
 	void logMessage(const StaticString &message) {
-		options.transaction->message(message);
+		poolOptions.transaction->message(message);
 	}
 
 	DEFINE_SERVER_KIT_BASE_HTTP_REQUEST_FOOTER(Passenger::Core::Request);
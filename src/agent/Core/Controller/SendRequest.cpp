@@ -23,6 +23,9 @@
  *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *  THE SOFTWARE.
  */
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <Core/Controller.h>
 #include <Utils/SystemTime.h>
 
@@ -60,17 +63,16 @@ struct Controller::SessionProtocolWorkingState {
 	const LString *remoteUser;
 	const LString *contentType;
 	const LString *contentLength;
+	StaticString deltaMonotonic;
 	char *environmentVariablesData;
 	size_t environmentVariablesSize;
 	bool hasBaseURI;
+	char headerSizeBuffer[sizeof(boost::uint32_t)];
+	char deltaMonotonicBuffer[sizeof("-18446744073709551615")];
 
 	SessionProtocolWorkingState()
 		: environmentVariablesData(NULL)
 		{ }
-
-	~SessionProtocolWorkingState() {
-		free(environmentVariablesData);
-	}
 };
 
 struct Controller::HttpHeaderConstructionCache {
@@ -103,6 +105,7 @@ Controller::sendHeaderToApp(Client *client, Request *req) {
 			// upon reaching the end of the request body.
 			req->halfClosePolicy = Request::HALF_CLOSE_UPON_REACHING_REQUEST_BODY_END;
 		}
+		req->requestBodyFdPassing = canPassRequestBodyFd(client, req);
 		sendHeaderToAppWithSessionProtocol(client, req);
 	} else {
 		UPDATE_TRACE_POINT();
@@ -155,48 +158,61 @@ void
 Controller::sendHeaderToAppWithSessionProtocol(Client *client, Request *req) {
 	TRACE_POINT();
 	SessionProtocolWorkingState state;
+	struct iovec *buffers;
+	unsigned int nbuffers, dataSize;
+	ssize_t ret;
+	bool ok;
 
-	// Workaround for Ruby < 2.1 support.
-	std::string deltaMonotonic;
-	unsigned long long now = SystemTime::getUsec();
-	MonotonicTimeUsec monotonicNow = SystemTime::getMonotonicUsec();
-	if (now > monotonicNow) {
-		deltaMonotonic = boost::to_string(now - monotonicNow);
+	initializeSessionProtocolWorkingState(req, state);
+
+	ok = constructHeaderBuffersForSessionProtocol(req, NULL, 0,
+		nbuffers, dataSize, state);
+	assert(ok);
+	buffers = (struct iovec *) psg_palloc(req->pool,
+		sizeof(struct iovec) * nbuffers);
+	ok = constructHeaderBuffersForSessionProtocol(req, buffers, nbuffers,
+		nbuffers, dataSize, state);
+	assert(ok);
+	(void) ok; // Shut up compiler warning
+
+	if (OXT_UNLIKELY(getLogLevel() >= LVL_DEBUG3)) {
+		char *buffer = (char *) psg_pnalloc(req->pool, dataSize);
+		gatherBuffers(buffer, dataSize, buffers, nbuffers);
+		SKC_TRACE(client, 3, "Header data: \"" <<
+			cEscapeString(StaticString(buffer, dataSize)) << "\"");
+	}
+
+	if (nbuffers <= IOV_MAX) {
+		ret = req->appSink.writev(buffers, nbuffers);
 	} else {
-		long long diff = monotonicNow - now;
-		deltaMonotonic = boost::to_string(-diff);
+		ret = 0;
+	}
+
+	if (ret == (ssize_t) dataSize) {
+		return;
+	} else if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		int e = errno;
+		disconnectWithAppSocketWriteError(&client, e);
+		return;
+	} else if (ret == -1) {
+		ret = 0;
 	}
 
-	unsigned int bufferSize = determineHeaderSizeForSessionProtocol(req,
-		state, deltaMonotonic);
+	// The socket (or ring) didn't accept everything, so copy the remainder
+	// and let appSink write it out when the socket becomes writable.
 	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
 	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
-	bool ok;
-
-	if (bufferSize <= MBUF_MAX_SIZE) {
+	if (dataSize <= MBUF_MAX_SIZE) {
 		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
-		bufferSize = MBUF_MAX_SIZE;
-
-		ok = constructHeaderForSessionProtocol(req, buffer.start,
-			bufferSize, state, deltaMonotonic);
-		assert(ok);
-		buffer = MemoryKit::mbuf(buffer, 0, bufferSize);
-		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
-			StaticString(buffer.start, bufferSize)) << "\"");
+		gatherBuffers(buffer.start, MBUF_MAX_SIZE, buffers, nbuffers);
+		buffer = MemoryKit::mbuf(buffer, ret, dataSize - ret);
 		req->appSink.feedWithoutRefGuard(boost::move(buffer));
 	} else {
-		char *buffer = (char *) psg_pnalloc(req->pool, bufferSize);
-
-		ok = constructHeaderForSessionProtocol(req, buffer,
-			bufferSize, state, deltaMonotonic);
-		assert(ok);
-		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
-			StaticString(buffer, bufferSize)) << "\"");
+		char *buffer = (char *) psg_pnalloc(req->pool, dataSize);
+		gatherBuffers(buffer, dataSize, buffers, nbuffers);
 		req->appSink.feedWithoutRefGuard(MemoryKit::mbuf(
-			buffer, bufferSize));
+			buffer + ret, dataSize - ret));
 	}
-
-	(void) ok; // Shut up compiler warning
 }
 
 void
@@ -316,17 +332,40 @@ httpHeaderToScgiUpperCase(unsigned char *data, unsigned int size) {
 	}
 }
 
-unsigned int
-Controller::determineHeaderSizeForSessionProtocol(Request *req,
-	SessionProtocolWorkingState &state, string delta_monotonic)
-{
-	unsigned int dataSize = sizeof(boost::uint32_t);
+/**
+ * Formats the difference between the wall clock and the monotonic clock into
+ * the working state's buffer. Ruby < 2.1 has no monotonic clock, so the app
+ * needs this to interpret our monotonic timestamps. Only needed when
+ * analytics is enabled, so we avoid the clock queries otherwise. Both
+ * times come from the event loop's time cache, so they are taken at the
+ * same instant.
+ */
+static void
+formatDeltaMonotonic(char *buffer, unsigned int bufsize, StaticString &result) {
+	unsigned long long now = SystemTime::getCachedUsec();
+	MonotonicTimeUsec monotonicNow = SystemTime::getCachedMonotonicUsec();
+	unsigned int size;
+
+	if (now > monotonicNow) {
+		size = integerToOtherBase<unsigned long long, 10>(now - monotonicNow,
+			buffer, bufsize);
+	} else {
+		buffer[0] = '-';
+		size = integerToOtherBase<unsigned long long, 10>(monotonicNow - now,
+			buffer + 1, bufsize - 1) + 1;
+	}
+	result = StaticString(buffer, size);
+}
 
+void
+Controller::initializeSessionProtocolWorkingState(Request *req,
+	SessionProtocolWorkingState &state)
+{
 	state.path        = req->getPathWithoutQueryString();
-	state.hasBaseURI  = req->options.baseURI != P_STATIC_STRING("/")
-		&& startsWith(state.path, req->options.baseURI);
+	state.hasBaseURI  = req->options->baseURI != P_STATIC_STRING("/")
+		&& startsWith(state.path, req->options->baseURI);
 	if (state.hasBaseURI) {
-		state.path = state.path.substr(req->options.baseURI.size());
+		state.path = state.path.substr(req->options->baseURI.size());
 		if (state.path.empty()) {
 			state.path = P_STATIC_STRING("/");
 		}
@@ -344,7 +383,7 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 	}
 	if (req->envvars != NULL) {
 		size_t len = modp_b64_decode_len(req->envvars->size);
-		state.environmentVariablesData = (char *) malloc(len);
+		state.environmentVariablesData = (char *) psg_pnalloc(req->pool, len);
 		if (state.environmentVariablesData == NULL) {
 			throw RuntimeException("Unable to allocate memory for base64 "
 				"decoding of environment variables");
@@ -358,25 +397,6 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.environmentVariablesSize = len;
 	}
 
-	dataSize += sizeof("REQUEST_URI");
-	dataSize += req->path.size + 1;
-
-	dataSize += sizeof("PATH_INFO");
-	dataSize += state.path.size() + 1;
-
-	dataSize += sizeof("SCRIPT_NAME");
-	if (state.hasBaseURI) {
-		dataSize += req->options.baseURI.size();
-	} else {
-		dataSize += sizeof("");
-	}
-
-	dataSize += sizeof("QUERY_STRING");
-	dataSize += state.queryString.size() + 1;
-
-	dataSize += sizeof("REQUEST_METHOD");
-	dataSize += state.methodStr.size() + 1;
-
 	if (req->host != NULL && req->host->size > 0) {
 		const LString *host = psg_lstr_make_contiguous(req->host, req->pool);
 		const char *sep = (const char *) memchr(host->start->data, ':', host->size);
@@ -397,192 +417,166 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.serverPort = defaultServerPort;
 	}
 
-	dataSize += sizeof("SERVER_NAME");
-	dataSize += state.serverName.size() + 1;
-
-	dataSize += sizeof("SERVER_PORT");
-	dataSize += state.serverPort.size() + 1;
-
-	dataSize += sizeof("SERVER_SOFTWARE");
-	dataSize += serverSoftware.size() + 1;
-
-	dataSize += sizeof("SERVER_PROTOCOL");
-	dataSize += sizeof("HTTP/1.1");
-
-	dataSize += sizeof("REMOTE_ADDR");
-	if (state.remoteAddr != NULL) {
-		dataSize += state.remoteAddr->size + 1;
-	} else {
-		dataSize += sizeof("127.0.0.1");
-	}
-
-	dataSize += sizeof("REMOTE_PORT");
-	if (state.remotePort != NULL) {
-		dataSize += state.remotePort->size + 1;
-	} else {
-		dataSize += sizeof("0");
-	}
-
-	if (state.remoteUser != NULL) {
-		dataSize += sizeof("REMOTE_USER");
-		dataSize += state.remoteUser->size + 1;
-	}
-
-	if (state.contentType != NULL) {
-		dataSize += sizeof("CONTENT_TYPE");
-		dataSize += state.contentType->size + 1;
-	}
-
-	if (state.contentLength != NULL) {
-		dataSize += sizeof("CONTENT_LENGTH");
-		dataSize += state.contentLength->size + 1;
+	if (req->appUsesUnionStation()) {
+		formatDeltaMonotonic(state.deltaMonotonicBuffer,
+			sizeof(state.deltaMonotonicBuffer), state.deltaMonotonic);
 	}
-
-	dataSize += sizeof("PASSENGER_CONNECT_PASSWORD");
-	dataSize += ApplicationPool2::ApiKey::SIZE + 1;
-
-	if (req->https) {
-		dataSize += sizeof("HTTPS");
-		dataSize += sizeof("on");
-	}
-
-	if (req->options.analytics) {
-		dataSize += sizeof("PASSENGER_TXN_ID");
-		dataSize += req->options.transaction->getTxnId().size() + 1;
-
-		dataSize += sizeof("PASSENGER_DELTA_MONOTONIC");
-		dataSize += delta_monotonic.size() + 1;
-	}
-
-	if (req->upgraded()) {
-		dataSize += sizeof("HTTP_CONNECTION");
-		dataSize += sizeof("upgrade");
-	}
-
-	ServerKit::HeaderTable::Iterator it(req->headers);
-	while (*it != NULL) {
-		dataSize += sizeof("HTTP_") - 1 + it->header->key.size + 1;
-		dataSize += it->header->val.size + 1;
-		it.next();
-	}
-
-	if (state.environmentVariablesData != NULL) {
-		dataSize += state.environmentVariablesSize;
-	}
-
-	return dataSize + 1;
 }
 
+/**
+ * Construct an array of buffers, which together contain the 'session' protocol
+ * header data that should be sent to the application. Like
+ * constructHeaderBuffersForHttpProtocol(), this method does not copy header
+ * values: the buffers point directly to the data stored inside `req->headers`,
+ * whose mbuf_blocks are kept alive by the request. Only header names are copied,
+ * because they have to be converted to their CGI form.
+ *
+ * The arguments and return value have the same meaning as those of
+ * constructHeaderBuffersForHttpProtocol().
+ */
 bool
-Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-	unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic)
+Controller::constructHeaderBuffersForSessionProtocol(Request *req, struct iovec *buffers,
+	unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
+	unsigned int & restrict_ref dataSize, SessionProtocolWorkingState &state)
 {
-	char *pos = buffer;
-	const char *end = buffer + size;
+	#define PUSH_BUFFER(data, size) \
+		do { \
+			if (buffers != NULL) { \
+				if (i >= maxbuffers) { \
+					return false; \
+				} \
+				buffers[i].iov_base = (void *) (data); \
+				buffers[i].iov_len  = (size); \
+			} \
+			i++; \
+			dataSize += (size); \
+		} while (false)
+	#define PUSH_STATIC_BUFFER(buf) \
+		PUSH_BUFFER(buf, sizeof(buf) - 1)
+	#define PUSH_STATIC_BUFFER_WITH_NULL(buf) \
+		PUSH_BUFFER(buf, sizeof(buf))
+	#define PUSH_STATIC_STRING(str) \
+		PUSH_BUFFER((str).data(), (str).size())
+	#define PUSH_LSTRING(str) \
+		do { \
+			const LString::Part *part = (str)->start; \
+			while (part != NULL) { \
+				PUSH_BUFFER(part->data, part->size); \
+				part = part->next; \
+			} \
+		} while (false)
+	#define PUSH_NULL() \
+		PUSH_BUFFER("", 1)
+
+	ServerKit::HeaderTable::Iterator it(req->headers);
+	unsigned int i = 0;
 
-	pos += sizeof(boost::uint32_t);
+	nbuffers = 0;
+	dataSize = 0;
+
+	PUSH_BUFFER(state.headerSizeBuffer, sizeof(boost::uint32_t));
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REQUEST_URI"));
-	pos = appendData(pos, end, req->path.start->data, req->path.size);
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("REQUEST_URI");
+	PUSH_BUFFER(req->path.start->data, req->path.size);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PATH_INFO"));
-	pos = appendData(pos, end, state.path.data(), state.path.size());
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("PATH_INFO");
+	PUSH_STATIC_STRING(state.path);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SCRIPT_NAME"));
+	PUSH_STATIC_BUFFER_WITH_NULL("SCRIPT_NAME");
 	if (state.hasBaseURI) {
-		pos = appendData(pos, end, req->options.baseURI);
-		pos = appendData(pos, end, "", 1);
-	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL(""));
+		PUSH_STATIC_STRING(req->options->baseURI);
 	}
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("QUERY_STRING"));
-	pos = appendData(pos, end, state.queryString.data(), state.queryString.size());
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("QUERY_STRING");
+	PUSH_STATIC_STRING(state.queryString);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REQUEST_METHOD"));
-	pos = appendData(pos, end, state.methodStr);
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("REQUEST_METHOD");
+	PUSH_STATIC_STRING(state.methodStr);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_NAME"));
-	pos = appendData(pos, end, state.serverName);
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("SERVER_NAME");
+	PUSH_STATIC_STRING(state.serverName);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_PORT"));
-	pos = appendData(pos, end, state.serverPort);
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("SERVER_PORT");
+	PUSH_STATIC_STRING(state.serverPort);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_SOFTWARE"));
-	pos = appendData(pos, end, serverSoftware);
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("SERVER_SOFTWARE");
+	PUSH_STATIC_STRING(serverSoftware);
+	PUSH_NULL();
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("SERVER_PROTOCOL"));
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTP/1.1"));
+	PUSH_STATIC_BUFFER_WITH_NULL("SERVER_PROTOCOL");
+	PUSH_STATIC_BUFFER_WITH_NULL("HTTP/1.1");
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_ADDR"));
+	PUSH_STATIC_BUFFER_WITH_NULL("REMOTE_ADDR");
 	if (state.remoteAddr != NULL) {
-		pos = appendData(pos, end, state.remoteAddr);
-		pos = appendData(pos, end, "", 1);
+		PUSH_LSTRING(state.remoteAddr);
+		PUSH_NULL();
 	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("127.0.0.1"));
+		PUSH_STATIC_BUFFER_WITH_NULL("127.0.0.1");
 	}
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_PORT"));
+	PUSH_STATIC_BUFFER_WITH_NULL("REMOTE_PORT");
 	if (state.remotePort != NULL) {
-		pos = appendData(pos, end, state.remotePort);
-		pos = appendData(pos, end, "", 1);
+		PUSH_LSTRING(state.remotePort);
+		PUSH_NULL();
 	} else {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("0"));
+		PUSH_STATIC_BUFFER_WITH_NULL("0");
 	}
 
 	if (state.remoteUser != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("REMOTE_USER"));
-		pos = appendData(pos, end, state.remoteUser);
-		pos = appendData(pos, end, "", 1);
+		PUSH_STATIC_BUFFER_WITH_NULL("REMOTE_USER");
+		PUSH_LSTRING(state.remoteUser);
+		PUSH_NULL();
 	}
 
 	if (state.contentType != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("CONTENT_TYPE"));
-		pos = appendData(pos, end, state.contentType);
-		pos = appendData(pos, end, "", 1);
+		PUSH_STATIC_BUFFER_WITH_NULL("CONTENT_TYPE");
+		PUSH_LSTRING(state.contentType);
+		PUSH_NULL();
 	}
 
 	if (state.contentLength != NULL) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("CONTENT_LENGTH"));
-		pos = appendData(pos, end, state.contentLength);
-		pos = appendData(pos, end, "", 1);
+		PUSH_STATIC_BUFFER_WITH_NULL("CONTENT_LENGTH");
+		PUSH_LSTRING(state.contentLength);
+		PUSH_NULL();
 	}
 
-	pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_CONNECT_PASSWORD"));
-	pos = appendData(pos, end, req->session->getApiKey().toStaticString());
-	pos = appendData(pos, end, "", 1);
+	PUSH_STATIC_BUFFER_WITH_NULL("PASSENGER_CONNECT_PASSWORD");
+	PUSH_STATIC_STRING(req->session->getApiKey().toStaticString());
+	PUSH_NULL();
 
 	if (req->https) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTPS"));
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("on"));
+		PUSH_STATIC_BUFFER_WITH_NULL("HTTPS");
+		PUSH_STATIC_BUFFER_WITH_NULL("on");
+	}
+
+	if (req->requestBodyFdPassing) {
+		PUSH_STATIC_BUFFER_WITH_NULL("PASSENGER_REQUEST_BODY_FD");
+		PUSH_STATIC_BUFFER_WITH_NULL("1");
 	}
 
-	if (req->options.analytics) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_TXN_ID"));
-		pos = appendData(pos, end, req->options.transaction->getTxnId());
-		pos = appendData(pos, end, "", 1);
+	if (req->appUsesUnionStation()) {
+		PUSH_STATIC_BUFFER_WITH_NULL("PASSENGER_TXN_ID");
+		PUSH_STATIC_STRING(req->poolOptions.transaction->getTxnId());
+		PUSH_NULL();
 
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("PASSENGER_DELTA_MONOTONIC"));
-		pos = appendData(pos, end, delta_monotonic);
-		pos = appendData(pos, end, "", 1);
+		PUSH_STATIC_BUFFER_WITH_NULL("PASSENGER_DELTA_MONOTONIC");
+		PUSH_STATIC_STRING(state.deltaMonotonic);
+		PUSH_NULL();
 	}
 
 	if (req->upgraded()) {
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("HTTP_CONNECTION"));
-		pos = appendData(pos, end, P_STATIC_STRING_WITH_NULL("upgrade"));
+		PUSH_STATIC_BUFFER_WITH_NULL("HTTP_CONNECTION");
+		PUSH_STATIC_BUFFER_WITH_NULL("upgrade");
 	}
 
-	ServerKit::HeaderTable::Iterator it(req->headers);
 	while (*it != NULL) {
-		// This header-skipping is not accounted for in determineHeaderSizeForSessionProtocol(), but
-		// since we are only reducing the size it just wastes some mem bytes.
 		if ((
 				(it->header->hash == HTTP_CONTENT_LENGTH.hash()
 						|| it->header->hash == HTTP_CONTENT_TYPE.hash()
@@ -598,34 +592,51 @@ Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buff
 			continue;
 		}
 
-		pos = appendData(pos, end, P_STATIC_STRING("HTTP_"));
-		const LString::Part *part = it->header->key.start;
-		while (part != NULL) {
-			char *start = pos;
-			pos = appendData(pos, end, part->data, part->size);
-			httpHeaderToScgiUpperCase((unsigned char *) start, pos - start);
-			part = part->next;
+		// "HTTP_" + the upper cased key + NULL
+		unsigned int keySize = sizeof("HTTP_") + it->header->key.size;
+		if (buffers != NULL) {
+			char *key = (char *) psg_pnalloc(req->pool, keySize);
+			char *pos = key;
+			const char *end = key + keySize;
+
+			pos = appendData(pos, end, P_STATIC_STRING("HTTP_"));
+			const LString::Part *part = it->header->key.start;
+			while (part != NULL) {
+				char *start = pos;
+				pos = appendData(pos, end, part->data, part->size);
+				httpHeaderToScgiUpperCase((unsigned char *) start, pos - start);
+				part = part->next;
+			}
+			*pos = '\0';
+			PUSH_BUFFER(key, keySize);
+		} else {
+			PUSH_BUFFER(NULL, keySize);
 		}
-		pos = appendData(pos, end, "", 1);
 
-		part = it->header->val.start;
-		while (part != NULL) {
-			pos = appendData(pos, end, part->data, part->size);
-			part = part->next;
-		}
-		pos = appendData(pos, end, "", 1);
+		PUSH_LSTRING(&it->header->val);
+		PUSH_NULL();
 
 		it.next();
 	}
 
 	if (state.environmentVariablesData != NULL) {
-		pos = appendData(pos, end, state.environmentVariablesData, state.environmentVariablesSize);
+		PUSH_BUFFER(state.environmentVariablesData, state.environmentVariablesSize);
+	}
+
+	if (buffers != NULL) {
+		Uint32Message::generate(state.headerSizeBuffer,
+			dataSize - sizeof(boost::uint32_t));
 	}
 
-	Uint32Message::generate(buffer, pos - buffer - sizeof(boost::uint32_t));
+	nbuffers = i;
+	return true;
 
-	size = pos - buffer;
-	return pos < end;
+	#undef PUSH_BUFFER
+	#undef PUSH_STATIC_BUFFER
+	#undef PUSH_STATIC_BUFFER_WITH_NULL
+	#undef PUSH_STATIC_STRING
+	#undef PUSH_LSTRING
+	#undef PUSH_NULL
 }
 
 void
@@ -863,16 +874,16 @@ Controller::constructHeaderBuffersForHttpProtocol(Request *req, struct iovec *bu
 		PUSH_STATIC_BUFFER("\r\n");
 	}
 
-	if (req->options.analytics) {
+	if (req->appUsesUnionStation()) {
 		PUSH_STATIC_BUFFER("!~Passenger-Txn-Id: ");
 
 		if (buffers != NULL) {
 			BEGIN_PUSH_NEXT_BUFFER();
-			buffers[i].iov_base = (void *) req->options.transaction->getTxnId().data();
-			buffers[i].iov_len  = req->options.transaction->getTxnId().size();
+			buffers[i].iov_base = (void *) req->poolOptions.transaction->getTxnId().data();
+			buffers[i].iov_len  = req->poolOptions.transaction->getTxnId().size();
 		}
 		INC_BUFFER_ITER(i);
-		dataSize += req->options.transaction->getTxnId().size();
+		dataSize += req->poolOptions.transaction->getTxnId().size();
 
 		PUSH_STATIC_BUFFER("\r\n");
 	}
@@ -900,10 +911,7 @@ Controller::sendHeaderToAppWithHttpProtocolAndWritev(Request *req, ssize_t &byte
 	if (constructHeaderBuffersForHttpProtocol(req, buffers,
 		maxbuffers, nbuffers, dataSize, cache))
 	{
-		ssize_t ret;
-		do {
-			ret = writev(req->session->fd(), buffers, nbuffers);
-		} while (ret == -1 && errno == EINTR);
+		ssize_t ret = req->appSink.writev(buffers, nbuffers);
 		bytesWritten = ret;
 		return ret == (ssize_t) dataSize;
 	} else {
@@ -957,7 +965,9 @@ Controller::sendBodyToApp(Client *client, Request *req) {
 			req->timeBeforeAccessingApplicationPool,
 			req->timeOnRequestHeaderSent);
 	#endif
-	if (req->hasBody() || req->upgraded()) {
+	if (req->requestBodyFdPassing) {
+		passRequestBodyFdToApp(client, req);
+	} else if (req->hasBody() || req->upgraded()) {
 		// onRequestBody() will take care of forwarding
 		// the request body to the app.
 		SKC_TRACE(client, 2, "Sending body to application");
@@ -980,7 +990,7 @@ Controller::maybeHalfCloseAppSinkBecauseRequestBodyEndReached(Client *client, Re
 		SKC_TRACE(client, 3, "Half-closing application socket with SHUT_WR"
 			" because end of request body reached");
 		req->halfClosePolicy = Request::HALF_CLOSE_PERFORMED;
-		::shutdown(req->session->fd(), SHUT_WR);
+		req->appSink.halfClose();
 	}
 }
 
@@ -1025,6 +1035,8 @@ Controller::whenSendingRequest_onRequestBody(Client *client, Request *req,
 				req->state = Request::WAITING_FOR_APP_OUTPUT;
 				stopBodyChannel(client, req);
 			}
+		} else if (canSpliceRequestBody(client, req)) {
+			beginSplicingRequestBody(client, req);
 		}
 		return Channel::Result(buffer.size(), false);
 	} else if (errcode == 0 || errcode == ECONNRESET) {
@@ -1094,6 +1106,236 @@ Controller::stopBodyChannel(Client *client, Request *req) {
 	}
 }
 
+/**
+ * Whether the rest of the request body can be spliced from the client socket
+ * to the application socket, instead of being read into mbufs and written out
+ * through appSink. Must be called from whenSendingRequest_onRequestBody()
+ * after appSink has written out everything that it was fed, and only applies
+ * when the body data came straight from `client->input`, so that no body
+ * data is left in the client's channels. Bodies that are buffered or
+ * dechunked are never spliced.
+ */
+bool
+Controller::canSpliceRequestBody(Client *client, Request *req) {
+	#ifdef __linux__
+		return spliceRequestBodies
+			&& client->tlsSession == NULL
+			&& req->bodyType == Request::RBT_CONTENT_LENGTH
+			&& !req->requestBodyBuffering
+			&& req->aux.bodyInfo.contentLength - req->bodyAlreadyRead
+				>= REQUEST_BODY_SPLICE_THRESHOLD
+			&& client->input.getState() == Channel::CALLING
+			&& req->bodyChannel.consumedCallback == NULL
+			&& !req->appSink.usesShmRing();
+	#else
+		return false;
+	#endif
+}
+
+void
+Controller::beginSplicingRequestBody(Client *client, Request *req) {
+	#ifdef __linux__
+		RequestColdState *cold = req->getColdState();
+
+		if (pipe2(cold->bodySplicePipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+			int e = errno;
+			SKC_WARN(client, "Cannot create a pipe for splicing the request body: " <<
+				strerror(e) << " (errno=" << e << ")");
+			cold->bodySplicePipe[0] = -1;
+			cold->bodySplicePipe[1] = -1;
+			return;
+		}
+		P_LOG_FILE_DESCRIPTOR_OPEN4(cold->bodySplicePipe[0], __FILE__, __LINE__,
+			"Request body splice pipe");
+		P_LOG_FILE_DESCRIPTOR_OPEN4(cold->bodySplicePipe[1], __FILE__, __LINE__,
+			"Request body splice pipe");
+
+		SKC_TRACE(client, 2, "Splicing the rest of the request body (" <<
+			(req->aux.bodyInfo.contentLength - req->bodyAlreadyRead) <<
+			" bytes) to the application");
+		// We're being called from within client->input's data callback,
+		// which has consumed all data that it was fed, so stopping it
+		// here leaves no data behind in it.
+		client->input.stop();
+		cold->bodySplicePipeBytes = 0;
+		ev_io_init(&cold->bodySpliceWatcher, onRequestBodySpliceEvent,
+			client->getFd(), EV_READ);
+		cold->bodySpliceWatcher.data = req;
+		ev_io_start(getLoop(), &cold->bodySpliceWatcher);
+	#endif
+}
+
+void
+Controller::onRequestBodySpliceEvent(EV_P_ ev_io *io, int revents) {
+	Request *req = static_cast<Request *>(io->data);
+	Client *client = static_cast<Client *>(req->client);
+	Controller *self = static_cast<Controller *>(getServerFromClient(client));
+	RequestRef ref(req, __FILE__, __LINE__);
+	SKC_LOG_EVENT_FROM_STATIC(self, Controller, client, "onRequestBodySpliceEvent");
+	self->spliceRequestBody(client, req);
+}
+
+/**
+ * Moves request body data from the client socket into the pipe, and from
+ * the pipe into the application socket. The pipe is only refilled once it
+ * has been emptied, so that body data is only accounted as read once it
+ * has reached the application.
+ */
+void
+Controller::spliceRequestBody(Client *client, Request *req) {
+	#ifdef __linux__
+		TRACE_POINT();
+		RequestColdState *cold = req->cold;
+		unsigned int i;
+		ssize_t ret;
+		int e;
+
+		P_ASSERT_EQ(req->state, Request::FORWARDING_BODY_TO_APP);
+		assert(req->splicingRequestBody());
+
+		for (i = 0; i < REQUEST_BODY_SPLICE_BURST_COUNT; i++) {
+			if (cold->bodySplicePipeBytes == 0) {
+				boost::uint64_t remaining = req->aux.bodyInfo.contentLength
+					- req->bodyAlreadyRead;
+				do {
+					ret = splice(client->getFd(), NULL, cold->bodySplicePipe[1], NULL,
+						std::min<boost::uint64_t>(remaining, REQUEST_BODY_SPLICE_CHUNK_SIZE),
+						SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				} while (ret == -1 && errno == EINTR);
+
+				if (ret > 0) {
+					cold->bodySplicePipeBytes = ret;
+				} else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					waitForRequestBodySpliceEvent(req, client->getFd(), EV_READ);
+					return;
+				} else if (ret == -1 && errno == EINVAL) {
+					// The kernel cannot splice from this kind of socket. The
+					// pipe is empty, so we can safely fall back to forwarding
+					// the body through client->input.
+					SKC_DEBUG(client, "Splicing from client sockets is not supported "
+						"by the kernel; forwarding request bodies without splicing");
+					spliceRequestBodies = false;
+					endSplicingRequestBody(client, req);
+					client->input.start();
+					return;
+				} else {
+					e = (ret == 0) ? 0 : errno;
+					endSplicingRequestBody(client, req);
+					requestBodyExternalReadError(client, req, e);
+					return;
+				}
+			}
+
+			do {
+				ret = splice(cold->bodySplicePipe[0], NULL, req->session->fd(), NULL,
+					cold->bodySplicePipeBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			} while (ret == -1 && errno == EINTR);
+
+			if (ret > 0) {
+				bool done;
+
+				cold->bodySplicePipeBytes -= ret;
+				done = cold->bodySplicePipeBytes == 0
+					&& req->bodyAlreadyRead + ret >= req->aux.bodyInfo.contentLength;
+				if (done) {
+					endSplicingRequestBody(client, req);
+				}
+				// Feeds EOF to the body channel once the body is fully
+				// read, which ends up in whenSendingRequest_onRequestBody().
+				requestBodyReadExternally(client, req, ret);
+				if (done || req->ended()) {
+					return;
+				}
+			} else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				waitForRequestBodySpliceEvent(req, req->session->fd(), EV_WRITE);
+				return;
+			} else {
+				// Just like a write error on appSink, we don't care about
+				// this; ForwardResponse.cpp will now forward the response
+				// data and end the request when it's done.
+				e = errno;
+				endSplicingRequestBody(client, req);
+				logAppSocketWriteError(client, e);
+				req->state = Request::WAITING_FOR_APP_OUTPUT;
+				return;
+			}
+		}
+
+		// Give other clients a chance before continuing.
+		if (cold->bodySplicePipeBytes > 0) {
+			waitForRequestBodySpliceEvent(req, req->session->fd(), EV_WRITE);
+		} else {
+			waitForRequestBodySpliceEvent(req, client->getFd(), EV_READ);
+		}
+	#endif
+}
+
+void
+Controller::waitForRequestBodySpliceEvent(Request *req, int fd, int events) {
+	ev_io *watcher = &req->cold->bodySpliceWatcher;
+	if (watcher->fd != fd || (watcher->events & (EV_READ | EV_WRITE)) != events) {
+		ev_io_stop(getLoop(), watcher);
+		ev_io_set(watcher, fd, events);
+	}
+	ev_io_start(getLoop(), watcher);
+}
+
+void
+Controller::endSplicingRequestBody(Client *client, Request *req) {
+	if (!req->splicingRequestBody()) {
+		return;
+	}
+	RequestColdState *cold = req->cold;
+	ev_io_stop(getLoop(), &cold->bodySpliceWatcher);
+	safelyClose(cold->bodySplicePipe[0], true);
+	P_LOG_FILE_DESCRIPTOR_CLOSE(cold->bodySplicePipe[0]);
+	safelyClose(cold->bodySplicePipe[1], true);
+	P_LOG_FILE_DESCRIPTOR_CLOSE(cold->bodySplicePipe[1]);
+	cold->bodySplicePipe[0] = -1;
+	cold->bodySplicePipe[1] = -1;
+}
+
+/**
+ * Whether the buffered request body can be passed to the app as a file
+ * descriptor, instead of being sent over the application socket. This saves
+ * both us and the app from copying the body: the app can use the file as its
+ * rewindable request body input directly. Applies to bodies that have been
+ * buffered entirely and that were large enough to be moved to bodyBuffer's
+ * buffer file, which whenBufferingBody_onRequestBody() ensures is complete at
+ * this point. The app must have advertised support for it.
+ */
+bool
+Controller::canPassRequestBodyFd(Client *client, Request *req) {
+	return req->requestBodyBuffering
+		&& !req->streamingBufferedBody
+		&& req->bodyBuffer.getBufferFileFd() != -1
+		&& req->bodyBuffer.getBytesBuffered() == 0
+		&& req->session->acceptsRequestBodyFd()
+		&& !req->appSink.usesShmRing();
+}
+
+/**
+ * Passes bodyBuffer's buffer file to the app. The file contains exactly the
+ * request body, starting at offset 0. The app receives it as ancillary data
+ * along with a single dummy byte that follows the header, as advertised by
+ * the PASSENGER_REQUEST_BODY_FD header. No body data is sent over the
+ * application socket.
+ */
+void
+Controller::passRequestBodyFdToApp(Client *client, Request *req) {
+	TRACE_POINT();
+	SKC_TRACE(client, 2, "Passing request body buffer file (" <<
+		req->bodyBytesBuffered << " bytes) to application");
+	try {
+		writeFileDescriptor(req->session->fd(), req->bodyBuffer.getBufferFileFd());
+	} catch (const SystemException &e) {
+		disconnectWithAppSocketWriteError(&client, e.code());
+		return;
+	}
+	req->state = Request::WAITING_FOR_APP_OUTPUT;
+	maybeHalfCloseAppSinkBecauseRequestBodyEndReached(client, req);
+}
+
 void
 Controller::logAppSocketWriteError(Client *client, int errcode) {
 	if (errcode == EPIPE) {
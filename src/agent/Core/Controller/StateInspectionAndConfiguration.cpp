@@ -53,108 +53,301 @@ Controller::getConfigAsJson() const {
 	doc["stat_throttle_rate"] = statThrottleRate;
 	doc["show_version_in_header"] = showVersionInHeader;
 	doc["data_buffer_dir"] = getContext()->defaultFileBufferedChannelConfig.bufferDir;
+	doc["file_buffer_threshold"] = getContext()->defaultFileBufferedChannelConfig.threshold;
+	doc["response_buffer_high_watermark"] = responseBufferHighWatermark;
+	doc["response_buffer_full_buffering_size"] = responseBufferFullBufferingSize;
+	doc["request_body_prebuffer_size"] = requestBodyPrebufferSize;
+	doc["request_body_slow_rate"] = requestBodySlowRate;
+	doc["turbocache_max_body_size"] = turboCaching.responseCache.getMaxBodySize();
+	doc["turbocache_coalescing_timeout"] = (Json::UInt) (coalescingTimeout * 1000);
+	doc["websocket_drain_time"] = (Json::UInt) websocketDrainTime;
 	return doc;
 }
 
+/**
+ * Applies the given settings. Called through the API server's /config.json
+ * while the Controller is serving requests, so every setting here only
+ * affects what happens from now on: buffer sizes and thresholds apply to
+ * responses and request bodies that start buffering afterwards, and the
+ * turbocache keeps the entries that it already stored.
+ */
 void
 Controller::configure(const Json::Value &doc) {
 	ParentClass::configure(doc);
 	if (doc.isMember("show_version_in_header")) {
 		showVersionInHeader = doc["show_version_in_header"].asBool();
 	}
+	if (doc.isMember("stat_throttle_rate")) {
+		statThrottleRate = doc["stat_throttle_rate"].asUInt();
+	}
 	if (doc.isMember("data_buffer_dir")) {
 		getContext()->defaultFileBufferedChannelConfig.bufferDir =
 			doc["data_buffer_dir"].asString();
 	}
+	if (doc.isMember("file_buffer_threshold")) {
+		getContext()->defaultFileBufferedChannelConfig.threshold =
+			doc["file_buffer_threshold"].asUInt();
+	}
+	if (doc.isMember("response_buffer_high_watermark")) {
+		responseBufferHighWatermark = doc["response_buffer_high_watermark"].asUInt();
+	}
+	if (doc.isMember("response_buffer_full_buffering_size")) {
+		responseBufferFullBufferingSize = doc["response_buffer_full_buffering_size"].asUInt();
+	}
+	if (doc.isMember("request_body_prebuffer_size")) {
+		requestBodyPrebufferSize = doc["request_body_prebuffer_size"].asUInt();
+	}
+	if (doc.isMember("request_body_slow_rate")) {
+		requestBodySlowRate = doc["request_body_slow_rate"].asUInt();
+	}
+	if (doc.isMember("turbocache_max_body_size")) {
+		turboCaching.responseCache.setMaxBodySize(doc["turbocache_max_body_size"].asUInt());
+	}
+	if (doc.isMember("turbocache_coalescing_timeout")) {
+		coalescingTimeout = doc["turbocache_coalescing_timeout"].asUInt() / 1000.0;
+		if (!LIST_EMPTY(&coalescedRequests)) {
+			// The coalescing timer was set for the old timeout.
+			ev_timer_stop(getLoop(), &coalescingTimer);
+			expireCoalescedRequests(ev_now(getLoop()));
+		}
+	}
+	if (doc.isMember("websocket_drain_time")) {
+		// Connections that are already draining keep their schedule.
+		websocketDrainTime = doc["websocket_drain_time"].asUInt();
+	}
 }
 
-Json::Value
-Controller::inspectStateAsJson() const {
-	Json::Value doc = ParentClass::inspectStateAsJson();
+void
+Controller::writeStateAsJson(JsonWriter &writer) const {
+	ParentClass::writeStateAsJson(writer);
 	if (turboCaching.isEnabled()) {
-		Json::Value subdoc;
-		subdoc["fetches"] = turboCaching.responseCache.getFetches();
-		subdoc["hits"] = turboCaching.responseCache.getHits();
-		subdoc["hit_ratio"] = turboCaching.responseCache.getHitRatio();
-		subdoc["stores"] = turboCaching.responseCache.getStores();
-		subdoc["store_successes"] = turboCaching.responseCache.getStoreSuccesses();
-		subdoc["store_success_ratio"] = turboCaching.responseCache.getStoreSuccessRatio();
-		doc["turbocaching"] = subdoc;
+		writer.key("turbocaching");
+		writer.beginObject();
+		writer.member("fetches", turboCaching.responseCache.getFetches());
+		writer.member("hits", turboCaching.responseCache.getHits());
+		writer.member("hit_ratio", turboCaching.responseCache.getHitRatio());
+		writer.member("stores", turboCaching.responseCache.getStores());
+		writer.member("store_successes", turboCaching.responseCache.getStoreSuccesses());
+		writer.member("store_success_ratio", turboCaching.responseCache.getStoreSuccessRatio());
+		writer.member("statistics", turboCaching.inspectStatisticsAsJson());
+		writer.member("huge_pages", MemoryKit::hugepage_backing_name(
+			turboCaching.responseCache.getHugePageBacking()));
+		if (turboCaching.responseCache.getHugePageMappingSize() > 0) {
+			writer.member("huge_page_memory", byteSizeToJson(
+				turboCaching.responseCache.getHugePageMappingSize()));
+		}
+		if (sharedResponseCache != NULL) {
+			writer.member("shared_cache", sharedResponseCache->inspectStateAsJson());
+		}
+		if (coalescingTimeout > 0) {
+			writer.member("coalesced_requests", coalescedRequestCount);
+		}
+		writer.endObject();
 	}
-	return doc;
+	if (rateLimiter != NULL) {
+		writer.key("rate_limiting");
+		writer.beginObject();
+		writer.member("rejected_requests", rateLimitedRequestCount);
+		writer.member("keys", rateLimitBuckets.size());
+		writer.member("shared", rateLimiter->inspectStateAsJson());
+		writer.endObject();
+	}
+	writer.member("request_stages", inspectRequestStagesAsJson());
+	writer.member("event_loop", inspectEventLoopAsJson());
 }
 
+/**
+ * Returns how busy this Controller's event loop is. Iteration times are
+ * the time spent running callbacks between two waits for events, in
+ * microseconds.
+ */
 Json::Value
-Controller::inspectClientStateAsJson(const Client *client) const {
-	Json::Value doc = ParentClass::inspectClientStateAsJson(client);
-	doc["connected_at"] = evTimeToJson(client->connectedAt, ev_now(getLoop()));
+Controller::inspectEventLoopAsJson() const {
+	Json::Value doc;
+	boost::uint64_t totalTime = loopBusyTime + loopBlockedTime;
+
+	doc["iterations"] = (Json::UInt64) loopIterations;
+	doc["busy_time"] = (Json::UInt64) loopBusyTime;
+	doc["blocked_time"] = (Json::UInt64) loopBlockedTime;
+	if (totalTime > 0) {
+		doc["utilization"] = capFloatPrecision(100.0 * loopBusyTime / totalTime);
+	} else {
+		doc["utilization"] = 0;
+	}
+	if (loopIterations > 0) {
+		doc["callbacks_per_iteration"] = capFloatPrecision(
+			(double) loopCallbacks / loopIterations);
+	} else {
+		doc["callbacks_per_iteration"] = 0;
+	}
+	doc["iteration_time"]["p50"] = (Json::UInt64) loopIterationTimes.getPercentile(50);
+	doc["iteration_time"]["p99"] = (Json::UInt64) loopIterationTimes.getPercentile(99);
+	doc["iteration_time"]["max"] = (Json::UInt64) loopIterationTimes.getMax();
+	doc["iteration_time"]["recent_max"] = std::max(loopMaxIterationTime,
+		lastLoopMaxIterationTime);
+	doc["pending_commands"] = getContext()->libev->getPendingCommandCount();
 	return doc;
 }
 
+/**
+ * Returns this Controller's request stage latency histograms, summarized
+ * per application group. All times are in microseconds.
+ */
 Json::Value
-Controller::inspectRequestStateAsJson(const Request *req) const {
-	Json::Value doc = ParentClass::inspectRequestStateAsJson(req);
-	Json::Value flags;
+Controller::inspectRequestStagesAsJson() const {
+	Json::Value doc(Json::objectValue);
+	StringKeyTable<RequestStageHistograms>::ConstIterator it(requestStageHistograms);
+
+	while (*it != NULL) {
+		const RequestStageHistograms &histograms = it.getValue();
+		Json::Value groupDoc(Json::objectValue);
+
+		for (unsigned int i = 0; i < REQUEST_STAGE_COUNT; i++) {
+			const LatencyHistogram &histogram = histograms.stages[i];
+			if (histogram.getCount() == 0) {
+				continue;
+			}
+
+			Json::Value stageDoc;
+			stageDoc["count"] = (Json::UInt64) histogram.getCount();
+			stageDoc["avg"] = (Json::UInt64) histogram.getAverage();
+			stageDoc["p50"] = (Json::UInt64) histogram.getPercentile(50);
+			stageDoc["p90"] = (Json::UInt64) histogram.getPercentile(90);
+			stageDoc["p99"] = (Json::UInt64) histogram.getPercentile(99);
+			stageDoc["max"] = (Json::UInt64) histogram.getMax();
+			groupDoc[getRequestStageName((RequestStage) i)] = stageDoc;
+		}
+
+		doc[it.getKey().toString()] = groupDoc;
+		it.next();
+	}
+	return doc;
+}
+
+void
+Controller::collectMetrics(ControllerMetrics &metrics) const {
+	const struct MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
+
+	metrics.activeClientCount = activeClientCount;
+	metrics.totalClientsAccepted = totalClientsAccepted;
+	metrics.totalRequestsBegun = totalRequestsBegun;
+	memcpy(metrics.responsesByStatusClass, responsesByStatusClass,
+		sizeof(metrics.responsesByStatusClass));
+	turboCaching.getTotalFetchesAndHits(metrics.turboCacheFetches,
+		metrics.turboCacheHits);
+	metrics.eventLoopIterations = loopIterations;
+	metrics.eventLoopBusyTime = loopBusyTime;
+	metrics.eventLoopBlockedTime = loopBlockedTime;
+	metrics.eventLoopCallbacks = loopCallbacks;
+	metrics.eventLoopMaxIterationTime = std::max(loopMaxIterationTime,
+		lastLoopMaxIterationTime);
+	metrics.eventLoopPendingCommands = getContext()->libev->getPendingCommandCount();
+
+	metrics.mbufActiveBlocks = mbuf_pool.nactive_mbuf_blockq;
+	metrics.mbufFreeBlocks = mbuf_pool.nfree_mbuf_blockq;
+	metrics.mbufActiveBytes = (boost::uint64_t) mbuf_pool.nactive_mbuf_blockq
+		* mbuf_pool.mbuf_block_chunk_size;
+	metrics.mbufFreeBytes = (boost::uint64_t) mbuf_pool.nfree_mbuf_blockq
+		* mbuf_pool.mbuf_block_chunk_size;
+	for (unsigned int i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+		const struct MemoryKit::mbuf_size_class *sizeClass = &mbuf_pool.size_classes[i];
+		metrics.mbufActiveBlocks += sizeClass->nactive_mbuf_blockq;
+		metrics.mbufFreeBlocks += sizeClass->nfree_mbuf_blockq;
+		metrics.mbufActiveBytes += (boost::uint64_t) sizeClass->nactive_mbuf_blockq
+			* sizeClass->mbuf_block_chunk_size;
+		metrics.mbufFreeBytes += (boost::uint64_t) sizeClass->nfree_mbuf_blockq
+			* sizeClass->mbuf_block_chunk_size;
+	}
+}
+
+void
+Controller::writeClientStateAsJson(JsonWriter &writer, const Client *client) const {
+	ParentClass::writeClientStateAsJson(writer, client);
+	writer.key("connected_at");
+	evTimeToJson(writer, client->connectedAt, ev_now(getLoop()));
+	if (client->responseDrainRate >= 0) {
+		writer.member("response_drain_rate", client->responseDrainRate);
+	}
+}
+
+void
+Controller::writeRequestStateAsJson(JsonWriter &writer, const Request *req) const {
+	ParentClass::writeRequestStateAsJson(writer, req);
 	const AppResponse *resp = &req->appResponse;
 
 	if (req->startedAt != 0) {
-		doc["started_at"] = evTimeToJson(req->startedAt, ev_now(getLoop()));
+		writer.key("started_at");
+		evTimeToJson(writer, req->startedAt, ev_now(getLoop()));
 	}
-	doc["state"] = req->getStateString();
+	writer.member("state", req->getStateString());
 	if (req->stickySession) {
-		doc["sticky_session_id"] = req->options.stickySessionId;
+		writer.member("sticky_session_id", req->poolOptions.stickySessionId);
 	}
-	doc["sticky_session"] = req->stickySession;
-	doc["session_checkout_try"] = req->sessionCheckoutTry;
+	writer.member("sticky_session", (bool) req->stickySession);
+	writer.member("session_checkout_try", (unsigned int) req->sessionCheckoutTry);
 
-	flags["dechunk_response"] = req->dechunkResponse;
-	flags["request_body_buffering"] = req->requestBodyBuffering;
-	flags["https"] = req->https;
-	doc["flags"] = flags;
+	writer.key("flags");
+	writer.beginObject();
+	writer.member("dechunk_response", (bool) req->dechunkResponse);
+	writer.member("request_body_buffering", (bool) req->requestBodyBuffering);
+	writer.member("streaming_buffered_body", (bool) req->streamingBufferedBody);
+	writer.member("request_body_fd_passing", (bool) req->requestBodyFdPassing);
+	writer.member("splicing_request_body", req->splicingRequestBody());
+	writer.member("https", (bool) req->https);
+	writer.endObject();
 
 	if (req->requestBodyBuffering) {
-		doc["body_bytes_buffered"] = byteSizeToJson(req->bodyBytesBuffered);
+		writer.key("body_bytes_buffered");
+		byteSizeToJson(writer, req->bodyBytesBuffered);
 	}
 
 	if (req->session != NULL) {
-		Json::Value &sessionDoc = doc["session"] = Json::Value(Json::objectValue);
 		const AbstractSession *session = req->session.get();
 
+		writer.key("session");
+		writer.beginObject();
 		if (req->session->isClosed()) {
-			sessionDoc["closed"] = true;
+			writer.member("closed", true);
 		} else {
-			sessionDoc["pid"] = (Json::Int64) session->getPid();
-			sessionDoc["gupid"] = session->getGupid().toString();
+			writer.member("pid", (long long) session->getPid());
+			writer.member("gupid", session->getGupid());
 		}
+		writer.endObject();
 	}
 
 	if (req->appResponseInitialized) {
-		doc["app_response_http_state"] = resp->getHttpStateString();
+		writer.member("app_response_http_state", resp->getHttpStateString());
 		if (resp->begun()) {
-			doc["app_response_http_major"] = resp->httpMajor;
-			doc["app_response_http_minor"] = resp->httpMinor;
-			doc["app_response_want_keep_alive"] = resp->wantKeepAlive;
-			doc["app_response_body_type"] = resp->getBodyTypeString();
-			doc["app_response_body_fully_read"] = resp->bodyFullyRead();
-			doc["app_response_body_already_read"] = byteSizeToJson(
-				resp->bodyAlreadyRead);
+			writer.member("app_response_http_major", (int) resp->httpMajor);
+			writer.member("app_response_http_minor", (int) resp->httpMinor);
+			writer.member("app_response_want_keep_alive", (bool) resp->wantKeepAlive);
+			writer.member("app_response_body_type", resp->getBodyTypeString());
+			writer.member("app_response_body_fully_read", resp->bodyFullyRead());
+			writer.key("app_response_body_already_read");
+			byteSizeToJson(writer, resp->bodyAlreadyRead);
 			if (resp->httpState != AppResponse::ERROR) {
 				if (resp->bodyType == AppResponse::RBT_CONTENT_LENGTH) {
-					doc["app_response_content_length"] = byteSizeToJson(
-						resp->aux.bodyInfo.contentLength);
+					writer.key("app_response_content_length");
+					byteSizeToJson(writer, resp->aux.bodyInfo.contentLength);
 				} else if (resp->bodyType == AppResponse::RBT_CHUNKED) {
-					doc["app_response_end_chunk_reached"] = resp->aux.bodyInfo.endChunkReached;
+					writer.member("app_response_end_chunk_reached",
+						resp->aux.bodyInfo.endChunkReached);
 				}
 			} else {
-				doc["app_response_parse_error"] = ServerKit::getErrorDesc(resp->aux.parseError);
+				writer.member("app_response_parse_error",
+					ServerKit::getErrorDesc(resp->aux.parseError));
 			}
 		}
 	}
 
-	doc["app_source_state"] = req->appSource.inspectAsJson();
-	doc["app_sink_state"] = req->appSink.inspectAsJson();
-
-	return doc;
+	writer.key("app_source_state");
+	writer.beginObject();
+	req->appSource.writeStateAsJson(writer);
+	writer.endObject();
+	writer.key("app_sink_state");
+	writer.beginObject();
+	req->appSink.writeStateAsJson(writer);
+	writer.endObject();
 }
 
 
@@ -0,0 +1,382 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2011-2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/Controller.h>
+
+/*************************************************************************
+ *
+ * Serving of static files for Core::Controller
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+using namespace boost;
+
+
+/****************************
+ *
+ * Private methods
+ *
+ ****************************/
+
+
+static bool
+isServableStaticFilePath(const StaticString &path) {
+	if (path.empty() || path[0] != '/' || path[path.size() - 1] == '/') {
+		return false;
+	}
+	// Percent-encoded paths are left to the app, so that we never have
+	// to decode them ourselves.
+	return path.find('%') == string::npos
+		&& path.find('\0') == string::npos
+		&& path.find("/..") == string::npos;
+}
+
+static const char *
+getStaticFileContentType(const StaticString &path) {
+	static const struct {
+		const char *extension;
+		const char *type;
+	} types[] = {
+		{ "html", "text/html" },
+		{ "htm", "text/html" },
+		{ "css", "text/css" },
+		{ "js", "application/javascript" },
+		{ "json", "application/json" },
+		{ "map", "application/json" },
+		{ "txt", "text/plain" },
+		{ "xml", "text/xml" },
+		{ "svg", "image/svg+xml" },
+		{ "png", "image/png" },
+		{ "jpg", "image/jpeg" },
+		{ "jpeg", "image/jpeg" },
+		{ "gif", "image/gif" },
+		{ "ico", "image/x-icon" },
+		{ "webp", "image/webp" },
+		{ "woff", "application/font-woff" },
+		{ "woff2", "font/woff2" },
+		{ "ttf", "application/x-font-ttf" },
+		{ "otf", "font/opentype" },
+		{ "eot", "application/vnd.ms-fontobject" },
+		{ "pdf", "application/pdf" },
+		{ "mp3", "audio/mpeg" },
+		{ "mp4", "video/mp4" },
+		{ "webm", "video/webm" },
+		{ "wasm", "application/wasm" },
+		{ "zip", "application/zip" }
+	};
+	const char *pos = path.data() + path.size();
+
+	while (pos > path.data() && pos[-1] != '.' && pos[-1] != '/') {
+		pos--;
+	}
+	if (pos > path.data() && pos[-1] == '.') {
+		StaticString extension(pos, path.data() + path.size() - pos);
+		for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+			if (equalsCaseInsensitive(extension, types[i].extension)) {
+				return types[i].type;
+			}
+		}
+	}
+	return "application/octet-stream";
+}
+
+static char *
+formatStaticFileHttpDate(psg_pool_t *pool, time_t time) {
+	const unsigned int BUFSIZE = 64;
+	char *buf = (char *) psg_pnalloc(pool, BUFSIZE);
+	struct tm the_tm;
+
+	gmtime_r(&time, &the_tm);
+	strftime(buf, BUFSIZE, "%a, %d %b %Y %H:%M:%S GMT", &the_tm);
+	return buf;
+}
+
+/**
+ * Called for GET and HEAD requests if serve_static_files is enabled. If the
+ * request path names a regular file in the app's public directory, then
+ * responds with that file and returns true. Otherwise returns false, and the
+ * request is forwarded to the app as usual.
+ *
+ * Precompressed `.gz` variants are served to clients that accept gzip.
+ * ETag and Last-Modified headers are derived from the file's mtime and size,
+ * and conditional requests with a matching If-None-Match or If-Modified-Since
+ * header are answered with 304. The body is sent by sendXSendfileBody(),
+ * unless the web server in front sends it (see delegateFileBody()).
+ */
+bool
+Controller::serveStaticFile(Client *client, Request *req) {
+	TRACE_POINT();
+
+	if ((req->method != HTTP_GET && req->method != HTTP_HEAD)
+	 || req->bodyType != Request::RBT_NO_BODY)
+	{
+		return false;
+	}
+
+	StaticString path = req->getPathWithoutQueryString();
+	if (!isServableStaticFilePath(path)) {
+		return false;
+	}
+
+	string filename;
+	filename.reserve(req->options->appRoot.size() + sizeof("/public") + path.size());
+	filename.append(req->options->appRoot.data(), req->options->appRoot.size());
+	filename.append("/public", sizeof("/public") - 1);
+	filename.append(path.data(), path.size());
+
+	struct stat buf;
+	if (staticFileStat.stat(filename, &buf, statThrottleRate) == -1
+	 || !S_ISREG(buf.st_mode))
+	{
+		return false;
+	}
+
+	UPDATE_TRACE_POINT();
+	string gzipFilename = filename + ".gz";
+	struct stat gzipBuf;
+	bool hasGzipVariant = staticFileStat.stat(gzipFilename, &gzipBuf,
+		statThrottleRate) == 0 && S_ISREG(gzipBuf.st_mode);
+	bool useGzipVariant = hasGzipVariant && acceptEncodingAllowsGzip(
+		lookupAndFlattenHeader(req, HTTP_ACCEPT_ENCODING));
+
+	OpenStaticFile *file = useGzipVariant
+		? openStaticFile(client, req, gzipFilename, gzipBuf)
+		: openStaticFile(client, req, filename, buf);
+	if (file == NULL) {
+		return false;
+	}
+
+	UPDATE_TRACE_POINT();
+	ServerKit::HeaderTable headers;
+	const unsigned int BUFSIZE = 64;
+	char *etag = (char *) psg_pnalloc(req->pool, BUFSIZE);
+	char *lastModified = formatStaticFileHttpDate(req->pool, file->mtime);
+	const LString *value;
+	boost::uint64_t start, end, size;
+	int code = 200, rangeResult = 0;
+
+	snprintf(etag, BUFSIZE, "\"%llx-%llx\"",
+		(unsigned long long) file->mtime,
+		(unsigned long long) file->size);
+	headers.insert(req->pool, "Content-Type", getStaticFileContentType(path));
+	headers.insert(req->pool, "Date", formatStaticFileHttpDate(req->pool,
+		(time_t) ev_now(getLoop())));
+	headers.insert(req->pool, "Last-Modified", lastModified);
+	headers.insert(req->pool, "ETag", etag);
+	headers.insert(req->pool, "Accept-Ranges", "bytes");
+	if (hasGzipVariant) {
+		headers.insert(req->pool, "Vary", "Accept-Encoding");
+	}
+	if (useGzipVariant) {
+		headers.insert(req->pool, "Content-Encoding", "gzip");
+	}
+
+	start = 0;
+	end = (file->size > 0) ? file->size - 1 : 0;
+	size = file->size;
+
+	if ((value = lookupAndFlattenHeader(req, "if-none-match")) != NULL) {
+		StaticString ifNoneMatch(value->start->data, value->size);
+		if (ifNoneMatch == "*" || ifNoneMatch.find(etag) != string::npos) {
+			code = 304;
+		}
+	} else if ((value = lookupAndFlattenHeader(req, "if-modified-since")) != NULL) {
+		if (StaticString(value->start->data, value->size) == lastModified) {
+			code = 304;
+		}
+	}
+
+	if (code == 200
+	 && (value = lookupAndFlattenHeader(req, HTTP_RANGE)) != NULL
+	 && req->headers.lookup("if-range") == NULL)
+	{
+		rangeResult = ResponseCache<Request>::parseByteRange(
+			StaticString(value->start->data, value->size),
+			file->size, start, end);
+		if (rangeResult == -1) {
+			char *contentRange = (char *) psg_pnalloc(req->pool, BUFSIZE);
+			snprintf(contentRange, BUFSIZE, "bytes */%llu",
+				(unsigned long long) file->size);
+			headers.insert(req->pool, "Content-Range", contentRange);
+			code = 416;
+			size = 0;
+		} else if (rangeResult == 1) {
+			char *contentRange = (char *) psg_pnalloc(req->pool, BUFSIZE);
+			snprintf(contentRange, BUFSIZE, "bytes %llu-%llu/%llu",
+				(unsigned long long) start, (unsigned long long) end,
+				(unsigned long long) file->size);
+			headers.insert(req->pool, "Content-Range", contentRange);
+			code = 206;
+			size = end - start + 1;
+		}
+	}
+
+	bool delegated = (code == 200 || code == 206)
+		&& size > 0
+		&& req->method != HTTP_HEAD
+		&& delegateFileBody(client, req, headers,
+			useGzipVariant ? gzipFilename : filename, start, size);
+
+	SKC_DEBUG(client, "Serving static file " <<
+		(useGzipVariant ? gzipFilename : filename) << " with status " << code);
+	writeSimpleResponseHeader(client, code, &headers, size);
+	if (req->ended()) {
+		return true;
+	}
+
+	if (code == 304 || size == 0 || req->method == HTTP_HEAD || delegated) {
+		endRequest(&client, &req);
+		return true;
+	}
+
+	UPDATE_TRACE_POINT();
+	int fd;
+	do {
+		fd = dup(file->fd);
+	} while (fd == -1 && errno == EINTR);
+	if (fd == -1) {
+		int e = errno;
+		disconnectWithError(&client, "cannot duplicate static file descriptor: "
+			+ string(strerror(e)) + " (errno=" + toString(e) + ")");
+		return true;
+	}
+	P_LOG_FILE_DESCRIPTOR_OPEN4(fd, __FILE__, __LINE__, "Static file");
+	req->xSendfileFd = fd;
+	req->xSendfileOffset = start;
+	req->xSendfileRemaining = size;
+	sendXSendfileBody(client, req);
+	return true;
+}
+
+/**
+ * Returns the cached open file for the given static file, opening it if
+ * necessary. `buf` is the (possibly throttled) stat information of the file.
+ * A cached file descriptor is only used if it still refers to the same
+ * version of the file, so that deploys are picked up once statThrottleRate
+ * has passed.
+ *
+ * Like X-Sendfile, only files that reside inside the application root
+ * after resolving symlinks are served, because the Core may be running with
+ * more privileges than the app. Returns NULL for other files.
+ */
+Controller::OpenStaticFile *
+Controller::openStaticFile(Client *client, Request *req, const string &filename,
+	const struct stat &buf)
+{
+	TRACE_POINT();
+
+	if (filename.size() > StringKeyTable<OpenStaticFile>::MAX_KEY_LENGTH) {
+		return NULL;
+	}
+
+	StringKeyTable<OpenStaticFile>::Cell *cell = openStaticFiles.lookupCell(filename);
+	OpenStaticFile *file;
+	if (cell != NULL) {
+		file = &cell->value;
+		if (file->dev == buf.st_dev && file->ino == buf.st_ino
+		 && file->mtime == buf.st_mtime && file->size == buf.st_size)
+		{
+			return file;
+		}
+		SKC_TRACE(client, 2, "Static file " << filename << " changed, reopening it");
+		safelyClose(file->fd, true);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(file->fd);
+		openStaticFiles.erase(cell);
+	} else if (openStaticFiles.size() >= STATIC_FILE_CACHE_SIZE) {
+		closeOpenStaticFiles();
+	}
+
+	UPDATE_TRACE_POINT();
+	string resolvedFilename, appRoot;
+	char *resolved;
+
+	resolved = realpath(filename.c_str(), NULL);
+	if (resolved == NULL) {
+		return NULL;
+	}
+	resolvedFilename = resolved;
+	free(resolved);
+
+	resolved = realpath(string(req->options->appRoot).c_str(), NULL);
+	if (resolved != NULL) {
+		appRoot = resolved;
+		free(resolved);
+	}
+	if (appRoot.empty() || !startsWith(resolvedFilename, appRoot + "/")) {
+		SKC_DEBUG(client, "Not serving static file " << filename <<
+			" because it is not inside the application root " <<
+			req->options->appRoot);
+		return NULL;
+	}
+
+	int fd;
+	do {
+		fd = open(resolvedFilename.c_str(), O_RDONLY | O_NOFOLLOW);
+	} while (fd == -1 && errno == EINTR);
+	if (fd == -1) {
+		return NULL;
+	}
+	P_LOG_FILE_DESCRIPTOR_OPEN4(fd, __FILE__, __LINE__, "Static file cache entry");
+
+	struct stat info;
+	if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+		safelyClose(fd, true);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
+		return NULL;
+	}
+
+	// The file that we opened may be newer than the throttled stat
+	// information, so the cache entry describes the file descriptor itself.
+	OpenStaticFile newFile;
+	newFile.fd = fd;
+	newFile.dev = info.st_dev;
+	newFile.ino = info.st_ino;
+	newFile.mtime = info.st_mtime;
+	newFile.size = info.st_size;
+	openStaticFiles.insert(filename, newFile, true);
+	openStaticFiles.lookup(filename, &file);
+	return file;
+}
+
+void
+Controller::closeOpenStaticFiles() {
+	StringKeyTable<OpenStaticFile>::Iterator it(openStaticFiles);
+
+	while (*it != NULL) {
+		OpenStaticFile &file = it.getValue();
+		safelyClose(file.fd, true);
+		P_LOG_FILE_DESCRIPTOR_CLOSE(file.fd);
+		it.next();
+	}
+	openStaticFiles.clear();
+}
+
+
+} // namespace Core
+} // namespace Passenger
@@ -26,12 +26,19 @@
 #ifndef _PASSENGER_TURBO_CACHING_H_
 #define _PASSENGER_TURBO_CACHING_H_
 
+#include <boost/cstdint.hpp>
 #include <oxt/backtrace.hpp>
 #include <ev++.h>
 #include <ctime>
 #include <cstddef>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <jsoncpp/json.h>
 #include <MemoryKit/mbuf.h>
+#include <DataStructures/StringKeyTable.h>
 #include <ServerKit/Context.h>
 #include <Constants.h>
 #include <Logging.h>
@@ -48,18 +55,11 @@ using namespace std;
 template<typename Request>
 class TurboCaching {
 public:
-	/** The interval of the timer while we're in the ENABLED state. */
+	/** The interval at which expired entries are erased, while we're in the ENABLED state. */
 	static const unsigned int ENABLED_TIMEOUT = 2;
-	/** The interval of the timer while we're in the TEMPORARILY_DISABLED state. */
-	static const unsigned int TEMPORARY_DISABLE_TIMEOUT = 10;
-	/** Only consider temporarily disabling turbocaching if the number of
-	 * fetches/stores in the current interval have reached these thresholds.
-	 */
-	static const unsigned int FETCH_THRESHOLD = 20;
-	static const unsigned int STORE_THRESHOLD = 20;
 
-	OXT_FORCE_INLINE static double MIN_HIT_RATIO() { return 0.5; }
-	OXT_FORCE_INLINE static double MIN_STORE_SUCCESS_RATIO() { return 0.5; }
+	/** The number of uncacheable paths that are tracked per application group. */
+	static const unsigned int MAX_UNCACHEABLE_PATHS = 16;
 
 	enum State {
 		/**
@@ -67,24 +67,62 @@ public:
 		 */
 		DISABLED,
 		/**
-		 * Turbocaching is enabled.
-		 */
-		ENABLED,
-		/**
-		 * In case turbocaching is enabled, and poor cache hit ratio
-		 * is detected, this state will be entered. It will stay
-		 * in this state for TEMPORARY_DISABLE_TIMEOUT seconds before
-		 * transitioning back to ENABLED.
+		 * Turbocaching is enabled. Poor hit ratios are dealt with by the
+		 * ResponseCache's admission filter, which keeps rarely requested
+		 * responses from replacing popular ones.
 		 */
-		TEMPORARILY_DISABLED
+		ENABLED
 	};
 
 	typedef ResponseCache<Request> ResponseCacheType;
 	typedef typename ResponseCache<Request>::Entry ResponseCacheEntryType;
+	typedef typename ResponseCache<Request>::StoreFailureReason StoreFailureReason;
+
+	struct UncacheablePath {
+		string path;
+		boost::uint64_t count;
+
+		UncacheablePath()
+			: count(0)
+			{ }
+	};
+
+	/**
+	 * Turbocaching statistics for a single application group. Unlike the
+	 * ResponseCache counters, which are reset every interval in order to
+	 * decide whether to temporarily disable turbocaching, these are
+	 * cumulative.
+	 */
+	struct Statistics {
+		boost::uint64_t fetches;
+		boost::uint64_t hits;
+		boost::uint64_t notModified;
+		// The number of response body bytes that were sent from the
+		// cache, and thus did not have to be generated by the application.
+		boost::uint64_t bytesSaved;
+		boost::uint64_t storeSuccesses;
+		boost::uint64_t storeFailures[ResponseCacheType::STORE_FAILURE_REASON_COUNT];
+		// The paths with the most store failures, approximated with the
+		// Space-Saving algorithm. Slots with a zero count are unused.
+		UncacheablePath uncacheablePaths[MAX_UNCACHEABLE_PATHS];
+
+		Statistics()
+			: fetches(0),
+			  hits(0),
+			  notModified(0),
+			  bytesSaved(0),
+			  storeSuccesses(0)
+		{
+			for (unsigned int i = 0; i < ResponseCacheType::STORE_FAILURE_REASON_COUNT; i++) {
+				storeFailures[i] = 0;
+			}
+		}
+	};
 
 private:
 	State state;
 	ev_tstamp lastTimeout, nextTimeout;
+	StringKeyTable<Statistics> statistics;
 
 	struct ResponsePreparation {
 		Request *req;
@@ -93,17 +131,30 @@ private:
 		time_t now;
 		time_t age;
 		unsigned int ageValueSize;
+		// The part of the cached body that is sent.
+		const char *bodyData;
+		unsigned int bodySize;
 		unsigned int contentLengthStrSize;
+		// Only set for 206 and 416 responses.
+		unsigned int statusCode;
+		char contentRange[64];
+		unsigned int contentRangeSize;
 		bool showVersionInHeader;
+		bool notModified;
 	};
 
 	template<typename Server>
 	void prepareResponseHeader(ResponsePreparation &prep, Server *server,
-		Request *req, const ResponseCacheEntryType &entry)
+		Request *req, const ResponseCacheEntryType &entry, bool notModified = false)
 	{
 		prep.req   = req;
 		prep.entry = &entry;
+		prep.notModified = notModified;
 		prep.now   = (time_t) ev_now(server->getLoop());
+		prep.bodyData = entry.body->httpBodyData;
+		prep.bodySize = entry.body->httpBodySize;
+		prep.statusCode = 0;
+		prep.contentRangeSize = 0;
 
 		if (prep.now >= entry.header->date) {
 			prep.age = prep.now - entry.header->date;
@@ -112,10 +163,65 @@ private:
 		}
 
 		prep.ageValueSize = integerSizeInOtherBase<time_t, 10>(prep.age);
-		prep.contentLengthStrSize = uintSizeAsString(entry.body->httpBodySize);
+		prep.contentLengthStrSize = uintSizeAsString(prep.bodySize);
 		prep.showVersionInHeader = server->showVersionInHeader;
 	}
 
+	template<typename Server>
+	void preparePartialResponseHeader(ResponsePreparation &prep, Server *server,
+		Request *req, const ResponseCacheEntryType &entry, bool satisfiable,
+		boost::uint64_t start, boost::uint64_t end)
+	{
+		prepareResponseHeader(prep, server, req, entry);
+		if (satisfiable) {
+			prep.statusCode = 206;
+			prep.bodyData = entry.body->httpBodyData + start;
+			prep.bodySize = end - start + 1;
+			prep.contentRangeSize = snprintf(prep.contentRange, sizeof(prep.contentRange),
+				"bytes %llu-%llu/%u", (unsigned long long) start,
+				(unsigned long long) end, entry.body->httpBodySize);
+		} else {
+			prep.statusCode = 416;
+			prep.bodySize = 0;
+			prep.contentRangeSize = snprintf(prep.contentRange, sizeof(prep.contentRange),
+				"bytes */%u", entry.body->httpBodySize);
+		}
+		prep.contentLengthStrSize = uintSizeAsString(prep.bodySize);
+	}
+
+	/**
+	 * Checks whether a cached header line is the status line or the
+	 * Status header, which partial responses replace.
+	 */
+	static bool isStatusHeaderLine(const char *line, size_t size) {
+		return (size >= sizeof("HTTP/") - 1 && memcmp(line, "HTTP/", sizeof("HTTP/") - 1) == 0)
+			|| (size >= sizeof("status:") - 1 && equalsCaseInsensitive(
+				StaticString(line, sizeof("status:") - 1), P_STATIC_STRING("status:")));
+	}
+
+	/**
+	 * Checks whether a cached header line is one that RFC 7232 section 4.1
+	 * requires in a 304 Not Modified response.
+	 */
+	static bool isNotModifiedHeaderLine(const char *line, size_t size) {
+		static const char *names[] = {
+			"cache-control", "content-location", "date", "etag",
+			"expires", "last-modified", "vary"
+		};
+		const char *colon = (const char *) memchr(line, ':', size);
+		if (colon == NULL) {
+			return false;
+		}
+
+		StaticString name(line, colon - line);
+		for (unsigned int i = 0; i < sizeof(names) / sizeof(const char *); i++) {
+			if (equalsCaseInsensitive(name, names[i])) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	template<typename Server>
 	unsigned int buildResponseHeader(const ResponsePreparation &prep, Server *server,
 		char *output, unsigned int outputSize)
@@ -136,24 +242,97 @@ private:
 		char *pos = output;
 		const char *end = output + outputSize;
 
-		result += entry->body->httpHeaderSize;
-		if (output != NULL) {
-			pos = appendData(pos, end, entry->body->httpHeaderData,
-				entry->body->httpHeaderSize);
-		}
+		if (prep.notModified) {
+			if (httpVersion >= 1010) {
+				PUSH_STATIC_STRING("HTTP/1.1 304 Not Modified\r\n");
+			} else {
+				PUSH_STATIC_STRING("HTTP/1.0 304 Not Modified\r\n");
+			}
+			PUSH_STATIC_STRING("Status: 304 Not Modified\r\n");
+
+			// Copy the cached header lines that a 304 response must contain.
+			// The first line is the status line, so skip it.
+			const char *line = entry->body->httpHeaderData;
+			const char *headerEnd = line + entry->body->httpHeaderSize;
+			bool first = true;
+			while (line < headerEnd) {
+				const char *lineEnd = (const char *) memchr(line, '\n', headerEnd - line);
+				lineEnd = (lineEnd == NULL) ? headerEnd : lineEnd + 1;
+				if (!first && isNotModifiedHeaderLine(line, lineEnd - line)) {
+					result += lineEnd - line;
+					if (output != NULL) {
+						pos = appendData(pos, end, line, lineEnd - line);
+					}
+				}
+				first = false;
+				line = lineEnd;
+			}
+		} else if (prep.statusCode != 0) {
+			if (prep.statusCode == 206) {
+				if (httpVersion >= 1010) {
+					PUSH_STATIC_STRING("HTTP/1.1 206 Partial Content\r\n");
+				} else {
+					PUSH_STATIC_STRING("HTTP/1.0 206 Partial Content\r\n");
+				}
+				PUSH_STATIC_STRING("Status: 206 Partial Content\r\n");
+			} else {
+				if (httpVersion >= 1010) {
+					PUSH_STATIC_STRING("HTTP/1.1 416 Requested Range Not Satisfiable\r\n");
+				} else {
+					PUSH_STATIC_STRING("HTTP/1.0 416 Requested Range Not Satisfiable\r\n");
+				}
+				PUSH_STATIC_STRING("Status: 416 Requested Range Not Satisfiable\r\n");
+			}
 
-		PUSH_STATIC_STRING("Content-Length: ");
-		result += prep.contentLengthStrSize;
-		if (output != NULL) {
-			uintToString(entry->body->httpBodySize, pos, end - pos);
-			pos += prep.contentLengthStrSize;
+			// Copy the cached header lines, except for the status ones.
+			const char *line = entry->body->httpHeaderData;
+			const char *headerEnd = line + entry->body->httpHeaderSize;
+			while (line < headerEnd) {
+				const char *lineEnd = (const char *) memchr(line, '\n', headerEnd - line);
+				lineEnd = (lineEnd == NULL) ? headerEnd : lineEnd + 1;
+				if (!isStatusHeaderLine(line, lineEnd - line)) {
+					result += lineEnd - line;
+					if (output != NULL) {
+						pos = appendData(pos, end, line, lineEnd - line);
+					}
+				}
+				line = lineEnd;
+			}
+
+			PUSH_STATIC_STRING("Content-Range: ");
+			result += prep.contentRangeSize;
+			if (output != NULL) {
+				pos = appendData(pos, end, prep.contentRange, prep.contentRangeSize);
+			}
+			PUSH_STATIC_STRING("\r\n");
+
+			PUSH_STATIC_STRING("Content-Length: ");
+			result += prep.contentLengthStrSize;
+			if (output != NULL) {
+				uintToStringWithSize(prep.bodySize, pos, prep.contentLengthStrSize);
+				pos += prep.contentLengthStrSize;
+			}
+			PUSH_STATIC_STRING("\r\n");
+		} else {
+			result += entry->body->httpHeaderSize;
+			if (output != NULL) {
+				pos = appendData(pos, end, entry->body->httpHeaderData,
+					entry->body->httpHeaderSize);
+			}
+
+			PUSH_STATIC_STRING("Content-Length: ");
+			result += prep.contentLengthStrSize;
+			if (output != NULL) {
+				uintToStringWithSize(prep.bodySize, pos, prep.contentLengthStrSize);
+				pos += prep.contentLengthStrSize;
+			}
+			PUSH_STATIC_STRING("\r\n");
 		}
-		PUSH_STATIC_STRING("\r\n");
 
 		PUSH_STATIC_STRING("Age: ");
 		result += prep.ageValueSize;
 		if (output != NULL) {
-			integerToOtherBase<time_t, 10>(prep.age, pos, end - pos);
+			integerToOtherBaseWithSize<time_t, 10>(prep.age, pos, prep.ageValueSize);
 			pos += prep.ageValueSize;
 		}
 		PUSH_STATIC_STRING("\r\n");
@@ -189,22 +368,170 @@ private:
 		#undef PUSH_STATIC_STRING
 	}
 
+	Statistics &getStatistics(const StaticString &appGroupName) {
+		// StringKeyTable doesn't support empty keys.
+		HashedStaticString key(appGroupName.empty()
+			? P_STATIC_STRING("(unknown)")
+			: appGroupName);
+		Statistics *result;
+
+		if (!statistics.lookup(key, &result)) {
+			statistics.insert(key, Statistics());
+			statistics.lookup(key, &result);
+		}
+		return *result;
+	}
+
+	/**
+	 * Counts the request's path, without the query string. If all slots
+	 * are taken, then the path with the lowest count is replaced and the
+	 * new path inherits that count, so that frequent paths eventually
+	 * make it into the list.
+	 */
+	static void recordUncacheablePath(Statistics &stats, const Request *req) {
+		StaticString path(req->path.start->data, req->path.size);
+		string::size_type pos = path.find('?');
+		if (pos != string::npos) {
+			path = path.substr(0, pos);
+		}
+
+		unsigned int least = 0;
+		for (unsigned int i = 0; i < MAX_UNCACHEABLE_PATHS; i++) {
+			UncacheablePath &slot = stats.uncacheablePaths[i];
+			if (slot.count > 0 && slot.path == path) {
+				slot.count++;
+				return;
+			} else if (slot.count < stats.uncacheablePaths[least].count) {
+				least = i;
+			}
+		}
+
+		UncacheablePath &slot = stats.uncacheablePaths[least];
+		slot.path.assign(path.data(), path.size());
+		slot.count++;
+	}
+
+	static bool compareUncacheablePaths(const UncacheablePath *a, const UncacheablePath *b) {
+		return a->count > b->count;
+	}
+
+	static Json::Value inspectStatisticsAsJson(const Statistics &stats) {
+		Json::Value doc, failures(Json::objectValue), paths(Json::arrayValue);
+		boost::uint64_t totalFailures = 0;
+		unsigned int i;
+
+		for (i = 0; i < ResponseCacheType::STORE_FAILURE_REASON_COUNT; i++) {
+			if (stats.storeFailures[i] > 0) {
+				failures[ResponseCacheType::getStoreFailureReasonString(
+					(StoreFailureReason) i)] = (Json::UInt64) stats.storeFailures[i];
+				totalFailures += stats.storeFailures[i];
+			}
+		}
+
+		vector<const UncacheablePath *> sortedPaths;
+		for (i = 0; i < MAX_UNCACHEABLE_PATHS; i++) {
+			if (stats.uncacheablePaths[i].count > 0) {
+				sortedPaths.push_back(&stats.uncacheablePaths[i]);
+			}
+		}
+		std::sort(sortedPaths.begin(), sortedPaths.end(), compareUncacheablePaths);
+		for (i = 0; i < sortedPaths.size(); i++) {
+			Json::Value path;
+			path["path"] = sortedPaths[i]->path;
+			path["count"] = (Json::UInt64) sortedPaths[i]->count;
+			paths.append(path);
+		}
+
+		doc["fetches"] = (Json::UInt64) stats.fetches;
+		doc["hits"] = (Json::UInt64) stats.hits;
+		doc["not_modified"] = (Json::UInt64) stats.notModified;
+		doc["bytes_saved"] = (Json::UInt64) stats.bytesSaved;
+		doc["stores"] = (Json::UInt64) (stats.storeSuccesses + totalFailures);
+		doc["store_successes"] = (Json::UInt64) stats.storeSuccesses;
+		doc["store_failures"] = failures;
+		doc["top_uncacheable_paths"] = paths;
+		return doc;
+	}
+
 public:
 	ResponseCache<Request> responseCache;
 
-	TurboCaching(State initialState = ENABLED)
+	TurboCaching(State initialState = ENABLED,
+		unsigned int maxEntries = ResponseCacheType::DEFAULT_MAX_ENTRIES,
+		unsigned int maxBodySize = ResponseCacheType::DEFAULT_MAX_BODY_SIZE,
+		bool hugePages = false)
 		: state(initialState),
 		  lastTimeout((ev_tstamp) time(NULL)),
-		  nextTimeout((ev_tstamp) time(NULL) + ENABLED_TIMEOUT)
+		  nextTimeout((ev_tstamp) time(NULL) + ENABLED_TIMEOUT),
+		  responseCache(maxEntries, maxBodySize, hugePages)
+		{ }
+
+	bool isEnabled() const {
+		return state == ENABLED;
+	}
+
+	/**
+	 * Records the result of a `responseCache.fetch()` for the statistics
+	 * of the given application group.
+	 */
+	void recordFetch(const StaticString &appGroupName, const ResponseCacheEntryType &entry,
+		bool notModified)
 	{
-		if (initialState != ENABLED && initialState != DISABLED) {
-			throw RuntimeException("The initial turbocaching state may "
-				"only be ENABLED or DISABLED");
+		Statistics &stats = getStatistics(appGroupName);
+		stats.fetches++;
+		if (entry.valid()) {
+			stats.hits++;
+			stats.bytesSaved += entry.body->httpBodySize;
+			if (notModified) {
+				stats.notModified++;
+			}
 		}
 	}
 
-	bool isEnabled() const {
-		return state == ENABLED;
+	void recordStoreSuccess(const StaticString &appGroupName) {
+		getStatistics(appGroupName).storeSuccesses++;
+	}
+
+	void recordStoreFailure(const StaticString &appGroupName, const Request *req,
+		StoreFailureReason reason)
+	{
+		Statistics &stats = getStatistics(appGroupName);
+		stats.storeFailures[reason]++;
+		if (reason != ResponseCacheType::NOT_ADMITTED) {
+			// The response was cacheable, its key was just not
+			// popular enough.
+			recordUncacheablePath(stats, req);
+		}
+	}
+
+	/**
+	 * Returns the statistics of all application groups, keyed by
+	 * application group name.
+	 */
+	Json::Value inspectStatisticsAsJson() const {
+		Json::Value doc(Json::objectValue);
+		typename StringKeyTable<Statistics>::ConstIterator it(statistics);
+
+		while (*it != NULL) {
+			doc[it.getKey().toString()] = inspectStatisticsAsJson(it.getValue());
+			it.next();
+		}
+		return doc;
+	}
+
+	/**
+	 * Sums the fetch and hit counts of all application groups.
+	 */
+	void getTotalFetchesAndHits(boost::uint64_t &fetches, boost::uint64_t &hits) const {
+		typename StringKeyTable<Statistics>::ConstIterator it(statistics);
+
+		fetches = 0;
+		hits = 0;
+		while (*it != NULL) {
+			fetches += it.getValue().fetches;
+			hits += it.getValue().hits;
+			it.next();
+		}
 	}
 
 	// Call when the event loop multiplexer returns.
@@ -217,76 +544,89 @@ public:
 			return;
 		}
 
-		switch (state) {
-		case ENABLED:
-			if (responseCache.getFetches() >= FETCH_THRESHOLD
-				&& responseCache.getHitRatio() < MIN_HIT_RATIO())
-			{
-				P_INFO("Poor turbocaching hit ratio detected (" <<
-					responseCache.getHits() << " hits, " <<
-					responseCache.getFetches() << " fetches, " <<
-					(int) (responseCache.getHitRatio() * 100) <<
-					"%). Temporarily disabling turbocaching "
-					"for " << TEMPORARY_DISABLE_TIMEOUT << " seconds");
-				state = TEMPORARILY_DISABLED;
-				nextTimeout = now + TEMPORARY_DISABLE_TIMEOUT;
-			} else if (responseCache.getStores() >= STORE_THRESHOLD
-				&& responseCache.getStoreSuccessRatio() < MIN_STORE_SUCCESS_RATIO())
-			{
-				P_INFO("Poor turbocaching store success ratio detected (" <<
-					responseCache.getStoreSuccesses() << " store successes, " <<
-					responseCache.getStores() << " stores, " <<
-					(int) (responseCache.getStoreSuccessRatio() * 100) <<
-					"%). Temporarily disabling turbocaching "
-					"for " << TEMPORARY_DISABLE_TIMEOUT << " seconds");
-				state = TEMPORARILY_DISABLED;
-				nextTimeout = now + TEMPORARY_DISABLE_TIMEOUT;
-			} else {
-				P_DEBUG("Clearing turbocache");
-				nextTimeout = now + ENABLED_TIMEOUT;
-			}
-			responseCache.resetStatistics();
-			responseCache.clear();
-			break;
-		case TEMPORARILY_DISABLED:
-			P_INFO("Re-enabling turbocaching");
-			state = ENABLED;
-			nextTimeout = now + ENABLED_TIMEOUT;
-			break;
-		default:
-			P_BUG("Unknown state " << (int) state);
-			break;
-		}
-
+		P_DEBUG("Erasing expired turbocache entries");
+		responseCache.resetStatistics();
+		responseCache.eraseExpired(now);
+		nextTimeout = now + ENABLED_TIMEOUT;
 		lastTimeout = now;
 	}
 
+	/**
+	 * Writes a 304 Not Modified response for the given entry. Call this
+	 * instead of writeResponse() if `responseCache.requestIsNotModified()`.
+	 */
 	template<typename Server, typename Client>
-	void writeResponse(Server *server, Client *client, Request *req, ResponseCacheEntryType &entry) {
+	void writeNotModifiedResponse(Server *server, Client *client, Request *req,
+		ResponseCacheEntryType &entry)
+	{
 		MemoryKit::mbuf_pool &mbuf_pool = server->getContext()->mbuf_pool;
 		const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
 		ResponsePreparation prep;
 		unsigned int headerSize;
 
-		prepareResponseHeader(prep, server, req, entry);
+		prepareResponseHeader(prep, server, req, entry, true);
 		headerSize = buildResponseHeader(prep, server, NULL, 0);
 
-		if (headerSize + entry.body->httpBodySize <= MBUF_MAX_SIZE) {
+		if (headerSize <= MBUF_MAX_SIZE) {
+			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
+			buffer = MemoryKit::mbuf(buffer, 0, headerSize);
+			buildResponseHeader(prep, server, buffer.start, buffer.size());
+			server->writeResponse(client, buffer);
+		} else {
+			char *buffer = (char *) psg_pnalloc(req->pool, headerSize);
+			buildResponseHeader(prep, server, buffer, headerSize);
+			server->writeResponse(client, buffer, headerSize);
+		}
+	}
+
+	template<typename Server, typename Client>
+	void writeResponse(Server *server, Client *client, Request *req, ResponseCacheEntryType &entry) {
+		ResponsePreparation prep;
+		prepareResponseHeader(prep, server, req, entry);
+		writePreparedResponse(prep, server, client, req);
+	}
+
+	/**
+	 * Writes a 206 Partial Content response with the given byte range
+	 * (inclusive) of the entry's body, or a 416 Range Not Satisfiable
+	 * response if `satisfiable` is false. See
+	 * `responseCache.getRequestedByteRange()`.
+	 */
+	template<typename Server, typename Client>
+	void writePartialResponse(Server *server, Client *client, Request *req,
+		ResponseCacheEntryType &entry, bool satisfiable,
+		boost::uint64_t start, boost::uint64_t end)
+	{
+		ResponsePreparation prep;
+		preparePartialResponseHeader(prep, server, req, entry, satisfiable, start, end);
+		writePreparedResponse(prep, server, client, req);
+	}
+
+private:
+	template<typename Server, typename Client>
+	void writePreparedResponse(const ResponsePreparation &prep, Server *server, Client *client,
+		Request *req)
+	{
+		MemoryKit::mbuf_pool &mbuf_pool = server->getContext()->mbuf_pool;
+		const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
+		unsigned int headerSize = buildResponseHeader(prep, server, NULL, 0);
+
+		if (headerSize + prep.bodySize <= MBUF_MAX_SIZE) {
 			// Header and body fit inside a single mbuf
 			MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
-			buffer = MemoryKit::mbuf(buffer, 0, headerSize + entry.body->httpBodySize);
+			buffer = MemoryKit::mbuf(buffer, 0, headerSize + prep.bodySize);
 
 			buildResponseHeader(prep, server, buffer.start, buffer.size());
-			memcpy(buffer.start + headerSize, entry.body->httpBodyData, entry.body->httpBodySize);
+			memcpy(buffer.start + headerSize, prep.bodyData, prep.bodySize);
 
 			server->writeResponse(client, buffer);
 		} else {
-			char *buffer = (char *) psg_pnalloc(req->pool, headerSize + entry.body->httpBodySize);
+			char *buffer = (char *) psg_pnalloc(req->pool, headerSize + prep.bodySize);
 			buildResponseHeader(prep, server, buffer,
-				headerSize + entry.body->httpBodySize);
-			memcpy(buffer + headerSize, entry.body->httpBodyData, entry.body->httpBodySize);
+				headerSize + prep.bodySize);
+			memcpy(buffer + headerSize, prep.bodyData, prep.bodySize);
 
-			server->writeResponse(client, buffer, headerSize + entry.body->httpBodySize);
+			server->writeResponse(client, buffer, headerSize + prep.bodySize);
 		}
 	}
 };
@@ -0,0 +1,145 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CORE_CONTROLLER_OPTIONS_H_
+#define _PASSENGER_CORE_CONTROLLER_OPTIONS_H_
+
+/*
+ * ControllerOptions.h is automatically generated from ControllerOptions.h.cxxcodebuilder.
+ * Edits to ControllerOptions.h will be lost.
+ *
+ * To force regeneration of ControllerOptions.h:
+ *   rm -f src/agent/Core/ControllerOptions.h
+ *   rake src/agent/Core/ControllerOptions.h
+ */
+
+#include <string>
+#include <Constants.h>
+#include <Utils/VariantMap.h>
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+
+/*
+ * The agent options that the controller consults while handling requests,
+ * parsed once from the agent options VariantMap. The VariantMap remains
+ * the canonical form that is passed between the Watchdog and the agents;
+ * this struct only exists so that request setup reads plain fields
+ * instead of looking up and parsing strings.
+ */
+struct ControllerOptions {
+	string defaultNodejs;
+	string defaultPython;
+	string meteorAppSettings;
+	unsigned int appFileDescriptorUlimit;
+	string integrationMode;
+	bool userSwitching;
+	string defaultUser;
+	string defaultGroup;
+	int minInstances;
+	unsigned int spawnConcurrency;
+	unsigned int targetUtilization;
+	unsigned int preloaderStandbyProcesses;
+	unsigned int recycleJitter;
+	unsigned int capacityWeight;
+	unsigned int maxOutOfBandWorkPercentage;
+	unsigned int outOfBandWorkMaxUtilization;
+	unsigned int outOfBandWorkIdleInterval;
+	unsigned int memoryLimit;
+	unsigned int warmupTime;
+	bool rollingRestarts;
+	unsigned int rollingRestartBatchSize;
+	int maxPreloaderIdleTime;
+	int maxRequestQueueSize;
+	unsigned int requestQueueTargetDelay;
+	unsigned int rateLimit;
+	unsigned int rateLimitBurst;
+	unsigned int maxRequestsInFlight;
+	bool abortWebsocketsOnProcessShutdown;
+	int forceMaxConcurrentRequestsPerProcess;
+	string spawnMethod;
+	string routingPolicy;
+	string appCpuAffinity;
+	string healthCheckPath;
+	unsigned int healthCheckInterval;
+	unsigned int healthCheckTimeout;
+	unsigned int unresponsiveProcessTimeout;
+	unsigned int healthCheckEjectionTime;
+	bool loadShellEnvvars;
+	bool preloaderCompactHeap;
+	string preloaderWarmupScript;
+	string friendlyErrorPages;
+
+	ControllerOptions(const VariantMap &options) {
+		defaultNodejs = options.get("default_nodejs", false, DEFAULT_NODEJS);
+		defaultPython = options.get("default_python", false, DEFAULT_PYTHON);
+		meteorAppSettings = options.get("meteor_app_settings", false, "");
+		appFileDescriptorUlimit = options.getUint("app_file_descriptor_ulimit", false, 0);
+		integrationMode = options.get("integration_mode", false, DEFAULT_INTEGRATION_MODE);
+		userSwitching = options.getBool("user_switching");
+		defaultUser = options.get("default_user", false, PASSENGER_DEFAULT_USER);
+		defaultGroup = options.get("default_group", false, "");
+		minInstances = options.getInt("min_instances");
+		spawnConcurrency = options.getUint("spawn_concurrency", false, 1);
+		targetUtilization = options.getUint("target_utilization", false, 0);
+		preloaderStandbyProcesses = options.getUint("preloader_standby_processes", false, 0);
+		recycleJitter = options.getUint("recycle_jitter", false, 0);
+		capacityWeight = options.getUint("capacity_weight", false, 1);
+		maxOutOfBandWorkPercentage = options.getUint("max_out_of_band_work_percentage", false, 0);
+		outOfBandWorkMaxUtilization = options.getUint("out_of_band_work_max_utilization", false, 0);
+		outOfBandWorkIdleInterval = options.getUint("out_of_band_work_idle_interval", false, 0);
+		memoryLimit = options.getUint("memory_limit", false, 0);
+		warmupTime = options.getUint("warmup_time", false, 0);
+		rollingRestarts = options.getBool("rolling_restarts", false, false);
+		rollingRestartBatchSize = options.getUint("rolling_restart_batch_size", false, 1);
+		maxPreloaderIdleTime = options.getInt("max_preloader_idle_time");
+		maxRequestQueueSize = options.getInt("max_request_queue_size");
+		requestQueueTargetDelay = options.getUint("request_queue_target_delay", false, 0);
+		rateLimit = options.getUint("rate_limit", false, 0);
+		rateLimitBurst = options.getUint("rate_limit_burst", false, 0);
+		maxRequestsInFlight = options.getUint("max_requests_in_flight", false, 0);
+		abortWebsocketsOnProcessShutdown = options.getBool("abort_websockets_on_process_shutdown");
+		forceMaxConcurrentRequestsPerProcess = options.getInt("force_max_concurrent_requests_per_process");
+		spawnMethod = options.get("spawn_method");
+		routingPolicy = options.get("routing_policy");
+		appCpuAffinity = options.get("app_cpu_affinity", false, "");
+		healthCheckPath = options.get("health_check_path", false, "");
+		healthCheckInterval = options.getUint("health_check_interval", false, 10);
+		healthCheckTimeout = options.getUint("health_check_timeout", false, 5);
+		unresponsiveProcessTimeout = options.getUint("unresponsive_process_timeout", false, 0);
+		healthCheckEjectionTime = options.getUint("health_check_ejection_time", false, 30);
+		loadShellEnvvars = options.getBool("load_shell_envvars");
+		preloaderCompactHeap = options.getBool("preloader_compact_heap", false, false);
+		preloaderWarmupScript = options.get("preloader_warmup_script", false, "");
+		friendlyErrorPages = options.get("friendly_error_pages", false, "auto");
+	}
+};
+
+} // namespace Core
+} // namespace Passenger
+
+#endif /* _PASSENGER_CORE_CONTROLLER_OPTIONS_H_ */
@@ -31,6 +31,7 @@
 	#define SUPPORTS_PER_THREAD_CPU_AFFINITY
 	#include <sched.h>
 	#include <pthread.h>
+	#include <linux/filter.h>
 #endif
 #ifdef USE_SELINUX
 	#include <selinux/selinux.h>
@@ -41,6 +42,8 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <cstring>
 #include <cassert>
 #include <cerrno>
@@ -86,6 +89,7 @@
 #include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
 #include <Utils/VariantMap.h>
+#include <Utils/SystemMetricsCollector.h>
 #include <Core/OptionParser.h>
 #include <Core/Controller.h>
 #include <Core/ApiServer.h>
@@ -130,6 +134,10 @@ namespace Core {
 	struct WorkingObjects {
 		int serverFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
 		int apiServerFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
+		// If SO_REUSEPORT is used, then serverFds[i] is the socket for
+		// thread 1, and reusePortServerFds[i][j] is the socket for thread j + 2.
+		vector<int> reusePortServerFds[SERVER_KIT_MAX_SERVER_ENDPOINTS];
+		bool reusePort;
 		string password;
 		ApiAccountDatabase apiAccountDatabase;
 
@@ -139,6 +147,10 @@ namespace Core {
 		SpawningKit::ConfigPtr spawningKitConfig;
 		SpawningKit::FactoryPtr spawningKitFactory;
 		PoolPtr appPool;
+		SharedResponseCachePtr sharedResponseCache;
+		RequestTraceRecorderPtr requestTraceRecorder;
+		RateLimiterPtr rateLimiter;
+		ServerKit::TlsContextPtr tlsContext;
 
 		ServerKit::AcceptLoadBalancer<Controller> loadBalancer;
 		vector<ThreadWorkingObjects> threadWorkingObjects;
@@ -157,7 +169,8 @@ namespace Core {
 		SecurityUpdateChecker *securityUpdateChecker;
 
 		WorkingObjects()
-			: exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
+			: reusePort(false),
+			  exitEvent(__FILE__, __LINE__, "WorkingObjects: exitEvent"),
 			  allClientsDisconnectedEvent(__FILE__, __LINE__, "WorkingObjects: allClientsDisconnectedEvent"),
 			  terminationCount(0),
 			  shutdownCounter(0),
@@ -202,7 +215,9 @@ static WorkingObjects *workingObjects;
 static void waitForExitEvent();
 static void cleanup();
 static void deletePidFile();
-static void abortLongRunningConnections(const ApplicationPool2::ProcessPtr &process);
+static void abortLongRunningConnections(const ApplicationPool2::ProcessPtr &process,
+	bool drain);
+static void purgeTurboCaches(const string &host, const string &path);
 static void controllerShutdownFinished(Controller *controller);
 static void apiServerShutdownFinished(Core::ApiServer::ApiServer *server);
 static void printInfoInThread();
@@ -222,6 +237,15 @@ initializePrivilegedWorkingObjects() {
 		wo->password = strip(readAll(options.get("core_password_file")));
 	}
 
+	if (options.getBool("core_reuse_port") && options.getInt("core_threads") > 1) {
+		if (reusePortSupported()) {
+			wo->reusePort = true;
+		} else {
+			P_WARN("SO_REUSEPORT load balancing is not supported on this platform. "
+				"Falling back to the builtin accept load balancer.");
+		}
+	}
+
 	vector<string> authorizations = options.getStrSet("core_authorizations",
 		false);
 	string description;
@@ -234,6 +258,20 @@ initializePrivilegedWorkingObjects() {
 			throw std::runtime_error(e.what());
 		}
 	}
+
+	// The certificate key is usually only readable by root, so
+	// load it before lowering privileges.
+	if (options.has("core_tls_certificate")) {
+		UPDATE_TRACE_POINT();
+		ServerKit::TlsContext::Config config;
+		config.certificateFile = options.get("core_tls_certificate");
+		config.certificateKeyFile = options.get("core_tls_certificate_key");
+		config.sessionCacheSize = options.getUint("core_tls_session_cache_size");
+		config.sessionTimeout = options.getUint("core_tls_session_timeout");
+		config.sessionTickets = options.getBool("core_tls_session_tickets");
+		config.kernelTls = options.getBool("core_tls_kernel_offload");
+		wo->tlsContext = boost::make_shared<ServerKit::TlsContext>(config);
+	}
 }
 
 static void
@@ -380,12 +418,172 @@ makeFileWorldReadableAndWritable(const string &path) {
 	}
 #endif
 
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	/* Attaches a classic BPF program to a SO_REUSEPORT group which selects
+	 * the socket with index (CPU number % groupSize), i.e. the socket
+	 * belonging to the core thread that is pinned to the CPU on which the
+	 * connection was received. This only makes sense in combination with
+	 * `--cpu-affine`.
+	 */
+	static void
+	attachReusePortCpuSteeringProgram(int fd, unsigned int groupSize) {
+		struct sock_filter code[] = {
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (boost::uint32_t) (SKF_AD_OFF + SKF_AD_CPU) },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, groupSize },
+			{ BPF_RET | BPF_A, 0, 0, 0 }
+		};
+		struct sock_fprog prog;
+
+		prog.len = sizeof(code) / sizeof(code[0]);
+		prog.filter = code;
+		if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+			int e = errno;
+			P_WARN("Cannot attach CPU steering program to SO_REUSEPORT socket group: " <<
+				strerror(e) << " (errno=" << e << "). Letting the kernel " <<
+				"distribute connections by hash instead.");
+		}
+	}
+#endif
+
+static void
+setTcpServerSocketOption(int fd, const string &address, int level, int name,
+	const char *description, const char *optionName)
+{
+	int value = agentsOptions->getInt(optionName);
+	if (value > 0 && setsockopt(fd, level, name, &value, sizeof(value)) == -1) {
+		int e = errno;
+		P_WARN("Cannot set " << description << " on " << address << ": " <<
+			strerror(e) << " (errno=" << e << ")");
+	}
+}
+
+/* Applies the TCP tuning options to a TCP server socket. None of these are
+ * essential, so failures only result in warnings.
+ */
+static void
+tuneTcpServerSocket(int fd, const string &address) {
+	#ifdef TCP_DEFER_ACCEPT
+		// Saves us from setting up Client objects for connections that
+		// haven't sent a request (yet).
+		setTcpServerSocketOption(fd, address, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			"TCP_DEFER_ACCEPT", "core_tcp_defer_accept");
+	#endif
+	#ifdef TCP_FASTOPEN
+		setTcpServerSocketOption(fd, address, IPPROTO_TCP, TCP_FASTOPEN,
+			"TCP_FASTOPEN", "core_tcp_fastopen");
+	#endif
+	#ifdef SO_BUSY_POLL
+		// Accepted sockets inherit this setting.
+		setTcpServerSocketOption(fd, address, SOL_SOCKET, SO_BUSY_POLL,
+			"SO_BUSY_POLL", "core_busy_poll");
+	#endif
+}
+
+static void
+createReusePortServers(unsigned int i, const string &address) {
+	TRACE_POINT();
+	WorkingObjects *wo = workingObjects;
+	unsigned int nthreads = agentsOptions->getInt("core_threads");
+
+	wo->reusePortServerFds[i].reserve(nthreads - 1);
+	for (unsigned int j = 1; j < nthreads; j++) {
+		int fd = createServer(address, agentsOptions->getInt("socket_backlog"), true,
+			__FILE__, __LINE__, true);
+		P_LOG_FILE_DESCRIPTOR_PURPOSE(fd, "Server address: " << address
+			<< " (SO_REUSEPORT socket for thread " << (j + 1) << ")");
+		tuneTcpServerSocket(fd, address);
+		wo->reusePortServerFds[i].push_back(fd);
+	}
+
+	#ifdef SO_ATTACH_REUSEPORT_CBPF
+		if (agentsOptions->getBool("core_cpu_affine")) {
+			attachReusePortCpuSteeringProgram(wo->serverFds[i], nthreads);
+		}
+	#endif
+}
+
+#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+	/* While an instance of this class is alive, the calling thread is bound
+	 * to the CPU that core thread `i` is pinned to (if `--cpu-affine` is set).
+	 * Anything that the calling thread allocates and touches for that core
+	 * thread in the mean time, such as its ServerKit context, Controller and
+	 * spare client objects, ends up on that CPU's NUMA node because of the
+	 * kernel's default first-touch allocation policy. Threads that are started
+	 * in the mean time inherit the CPU binding right from the start.
+	 */
+	class ScopedCoreThreadCpuBinding {
+	private:
+		cpu_set_t oldCpus;
+		bool bound;
+
+	public:
+		ScopedCoreThreadCpuBinding(unsigned int i)
+			: bound(false)
+		{
+			unsigned int maxCpus = boost::thread::hardware_concurrency();
+			if (!agentsOptions->getBool("core_cpu_affine") || maxCpus > CPU_SETSIZE
+			 || pthread_getaffinity_np(pthread_self(), sizeof(oldCpus), &oldCpus) != 0)
+			{
+				return;
+			}
+
+			cpu_set_t cpus;
+			int result;
+
+			CPU_ZERO(&cpus);
+			CPU_SET(i % maxCpus, &cpus);
+			result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+			if (result == 0) {
+				bound = true;
+			} else {
+				P_WARN("Cannot set CPU affinity for core thread " << (i + 1)
+					<< ": " << strerror(result) << " (errno=" << result << ")");
+			}
+		}
+
+		~ScopedCoreThreadCpuBinding() {
+			if (bound) {
+				pthread_setaffinity_np(pthread_self(), sizeof(oldCpus), &oldCpus);
+			}
+		}
+	};
+#endif
+
+/* When the Watchdog restarts the Core, it hands over the listening sockets
+ * of the previous Core process (see CoreWatcher), so that they're never
+ * closed during the restart. Returns them in the order of `core_addresses`,
+ * or an empty vector if there are none.
+ */
+static vector<int>
+receiveInheritedServerFds(unsigned int addressCount) {
+	TRACE_POINT();
+	unsigned int count = agentsOptions->getUint("core_inherited_listen_fds", false, 0);
+	vector<int> fds;
+
+	if (count == 0 || !feedbackFdAvailable()) {
+		return fds;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		fds.push_back(readFileDescriptorWithNegotiation(FEEDBACK_FD));
+	}
+	if (count != addressCount) {
+		P_WARN("The watchdog handed over " << count << " listening sockets, but "
+			<< addressCount << " are configured. Creating new sockets instead");
+		for (unsigned int i = 0; i < count; i++) {
+			safelyClose(fds[i]);
+		}
+		fds.clear();
+	}
+	return fds;
+}
+
 static void
 startListening() {
 	TRACE_POINT();
 	WorkingObjects *wo = workingObjects;
 	vector<string> addresses = agentsOptions->getStrSet("core_addresses");
 	vector<string> apiAddresses = agentsOptions->getStrSet("core_api_addresses", false);
+	vector<int> inheritedServerFds = receiveInheritedServerFds(addresses.size());
 
 	#ifdef USE_SELINUX
 		// Set SELinux context on the first socket that we create
@@ -394,8 +592,14 @@ startListening() {
 	#endif
 
 	for (unsigned int i = 0; i < addresses.size(); i++) {
-		wo->serverFds[i] = createServer(addresses[i], agentsOptions->getInt("socket_backlog"), true,
-			__FILE__, __LINE__);
+		bool reusePort = wo->reusePort && getSocketAddressType(addresses[i]) == SAT_TCP;
+		if (!inheritedServerFds.empty()) {
+			wo->serverFds[i] = inheritedServerFds[i];
+			P_DEBUG("Reusing the previous Core's listening socket for " << addresses[i]);
+		} else {
+			wo->serverFds[i] = createServer(addresses[i], agentsOptions->getInt("socket_backlog"), true,
+				__FILE__, __LINE__, reusePort);
+		}
 		#ifdef USE_SELINUX
 			resetSelinuxSocketContext();
 			if (i == 0 && getSocketAddressType(addresses[0]) == SAT_UNIX) {
@@ -410,6 +614,11 @@ startListening() {
 			"Server address: " << addresses[i]);
 		if (getSocketAddressType(addresses[i]) == SAT_UNIX) {
 			makeFileWorldReadableAndWritable(parseUnixSocketAddress(addresses[i]));
+		} else if (getSocketAddressType(addresses[i]) == SAT_TCP) {
+			tuneTcpServerSocket(wo->serverFds[i], addresses[i]);
+		}
+		if (reusePort) {
+			createReusePortServers(i, addresses[i]);
 		}
 	}
 	for (unsigned int i = 0; i < apiAddresses.size(); i++) {
@@ -456,7 +665,7 @@ printInfo(EV_P_ struct ev_signal *watcher, int revents) {
 
 static void
 inspectControllerStateAsJson(Controller *controller, string *result) {
-	*result = controller->inspectStateAsJson().toStyledString();
+	*result = controller->inspectStateAsJsonString();
 }
 
 static void
@@ -533,7 +742,7 @@ dumpDiagnosticsOnCrash(void *userData) {
 	for (i = 0; i < wo->threadWorkingObjects.size(); i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
 		cerr << "### Request handler state (thread " << (i + 1) << ")\n";
-		cerr << two->controller->inspectStateAsJson();
+		cerr << two->controller->inspectStateAsJsonString();
 		cerr << "\n";
 		cerr.flush();
 	}
@@ -605,6 +814,47 @@ initializeCurl() {
 	}
 }
 
+static void
+createSpareClientsOnController(unsigned int i) {
+	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+		ScopedCoreThreadCpuBinding cpuBinding(i);
+	#endif
+	workingObjects->threadWorkingObjects[i].controller->createSpareClients();
+}
+
+/**
+ * Preallocates the spare client objects of all Controllers. Every Controller
+ * only touches its own state here, so with multiple threads the Controllers
+ * are filled in parallel, each from a thread that is bound to the CPU of the
+ * event loop that will use the objects.
+ */
+static void
+createSpareClients() {
+	TRACE_POINT();
+	WorkingObjects *wo = workingObjects;
+	unsigned int nthreads = wo->threadWorkingObjects.size();
+
+	if (nthreads == 1 || wo->threadWorkingObjects[0].controller->minSpareClients == 0) {
+		for (unsigned int i = 0; i < nthreads; i++) {
+			createSpareClientsOnController(i);
+		}
+		return;
+	}
+
+	vector<oxt::thread *> threads;
+	threads.reserve(nthreads);
+	for (unsigned int i = 0; i < nthreads; i++) {
+		threads.push_back(new oxt::thread(
+			boost::bind(createSpareClientsOnController, i),
+			"Spare client creator " + toString(i + 1), 256 * 1024));
+	}
+	UPDATE_TRACE_POINT();
+	for (unsigned int i = 0; i < nthreads; i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
 static void
 initializeNonPrivilegedWorkingObjects() {
 	TRACE_POINT();
@@ -639,6 +889,8 @@ initializeNonPrivilegedWorkingObjects() {
 			options.get("ust_router_address"),
 			"logging",
 			options.get("ust_router_password"));
+		wo->unionStationContext->setBufferedLogging(
+			options.getUint("ust_router_log_buffer_size"));
 	}
 
 	UPDATE_TRACE_POINT();
@@ -653,6 +905,18 @@ initializeNonPrivilegedWorkingObjects() {
 		wo->spawningKitConfig->instanceDir = absolutizePath(
 			wo->spawningKitConfig->instanceDir);
 	}
+	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+		if (options.getBool("core_cpu_affine")) {
+			// The CPUs that ScopedCoreThreadCpuBinding pins the core threads to.
+			unsigned int maxCpus = boost::thread::hardware_concurrency();
+			unsigned int nthreads = options.getInt("core_threads");
+			SpawningKit::CpuList &coreCpus = wo->spawningKitConfig->coreCpus;
+			for (unsigned int i = 0; i < nthreads && i < maxCpus; i++) {
+				coreCpus.push_back(i);
+			}
+		}
+	#endif
+	wo->spawningKitConfig->shmRingSlots = options.getUint("app_shm_ring_slots");
 	wo->spawningKitConfig->finalize();
 
 	UPDATE_TRACE_POINT();
@@ -661,16 +925,63 @@ initializeNonPrivilegedWorkingObjects() {
 	wo->appPool->initialize();
 	wo->appPool->setMax(options.getInt("max_pool_size"));
 	wo->appPool->setMaxIdleTime(options.getInt("pool_idle_time") * 1000000ULL);
+	vector<string> tenantLimits = options.getStrSet("core_tenant_max_pool_sizes", false);
+	string limit;
+	foreach (limit, tenantLimits) {
+		string::size_type pos = limit.find('=');
+		wo->appPool->setTenantMaxProcesses(limit.substr(0, pos),
+			stringToUint(limit.substr(pos + 1)));
+	}
+	wo->appPool->setSpawnWorkerCount(options.getUint("spawn_worker_threads"));
+	wo->appPool->enablePrespawnManifest(options.getUint("prespawn_concurrency"),
+		options.getUint("prespawn_max_load"));
+	if (!options.get("app_cgroup_root", false).empty()) {
+		wo->appPool->setAppCgroupRoot(options.get("app_cgroup_root"));
+	}
+	if (options.getBool("restart_file_watching")) {
+		wo->appPool->enableRestartFileWatching();
+	}
 	wo->appPool->enableSelfChecking(options.getBool("selfchecks"));
 	wo->appPool->abortLongRunningConnectionsCallback = abortLongRunningConnections;
 
-	UPDATE_TRACE_POINT();
+	if (options.getBool("turbocaching") && options.getUint("shared_turbocache_size") > 0) {
+		wo->sharedResponseCache = boost::make_shared<SharedResponseCache>(
+			options.getUint("shared_turbocache_size"));
+	}
+
+	if (options.getUint("request_trace_sample_rate") > 0) {
+		string path = options.get("request_trace_file", false);
+		if (path.empty() && !options.get("instance_dir", false).empty()) {
+			path = options.get("instance_dir") + "/request_trace.bin";
+		}
+		if (path.empty()) {
+			P_WARN("Request tracing is disabled because neither an instance "
+				"directory nor --request-trace-file is set");
+		} else {
+			wo->requestTraceRecorder = boost::make_shared<RequestTraceRecorder>(
+				absolutizePath(path), options.getUint("request_trace_entries"),
+				options.getUint("request_trace_sample_rate"));
+			P_NOTICE("Recording 1 in " << options.getUint("request_trace_sample_rate")
+				<< " requests to " << wo->requestTraceRecorder->getPath());
+		}
+	}
+
 	unsigned int nthreads = options.getInt("core_threads");
+	// Always created, because app groups can set their own limits even
+	// if there are no global ones.
+	wo->rateLimiter = boost::make_shared<RateLimiter>(nthreads);
+
+	UPDATE_TRACE_POINT();
+	// minSpareClients and clientFreelistLimit are 12-bit fields.
+	unsigned int spareClients = std::min(options.getUint("core_spare_clients"), 4095u);
 	BackgroundEventLoop *firstLoop = NULL; // Avoid compiler warning
 	wo->threadWorkingObjects.reserve(nthreads);
 	for (unsigned int i = 0; i < nthreads; i++) {
 		UPDATE_TRACE_POINT();
 		ThreadWorkingObjects two;
+		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
+			ScopedCoreThreadCpuBinding cpuBinding(i);
+		#endif
 
 		if (i == 0) {
 			two.bgloop = firstLoop = new BackgroundEventLoop(true, true);
@@ -686,14 +997,29 @@ initializeNonPrivilegedWorkingObjects() {
 			options.get("data_buffer_dir");
 		two.serverKitContext->defaultFileBufferedChannelConfig.threshold =
 			options.getUint("file_buffer_threshold");
+		if (options.getInt("mbuf_pool_trim_interval") > 0) {
+			two.serverKitContext->startMbufPoolTrimming(
+				options.getInt("mbuf_pool_trim_interval"));
+		}
+		if (options.getUint("huge_page_arena_size") > 0) {
+			two.serverKitContext->enableMbufPoolHugePages(
+				(size_t) options.getUint("huge_page_arena_size") * 1024 * 1024);
+		}
 
 		UPDATE_TRACE_POINT();
 		two.controller = new Core::Controller(two.serverKitContext, agentsOptions, i + 1);
-		two.controller->minSpareClients = 128;
-		two.controller->clientFreelistLimit = 1024;
+		two.controller->minSpareClients = spareClients;
+		two.controller->clientFreelistLimit = std::max(spareClients, 1024u);
+		two.controller->requestFreelistLimit = std::max(spareClients, 1024u);
+		two.controller->autoTune = options.getBool("core_auto_tune");
 		two.controller->resourceLocator = &wo->resourceLocator;
 		two.controller->appPool = wo->appPool;
 		two.controller->unionStationContext = wo->unionStationContext;
+		two.controller->sharedResponseCache = wo->sharedResponseCache;
+		two.controller->requestTraceRecorder = wo->requestTraceRecorder;
+		two.controller->rateLimiter = wo->rateLimiter;
+		two.controller->tlsContext = wo->tlsContext;
+		two.controller->turboCachePurgeCallback = purgeTurboCaches;
 		two.controller->shutdownFinishCallback = controllerShutdownFinished;
 		two.controller->initialize();
 		wo->shutdownCounter.fetch_add(1, boost::memory_order_relaxed);
@@ -722,6 +1048,10 @@ initializeNonPrivilegedWorkingObjects() {
 			options.get("data_buffer_dir");
 		awo->serverKitContext->defaultFileBufferedChannelConfig.threshold =
 			options.getUint("file_buffer_threshold");
+		if (options.getInt("mbuf_pool_trim_interval") > 0) {
+			awo->serverKitContext->startMbufPoolTrimming(
+				options.getInt("mbuf_pool_trim_interval"));
+		}
 
 		UPDATE_TRACE_POINT();
 		awo->apiServer = new Core::ApiServer::ApiServer(awo->serverKitContext);
@@ -752,15 +1082,19 @@ initializeNonPrivilegedWorkingObjects() {
 		if (nthreads == 1) {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[0];
 			two->controller->listen(wo->serverFds[i]);
+		} else if (!wo->reusePortServerFds[i].empty()) {
+			wo->threadWorkingObjects[0].controller->listen(wo->serverFds[i]);
+			for (unsigned int j = 1; j < nthreads; j++) {
+				ThreadWorkingObjects *two = &wo->threadWorkingObjects[j];
+				two->controller->listen(wo->reusePortServerFds[i][j - 1]);
+			}
 		} else {
 			wo->loadBalancer.listen(wo->serverFds[i]);
 		}
 	}
-	for (unsigned int i = 0; i < nthreads; i++) {
-		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
-		two->controller->createSpareClients();
-	}
+	createSpareClients();
 	if (nthreads > 1) {
+		wo->loadBalancer.autoTune = options.getBool("core_auto_tune");
 		wo->loadBalancer.servers.reserve(nthreads);
 		for (unsigned int i = 0; i < nthreads; i++) {
 			ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
@@ -817,10 +1151,17 @@ static void
 reportInitializationInfo() {
 	TRACE_POINT();
 	if (feedbackFdAvailable()) {
+		unsigned int count = agentsOptions->getStrSet("core_addresses").size();
+
 		P_NOTICE(SHORT_PROGRAM_NAME " core online, PID " << getpid());
 		writeArrayMessage(FEEDBACK_FD,
 			"initialized",
+			toString(count).c_str(),
 			NULL);
+		// Lets the Watchdog keep our listening sockets open across restarts.
+		for (unsigned int i = 0; i < count; i++) {
+			writeFileDescriptorWithNegotiation(FEEDBACK_FD, workingObjects->serverFds[i]);
+		}
 	} else {
 		vector<string> addresses = agentsOptions->getStrSet("core_addresses");
 		vector<string> apiAddresses = agentsOptions->getStrSet("core_api_addresses", false);
@@ -851,42 +1192,36 @@ reportInitializationInfo() {
 	}
 }
 
+/**
+ * Runs one step of the startup sequence and logs how long it took, so that
+ * a slow cold start can be attributed to a specific step.
+ */
+static void
+runStartupPhase(const char *name, void (*phase)()) {
+	Timer<> timer;
+	phase();
+	P_DEBUG("Startup phase " << name << " finished in " <<
+		timer.usecElapsed() / 1000.0 << " ms");
+}
+
 static void
 mainLoop() {
 	TRACE_POINT();
 	WorkingObjects *wo = workingObjects;
-	#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
-		unsigned int maxCpus = boost::thread::hardware_concurrency();
-		bool cpuAffine = agentsOptions->getBool("core_cpu_affine")
-			&& maxCpus <= CPU_SETSIZE;
-	#endif
-
 	installDiagnosticsDumper(dumpDiagnosticsOnCrash, NULL);
 	for (unsigned int i = 0; i < wo->threadWorkingObjects.size(); i++) {
 		ThreadWorkingObjects *two = &wo->threadWorkingObjects[i];
-		two->bgloop->start("Main event loop: thread " + toString(i + 1), 0);
 		#ifdef SUPPORTS_PER_THREAD_CPU_AFFINITY
-			if (cpuAffine) {
-				cpu_set_t cpus;
-				int result;
-
-				CPU_ZERO(&cpus);
-				CPU_SET(i % maxCpus, &cpus);
-				P_DEBUG("Setting CPU affinity of core thread " << (i + 1)
-					<< " to CPU " << (i % maxCpus + 1));
-				result = pthread_setaffinity_np(two->bgloop->getNativeHandle(),
-					maxCpus, &cpus);
-				if (result != 0) {
-					P_WARN("Cannot set CPU affinity on core thread " << (i + 1)
-						<< ": " << strerror(result) << " (errno=" << result << ")");
-				}
-			}
+			// The event loop thread inherits this CPU binding, so
+			// its stack is allocated on the right NUMA node too.
+			ScopedCoreThreadCpuBinding cpuBinding(i);
 		#endif
+		two->bgloop->start("Main event loop: thread " + toString(i + 1), 0);
 	}
 	if (wo->apiWorkingObjects.apiServer != NULL) {
 		wo->apiWorkingObjects.bgloop->start("API event loop", 0);
 	}
-	if (wo->threadWorkingObjects.size() > 1) {
+	if (wo->threadWorkingObjects.size() > 1 && wo->loadBalancer.getEndpointCount() > 0) {
 		wo->loadBalancer.start();
 	}
 	waitForExitEvent();
@@ -894,13 +1229,13 @@ mainLoop() {
 
 static void
 abortLongRunningConnectionsOnController(Core::Controller *controller,
-	string gupid)
+	ApplicationPool2::ProcessPtr process, bool drain)
 {
-	controller->disconnectLongRunningConnections(gupid);
+	controller->disconnectLongRunningConnections(process, drain);
 }
 
 static void
-abortLongRunningConnections(const ApplicationPool2::ProcessPtr &process) {
+abortLongRunningConnections(const ApplicationPool2::ProcessPtr &process, bool drain) {
 	// We are inside the ApplicationPool lock. Be very careful here.
 	WorkingObjects *wo = workingObjects;
 	P_NOTICE("Checking whether to disconnect long-running connections for process " <<
@@ -909,7 +1244,24 @@ abortLongRunningConnections(const ApplicationPool2::ProcessPtr &process) {
 		wo->threadWorkingObjects[i].bgloop->safe->runLater(
 			boost::bind(abortLongRunningConnectionsOnController,
 				wo->threadWorkingObjects[i].controller,
-				process->getGupid().toString()));
+				process, drain));
+	}
+}
+
+static void
+purgeTurboCacheOnController(Core::Controller *controller, string host, string path) {
+	controller->purgeTurboCache(host, path);
+}
+
+static void
+purgeTurboCaches(const string &host, const string &path) {
+	// We may be called from any Controller thread.
+	WorkingObjects *wo = workingObjects;
+	for (unsigned int i = 0; i < wo->threadWorkingObjects.size(); i++) {
+		wo->threadWorkingObjects[i].bgloop->safe->runLater(
+			boost::bind(purgeTurboCacheOnController,
+				wo->threadWorkingObjects[i].controller,
+				host, path));
 	}
 }
 
@@ -1048,6 +1400,9 @@ cleanup() {
 		if (wo->apiServerFds[i] != -1) {
 			close(wo->apiServerFds[i]);
 		}
+		foreach (int fd, wo->reusePortServerFds[i]) {
+			close(fd);
+		}
 	}
 	deletePidFile();
 	delete workingObjects;
@@ -1071,16 +1426,18 @@ runCore() {
 
 	try {
 		UPDATE_TRACE_POINT();
-		initializePrivilegedWorkingObjects();
-		initializeSingleAppMode();
-		setUlimits();
-		startListening();
-		createPidFile();
-		lowerPrivilege();
-		initializeCurl();
-		initializeNonPrivilegedWorkingObjects();
-		initializeSecurityUpdateChecker();
-		prestartWebApps();
+		Timer<> startupTimer;
+		runStartupPhase("initializePrivilegedWorkingObjects", initializePrivilegedWorkingObjects);
+		runStartupPhase("initializeSingleAppMode", initializeSingleAppMode);
+		runStartupPhase("setUlimits", setUlimits);
+		runStartupPhase("startListening", startListening);
+		runStartupPhase("createPidFile", createPidFile);
+		runStartupPhase("lowerPrivilege", lowerPrivilege);
+		runStartupPhase("initializeCurl", initializeCurl);
+		runStartupPhase("initializeNonPrivilegedWorkingObjects", initializeNonPrivilegedWorkingObjects);
+		runStartupPhase("initializeSecurityUpdateChecker", initializeSecurityUpdateChecker);
+		runStartupPhase("prestartWebApps", prestartWebApps);
+		P_INFO(SHORT_PROGRAM_NAME " core initialized in " << startupTimer.elapsed() << " ms");
 
 		UPDATE_TRACE_POINT();
 		reportInitializationInfo();
@@ -1169,32 +1526,92 @@ setAgentsOptionsDefaults() {
 	}
 	options.setDefaultStrSet("core_addresses", defaultAddress);
 	options.setDefaultInt("socket_backlog", DEFAULT_SOCKET_BACKLOG);
+	options.setDefaultInt("core_tcp_defer_accept", 0);
+	options.setDefaultInt("core_tcp_fastopen", 0);
+	options.setDefaultInt("core_busy_poll", 0);
+	options.setDefaultUint("core_log_buffer_size", 0);
 	options.setDefaultBool("multi_app", false);
 	options.setDefault("environment", DEFAULT_APP_ENV);
 	options.setDefault("spawn_method", DEFAULT_SPAWN_METHOD);
 	options.setDefaultBool("load_shell_envvars", false);
+	options.setDefaultBool("preloader_compact_heap", false);
 	options.setDefaultBool("abort_websockets_on_process_shutdown", true);
+	options.setDefaultUint("websocket_drain_time", 0);
 	options.setDefaultInt("force_max_concurrent_requests_per_process", -1);
 	options.setDefault("concurrency_model", DEFAULT_CONCURRENCY_MODEL);
 	options.setDefaultInt("app_thread_count", DEFAULT_APP_THREAD_COUNT);
 	options.setDefaultInt("max_pool_size", DEFAULT_MAX_POOL_SIZE);
 	options.setDefaultInt("pool_idle_time", DEFAULT_POOL_IDLE_TIME);
+	options.setDefaultUint("spawn_worker_threads", 0);
+	options.setDefaultUint("prespawn_concurrency", 0);
+	options.setDefaultUint("prespawn_max_load", 0);
 	options.setDefaultInt("min_instances", 1);
+	options.setDefaultUint("spawn_concurrency", 1);
+	options.setDefaultUint("target_utilization", 0);
+	options.setDefaultUint("preloader_standby_processes", 0);
+	options.setDefaultUint("recycle_jitter", 0);
+	options.setDefaultUint("capacity_weight", 1);
+	options.setDefaultUint("max_out_of_band_work_percentage", 0);
+	options.setDefaultUint("out_of_band_work_max_utilization", 0);
+	options.setDefaultUint("out_of_band_work_idle_interval", 0);
+	options.setDefaultUint("memory_limit", 0);
+	options.setDefaultUint("warmup_time", 0);
+	options.setDefaultUint("rolling_restart_batch_size", 1);
 	options.setDefaultInt("max_preloader_idle_time", DEFAULT_MAX_PRELOADER_IDLE_TIME);
 	options.setDefaultUint("max_request_queue_size", DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	options.setDefaultUint("request_queue_target_delay", 0);
 	options.setDefaultUint("stat_throttle_rate", DEFAULT_STAT_THROTTLE_RATE);
+	options.setDefaultBool("restart_file_watching", true);
+	options.setDefaultInt("mbuf_pool_trim_interval", DEFAULT_MBUF_POOL_TRIM_INTERVAL);
+	options.setDefaultUint("huge_page_arena_size", 0);
+	options.setDefaultUint("app_shm_ring_slots", 0);
+	options.setDefaultUint("rate_limit", 0);
+	options.setDefaultUint("rate_limit_burst", 0);
+	options.setDefaultUint("max_requests_in_flight", 0);
+	options.setDefaultUint("request_trace_sample_rate", 0);
+	options.setDefaultUint("request_trace_entries", DEFAULT_REQUEST_TRACE_ENTRIES);
+	options.setDefaultUint("ust_router_log_buffer_size", DEFAULT_UST_ROUTER_LOG_BUFFER_SIZE);
+	options.setDefault("union_station_sample_rate", "100");
+	options.setDefaultUint("union_station_slow_request_threshold",
+		DEFAULT_UNION_STATION_SLOW_REQUEST_THRESHOLD);
 	options.setDefault("server_software", SERVER_TOKEN_NAME "/" PASSENGER_VERSION);
 	options.setDefaultBool("show_version_in_header", true);
 	options.setDefaultBool("sticky_sessions", false);
 	options.setDefault("sticky_sessions_cookie_name", DEFAULT_STICKY_SESSIONS_COOKIE_NAME);
+	options.setDefault("routing_policy", DEFAULT_ROUTING_POLICY);
+	options.setDefaultUint("health_check_interval", 10);
+	options.setDefaultUint("health_check_timeout", 5);
+	options.setDefaultUint("unresponsive_process_timeout", 0);
+	options.setDefaultUint("health_check_ejection_time", 30);
 	options.setDefaultBool("turbocaching", true);
+	options.setDefaultUint("turbocache_entries", DEFAULT_TURBOCACHE_ENTRIES);
+	options.setDefaultUint("turbocache_max_body_size", DEFAULT_TURBOCACHE_MAX_BODY_SIZE);
+	options.setDefaultUint("shared_turbocache_size", 0);
+	options.setDefaultUint("turbocache_coalescing_timeout", 0);
+	options.setDefaultBool("serve_x_sendfile", false);
+	options.setDefaultBool("serve_static_files", false);
+	options.setDefaultBool("response_compression", false);
+	options.setDefaultBool("probe_requires_process", false);
 	options.setDefault("data_buffer_dir", getSystemTempDir());
 	options.setDefaultUint("file_buffer_threshold", DEFAULT_FILE_BUFFERED_CHANNEL_THRESHOLD);
 	options.setDefaultInt("response_buffer_high_watermark", DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK);
+	options.setDefaultUint("response_buffer_full_buffering_size", DEFAULT_RESPONSE_BUFFER_FULL_BUFFERING_SIZE);
+	options.setDefaultUint("request_body_prebuffer_size", DEFAULT_REQUEST_BODY_PREBUFFER_SIZE);
+	options.setDefaultUint("request_body_slow_rate", DEFAULT_REQUEST_BODY_SLOW_RATE);
+	options.setDefaultUint("client_header_timeout", DEFAULT_CLIENT_HEADER_TIMEOUT);
+	options.setDefaultUint("client_keepalive_timeout", 0);
+	options.setDefaultUint("client_body_min_rate", 0);
 	options.setDefaultBool("selfchecks", false);
 	options.setDefaultBool("core_graceful_exit", true);
-	options.setDefaultInt("core_threads", boost::thread::hardware_concurrency());
+	options.setDefaultInt("core_threads", getUsableCpuCount());
+	options.setDefaultInt("core_spare_clients", DEFAULT_CORE_SPARE_CLIENTS);
 	options.setDefaultBool("core_cpu_affine", false);
+	options.setDefaultBool("core_reuse_port", false);
+	options.setDefaultBool("core_auto_tune", false);
+	options.setDefaultUint("core_tls_session_cache_size", DEFAULT_TLS_SESSION_CACHE_SIZE);
+	options.setDefaultUint("core_tls_session_timeout", DEFAULT_TLS_SESSION_TIMEOUT);
+	options.setDefaultBool("core_tls_session_tickets", true);
+	options.setDefaultBool("core_tls_kernel_offload", false);
 	options.setDefault("friendly_error_pages", "auto");
 	options.setDefaultBool("rolling_restarts", false);
 	options.setDefaultBool("resist_deployment_errors", false);
@@ -1279,13 +1696,10 @@ sanityCheckOptions() {
 			ok = false;
 		#endif
 	}
-	if (options.has("memory_limit")) {
-		#ifndef PASSENGER_IS_ENTERPRISE
-			fprintf(stderr, "ERROR: the --memory-limit option is only supported in "
-				PROGRAM_NAME " Enterprise.\nYou are currently using the open source "
-				PROGRAM_NAME ". Buy " PROGRAM_NAME " Enterprise here: https://www.phusionpassenger.com/enterprise\n");
-			ok = false;
-		#endif
+	if (options.has("core_tls_certificate") != options.has("core_tls_certificate_key")) {
+		fprintf(stderr, "ERROR: --tls-certificate and --tls-certificate-key must "
+			"be passed together.\n");
+		ok = false;
 	}
 	if (options.has("max_requests")) {
 		if (options.getInt("max_requests", false, 0) < 0) {
@@ -1337,8 +1751,12 @@ coreMain(int argc, char *argv[]) {
 	sanityCheckOptions();
 
 	restoreOomScore(agentsOptions);
+	if (agentsOptions->getUint("core_log_buffer_size") > 0) {
+		startAsyncLogging(agentsOptions->getUint("core_log_buffer_size"));
+	}
 
 	ret = runCore();
+	stopAsyncLogging();
 	shutdownAgent(agentsOptions);
 	return ret;
 }
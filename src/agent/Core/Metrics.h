@@ -0,0 +1,223 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CORE_METRICS_H_
+#define _PASSENGER_CORE_METRICS_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include <MemoryKit/mbuf.h>
+#include <StaticString.h>
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+
+
+/**
+ * A snapshot of a Controller's counters, taken on the Controller's own
+ * event loop by Controller::collectMetrics(), so that the API server can
+ * format it without touching the Controller's state.
+ */
+struct ControllerMetrics {
+	unsigned int activeClientCount;
+	boost::uint64_t totalClientsAccepted;
+	boost::uint64_t totalRequestsBegun;
+	boost::uint64_t responsesByStatusClass[5];
+	boost::uint64_t turboCacheFetches;
+	boost::uint64_t turboCacheHits;
+	unsigned int mbufActiveBlocks;
+	unsigned int mbufFreeBlocks;
+	boost::uint64_t mbufActiveBytes;
+	boost::uint64_t mbufFreeBytes;
+	boost::uint64_t eventLoopIterations;
+	boost::uint64_t eventLoopBusyTime;
+	boost::uint64_t eventLoopBlockedTime;
+	boost::uint64_t eventLoopCallbacks;
+	unsigned int eventLoopMaxIterationTime;
+	unsigned int eventLoopPendingCommands;
+
+	ControllerMetrics() {
+		memset(this, 0, sizeof(ControllerMetrics));
+	}
+};
+
+/**
+ * Renders metrics in the Prometheus text exposition format (version 0.0.4)
+ * directly into mbufs, so that large pools do not need one big contiguous
+ * string. The mbufs can be written to a client with writeResponse() one by one.
+ */
+class MetricsWriter: public boost::noncopyable {
+private:
+	MemoryKit::mbuf_pool *pool;
+	MemoryKit::mbuf current;
+	unsigned int currentSize;
+	boost::uint64_t totalSize;
+
+	void flushCurrent() {
+		if (currentSize > 0) {
+			buffers.push_back(MemoryKit::mbuf(current, 0, currentSize));
+		}
+		current = MemoryKit::mbuf();
+		currentSize = 0;
+	}
+
+	void append(const char *data, unsigned int size) {
+		while (size > 0) {
+			if (current.empty() || currentSize == current.size()) {
+				flushCurrent();
+				current = MemoryKit::mbuf_get(pool);
+			}
+
+			unsigned int n = std::min(size, (unsigned int) current.size() - currentSize);
+			memcpy(current.start + currentSize, data, n);
+			currentSize += n;
+			totalSize += n;
+			data += n;
+			size -= n;
+		}
+	}
+
+	void append(const StaticString &data) {
+		append(data.data(), data.size());
+	}
+
+	void appendLabelValue(const StaticString &value) {
+		const char *pos = value.data();
+		const char *end = value.data() + value.size();
+		const char *runStart = pos;
+
+		while (pos < end) {
+			const char *escaped;
+			switch (*pos) {
+			case '\\':
+				escaped = "\\\\";
+				break;
+			case '"':
+				escaped = "\\\"";
+				break;
+			case '\n':
+				escaped = "\\n";
+				break;
+			default:
+				pos++;
+				continue;
+			}
+			append(runStart, pos - runStart);
+			append(escaped, 2);
+			pos++;
+			runStart = pos;
+		}
+		append(runStart, pos - runStart);
+	}
+
+	void appendValue(boost::uint64_t value) {
+		char buf[32];
+		int size = snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long) value);
+		append(buf, size);
+	}
+
+public:
+	vector<MemoryKit::mbuf> buffers;
+
+	MetricsWriter(MemoryKit::mbuf_pool *_pool)
+		: pool(_pool),
+		  currentSize(0),
+		  totalSize(0)
+		{ }
+
+	void writeHeader(const StaticString &name, const StaticString &type,
+		const StaticString &help)
+	{
+		append(P_STATIC_STRING("# HELP "));
+		append(name);
+		append(P_STATIC_STRING(" "));
+		append(help);
+		append(P_STATIC_STRING("\n# TYPE "));
+		append(name);
+		append(P_STATIC_STRING(" "));
+		append(type);
+		append(P_STATIC_STRING("\n"));
+	}
+
+	void writeSample(const StaticString &name, boost::uint64_t value) {
+		append(name);
+		appendValue(value);
+	}
+
+	void writeSample(const StaticString &name, const StaticString &labelName,
+		const StaticString &labelValue, boost::uint64_t value)
+	{
+		append(name);
+		append(P_STATIC_STRING("{"));
+		append(labelName);
+		append(P_STATIC_STRING("=\""));
+		appendLabelValue(labelValue);
+		append(P_STATIC_STRING("\"}"));
+		appendValue(value);
+	}
+
+	void writeSample(const StaticString &name,
+		const StaticString &labelName1, const StaticString &labelValue1,
+		const StaticString &labelName2, const StaticString &labelValue2,
+		boost::uint64_t value)
+	{
+		append(name);
+		append(P_STATIC_STRING("{"));
+		append(labelName1);
+		append(P_STATIC_STRING("=\""));
+		appendLabelValue(labelValue1);
+		append(P_STATIC_STRING("\","));
+		append(labelName2);
+		append(P_STATIC_STRING("=\""));
+		appendLabelValue(labelValue2);
+		append(P_STATIC_STRING("\"}"));
+		appendValue(value);
+	}
+
+	/**
+	 * Moves the partially filled last mbuf into `buffers`. Call this
+	 * once, after writing all metrics.
+	 */
+	void finish() {
+		flushCurrent();
+	}
+
+	boost::uint64_t size() const {
+		return totalSize;
+	}
+};
+
+
+} // namespace Core
+} // namespace Passenger
+
+#endif /* _PASSENGER_CORE_METRICS_H_ */
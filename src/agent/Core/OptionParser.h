@@ -29,11 +29,13 @@
 #include <boost/thread.hpp>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <Constants.h>
 #include <Utils.h>
 #include <Utils/VariantMap.h>
 #include <Utils/OptionParsing.h>
 #include <Utils/StrIntUtils.h>
+#include <Utils/SystemMetricsCollector.h>
 
 namespace Passenger {
 
@@ -62,11 +64,43 @@ coreUsage() {
 		SERVER_KIT_MAX_SERVER_ENDPOINTS);
 	printf("                            listen on multiple addresses. Default:\n");
 	printf("                            " DEFAULT_HTTP_SERVER_LISTEN_ADDRESS "\n");
+	printf("      --tenant NAME=ADDRESS Listen on the given address, like --listen, and\n");
+	printf("                            serve the requests that arrive on it as tenant\n");
+	printf("                            NAME: its apps are isolated from those of other\n");
+	printf("                            tenants (multi-app mode only)\n");
 	printf("      --api-listen ADDRESS  Listen on the given address for API commands.\n");
 	printf("                            The same syntax and limitations as with --listen\n");
 	printf("                            are applicable\n");
 	printf("      --socket-backlog      Override size of the socket backlog.\n");
 	printf("                            Default: %d\n", DEFAULT_SOCKET_BACKLOG);
+	printf("      --tcp-defer-accept SECONDS\n");
+	printf("                            Only accept TCP clients once they have sent data,\n");
+	printf("                            waiting at most the given number of seconds\n");
+	printf("                            (Linux only). Default: 0 (disabled)\n");
+	printf("      --tcp-fastopen QUEUE_LENGTH\n");
+	printf("                            Enable TCP Fast Open on TCP listen sockets, with\n");
+	printf("                            the given maximum number of pending Fast Open\n");
+	printf("                            requests. Default: 0 (disabled)\n");
+	printf("      --busy-poll MICROSECONDS\n");
+	printf("                            Busy poll the network device for the given time\n");
+	printf("                            when a TCP socket has no data (Linux only,\n");
+	printf("                            requires root). Default: 0 (disabled)\n");
+	printf("      --tls-certificate PATH\n");
+	printf("                            Serve HTTPS instead of HTTP on the --listen\n");
+	printf("                            addresses, using the given PEM certificate chain\n");
+	printf("      --tls-certificate-key PATH\n");
+	printf("                            The PEM private key of --tls-certificate\n");
+	printf("      --tls-session-cache-size NUMBER\n");
+	printf("                            Maximum number of TLS sessions to cache for\n");
+	printf("                            resumption, shared by all threads. Default: %u\n",
+		DEFAULT_TLS_SESSION_CACHE_SIZE);
+	printf("      --tls-session-timeout SECONDS\n");
+	printf("                            How long TLS sessions can be resumed. Default: %u\n",
+		DEFAULT_TLS_SESSION_TIMEOUT);
+	printf("      --no-tls-session-tickets\n");
+	printf("                            Only resume TLS sessions from the session cache\n");
+	printf("      --tls-kernel-offload  Let the kernel encrypt and decrypt TLS records\n");
+	printf("                            (kTLS), if the kernel and OpenSSL support it\n");
 	printf("\n");
 	printf("Daemon options (optional):\n");
 	printf("      --pid-file PATH       Store the core's PID in the given file. The file\n");
@@ -104,6 +138,12 @@ coreUsage() {
 	printf("      --spawn-method NAME   Spawn method to use. Can either be 'smart' or\n");
 	printf("                            'direct'. Default: %s\n", DEFAULT_SPAWN_METHOD);
 	printf("      --load-shell-envvars  Load shell startup files before loading application\n");
+	printf("      --preloader-compact-heap\n");
+	printf("                            Compact the preloader's heap before forking, so\n");
+	printf("                            that more memory stays shared with processes\n");
+	printf("      --preloader-warmup-script PATH\n");
+	printf("                            Script that the preloader loads before forking\n");
+	printf("                            processes, relative to the app root\n");
 	printf("      --concurrency-model   The concurrency model to use for the app, either\n");
 	printf("                            'process' or 'thread' (Enterprise only).\n");
 	printf("                            Default: " DEFAULT_CONCURRENCY_MODEL "\n");
@@ -126,18 +166,57 @@ coreUsage() {
 	printf("                            (passed to Meteor using --settings)\n");
 	printf("      --app-file-descriptor-ulimit NUMBER\n");
 	printf("                            Set custom file descriptor ulimit for the app\n");
+	printf("      --app-cpu-affinity POLICY\n");
+	printf("                            Which CPUs app processes are pinned to when they\n");
+	printf("                            are spawned: 'none', 'round-robin' (one CPU per\n");
+	printf("                            process), 'numa-node' (one NUMA node per\n");
+	printf("                            process) or 'exclude-core' (any CPU that\n");
+	printf("                            --cpu-affine doesn't pin a Core thread to).\n");
+	printf("                            Default: none\n");
+	printf("      --app-shm-ring-slots NUMBER\n");
+	printf("                            Offer app processes this many shared memory\n");
+	printf("                            rings, through which they exchange request and\n");
+	printf("                            response data with the Core instead of through\n");
+	printf("                            their sockets. Only used by apps that support it.\n");
+	printf("                            Default: 0 (disabled)\n");
 	printf("      --debugger            Enable Ruby debugger support (Enterprise only)\n");
 	printf("\n");
-	printf("      --rolling-restarts    Enable rolling restarts (Enterprise only)\n");
+	printf("      --rolling-restarts    Restart application processes one batch at a\n");
+	printf("                            time, so that old processes keep handling\n");
+	printf("                            requests until their successors are ready\n");
+	printf("      --rolling-restart-batch-size N\n");
+	printf("                            Maximum number of processes that are replaced\n");
+	printf("                            at the same time during a rolling restart.\n");
+	printf("                            Default: 1\n");
 	printf("      --resist-deployment-errors\n");
 	printf("                            Enable deployment error resistance (Enterprise only)\n");
 	printf("\n");
 	printf("Process management options (optional):\n");
 	printf("      --max-pool-size N     Maximum number of application processes.\n");
 	printf("                            Default: %d\n", DEFAULT_MAX_POOL_SIZE);
+	printf("      --tenant-max-pool-size NAME=N\n");
+	printf("                            Maximum number of application processes of the\n");
+	printf("                            given tenant. Each app can always have one\n");
+	printf("                            process. Default: no limit\n");
 	printf("      --pool-idle-time SECS\n");
 	printf("                            Maximum number of seconds an application process\n");
 	printf("                            may be idle. Default: %d\n", DEFAULT_POOL_IDLE_TIME);
+	printf("      --spawn-worker-threads N\n");
+	printf("                            Run the spawning of all applications on N shared\n");
+	printf("                            threads, instead of on a thread per spawn.\n");
+	printf("                            Default: 0 (a thread per spawn)\n");
+	printf("      --prespawn-concurrency N\n");
+	printf("                            Remember which applications were running, and\n");
+	printf("                            spawn them again after the Core is restarted, N\n");
+	printf("                            applications at a time. Default: 0 (disabled)\n");
+	printf("      --prespawn-max-load PERCENT\n");
+	printf("                            Pause prespawning while the load average per CPU\n");
+	printf("                            is higher than this percentage. Default: 0 (no\n");
+	printf("                            limit)\n");
+	printf("      --app-cgroup-root DIR\n");
+	printf("                            Place the processes of each application in a\n");
+	printf("                            cgroup of their own, under this (delegated) cgroup\n");
+	printf("                            directory. Default: none\n");
 	printf("      --max-preloader-idle-time SECS\n");
 	printf("                            Maximum time that preloader processes may be\n");
 	printf("                            be idle. A value of 0 means that preloader\n");
@@ -147,8 +226,57 @@ coreUsage() {
 	printf("                            process can handle the given number of concurrent\n");
 	printf("                            requests per process\n");
 	printf("      --min-instances N     Minimum number of application processes. Default: 1\n");
-	printf("      --memory-limit MB     Restart application processes that go over the\n");
-	printf("                            given memory limit (Enterprise only)\n");
+	printf("      --spawn-concurrency N Maximum number of processes per application that\n");
+	printf("                            may be spawned at the same time. Default: 1\n");
+	printf("      --target-utilization PERCENT\n");
+	printf("                            Spawn processes ahead of demand, based on the\n");
+	printf("                            request rate, so that processes are busy for this\n");
+	printf("                            percentage of the time. Default: 0 (disabled)\n");
+	printf("      --preloader-standby-processes NUMBER\n");
+	printf("                            Keep this many processes forked ahead of time by\n");
+	printf("                            the preloader, so that spawning only needs to\n");
+	printf("                            activate one of them. Default: 0\n");
+	printf("      --recycle-jitter PERCENT\n");
+	printf("                            Lower the max requests and memory limits of each\n");
+	printf("                            process by a random percentage up to this value,\n");
+	printf("                            so that processes aren't recycled at the same\n");
+	printf("                            time. Default: 0\n");
+	printf("      --capacity-weight NUMBER\n");
+	printf("                            The weight of this application when the capacity\n");
+	printf("                            of a full pool is shared between applications.\n");
+	printf("                            Default: 1\n");
+	printf("      --max-out-of-band-work-percentage PERCENT\n");
+	printf("                            Allow this percentage of the processes to perform\n");
+	printf("                            out-of-band work at the same time. Default: 0\n");
+	printf("                            (one process at a time)\n");
+	printf("      --out-of-band-work-max-utilization PERCENT\n");
+	printf("                            Defer out-of-band work while the utilization of\n");
+	printf("                            the processes is above this percentage.\n");
+	printf("                            Default: 0 (only while requests are queued)\n");
+	printf("      --out-of-band-work-idle-interval SECONDS\n");
+	printf("                            Give idle processes out-of-band work at most once\n");
+	printf("                            per this many seconds while the load is low.\n");
+	printf("                            Default: 0 (only when processes request it)\n");
+	printf("      --memory-limit MB     Replace application processes that go over the\n");
+	printf("                            given memory limit. Default: 0 (no limit)\n");
+	printf("      --warmup-time SECS    Ramp up the traffic to newly spawned processes\n");
+	printf("                            over this many seconds. Default: 0 (disabled)\n");
+	printf("      --health-check-path PATH\n");
+	printf("                            Periodically request this path from every\n");
+	printf("                            process, and stop routing requests to processes\n");
+	printf("                            that don't respond successfully for a while\n");
+	printf("      --health-check-interval SECS\n");
+	printf("                            Time between health checks of a process.\n");
+	printf("                            Default: 10\n");
+	printf("      --health-check-timeout SECS\n");
+	printf("                            Time that a health check may take. Default: 5\n");
+	printf("      --unresponsive-process-timeout SECS\n");
+	printf("                            Stop routing requests to processes that have had\n");
+	printf("                            requests in progress for this long without\n");
+	printf("                            finishing any. Default: 0 (disabled)\n");
+	printf("      --health-check-ejection-time SECS\n");
+	printf("                            Time that an unhealthy process is taken out of\n");
+	printf("                            routing for. Default: 30\n");
 	printf("\n");
 	printf("Request handling options (optional):\n");
 	printf("      --max-requests        Restart application processes that have handled\n");
@@ -158,31 +286,175 @@ coreUsage() {
 	printf("      --max-request-queue-size NUMBER\n");
 	printf("                            Specify request queue size. Default: %d\n",
 		DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	printf("      --request-queue-target-delay MSEC\n");
+	printf("                            Reject queued requests that waited longer than\n");
+	printf("                            this, once the queue has been slow for a while.\n");
+	printf("                            Default: 0 (disabled)\n");
 	printf("      --sticky-sessions     Enable sticky sessions\n");
 	printf("      --sticky-sessions-cookie-name NAME\n");
 	printf("                            Cookie name to use for sticky sessions.\n");
 	printf("                            Default: " DEFAULT_STICKY_SESSIONS_COOKIE_NAME "\n");
+	printf("      --routing-policy NAME How to pick a process for a request: 'least-busy',\n");
+	printf("                            'p2c' (power of two choices), 'ewma' (prefer\n");
+	printf("                            processes with low response times) or\n");
+	printf("                            'consistent-hash' (route requests with the same\n");
+	printf("                            --routing-key to the same process).\n");
+	printf("                            Default: " DEFAULT_ROUTING_POLICY "\n");
+	printf("      --routing-key SPEC    What the consistent-hash routing policy hashes:\n");
+	printf("                            'header:NAME', 'cookie:NAME' or\n");
+	printf("                            'path-prefix:SEGMENTS'\n");
+	printf("      --rate-limit NUMBER   Answer requests with 429 Too Many Requests once\n");
+	printf("                            they arrive faster than this many per second per\n");
+	printf("                            --rate-limit-key. Default: 0 (disabled)\n");
+	printf("      --rate-limit-burst NUMBER\n");
+	printf("                            How many requests per key may arrive at once\n");
+	printf("                            before --rate-limit applies. Default: the rate\n");
+	printf("      --max-requests-in-flight NUMBER\n");
+	printf("                            Answer requests with 429 Too Many Requests while\n");
+	printf("                            this many requests with the same --rate-limit-key\n");
+	printf("                            are being processed. Default: 0 (disabled)\n");
+	printf("      --rate-limit-key SPEC What requests are limited by: 'app-group',\n");
+	printf("                            'remote-addr', 'header:NAME' or\n");
+	printf("                            'path-prefix:SEGMENTS'. Default: app-group.\n");
+	printf("                            Keys are counted per application group, which\n");
+	printf("                            may override the three limits above\n");
 	printf("      --vary-turbocache-by-cookie NAME\n");
 	printf("                            Vary the turbocache by the cookie of the given name\n");
+	printf("      --request-priority-header NAME\n");
+	printf("                            Prioritize requests waiting for a process by the\n");
+	printf("                            numerical value of this header (0-3)\n");
+	printf("      --serve-x-sendfile    Serve files named by X-Sendfile response headers\n");
+	printf("                            directly, instead of leaving that to the web\n");
+	printf("                            server in front\n");
+	printf("      --serve-static-files  Serve files in the app's public directory\n");
+	printf("                            directly, instead of forwarding those requests\n");
+	printf("                            to the app\n");
+	printf("      --response-compression\n");
+	printf("                            Gzip-compress textual response bodies for\n");
+	printf("                            clients that accept it\n");
+	printf("      --probe-path PATH     Answer GET and HEAD requests for this path, such\n");
+	printf("                            as load balancer health checks, directly instead\n");
+	printf("                            of forwarding them to the app. May be specified\n");
+	printf("                            multiple times\n");
+	printf("      --probe-requires-process\n");
+	printf("                            Answer probe requests with 503 Service Unavailable\n");
+	printf("                            unless the app has an enabled process\n");
 	printf("      --disable-turbocaching\n");
 	printf("                            Disable turbocaching\n");
+	printf("      --turbocache-entries NUMBER\n");
+	printf("                            Number of responses that each thread's turbocache\n");
+	printf("                            can hold. Default: %d\n", DEFAULT_TURBOCACHE_ENTRIES);
+	printf("      --turbocache-max-body-size BYTES\n");
+	printf("                            Maximum size of a response body that may be\n");
+	printf("                            turbocached. Default: %d\n",
+		DEFAULT_TURBOCACHE_MAX_BODY_SIZE);
+	printf("      --shared-turbocache-size BYTES\n");
+	printf("                            Back the per-thread turbocaches with a cache of\n");
+	printf("                            the given size that is shared by all threads.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --turbocache-coalescing-timeout MSEC\n");
+	printf("                            Let turbocacheable requests wait up to this long\n");
+	printf("                            for an identical request that is already being\n");
+	printf("                            forwarded to the application, and reply from\n");
+	printf("                            its cached response. Default: 0 (disabled)\n");
+	printf("      --turbocache-snapshot PATH\n");
+	printf("                            Save the turbocache contents to files starting\n");
+	printf("                            with this path on shutdown, and load them again\n");
+	printf("                            on startup. Default: not saved\n");
 	printf("      --no-abort-websockets-on-process-shutdown\n");
 	printf("                            Do not abort WebSocket connections on process\n");
 	printf("                            shutdown or restart\n");
+	printf("      --websocket-drain-time SECONDS\n");
+	printf("                            When a process is restarted, spread the\n");
+	printf("                            disconnection of its WebSocket connections\n");
+	printf("                            randomly over this many seconds, so that clients\n");
+	printf("                            don't all reconnect at once. Default: 0\n");
 	printf("\n");
 	printf("Other options (optional):\n");
 	printf("      --log-file PATH       Log to the given file.\n");
 	printf("      --log-level LEVEL     Logging level. Default: %d\n", DEFAULT_LOG_LEVEL);
 	printf("      --fd-log-file PATH    Log file descriptor activity to the given file.\n");
+	printf("      --log-buffer-size BYTES\n");
+	printf("                            Write log messages from a background thread,\n");
+	printf("                            buffering up to this many bytes per thread. Messages\n");
+	printf("                            that do not fit are dropped and counted.\n");
+	printf("                            Default: 0 (log synchronously)\n");
 	printf("      --stat-throttle-rate SECONDS\n");
 	printf("                            Throttle filesystem restart.txt checks to at most\n");
 	printf("                            once per given seconds. Default: %d\n", DEFAULT_STAT_THROTTLE_RATE);
+	printf("      --no-restart-file-watching\n");
+	printf("                            Always poll restart.txt, instead of watching its\n");
+	printf("                            directory for changes where possible\n");
+	printf("      --ust-router-log-buffer-size BYTES\n");
+	printf("                            Buffer up to this many bytes of Union Station log\n");
+	printf("                            messages per UstRouter connection, and write them\n");
+	printf("                            from a background thread. Messages that don't fit\n");
+	printf("                            are dropped. 0 writes them immediately.\n");
+	printf("                            Default: %d\n", DEFAULT_UST_ROUTER_LOG_BUFFER_SIZE);
+	printf("      --union-station-sample-rate PERCENT\n");
+	printf("                            Log only this percentage of requests to Union\n");
+	printf("                            Station. Failed and slow requests are always\n");
+	printf("                            logged. Default: 100\n");
+	printf("      --union-station-slow-request-threshold MSEC\n");
+	printf("                            Requests that take at least this long are logged\n");
+	printf("                            to Union Station even if they were not sampled.\n");
+	printf("                            0 only logs failed ones. Default: %d\n",
+		DEFAULT_UNION_STATION_SLOW_REQUEST_THRESHOLD);
+	printf("      --mbuf-pool-trim-interval SECONDS\n");
+	printf("                            Release unused buffer memory every given seconds.\n");
+	printf("                            0 disables this. Default: %d\n",
+		DEFAULT_MBUF_POOL_TRIM_INTERVAL);
+	printf("      --huge-page-arena-size MB\n");
+	printf("                            Allocate buffers out of up to this many MB of\n");
+	printf("                            huge page backed memory per thread, and back the\n");
+	printf("                            turbocache with huge pages too. Uses explicit huge\n");
+	printf("                            pages if reserved, transparent ones otherwise.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --request-trace-sample-rate NUMBER\n");
+	printf("                            Record sizes, timings and routing decisions of 1\n");
+	printf("                            in NUMBER requests into an anonymized trace, which\n");
+	printf("                            dev/benchmark_core --replay can replay.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --request-trace-entries NUMBER\n");
+	printf("                            Number of requests that the trace holds before the\n");
+	printf("                            oldest ones are overwritten. Default: %d\n",
+		DEFAULT_REQUEST_TRACE_ENTRIES);
+	printf("      --request-trace-file PATH\n");
+	printf("                            Where to store the trace. Default:\n");
+	printf("                            request_trace.bin in the instance directory\n");
 	printf("      --no-show-version-in-header\n");
 	printf("                            Do not show " PROGRAM_NAME " version number in\n");
 	printf("                            HTTP headers.\n");
 	printf("      --data-buffer-dir PATH\n");
 	printf("                            Directory to store data buffers in. Default:\n");
 	printf("                            %s\n", getSystemTempDir());
+	printf("      --request-body-prebuffer-size BYTES\n");
+	printf("                            When buffering request bodies, check out a session\n");
+	printf("                            after buffering this many bytes, and stream the rest\n");
+	printf("                            of the body to the app. 0 buffers whole bodies.\n");
+	printf("                            Default: %d\n", DEFAULT_REQUEST_BODY_PREBUFFER_SIZE);
+	printf("      --request-body-slow-rate BYTES_PER_SEC\n");
+	printf("                            Clients that upload the first part of the request\n");
+	printf("                            body slower than this have their whole body\n");
+	printf("                            buffered. Default: %d\n", DEFAULT_REQUEST_BODY_SLOW_RATE);
+	printf("      --client-header-timeout SECONDS\n");
+	printf("                            Disconnect clients that don't send a request's\n");
+	printf("                            headers within this time. 0 means no limit.\n");
+	printf("                            Default: %d\n", DEFAULT_CLIENT_HEADER_TIMEOUT);
+	printf("      --client-keepalive-timeout SECONDS\n");
+	printf("                            Disconnect keep-alive connections that stay idle\n");
+	printf("                            this long between requests. Default: 0 (no limit)\n");
+	printf("      --client-body-min-rate BYTES_PER_SEC\n");
+	printf("                            Disconnect clients that upload a request body\n");
+	printf("                            slower than this, measured over 10 seconds.\n");
+	printf("                            Default: 0 (no limit)\n");
+	printf("      --response-buffer-full-buffering-size BYTES\n");
+	printf("                            Buffer app responses up to this size completely, so\n");
+	printf("                            that the app is released as soon as possible. Beyond\n");
+	printf("                            it, stop reading from the app once the buffered data\n");
+	printf("                            would take the client more than a few seconds to\n");
+	printf("                            receive. 0 disables this. Default: %d\n",
+		DEFAULT_RESPONSE_BUFFER_FULL_BUFFERING_SIZE);
 	printf("      --no-graceful-exit    When exiting, exit immediately instead of waiting\n");
 	printf("                            for all connections to terminate\n");
 	printf("      --benchmark MODE      Enable benchmark mode. Available modes:\n");
@@ -192,9 +464,24 @@ coreUsage() {
 	printf("                            performance, but might delay finding bugs in\n");
 	printf("                            " PROGRAM_NAME "\n");
 	printf("      --threads NUMBER      Number of threads to use for request handling.\n");
-	printf("                            Default: number of CPU cores (%d)\n",
-		boost::thread::hardware_concurrency());
-	printf("      --cpu-affine          Enable per-thread CPU affinity (Linux only)\n");
+	printf("                            Default: number of usable CPU cores, taking\n");
+	printf("                            affinity and cgroup CPU quota into account (%u)\n",
+		getUsableCpuCount());
+	printf("      --spare-clients NUMBER\n");
+	printf("                            Number of client and request objects that each\n");
+	printf("                            thread preallocates at startup (max 4095).\n");
+	printf("                            Default: %d\n", DEFAULT_CORE_SPARE_CLIENTS);
+	printf("      --cpu-affine          Enable per-thread CPU affinity. Each thread's\n");
+	printf("                            memory is allocated on its CPU's NUMA node\n");
+	printf("                            (Linux only)\n");
+	printf("      --reuse-port          Give each thread its own SO_REUSEPORT socket for\n");
+	printf("                            every TCP address, instead of distributing\n");
+	printf("                            clients through a single load balancer thread.\n");
+	printf("                            Combine with --cpu-affine to steer connections\n");
+	printf("                            to the thread pinned to the receiving CPU\n");
+	printf("                            (Linux only)\n");
+	printf("      --auto-tune           Let each thread adjust its accept burst size and\n");
+	printf("                            its number of spare clients to the workload\n");
 	printf("      --core-file-descriptor-ulimit NUMBER\n");
 	printf("                            Set custom file descriptor ulimit for the core\n");
 	printf("  -h, --help                Show this help\n");
@@ -228,6 +515,28 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 				"for Unix domain sockets.\n");
 			exit(1);
 		}
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tenant")) {
+		const char *sep = strchr(argv[i + 1], '=');
+		if (sep == NULL || sep == argv[i + 1]
+		 || getSocketAddressType(sep + 1) == SAT_UNKNOWN)
+		{
+			fprintf(stderr, "ERROR: invalid format for --tenant. It must be "
+				"formatted as NAME=ADDRESS, where ADDRESS has the same format "
+				"as for --listen.\n");
+			exit(1);
+		}
+		vector<string> addresses = options.getStrSet("core_addresses", false);
+		if (addresses.size() == SERVER_KIT_MAX_SERVER_ENDPOINTS) {
+			fprintf(stderr, "ERROR: you may specify up to %u --listen and "
+				"--tenant addresses.\n", SERVER_KIT_MAX_SERVER_ENDPOINTS);
+			exit(1);
+		}
+		addresses.push_back(sep + 1);
+		options.setStrSet("core_addresses", addresses);
+		vector<string> tenants = options.getStrSet("core_tenants", false);
+		tenants.push_back(argv[i + 1]);
+		options.setStrSet("core_tenants", tenants);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--api-listen")) {
 		if (getSocketAddressType(argv[i + 1]) != SAT_UNKNOWN) {
 			vector<string> addresses = options.getStrSet("core_api_addresses",
@@ -267,6 +576,33 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--socket-backlog")) {
 		options.setInt("socket_backlog", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tcp-defer-accept")) {
+		options.setInt("core_tcp_defer_accept", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tcp-fastopen")) {
+		options.setInt("core_tcp_fastopen", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--busy-poll")) {
+		options.setInt("core_busy_poll", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tls-certificate")) {
+		options.set("core_tls_certificate", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tls-certificate-key")) {
+		options.set("core_tls_certificate_key", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tls-session-cache-size")) {
+		options.setUint("core_tls_session_cache_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tls-session-timeout")) {
+		options.setUint("core_tls_session_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--no-tls-session-tickets")) {
+		options.setBool("core_tls_session_tickets", false);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--tls-kernel-offload")) {
+		options.setBool("core_tls_kernel_offload", true);
+		i++;
 	} else if (p.isFlag(argv[i], '\0', "--no-user-switching")) {
 		options.setBool("user_switching", false);
 		i++;
@@ -278,16 +614,39 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--disable-security-update-check")) {
 		options.setBool("disable_security_update_check", true);
-		i += 2;
+		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--security-update-check-proxy")) {
 		options.set("security_update_check_proxy", argv[i + 1]);
 		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-pool-size")) {
 		options.setInt("max_pool_size", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--tenant-max-pool-size")) {
+		const char *sep = strchr(argv[i + 1], '=');
+		if (sep == NULL || sep == argv[i + 1] || atoi(sep + 1) <= 0) {
+			fprintf(stderr, "ERROR: invalid format for --tenant-max-pool-size. "
+				"It must be formatted as NAME=NUMBER.\n");
+			exit(1);
+		}
+		vector<string> limits = options.getStrSet("core_tenant_max_pool_sizes", false);
+		limits.push_back(argv[i + 1]);
+		options.setStrSet("core_tenant_max_pool_sizes", limits);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--pool-idle-time")) {
 		options.setInt("pool_idle_time", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spawn-worker-threads")) {
+		options.setUint("spawn_worker_threads", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--prespawn-concurrency")) {
+		options.setUint("prespawn_concurrency", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--prespawn-max-load")) {
+		options.setUint("prespawn_max_load", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-cgroup-root")) {
+		options.set("app_cgroup_root", argv[i + 1]);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-preloader-idle-time")) {
 		options.setInt("max_preloader_idle_time", atoi(argv[i + 1]));
 		i += 2;
@@ -297,8 +656,50 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--min-instances")) {
 		options.setInt("min_instances", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spawn-concurrency")) {
+		options.setUint("spawn_concurrency", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--target-utilization")) {
+		options.setUint("target_utilization", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--preloader-standby-processes")) {
+		options.setUint("preloader_standby_processes", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--recycle-jitter")) {
+		options.setUint("recycle_jitter", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--capacity-weight")) {
+		options.setUint("capacity_weight", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-out-of-band-work-percentage")) {
+		options.setUint("max_out_of_band_work_percentage", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--out-of-band-work-max-utilization")) {
+		options.setUint("out_of_band_work_max_utilization", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--out-of-band-work-idle-interval")) {
+		options.setUint("out_of_band_work_idle_interval", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--memory-limit")) {
-		options.setInt("memory_limit", atoi(argv[i + 1]));
+		options.setUint("memory_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-time")) {
+		options.setUint("warmup_time", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--health-check-path")) {
+		options.set("health_check_path", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--health-check-interval")) {
+		options.setUint("health_check_interval", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--health-check-timeout")) {
+		options.setUint("health_check_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--unresponsive-process-timeout")) {
+		options.setUint("unresponsive_process_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--health-check-ejection-time")) {
+		options.setUint("health_check_ejection_time", atoi(argv[i + 1]));
 		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], 'e', "--environment")) {
 		options.set("environment", argv[i + 1]);
@@ -315,6 +716,12 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--load-shell-envvars")) {
 		options.setBool("load_shell_envvars", true);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--preloader-compact-heap")) {
+		options.setBool("preloader_compact_heap", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--preloader-warmup-script")) {
+		options.set("preloader_warmup_script", argv[i + 1]);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--concurrency-model")) {
 		options.set("concurrency_model", argv[i + 1]);
 		i += 2;
@@ -339,21 +746,80 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-request-queue-size")) {
 		options.setInt("max_request_queue_size", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-queue-target-delay")) {
+		options.setUint("request_queue_target_delay", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--sticky-sessions")) {
 		options.setBool("sticky_sessions", true);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--routing-policy")) {
+		options.set("routing_policy", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--routing-key")) {
+		options.set("routing_key", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--rate-limit")) {
+		options.setUint("rate_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--rate-limit-burst")) {
+		options.setUint("rate_limit_burst", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-requests-in-flight")) {
+		options.setUint("max_requests_in_flight", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--rate-limit-key")) {
+		options.set("rate_limit_key", argv[i + 1]);
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--sticky-sessions-cookie-name")) {
 		options.set("sticky_sessions_cookie_name", argv[i + 1]);
 		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--vary-turbocache-by-cookie")) {
 		options.set("vary_turbocache_by_cookie", argv[i + 1]);
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-priority-header")) {
+		options.set("request_priority_header", argv[i + 1]);
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--serve-x-sendfile")) {
+		options.setBool("serve_x_sendfile", true);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--serve-static-files")) {
+		options.setBool("serve_static_files", true);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--response-compression")) {
+		options.setBool("response_compression", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--probe-path")) {
+		vector<string> paths = options.getStrSet("probe_paths", false);
+		paths.push_back(argv[i + 1]);
+		options.setStrSet("probe_paths", paths);
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--probe-requires-process")) {
+		options.setBool("probe_requires_process", true);
+		i++;
 	} else if (p.isFlag(argv[i], '\0', "--disable-turbocaching")) {
 		options.setBool("turbocaching", false);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-entries")) {
+		options.setUint("turbocache_entries", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-max-body-size")) {
+		options.setUint("turbocache_max_body_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--shared-turbocache-size")) {
+		options.setUint("shared_turbocache_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-coalescing-timeout")) {
+		options.setUint("turbocache_coalescing_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--turbocache-snapshot")) {
+		options.set("turbocache_snapshot", argv[i + 1]);
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--no-abort-websockets-on-process-shutdown")) {
 		options.setBool("abort_websockets_on_process_shutdown", false);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--websocket-drain-time")) {
+		options.setUint("websocket_drain_time", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--ruby")) {
 		options.set("default_ruby", argv[i + 1]);
 		i += 2;
@@ -369,12 +835,21 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-file-descriptor-ulimit")) {
 		options.setUint("app_file_descriptor_ulimit", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-cpu-affinity")) {
+		options.set("app_cpu_affinity", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-shm-ring-slots")) {
+		options.setUint("app_shm_ring_slots", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--debugger")) {
 		options.setBool("debugger", true);
 		i++;
 	} else if (p.isFlag(argv[i], '\0', "--rolling-restarts")) {
 		options.setBool("rolling_restarts", true);
 		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--rolling-restart-batch-size")) {
+		options.setUint("rolling_restart_batch_size", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--resist-deployment-errors")) {
 		options.setBool("resist_deployment_errors", true);
 		i++;
@@ -388,6 +863,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 		// the Watchdog, we don't want to affect the Watchdog's own log file.
 		options.set("core_log_file", argv[i + 1]);
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--log-buffer-size")) {
+		options.setUint("core_log_buffer_size", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--fd-log-file")) {
 		// We do not set file_descriptor_log_file because, when this function is called from
 		// the Watchdog, we don't want to affect the Watchdog's own log file.
@@ -396,12 +874,57 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--stat-throttle-rate")) {
 		options.setInt("stat_throttle_rate", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--no-restart-file-watching")) {
+		options.setBool("restart_file_watching", false);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--ust-router-log-buffer-size")) {
+		options.setUint("ust_router_log_buffer_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--union-station-sample-rate")) {
+		options.set("union_station_sample_rate", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--union-station-slow-request-threshold")) {
+		options.setUint("union_station_slow_request_threshold", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--mbuf-pool-trim-interval")) {
+		options.setInt("mbuf_pool_trim_interval", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--huge-page-arena-size")) {
+		options.setUint("huge_page_arena_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-trace-sample-rate")) {
+		options.setUint("request_trace_sample_rate", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-trace-entries")) {
+		options.setUint("request_trace_entries", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-trace-file")) {
+		options.set("request_trace_file", argv[i + 1]);
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--no-show-version-in-header")) {
 		options.setBool("show_version_in_header", false);
 		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--data-buffer-dir")) {
 		options.setInt("data_buffer_dir", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-body-prebuffer-size")) {
+		options.setUint("request_body_prebuffer_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--request-body-slow-rate")) {
+		options.setUint("request_body_slow_rate", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--client-header-timeout")) {
+		options.setUint("client_header_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--client-keepalive-timeout")) {
+		options.setUint("client_keepalive_timeout", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--client-body-min-rate")) {
+		options.setUint("client_body_min_rate", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--response-buffer-full-buffering-size")) {
+		options.setUint("response_buffer_full_buffering_size", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--no-graceful-exit")) {
 		options.setBool("core_graceful_exit", false);
 		i++;
@@ -414,9 +937,18 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--threads")) {
 		options.setInt("core_threads", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spare-clients")) {
+		options.setInt("core_spare_clients", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--cpu-affine")) {
 		options.setBool("core_cpu_affine", true);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--reuse-port")) {
+		options.setBool("core_reuse_port", true);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--auto-tune")) {
+		options.setBool("core_auto_tune", true);
+		i++;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--core-file-descriptor-ulimit")) {
 		options.setUint("core_file_descriptor_ulimit", atoi(argv[i + 1]));
 		i += 2;
@@ -0,0 +1,327 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CORE_RATE_LIMITER_H_
+#define _PASSENGER_CORE_RATE_LIMITER_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <jsoncpp/json.h>
+#include <DataStructures/HashedStaticString.h>
+#include <StaticString.h>
+#include <Utils/SystemTime.h>
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+
+
+/**
+ * Token bucket rate limits and caps on the number of requests in flight,
+ * per key (an application group, the value of a header, ...). Shared by
+ * all Controllers. The limits are passed along with every call, so that
+ * each application group can have its own; an entry follows the limits
+ * that it was last called with.
+ *
+ * To keep locking off the request path, Controllers don't take tokens
+ * and in-flight slots from here one request at a time. They lease them in
+ * small batches, and hand those out to requests from their own event loop
+ * without locking. Every now and then they return what they didn't use,
+ * so that an idle thread doesn't sit on capacity that a busy one needs.
+ * Under contention, a key may therefore be limited slightly before it
+ * reaches its limit, but it never exceeds it.
+ *
+ * Entries live in fixed-size stripes, each protected by its own lock. An
+ * entry whose bucket is full and that has no slots leased out is idle,
+ * and may be taken over by another key. If a stripe has no room for a new
+ * key, that key is denied until room frees up: letting it through would
+ * let anyone escape their limits by rotating keys until the table is
+ * full. Such denials are counted separately in the state output.
+ */
+class RateLimiter: public boost::noncopyable {
+public:
+	static const unsigned int STRIPES = 16;
+	static const unsigned int SLOTS_PER_STRIPE = 64;
+	static const unsigned int MAX_LEASE_SIZE = 32;
+
+private:
+	struct Entry {
+		bool valid;
+		boost::uint32_t hash;
+		string key;
+		double tokens;
+		// The limits that tokens is refilled with. A burst of 0 means
+		// that no tokens have been taken from this entry yet.
+		double rate;
+		double burst;
+		MonotonicTimeUsec lastRefillTime;
+		unsigned int leasedSlots;
+
+		Entry()
+			: valid(false),
+			  hash(0),
+			  tokens(0),
+			  rate(0),
+			  burst(0),
+			  lastRefillTime(0),
+			  leasedSlots(0)
+			{ }
+	};
+
+	struct Stripe {
+		mutable boost::mutex syncher;
+		Entry entries[SLOTS_PER_STRIPE];
+		unsigned int leases, deniedLeases, overflowLeases;
+
+		Stripe()
+			: leases(0),
+			  deniedLeases(0),
+			  overflowLeases(0)
+			{ }
+	};
+
+	Stripe stripes[STRIPES];
+	unsigned int threads;
+
+	OXT_FORCE_INLINE
+	Stripe &getStripe(const HashedStaticString &key) {
+		return stripes[key.hash() % STRIPES];
+	}
+
+	static void refill(Entry *entry, MonotonicTimeUsec now) {
+		if (now > entry->lastRefillTime) {
+			entry->tokens = std::min(entry->burst, entry->tokens
+				+ (now - entry->lastRefillTime) * entry->rate / 1000000.0);
+			entry->lastRefillTime = now;
+		}
+	}
+
+	static void setTokenLimits(Entry *entry, double rate, double burst,
+		MonotonicTimeUsec now)
+	{
+		if (entry->burst == 0) {
+			entry->tokens = burst;
+		} else {
+			refill(entry, now);
+			entry->tokens = std::min(entry->tokens, burst);
+		}
+		entry->rate = rate;
+		entry->burst = burst;
+		entry->lastRefillTime = now;
+	}
+
+	static bool isIdle(Entry *entry, MonotonicTimeUsec now) {
+		if (entry->leasedSlots > 0) {
+			return false;
+		}
+		refill(entry, now);
+		return entry->tokens >= entry->burst;
+	}
+
+	static Entry *lookup(Stripe &stripe, const HashedStaticString &key) {
+		for (unsigned int i = 0; i < SLOTS_PER_STRIPE; i++) {
+			Entry *entry = &stripe.entries[i];
+			if (entry->valid && entry->hash == key.hash() && key == entry->key) {
+				return entry;
+			}
+		}
+		return NULL;
+	}
+
+	/** Returns NULL if the stripe has no room for the key. */
+	Entry *lookupOrCreate(Stripe &stripe, const HashedStaticString &key,
+		MonotonicTimeUsec now)
+	{
+		Entry *reusable = NULL;
+
+		for (unsigned int i = 0; i < SLOTS_PER_STRIPE; i++) {
+			Entry *entry = &stripe.entries[i];
+			if (entry->valid && entry->hash == key.hash() && key == entry->key) {
+				return entry;
+			} else if (reusable == NULL && (!entry->valid || isIdle(entry, now))) {
+				reusable = entry;
+			}
+		}
+
+		if (reusable != NULL) {
+			reusable->valid = true;
+			reusable->hash = key.hash();
+			reusable->key.assign(key.data(), key.size());
+			reusable->tokens = 0;
+			reusable->rate = 0;
+			reusable->burst = 0;
+			reusable->lastRefillTime = now;
+			reusable->leasedSlots = 0;
+		}
+		return reusable;
+	}
+
+	static unsigned int calculateLeaseSize(double limit, unsigned int threads) {
+		// Small enough that the threads can't lease everything between them
+		// while some of them still have nothing.
+		unsigned int size = (unsigned int) (limit / (4 * std::max(threads, 1u)));
+		if (size > MAX_LEASE_SIZE) {
+			return MAX_LEASE_SIZE;
+		} else {
+			return std::max(size, 1u);
+		}
+	}
+
+public:
+	/**
+	 * @param _threads The number of Controllers that share this object.
+	 */
+	RateLimiter(unsigned int _threads)
+		: threads(std::max(_threads, 1u))
+		{ }
+
+	/**
+	 * Takes up to a lease's worth of tokens from the key's bucket, and
+	 * returns how many were taken. 0 means that the key is over its rate.
+	 *
+	 * @param rate  Requests per second. Greater than 0.
+	 * @param burst How many requests may arrive at once. At least 1.
+	 */
+	unsigned int leaseTokens(const HashedStaticString &key, double rate,
+		unsigned int burst, MonotonicTimeUsec now)
+	{
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Entry *entry = lookupOrCreate(stripe, key, now);
+		unsigned int result;
+
+		if (OXT_UNLIKELY(entry == NULL)) {
+			stripe.overflowLeases++;
+			stripe.deniedLeases++;
+			return 0;
+		}
+
+		if (OXT_UNLIKELY(entry->rate != rate || entry->burst != burst)) {
+			setTokenLimits(entry, rate, burst, now);
+		} else {
+			refill(entry, now);
+		}
+		result = (unsigned int) std::min<double>(calculateLeaseSize(burst, threads),
+			std::floor(entry->tokens));
+		entry->tokens -= result;
+		stripe.leases++;
+		if (result == 0) {
+			stripe.deniedLeases++;
+		}
+		return result;
+	}
+
+	/**
+	 * Takes up to a lease's worth of in-flight slots for the key, and
+	 * returns how many were taken. 0 means that the key has the maximum
+	 * number of requests in flight.
+	 *
+	 * @param maxInFlight The maximum number of requests in flight.
+	 *                    Greater than 0.
+	 */
+	unsigned int leaseSlots(const HashedStaticString &key, unsigned int maxInFlight,
+		MonotonicTimeUsec now)
+	{
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Entry *entry = lookupOrCreate(stripe, key, now);
+		unsigned int result;
+
+		if (OXT_UNLIKELY(entry == NULL)) {
+			stripe.overflowLeases++;
+			stripe.deniedLeases++;
+			return 0;
+		}
+
+		if (entry->leasedSlots >= maxInFlight) {
+			// The limit may have been lowered while slots were leased out.
+			result = 0;
+		} else {
+			result = std::min(calculateLeaseSize(maxInFlight, threads),
+				maxInFlight - entry->leasedSlots);
+		}
+		entry->leasedSlots += result;
+		stripe.leases++;
+		if (result == 0) {
+			stripe.deniedLeases++;
+		}
+		return result;
+	}
+
+	/** Gives back leased tokens and slots that weren't used. */
+	void returnLeases(const HashedStaticString &key, unsigned int tokens,
+		unsigned int slots, MonotonicTimeUsec now)
+	{
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Entry *entry = lookup(stripe, key);
+
+		// The entry may have been taken over by another key while the
+		// caller held no slots, in which case its tokens are forfeited.
+		if (entry != NULL) {
+			refill(entry, now);
+			entry->tokens = std::min(entry->burst, entry->tokens + tokens);
+			entry->leasedSlots -= std::min(slots, entry->leasedSlots);
+		}
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		unsigned int entries = 0, leases = 0, deniedLeases = 0, overflowLeases = 0;
+
+		for (unsigned int i = 0; i < STRIPES; i++) {
+			const Stripe &stripe = stripes[i];
+			boost::lock_guard<boost::mutex> l(stripe.syncher);
+			for (unsigned int j = 0; j < SLOTS_PER_STRIPE; j++) {
+				entries += stripe.entries[j].valid;
+			}
+			leases += stripe.leases;
+			deniedLeases += stripe.deniedLeases;
+			overflowLeases += stripe.overflowLeases;
+		}
+
+		doc["entries"] = entries;
+		doc["leases"] = leases;
+		doc["denied_leases"] = deniedLeases;
+		// Denied because there was no room for the key.
+		doc["overflow_denied_leases"] = overflowLeases;
+		return doc;
+	}
+};
+
+typedef boost::shared_ptr<RateLimiter> RateLimiterPtr;
+
+
+} // namespace Core
+} // namespace Passenger
+
+#endif /* _PASSENGER_CORE_RATE_LIMITER_H_ */
@@ -0,0 +1,247 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_CORE_REQUEST_TRACE_RECORDER_H_
+#define _PASSENGER_CORE_REQUEST_TRACE_RECORDER_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+#include <oxt/system_calls.hpp>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+#include <RandomGenerator.h>
+#include <Utils/Hasher.h>
+#include <Utils/SystemTime.h>
+
+namespace Passenger {
+namespace Core {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * One sampled request. All times are in microseconds. Durations that the
+ * request did not go through (e.g. the queue time of a request that was
+ * served from the turbocache) are 0.
+ */
+struct RequestTraceRecord {
+	/** Wall clock time at which the request header began to arrive. */
+	boost::uint64_t arrivalTime;
+	boost::uint64_t requestBodySize;
+	/** Number of bytes sent to the client, including the header. */
+	boost::uint64_t responseSize;
+	/** Salted hash of the path without the query string. */
+	boost::uint32_t pathHash;
+	/** Salted hash of the application group name. */
+	boost::uint32_t appGroupHash;
+	boost::uint32_t headerSize;
+	/** Time spent waiting for a session from the application pool. */
+	boost::uint32_t queueTime;
+	/** Time between connecting to the process and its first response byte. */
+	boost::uint32_t serviceTime;
+	boost::uint32_t totalTime;
+	/** The process that the request was routed to, or 0. */
+	boost::int32_t pid;
+	/** The application's response status, or 0 if the app did not respond. */
+	boost::uint16_t statusCode;
+	/** An `http_method`. */
+	boost::uint8_t method;
+	boost::uint8_t flags;
+	boost::uint64_t sequence;
+};
+
+BOOST_STATIC_ASSERT(sizeof(RequestTraceRecord) == 64);
+
+
+/**
+ * Records a sample of the requests that a Core handles into a ring file,
+ * so that the shape of production traffic can be replayed later with
+ * `dev/benchmark_core --replay`. Requests are anonymized: only sizes,
+ * timings, the routing decision and salted hashes of the path and the
+ * application group are recorded. The salt is random and is not stored,
+ * so hashes can only be compared within one file.
+ *
+ * The recorder is shared by all Controllers. Recording a request is a
+ * single atomic increment plus a 64-byte copy into the mapped file; the
+ * Controllers decide which requests to sample.
+ *
+ * The layout, in native byte order:
+ *
+ *     offset  type       field
+ *     0       char[8]    magic: "PSGTRACE"
+ *     8       uint32     version: 1
+ *     12      uint32     record size: 64
+ *     16      uint32     capacity (number of records)
+ *     20      uint32     sample rate (1 in N requests)
+ *     24      uint64     created_at (usec since the epoch)
+ *     32      record[capacity]
+ *
+ * A record with sequence number N (starting at 1) is stored in slot
+ * (N - 1) % capacity, overwriting older records. The sequence number is
+ * set to 0 before the other fields of a slot change, and to N afterwards,
+ * so readers skip slots with a sequence number of 0 and sort the others
+ * by their sequence number.
+ */
+class RequestTraceRecorder: public boost::noncopyable {
+public:
+	enum Flags {
+		/** The request went through the application pool. */
+		RTF_CHECKED_OUT   = 1 << 0,
+		/** The application sent a response header. */
+		RTF_APP_RESPONDED = 1 << 1,
+		RTF_KEEP_ALIVE    = 1 << 2,
+		RTF_HTTPS         = 1 << 3,
+		RTF_UPGRADED      = 1 << 4
+	};
+
+	static const unsigned int VERSION = 1;
+
+private:
+	struct Header {
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t recordSize;
+		boost::uint32_t capacity;
+		boost::uint32_t sampleRate;
+		boost::uint64_t createdAt;
+	};
+
+	string path;
+	unsigned int capacity;
+	unsigned int sampleRate;
+	boost::uint32_t salt;
+	void *mapping;
+	size_t mappingSize;
+	RequestTraceRecord *records;
+	boost::atomic<boost::uint64_t> lastSequence;
+
+public:
+	/**
+	 * Creates (or truncates) the ring file at `path`, with room for
+	 * `capacity` records. Controllers record 1 in `sampleRate` requests.
+	 *
+	 * @throws SystemException
+	 */
+	RequestTraceRecorder(const string &_path, unsigned int _capacity,
+		unsigned int _sampleRate)
+		: path(_path),
+		  capacity(std::max(_capacity, 1u)),
+		  sampleRate(std::max(_sampleRate, 1u)),
+		  mapping(NULL),
+		  mappingSize(sizeof(Header) + capacity * sizeof(RequestTraceRecord)),
+		  records(NULL),
+		  lastSequence(0)
+	{
+		FileDescriptor fd(syscalls::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600),
+			__FILE__, __LINE__);
+		if (fd == -1) {
+			int e = errno;
+			throw FileSystemException("Cannot create request trace file " + path, e, path);
+		}
+		if (ftruncate(fd, mappingSize) == -1) {
+			int e = errno;
+			throw FileSystemException("Cannot resize " + path, e, path);
+		}
+
+		mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED) {
+			int e = errno;
+			mapping = NULL;
+			throw FileSystemException("Cannot map " + path, e, path);
+		}
+
+		Header *header = (Header *) mapping;
+		memcpy(header->magic, "PSGTRACE", sizeof(header->magic));
+		header->version = VERSION;
+		header->recordSize = sizeof(RequestTraceRecord);
+		header->capacity = capacity;
+		header->sampleRate = sampleRate;
+		header->createdAt = SystemTime::getUsec();
+		records = (RequestTraceRecord *) ((char *) mapping + sizeof(Header));
+
+		generateRandomBytes(&salt, sizeof(salt));
+	}
+
+	~RequestTraceRecorder() {
+		if (mapping != NULL) {
+			munmap(mapping, mappingSize);
+		}
+	}
+
+	const string &getPath() const {
+		return path;
+	}
+
+	unsigned int getSampleRate() const {
+		return sampleRate;
+	}
+
+	boost::uint64_t getRecordCount() const {
+		return lastSequence.load(boost::memory_order_relaxed);
+	}
+
+	boost::uint32_t hash(const char *data, unsigned int size) const {
+		Hasher h;
+		h.update((const char *) &salt, sizeof(salt));
+		h.update(data, size);
+		return h.finalize();
+	}
+
+	/**
+	 * Stores a record. Its `sequence` field is ignored. Thread-safe.
+	 */
+	void record(const RequestTraceRecord &record) {
+		boost::uint64_t sequence = lastSequence.fetch_add(1,
+			boost::memory_order_relaxed) + 1;
+		volatile RequestTraceRecord *slot = &records[(sequence - 1) % capacity];
+
+		slot->sequence = 0;
+		boost::atomic_thread_fence(boost::memory_order_release);
+		memcpy((void *) slot, &record, offsetof(RequestTraceRecord, sequence));
+		boost::atomic_thread_fence(boost::memory_order_release);
+		slot->sequence = sequence;
+	}
+};
+
+typedef boost::shared_ptr<RequestTraceRecorder> RequestTraceRecorderPtr;
+
+
+} // namespace Core
+} // namespace Passenger
+
+#endif /* _PASSENGER_CORE_REQUEST_TRACE_RECORDER_H_ */
@@ -27,14 +27,22 @@
 #define _PASSENGER_RESPONSE_CACHE_H_
 
 #include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
 #include <time.h>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <new>
 #include <DataStructures/HashedStaticString.h>
+#include <MemoryKit/hugepage.h>
+#include <Core/SharedResponseCache.h>
+#include <Constants.h>
 #include <ServerKit/http_parser.h>
 #include <ServerKit/CookieUtils.h>
 #include <StaticString.h>
 #include <Utils/DateParsing.h>
+#include <Utils/Hasher.h>
 #include <Utils/StrIntUtils.h>
 
 namespace Passenger {
@@ -45,44 +53,146 @@ namespace Passenger {
  * https://tools.ietf.org/html/rfc2109    HTTP State Management Mechanism
  */
 template<typename Request>
-class ResponseCache {
+class ResponseCache: public boost::noncopyable {
 public:
-	static const unsigned int MAX_ENTRIES     = 8; // Fits in exactly 2 cache lines
+	// The default of 8 makes the headers fit in exactly 2 cache lines.
+	static const unsigned int DEFAULT_MAX_ENTRIES   = DEFAULT_TURBOCACHE_ENTRIES;
 	static const unsigned int MAX_KEY_LENGTH  = 256;
 	static const unsigned int MAX_HEADER_SIZE = 4096;
-	static const unsigned int MAX_BODY_SIZE   = 1024 * 32;
+	static const unsigned int MAX_ETAG_SIZE   = 128;
+	static const unsigned int MAX_VARY_SIZE   = 256;
+	// The maximum number of variants stored for a single key, so that
+	// a widely varying response cannot push everything else out.
+	static const unsigned int MAX_VARIANTS    = 4;
+	static const unsigned int DEFAULT_MAX_BODY_SIZE = DEFAULT_TURBOCACHE_MAX_BODY_SIZE;
 	static const unsigned int DEFAULT_HEURISTIC_FRESHNESS = 10;
 	static const unsigned int MIN_HEURISTIC_FRESHNESS = 1;
 
+	/**
+	 * Why a response could not be stored. Used for statistics only.
+	 */
+	enum StoreFailureReason {
+		// The request's method or Cache-Control header did not allow storing.
+		UNCACHEABLE_REQUEST,
+		UNCACHEABLE_STATUS_CODE,
+		// The response's Cache-Control contained no-store, private or no-cache.
+		CACHE_CONTROL_DISALLOWS_STORING,
+		AUTHORIZATION_REQUIRED,
+		SENDFILE_RESPONSE,
+		VARIES_ON_EVERYTHING,
+		// Neither Cache-Control nor Expires give the response a
+		// (positive) freshness lifetime.
+		NO_FRESHNESS_INFORMATION,
+		HEADER_TOO_LARGE,
+		BODY_TOO_LARGE,
+		VARY_SPEC_TOO_LARGE,
+		INVALID_DATE,
+		OUT_OF_MEMORY,
+		// The admission filter judged the response's key to be requested
+		// less often than that of the entry it would replace.
+		NOT_ADMITTED,
+
+		STORE_FAILURE_REASON_COUNT
+	};
+
 	struct Header {
 		bool valid;
+		// Set while a request is refreshing this stale entry from
+		// the application. See fetch().
+		bool revalidating;
 		unsigned short keySize;
 		boost::uint32_t hash;
 		time_t date;
 
 		Header()
 			: valid(false),
+			  revalidating(false),
 			  keySize(0),
 			  hash(0),
 			  date(0)
 			{ }
 	};
 
-	struct Body {
+	struct Body: public boost::noncopyable {
 		unsigned short httpHeaderSize;
-		unsigned short httpBodySize;
+		unsigned short statusCode;
+		// 0 if the response had no ETag, or if it was too large.
+		unsigned short etagSize;
+		// 0 if the response had no Vary header. See buildVarySpec().
+		unsigned short varySize;
+		unsigned int httpBodySize;
+		// The size of the memory block that httpBodyData points to.
+		unsigned int httpBodyCapacity;
 		time_t expiryDate;
+		// Until this time, a stale entry may still be served while it
+		// is being revalidated (RFC 5861 stale-while-revalidate).
+		// Equal to expiryDate if the response did not allow that.
+		time_t staleUntil;
+		// (time_t) -1 if the response had no valid Last-Modified header.
+		time_t lastModified;
 		char key[MAX_KEY_LENGTH];
+		char etag[MAX_ETAG_SIZE];
+		char vary[MAX_VARY_SIZE];
 		char httpHeaderData[MAX_HEADER_SIZE];
-		// This data is dechunked.
-		char httpBodyData[MAX_BODY_SIZE];
+		// This data is dechunked. It is allocated on demand through
+		// reserveBodyData(), so that entries only use as much memory as
+		// the largest response that they have held.
+		char *httpBodyData;
+		// Space for the body data in the cache's huge page mapping,
+		// or NULL. httpBodyData points here until the entry needs more
+		// than that. It's unmapped together with the cache.
+		char *reservedBodyData;
 
 		Body()
 			: httpHeaderSize(0),
+			  statusCode(0),
+			  etagSize(0),
+			  varySize(0),
 			  httpBodySize(0),
-			  expiryDate(0)
+			  httpBodyCapacity(0),
+			  expiryDate(0),
+			  staleUntil(0),
+			  lastModified((time_t) -1),
+			  httpBodyData(NULL),
+			  reservedBodyData(NULL)
 		{
-			key[0] = httpHeaderData[0] = httpBodyData[0] = '\0';
+			key[0] = etag[0] = vary[0] = httpHeaderData[0] = '\0';
+		}
+
+		~Body() {
+			freeBodyData();
+		}
+
+		void freeBodyData() {
+			if (httpBodyData != reservedBodyData) {
+				free(httpBodyData);
+			}
+		}
+
+		void setReservedBodyData(char *data, unsigned int capacity) {
+			freeBodyData();
+			httpBodyData = reservedBodyData = data;
+			httpBodyCapacity = capacity;
+		}
+
+		/**
+		 * Ensures that httpBodyData can hold at least `size` bytes.
+		 * Existing data is not preserved. Returns false if memory
+		 * cannot be allocated.
+		 */
+		bool reserveBodyData(unsigned int size) {
+			if (size <= httpBodyCapacity) {
+				return true;
+			}
+
+			char *data = (char *) malloc(size);
+			if (data == NULL) {
+				return false;
+			}
+			freeBodyData();
+			httpBodyData = data;
+			httpBodyCapacity = size;
+			return true;
 		}
 	};
 
@@ -92,8 +202,11 @@ public:
 		Body *body;
 		enum {
 			NOT_FOUND,
-			NOT_FRESH
+			NOT_FRESH,
+			REVALIDATING
 		} cacheMissReason;
+		// Only set if store() failed.
+		StoreFailureReason storeFailureReason;
 
 		Entry()
 			: index(0),
@@ -118,12 +231,123 @@ public:
 				return "NOT_FOUND";
 			case NOT_FRESH:
 				return "NOT_FRESH";
+			case REVALIDATING:
+				return "REVALIDATING";
 			default:
 				return "UNKNOWN";
 			}
 		}
 	};
 
+	static const char *getStoreFailureReasonString(StoreFailureReason reason) {
+		switch (reason) {
+		case UNCACHEABLE_REQUEST:
+			return "uncacheable_request";
+		case UNCACHEABLE_STATUS_CODE:
+			return "uncacheable_status_code";
+		case CACHE_CONTROL_DISALLOWS_STORING:
+			return "cache_control_disallows_storing";
+		case AUTHORIZATION_REQUIRED:
+			return "authorization_required";
+		case SENDFILE_RESPONSE:
+			return "sendfile_response";
+		case VARIES_ON_EVERYTHING:
+			return "varies_on_everything";
+		case NO_FRESHNESS_INFORMATION:
+			return "no_freshness_information";
+		case HEADER_TOO_LARGE:
+			return "header_too_large";
+		case BODY_TOO_LARGE:
+			return "body_too_large";
+		case VARY_SPEC_TOO_LARGE:
+			return "vary_spec_too_large";
+		case INVALID_DATE:
+			return "invalid_date";
+		case OUT_OF_MEMORY:
+			return "out_of_memory";
+		case NOT_ADMITTED:
+			return "not_admitted";
+		default:
+			return "unknown";
+		}
+	}
+
+	/**
+	 * A count-min sketch that estimates how often keys have recently been
+	 * fetched, for the TinyLFU admission policy: a new entry may only
+	 * replace an existing one if its key is fetched more often. That way
+	 * a stream of one-off URLs cannot push out the entries that are
+	 * actually hit.
+	 *
+	 * Counters saturate at MAX_COUNT and are all halved every
+	 * `sampleSize` increments, so that the estimates follow changes in
+	 * popularity.
+	 */
+	class FrequencySketch: public boost::noncopyable {
+	public:
+		static const unsigned int DEPTH = 4;
+		static const unsigned int MAX_COUNT = 15;
+
+	private:
+		boost::uint8_t *counters;
+		// A power of two.
+		unsigned int width;
+		unsigned int additions;
+		unsigned int sampleSize;
+
+		unsigned int indexOf(boost::uint32_t hash, unsigned int row) const {
+			boost::uint32_t h = (hash + row * 0x9E3779B9u) * 0x85EBCA6Bu;
+			h ^= h >> 15;
+			return row * width + (h & (width - 1));
+		}
+
+		void age() {
+			for (unsigned int i = 0; i < DEPTH * width; i++) {
+				counters[i] >>= 1;
+			}
+			additions /= 2;
+		}
+
+	public:
+		FrequencySketch(unsigned int maxEntries)
+			: width(64),
+			  additions(0)
+		{
+			while (width < maxEntries * 16) {
+				width *= 2;
+			}
+			sampleSize = width * 10;
+			counters = new boost::uint8_t[DEPTH * width];
+			memset(counters, 0, DEPTH * width);
+		}
+
+		~FrequencySketch() {
+			delete[] counters;
+		}
+
+		void increment(boost::uint32_t hash) {
+			bool added = false;
+			for (unsigned int row = 0; row < DEPTH; row++) {
+				boost::uint8_t &counter = counters[indexOf(hash, row)];
+				if (counter < MAX_COUNT) {
+					counter++;
+					added = true;
+				}
+			}
+			if (added && ++additions >= sampleSize) {
+				age();
+			}
+		}
+
+		unsigned int estimate(boost::uint32_t hash) const {
+			unsigned int result = MAX_COUNT;
+			for (unsigned int row = 0; row < DEPTH; row++) {
+				result = std::min<unsigned int>(result, counters[indexOf(hash, row)]);
+			}
+			return result;
+		}
+	};
+
 private:
 	HashedStaticString HOST;
 	HashedStaticString CACHE_CONTROL;
@@ -135,6 +359,11 @@ private:
 	HashedStaticString X_ACCEL_REDIRECT;
 	HashedStaticString EXPIRES;
 	HashedStaticString LAST_MODIFIED;
+	HashedStaticString ETAG;
+	HashedStaticString IF_NONE_MATCH;
+	HashedStaticString IF_MODIFIED_SINCE;
+	HashedStaticString RANGE;
+	HashedStaticString IF_RANGE;
 	HashedStaticString LOCATION;
 	HashedStaticString CONTENT_LOCATION;
 	HashedStaticString COOKIE;
@@ -142,15 +371,31 @@ private:
 
 	unsigned int fetches, hits, stores, storeSuccesses;
 
-	Header headers[MAX_ENTRIES];
-	Body bodies[MAX_ENTRIES];
-
-	unsigned int calculateKeyLength(const LString * restrict host,
+	// Optional second-level cache, shared with other ResponseCaches.
+	SharedResponseCache *sharedCache;
+
+	// The headers are kept apart from the bodies, and are small,
+	// so that lookups only touch a few cache lines.
+	unsigned int maxEntries;
+	unsigned int maxBodySize;
+	Header *headers;
+	Body *bodies;
+	FrequencySketch frequencies;
+	// If the headers and bodies live in huge pages: the mapping that
+	// holds them, followed by `maxBodySize` bytes of body data per entry.
+	char *hugePageMapping;
+	size_t hugePageMappingSize;
+	MemoryKit::hugepage_backing hugePageBacking;
+
+	unsigned int calculateKeyLength(const StaticString &tenant,
+		const LString * restrict host,
 		const LString * restrict varyCookie,
 		const StaticString &path)
 	{
 		unsigned int size =
 			1  // protocol flag
+			+ tenant.size()
+			+ 1  // '\0'
 			+ ((host != NULL) ? host->size : 0)
 			+ 1  // '\n'
 			+ path.size()
@@ -162,7 +407,16 @@ private:
 		}
 	}
 
-	void generateKey(bool https, const StaticString &path,
+	/**
+	 * The protocol flag also records whether the client accepts a
+	 * gzip-compressed response (lower case if so), so that compressed and
+	 * uncompressed variants of a response are cached separately. The
+	 * tenant (see `Request::tenant`) follows it, so that tenants that
+	 * serve the same host don't share entries. Tenant names can't contain
+	 * NUL bytes, so a NUL byte ends it.
+	 */
+	void generateKey(bool https, bool acceptsGzip, const StaticString &tenant,
+		const StaticString &path,
 		const LString * restrict host,
 		const LString * restrict varyCookie,
 		char * restrict output,
@@ -173,11 +427,14 @@ private:
 		const LString::Part *part;
 
 		if (https) {
-			pos = appendData(pos, end, "S", 1);
+			pos = appendData(pos, end, acceptsGzip ? "s" : "S", 1);
 		} else {
-			pos = appendData(pos, end, "H", 1);
+			pos = appendData(pos, end, acceptsGzip ? "h" : "H", 1);
 		}
 
+		pos = appendData(pos, end, tenant);
+		pos = appendData(pos, end, "\0", 1);
+
 		if (host != NULL) {
 			part = host->start;
 			while (part != NULL) {
@@ -216,11 +473,16 @@ private:
 		}
 	}
 
-	Entry lookup(const HashedStaticString &cacheKey) {
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
+	/**
+	 * Looks up the entry for the key whose Vary spec matches the
+	 * request. See buildVarySpec().
+	 */
+	Entry lookup(const HashedStaticString &cacheKey, Request *req) {
+		for (unsigned int i = 0; i < maxEntries; i++) {
 			if (headers[i].valid
 			 && headers[i].hash == cacheKey.hash()
-			 && cacheKey == StaticString(bodies[i].key, headers[i].keySize))
+			 && cacheKey == StaticString(bodies[i].key, headers[i].keySize)
+			 && requestMatchesVariant(req, &bodies[i]))
 			{
 				return Entry(i, &headers[i], &bodies[i]);
 			}
@@ -228,10 +490,52 @@ private:
 		return Entry();
 	}
 
+	/**
+	 * Looks up the entry to store a response with the given Vary spec in.
+	 * That is the existing entry for the same variant if there is one.
+	 * Otherwise, it is the oldest variant if the key already has
+	 * MAX_VARIANTS of them, or else an invalid or the oldest entry.
+	 * Entries for the same key that disagree with the response on whether
+	 * it varies at all are left over from an earlier version of the
+	 * response, and are erased.
+	 */
+	Entry lookupForStoring(const HashedStaticString &cacheKey,
+		const StaticString &varySpec)
+	{
+		unsigned int variants = 0;
+		int oldestVariant = -1;
+
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			if (!headers[i].valid
+			 || headers[i].hash != cacheKey.hash()
+			 || cacheKey != StaticString(bodies[i].key, headers[i].keySize))
+			{
+				continue;
+			}
+
+			if (varySpec == StaticString(bodies[i].vary, bodies[i].varySize)) {
+				return Entry(i, &headers[i], &bodies[i]);
+			} else if (varySpec.empty() || bodies[i].varySize == 0) {
+				erase(i);
+			} else {
+				variants++;
+				if (oldestVariant == -1 || headers[i].date < headers[oldestVariant].date) {
+					oldestVariant = i;
+				}
+			}
+		}
+
+		if (variants >= MAX_VARIANTS) {
+			return Entry(oldestVariant, &headers[oldestVariant], &bodies[oldestVariant]);
+		} else {
+			return Entry();
+		}
+	}
+
 	Entry lookupInvalidOrOldest() {
 		int oldest = -1;
 
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
+		for (unsigned int i = 0; i < maxEntries; i++) {
 			if (!headers[i].valid) {
 				return Entry(i, &headers[i], &bodies[i]);
 			} else if (oldest == -1 || headers[i].date < headers[oldest].date) {
@@ -247,6 +551,233 @@ private:
 		headers[index].valid = false;
 	}
 
+	static bool rejectStoring(StoreFailureReason *output, StoreFailureReason reason) {
+		if (output != NULL) {
+			*output = reason;
+		}
+		return false;
+	}
+
+	Entry storeFailure(StoreFailureReason reason) {
+		Entry entry;
+		entry.storeFailureReason = reason;
+		return entry;
+	}
+
+	// Erases all variants with the given key.
+	void eraseKey(const HashedStaticString &cacheKey) {
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			if (headers[i].valid
+			 && headers[i].hash == cacheKey.hash()
+			 && cacheKey == StaticString(bodies[i].key, headers[i].keySize))
+			{
+				erase(i);
+			}
+		}
+	}
+
+	/**
+	 * Looks up the key in the shared cache. On a hit, the entry is
+	 * copied into this cache, and the copy is returned. The copy replaces
+	 * `target` if given; otherwise the oldest entry is replaced. On a miss,
+	 * `target` is left untouched.
+	 */
+	Entry fetchFromSharedCache(const HashedStaticString &cacheKey, ev_tstamp now,
+		Entry target = Entry())
+	{
+		if (sharedCache == NULL) {
+			return Entry();
+		}
+
+		Entry entry(target.valid() ? target : lookupInvalidOrOldest());
+		time_t date;
+		if (!sharedCache->fetch(cacheKey, (time_t) now, maxBodySize, date, *entry.body)) {
+			return Entry();
+		}
+
+		entry.header->valid   = true;
+		entry.header->revalidating = false;
+		entry.header->hash    = cacheKey.hash();
+		entry.header->keySize = cacheKey.size();
+		entry.header->date    = date;
+		entry.body->varySize  = 0;
+		memcpy(entry.body->key, cacheKey.data(), cacheKey.size());
+		return entry;
+	}
+
+	// Bumped whenever the key format changes, so that snapshots with
+	// keys that no request would match aren't loaded.
+	static StaticString getSnapshotMagic() {
+		return P_STATIC_STRING("PASSENGER TURBOCACHE SNAPSHOT 2\n");
+	}
+
+	template<typename IntegerType>
+	static void appendSnapshotInteger(string &output, IntegerType value) {
+		output.append((const char *) &value, sizeof(value));
+	}
+
+	static void appendSnapshotData(string &output, const char *data, unsigned int size) {
+		appendSnapshotInteger<boost::uint32_t>(output, size);
+		output.append(data, size);
+	}
+
+	template<typename IntegerType>
+	static bool readSnapshotInteger(const char *&pos, const char *end, IntegerType &value) {
+		if (size_t(end - pos) < sizeof(value)) {
+			return false;
+		}
+		memcpy(&value, pos, sizeof(value));
+		pos += sizeof(value);
+		return true;
+	}
+
+	// Reads data that was written by appendSnapshotData(), if it fits in `capacity`.
+	static bool readSnapshotData(const char *&pos, const char *end, char *output,
+		unsigned int capacity, unsigned int &size)
+	{
+		boost::uint32_t dataSize;
+		if (!readSnapshotInteger(pos, end, dataSize)
+		 || dataSize > capacity
+		 || size_t(end - pos) < dataSize)
+		{
+			return false;
+		}
+		memcpy(output, pos, dataSize);
+		pos += dataSize;
+		size = dataSize;
+		return true;
+	}
+
+	/**
+	 * Copies the header value into `output` in the normalized form that
+	 * Vary specs use: lower case, and without whitespace. Returns false
+	 * if it doesn't fit in `capacity` bytes.
+	 */
+	static bool normalizeVaryValue(const LString *value, char *output,
+		unsigned int capacity, unsigned int &size)
+	{
+		size = 0;
+		if (value == NULL) {
+			return true;
+		}
+
+		const LString::Part *part = value->start;
+		while (part != NULL) {
+			const char *pos = part->data;
+			const char *end = part->data + part->size;
+			while (pos < end) {
+				char ch = *pos;
+				if (ch != ' ' && ch != '\t') {
+					if (size == capacity) {
+						return false;
+					}
+					if (ch >= 'A' && ch <= 'Z') {
+						ch += 'a' - 'A';
+					}
+					output[size++] = ch;
+				}
+				pos++;
+			}
+			part = part->next;
+		}
+		return true;
+	}
+
+	/**
+	 * Builds the Vary spec of a response: for every header name in its
+	 * Vary header, a "name:value\n" line, with the normalized value of
+	 * that request header. Returns false if the response varies on
+	 * everything ("*"), or if the spec does not fit in MAX_VARY_SIZE.
+	 *
+	 * @pre req->appResponse.varyHeader is contiguous
+	 */
+	bool buildVarySpec(Request *req, char *output, unsigned short &size) const {
+		const LString *varyHeader = req->appResponse.varyHeader;
+		unsigned int pos = 0;
+
+		size = 0;
+		if (varyHeader == NULL) {
+			return true;
+		}
+
+		StaticString names(varyHeader->start->data, varyHeader->size);
+		string::size_type start = 0;
+		while (start < names.size()) {
+			string::size_type end = names.find(',', start);
+			if (end == string::npos) {
+				end = names.size();
+			}
+			StaticString name = names.substr(start, end - start);
+			while (!name.empty() && (name[0] == ' ' || name[0] == '\t')) {
+				name = name.substr(1);
+			}
+			while (!name.empty() && (name[name.size() - 1] == ' '
+				|| name[name.size() - 1] == '\t'))
+			{
+				name = name.substr(0, name.size() - 1);
+			}
+			start = end + 1;
+
+			if (name.empty()) {
+				continue;
+			} else if (name == "*") {
+				return false;
+			}
+
+			if (pos + name.size() + 2 > MAX_VARY_SIZE) {
+				return false;
+			}
+			Hasher hasher;
+			hasher.updateLowerCase(name.data(), name.size(), output + pos);
+			HashedStaticString lowercaseName(output + pos, name.size(),
+				hasher.finalize());
+			pos += name.size();
+			output[pos++] = ':';
+
+			unsigned int valueSize;
+			if (!normalizeVaryValue(req->headers.lookup(lowercaseName),
+				output + pos, MAX_VARY_SIZE - pos - 1, valueSize))
+			{
+				return false;
+			}
+			pos += valueSize;
+			output[pos++] = '\n';
+		}
+
+		size = pos;
+		return true;
+	}
+
+	/**
+	 * Checks whether the request has the same normalized values, for the
+	 * headers in the entry's Vary spec, as the request that the entry's
+	 * response was generated for.
+	 */
+	bool requestMatchesVariant(Request *req, const Body *body) const {
+		const char *pos = body->vary;
+		const char *end = body->vary + body->varySize;
+		char value[MAX_VARY_SIZE];
+		unsigned int valueSize;
+
+		while (pos < end) {
+			const char *colon = (const char *) memchr(pos, ':', end - pos);
+			const char *newline = (const char *) memchr(colon, '\n', end - colon);
+			HashedStaticString name(pos, colon - pos);
+
+			if (!normalizeVaryValue(req->headers.lookup(name), value,
+				sizeof(value), valueSize))
+			{
+				return false;
+			}
+			if (StaticString(value, valueSize) != StaticString(colon + 1, newline - colon - 1)) {
+				return false;
+			}
+
+			pos = newline + 1;
+		}
+		return true;
+	}
+
 	time_t parseDate(psg_pool_t *pool, const LString *date, ev_tstamp now) const {
 		if (date == NULL || date->size == 0) {
 			return (time_t) now;
@@ -313,10 +844,110 @@ private:
 		return now + DEFAULT_HEURISTIC_FRESHNESS;
 	}
 
+	time_t determineStaleUntil(const Request *req, time_t expiryDate) const {
+		const LString *value = req->appResponse.cacheControl;
+		if (value != NULL) {
+			StaticString cacheControl(value->start->data, value->size);
+			string::size_type pos = cacheControl.find(
+				P_STATIC_STRING("stale-while-revalidate="));
+			if (pos != string::npos) {
+				return expiryDate + stringToUint(cacheControl.substr(
+					pos + sizeof("stale-while-revalidate=") - 1));
+			}
+		}
+		return expiryDate;
+	}
+
+	void storeValidators(Request *req, Body *body) const {
+		ServerKit::HeaderTable &respHeaders = req->appResponse.headers;
+		const LString *value;
+
+		body->etagSize = 0;
+		value = respHeaders.lookup(ETAG);
+		if (value != NULL && value->size > 0 && value->size <= MAX_ETAG_SIZE) {
+			value = psg_lstr_make_contiguous(value, req->pool);
+			memcpy(body->etag, value->start->data, value->size);
+			body->etagSize = value->size;
+		}
+
+		body->lastModified = (time_t) -1;
+		value = req->appResponse.lastModifiedHeader;
+		if (value == NULL) {
+			value = respHeaders.lookup(LAST_MODIFIED);
+		}
+		if (value != NULL && value->size > 0) {
+			struct tm tm;
+			int zone;
+
+			value = psg_lstr_make_contiguous(value, req->pool);
+			if (parseImfFixdate(value->start->data, value->start->data + value->size, tm, zone)) {
+				body->lastModified = parsedDateToTimestamp(tm, zone);
+			}
+		}
+	}
+
 	bool isFresh(const Entry &entry, ev_tstamp now) const {
 		return entry.body->expiryDate > now;
 	}
 
+	bool mayServeStale(const Entry &entry, ev_tstamp now) const {
+		return entry.body->staleUntil > now;
+	}
+
+	static StaticString stripWeakEtagPrefix(const StaticString &etag) {
+		if (etag.size() >= 2 && etag[0] == 'W' && etag[1] == '/') {
+			return etag.substr(2);
+		} else {
+			return etag;
+		}
+	}
+
+	/**
+	 * Checks whether an If-None-Match header value matches the given
+	 * entity tag, using the weak comparison function from RFC 7232.
+	 */
+	static bool etagListMatches(const StaticString &list, const StaticString &etag) {
+		StaticString opaqueTag = stripWeakEtagPrefix(etag);
+		const char *pos = list.data();
+		const char *end = list.data() + list.size();
+
+		while (pos < end) {
+			while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ',')) {
+				pos++;
+			}
+			if (pos == end) {
+				break;
+			} else if (*pos == '*') {
+				return !etag.empty();
+			}
+
+			const char *tagStart = pos;
+			if (end - pos >= 2 && pos[0] == 'W' && pos[1] == '/') {
+				pos += 2;
+			}
+			if (pos < end && *pos == '"') {
+				const char *closingQuote = (const char *) memchr(pos + 1, '"',
+					end - pos - 1);
+				if (closingQuote == NULL) {
+					return false;
+				}
+				pos = closingQuote + 1;
+			} else {
+				// Not a valid entity tag, but compare it anyway.
+				while (pos < end && *pos != ',' && *pos != ' ' && *pos != '\t') {
+					pos++;
+				}
+			}
+
+			if (!etag.empty()
+			 && stripWeakEtagPrefix(StaticString(tagStart, pos - tagStart)) == opaqueTag)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
 	StaticString extractHostNameWithPortFromParsedUrl(struct http_parser_url &url,
 		const LString *value) const
 	{
@@ -394,22 +1025,114 @@ private:
 			https = req->https;
 		}
 
-		unsigned int keySize = calculateKeyLength(req->host, req->varyCookie, path);
+		unsigned int keySize = calculateKeyLength(req->tenant, req->host,
+			req->varyCookie, path);
 		if (keySize == 0) {
 			return;
 		}
 
 		char *key = (char *) psg_pnalloc(req->pool, keySize);
-		generateKey(https, path, req->host, req->varyCookie, key, keySize);
+		generateKey(https, false, req->tenant, path, req->host, req->varyCookie,
+			key, keySize);
+		invalidateAllVariants(key, keySize);
+	}
 
-		Entry entry(lookup(StaticString(key, keySize)));
-		if (entry.valid()) {
-			entry.header->valid = false;
+	/**
+	 * Invalidates the entries with the given key, including all Vary
+	 * variants, as well as the entries for the other Accept-Encoding
+	 * variant of the same response. `key` is modified in the process.
+	 */
+	void invalidateAllVariants(char *key, unsigned int keySize) {
+		for (unsigned int i = 0; i < 2; i++) {
+			HashedStaticString variantKey(key, keySize);
+			eraseKey(variantKey);
+			if (sharedCache != NULL) {
+				sharedCache->invalidate(variantKey);
+			}
+			// Toggles between upper and lower case.
+			key[0] ^= 0x20;
+		}
+	}
+
+	/**
+	 * Matches cache keys for a given host and path, regardless of the
+	 * protocol, Accept-Encoding, tenant and cookie variant. See purge().
+	 */
+	struct PurgeMatcher {
+		StaticString host;
+		StaticString path;
+
+		PurgeMatcher(const StaticString &_host, const StaticString &_path)
+			: host(_host),
+			  path(_path)
+			{ }
+
+		bool operator()(const StaticString &key) const {
+			// Skip the protocol flag and the tenant.
+			string::size_type pos = key.find('\0');
+			if (pos == string::npos) {
+				return false;
+			}
+			StaticString rest = key.substr(pos + 1);
+			pos = rest.find('\n');
+			if (pos == string::npos) {
+				return false;
+			}
+			if (!host.empty() && rest.substr(0, pos) != host) {
+				return false;
+			}
+
+			StaticString pathAndVaryCookie = rest.substr(pos + 1);
+			if (path.empty()) {
+				return true;
+			} else if (path[path.size() - 1] == '*') {
+				return startsWith(pathAndVaryCookie, path.substr(0, path.size() - 1));
+			} else {
+				return startsWith(pathAndVaryCookie, path)
+					&& (pathAndVaryCookie.size() == path.size()
+						|| pathAndVaryCookie[path.size()] == '\n');
+			}
 		}
+	};
+
+	/**
+	 * Places the headers, the bodies and `maxBodySize` bytes of body data
+	 * per entry in a single huge page backed mapping, so that cache lookups
+	 * and hits need only a few TLB entries. Returns false if the memory
+	 * couldn't be mapped.
+	 */
+	bool allocateInHugePages() {
+		size_t headersSize = (maxEntries * sizeof(Header) + 63) & ~(size_t) 63;
+		size_t bodiesSize = (maxEntries * sizeof(Body) + 63) & ~(size_t) 63;
+		size_t size = MemoryKit::hugepage_round_size(headersSize + bodiesSize
+			+ (size_t) maxEntries * maxBodySize);
+		char *mapping = (char *) MemoryKit::hugepage_map(size, &hugePageBacking);
+		if (mapping == NULL) {
+			return false;
+		}
+
+		char *bodyData = mapping + headersSize + bodiesSize;
+		headers = reinterpret_cast<Header *>(mapping);
+		bodies = reinterpret_cast<Body *>(mapping + headersSize);
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			new (&headers[i]) Header();
+			new (&bodies[i]) Body();
+			bodies[i].setReservedBodyData(bodyData + (size_t) i * maxBodySize,
+				maxBodySize);
+		}
+		hugePageMapping = mapping;
+		hugePageMappingSize = size;
+		return true;
 	}
 
 public:
-	ResponseCache()
+	/**
+	 * If `hugePages` is true then the cache's memory is backed by huge pages
+	 * where possible. Otherwise, or if that fails, it's allocated normally.
+	 */
+	ResponseCache(unsigned int _maxEntries = DEFAULT_MAX_ENTRIES,
+		unsigned int _maxBodySize = DEFAULT_MAX_BODY_SIZE,
+		bool hugePages = false)
 		: CACHE_CONTROL("cache-control"),
 		  PRAGMA_CONST("pragma"),
 		  AUTHORIZATION("authorization"),
@@ -419,6 +1142,11 @@ public:
 		  X_ACCEL_REDIRECT("x-accel-redirect"),
 		  EXPIRES("expires"),
 		  LAST_MODIFIED("last-modified"),
+		  ETAG("etag"),
+		  IF_NONE_MATCH("if-none-match"),
+		  IF_MODIFIED_SINCE("if-modified-since"),
+		  RANGE("range"),
+		  IF_RANGE("if-range"),
 		  LOCATION("location"),
 		  CONTENT_LOCATION("content-location"),
 		  COOKIE("cookie"),
@@ -426,8 +1154,72 @@ public:
 		  fetches(0),
 		  hits(0),
 		  stores(0),
-		  storeSuccesses(0)
-		{ }
+		  storeSuccesses(0),
+		  sharedCache(NULL),
+		  maxEntries(std::max(_maxEntries, 1u)),
+		  maxBodySize(_maxBodySize),
+		  headers(NULL),
+		  bodies(NULL),
+		  frequencies(maxEntries),
+		  hugePageMapping(NULL),
+		  hugePageMappingSize(0),
+		  hugePageBacking(MemoryKit::HUGEPAGE_BACKING_NONE)
+	{
+		if (!hugePages || !allocateInHugePages()) {
+			headers = new Header[maxEntries];
+			bodies = new Body[maxEntries];
+		}
+	}
+
+	~ResponseCache() {
+		if (hugePageMapping != NULL) {
+			for (unsigned int i = 0; i < maxEntries; i++) {
+				bodies[i].~Body();
+			}
+			MemoryKit::hugepage_unmap(hugePageMapping, hugePageMappingSize);
+		} else {
+			delete[] headers;
+			delete[] bodies;
+		}
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getMaxEntries() const {
+		return maxEntries;
+	}
+
+	OXT_FORCE_INLINE
+	unsigned int getMaxBodySize() const {
+		return maxBodySize;
+	}
+
+	/**
+	 * Changes the maximum size of bodies that are stored from now on.
+	 * Entries that are already stored are kept, even if they're larger.
+	 */
+	void setMaxBodySize(unsigned int value) {
+		maxBodySize = value;
+	}
+
+	MemoryKit::hugepage_backing getHugePageBacking() const {
+		return hugePageBacking;
+	}
+
+	/** The size of the huge page mapping, or 0 if there is none. */
+	size_t getHugePageMappingSize() const {
+		return hugePageMappingSize;
+	}
+
+	OXT_FORCE_INLINE
+	SharedResponseCache *getSharedCache() const {
+		return sharedCache;
+	}
+
+	// May only be called right after construction.
+	OXT_FORCE_INLINE
+	void setSharedCache(SharedResponseCache *cache) {
+		sharedCache = cache;
+	}
 
 	OXT_FORCE_INLINE
 	unsigned int getFetches() const {
@@ -473,11 +1265,29 @@ public:
 	}
 
 	void clear() {
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
+		for (unsigned int i = 0; i < maxEntries; i++) {
 			headers[i].valid = false;
 		}
 	}
 
+	/**
+	 * Erases all entries that are no longer fresh, and that may not be
+	 * served stale either. Returns the number of entries that are left.
+	 */
+	unsigned int eraseExpired(ev_tstamp now) {
+		unsigned int result = 0;
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			if (headers[i].valid) {
+				if (mayServeStale(Entry(i, &headers[i], &bodies[i]), now)) {
+					result++;
+				} else {
+					erase(i);
+				}
+			}
+		}
+		return result;
+	}
+
 
 	/**
 	 * Prepares the request for caching operations (fetching and storing).
@@ -502,11 +1312,14 @@ public:
 		if (varyCookieName != NULL) {
 			LString *cookieHeader = req->headers.lookup(COOKIE);
 			if (cookieHeader != NULL) {
+				// Cookie headers tend to be large and split over multiple
+				// parts, and other code (e.g. sticky sessions) parses them too.
+				psg_lstr_flatten(cookieHeader, req->pool);
 				req->varyCookie = ServerKit::findCookie(req->pool, cookieHeader, varyCookieName);
 			}
 		}
 
-		unsigned int size = calculateKeyLength(req->host,
+		unsigned int size = calculateKeyLength(req->tenant, req->host,
 			req->varyCookie,
 			StaticString(req->path.start->data, req->path.size));
 		if (size == 0) {
@@ -523,7 +1336,8 @@ public:
 		}
 
 		char *key = (char *) psg_pnalloc(req->pool, size);
-		generateKey(req->https, StaticString(req->path.start->data, req->path.size),
+		generateKey(req->https, req->acceptsGzip, req->tenant,
+			StaticString(req->path.start->data, req->path.size),
 			req->host, req->varyCookie, key, size);
 		req->cacheKey = HashedStaticString(key, size);
 		return true;
@@ -537,7 +1351,19 @@ public:
 			&& !req->hasPragmaHeader;
 	}
 
-	// @pre requestAllowsFetching()
+	/**
+	 * Looks up a fresh entry for the request.
+	 *
+	 * If the entry is stale but its response allowed stale-while-revalidate,
+	 * then the first request to find it is told that it's a miss so that it
+	 * fetches a new response from the application, and the entry is marked
+	 * as being revalidated. Until that new response is stored, or until the
+	 * stale-while-revalidate window closes, other requests are served the
+	 * stale entry. That way the application is only asked once to
+	 * regenerate an expired response.
+	 *
+	 * @pre requestAllowsFetching()
+	 */
 	Entry fetch(Request *req, ev_tstamp now) {
 		fetches++;
 		if (OXT_UNLIKELY(fetches == 0)) {
@@ -546,34 +1372,193 @@ public:
 			hits = 0;
 		}
 
-		Entry entry(lookup(req->cacheKey));
+		frequencies.increment(req->cacheKey.hash());
+
+		Entry entry(lookup(req->cacheKey, req));
 		if (entry.valid()) {
 			hits++;
 			if (isFresh(entry, now)) {
 				return entry;
-			} else {
+			}
+
+			// Another thread may have stored a fresher copy.
+			Entry result(fetchFromSharedCache(req->cacheKey, now, entry));
+			if (result.valid()) {
+				return result;
+			} else if (!mayServeStale(entry, now)) {
 				erase(entry.index);
-				Entry result;
 				result.cacheMissReason = Entry::NOT_FRESH;
 				return result;
+			} else if (entry.header->revalidating) {
+				return entry;
+			} else {
+				entry.header->revalidating = true;
+				result.cacheMissReason = Entry::REVALIDATING;
+				return result;
 			}
 		} else {
-			entry.cacheMissReason = Entry::NOT_FOUND;
+			entry = fetchFromSharedCache(req->cacheKey, now);
+			if (entry.valid()) {
+				hits++;
+			} else {
+				entry.cacheMissReason = Entry::NOT_FOUND;
+			}
 			return entry;
 		}
 	}
 
 
+	/**
+	 * Checks whether the request's If-None-Match or If-Modified-Since
+	 * header says that the client already has the entry's response, so
+	 * that a 304 Not Modified response may be sent instead.
+	 *
+	 * @pre fetch() returned `entry`
+	 */
+	bool requestIsNotModified(Request *req, const Entry &entry) const {
+		if (entry.body->statusCode != 200) {
+			return false;
+		}
+
+		// If-None-Match takes precedence over If-Modified-Since.
+		// See RFC 7232 section 6.
+		const LString *value = req->headers.lookup(IF_NONE_MATCH);
+		if (value != NULL) {
+			value = psg_lstr_make_contiguous(value, req->pool);
+			return etagListMatches(StaticString(value->start->data, value->size),
+				StaticString(entry.body->etag, entry.body->etagSize));
+		}
+
+		value = req->headers.lookup(IF_MODIFIED_SINCE);
+		if (value != NULL && value->size > 0 && entry.body->lastModified != (time_t) -1) {
+			struct tm tm;
+			int zone;
+
+			value = psg_lstr_make_contiguous(value, req->pool);
+			if (parseImfFixdate(value->start->data, value->start->data + value->size, tm, zone)) {
+				return entry.body->lastModified <= parsedDateToTimestamp(tm, zone);
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Checks whether the request asks for a single byte range of the
+	 * entry's response body. Returns 0 if the full response should be
+	 * sent, 1 if the range in `start` and `end` (inclusive) should be
+	 * sent in a 206 Partial Content response, or -1 if a 416 Range Not
+	 * Satisfiable response should be sent.
+	 *
+	 * An If-Range header is only honored if it is a strong entity tag
+	 * that matches the entry's. Other If-Range values cause the full
+	 * response to be sent, which RFC 7233 always allows.
+	 *
+	 * @pre fetch() returned `entry`
+	 * @pre !requestIsNotModified(req, entry)
+	 */
+	int getRequestedByteRange(Request *req, const Entry &entry,
+		boost::uint64_t &start, boost::uint64_t &end) const
+	{
+		if (req->method != HTTP_GET || entry.body->statusCode != 200) {
+			return 0;
+		}
+
+		const LString *value = req->headers.lookup(RANGE);
+		if (value == NULL) {
+			return 0;
+		}
+
+		const LString *ifRange = req->headers.lookup(IF_RANGE);
+		if (ifRange != NULL) {
+			ifRange = psg_lstr_make_contiguous(ifRange, req->pool);
+			StaticString etag(entry.body->etag, entry.body->etagSize);
+			if (etag.empty() || startsWith(etag, P_STATIC_STRING("W/"))
+			 || etag != StaticString(ifRange->start->data, ifRange->size))
+			{
+				return 0;
+			}
+		}
+
+		value = psg_lstr_make_contiguous(value, req->pool);
+		return parseByteRange(StaticString(value->start->data, value->size),
+			entry.body->httpBodySize, start, end);
+	}
+
+	/**
+	 * Parses a Range request header of the form `bytes=START-END`, `bytes=START-`
+	 * or `bytes=-SUFFIXLENGTH`. Only a single range is supported; multiple ranges
+	 * or malformed values yield 0, which means that the Range header should be
+	 * ignored. Returns 1 if the range is satisfiable, in which case `start` and
+	 * `end` (inclusive) are set, or -1 if the range is not satisfiable.
+	 */
+	static int parseByteRange(const StaticString &value, boost::uint64_t size,
+		boost::uint64_t &start, boost::uint64_t &end)
+	{
+		const char *pos = value.data();
+		const char *valueEnd = value.data() + value.size();
+		boost::uint64_t first = 0, last = 0;
+		bool hasFirst = false, hasLast = false;
+
+		if (!startsWith(value, P_STATIC_STRING("bytes="))) {
+			return 0;
+		}
+		pos += sizeof("bytes=") - 1;
+
+		while (pos < valueEnd && *pos >= '0' && *pos <= '9') {
+			first = first * 10 + (*pos - '0');
+			hasFirst = true;
+			pos++;
+		}
+		if (pos == valueEnd || *pos != '-') {
+			return 0;
+		}
+		pos++;
+		while (pos < valueEnd && *pos >= '0' && *pos <= '9') {
+			last = last * 10 + (*pos - '0');
+			hasLast = true;
+			pos++;
+		}
+		if (pos != valueEnd || (!hasFirst && !hasLast)) {
+			return 0;
+		}
+
+		if (!hasFirst) {
+			// Suffix range: the last `last` bytes.
+			if (last == 0 || size == 0) {
+				return -1;
+			}
+			start = (last >= size) ? 0 : size - last;
+			end = size - 1;
+			return 1;
+		} else if (hasLast && last < first) {
+			return 0;
+		} else if (first >= size) {
+			return -1;
+		} else {
+			start = first;
+			end = (hasLast && last < size) ? last : size - 1;
+			return 1;
+		}
+	}
+
+
 	// @pre prepareRequest() returned true
 	OXT_FORCE_INLINE
 	bool requestAllowsStoring(Request *req) const {
 		return req->method != HTTP_HEAD && requestAllowsFetching(req);
 	}
 
-	// @pre prepareRequest() returned true
-	bool prepareRequestForStoring(Request *req) {
+	/**
+	 * Checks whether the response may be stored, and prepares it for
+	 * store(). If not, and `reason` is given, then the reason is stored
+	 * in there.
+	 *
+	 * @pre prepareRequest() returned true
+	 */
+	bool prepareRequestForStoring(Request *req, StoreFailureReason *reason = NULL) {
 		if (!statusCodeIsCacheableByDefault(req->appResponse.statusCode)) {
-			return false;
+			return rejectStoring(reason, UNCACHEABLE_STATUS_CODE);
 		}
 
 		ServerKit::HeaderTable &respHeaders = req->appResponse.headers;
@@ -590,17 +1575,32 @@ public:
 			 || cacheControl.find(P_STATIC_STRING("private")) != string::npos
 			 || cacheControl.find(P_STATIC_STRING("no-cache")) != string::npos)
 			{
-				return false;
+				return rejectStoring(reason, CACHE_CONTROL_DISALLOWS_STORING);
 			}
 		}
 
 		if (req->headers.lookup(AUTHORIZATION) != NULL
-		 || respHeaders.lookup(VARY) != NULL
-		 || respHeaders.lookup(WWW_AUTHENTICATE) != NULL
-		 || respHeaders.lookup(X_SENDFILE) != NULL
+		 || respHeaders.lookup(WWW_AUTHENTICATE) != NULL)
+		{
+			return rejectStoring(reason, AUTHORIZATION_REQUIRED);
+		}
+		if (respHeaders.lookup(X_SENDFILE) != NULL
 		 || respHeaders.lookup(X_ACCEL_REDIRECT) != NULL)
 		{
-			return false;
+			return rejectStoring(reason, SENDFILE_RESPONSE);
+		}
+
+		// Responses that vary on request headers are stored per variant.
+		// See buildVarySpec().
+		req->appResponse.varyHeader = respHeaders.lookup(VARY);
+		if (req->appResponse.varyHeader != NULL) {
+			req->appResponse.varyHeader = psg_lstr_make_contiguous(
+				req->appResponse.varyHeader, req->pool);
+			if (StaticString(req->appResponse.varyHeader->start->data,
+				req->appResponse.varyHeader->size).find('*') != string::npos)
+			{
+				return rejectStoring(reason, VARIES_ON_EVERYTHING);
+			}
 		}
 
 		req->appResponse.expiresHeader = respHeaders.lookup(EXPIRES);
@@ -621,46 +1621,102 @@ public:
 					req->pool);
 		}
 
-		return req->appResponse.cacheControl != NULL
-			|| req->appResponse.expiresHeader != NULL;
+		if (req->appResponse.cacheControl == NULL
+		 && req->appResponse.expiresHeader == NULL)
+		{
+			return rejectStoring(reason, NO_FRESHNESS_INFORMATION);
+		}
+		return true;
 	}
 
-	// @pre requestAllowsStoring()
-	// @pre prepareRequestForStoring()
+	/**
+	 * On failure, returns an invalid Entry whose `storeFailureReason`
+	 * is set.
+	 *
+	 * @pre requestAllowsStoring()
+	 * @pre prepareRequestForStoring()
+	 */
 	Entry store(Request *req, ev_tstamp now, unsigned int headerSize, unsigned int bodySize) {
 		stores++;
 
-		if (headerSize > MAX_HEADER_SIZE || bodySize > MAX_BODY_SIZE) {
-			return Entry();
+		if (headerSize > MAX_HEADER_SIZE) {
+			return storeFailure(HEADER_TOO_LARGE);
+		} else if (bodySize > maxBodySize) {
+			return storeFailure(BODY_TOO_LARGE);
 		}
 
 		time_t responseDate = parseDate(req->pool, req->appResponse.date, now);
 		if (responseDate == (time_t) -1) {
-			return Entry();
+			return storeFailure(INVALID_DATE);
 		}
 
 		time_t expiryDate = determineExpiryDate(req, responseDate, now);
 		if (expiryDate == (time_t) -1) {
-			return Entry();
+			return storeFailure(NO_FRESHNESS_INFORMATION);
+		}
+
+		char varySpec[MAX_VARY_SIZE];
+		unsigned short varySize;
+		if (!buildVarySpec(req, varySpec, varySize)) {
+			return storeFailure(VARY_SPEC_TOO_LARGE);
 		}
 
 		const HashedStaticString &cacheKey = req->cacheKey;
-		Entry entry(lookup(cacheKey));
+		Entry entry(lookupForStoring(cacheKey, StaticString(varySpec, varySize)));
 		if (!entry.valid()) {
 			entry = lookupInvalidOrOldest();
+			if (entry.header->valid
+			 && frequencies.estimate(cacheKey.hash())
+				<= frequencies.estimate(entry.header->hash))
+			{
+				return storeFailure(NOT_ADMITTED);
+			}
 			entry.header->valid   = true;
+			entry.header->revalidating = false;
 			entry.header->hash    = cacheKey.hash();
 			entry.header->keySize = cacheKey.size();
 			memcpy(entry.body->key, cacheKey.data(), cacheKey.size());
 		}
+		if (!entry.body->reserveBodyData(bodySize)) {
+			erase(entry.index);
+			return storeFailure(OUT_OF_MEMORY);
+		}
 		entry.header->date     = responseDate;
+		entry.header->revalidating = false;
 		entry.body->expiryDate = expiryDate;
+		entry.body->staleUntil = determineStaleUntil(req, expiryDate);
+		entry.body->statusCode = req->appResponse.statusCode;
+		entry.body->varySize   = varySize;
+		memcpy(entry.body->vary, varySpec, varySize);
+		storeValidators(req, entry.body);
 		entry.body->httpHeaderSize = headerSize;
 		entry.body->httpBodySize   = bodySize;
 		storeSuccesses++;
 		return entry;
 	}
 
+	/**
+	 * Copies an entry into the shared cache, if any. Must be called
+	 * after the caller has filled in the data of an entry returned by
+	 * store().
+	 *
+	 * The shared cache holds one response per key, so Vary variants are
+	 * only cached locally. Their key is invalidated in the shared cache
+	 * instead, so that other threads don't serve an older response
+	 * that did not vary.
+	 */
+	void storeInSharedCache(const Entry &entry) {
+		if (sharedCache != NULL) {
+			HashedStaticString key(entry.body->key, entry.header->keySize,
+				entry.header->hash);
+			if (entry.body->varySize == 0) {
+				sharedCache->store(key, entry.header->date, *entry.body);
+			} else {
+				sharedCache->invalidate(key);
+			}
+		}
+	}
+
 
 	// @pre prepareRequest() returned true
 	// @pre !requestAllowsStoring() || !prepareRequestForStoring()
@@ -670,25 +1726,164 @@ public:
 
 	// @pre requestAllowsInvalidating()
 	void invalidate(Request *req) {
-		Entry entry(lookup(req->cacheKey));
-		if (entry.valid()) {
-			entry.header->valid = false;
-		}
+		char *key = (char *) psg_pnalloc(req->pool, req->cacheKey.size());
+		memcpy(key, req->cacheKey.data(), req->cacheKey.size());
+		invalidateAllVariants(key, req->cacheKey.size());
 
 		invalidateLocation(req, LOCATION);
 		invalidateLocation(req, CONTENT_LOCATION);
 	}
 
 
+	/**
+	 * Erases all entries for the given host and path (including the
+	 * query string), in this cache as well as in the shared cache.
+	 * An empty `host` matches all hosts, and an empty `path` matches all
+	 * paths. If `path` ends with '*' then it matches all paths that
+	 * start with it. Returns the number of entries erased from this cache.
+	 */
+	unsigned int purge(const StaticString &host, const StaticString &path) {
+		PurgeMatcher matcher(host, path);
+		unsigned int result = 0;
+
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			if (headers[i].valid
+			 && matcher(StaticString(bodies[i].key, headers[i].keySize)))
+			{
+				erase(i);
+				result++;
+			}
+		}
+		if (sharedCache != NULL) {
+			sharedCache->invalidateMatching(matcher);
+		}
+		return result;
+	}
+
+
+	/**
+	 * Serializes all entries that may still be served into a string that
+	 * can be handed to loadSnapshot(), possibly by another process on the
+	 * same machine. Expiry dates are absolute, so entries keep aging
+	 * while they are in the snapshot.
+	 */
+	string saveSnapshot(ev_tstamp now) const {
+		string result(getSnapshotMagic());
+
+		for (unsigned int i = 0; i < maxEntries; i++) {
+			const Header &header = headers[i];
+			const Body &body = bodies[i];
+			if (!header.valid || !mayServeStale(Entry(i, &headers[i], &bodies[i]), now)) {
+				continue;
+			}
+
+			appendSnapshotData(result, body.key, header.keySize);
+			appendSnapshotInteger<boost::int64_t>(result, header.date);
+			appendSnapshotInteger<boost::int64_t>(result, body.expiryDate);
+			appendSnapshotInteger<boost::int64_t>(result, body.staleUntil);
+			appendSnapshotInteger<boost::int64_t>(result, body.lastModified);
+			appendSnapshotInteger<boost::uint16_t>(result, body.statusCode);
+			appendSnapshotData(result, body.etag, body.etagSize);
+			appendSnapshotData(result, body.vary, body.varySize);
+			appendSnapshotData(result, body.httpHeaderData, body.httpHeaderSize);
+			appendSnapshotData(result, body.httpBodyData, body.httpBodySize);
+		}
+
+		return result;
+	}
+
+	/**
+	 * Loads the entries from a snapshot that was created by saveSnapshot(),
+	 * except those that may no longer be served. They are also copied into
+	 * the shared cache, if any. Loading stops at the first malformed entry.
+	 * Returns the number of entries loaded.
+	 */
+	unsigned int loadSnapshot(const StaticString &data, ev_tstamp now) {
+		const char *pos = data.data();
+		const char *end = data.data() + data.size();
+		unsigned int result = 0;
+
+		if (!startsWith(data, getSnapshotMagic())) {
+			return 0;
+		}
+		pos += getSnapshotMagic().size();
+
+		while (pos < end) {
+			Entry entry(lookupInvalidOrOldest());
+			Header *header = entry.header;
+			Body *body = entry.body;
+			boost::int64_t date, expiryDate, staleUntil, lastModified;
+			boost::uint16_t statusCode;
+			boost::uint32_t bodySize;
+			unsigned int size;
+
+			header->valid = false;
+			if (!readSnapshotData(pos, end, body->key, MAX_KEY_LENGTH, size)) {
+				break;
+			}
+			header->keySize = size;
+			if (!readSnapshotInteger(pos, end, date)
+			 || !readSnapshotInteger(pos, end, expiryDate)
+			 || !readSnapshotInteger(pos, end, staleUntil)
+			 || !readSnapshotInteger(pos, end, lastModified)
+			 || !readSnapshotInteger(pos, end, statusCode))
+			{
+				break;
+			}
+			if (!readSnapshotData(pos, end, body->etag, MAX_ETAG_SIZE, size)) {
+				break;
+			}
+			body->etagSize = size;
+			if (!readSnapshotData(pos, end, body->vary, MAX_VARY_SIZE, size)) {
+				break;
+			}
+			body->varySize = size;
+			if (!readSnapshotData(pos, end, body->httpHeaderData, MAX_HEADER_SIZE, size)) {
+				break;
+			}
+			body->httpHeaderSize = size;
+			if (!readSnapshotInteger(pos, end, bodySize)
+			 || bodySize > maxBodySize
+			 || size_t(end - pos) < bodySize
+			 || !body->reserveBodyData(bodySize))
+			{
+				break;
+			}
+			memcpy(body->httpBodyData, pos, bodySize);
+			pos += bodySize;
+			body->httpBodySize = bodySize;
+
+			header->date = (time_t) date;
+			header->hash = HashedStaticString(body->key, header->keySize).hash();
+			header->revalidating = false;
+			body->expiryDate = (time_t) expiryDate;
+			body->staleUntil = (time_t) staleUntil;
+			body->lastModified = (time_t) lastModified;
+			body->statusCode = statusCode;
+
+			if (mayServeStale(entry, now)) {
+				header->valid = true;
+				storeInSharedCache(entry);
+				result++;
+			}
+		}
+
+		return result;
+	}
+
+
 	string inspect() const {
 		stringstream stream;
-		for (unsigned int i = 0; i < MAX_ENTRIES; i++) {
+		for (unsigned int i = 0; i < maxEntries; i++) {
 			time_t expiryDate = bodies[i].expiryDate;
 			stream << " #" << i << ": valid=" << headers[i].valid
+				<< ", revalidating=" << headers[i].revalidating
 				<< ", hash=" << headers[i].hash
 				<< ", expiryDate=" << expiryDate
 				<< ", keySize=" << headers[i].keySize << ", key=\""
-				<< cEscapeString(StaticString(bodies[i].key, headers[i].keySize)) << "\"\n";
+				<< cEscapeString(StaticString(bodies[i].key, headers[i].keySize))
+				<< "\", vary=\""
+				<< cEscapeString(StaticString(bodies[i].vary, bodies[i].varySize)) << "\"\n";
 		}
 		return stream.str();
 	}
@@ -0,0 +1,382 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SHARED_RESPONSE_CACHE_H_
+#define _PASSENGER_SHARED_RESPONSE_CACHE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <time.h>
+#include <cstdlib>
+#include <cstring>
+#include <jsoncpp/json.h>
+#include <DataStructures/HashedStaticString.h>
+#include <StaticString.h>
+#include <Utils/JsonUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A second-level turbocache that is shared by all Controllers (and thus
+ * all Core threads). Each Controller's ResponseCache is consulted first;
+ * only when it misses do we look in here. Responses stored in any
+ * ResponseCache are also stored in here, so that a popular response only
+ * has to be generated by the application once instead of once per thread.
+ *
+ * The cache is split into stripes, each protected by its own lock, so
+ * that threads looking up different keys rarely contend. Each stripe
+ * has a fixed number of slots. Entries are evicted with the CLOCK
+ * algorithm when a stripe runs out of slots, or when it exceeds its
+ * share of the memory budget.
+ *
+ * Entries are copied into and out of this cache. The caller never holds
+ * a reference to an entry after a method returns.
+ */
+class SharedResponseCache {
+public:
+	static const unsigned int STRIPES = 32;
+	static const unsigned int SLOTS_PER_STRIPE = 32;
+
+private:
+	struct Slot {
+		bool valid: 1;
+		// Set on every hit. The CLOCK hand clears it and evicts
+		// slots whose bit was already cleared.
+		bool referenced: 1;
+		unsigned short keySize;
+		unsigned short etagSize;
+		unsigned short httpHeaderSize;
+		unsigned short statusCode;
+		unsigned int httpBodySize;
+		boost::uint32_t hash;
+		time_t date;
+		time_t expiryDate;
+		time_t staleUntil;
+		time_t lastModified;
+		// Contains the key, the ETag, the HTTP header and the HTTP body,
+		// in that order.
+		char *data;
+
+		Slot()
+			: valid(false),
+			  referenced(false),
+			  keySize(0),
+			  etagSize(0),
+			  httpHeaderSize(0),
+			  statusCode(0),
+			  httpBodySize(0),
+			  hash(0),
+			  date(0),
+			  expiryDate(0),
+			  staleUntil(0),
+			  lastModified(0),
+			  data(NULL)
+			{ }
+
+		size_t dataSize() const {
+			return keySize + etagSize + httpHeaderSize + httpBodySize;
+		}
+	};
+
+	struct Stripe {
+		mutable boost::mutex syncher;
+		Slot slots[SLOTS_PER_STRIPE];
+		unsigned int clockHand;
+		size_t memoryUsage;
+		unsigned int fetches, hits, stores, evictions;
+
+		Stripe()
+			: clockHand(0),
+			  memoryUsage(0),
+			  fetches(0),
+			  hits(0),
+			  stores(0),
+			  evictions(0)
+			{ }
+	};
+
+	Stripe stripes[STRIPES];
+	size_t maxStripeMemory;
+
+	OXT_FORCE_INLINE
+	Stripe &getStripe(const HashedStaticString &key) {
+		return stripes[key.hash() % STRIPES];
+	}
+
+	static Slot *lookup(Stripe &stripe, const HashedStaticString &key) {
+		for (unsigned int i = 0; i < SLOTS_PER_STRIPE; i++) {
+			Slot *slot = &stripe.slots[i];
+			if (slot->valid
+			 && slot->hash == key.hash()
+			 && key == StaticString(slot->data, slot->keySize))
+			{
+				return slot;
+			}
+		}
+		return NULL;
+	}
+
+	static void erase(Stripe &stripe, Slot *slot) {
+		stripe.memoryUsage -= slot->dataSize();
+		free(slot->data);
+		slot->data = NULL;
+		slot->valid = false;
+	}
+
+	/**
+	 * Runs the CLOCK hand until it finds a slot that may be reused,
+	 * evicting it if necessary. `exclude` is never chosen.
+	 */
+	static Slot *evictOne(Stripe &stripe, const Slot *exclude) {
+		while (true) {
+			Slot *slot = &stripe.slots[stripe.clockHand];
+			stripe.clockHand = (stripe.clockHand + 1) % SLOTS_PER_STRIPE;
+			if (slot == exclude) {
+				continue;
+			} else if (!slot->valid) {
+				return slot;
+			} else if (slot->referenced) {
+				slot->referenced = false;
+			} else {
+				erase(stripe, slot);
+				stripe.evictions++;
+				return slot;
+			}
+		}
+	}
+
+	static Slot *findFreeSlot(Stripe &stripe) {
+		for (unsigned int i = 0; i < SLOTS_PER_STRIPE; i++) {
+			if (!stripe.slots[i].valid) {
+				return &stripe.slots[i];
+			}
+		}
+		return NULL;
+	}
+
+public:
+	/**
+	 * @param maxMemory The maximum number of bytes of response data
+	 *                  to keep in this cache.
+	 */
+	SharedResponseCache(size_t maxMemory)
+		: maxStripeMemory(maxMemory / STRIPES)
+		{ }
+
+	~SharedResponseCache() {
+		clear();
+	}
+
+	/**
+	 * Looks up a fresh entry with the given key. If found, copies it into
+	 * `body` (a `ResponseCache::Body`) and `date`, and returns true.
+	 * `body.key` is not touched. Stale entries are erased. Entries with
+	 * a body larger than `maxBodySize` are treated as misses.
+	 */
+	template<typename Body>
+	bool fetch(const HashedStaticString &key, time_t now, unsigned int maxBodySize,
+		time_t &date, Body &body)
+	{
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Slot *slot;
+
+		stripe.fetches++;
+		slot = lookup(stripe, key);
+		if (slot == NULL) {
+			return false;
+		} else if (slot->expiryDate <= now) {
+			erase(stripe, slot);
+			return false;
+		} else if (slot->httpBodySize > maxBodySize
+			|| !body.reserveBodyData(slot->httpBodySize))
+		{
+			return false;
+		}
+
+		const char *pos = slot->data + slot->keySize;
+		stripe.hits++;
+		slot->referenced = true;
+		date = slot->date;
+		body.expiryDate = slot->expiryDate;
+		body.staleUntil = slot->staleUntil;
+		body.lastModified = slot->lastModified;
+		body.statusCode = slot->statusCode;
+		body.etagSize = slot->etagSize;
+		body.httpHeaderSize = slot->httpHeaderSize;
+		body.httpBodySize = slot->httpBodySize;
+		memcpy(body.etag, pos, slot->etagSize);
+		pos += slot->etagSize;
+		memcpy(body.httpHeaderData, pos, slot->httpHeaderSize);
+		pos += slot->httpHeaderSize;
+		memcpy(body.httpBodyData, pos, slot->httpBodySize);
+		return true;
+	}
+
+	/**
+	 * Stores a copy of the given `ResponseCache::Body` under the given
+	 * key, replacing any existing entry with that key. Does nothing if
+	 * the entry doesn't fit in a stripe's share of the memory budget.
+	 */
+	template<typename Body>
+	void store(const HashedStaticString &key, time_t date, const Body &body) {
+		size_t size = key.size() + body.etagSize + body.httpHeaderSize
+			+ body.httpBodySize;
+		if (size > maxStripeMemory) {
+			return;
+		}
+
+		char *data = (char *) malloc(size);
+		if (data == NULL) {
+			return;
+		}
+		char *pos = data;
+		memcpy(pos, key.data(), key.size());
+		pos += key.size();
+		memcpy(pos, body.etag, body.etagSize);
+		pos += body.etagSize;
+		memcpy(pos, body.httpHeaderData, body.httpHeaderSize);
+		pos += body.httpHeaderSize;
+		memcpy(pos, body.httpBodyData, body.httpBodySize);
+
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Slot *slot;
+
+		stripe.stores++;
+		slot = lookup(stripe, key);
+		if (slot != NULL) {
+			erase(stripe, slot);
+		} else {
+			slot = findFreeSlot(stripe);
+			if (slot == NULL) {
+				slot = evictOne(stripe, NULL);
+			}
+		}
+		while (stripe.memoryUsage + size > maxStripeMemory) {
+			// Eviction never picks `slot`, and `slot` doesn't count towards
+			// memoryUsage yet, so this loop terminates.
+			evictOne(stripe, slot);
+		}
+
+		slot->valid = true;
+		slot->referenced = false;
+		slot->keySize = key.size();
+		slot->etagSize = body.etagSize;
+		slot->httpHeaderSize = body.httpHeaderSize;
+		slot->statusCode = body.statusCode;
+		slot->httpBodySize = body.httpBodySize;
+		slot->hash = key.hash();
+		slot->date = date;
+		slot->expiryDate = body.expiryDate;
+		slot->staleUntil = body.staleUntil;
+		slot->lastModified = body.lastModified;
+		slot->data = data;
+		stripe.memoryUsage += size;
+	}
+
+	void invalidate(const HashedStaticString &key) {
+		Stripe &stripe = getStripe(key);
+		boost::lock_guard<boost::mutex> l(stripe.syncher);
+		Slot *slot = lookup(stripe, key);
+		if (slot != NULL) {
+			erase(stripe, slot);
+		}
+	}
+
+	/**
+	 * Erases all entries whose key satisfies `predicate`, which is called
+	 * with the key as a StaticString. Returns the number of entries erased.
+	 */
+	template<typename Predicate>
+	unsigned int invalidateMatching(const Predicate &predicate) {
+		unsigned int result = 0;
+		for (unsigned int i = 0; i < STRIPES; i++) {
+			Stripe &stripe = stripes[i];
+			boost::lock_guard<boost::mutex> l(stripe.syncher);
+			for (unsigned int j = 0; j < SLOTS_PER_STRIPE; j++) {
+				Slot *slot = &stripe.slots[j];
+				if (slot->valid && predicate(StaticString(slot->data, slot->keySize))) {
+					erase(stripe, slot);
+					result++;
+				}
+			}
+		}
+		return result;
+	}
+
+	void clear() {
+		for (unsigned int i = 0; i < STRIPES; i++) {
+			Stripe &stripe = stripes[i];
+			boost::lock_guard<boost::mutex> l(stripe.syncher);
+			for (unsigned int j = 0; j < SLOTS_PER_STRIPE; j++) {
+				if (stripe.slots[j].valid) {
+					erase(stripe, &stripe.slots[j]);
+				}
+			}
+		}
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		unsigned int entries = 0, fetches = 0, hits = 0, stores = 0, evictions = 0;
+		size_t memoryUsage = 0;
+
+		for (unsigned int i = 0; i < STRIPES; i++) {
+			const Stripe &stripe = stripes[i];
+			boost::lock_guard<boost::mutex> l(stripe.syncher);
+			for (unsigned int j = 0; j < SLOTS_PER_STRIPE; j++) {
+				entries += stripe.slots[j].valid;
+			}
+			memoryUsage += stripe.memoryUsage;
+			fetches += stripe.fetches;
+			hits += stripe.hits;
+			stores += stripe.stores;
+			evictions += stripe.evictions;
+		}
+
+		doc["entries"] = entries;
+		doc["memory_usage"] = byteSizeToJson(memoryUsage);
+		doc["memory_limit"] = byteSizeToJson(maxStripeMemory * STRIPES);
+		doc["fetches"] = fetches;
+		doc["hits"] = hits;
+		doc["hit_ratio"] = hits / (double) fetches;
+		doc["stores"] = stores;
+		doc["evictions"] = evictions;
+		return doc;
+	}
+};
+
+typedef boost::shared_ptr<SharedResponseCache> SharedResponseCachePtr;
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_SHARED_RESPONSE_CACHE_H_ */
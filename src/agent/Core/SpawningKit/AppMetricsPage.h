@@ -0,0 +1,251 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_APP_METRICS_PAGE_H_
+#define _PASSENGER_SPAWNING_KIT_APP_METRICS_PAGE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <oxt/system_calls.hpp>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * Metrics that an application process publishes about itself through its
+ * AppMetricsPage. Counters that the process doesn't know are 0.
+ */
+struct AppMetrics {
+	/** When the process last updated its metrics, in usec since the epoch. */
+	boost::uint64_t updatedAt;
+	boost::uint64_t gcCount;
+	/** Total time spent on garbage collection, in usec. */
+	boost::uint64_t gcTime;
+	/** In bytes. */
+	boost::uint64_t heapSize;
+	boost::uint32_t threadsBusy;
+	boost::uint32_t threadsTotal;
+	bool gcInProgress;
+
+	AppMetrics()
+		: updatedAt(0),
+		  gcCount(0),
+		  gcTime(0),
+		  heapSize(0),
+		  threadsBusy(0),
+		  threadsTotal(0),
+		  gcInProgress(false)
+		{ }
+};
+
+/**
+ * A page of shared memory through which an application process publishes
+ * metrics that can't be observed from the outside, such as garbage
+ * collection activity. The Core can read them at any time without
+ * communicating with the process.
+ *
+ * The spawner creates the page as a file, and passes its path to the
+ * process in the "metrics_file" spawn request option. A process that
+ * supports this opens the file, writes the magic and version, and keeps
+ * the metrics up to date. After the process has reported that it is
+ * ready, the spawner removes the file, so that it disappears once both
+ * sides have closed it. A process that doesn't support this ignores the
+ * option; `isInitialized()` then returns false and the page is dropped.
+ *
+ * The layout, in native byte order:
+ *
+ *     offset  type       field
+ *     0       char[4]    magic: "PSGM"
+ *     4       uint32     version: 1
+ *     8       uint64     sequence
+ *     16      uint64     updated_at (usec since the epoch)
+ *     24      uint64     gc_count
+ *     32      uint64     gc_time (usec)
+ *     40      uint64     heap_size (bytes)
+ *     48      uint32     threads_busy
+ *     52      uint32     threads_total
+ *     56      uint32     flags (bit 0: garbage collection in progress)
+ *     60      uint32     reserved
+ *
+ * `sequence` works like a seqlock: the process makes it odd before it
+ * changes the fields after it, and even again afterwards. Processes that
+ * cannot map the file may update it with two positional writes instead:
+ * one of the odd sequence number together with the fields, followed by
+ * one of the even sequence number. The flags may also be changed without
+ * touching the sequence number.
+ */
+class AppMetricsPage: public boost::noncopyable {
+public:
+	static const unsigned int SIZE = 4096;
+	static const boost::uint32_t FLAG_GC_IN_PROGRESS = 1;
+
+private:
+	struct Layout {
+		char magic[4];
+		boost::uint32_t version;
+		boost::uint64_t sequence;
+		boost::uint64_t updatedAt;
+		boost::uint64_t gcCount;
+		boost::uint64_t gcTime;
+		boost::uint64_t heapSize;
+		boost::uint32_t threadsBusy;
+		boost::uint32_t threadsTotal;
+		boost::uint32_t flags;
+		boost::uint32_t reserved;
+	};
+
+	const volatile Layout *layout;
+	string path;
+
+	AppMetricsPage()
+		: layout(NULL)
+		{ }
+
+public:
+	/**
+	 * Creates a page in the given directory, owned by the given user.
+	 *
+	 * @throws SystemException
+	 */
+	static boost::shared_ptr<AppMetricsPage> create(const string &dir, uid_t uid, gid_t gid) {
+		boost::shared_ptr<AppMetricsPage> page(new AppMetricsPage());
+		char filename[PATH_MAX];
+
+		snprintf(filename, PATH_MAX, "%s/passenger.metrics.XXXXXX", dir.c_str());
+		FileDescriptor fd(mkstemp(filename), __FILE__, __LINE__);
+		if (fd == -1) {
+			int e = errno;
+			throw SystemException("Cannot create an application metrics file in " + dir, e);
+		}
+		page->path = filename;
+
+		if (ftruncate(fd, SIZE) == -1) {
+			int e = errno;
+			throw SystemException("Cannot resize " + page->path, e);
+		}
+		if (geteuid() == 0 && fchown(fd, uid, gid) == -1) {
+			int e = errno;
+			throw SystemException("Cannot change the owner of " + page->path, e);
+		}
+
+		void *addr = mmap(NULL, SIZE, PROT_READ, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			int e = errno;
+			throw SystemException("Cannot map " + page->path, e);
+		}
+		page->layout = (const volatile Layout *) addr;
+		return page;
+	}
+
+	~AppMetricsPage() {
+		removeFile();
+		if (layout != NULL) {
+			munmap((void *) layout, SIZE);
+		}
+	}
+
+	const string &getPath() const {
+		return path;
+	}
+
+	/**
+	 * Removes the file. The page stays mapped.
+	 */
+	void removeFile() {
+		if (!path.empty()) {
+			boost::this_thread::disable_syscall_interruption dsi;
+			syscalls::unlink(path.c_str());
+			path.clear();
+		}
+	}
+
+	/**
+	 * Whether the process has opened the page and publishes metrics.
+	 */
+	bool isInitialized() const {
+		return layout->magic[0] == 'P' && layout->magic[1] == 'S'
+			&& layout->magic[2] == 'G' && layout->magic[3] == 'M'
+			&& layout->version >= 1;
+	}
+
+	/**
+	 * Reads the metrics without blocking. Returns false if they were being
+	 * updated during every attempt.
+	 */
+	bool read(AppMetrics &metrics) const {
+		for (unsigned int i = 0; i < 3; i++) {
+			boost::uint64_t sequence = layout->sequence;
+			if (sequence % 2 != 0) {
+				continue;
+			}
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			metrics.updatedAt = layout->updatedAt;
+			metrics.gcCount = layout->gcCount;
+			metrics.gcTime = layout->gcTime;
+			metrics.heapSize = layout->heapSize;
+			metrics.threadsBusy = layout->threadsBusy;
+			metrics.threadsTotal = layout->threadsTotal;
+			metrics.gcInProgress = (layout->flags & FLAG_GC_IN_PROGRESS) != 0;
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			if (layout->sequence == sequence) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Whether the process is collecting garbage. Cheap enough to be used
+	 * for every routing decision.
+	 */
+	bool gcInProgress() const {
+		return (layout->flags & FLAG_GC_IN_PROGRESS) != 0;
+	}
+};
+
+typedef boost::shared_ptr<AppMetricsPage> AppMetricsPagePtr;
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_APP_METRICS_PAGE_H_ */
@@ -36,6 +36,9 @@
 #include <Exceptions.h>
 #include <Utils/VariantMap.h>
 #include <Core/UnionStation/Context.h>
+#include <Core/SpawningKit/UserDatabaseCache.h>
+#include <Core/SpawningKit/PipeWatcher.h>
+#include <Core/SpawningKit/CpuPlacement.h>
 
 namespace Passenger {
 namespace ApplicationPool2 {
@@ -54,7 +57,6 @@ typedef ApplicationPool2::Options Options;
 typedef boost::shared_ptr<Config> ConfigPtr;
 
 typedef void (*ErrorHandler)(const ConfigPtr &config, SpawnException &e, const Options &options);
-typedef boost::function<void (const char *data, unsigned int size)> OutputHandler;
 
 struct Config {
 	// Used by error pages and hooks.
@@ -69,13 +71,27 @@ struct Config {
 	RandomGeneratorPtr randomGenerator;
 	string instanceDir;
 
+	// Used by UserSwitchingRules. Shared by all spawns.
+	UserDatabaseCachePtr userDatabaseCache;
+
 	// Used by DummySpawner and SpawnerFactory.
 	unsigned int concurrency;
 	unsigned int spawnerCreationSleepTime;
 	unsigned int spawnTime;
 
-	// Used by PipeWatcher.
+	// Used for forwarding the output of app processes and preloaders.
+	// pipeWatcher is shared by all spawners. It must be declared after
+	// outputHandler so that it's destroyed first.
 	OutputHandler outputHandler;
+	PipeWatcherPtr pipeWatcher;
+
+	// Used for CPU placement. The CPUs that the Core's threads are pinned
+	// to, sorted. Empty unless the Core runs with `--cpu-affine`.
+	CpuList coreCpus;
+
+	// Used for shared memory rings. The number of ring slots that app
+	// processes are offered, or 0 to not offer them. See ShmRingFile.
+	unsigned int shmRingSlots;
 
 	// Other.
 	void *data;
@@ -87,6 +103,7 @@ struct Config {
 		  concurrency(1),
 		  spawnerCreationSleepTime(0),
 		  spawnTime(0),
+		  shmRingSlots(0),
 		  data(NULL)
 		{ }
 
@@ -98,6 +115,12 @@ struct Config {
 		if (randomGenerator == NULL) {
 			randomGenerator = boost::make_shared<RandomGenerator>();
 		}
+		if (userDatabaseCache == NULL) {
+			userDatabaseCache = boost::make_shared<UserDatabaseCache>();
+		}
+		if (pipeWatcher == NULL) {
+			pipeWatcher = boost::make_shared<PipeWatcher>();
+		}
 	}
 };
 
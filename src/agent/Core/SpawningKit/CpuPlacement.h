@@ -0,0 +1,405 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_CPU_PLACEMENT_H_
+#define _PASSENGER_SPAWNING_KIT_CPU_PLACEMENT_H_
+
+#ifdef __linux__
+	#include <sched.h>
+#endif
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <StaticString.h>
+#include <Exceptions.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * Decides on which CPUs the processes of a group run. Set through
+ * Options::cpuAffinity; see parseCpuAffinityPolicy() for the names.
+ *
+ * All policies keep app processes away from the CPUs that the Core's
+ * threads are pinned to (Config::coreCpus), unless that would leave no
+ * CPUs at all.
+ */
+enum CpuAffinityPolicy {
+	/** App processes inherit the Core's CPU affinity. */
+	CPU_AFFINITY_NONE,
+	/** Each process is pinned to a single CPU. Successive processes get
+	 * successive CPUs. */
+	CPU_AFFINITY_ROUND_ROBIN,
+	/** Each process is pinned to the CPUs of a single NUMA node, so that
+	 * the kernel allocates its memory on that node too. Successive
+	 * processes get successive nodes. */
+	CPU_AFFINITY_NUMA_NODE,
+	/** Processes may run on any CPU that the Core's threads aren't
+	 * pinned to. */
+	CPU_AFFINITY_EXCLUDE_CORE
+};
+
+/** A sorted list of CPU numbers. */
+typedef vector<unsigned int> CpuList;
+
+/**
+ * The CPUs that the Core may use, grouped by NUMA node.
+ */
+struct CpuTopology {
+	struct NumaNode {
+		/** -1 if the system doesn't report NUMA nodes. */
+		int id;
+		CpuList cpus;
+	};
+
+	/** The CPUs in the Core's affinity mask. This takes the Core's cpuset
+	 * into account. Empty if the platform doesn't support CPU affinity. */
+	CpuList usableCpus;
+	/** The NUMA nodes that contain at least one of `usableCpus`. */
+	vector<NumaNode> numaNodes;
+
+	/** Reads the topology from the kernel. Cheap enough to do for every spawn. */
+	static CpuTopology detect();
+};
+
+/**
+ * Where a process has been placed. `cpus` is empty if the process isn't
+ * restricted to a subset of the CPUs.
+ */
+struct CpuPlacement {
+	CpuList cpus;
+	/** The NUMA node that `cpus` belong to, if the policy chose one. -1 otherwise. */
+	int numaNode;
+
+	CpuPlacement()
+		: numaNode(-1)
+		{ }
+};
+
+
+inline CpuAffinityPolicy
+parseCpuAffinityPolicy(const StaticString &name) {
+	if (name == P_STATIC_STRING("round-robin")) {
+		return CPU_AFFINITY_ROUND_ROBIN;
+	} else if (name == P_STATIC_STRING("numa-node")) {
+		return CPU_AFFINITY_NUMA_NODE;
+	} else if (name == P_STATIC_STRING("exclude-core")) {
+		return CPU_AFFINITY_EXCLUDE_CORE;
+	} else {
+		return CPU_AFFINITY_NONE;
+	}
+}
+
+inline const char *
+getCpuAffinityPolicyName(CpuAffinityPolicy policy) {
+	switch (policy) {
+	case CPU_AFFINITY_ROUND_ROBIN:
+		return "round-robin";
+	case CPU_AFFINITY_NUMA_NODE:
+		return "numa-node";
+	case CPU_AFFINITY_EXCLUDE_CORE:
+		return "exclude-core";
+	default:
+		return "none";
+	}
+}
+
+/**
+ * Parses a CPU list in the kernel's format, e.g. "0-3,8,10-11". Returns
+ * whether it was well-formed.
+ */
+inline bool
+parseCpuList(const StaticString &str, CpuList &result) {
+	const char *pos = str.data();
+	const char *end = str.data() + str.size();
+
+	result.clear();
+	while (pos < end && *pos != '\n') {
+		char *numberEnd;
+		unsigned long first, last;
+
+		first = last = strtoul(pos, &numberEnd, 10);
+		if (numberEnd == pos) {
+			return false;
+		}
+		pos = numberEnd;
+		if (pos < end && *pos == '-') {
+			pos++;
+			last = strtoul(pos, &numberEnd, 10);
+			if (numberEnd == pos || last < first) {
+				return false;
+			}
+			pos = numberEnd;
+		}
+		for (unsigned long cpu = first; cpu <= last; cpu++) {
+			result.push_back((unsigned int) cpu);
+		}
+		if (pos < end && *pos == ',') {
+			pos++;
+		}
+	}
+
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return true;
+}
+
+/** The inverse of parseCpuList(). */
+inline string
+formatCpuList(const CpuList &cpus) {
+	string result;
+	CpuList::size_type i = 0;
+
+	while (i < cpus.size()) {
+		CpuList::size_type j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+			j++;
+		}
+		if (!result.empty()) {
+			result.append(1, ',');
+		}
+		result.append(toString(cpus[i]));
+		if (j > i) {
+			result.append(1, '-');
+			result.append(toString(cpus[j]));
+		}
+		i = j + 1;
+	}
+	return result;
+}
+
+/**
+ * Returns the CPUs that app processes may be placed on: `usableCpus`
+ * without the Core's pinned CPUs, or all of `usableCpus` if that would
+ * leave none. `coreCpus` must be sorted.
+ */
+inline CpuList
+getAllowedCpus(const CpuTopology &topology, const CpuList &coreCpus) {
+	CpuList result;
+	std::set_difference(topology.usableCpus.begin(), topology.usableCpus.end(),
+		coreCpus.begin(), coreCpus.end(), std::back_inserter(result));
+	if (result.empty()) {
+		result = topology.usableCpus;
+	}
+	return result;
+}
+
+/**
+ * Computes the placement of the process with the given sequence number
+ * within its group. `coreCpus` must be sorted.
+ */
+inline CpuPlacement
+computeCpuPlacement(CpuAffinityPolicy policy, unsigned int sequenceNumber,
+	const CpuTopology &topology, const CpuList &coreCpus)
+{
+	CpuPlacement placement;
+	CpuList allowed;
+
+	if (policy == CPU_AFFINITY_NONE) {
+		return placement;
+	}
+	allowed = getAllowedCpus(topology, coreCpus);
+	if (allowed.empty()) {
+		return placement;
+	}
+
+	switch (policy) {
+	case CPU_AFFINITY_ROUND_ROBIN:
+		placement.cpus.push_back(allowed[sequenceNumber % allowed.size()]);
+		break;
+	case CPU_AFFINITY_NUMA_NODE: {
+		// Only consider nodes that have allowed CPUs.
+		vector<CpuPlacement> candidates;
+		vector<CpuTopology::NumaNode>::const_iterator it;
+
+		for (it = topology.numaNodes.begin(); it != topology.numaNodes.end(); it++) {
+			CpuPlacement candidate;
+			candidate.numaNode = it->id;
+			std::set_intersection(it->cpus.begin(), it->cpus.end(),
+				allowed.begin(), allowed.end(),
+				std::back_inserter(candidate.cpus));
+			if (!candidate.cpus.empty()) {
+				candidates.push_back(candidate);
+			}
+		}
+		if (candidates.empty()) {
+			placement.cpus = allowed;
+		} else {
+			placement = candidates[sequenceNumber % candidates.size()];
+		}
+		break;
+	}
+	default:
+		placement.cpus = allowed;
+		break;
+	}
+	return placement;
+}
+
+inline CpuTopology
+CpuTopology::detect() {
+	CpuTopology topology;
+
+	#ifdef __linux__
+		cpu_set_t cpus;
+		if (sched_getaffinity(getpid(), sizeof(cpus), &cpus) == -1) {
+			return topology;
+		}
+		for (unsigned int i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &cpus)) {
+				topology.usableCpus.push_back(i);
+			}
+		}
+
+		DIR *dir = opendir("/sys/devices/system/node");
+		if (dir != NULL) {
+			struct dirent *ent;
+			while ((ent = readdir(dir)) != NULL) {
+				unsigned int id;
+				char dummy;
+				if (sscanf(ent->d_name, "node%u%c", &id, &dummy) != 1) {
+					continue;
+				}
+
+				NumaNode node;
+				CpuList nodeCpus;
+				node.id = (int) id;
+				try {
+					if (!parseCpuList(readAll(string("/sys/devices/system/node/")
+						+ ent->d_name + "/cpulist"), nodeCpus))
+					{
+						continue;
+					}
+				} catch (const SystemException &) {
+					continue;
+				}
+				std::set_intersection(nodeCpus.begin(), nodeCpus.end(),
+					topology.usableCpus.begin(), topology.usableCpus.end(),
+					std::back_inserter(node.cpus));
+				if (!node.cpus.empty()) {
+					topology.numaNodes.push_back(node);
+				}
+			}
+			closedir(dir);
+		}
+		if (topology.numaNodes.empty()) {
+			NumaNode node;
+			node.id = -1;
+			node.cpus = topology.usableCpus;
+			topology.numaNodes.push_back(node);
+		}
+	#endif
+
+	return topology;
+}
+
+#ifdef __linux__
+	/** Doesn't allocate, so it may be called in a vfork()ed child. */
+	inline void
+	cpuListToCpuSet(const CpuList &cpus, cpu_set_t *result) {
+		CPU_ZERO(result);
+		for (CpuList::size_type i = 0; i < cpus.size(); i++) {
+			if (cpus[i] < CPU_SETSIZE) {
+				CPU_SET(cpus[i], result);
+			}
+		}
+	}
+#endif
+
+/**
+ * Restricts all threads of the given process to the given CPUs. Threads
+ * that the process creates later inherit the affinity of the thread that
+ * creates them. Returns 0 on success, or an errno code.
+ */
+inline int
+setProcessCpuAffinity(pid_t pid, const CpuList &cpus) {
+	#ifdef __linux__
+		cpu_set_t set;
+		DIR *dir;
+		struct dirent *ent;
+		int result = 0;
+
+		cpuListToCpuSet(cpus, &set);
+		dir = opendir(("/proc/" + toString(pid) + "/task").c_str());
+		if (dir == NULL) {
+			if (sched_setaffinity(pid, sizeof(set), &set) == -1) {
+				return errno;
+			} else {
+				return 0;
+			}
+		}
+		while ((ent = readdir(dir)) != NULL) {
+			pid_t tid = (pid_t) atoi(ent->d_name);
+			// Threads that exit in the mean time don't matter.
+			if (tid > 0 && sched_setaffinity(tid, sizeof(set), &set) == -1
+			 && errno != ESRCH && result == 0)
+			{
+				result = errno;
+			}
+		}
+		closedir(dir);
+		return result;
+	#else
+		return ENOSYS;
+	#endif
+}
+
+/** Returns false if the affinity of the given process cannot be queried. */
+inline bool
+getProcessCpuAffinity(pid_t pid, CpuList &result) {
+	result.clear();
+	#ifdef __linux__
+		cpu_set_t set;
+		if (sched_getaffinity(pid, sizeof(set), &set) == -1) {
+			return false;
+		}
+		for (unsigned int i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &set)) {
+				result.push_back(i);
+			}
+		}
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_CPU_PLACEMENT_H_ */
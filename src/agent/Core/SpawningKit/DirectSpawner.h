@@ -31,6 +31,15 @@
 #include <LveLoggingDecorator.h>
 #include <limits.h>  // for PTHREAD_STACK_MIN
 #include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <cstring>
+#ifdef __linux__
+	#include <sys/syscall.h>
+#endif
+
+extern char **environ;
 
 #include <adhoc_lve.h>
 
@@ -148,6 +157,193 @@ private:
 		return command;
 	}
 
+	/**
+	 * Whether the process can be started with vfork() instead of fork().
+	 * fork() copies the page tables of the Core, which takes longer the
+	 * more memory the Core uses, while vfork() costs the same regardless.
+	 * But the vfork()ed child shares the Core's memory until it execs, so
+	 * it may only make system calls. That rules out switching users:
+	 * initgroups() and the setuid() family are not safe there. So spawns
+	 * that switch users still use fork(), and so do chrooted spawns and
+	 * spawns for which the app root is not accessible, so that fork()
+	 * reports why, and spawns with a file descriptor limit that is too
+	 * large to close all file descriptors one by one.
+	 */
+	bool canUseVfork(const SpawnPreparationInfo &preparation, const char *program) const {
+		#ifdef __linux__
+			struct rlimit limit;
+			if (preparation.userSwitching.enabled
+			 || preparation.chrootDir != "/"
+			 || strchr(program, '/') == NULL
+			 || getrlimit(RLIMIT_NOFILE, &limit) == -1
+			 || limit.rlim_cur == RLIM_INFINITY
+			 || limit.rlim_cur > 1024 * 1024)
+			{
+				return false;
+			}
+
+			vector<string>::const_iterator it, end = preparation.appRootPaths.end();
+			for (it = preparation.appRootPaths.begin(); it != end; it++) {
+				struct stat buf;
+				if (stat(it->c_str(), &buf) == -1) {
+					return false;
+				}
+			}
+			// Let the fork() code path report permission problems, because
+			// it produces more helpful error messages.
+			return access(preparation.appRootPaths.back().c_str(), X_OK) == 0;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Creates the environment for a vfork()ed child, which cannot call
+	 * setenv() itself: the Core's environment, plus the variables that
+	 * the fork() code path sets in the child.
+	 */
+	static vector<string> createVforkEnvironment(const DebugDirPtr &debugDir,
+		const SpawnPreparationInfo &preparation, shared_array<const char *> &envp)
+	{
+		static const char * const excludedNames[] = {
+			// See disableMallocDebugging().
+			"MALLOC_FILL_SPACE=", "MALLOC_PROTECT_BEFORE=", "MallocGuardEdges=",
+			"MallocScribble=", "MallocPreScribble=", "MallocCheckHeapStart=",
+			"MallocCheckHeapEach=", "MallocCheckHeapAbort=", "MallocBadFreeAbort=",
+			"MALLOC_CHECK_=", "PASSENGER_DEBUG_DIR=", "PWD="
+		};
+		vector<string> env;
+
+		for (char **var = environ; *var != NULL; var++) {
+			bool excluded = false;
+			for (unsigned int i = 0; i < sizeof(excludedNames) / sizeof(const char *); i++) {
+				if (strncmp(*var, excludedNames[i], strlen(excludedNames[i])) == 0) {
+					excluded = true;
+					break;
+				}
+			}
+			if (!excluded) {
+				env.push_back(*var);
+			}
+		}
+		env.push_back("PASSENGER_DEBUG_DIR=" + debugDir->getPath());
+		env.push_back("PWD=" + preparation.appRootPathsInsideChroot.back());
+
+		envp.reset(new const char *[env.size() + 1]);
+		for (unsigned int i = 0; i < env.size(); i++) {
+			envp[i] = env[i].c_str();
+		}
+		envp[env.size()] = NULL;
+		return env;
+	}
+
+	/**
+	 * Writes `message`, followed by a description of the errno value `e`,
+	 * without calling anything but write(). For use in vfork()ed children.
+	 */
+	static void writeChildError(int fd, const string &message, int e) {
+		const char *description = strerror(e);
+		char number[sizeof(" (errno=)\n") + 12];
+		char *pos = number + sizeof(number);
+		unsigned int value = e;
+
+		*--pos = '\n';
+		*--pos = ')';
+		do {
+			*--pos = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
+		pos -= sizeof(" (errno=") - 1;
+		memcpy(pos, " (errno=", sizeof(" (errno=") - 1);
+
+		ssize_t ret;
+		ret = write(fd, message.data(), message.size());
+		ret = write(fd, description, strlen(description));
+		ret = write(fd, pos, number + sizeof(number) - pos);
+		(void) ret;
+	}
+
+	/**
+	 * vfork()s a child that sets up its file descriptors, ulimits, CPU
+	 * affinity and working directory like the fork() code path in spawn() does, and
+	 * that then execs `args`. The child must not touch the Core's memory,
+	 * so everything that it needs is prepared by the caller.
+	 */
+	pid_t vforkAndExec(const Options &options, const SpawnPreparationInfo &preparation,
+		const vector<string> &command, const char * const *args, const char * const *envp,
+		int adminSocket, int errorPipe)
+	{
+		string execErrorLogMessage = "Cannot execute \"" + command[0] + "\": ";
+		string execErrorMessage = "!> Error\n!> \n" + execErrorLogMessage;
+		string chdirErrorMessage = "!> Error\n!> \nUnable to change working directory to '"
+			+ preparation.appRootPathsInsideChroot.back() + "': ";
+		const char *workingDir = preparation.appRootPathsInsideChroot.back().c_str();
+		struct rlimit limit;
+		#ifdef __linux__
+			cpu_set_t cpus;
+		#endif
+		sigset_t allSignals, oldMask;
+		int highestFd;
+		pid_t pid;
+
+		// closeAllFileDescriptors() may fork to find the highest file
+		// descriptor, which a vfork()ed child cannot do. canUseVfork()
+		// has checked that the limit is finite.
+		getrlimit(RLIMIT_NOFILE, &limit);
+		highestFd = (int) limit.rlim_cur - 1;
+		limit.rlim_cur = options.fileDescriptorUlimit;
+		limit.rlim_max = options.fileDescriptorUlimit;
+		#ifdef __linux__
+			cpuListToCpuSet(preparation.cpuPlacement.cpus, &cpus);
+		#endif
+
+		// Until the child has reset its signal handlers, a signal would
+		// run one of the Core's handlers on the Core's memory.
+		sigfillset(&allSignals);
+		pthread_sigmask(SIG_SETMASK, &allSignals, &oldMask);
+
+		pid = vfork();
+		if (pid == 0) {
+			resetSignalHandlersAndMask();
+			int adminSocketCopy = dup2(adminSocket, 3);
+			int errorPipeCopy = dup2(errorPipe, 4);
+			dup2(adminSocketCopy, 0);
+			dup2(adminSocketCopy, 1);
+			dup2(errorPipeCopy, 2);
+			#ifdef SYS_close_range
+				if (syscall(SYS_close_range, 3, ~0u, 0) == -1)
+			#endif
+			{
+				for (int i = highestFd; i > 2; i--) {
+					close(i);
+				}
+			}
+			if (options.fileDescriptorUlimit != 0) {
+				setrlimit(RLIMIT_NOFILE, &limit);
+			}
+			#ifdef __linux__
+				// Failures show up when the Spawner reads back the affinity.
+				if (!preparation.cpuPlacement.cpus.empty()) {
+					sched_setaffinity(0, sizeof(cpus), &cpus);
+				}
+			#endif
+			if (chdir(workingDir) == -1) {
+				writeChildError(1, chdirErrorMessage, errno);
+				_exit(1);
+			}
+			execve(args[0], (char * const *) args, (char * const *) envp);
+			int e = errno;
+			writeChildError(1, execErrorMessage, e);
+			writeChildError(2, execErrorLogMessage, e);
+			_exit(1);
+		} else {
+			int e = errno;
+			pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+			errno = e;
+			return pid;
+		}
+	}
+
 public:
 	DirectSpawner(const ConfigPtr &_config)
 		: Spawner(_config)
@@ -160,8 +356,10 @@ public:
 		P_DEBUG("Spawning new process: appRoot=" << options.appRoot);
 		possiblyRaiseInternalError(options);
 
+		unsigned long long beginTime = SystemTime::getUsec();
 		shared_array<const char *> args;
 		SpawnPreparationInfo preparation = prepareSpawn(options);
+		preparation.cpuPlacement = nextCpuPlacement(options);
 		vector<string> command = createCommand(options, preparation, args);
 		SocketPair adminSocket = createUnixSocketPair(__FILE__, __LINE__);
 		Pipe errorPipe = createPipe(__FILE__, __LINE__);
@@ -177,7 +375,14 @@ public:
 		                                 preparation.userSwitching.uid,
 		                                 options.lveMinUid);
 
-		pid = syscalls::fork();
+		if (canUseVfork(preparation, args[0])) {
+			shared_array<const char *> envp;
+			vector<string> env = createVforkEnvironment(debugDir, preparation, envp);
+			pid = vforkAndExec(options, preparation, command, args.get(), envp.get(),
+				adminSocket.first, errorPipe.second);
+		} else {
+			pid = syscalls::fork();
+		}
 		if (pid == 0) {
 			setenv("PASSENGER_DEBUG_DIR", debugDir->getPath().c_str(), 1);
 			purgeStdio(stdout);
@@ -192,6 +397,7 @@ public:
 			closeAllFileDescriptors(2);
 			setChroot(preparation);
 			setUlimits(options);
+			setCpuAffinity(preparation);
 			switchUser(preparation);
 			setWorkingDirectory(preparation);
 			execvp(args[0], (char * const *) args.get());
@@ -213,6 +419,7 @@ public:
 
 		} else {
 			UPDATE_TRACE_POINT();
+			unsigned long long forkTime = SystemTime::getUsec();
 			scopedLveEnter.exit();
 
 			P_LOG_FILE_DESCRIPTOR_PURPOSE(adminSocket.first,
@@ -245,6 +452,8 @@ public:
 			details.errorPipe = errorPipe.first;
 			details.options = &options;
 			details.debugDir = debugDir;
+			details.beginTime = beginTime;
+			details.forkTime = forkTime;
 
 			UPDATE_TRACE_POINT();
 			Result result;
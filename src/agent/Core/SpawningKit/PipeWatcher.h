@@ -23,120 +23,174 @@
  *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *  THE SOFTWARE.
  */
-#ifndef _PASSENGER_SPAwNING_KIT_PIPE_WATCHER_H_
-#define _PASSENGER_SPAwNING_KIT_PIPE_WATCHER_H_
+#ifndef _PASSENGER_SPAWNING_KIT_PIPE_WATCHER_H_
+#define _PASSENGER_SPAWNING_KIT_PIPE_WATCHER_H_
 
 #include <boost/shared_ptr.hpp>
-#include <boost/enable_shared_from_this.hpp>
 #include <boost/thread.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
-#include <oxt/thread.hpp>
 #include <oxt/backtrace.hpp>
+#include <oxt/system_calls.hpp>
+#include <ev++.h>
 #include <vector>
+#include <set>
+#include <cerrno>
+#include <cstring>
 
 #include <sys/types.h>
 
 #include <FileDescriptor.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
 #include <Constants.h>
 #include <Logging.h>
 #include <Utils.h>
 #include <Utils/StrIntUtils.h>
-#include <Core/SpawningKit/Config.h>
+#include <Utils/IOUtils.h>
 
 namespace Passenger {
 namespace SpawningKit {
 
+using namespace std;
 using namespace boost;
 
 
-/** A PipeWatcher lives until the file descriptor is closed. */
-class PipeWatcher: public boost::enable_shared_from_this<PipeWatcher> {
+typedef boost::function<void (const char *data, unsigned int size)> OutputHandler;
+
+/**
+ * Forwards the stdout and stderr output of app processes and preloaders
+ * to the log, and to an OutputHandler, until the pipes are closed.
+ *
+ * All pipes are watched by a single libev event loop (epoll or kqueue)
+ * that runs in a background thread, which is started upon the first
+ * watch() call. Spawning one thread per pipe would cost two threads per
+ * process. Each readiness notification reads up to READ_BUFFER_SIZE bytes
+ * at once, so bursts of output are forwarded in batches.
+ */
+class PipeWatcher: public boost::noncopyable {
 private:
-	ConfigPtr config;
-	FileDescriptor fd;
-	const char *name;
-	pid_t pid;
-	bool started;
-	boost::mutex startSyncher;
-	boost::condition_variable startCond;
-
-	static void threadMain(boost::shared_ptr<PipeWatcher> self) {
-		TRACE_POINT();
-		self->threadMain();
+	static const unsigned int READ_BUFFER_SIZE = 1024 * 64;
+
+	struct Watch {
+		ev_io watcher;
+		PipeWatcher *self;
+		FileDescriptor fd;
+		const char *name;
+		pid_t pid;
+		const OutputHandler *outputHandler;
+	};
+
+	BackgroundEventLoop bgloop;
+	boost::mutex syncher;
+	/** Protected by syncher. */
+	std::set<Watch *> watches;
+	/** Only accessed by the event loop thread. */
+	char buf[READ_BUFFER_SIZE];
+
+	static void _onReadable(struct ev_loop *loop, ev_io *io, int revents) {
+		Watch *watch = static_cast<Watch *>(io->data);
+		watch->self->onReadable(watch);
 	}
 
-	void threadMain() {
+	void startWatch(Watch *watch) {
+		ev_io_start(bgloop.libev_loop, &watch->watcher);
+	}
+
+	void onReadable(Watch *watch) {
 		TRACE_POINT();
-		{
-			boost::unique_lock<boost::mutex> lock(startSyncher);
-			while (!started) {
-				startCond.wait(lock);
+		ssize_t ret = syscalls::read(watch->fd, buf, sizeof(buf));
+		if (ret == 0) {
+			removeWatch(watch);
+		} else if (ret == -1) {
+			UPDATE_TRACE_POINT();
+			if (errno == ECONNRESET) {
+				removeWatch(watch);
+			} else if (errno != EAGAIN) {
+				int e = errno;
+				P_WARN("Cannot read from process " << watch->pid << " " << watch->name <<
+					": " << strerror(e) << " (errno=" << e << ")");
+				removeWatch(watch);
 			}
-		}
-
-		UPDATE_TRACE_POINT();
-		while (!this_thread::interruption_requested()) {
-			char buf[1024 * 8];
-			ssize_t ret;
-
+		} else if (ret == 1 && buf[0] == '\n') {
 			UPDATE_TRACE_POINT();
-			ret = syscalls::read(fd, buf, sizeof(buf));
-			if (ret == 0) {
-				break;
-			} else if (ret == -1) {
-				UPDATE_TRACE_POINT();
-				if (errno == ECONNRESET) {
-					break;
-				} else if (errno != EAGAIN) {
-					int e = errno;
-					P_WARN("Cannot read from process " << pid << " " << name <<
-						": " << strerror(e) << " (errno=" << e << ")");
-					break;
-				}
-			} else if (ret == 1 && buf[0] == '\n') {
-				UPDATE_TRACE_POINT();
-				printAppOutput(pid, name, "", 0);
-			} else {
-				UPDATE_TRACE_POINT();
-				vector<StaticString> lines;
-				ssize_t ret2 = ret;
-				if (ret2 > 0 && buf[ret2 - 1] == '\n') {
-					ret2--;
-				}
-				split(StaticString(buf, ret2), '\n', lines);
-				foreach (const StaticString line, lines) {
-					printAppOutput(pid, name, line.data(), line.size());
-				}
+			printAppOutput(watch->pid, watch->name, "", 0);
+			if (watch->outputHandler != NULL && *watch->outputHandler) {
+				(*watch->outputHandler)(buf, ret);
 			}
-
-			if (config->outputHandler) {
-				config->outputHandler(buf, ret);
+		} else {
+			UPDATE_TRACE_POINT();
+			vector<StaticString> lines;
+			ssize_t ret2 = ret;
+			if (ret2 > 0 && buf[ret2 - 1] == '\n') {
+				ret2--;
+			}
+			split(StaticString(buf, ret2), '\n', lines);
+			foreach (const StaticString line, lines) {
+				printAppOutput(watch->pid, watch->name, line.data(), line.size());
+			}
+			if (watch->outputHandler != NULL && *watch->outputHandler) {
+				(*watch->outputHandler)(buf, ret);
 			}
 		}
 	}
 
+	void removeWatch(Watch *watch) {
+		ev_io_stop(bgloop.libev_loop, &watch->watcher);
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			watches.erase(watch);
+		}
+		delete watch;
+	}
+
 public:
-	PipeWatcher(const ConfigPtr &_config, const FileDescriptor &_fd,
-		const char *_name, pid_t _pid)
-		: config(_config),
-		  fd(_fd),
-		  name(_name),
-		  pid(_pid),
-		  started(false)
+	PipeWatcher()
+		: bgloop(true, false)
 		{ }
 
-	void initialize() {
-		oxt::thread(boost::bind(threadMain, shared_from_this()),
-			"PipeWatcher: PID " + toString(pid) + " " + name + ", fd " + toString(fd),
-			POOL_HELPER_THREAD_STACK_SIZE);
+	~PipeWatcher() {
+		bgloop.stop();
+		foreach (Watch *watch, watches) {
+			delete watch;
+		}
+	}
+
+	/**
+	 * Forwards the output of `fd`, which belongs to process `pid`, until
+	 * `fd` is closed. `name` is the name of the channel, e.g. "stdout", and
+	 * must be a static string. If `outputHandler` is given then it must
+	 * outlive this PipeWatcher; it is called if set at the time output
+	 * arrives. Thread-safe.
+	 */
+	void watch(const FileDescriptor &fd, const char *name, pid_t pid,
+		const OutputHandler *outputHandler = NULL)
+	{
+		Watch *watch = new Watch();
+		watch->self = this;
+		watch->fd = fd;
+		watch->name = name;
+		watch->pid = pid;
+		watch->outputHandler = outputHandler;
+		setNonBlocking(fd);
+		ev_io_init(&watch->watcher, _onReadable, fd, EV_READ);
+		watch->watcher.data = watch;
+
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			watches.insert(watch);
+			if (!bgloop.isStarted()) {
+				bgloop.start("Pipe watcher", POOL_HELPER_THREAD_STACK_SIZE);
+			}
+		}
+		bgloop.safe->runLater(boost::bind(&PipeWatcher::startWatch, this, watch));
 	}
 
-	void start() {
-		boost::lock_guard<boost::mutex> lock(startSyncher);
-		started = true;
-		startCond.notify_all();
+	/** The number of pipes that are currently being watched. */
+	unsigned int getWatchCount() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return watches.size();
 	}
 };
 
@@ -146,4 +200,4 @@ typedef boost::shared_ptr<PipeWatcher> PipeWatcherPtr;
 } // namespace SpawningKit
 } // namespace Passenger
 
-#endif /* _PASSENGER_SPAwNING_KIT_PIPE_WATCHER_H_ */
+#endif /* _PASSENGER_SPAWNING_KIT_PIPE_WATCHER_H_ */
@@ -28,19 +28,71 @@
 
 #include <FileDescriptor.h>
 #include <jsoncpp/json.h>
+#include <Utils/ShmRing.h>
+#include <Core/SpawningKit/AppMetricsPage.h>
 
 namespace Passenger {
 namespace SpawningKit {
 
 
+/**
+ * The phases that spawning a process consists of. The time spent in
+ * each phase is stored in the Result's "spawn_phases" object, in usec,
+ * under the name returned by getSpawnPhaseName().
+ */
+enum SpawnPhase {
+	/** Preparing the spawn and forking the process, or asking the
+	 * preloader to fork it. */
+	SPAWN_PHASE_FORK,
+	/** Starting the preloader, if that had to be done first. */
+	SPAWN_PHASE_PRELOADER_STARTUP,
+	/** Running the SpawnPreparer. Only known for directly spawned processes. */
+	SPAWN_PHASE_SPAWN_PREPARER,
+	/** Until the loader sends its handshake message. */
+	SPAWN_PHASE_LOADER_BOOT,
+	/** From the handshake until the process reports that it is ready,
+	 * which includes loading the application. Excludes SPAWN_PHASE_WARMUP. */
+	SPAWN_PHASE_NEGOTIATION,
+	/** Warming up the process before it reported that it is ready, e.g.
+	 * starting its request handling threads. As reported by the process
+	 * itself. */
+	SPAWN_PHASE_WARMUP,
+
+	SPAWN_PHASE_COUNT
+};
+
+inline const char *
+getSpawnPhaseName(SpawnPhase phase) {
+	switch (phase) {
+	case SPAWN_PHASE_FORK:
+		return "fork";
+	case SPAWN_PHASE_PRELOADER_STARTUP:
+		return "preloader_startup";
+	case SPAWN_PHASE_SPAWN_PREPARER:
+		return "spawn_preparer";
+	case SPAWN_PHASE_LOADER_BOOT:
+		return "loader_boot";
+	case SPAWN_PHASE_NEGOTIATION:
+		return "negotiation";
+	case SPAWN_PHASE_WARMUP:
+		return "warmup";
+	default:
+		return "unknown";
+	}
+}
+
 /**
  * Represents the result of a spawning operation. It is a JSON document
  * containing information about the spawned process, such as its PID,
- * GUPID, etc. In addition, it contains two file descriptors.
+ * GUPID, etc. In addition, it contains two file descriptors, the
+ * process's AppMetricsPage if it publishes metrics, and the ShmRingFile
+ * if one of its sockets accepts shared memory rings.
  */
 struct Result: public Json::Value {
 	FileDescriptor adminSocket;
 	FileDescriptor errorPipe;
+	AppMetricsPagePtr appMetricsPage;
+	ShmRingFilePtr shmRingFile;
 };
 
 
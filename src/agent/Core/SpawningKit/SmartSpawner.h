@@ -32,6 +32,7 @@
 #include <LveLoggingDecorator.h>
 
 #include <adhoc_lve.h>
+#include <deque>
 
 namespace Passenger {
 namespace SpawningKit {
@@ -82,6 +83,9 @@ private:
 	// Upon starting the preloader, its preparation info is stored here
 	// for future reference.
 	SpawnPreparationInfo preparation;
+	// Processes that the preloader has forked ahead of time, and that are
+	// waiting for the spawn handshake. See `options.preloaderStandbyProcesses`.
+	deque<NegotiationDetails> standbyProcesses;
 
 	string getPreloaderCommandString() const {
 		string result;
@@ -210,6 +214,7 @@ private:
 
 		shared_array<const char *> args;
 		preparation = prepareSpawn(options);
+		preparation.cpuPlacement = getPreloaderCpuPlacement(options);
 		vector<string> command = createRealPreloaderCommand(options, args);
 		SocketPair adminSocket = createUnixSocketPair(__FILE__, __LINE__);
 		Pipe errorPipe = createPipe(__FILE__, __LINE__);
@@ -238,6 +243,7 @@ private:
 			closeAllFileDescriptors(2);
 			setChroot(preparation);
 			setUlimits(options);
+			setCpuAffinity(preparation);
 			switchUser(preparation);
 			setWorkingDirectory(preparation);
 			execvp(command[0].c_str(), (char * const *) args.get());
@@ -302,17 +308,10 @@ private:
 				this->pid = pid;
 			}
 
-			PipeWatcherPtr watcher;
-
-			watcher = boost::make_shared<PipeWatcher>(config,
-				adminSocket.second, "stdout", pid);
-			watcher->initialize();
-			watcher->start();
-
-			watcher = boost::make_shared<PipeWatcher>(config,
-				errorPipe.first, "stderr", pid);
-			watcher->initialize();
-			watcher->start();
+			config->pipeWatcher->watch(adminSocket.second, "stdout", pid,
+				&config->outputHandler);
+			config->pipeWatcher->watch(errorPipe.first, "stderr", pid,
+				&config->outputHandler);
 
 			preloaderAnnotations = debugDir->readAll();
 			P_INFO("Preloader for " << options.appRoot <<
@@ -330,6 +329,9 @@ private:
 		if (!preloaderStarted()) {
 			return;
 		}
+		// Closing their admin sockets makes standby processes exit
+		// as soon as they notice that the handshake won't happen.
+		standbyProcesses.clear();
 		syscalls::shutdown(adminSocket, SHUT_WR);
 		if (timedWaitpid(pid, NULL, 5000) == 0) {
 			P_TRACE(2, "Spawn server did not exit in time, killing it...");
@@ -733,6 +735,46 @@ private:
 		}
 	}
 
+	/**
+	 * Tops up the standby processes to `options.preloaderStandbyProcesses`.
+	 * Failures are not fatal: the next spawn just forks its process on demand.
+	 */
+	void fillStandbyProcesses() {
+		TRACE_POINT();
+		while (preloaderStarted()
+			&& standbyProcesses.size() < options.preloaderStandbyProcesses)
+		{
+			NegotiationDetails details;
+			details.preparation = &preparation;
+			details.options = &options;
+			try {
+				sendSpawnCommand(details);
+			} catch (const std::exception &e) {
+				P_WARN("Unable to fork a standby process for " << options.appRoot
+					<< ": " << e.what());
+				return;
+			}
+			P_DEBUG("Forked standby process " << details.pid
+				<< " for " << options.appRoot);
+			standbyProcesses.push_back(details);
+		}
+	}
+
+	/**
+	 * Takes a standby process that is still alive, if there is one.
+	 */
+	bool takeStandbyProcess(NegotiationDetails &details) {
+		while (!standbyProcesses.empty()) {
+			details = standbyProcesses.front();
+			standbyProcesses.pop_front();
+			if (syscalls::kill(details.pid, 0) == 0) {
+				return true;
+			}
+			P_DEBUG("Standby process " << details.pid << " has exited");
+		}
+		return false;
+	}
+
 	template<typename Exception>
 	void sendSpawnCommandAgain(const Exception &e, NegotiationDetails &details) {
 		TRACE_POINT();
@@ -780,19 +822,60 @@ public:
 		P_DEBUG("Spawning new process: appRoot=" << options.appRoot);
 		possiblyRaiseInternalError(options);
 
+		unsigned long long beginTime = SystemTime::getUsec();
+		unsigned long long preloaderStartupTime = 0;
 		{
 			boost::lock_guard<boost::mutex> l(simpleFieldSyncher);
-			m_lastUsed = SystemTime::getUsec();
+			m_lastUsed = beginTime;
 		}
 		UPDATE_TRACE_POINT();
-		boost::lock_guard<boost::mutex> l(syncher);
+		boost::unique_lock<boost::mutex> l(syncher);
 		if (!preloaderStarted()) {
 			UPDATE_TRACE_POINT();
+			unsigned long long preloaderBeginTime = SystemTime::getUsec();
 			startPreloader();
+			preloaderStartupTime = SystemTime::getUsec() - preloaderBeginTime;
+		}
+
+		UPDATE_TRACE_POINT();
+		NegotiationDetails details;
+		if (takeStandbyProcess(details)) {
+			P_DEBUG("Activating standby process " << details.pid);
+			details.options = &options;
+		} else {
+			details = sendSpawnCommandAndGetNegotiationDetails(options);
+		}
+		// A standby process has been booting since long before this spawn,
+		// so its fork time is when it was taken: only the time it still
+		// needs to boot delays this spawn.
+		details.beginTime = beginTime;
+		details.forkTime = SystemTime::getUsec();
+		details.preloaderStartupTime = preloaderStartupTime;
+		// Fork the replacement now, so that it boots while this
+		// process is being negotiated with.
+		UPDATE_TRACE_POINT();
+		fillStandbyProcesses();
+
+		// Only talking to the preloader needs to be serialized. The forked
+		// process boots on its own, so let other threads fork more
+		// processes while we wait for it. The preparation info of the
+		// preloader may change while we wait, so use a copy.
+		SpawnPreparationInfo preparation = this->preparation;
+		details.preparation = &preparation;
+		l.unlock();
+
+		// The process inherited the preloader's CPUs. Move it to its own.
+		preparation.cpuPlacement = nextCpuPlacement(options);
+		if (!preparation.cpuPlacement.cpus.empty()) {
+			int e = setProcessCpuAffinity(details.pid, preparation.cpuPlacement.cpus);
+			if (e != 0) {
+				P_WARN("Cannot set the CPU affinity of process " << details.pid <<
+					" to " << formatCpuList(preparation.cpuPlacement.cpus) << ": " <<
+					strerror(e) << " (errno=" << e << ")");
+			}
 		}
 
 		UPDATE_TRACE_POINT();
-		NegotiationDetails details = sendSpawnCommandAndGetNegotiationDetails(options);
 		Result result = negotiateSpawn(details);
 		P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
 			", pid=" << result["pid"].asInt());
@@ -822,6 +905,11 @@ public:
 		boost::lock_guard<boost::mutex> lock(simpleFieldSyncher);
 		return pid;
 	}
+
+	unsigned int getStandbyProcessCount() const {
+		boost::lock_guard<boost::mutex> lock(syncher);
+		return standbyProcesses.size();
+	}
 };
 
 
@@ -64,6 +64,7 @@
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/move/move.hpp>
+#include <boost/atomic.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 #include <sys/types.h>
@@ -90,7 +91,10 @@
 #include <Utils/IOUtils.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/ProcessMetricsCollector.h>
+#include <Utils/JsonUtils.h>
+#include <Utils/ShmRing.h>
 #include <Core/SpawningKit/Config.h>
+#include <Core/SpawningKit/CpuPlacement.h>
 #include <Core/SpawningKit/Options.h>
 #include <Core/SpawningKit/Result.h>
 #include <Core/SpawningKit/BackgroundIOCapturer.h>
@@ -151,6 +155,18 @@ protected:
 			return path;
 		}
 
+		/**
+		 * Reads a timestamp that the spawned process wrote to the given
+		 * file. Returns 0 if the file does not exist or is invalid.
+		 */
+		unsigned long long readTimestamp(const string &name) const {
+			try {
+				return stringToULL(Passenger::readAll(path + "/" + name));
+			} catch (const SystemException &) {
+				return 0;
+			}
+		}
+
 		map<string, string> readAll() {
 			map<string, string> result;
 			DIR *dir = opendir(path.c_str());
@@ -210,6 +226,10 @@ protected:
 
 		UserSwitchingInfo userSwitching;
 
+		/** The CPUs that the process is pinned to before it execs. Empty if
+		 * it inherits the Core's CPU affinity. */
+		CpuPlacement cpuPlacement;
+
 		// Other information
 		string codeRevision;
 	};
@@ -237,18 +257,39 @@ protected:
 		FileDescriptor errorPipe;
 		const Options *options;
 		DebugDirPtr debugDir;
+		/** The page through which the process may publish its metrics, if
+		 * one could be created. */
+		AppMetricsPagePtr appMetricsPage;
+		/** The rings that the process may use for session data, if
+		 * they're enabled and could be created. */
+		ShmRingFilePtr shmRingFile;
+		/** Time at which the spawn was requested. */
+		unsigned long long beginTime;
+		/** Time at which the process was forked. */
+		unsigned long long forkTime;
+		/** Time spent on starting the preloader during this spawn, if any. */
+		unsigned long long preloaderStartupTime;
 
 		/****** Working state ******/
 		BufferedIO io;
 		string gupid;
 		unsigned long long spawnStartTime;
+		/** Time at which the handshake message was received. */
+		unsigned long long handshakeTime;
+		/** Time that the process spent on warming up, as reported by itself. */
+		unsigned long long warmupDuration;
 		unsigned long long timeout;
 
 		NegotiationDetails() {
 			preparation = NULL;
 			pid = 0;
 			options = NULL;
+			beginTime = 0;
+			forkTime = 0;
+			preloaderStartupTime = 0;
 			spawnStartTime = 0;
+			handshakeTime = 0;
+			warmupDuration = 0;
 			timeout = 0;
 		}
 	};
@@ -283,6 +324,16 @@ private:
 				data.append("instance_dir: " + config->instanceDir + "\n");
 				data.append("socket_dir: " + config->instanceDir + "/apps.s\n");
 			}
+			createAppMetricsPage(details);
+			if (details.appMetricsPage != NULL) {
+				data.append("metrics_file: " + details.appMetricsPage->getPath() + "\n");
+			}
+			if (config->shmRingSlots > 0) {
+				createShmRingFile(details);
+				if (details.shmRingFile != NULL) {
+					data.append("shm_ring_file: " + details.shmRingFile->getPath() + "\n");
+				}
+			}
 
 			vector<string> args;
 			vector<string>::const_iterator it, end;
@@ -313,6 +364,53 @@ private:
 		}
 	}
 
+	/**
+	 * Creates the page through which the process may publish its metrics.
+	 * Spawning continues without one if that fails.
+	 */
+	void createAppMetricsPage(NegotiationDetails &details) {
+		string dir;
+		if (config->instanceDir.empty()) {
+			dir = getSystemTempDir();
+		} else {
+			dir = config->instanceDir + "/apps.s";
+		}
+		try {
+			details.appMetricsPage = AppMetricsPage::create(dir,
+				details.preparation->userSwitching.uid,
+				details.preparation->userSwitching.gid);
+		} catch (const SystemException &e) {
+			P_WARN("Application process " << details.pid << " cannot publish "
+				"its metrics: " << e.what());
+		}
+	}
+
+	/**
+	 * Creates the rings that the process may use for session data instead
+	 * of its session socket. Preferably in /dev/shm, so that the kernel
+	 * never writes them back to disk. Spawning continues without them if
+	 * that fails.
+	 */
+	void createShmRingFile(NegotiationDetails &details) {
+		string dir;
+		if (access("/dev/shm", W_OK) == 0) {
+			dir = "/dev/shm";
+		} else if (config->instanceDir.empty()) {
+			dir = getSystemTempDir();
+		} else {
+			dir = config->instanceDir + "/apps.s";
+		}
+		try {
+			details.shmRingFile = ShmRingFile::create(dir, config->shmRingSlots,
+				ShmRingFile::DEFAULT_RING_CAPACITY,
+				details.preparation->userSwitching.uid,
+				details.preparation->userSwitching.gid);
+		} catch (const SystemException &e) {
+			P_WARN("Application process " << details.pid << " cannot use "
+				"shared memory rings: " << e.what());
+		}
+	}
+
 	Result handleSpawnResponse(NegotiationDetails &details) {
 		TRACE_POINT();
 		Json::Value sockets;
@@ -364,13 +462,15 @@ private:
 			string key = line.substr(0, pos);
 			string value = line.substr(pos + 2, line.size() - pos - 3);
 			if (key == "socket") {
-				// socket: <name>;<address>;<protocol>;<concurrency>
+				// socket: <name>;<address>;<protocol>;<concurrency>[;<flags>]
+				// <flags> is an optional comma-separated list of socket
+				// capabilities. Unknown flags are ignored.
 				// TODO: in case of TCP sockets, check whether it points to localhost
 				// TODO: in case of unix sockets, check whether filename is absolute
 				// and whether owner is correct
 				vector<string> args;
 				split(value, ';', args);
-				if (args.size() == 4) {
+				if (args.size() == 4 || args.size() == 5) {
 					string error = validateSocketAddress(details, args[1]);
 					if (!error.empty()) {
 						throwAppSpawnException(
@@ -384,6 +484,17 @@ private:
 					socket["address"] = fixupSocketAddress(*details.options, args[1]);
 					socket["protocol"] = args[2];
 					socket["concurrency"] = atoi(args[3]);
+					if (args.size() == 5) {
+						vector<string> flags;
+						split(args[4], ',', flags);
+						socket["accepts_request_body_fd"] =
+							std::find(flags.begin(), flags.end(), "body_fd") != flags.end()
+							&& startsWith(args[1], "unix:");
+						socket["accepts_shm_ring"] =
+							std::find(flags.begin(), flags.end(), "shm_ring") != flags.end()
+							&& startsWith(args[1], "unix:")
+							&& details.shmRingFile != NULL;
+					}
 					sockets.append(socket);
 				} else {
 					throwAppSpawnException("An error occurred while starting the "
@@ -408,6 +519,9 @@ private:
 						details);
 				}
 				details.pid = pid;
+			} else if (key == "warmup_duration") {
+				// warmup_duration: <usec>
+				details.warmupDuration = stringToULL(value);
 			} else {
 				throwAppSpawnException("An error occurred while starting the "
 					"web application. It sent an unknown startup response line "
@@ -431,11 +545,90 @@ private:
 		result["code_revision"] = details.preparation->codeRevision;
 		result["spawner_creation_time"] = (Json::UInt64) creationTime;
 		result["spawn_start_time"] = (Json::UInt64) details.spawnStartTime;
+		result["spawn_phases"] = createSpawnPhasesJson(details, SystemTime::getUsec());
+		if (!details.preparation->cpuPlacement.cpus.empty()) {
+			recordCpuPlacement(result, details);
+		}
 		result.adminSocket = details.adminSocket;
 		result.errorPipe = details.errorPipe;
+		if (details.appMetricsPage != NULL) {
+			// The process has opened the file by now, if it is going to.
+			details.appMetricsPage->removeFile();
+			if (details.appMetricsPage->isInitialized()) {
+				result.appMetricsPage = details.appMetricsPage;
+			}
+		}
+		if (details.shmRingFile != NULL) {
+			// The process has mapped the file before advertising its sockets.
+			details.shmRingFile->removeFile();
+			if (socketsAcceptShmRing(sockets)) {
+				result.shmRingFile = details.shmRingFile;
+			}
+		}
 		return result;
 	}
 
+	/**
+	 * Records where the process ended up. Its affinity is read back from the
+	 * kernel, because the process may not have been able to apply the
+	 * planned placement, e.g. because a CPU was taken out of the cpuset.
+	 */
+	void recordCpuPlacement(Result &result, const NegotiationDetails &details) {
+		CpuList cpus;
+		if (getProcessCpuAffinity(details.pid, cpus)) {
+			result["cpu_affinity"] = formatCpuList(cpus);
+			if (cpus == details.preparation->cpuPlacement.cpus
+			 && details.preparation->cpuPlacement.numaNode != -1)
+			{
+				result["numa_node"] = details.preparation->cpuPlacement.numaNode;
+			}
+		}
+	}
+
+	static unsigned long long timeBetween(unsigned long long start, unsigned long long end) {
+		if (start != 0 && end > start) {
+			return end - start;
+		} else {
+			return 0;
+		}
+	}
+
+	/**
+	 * Returns the time spent in each SpawnPhase, in usec. Phases that
+	 * have not been reached, or that are not applicable, took 0 usec.
+	 */
+	static Json::Value createSpawnPhasesJson(const NegotiationDetails &details,
+		unsigned long long now)
+	{
+		unsigned long long times[SPAWN_PHASE_COUNT];
+
+		times[SPAWN_PHASE_PRELOADER_STARTUP] = details.preloaderStartupTime;
+		times[SPAWN_PHASE_FORK] = timeBetween(details.beginTime, details.forkTime);
+		times[SPAWN_PHASE_FORK] -= std::min(times[SPAWN_PHASE_FORK],
+			times[SPAWN_PHASE_PRELOADER_STARTUP]);
+		if (details.debugDir != NULL) {
+			times[SPAWN_PHASE_SPAWN_PREPARER] = timeBetween(
+				details.debugDir->readTimestamp("spawn_preparer_start_time"),
+				details.debugDir->readTimestamp("spawn_preparer_end_time"));
+		} else {
+			times[SPAWN_PHASE_SPAWN_PREPARER] = 0;
+		}
+		times[SPAWN_PHASE_LOADER_BOOT] = timeBetween(details.forkTime,
+			details.handshakeTime);
+		times[SPAWN_PHASE_LOADER_BOOT] -= std::min(times[SPAWN_PHASE_LOADER_BOOT],
+			times[SPAWN_PHASE_SPAWN_PREPARER]);
+		times[SPAWN_PHASE_NEGOTIATION] = timeBetween(details.handshakeTime, now);
+		times[SPAWN_PHASE_WARMUP] = std::min(details.warmupDuration,
+			times[SPAWN_PHASE_NEGOTIATION]);
+		times[SPAWN_PHASE_NEGOTIATION] -= times[SPAWN_PHASE_WARMUP];
+
+		Json::Value doc(Json::objectValue);
+		for (unsigned int i = 0; i < SPAWN_PHASE_COUNT; i++) {
+			doc[getSpawnPhaseName((SpawnPhase) i)] = (Json::UInt64) times[i];
+		}
+		return doc;
+	}
+
 	bool hasSessionSockets(const Json::Value &sockets) const {
 		Json::Value::const_iterator it, end = sockets.end();
 
@@ -448,8 +641,22 @@ private:
 		return false;
 	}
 
+	bool socketsAcceptShmRing(const Json::Value &sockets) const {
+		Json::Value::const_iterator it, end = sockets.end();
+
+		for (it = sockets.begin(); it != end; it++) {
+			if ((*it)["accepts_shm_ring"].asBool()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 protected:
 	ConfigPtr config;
+	/** The sequence number of the next process whose CPU placement is
+	 * computed. See nextCpuPlacement(). */
+	boost::atomic<unsigned int> cpuPlacementCounter;
 
 	static void nonInterruptableKillAndWaitpid(pid_t pid) {
 		boost::this_thread::disable_syscall_interruption dsi;
@@ -654,6 +861,8 @@ protected:
 		if (details.debugDir != NULL) {
 			e.addAnnotations(details.debugDir->readAll());
 		}
+		e.set("spawn_phases",
+			stringifyJson(createSpawnPhasesJson(details, SystemTime::getUsec())));
 	}
 
 	string createErrorPageFromStderrOutput(const string &msg,
@@ -717,7 +926,7 @@ protected:
 		TRACE_POINT();
 		SpawnPreparationInfo info;
 		prepareChroot(info, options);
-		info.userSwitching = prepareUserSwitching(options);
+		info.userSwitching = prepareUserSwitching(options, *config->userDatabaseCache);
 		prepareSwitchingWorkingDirectory(info, options);
 		inferApplicationInfo(info);
 		return info;
@@ -1026,6 +1235,50 @@ protected:
 		}
 	}
 
+	/**
+	 * Computes where the next process of this spawner's group goes, according
+	 * to `options.cpuAffinity`. Each group has its own spawner, so the
+	 * round-robin policies cycle through the CPUs or nodes per group.
+	 */
+	CpuPlacement nextCpuPlacement(const Options &options) {
+		CpuAffinityPolicy policy = parseCpuAffinityPolicy(options.cpuAffinity);
+		if (policy == CPU_AFFINITY_NONE) {
+			return CpuPlacement();
+		} else {
+			return computeCpuPlacement(policy,
+				cpuPlacementCounter.fetch_add(1, boost::memory_order_relaxed),
+				CpuTopology::detect(), config->coreCpus);
+		}
+	}
+
+	/**
+	 * The placement of a preloader: it may run on all CPUs that its
+	 * processes may be placed on. The processes that it forks are then
+	 * moved to their own CPUs with setProcessCpuAffinity().
+	 */
+	CpuPlacement getPreloaderCpuPlacement(const Options &options) const {
+		CpuPlacement placement;
+		if (parseCpuAffinityPolicy(options.cpuAffinity) != CPU_AFFINITY_NONE) {
+			placement.cpus = getAllowedCpus(CpuTopology::detect(), config->coreCpus);
+		}
+		return placement;
+	}
+
+	void setCpuAffinity(const SpawnPreparationInfo &info) {
+		#ifdef __linux__
+			if (!info.cpuPlacement.cpus.empty()) {
+				cpu_set_t cpus;
+				cpuListToCpuSet(info.cpuPlacement.cpus, &cpus);
+				if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+					int e = errno;
+					fprintf(stderr, "Unable to set CPU affinity to %s: %s (errno=%d)\n",
+						formatCpuList(info.cpuPlacement.cpus).c_str(), strerror(e), e);
+					fflush(stderr);
+				}
+			}
+		#endif
+	}
+
 	void setWorkingDirectory(const SpawnPreparationInfo &info) {
 		vector<string>::const_iterator it, end = info.appRootPathsInsideChroot.end();
 		int ret;
@@ -1115,6 +1368,7 @@ protected:
 				SpawnException::APP_STARTUP_TIMEOUT,
 				details);
 		}
+		details.handshakeTime = SystemTime::getUsec();
 
 		protocol_begin:
 		if (result == "I have control 1.0\n") {
@@ -1238,6 +1492,7 @@ public:
 
 	Spawner(const ConfigPtr &_config)
 		: config(_config),
+		  cpuPlacementCounter(0),
 		  creationTime(SystemTime::getUsec())
 		{ }
 
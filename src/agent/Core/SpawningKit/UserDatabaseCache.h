@@ -0,0 +1,477 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_USER_DATABASE_CACHE_H_
+#define _PASSENGER_SPAWNING_KIT_USER_DATABASE_CACHE_H_
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/backtrace.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <grp.h>
+#include <unistd.h>
+
+#include <Logging.h>
+#include <Utils/SystemTime.h>
+#include <Utils/StrIntUtils.h>
+
+#if !defined(HAVE_GETGROUPLIST) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+	#define HAVE_GETGROUPLIST
+#endif
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * Caches user database (passwd) and group database lookups for the benefit
+ * of UserSwitchingRules, which would otherwise query NSS several times per
+ * spawn. On LDAP/SSSD-backed hosts such queries can take tens to hundreds
+ * of milliseconds each, which would serialize mass scale-ups.
+ *
+ * Found entries are kept for `ttl` seconds. After that, lookups keep
+ * returning the stale entry while a background thread re-resolves it, so
+ * that only the very first lookup of a user or group ever blocks on NSS.
+ * If re-resolving fails because of an NSS error, the stale entry is kept
+ * and the next lookup tries again. Negative results are cached too, but
+ * are resolved again synchronously once they have expired, so that newly
+ * created users are picked up promptly.
+ *
+ * This class is thread-safe.
+ */
+class UserDatabaseCache {
+public:
+	struct UserInfo {
+		string name;
+		string passwd;
+		string gecos;
+		string home;
+		string shell;
+		uid_t uid;
+		gid_t gid;
+
+		UserInfo()
+			: uid((uid_t) -1),
+			  gid((gid_t) -1)
+			{ }
+	};
+
+	struct GroupInfo {
+		string name;
+		gid_t gid;
+
+		GroupInfo()
+			: gid((gid_t) -1)
+			{ }
+	};
+
+	typedef vector<gid_t> GroupList;
+
+private:
+	enum ResolveResult {
+		RESOLVE_FOUND,
+		RESOLVE_NOT_FOUND,
+		RESOLVE_ERROR
+	};
+
+	template<typename Value>
+	struct Entry {
+		Value value;
+		MonotonicTimeUsec resolvedAt;
+		bool found;
+		bool refreshing;
+
+		Entry()
+			: resolvedAt(0),
+			  found(false),
+			  refreshing(false)
+			{ }
+	};
+
+	typedef pair<string, gid_t> GroupListKey;
+
+	const unsigned int ttl;
+	mutable boost::mutex syncher;
+	map< string, Entry<UserInfo> > usersByName;
+	map< uid_t, Entry<UserInfo> > usersByUid;
+	map< string, Entry<GroupInfo> > groupsByName;
+	map< gid_t, Entry<GroupInfo> > groupsByGid;
+	map< GroupListKey, Entry<GroupList> > groupLists;
+
+	boost::condition_variable refreshCond;
+	deque< boost::function<void ()> > refreshQueue;
+	oxt::thread *refresherThread;
+	unsigned int lookups;
+	unsigned int misses;
+	unsigned int refreshes;
+
+	static long getPwBufSize() {
+		// _SC_GETPW_R_SIZE_MAX is not a maximum:
+		// http://tomlee.co/2012/10/problems-with-large-linux-unix-groups-and-getgrgid_r-getgrnam_r/
+		return std::max<long>(1024 * 128, sysconf(_SC_GETPW_R_SIZE_MAX));
+	}
+
+	static long getGrBufSize() {
+		// _SC_GETGR_R_SIZE_MAX is not a maximum; see above.
+		return std::max<long>(1024 * 128, sysconf(_SC_GETGR_R_SIZE_MAX));
+	}
+
+	static ResolveResult storeUserInfo(int ret, const struct passwd *pwd, UserInfo &result) {
+		if (ret != 0) {
+			// POSIX says that "not found" is reported through a NULL result,
+			// but some implementations return ENOENT and friends instead.
+			if (ret == ENOENT || ret == ESRCH || ret == EBADF || ret == EPERM) {
+				return RESOLVE_NOT_FOUND;
+			} else {
+				return RESOLVE_ERROR;
+			}
+		} else if (pwd == NULL) {
+			return RESOLVE_NOT_FOUND;
+		} else {
+			result.name   = pwd->pw_name;
+			result.passwd = (pwd->pw_passwd != NULL) ? pwd->pw_passwd : "";
+			result.gecos  = (pwd->pw_gecos != NULL) ? pwd->pw_gecos : "";
+			result.home   = pwd->pw_dir;
+			result.shell  = pwd->pw_shell;
+			result.uid    = pwd->pw_uid;
+			result.gid    = pwd->pw_gid;
+			return RESOLVE_FOUND;
+		}
+	}
+
+	static ResolveResult storeGroupInfo(int ret, const struct group *grp, GroupInfo &result) {
+		if (ret != 0) {
+			if (ret == ENOENT || ret == ESRCH || ret == EBADF || ret == EPERM) {
+				return RESOLVE_NOT_FOUND;
+			} else {
+				return RESOLVE_ERROR;
+			}
+		} else if (grp == NULL) {
+			return RESOLVE_NOT_FOUND;
+		} else {
+			result.name = grp->gr_name;
+			result.gid  = grp->gr_gid;
+			return RESOLVE_FOUND;
+		}
+	}
+
+	static ResolveResult resolveUserByName(const string &name, UserInfo &result) {
+		long bufSize = getPwBufSize();
+		boost::shared_array<char> buf(new char[bufSize]);
+		struct passwd pwd, *pwdResult = NULL;
+		int ret = getpwnam_r(name.c_str(), &pwd, buf.get(), bufSize, &pwdResult);
+		return storeUserInfo(ret, pwdResult, result);
+	}
+
+	static ResolveResult resolveUserByUid(const uid_t &uid, UserInfo &result) {
+		long bufSize = getPwBufSize();
+		boost::shared_array<char> buf(new char[bufSize]);
+		struct passwd pwd, *pwdResult = NULL;
+		int ret = getpwuid_r(uid, &pwd, buf.get(), bufSize, &pwdResult);
+		return storeUserInfo(ret, pwdResult, result);
+	}
+
+	static ResolveResult resolveGroupByName(const string &name, GroupInfo &result) {
+		long bufSize = getGrBufSize();
+		boost::shared_array<char> buf(new char[bufSize]);
+		struct group grp, *grpResult = NULL;
+		int ret = getgrnam_r(name.c_str(), &grp, buf.get(), bufSize, &grpResult);
+		return storeGroupInfo(ret, grpResult, result);
+	}
+
+	static ResolveResult resolveGroupByGid(const gid_t &gid, GroupInfo &result) {
+		long bufSize = getGrBufSize();
+		boost::shared_array<char> buf(new char[bufSize]);
+		struct group grp, *grpResult = NULL;
+		int ret = getgrgid_r(gid, &grp, buf.get(), bufSize, &grpResult);
+		return storeGroupInfo(ret, grpResult, result);
+	}
+
+	static ResolveResult resolveGroupList(const GroupListKey &key, GroupList &result) {
+		#ifdef HAVE_GETGROUPLIST
+			#ifdef __APPLE__
+				int groups[1024];
+				int ngroups = sizeof(groups) / sizeof(int);
+			#else
+				gid_t groups[1024];
+				int ngroups = sizeof(groups) / sizeof(gid_t);
+			#endif
+			if (getgrouplist(key.first.c_str(), key.second, groups, &ngroups) == -1) {
+				return RESOLVE_ERROR;
+			}
+			result.clear();
+			result.reserve(ngroups);
+			for (int i = 0; i < ngroups; i++) {
+				result.push_back((gid_t) groups[i]);
+			}
+			return RESOLVE_FOUND;
+		#else
+			result.clear();
+			return RESOLVE_FOUND;
+		#endif
+	}
+
+	bool isExpired(MonotonicTimeUsec now, MonotonicTimeUsec resolvedAt) const {
+		return now - resolvedAt >= (MonotonicTimeUsec) ttl * 1000000;
+	}
+
+	/**
+	 * Looks up `key` in `table`, resolving it with `resolve` if necessary.
+	 * Returns the ResolveResult; `result` is only set if RESOLVE_FOUND.
+	 */
+	template<typename Key, typename Value>
+	ResolveResult lookup(map< Key, Entry<Value> > &table, const Key &key, Value &result,
+		ResolveResult (*resolve)(const Key &, Value &))
+	{
+		MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+		boost::unique_lock<boost::mutex> l(syncher);
+		typename map< Key, Entry<Value> >::iterator it = table.find(key);
+
+		lookups++;
+		if (it != table.end()) {
+			Entry<Value> &entry = it->second;
+			if (!isExpired(now, entry.resolvedAt)) {
+				if (entry.found) {
+					result = entry.value;
+					return RESOLVE_FOUND;
+				} else {
+					return RESOLVE_NOT_FOUND;
+				}
+			} else if (entry.found) {
+				if (!entry.refreshing) {
+					entry.refreshing = true;
+					scheduleRefresh(boost::bind(&UserDatabaseCache::refresh<Key, Value>,
+						this, boost::ref(table), key, resolve));
+				}
+				result = entry.value;
+				return RESOLVE_FOUND;
+			}
+		}
+
+		// Not cached, or an expired negative entry: resolve synchronously,
+		// without holding the lock so that other lookups aren't blocked.
+		misses++;
+		l.unlock();
+		Value value;
+		ResolveResult ret = resolve(key, value);
+		if (ret == RESOLVE_ERROR) {
+			return ret;
+		}
+
+		l.lock();
+		Entry<Value> &entry = table[key];
+		entry.found = (ret == RESOLVE_FOUND);
+		entry.value = value;
+		entry.resolvedAt = SystemTime::getMonotonicUsec();
+		entry.refreshing = false;
+		if (ret == RESOLVE_FOUND) {
+			result = value;
+		}
+		return ret;
+	}
+
+	template<typename Key, typename Value>
+	void refresh(map< Key, Entry<Value> > &table, Key key,
+		ResolveResult (*resolve)(const Key &, Value &))
+	{
+		Value value;
+		ResolveResult ret = resolve(key, value);
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		typename map< Key, Entry<Value> >::iterator it = table.find(key);
+		if (it == table.end()) {
+			return;
+		}
+
+		Entry<Value> &entry = it->second;
+		entry.refreshing = false;
+		refreshes++;
+		if (ret != RESOLVE_ERROR) {
+			// On error we keep serving the stale entry. Since resolvedAt is
+			// left alone, the next lookup schedules another refresh.
+			entry.found = (ret == RESOLVE_FOUND);
+			entry.value = value;
+			entry.resolvedAt = SystemTime::getMonotonicUsec();
+		}
+	}
+
+	void scheduleRefresh(const boost::function<void ()> &job) {
+		refreshQueue.push_back(job);
+		if (refresherThread == NULL) {
+			refresherThread = new oxt::thread(
+				boost::bind(&UserDatabaseCache::refresherMain, this),
+				"User database cache refresher",
+				1024 * 128);
+		} else {
+			refreshCond.notify_one();
+		}
+	}
+
+	void refresherMain() {
+		TRACE_POINT();
+		try {
+			while (true) {
+				boost::function<void ()> job;
+				{
+					boost::unique_lock<boost::mutex> l(syncher);
+					while (refreshQueue.empty()) {
+						refreshCond.wait(l);
+					}
+					job = refreshQueue.front();
+					refreshQueue.pop_front();
+				}
+
+				UPDATE_TRACE_POINT();
+				boost::this_thread::disable_interruption di;
+				boost::this_thread::disable_syscall_interruption dsi;
+				try {
+					job();
+				} catch (const std::exception &e) {
+					P_WARN("Error refreshing the user database cache: " << e.what());
+				}
+			}
+		} catch (const boost::thread_interrupted &) {
+			// Do nothing.
+		}
+	}
+
+public:
+	/**
+	 * @param ttl The number of seconds after which a found entry is
+	 *            refreshed in the background, and after which a negative
+	 *            entry is resolved again.
+	 */
+	UserDatabaseCache(unsigned int _ttl = 60)
+		: ttl(_ttl),
+		  refresherThread(NULL),
+		  lookups(0),
+		  misses(0),
+		  refreshes(0)
+		{ }
+
+	~UserDatabaseCache() {
+		if (refresherThread != NULL) {
+			refresherThread->interrupt_and_join();
+			delete refresherThread;
+		}
+	}
+
+	bool lookupUserByName(const string &name, UserInfo &result) {
+		return lookup(usersByName, name, result, resolveUserByName) == RESOLVE_FOUND;
+	}
+
+	bool lookupUserByUid(uid_t uid, UserInfo &result) {
+		return lookup(usersByUid, uid, result, resolveUserByUid) == RESOLVE_FOUND;
+	}
+
+	bool lookupGroupByName(const string &name, GroupInfo &result) {
+		return lookup(groupsByName, name, result, resolveGroupByName) == RESOLVE_FOUND;
+	}
+
+	bool lookupGroupByGid(gid_t gid, GroupInfo &result) {
+		return lookup(groupsByGid, gid, result, resolveGroupByGid) == RESOLVE_FOUND;
+	}
+
+	/**
+	 * Returns the supplementary groups of the given user, like getgrouplist().
+	 * Returns false if getgrouplist() failed. On platforms without
+	 * getgrouplist(), always returns an empty list.
+	 */
+	bool lookupGroupList(const string &username, gid_t gid, GroupList &result) {
+		return lookup(groupLists, GroupListKey(username, gid), result,
+			resolveGroupList) == RESOLVE_FOUND;
+	}
+
+	/** Like getGroupName() in Utils.h, but cached. */
+	string getGroupName(gid_t gid) {
+		GroupInfo info;
+		if (lookupGroupByGid(gid, info)) {
+			return info.name;
+		} else {
+			return toString(gid);
+		}
+	}
+
+	/** Like lookupGid() in Utils.h, but cached. */
+	gid_t lookupGid(const string &groupName) {
+		GroupInfo info;
+		if (lookupGroupByName(groupName, info)) {
+			return info.gid;
+		} else if (looksLikePositiveNumber(groupName)) {
+			return atoi(groupName);
+		} else {
+			return (gid_t) -1;
+		}
+	}
+
+	/** Forgets all cached entries. */
+	void clear() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		usersByName.clear();
+		usersByUid.clear();
+		groupsByName.clear();
+		groupsByGid.clear();
+		groupLists.clear();
+	}
+
+	unsigned int getLookupCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return lookups;
+	}
+
+	unsigned int getMissCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return misses;
+	}
+
+	unsigned int getRefreshCount() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return refreshes;
+	}
+};
+
+typedef boost::shared_ptr<UserDatabaseCache> UserDatabaseCachePtr;
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_USER_DATABASE_CACHE_H_ */
@@ -31,12 +31,14 @@
 #include <unistd.h>
 #include <string>
 #include <algorithm>
+#include <cstring>
 #include <boost/shared_array.hpp>
 #include <oxt/backtrace.hpp>
 #include <oxt/system_calls.hpp>
 #include <Exceptions.h>
 #include <Utils.h>
 #include <Core/SpawningKit/Options.h>
+#include <Core/SpawningKit/UserDatabaseCache.h>
 
 namespace Passenger {
 namespace SpawningKit {
@@ -61,36 +63,64 @@ struct UserSwitchingInfo {
 	boost::shared_array<char> lveUserPwdStrBuf;
 };
 
+/**
+ * Fills `info.lveUserPwd` with the given user, with its strings stored in
+ * `info.lveUserPwdStrBuf` so that copies of `info` remain valid.
+ */
+inline void
+setLveUserPwd(UserSwitchingInfo &info, const UserDatabaseCache::UserInfo &user) {
+	const string *fields[] = { &user.name, &user.passwd, &user.gecos, &user.home, &user.shell };
+	char *pointers[5];
+	size_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < 5; i++) {
+		size += fields[i]->size() + 1;
+	}
+	info.lveUserPwdStrBuf.reset(new char[size]);
+
+	char *pos = info.lveUserPwdStrBuf.get();
+	for (i = 0; i < 5; i++) {
+		memcpy(pos, fields[i]->c_str(), fields[i]->size() + 1);
+		pointers[i] = pos;
+		pos += fields[i]->size() + 1;
+	}
+
+	memset(&info.lveUserPwd, 0, sizeof(struct passwd));
+	info.lveUserPwd.pw_name   = pointers[0];
+	info.lveUserPwd.pw_passwd = pointers[1];
+	info.lveUserPwd.pw_gecos  = pointers[2];
+	info.lveUserPwd.pw_dir    = pointers[3];
+	info.lveUserPwd.pw_shell  = pointers[4];
+	info.lveUserPwd.pw_uid    = user.uid;
+	info.lveUserPwd.pw_gid    = user.gid;
+	info.lveUserPwdComplete   = &info.lveUserPwd;
+}
+
+/**
+ * Determines the user and group that a process spawned with the given
+ * options should run as. User and group database lookups go through
+ * `cache`, so that spawns don't block on NSS every time.
+ */
 inline UserSwitchingInfo
-prepareUserSwitching(const Options &options) {
+prepareUserSwitching(const Options &options, UserDatabaseCache &cache) {
 	TRACE_POINT();
 	UserSwitchingInfo info;
+	UserDatabaseCache::UserInfo userInfo;
 
 	if (geteuid() != 0) {
-		struct passwd &pwd = info.lveUserPwd;
-		boost::shared_array<char> &strings = info.lveUserPwdStrBuf;
-		struct passwd *userInfo;
-		long bufSize;
-
-		// _SC_GETPW_R_SIZE_MAX is not a maximum:
-		// http://tomlee.co/2012/10/problems-with-large-linux-unix-groups-and-getgrgid_r-getgrnam_r/
-		bufSize = std::max<long>(1024 * 128, sysconf(_SC_GETPW_R_SIZE_MAX));
-		strings.reset(new char[bufSize]);
-
-		userInfo = (struct passwd *) NULL;
-		if (getpwuid_r(geteuid(), &pwd, strings.get(), bufSize, &userInfo) != 0
-		 || userInfo == (struct passwd *) NULL)
-		{
+		if (!cache.lookupUserByUid(geteuid(), userInfo)) {
 			throw RuntimeException("Cannot get user database entry for user " +
 				getProcessUsername() + "; it looks like your system's " +
 				"user database is broken, please fix it.");
 		}
 
+		setLveUserPwd(info, userInfo);
 		info.enabled = false;
-		info.username = userInfo->pw_name;
-		info.groupname = getGroupName(userInfo->pw_gid);
-		info.home = userInfo->pw_dir;
-		info.shell = userInfo->pw_shell;
+		info.username = userInfo.name;
+		info.groupname = cache.getGroupName(userInfo.gid);
+		info.home = userInfo.home;
+		info.shell = userInfo.shell;
 		info.uid = geteuid();
 		info.gid = getegid();
 		info.ngroups = 0;
@@ -101,62 +131,33 @@ prepareUserSwitching(const Options &options) {
 	string defaultGroup;
 	string startupFile = absolutizePath(options.getStartupFile(),
 		absolutizePath(options.appRoot));
-	struct passwd &pwd = info.lveUserPwd;
-	boost::shared_array<char> &pwdBuf = info.lveUserPwdStrBuf;
-	struct passwd *userInfo;
-	struct group  grp;
+	bool userFound;
 	gid_t  groupId = (gid_t) -1;
-	long pwdBufSize, grpBufSize;
-	boost::shared_array<char> grpBuf;
-	int ret;
-
-	// _SC_GETPW_R_SIZE_MAX/_SC_GETGR_R_SIZE_MAX are not maximums:
-	// http://tomlee.co/2012/10/problems-with-large-linux-unix-groups-and-getgrgid_r-getgrnam_r/
-	pwdBufSize = std::max<long>(1024 * 128, sysconf(_SC_GETPW_R_SIZE_MAX));
-	pwdBuf.reset(new char[pwdBufSize]);
-	grpBufSize = std::max<long>(1024 * 128, sysconf(_SC_GETGR_R_SIZE_MAX));
-	grpBuf.reset(new char[grpBufSize]);
 
 	if (options.defaultGroup.empty()) {
-		struct passwd *info;
-		struct group *group;
+		UserDatabaseCache::UserInfo defaultUserInfo;
+		UserDatabaseCache::GroupInfo groupInfo;
 
-		info = (struct passwd *) NULL;
-		ret = getpwnam_r(options.defaultUser.c_str(), &pwd, pwdBuf.get(),
-			pwdBufSize, &info);
-		if (ret != 0) {
-			info = (struct passwd *) NULL;
-		}
-		if (info == (struct passwd *) NULL) {
+		if (!cache.lookupUserByName(options.defaultUser, defaultUserInfo)) {
 			throw RuntimeException("Cannot get user database entry for username '" +
 				options.defaultUser + "'");
 		}
-
-		group = (struct group *) NULL;
-		ret = getgrgid_r(info->pw_gid, &grp, grpBuf.get(), grpBufSize, &group);
-		if (ret != 0) {
-			group = (struct group *) NULL;
-		}
-		if (group == (struct group *) NULL) {
+		if (!cache.lookupGroupByGid(defaultUserInfo.gid, groupInfo)) {
 			throw RuntimeException(string("Cannot get group database entry for ") +
 				"the default group belonging to username '" +
 				options.defaultUser + "'");
 		}
-		defaultGroup = group->gr_name;
+		defaultGroup = groupInfo.name;
 	} else {
 		defaultGroup = options.defaultGroup;
 	}
 
 	UPDATE_TRACE_POINT();
-	userInfo = (struct passwd *) NULL;
+	userFound = false;
 	if (!options.userSwitching) {
-		// Keep userInfo at NULL so that it's set to defaultUser's UID.
+		// Keep userFound at false so that it's set to defaultUser's UID.
 	} else if (!options.user.empty()) {
-		ret = getpwnam_r(options.user.c_str(), &pwd, pwdBuf.get(),
-			pwdBufSize, &userInfo);
-		if (ret != 0) {
-			userInfo = (struct passwd *) NULL;
-		}
+		userFound = cache.lookupUserByName(options.user, userInfo);
 	} else {
 		struct stat buf;
 		if (syscalls::lstat(startupFile.c_str(), &buf) == -1) {
@@ -164,26 +165,17 @@ prepareUserSwitching(const Options &options) {
 			throw SystemException("Cannot lstat(\"" + startupFile +
 				"\")", e);
 		}
-		ret = getpwuid_r(buf.st_uid, &pwd, pwdBuf.get(),
-			pwdBufSize, &userInfo);
-		if (ret != 0) {
-			userInfo = (struct passwd *) NULL;
-		}
+		userFound = cache.lookupUserByUid(buf.st_uid, userInfo);
 	}
-	if (userInfo == (struct passwd *) NULL || userInfo->pw_uid == 0) {
-		userInfo = (struct passwd *) NULL;
-		ret = getpwnam_r(options.defaultUser.c_str(), &pwd,
-			pwdBuf.get(), pwdBufSize, &userInfo);
-		if (ret != 0) {
-			userInfo = (struct passwd *) NULL;
-		}
+	if (!userFound || userInfo.uid == 0) {
+		userFound = cache.lookupUserByName(options.defaultUser, userInfo);
 	}
 
 	UPDATE_TRACE_POINT();
 	if (!options.userSwitching) {
 		// Keep groupId at -1 so that it's set to defaultGroup's GID.
 	} else if (!options.group.empty()) {
-		struct group *groupInfo = (struct group *) NULL;
+		UserDatabaseCache::GroupInfo groupInfo;
 
 		if (options.group == "!STARTUP_FILE!") {
 			struct stat buf;
@@ -194,37 +186,27 @@ prepareUserSwitching(const Options &options) {
 					startupFile + "\")", e);
 			}
 
-			ret = getgrgid_r(buf.st_gid, &grp, grpBuf.get(), grpBufSize,
-				&groupInfo);
-			if (ret != 0) {
-				groupInfo = (struct group *) NULL;
-			}
-			if (groupInfo != NULL) {
+			if (cache.lookupGroupByGid(buf.st_gid, groupInfo)) {
 				groupId = buf.st_gid;
 			} else {
 				groupId = (gid_t) -1;
 			}
 		} else {
-			ret = getgrnam_r(options.group.c_str(), &grp, grpBuf.get(),
-				grpBufSize, &groupInfo);
-			if (ret != 0) {
-				groupInfo = (struct group *) NULL;
-			}
-			if (groupInfo != NULL) {
-				groupId = groupInfo->gr_gid;
+			if (cache.lookupGroupByName(options.group, groupInfo)) {
+				groupId = groupInfo.gid;
 			} else {
 				groupId = (gid_t) -1;
 			}
 		}
-	} else if (userInfo != (struct passwd *) NULL) {
-		groupId = userInfo->pw_gid;
+	} else if (userFound) {
+		groupId = userInfo.gid;
 	}
 	if (groupId == 0 || groupId == (gid_t) -1) {
-		groupId = lookupGid(defaultGroup);
+		groupId = cache.lookupGid(defaultGroup);
 	}
 
 	UPDATE_TRACE_POINT();
-	if (userInfo == (struct passwd *) NULL) {
+	if (!userFound) {
 		throw RuntimeException("Cannot determine a user to lower privilege to");
 	}
 	if (groupId == (gid_t) -1) {
@@ -232,30 +214,21 @@ prepareUserSwitching(const Options &options) {
 	}
 
 	UPDATE_TRACE_POINT();
-	#ifdef __APPLE__
-		int groups[1024];
-		info.ngroups = sizeof(groups) / sizeof(int);
-	#else
-		gid_t groups[1024];
-		info.ngroups = sizeof(groups) / sizeof(gid_t);
-	#endif
+	setLveUserPwd(info, userInfo);
 	info.enabled = true;
-	info.username = userInfo->pw_name;
-	info.groupname = getGroupName(groupId);
-	info.home = userInfo->pw_dir;
-	info.shell = userInfo->pw_shell;
-	info.uid = userInfo->pw_uid;
+	info.username = userInfo.name;
+	info.groupname = cache.getGroupName(groupId);
+	info.home = userInfo.home;
+	info.shell = userInfo.shell;
+	info.uid = userInfo.uid;
 	info.gid = groupId;
-	#if !defined(HAVE_GETGROUPLIST) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
-		#define HAVE_GETGROUPLIST
-	#endif
+	info.ngroups = 0;
 	#ifdef HAVE_GETGROUPLIST
-		ret = getgrouplist(userInfo->pw_name, groupId,
-			groups, &info.ngroups);
-		if (ret == -1) {
-			int e = errno;
-			throw SystemException("getgrouplist() failed", e);
+		UserDatabaseCache::GroupList groups;
+		if (!cache.lookupGroupList(userInfo.name, groupId, groups)) {
+			throw RuntimeException("getgrouplist() failed");
 		}
+		info.ngroups = groups.size();
 		info.gidset = boost::shared_array<gid_t>(new gid_t[info.ngroups]);
 		for (int i = 0; i < info.ngroups; i++) {
 			info.gidset[i] = groups[i];
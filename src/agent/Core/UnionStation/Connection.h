@@ -29,7 +29,9 @@
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
 #include <oxt/system_calls.hpp>
+#include <oxt/spin_lock.hpp>
 #include <oxt/backtrace.hpp>
 
 #include <string>
@@ -39,6 +41,7 @@
 
 #include <Logging.h>
 #include <Exceptions.h>
+#include <StaticString.h>
 #include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
 
@@ -87,13 +90,28 @@ public:
  * Represents a connection to the UstRouter.
  * All access to the file descriptor must be synchronized through the syncher.
  * You can use the ConnectionLock to do that.
+ *
+ * When the Context buffers log messages, they are appended to the write
+ * buffer instead, which the Context's flusher thread writes out. The write
+ * buffer is synchronized through the bufferSyncher, so that appending to it
+ * never has to wait for I/O on the connection.
  */
 struct Connection: public boost::noncopyable {
 	mutable boost::mutex syncher;
 	int fd;
 
+	oxt::spin_lock bufferSyncher;
+	string buffer;
+	/** The number of log messages in the write buffer. */
+	unsigned int bufferedMessages;
+	/** Whether the connection must be closed once its write buffer has been
+	 * written out, because it didn't fit in the connection pool anymore. */
+	boost::atomic<bool> retired;
+
 	Connection(int _fd)
-		: fd(_fd)
+		: fd(_fd),
+		  bufferedMessages(0),
+		  retired(false)
 		{ }
 
 	~Connection() {
@@ -105,14 +123,50 @@ struct Connection: public boost::noncopyable {
 	}
 
 	void disconnect() {
-		if (fd != -1) {
+		int oldFd;
+		{
+			oxt::spin_lock::scoped_lock l(bufferSyncher);
+			oldFd = fd;
+			fd = -1;
+		}
+		if (oldFd != -1) {
 			boost::this_thread::disable_interruption di;
 			boost::this_thread::disable_syscall_interruption dsi;
-			safelyClose(fd);
-			P_LOG_FILE_DESCRIPTOR_CLOSE(fd);
-			fd = -1;
+			safelyClose(oldFd);
+			P_LOG_FILE_DESCRIPTOR_CLOSE(oldFd);
 		}
 	}
+
+	/**
+	 * Appends data to the write buffer, unless the connection has been
+	 * closed or the buffer would become larger than `limit` bytes. A `limit`
+	 * of 0 means that the buffer size is not limited. `messages` is the
+	 * number of log messages that the data contains.
+	 *
+	 * Returns whether the data was appended.
+	 */
+	bool appendToBuffer(const StaticString &data, unsigned int messages, size_t limit) {
+		oxt::spin_lock::scoped_lock l(bufferSyncher);
+		if (fd == -1 || (limit != 0 && buffer.size() + data.size() > limit)) {
+			return false;
+		}
+		buffer.append(data.data(), data.size());
+		bufferedMessages += messages;
+		return true;
+	}
+
+	/**
+	 * Moves the contents of the write buffer into `output`.
+	 * Returns the number of log messages that it contains.
+	 */
+	unsigned int takeBuffer(string &output) {
+		oxt::spin_lock::scoped_lock l(bufferSyncher);
+		unsigned int messages = bufferedMessages;
+		output.swap(buffer);
+		buffer.clear();
+		bufferedMessages = 0;
+		return messages;
+	}
 };
 
 typedef boost::shared_ptr<Connection> ConnectionPtr;
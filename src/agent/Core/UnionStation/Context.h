@@ -29,18 +29,25 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 
 #include <errno.h>
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 
 #include <Logging.h>
 #include <Exceptions.h>
 #include <StaticString.h>
+#include <MessageReadersWriters.h>
 #include <Utils.h>
+#include <Utils/IOUtils.h>
 #include <Utils/MessageIO.h>
 #include <Utils/SystemTime.h>
 #include <Core/UnionStation/Connection.h>
@@ -56,6 +63,14 @@ using namespace boost;
 class Context: public boost::enable_shared_from_this<Context> {
 private:
 	static const unsigned int CONNECTION_POOL_MAX_SIZE = 10;
+	/** How often the flusher thread writes out the connections' write buffers. */
+	static const unsigned long long FLUSH_INTERVAL = 100000;
+	/** Minimum interval between warnings about dropped log messages. */
+	static const unsigned long long DROPPED_MESSAGES_REPORT_INTERVAL = 10000000;
+	static const unsigned long long FLUSH_TIMEOUT = 5000000;
+	/** The UstRouter rejects scalar messages larger than 1 MB, so leave some
+	 * room for the closeTransaction records that bypass the size limit. */
+	static const size_t MAX_BUFFER_SIZE = 512 * 1024;
 
 	/**** Server information ****/
 	const string serverAddress;
@@ -79,6 +94,19 @@ private:
 	 * will fail. Calculated from reconnectTimeout.
 	 */
 	unsigned long long nextReconnectTime;
+	/** All connections that the flusher thread writes out, including the
+	 * ones that are checked out. Only used when log messages are buffered. */
+	vector<ConnectionPtr> bufferedConnections;
+
+	/********************** Buffered logging fields **********************/
+	/** The maximum size of each connection's write buffer, or 0 if log
+	 * messages are written synchronously. See setBufferedLogging(). */
+	size_t maxBufferSize;
+	oxt::thread *flusherThread;
+	boost::atomic<unsigned long long> droppedMessages;
+	/** Only accessed by the flusher thread. */
+	unsigned long long reportedDroppedMessages;
+	unsigned long long lastDroppedMessagesReportTime;
 
 	static bool isNetworkError(int code) {
 		return code == EPIPE || code == ECONNREFUSED || code == ECONNRESET
@@ -95,6 +123,122 @@ private:
 		nullTransaction   = boost::make_shared<Transaction>();
 		reconnectTimeout  = 1000000;
 		nextReconnectTime = 0;
+		maxBufferSize     = 0;
+		flusherThread     = NULL;
+		droppedMessages   = 0;
+		reportedDroppedMessages = 0;
+		lastDroppedMessagesReportTime = 0;
+	}
+
+	/**
+	 * Writes out the connection's write buffer as a single "batch"
+	 * command, which the UstRouter processes without acknowledging. The
+	 * caller must hold the connection's lock. Returns false if the
+	 * connection is closed, or was closed because writing failed. The
+	 * messages in the buffer are dropped in that case.
+	 */
+	bool flushBuffer(const ConnectionPtr &connection) {
+		TRACE_POINT();
+		string data;
+		unsigned int messages = connection->takeBuffer(data);
+
+		if (!connection->connected()) {
+			recordDroppedMessages(messages);
+			return false;
+		} else if (data.empty()) {
+			return true;
+		}
+
+		// The "batch" array message, followed by the scalar message header.
+		char header[sizeof(boost::uint16_t) + sizeof("batch") + sizeof(boost::uint32_t)];
+		Uint16Message::generate(header, sizeof("batch"));
+		memcpy(header + sizeof(boost::uint16_t), "batch", sizeof("batch"));
+		Uint32Message::generate(header + sizeof(boost::uint16_t) + sizeof("batch"),
+			data.size());
+		StaticString output[] = {
+			StaticString(header, sizeof(header)),
+			data
+		};
+
+		try {
+			unsigned long long timeout = FLUSH_TIMEOUT;
+			gatheredWrite(connection->fd, output, 2, &timeout);
+			return true;
+		} catch (const TimeoutException &) {
+			connection->disconnect();
+			recordDroppedMessages(messages);
+			handleTimeout();
+			return false;
+		} catch (const SystemException &e) {
+			connection->disconnect();
+			recordDroppedMessages(messages);
+			boost::lock_guard<boost::mutex> l(syncher);
+			P_WARN("Cannot write to the UstRouter at " << serverAddress <<
+				" (" << e.what() << "); will reconnect in " <<
+				reconnectTimeout / 1000000 << " second(s).");
+			nextReconnectTime = SystemTime::getUsec() + reconnectTimeout;
+			return false;
+		}
+	}
+
+	void flushBuffers() {
+		TRACE_POINT();
+		vector<ConnectionPtr> connections, closedConnections;
+		vector<ConnectionPtr>::iterator it;
+
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			connections = bufferedConnections;
+		}
+
+		for (it = connections.begin(); it != connections.end(); it++) {
+			const ConnectionPtr &connection = *it;
+			ConnectionLock l(connection);
+			if (flushBuffer(connection) && connection->retired) {
+				connection->disconnect();
+			}
+			if (!connection->connected()) {
+				closedConnections.push_back(connection);
+			}
+		}
+
+		if (!closedConnections.empty()) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			for (it = closedConnections.begin(); it != closedConnections.end(); it++) {
+				bufferedConnections.erase(std::remove(bufferedConnections.begin(),
+					bufferedConnections.end(), *it), bufferedConnections.end());
+			}
+		}
+
+		reportDroppedMessages();
+	}
+
+	void reportDroppedMessages() {
+		unsigned long long dropped = droppedMessages.load(boost::memory_order_relaxed);
+		unsigned long long now = SystemTime::getUsec();
+		if (dropped != reportedDroppedMessages
+		 && now >= lastDroppedMessagesReportTime + DROPPED_MESSAGES_REPORT_INTERVAL)
+		{
+			P_WARN("Dropped " << (dropped - reportedDroppedMessages) <<
+				" Union Station log message(s) because the UstRouter at " <<
+				serverAddress << " could not keep up");
+			reportedDroppedMessages = dropped;
+			lastDroppedMessagesReportTime = now;
+		}
+	}
+
+	void flusherMain() {
+		TRACE_POINT();
+		try {
+			while (true) {
+				syscalls::usleep(FLUSH_INTERVAL);
+				boost::this_thread::disable_interruption di;
+				boost::this_thread::disable_syscall_interruption dsi;
+				flushBuffers();
+			}
+		} catch (const thread_interrupted &) {
+			// Do nothing.
+		}
 	}
 
 	ConnectionPtr createNewConnection() {
@@ -187,6 +331,14 @@ public:
 		initialize();
 	}
 
+	~Context() {
+		if (flusherThread != NULL) {
+			flusherThread->interrupt_and_join();
+			delete flusherThread;
+			flushBuffers();
+		}
+	}
+
 
 	/***** Connection pool methods *****/
 
@@ -210,6 +362,10 @@ public:
 			ConnectionPtr connection;
 			try {
 				connection = createNewConnection();
+				if (maxBufferSize > 0) {
+					l.lock();
+					bufferedConnections.push_back(connection);
+				}
 			} catch (const TimeoutException &) {
 				l.lock();
 				P_WARN("Timeout trying to connect to the UstRouter at " << serverAddress << "; " <<
@@ -237,12 +393,19 @@ public:
 		boost::unique_lock<boost::mutex> l(syncher);
 		if (connectionPool.size() < CONNECTION_POOL_MAX_SIZE) {
 			connectionPool.push_back(connection);
+		} else if (maxBufferSize > 0) {
+			// Let the flusher thread close it after writing out its buffer.
+			connection->retired = true;
 		} else {
 			l.unlock();
 			connection->disconnect();
 		}
 	}
 
+	void recordDroppedMessages(unsigned int count) {
+		droppedMessages.fetch_add(count, boost::memory_order_relaxed);
+	}
+
 
 	/***** Transaction methods *****/
 
@@ -280,6 +443,11 @@ public:
 		ConnectionLock cl(connection);
 		ConnectionGuard guard(connection.get());
 
+		if (maxBufferSize > 0 && !flushBuffer(connection)) {
+			guard.clear();
+			return false;
+		}
+
 		try {
 			unsigned long long timeout = 15000000;
 
@@ -303,6 +471,11 @@ public:
 		ConnectionLock cl(connection);
 		ConnectionGuard guard(connection.get());
 
+		if (maxBufferSize > 0 && !flushBuffer(connection)) {
+			guard.clear();
+			return false;
+		}
+
 		try {
 			unsigned long long timeout = 15000000;
 
@@ -428,7 +601,9 @@ public:
 				txnId,
 				groupName,
 				category,
-				unionStationKey);
+				unionStationKey,
+				PRINT,
+				maxBufferSize);
 			guard.clear();
 			P_TRACE(2, "Created new Union Station transaction: group=" << groupName <<
 				", category=" << category << ", txnId=" << txnId);
@@ -483,7 +658,9 @@ public:
 				txnId,
 				groupName,
 				category,
-				unionStationKey);
+				unionStationKey,
+				PRINT,
+				maxBufferSize);
 			guard.clear();
 			return transaction;
 		} else {
@@ -499,6 +676,37 @@ public:
 		reconnectTimeout = usec;
 	}
 
+	/**
+	 * Makes Transaction::message() append to a write buffer of at most
+	 * `maxBufferSize` bytes per connection, instead of writing to the
+	 * UstRouter and waiting for that. A background thread writes out the
+	 * buffers every FLUSH_INTERVAL. When a buffer is full, messages are
+	 * dropped and counted in getDroppedMessageCount(). `maxBufferSize` is
+	 * capped at MAX_BUFFER_SIZE.
+	 *
+	 * Must be called before any transactions are created.
+	 */
+	void setBufferedLogging(size_t maxBufferSize) {
+		assert(flusherThread == NULL);
+		if (isNull() || maxBufferSize == 0) {
+			return;
+		}
+		if (maxBufferSize > MAX_BUFFER_SIZE) {
+			maxBufferSize = MAX_BUFFER_SIZE;
+		}
+		this->maxBufferSize = maxBufferSize;
+		flusherThread = new oxt::thread(
+			boost::bind(&Context::flusherMain, this),
+			"Union Station log flusher",
+			1024 * 128);
+	}
+
+	/** The number of log messages that were dropped because they could not
+	 * be buffered, or because writing them failed. */
+	unsigned long long getDroppedMessageCount() const {
+		return droppedMessages.load(boost::memory_order_relaxed);
+	}
+
 	bool isNull() const {
 		return serverAddress.empty();
 	}
@@ -529,6 +737,11 @@ _checkinConnection(const ContextPtr &ctx, const ConnectionPtr &connection) {
 	ctx->checkinConnection(connection);
 }
 
+inline void
+_recordDroppedMessages(const ContextPtr &ctx, unsigned int count) {
+	ctx->recordDroppedMessages(count);
+}
+
 
 } // namespace UnionStation
 } // namespace Passenger
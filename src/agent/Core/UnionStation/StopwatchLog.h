@@ -32,6 +32,8 @@
 
 #include <string>
 
+#include <modp_b64.h>
+
 #include <StaticString.h>
 #include <Exceptions.h>
 #include <Utils/StrIntUtils.h>
@@ -45,21 +47,55 @@ using namespace std;
 using namespace boost;
 
 
+/**
+ * Logs the begin and end of a measured section to a transaction, together
+ * with the monotonic clock time and the CPU time at those points.
+ *
+ * The CPU time is that of the calling thread where the OS supports it
+ * (RUSAGE_THREAD), because the process-wide CPU time of a multithreaded
+ * agent says little about a single request and is more expensive to
+ * query. The begin and end must therefore be logged from the same thread.
+ */
 class StopwatchLog: public noncopyable {
 private:
 	Transaction * const transaction;
 	const char *id;
 	bool ok;
 
-	static string timevalToString(struct timeval &tv) {
-		unsigned long long i = (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
-		return usecToString(i);
+	static char *appendUsec(char *pos, const char *end, unsigned long long usec) {
+		char buf[2 * sizeof(unsigned long long) + 1];
+		unsigned int size = integerToHexatri<unsigned long long>(usec, buf);
+		return appendData(pos, end, buf, size);
 	}
 
-	static string usecToString(unsigned long long usec) {
-		char timestamp[2 * sizeof(unsigned long long) + 1];
-		integerToHexatri<unsigned long long>(usec, timestamp);
-		return timestamp;
+	static char *appendUsec(char *pos, const char *end, const struct timeval &tv) {
+		return appendUsec(pos, end,
+			(unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+
+	/**
+	 * Appends "(monotonic time,user CPU time,system CPU time)", all in
+	 * microseconds and formatted without going through the heap.
+	 */
+	static char *appendTimes(char *pos, const char *end) {
+		struct rusage usage;
+
+		pos = appendData(pos, end, " (");
+		pos = appendUsec(pos, end, SystemTime::getMonotonicUsec());
+		pos = appendData(pos, end, ",");
+		#ifdef RUSAGE_THREAD
+			int who = RUSAGE_THREAD;
+		#else
+			int who = RUSAGE_SELF;
+		#endif
+		if (getrusage(who, &usage) == -1) {
+			int e = errno;
+			throw SystemException("getrusage() failed", e);
+		}
+		pos = appendUsec(pos, end, usage.ru_utime);
+		pos = appendData(pos, end, ",");
+		pos = appendUsec(pos, end, usage.ru_stime);
+		return appendData(pos, end, ")");
 	}
 
 public:
@@ -73,24 +109,18 @@ public:
 		this->id = id;
 		ok = false;
 
+		if (transaction == NULL) {
+			return;
+		}
+
 		char message[250];
 		char *pos = message;
 		const char *end = message + sizeof(message);
-		struct rusage usage;
 
 		pos = appendData(pos, end, "BEGIN: ");
 		pos = appendData(pos, end, id);
-		pos = appendData(pos, end, " (");
-		pos = appendData(pos, end, usecToString(SystemTime::getMonotonicUsec()));
-		pos = appendData(pos, end, ",");
-		if (getrusage(RUSAGE_SELF, &usage) == -1) {
-			int e = errno;
-			throw SystemException("getrusage() failed", e);
-		}
-		pos = appendData(pos, end, timevalToString(usage.ru_utime));
-		pos = appendData(pos, end, ",");
-		pos = appendData(pos, end, timevalToString(usage.ru_stime));
-		pos = appendData(pos, end, ") ");
+		pos = appendTimes(pos, end);
+		pos = appendData(pos, end, " ");
 
 		if (nameAndData != NULL) {
 			try {
@@ -100,9 +130,7 @@ public:
 			}
 		}
 
-		if (transaction != NULL) {
-			transaction->message(StaticString(message, pos - message));
-		}
+		transaction->message(StaticString(message, pos - message));
 	}
 
 	~StopwatchLog() {
@@ -112,7 +140,6 @@ public:
 		char message[150];
 		char *pos = message;
 		const char *end = message + sizeof(message);
-		struct rusage usage;
 
 		if (ok) {
 			pos = appendData(pos, end, "END: ");
@@ -120,17 +147,7 @@ public:
 			pos = appendData(pos, end, "FAIL: ");
 		}
 		pos = appendData(pos, end, id);
-		pos = appendData(pos, end, " (");
-		pos = appendData(pos, end, usecToString(SystemTime::getMonotonicUsec()));
-		pos = appendData(pos, end, ",");
-		if (getrusage(RUSAGE_SELF, &usage) == -1) {
-			int e = errno;
-			throw SystemException("getrusage() failed", e);
-		}
-		pos = appendData(pos, end, timevalToString(usage.ru_utime));
-		pos = appendData(pos, end, ",");
-		pos = appendData(pos, end, timevalToString(usage.ru_stime));
-		pos = appendData(pos, end, ")");
+		pos = appendTimes(pos, end);
 
 		transaction->message(StaticString(message, pos - message));
 	}
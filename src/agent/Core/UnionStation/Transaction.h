@@ -62,6 +62,7 @@ class Context;
 typedef boost::shared_ptr<Context> ContextPtr;
 
 inline void _checkinConnection(const ContextPtr &ctx, const ConnectionPtr &connection);
+inline void _recordDroppedMessages(const ContextPtr &ctx, unsigned int count);
 
 
 class Transaction: public boost::noncopyable {
@@ -76,6 +77,29 @@ private:
 	const string category;
 	const string unionStationKey;
 	const ExceptionHandlingMode exceptionHandlingMode;
+	/**
+	 * If nonzero, messages are not written to the connection directly, but
+	 * appended to its write buffer, which may be at most this many bytes.
+	 * See Context::setBufferedLogging().
+	 */
+	const size_t maxBufferSize;
+
+	/**
+	 * Appends a record in the UstRouter's batch format: a 16-bit field
+	 * count followed by, for each field, a 32-bit length and the data.
+	 * See UstRouter::Controller::processBatchBody().
+	 */
+	static void appendBatchRecord(string &output, const StaticString fields[],
+		unsigned int nfields)
+	{
+		boost::uint16_t count = htons(nfields);
+		output.append((const char *) &count, sizeof(boost::uint16_t));
+		for (unsigned int i = 0; i < nfields; i++) {
+			boost::uint32_t len = htonl(fields[i].size());
+			output.append((const char *) &len, sizeof(boost::uint32_t));
+			output.append(fields[i].data(), fields[i].size());
+		}
+	}
 
 	/**
 	 * Buffer must be at least txnId.size() + 1 + INT64_STR_BUFSIZE + 1 bytes.
@@ -127,7 +151,8 @@ private:
 
 public:
 	Transaction()
-		: exceptionHandlingMode(PRINT)
+		: exceptionHandlingMode(PRINT),
+		  maxBufferSize(0)
 		{ }
 
 	Transaction(const ContextPtr &_context,
@@ -136,14 +161,16 @@ public:
 		const string &_groupName,
 		const string &_category,
 		const string &_unionStationKey,
-		ExceptionHandlingMode _exceptionHandlingMode = PRINT)
+		ExceptionHandlingMode _exceptionHandlingMode = PRINT,
+		size_t _maxBufferSize = 0)
 		: context(_context),
 		  connection(_connection),
 		  txnId(_txnId),
 		  groupName(_groupName),
 		  category(_category),
 		  unionStationKey(_unionStationKey),
-		  exceptionHandlingMode(_exceptionHandlingMode)
+		  exceptionHandlingMode(_exceptionHandlingMode),
+		  maxBufferSize(_maxBufferSize)
 		{ }
 
 	~Transaction() {
@@ -151,6 +178,10 @@ public:
 		if (connection == NULL) {
 			return;
 		}
+		if (maxBufferSize > 0) {
+			bufferCloseMessage();
+			return;
+		}
 		ConnectionLock l(connection);
 		if (!connection->connected()) {
 			return;
@@ -186,6 +217,10 @@ public:
 			P_TRACE(3, "[Union Station log to null] " << text);
 			return;
 		}
+		if (maxBufferSize > 0) {
+			bufferMessage(text);
+			return;
+		}
 		ConnectionLock l(connection);
 		if (!connection->connected()) {
 			P_TRACE(3, "[Union Station log to null] " << text);
@@ -215,6 +250,50 @@ public:
 		}
 	}
 
+	/**
+	 * Appends a message to the connection's write buffer, so that it is
+	 * written out by the Context's flusher thread. If the buffer is full,
+	 * then the message is dropped instead of waiting for the UstRouter.
+	 */
+	void bufferMessage(const StaticString &text) {
+		char timestamp[2 * sizeof(unsigned long long) + 1];
+		integerToHexatri<unsigned long long>(SystemTime::getUsec(), timestamp);
+		P_TRACE(3, "[Union Station log] " << txnId << " " << timestamp << " " << text);
+
+		StaticString fields[] = {
+			P_STATIC_STRING("log"),
+			txnId,
+			timestamp,
+			text
+		};
+		string data;
+		appendBatchRecord(data, fields, sizeof(fields) / sizeof(StaticString));
+		if (!connection->appendToBuffer(data, 1, maxBufferSize)) {
+			_recordDroppedMessages(context, 1);
+		}
+	}
+
+	/**
+	 * Buffers the closeTransaction command and returns the connection to
+	 * the pool. The command is never dropped, because then the UstRouter
+	 * would keep the transaction open.
+	 */
+	void bufferCloseMessage() {
+		char timestamp[2 * sizeof(unsigned long long) + 1];
+		integerToHexatri<unsigned long long>(SystemTime::getUsec(), timestamp);
+
+		StaticString fields[] = {
+			P_STATIC_STRING("closeTransaction"),
+			txnId,
+			timestamp
+		};
+		string data;
+		appendBatchRecord(data, fields, sizeof(fields) / sizeof(StaticString));
+		if (connection->appendToBuffer(data, 0, 0)) {
+			_checkinConnection(context, connection);
+		}
+	}
+
 	void abort(const StaticString &text) {
 		message("ABORT");
 	}
@@ -45,6 +45,7 @@
 #include <sstream>
 #include <modp_b64.h>
 #include <Utils/SystemMetricsCollector.h>
+#include <Utils/SystemTime.h>
 
 using namespace std;
 using namespace Passenger;
@@ -96,6 +97,24 @@ setGivenEnvVars(const char *envvarsData) {
 	}
 }
 
+/**
+ * Writes the current time to the given file in the debug directory,
+ * so that the Spawner can tell how long the SpawnPreparer took.
+ */
+static void
+recordTimestamp(const char *name) {
+	const char *c_dir;
+	if ((c_dir = getenv("PASSENGER_DEBUG_DIR")) == NULL) {
+		return;
+	}
+
+	FILE *f = fopen((string(c_dir) + "/" + name).c_str(), "w");
+	if (f != NULL) {
+		fprintf(f, "%llu\n", SystemTime::getUsec());
+		fclose(f);
+	}
+}
+
 static void
 dumpInformation() {
 	const char *c_dir;
@@ -189,6 +208,7 @@ spawnPreparerMain(int argc, char *argv[]) {
 	const char *executable = argv[ARG_OFFSET + 3];
 	char **execArgs = &argv[ARG_OFFSET + 4];
 
+	recordTimestamp("spawn_preparer_start_time");
 	changeWorkingDir(workingDir);
 	setGivenEnvVars(envvars);
 	dumpInformation();
@@ -200,6 +220,7 @@ spawnPreparerMain(int argc, char *argv[]) {
 	printf("\n");
 	fflush(stdout);
 
+	recordTimestamp("spawn_preparer_end_time");
 	execvp(executable, (char * const *) execArgs);
 	int e = errno;
 	fprintf(stderr, "*** ERROR ***: Cannot execute %s: %s (%d)\n",
@@ -25,7 +25,8 @@
  */
 
 /* This tool touches everything in a directory every 30 minutes to prevent
- * /tmp cleaners from removing it.
+ * /tmp cleaners from removing it. The directory is walked in-process (see
+ * touchDirTree()), and not touched at all if systemd-tmpfiles excludes it.
  */
 
 #include <sys/stat.h>
@@ -41,6 +42,7 @@
 #include <errno.h>
 #include <string.h>
 #include <Constants.h>
+#include <Utils.h>
 
 #define ERROR_PREFIX "*** TempDirToucher error"
 
@@ -329,54 +331,20 @@ static int
 dirExists(const char *dir) {
 	up_privilege(); // raise priv. to stat file
 	struct stat buf;
-	return stat(dir, &buf) == 0 && S_ISDIR(buf.st_mode);
+	int result = stat(dir, &buf) == 0 && S_ISDIR(buf.st_mode);
 	down_privilege(); // drop priv now that unneeded
+	return result;
 }
 
 static void
 touchDir(const char *dir) {
-	pid_t pid;
-	int e, status;
+	if (Passenger::isExcludedFromTmpCleaning(dir)) {
+		DEBUG("Directory is excluded from systemd-tmpfiles cleaning, not touching it");
+		return;
+	}
 
 	up_privilege(); // raise priv. to touch files
-	pid = fork();
-	if (pid == 0) {
-		close(terminationPipe[0]);
-		close(terminationPipe[1]);
-		if (chdir(dir) == -1) {
-			e = errno;
-			fprintf(stderr, ERROR_PREFIX
-				": cannot change working directory to %s: %s (errno %d)\n",
-				dir, strerror(e), e);
-			_exit(1);
-		}
-		execlp("/bin/sh", "/bin/sh", "-c",
-			"find \"$1\" | xargs touch", "/bin/sh", ".",
-			(const char * const) 0);
-		e = errno;
-		fprintf(stderr, ERROR_PREFIX ": cannot execute /bin/sh: %s (errno %d)\n",
-			strerror(e), e);
-		_exit(1);
-	} else if (pid == -1) {
-		e = errno;
-		fprintf(stderr, ERROR_PREFIX ": cannot fork: %s (errno %d)\n",
-			strerror(e), e);
-		exit(1);
-	} else {
-		if (waitpid(pid, &status, 0) == -1) {
-			if (errno != ESRCH && errno != EPERM) {
-				fprintf(stderr, ERROR_PREFIX
-					": unable to wait for shell command 'find %s | xargs touch'\n",
-					dir);
-				exit(1);
-			}
-		} else if (WEXITSTATUS(status) != 0) {
-			fprintf(stderr, ERROR_PREFIX
-				": shell command 'find %s | xargs touch' failed with exit status %d\n",
-				dir, WEXITSTATUS(status));
-			exit(1);
-		}
-	}
+	Passenger::touchDirTree(dir);
 	down_privilege(); // drop priv now that unneeded
 }
 
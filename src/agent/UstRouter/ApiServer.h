@@ -172,12 +172,12 @@ private:
 	}
 
 	void gatherControllerState(Client *client, Request *req, Controller *controller) {
-		Json::Value state = controller->inspectStateAsJson();
+		string state = controller->inspectStateAsJsonString();
 		getContext()->libev->runLater(boost::bind(&ApiServer::controllerStateGathered,
 			this, client, req, state));
 	}
 
-	void controllerStateGathered(Client *client, Request *req, Json::Value state) {
+	void controllerStateGathered(Client *client, Request *req, const string &state) {
 		if (req->ended()) {
 			unrefRequest(req, __FILE__, __LINE__);
 			return;
@@ -186,8 +186,7 @@ private:
 		HeaderTable headers;
 		headers.insert(req->pool, "Content-Type", "application/json");
 
-		writeSimpleResponse(client, 200, &headers,
-			psg_pstrdup(req->pool, state.toStyledString()));
+		writeSimpleResponse(client, 200, &headers, psg_pstrdup(req->pool, state));
 		if (!req->ended()) {
 			Request *req2 = req;
 			endRequest(&client, &req2);
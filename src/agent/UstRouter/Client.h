@@ -45,7 +45,8 @@ public:
 		READING_AUTH_USERNAME,
 		READING_AUTH_PASSWORD,
 		READING_MESSAGE,
-		READING_MESSAGE_BODY
+		READING_MESSAGE_BODY,
+		READING_BATCH_BODY
 	};
 
 	enum Type {
@@ -72,6 +73,12 @@ public:
 		bool ack;
 	} logCommandParams;
 
+	/**
+	 * The fields of the batch record that is currently being processed.
+	 * Reused between records so that parsing a batch does not allocate.
+	 */
+	vector<StaticString> batchRecord;
+
 	Client(void *server)
 		: ServerKit::BaseClient(server)
 		{ }
@@ -86,6 +93,8 @@ public:
 			return "READING_MESSAGE";
 		case READING_MESSAGE_BODY:
 			return "READING_MESSAGE_BODY";
+		case READING_BATCH_BODY:
+			return "READING_BATCH_BODY";
 		default:
 			return "UNKNOWN";
 		}
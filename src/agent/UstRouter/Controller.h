@@ -80,6 +80,9 @@ private:
 	string username;
 	string password;
 	string dumpDir;
+	size_t dumpBufferSize;
+	size_t dumpRotateSize;
+	bool dumpFsync;
 	string defaultNodeName;
 	bool devMode;
 
@@ -229,7 +232,11 @@ private:
 
 		if (client->scalarReader.done()) {
 			// No error
-			processLogMessageBody(client, client->scalarReader.value());
+			if (client->state == Client::READING_BATCH_BODY) {
+				processBatchBody(client, client->scalarReader.value());
+			} else {
+				processLogMessageBody(client, client->scalarReader.value());
+			}
 			client->scalarReader.reset();
 		}
 		return Channel::Result(consumed, false);
@@ -243,6 +250,8 @@ private:
 				processOpenTransactionMessage(client, args);
 			} else if (args[0] == P_STATIC_STRING("closeTransaction")) {
 				processCloseTransactionMessage(client, args);
+			} else if (args[0] == P_STATIC_STRING("batch")) {
+				processBatchMessage(client, args);
 			} else if (args[0] == P_STATIC_STRING("init")) {
 				processInitMessage(client, args);
 			} else if (args[0] == P_STATIC_STRING("info")) {
@@ -436,7 +445,7 @@ private:
 			}
 
 			transaction = boost::make_shared<Transaction>(
-				txnId, groupName, nodeName, category,
+				&getContext()->mbuf_pool, txnId, groupName, nodeName, category,
 				unionStationKey, ev_now(getLoop()), filters
 			);
 			transaction->enableCrashProtect(crashProtect);
@@ -586,6 +595,126 @@ private:
 		}
 	}
 
+	void processBatchMessage(Client *client, const vector<StaticString> &args) {
+		if (OXT_UNLIKELY(!expectingLoggerType(client))) {
+			return;
+		}
+
+		// Control will continue in processBatchBody()
+		// when body is fully read.
+		client->state = Client::READING_BATCH_BODY;
+		SKC_DEBUG(client, "Done processing 'batch' message");
+	}
+
+	/**
+	 * Processes the scalar message that's expected to come after the
+	 * "batch" command. It contains any number of records, each of which
+	 * consists of a 16-bit field count followed by that many fields.
+	 * Each field is a 32-bit length followed by the field data. Integers
+	 * are in network byte order.
+	 *
+	 * The fields of a record are the same as the arguments of the
+	 * "openTransaction" and "closeTransaction" commands, or those of the
+	 * "log" command followed by the log message body. Records are
+	 * processed in order and are never acknowledged, so that a logger
+	 * can send many transactions' worth of records in a single write.
+	 */
+	void processBatchBody(Client *client, const StaticString &body) {
+		const char *pos = body.data();
+		const char *end = body.data() + body.size();
+		unsigned int count = 0;
+
+		client->state = Client::READING_MESSAGE;
+
+		try {
+			while (pos < end && client->connected()) {
+				size_t consumed = parseBatchRecord(pos, end - pos,
+					client->batchRecord);
+				if (OXT_UNLIKELY(consumed == 0)) {
+					disconnectWithError(&client, "Error processing batch:"
+						" malformed record");
+					return;
+				}
+				pos += consumed;
+				count++;
+				processBatchRecord(client, client->batchRecord);
+			}
+		} catch (const oxt::tracable_exception &e) {
+			SKC_ERROR(client, "Exception: " << e.what() << "\n" << e.backtrace());
+			if (client->connected()) {
+				disconnect(&client);
+			}
+			return;
+		}
+
+		if (client->connected()) {
+			SKC_DEBUG(client, "Done processing batch of " << count << " records");
+		}
+	}
+
+	/**
+	 * Parses a single batch record into `fields`. Returns the number of
+	 * bytes consumed, or 0 if the record is malformed.
+	 */
+	static size_t parseBatchRecord(const char *data, size_t size,
+		vector<StaticString> &fields)
+	{
+		const char *pos = data;
+		const char *end = data + size;
+		boost::uint16_t count;
+		boost::uint32_t len;
+
+		fields.clear();
+		if (end - pos < (ptrdiff_t) sizeof(count)) {
+			return 0;
+		}
+		memcpy(&count, pos, sizeof(count));
+		count = ntohs(count);
+		pos += sizeof(count);
+		if (count == 0) {
+			return 0;
+		}
+
+		for (boost::uint16_t i = 0; i < count; i++) {
+			if (end - pos < (ptrdiff_t) sizeof(len)) {
+				return 0;
+			}
+			memcpy(&len, pos, sizeof(len));
+			len = ntohl(len);
+			pos += sizeof(len);
+			if ((size_t) (end - pos) < len) {
+				return 0;
+			}
+			fields.push_back(StaticString(pos, len));
+			pos += len;
+		}
+
+		return pos - data;
+	}
+
+	void processBatchRecord(Client *client, vector<StaticString> &fields) {
+		if (fields[0] == P_STATIC_STRING("log")) {
+			if (OXT_UNLIKELY(!expectingMinArgumentsCount(client, fields, 4))) {
+				return;
+			}
+			// The body is the last field. Without it, the remaining
+			// fields are exactly the arguments of a "log" command
+			// that does not ask for an acknowledgement.
+			StaticString body = fields.back();
+			fields.pop_back();
+			processLogMessage(client, fields);
+			if (client->connected() && client->state == Client::READING_MESSAGE_BODY) {
+				processLogMessageBody(client, body);
+			}
+		} else if (fields[0] == P_STATIC_STRING("openTransaction")) {
+			processOpenTransactionMessage(client, fields);
+		} else if (fields[0] == P_STATIC_STRING("closeTransaction")) {
+			processCloseTransactionMessage(client, fields);
+		} else {
+			processUnknownMessage(client, fields);
+		}
+	}
+
 	void processInitMessage(Client *client, const vector<StaticString> &args) {
 		StaticString nodeName;
 
@@ -616,7 +745,7 @@ private:
 	}
 
 	void processInfoMessage(Client *client, const vector<StaticString> &args) {
-		string info = inspectStateAsJson().toStyledString();
+		string info = inspectStateAsJsonString();
 
 		StaticString reply[] = {
 			P_STATIC_STRING("status"),
@@ -874,6 +1003,7 @@ private:
 	bool supportedCategory(const StaticString &category) const {
 		return category == P_STATIC_STRING("requests")
 			|| category == P_STATIC_STRING("processes")
+			|| category == P_STATIC_STRING("process_states")
 			|| category == P_STATIC_STRING("exceptions")
 			|| category == P_STATIC_STRING("system_metrics")
 			|| category == P_STATIC_STRING("internal_information");
@@ -904,7 +1034,8 @@ private:
 		if (sink == NULL) {
 			string dumpFile = dumpDir + "/" + category;
 			SKC_DEBUG(client, "Creating dump file: " << dumpFile);
-			sink = boost::make_shared<FileSink>(this, dumpFile);
+			sink = boost::make_shared<FileSink>(this, dumpFile,
+				dumpBufferSize, dumpRotateSize, dumpFsync);
 			sink->opened = 1;
 			logSinkCache.set(StaticString(cacheKey, cacheKeySize), sink);
 		} else {
@@ -959,7 +1090,7 @@ private:
 					transaction->getNodeName(), transaction->getCategory());
 			}
 			P_DEBUG("Closing transaction " << transaction->getTxnId() <<
-				": appending " << transaction->getBody().size() << " bytes "
+				": appending " << transaction->getBodySize() << " bytes "
 				"to sink " << logSink->inspect());
 			logSink->append(transaction);
 			closeLogSink(logSink);
@@ -1025,7 +1156,7 @@ private:
 			return true;
 		}
 
-		StaticString body   = transaction->getBody();
+		string body         = transaction->getBody();
 		const char *current = filters.data();
 		const char *end     = filters.data() + filters.size();
 		bool result         = true;
@@ -1123,6 +1254,7 @@ protected:
 		case Client::READING_MESSAGE:
 			return onMessageDataReceived(client, buffer, errcode);
 		case Client::READING_MESSAGE_BODY:
+		case Client::READING_BATCH_BODY:
 			return onMessageBodyDataReceived(client, buffer, errcode);
 		default:
 			P_BUG("Unknown state " << client->state);
@@ -1142,13 +1274,21 @@ public:
 		  username(options.get("ust_router_username", false, "")),
 		  password(options.get("ust_router_password", false, "")),
 		  dumpDir(options.get("ust_router_dump_dir", false, "/tmp")),
+		  dumpBufferSize(options.getUint("ust_router_dump_buffer_size", false, 64 * 1024)),
+		  dumpRotateSize(options.getULL("ust_router_dump_rotate_size", false, 0)),
+		  dumpFsync(options.getBool("ust_router_dump_fsync", false, false)),
 		  defaultNodeName(options.get("ust_router_default_node_name", false, "")),
 		  devMode(options.getBool("ust_router_dev_mode", false, false)),
 		  remoteSender(
 		      options.get("union_station_gateway_address", false, DEFAULT_UNION_STATION_GATEWAY_ADDRESS),
 		      options.getInt("union_station_gateway_port", false, DEFAULT_UNION_STATION_GATEWAY_PORT),
 		      options.get("union_station_gateway_cert", false, ""),
-		      options.get("union_station_proxy_address", false, "")),
+		      options.get("union_station_proxy_address", false, ""),
+		      options.getUint("union_station_upload_workers", false,
+		          DEFAULT_UNION_STATION_UPLOAD_WORKERS),
+		      options.get("union_station_spill_dir", false, ""),
+		      (size_t) options.getUint("union_station_spill_limit", false,
+		          DEFAULT_UNION_STATION_SPILL_LIMIT) * 1024 * 1024),
 		  gcTimer(getLoop()),
 		  flushTimer(getLoop())
 	{
@@ -1178,56 +1318,59 @@ public:
 		return pos - buf;
 	}
 
-	virtual Json::Value inspectStateAsJson() const {
-		Json::Value doc = ParentClass::inspectStateAsJson();
-		doc["dev_mode"] = devMode;
-		doc["log_sink_cache"] = inspectLogSinkCacheStateAsJson();
-		doc["transactions"] = inspectTransactionsStateAsJson();
+	virtual void writeStateAsJson(JsonWriter &writer) const {
+		ParentClass::writeStateAsJson(writer);
+		writer.member("dev_mode", devMode);
+		writer.key("log_sink_cache");
+		writeLogSinkCacheStateAsJson(writer);
+		writer.key("transactions");
+		writeTransactionsStateAsJson(writer);
 		if (devMode) {
-			doc["dump_dir"] = dumpDir;
+			writer.member("dump_dir", dumpDir);
 		} else {
-			doc["remote_sender"] = remoteSender.inspectStateAsJson();
+			writer.member("remote_sender", remoteSender.inspectStateAsJson());
 		}
-		doc["default_node_name"] = defaultNodeName;
-		return doc;
+		writer.member("default_node_name", defaultNodeName);
 	}
 
-	virtual Json::Value inspectClientStateAsJson(const Client *client) const {
-		Json::Value doc = ParentClass::inspectClientStateAsJson(client);
-		doc["state"] = client->getStateName();
-		doc["type"] = client->getTypeName();
-		doc["node_name"] = client->nodeName;
-		doc["open_transactions_count"] = Json::UInt(client->openTransactions.size());
+	virtual void writeClientStateAsJson(JsonWriter &writer, const Client *client) const {
+		ParentClass::writeClientStateAsJson(writer, client);
+		writer.member("state", client->getStateName());
+		writer.member("type", client->getTypeName());
+		writer.member("node_name", client->nodeName);
+		writer.member("open_transactions_count",
+			(unsigned int) client->openTransactions.size());
 
-		Json::Value openTransactions(Json::arrayValue);
-		foreach (string txnId, client->openTransactions) {
-			openTransactions.append(txnId);
+		writer.key("open_transactions");
+		writer.beginArray();
+		foreach (const string &txnId, client->openTransactions) {
+			writer.value(txnId);
 		}
-		doc["open_transactions"] = openTransactions;
-
-		return doc;
+		writer.endArray();
 	}
 
-	Json::Value inspectLogSinkCacheStateAsJson() const {
-		Json::Value doc(Json::objectValue);
+	void writeLogSinkCacheStateAsJson(JsonWriter &writer) const {
 		LogSinkCache::const_iterator it;
 		LogSinkCache::const_iterator end = logSinkCache.end();
+
+		writer.beginObject();
 		for (it = logSinkCache.begin(); it != end; it++) {
 			const LogSinkPtr &logSink = it->second;
-			doc[createJsonKey(it->first)] = logSink->inspectStateAsJson();
+			writer.member(createJsonKey(it->first), logSink->inspectStateAsJson());
 		}
-		return doc;
+		writer.endObject();
 	}
 
-	Json::Value inspectTransactionsStateAsJson() const {
-		Json::Value doc(Json::objectValue);
+	void writeTransactionsStateAsJson(JsonWriter &writer) const {
 		TransactionMap::const_iterator it;
 		TransactionMap::const_iterator end = transactions.end();
+
+		writer.beginObject();
 		for (it = transactions.begin(); it != end; it++) {
 			const TransactionPtr &transaction = it->second;
-			doc[it->first.toString()] = transaction->inspectStateAsJson();
+			writer.member(it->first, transaction->inspectStateAsJson());
 		}
-		return doc;
+		writer.endObject();
 	}
 };
 
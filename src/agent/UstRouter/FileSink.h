@@ -28,10 +28,18 @@
 
 #include <string>
 #include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <oxt/system_calls.hpp>
+#include <Logging.h>
+#include <SmallVector.h>
 #include <Exceptions.h>
 #include <FileDescriptor.h>
+#include <MemoryKit/mbuf.h>
 #include <UstRouter/LogSink.h>
+#include <Utils/IOUtils.h>
 #include <Utils/StrIntUtils.h>
 
 namespace Passenger {
@@ -41,16 +49,32 @@ using namespace std;
 using namespace oxt;
 
 
+/**
+ * Appends transaction data to a file. The sink keeps references to the mbufs
+ * that hold the transaction bodies, without copying them, and writes them out
+ * with a single writev() when `bufferCapacity` bytes have been buffered, or
+ * when the Controller's flush timer flushes the sink. A `bufferCapacity` of 0
+ * writes every transaction immediately. Because the referenced mbufs may be
+ * partially filled, the memory held by the buffer may be larger than
+ * `bufferCapacity`.
+ *
+ * If `rotateSize` is non-zero, then the file is renamed to `<filename>.1`
+ * (replacing any previous one) once it has grown to at least that size, and
+ * a new file is started.
+ *
+ * Crash consistency: buffered data that has not been flushed yet is lost if
+ * the UstRouter crashes. Every flush is a single append, so transactions from
+ * different flushes are never interleaved, but a crash in the middle of a
+ * flush may leave a partial transaction at the end of the file. Flushed data
+ * is only guaranteed to survive an OS crash or power loss if `fsyncOnFlush`
+ * is set.
+ */
 class FileSink: public LogSink {
-public:
-	string filename;
-	FileDescriptor fd;
+private:
+	SmallVector<MemoryKit::mbuf, 16> buffers;
 
-	FileSink(Controller *controller, const string &_filename)
-		: LogSink(controller),
-		  filename(_filename)
-	{
-		fd.assign(syscalls::open(_filename.c_str(),
+	void openFile() {
+		fd.assign(syscalls::open(filename.c_str(),
 			O_CREAT | O_WRONLY | O_APPEND,
 			0600), __FILE__, __LINE__);
 		if (fd == -1) {
@@ -60,16 +84,114 @@ public:
 		}
 	}
 
+	void writeBuffers() {
+		SmallVector<StaticString, 16> data;
+		unsigned int i;
+
+		data.reserve(buffers.size());
+		for (i = 0; i < buffers.size(); i++) {
+			data.push_back(StaticString(buffers[i].start, buffers[i].size()));
+		}
+		writeData(&data[0], data.size());
+		buffers.clear();
+		bufferSize = 0;
+	}
+
+	void writeData(const StaticString data[], unsigned int count) {
+		try {
+			gatheredWrite(fd, data, count);
+			if (fsyncOnFlush && fsync(fd) == -1) {
+				int e = errno;
+				throw SystemException("fsync() failed", e);
+			}
+		} catch (const SystemException &e) {
+			P_ERROR("Cannot write to " << inspect() << ": " << e.what());
+		}
+		lastFlushed = ev_now(Controller_getLoop(controller));
+		if (rotateSize > 0) {
+			rotateIfNecessary();
+		}
+	}
+
+	void rotateIfNecessary() {
+		struct stat buf;
+
+		if (fstat(fd, &buf) == -1 || (size_t) buf.st_size < rotateSize) {
+			return;
+		}
+
+		string rotatedFilename = filename + ".1";
+		P_DEBUG("Rotating " << inspect() << " to " << rotatedFilename);
+		if (rename(filename.c_str(), rotatedFilename.c_str()) == -1) {
+			int e = errno;
+			P_ERROR("Cannot rename " << filename << " to " << rotatedFilename <<
+				": " << strerror(e) << " (errno=" << e << ")");
+			return;
+		}
+		fd.close(false);
+		openFile();
+	}
+
+	bool realFlush() {
+		if (bufferSize > 0) {
+			writeBuffers();
+			return true;
+		} else {
+			lastFlushed = ev_now(Controller_getLoop(controller));
+			return false;
+		}
+	}
+
+public:
+	string filename;
+	FileDescriptor fd;
+	size_t bufferCapacity;
+	size_t rotateSize;
+	bool fsyncOnFlush;
+	/** Amount of data buffered since the last flush. */
+	size_t bufferSize;
+
+	FileSink(Controller *controller, const string &_filename,
+		size_t _bufferCapacity = 0, size_t _rotateSize = 0,
+		bool _fsyncOnFlush = false)
+		: LogSink(controller),
+		  filename(_filename),
+		  bufferCapacity(_bufferCapacity),
+		  rotateSize(_rotateSize),
+		  fsyncOnFlush(_fsyncOnFlush),
+		  bufferSize(0)
+	{
+		openFile();
+	}
+
+	~FileSink() {
+		// Calling non-virtual flush method
+		realFlush();
+	}
+
 	virtual void append(const TransactionPtr &transaction) {
-		StaticString data = transaction->getBody();
+		unsigned int i, count = transaction->getBodyBufferCount();
+
 		LogSink::append(transaction);
-		syscalls::write(fd, data.data(), data.size());
+		for (i = 0; i < count; i++) {
+			buffers.push_back(transaction->getBodyBuffer(i));
+		}
+		bufferSize += transaction->getBodySize();
+		if (bufferSize > 0 && bufferSize >= bufferCapacity) {
+			writeBuffers();
+		}
+	}
+
+	virtual bool flush() {
+		return realFlush();
 	}
 
 	virtual Json::Value inspectStateAsJson() const {
 		Json::Value doc = LogSink::inspectStateAsJson();
 		doc["type"] = "file";
 		doc["filename"] = filename;
+		doc["buffer_size"] = byteSizeToJson(bufferSize);
+		doc["buffer_capacity"] = byteSizeToJson(bufferCapacity);
 		return doc;
 	}
 
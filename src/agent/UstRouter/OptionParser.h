@@ -69,6 +69,22 @@ ustRouterUsage() {
 	printf("      --dev-mode              Enable development mode: dump data to a directory\n");
 	printf("                              instead of sending them to the Union Station gateway\n");
 	printf("      --dump-dir  PATH        Directory to dump to\n");
+	printf("      --dump-buffer-size BYTES\n");
+	printf("                              Buffer up to this much data per dump file\n");
+	printf("                              before writing it. Default: 65536\n");
+	printf("      --dump-rotate-size BYTES\n");
+	printf("                              Rotate dump files once they reach this size.\n");
+	printf("                              Default: 0 (never)\n");
+	printf("      --dump-fsync            fsync() dump files after every write\n");
+	printf("      --upload-workers NUMBER Number of threads that upload data to the Union\n");
+	printf("                              Station gateway in parallel. Default: %d\n",
+		DEFAULT_UNION_STATION_UPLOAD_WORKERS);
+	printf("      --spill-dir PATH        Directory to store packets in while the Union\n");
+	printf("                              Station gateway is unreachable. Default: a\n");
+	printf("                              subdirectory of the instance directory\n");
+	printf("      --spill-limit MB        Maximum disk usage of the spill directory, in\n");
+	printf("                              megabytes. 0 disables spilling. Default: %d\n",
+		DEFAULT_UNION_STATION_SPILL_LIMIT);
 	printf("\n");
 	printf("Other options (optional):\n");
 	printf("      --user USERNAME         Lower privilege to the given user. Only has\n");
@@ -149,6 +165,24 @@ parseUstRouterOption(int argc, const char *argv[], int &i, VariantMap &options)
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--dump-dir")) {
 		options.set("ust_router_dump_dir", argv[i + 1]);
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--dump-buffer-size")) {
+		options.setUint("ust_router_dump_buffer_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--dump-rotate-size")) {
+		options.setULL("ust_router_dump_rotate_size", stringToULL(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--dump-fsync")) {
+		options.setBool("ust_router_dump_fsync", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--upload-workers")) {
+		options.setUint("union_station_upload_workers", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spill-dir")) {
+		options.set("union_station_spill_dir", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spill-limit")) {
+		options.setUint("union_station_spill_limit", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--user")) {
 		options.set("analytics_log_user", argv[i + 1]);
 		i += 2;
@@ -33,15 +33,20 @@
 #include <zlib.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <oxt/thread.hpp>
 #include <string>
 #include <list>
+#include <vector>
+#include <algorithm>
 #include <jsoncpp/json.h>
 #include <modp_b64.h>
 
 #include <Logging.h>
+#include <Constants.h>
 #include <StaticString.h>
 #include <Utils.h>
 #include <Utils/BlockingQueue.h>
@@ -49,6 +54,7 @@
 #include <Utils/ScopeGuard.h>
 #include <Utils/JsonUtils.h>
 #include <Utils/Curl.h>
+#include <UstRouter/SpillQueue.h>
 
 namespace Passenger {
 
@@ -109,21 +115,38 @@ private:
 		};
 
 	private:
+		/**
+		 * A CURL handle and its per-request state. A handle keeps its HTTP
+		 * connection alive between requests, so handles are pooled and
+		 * reused instead of being created for every request. Each upload
+		 * worker uses its own handle.
+		 */
+		struct Connection {
+			CURL *curl;
+			char lastCurlErrorMessage[CURL_ERROR_SIZE];
+			string responseBody;
+
+			Connection()
+				: curl(NULL)
+			{
+				lastCurlErrorMessage[0] = '\0';
+			}
+		};
+
 		string ip;
 		unsigned short port;
 		string certificate;
 		const CurlProxyInfo *proxyInfo;
+		CurlShare *curlShare;
 
-		CURL *curl;
 		struct curl_slist *headers;
-		char lastCurlErrorMessage[CURL_ERROR_SIZE];
 		string hostHeader;
-		string responseBody;
 
 		string pingURL;
 		string sinkURL;
 
 		mutable boost::mutex syncher;
+		vector<Connection *> idleConnections;
 		string lastErrorMessage;
 		unsigned long long lastErrorTime;
 		unsigned long long lastSuccessTime;
@@ -132,7 +155,8 @@ private:
 		unsigned int packetsRejected;
 		unsigned int packetsDropped;
 
-		void resetConnection() {
+		void resetConnection(Connection *conn) {
+			CURL *&curl = conn->curl;
 			if (curl != NULL) {
 				#ifdef HAS_CURL_EASY_RESET
 					curl_easy_reset(curl);
@@ -149,10 +173,10 @@ private:
 			}
 			curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
 			curl_easy_setopt(curl, CURLOPT_TIMEOUT, 180);
-			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, lastCurlErrorMessage);
+			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, conn->lastCurlErrorMessage);
 			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlDataReceived);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, conn);
 			if (certificate.empty()) {
 				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
 			} else {
@@ -165,12 +189,38 @@ private:
 			 */
 			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
 			setCurlProxy(curl, *proxyInfo);
-			responseBody.clear();
+			curlShare->apply(curl);
+			conn->responseBody.clear();
+		}
+
+		Connection *checkoutConnection() {
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				if (!idleConnections.empty()) {
+					Connection *conn = idleConnections.back();
+					idleConnections.pop_back();
+					return conn;
+				}
+			}
+
+			Connection *conn = new Connection();
+			try {
+				resetConnection(conn);
+			} catch (...) {
+				delete conn;
+				throw;
+			}
+			return conn;
+		}
+
+		void checkinConnection(Connection *conn) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			idleConnections.push_back(conn);
 		}
 
-		void prepareRequest(const string &url) {
-			curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-			responseBody.clear();
+		void prepareRequest(Connection *conn, const string &url) {
+			curl_easy_setopt(conn->curl, CURLOPT_URL, url.c_str());
+			conn->responseBody.clear();
 		}
 
 		static bool validateResponse(const Json::Value &response) {
@@ -188,12 +238,13 @@ private:
 			}
 		}
 
-		SendResult handleSendResponse(const Item &item) {
+		SendResult handleSendResponse(Connection *conn, const Item &item) {
+			const string &responseBody = conn->responseBody;
 			Json::Reader reader;
 			Json::Value response;
 			long httpCode = -1;
 
-			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+			curl_easy_getinfo(conn->curl, CURLINFO_RESPONSE_CODE, &httpCode);
 
 			if (!reader.parse(responseBody, response, false) || !validateResponse(response)) {
 				setRequestError(
@@ -232,11 +283,11 @@ private:
 			}
 		}
 
-		void handleSendError(const Item &item) {
+		void handleSendError(Connection *conn, const Item &item) {
 			setRequestError(
 				"Could not send data to Union Station gateway server " +
 				ip + ". It might be down. Key: " + item.unionStationKey +
-				". Error: " + lastCurlErrorMessage);
+				". Error: " + conn->lastCurlErrorMessage);
 		}
 
 		void setPingError(const string &message) {
@@ -281,19 +332,21 @@ private:
 		}
 
 		static size_t curlDataReceived(void *buffer, size_t size, size_t nmemb, void *userData) {
-			Server *self = (Server *) userData;
-			self->responseBody.append((const char *) buffer, size * nmemb);
+			Connection *conn = (Connection *) userData;
+			conn->responseBody.append((const char *) buffer, size * nmemb);
 			return size * nmemb;
 		}
 
 	public:
 		Server(const string &ip, const string &hostName, unsigned short port,
-			const string &cert, const CurlProxyInfo *proxyInfo)
+			const string &cert, const CurlProxyInfo *proxyInfo,
+			CurlShare *curlShare)
 		{
 			this->ip = ip;
 			this->port = port;
 			this->certificate = cert;
 			this->proxyInfo = proxyInfo;
+			this->curlShare = curlShare;
 
 			hostHeader = "Host: " + hostName;
 			headers = NULL;
@@ -309,19 +362,20 @@ private:
 			sinkURL = string("https://") + ip + ":" + toString(port) +
 				"/sink";
 
-			curl = NULL;
 			lastErrorTime = 0;
 			lastSuccessTime = 0;
 			pingErrors = 0;
 			packetsAccepted = 0;
 			packetsRejected = 0;
 			packetsDropped = 0;
-			resetConnection();
 		}
 
 		~Server() {
-			if (curl != NULL) {
-				curl_easy_cleanup(curl);
+			foreach (Connection *conn, idleConnections) {
+				if (conn->curl != NULL) {
+					curl_easy_cleanup(conn->curl);
+				}
+				delete conn;
 			}
 			curl_slist_free_all(headers);
 		}
@@ -332,31 +386,35 @@ private:
 
 		bool ping() {
 			P_INFO("Pinging Union Station gateway " << ip << ":" << port);
-			ScopeGuard guard(boost::bind(&Server::resetConnection, this));
-			prepareRequest(pingURL);
+			Connection *conn = checkoutConnection();
+			ScopeGuard checkinGuard(boost::bind(&Server::checkinConnection, this, conn));
+			ScopeGuard guard(boost::bind(&Server::resetConnection, this, conn));
+			prepareRequest(conn, pingURL);
 
-			curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
-			if (curl_easy_perform(curl) != 0) {
+			curl_easy_setopt(conn->curl, CURLOPT_HTTPGET, 1);
+			if (curl_easy_perform(conn->curl) != 0) {
 				setPingError(
 					"Could not ping Union Station gateway server " +
-					ip + ": " + lastCurlErrorMessage);
+					ip + ": " + conn->lastCurlErrorMessage);
 				return false;
 			}
-			if (responseBody == "pong") {
+			if (conn->responseBody == "pong") {
 				guard.clear();
 				return true;
 			} else {
 				setPingError(
 					"Union Station gateway server " + ip +
 					" returned an unexpected ping message: " +
-					responseBody);
+					conn->responseBody);
 				return false;
 			}
 		}
 
 		SendResult send(const Item &item) {
-			ScopeGuard guard(boost::bind(&Server::resetConnection, this));
-			prepareRequest(sinkURL);
+			Connection *conn = checkoutConnection();
+			ScopeGuard checkinGuard(boost::bind(&Server::checkinConnection, this, conn));
+			ScopeGuard guard(boost::bind(&Server::resetConnection, this, conn));
+			prepareRequest(conn, sinkURL);
 
 			struct curl_httppost *post = NULL;
 			struct curl_httppost *last = NULL;
@@ -401,19 +459,19 @@ private:
 					CURLFORM_END);
 			}
 
-			curl_easy_setopt(curl, CURLOPT_HTTPGET, 0);
-			curl_easy_setopt(curl, CURLOPT_HTTPPOST, post);
+			curl_easy_setopt(conn->curl, CURLOPT_HTTPGET, 0);
+			curl_easy_setopt(conn->curl, CURLOPT_HTTPPOST, post);
 			P_DEBUG("Sending Union Station packet: key=" << item.unionStationKey <<
 				", node=" << item.nodeName << ", category=" << item.category <<
 				", compressedDataSize=" << item.data.size());
-			CURLcode code = curl_easy_perform(curl);
+			CURLcode code = curl_easy_perform(conn->curl);
 			curl_formfree(post);
 
 			if (code == CURLE_OK) {
 				guard.clear();
-				return handleSendResponse(item);
+				return handleSendResponse(conn, item);
 			} else {
-				handleSendError(item);
+				handleSendError(conn, item);
 				return SR_DOWN;
 			}
 		}
@@ -445,6 +503,7 @@ private:
 
 			doc["errors"] = errorDoc;
 			doc["packets_accepted"] = packetsAccepted;
+			doc["idle_connections"] = (Json::UInt) idleConnections.size();
 
 			return doc;
 		}
@@ -452,19 +511,132 @@ private:
 
 	typedef boost::shared_ptr<Server> ServerPtr;
 
+	static const unsigned int QUEUE_CAPACITY = 1024;
+
 	string gatewayAddress;
 	unsigned short gatewayPort;
 	string certificate;
 	CurlProxyInfo proxyInfo;
+	/**
+	 * Shared by the handles of all servers, so that the servers found by
+	 * every checkup can resume the TLS sessions of earlier ones.
+	 */
+	CurlShare curlShare;
 	BlockingQueue<Item> queue;
-	oxt::thread *thr;
+	vector<oxt::thread *> threads;
 
 	mutable boost::mutex syncher;
+	boost::condition_variable checkupFinished;
 	list<ServerPtr> upServers;
 	vector<ServerPtr> downServers;
 	time_t lastCheckupTime, nextCheckupTime;
+	/** Whether an upload worker is currently rechecking the servers. */
+	bool checkingServers;
 	string lastDnsErrorMessage;
 	unsigned int packetsAccepted, packetsRejected, packetsDropped;
+	/** Packets that were dropped because the queue was full. Also counted
+	 * in packetsDropped. */
+	unsigned int packetsDroppedQueueFull;
+	unsigned int runningWorkers, busyWorkers;
+	unsigned int peakQueueSize;
+	/** Packets that could not be delivered, and were spilled to disk instead
+	 * of being dropped. NULL if spilling is disabled. */
+	boost::scoped_ptr<UstRouter::SpillQueue> spillQueue;
+	unsigned int packetsSpilled;
+
+	static void appendField(string &output, const StaticString &field) {
+		boost::uint32_t size = htonl((boost::uint32_t) field.size());
+		output.append((const char *) &size, sizeof(size));
+		output.append(field.data(), field.size());
+	}
+
+	static bool parseField(StaticString &input, string &field) {
+		boost::uint32_t size;
+
+		if (input.size() < sizeof(size)) {
+			return false;
+		}
+		memcpy(&size, input.data(), sizeof(size));
+		size = ntohl(size);
+		input = input.substr(sizeof(size));
+		if (input.size() < size) {
+			return false;
+		}
+		field.assign(input.data(), size);
+		input = input.substr(size);
+		return true;
+	}
+
+	static string serializeItem(const Item &item) {
+		string result;
+		result.reserve(4 * 4 + 1 + item.unionStationKey.size() + item.nodeName.size()
+			+ item.category.size() + item.data.size());
+		result.append(1, item.compressed ? '1' : '0');
+		appendField(result, item.unionStationKey);
+		appendField(result, item.nodeName);
+		appendField(result, item.category);
+		appendField(result, item.data);
+		return result;
+	}
+
+	static bool deserializeItem(const StaticString &record, Item &item) {
+		StaticString input = record;
+
+		if (input.empty()) {
+			return false;
+		}
+		item.compressed = input[0] == '1';
+		input = input.substr(1);
+		return parseField(input, item.unionStationKey)
+			&& parseField(input, item.nodeName)
+			&& parseField(input, item.category)
+			&& parseField(input, item.data)
+			&& input.empty();
+	}
+
+	/**
+	 * Stores an item that could not be delivered in the spill queue, so
+	 * that it is sent once the gateway becomes reachable again. Returns
+	 * false if the item must be dropped.
+	 */
+	bool spill(const Item &item) {
+		if (spillQueue != NULL && spillQueue->push(serializeItem(item))) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			packetsSpilled++;
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	/**
+	 * Whether there are spilled items, and servers that are up to send
+	 * them to.
+	 */
+	bool shouldDrainSpillQueue() const {
+		if (spillQueue == NULL || spillQueue->empty()) {
+			return false;
+		}
+		boost::lock_guard<boost::mutex> l(syncher);
+		return !checkingServers && !upServers.empty();
+	}
+
+	/**
+	 * Sends out the oldest spilled item, if any. If it cannot be
+	 * delivered then sendOut() spills it again.
+	 */
+	void drainSpilledItem() {
+		string record;
+		Item item;
+
+		if (spillQueue->pop(record)) {
+			if (deserializeItem(record, item)) {
+				sendOut(item);
+			} else {
+				P_WARN("Discarding malformed spilled Union Station packet");
+			}
+		}
+	}
 
 	void threadMain() {
 		ScopeGuard guard(boost::bind(&RemoteSender::freeThreadData, this));
@@ -472,8 +644,13 @@ private:
 		while (true) {
 			Item item;
 			bool hasItem;
+			bool drain = shouldDrainSpillQueue();
 
-			if (firstStarted()) {
+			if (drain) {
+				// Items in the queue take precedence, but keep draining
+				// the spill queue in between.
+				hasItem = queue.tryGet(item);
+			} else if (firstStarted() && (spillQueue == NULL || spillQueue->empty())) {
 				item = queue.get();
 				hasItem = true;
 			} else {
@@ -484,14 +661,33 @@ private:
 				if (item.exit) {
 					return;
 				} else {
-					if (timeForCheckup()) {
+					if (beginCheckup()) {
 						recheckServers();
 					}
 					sendOut(item);
 				}
-			} else if (timeForCheckup()) {
+			} else if (beginCheckup()) {
 				recheckServers();
 			}
+
+			if (drain) {
+				drainSpilledItem();
+			}
+		}
+	}
+
+	/**
+	 * Returns whether it is time for a checkup. If so, then the caller
+	 * must perform it by calling recheckServers(). Only one upload
+	 * worker performs a checkup at a time.
+	 */
+	bool beginCheckup() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		if (checkingServers || SystemTime::get() < nextCheckupTime) {
+			return false;
+		} else {
+			checkingServers = true;
+			return true;
 		}
 	}
 
@@ -501,6 +697,7 @@ private:
 	}
 
 	void recheckServers() {
+		ScopeGuard guard(boost::bind(&RemoteSender::endCheckup, this));
 		P_INFO("Rechecking Union Station gateway servers (" << gatewayAddress << ")...");
 
 		vector<string> ips;
@@ -512,13 +709,13 @@ private:
 			ips = resolveHostname(gatewayAddress, gatewayPort);
 		} catch (const tracable_exception &e) {
 			P_ERROR(e.what());
+			boost::lock_guard<boost::mutex> l(syncher);
 			// DNS errors tend to be temporary, so retry
 			// after a short timeout.
 			scheduleNextCheckup(1 * 60);
 			// Take note of the error, but do not change the server
 			// list so that the RemoteSender can keep working with
 			// the last known server list.
-			boost::lock_guard<boost::mutex> l(syncher);
 			this->lastCheckupTime = SystemTime::get();
 			this->lastDnsErrorMessage = e.what();
 			return;
@@ -530,7 +727,7 @@ private:
 		for (it = ips.begin(); it != ips.end(); it++) {
 			ServerPtr server = boost::make_shared<Server>(
 				*it, gatewayAddress, gatewayPort, certificate,
-				&proxyInfo);
+				&proxyInfo, &curlShare);
 			if (server->ping()) {
 				upServers.push_back(server);
 			} else {
@@ -539,6 +736,7 @@ private:
 		}
 		P_INFO(upServers.size() << " Union Station gateway servers are up");
 
+		boost::lock_guard<boost::mutex> l(syncher);
 		if (downServers.empty()) {
 			if (upServers.empty()) {
 				// The DNS lookup was successful, but returned no results.
@@ -560,24 +758,32 @@ private:
 			scheduleNextCheckup(1 * 60);
 		}
 
-		boost::lock_guard<boost::mutex> l(syncher);
 		this->lastCheckupTime = SystemTime::get();
 		this->upServers = upServers;
 		this->downServers = downServers;
 		this->lastDnsErrorMessage.clear();
 	}
 
+	void endCheckup() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		checkingServers = false;
+		checkupFinished.notify_all();
+	}
+
 	void freeThreadData() {
 		boost::lock_guard<boost::mutex> l(syncher);
-		// Invoke destructors inside this thread.
-		upServers.clear();
-		downServers.clear();
+		runningWorkers--;
+		if (runningWorkers == 0) {
+			// Invoke destructors inside an upload worker.
+			upServers.clear();
+			downServers.clear();
+		}
 	}
 
 	/**
 	 * Schedules the next checkup to be run after the given number
 	 * of seconds, unless there's already a checkup scheduled for
-	 * earlier.
+	 * earlier. The caller must hold the lock.
 	 */
 	void scheduleNextCheckup(unsigned int seconds) {
 		time_t now = SystemTime::get();
@@ -597,11 +803,6 @@ private:
 		}
 	}
 
-	bool timeForCheckup() const {
-		boost::lock_guard<boost::mutex> l(syncher);
-		return SystemTime::get() >= nextCheckupTime;
-	}
-
 	void sendOut(const Item &item) {
 		boost::unique_lock<boost::mutex> l(syncher);
 		bool done = false;
@@ -609,28 +810,40 @@ private:
 		bool rejected = false;
 		bool upServersEmpty;
 
+		// Don't drop the item just because another worker is still
+		// finding out which servers are up.
+		while (checkingServers) {
+			checkupFinished.wait(l);
+		}
+		busyWorkers++;
+
 		while (!done && !upServers.empty()) {
 			// Pick first available server and put it on the back of the list
-			// for round-robin load balancing.
+			// for round-robin load balancing. This is done before sending, so
+			// that concurrent upload workers pick different servers.
 			ServerPtr server = upServers.front();
+			upServers.pop_front();
+			upServers.push_back(server);
 
 			l.unlock();
 			Server::SendResult result = server->send(item);
 			l.lock();
 
 			if (result == Server::SR_OK) {
-				upServers.pop_front();
-				upServers.push_back(server);
 				accepted = true;
 				done = true;
 			} else if (result == Server::SR_REJECTED) {
-				upServers.pop_front();
-				upServers.push_back(server);
 				rejected = true;
 				done = true;
 			} else {
-				upServers.pop_front();
-				downServers.push_back(server);
+				// Another worker, or a checkup, may have already
+				// moved the server.
+				list<ServerPtr>::iterator it = std::find(upServers.begin(),
+					upServers.end(), server);
+				if (it != upServers.end()) {
+					upServers.erase(it);
+					downServers.push_back(server);
+				}
 			}
 		}
 
@@ -645,11 +858,10 @@ private:
 			packetsAccepted++;
 		} else if (rejected) {
 			packetsRejected++;
-		} else {
-			packetsDropped++;
 		}
 
 		upServersEmpty = upServers.empty();
+		busyWorkers--;
 
 		l.unlock();
 
@@ -658,9 +870,21 @@ private:
 			(void) upServersEmpty; // Avoid compiler warning
 
 			/* If all servers went down then all items in the queue will be
-			 * effectively dropped until after the next checkup has detected
-			 * servers that are up.
+			 * spilled, or effectively dropped if spilling is disabled,
+			 * until after the next checkup has detected servers that are up.
 			 */
+			if (spill(item)) {
+				P_DEBUG("Spilling Union Station packet because no servers are"
+					" available: key=" << item.unionStationKey <<
+					", node=" << item.nodeName <<
+					", category=" << item.category <<
+					", compressedDataSize=" << item.data.size());
+				return;
+			}
+
+			l.lock();
+			packetsDropped++;
+			l.unlock();
 			P_WARN("Dropping Union Station packet because no servers are"
 				" available. Run `passenger-status --show=union_station` to"
 				" view server status. Details of dropped packet:"
@@ -727,10 +951,39 @@ private:
 		return doc;
 	}
 
+	void scheduleItem(const Item &item) {
+		P_DEBUG("Scheduling Union Station packet: key=" << item.unionStationKey <<
+			", node=" << item.nodeName << ", category=" << item.category <<
+			", compressedDataSize=" << item.data.size());
+
+		if (queue.tryAdd(item)) {
+			unsigned int size = queue.size();
+			boost::lock_guard<boost::mutex> l(syncher);
+			if (size > peakQueueSize) {
+				peakQueueSize = size;
+			}
+		} else if (!spill(item)) {
+			P_WARN("The Union Station gateway isn't responding quickly enough; dropping packet.");
+			boost::lock_guard<boost::mutex> l(syncher);
+			packetsDropped++;
+			packetsDroppedQueueFull++;
+		}
+	}
+
 public:
+	/**
+	 * Items are uploaded by `uploadWorkers` threads in parallel, so that
+	 * a slow gateway does not make the queue fill up as quickly.
+	 *
+	 * If `spillDir` is not empty, then items that cannot be delivered
+	 * or queued are spilled to that directory, using at most
+	 * `spillLimit` bytes, and are sent later.
+	 */
 	RemoteSender(const string &gatewayAddress, unsigned short gatewayPort,
-		const string &certificate, const string &proxyAddress)
-		: queue(1024)
+		const string &certificate, const string &proxyAddress,
+		unsigned int uploadWorkers = DEFAULT_UNION_STATION_UPLOAD_WORKERS,
+		const string &spillDir = string(), size_t spillLimit = 0)
+		: queue(QUEUE_CAPACITY)
 	{
 		TRACE_POINT();
 		this->gatewayAddress = gatewayAddress;
@@ -744,27 +997,45 @@ public:
 		}
 		lastCheckupTime = 0;
 		nextCheckupTime = 0;
+		checkingServers = false;
 		packetsAccepted = 0;
 		packetsRejected = 0;
 		packetsDropped = 0;
-		thr = new oxt::thread(
-			boost::bind(&RemoteSender::threadMain, this),
-			"RemoteSender thread",
-			1024 * 512
-		);
+		packetsDroppedQueueFull = 0;
+		busyWorkers = 0;
+		peakQueueSize = 0;
+		packetsSpilled = 0;
+		if (!spillDir.empty() && spillLimit > 0) {
+			spillQueue.reset(new UstRouter::SpillQueue(spillDir, spillLimit));
+		}
+		if (uploadWorkers == 0) {
+			uploadWorkers = 1;
+		}
+		runningWorkers = uploadWorkers;
+		for (unsigned int i = 0; i < uploadWorkers; i++) {
+			threads.push_back(new oxt::thread(
+				boost::bind(&RemoteSender::threadMain, this),
+				"RemoteSender thread " + toString(i + 1),
+				1024 * 512
+			));
+		}
 	}
 
 	~RemoteSender() {
 		Item item;
 		item.exit = true;
-		queue.add(item);
-		/* Wait until the thread sends out all queued items.
+		for (unsigned int i = 0; i < threads.size(); i++) {
+			queue.add(item);
+		}
+		/* Wait until the threads send out all queued items.
 		 * If this cannot be done within a short amount of time,
 		 * e.g. because all servers are down, then we'll get killed
 		 * by the watchdog anyway.
 		 */
-		thr->join();
-		delete thr;
+		foreach (oxt::thread *thr, threads) {
+			thr->join();
+			delete thr;
+		}
 	}
 
 	void schedule(const string &unionStationKey, const StaticString &nodeName,
@@ -792,15 +1063,25 @@ public:
 			}
 		}
 
-		P_DEBUG("Scheduling Union Station packet: key=" << unionStationKey <<
-			", node=" << nodeName << ", category=" << category <<
-			", compressedDataSize=" << item.data.size());
+		scheduleItem(item);
+	}
 
-		if (!queue.tryAdd(item)) {
-			P_WARN("The Union Station gateway isn't responding quickly enough; dropping packet.");
-			boost::lock_guard<boost::mutex> l(syncher);
-			packetsDropped++;
-		}
+	/**
+	 * Schedules data that the caller has already compressed, e.g. with
+	 * a long-lived deflate stream. The contents of `data` are moved
+	 * into the queue, leaving `data` empty.
+	 */
+	void scheduleCompressed(const string &unionStationKey, const StaticString &nodeName,
+		const StaticString &category, string &data)
+	{
+		Item item;
+
+		item.unionStationKey = unionStationKey;
+		item.nodeName = nodeName;
+		item.category = category;
+		item.compressed = true;
+		item.data.swap(data);
+		scheduleItem(item);
 	}
 
 	unsigned int queued() const {
@@ -813,9 +1094,18 @@ public:
 		doc["up_servers"] = inspectUpServersStateAsJson();
 		doc["down_servers"] = inspectDownServersStateAsJson();
 		doc["queue_size"] = queue.size();
+		doc["queue_capacity"] = QUEUE_CAPACITY;
+		doc["peak_queue_size"] = peakQueueSize;
+		doc["upload_workers"] = (Json::UInt) threads.size();
+		doc["busy_upload_workers"] = busyWorkers;
 		doc["packets_accepted"] = packetsAccepted;
 		doc["packets_rejected"] = packetsRejected;
 		doc["packets_dropped"] = packetsDropped;
+		doc["packets_dropped_queue_full"] = packetsDroppedQueueFull;
+		doc["packets_spilled"] = packetsSpilled;
+		if (spillQueue != NULL) {
+			doc["spill_queue"] = spillQueue->inspectStateAsJson();
+		}
 		if (certificate.empty()) {
 			doc["certificate"] = Json::nullValue;
 		} else {
@@ -29,6 +29,8 @@
 #include <string>
 #include <cstring>
 #include <ctime>
+#include <cassert>
+#include <zlib.h>
 #include <ev++.h>
 #include <Logging.h>
 #include <UstRouter/LogSink.h>
@@ -45,14 +47,73 @@ inline RemoteSender &Controller_getRemoteSender(Controller *controller);
 
 class RemoteSink: public LogSink {
 private:
+	/**
+	 * Appended data is compressed into `output` right away, instead of
+	 * all at once when the sink is flushed. The deflate stream is reset
+	 * and reused after every flush, so that its state does not have to
+	 * be allocated and initialized again.
+	 */
+	z_stream stream;
+	/** Whether `stream` could be initialized. If not, then `output`
+	 * contains uncompressed data, and RemoteSender compresses it. */
+	bool compressing;
+	string output;
+
+	void initializeStream() {
+		stream.zalloc = Z_NULL;
+		stream.zfree  = Z_NULL;
+		stream.opaque = Z_NULL;
+		compressing = deflateInit(&stream, Z_DEFAULT_COMPRESSION) == Z_OK;
+		if (!compressing) {
+			P_WARN("Cannot initialize a deflate stream for " << inspect() <<
+				"; compressing data at flush time instead");
+		}
+	}
+
+	void feed(const StaticString &data, int flush) {
+		if (!compressing) {
+			output.append(data.data(), data.size());
+			return;
+		}
+
+		char out[16 * 1024];
+		int ret;
+
+		stream.next_in  = (Bytef *) data.data();
+		stream.avail_in = data.size();
+		do {
+			stream.next_out  = (Bytef *) out;
+			stream.avail_out = sizeof(out);
+			ret = deflate(&stream, flush);
+			assert(ret != Z_STREAM_ERROR);
+			output.append(out, sizeof(out) - stream.avail_out);
+		} while (stream.avail_out == 0);
+		assert(stream.avail_in == 0);
+		assert(flush != Z_FINISH || ret == Z_STREAM_END);
+		(void) ret; // Avoid compiler warning
+	}
+
+	void sendOutput() {
+		RemoteSender &sender = Controller_getRemoteSender(controller);
+
+		if (compressing) {
+			feed(StaticString(), Z_FINISH);
+			sender.scheduleCompressed(unionStationKey, nodeName, category,
+				output);
+			deflateReset(&stream);
+		} else {
+			StaticString data(output);
+			sender.schedule(unionStationKey, nodeName, category, &data, 1);
+		}
+		output.clear();
+		lastFlushed = ev_now(Controller_getLoop(controller));
+		bufferSize = 0;
+	}
+
 	bool realFlush() {
 		if (bufferSize > 0) {
 			P_DEBUG("Flushing " << inspect() << ": " << bufferSize << " bytes");
-			lastFlushed = ev_now(Controller_getLoop(controller));
-			StaticString data(buffer, bufferSize);
-			Controller_getRemoteSender(controller).schedule(unionStationKey,
-				nodeName, category, &data, 1);
-			bufferSize = 0;
+			sendOutput();
 			return true;
 		} else {
 			P_DEBUG("Flushing remote sink " << inspect() << ": 0 bytes");
@@ -61,8 +122,8 @@ private:
 	}
 
 public:
-	/* RemoteSender compresses the data with zlib before sending it
-	 * to the server. Even including Base64 and URL encoding overhead,
+	/* RemoteSender sends the data compressed with zlib to the server.
+	 * Even including Base64 and URL encoding overhead,
 	 * this compresses the data to about 25% of its original size.
 	 * Therefore we set a buffer capacity of a little less than 4 times
 	 * the TCP maximum segment size so that we can send as much
@@ -80,7 +141,7 @@ public:
 	string unionStationKey;
 	string nodeName;
 	string category;
-	char buffer[BUFFER_CAPACITY];
+	/** Amount of uncompressed data appended since the last flush. */
 	unsigned int bufferSize;
 
 	RemoteSink(Controller *controller, const string &_unionStationKey,
@@ -90,11 +151,16 @@ public:
 		  nodeName(_nodeName),
 		  category(_category),
 		  bufferSize(0)
-		{ }
+	{
+		initializeStream();
+	}
 
 	~RemoteSink() {
 		// Calling non-virtual flush method
 		realFlush();
+		if (compressing) {
+			deflateEnd(&stream);
+		}
 	}
 
 	virtual bool isRemote() const {
@@ -102,20 +168,15 @@ public:
 	}
 
 	virtual void append(const TransactionPtr &transaction) {
-		StaticString data = transaction->getBody();
+		unsigned int i, count = transaction->getBodyBufferCount();
+
 		LogSink::append(transaction);
-		if (bufferSize + data.size() > BUFFER_CAPACITY) {
-			StaticString data2[] = {
-				StaticString(buffer, bufferSize),
-				data
-			};
-			Controller_getRemoteSender(controller).schedule(unionStationKey,
-				nodeName, category, data2, 2);
-			lastFlushed = ev_now(Controller_getLoop(controller));
-			bufferSize = 0;
-		} else {
-			memcpy(buffer + bufferSize, data.data(), data.size());
-			bufferSize += data.size();
+		for (i = 0; i < count; i++) {
+			feed(transaction->getBodyData(i), Z_NO_FLUSH);
+		}
+		bufferSize += transaction->getBodySize();
+		if (bufferSize > BUFFER_CAPACITY) {
+			sendOutput();
 		}
 	}
 
@@ -130,6 +191,7 @@ public:
 		doc["node"] = nodeName;
 		doc["category"] = category;
 		doc["buffer_size"] = byteSizeToJson(bufferSize);
+		doc["compressed_buffer_size"] = byteSizeToJson(output.size());
 		return doc;
 	}
 
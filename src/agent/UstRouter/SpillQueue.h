@@ -0,0 +1,494 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_UST_ROUTER_SPILL_QUEUE_H_
+#define _PASSENGER_UST_ROUTER_SPILL_QUEUE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/foreach.hpp>
+#include <oxt/system_calls.hpp>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <jsoncpp/json.h>
+
+#include <Logging.h>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+#include <StaticString.h>
+#include <Utils.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/JsonUtils.h>
+
+namespace Passenger {
+namespace UstRouter {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * A persistent FIFO queue of opaque records, stored in a directory as a
+ * series of append-only segment files. The RemoteSender spills packets
+ * into it when it cannot deliver them, and drains it once the gateway
+ * is reachable again.
+ *
+ * Records are appended to the newest segment. Every record is prefixed
+ * with a magic number, its size and a CRC32 checksum, so that a segment
+ * that was truncated or damaged (e.g. because the UstRouter was killed
+ * in the middle of a write) is detected instead of yielding garbage.
+ * The oldest segment is memory mapped for reading, and is deleted once
+ * all its records have been consumed.
+ *
+ * The total size of the segment files is bounded by `sizeLimit`. When a
+ * new record would not fit, whole segments are dropped, oldest first.
+ *
+ * Writes are not fsynced: the queue is meant to survive network outages
+ * and UstRouter restarts, not machine crashes. A record that was popped
+ * but not delivered may be pushed again by the caller, so delivery is
+ * at-least-once.
+ *
+ * This class is thread-safe.
+ */
+class SpillQueue {
+private:
+	static const boost::uint32_t RECORD_MAGIC = 0x55535131; // "USQ1"
+	static const unsigned int HEADER_SIZE = 12;
+
+	struct Segment {
+		unsigned long long number;
+		string path;
+		/** Size of the segment file. */
+		size_t size;
+		/** Number of records in this segment that have not been popped yet. */
+		unsigned int records;
+	};
+
+	const string dir;
+	const size_t sizeLimit;
+	const size_t segmentSize;
+
+	mutable boost::mutex syncher;
+	/** Oldest segment first. */
+	deque<Segment> segments;
+	unsigned long long nextSegmentNumber;
+	size_t totalSize;
+	unsigned int totalRecords;
+	unsigned int recordsDropped;
+	unsigned int recordsCorrupted;
+
+	/** Open for appending to segments.back(), or -1 if that segment is sealed. */
+	FileDescriptor writeFd;
+
+	/** The memory mapping of segments.front(), or NULL. */
+	const char *readMap;
+	size_t readMapSize;
+	size_t readOffset;
+
+
+	static size_t calculateSegmentSize(size_t sizeLimit) {
+		size_t result = sizeLimit / 8;
+		if (result > 4 * 1024 * 1024) {
+			result = 4 * 1024 * 1024;
+		} else if (result < 64 * 1024) {
+			result = 64 * 1024;
+		}
+		return result;
+	}
+
+	static void generateHeader(char *buf, const StaticString &record) {
+		boost::uint32_t checksum = crc32(0, (const Bytef *) record.data(),
+			record.size());
+		boost::uint32_t fields[3] = {
+			htonl(RECORD_MAGIC),
+			htonl((boost::uint32_t) record.size()),
+			htonl(checksum)
+		};
+		memcpy(buf, fields, HEADER_SIZE);
+	}
+
+	/**
+	 * Parses the record at `offset` in the given segment data. Returns
+	 * whether it is intact, and if so, sets `record` to point to its data.
+	 */
+	static bool parseRecord(const char *data, size_t size, size_t offset,
+		StaticString &record, bool verifyChecksum = true)
+	{
+		boost::uint32_t fields[3];
+
+		if (size - offset < HEADER_SIZE) {
+			return false;
+		}
+		memcpy(fields, data + offset, HEADER_SIZE);
+		if (ntohl(fields[0]) != RECORD_MAGIC) {
+			return false;
+		}
+
+		size_t recordSize = ntohl(fields[1]);
+		if (size - offset - HEADER_SIZE < recordSize) {
+			return false;
+		}
+		record = StaticString(data + offset + HEADER_SIZE, recordSize);
+		return !verifyChecksum
+			|| crc32(0, (const Bytef *) record.data(), recordSize) == ntohl(fields[2]);
+	}
+
+	static bool parseSegmentNumber(const char *name, unsigned long long &number) {
+		if (strncmp(name, "segment-", sizeof("segment-") - 1) != 0) {
+			return false;
+		}
+		name += sizeof("segment-") - 1;
+		if (*name == '\0' || strspn(name, "0123456789") != strlen(name)) {
+			return false;
+		}
+		number = stringToULL(name);
+		return true;
+	}
+
+	string segmentPath(unsigned long long number) const {
+		char name[sizeof("segment-") + 20];
+		snprintf(name, sizeof(name), "segment-%010llu", number);
+		return dir + "/" + name;
+	}
+
+	/**
+	 * Maps the given file into memory. Returns NULL if it is empty or
+	 * could not be mapped.
+	 */
+	static const char *mapFile(const string &path, size_t &size) {
+		FileDescriptor fd(syscalls::open(path.c_str(), O_RDONLY),
+			__FILE__, __LINE__);
+		struct stat buf;
+
+		if (fd == -1) {
+			int e = errno;
+			P_WARN("Cannot open Union Station spill segment " << path <<
+				": " << strerror(e) << " (errno=" << e << ")");
+			return NULL;
+		}
+		if (fstat(fd, &buf) == -1 || buf.st_size == 0) {
+			return NULL;
+		}
+
+		void *result = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (result == MAP_FAILED) {
+			int e = errno;
+			P_WARN("Cannot map Union Station spill segment " << path <<
+				": " << strerror(e) << " (errno=" << e << ")");
+			return NULL;
+		}
+		size = buf.st_size;
+		return (const char *) result;
+	}
+
+	/**
+	 * Scans the segments that a previous UstRouter instance left behind,
+	 * oldest first.
+	 */
+	void loadSegments() {
+		DIR *d = opendir(dir.c_str());
+		struct dirent *ent;
+		vector<unsigned long long> numbers;
+		unsigned long long number;
+
+		if (d == NULL) {
+			int e = errno;
+			throw FileSystemException("Cannot open directory " + dir, e, dir);
+		}
+		while ((ent = readdir(d)) != NULL) {
+			if (parseSegmentNumber(ent->d_name, number)) {
+				numbers.push_back(number);
+			}
+		}
+		closedir(d);
+		std::sort(numbers.begin(), numbers.end());
+
+		foreach (number, numbers) {
+			Segment segment;
+			const char *data;
+			size_t size = 0, offset = 0;
+			StaticString record;
+
+			segment.number = number;
+			segment.path = segmentPath(number);
+			segment.size = 0;
+			segment.records = 0;
+			nextSegmentNumber = number + 1;
+
+			data = mapFile(segment.path, size);
+			if (data != NULL) {
+				// Checksums are verified when the records are popped.
+				while (parseRecord(data, size, offset, record, false)) {
+					segment.records++;
+					offset += HEADER_SIZE + record.size();
+				}
+				munmap((void *) data, size);
+				segment.size = size;
+			}
+
+			if (segment.records == 0) {
+				syscalls::unlink(segment.path.c_str());
+			} else {
+				segments.push_back(segment);
+				totalSize += segment.size;
+				totalRecords += segment.records;
+			}
+		}
+
+		while (totalSize > sizeLimit && !segments.empty()) {
+			dropOldestSegment();
+		}
+		if (totalRecords > 0) {
+			P_NOTICE("Loaded " << totalRecords << " spilled Union Station packets from " << dir);
+		}
+	}
+
+	void unmapReadSegment() {
+		if (readMap != NULL) {
+			munmap((void *) readMap, readMapSize);
+			readMap = NULL;
+			readMapSize = 0;
+			readOffset = 0;
+		}
+	}
+
+	/** Deletes the oldest segment, whether or not it was fully consumed. */
+	void removeOldestSegment() {
+		Segment &segment = segments.front();
+		unmapReadSegment();
+		if (segments.size() == 1 && writeFd != -1) {
+			writeFd.close(false);
+		}
+		syscalls::unlink(segment.path.c_str());
+		totalSize -= segment.size;
+		totalRecords -= segment.records;
+		segments.pop_front();
+	}
+
+	void dropOldestSegment() {
+		P_WARN("Union Station spill queue is full; dropping " <<
+			segments.front().records << " spilled packets");
+		recordsDropped += segments.front().records;
+		removeOldestSegment();
+	}
+
+	bool startNewSegment() {
+		Segment segment;
+
+		segment.number = nextSegmentNumber;
+		segment.path = segmentPath(segment.number);
+		segment.size = 0;
+		segment.records = 0;
+
+		writeFd.assign(syscalls::open(segment.path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600),
+			__FILE__, __LINE__);
+		if (writeFd == -1) {
+			int e = errno;
+			P_WARN("Cannot create Union Station spill segment " << segment.path <<
+				": " << strerror(e) << " (errno=" << e << ")");
+			return false;
+		}
+
+		nextSegmentNumber++;
+		segments.push_back(segment);
+		return true;
+	}
+
+public:
+	SpillQueue(const string &_dir, size_t _sizeLimit, size_t _segmentSize = 0)
+		: dir(_dir),
+		  sizeLimit(_sizeLimit),
+		  segmentSize(_segmentSize == 0 ? calculateSegmentSize(_sizeLimit) : _segmentSize),
+		  nextSegmentNumber(0),
+		  totalSize(0),
+		  totalRecords(0),
+		  recordsDropped(0),
+		  recordsCorrupted(0),
+		  readMap(NULL),
+		  readMapSize(0),
+		  readOffset(0)
+	{
+		if (getFileType(dir) == FT_NONEXISTANT) {
+			makeDirTree(dir);
+		}
+		loadSegments();
+	}
+
+	~SpillQueue() {
+		unmapReadSegment();
+	}
+
+	/**
+	 * Appends a record. Returns false if the record could not be written,
+	 * e.g. because it is larger than the size limit.
+	 */
+	bool push(const StaticString &record) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		size_t needed = HEADER_SIZE + record.size();
+		char header[HEADER_SIZE];
+
+		if (needed > sizeLimit) {
+			recordsDropped++;
+			return false;
+		}
+		while (totalSize + needed > sizeLimit && !segments.empty()) {
+			dropOldestSegment();
+		}
+		if (writeFd == -1
+		 || (segments.back().size > 0 && segments.back().size + needed > segmentSize))
+		{
+			writeFd.close(false);
+			if (!startNewSegment()) {
+				recordsDropped++;
+				return false;
+			}
+		}
+
+		generateHeader(header, record);
+		StaticString data[2] = { StaticString(header, HEADER_SIZE), record };
+		try {
+			gatheredWrite(writeFd, data, 2);
+		} catch (const SystemException &e) {
+			// The segment may now end with a partial record, which the
+			// reader treats as the end of the segment. Continue in a
+			// new segment.
+			P_WARN("Cannot write to Union Station spill segment " <<
+				segments.back().path << ": " << e.what());
+			writeFd.close(false);
+			recordsDropped++;
+			return false;
+		}
+
+		segments.back().size += needed;
+		segments.back().records++;
+		totalSize += needed;
+		totalRecords++;
+		return true;
+	}
+
+	/**
+	 * Removes the oldest record and stores it in `output`. Returns false
+	 * if the queue is empty. Records whose checksum does not match are
+	 * skipped, together with the rest of their segment.
+	 */
+	bool pop(string &output) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		StaticString record;
+
+		while (!segments.empty()) {
+			Segment &segment = segments.front();
+
+			if (readMap == NULL) {
+				if (segments.size() == 1) {
+					// Seal the segment so that it is not appended to
+					// while it's mapped.
+					writeFd.close(false);
+				}
+				readMap = mapFile(segment.path, readMapSize);
+				readOffset = 0;
+			}
+
+			if (readMap != NULL && segment.records > 0) {
+				if (parseRecord(readMap, readMapSize, readOffset, record)) {
+					output.assign(record.data(), record.size());
+					readOffset += HEADER_SIZE + record.size();
+					segment.records--;
+					totalRecords--;
+					return true;
+				} else {
+					P_WARN("Union Station spill segment " << segment.path <<
+						" is corrupt; skipping " << segment.records <<
+						" spilled packets");
+					recordsCorrupted += segment.records;
+				}
+			}
+
+			removeOldestSegment();
+		}
+
+		return false;
+	}
+
+	bool empty() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return totalRecords == 0;
+	}
+
+	unsigned int count() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return totalRecords;
+	}
+
+	size_t size() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return totalSize;
+	}
+
+	unsigned int dropped() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return recordsDropped;
+	}
+
+	unsigned int corrupted() const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return recordsCorrupted;
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		boost::lock_guard<boost::mutex> l(syncher);
+		doc["dir"] = dir;
+		doc["records"] = totalRecords;
+		doc["segments"] = (Json::UInt) segments.size();
+		doc["size"] = byteSizeToJson(totalSize);
+		doc["size_limit"] = byteSizeToJson(sizeLimit);
+		doc["records_dropped"] = recordsDropped;
+		doc["records_corrupted"] = recordsCorrupted;
+		return doc;
+	}
+};
+
+
+} // namespace UstRouter
+} // namespace Passenger
+
+#endif /* _PASSENGER_UST_ROUTER_SPILL_QUEUE_H_ */
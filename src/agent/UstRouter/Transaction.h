@@ -29,13 +29,17 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/move/move.hpp>
 #include <boost/container/string.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/cstdint.hpp>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <algorithm>
 
 #include <ev++.h>
 #include <StaticString.h>
 #include <MemoryKit/palloc.h>
+#include <MemoryKit/mbuf.h>
 #include <DataStructures/LString.h>
 #include <Utils/JsonUtils.h>
 
@@ -64,8 +68,64 @@ private:
 	unsigned int bodyOffset;
 	bool crashProtect, discarded;
 
+	/** Holds the txn ID, group name, etc. */
 	boost::container::string storage;
 
+	/**
+	 * The body is stored in a chain of mbufs. Appending to it never
+	 * reallocates and copies the data written so far, and sinks can
+	 * hold on to the data by referencing the mbufs instead of copying
+	 * them. Blocks are taken from increasingly larger size classes.
+	 */
+	struct MemoryKit::mbuf_pool *mbufPool;
+	boost::container::small_vector<MemoryKit::mbuf, 2> body;
+	/** Number of bytes used in body.back(). */
+	unsigned int lastBodyBufferUsed;
+	size_t bodySize;
+	unsigned int initialCapacity;
+
+	void addBodyBuffer() {
+		unsigned int sizeClass;
+
+		if (body.empty()) {
+			sizeClass = 0;
+			while (sizeClass < MBUF_SIZE_CLASS_COUNT - 1
+			 && mbuf_pool_size_class_data_size(mbufPool, sizeClass) < initialCapacity)
+			{
+				sizeClass++;
+			}
+		} else {
+			sizeClass = body.back().mbuf_block->size_class - mbufPool->size_classes;
+			if (sizeClass < MBUF_SIZE_CLASS_COUNT - 1) {
+				sizeClass++;
+			}
+		}
+
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get_with_size_class(mbufPool, sizeClass));
+		if (OXT_UNLIKELY(buffer.is_null())) {
+			throw std::bad_alloc();
+		}
+		body.push_back(buffer);
+		lastBodyBufferUsed = 0;
+	}
+
+	void appendToBody(const char *data, size_t size) {
+		const char *end = data + size;
+
+		while (data < end) {
+			if (body.empty() || lastBodyBufferUsed == body.back().size()) {
+				addBodyBuffer();
+			}
+
+			MemoryKit::mbuf &last = body.back();
+			size_t n = std::min<size_t>(last.size() - lastBodyBufferUsed, end - data);
+			memcpy(last.start + lastBodyBufferUsed, data, n);
+			lastBodyBufferUsed += n;
+			data += n;
+		}
+		bodySize += size;
+	}
+
 	template<typename IntegerType1, typename IntegerType2>
 	void internString(const StaticString &str, IntegerType1 *offset, IntegerType2 *size) {
 		if (offset != NULL) {
@@ -78,17 +138,26 @@ private:
 	}
 
 public:
-	Transaction(const StaticString &txnId, const StaticString &groupName,
+	/**
+	 * @param initialCapacity Expected body size. Used to pick the size of
+	 *                        the first body buffer.
+	 */
+	Transaction(struct MemoryKit::mbuf_pool *_mbufPool,
+		const StaticString &txnId, const StaticString &groupName,
 		const StaticString &nodeName, const StaticString &category,
 		const StaticString &unionStationKey, ev_tstamp _createdAt,
 		const StaticString &filters = StaticString(),
-		unsigned int initialCapacity = 1024 * 8)
+		unsigned int _initialCapacity = 1024)
 		: createdAt(_createdAt),
 		  writeCount(0),
 		  refCount(0),
 		  bodyOffset(0),
 		  crashProtect(false),
-		  discarded(false)
+		  discarded(false),
+		  mbufPool(_mbufPool),
+		  lastBodyBufferUsed(0),
+		  bodySize(0),
+		  initialCapacity(_initialCapacity)
 	{
 		internString(txnId, (boost::uint8_t *) NULL, &txnIdSize);
 		internString(groupName, &groupNameOffset, &groupNameSize);
@@ -116,7 +185,12 @@ public:
 		  bodyOffset(other.bodyOffset),
 		  crashProtect(other.crashProtect),
 		  discarded(other.discarded),
-		  storage(boost::move(other.storage))
+		  storage(boost::move(other.storage)),
+		  mbufPool(other.mbufPool),
+		  body(boost::move(other.body)),
+		  lastBodyBufferUsed(other.lastBodyBufferUsed),
+		  bodySize(other.bodySize),
+		  initialCapacity(other.initialCapacity)
 	{
 		other.groupNameOffset = 0;
 		other.nodeNameOffset = 0;
@@ -135,6 +209,9 @@ public:
 		other.bodyOffset = 0;
 		other.crashProtect = false;
 		other.discarded = true;
+		other.body.clear();
+		other.lastBodyBufferUsed = 0;
+		other.bodySize = 0;
 	}
 
 	Transaction &operator=(BOOST_RV_REF(Transaction) other) {
@@ -157,6 +234,11 @@ public:
 			crashProtect = other.crashProtect;
 			discarded = other.discarded;
 			storage = boost::move(other.storage);
+			mbufPool = other.mbufPool;
+			body = boost::move(other.body);
+			lastBodyBufferUsed = other.lastBodyBufferUsed;
+			bodySize = other.bodySize;
+			initialCapacity = other.initialCapacity;
 
 			other.groupNameOffset = 0;
 			other.nodeNameOffset = 0;
@@ -175,6 +257,9 @@ public:
 			other.bodyOffset = 0;
 			other.crashProtect = false;
 			other.discarded = true;
+			other.body.clear();
+			other.lastBodyBufferUsed = 0;
+			other.bodySize = 0;
 		}
 		return *this;
 	}
@@ -203,8 +288,48 @@ public:
 		return StaticString(storage.data() + filtersOffset, filtersSize);
 	}
 
-	StaticString getBody() const {
-		return StaticString(storage.data() + bodyOffset, storage.size() - bodyOffset);
+	size_t getBodySize() const {
+		return bodySize;
+	}
+
+	unsigned int getBodyBufferCount() const {
+		return body.size();
+	}
+
+	/**
+	 * Returns a part of the body. The returned mbuf shares its memory
+	 * with this transaction, so it stays valid after the transaction
+	 * is destroyed. It must not be used after appending to the
+	 * transaction.
+	 */
+	MemoryKit::mbuf getBodyBuffer(unsigned int i) const {
+		if (i == body.size() - 1) {
+			return MemoryKit::mbuf(body[i], 0, lastBodyBufferUsed);
+		} else {
+			return MemoryKit::mbuf(body[i]);
+		}
+	}
+
+	StaticString getBodyData(unsigned int i) const {
+		if (i == body.size() - 1) {
+			return StaticString(body[i].start, lastBodyBufferUsed);
+		} else {
+			return StaticString(body[i].start, body[i].size());
+		}
+	}
+
+	/**
+	 * Returns a copy of the whole body. Use getBodyData() or
+	 * getBodyBuffer() instead when possible.
+	 */
+	string getBody() const {
+		string result;
+		result.reserve(bodySize);
+		for (unsigned int i = 0; i < body.size(); i++) {
+			StaticString data = getBodyData(i);
+			result.append(data.data(), data.size());
+		}
+		return result;
 	}
 
 	bool crashProtectEnabled() const {
@@ -237,22 +362,20 @@ public:
 	}
 
 	void append(const StaticString &timestamp, const StaticString &data) {
-		char txnIdCopy[txnIdSize];
 		char writeCountStr[sizeof(unsigned int) * 2 + 1];
 		unsigned int writeCountStrSize = integerToHexatri(
 			writeCount, writeCountStr);
 
-		memcpy(txnIdCopy, getTxnId().data(), getTxnId().size());
 		writeCount++;
 
-		storage.append(txnIdCopy, getTxnId().size());
-		storage.append(1, ' ');
-		storage.append(timestamp.data(), timestamp.size());
-		storage.append(1, ' ');
-		storage.append(writeCountStr, writeCountStrSize);
-		storage.append(1, ' ');
-		storage.append(data.data(), data.size());
-		storage.append(1, '\n');
+		appendToBody(storage.data(), txnIdSize);
+		appendToBody(" ", 1);
+		appendToBody(timestamp.data(), timestamp.size());
+		appendToBody(" ", 1);
+		appendToBody(writeCountStr, writeCountStrSize);
+		appendToBody(" ", 1);
+		appendToBody(data.data(), data.size());
+		appendToBody("\n", 1);
 	}
 
 	Json::Value inspectStateAsJson() const {
@@ -264,7 +387,7 @@ public:
 		doc["category"] = getCategory().toString();
 		doc["key"] = getUnionStationKey().toString();
 		doc["refcount"] = refCount;
-		doc["body_size"] = byteSizeToJson(getBody().size());
+		doc["body_size"] = byteSizeToJson(bodySize);
 		return doc;
 	}
 };
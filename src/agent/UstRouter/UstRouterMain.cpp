@@ -187,6 +187,31 @@ initializePrivilegedWorkingObjects() {
 	// Initialize ResourceLocator here in case passenger_root's parent
 	// directory is not executable by the unprivileged user.
 	wo->resourceLocator = new ResourceLocator(options.get("passenger_root"));
+
+	// The spill directory is usually inside the instance directory,
+	// which the unprivileged user cannot write to.
+	UPDATE_TRACE_POINT();
+	string spillDir = options.get("union_station_spill_dir", false);
+	if (!spillDir.empty()) {
+		string userName = options.get("analytics_log_user", false);
+		uid_t uid = USER_NOT_GIVEN;
+		gid_t gid = GROUP_NOT_GIVEN;
+
+		if (geteuid() == 0 && !userName.empty()) {
+			struct passwd *pwUser = getpwnam(userName.c_str());
+			if (pwUser == NULL) {
+				throw RuntimeException("Cannot lookup user information for user " +
+					userName);
+			}
+			uid = pwUser->pw_uid;
+			if (options.has("analytics_log_group")) {
+				gid = lookupGid(options.get("analytics_log_group"));
+			} else {
+				gid = pwUser->pw_gid;
+			}
+		}
+		makeDirTree(spillDir, "u=rwx,g=,o=", uid, gid);
+	}
 }
 
 static void
@@ -371,7 +396,7 @@ printInfo(EV_P_ struct ev_signal *watcher, int revents) {
 
 static void
 inspectControllerStateAsJson(Controller *controller, string *result) {
-	*result = controller->inspectStateAsJson().toStyledString();
+	*result = controller->inspectStateAsJsonString();
 }
 
 static void
@@ -593,6 +618,12 @@ setAgentsOptionsDefaults() {
 
 	options.setDefault("ust_router_address", DEFAULT_UST_ROUTER_LISTEN_ADDRESS);
 	options.setDefault("ust_router_default_node_name", getHostName());
+	if (options.has("instance_dir")
+	 && !options.getBool("ust_router_dev_mode", false, false))
+	{
+		options.setDefault("union_station_spill_dir",
+			options.get("instance_dir") + "/ust_router_spill");
+	}
 }
 
 static void
@@ -51,15 +51,15 @@ private:
 				if (ret == -1 && errno == ECHILD) {
 					/* If the agent is attached to gdb then waitpid()
 					 * here can return -1 with errno == ECHILD.
-					 * Fallback to kill() polling for checking
-					 * whether the agent is alive.
+					 * Fall back to waiting for the agent process
+					 * without waitpid().
 					 */
 					ret = pid;
 					status = 0;
 					P_WARN("waitpid() on " << name() << " (pid=" << pid <<
 						") returned -1 with " <<
-						"errno = ECHILD, falling back to kill polling");
-					waitpidUsingKillPolling(pid);
+						"errno = ECHILD, waiting for its exit without waitpid()");
+					waitForProcessExit(pid);
 					e = 0;
 				} else {
 					e = errno;
@@ -198,37 +198,6 @@ protected:
 		syscalls::waitpid(pid, NULL, 0);
 	}
 
-	/**
-	 * Behaves like <tt>waitpid(pid, status, WNOHANG)</tt>, but waits at most
-	 * <em>timeout</em> miliseconds for the process to exit.
-	 */
-	static int timedWaitPid(pid_t pid, int *status, unsigned long long timeout) {
-		Timer<SystemTime::GRAN_10MSEC> timer;
-		int ret;
-
-		do {
-			ret = syscalls::waitpid(pid, status, WNOHANG);
-			if (ret > 0 || ret == -1) {
-				return ret;
-			} else {
-				syscalls::usleep(10000);
-			}
-		} while (timer.elapsed() < timeout);
-		return 0; // timed out
-	}
-
-	static void waitpidUsingKillPolling(pid_t pid) {
-		bool done = false;
-
-		while (!done) {
-			int ret = syscalls::kill(pid, 0);
-			done = ret == -1;
-			if (!done) {
-				syscalls::usleep(20000);
-			}
-		}
-	}
-
 public:
 	AgentWatcher(const WorkingObjectsPtr &wo) {
 		thr = NULL;
@@ -27,6 +27,15 @@
 class CoreWatcher: public AgentWatcher {
 protected:
 	string agentFilename;
+	/**
+	 * Duplicates of the Core's listening sockets, which the Core sends us
+	 * once it has initialized. They are handed to the next Core process
+	 * when the Core is restarted, so that the sockets stay open in the mean
+	 * time: clients that connect while the Core restarts wait in the
+	 * socket's backlog instead of getting a "connection refused", and the
+	 * new Core doesn't have to recreate the sockets. Protected by `lock`.
+	 */
+	vector<FileDescriptor> listenFds;
 
 	virtual const char *name() const {
 		return SHORT_PROGRAM_NAME " core";
@@ -51,12 +60,49 @@ protected:
 
 	virtual void sendStartupArguments(pid_t pid, FileDescriptor &fd) {
 		VariantMap options = *agentsOptions;
+		vector<FileDescriptor> listenFds;
+		{
+			boost::lock_guard<boost::mutex> l(lock);
+			listenFds = this->listenFds;
+		}
+
 		options.erase("ust_router_authorizations");
+		if (!listenFds.empty()) {
+			options.setUint("core_inherited_listen_fds", listenFds.size());
+		}
 		options.writeToFd(fd);
+
+		try {
+			foreach (const FileDescriptor &listenFd, listenFds) {
+				writeFileDescriptorWithNegotiation(fd, listenFd);
+			}
+		} catch (const EOFException &) {
+			// The Core exited prematurely. start() reports why.
+		}
 	}
 
 	virtual bool processStartupInfo(pid_t pid, FileDescriptor &fd, const vector<string> &args) {
-		return args[0] == "initialized";
+		if (args[0] != "initialized") {
+			return false;
+		}
+
+		vector<FileDescriptor> listenFds;
+		unsigned int count = (args.size() > 1) ? atoi(args[1]) : 0;
+		for (unsigned int i = 0; i < count; i++) {
+			listenFds.push_back(FileDescriptor(readFileDescriptorWithNegotiation(fd),
+				__FILE__, __LINE__));
+			P_LOG_FILE_DESCRIPTOR_PURPOSE(listenFds.back(),
+				"Core listening socket " << (i + 1) << " (kept for restarts)");
+		}
+
+		boost::lock_guard<boost::mutex> l(lock);
+		this->listenFds = listenFds;
+		return true;
+	}
+
+	void closeListenFds() {
+		boost::lock_guard<boost::mutex> l(lock);
+		listenFds.clear();
 	}
 
 public:
@@ -66,6 +112,18 @@ public:
 		agentFilename = wo->resourceLocator->findSupportBinary(AGENT_EXE);
 	}
 
+	virtual bool signalShutdown() {
+		// We're shutting down, so don't make clients wait for a Core
+		// that won't come back.
+		closeListenFds();
+		return AgentWatcher::signalShutdown();
+	}
+
+	virtual bool forceShutdown() {
+		closeListenFds();
+		return AgentWatcher::forceShutdown();
+	}
+
 	virtual void reportAgentsInformation(VariantMap &report) {
 		const VariantMap &options = *agentsOptions;
 		vector<string> addresses = options.getStrSet("core_addresses");
@@ -25,9 +25,13 @@
  */
 
 /**
- * Touch all files in the server instance dir every 6 hours in order to prevent /tmp
+ * Touch all files in the server instance dir every hour in order to prevent /tmp
  * cleaners from weaking havoc:
  * http://code.google.com/p/phusion-passenger/issues/detail?id=365
+ *
+ * The tree is touched from this thread instead of from a forked
+ * `find | xargs touch`, and not at all if systemd-tmpfiles is configured
+ * to leave the directory alone.
  */
 class InstanceDirToucher {
 private:
@@ -39,64 +43,17 @@ private:
 		while (!boost::this_thread::interruption_requested()) {
 			syscalls::sleep(60 * 60);
 
-			begin_touch:
+			const string &path = wo->instanceDir->getPath();
+			if (isExcludedFromTmpCleaning(path)) {
+				P_DEBUG("Not touching the server instance directory because "
+					"systemd-tmpfiles is configured to exclude it");
+				continue;
+			}
 
 			boost::this_thread::disable_interruption di;
 			boost::this_thread::disable_syscall_interruption dsi;
-			// Fork a process which touches everything in the server instance dir.
-			pid_t pid = syscalls::fork();
-			if (pid == 0) {
-				// Child
-				int prio, ret, e;
-
-				closeAllFileDescriptors(2);
-
-				// Make process nicer.
-				do {
-					prio = getpriority(PRIO_PROCESS, getpid());
-				} while (prio == -1 && errno == EINTR);
-				if (prio != -1) {
-					prio++;
-					if (prio > 20) {
-						prio = 20;
-					}
-					do {
-						ret = setpriority(PRIO_PROCESS, getpid(), prio);
-					} while (ret == -1 && errno == EINTR);
-				} else {
-					perror("getpriority");
-				}
-
-				do {
-					ret = chdir(wo->instanceDir->getPath().c_str());
-				} while (ret == -1 && errno == EINTR);
-				if (ret == -1) {
-					e = errno;
-					fprintf(stderr, "chdir(\"%s\") failed: %s (%d)\n",
-						wo->instanceDir->getPath().c_str(),
-						strerror(e), e);
-					fflush(stderr);
-					_exit(1);
-				}
-				restoreOomScore(agentsOptions);
-
-				execlp("/bin/sh", "/bin/sh", "-c", "find . | xargs touch", (char *) 0);
-				e = errno;
-				fprintf(stderr, "Cannot execute 'find . | xargs touch': %s (%d)\n",
-					strerror(e), e);
-				fflush(stderr);
-				_exit(1);
-			} else if (pid == -1) {
-				// Error
-				P_WARN("Could not touch the server instance directory because "
-					"fork() failed. Retrying in 2 minutes...");
-				boost::this_thread::restore_interruption si(di);
-				boost::this_thread::restore_syscall_interruption rsi(dsi);
-				syscalls::sleep(60 * 2);
-				goto begin_touch;
-			} else {
-				syscalls::waitpid(pid, NULL, 0);
-			}
+			unsigned int count = touchDirTree(path);
+			P_DEBUG("Touched " << count << " entries in the server instance directory");
 		}
 	}
 
@@ -46,6 +46,7 @@
 #include <sys/prctl.h>
 #endif
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #ifdef HAVE_FLOCK
@@ -385,6 +386,47 @@ deletePidFile(const WorkingObjectsPtr &wo) {
 	}
 }
 
+/**
+ * Waits until all started agent processes have exited, but at most `timeout`
+ * miliseconds. An agent process's feedback fd becomes readable when the
+ * agent exits, so this wakes up as soon as the last agent is gone instead
+ * of sleeping for a fixed amount of time. Returns whether all agents exited
+ * in time.
+ */
+static bool
+waitForAgentsToExit(const vector<AgentWatcherPtr> &watchers, unsigned long long timeout) {
+	vector<AgentWatcherPtr>::const_iterator it;
+	vector<struct pollfd> fds;
+	Timer<SystemTime::GRAN_10MSEC> timer;
+
+	for (it = watchers.begin(); it != watchers.end(); it++) {
+		int fd = (*it)->getFeedbackFd();
+		if (fd != -1) {
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			fds.push_back(pfd);
+		}
+	}
+
+	while (!fds.empty()) {
+		unsigned long long elapsed = timer.elapsed();
+		if (elapsed >= timeout) {
+			return false;
+		}
+		if (syscalls::poll(&fds[0], fds.size(), (int) (timeout - elapsed)) == -1) {
+			return false;
+		}
+		for (unsigned int i = fds.size(); i > 0; i--) {
+			if (fds[i - 1].revents != 0) {
+				fds.erase(fds.begin() + i - 1);
+			}
+		}
+	}
+	return true;
+}
+
 static void
 cleanupAgentsInBackground(const WorkingObjectsPtr &wo, vector<AgentWatcherPtr> &watchers, char *argv[]) {
 	boost::this_thread::disable_interruption di;
@@ -397,10 +439,6 @@ cleanupAgentsInBackground(const WorkingObjectsPtr &wo, vector<AgentWatcherPtr> &
 		// Child
 		try {
 			vector<AgentWatcherPtr>::const_iterator it;
-			Timer<SystemTime::GRAN_10MSEC> timer(false);
-			fd_set fds, fds2;
-			int max, agentProcessesDone;
-			unsigned long long deadline = 30000; // miliseconds
 
 			#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(sun)
 				// Change process title.
@@ -412,42 +450,8 @@ cleanupAgentsInBackground(const WorkingObjectsPtr &wo, vector<AgentWatcherPtr> &
 				(*it)->signalShutdown();
 			}
 
-			max = 0;
-			FD_ZERO(&fds);
-			for (it = watchers.begin(); it != watchers.end(); it++) {
-				FD_SET((*it)->getFeedbackFd(), &fds);
-				if ((*it)->getFeedbackFd() > max) {
-					max = (*it)->getFeedbackFd();
-				}
-			}
-
 			P_DEBUG("Waiting until all agent processes have exited...");
-			timer.start();
-			agentProcessesDone = 0;
-			while (agentProcessesDone != -1
-			    && agentProcessesDone < (int) watchers.size()
-			    && timer.elapsed() < deadline)
-			{
-				struct timeval timeout;
-
-				#ifdef FD_COPY
-					FD_COPY(&fds, &fds2);
-				#else
-					FD_ZERO(&fds2);
-					for (it = watchers.begin(); it != watchers.end(); it++) {
-						FD_SET((*it)->getFeedbackFd(), &fds2);
-					}
-				#endif
-
-				timeout.tv_sec = 0;
-				timeout.tv_usec = 10000;
-				agentProcessesDone = syscalls::select(max + 1, &fds2, NULL, NULL, &timeout);
-				if (agentProcessesDone > 0 && timer.elapsed() < deadline) {
-					usleep(10000);
-				}
-			}
-
-			if (agentProcessesDone == -1 || timer.elapsed() >= deadline) {
+			if (!waitForAgentsToExit(watchers, 30000)) {
 				// An error occurred or we've waited long enough. Kill all the
 				// processes.
 				P_WARN("Some " PROGRAM_NAME " agent processes did not exit " <<
@@ -492,7 +496,7 @@ forceAllAgentsShutdown(const WorkingObjectsPtr &wo, vector<AgentWatcherPtr> &wat
 	for (it = watchers.begin(); it != watchers.end(); it++) {
 		(*it)->signalShutdown();
 	}
-	usleep(1000000);
+	waitForAgentsToExit(watchers, 1000);
 	P_DEBUG("Sending SIGKILL to all agent processes");
 	for (it = watchers.begin(); it != watchers.end(); it++) {
 		(*it)->forceShutdown();
@@ -1164,33 +1168,67 @@ initializeApiServer(const WorkingObjectsPtr &wo) {
 	}
 }
 
+static void
+startAgent(AgentWatcherPtr watcher, string *errorMessage, string *errorBacktrace) {
+	TRACE_POINT();
+	Timer<> timer;
+	P_DEBUG("Starting agent: " << watcher->name());
+	try {
+		watcher->start();
+		P_INFO(watcher->name() << " started in " << timer.elapsed() << " ms");
+	} catch (const tracable_exception &e) {
+		*errorMessage = e.what();
+		*errorBacktrace = e.backtrace();
+	} catch (const std::exception &e) {
+		*errorMessage = e.what();
+	}
+	// Allow other exceptions to propagate and crash the watchdog.
+}
+
+/**
+ * Starts all agents in parallel. The agents don't depend on each other
+ * during startup, so the watchdog only has to wait for the slowest one
+ * instead of for the sum of their startup times.
+ */
 static void
 startAgents(const WorkingObjectsPtr &wo, vector<AgentWatcherPtr> &watchers) {
 	TRACE_POINT();
-	foreach (AgentWatcherPtr watcher, watchers) {
-		P_DEBUG("Starting agent: " << watcher->name());
-		try {
-			watcher->start();
-		} catch (const std::exception &e) {
-			if (feedbackFdAvailable()) {
-				writeArrayMessage(FEEDBACK_FD,
-					"Watchdog startup error",
-					e.what(),
-					NULL);
-			} else {
-				const oxt::tracable_exception *e2 =
-					dynamic_cast<const oxt::tracable_exception *>(&e);
-				if (e2 != NULL) {
-					P_CRITICAL("ERROR: " << e2->what() << "\n" << e2->backtrace());
-				} else {
-					P_CRITICAL("ERROR: " << e.what());
-				}
-			}
-			forceAllAgentsShutdown(wo, watchers);
-			cleanup(wo);
-			exit(1);
+	vector<string> errorMessages(watchers.size());
+	vector<string> errorBacktraces(watchers.size());
+	vector<oxt::thread *> threads;
+	unsigned int i;
+
+	for (i = 1; i < watchers.size(); i++) {
+		threads.push_back(new oxt::thread(
+			boost::bind(startAgent, watchers[i], &errorMessages[i], &errorBacktraces[i]),
+			string("Agent starter: ") + watchers[i]->name(), 256 * 1024));
+	}
+	if (!watchers.empty()) {
+		startAgent(watchers[0], &errorMessages[0], &errorBacktraces[0]);
+	}
+	UPDATE_TRACE_POINT();
+	foreach (oxt::thread *thread, threads) {
+		thread->join();
+		delete thread;
+	}
+
+	for (i = 0; i < watchers.size(); i++) {
+		if (errorMessages[i].empty()) {
+			continue;
 		}
-		// Allow other exceptions to propagate and crash the watchdog.
+		if (feedbackFdAvailable()) {
+			writeArrayMessage(FEEDBACK_FD,
+				"Watchdog startup error",
+				errorMessages[i].c_str(),
+				NULL);
+		} else if (!errorBacktraces[i].empty()) {
+			P_CRITICAL("ERROR: " << errorMessages[i] << "\n" << errorBacktraces[i]);
+		} else {
+			P_CRITICAL("ERROR: " << errorMessages[i]);
+		}
+		forceAllAgentsShutdown(wo, watchers);
+		cleanup(wo);
+		exit(1);
 	}
 }
 
@@ -1283,6 +1321,7 @@ watchdogMain(int argc, char *argv[]) {
 	InstanceDirToucherPtr instanceDirToucher;
 	vector<AgentWatcherPtr> watchers;
 	uid_t uidBeforeLoweringPrivilege = geteuid();
+	Timer<> startupTimer;
 
 	try {
 		TRACE_POINT();
@@ -1297,6 +1336,7 @@ watchdogMain(int argc, char *argv[]) {
 		initializeApiServer(wo);
 		UPDATE_TRACE_POINT();
 		runHookScriptAndThrowOnError("before_watchdog_initialization");
+		P_DEBUG("Watchdog initialized in " << startupTimer.elapsed() << " ms");
 	} catch (const std::exception &e) {
 		if (feedbackFdAvailable()) {
 			writeArrayMessage(FEEDBACK_FD,
@@ -1325,7 +1365,7 @@ watchdogMain(int argc, char *argv[]) {
 		beginWatchingAgents(wo, watchers);
 		reportAgentsInformation(wo, watchers);
 		finalizeInstanceDir(wo);
-		P_INFO("All " PROGRAM_NAME " agents started!");
+		P_INFO("All " PROGRAM_NAME " agents started in " << startupTimer.elapsed() << " ms");
 		UPDATE_TRACE_POINT();
 		runHookScriptAndThrowOnError("after_watchdog_initialization");
 
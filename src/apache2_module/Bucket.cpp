@@ -24,7 +24,8 @@
  *  THE SOFTWARE.
  */
 
-#include <boost/make_shared.hpp>
+#include <unistd.h>
+#include <errno.h>
 #include "Bucket.h"
 
 namespace Passenger {
@@ -43,31 +44,23 @@ static const apr_bucket_type_t apr_bucket_type_passenger_pipe = {
 	apr_bucket_copy_notimpl
 };
 
-struct BucketData {
-	FileDescriptor fd;
-	PassengerBucketStatePtr state;
-	bool bufferResponse;
-};
-
 static void
 bucket_destroy(void *data) {
-	BucketData *bucket_data = (BucketData *) data;
-	if (data != NULL) {
-		delete bucket_data;
-	}
+	/* The state is owned by the request pool. */
 }
 
 static apr_status_t
 bucket_read(apr_bucket *bucket, const char **str, apr_size_t *len, apr_read_type_e block) {
 	char *buf;
+	apr_size_t size;
 	ssize_t ret;
-	BucketData *data;
+	PassengerBucketState *state;
 
-	data = (BucketData *) bucket->data;
+	state = (PassengerBucketState *) bucket->data;
 	*str = NULL;
 	*len = 0;
 
-	if (!data->bufferResponse && block == APR_NONBLOCK_READ) {
+	if (!state->bufferResponse && block == APR_NONBLOCK_READ) {
 		/*
 		 * The bucket brigade that Hooks::handleRequest() passes using
 		 * ap_pass_brigade() is always passed through ap_content_length_filter,
@@ -87,23 +80,54 @@ bucket_read(apr_bucket *bucket, const char **str, apr_size_t *len, apr_read_type
 		return APR_EAGAIN;
 	}
 
-	buf = (char *) apr_bucket_alloc(APR_BUCKET_BUFF_SIZE, bucket->list);
+	if (state->bodyBytesRemaining == 0) {
+		/* The entire response body has been read. Don't read from the
+		 * connection: it's a keep-alive connection, so the Passenger core
+		 * won't send EOF.
+		 */
+		state->completed = true;
+		bucket->data = NULL;
+
+		bucket = apr_bucket_immortal_make(bucket, "", 0);
+		*str = (const char *) bucket->data;
+		*len = 0;
+		return APR_SUCCESS;
+	}
+
+	size = state->bufferSize;
+	if (state->bodyBytesRemaining > 0
+	 && (unsigned long long) state->bodyBytesRemaining < size)
+	{
+		size = (apr_size_t) state->bodyBytesRemaining;
+	}
+
+	buf = (char *) apr_bucket_alloc(size, bucket->list);
 	if (buf == NULL) {
 		return APR_ENOMEM;
 	}
 
 	do {
-		ret = read(data->state->connection, buf, APR_BUCKET_BUFF_SIZE);
+		ret = read(state->connection, buf, size);
 	} while (ret == -1 && errno == EINTR);
 
 	if (ret > 0) {
 		apr_bucket_heap *h;
 
-		data->state->bytesRead += ret;
+		state->bytesRead += ret;
+		if (state->bodyBytesRemaining > 0) {
+			state->bodyBytesRemaining -= ret;
+		}
+		if ((apr_size_t) ret == state->bufferSize
+		 && state->bufferSize < PASSENGER_BUCKET_MAX_BUFFER_SIZE)
+		{
+			/* The Passenger core has more data than fits in our buffer,
+			 * so read bigger chunks from now on.
+			 */
+			state->bufferSize *= 2;
+		}
 
 		*str = buf;
 		*len = ret;
-		bucket->data = NULL;
 
 		/* Change the current bucket (which is a Passenger Bucket) into a heap bucket
 		 * that contains the data that we just read. This newly created heap bucket
@@ -111,24 +135,18 @@ bucket_read(apr_bucket *bucket, const char **str, apr_size_t *len, apr_read_type
 		 */
 		bucket = apr_bucket_heap_make(bucket, buf, *len, apr_bucket_free);
 		h = (apr_bucket_heap *) bucket->data;
-		h->alloc_len = APR_BUCKET_BUFF_SIZE; /* note the real buffer size */
+		h->alloc_len = size; /* note the real buffer size */
 
 		/* And after this newly created bucket we insert a new Passenger Bucket
 		 * which can read the next chunk from the stream.
 		 */
 		APR_BUCKET_INSERT_AFTER(bucket, passenger_bucket_create(
-			data->state, bucket->list, data->bufferResponse));
-
-		/* The newly created Passenger Bucket has a reference to the session
-		 * object, so we can delete data here.
-		 */
-		delete data;
+			state, bucket->list));
 
 		return APR_SUCCESS;
 
 	} else if (ret == 0) {
-		data->state->completed = true;
-		delete data;
+		state->completed = true;
 		bucket->data = NULL;
 
 		apr_bucket_free(buf);
@@ -140,37 +158,45 @@ bucket_read(apr_bucket *bucket, const char **str, apr_size_t *len, apr_read_type
 
 	} else /* ret == -1 */ {
 		int e = errno;
-		data->state->completed = true;
-		data->state->errorCode = e;
-		delete data;
-		bucket->data = NULL;
+		state->completed = true;
+		state->errorCode = e;
 		apr_bucket_free(buf);
 		return APR_FROM_OS_ERROR(e);
 	}
 }
 
 static apr_bucket *
-passenger_bucket_make(apr_bucket *bucket, const PassengerBucketStatePtr &state, bool bufferResponse) {
-	BucketData *data = new BucketData();
-	data->state    = state;
-	data->bufferResponse = bufferResponse;
-
+passenger_bucket_make(apr_bucket *bucket, PassengerBucketState *state) {
 	bucket->type   = &apr_bucket_type_passenger_pipe;
 	bucket->length = (apr_size_t)(-1);
 	bucket->start  = -1;
-	bucket->data   = data;
+	bucket->data   = state;
 	return bucket;
 }
 
+PassengerBucketState *
+passenger_bucket_state_create(apr_pool_t *pool, int connection, bool bufferResponse) {
+	PassengerBucketState *state = (PassengerBucketState *)
+		apr_palloc(pool, sizeof(PassengerBucketState));
+	state->bytesRead  = 0;
+	state->completed  = false;
+	state->bufferResponse = bufferResponse;
+	state->errorCode  = 0;
+	state->bodyBytesRemaining = -1;
+	state->bufferSize = PASSENGER_BUCKET_MIN_BUFFER_SIZE;
+	state->connection = connection;
+	return state;
+}
+
 apr_bucket *
-passenger_bucket_create(const PassengerBucketStatePtr &state, apr_bucket_alloc_t *list, bool bufferResponse) {
+passenger_bucket_create(PassengerBucketState *state, apr_bucket_alloc_t *list) {
 	apr_bucket *bucket;
 
 	bucket = (apr_bucket *) apr_bucket_alloc(sizeof(*bucket), list);
 	APR_BUCKET_INIT(bucket);
 	bucket->free = apr_bucket_free;
 	bucket->list = list;
-	return passenger_bucket_make(bucket, state, bufferResponse);
+	return passenger_bucket_make(bucket, state);
 }
 
 } // namespace Passenger
@@ -26,14 +26,26 @@
 #ifndef _PASSENGER_BUCKET_H_
 #define _PASSENGER_BUCKET_H_
 
-#include <boost/shared_ptr.hpp>
 #include <apr_buckets.h>
-#include <FileDescriptor.h>
 
 namespace Passenger {
 
-using namespace boost;
+/**
+ * The minimum and maximum sizes of the buffers that a PassengerBucket reads
+ * into. The buffer size starts at the minimum and doubles every time a read
+ * fills the entire buffer, so that large responses are forwarded in a few
+ * big buckets instead of many small ones. Buffers larger than
+ * APR_BUCKET_BUFF_SIZE are allocated from the bucket allocator's
+ * apr_allocator, which recycles them.
+ */
+#define PASSENGER_BUCKET_MIN_BUFFER_SIZE APR_BUCKET_BUFF_SIZE
+#define PASSENGER_BUCKET_MAX_BUFFER_SIZE (64 * 1024)
 
+/**
+ * State shared by all PassengerBuckets of a single response. It is allocated
+ * from the request pool by passenger_bucket_state_create(), so it outlives
+ * all buckets that refer to it, and it doesn't need to be reference counted.
+ */
 struct PassengerBucketState {
 	/** The number of bytes that this PassengerBucket has read so far. */
 	unsigned long bytesRead;
@@ -45,6 +57,9 @@ struct PassengerBucketState {
 	 */
 	bool completed;
 
+	/** Whether non-blocking reads should block anyway. See bucket_read(). */
+	bool bufferResponse;
+
 	/** When completed is true, errorCode contains the errno value of
 	 * the last read() call.
 	 *
@@ -52,18 +67,26 @@ struct PassengerBucketState {
 	 */
 	int errorCode;
 
-	/** Connection to the Passenger core. */
-	FileDescriptor connection;
+	/** The number of response body bytes that this PassengerBucket may still
+	 * read from the connection, or -1 if the body ends at EOF. Once this
+	 * reaches 0, the bucket is completed without reading from the connection,
+	 * so that a keep-alive connection can be reused for the next request.
+	 */
+	long long bodyBytesRemaining;
+
+	/** The size of the buffer that the next read will use. */
+	apr_size_t bufferSize;
 
-	PassengerBucketState(const FileDescriptor &conn) {
-		bytesRead  = 0;
-		completed  = false;
-		errorCode  = 0;
-		connection = conn;
-	}
+	/** Connection to the Passenger core. The caller owns the file
+	 * descriptor, and must keep it open for as long as the buckets
+	 * may be read.
+	 */
+	int connection;
 };
 
-typedef boost::shared_ptr<PassengerBucketState> PassengerBucketStatePtr;
+PassengerBucketState *passenger_bucket_state_create(apr_pool_t *pool,
+                                                    int connection,
+                                                    bool bufferResponse);
 
 /**
  * We used to use an apr_bucket_pipe for forwarding the backend process's
@@ -76,16 +99,14 @@ typedef boost::shared_ptr<PassengerBucketState> PassengerBucketStatePtr;
  *   to read less data than can actually be read.
  *
  * PassengerBucket is like apr_bucket_pipe, but:
- * - It also holds a reference to the connection with the Passenger core.
- *   When a read error has occured or when end-of-stream has been reached
- *   this connection will be closed.
+ * - It reads from the connection with the Passenger core, but doesn't
+ *   close it. The caller decides whether the connection can be reused.
  * - It ignores the APR_NONBLOCK_READ flag because that's known to cause
  *   strange I/O problems.
- * - It can store its current state in a PassengerBucketState data structure.
+ * - It stores its current state in a PassengerBucketState data structure.
  */
-apr_bucket *passenger_bucket_create(const PassengerBucketStatePtr &state,
-                                    apr_bucket_alloc_t *list,
-                                    bool bufferResponse);
+apr_bucket *passenger_bucket_create(PassengerBucketState *state,
+                                    apr_bucket_alloc_t *list);
 
 } // namespace Passenger
 
@@ -25,6 +25,7 @@
  */
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
 #include <climits>
 
 /* ap_config.h checks whether the compiler has support for C99's designated
@@ -177,6 +178,70 @@ contains(const Collection &coll, const T &item) {
 	return false;
 }
 
+static void
+addHeader(string &headers, const StaticString &name, const char *value) {
+	if (value != NULL) {
+		headers.append(name.data(), name.size());
+		headers.append(": ", 2);
+		headers.append(value);
+		headers.append("\r\n", 2);
+	}
+}
+
+static void
+addHeader(string &headers, const StaticString &name, const StaticString &value) {
+	headers.append(name.data(), name.size());
+	headers.append(": ", 2);
+	headers.append(value.data(), value.size());
+	headers.append("\r\n", 2);
+}
+
+static void
+addHeader(string &headers, const StaticString &name, int value) {
+	if (value != UNSET_INT_VALUE) {
+		char buf[sizeof(int) * 3 + 2];
+		int size = snprintf(buf, sizeof(buf), "%d", value);
+		headers.append(name.data(), name.size());
+		headers.append(": ", 2);
+		headers.append(buf, size);
+		headers.append("\r\n", 2);
+	}
+}
+
+static void
+addHeader(string &headers, const StaticString &name, DirConfig::Threeway value) {
+	if (value != DirConfig::UNSET) {
+		headers.append(name.data(), name.size());
+		headers.append(": ", 2);
+		if (value == DirConfig::ENABLED) {
+			headers.append("t", 1);
+		} else {
+			headers.append("f", 1);
+		}
+		headers.append("\r\n", 2);
+	}
+}
+
+/**
+ * Appends the secure headers that only depend on this DirConfig (and on
+ * the server config) to <tt>result</tt>. These are the same for every
+ * request, so passenger_postprocess_config() serializes them once.
+ */
+void
+DirConfig::serializeStaticHeaders(string &result) const {
+	const DirConfig *config = this;
+
+	if (config->useUnionStation() && !config->unionStationKey.empty()) {
+		addHeader(result, P_STATIC_STRING("!~UNION_STATION_SUPPORT"), P_STATIC_STRING("t"));
+		addHeader(result, P_STATIC_STRING("!~UNION_STATION_KEY"), config->unionStationKey);
+		if (!config->unionStationFilters.empty()) {
+			addHeader(result, P_STATIC_STRING("!~UNION_STATION_FILTERS"),
+				config->getUnionStationFilterString());
+		}
+	}
+	#include "SetHeaders.cpp"
+}
+
 
 extern "C" {
 
@@ -198,6 +263,7 @@ passenger_config_create_dir(apr_pool_t *p, char *dirspec) {
 	config->allowEncodedSlashes = DirConfig::UNSET;
 	config->unionStationSupport = DirConfig::UNSET;
 	config->bufferResponse = DirConfig::UNSET;
+	config->staticHeadersSerialized = false;
 	/*************************************/
 	return config;
 }
@@ -227,6 +293,7 @@ passenger_config_merge_dir(apr_pool_t *p, void *basev, void *addv) {
 	MERGE_THREEWAY_CONFIG(allowEncodedSlashes);
 	MERGE_THREEWAY_CONFIG(unionStationSupport);
 	MERGE_THREEWAY_CONFIG(bufferResponse);
+	config->staticHeadersSerialized = false;
 	/*************************************/
 	return config;
 }
@@ -238,6 +305,9 @@ postprocessDirConfig(server_rec *s, core_dir_config *core_dconf,
 	if (psg_dconf->unionStationSupport == DirConfig::ENABLED) {
 		serverConfig.unionStationSupport = true;
 	}
+	psg_dconf->staticHeaders.clear();
+	psg_dconf->serializeStaticHeaders(psg_dconf->staticHeaders);
+	psg_dconf->staticHeadersSerialized = true;
 }
 
 #ifndef ap_get_core_module_config
@@ -312,6 +382,7 @@ DEFINE_SERVER_STR_CONFIG_SETTER(cmd_union_station_proxy_address, unionStationPro
 DEFINE_SERVER_STR_CONFIG_SETTER(cmd_passenger_analytics_log_user, analyticsLogUser)
 DEFINE_SERVER_STR_CONFIG_SETTER(cmd_passenger_analytics_log_group, analyticsLogGroup)
 DEFINE_SERVER_BOOLEAN_CONFIG_SETTER(cmd_passenger_turbocaching, turbocaching)
+DEFINE_SERVER_BOOLEAN_CONFIG_SETTER(cmd_passenger_async_handoff, asyncHandoff)
 
 static const char *
 cmd_passenger_ctl(cmd_parms *cmd, void *dummy, const char *name, const char *value) {
@@ -571,6 +642,12 @@ const command_rec passenger_commands[] = {
 		NULL,
 		RSRC_CONF,
 		"Whether to enable turbocaching."),
+	AP_INIT_FLAG("PassengerAsyncHandoff",
+		(FlagFunc) cmd_passenger_async_handoff,
+		NULL,
+		RSRC_CONF,
+		"Whether to hand off client connections to the Passenger core, so that Apache worker threads don't wait for slow clients (experimental). "
+		"Handed off responses bypass Apache's output filters and access logging, and their connections aren't kept alive."),
 
 	#include "ConfigurationCommands.cpp"
 
@@ -616,11 +693,6 @@ const command_rec passenger_commands[] = {
 		"Whether to enable logging through Union Station."),
 
 	/*****************************/
-	AP_INIT_TAKE1("PassengerMemoryLimit",
-		(Take1Func) cmd_passenger_enterprise_only,
-		NULL,
-		OR_LIMIT | ACCESS_CONF | RSRC_CONF,
-		"The maximum amount of memory in MB that an application instance may use."),
 	AP_INIT_TAKE1("PassengerMaxInstances",
 		(Take1Func) cmd_passenger_enterprise_only,
 		NULL,
@@ -631,11 +703,6 @@ const command_rec passenger_commands[] = {
 		NULL,
 		OR_ALL,
 		"The maximum time (in seconds) that the current application may spend on a request."),
-	AP_INIT_FLAG("PassengerRollingRestarts",
-		(FlagFunc) cmd_passenger_enterprise_only,
-		NULL,
-		OR_OPTIONS | ACCESS_CONF | RSRC_CONF,
-		"Whether to turn on rolling restarts"),
 	AP_INIT_FLAG("PassengerResistDeploymentErrors",
 		(FlagFunc) cmd_passenger_enterprise_only,
 		NULL,
@@ -102,6 +102,15 @@ struct DirConfig : GeneratedDirConfigPart {
 	 */
 	Threeway bufferResponse;
 
+	/**
+	 * The secure headers that only depend on this DirConfig, as serialized
+	 * by serializeStaticHeaders(). Only set if staticHeadersSerialized is
+	 * true, which passenger_postprocess_config() ensures for the DirConfigs
+	 * that Apache uses for more than one request.
+	 */
+	string staticHeaders;
+	bool staticHeadersSerialized;
+
 	/*************************************/
 	/*************************************/
 
@@ -125,6 +134,8 @@ struct DirConfig : GeneratedDirConfigPart {
 		return bufferResponse == ENABLED;
 	}
 
+	void serializeStaticHeaders(string &result) const;
+
 	string getUnionStationFilterString() const {
 		if (unionStationFilters.empty()) {
 			return string();
@@ -209,6 +220,13 @@ struct ServerConfig {
 
 	bool turbocaching;
 
+	/** Whether to hand off requests, together with the client connection,
+	 * to the Passenger core instead of forwarding its response ourselves.
+	 * Handed off responses bypass Apache's output filters and access
+	 * logging, and their connections aren't kept alive.
+	 */
+	bool asyncHandoff;
+
 	set<string> prestartURLs;
 
 	ServerConfig() {
@@ -234,6 +252,7 @@ struct ServerConfig {
 		analyticsLogUser   = DEFAULT_ANALYTICS_LOG_USER;
 		analyticsLogGroup  = DEFAULT_ANALYTICS_LOG_GROUP;
 		turbocaching       = true;
+		asyncHandoff       = false;
 	}
 
 	/** Called after the configuration files have been loaded, inside
@@ -67,6 +67,61 @@ AP_INIT_TAKE1("PassengerMinInstances",
 	NULL,
 	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
 	"The minimum number of application instances to keep when cleaning idle instances."),
+AP_INIT_TAKE1("PassengerSpawnConcurrency",
+	(Take1Func) cmd_passenger_spawn_concurrency,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The maximum number of application instances that may be spawned at the same time."),
+AP_INIT_TAKE1("PassengerRollingRestartBatchSize",
+	(Take1Func) cmd_passenger_rolling_restart_batch_size,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The maximum number of application instances that are replaced at the same time during a rolling restart."),
+AP_INIT_TAKE1("PassengerTargetUtilization",
+	(Take1Func) cmd_passenger_target_utilization,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The percentage of time that application instances should be busy. Instances are spawned ahead of demand to maintain it."),
+AP_INIT_TAKE1("PassengerPreloaderStandbyProcesses",
+	(Take1Func) cmd_passenger_preloader_standby_processes,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The number of application instances that the preloader keeps forked ahead of time, so that spawning only needs to activate one of them. While nonzero, the preloader is never shut down for being idle."),
+AP_INIT_TAKE1("PassengerRecycleJitter",
+	(Take1Func) cmd_passenger_recycle_jitter,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"Lowers the max requests and memory limits of each application instance by a random percentage up to this value, so that instances are not recycled at the same time."),
+AP_INIT_TAKE1("PassengerCapacityWeight",
+	(Take1Func) cmd_passenger_capacity_weight,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The weight of this application when the capacity of a full pool is shared between applications."),
+AP_INIT_TAKE1("PassengerMaxOutOfBandWorkPercentage",
+	(Take1Func) cmd_passenger_max_out_of_band_work_percentage,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The percentage of application instances that may be performing out-of-band work at the same time."),
+AP_INIT_TAKE1("PassengerOutOfBandWorkMaxUtilization",
+	(Take1Func) cmd_passenger_out_of_band_work_max_utilization,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"Out-of-band work is deferred while the utilization of application instances, as a percentage, is above this value."),
+AP_INIT_TAKE1("PassengerOutOfBandWorkIdleInterval",
+	(Take1Func) cmd_passenger_out_of_band_work_idle_interval,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The minimum number of seconds between out-of-band work that Passenger gives idle application instances while the load is low, without them requesting it. 0 disables this."),
+AP_INIT_TAKE1("PassengerWarmupTime",
+	(Take1Func) cmd_passenger_warmup_time,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The number of seconds during which a newly spawned application instance receives a ramped share of the traffic."),
+AP_INIT_TAKE1("PassengerMemoryLimit",
+	(Take1Func) cmd_passenger_memory_limit,
+	NULL,
+	OR_LIMIT | ACCESS_CONF | RSRC_CONF,
+	"The maximum amount of memory in MB that an application instance may use."),
 AP_INIT_TAKE1("PassengerMaxInstancesPerApp",
 	(Take1Func) cmd_passenger_max_instances_per_app,
 	NULL,
@@ -112,6 +167,26 @@ AP_INIT_TAKE1("PassengerMaxRequestQueueSize",
 	NULL,
 	OR_ALL,
 	"The maximum number of queued requests."),
+AP_INIT_TAKE1("PassengerRequestQueueTargetDelay",
+	(Take1Func) cmd_passenger_request_queue_target_delay,
+	NULL,
+	OR_ALL,
+	"The target time that requests may wait in the request queue. When exceeded for too long, requests that waited longer are rejected."),
+AP_INIT_TAKE1("PassengerRateLimit",
+	(Take1Func) cmd_passenger_rate_limit,
+	NULL,
+	OR_ALL,
+	"The number of requests per second, per rate limit key, above which requests are answered with 429 Too Many Requests. 0 disables this."),
+AP_INIT_TAKE1("PassengerRateLimitBurst",
+	(Take1Func) cmd_passenger_rate_limit_burst,
+	NULL,
+	OR_ALL,
+	"The number of requests per rate limit key that may arrive at once before PassengerRateLimit applies. 0 means the same as PassengerRateLimit."),
+AP_INIT_TAKE1("PassengerMaxRequestsInFlight",
+	(Take1Func) cmd_passenger_max_requests_in_flight,
+	NULL,
+	OR_ALL,
+	"The number of requests per rate limit key that may be in flight at once. Requests beyond it are answered with 429 Too Many Requests. 0 disables this."),
 AP_INIT_TAKE1("PassengerMaxPreloaderIdleTime",
 	(Take1Func) cmd_passenger_max_preloader_idle_time,
 	NULL,
@@ -122,6 +197,21 @@ AP_INIT_FLAG("PassengerLoadShellEnvvars",
 	NULL,
 	OR_OPTIONS | ACCESS_CONF | RSRC_CONF,
 	"Whether to load environment variables from the shell before running the application."),
+AP_INIT_FLAG("PassengerPreloaderCompactHeap",
+	(FlagFunc) cmd_passenger_preloader_compact_heap,
+	NULL,
+	OR_OPTIONS | ACCESS_CONF | RSRC_CONF,
+	"Whether the preloader should compact its heap before forking application instances, so that more memory stays shared with them."),
+AP_INIT_TAKE1("PassengerPreloaderWarmupScript",
+	(Take1Func) cmd_passenger_preloader_warmup_script,
+	NULL,
+	OR_OPTIONS | ACCESS_CONF | RSRC_CONF,
+	"A script that the preloader should load before forking application instances, e.g. to eager load code or to prime caches."),
+AP_INIT_FLAG("PassengerRollingRestarts",
+	(FlagFunc) cmd_passenger_rolling_restarts,
+	NULL,
+	OR_OPTIONS | ACCESS_CONF | RSRC_CONF,
+	"Whether to turn on rolling restarts"),
 AP_INIT_FLAG("PassengerBufferUpload",
 	(FlagFunc) cmd_passenger_buffer_upload,
 	NULL,
@@ -70,6 +70,21 @@ struct GeneratedDirConfigPart {
 	 */
 	Threeway loadShellEnvvars;
 
+	/*
+	 * Whether the preloader should compact its heap before forking application instances, so that more memory stays shared with them.
+	 */
+	Threeway preloaderCompactHeap;
+
+	/*
+	 * A script that the preloader should load before forking application instances, e.g. to eager load code or to prime caches.
+	 */
+	const char *preloaderWarmupScript;
+
+	/*
+	 * Whether to turn on rolling restarts
+	 */
+	Threeway rollingRestarts;
+
 	/*
 	 * Whether to show the Phusion Passenger version number in the X-Powered-By header.
 	 */
@@ -110,6 +125,23 @@ struct GeneratedDirConfigPart {
 	 */
 	int maxRequestQueueSize;
 
+	/*
+	 * The target time that requests may wait in the request queue. When exceeded for too long, requests that waited longer are rejected.
+	 */
+	int requestQueueTargetDelay;
+	/*
+	 * The number of requests per second, per rate limit key, above which requests are answered with 429 Too Many Requests. 0 disables this.
+	 */
+	int rateLimit;
+	/*
+	 * The number of requests per rate limit key that may arrive at once before PassengerRateLimit applies. 0 means the same as PassengerRateLimit.
+	 */
+	int rateLimitBurst;
+	/*
+	 * The number of requests per rate limit key that may be in flight at once. Requests beyond it are answered with 429 Too Many Requests. 0 disables this.
+	 */
+	int maxRequestsInFlight;
+
 	/*
 	 * The maximum number of requests that an application instance may process.
 	 */
@@ -120,11 +152,65 @@ struct GeneratedDirConfigPart {
 	 */
 	int minInstances;
 
+	/*
+	 * The maximum number of application instances that may be spawned at the same time.
+	 */
+	int spawnConcurrency;
+
+	/*
+	 * The maximum number of application instances that are replaced at the same time during a rolling restart.
+	 */
+	int rollingRestartBatchSize;
+
 	/*
 	 * A timeout for application startup.
 	 */
 	int startTimeout;
 
+	/*
+	 * The percentage of time that application instances should be busy. Instances are spawned ahead of demand to maintain it.
+	 */
+	int targetUtilization;
+
+	/*
+	 * The number of application instances that the preloader keeps forked ahead of time, so that spawning only needs to activate one of them. While nonzero, the preloader is never shut down for being idle.
+	 */
+	int preloaderStandbyProcesses;
+
+	/*
+	 * Lowers the max requests and memory limits of each application instance by a random percentage up to this value, so that instances are not recycled at the same time.
+	 */
+	int recycleJitter;
+
+	/*
+	 * The weight of this application when the capacity of a full pool is shared between applications.
+	 */
+	int capacityWeight;
+
+	/*
+	 * The percentage of application instances that may be performing out-of-band work at the same time.
+	 */
+	int maxOutOfBandWorkPercentage;
+
+	/*
+	 * Out-of-band work is deferred while the utilization of application instances, as a percentage, is above this value.
+	 */
+	int outOfBandWorkMaxUtilization;
+	/*
+	 * The minimum number of seconds between out-of-band work that Passenger gives idle application instances while the load is low, without them requesting it. 0 disables this.
+	 */
+	int outOfBandWorkIdleInterval;
+
+	/*
+	 * The number of seconds during which a newly spawned application instance receives a ramped share of the traffic.
+	 */
+	int warmupTime;
+
+	/*
+	 * The maximum amount of memory in MB that an application instance may use.
+	 */
+	int memoryLimit;
+
 	/*
 	 * The environment under which applications are run.
 	 */
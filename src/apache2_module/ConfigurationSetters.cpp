@@ -103,6 +103,347 @@ cmd_passenger_min_instances(cmd_parms *cmd, void *pcfg, const char *arg) {
 	}
 }
 
+static const char *
+cmd_passenger_spawn_concurrency(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 1) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 1.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->spawnConcurrency = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_rolling_restart_batch_size(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 1) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 1.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->rollingRestartBatchSize = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_target_utilization(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->targetUtilization = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_preloader_standby_processes(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->preloaderStandbyProcesses = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_recycle_jitter(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->recycleJitter = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_capacity_weight(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 1) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 1.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->capacityWeight = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_max_out_of_band_work_percentage(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->maxOutOfBandWorkPercentage = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_out_of_band_work_max_utilization(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->outOfBandWorkMaxUtilization = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_out_of_band_work_idle_interval(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->outOfBandWorkIdleInterval = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_warmup_time(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->warmupTime = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_memory_limit(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->memoryLimit = (int) result;
+		return NULL;
+	}
+}
+
 static const char *
 cmd_passenger_max_instances_per_app(cmd_parms *cmd, void *pcfg, const char *arg) {
 	DirConfig *config = (DirConfig *) pcfg;
@@ -262,6 +603,130 @@ cmd_passenger_max_request_queue_size(cmd_parms *cmd, void *pcfg, const char *arg
 	}
 }
 
+static const char *
+cmd_passenger_request_queue_target_delay(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->requestQueueTargetDelay = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_rate_limit(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->rateLimit = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_rate_limit_burst(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->rateLimitBurst = (int) result;
+		return NULL;
+	}
+}
+
+static const char *
+cmd_passenger_max_requests_in_flight(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	char *end;
+	long result;
+
+	result = strtol(arg, &end, 10);
+	if (*end != '\0') {
+		string message = "Invalid number specified for ";
+		message.append(cmd->directive->directive);
+		message.append(".");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else if (result < 0) {
+		string message = "Value for ";
+		message.append(cmd->directive->directive);
+		message.append(" must be greater than or equal to 0.");
+
+		char *messageStr = (char *) apr_palloc(cmd->temp_pool,
+			message.size() + 1);
+		memcpy(messageStr, message.c_str(), message.size() + 1);
+		return messageStr;
+	} else {
+		config->maxRequestsInFlight = (int) result;
+		return NULL;
+	}
+}
+
 static const char *
 cmd_passenger_max_preloader_idle_time(cmd_parms *cmd, void *pcfg, const char *arg) {
 	DirConfig *config = (DirConfig *) pcfg;
@@ -303,6 +768,33 @@ cmd_passenger_load_shell_envvars(cmd_parms *cmd, void *pcfg, const char *arg) {
 	return NULL;
 }
 
+static const char *
+cmd_passenger_preloader_compact_heap(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	config->preloaderCompactHeap =
+		arg ?
+		DirConfig::ENABLED :
+		DirConfig::DISABLED;
+	return NULL;
+}
+
+static const char *
+cmd_passenger_preloader_warmup_script(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	config->preloaderWarmupScript = arg;
+	return NULL;
+}
+
+static const char *
+cmd_passenger_rolling_restarts(cmd_parms *cmd, void *pcfg, const char *arg) {
+	DirConfig *config = (DirConfig *) pcfg;
+	config->rollingRestarts =
+		arg ?
+		DirConfig::ENABLED :
+		DirConfig::DISABLED;
+	return NULL;
+}
+
 static const char *
 cmd_passenger_buffer_upload(cmd_parms *cmd, void *pcfg, const char *arg) {
 	DirConfig *config = (DirConfig *) pcfg;
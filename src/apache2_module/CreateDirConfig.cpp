@@ -43,6 +43,17 @@ config->nodejs = NULL;
 config->meteorAppSettings = NULL;
 config->appEnv = NULL;
 config->minInstances = UNSET_INT_VALUE;
+config->spawnConcurrency = UNSET_INT_VALUE;
+config->rollingRestartBatchSize = UNSET_INT_VALUE;
+config->targetUtilization = UNSET_INT_VALUE;
+config->preloaderStandbyProcesses = UNSET_INT_VALUE;
+config->recycleJitter = UNSET_INT_VALUE;
+config->capacityWeight = UNSET_INT_VALUE;
+config->maxOutOfBandWorkPercentage = UNSET_INT_VALUE;
+config->outOfBandWorkMaxUtilization = UNSET_INT_VALUE;
+config->outOfBandWorkIdleInterval = UNSET_INT_VALUE;
+config->warmupTime = UNSET_INT_VALUE;
+config->memoryLimit = UNSET_INT_VALUE;
 config->maxInstancesPerApp = UNSET_INT_VALUE;
 config->user = NULL;
 config->group = NULL;
@@ -52,8 +63,15 @@ config->startTimeout = UNSET_INT_VALUE;
 config->highPerformance = DirConfig::UNSET;
 config->enabled = DirConfig::UNSET;
 config->maxRequestQueueSize = UNSET_INT_VALUE;
+config->requestQueueTargetDelay = UNSET_INT_VALUE;
+config->rateLimit = UNSET_INT_VALUE;
+config->rateLimitBurst = UNSET_INT_VALUE;
+config->maxRequestsInFlight = UNSET_INT_VALUE;
 config->maxPreloaderIdleTime = UNSET_INT_VALUE;
 config->loadShellEnvvars = DirConfig::UNSET;
+config->preloaderCompactHeap = DirConfig::UNSET;
+config->preloaderWarmupScript = NULL;
+config->rollingRestarts = DirConfig::UNSET;
 config->bufferUpload = DirConfig::UNSET;
 config->appType = NULL;
 config->startupFile = NULL;
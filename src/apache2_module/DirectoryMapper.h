@@ -177,7 +177,8 @@ public:
 	 *
 	 * @param cstat A CachedFileStat object used for statting files.
 	 * @param cstatMutex A mutex for locking CachedFileStat, making its
-	 *                   usage thread-safe.
+	 *                   usage thread-safe. May be NULL if <tt>cstat</tt>
+	 *                   is only used by the calling thread.
 	 * @param throttleRate A throttling rate for cstat.
 	 * @warning Do not use this object after the destruction of <tt>r</tt>,
 	 *          <tt>config</tt> or <tt>cstat</tt>.
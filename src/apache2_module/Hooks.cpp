@@ -42,13 +42,18 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <exception>
 #include <cstdio>
+#include <cstring>
 #include <unistd.h>
+#include <poll.h>
 
 #include <oxt/initialize.hpp>
 #include <oxt/macros.hpp>
 #include <oxt/backtrace.hpp>
+#include <oxt/system_calls.hpp>
 #include <oxt/detail/context.hpp>
 #include "Hooks.h"
 #include "Bucket.h"
@@ -61,6 +66,7 @@
 #include <Utils/SystemTime.h>
 #include <Utils/HttpConstants.h>
 #include <Utils/ReleaseableScopedPointer.h>
+#include <Utils/StaticAssetManifest.hpp>
 #include <Logging.h>
 #include <WatchdogLauncher.h>
 #include <Constants.h>
@@ -222,10 +228,41 @@ private:
 
 	enum Threeway { YES, NO, UNKNOWN };
 
+	/** Maximum number of entries in each thread's CachedFileStat. */
+	static const unsigned int CSTAT_MAX_SIZE = 1024;
+
 	Threeway m_hasModRewrite, m_hasModDir, m_hasModAutoIndex, m_hasModXsendfile;
-	CachedFileStat cstat;
+	/**
+	 * A CachedFileStat per Apache worker thread, so that mapping requests
+	 * to directories doesn't serialize all worker threads on a shared lock.
+	 * See getCachedFileStat().
+	 */
+	boost::thread_specific_ptr<CachedFileStat> cstat;
+	/**
+	 * The asset manifests of the applications that we serve, which tell us
+	 * whether a URI maps to a precompiled asset without stat()ing it.
+	 */
+	StaticAssetManifestRegistry staticAssetManifests;
 	WatchdogLauncher watchdogLauncher;
-	boost::mutex cstatMutex;
+	/**
+	 * An idle keep-alive connection to the Passenger core, per Apache worker
+	 * thread. A worker thread handles one request at a time, so it never
+	 * needs more than one. Reusing it saves a connect/accept/close cycle
+	 * per request.
+	 */
+	boost::thread_specific_ptr<FileDescriptor> idleCoreConnection;
+
+	/**
+	 * Returns this thread's CachedFileStat, creating it on first use.
+	 */
+	CachedFileStat *getCachedFileStat() {
+		CachedFileStat *result = cstat.get();
+		if (OXT_UNLIKELY(result == NULL)) {
+			result = new CachedFileStat(CSTAT_MAX_SIZE);
+			cstat.reset(result);
+		}
+		return result;
+	}
 
 	inline DirConfig *getDirConfig(request_rec *r) {
 		return (DirConfig *) ap_get_module_config(r->per_dir_config, &passenger_module);
@@ -314,6 +351,217 @@ private:
 		return conn;
 	}
 
+	/**
+	 * Returns this thread's idle connection to the Passenger core if it is
+	 * still usable, or a new connection otherwise.
+	 *
+	 * @param reused Set to whether an idle connection was returned.
+	 */
+	FileDescriptor checkoutCoreConnection(bool &reused) {
+		FileDescriptor *idle = idleCoreConnection.get();
+		if (idle != NULL) {
+			FileDescriptor conn = *idle;
+			idleCoreConnection.reset();
+			if (coreConnectionIsIdle(conn)) {
+				reused = true;
+				return conn;
+			}
+		}
+		reused = false;
+		return connectToCore();
+	}
+
+	/**
+	 * Makes the given connection this thread's idle connection, so that the
+	 * next request can reuse it.
+	 */
+	void checkinCoreConnection(const FileDescriptor &conn) {
+		idleCoreConnection.reset(new FileDescriptor(conn));
+	}
+
+	/**
+	 * An idle connection is no longer usable if the Passenger core closed it
+	 * (e.g. because it restarted), in which case it is readable.
+	 */
+	static bool coreConnectionIsIdle(const FileDescriptor &conn) {
+		struct pollfd pfd;
+		int ret;
+
+		pfd.fd = conn;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		do {
+			ret = poll(&pfd, 1, 0);
+		} while (ret == -1 && errno == EINTR);
+		return ret == 0;
+	}
+
+	/**
+	 * Whether handleRequest() may hand off the request to the Passenger
+	 * core together with the client connection, so that this thread
+	 * doesn't have to wait until the response has been sent to a possibly
+	 * slow client. The core then reads from and writes to the client
+	 * socket itself, so we only do this if Apache has nothing more to
+	 * do with the connection: no request body, no TLS, and no pipelined
+	 * request data that Apache's input filters have already read.
+	 *
+	 * Handing off changes how Apache treats the request:
+	 * - The response bypasses Apache's output filters (mod_deflate,
+	 *   mod_headers, etc.), because Apache never sees it.
+	 * - The response bypasses Apache's access logging. Apache still logs
+	 *   the request, but with the status and size that it assumes, not
+	 *   those of the response that the core sent.
+	 * - Keep-alive is forced off: we mark the connection as aborted, and
+	 *   the core closes it after the response, because the client's next
+	 *   request wouldn't pass through us.
+	 */
+	bool canHandOffClient(request_rec *r, bool expectingBody) {
+		#if HTTP_VERSION(AP_SERVER_MAJORVERSION_NUMBER, AP_SERVER_MINORVERSION_NUMBER) >= 2004
+			if (!serverConfig.asyncHandoff
+			 || expectingBody
+			 || r->main != NULL
+			 || r->proto_num != HTTP_VERSION(1, 1)
+			 || lookupEnv(r, "HTTPS") != NULL
+			 || ap_get_conn_socket(r->connection) == NULL)
+			{
+				return false;
+			}
+
+			apr_bucket_brigade *bb = apr_brigade_create(r->pool,
+				r->connection->bucket_alloc);
+			apr_status_t rv = ap_get_brigade(r->connection->input_filters, bb,
+				AP_MODE_SPECULATIVE, APR_NONBLOCK_READ, 1);
+			bool hasBufferedInput = rv == APR_SUCCESS && !APR_BRIGADE_EMPTY(bb);
+			apr_brigade_destroy(bb);
+			return !hasBufferedInput;
+		#else
+			return false;
+		#endif
+	}
+
+	int getClientSocket(request_rec *r) {
+		#if HTTP_VERSION(AP_SERVER_MAJORVERSION_NUMBER, AP_SERVER_MINORVERSION_NUMBER) >= 2004
+			apr_os_sock_t fd;
+			if (apr_os_sock_get(&fd, ap_get_conn_socket(r->connection)) == APR_SUCCESS) {
+				return fd;
+			}
+		#endif
+		return -1;
+	}
+
+	/**
+	 * Called after the request has been handed off, together with the
+	 * client socket. The Passenger core now owns the client connection:
+	 * we close our connection to it without reading the response, and
+	 * make sure that Apache neither writes to the client socket nor shuts
+	 * it down. Closing Apache's copy of the socket leaves the core's open.
+	 *
+	 * Because the connection is aborted, Apache's output filters discard
+	 * whatever is written after this, and Apache closes the connection
+	 * without a lingering close (which would shut down the socket for the
+	 * core too) instead of waiting for another request on it.
+	 */
+	int finishClientHandoff(request_rec *r) {
+		r->connection->keepalive = AP_CONN_CLOSE;
+		r->connection->aborted = 1;
+		return OK;
+	}
+
+	/**
+	 * Looks up a response header that ap_scan_script_header_err_brigade()
+	 * has parsed. It's undefined in which of the tables it ends up in.
+	 */
+	static const char *lookupResponseHeader(request_rec *r, const char *name) {
+		const char *value = apr_table_get(r->headers_out, name);
+		if (value == NULL) {
+			value = apr_table_get(r->err_headers_out, name);
+		}
+		return value;
+	}
+
+	/**
+	 * Determines how many response body bytes the Passenger core is going to
+	 * send after the response header, so that the connection can be reused
+	 * afterwards. The Passenger core closes the connection after responses
+	 * whose body size isn't known in advance, because we ask it to dechunk
+	 * responses. Upgraded connections aren't kept alive either, because
+	 * their Connection header says "upgrade".
+	 *
+	 * @return The body size, or -1 if the body ends at EOF.
+	 */
+	static long long getResponseBodySize(request_rec *r, bool coreKeepAlive) {
+		if (!coreKeepAlive) {
+			return -1;
+		} else if (r->header_only || r->status == 204 || r->status == 304) {
+			return 0;
+		}
+
+		const char *contentLength = lookupResponseHeader(r, "Content-Length");
+		if (contentLength != NULL) {
+			return (long long) stringToULL(contentLength);
+		} else {
+			return -1;
+		}
+	}
+
+	/**
+	 * Returns the number of bytes in the bucket brigade that have already
+	 * been read from the Passenger core, i.e. the part of the response body
+	 * that was read together with the response header.
+	 */
+	static long long getBufferedBodySize(apr_bucket_brigade *bb) {
+		apr_bucket *e;
+		long long result = 0;
+
+		for (e = APR_BRIGADE_FIRST(bb);
+		     e != APR_BRIGADE_SENTINEL(bb) && e->length != (apr_size_t) -1;
+		     e = APR_BUCKET_NEXT(e))
+		{
+			result += e->length;
+		}
+		return result;
+	}
+
+	/**
+	 * Inserts the part of a file that the Passenger core named in an
+	 * X-Passenger-File response header ("<start> <size> <filename>") into
+	 * the bucket brigade, just before its EOS bucket. The core filters
+	 * then send it with sendfile() if possible.
+	 */
+	static bool insertCoreFile(request_rec *r, apr_bucket_brigade *bb,
+		const char *value)
+	{
+		char *end;
+		apr_off_t start, size;
+		apr_file_t *file;
+		apr_status_t rv;
+		apr_bucket *eos;
+
+		start = (apr_off_t) apr_strtoi64(value, &end, 10);
+		if (*end != ' ') {
+			return false;
+		}
+		size = (apr_off_t) apr_strtoi64(end + 1, &end, 10);
+		if (*end != ' ' || start < 0 || size <= 0) {
+			return false;
+		}
+
+		rv = apr_file_open(&file, end + 1, APR_FOPEN_READ | APR_FOPEN_SENDFILE_ENABLED,
+			APR_OS_DEFAULT, r->pool);
+		if (rv != APR_SUCCESS) {
+			char buf[256];
+			P_ERROR("Cannot open file " << (end + 1) << " that the Passenger "
+				"core asked us to send: " << apr_strerror(rv, buf, sizeof(buf)));
+			return false;
+		}
+
+		eos = APR_BRIGADE_LAST(bb);
+		APR_BUCKET_REMOVE(eos);
+		apr_brigade_insert_file(bb, file, start, size, r->pool);
+		APR_BRIGADE_INSERT_TAIL(bb, eos);
+		return true;
+	}
+
 	bool hasModRewrite() {
 		if (m_hasModRewrite == UNKNOWN) {
 			if (ap_find_linked_module("mod_rewrite.c")) {
@@ -388,7 +636,8 @@ private:
 	bool prepareRequest(request_rec *r, DirConfig *config, const char *filename, bool coreModuleWillBeRun = false) {
 		TRACE_POINT();
 
-		DirectoryMapper mapper(r, config, &cstat, &cstatMutex, serverConfig.statThrottleRate);
+		DirectoryMapper mapper(r, config, getCachedFileStat(), NULL,
+			serverConfig.statThrottleRate);
 		try {
 			if (mapper.getApplicationType() == PAT_NONE) {
 				// (B) is not true.
@@ -430,7 +679,12 @@ private:
 		// (B) is true.
 
 		try {
-			FileType fileType = getFileType(filename);
+			FileType fileType;
+			if (staticAssetManifests.lookup(mapper.getPublicDirectory(), filename).exists) {
+				fileType = FT_REGULAR;
+			} else {
+				fileType = getFileType(filename);
+			}
 			if (fileType == FT_REGULAR) {
 				// (C) is true.
 				disableRequestNote(r);
@@ -579,11 +833,29 @@ private:
 
 			int ret;
 			bool bodyIsChunked = false;
-
-			string headers = constructRequestHeaders(r, mapper, bodyIsChunked);
-			FileDescriptor conn = connectToCore();
-			writeExact(conn, headers);
+			int clientFd = canHandOffClient(r, expectingBody)
+				? getClientSocket(r)
+				: -1;
+
+			string headers = constructRequestHeaders(r, mapper, bodyIsChunked,
+				clientFd != -1);
+			bool reusedConnection;
+			FileDescriptor conn = checkoutCoreConnection(reusedConnection);
+			try {
+				sendRequestHeaders(conn, config, headers, clientFd);
+			} catch (const SystemException &e) {
+				if (reusedConnection && (e.code() == EPIPE || e.code() == ECONNRESET)) {
+					// The Passenger core closed the idle connection just now.
+					conn = connectToCore();
+					sendRequestHeaders(conn, config, headers, clientFd);
+				} else {
+					throw;
+				}
+			}
 			headers.clear();
+			if (clientFd != -1) {
+				return finishClientHandoff(r);
+			}
 			if (expectingBody) {
 				sendRequestBody(conn, r, bodyIsChunked);
 			}
@@ -595,14 +867,14 @@ private:
 			UPDATE_TRACE_POINT();
 			apr_bucket_brigade *bb;
 			apr_bucket *b;
-			PassengerBucketStatePtr bucketState;
+			PassengerBucketState *bucketState;
 
 			/* Setup the bucket brigade. */
 			bb = apr_brigade_create(r->connection->pool, r->connection->bucket_alloc);
 
-			bucketState = boost::make_shared<PassengerBucketState>(conn);
-			b = passenger_bucket_create(bucketState, r->connection->bucket_alloc,
+			bucketState = passenger_bucket_state_create(r->pool, conn,
 				config->getBufferResponse());
+			b = passenger_bucket_create(bucketState, r->connection->bucket_alloc);
 			APR_BRIGADE_INSERT_TAIL(bb, b);
 
 			b = apr_bucket_eos_create(r->connection->bucket_alloc);
@@ -624,14 +896,26 @@ private:
 			// into error_headers_out (mostly) as well as headers_out.
 			ret = ap_scan_script_header_err_brigade(r, bb, backendData);
 
-			// The PassengerAgent sets the Connection: close header because it wants
+			// The PassengerAgent sets the Connection: close header if it wants
 			// the bb connection closed, but because we fed everything to the
 			// ap_scan_script it will also be set in the response to the client and
 			// that breaks HTTP 1.1 keep-alive, so unset it.
+			const char *coreConnectionHeader = lookupResponseHeader(r, "Connection");
+			bool coreKeepAlive = coreConnectionHeader == NULL
+				|| strcasecmp(coreConnectionHeader, "keep-alive") == 0;
 			apr_table_unset(r->err_headers_out, "Connection");
 			// It's undefined in which of the tables it ends up in, so unset on both.
 			apr_table_unset(r->headers_out, "Connection");
 
+			// The Passenger core may ask us to send a file as the response
+			// body, instead of sending the body over the connection.
+			const char *coreFile = lookupResponseHeader(r, "X-Passenger-File");
+			if (coreFile != NULL) {
+				coreFile = apr_pstrdup(r->pool, coreFile);
+				apr_table_unset(r->err_headers_out, "X-Passenger-File");
+				apr_table_unset(r->headers_out, "X-Passenger-File");
+			}
+
 			if (ret == OK) {
 				// The API documentation for ap_scan_script_err_brigade() says it
 				// returns HTTP_OK on success, but it actually returns OK.
@@ -646,6 +930,30 @@ private:
 				 * out. Some broken HTTP clients depend on the
 				 * Status header for retrieving the HTTP status.
 				 */
+				long long bodySize = getResponseBodySize(r, coreKeepAlive);
+				if (coreFile != NULL) {
+					// The Passenger core doesn't send a body in this case.
+					if (getBufferedBodySize(bb) != 0) {
+						coreKeepAlive = false;
+					}
+					bucketState->bodyBytesRemaining = 0;
+					if (!insertCoreFile(r, bb, coreFile)) {
+						apr_brigade_cleanup(bb);
+						if (coreKeepAlive) {
+							checkinCoreConnection(conn);
+						}
+						return HTTP_INTERNAL_SERVER_ERROR;
+					}
+				} else if (bodySize != -1) {
+					long long bufferedBodySize = getBufferedBodySize(bb);
+					if (bufferedBodySize <= bodySize) {
+						bucketState->bodyBytesRemaining = bodySize - bufferedBodySize;
+					} else {
+						// The Passenger core sent more than it announced.
+						coreKeepAlive = false;
+					}
+				}
+
 				if (!r->status_line || *r->status_line == '\0') {
 					r->status_line = getStatusCodeAndReasonPhrase(r->status);
 					if (r->status_line == NULL) {
@@ -667,9 +975,17 @@ private:
 					 */
 					int originalStatus = r->status;
 					r->status = HTTP_OK;
+					apr_brigade_cleanup(bb);
 					return originalStatus;
 				} else if (ap_pass_brigade(r->output_filters, bb) == APR_SUCCESS) {
 					apr_brigade_cleanup(bb);
+					if (coreKeepAlive
+					 && bucketState->completed
+					 && bucketState->errorCode == 0
+					 && bucketState->bodyBytesRemaining == 0)
+					{
+						checkinCoreConnection(conn);
+					}
 				}
 				return OK;
 			} else {
@@ -826,21 +1142,8 @@ private:
 		}
 	}
 
-	void addHeader(string &headers, const StaticString &name, DirConfig::Threeway value) {
-		if (value != DirConfig::UNSET) {
-			headers.append(name.data(), name.size());
-			headers.append(": ", 2);
-			if (value == DirConfig::ENABLED) {
-				headers.append("t", 1);
-			} else {
-				headers.append("f", 1);
-			}
-			headers.append("\r\n", 2);
-		}
-	}
-
 	string constructRequestHeaders(request_rec *r, DirectoryMapper &mapper,
-		bool &bodyIsChunked)
+		bool &bodyIsChunked, bool handOff)
 	{
 		const char *baseURI = mapper.getBaseURI();
 		DirConfig *config = getDirConfig(r);
@@ -914,7 +1217,8 @@ private:
 		if (connectionHeader != NULL && connectionUpgradeFlagSet(connectionHeader->val)) {
 			result.append("Connection: upgrade\r\n", sizeof("Connection: upgrade\r\n") - 1);
 		} else {
-			result.append("Connection: close\r\n", sizeof("Connection: close\r\n") - 1);
+			// See checkoutCoreConnection().
+			result.append("Connection: keep-alive\r\n", sizeof("Connection: keep-alive\r\n") - 1);
 		}
 
 		if (transferEncodingHeader != NULL) {
@@ -964,21 +1268,10 @@ private:
 			result.append("\r\n", 2);
 		}
 
-		// Phusion Passenger options.
+		// Phusion Passenger options. The ones that only depend on the
+		// DirConfig are sent separately by sendRequestHeaders().
 		addHeader(result, P_STATIC_STRING("!~PASSENGER_APP_ROOT"), mapper.getAppRoot());
 		addHeader(result, P_STATIC_STRING("!~PASSENGER_APP_TYPE"), mapper.getApplicationTypeName());
-		if (config->useUnionStation() && !config->unionStationKey.empty()) {
-			addHeader(result, P_STATIC_STRING("!~UNION_STATION_SUPPORT"), P_STATIC_STRING("t"));
-			addHeader(result, P_STATIC_STRING("!~UNION_STATION_KEY"), config->unionStationKey);
-			if (!config->unionStationFilters.empty()) {
-				addHeader(result, P_STATIC_STRING("!~UNION_STATION_FILTERS"),
-					config->getUnionStationFilterString());
-			}
-		}
-		#include "SetHeaders.cpp"
-
-		/*********************/
-		/*********************/
 
 		// Add environment variables.
 
@@ -1026,19 +1319,111 @@ private:
 		// D = Dechunk
 		// B = Buffer request body
 		// S = SSL
+		// F = We send files that the Passenger core names in an
+		//     X-Passenger-File response header ourselves
+		// H = We hand off the client connection; the Passenger core
+		//     responds to the client directly
 
-		result.append("!~FLAGS: CD", sizeof("!~FLAGS: CD") - 1);
+		if (handOff) {
+			result.append("!~FLAGS: CH", sizeof("!~FLAGS: CH") - 1);
+		} else {
+			result.append("!~FLAGS: CDF", sizeof("!~FLAGS: CDF") - 1);
+		}
 		if (config->bufferUpload != DirConfig::DISABLED) {
 			result.append("B", 1);
 		}
 		if (lookupEnv(r, "HTTPS") != NULL) {
 			result.append("S", 1);
 		}
-		result.append("\r\n\r\n", 4);
+		result.append("\r\n", 2);
 
 		return result;
 	}
 
+	/**
+	 * Sends the request headers constructed by constructRequestHeaders(),
+	 * followed by the headers that only depend on the DirConfig and the
+	 * end of the header block, in a single writev() call. If `clientFd`
+	 * is given, then it's passed along with the headers.
+	 *
+	 * The DirConfigs that Apache uses for more than one request have been
+	 * serialized by passenger_postprocess_config(). Other DirConfigs are
+	 * merged for this request only, so serializing them here costs no more
+	 * than appending their headers in constructRequestHeaders() did.
+	 */
+	void sendRequestHeaders(const FileDescriptor &conn, DirConfig *config,
+		const string &headers, int clientFd = -1)
+	{
+		string buffer;
+		StaticString data[3];
+
+		data[0] = headers;
+		if (config->staticHeadersSerialized) {
+			data[1] = config->staticHeaders;
+		} else {
+			config->serializeStaticHeaders(buffer);
+			data[1] = buffer;
+		}
+		data[2] = P_STATIC_STRING("\r\n");
+		if (clientFd == -1) {
+			gatheredWrite(conn, data, 3);
+		} else {
+			gatheredWriteWithFd(conn, data, 3, clientFd);
+		}
+	}
+
+	/**
+	 * Like gatheredWrite(), but passes `fd` along with the data, so that
+	 * the Passenger core receives it together with the request header.
+	 */
+	static void gatheredWriteWithFd(int conn, const StaticString *data,
+		unsigned int dataCount, int fd)
+	{
+		struct msghdr msg;
+		struct iovec iov[3];
+		union {
+			struct cmsghdr header;
+			char data[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct cmsghdr *controlHeader;
+		ssize_t ret;
+		unsigned int i;
+
+		assert(dataCount <= 3);
+		memset(&msg, 0, sizeof(msg));
+		memset(&control, 0, sizeof(control));
+		for (i = 0; i < dataCount; i++) {
+			iov[i].iov_base = (void *) data[i].data();
+			iov[i].iov_len  = data[i].size();
+		}
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = dataCount;
+		msg.msg_control    = control.data;
+		msg.msg_controllen = sizeof(control.data);
+
+		controlHeader = CMSG_FIRSTHDR(&msg);
+		controlHeader->cmsg_level = SOL_SOCKET;
+		controlHeader->cmsg_type  = SCM_RIGHTS;
+		controlHeader->cmsg_len   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(controlHeader), &fd, sizeof(int));
+
+		ret = oxt::syscalls::sendmsg(conn, &msg, 0);
+		if (ret == -1) {
+			throw SystemException("Cannot pass the client connection to the Passenger core",
+				errno);
+		}
+
+		// Write whatever sendmsg() didn't.
+		for (i = 0; i < dataCount; i++) {
+			if ((size_t) ret >= data[i].size()) {
+				ret -= data[i].size();
+			} else {
+				writeExact(conn, data[i].data() + ret, data[i].size() - ret);
+				ret = 0;
+			}
+		}
+	}
+
 	static int getsfunc_BRIGADE(char *buf, int len, void *arg) {
 		apr_bucket_brigade *bb = (apr_bucket_brigade *)arg;
 		const char *dst_end = buf + len - 1; /* leave room for terminating null */
@@ -1234,8 +1619,7 @@ private:
 
 public:
 	Hooks(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
-	    : cstat(1024),
-	      watchdogLauncher(IM_APACHE)
+	    : watchdogLauncher(IM_APACHE)
 	{
 		passenger_postprocess_config(s);
 
@@ -1257,6 +1641,7 @@ public:
 		m_hasModDir = UNKNOWN;
 		m_hasModAutoIndex = UNKNOWN;
 		m_hasModXsendfile = UNKNOWN;
+		staticAssetManifests.setThrottleRate(serverConfig.statThrottleRate);
 
 		P_DEBUG("Initializing Phusion Passenger...");
 		ap_add_version_component(pconf, SERVER_TOKEN_NAME "/" PASSENGER_VERSION);
@@ -1311,6 +1696,7 @@ public:
 			.set    ("union_station_gateway_cert", serverConfig.unionStationGatewayCert)
 			.set    ("union_station_proxy_address", serverConfig.unionStationProxyAddress)
 			.setBool("turbocaching", serverConfig.turbocaching)
+			.setBool("accept_client_handoff", serverConfig.asyncHandoff)
 			.setStrSet("prestart_urls", serverConfig.prestartURLs);
 
 		if (serverConfig.logFile != NULL) {
@@ -61,6 +61,50 @@ config->minInstances =
 	(add->minInstances == UNSET_INT_VALUE) ?
 	base->minInstances :
 	add->minInstances;
+config->spawnConcurrency =
+	(add->spawnConcurrency == UNSET_INT_VALUE) ?
+	base->spawnConcurrency :
+	add->spawnConcurrency;
+config->rollingRestartBatchSize =
+	(add->rollingRestartBatchSize == UNSET_INT_VALUE) ?
+	base->rollingRestartBatchSize :
+	add->rollingRestartBatchSize;
+config->targetUtilization =
+	(add->targetUtilization == UNSET_INT_VALUE) ?
+	base->targetUtilization :
+	add->targetUtilization;
+config->preloaderStandbyProcesses =
+	(add->preloaderStandbyProcesses == UNSET_INT_VALUE) ?
+	base->preloaderStandbyProcesses :
+	add->preloaderStandbyProcesses;
+config->recycleJitter =
+	(add->recycleJitter == UNSET_INT_VALUE) ?
+	base->recycleJitter :
+	add->recycleJitter;
+config->capacityWeight =
+	(add->capacityWeight == UNSET_INT_VALUE) ?
+	base->capacityWeight :
+	add->capacityWeight;
+config->maxOutOfBandWorkPercentage =
+	(add->maxOutOfBandWorkPercentage == UNSET_INT_VALUE) ?
+	base->maxOutOfBandWorkPercentage :
+	add->maxOutOfBandWorkPercentage;
+config->outOfBandWorkMaxUtilization =
+	(add->outOfBandWorkMaxUtilization == UNSET_INT_VALUE) ?
+	base->outOfBandWorkMaxUtilization :
+	add->outOfBandWorkMaxUtilization;
+config->outOfBandWorkIdleInterval =
+	(add->outOfBandWorkIdleInterval == UNSET_INT_VALUE) ?
+	base->outOfBandWorkIdleInterval :
+	add->outOfBandWorkIdleInterval;
+config->warmupTime =
+	(add->warmupTime == UNSET_INT_VALUE) ?
+	base->warmupTime :
+	add->warmupTime;
+config->memoryLimit =
+	(add->memoryLimit == UNSET_INT_VALUE) ?
+	base->memoryLimit :
+	add->memoryLimit;
 config->maxInstancesPerApp =
 	(add->maxInstancesPerApp == UNSET_INT_VALUE) ?
 	base->maxInstancesPerApp :
@@ -97,6 +141,22 @@ config->maxRequestQueueSize =
 	(add->maxRequestQueueSize == UNSET_INT_VALUE) ?
 	base->maxRequestQueueSize :
 	add->maxRequestQueueSize;
+config->requestQueueTargetDelay =
+	(add->requestQueueTargetDelay == UNSET_INT_VALUE) ?
+	base->requestQueueTargetDelay :
+	add->requestQueueTargetDelay;
+config->rateLimit =
+	(add->rateLimit == UNSET_INT_VALUE) ?
+	base->rateLimit :
+	add->rateLimit;
+config->rateLimitBurst =
+	(add->rateLimitBurst == UNSET_INT_VALUE) ?
+	base->rateLimitBurst :
+	add->rateLimitBurst;
+config->maxRequestsInFlight =
+	(add->maxRequestsInFlight == UNSET_INT_VALUE) ?
+	base->maxRequestsInFlight :
+	add->maxRequestsInFlight;
 config->maxPreloaderIdleTime =
 	(add->maxPreloaderIdleTime == UNSET_INT_VALUE) ?
 	base->maxPreloaderIdleTime :
@@ -105,6 +165,18 @@ config->loadShellEnvvars =
 	(add->loadShellEnvvars == DirConfig::UNSET) ?
 	base->loadShellEnvvars :
 	add->loadShellEnvvars;
+config->preloaderCompactHeap =
+	(add->preloaderCompactHeap == DirConfig::UNSET) ?
+	base->preloaderCompactHeap :
+	add->preloaderCompactHeap;
+config->preloaderWarmupScript =
+	(add->preloaderWarmupScript == NULL) ?
+	base->preloaderWarmupScript :
+	add->preloaderWarmupScript;
+config->rollingRestarts =
+	(add->rollingRestarts == DirConfig::UNSET) ?
+	base->rollingRestarts :
+	add->rollingRestarts;
 config->bufferUpload =
 	(add->bufferUpload == DirConfig::UNSET) ?
 	base->bufferUpload :
@@ -52,10 +52,43 @@ addHeader(result, StaticString("!~PASSENGER_METEOR_APP_SETTINGS",
 addHeader(result, StaticString("!~PASSENGER_APP_ENV",
 		sizeof("!~PASSENGER_APP_ENV") - 1),
 	config->appEnv);
-addHeader(r, result, StaticString("!~PASSENGER_MIN_PROCESSES",
+addHeader(result, StaticString("!~PASSENGER_MIN_PROCESSES",
 		sizeof("!~PASSENGER_MIN_PROCESSES") - 1),
 	config->minInstances);
-addHeader(r, result, StaticString("!~PASSENGER_MAX_PROCESSES",
+addHeader(result, StaticString("!~PASSENGER_SPAWN_CONCURRENCY",
+		sizeof("!~PASSENGER_SPAWN_CONCURRENCY") - 1),
+	config->spawnConcurrency);
+addHeader(result, StaticString("!~PASSENGER_ROLLING_RESTART_BATCH_SIZE",
+		sizeof("!~PASSENGER_ROLLING_RESTART_BATCH_SIZE") - 1),
+	config->rollingRestartBatchSize);
+addHeader(result, StaticString("!~PASSENGER_TARGET_UTILIZATION",
+		sizeof("!~PASSENGER_TARGET_UTILIZATION") - 1),
+	config->targetUtilization);
+addHeader(result, StaticString("!~PASSENGER_PRELOADER_STANDBY_PROCESSES",
+		sizeof("!~PASSENGER_PRELOADER_STANDBY_PROCESSES") - 1),
+	config->preloaderStandbyProcesses);
+addHeader(result, StaticString("!~PASSENGER_RECYCLE_JITTER",
+		sizeof("!~PASSENGER_RECYCLE_JITTER") - 1),
+	config->recycleJitter);
+addHeader(result, StaticString("!~PASSENGER_CAPACITY_WEIGHT",
+		sizeof("!~PASSENGER_CAPACITY_WEIGHT") - 1),
+	config->capacityWeight);
+addHeader(result, StaticString("!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE",
+		sizeof("!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE") - 1),
+	config->maxOutOfBandWorkPercentage);
+addHeader(result, StaticString("!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION",
+		sizeof("!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION") - 1),
+	config->outOfBandWorkMaxUtilization);
+addHeader(result, StaticString("!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL",
+		sizeof("!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL") - 1),
+	config->outOfBandWorkIdleInterval);
+addHeader(result, StaticString("!~PASSENGER_WARMUP_TIME",
+		sizeof("!~PASSENGER_WARMUP_TIME") - 1),
+	config->warmupTime);
+addHeader(result, StaticString("!~PASSENGER_MEMORY_LIMIT",
+		sizeof("!~PASSENGER_MEMORY_LIMIT") - 1),
+	config->memoryLimit);
+addHeader(result, StaticString("!~PASSENGER_MAX_PROCESSES",
 		sizeof("!~PASSENGER_MAX_PROCESSES") - 1),
 	config->maxInstancesPerApp);
 addHeader(result, StaticString("!~PASSENGER_USER",
@@ -64,21 +97,42 @@ addHeader(result, StaticString("!~PASSENGER_USER",
 addHeader(result, StaticString("!~PASSENGER_GROUP",
 		sizeof("!~PASSENGER_GROUP") - 1),
 	config->group);
-addHeader(r, result, StaticString("!~PASSENGER_MAX_REQUESTS",
+addHeader(result, StaticString("!~PASSENGER_MAX_REQUESTS",
 		sizeof("!~PASSENGER_MAX_REQUESTS") - 1),
 	config->maxRequests);
-addHeader(r, result, StaticString("!~PASSENGER_START_TIMEOUT",
+addHeader(result, StaticString("!~PASSENGER_START_TIMEOUT",
 		sizeof("!~PASSENGER_START_TIMEOUT") - 1),
 	config->startTimeout);
-addHeader(r, result, StaticString("!~PASSENGER_MAX_REQUEST_QUEUE_SIZE",
+addHeader(result, StaticString("!~PASSENGER_MAX_REQUEST_QUEUE_SIZE",
 		sizeof("!~PASSENGER_MAX_REQUEST_QUEUE_SIZE") - 1),
 	config->maxRequestQueueSize);
-addHeader(r, result, StaticString("!~PASSENGER_MAX_PRELOADER_IDLE_TIME",
+addHeader(result, StaticString("!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY",
+		sizeof("!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY") - 1),
+	config->requestQueueTargetDelay);
+addHeader(result, StaticString("!~PASSENGER_RATE_LIMIT",
+		sizeof("!~PASSENGER_RATE_LIMIT") - 1),
+	config->rateLimit);
+addHeader(result, StaticString("!~PASSENGER_RATE_LIMIT_BURST",
+		sizeof("!~PASSENGER_RATE_LIMIT_BURST") - 1),
+	config->rateLimitBurst);
+addHeader(result, StaticString("!~PASSENGER_MAX_REQUESTS_IN_FLIGHT",
+		sizeof("!~PASSENGER_MAX_REQUESTS_IN_FLIGHT") - 1),
+	config->maxRequestsInFlight);
+addHeader(result, StaticString("!~PASSENGER_MAX_PRELOADER_IDLE_TIME",
 		sizeof("!~PASSENGER_MAX_PRELOADER_IDLE_TIME") - 1),
 	config->maxPreloaderIdleTime);
 addHeader(result, StaticString("!~PASSENGER_LOAD_SHELL_ENVVARS",
 		sizeof("!~PASSENGER_LOAD_SHELL_ENVVARS") - 1),
 	config->loadShellEnvvars);
+addHeader(result, StaticString("!~PASSENGER_PRELOADER_COMPACT_HEAP",
+		sizeof("!~PASSENGER_PRELOADER_COMPACT_HEAP") - 1),
+	config->preloaderCompactHeap);
+addHeader(result, StaticString("!~PASSENGER_PRELOADER_WARMUP_SCRIPT",
+		sizeof("!~PASSENGER_PRELOADER_WARMUP_SCRIPT") - 1),
+	config->preloaderWarmupScript);
+addHeader(result, StaticString("!~PASSENGER_ROLLING_RESTARTS",
+		sizeof("!~PASSENGER_ROLLING_RESTARTS") - 1),
+	config->rollingRestarts);
 addHeader(result, StaticString("!~PASSENGER_STARTUP_FILE",
 		sizeof("!~PASSENGER_STARTUP_FILE") - 1),
 	config->startupFile);
@@ -103,9 +157,9 @@ addHeader(result, StaticString("!~PASSENGER_RESTART_DIR",
 addHeader(result, StaticString("!~PASSENGER_APP_GROUP_NAME",
 		sizeof("!~PASSENGER_APP_GROUP_NAME") - 1),
 	config->appGroupName);
-addHeader(r, result, StaticString("!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS",
+addHeader(result, StaticString("!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS",
 		sizeof("!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS") - 1),
 	config->forceMaxConcurrentRequestsPerProcess);
-addHeader(r, result, StaticString("!~PASSENGER_LVE_MIN_UID",
+addHeader(result, StaticString("!~PASSENGER_LVE_MIN_UID",
 		sizeof("!~PASSENGER_LVE_MIN_UID") - 1),
 	config->lveMinUid);
@@ -0,0 +1,156 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_ALGORITHMS_LATENCY_HISTOGRAM_H_
+#define _PASSENGER_ALGORITHMS_LATENCY_HISTOGRAM_H_
+
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A fixed-size, log-linear histogram of durations in microseconds, in the
+ * spirit of HdrHistogram. Every power-of-two range is split into
+ * SUB_BUCKETS linear sub-buckets, so recorded values (and thus percentiles)
+ * have a relative error of at most 1 / SUB_BUCKETS, independent of their
+ * magnitude. Recording is a few shifts and an increment, so it is cheap
+ * enough to do for every request.
+ *
+ * Not thread-safe. Merge per-thread histograms with `merge()` instead.
+ */
+class LatencyHistogram {
+public:
+	static const unsigned int SUB_BUCKET_BITS = 2;
+	static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	/** Values of 2^MAX_EXPONENT usec (about 36 minutes) and up share the last bucket. */
+	static const unsigned int MAX_EXPONENT = 31;
+	static const unsigned int BUCKETS = SUB_BUCKETS
+		+ (MAX_EXPONENT - SUB_BUCKET_BITS) * SUB_BUCKETS + 1;
+
+private:
+	unsigned int buckets[BUCKETS];
+	boost::uint64_t count;
+	boost::uint64_t total;
+	boost::uint64_t max;
+
+	static unsigned int bucketFor(boost::uint64_t value) {
+		if (value < SUB_BUCKETS) {
+			return value;
+		}
+
+		unsigned int exponent = 63 - __builtin_clzll(value);
+		if (exponent >= MAX_EXPONENT) {
+			return BUCKETS - 1;
+		}
+		unsigned int subBucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+		return SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * SUB_BUCKETS + subBucket;
+	}
+
+	/** The largest value that falls into the given bucket. */
+	static boost::uint64_t bucketUpperBound(unsigned int bucket) {
+		if (bucket < SUB_BUCKETS) {
+			return bucket;
+		} else if (bucket == BUCKETS - 1) {
+			return ~(boost::uint64_t) 0;
+		}
+
+		unsigned int exponent = (bucket - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+		unsigned int subBucket = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+		boost::uint64_t width = 1ull << (exponent - SUB_BUCKET_BITS);
+		return (1ull << exponent) + (subBucket + 1) * width - 1;
+	}
+
+public:
+	LatencyHistogram() {
+		reset();
+	}
+
+	void reset() {
+		memset(buckets, 0, sizeof(buckets));
+		count = 0;
+		total = 0;
+		max = 0;
+	}
+
+	void record(boost::uint64_t usec) {
+		buckets[bucketFor(usec)]++;
+		count++;
+		total += usec;
+		max = std::max(max, usec);
+	}
+
+	void merge(const LatencyHistogram &other) {
+		for (unsigned int i = 0; i < BUCKETS; i++) {
+			buckets[i] += other.buckets[i];
+		}
+		count += other.count;
+		total += other.total;
+		max = std::max(max, other.max);
+	}
+
+	boost::uint64_t getCount() const {
+		return count;
+	}
+
+	boost::uint64_t getAverage() const {
+		return (count == 0) ? 0 : total / count;
+	}
+
+	boost::uint64_t getMax() const {
+		return max;
+	}
+
+	/**
+	 * Returns the value below which `percentile` (0..100) percent of the
+	 * recorded values fall, rounded up to the end of its bucket but never
+	 * more than the largest recorded value.
+	 */
+	boost::uint64_t getPercentile(double percentile) const {
+		if (count == 0) {
+			return 0;
+		}
+
+		boost::uint64_t threshold = (boost::uint64_t) (count * percentile / 100.0 + 0.5);
+		boost::uint64_t seen = 0;
+		threshold = std::max<boost::uint64_t>(threshold, 1);
+		for (unsigned int i = 0; i < BUCKETS; i++) {
+			seen += buckets[i];
+			if (seen >= threshold) {
+				return std::min(bucketUpperBound(i), max);
+			}
+		}
+		return max;
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_ALGORITHMS_LATENCY_HISTOGRAM_H_ */
@@ -46,7 +46,9 @@
 #define DEFAULT_ANALYTICS_LOG_USER "nobody"
 #define DEFAULT_APP_ENV "production"
 #define DEFAULT_APP_THREAD_COUNT 1
+#define DEFAULT_CLIENT_HEADER_TIMEOUT 60
 #define DEFAULT_CONCURRENCY_MODEL "process"
+#define DEFAULT_CORE_SPARE_CLIENTS 128
 #define DEFAULT_FILE_BUFFERED_CHANNEL_THRESHOLD 131072
 #define DEFAULT_HTTP_SERVER_LISTEN_ADDRESS "tcp://127.0.0.1:3000"
 #define DEFAULT_INTEGRATION_MODE "standalone"
@@ -56,19 +58,33 @@
 #define DEFAULT_MAX_PRELOADER_IDLE_TIME 300
 #define DEFAULT_MAX_REQUEST_QUEUE_SIZE 100
 #define DEFAULT_MBUF_CHUNK_SIZE 4096
+#define DEFAULT_MBUF_POOL_TRIM_INTERVAL 60
 #define DEFAULT_NODEJS "node"
 #define DEFAULT_POOL_IDLE_TIME 300
 #define DEFAULT_PYTHON "python"
+#define DEFAULT_REQUEST_BODY_PREBUFFER_SIZE 65536
+#define DEFAULT_REQUEST_BODY_SLOW_RATE 262144
+#define DEFAULT_REQUEST_TRACE_ENTRIES 65536
+#define DEFAULT_RESPONSE_BUFFER_FULL_BUFFERING_SIZE 8388608
 #define DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK 134217728
+#define DEFAULT_ROUTING_POLICY "least-busy"
 #define DEFAULT_RUBY "ruby"
 #define DEFAULT_SOCKET_BACKLOG 2048
 #define DEFAULT_SPAWN_METHOD "smart"
 #define DEFAULT_START_TIMEOUT 90000
 #define DEFAULT_STAT_THROTTLE_RATE 10
 #define DEFAULT_STICKY_SESSIONS_COOKIE_NAME "_passenger_route"
+#define DEFAULT_TLS_SESSION_CACHE_SIZE 20480
+#define DEFAULT_TLS_SESSION_TIMEOUT 300
+#define DEFAULT_TURBOCACHE_ENTRIES 8
+#define DEFAULT_TURBOCACHE_MAX_BODY_SIZE 32768
 #define DEFAULT_UNION_STATION_GATEWAY_ADDRESS "gateway.unionstationapp.com"
 #define DEFAULT_UNION_STATION_GATEWAY_PORT 443
+#define DEFAULT_UNION_STATION_SLOW_REQUEST_THRESHOLD 2000
+#define DEFAULT_UNION_STATION_SPILL_LIMIT 64
+#define DEFAULT_UNION_STATION_UPLOAD_WORKERS 4
 #define DEFAULT_UST_ROUTER_LISTEN_ADDRESS "tcp://127.0.0.1:9344"
+#define DEFAULT_UST_ROUTER_LOG_BUFFER_SIZE 65536
 #define DEFAULT_WEB_APP_USER "nobody"
 #define ENTERPRISE_URL "https://www.phusionpassenger.com/enterprise"
 #define FEEDBACK_FD 3
@@ -0,0 +1,179 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_DATA_STRUCTURES_HASH_TABLE_CONTROL_BYTES_H_
+#define _PASSENGER_DATA_STRUCTURES_HASH_TABLE_CONTROL_BYTES_H_
+
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <cstring>
+#include <cstddef>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace Passenger {
+
+
+/**
+ * A SwissTable-style control byte array that accelerates probing in the
+ * open addressing, linear probing hash tables StringKeyTable and
+ * ServerKit::HeaderTable.
+ *
+ * There is one control byte per cell. It is either EMPTY, or a 7-bit tag
+ * derived from the hash of the key in that cell. Probing loads the control
+ * bytes of GROUP_SIZE consecutive cells at once and compares them against
+ * the tag of the key that is looked up (with SSE2 where available), so that
+ * only cells whose tag matches (on average 1 in 128 non-matching cells) have
+ * to be compared against the key, and a miss usually costs a single group
+ * load instead of a walk over the probe chain.
+ *
+ * The cells are still laid out as in plain linear probing, so the tables'
+ * insertion, backward shift deletion and iteration logic stay the same; the
+ * tables only need to keep the control bytes in sync through set().
+ *
+ * The first GROUP_SIZE - 1 control bytes are mirrored after the end of the
+ * array, so that a group that starts near the end of the array wraps around
+ * without special casing.
+ */
+class HashTableControlBytes {
+public:
+	static const unsigned int GROUP_SIZE = 16;
+	static const boost::uint8_t EMPTY = 0x80;
+
+	/** The number of control bytes to allocate for a table of `arraySize` cells. */
+	static unsigned int allocationSize(unsigned int arraySize) {
+		return arraySize + GROUP_SIZE - 1;
+	}
+
+	OXT_FORCE_INLINE
+	static boost::uint8_t tag(boost::uint32_t hash) {
+		// The low bits of the hash select the first cell, so use the high bits.
+		return hash >> 25;
+	}
+
+	static void clear(boost::uint8_t *ctrl, unsigned int arraySize) {
+		memset(ctrl, EMPTY, allocationSize(arraySize));
+	}
+
+	OXT_FORCE_INLINE
+	static void set(boost::uint8_t *ctrl, unsigned int arraySize, unsigned int index,
+		boost::uint8_t value)
+	{
+		ctrl[index] = value;
+		for (unsigned int i = index + arraySize; i < arraySize + GROUP_SIZE - 1; i += arraySize) {
+			ctrl[i] = value;
+		}
+	}
+
+	/**
+	 * Probes a table of `arraySize` cells, starting at the ideal cell for
+	 * `hash`, until an empty cell is found. `matcher(index)` is called, in
+	 * probe order, for every cell before that empty cell whose tag matches.
+	 *
+	 * Returns the index of the first cell for which `matcher` returns true,
+	 * or -1 if there is none. In the latter case, `*emptyIndex` (if not NULL)
+	 * is set to the index of the empty cell that ended the probe chain, which
+	 * is where linear probing would insert the key.
+	 *
+	 * The table must contain at least one empty cell.
+	 */
+	template<typename Matcher>
+	OXT_FORCE_INLINE
+	static int probe(const boost::uint8_t *ctrl, unsigned int arraySize, boost::uint32_t hash,
+		const Matcher &matcher, unsigned int *emptyIndex = NULL)
+	{
+		const unsigned int mask = arraySize - 1;
+		const boost::uint8_t hashTag = tag(hash);
+		unsigned int pos = hash & mask;
+
+		while (true) {
+			unsigned int matches, empties;
+			matchGroup(ctrl + pos, hashTag, matches, empties);
+			if (empties != 0) {
+				// Only the cells before the first empty cell belong to the chain.
+				matches &= (empties & (0 - empties)) - 1;
+			}
+			while (matches != 0) {
+				unsigned int index = (pos + lowestBit(matches)) & mask;
+				if (matcher(index)) {
+					return index;
+				}
+				matches &= matches - 1;
+			}
+			if (empties != 0) {
+				if (emptyIndex != NULL) {
+					*emptyIndex = (pos + lowestBit(empties)) & mask;
+				}
+				return -1;
+			}
+			pos = (pos + GROUP_SIZE) & mask;
+		}
+	}
+
+private:
+	OXT_FORCE_INLINE
+	static unsigned int lowestBit(unsigned int bits) {
+		#ifdef __GNUC__
+			return __builtin_ctz(bits);
+		#else
+			unsigned int result = 0;
+			while ((bits & 1) == 0) {
+				bits >>= 1;
+				result++;
+			}
+			return result;
+		#endif
+	}
+
+	/**
+	 * Sets bit i of `matches` if the control byte of cell i in the group
+	 * equals `hashTag`, and bit i of `empties` if that cell is empty.
+	 */
+	OXT_FORCE_INLINE
+	static void matchGroup(const boost::uint8_t *group, boost::uint8_t hashTag,
+		unsigned int &matches, unsigned int &empties)
+	{
+		#ifdef __SSE2__
+			__m128i bytes = _mm_loadu_si128((const __m128i *) group);
+			matches = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) hashTag)));
+			// EMPTY is the only control byte value with the high bit set.
+			empties = _mm_movemask_epi8(bytes);
+		#else
+			matches = 0;
+			empties = 0;
+			for (unsigned int i = 0; i < GROUP_SIZE; i++) {
+				matches |= (unsigned int) (group[i] == hashTag) << i;
+				empties |= (unsigned int) (group[i] == EMPTY) << i;
+			}
+		#endif
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_DATA_STRUCTURES_HASH_TABLE_CONTROL_BYTES_H_ */
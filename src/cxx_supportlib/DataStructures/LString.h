@@ -252,6 +252,53 @@ psg_lstr_make_contiguous(const LString *str, psg_pool_t *pool) {
 	}
 }
 
+/**
+ * Like psg_lstr_make_contiguous(), but modifies `str` in place instead of
+ * returning a contiguous copy. If `str` consists of multiple parts, then its
+ * data is copied into the pool once, the mbuf_blocks referenced by the old
+ * parts are unreferenced, and `str` is turned into a single part that
+ * references the copy. Because single-part strings are already contiguous,
+ * subsequent calls to this function or to psg_lstr_make_contiguous() on the
+ * same string don't copy anything, so use this on strings that are flattened
+ * more than once (e.g. request headers stored in a HeaderTable).
+ *
+ * Returns `str`.
+ */
+inline LString *
+psg_lstr_flatten(LString *str, psg_pool_t *pool) {
+	if (str->size == 0 || str->start == str->end) {
+		return str;
+	}
+
+	LString::Part *newPart, *part;
+	char *data, *pos;
+
+	data = (char *) psg_pnalloc(pool, str->size + 1);
+	newPart = (LString::Part *) psg_palloc(pool, sizeof(LString::Part));
+	if (OXT_UNLIKELY(data == NULL || newPart == NULL)) {
+		TRACE_POINT();
+		throw std::bad_alloc();
+	}
+
+	pos = data;
+	for (part = str->start; part != NULL; part = part->next) {
+		memcpy(pos, part->data, part->size);
+		pos += part->size;
+		if (part->mbuf_block != NULL) {
+			mbuf_block_unref(part->mbuf_block);
+		}
+	}
+	*pos = '\0';
+
+	newPart->next = NULL;
+	newPart->mbuf_block = NULL;
+	newPart->data = data;
+	newPart->size = str->size;
+	str->start = newPart;
+	str->end = newPart;
+	return str;
+}
+
 inline bool
 psg_lstr_cmp(const LString *str, const StaticString &other) {
 	const LString::Part *part;
@@ -34,6 +34,7 @@
 #include <cstddef>
 
 #include <DataStructures/HashedStaticString.h>
+#include <DataStructures/HashTableControlBytes.h>
 #include <StaticString.h>
 
 namespace Passenger {
@@ -52,8 +53,11 @@ struct SKT_DisableMoveSupport { };
  *  * Once the bulk insertion phase is over, lookups are frequent, but modifications
  *    are not.
  *
- * The hash table uses open addressing and linear probing. It also stores key data
- * in a single contiguous internal storage area, outside the cells. This reduces calls
+ * The hash table uses open addressing and linear probing. Probing is accelerated with
+ * a SwissTable-style control byte array (see HashTableControlBytes), so that most
+ * non-matching cells, and most misses, are rejected without touching the cells or
+ * the keys. It also stores key data in a single contiguous internal storage area,
+ * outside the cells. This reduces calls
  * to malloc(), avoids a lot of malloc space overhead and improves cache locality.
  * Because the table owns the key data, there's no need to allocate keys and to keep
  * them alive outside the hash table.
@@ -107,7 +111,28 @@ public:
 	};
 
 private:
+	struct KeyMatcher {
+		const Cell *cells;
+		const char *storage;
+		const HashedStaticString &key;
+
+		KeyMatcher(const Cell *_cells, const char *_storage, const HashedStaticString &_key)
+			: cells(_cells),
+			  storage(_storage),
+			  key(_key)
+			{ }
+
+		OXT_FORCE_INLINE
+		bool operator()(unsigned int index) const {
+			const Cell &cell = cells[index];
+			return cell.hash == key.hash()
+				&& compareKeys(storage + cell.keyOffset, cell.keyLength, key);
+		}
+	};
+
 	Cell *m_cells;
+	/** See HashTableControlBytes. */
+	boost::uint8_t *m_ctrl;
 	unsigned short m_arraySize;
 	unsigned short m_population;
 	// Index of a random non-empty cell
@@ -184,6 +209,9 @@ private:
 		// Allocate new array
 		m_arraySize = desiredSize;
 		m_cells = new Cell[m_arraySize];
+		delete[] m_ctrl;
+		m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+		HashTableControlBytes::clear(m_ctrl, m_arraySize);
 
 		if (oldCells == NULL) {
 			return;
@@ -198,6 +226,8 @@ private:
 					if (cellIsEmpty(newCell)) {
 						// Insert here
 						copyOrMoveCell(*oldCell, *newCell, MoveSupport());
+						HashTableControlBytes::set(m_ctrl, m_arraySize, newCell - m_cells,
+							HashTableControlBytes::tag(newCell->hash));
 						break;
 					} else {
 						newCell = SKT_CIRCULAR_NEXT(newCell);
@@ -233,6 +263,12 @@ private:
 		for (unsigned int i = 0; i < m_arraySize; i++) {
 			m_cells[i] = other.m_cells[i];
 		}
+		if (other.m_ctrl != NULL) {
+			m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+			memcpy(m_ctrl, other.m_ctrl, HashTableControlBytes::allocationSize(m_arraySize));
+		} else {
+			m_ctrl = NULL;
+		}
 
 		m_storageSize = other.m_storageSize;
 		m_storageUsed = other.m_storageUsed;
@@ -255,33 +291,33 @@ private:
 		}
 
 		while (true) {
-			Cell *cell = SKT_FIRST_CELL(key.hash());
-			while (true) {
-				const char *cellKey = lookupCellKey(cell);
-				if (cellKey == NULL) {
-					// Cell is empty. Insert here.
-					if (shouldRepopulateOnInsert()) {
-						// Time to resize
-						repopulate(m_arraySize * 2);
-						break;
-					}
-					m_population++;
-					cell->keyOffset = appendToStorage(key);
-					cell->keyLength = key.size();
-					cell->hash = key.hash();
-					copyOrMoveValue(val, cell->value, LocalMoveSupport());
-					nonEmptyIndex = cell - &m_cells[0];
-					return;
-				} else if (compareKeys(cellKey, cell->keyLength, key)) {
-					// Cell matches.
-					if (overwrite) {
-						copyOrMoveValue(val, cell->value, LocalMoveSupport());
-					}
-					return;
-				} else {
-					cell = SKT_CIRCULAR_NEXT(cell);
+			unsigned int emptyIndex = 0;
+			int index = HashTableControlBytes::probe(m_ctrl, m_arraySize, key.hash(),
+				KeyMatcher(m_cells, m_storage, key), &emptyIndex);
+			if (index != -1) {
+				// Cell matches.
+				if (overwrite) {
+					copyOrMoveValue(val, m_cells[index].value, LocalMoveSupport());
 				}
+				return;
+			}
+
+			// Found an empty cell. Insert here.
+			if (shouldRepopulateOnInsert()) {
+				// Time to resize
+				repopulate(m_arraySize * 2);
+				continue;
 			}
+			Cell *cell = &m_cells[emptyIndex];
+			m_population++;
+			cell->keyOffset = appendToStorage(key);
+			cell->keyLength = key.size();
+			cell->hash = key.hash();
+			copyOrMoveValue(val, cell->value, LocalMoveSupport());
+			HashTableControlBytes::set(m_ctrl, m_arraySize, emptyIndex,
+				HashTableControlBytes::tag(key.hash()));
+			nonEmptyIndex = emptyIndex;
+			return;
 		}
 	}
 
@@ -296,12 +332,14 @@ public:
 
 	~StringKeyTable() {
 		delete[] m_cells;
+		delete[] m_ctrl;
 		free(m_storage);
 	}
 
 	StringKeyTable &operator=(const StringKeyTable &other) {
 		if (this != &other) {
 			delete[] m_cells;
+			delete[] m_ctrl;
 			free(m_storage);
 			copyTableFrom(other);
 		}
@@ -317,8 +355,11 @@ public:
 		m_arraySize = initialSize;
 		if (initialSize == 0) {
 			m_cells = NULL;
+			m_ctrl = NULL;
 		} else {
 			m_cells = new Cell[m_arraySize];
+			m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+			HashTableControlBytes::clear(m_ctrl, m_arraySize);
 		}
 		m_population = 0;
 
@@ -331,27 +372,9 @@ public:
 		m_storageUsed = 0;
 	}
 
+	OXT_FORCE_INLINE
 	Cell *lookupCell(const HashedStaticString &key) {
-		assert(!key.empty());
-
-		if (m_cells == NULL) {
-			return NULL;
-		}
-
-		Cell *cell = SKT_FIRST_CELL(key.hash());
-		while (true) {
-			const char *cellKey = lookupCellKey(cell);
-			if (cellKey == NULL) {
-				// Empty cell found.
-				return NULL;
-			} else if (compareKeys(cellKey, cell->keyLength, key)) {
-				// Non-empty cell found.
-				return cell;
-			} else {
-				// Keep probing.
-				cell = SKT_CIRCULAR_NEXT(cell);
-			}
-		}
+		return const_cast<Cell *>(static_cast<const StringKeyTable *>(this)->lookupCell(key));
 	}
 
 	const Cell *lookupCell(const HashedStaticString &key) const {
@@ -361,19 +384,12 @@ public:
 			return NULL;
 		}
 
-		const Cell *cell = SKT_FIRST_CELL(key.hash());
-		while (true) {
-			const char *cellKey = lookupCellKey(cell);
-			if (cellKey == NULL) {
-				// Empty cell found.
-				return NULL;
-			} else if (compareKeys(cellKey, cell->keyLength, key)) {
-				// Non-empty cell found.
-				return cell;
-			} else {
-				// Keep probing.
-				cell = SKT_CIRCULAR_NEXT(cell);
-			}
+		int index = HashTableControlBytes::probe(m_ctrl, m_arraySize, key.hash(),
+			KeyMatcher(m_cells, m_storage, key));
+		if (index != -1) {
+			return &m_cells[index];
+		} else {
+			return NULL;
 		}
 	}
 
@@ -454,6 +470,8 @@ public:
 				// Note that this doesn't erase the key from storage.
 				cell->keyOffset = EMPTY_CELL_KEY_OFFSET;
 				cell->value = T();
+				HashTableControlBytes::set(m_ctrl, m_arraySize, cell - m_cells,
+					HashTableControlBytes::EMPTY);
 				m_population--;
 				if (m_population == 0) {
 					nonEmptyIndex = NON_EMPTY_INDEX_NONE;
@@ -467,6 +485,8 @@ public:
 			if (SKT_CIRCULAR_OFFSET(ideal, cell) < SKT_CIRCULAR_OFFSET(ideal, neighbor)) {
 				// Swap with neighbor, then make neighbor the new cell to remove.
 				*cell = *neighbor;
+				HashTableControlBytes::set(m_ctrl, m_arraySize, cell - m_cells,
+					m_ctrl[neighbor - m_cells]);
 				cell = neighbor;
 			}
 			neighbor = SKT_CIRCULAR_NEXT(neighbor);
@@ -493,6 +513,7 @@ public:
 			m_cells[i].keyOffset = EMPTY_CELL_KEY_OFFSET;
 			m_cells[i].value = T();
 		}
+		HashTableControlBytes::clear(m_ctrl, m_arraySize);
 		m_population = 0;
 		m_storageUsed = 0;
 		nonEmptyIndex = NON_EMPTY_INDEX_NONE;
@@ -501,6 +522,8 @@ public:
 	void freeMemory() {
 		delete[] m_cells;
 		m_cells = NULL;
+		delete[] m_ctrl;
+		m_ctrl = NULL;
 		m_arraySize  = 0;
 		m_population = 0;
 
@@ -409,6 +409,11 @@ public:
 			msg = str.str();
 		}
 
+	RequestQueueFullException(const string &message)
+		: GetAbortedException(oxt::tracable_exception::no_backtrace()),
+		  msg(message)
+		{ }
+
 	virtual ~RequestQueueFullException() throw() {}
 
 	virtual const char *what() const throw() {
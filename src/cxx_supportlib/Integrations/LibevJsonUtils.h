@@ -32,6 +32,7 @@
 #include <ctime>
 #include <Utils/StrIntUtils.h>
 #include <Utils/SystemTime.h>
+#include <Utils/JsonWriter.h>
 
 namespace Passenger {
 
@@ -86,6 +87,47 @@ evTimeToJson(ev_tstamp evTime, ev_tstamp evNow, unsigned long long now = 0) {
 	return doc;
 }
 
+/**
+ * Like evTimeToJson() above, but writes the object to `writer`.
+ */
+inline void
+evTimeToJson(JsonWriter &writer, ev_tstamp evTime, ev_tstamp evNow,
+	unsigned long long now = 0)
+{
+	if (evTime <= 0) {
+		writer.nullValue();
+		return;
+	}
+
+	if (now == 0) {
+		now = SystemTime::getUsec();
+	}
+
+	unsigned long long wallClockTimeUsec = now
+		+ (evTime - evNow) * 1000000ull;
+	time_t wallClockTime = (time_t) (wallClockTimeUsec / 1000000ull);
+	char buf[32];
+	size_t len;
+
+	ctime_r(&wallClockTime, buf);
+	len = strlen(buf);
+	if (len > 0) {
+		// Get rid of trailing newline
+		buf[len - 1] = '\0';
+	}
+
+	writer.beginObject();
+	writer.member("timestamp", wallClockTimeUsec / 1000000.0);
+	writer.member("local", (const char *) buf);
+	writer.member("relative_timestamp", evTime - evNow);
+	if (evTime > evNow) {
+		writer.member("relative", distanceOfTimeInWords(evTime, evNow) + " from now");
+	} else {
+		writer.member("relative", distanceOfTimeInWords(evTime, evNow) + " ago");
+	}
+	writer.endObject();
+}
+
 
 } // namespace Passenger
 
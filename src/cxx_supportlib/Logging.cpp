@@ -28,9 +28,12 @@
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <boost/atomic.hpp>
+#include <vector>
 #include <Logging.h>
 #include <Constants.h>
 #include <StaticString.h>
@@ -51,6 +54,59 @@ static int fileDescriptorLog = -1;
 static string fileDescriptorLogFile;
 
 #define TRUNCATE_LOGPATHS_TO_MAXCHARS 3 // set to 0 to disable truncation
+#define ASYNC_LOG_FLUSH_INTERVAL 10 // msec
+
+namespace {
+	/**
+	 * A single-producer, single-consumer ring buffer of log entry bytes.
+	 * `head` and `tail` only ever increase; the producer owns `head`, the
+	 * writer thread owns `tail`. Entries are only published in whole, so
+	 * the writer can write out everything between `tail` and `head` as-is.
+	 */
+	struct LogRing {
+		char *buffer;
+		unsigned int capacity; // A power of two.
+		unsigned int generation;
+		pthread_t thread;
+		boost::atomic<boost::uint64_t> head;
+		boost::atomic<boost::uint64_t> tail;
+		boost::atomic<boost::uint64_t> dropped;
+		/** Set when the owning thread has exited. */
+		boost::atomic<bool> orphaned;
+
+		LogRing(unsigned int _capacity, unsigned int _generation)
+			: buffer((char *) malloc(_capacity)),
+			  capacity(_capacity),
+			  generation(_generation),
+			  thread(pthread_self()),
+			  head(0),
+			  tail(0),
+			  dropped(0),
+			  orphaned(false)
+			{ }
+
+		~LogRing() {
+			free(buffer);
+		}
+	};
+}
+
+static void orphanLogRing(LogRing *ring);
+
+// Protects asyncLogRings and the writer thread state, but is never
+// held while writing log entries.
+static boost::mutex asyncLogMutex;
+static boost::condition_variable asyncLogCond;
+static vector<LogRing *> asyncLogRings;
+static oxt::thread *asyncLogWriter = NULL;
+static bool asyncLogQuit = false;
+static unsigned int asyncLogRingCapacity = 0;
+// Incremented by every startAsyncLogging() call, so that threads replace
+// ring buffers that were created with an older buffer size.
+static boost::atomic<unsigned int> asyncLogGeneration(0);
+static boost::atomic<bool> asyncLogEnabled(false);
+static boost::atomic<boost::uint64_t> droppedLogEntries(0);
+static boost::thread_specific_ptr<LogRing> currentLogRing(orphanLogRing);
 
 
 void
@@ -215,9 +271,195 @@ writeExactWithoutOXT(int fd, const char *str, unsigned int size) {
 	}
 }
 
+static void
+orphanLogRing(LogRing *ring) {
+	ring->orphaned.store(true, boost::memory_order_release);
+}
+
+static LogRing *
+registerLogRing() {
+	boost::lock_guard<boost::mutex> l(asyncLogMutex);
+	if (asyncLogRingCapacity == 0) {
+		return NULL;
+	}
+	LogRing *ring = new LogRing(asyncLogRingCapacity,
+		asyncLogGeneration.load(boost::memory_order_relaxed));
+	asyncLogRings.push_back(ring);
+	// Orphans the thread's previous ring buffer, if any.
+	currentLogRing.reset(ring);
+	return ring;
+}
+
+/**
+ * Appends a log entry to the calling thread's ring buffer, or drops it if
+ * the ring buffer is full. Returns false if the entry must be written
+ * synchronously instead.
+ */
+static bool
+pushAsyncLogEntry(const char *str, unsigned int size) {
+	LogRing *ring = currentLogRing.get();
+	if (OXT_UNLIKELY(ring == NULL
+		|| ring->generation != asyncLogGeneration.load(boost::memory_order_relaxed)))
+	{
+		ring = registerLogRing();
+		if (ring == NULL) {
+			return false;
+		}
+	}
+	if (size > ring->capacity / 4) {
+		return false;
+	}
+
+	boost::uint64_t head = ring->head.load(boost::memory_order_relaxed);
+	boost::uint64_t tail = ring->tail.load(boost::memory_order_acquire);
+	if (ring->capacity - (head - tail) < size) {
+		ring->dropped.fetch_add(1, boost::memory_order_relaxed);
+		return true;
+	}
+
+	unsigned int offset = head & (ring->capacity - 1);
+	unsigned int firstPart = std::min(size, ring->capacity - offset);
+	memcpy(ring->buffer + offset, str, firstPart);
+	memcpy(ring->buffer, str + firstPart, size - firstPart);
+	ring->head.store(head + size, boost::memory_order_release);
+	return true;
+}
+
+static void
+drainLogRing(LogRing *ring) {
+	boost::uint64_t tail = ring->tail.load(boost::memory_order_relaxed);
+	boost::uint64_t head = ring->head.load(boost::memory_order_acquire);
+
+	if (head != tail) {
+		unsigned int offset = tail & (ring->capacity - 1);
+		unsigned int size = head - tail;
+		unsigned int firstPart = std::min(size, ring->capacity - offset);
+		writeExactWithoutOXT(logFd, ring->buffer + offset, firstPart);
+		writeExactWithoutOXT(logFd, ring->buffer, size - firstPart);
+		ring->tail.store(head, boost::memory_order_release);
+	}
+
+	boost::uint64_t dropped = ring->dropped.exchange(0, boost::memory_order_relaxed);
+	if (dropped > 0) {
+		FastStringStream<> sstream;
+		droppedLogEntries.fetch_add(dropped, boost::memory_order_relaxed);
+		_prepareLogEntry(sstream, __FILE__, __LINE__);
+		sstream << dropped << " log messages from thread " << std::hex <<
+			ring->thread << std::dec << " were dropped because its log "
+			"buffer was full\n";
+		writeExactWithoutOXT(logFd, sstream.data(), sstream.size());
+	}
+}
+
+static void
+drainLogRings(boost::unique_lock<boost::mutex> &l) {
+	vector<LogRing *> rings = asyncLogRings;
+	vector<LogRing *>::iterator it;
+
+	l.unlock();
+	for (it = rings.begin(); it != rings.end(); it++) {
+		drainLogRing(*it);
+	}
+	l.lock();
+
+	it = asyncLogRings.begin();
+	while (it != asyncLogRings.end()) {
+		LogRing *ring = *it;
+		if (ring->orphaned.load(boost::memory_order_acquire)
+		 && ring->head.load(boost::memory_order_acquire)
+		    == ring->tail.load(boost::memory_order_relaxed)
+		 && ring->dropped.load(boost::memory_order_relaxed) == 0)
+		{
+			delete ring;
+			it = asyncLogRings.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+static void
+asyncLogWriterMain() {
+	boost::unique_lock<boost::mutex> l(asyncLogMutex);
+	while (!asyncLogQuit) {
+		drainLogRings(l);
+		asyncLogCond.timed_wait(l,
+			boost::posix_time::milliseconds(ASYNC_LOG_FLUSH_INTERVAL));
+	}
+	drainLogRings(l);
+}
+
+static void
+disableAsyncLoggingAfterFork() {
+	// The writer thread does not exist in the child.
+	asyncLogEnabled.store(false, boost::memory_order_relaxed);
+}
+
+void
+startAsyncLogging(unsigned int bufferSize) {
+	static bool atForkHandlerInstalled = false;
+	unsigned int capacity = 4096;
+
+	while (capacity < bufferSize) {
+		capacity *= 2;
+	}
+
+	boost::lock_guard<boost::mutex> l(asyncLogMutex);
+	if (asyncLogWriter != NULL) {
+		return;
+	}
+	if (!atForkHandlerInstalled) {
+		pthread_atfork(NULL, NULL, disableAsyncLoggingAfterFork);
+		atForkHandlerInstalled = true;
+	}
+	asyncLogRingCapacity = capacity;
+	asyncLogGeneration.fetch_add(1, boost::memory_order_relaxed);
+	asyncLogQuit = false;
+	asyncLogWriter = new oxt::thread(boost::bind(asyncLogWriterMain),
+		"Log writer", 1024 * 64);
+	asyncLogEnabled.store(true, boost::memory_order_release);
+}
+
+void
+stopAsyncLogging() {
+	oxt::thread *writer;
+	{
+		boost::lock_guard<boost::mutex> l(asyncLogMutex);
+		if (asyncLogWriter == NULL) {
+			return;
+		}
+		asyncLogEnabled.store(false, boost::memory_order_release);
+		asyncLogQuit = true;
+		writer = asyncLogWriter;
+		asyncLogCond.notify_one();
+	}
+
+	// Ring buffers are not freed here because threads that have
+	// just seen asyncLogEnabled == true may still append to them.
+	writer->join();
+	delete writer;
+
+	boost::lock_guard<boost::mutex> l(asyncLogMutex);
+	asyncLogWriter = NULL;
+}
+
+bool
+isAsyncLoggingEnabled() {
+	return asyncLogEnabled.load(boost::memory_order_acquire);
+}
+
+boost::uint64_t
+getDroppedLogEntryCount() {
+	return droppedLogEntries.load(boost::memory_order_relaxed);
+}
+
 void
 _writeLogEntry(const char *str, unsigned int size) {
-	writeExactWithoutOXT(logFd, str, size);
+	if (!asyncLogEnabled.load(boost::memory_order_acquire)
+	 || !pushAsyncLogEntry(str, size))
+	{
+		writeExactWithoutOXT(logFd, str, size);
+	}
 }
 
 void
@@ -29,6 +29,8 @@
 #include <oxt/thread.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/macros.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -164,6 +166,37 @@ int getFileDescriptorLogFileFd();
  */
 bool setFileDescriptorLogFile(const string &path, int *errcode = NULL);
 
+/**
+ * Switches the general log to asynchronous mode. From then on, every thread
+ * that logs appends its entries to a ring buffer of its own, of
+ * `bufferSize` bytes, instead of writing to the log file directly. A
+ * background thread writes the ring buffers to the log file, so that
+ * logging threads never block on disk I/O or on each other.
+ *
+ * Memory use is bounded: when a thread's ring buffer is full, its new log
+ * entries are dropped, and the background thread logs how many were
+ * dropped. Entries larger than a quarter of the ring buffer are written
+ * synchronously. Child processes created with fork() log synchronously.
+ *
+ * Entries that are still buffered when the process crashes are lost, so
+ * this is off by default.
+ */
+void startAsyncLogging(unsigned int bufferSize);
+
+/**
+ * Writes out all buffered log entries, stops the background thread and
+ * switches the general log back to synchronous mode.
+ */
+void stopAsyncLogging();
+
+bool isAsyncLoggingEnabled();
+
+/**
+ * Returns the number of log entries that have been dropped so far because
+ * a ring buffer was full. This method is thread-safe.
+ */
+boost::uint64_t getDroppedLogEntryCount();
+
 void _prepareLogEntry(FastStringStream<> &sstream, const char *file, unsigned int line);
 void _writeLogEntry(const char *str, unsigned int size);
 void _writeFileDescriptorLogEntry(const char *str, unsigned int size);
@@ -204,12 +237,70 @@ enum PassengerLogLevel {
 		} \
 	} while (false)
 
+/**
+ * Used by P_LOG_RATE_LIMITED to let through at most one log entry per
+ * call site per interval, and to count the entries it suppressed.
+ */
+class LogRateLimiter {
+private:
+	boost::atomic<long long> lastLogTime;
+	boost::atomic<unsigned int> suppressed;
+
+public:
+	LogRateLimiter()
+		: lastLogTime(0),
+		  suppressed(0)
+		{ }
+
+	/**
+	 * Returns whether an entry may be logged now. If so, `suppressedCount`
+	 * is set to the number of entries suppressed since the last one.
+	 */
+	bool shouldLog(unsigned int intervalSec, unsigned int *suppressedCount) {
+		long long now = (long long) time(NULL);
+		long long last = lastLogTime.load(boost::memory_order_relaxed);
+		if ((last != 0 && now - last < (long long) intervalSec)
+		 || !lastLogTime.compare_exchange_strong(last, now, boost::memory_order_relaxed))
+		{
+			suppressed.fetch_add(1, boost::memory_order_relaxed);
+			return false;
+		} else {
+			*suppressedCount = suppressed.exchange(0, boost::memory_order_relaxed);
+			return true;
+		}
+	}
+};
+
+/**
+ * Like P_LOG, but logs at most once every `intervalSec` seconds from this
+ * call site. Use this for messages that may be logged in a tight loop or
+ * for every request, such as when an application is down.
+ */
+#define P_LOG_RATE_LIMITED(level, intervalSec, expr) \
+	do { \
+		if (Passenger::getLogLevel() >= (level)) { \
+			static Passenger::LogRateLimiter _rateLimiter; \
+			unsigned int _suppressed; \
+			if (_rateLimiter.shouldLog((intervalSec), &_suppressed)) { \
+				Passenger::FastStringStream<> _ostream; \
+				Passenger::_prepareLogEntry(_ostream, __FILE__, __LINE__); \
+				_ostream << expr; \
+				if (_suppressed > 0) { \
+					_ostream << " (" << _suppressed << " similar messages suppressed)"; \
+				} \
+				_ostream << "\n"; \
+				Passenger::_writeLogEntry(_ostream.data(), _ostream.size()); \
+			} \
+		} \
+	} while (false)
+
 /**
  * Write the given expression, which represents a warning,
  * to the log stream.
  */
 #define P_WARN(expr) P_LOG(LVL_WARN, __FILE__, __LINE__, expr)
 #define P_WARN_WITH_POS(file, line, expr) P_LOG(LVL_WARN, file, line, expr)
+#define P_WARN_RATE_LIMITED(intervalSec, expr) P_LOG_RATE_LIMITED(LVL_WARN, intervalSec, expr)
 
 /**
  * Write the given expression, which represents a notice (important information),
@@ -231,6 +322,7 @@ enum PassengerLogLevel {
  */
 #define P_ERROR(expr) P_LOG(LVL_ERROR, __FILE__, __LINE__, expr)
 #define P_ERROR_WITH_POS(file, line, expr) P_LOG(LVL_ERROR, file, line, expr)
+#define P_ERROR_RATE_LIMITED(intervalSec, expr) P_LOG_RATE_LIMITED(LVL_ERROR, intervalSec, expr)
 
 /**
  * Write the given expression, which represents a critical non-recoverable error,
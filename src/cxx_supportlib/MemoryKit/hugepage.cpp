@@ -0,0 +1,204 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <cstdlib>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <oxt/macros.hpp>
+#include <MemoryKit/hugepage.h>
+
+namespace Passenger {
+namespace MemoryKit {
+
+
+struct hugepage_region {
+	struct hugepage_region *next;
+	char *base;
+	size_t size;
+	enum hugepage_backing backing;
+};
+
+
+const char *
+hugepage_backing_name(enum hugepage_backing backing)
+{
+	switch (backing) {
+	case HUGEPAGE_BACKING_HUGETLB:
+		return "hugetlb";
+	case HUGEPAGE_BACKING_THP:
+		return "transparent";
+	default:
+		return "none";
+	}
+}
+
+size_t
+hugepage_round_size(size_t size)
+{
+	return (size + HUGEPAGE_SIZE - 1) & ~((size_t) HUGEPAGE_SIZE - 1);
+}
+
+/*
+ * Maps `size` bytes, which must be a multiple of HUGEPAGE_SIZE (see
+ * hugepage_round_size()), aligned to HUGEPAGE_SIZE. Returns NULL if the
+ * memory couldn't be mapped at all. The memory is zero-filled.
+ */
+void *
+hugepage_map(size_t size, enum hugepage_backing *backing)
+{
+	char *result;
+
+	#ifdef MAP_HUGETLB
+		result = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (result != MAP_FAILED) {
+			*backing = HUGEPAGE_BACKING_HUGETLB;
+			return result;
+		}
+	#endif
+
+	/* Over-allocate so that we can trim the mapping to a huge page boundary.
+	 * The kernel only uses transparent huge pages for aligned ranges.
+	 */
+	result = (char *) mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (OXT_UNLIKELY(result == MAP_FAILED)) {
+		*backing = HUGEPAGE_BACKING_NONE;
+		return NULL;
+	}
+
+	char *aligned = (char *) (((uintptr_t) result + HUGEPAGE_SIZE - 1)
+		& ~((uintptr_t) HUGEPAGE_SIZE - 1));
+	if (aligned > result) {
+		munmap(result, aligned - result);
+	}
+	munmap(aligned + size, result + HUGEPAGE_SIZE - aligned);
+
+	#ifdef MADV_HUGEPAGE
+		madvise(aligned, size, MADV_HUGEPAGE);
+	#endif
+	*backing = HUGEPAGE_BACKING_THP;
+	return aligned;
+}
+
+void
+hugepage_unmap(void *ptr, size_t size)
+{
+	munmap(ptr, size);
+}
+
+void
+hugepage_arena_init(struct hugepage_arena *arena, size_t max_size)
+{
+	arena->regions = NULL;
+	arena->pos = NULL;
+	arena->end = NULL;
+	arena->max_size = max_size;
+	arena->nregions = 0;
+	arena->nhugetlb_regions = 0;
+	arena->nfailed_allocs = 0;
+	arena->mapped_size = 0;
+	arena->used_size = 0;
+}
+
+void
+hugepage_arena_deinit(struct hugepage_arena *arena)
+{
+	struct hugepage_region *region = arena->regions;
+
+	while (region != NULL) {
+		struct hugepage_region *next = region->next;
+		hugepage_unmap(region->base, region->size);
+		free(region);
+		region = next;
+	}
+	hugepage_arena_init(arena, arena->max_size);
+}
+
+static bool
+_hugepage_arena_add_region(struct hugepage_arena *arena, size_t size)
+{
+	struct hugepage_region *region;
+
+	size = hugepage_round_size(size);
+	if (arena->mapped_size + size > arena->max_size) {
+		return false;
+	}
+
+	region = (struct hugepage_region *) malloc(sizeof(struct hugepage_region));
+	if (OXT_UNLIKELY(region == NULL)) {
+		return false;
+	}
+	region->base = (char *) hugepage_map(size, &region->backing);
+	if (OXT_UNLIKELY(region->base == NULL)) {
+		free(region);
+		return false;
+	}
+	region->size = size;
+	region->next = arena->regions;
+	arena->regions = region;
+
+	arena->pos = region->base;
+	arena->end = region->base + size;
+	arena->nregions++;
+	if (region->backing == HUGEPAGE_BACKING_HUGETLB) {
+		arena->nhugetlb_regions++;
+	}
+	arena->mapped_size += size;
+	return true;
+}
+
+/*
+ * Returns `size` bytes of zero-filled memory, aligned to 16 bytes, or NULL
+ * if the arena is disabled or full.
+ * The unused tail of the current region is abandoned if the chunk doesn't
+ * fit in it, so chunk sizes that divide HUGEPAGE_SIZE waste nothing.
+ */
+void *
+hugepage_arena_alloc(struct hugepage_arena *arena, size_t size)
+{
+	char *result;
+
+	if (arena->max_size == 0) {
+		return NULL;
+	}
+
+	size = (size + 15) & ~(size_t) 15;
+	if ((size_t) (arena->end - arena->pos) < size
+	 && !_hugepage_arena_add_region(arena, size))
+	{
+		arena->nfailed_allocs++;
+		return NULL;
+	}
+
+	result = arena->pos;
+	arena->pos += size;
+	arena->used_size += size;
+	return result;
+}
+
+
+} // namespace MemoryKit
+} // namespace Passenger
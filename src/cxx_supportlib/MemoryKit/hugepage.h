@@ -0,0 +1,98 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_MEMORY_KIT_HUGEPAGE_H_
+#define _PASSENGER_MEMORY_KIT_HUGEPAGE_H_
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+/*
+ * Memory that is backed by 2 MB huge pages where possible, for large and
+ * long-lived allocations that are accessed all over the place, such as
+ * mbuf_blocks and the turbocache. Such memory needs far fewer TLB entries
+ * than memory that is backed by regular pages.
+ *
+ * hugepage_map() first tries an explicit huge page mapping (MAP_HUGETLB),
+ * which only works if the administrator reserved huge pages
+ * (vm.nr_hugepages). Otherwise it maps regular memory that is aligned to the
+ * huge page size and asks the kernel to back it with transparent huge pages
+ * (madvise MADV_HUGEPAGE), which works if THP is set to "always" or
+ * "madvise". The caller finds out which one it got through `backing`.
+ */
+
+namespace Passenger {
+namespace MemoryKit {
+
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+enum hugepage_backing {
+	HUGEPAGE_BACKING_NONE,
+	/* Explicit huge pages, mapped with MAP_HUGETLB. */
+	HUGEPAGE_BACKING_HUGETLB,
+	/* Regular pages that the kernel may merge into transparent huge pages. */
+	HUGEPAGE_BACKING_THP
+};
+
+struct hugepage_region;
+
+/*
+ * An arena that hands out chunks carved out of huge page regions, by bumping
+ * a pointer. Chunks cannot be freed individually: they're meant to be kept
+ * on the freelist of whoever allocated them. All regions are unmapped by
+ * hugepage_arena_deinit().
+ *
+ * The arena maps at most `max_size` bytes. Once that limit is reached, or
+ * if the kernel refuses to map more, hugepage_arena_alloc() returns NULL
+ * and the caller should fall back to malloc().
+ */
+struct hugepage_arena {
+	struct hugepage_region *regions;
+	char *pos;                      /* next free byte in the current region */
+	char *end;                      /* end of the current region */
+	size_t max_size;                /* 0 means disabled */
+
+	boost::uint32_t nregions;
+	boost::uint32_t nhugetlb_regions; /* # regions backed by HUGEPAGE_BACKING_HUGETLB */
+	boost::uint32_t nfailed_allocs;   /* # hugepage_arena_alloc() calls that returned NULL */
+	size_t mapped_size;             /* total size of all regions */
+	size_t used_size;               /* total size of all chunks handed out */
+};
+
+const char *hugepage_backing_name(enum hugepage_backing backing);
+size_t hugepage_round_size(size_t size);
+void *hugepage_map(size_t size, enum hugepage_backing *backing);
+void hugepage_unmap(void *ptr, size_t size);
+
+void hugepage_arena_init(struct hugepage_arena *arena, size_t max_size);
+void hugepage_arena_deinit(struct hugepage_arena *arena);
+void *hugepage_arena_alloc(struct hugepage_arena *arena, size_t size);
+
+
+} // namespace MemoryKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_MEMORY_KIT_HUGEPAGE_H_ */
@@ -22,6 +22,9 @@
 #include <oxt/thread.hpp>
 #include <oxt/backtrace.hpp>
 #include <algorithm>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <ostream>
 #include <MemoryKit/mbuf.h>
 #include <Logging.h>
@@ -46,6 +49,21 @@ namespace MemoryKit {
 static void mbuf_block_print(struct mbuf_block *mbuf_block, std::ostream &stream);
 
 
+/*
+ * Normal mbuf_blocks either belong to the pool's main freelist (size_class
+ * is NULL) or to one of the pool's size classes. Standalone mbuf_blocks are
+ * always accounted for in the pool's main counters.
+ */
+static boost::uint32_t &
+_mbuf_block_nactive(struct mbuf_block *mbuf_block)
+{
+	if (mbuf_block->size_class != NULL) {
+		return mbuf_block->size_class->nactive_mbuf_blockq;
+	} else {
+		return mbuf_block->pool->nactive_mbuf_blockq;
+	}
+}
+
 static void
 _mbuf_block_mark_as_active(struct mbuf_pool *pool, struct mbuf_block *mbuf_block)
 {
@@ -57,11 +75,12 @@ _mbuf_block_mark_as_active(struct mbuf_pool *pool, struct mbuf_block *mbuf_block
 		mbuf_block->backtrace = strdup(oxt::thread::current_backtrace().c_str());
 	#endif
 	mbuf_block->refcount = 1;
-	pool->nactive_mbuf_blockq++;
+	_mbuf_block_nactive(mbuf_block)++;
 }
 
 static struct mbuf_block *
-_mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset)
+_mbuf_block_init(struct mbuf_pool *pool, struct mbuf_size_class *size_class,
+	char *buf, size_t block_offset)
 {
 	struct mbuf_block *mbuf_block;
 
@@ -73,8 +92,9 @@ _mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset)
 	 * mbuf_block header is at the tail end of the mbuf_block. The data
 	 * precedes the header. This enables us to catch buffer overrun early
 	 * by asserting on the magic value during get or put operations.
-	 * All normal mbuf_blocks in a pool have the same mbuf_block_offset,
-	 * allowing them to be reused through a freelist.
+	 * All normal mbuf_blocks in a pool (or in one of its size classes) have
+	 * the same mbuf_block_offset, allowing them to be reused through a
+	 * freelist.
 	 *
 	 *   <------------ pool->mbuf_block_chunk_size -------------->
 	 *   +-------------------------------------------------------+
@@ -113,56 +133,71 @@ _mbuf_block_init(struct mbuf_pool *pool, char *buf, size_t block_offset)
 	mbuf_block = (struct mbuf_block *)(buf + block_offset);
 	mbuf_block->magic = MBUF_BLOCK_MAGIC;
 	mbuf_block->pool  = pool;
+	mbuf_block->size_class = size_class;
 	mbuf_block->offset = 0;
+	mbuf_block->in_arena = 0;
 
 	_mbuf_block_mark_as_active(pool, mbuf_block);
 	return mbuf_block;
 }
 
 static struct mbuf_block *
-_mbuf_block_get(struct mbuf_pool *pool)
+_mbuf_block_get(struct mbuf_pool *pool, struct mbuf_size_class *size_class)
 {
 	struct mbuf_block *mbuf_block;
+	boost::uint32_t *nfree_mbuf_blockq, *nfree_mbuf_blockq_low;
+	struct mhdr *free_mbuf_blockq;
+	size_t chunk_size, block_offset;
 	char *buf;
 
-	if (!STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
-		assert(pool->nfree_mbuf_blockq > 0);
+	if (size_class == NULL) {
+		nfree_mbuf_blockq = &pool->nfree_mbuf_blockq;
+		nfree_mbuf_blockq_low = &pool->nfree_mbuf_blockq_low;
+		free_mbuf_blockq = &pool->free_mbuf_blockq;
+		chunk_size = pool->mbuf_block_chunk_size;
+		block_offset = pool->mbuf_block_offset;
+	} else {
+		nfree_mbuf_blockq = &size_class->nfree_mbuf_blockq;
+		nfree_mbuf_blockq_low = &size_class->nfree_mbuf_blockq_low;
+		free_mbuf_blockq = &size_class->free_mbuf_blockq;
+		chunk_size = size_class->mbuf_block_chunk_size;
+		block_offset = size_class->mbuf_block_offset;
+	}
+
+	if (!STAILQ_EMPTY(free_mbuf_blockq)) {
+		assert(*nfree_mbuf_blockq > 0);
 
-		mbuf_block = STAILQ_FIRST(&pool->free_mbuf_blockq);
+		mbuf_block = STAILQ_FIRST(free_mbuf_blockq);
 		ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
 		ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount == 0);
 
-		pool->nfree_mbuf_blockq--;
-		STAILQ_REMOVE_HEAD(&pool->free_mbuf_blockq, next);
+		(*nfree_mbuf_blockq)--;
+		if (*nfree_mbuf_blockq < *nfree_mbuf_blockq_low) {
+			*nfree_mbuf_blockq_low = *nfree_mbuf_blockq;
+		}
+		STAILQ_REMOVE_HEAD(free_mbuf_blockq, next);
 		_mbuf_block_mark_as_active(pool, mbuf_block);
-		return mbuf_block;
-	}
-
-	buf = (char *) malloc(pool->mbuf_block_chunk_size);
-	if (OXT_UNLIKELY(buf == NULL)) {
-		return NULL;
-	}
-
-	return _mbuf_block_init(pool, buf, pool->mbuf_block_offset);
-}
-
-struct mbuf_block *
-mbuf_block_get(struct mbuf_pool *pool)
-{
-	struct mbuf_block *mbuf_block;
-	char *buf;
-
-	mbuf_block = _mbuf_block_get(pool);
-	if (OXT_UNLIKELY(mbuf_block == NULL)) {
-		return NULL;
+	} else {
+		buf = (char *) hugepage_arena_alloc(&pool->arena, chunk_size);
+		if (buf != NULL) {
+			mbuf_block = _mbuf_block_init(pool, size_class, buf, block_offset);
+			mbuf_block->in_arena = 1;
+			pool->narena_mbuf_blockq++;
+		} else {
+			buf = (char *) malloc(chunk_size);
+			if (OXT_UNLIKELY(buf == NULL)) {
+				return NULL;
+			}
+			mbuf_block = _mbuf_block_init(pool, size_class, buf, block_offset);
+		}
 	}
 
-	buf = (char *)mbuf_block - pool->mbuf_block_offset;
+	buf = (char *) mbuf_block - block_offset;
 	mbuf_block->start = buf;
-	mbuf_block->end = buf + pool->mbuf_block_offset;
+	mbuf_block->end = buf + block_offset;
 
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block,
-		mbuf_block->end - mbuf_block->start == (int) pool->mbuf_block_offset);
+		mbuf_block->end - mbuf_block->start == (int) block_offset);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->start < mbuf_block->end);
 
 	#ifdef MBUF_DEBUG_REFCOUNTS
@@ -172,6 +207,19 @@ mbuf_block_get(struct mbuf_pool *pool)
 	return mbuf_block;
 }
 
+struct mbuf_block *
+mbuf_block_get(struct mbuf_pool *pool)
+{
+	return _mbuf_block_get(pool, NULL);
+}
+
+struct mbuf_block *
+mbuf_block_get_with_size_class(struct mbuf_pool *pool, unsigned int size_class)
+{
+	assert(size_class < MBUF_SIZE_CLASS_COUNT);
+	return _mbuf_block_get(pool, &pool->size_classes[size_class]);
+}
+
 struct mbuf_block *
 mbuf_block_new_standalone(struct mbuf_pool *pool, size_t size)
 {
@@ -185,7 +233,7 @@ mbuf_block_new_standalone(struct mbuf_pool *pool, size_t size)
 		return NULL;
 	}
 
-	mbuf_block = _mbuf_block_init(pool, buf, block_offset);
+	mbuf_block = _mbuf_block_init(pool, NULL, buf, block_offset);
 	mbuf_block->start = buf;
 	mbuf_block->end = buf + size;
 	mbuf_block->offset = block_offset;
@@ -213,6 +261,7 @@ mbuf_block_free(struct mbuf_block *mbuf_block)
 
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, !mbuf_block->in_arena);
 
 	#ifdef MBUF_ENABLE_DEBUGGING
 		TAILQ_REMOVE(&mbuf_block->pool->active_mbuf_blockq, mbuf_block, active_q);
@@ -223,6 +272,8 @@ mbuf_block_free(struct mbuf_block *mbuf_block)
 
 	if (mbuf_block->offset > 0) {
 		buf = (char *) mbuf_block - mbuf_block->offset;
+	} else if (mbuf_block->size_class != NULL) {
+		buf = (char *) mbuf_block - mbuf_block->size_class->mbuf_block_offset;
 	} else {
 		buf = (char *) mbuf_block - mbuf_block->pool->mbuf_block_offset;
 	}
@@ -239,12 +290,19 @@ mbuf_block_put(struct mbuf_block *mbuf_block)
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount == 0);
-	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, _mbuf_block_nactive(mbuf_block) > 0);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->offset == 0);
 
-	mbuf_block->pool->nfree_mbuf_blockq++;
-	mbuf_block->pool->nactive_mbuf_blockq--;
-	STAILQ_INSERT_HEAD(&mbuf_block->pool->free_mbuf_blockq, mbuf_block, next);
+	if (mbuf_block->size_class != NULL) {
+		struct mbuf_size_class *size_class = mbuf_block->size_class;
+		size_class->nfree_mbuf_blockq++;
+		size_class->nactive_mbuf_blockq--;
+		STAILQ_INSERT_HEAD(&size_class->free_mbuf_blockq, mbuf_block, next);
+	} else {
+		mbuf_block->pool->nfree_mbuf_blockq++;
+		mbuf_block->pool->nactive_mbuf_blockq--;
+		STAILQ_INSERT_HEAD(&mbuf_block->pool->free_mbuf_blockq, mbuf_block, next);
+	}
 
 	#ifdef MBUF_ENABLE_DEBUGGING
 		TAILQ_REMOVE(&mbuf_block->pool->active_mbuf_blockq, mbuf_block, active_q);
@@ -271,8 +329,11 @@ _mbuf_block_assert_refcount_at_least_two(struct mbuf_block *mbuf_block) {
 void
 mbuf_pool_init(struct mbuf_pool *pool)
 {
+	unsigned int i;
+
 	pool->nfree_mbuf_blockq = 0;
 	pool->nactive_mbuf_blockq = 0;
+	pool->nfree_mbuf_blockq_low = 0;
 	STAILQ_INIT(&pool->free_mbuf_blockq);
 
 	#ifdef MBUF_ENABLE_DEBUGGING
@@ -280,12 +341,72 @@ mbuf_pool_init(struct mbuf_pool *pool)
 	#endif
 
 	pool->mbuf_block_offset = pool->mbuf_block_chunk_size - MBUF_BLOCK_HSIZE;
+
+	for (i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+		struct mbuf_size_class *size_class = &pool->size_classes[i];
+		size_class->nfree_mbuf_blockq = 0;
+		size_class->nactive_mbuf_blockq = 0;
+		size_class->nfree_mbuf_blockq_low = 0;
+		STAILQ_INIT(&size_class->free_mbuf_blockq);
+		size_class->mbuf_block_chunk_size = 1024 << (2 * i);
+		size_class->mbuf_block_offset = size_class->mbuf_block_chunk_size - MBUF_BLOCK_HSIZE;
+	}
+
+	hugepage_arena_init(&pool->arena, 0);
+	pool->narena_mbuf_blockq = 0;
+}
+
+static unsigned int
+_mbuf_freelist_count_arena_blocks(struct mhdr *free_mbuf_blockq)
+{
+	struct mbuf_block *mbuf_block;
+	unsigned int count = 0;
+
+	STAILQ_FOREACH (mbuf_block, free_mbuf_blockq, next) {
+		if (mbuf_block->in_arena) {
+			count++;
+		}
+	}
+	return count;
 }
 
 void
 mbuf_pool_deinit(struct mbuf_pool *pool)
 {
+	unsigned int nfree_arena_blocks, i;
+
 	mbuf_pool_compact(pool);
+
+	/* Only unmap the arena if none of its chunks are still in use, so that
+	 * leaked mbuf_blocks stay valid just like leaked malloc()ed ones.
+	 */
+	nfree_arena_blocks = _mbuf_freelist_count_arena_blocks(&pool->free_mbuf_blockq);
+	for (i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+		nfree_arena_blocks += _mbuf_freelist_count_arena_blocks(
+			&pool->size_classes[i].free_mbuf_blockq);
+	}
+	if (nfree_arena_blocks == pool->narena_mbuf_blockq) {
+		STAILQ_INIT(&pool->free_mbuf_blockq);
+		pool->nfree_mbuf_blockq = 0;
+		for (i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+			STAILQ_INIT(&pool->size_classes[i].free_mbuf_blockq);
+			pool->size_classes[i].nfree_mbuf_blockq = 0;
+		}
+		hugepage_arena_deinit(&pool->arena);
+		pool->narena_mbuf_blockq = 0;
+	}
+}
+
+/*
+ * Lets the pool carve new chunks out of a huge page arena, which may map up
+ * to `max_size` bytes, rounded down to a multiple of HUGEPAGE_SIZE. 0 stops
+ * the arena from growing any further. Chunks that don't fit in the arena
+ * are malloc()ed as usual.
+ */
+void
+mbuf_pool_enable_hugepages(struct mbuf_pool *pool, size_t max_size)
+{
+	pool->arena.max_size = max_size & ~((size_t) HUGEPAGE_SIZE - 1);
 }
 
 /*
@@ -298,18 +419,112 @@ mbuf_pool_data_size(struct mbuf_pool *pool)
 	return pool->mbuf_block_offset;
 }
 
+size_t
+mbuf_pool_size_class_data_size(struct mbuf_pool *pool, unsigned int size_class)
+{
+	assert(size_class < MBUF_SIZE_CLASS_COUNT);
+	return pool->size_classes[size_class].mbuf_block_offset;
+}
+
+/*
+ * Tell the kernel that it may drop the pages of a free mbuf_block's data
+ * area right away, before handing the chunk back to malloc. Large chunks
+ * are otherwise often kept resident by the allocator. The first bytes of
+ * the chunk are skipped because malloc stores its freelist pointers there,
+ * and the header at the end is skipped because mbuf_block_free() still
+ * reads it.
+ */
+static void
+_mbuf_block_release_pages(struct mbuf_block *mbuf_block, size_t block_offset)
+{
+	static const size_t MALLOC_RESERVED = 64;
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t) mbuf_block - block_offset + MALLOC_RESERVED;
+	uintptr_t end = (uintptr_t) mbuf_block;
+
+	begin = (begin + page_size - 1) & ~(uintptr_t) (page_size - 1);
+	end = end & ~(uintptr_t) (page_size - 1);
+	if (begin < end) {
+		madvise((void *) begin, end - begin, MADV_DONTNEED);
+	}
+}
+
+/*
+ * Releases up to `count` free mbuf_blocks. Chunks that belong to the huge
+ * page arena can't be released individually, so they're skipped and stay
+ * on the freelist, in the same order.
+ */
+static unsigned int
+_mbuf_freelist_release(struct mhdr *free_mbuf_blockq, boost::uint32_t *nfree_mbuf_blockq,
+	size_t block_offset, unsigned int count)
+{
+	struct mhdr kept;
+	unsigned int i = 0;
+
+	STAILQ_INIT(&kept);
+	while (i < count && !STAILQ_EMPTY(free_mbuf_blockq)) {
+		struct mbuf_block *mbuf_block = STAILQ_FIRST(free_mbuf_blockq);
+		mbuf_block_remove(free_mbuf_blockq, mbuf_block);
+		if (mbuf_block->in_arena) {
+			STAILQ_INSERT_TAIL(&kept, mbuf_block, next);
+		} else {
+			_mbuf_block_release_pages(mbuf_block, block_offset);
+			mbuf_block_free(mbuf_block);
+			(*nfree_mbuf_blockq)--;
+			i++;
+		}
+	}
+	STAILQ_CONCAT(&kept, free_mbuf_blockq);
+	STAILQ_SWAP(&kept, free_mbuf_blockq, mbuf_block);
+
+	return i;
+}
+
 unsigned int
 mbuf_pool_compact(struct mbuf_pool *pool)
 {
-	unsigned int count = pool->nfree_mbuf_blockq;
+	unsigned int count, i;
+
+	count = _mbuf_freelist_release(&pool->free_mbuf_blockq, &pool->nfree_mbuf_blockq,
+		pool->mbuf_block_offset, pool->nfree_mbuf_blockq);
+	assert(pool->nfree_mbuf_blockq <= pool->narena_mbuf_blockq);
+	pool->nfree_mbuf_blockq_low = pool->nfree_mbuf_blockq;
+	for (i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+		struct mbuf_size_class *size_class = &pool->size_classes[i];
+		count += _mbuf_freelist_release(&size_class->free_mbuf_blockq,
+			&size_class->nfree_mbuf_blockq, size_class->mbuf_block_offset,
+			size_class->nfree_mbuf_blockq);
+		assert(size_class->nfree_mbuf_blockq <= pool->narena_mbuf_blockq);
+		size_class->nfree_mbuf_blockq_low = size_class->nfree_mbuf_blockq;
+	}
+
+	return count;
+}
 
-	while (!STAILQ_EMPTY(&pool->free_mbuf_blockq)) {
-		struct mbuf_block *mbuf_block = STAILQ_FIRST(&pool->free_mbuf_blockq);
-		mbuf_block_remove(&pool->free_mbuf_blockq, mbuf_block);
-		mbuf_block_free(mbuf_block);
-		pool->nfree_mbuf_blockq--;
+/*
+ * Gradually give back free mbuf_blocks that were not needed recently. Meant
+ * to be called periodically. Blocks that stayed on a freelist during the
+ * entire period since the previous call (nfree_mbuf_blockq_low) were not
+ * needed to serve the load in that period, so half of them (rounded up) are
+ * released. Halving instead of releasing all of them provides hysteresis:
+ * after a traffic spike the freelists shrink over a few periods, and a
+ * recurring spike doesn't have to malloc everything again.
+ */
+unsigned int
+mbuf_pool_trim(struct mbuf_pool *pool)
+{
+	unsigned int count, i;
+
+	count = _mbuf_freelist_release(&pool->free_mbuf_blockq, &pool->nfree_mbuf_blockq,
+		pool->mbuf_block_offset, (pool->nfree_mbuf_blockq_low + 1) / 2);
+	pool->nfree_mbuf_blockq_low = pool->nfree_mbuf_blockq;
+	for (i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+		struct mbuf_size_class *size_class = &pool->size_classes[i];
+		count += _mbuf_freelist_release(&size_class->free_mbuf_blockq,
+			&size_class->nfree_mbuf_blockq, size_class->mbuf_block_offset,
+			(size_class->nfree_mbuf_blockq_low + 1) / 2);
+		size_class->nfree_mbuf_blockq_low = size_class->nfree_mbuf_blockq;
 	}
-	assert(pool->nfree_mbuf_blockq == 0);
 
 	return count;
 }
@@ -330,7 +545,7 @@ mbuf_block_ref(struct mbuf_block *mbuf_block)
 
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
-	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, _mbuf_block_nactive(mbuf_block) > 0);
 
 	mbuf_block->refcount++;
 }
@@ -347,7 +562,7 @@ mbuf_block_unref(struct mbuf_block *mbuf_block)
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, STAILQ_NEXT(mbuf_block, next) == NULL);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->magic == MBUF_BLOCK_MAGIC);
 	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->refcount > 0);
-	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, mbuf_block->pool->nactive_mbuf_blockq > 0);
+	ASSERT_MBUF_BLOCK_PROPERTY(mbuf_block, _mbuf_block_nactive(mbuf_block) > 0);
 
 	mbuf_block->refcount--;
 	if (mbuf_block->refcount == 0) {
@@ -379,6 +594,18 @@ mbuf_get(struct mbuf_pool *pool)
 	return mbuf(block, 0, block->end - block->start, mbuf::just_created_t());
 }
 
+mbuf
+mbuf_get_with_size_class(struct mbuf_pool *pool, unsigned int size_class)
+{
+	struct mbuf_block *block = mbuf_block_get_with_size_class(pool, size_class);
+	if (OXT_UNLIKELY(block == NULL)) {
+		return mbuf();
+	}
+
+	ASSERT_MBUF_BLOCK_PROPERTY(block, block->refcount == 1);
+	return mbuf(block, 0, block->end - block->start, mbuf::just_created_t());
+}
+
 mbuf
 mbuf_get_with_size(struct mbuf_pool *pool, size_t size)
 {
@@ -409,6 +636,8 @@ mbuf_block_print(struct mbuf_block *mbuf_block, std::ostream &stream)
 		"mbuf_block.refcount: " << mbuf_block->refcount << "\n"
 		"mbuf_block.offset: " << mbuf_block->offset << "\n"
 		"mbuf_block.pool: " << (void *) mbuf_block->pool << "\n"
+		"mbuf_block.size_class: " << (void *) mbuf_block->size_class << "\n"
+		"mbuf_block.in_arena: " << (int) mbuf_block->in_arena << "\n"
 		"mbuf_block.pool.nfree_mbuf_blockq: " << mbuf_block->pool->nfree_mbuf_blockq << "\n"
 		"mbuf_block.pool.nactive_mbuf_blockq: " << mbuf_block->pool->nactive_mbuf_blockq << "\n"
 		"mbuf_block.pool.mbuf_block_chunk_size: " << mbuf_block->pool->mbuf_block_chunk_size << "\n"
@@ -27,6 +27,7 @@
 #include <oxt/macros.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/move/core.hpp>
+#include <MemoryKit/hugepage.h>
 
 /** A memory buffer allocator system taken from twemproxy and modified to
  * suit our needs.
@@ -54,6 +55,18 @@
  * This approach is similar to how Node.js manages buffer slices.
  * We also got rid of the global variables, and put them in an mbuf_pool
  * struct, which acts like a context structure.
+ *
+ * On top of the pool's main chunk size, an mbuf_pool also maintains a small
+ * number of size classes (see MBUF_SIZE_CLASS_COUNT), each with its own
+ * freelist. Readers that see very different message sizes, e.g. mostly idle
+ * WebSocket connections versus large uploads, can pick a size class per read
+ * with mbuf_get_with_size_class() instead of settling for one chunk size.
+ *
+ * Optionally, new chunks are carved out of a huge page arena instead of
+ * being malloc()ed one by one, so that tens of thousands of mbuf_blocks
+ * need only a few TLB entries. See mbuf_pool_enable_hugepages(). Such
+ * chunks stay on the freelists until the pool is deinitialized: trimming
+ * and compacting only release malloc()ed chunks.
  */
 
 //#define MBUF_ENABLE_DEBUGGING
@@ -68,12 +81,14 @@ using namespace boost;
 
 struct mbuf_block;
 struct mhdr;
+struct mbuf_size_class;
 
 typedef void (*mbuf_block_copy_t)(struct mbuf_block *, void *);
 
 /* See _mbuf_block_init() for format description */
 struct mbuf_block {
 	boost::uint32_t    magic;     /* mbuf_block magic (const) */
+	boost::uint8_t     in_arena;  /* chunk belongs to pool->arena (const) */
 	STAILQ_ENTRY(struct mbuf_block) next;         /* next free mbuf_block */
 	#ifdef MBUF_ENABLE_DEBUGGING
 		TAILQ_ENTRY(struct mbuf_block) active_q;  /* prev and next active mbuf_block */
@@ -84,6 +99,7 @@ struct mbuf_block {
 	char              *start;     /* start of buffer (const) */
 	char              *end;       /* end of buffer (const) */
 	struct mbuf_pool  *pool;      /* containing pool (const) */
+	struct mbuf_size_class *size_class; /* containing size class, or NULL (const) */
 	boost::uint32_t    refcount;  /* number of references by mbuf subsets */
 	boost::uint32_t    offset;    /* standalone mbuf_block data size */
 };
@@ -93,9 +109,22 @@ STAILQ_HEAD(mhdr, struct mbuf_block);
 	TAILQ_HEAD(active_mbuf_block_list, struct mbuf_block);
 #endif
 
+#define MBUF_SIZE_CLASS_COUNT 4
+
+struct mbuf_size_class {
+	boost::uint32_t nfree_mbuf_blockq;   /* # free mbuf_block */
+	boost::uint32_t nactive_mbuf_blockq; /* # active (non-free) mbuf_block */
+	boost::uint32_t nfree_mbuf_blockq_low; /* lowest nfree_mbuf_blockq since last trim */
+	struct mhdr free_mbuf_blockq; /* free mbuf_block q */
+
+	size_t mbuf_block_chunk_size; /* mbuf_block chunk size - header + data (const) */
+	size_t mbuf_block_offset;     /* mbuf_block offset in chunk (const) */
+};
+
 struct mbuf_pool {
 	boost::uint32_t nfree_mbuf_blockq;   /* # free mbuf_block */
 	boost::uint32_t nactive_mbuf_blockq; /* # active (non-free) mbuf_block */
+	boost::uint32_t nfree_mbuf_blockq_low; /* lowest nfree_mbuf_blockq since last trim */
 	struct mhdr free_mbuf_blockq; /* free mbuf_block q */
 	#ifdef MBUF_ENABLE_DEBUGGING
 		struct active_mbuf_block_list active_mbuf_blockq; /* active mbuf_block q */
@@ -103,6 +132,12 @@ struct mbuf_pool {
 
 	size_t mbuf_block_chunk_size; /* mbuf_block chunk size - header + data (const) */
 	size_t mbuf_block_offset;     /* mbuf_block offset in chunk (const) */
+
+	/* Chunk sizes are 1K, 4K, 16K and 64K, in that order. */
+	struct mbuf_size_class size_classes[MBUF_SIZE_CLASS_COUNT];
+
+	struct hugepage_arena arena; /* disabled unless mbuf_pool_enable_hugepages() */
+	boost::uint32_t narena_mbuf_blockq; /* # mbuf_block carved out of arena */
 };
 
 #define MBUF_BLOCK_MAGIC      0xdeadbeef
@@ -118,8 +153,14 @@ void mbuf_pool_init(struct mbuf_pool *pool);
 void mbuf_pool_deinit(struct mbuf_pool *pool);
 size_t mbuf_pool_data_size(struct mbuf_pool *pool);
 unsigned int mbuf_pool_compact(struct mbuf_pool *pool);
+unsigned int mbuf_pool_trim(struct mbuf_pool *pool);
+void mbuf_pool_enable_hugepages(struct mbuf_pool *pool, size_t max_size);
+
+size_t mbuf_pool_size_class_data_size(struct mbuf_pool *pool, unsigned int size_class);
 
 struct mbuf_block *mbuf_block_get(struct mbuf_pool *pool);
+struct mbuf_block *mbuf_block_get_with_size_class(struct mbuf_pool *pool,
+	unsigned int size_class);
 void mbuf_block_put(struct mbuf_block *mbuf_block);
 
 void mbuf_block_ref(struct mbuf_block *mbuf_block);
@@ -280,6 +321,7 @@ public:
 mbuf mbuf_block_subset(struct mbuf_block *mbuf_block, unsigned int start, unsigned int len);
 mbuf mbuf_get(struct mbuf_pool *pool);
 mbuf mbuf_get_with_size(struct mbuf_pool *pool, size_t size);
+mbuf mbuf_get_with_size_class(struct mbuf_pool *pool, unsigned int size_class);
 
 
 } // namespace MemoryKit
@@ -153,6 +153,42 @@ psg_reset_pool(psg_pool_t *pool, size_t size)
 }
 
 
+size_t
+psg_pool_size(const psg_pool_t *pool)
+{
+	return (size_t) (pool->data.end - (const char *) pool);
+}
+
+
+size_t
+psg_pool_usage(const psg_pool_t *pool)
+{
+	const psg_pool_t  *p;
+	size_t             usage = 0;
+
+	for (p = pool; p; p = p->data.next) {
+		const char *m = (const char *) p;
+		if (p == pool) {
+			m += sizeof(psg_pool_t);
+		} else {
+			m += sizeof(psg_pool_data_t);
+		}
+		if (p->data.last > m) {
+			usage += p->data.last - m;
+		}
+	}
+
+	return usage;
+}
+
+
+bool
+psg_pool_used_malloc(const psg_pool_t *pool)
+{
+	return pool->data.next != NULL || pool->large != NULL;
+}
+
+
 void *
 psg_palloc(psg_pool_t *pool, size_t size)
 {
@@ -101,6 +101,20 @@ psg_pool_t *psg_create_pool(size_t size);
 void psg_destroy_pool(psg_pool_t *pool);
 bool psg_reset_pool(psg_pool_t *pool, size_t size);
 
+/** Returns the size of the pool's blocks, i.e. the `size` it was created with. */
+size_t psg_pool_size(const psg_pool_t *pool);
+
+/** Returns the number of bytes allocated from the pool's blocks, excluding
+ * the block headers. Objects handled by the large memory allocator are
+ * not counted, except for their bookkeeping entries.
+ */
+size_t psg_pool_usage(const psg_pool_t *pool);
+
+/** Returns whether the pool had to call malloc() since it was created or reset,
+ * either for an additional block or for the large memory allocator.
+ */
+bool psg_pool_used_malloc(const psg_pool_t *pool);
+
 /** Allocate `size` bytes from the pool, aligned on platform word size. */
 void *psg_palloc(psg_pool_t *pool, size_t size);
 
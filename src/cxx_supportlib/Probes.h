@@ -0,0 +1,71 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_PROBES_H_
+#define _PASSENGER_PROBES_H_
+
+/**
+ * User space statically defined tracing (USDT) probes, in the "passenger"
+ * provider. When built against <sys/sdt.h> (systemtap-sdt-dev on Debian,
+ * systemtap-sdt-devel on Red Hat), every probe compiles to a single nop
+ * plus a note in the ELF file, so that tools like bpftrace, perf and
+ * SystemTap can attach to it on a running process:
+ *
+ *   bpftrace -e 'usdt:/path/to/PassengerAgent:passenger:request__begin { ... }'
+ *
+ * Without <sys/sdt.h>, the probes compile to nothing. Probe arguments
+ * are evaluated even while no tracer is attached, so only pass values
+ * that are free to compute, such as integers and pointers.
+ *
+ * Probes:
+ *
+ *   request__begin(void *req, int method)
+ *   request__end(void *req)
+ *   session__checkout__begin(void *req)
+ *   session__checkout__end(void *req, int pid)     pid is -1 on failure
+ *   app__connect(void *req, int pid)
+ *   app__response__begin(void *req, int status)
+ *   turbocache__hit(void *req)
+ *   turbocache__miss(void *req)
+ *   spawn__begin(const char *groupName)
+ *   spawn__end(const char *groupName, int pid)     pid is -1 on failure
+ */
+
+#ifdef HAS_SYS_SDT_H
+	#include <sys/sdt.h>
+
+	#define P_PROBE0(name) \
+		DTRACE_PROBE(passenger, name)
+	#define P_PROBE1(name, arg1) \
+		DTRACE_PROBE1(passenger, name, arg1)
+	#define P_PROBE2(name, arg1, arg2) \
+		DTRACE_PROBE2(passenger, name, arg1, arg2)
+#else
+	#define P_PROBE0(name) do { } while (false)
+	#define P_PROBE1(name, arg1) do { } while (false)
+	#define P_PROBE2(name, arg1, arg2) do { } while (false)
+#endif
+
+#endif /* _PASSENGER_PROBES_H_ */
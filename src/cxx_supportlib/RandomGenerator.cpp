@@ -0,0 +1,268 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2010-2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+#include <boost/thread.hpp>
+#include <oxt/macros.hpp>
+#include <oxt/system_calls.hpp>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#ifdef __linux__
+	#include <sys/syscall.h>
+#endif
+
+#include <RandomGenerator.h>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+#include <Utils/IOUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+using namespace oxt;
+
+
+namespace {
+	/** Number of ChaCha20 blocks generated at once. */
+	const unsigned int BLOCKS_PER_REFILL = 16;
+	const unsigned int BUFFER_SIZE = BLOCKS_PER_REFILL * 64;
+	/** Size of the key and nonce that the generator rekeys itself with. */
+	const unsigned int SEED_SIZE = 40;
+	/** Number of bytes after which the generator seeds itself from the kernel again. */
+	const boost::uint64_t RESEED_INTERVAL = 1600000;
+
+	struct GeneratorState {
+		boost::uint32_t input[16];
+		unsigned char buffer[BUFFER_SIZE];
+		/** Number of unused bytes at the end of `buffer`. */
+		unsigned int available;
+		boost::uint64_t generatedSinceSeed;
+		unsigned int forkGeneration;
+	};
+}
+
+// Incremented in the child after every fork(), so that the child doesn't
+// produce the same random data as the parent.
+static volatile unsigned int forkGeneration = 0;
+static pthread_once_t atforkHandlerInstalled = PTHREAD_ONCE_INIT;
+
+static void
+destroyState(GeneratorState *state) {
+	memset(state, 0, sizeof(GeneratorState));
+	delete state;
+}
+
+static boost::thread_specific_ptr<GeneratorState> threadState(destroyState);
+
+
+static void
+incrementForkGeneration() {
+	forkGeneration++;
+}
+
+static void
+installAtforkHandler() {
+	pthread_atfork(NULL, NULL, incrementForkGeneration);
+}
+
+static boost::uint32_t
+readLittleEndian32(const unsigned char *p) {
+	return (boost::uint32_t) p[0]
+		| ((boost::uint32_t) p[1] << 8)
+		| ((boost::uint32_t) p[2] << 16)
+		| ((boost::uint32_t) p[3] << 24);
+}
+
+static void
+getKernelEntropy(unsigned char *buf, unsigned int size) {
+	#if defined(__linux__) && defined(SYS_getrandom)
+		unsigned int done = 0;
+		while (done < size) {
+			long ret = syscall(SYS_getrandom, buf + done, size - done, 0);
+			if (ret == -1) {
+				int e = errno;
+				if (e == EINTR) {
+					continue;
+				} else if (e == ENOSYS) {
+					// Kernel older than 3.17.
+					break;
+				} else {
+					throw SystemException("Cannot obtain random data from the kernel", e);
+				}
+			}
+			done += ret;
+		}
+		if (done == size) {
+			return;
+		}
+	#endif
+
+	FileDescriptor fd(syscalls::open("/dev/urandom", O_RDONLY), __FILE__, __LINE__);
+	if (fd == -1) {
+		int e = errno;
+		throw FileSystemException("Cannot open /dev/urandom", e, "/dev/urandom");
+	}
+	if (readExact(fd, buf, size) != size) {
+		throw IOException("Cannot read sufficient data from /dev/urandom");
+	}
+}
+
+/** Sets the key and nonce, and resets the block counter. */
+static void
+setKey(GeneratorState *state, const unsigned char seed[SEED_SIZE]) {
+	// "expand 32-byte k"
+	state->input[0] = 0x61707865;
+	state->input[1] = 0x3320646e;
+	state->input[2] = 0x79622d32;
+	state->input[3] = 0x6b206574;
+	for (unsigned int i = 0; i < 8; i++) {
+		state->input[4 + i] = readLittleEndian32(seed + i * 4);
+	}
+	state->input[12] = 0;
+	state->input[13] = 0;
+	state->input[14] = readLittleEndian32(seed + 32);
+	state->input[15] = readLittleEndian32(seed + 36);
+}
+
+static void
+seed(GeneratorState *state) {
+	unsigned char entropy[SEED_SIZE];
+	getKernelEntropy(entropy, SEED_SIZE);
+	setKey(state, entropy);
+	memset(entropy, 0, SEED_SIZE);
+	memset(state->buffer, 0, BUFFER_SIZE);
+	state->available = 0;
+	state->generatedSinceSeed = 0;
+	state->forkGeneration = forkGeneration;
+}
+
+/**
+ * Fills the buffer with keystream, and rekeys with the start of it, so that
+ * the keystream handed out so far cannot be computed from the new state.
+ */
+static void
+refill(GeneratorState *state) {
+	for (unsigned int i = 0; i < BLOCKS_PER_REFILL; i++) {
+		chacha20Block(state->input, state->buffer + i * 64);
+		state->input[12]++;
+		if (state->input[12] == 0) {
+			state->input[13]++;
+		}
+	}
+	setKey(state, state->buffer);
+	memset(state->buffer, 0, SEED_SIZE);
+	state->available = BUFFER_SIZE - SEED_SIZE;
+}
+
+static GeneratorState *
+getState() {
+	GeneratorState *state = threadState.get();
+	if (OXT_UNLIKELY(state == NULL)) {
+		pthread_once(&atforkHandlerInstalled, installAtforkHandler);
+		state = new GeneratorState();
+		try {
+			seed(state);
+		} catch (...) {
+			destroyState(state);
+			throw;
+		}
+		threadState.reset(state);
+	} else if (OXT_UNLIKELY(state->forkGeneration != forkGeneration
+		|| state->generatedSinceSeed >= RESEED_INTERVAL))
+	{
+		seed(state);
+	}
+	return state;
+}
+
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8);  \
+	c += d; b ^= c; b = ROTL32(b, 7)
+
+void
+chacha20Block(const boost::uint32_t input[16], unsigned char output[64]) {
+	boost::uint32_t x[16];
+	unsigned int i;
+
+	memcpy(x, input, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+	for (i = 0; i < 16; i++) {
+		boost::uint32_t v = x[i] + input[i];
+		output[i * 4]     = (unsigned char) v;
+		output[i * 4 + 1] = (unsigned char) (v >> 8);
+		output[i * 4 + 2] = (unsigned char) (v >> 16);
+		output[i * 4 + 3] = (unsigned char) (v >> 24);
+	}
+}
+
+#undef QUARTERROUND
+#undef ROTL32
+
+void
+generateRandomBytes(void *buf, unsigned int size) {
+	GeneratorState *state = getState();
+	unsigned char *output = (unsigned char *) buf;
+
+	while (size > 0) {
+		if (state->available == 0) {
+			refill(state);
+		}
+
+		unsigned int n = std::min(size, state->available);
+		unsigned char *data = state->buffer + BUFFER_SIZE - state->available;
+		memcpy(output, data, n);
+		memset(data, 0, n);
+		state->available -= n;
+		state->generatedSinceSeed += n;
+		output += n;
+		size -= n;
+	}
+}
+
+void
+reseedRandomBytesGenerator() {
+	threadState.reset();
+}
+
+
+} // namespace Passenger
@@ -30,11 +30,9 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
-#include <oxt/system_calls.hpp>
+#include <boost/cstdint.hpp>
 
-#include <Logging.h>
 #include <StaticString.h>
-#include <Exceptions.h>
 #include <Utils/StrIntUtils.h>
 
 
@@ -42,61 +40,65 @@ namespace Passenger {
 
 using namespace std;
 using namespace boost;
-using namespace oxt;
+
 
 /**
- * A random data generator. Data is generated using /dev/urandom, and
- * is cryptographically secure. Unlike rand() and friends,
- * RandomGenerator does not require seeding.
+ * Fills `buf` with `size` cryptographically secure random bytes.
  *
- * The reason why RandomGenerator isn't a singleton is because opening
- * /dev/urandom is *very* slow on Mac OS X and OpenBSD. Each object of
- * this class caches the /dev/urandom file handle.
+ * Each thread has its own ChaCha20 keystream generator, which is seeded from
+ * the kernel (getrandom(), or /dev/urandom if that's not available) when the
+ * thread first needs random data, periodically after that, and again in the
+ * child after a fork(). Keystream is generated a buffer at a time, and the
+ * generator rekeys itself from its own output after every buffer, so that
+ * data that was already returned cannot be reconstructed from the current
+ * state. Most calls therefore don't make any system calls and don't take
+ * any locks.
  *
- * This class is thread-safe as long as there are no concurrent
- * calls to reopen() or close().
+ * @throws SystemException Seeding failed.
+ * @throws IOException Seeding failed.
+ * @throws boost::thread_interrupted
  */
-class RandomGenerator: public boost::noncopyable {
-private:
-	FILE *handle;
+void generateRandomBytes(void *buf, unsigned int size);
 
-public:
-	RandomGenerator(bool open = true) {
-		handle = NULL;
-		if (open) {
-			reopen();
-		}
-	}
+/**
+ * Discards the calling thread's generator state, so that the next call to
+ * generateRandomBytes() in this thread seeds it again from the kernel.
+ */
+void reseedRandomBytesGenerator();
+
+/**
+ * Computes a ChaCha20 block for the given 16-word input state. Exposed for
+ * unit tests.
+ */
+void chacha20Block(const boost::uint32_t input[16], unsigned char output[64]);
 
-	~RandomGenerator() {
-		boost::this_thread::disable_syscall_interruption dsi;
-		close();
-	}
 
+/**
+ * A random data generator. Data is generated with generateRandomBytes(),
+ * and is cryptographically secure. Unlike rand() and friends,
+ * RandomGenerator does not require seeding.
+ *
+ * The generator state is kept per thread, not per RandomGenerator object,
+ * so a single object can be used by any number of threads concurrently
+ * without locking. The object itself no longer holds any resources; the
+ * class is kept so that existing code can continue to pass generators
+ * around.
+ */
+class RandomGenerator: public boost::noncopyable {
+public:
+	RandomGenerator(bool open = true) { }
+
+	/**
+	 * Makes the calling thread's generator seed itself from the kernel again.
+	 */
 	void reopen() {
-		close();
-		handle = syscalls::fopen("/dev/urandom", "r");
-		if (handle == NULL) {
-			throw FileSystemException("Cannot open /dev/urandom",
-				errno, "/dev/urandom");
-		}
-		P_LOG_FILE_DESCRIPTOR_OPEN4(fileno(handle), __FILE__, __LINE__,
-			"RandomGenerator");
+		reseedRandomBytesGenerator();
 	}
 
-	void close() {
-		if (handle != NULL) {
-			P_LOG_FILE_DESCRIPTOR_CLOSE(fileno(handle));
-			syscalls::fclose(handle);
-			handle = NULL;
-		}
-	}
+	void close() { }
 
 	StaticString generateBytes(void *buf, unsigned int size) {
-		size_t ret = syscalls::fread(buf, 1, size, handle);
-		if (ret != size) {
-			throw IOException("Cannot read sufficient data from /dev/urandom");
-		}
+		generateRandomBytes(buf, size);
 		return StaticString((const char *) buf, size);
 	}
 
@@ -35,6 +35,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
+#include <boost/atomic.hpp>
 #include <oxt/thread.hpp>
 #include <Logging.h>
 
@@ -46,6 +47,12 @@ using namespace boost;
 
 /**
  * Class for thread-safely using libev.
+ *
+ * Callbacks that other threads schedule with runLater() are pushed onto
+ * a lock-free stack, which the event loop thread takes over as a whole
+ * and runs in FIFO order. Only the thread that pushes onto an empty
+ * stack wakes up the event loop, so a burst of callbacks from many
+ * threads costs one ev_async_send().
  */
 class SafeLibev {
 private:
@@ -56,12 +63,14 @@ private:
 	typedef boost::function<void ()> Callback;
 
 	struct Command {
+		Command *next;
 		Callback callback;
 		unsigned int id: 31;
 		bool canceled: 1;
 
 		Command(unsigned int _id, const Callback &_callback)
-			: callback(_callback),
+			: next(NULL),
+			  callback(_callback),
 			  id(_id),
 			  canceled(false)
 			{ }
@@ -71,10 +80,22 @@ private:
 	pthread_t loopThread;
 	ev_async async;
 
+	/** Protects nothing but the waits in start(), stop() and runSync(). */
 	boost::mutex syncher;
 	boost::condition_variable cond;
-	vector<Command> commands;
-	unsigned int nextCommandId;
+	/**
+	 * The most recently scheduled command that the event loop hasn't
+	 * taken over yet. Commands are only removed by the event loop thread,
+	 * which takes the whole stack at once, so there is no ABA problem.
+	 */
+	boost::atomic<Command *> pendingCommands;
+	/**
+	 * The remainder of the commands that the event loop thread is
+	 * currently running, in FIFO order. Only accessed by that thread.
+	 */
+	Command *runningCommands;
+	boost::atomic<unsigned int> pendingCommandCount;
+	boost::atomic<unsigned int> nextCommandId;
 
 	static void asyncHandler(EV_P_ ev_async *w, int revents) {
 		SafeLibev *self = (SafeLibev *) w->data;
@@ -86,18 +107,67 @@ private:
 		(*callback)();
 	}
 
+	static Command *reverseCommands(Command *command) {
+		Command *result = NULL;
+		while (command != NULL) {
+			Command *next = command->next;
+			command->next = result;
+			result = command;
+			command = next;
+		}
+		return result;
+	}
+
+	static void deleteCommands(Command *command) {
+		while (command != NULL) {
+			Command *next = command->next;
+			delete command;
+			command = next;
+		}
+	}
+
 	void runCommands() {
-		boost::unique_lock<boost::mutex> l(syncher);
-		vector<Command> commands = this->commands;
-		this->commands.clear();
-		l.unlock();
-
-		vector<Command>::const_iterator it, end = commands.end();
-		for (it = commands.begin(); it != end; it++) {
-			if (!it->canceled) {
-				it->callback();
+		runningCommands = reverseCommands(
+			pendingCommands.exchange(NULL, boost::memory_order_acquire));
+		while (runningCommands != NULL) {
+			boost::scoped_ptr<Command> command(runningCommands);
+			runningCommands = command->next;
+			pendingCommandCount.fetch_sub(1, boost::memory_order_relaxed);
+			if (!command->canceled) {
+				command->callback();
+			}
+		}
+	}
+
+	unsigned int pushCommand(const Callback &callback) {
+		// Command IDs are in the range [1, MAX_COMMAND_ID].
+		unsigned int id = nextCommandId.fetch_add(1, boost::memory_order_relaxed)
+			% MAX_COMMAND_ID + 1;
+		Command *command = new Command(id, callback);
+		Command *head = pendingCommands.load(boost::memory_order_relaxed);
+
+		pendingCommandCount.fetch_add(1, boost::memory_order_relaxed);
+		do {
+			command->next = head;
+		} while (!pendingCommands.compare_exchange_weak(head, command,
+			boost::memory_order_release, boost::memory_order_relaxed));
+		if (head == NULL) {
+			// Otherwise, whoever pushed onto the empty stack
+			// wakes up the event loop.
+			ev_async_send(loop, &async);
+		}
+		return id;
+	}
+
+	static bool cancelCommandInList(Command *command, unsigned int id) {
+		while (command != NULL) {
+			if (command->id == id) {
+				command->canceled = true;
+				return true;
 			}
+			command = command->next;
 		}
+		return false;
 	}
 
 	template<typename Watcher>
@@ -124,20 +194,16 @@ private:
 		cond.notify_all();
 	}
 
-	void incNextCommandId() {
-		if (nextCommandId == MAX_COMMAND_ID) {
-			nextCommandId = 1;
-		} else {
-			nextCommandId++;
-		}
-	}
-
 public:
 	/** SafeLibev takes over ownership of the loop object. */
-	SafeLibev(struct ev_loop *loop) {
+	SafeLibev(struct ev_loop *loop)
+		: pendingCommands(NULL),
+		  runningCommands(NULL),
+		  pendingCommandCount(0),
+		  nextCommandId(0)
+	{
 		this->loop = loop;
 		loopThread = pthread_self();
-		nextCommandId = 1;
 
 		ev_async_init(&async, asyncHandler);
 		ev_set_priority(&async, EV_MAXPRI);
@@ -147,6 +213,8 @@ public:
 
 	~SafeLibev() {
 		destroy();
+		deleteCommands(runningCommands);
+		deleteCommands(pendingCommands.exchange(NULL, boost::memory_order_acquire));
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_loop_get_pipe(loop, 0));
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_loop_get_pipe(loop, 1));
 		P_LOG_FILE_DESCRIPTOR_CLOSE(ev_backend_fd(loop));
@@ -194,11 +262,8 @@ public:
 		} else {
 			boost::unique_lock<boost::mutex> l(syncher);
 			bool done = false;
-			commands.push_back(Command(nextCommandId,
-				boost::bind(&SafeLibev::startWatcherAndNotify<Watcher>,
-					this, &watcher, &done)));
-			incNextCommandId();
-			ev_async_send(loop, &async);
+			pushCommand(boost::bind(&SafeLibev::startWatcherAndNotify<Watcher>,
+				this, &watcher, &done));
 			while (!done) {
 				cond.wait(l);
 			}
@@ -212,11 +277,8 @@ public:
 		} else {
 			boost::unique_lock<boost::mutex> l(syncher);
 			bool done = false;
-			commands.push_back(Command(nextCommandId,
-				boost::bind(&SafeLibev::stopWatcherAndNotify<Watcher>,
-					this, &watcher, &done)));
-			incNextCommandId();
-			ev_async_send(loop, &async);
+			pushCommand(boost::bind(&SafeLibev::stopWatcherAndNotify<Watcher>,
+				this, &watcher, &done));
 			while (!done) {
 				cond.wait(l);
 			}
@@ -236,11 +298,8 @@ public:
 		assert(callback != NULL);
 		boost::unique_lock<boost::mutex> l(syncher);
 		bool done = false;
-		commands.push_back(Command(nextCommandId,
-			boost::bind(&SafeLibev::runAndNotify, this,
-				&callback, &done)));
-		incNextCommandId();
-		ev_async_send(loop, &async);
+		pushCommand(boost::bind(&SafeLibev::runAndNotify, this,
+			&callback, &done));
 		while (!done) {
 			cond.wait(l);
 		}
@@ -262,17 +321,13 @@ public:
 		}
 	}
 
+	/**
+	 * Schedules a callback to be run on the event loop thread, and returns
+	 * its command ID. Thread-safe and lock-free.
+	 */
 	unsigned int runLater(const Callback &callback) {
 		assert(callback != NULL);
-		unsigned int result;
-		{
-			boost::unique_lock<boost::mutex> l(syncher);
-			commands.push_back(Command(nextCommandId, callback));
-			result = nextCommandId;
-			incNextCommandId();
-		}
-		ev_async_send(loop, &async);
-		return result;
+		return pushCommand(callback);
 	}
 
 	/**
@@ -281,23 +336,23 @@ public:
 	 * That is, a return value of true guarantees that the callback will not be called
 	 * in the future, while a return value of false means that the callback has already
 	 * been called or is currently being called.
+	 *
+	 * May only be called from the event loop thread.
 	 */
 	bool cancelCommand(unsigned int id) {
 		if (id == 0) {
 			return false;
 		}
+		return cancelCommandInList(runningCommands, id)
+			|| cancelCommandInList(pendingCommands.load(boost::memory_order_acquire), id);
+	}
 
-		boost::unique_lock<boost::mutex> l(syncher);
-		// TODO: we can do a binary search because the command ID
-		// is monotically increasing except on overflow.
-		vector<Command>::iterator it, end = commands.end();
-		for (it = commands.begin(); it != end; it++) {
-			if (it->id == id) {
-				it->canceled = true;
-				return true;
-			}
-		}
-		return false;
+	/**
+	 * Returns the number of callbacks that have been scheduled with runLater()
+	 * (or its variants) but have not been run yet.
+	 */
+	unsigned int getPendingCommandCount() {
+		return pendingCommandCount.load(boost::memory_order_relaxed);
 	}
 };
 
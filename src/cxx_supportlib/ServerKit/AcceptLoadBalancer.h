@@ -77,18 +77,24 @@ using namespace boost;
  *
  * Inside the "PassengerAgent core", we activate AcceptLoadBalancer
  * only if `core_threads > 1`, which is often the case because
- * `core_threads` defaults to the number of CPU cores.
+ * `core_threads` defaults to the number of CPU cores. If `--reuse-port`
+ * is given then TCP endpoints bypass the AcceptLoadBalancer: each
+ * Server gets its own SO_REUSEPORT socket and the kernel does the
+ * load balancing instead. Unix domain socket endpoints still go
+ * through the AcceptLoadBalancer.
  */
 template<typename Server>
 class AcceptLoadBalancer {
 private:
-	static const unsigned int ACCEPT_BURST_COUNT = 16;
+	static const unsigned int DEFAULT_ACCEPT_BURST_COUNT = 16;
+	static const unsigned int MAX_ACCEPT_BURST_COUNT = 127;
 
 	int endpoints[SERVER_KIT_MAX_SERVER_ENDPOINTS];
 	struct pollfd pollers[1 + SERVER_KIT_MAX_SERVER_ENDPOINTS];
-	int newClients[ACCEPT_BURST_COUNT];
+	int newClients[MAX_ACCEPT_BURST_COUNT];
 
 	unsigned int nEndpoints;
+	unsigned int acceptBurstCount;
 	boost::uint8_t newClientCount;
 	boost::uint8_t nextServer;
 	bool accept4Available;
@@ -125,7 +131,7 @@ private:
 		bool error = false;
 		int fd, errcode = 0;
 
-		while (newClientCount < ACCEPT_BURST_COUNT) {
+		while (newClientCount < acceptBurstCount) {
 			fd = acceptNonBlockingSocket(endpoint);
 			if (fd == -1) {
 				error = true;
@@ -170,6 +176,27 @@ private:
 		newClientCount = 0;
 	}
 
+	/**
+	 * Doubles the burst size when a burst was full, because more clients
+	 * are probably waiting, and shrinks it back slowly when bursts are
+	 * mostly empty, so that a single burst can't starve the exit pipe.
+	 */
+	void tuneAcceptBurstCount() {
+		if (newClientCount == acceptBurstCount) {
+			if (acceptBurstCount < MAX_ACCEPT_BURST_COUNT) {
+				acceptBurstCount *= 2;
+				if (acceptBurstCount > MAX_ACCEPT_BURST_COUNT) {
+					acceptBurstCount = MAX_ACCEPT_BURST_COUNT;
+				}
+				P_DEBUG("AcceptLoadBalancer: raised accept burst count to " << acceptBurstCount);
+			}
+		} else if (newClientCount < acceptBurstCount / 4
+			&& acceptBurstCount > DEFAULT_ACCEPT_BURST_COUNT)
+		{
+			acceptBurstCount--;
+		}
+	}
+
 	static void feedNewClient(Server *server, int fd) {
 		server->feedNewClients(&fd, 1);
 	}
@@ -229,7 +256,7 @@ private:
 			unsigned int i = 0;
 			newClientCount = 0;
 
-			while (newClientCount < ACCEPT_BURST_COUNT && i < nEndpoints) {
+			while (newClientCount < acceptBurstCount && i < nEndpoints) {
 				if (pollers[i + 1].revents & POLLIN) {
 					if (!acceptNewClients(endpoints[i])) {
 						break;
@@ -238,20 +265,28 @@ private:
 				i++;
 			}
 
+			if (autoTune) {
+				tuneAcceptBurstCount();
+			}
 			distributeNewClients();
 		}
 	}
 
 public:
 	vector<Server *> servers;
+	// If set, the accept burst size adapts to the connection rate.
+	// Must be set before start().
+	bool autoTune;
 
 	AcceptLoadBalancer()
 		: nEndpoints(0),
+		  acceptBurstCount(DEFAULT_ACCEPT_BURST_COUNT),
 		  newClientCount(0),
 		  nextServer(0),
 		  accept4Available(true),
 		  quit(false),
-		  thread(NULL)
+		  thread(NULL),
+		  autoTune(false)
 	{
 		if (pipe(exitPipe) == -1) {
 			int e = errno;
@@ -300,6 +335,10 @@ public:
 		#undef EXTENSION_EOPNOTSUPP
 	}
 
+	unsigned int getEndpointCount() const {
+		return nEndpoints;
+	}
+
 	void start() {
 		boost::function<void ()> func = boost::bind(&AcceptLoadBalancer<Server>::mainLoop, this);
 		thread = new oxt::thread(boost::bind(runAndPrintExceptions, func, true),
@@ -0,0 +1,251 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_AUTO_TUNER_H_
+#define _PASSENGER_SERVER_KIT_AUTO_TUNER_H_
+
+#include <algorithm>
+#include <Utils/JsonWriter.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * Statistics about one statistics update interval of a Server (about
+ * 5 seconds), on which AutoTuner bases its decisions.
+ */
+struct AutoTunerSample {
+	/** Number of times that a server socket became acceptable. */
+	unsigned int acceptEvents;
+	/** Number of those times in which a full accept burst was accepted,
+	 * meaning that more clients were probably waiting. */
+	unsigned int fullAcceptBursts;
+	/** Total accept queue length of the server sockets, or -1 if unknown. */
+	int backlogDepth;
+	/** How late the event loop ran the statistics timer, in seconds. */
+	double loopLag;
+	/** Client objects that had to be allocated because the freelist was empty. */
+	unsigned int clientsAllocated;
+	/** Client objects that were destroyed because the freelist was full. */
+	unsigned int clientsDestroyed;
+
+	AutoTunerSample()
+		: acceptEvents(0),
+		  fullAcceptBursts(0),
+		  backlogDepth(-1),
+		  loopLag(0),
+		  clientsAllocated(0),
+		  clientsDestroyed(0)
+		{ }
+};
+
+/**
+ * Adjusts a Server's accept burst size and client freelist sizes, within
+ * bounds, based on the statistics of the last interval:
+ *
+ *  - If the event loop lags, the accept burst size is halved, so that the
+ *    clients that were already accepted get a chance to make progress.
+ *  - Otherwise, if clients are waiting in the accept queue, or if most accept
+ *    bursts were full, the accept burst size is doubled.
+ *  - If client objects had to be allocated because the freelist was empty,
+ *    the number of spare clients is raised by that amount, so that the next
+ *    peak doesn't have to call malloc.
+ *  - If client objects were destroyed because the freelist was full while
+ *    others were allocated, the freelist limit is raised by that amount.
+ *  - After a minute without allocations, the number of spare clients and the
+ *    freelist limit decay back towards their configured values.
+ *
+ * The values that the Server had when the tuner saw it first (or after
+ * `reset()`) are the baseline: the tuner never goes below them, except that
+ * the accept burst size may be lowered while the loop lags.
+ */
+class AutoTuner {
+public:
+	static const unsigned int MIN_ACCEPT_BURST_COUNT = 4;
+	static const unsigned int MAX_ACCEPT_BURST_COUNT = 127;
+	static const unsigned int MAX_FREELIST_SIZE = 4095;
+	/** Loop lag above which accepting is throttled. */
+	static const unsigned int MAX_LOOP_LAG_MSEC = 50;
+	/** Number of quiet intervals after which the freelists decay. */
+	static const unsigned int DECAY_INTERVALS = 12;
+
+	unsigned int acceptBurstCount;
+	unsigned int minSpareClients;
+	unsigned int clientFreelistLimit;
+
+private:
+	bool initialized;
+	unsigned int baseAcceptBurstCount;
+	unsigned int baseMinSpareClients;
+	unsigned int baseClientFreelistLimit;
+	unsigned int quietIntervals;
+	unsigned int adjustments;
+	AutoTunerSample lastSample;
+	const char *acceptDecision;
+	const char *freelistDecision;
+
+	static unsigned int grow(unsigned int value, unsigned int amount, unsigned int max) {
+		if (value + amount > max) {
+			return max;
+		} else {
+			return value + amount;
+		}
+	}
+
+	static unsigned int decay(unsigned int value, unsigned int base) {
+		if (value <= base) {
+			return value;
+		} else {
+			return value - std::max((value - base) / 4, 1u);
+		}
+	}
+
+public:
+	AutoTuner()
+		: acceptBurstCount(0),
+		  minSpareClients(0),
+		  clientFreelistLimit(0),
+		  initialized(false),
+		  baseAcceptBurstCount(0),
+		  baseMinSpareClients(0),
+		  baseClientFreelistLimit(0),
+		  quietIntervals(0),
+		  adjustments(0),
+		  acceptDecision("none"),
+		  freelistDecision("none")
+		{ }
+
+	/** Makes the tuner adopt the Server's current values as the new baseline. */
+	void reset() {
+		initialized = false;
+	}
+
+	/**
+	 * Updates `acceptBurstCount`, `minSpareClients` and `clientFreelistLimit`,
+	 * given their current values in the Server and the statistics of the
+	 * last interval. Returns whether any of them changed.
+	 */
+	bool update(unsigned int currentAcceptBurstCount, unsigned int currentMinSpareClients,
+		unsigned int currentClientFreelistLimit, const AutoTunerSample &sample)
+	{
+		if (!initialized) {
+			baseAcceptBurstCount = currentAcceptBurstCount;
+			baseMinSpareClients = currentMinSpareClients;
+			baseClientFreelistLimit = currentClientFreelistLimit;
+			quietIntervals = 0;
+			initialized = true;
+		}
+
+		acceptBurstCount = currentAcceptBurstCount;
+		minSpareClients = currentMinSpareClients;
+		clientFreelistLimit = currentClientFreelistLimit;
+		lastSample = sample;
+		acceptDecision = "none";
+		freelistDecision = "none";
+
+		if (sample.loopLag * 1000 > MAX_LOOP_LAG_MSEC) {
+			if (acceptBurstCount > MIN_ACCEPT_BURST_COUNT) {
+				acceptBurstCount /= 2;
+				if (acceptBurstCount < MIN_ACCEPT_BURST_COUNT) {
+					acceptBurstCount = MIN_ACCEPT_BURST_COUNT;
+				}
+				acceptDecision = "event loop lags: lowered accept burst count";
+			}
+		} else if (sample.backlogDepth > 0
+			|| (sample.acceptEvents > 0 && sample.fullAcceptBursts * 2 > sample.acceptEvents))
+		{
+			if (acceptBurstCount < MAX_ACCEPT_BURST_COUNT) {
+				acceptBurstCount = grow(acceptBurstCount, acceptBurstCount,
+					MAX_ACCEPT_BURST_COUNT);
+				acceptDecision = "clients are waiting to be accepted: raised accept burst count";
+			}
+		} else if (acceptBurstCount < baseAcceptBurstCount) {
+			acceptBurstCount = grow(acceptBurstCount, acceptBurstCount,
+				baseAcceptBurstCount);
+			acceptDecision = "event loop recovered: restored accept burst count";
+		}
+
+		if (sample.clientsAllocated > 0) {
+			quietIntervals = 0;
+			minSpareClients = grow(minSpareClients, sample.clientsAllocated,
+				MAX_FREELIST_SIZE);
+			clientFreelistLimit = std::max(clientFreelistLimit, minSpareClients);
+			if (sample.clientsDestroyed > 0) {
+				clientFreelistLimit = grow(clientFreelistLimit, sample.clientsDestroyed,
+					MAX_FREELIST_SIZE);
+			}
+			freelistDecision = "freelist ran empty: raised spare client count";
+		} else if (++quietIntervals >= DECAY_INTERVALS) {
+			quietIntervals = 0;
+			if (minSpareClients > baseMinSpareClients
+			 || clientFreelistLimit > baseClientFreelistLimit)
+			{
+				minSpareClients = decay(minSpareClients, baseMinSpareClients);
+				clientFreelistLimit = std::max(
+					decay(clientFreelistLimit, baseClientFreelistLimit),
+					minSpareClients);
+				freelistDecision = "freelist was not exhausted for a while: lowered freelist sizes";
+			}
+		}
+
+		bool changed = acceptBurstCount != currentAcceptBurstCount
+			|| minSpareClients != currentMinSpareClients
+			|| clientFreelistLimit != currentClientFreelistLimit;
+		if (changed) {
+			adjustments++;
+		}
+		return changed;
+	}
+
+	void writeStateAsJson(JsonWriter &writer) const {
+		writer.member("adjustments", adjustments);
+		writer.member("accept_decision", acceptDecision);
+		writer.member("freelist_decision", freelistDecision);
+		writer.key("baseline");
+		writer.beginObject();
+		writer.member("accept_burst_count", baseAcceptBurstCount);
+		writer.member("min_spare_clients", baseMinSpareClients);
+		writer.member("client_freelist_limit", baseClientFreelistLimit);
+		writer.endObject();
+		writer.key("last_interval");
+		writer.beginObject();
+		writer.member("accept_events", lastSample.acceptEvents);
+		writer.member("full_accept_bursts", lastSample.fullAcceptBursts);
+		writer.member("backlog_depth", lastSample.backlogDepth);
+		writer.member("loop_lag_ms", (unsigned int) (lastSample.loopLag * 1000));
+		writer.member("clients_allocated", lastSample.clientsAllocated);
+		writer.member("clients_destroyed", lastSample.clientsDestroyed);
+		writer.endObject();
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_AUTO_TUNER_H_ */
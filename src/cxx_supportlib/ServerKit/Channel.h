@@ -32,7 +32,7 @@
 #include <boost/move/core.hpp>
 #include <algorithm>
 #include <cassert>
-#include <jsoncpp/json.h>
+#include <Utils/JsonWriter.h>
 #include <ServerKit/Context.h>
 #include <ServerKit/Hooks.h>
 #include <MemoryKit/mbuf.h>
@@ -347,6 +347,14 @@ protected:
 	int errcode;
 	unsigned int generation;
 	unsigned int bytesConsumed;
+	/**
+	 * The event loop iteration in which the budget counters below were
+	 * last reset, and the number of data callback calls and consumed bytes
+	 * since then. See `Context::channelCallBudget`.
+	 */
+	unsigned int budgetIteration;
+	unsigned int budgetCalls;
+	unsigned int budgetBytes;
 	/** Buffer that will be (or is being) passed to the callback. */
 	MemoryKit::mbuf buffer;
 	Context *ctx;
@@ -387,6 +395,7 @@ protected:
 
 		if (cbResult.consumed >= 0) {
 			bytesConsumed += cbResult.consumed;
+			chargeBudget(cbResult.consumed);
 			if ((unsigned int) cbResult.consumed == buffer.size()) {
 				// Unref mbuf_block
 				buffer = MemoryKit::mbuf();
@@ -404,6 +413,11 @@ protected:
 					state = IDLE;
 					callConsumedCallback();
 					return bytesConsumed;
+				} else if (budgetExhausted()) {
+					// Give the other channels on this event loop a turn
+					// before passing the remainder to the callback.
+					planNextActivity();
+					return -1;
 				} else {
 					if (hooks == NULL
 					 || hooks->impl == NULL
@@ -457,6 +471,29 @@ protected:
 		}
 	}
 
+	void chargeBudget(unsigned int size) {
+		unsigned int iteration = ev_iteration(ctx->libev->getLoop());
+		if (budgetIteration != iteration) {
+			budgetIteration = iteration;
+			budgetCalls = 0;
+			budgetBytes = 0;
+		}
+		budgetCalls++;
+		budgetBytes += size;
+	}
+
+	/**
+	 * Returns whether this Channel has used up its budget for the
+	 * current event loop iteration.
+	 */
+	bool budgetExhausted() const {
+		if (budgetIteration != ev_iteration(ctx->libev->getLoop())) {
+			return false;
+		}
+		return (ctx->channelCallBudget != 0 && budgetCalls >= ctx->channelCallBudget)
+			|| (ctx->channelByteBudget != 0 && budgetBytes >= ctx->channelByteBudget);
+	}
+
 	void planNextActivity() {
 		if (buffer.empty()) {
 			state = IDLE;
@@ -503,6 +540,9 @@ public:
 		  errcode(0),
 		  generation(0),
 		  bytesConsumed(0),
+		  budgetIteration(0),
+		  budgetCalls(0),
+		  budgetBytes(0),
 		  ctx(NULL),
 		  dataCallback(NULL),
 		  consumedCallback(NULL),
@@ -518,6 +558,9 @@ public:
 		  errcode(0),
 		  generation(0),
 		  bytesConsumed(0),
+		  budgetIteration(0),
+		  budgetCalls(0),
+		  budgetBytes(0),
 		  ctx(context),
 		  dataCallback(NULL),
 		  consumedCallback(NULL),
@@ -717,11 +760,11 @@ public:
 			break;
 		case IDLE:
 		case PLANNING_TO_CALL:
-			state = STOPPED;
 			if (state == PLANNING_TO_CALL) {
 				ctx->libev->cancelCommand(planId);
 				planId = 0;
 			}
+			state = STOPPED;
 			break;
 		case CALLING:
 			state = STOPPED_WHILE_CALLING;
@@ -837,6 +880,16 @@ public:
 	 * notify it about the error. When the callback is done consuming the error,
 	 * `hasError() && endAcked()` will be true.
 	 */
+	/**
+	 * Returns whether there is fed data that the callback has not consumed
+	 * yet. This is the case if the callback only consumed part of a buffer
+	 * and the Channel was stopped before the rest could be passed to it.
+	 */
+	OXT_FORCE_INLINE
+	bool hasUnconsumedData() const {
+		return !buffer.empty();
+	}
+
 	OXT_FORCE_INLINE
 	bool hasError() const {
 		return errcode != 0;
@@ -872,19 +925,19 @@ public:
 		return state == EOF_OR_ERROR_ACKNOWLEDGED;
 	}
 
-	Json::Value inspectAsJson() const {
-		Json::Value doc;
-
-		doc["callback_in_progress"] = !acceptingInput();
+	/**
+	 * Writes this channel's state as members of the JSON object that
+	 * `writer` is currently writing.
+	 */
+	void writeStateAsJson(JsonWriter &writer) const {
+		writer.member("callback_in_progress", !acceptingInput());
 		if (hasError()) {
-			doc["error"] = errcode;
-			doc["error_acked"] = endAcked();
+			writer.member("error", errcode);
+			writer.member("error_acked", endAcked());
 		} else if (ended()) {
-			doc["ended"] = true;
-			doc["end_acked"] = endAcked();
+			writer.member("ended", true);
+			writer.member("end_acked", endAcked());
 		}
-
-		return doc;
 	}
 };
 
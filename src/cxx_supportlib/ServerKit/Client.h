@@ -32,6 +32,8 @@
 #include <ServerKit/Hooks.h>
 #include <ServerKit/FdSourceChannel.h>
 #include <ServerKit/FileBufferedFdSinkChannel.h>
+#include <ServerKit/Tls.h>
+#include <ServerKit/TimerWheel.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -87,10 +89,16 @@ public:
 	Hooks hooks;
 	FdSourceChannel input;
 	FileBufferedFdSinkChannel output;
+	// The client's TLS connection, if the server has a TLS context.
+	// Both channels perform their I/O through it.
+	TlsSession *tlsSession;
+	// Scheduled on the context's timer wheel by BaseServer::setClientTimeout().
+	TimerWheelEntry timeoutTimer;
 
 	BaseClient(void *_server)
 		: server(_server),
-		  refcount(2)
+		  refcount(2),
+		  tlsSession(NULL)
 	{
 		setConnState(DISCONNECTED);
 	}
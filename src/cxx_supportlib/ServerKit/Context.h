@@ -29,9 +29,11 @@
 #include <boost/make_shared.hpp>
 #include <string>
 #include <cstddef>
+#include <ev.h>
 #include <jsoncpp/json.h>
 #include <MemoryKit/mbuf.h>
 #include <SafeLibev.h>
+#include <ServerKit/TimerWheel.h>
 #include <Constants.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/JsonUtils.h>
@@ -64,35 +66,110 @@ struct FileBufferedChannelConfig {
 
 class Context {
 private:
+	ev_timer mbufPoolTrimTimer;
+
 	void initialize() {
+		channelCallBudget = DEFAULT_CHANNEL_CALL_BUDGET;
+		channelByteBudget = DEFAULT_CHANNEL_BYTE_BUDGET;
 		mbuf_pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
 		MemoryKit::mbuf_pool_init(&mbuf_pool);
+		ev_timer_init(&mbufPoolTrimTimer, onMbufPoolTrimTimeout, 0, 0);
+		mbufPoolTrimTimer.data = this;
+		mbufPoolTrimmedBlocks = 0;
+		lastMbufPoolTrimTime = 0;
+	}
+
+	static void onMbufPoolTrimTimeout(EV_P_ ev_timer *timer, int revents) {
+		static_cast<Context *>(timer->data)->trimMbufPool();
 	}
 
 public:
+	static const unsigned int DEFAULT_CHANNEL_CALL_BUDGET = 64;
+	static const unsigned int DEFAULT_CHANNEL_BYTE_BUDGET = 256 * 1024;
+
 	SafeLibevPtr libev;
 	struct uv_loop_s *libuv;
+	/** For coarse per-client timeouts. See BaseServer::setClientTimeout(). */
+	TimerWheel timerWheel;
 	struct MemoryKit::mbuf_pool mbuf_pool;
 	string secureModePassword;
 	FileBufferedChannelConfig defaultFileBufferedChannelConfig;
+	/**
+	 * The maximum number of data callback calls, and the maximum number of
+	 * bytes consumed, that a single Channel gets per event loop iteration.
+	 * Once a Channel has used up its budget, it processes the remainder of
+	 * its data in a later iteration, so that a client that sends a lot of
+	 * data (e.g. many pipelined requests) cannot starve the other clients
+	 * on the same event loop. 0 means unlimited.
+	 */
+	unsigned int channelCallBudget;
+	unsigned int channelByteBudget;
+	// Statistics for trimMbufPool().
+	unsigned long long mbufPoolTrimmedBlocks;
+	ev_tstamp lastMbufPoolTrimTime;
 
 	Context(const SafeLibevPtr &_libev, struct uv_loop_s *_libuv)
 		: libev(_libev),
-		  libuv(_libuv)
+		  libuv(_libuv),
+		  timerWheel(_libev->getLoop())
 	{
 		initialize();
 	}
 
 	Context(struct ev_loop *loop)
-		: libev(boost::make_shared<SafeLibev>(loop))
+		: libev(boost::make_shared<SafeLibev>(loop)),
+		  timerWheel(loop)
 	{
 		initialize();
 	}
 
 	~Context() {
+		if (ev_is_active(&mbufPoolTrimTimer)) {
+			ev_timer_stop(libev->getLoop(), &mbufPoolTrimTimer);
+		}
 		MemoryKit::mbuf_pool_deinit(&mbuf_pool);
 	}
 
+	/**
+	 * Periodically calls trimMbufPool(), every `interval` seconds, so that
+	 * the mbuf freelists shrink back after traffic spikes.
+	 *
+	 * May only be called from the event loop thread, or before the
+	 * event loop is started.
+	 */
+	void startMbufPoolTrimming(ev_tstamp interval) {
+		if (ev_is_active(&mbufPoolTrimTimer)) {
+			ev_timer_stop(libev->getLoop(), &mbufPoolTrimTimer);
+		}
+		ev_timer_set(&mbufPoolTrimTimer, interval, interval);
+		ev_timer_start(libev->getLoop(), &mbufPoolTrimTimer);
+	}
+
+	/**
+	 * Lets the mbuf pool carve new blocks out of huge page backed memory,
+	 * up to `maxSize` bytes. See MemoryKit::mbuf_pool_enable_hugepages().
+	 *
+	 * May only be called from the event loop thread, or before the
+	 * event loop is started.
+	 */
+	void enableMbufPoolHugePages(size_t maxSize) {
+		MemoryKit::mbuf_pool_enable_hugepages(&mbuf_pool, maxSize);
+	}
+
+	/**
+	 * Releases part of the free mbuf_blocks that weren't needed since
+	 * the last trim. See MemoryKit::mbuf_pool_trim(). Returns the number
+	 * of released blocks.
+	 *
+	 * May only be called from the event loop thread.
+	 */
+	unsigned int trimMbufPool() {
+		unsigned int count = MemoryKit::mbuf_pool_trim(&mbuf_pool);
+		mbufPoolTrimmedBlocks += count;
+		lastMbufPoolTrimTime = ev_now(libev->getLoop());
+		return count;
+	}
+
 	Json::Value inspectStateAsJson() const {
 		Json::Value doc;
 		Json::Value mbufDoc;
@@ -105,6 +182,47 @@ public:
 			* mbuf_pool.mbuf_block_chunk_size);
 		mbufDoc["active_memory"] = byteSizeToJson(mbuf_pool.nactive_mbuf_blockq
 			* mbuf_pool.mbuf_block_chunk_size);
+
+		Json::Value sizeClassesDoc(Json::arrayValue);
+		for (unsigned int i = 0; i < MBUF_SIZE_CLASS_COUNT; i++) {
+			const struct MemoryKit::mbuf_size_class *sizeClass = &mbuf_pool.size_classes[i];
+			Json::Value sizeClassDoc;
+
+			sizeClassDoc["free_blocks"] = (Json::UInt) sizeClass->nfree_mbuf_blockq;
+			sizeClassDoc["active_blocks"] = (Json::UInt) sizeClass->nactive_mbuf_blockq;
+			sizeClassDoc["chunk_size"] = (Json::UInt) sizeClass->mbuf_block_chunk_size;
+			sizeClassDoc["spare_memory"] = byteSizeToJson(sizeClass->nfree_mbuf_blockq
+				* sizeClass->mbuf_block_chunk_size);
+			sizeClassDoc["active_memory"] = byteSizeToJson(sizeClass->nactive_mbuf_blockq
+				* sizeClass->mbuf_block_chunk_size);
+			sizeClassesDoc.append(sizeClassDoc);
+		}
+		mbufDoc["size_classes"] = sizeClassesDoc;
+
+		Json::Value trimDoc;
+		trimDoc["enabled"] = (bool) ev_is_active(&mbufPoolTrimTimer);
+		if (ev_is_active(&mbufPoolTrimTimer)) {
+			trimDoc["interval"] = mbufPoolTrimTimer.repeat;
+		}
+		trimDoc["trimmed_blocks"] = (Json::UInt64) mbufPoolTrimmedBlocks;
+		if (lastMbufPoolTrimTime != 0) {
+			trimDoc["last_trim_time"] = timeToJson(lastMbufPoolTrimTime * 1000000.0);
+		}
+		mbufDoc["trimming"] = trimDoc;
+
+		const struct MemoryKit::hugepage_arena *arena = &mbuf_pool.arena;
+		Json::Value arenaDoc;
+		arenaDoc["enabled"] = arena->max_size > 0;
+		arenaDoc["limit"] = byteSizeToJson(arena->max_size);
+		arenaDoc["regions"] = (Json::UInt) arena->nregions;
+		arenaDoc["hugetlb_regions"] = (Json::UInt) arena->nhugetlb_regions;
+		arenaDoc["transparent_regions"] = (Json::UInt) (arena->nregions
+			- arena->nhugetlb_regions);
+		arenaDoc["mapped_memory"] = byteSizeToJson(arena->mapped_size);
+		arenaDoc["used_memory"] = byteSizeToJson(arena->used_size);
+		arenaDoc["blocks"] = (Json::UInt) mbuf_pool.narena_mbuf_blockq;
+		arenaDoc["failed_allocations"] = (Json::UInt) arena->nfailed_allocs;
+		mbufDoc["huge_page_arena"] = arenaDoc;
 		#ifdef MBUF_ENABLE_DEBUGGING
 			struct MemoryKit::active_mbuf_block_list *list =
 				const_cast<struct MemoryKit::active_mbuf_block_list *>(
@@ -127,6 +245,7 @@ public:
 		#endif
 
 		doc["mbuf_pool"] = mbufDoc;
+		doc["timer_wheel_entries"] = timerWheel.size();
 
 		return doc;
 	}
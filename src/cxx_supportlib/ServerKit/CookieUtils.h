@@ -27,254 +27,118 @@
 #define _PASSENGER_SERVER_KIT_COOKIE_UTILS_H_
 
 #include <cstring>
-#include <cassert>
 #include <MemoryKit/palloc.h>
 #include <DataStructures/LString.h>
+#include <StaticString.h>
+#include <Utils/StrIntUtils.h>
 
 namespace Passenger {
 namespace ServerKit {
 
 
-inline bool findCookieNameValueSeparator(const LString::Part *part, size_t index,
-	const LString::Part **separatorPart, size_t *separatorIndex);
-inline bool findCookieEnd(const LString::Part *separatorPart, size_t separatorIndex,
-	const LString::Part **endPart, size_t *endIndex);
-inline bool matchCookieName(psg_pool_t *pool, const LString::Part *part, size_t index,
-	const LString::Part *separatorPart, size_t separatorIndex,
-	const LString *name);
-inline LString *extractCookieValue(psg_pool_t *pool,
-	const LString::Part *separatorPart, size_t separatorIndex,
-	const LString::Part *endPart, size_t endIndex);
-
-
 /**
- * Given the value of an HTTP cookie header, returns the value of the cookie
- * of the given name, or NULL if not found.
+ * A cookie to look for with findCookies(). `value` and `found` are
+ * filled in when the cookie is found.
  */
-inline LString *
-findCookie(psg_pool_t *pool, const LString *cookieHeaderValue, const LString *name) {
-	const LString::Part *part = cookieHeaderValue->start;
-	const LString::Part *separatorPart, *endPart;
-	size_t index = 0, separatorIndex, endIndex;
-	bool done = part == NULL;
-	LString *result = NULL;
+struct CookieTarget {
+	StaticString name;
+	StaticString value;
+	bool found;
 
-	if (cookieHeaderValue->size == 0) {
-		return NULL;
-	}
+	CookieTarget()
+		: found(false)
+		{ }
 
-	while (!done) {
-		if (findCookieNameValueSeparator(part, index, &separatorPart, &separatorIndex)) {
-			if (!findCookieEnd(separatorPart, separatorIndex, &endPart, &endIndex)) {
-				done = true;
-			} else if (matchCookieName(pool, part, index, separatorPart, separatorIndex, name)) {
-				result = extractCookieValue(pool, separatorPart, separatorIndex, endPart, endIndex);
-				done   = true;
-			} else {
-				part  = endPart;
-				index = endIndex;
-				done  = endIndex >= endPart->size;
-			}
-		} else {
-			done = true;
-		}
-	}
+	CookieTarget(const StaticString &_name)
+		: name(_name),
+		  found(false)
+		{ }
+};
 
-	return result;
-}
 
 /**
- * Search an LString, starting from the given part and the given index inside that part,
- * for the cookie separator character ('='). Will keep iterating to the next parts
- * until found or until the end of the LString is reached.
+ * Scans the value of an HTTP cookie header once, looking for all of the
+ * given cookies at the same time. For every target that is found, its
+ * `value` is set to the (whitespace-stripped) cookie value, pointing into
+ * `data`. If a cookie occurs multiple times then the first occurrence wins.
+ * Returns the number of targets that were found.
  *
- * The part in which the separator character is found is written to `*separatorPart`,
- * and the index inside that part is written to `*separatorIndex`.
+ * Cookie headers can be several kilobytes of cookies that we're not
+ * interested in, so this function allocates nothing and only looks at the
+ * first few bytes of each cookie: it jumps from ';' to ';' with memchr()
+ * (which is vectorized by the C library) and stops as soon as all targets
+ * have been found.
  */
-inline bool
-findCookieNameValueSeparator(const LString::Part *part, size_t index,
-	const LString::Part **separatorPart, size_t *separatorIndex)
-{
-	const char *pos;
-	bool result = false;
-	bool done = part == NULL;
-
-	while (!done) {
-		pos = (const char *) memchr(part->data + index, '=', part->size - index);
-		if (pos == NULL) {
-			part  = part->next;
-			index = 0;
-			done  = part == NULL;
-		} else {
-			*separatorPart  = part;
-			*separatorIndex = pos - part->data;
-			result = true;
-			done   = true;
+inline unsigned int
+findCookies(const char *data, size_t size, CookieTarget *targets, unsigned int count) {
+	// See http://stackoverflow.com/questions/6108207/definite-guide-to-valid-cookie-values
+	// for syntax grammar.
+	const char *pos = data;
+	const char *end = data + size;
+	unsigned int remaining = count;
+
+	while (pos < end && remaining > 0) {
+		const char *cookieEnd = (const char *) memchr(pos, ';', end - pos);
+		if (cookieEnd == NULL) {
+			cookieEnd = end;
 		}
-	}
 
-	return result;
-}
+		skipLeadingWhitespaces(&pos, cookieEnd);
 
-/**
- * Given an LString and an offset inside that LString containing a cookie separator
- * character (as provided by `separatorPart` and `separatorIndex`), search for the
- * end of that cookie. The end of the cookie is denoted by either the ';' character
- * or by end-of-string. Will keep iterating to the next parts until the end is found.
- *
- * The part in which the end is found is written to `*endPart`,
- * and the index inside that part is written to `*endIndex`.
- */
-inline bool
-findCookieEnd(const LString::Part *separatorPart, size_t separatorIndex,
-	const LString::Part **endPart, size_t *endIndex)
-{
-	const LString::Part *part = separatorPart;
-	size_t index = separatorIndex;
-	const char *pos;
-	bool result = false;
-	bool done = part == NULL;
+		for (unsigned int i = 0; i < count; i++) {
+			CookieTarget &target = targets[i];
+			size_t nameSize = target.name.size();
 
-	while (!done) {
-		pos = (const char *) memchr(part->data + index, ';', part->size - index);
-		if (pos == NULL) {
-			if (part->next == NULL) {
-				// Semicolon not found in entire LString. Return end-of-LString
-				// as cookie end.
-				*endPart = part;
-				*endIndex = part->size;
-				result = true;
-				done   = true;
-			} else {
-				part  = part->next;
-				index = 0;
-				done  = part == NULL;
+			if (target.found
+			 || nameSize == 0
+			 || nameSize >= (size_t) (cookieEnd - pos)
+			 || memcmp(pos, target.name.data(), nameSize) != 0)
+			{
+				continue;
 			}
-		} else {
-			// Semicolon found.
-			*endPart = part;
-			*endIndex = pos - part->data;
-			result = true;
-			done   = true;
-		}
-	}
-
-	return result;
-}
-
-/**
- * Given an LString containing a cookie name, skip all leading whitespace
- * by modifying the LString in-place.
- */
-inline void
-_matchCookieName_skipWhitespace(LString *str) {
-	LString::Part *part = str->start;
-	size_t pos = 0;
-	bool done = false;
 
-	while (!done) {
-		while (pos < part->size
-		 && (part->data[pos] == ' ' || part->data[pos] == ';'))
-		{
-			pos++;
-		}
-
-		if (pos == part->size) {
-			str->start = part->next;
-			str->size -= part->size;
-			part = part->next;
-			pos = 0;
-			if (part == NULL) {
-				assert(str->size == 0);
-				done = true;
-				psg_lstr_init(str);
+			const char *sep = pos + nameSize;
+			skipLeadingWhitespaces(&sep, cookieEnd);
+			if (sep < cookieEnd && *sep == '=') {
+				const char *valueBegin = sep + 1;
+				const char *valueEnd = cookieEnd;
+
+				skipLeadingWhitespaces(&valueBegin, valueEnd);
+				skipTrailingWhitespaces(valueBegin, &valueEnd);
+				target.value = StaticString(valueBegin, valueEnd - valueBegin);
+				target.found = true;
+				remaining--;
+				break;
 			}
-		} else {
-			part->data += pos;
-			part->size -= pos;
-			str->size  -= pos;
-			done = true;
 		}
-	}
-}
-
-/**
- * Checks whether a substring of an LString matches `name`.
- * The substring is assumed to start in part `part` at index `index`.
- * The substring is assumed to end in part `separatorPart` at index
- * `separatorIndex` (which is supposed to contain the cookie name-value
- * separator character '=').
- */
-inline bool
-matchCookieName(psg_pool_t *pool, const LString::Part *part, size_t index,
-	const LString::Part *separatorPart, size_t separatorIndex,
-	const LString *name)
-{
-	LString *str = (LString *) psg_palloc(pool, sizeof(LString));
-	psg_lstr_init(str);
 
-	// Construct the specified substring so that we can use
-	// psg_lstr_cmp() to compare that with `name`.
-	if (part == separatorPart) {
-		assert(index < separatorIndex);
-		psg_lstr_append(str, pool,
-			part->data + index,
-			separatorIndex - index);
-	} else {
-		psg_lstr_append(str, pool,
-			part->data + index,
-			part->size - index);
-
-		part = part->next;
-		while (part != separatorPart) {
-			psg_lstr_append(str, pool, part->data, part->size);
-			part = part->next;
-		}
-
-		if (separatorIndex != 0) {
-			psg_lstr_append(str, pool, separatorPart->data, separatorIndex);
-		}
+		pos = cookieEnd + 1;
 	}
 
-	_matchCookieName_skipWhitespace(str);
-
-	bool result = psg_lstr_cmp(str, name);
-	psg_lstr_deinit(str);
-	return result;
+	return count - remaining;
 }
 
+/**
+ * Given the value of an HTTP cookie header, returns the value of the cookie
+ * of the given name, or NULL if not found.
+ */
 inline LString *
-extractCookieValue(psg_pool_t *pool,
-	const LString::Part *separatorPart, size_t separatorIndex,
-	const LString::Part *endPart, size_t endIndex)
-{
-	LString *str = (LString *) psg_palloc(pool, sizeof(LString));
-	psg_lstr_init(str);
-
-	if (separatorPart == endPart) {
-		assert(separatorIndex < endIndex);
-		psg_lstr_append(str, pool,
-			separatorPart->data + separatorIndex + 1,
-			endIndex - separatorIndex - 1);
-	} else {
-		if (separatorIndex < separatorPart->size - 1) {
-			psg_lstr_append(str, pool,
-				separatorPart->data + separatorIndex + 1,
-				separatorPart->size - separatorIndex - 1);
-		}
+findCookie(psg_pool_t *pool, const LString *cookieHeaderValue, const LString *name) {
+	if (cookieHeaderValue->size == 0 || name->size == 0) {
+		return NULL;
+	}
 
-		const LString::Part *part = separatorPart->next;
-		while (part != endPart) {
-			psg_lstr_append(str, pool, part->data, part->size);
-			part = part->next;
-		}
+	// These are no-ops for headers that have already been flattened.
+	cookieHeaderValue = psg_lstr_make_contiguous(cookieHeaderValue, pool);
+	name = psg_lstr_make_contiguous(name, pool);
 
-		if (endIndex != 0) {
-			psg_lstr_append(str, pool, endPart->data, endIndex);
-		}
+	CookieTarget target(StaticString(name->start->data, name->size));
+	if (findCookies(cookieHeaderValue->start->data, cookieHeaderValue->size,
+		&target, 1) == 0)
+	{
+		return NULL;
 	}
-
-	return str;
+	return psg_lstr_create(pool, target.value);
 }
 
 
@@ -28,9 +28,13 @@
 
 #include <oxt/macros.hpp>
 #include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <ev.h>
-#include <jsoncpp/json.h>
+#include <Utils/JsonWriter.h>
+#include <Utils/ShmRing.h>
 #include <ServerKit/Channel.h>
 
 namespace Passenger {
@@ -42,13 +46,23 @@ using namespace oxt;
 class FdSinkChannel: protected Channel {
 private:
 	ev_io watcher;
+	// If not NULL, data is written to this slot's outgoing ring, and the
+	// file descriptor only carries doorbells. See ShmRingFile.
+	ShmRingSlot *shmRingSlot;
+	// An error that the doorbell watcher ran into while we were waiting for
+	// ring space. Reported the next time the channel calls onData().
+	int shmRingError;
+	// Whether halfClose() was called while there was still data to write.
+	bool shmRingClosePending;
 
 	static Result _onData(Channel *channel, const MemoryKit::mbuf &buffer, int errcode) {
 		return static_cast<FdSinkChannel *>(channel)->onData(buffer, errcode);
 	}
 
 	Result onData(const MemoryKit::mbuf &buffer, int errcode) {
-		if (buffer.size() > 0) {
+		if (shmRingSlot != NULL) {
+			return onShmRingData(buffer, errcode);
+		} else if (buffer.size() > 0) {
 			// Data
 			ssize_t ret;
 
@@ -79,14 +93,99 @@ private:
 		}
 	}
 
+	Result onShmRingData(const MemoryKit::mbuf &buffer, int errcode) {
+		ShmRing &ring = shmRingSlot->outgoing;
+
+		if (OXT_UNLIKELY(shmRingError != 0)) {
+			Channel::feedError(shmRingError);
+			return Result(0, false);
+		} else if (buffer.size() > 0) {
+			// Data
+			size_t written = 0;
+			bool full = false;
+			int e;
+
+			while (written < buffer.size() && !full) {
+				written += ring.write(buffer.start + written, buffer.size() - written);
+				full = written < buffer.size() && ring.prepareToWaitForSpace();
+			}
+			if (OXT_UNLIKELY(ring.isCorrupted())) {
+				Channel::feedError(EPROTO);
+				return Result(0, false);
+			}
+			if (ring.consumerNeedsWakeup() && (e = ringShmRingDoorbell(watcher.fd)) != 0) {
+				Channel::feedError(e);
+				return Result(0, false);
+			}
+
+			if (!full) {
+				if (shmRingClosePending) {
+					closeShmRing();
+				}
+			} else {
+				ev_io_start(ctx->libev->getLoop(), &watcher);
+				stop();
+			}
+			return Result(written, false);
+		} else if (errcode == 0) {
+			// EOF
+			closeShmRing();
+			return Channel::Result(0, true);
+		} else {
+			// Error
+			// We do nothing here. The caller is responsible for handling the error.
+			return Channel::Result(0, false);
+		}
+	}
+
 	static void _onWritable(EV_P_ ev_io *io, int revents) {
 		FdSinkChannel *self = static_cast<FdSinkChannel *>(io->data);
 		ev_io_stop(self->ctx->libev->getLoop(), &self->watcher);
 		self->start();
 	}
 
+	/**
+	 * Called when a doorbell arrives while we're waiting for the other side
+	 * to free ring space. FdSourceChannel may be draining the same doorbells,
+	 * so we check the ring regardless of whether we read any.
+	 */
+	static void _onShmRingDoorbell(EV_P_ ev_io *io, int revents) {
+		FdSinkChannel *self = static_cast<FdSinkChannel *>(io->data);
+		ShmRing &ring = self->shmRingSlot->outgoing;
+		bool eof;
+		int e;
+
+		e = drainShmRingDoorbells(self->watcher.fd, eof);
+		if (e == 0 && eof) {
+			e = EPIPE;
+		}
+		if (e != 0) {
+			self->shmRingError = e;
+		} else if (ring.writable() == 0) {
+			if (OXT_LIKELY(!ring.isCorrupted())) {
+				return;
+			}
+			self->shmRingError = EPROTO;
+		}
+		ring.stopWaitingForSpace();
+		ev_io_stop(self->ctx->libev->getLoop(), &self->watcher);
+		self->start();
+	}
+
+	void closeShmRing() {
+		shmRingClosePending = false;
+		shmRingSlot->outgoing.close();
+		if (shmRingSlot->outgoing.consumerNeedsWakeup()) {
+			// The other side notices it if this fails.
+			ringShmRingDoorbell(watcher.fd);
+		}
+	}
+
 	void initialize() {
 		dataCallback = _onData;
+		shmRingSlot = NULL;
+		shmRingError = 0;
+		shmRingClosePending = false;
 		watcher.active = false;
 		watcher.fd = -1;
 		watcher.data = this;
@@ -115,9 +214,21 @@ public:
 		Channel::setContext(context);
 	}
 
-	void reinitialize(int fd) {
+	/**
+	 * If `slot` is given, then data is written to its outgoing ring, and
+	 * `fd` must be the non-blocking connection that carries the ring's
+	 * doorbells. The slot is not owned by this channel.
+	 */
+	void reinitialize(int fd, ShmRingSlot *slot = NULL) {
 		Channel::reinitialize();
-		ev_io_init(&watcher, _onWritable, fd, EV_WRITE);
+		shmRingSlot = slot;
+		shmRingError = 0;
+		shmRingClosePending = false;
+		if (slot == NULL) {
+			ev_io_init(&watcher, _onWritable, fd, EV_WRITE);
+		} else {
+			ev_io_init(&watcher, _onShmRingDoorbell, fd, EV_READ);
+		}
 	}
 
 	void deinitialize() {
@@ -125,9 +236,57 @@ public:
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
 		watcher.fd = -1;
+		shmRingSlot = NULL;
 		Channel::deinitialize();
 	}
 
+	/**
+	 * Writes the given buffers directly, bypassing the channel, like
+	 * writev(2) on the file descriptor. Returns the number of bytes
+	 * written, or -1 with errno set. May only be called while the
+	 * channel is idle, i.e. when it has no data of its own to write.
+	 */
+	ssize_t writev(const struct iovec *iov, unsigned int iovcnt) {
+		ssize_t ret;
+
+		assert(acceptingInput());
+		if (shmRingSlot == NULL) {
+			do {
+				ret = ::writev(watcher.fd, iov, iovcnt);
+			} while (ret == -1 && errno == EINTR);
+		} else {
+			ShmRing &ring = shmRingSlot->outgoing;
+			int e;
+
+			ret = ring.writev(iov, iovcnt);
+			if (OXT_UNLIKELY(ring.isCorrupted())) {
+				errno = EPROTO;
+				ret = -1;
+			} else if (ret > 0 && ring.consumerNeedsWakeup()
+			 && (e = ringShmRingDoorbell(watcher.fd)) != 0)
+			{
+				errno = e;
+				ret = -1;
+			}
+		}
+		return ret;
+	}
+
+	/**
+	 * Tells the other side that no more data will follow, without closing
+	 * the connection: shuts down the writing side of the socket, or closes
+	 * the ring once the channel has written out the data that it has.
+	 */
+	void halfClose() {
+		if (shmRingSlot == NULL) {
+			::shutdown(watcher.fd, SHUT_WR);
+		} else if (acceptingInput()) {
+			closeShmRing();
+		} else {
+			shmRingClosePending = true;
+		}
+	}
+
 	OXT_FORCE_INLINE
 	int feed(const MemoryKit::mbuf &mbuf) {
 		return Channel::feed(mbuf);
@@ -158,6 +317,11 @@ public:
 		return watcher.fd;
 	}
 
+	OXT_FORCE_INLINE
+	bool usesShmRing() const {
+		return shmRingSlot != NULL;
+	}
+
 	OXT_FORCE_INLINE
 	bool acceptingInput() const {
 		return Channel::acceptingInput();
@@ -203,11 +367,10 @@ public:
 		this->hooks = hooks;
 	}
 
-	Json::Value inspectAsJson() const {
-		Json::Value doc = Channel::inspectAsJson();
-		doc["initialized"] = watcher.fd != -1;
-		doc["io_watcher_active"] = (bool) watcher.active;
-		return doc;
+	void writeStateAsJson(JsonWriter &writer) const {
+		Channel::writeStateAsJson(writer);
+		writer.member("initialized", watcher.fd != -1);
+		writer.member("io_watcher_active", (bool) watcher.active);
 	}
 };
 
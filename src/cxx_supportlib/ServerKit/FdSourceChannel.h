@@ -29,12 +29,17 @@
 #include <oxt/macros.hpp>
 #include <boost/move/move.hpp>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <ev.h>
-#include <jsoncpp/json.h>
+#include <Utils/JsonWriter.h>
+#include <Utils/ShmRing.h>
+#include <algorithm>
+#include <cstring>
 #include <MemoryKit/mbuf.h>
 #include <ServerKit/Context.h>
 #include <ServerKit/Channel.h>
+#include <ServerKit/Tls.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -46,6 +51,38 @@ class FdSourceChannel: protected Channel {
 private:
 	ev_io watcher;
 	MemoryKit::mbuf buffer;
+	// The mbuf size class to allocate the next read buffer from. Adjusted
+	// after every read that used a fresh buffer: grows when the buffer was
+	// filled completely, shrinks when the data would have fit in the next
+	// smaller size class. This way mostly idle connections and connections
+	// exchanging small messages don't tie up large buffers, while bulk
+	// transfers still read in big chunks.
+	boost::uint8_t sizeClass;
+	// The number of reads to attempt per readability event, never more
+	// than `burstReadCount`. Doubled when a burst used up all its reads
+	// on completely filled buffers, halved when a burst ended with a
+	// read that only returned EAGAIN.
+	unsigned int adaptiveBurstReadCount;
+	// If not NULL, data is read through this TLS connection instead of
+	// directly from the file descriptor.
+	TlsSession *tlsSession;
+	// Whether the watcher currently waits for writability too, because
+	// the TLS handshake has to write to the socket before it can continue.
+	bool tlsWaitingForWritability;
+	// If not NULL, data is read from this slot's incoming ring, and the
+	// file descriptor only carries doorbells. See ShmRingFile.
+	ShmRingSlot *shmRingSlot;
+	// Whether the other side closed the connection while we were reading
+	// from a ring. The ring may still contain data then.
+	bool shmRingPeerClosed;
+	// Whether to accept file descriptors that the peer passes along with
+	// the data (SCM_RIGHTS). The last one received is kept in `passedFd`
+	// until it's taken with takePassedFd().
+	bool receivesFds;
+	int passedFd;
+	// Statistics for writeStateAsJson().
+	unsigned int nreads;
+	unsigned int nWastedReads;
 
 	static void _onReadable(EV_P_ ev_io *io, int revents) {
 		static_cast<FdSourceChannel *>(io->data)->onReadable(io, revents);
@@ -58,11 +95,16 @@ private:
 
 	void onReadableWithoutRefGuard() {
 		unsigned int generation = this->generation;
-		unsigned int i, origBufferSize;
-		bool done = false;
+		unsigned int i, origBufferSize, burstLimit;
+		bool done = false, freshBuffer;
 		ssize_t ret;
 		int e;
 
+		if (shmRingSlot != NULL) {
+			onShmRingReadable();
+			return;
+		}
+
 		if (!acceptingInput()) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 			if (mayAcceptInputLater()) {
@@ -71,18 +113,36 @@ private:
 			return;
 		}
 
-		for (i = 0; i < burstReadCount && !done; i++) {
-			if (buffer.empty()) {
-				buffer = MemoryKit::mbuf_get(&ctx->mbuf_pool);
+		if (OXT_UNLIKELY(tlsWaitingForWritability)) {
+			setWatcherEvents(EV_READ);
+			tlsWaitingForWritability = false;
+		}
+
+		burstLimit = std::max(1u, std::min(adaptiveBurstReadCount, burstReadCount));
+		for (i = 0; i < burstLimit && !done; i++) {
+			freshBuffer = buffer.empty();
+			if (freshBuffer) {
+				buffer = MemoryKit::mbuf_get_with_size_class(&ctx->mbuf_pool, sizeClass);
 			}
 
 			origBufferSize = buffer.size();
-			do {
-				ret = ::read(watcher.fd, buffer.start, buffer.size());
-			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			if (OXT_UNLIKELY(receivesFds)) {
+				ret = readAndReceiveFd(buffer.start, buffer.size());
+			} else if (tlsSession == NULL) {
+				do {
+					ret = ::read(watcher.fd, buffer.start, buffer.size());
+				} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			} else {
+				ret = tlsRead(tlsSession, buffer.start, buffer.size());
+			}
+			nreads++;
 			if (ret > 0) {
+				if (freshBuffer) {
+					adjustSizeClass(ret, origBufferSize);
+				}
+
 				MemoryKit::mbuf buffer2(buffer, 0, ret);
-				if (size_t(ret) == size_t(buffer.size())) {
+				if (size_t(ret) == size_t(buffer.size()) || releaseBufferWhenIdle) {
 					// Unref mbuf_block
 					buffer = MemoryKit::mbuf();
 				} else {
@@ -104,7 +164,15 @@ private:
 					// If we were unable to fill the entire buffer, then it's likely that
 					// the client is slow and that the next read() will fail with
 					// EAGAIN, so we stop looping and return to the event loop poller.
-					done = (size_t) ret < origBufferSize;
+					// That doesn't hold if the TLS connection already has the next
+					// record's data decrypted.
+					done = (size_t) ret < origBufferSize
+						&& (tlsSession == NULL || !tlsHasPendingData(tlsSession));
+					// Once this client has used up its budget for this event loop
+					// iteration, we leave the rest of the socket's data for the next
+					// iteration, so that the other clients get a turn first. The
+					// watcher is level-triggered, so it fires again.
+					done = done || budgetExhausted();
 				}
 
 			} else if (ret == 0) {
@@ -117,12 +185,202 @@ private:
 				e = errno;
 				done = true;
 				buffer = MemoryKit::mbuf();
-				if (e != EAGAIN && e != EWOULDBLOCK) {
+				if (e == EAGAIN || e == EWOULDBLOCK) {
+					nWastedReads++;
+					if (tlsSession != NULL && tlsWantsWrite(tlsSession)) {
+						setWatcherEvents(EV_READ | EV_WRITE);
+						tlsWaitingForWritability = true;
+					}
+					if (i > 0 && adaptiveBurstReadCount > 1) {
+						// The previous read in this burst filled its buffer,
+						// but the peer had nothing more for us.
+						adaptiveBurstReadCount /= 2;
+					}
+				} else {
 					ev_io_stop(ctx->libev->getLoop(), &watcher);
 					feedError(e);
 				}
 			}
 		}
+
+		if (!done && adaptiveBurstReadCount < burstReadCount) {
+			// Every read in this burst filled its buffer, so the peer is
+			// likely to have more data for us than we dared to read.
+			adaptiveBurstReadCount = std::min(adaptiveBurstReadCount * 2,
+				burstReadCount);
+		}
+		if (tlsSession != NULL) {
+			feedTlsPendingDataEvent();
+		}
+	}
+
+	/**
+	 * Reads from the ring instead of from the file descriptor. We get
+	 * here whenever a doorbell arrives, but also when we start or resume
+	 * reading, because the ring may have received data whose doorbell we
+	 * didn't see: FdSinkChannel drains doorbells too.
+	 */
+	void onShmRingReadable() {
+		ShmRing &ring = shmRingSlot->incoming;
+		unsigned int generation = this->generation;
+		unsigned int i, burstLimit;
+		bool eof;
+		size_t ret;
+		int e;
+
+		e = drainShmRingDoorbells(watcher.fd, eof);
+		if (e != 0) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+			buffer = MemoryKit::mbuf();
+			feedError(e);
+			return;
+		}
+		shmRingPeerClosed = shmRingPeerClosed || eof;
+		ring.stopWaitingForData();
+
+		if (!acceptingInput()) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+			if (mayAcceptInputLater()) {
+				consumedCallback = onChannelConsumed;
+			}
+			return;
+		}
+
+		burstLimit = std::max(1u, burstReadCount);
+		for (i = 0; i < burstLimit && ring.readable() > 0; i++) {
+			if (buffer.empty()) {
+				buffer = MemoryKit::mbuf_get_with_size_class(&ctx->mbuf_pool, sizeClass);
+			}
+			ret = ring.read(buffer.start, buffer.size());
+			nreads++;
+			if (ring.producerNeedsWakeup()) {
+				// The other side notices it if this fails.
+				ringShmRingDoorbell(watcher.fd);
+			}
+
+			MemoryKit::mbuf buffer2(buffer, 0, ret);
+			if (ret == size_t(buffer.size()) || releaseBufferWhenIdle) {
+				buffer = MemoryKit::mbuf();
+			} else {
+				buffer = MemoryKit::mbuf(buffer, ret);
+			}
+			feedWithoutRefGuard(boost::move(buffer2));
+			if (generation != this->generation) {
+				// Callback deinitialized this object.
+				return;
+			}
+			if (!acceptingInput()) {
+				ev_io_stop(ctx->libev->getLoop(), &watcher);
+				if (mayAcceptInputLater()) {
+					consumedCallback = onChannelConsumed;
+				}
+				return;
+			}
+		}
+
+		if (OXT_UNLIKELY(ring.isCorrupted())) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+			buffer = MemoryKit::mbuf();
+			feedError(EPROTO);
+		} else if (ring.readable() > 0) {
+			// Burst limit reached. No doorbell may be coming for the rest.
+			ev_feed_event(ctx->libev->getLoop(), &watcher, EV_READ);
+		} else if (ring.atEof() || shmRingPeerClosed) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+			buffer = MemoryKit::mbuf();
+			feedWithoutRefGuard(MemoryKit::mbuf());
+		} else if (!ring.prepareToWaitForData()) {
+			// Data arrived while we were announcing that we're going to wait.
+			ev_feed_event(ctx->libev->getLoop(), &watcher, EV_READ);
+		}
+	}
+
+	void setWatcherEvents(int events) {
+		bool active = ev_is_active(&watcher);
+		if (active) {
+			ev_io_stop(ctx->libev->getLoop(), &watcher);
+		}
+		ev_io_set(&watcher, watcher.fd, events);
+		if (active) {
+			ev_io_start(ctx->libev->getLoop(), &watcher);
+		}
+	}
+
+	/**
+	 * Like read(), but also accepts a file descriptor that the peer passed
+	 * along with the data. It replaces any earlier one that wasn't taken.
+	 */
+	ssize_t readAndReceiveFd(char *buf, size_t size) {
+		struct msghdr msg;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		union {
+			struct cmsghdr header;
+			char data[CMSG_SPACE(sizeof(int))];
+		} control;
+		int flags = 0;
+		ssize_t ret;
+
+		#ifdef MSG_CMSG_CLOEXEC
+			flags |= MSG_CMSG_CLOEXEC;
+		#endif
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = size;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+		do {
+			ret = recvmsg(watcher.fd, &msg, flags);
+		} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+		if (ret == -1) {
+			return -1;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET
+			 && cmsg->cmsg_type == SCM_RIGHTS
+			 && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			{
+				int fd;
+				memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+				closePassedFd();
+				passedFd = fd;
+			}
+		}
+		return ret;
+	}
+
+	void closePassedFd() {
+		if (passedFd != -1) {
+			::close(passedFd);
+			passedFd = -1;
+		}
+	}
+
+	/**
+	 * The socket does not become readable for data that the TLS connection
+	 * has already decrypted, so if we're waiting for readability while
+	 * there is such data, we simulate a readability event.
+	 */
+	void feedTlsPendingDataEvent() {
+		if (ev_is_active(&watcher) && tlsHasPendingData(tlsSession)) {
+			ev_feed_event(ctx->libev->getLoop(), &watcher, EV_READ);
+		}
+	}
+
+	void adjustSizeClass(size_t readSize, size_t bufferSize) {
+		if (readSize == bufferSize) {
+			if (sizeClass + 1 < MBUF_SIZE_CLASS_COUNT) {
+				sizeClass++;
+			}
+		} else if (sizeClass > 0
+			&& readSize <= MemoryKit::mbuf_pool_size_class_data_size(
+				&ctx->mbuf_pool, sizeClass - 1))
+		{
+			sizeClass--;
+		}
 	}
 
 	static void onChannelConsumed(Channel *channel, unsigned int size) {
@@ -130,18 +388,45 @@ private:
 		self->consumedCallback = NULL;
 		if (self->acceptingInput()) {
 			ev_io_start(self->ctx->libev->getLoop(), &self->watcher);
+			if (self->tlsSession != NULL) {
+				self->feedTlsPendingDataEvent();
+			} else if (self->shmRingSlot != NULL) {
+				ev_feed_event(self->ctx->libev->getLoop(), &self->watcher, EV_READ);
+			}
 		}
 	}
 
 	void initialize() {
 		burstReadCount = 1;
+		releaseBufferWhenIdle = false;
+		sizeClass = DEFAULT_SIZE_CLASS;
+		adaptiveBurstReadCount = 1;
+		tlsSession = NULL;
+		tlsWaitingForWritability = false;
+		shmRingSlot = NULL;
+		shmRingPeerClosed = false;
+		receivesFds = false;
+		passedFd = -1;
+		nreads = 0;
+		nWastedReads = 0;
 		watcher.active = false;
 		watcher.fd = -1;
 		watcher.data = this;
 	}
 
 public:
+	// The 4K size class, which matches DEFAULT_MBUF_CHUNK_SIZE.
+	static const boost::uint8_t DEFAULT_SIZE_CLASS = 1;
+
+	// The maximum number of reads per readability event. The actual
+	// number adapts to how much data the peer has available.
 	unsigned int burstReadCount;
+	// Whether to release the read buffer after every read, instead of
+	// keeping the unused remainder around for the next read. Meant for
+	// connections that are idle most of the time, such as upgraded
+	// (WebSocket) connections: between messages they then don't hold on
+	// to an mbuf at all. Reset by reinitialize().
+	bool releaseBufferWhenIdle;
 
 	FdSourceChannel() {
 		initialize();
@@ -157,6 +442,7 @@ public:
 		if (ctx != NULL && ev_is_active(&watcher)) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
+		closePassedFd();
 	}
 
 	// May only be called right after construction.
@@ -165,21 +451,100 @@ public:
 		Channel::setContext(context);
 	}
 
-	void reinitialize(int fd) {
+	/**
+	 * If `slot` is given, then data is read from its incoming ring, and
+	 * `fd` must be the non-blocking connection that carries the ring's
+	 * doorbells. The slot is not owned by this channel.
+	 */
+	void reinitialize(int fd, ShmRingSlot *slot = NULL) {
 		Channel::reinitialize();
+		releaseBufferWhenIdle = false;
+		sizeClass = DEFAULT_SIZE_CLASS;
+		adaptiveBurstReadCount = 1;
+		tlsSession = NULL;
+		tlsWaitingForWritability = false;
+		shmRingSlot = slot;
+		shmRingPeerClosed = false;
+		receivesFds = false;
+		nreads = 0;
+		nWastedReads = 0;
 		ev_io_init(&watcher, _onReadable, fd, EV_READ);
 	}
 
+	/**
+	 * Makes this channel read through the given TLS connection, which must
+	 * belong to the file descriptor. May only be called right after
+	 * reinitialize(). The session is not owned by this channel.
+	 */
+	void setTlsSession(TlsSession *session) {
+		tlsSession = session;
+	}
+
 	void deinitialize() {
 		buffer = MemoryKit::mbuf();
 		if (ev_is_active(&watcher)) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
 		watcher.fd = -1;
+		tlsSession = NULL;
+		shmRingSlot = NULL;
+		receivesFds = false;
+		closePassedFd();
 		consumedCallback = NULL;
 		Channel::deinitialize();
 	}
 
+	/**
+	 * Sets whether to accept a file descriptor that the peer passes along
+	 * with the data. May only be called for plain (non-TLS, non-ring)
+	 * Unix domain socket connections.
+	 */
+	void setReceivesFds(bool value) {
+		receivesFds = value;
+	}
+
+	/**
+	 * Returns the file descriptor that the peer passed most recently, and
+	 * gives up ownership of it. Returns -1 if there is none.
+	 */
+	int takePassedFd() {
+		int fd = passedFd;
+		passedFd = -1;
+		return fd;
+	}
+
+	/**
+	 * Must be called after the file descriptor has been made to refer to
+	 * another file, e.g. with dup2(), so that the event loop watches the
+	 * new file instead of the old one.
+	 */
+	void watchReplacedFd() {
+		struct ev_loop *loop = ctx->libev->getLoop();
+		bool active = ev_is_active(&watcher);
+
+		if (active) {
+			ev_io_stop(loop, &watcher);
+		}
+		// ev_io_set() tells libev that the fd may refer to another file now.
+		ev_io_set(&watcher, watcher.fd, watcher.events & (EV_READ | EV_WRITE));
+		if (active) {
+			ev_io_start(loop, &watcher);
+		}
+	}
+
+	/**
+	 * Sets `releaseBufferWhenIdle`. Enabling it also releases the current
+	 * read buffer and starts over at the smallest size class, which grows
+	 * again if the peer starts sending larger amounts of data.
+	 */
+	void setReleaseBufferWhenIdle(bool value) {
+		releaseBufferWhenIdle = value;
+		if (value) {
+			buffer = MemoryKit::mbuf();
+			sizeClass = 0;
+		}
+	}
+
 	// May only be called right after the constructor or reinitialize().
 	void startReading() {
 		startReadingInNextTick();
@@ -190,6 +555,9 @@ public:
 	void startReadingInNextTick() {
 		assert(Channel::acceptingInput());
 		ev_io_start(ctx->libev->getLoop(), &watcher);
+		if (shmRingSlot != NULL) {
+			ev_feed_event(ctx->libev->getLoop(), &watcher, EV_READ);
+		}
 	}
 
 	OXT_FORCE_INLINE
@@ -212,6 +580,11 @@ public:
 		return watcher.fd;
 	}
 
+	OXT_FORCE_INLINE
+	bool usesShmRing() const {
+		return shmRingSlot != NULL;
+	}
+
 	OXT_FORCE_INLINE
 	State getState() const {
 		return Channel::getState();
@@ -222,6 +595,11 @@ public:
 		return Channel::isStarted();
 	}
 
+	OXT_FORCE_INLINE
+	bool hasUnconsumedData() const {
+		return Channel::hasUnconsumedData();
+	}
+
 	OXT_FORCE_INLINE
 	void setDataCallback(DataCallback callback) {
 		Channel::dataCallback = callback;
@@ -237,11 +615,22 @@ public:
 		this->hooks = hooks;
 	}
 
-	Json::Value inspectAsJson() const {
-		Json::Value doc = Channel::inspectAsJson();
-		doc["initialized"] = watcher.fd != -1;
-		doc["io_watcher_active"] = (bool) watcher.active;
-		return doc;
+	void writeStateAsJson(JsonWriter &writer) const {
+		Channel::writeStateAsJson(writer);
+		writer.member("initialized", watcher.fd != -1);
+		writer.member("io_watcher_active", (bool) watcher.active);
+		writer.member("mbuf_size_class", (unsigned int) sizeClass);
+		writer.member("burst_read_count", burstReadCount);
+		writer.member("release_buffer_when_idle", releaseBufferWhenIdle);
+		writer.member("adaptive_burst_read_count", adaptiveBurstReadCount);
+		writer.member("reads", nreads);
+		writer.member("wasted_reads", nWastedReads);
+		if (tlsSession != NULL) {
+			writer.member("tls", true);
+		}
+		if (receivesFds) {
+			writer.member("receives_fds", true);
+		}
 	}
 };
 
@@ -32,6 +32,7 @@
 #include <boost/move/move.hpp>
 #include <boost/atomic.hpp>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <uv.h>
 #include <jsoncpp/json.h>
 #include <cassert>
@@ -46,6 +47,7 @@
 #include <ServerKit/Errors.h>
 #include <ServerKit/Channel.h>
 #include <Utils/JsonUtils.h>
+#include <Utils/JsonWriter.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -201,6 +203,9 @@ public:
 	static const unsigned int MAX_MEMORY_BUFFERING = 4294967295u;
 	// `nbuffers` is 27-bit. This is 2^27-1.
 	static const unsigned int MAX_BUFFERS = 134217727;
+	// Maximum number of in-memory buffers that the writer moves to
+	// the file with a single vectored write.
+	static const unsigned int MAX_MOVE_BATCH_SIZE = 16;
 
 
 private:
@@ -864,12 +869,30 @@ private:
 
 	struct FileCreationContext: public FileIOContext {
 		string path;
+		/**
+		 * Whether the file is created with O_TMPFILE, i.e. without a
+		 * directory entry. Such a file doesn't have to be unlinked.
+		 */
+		bool anonymous;
 
 		FileCreationContext(FileBufferedChannel *self)
-			: FileIOContext(self)
+			: FileIOContext(self),
+			  anonymous(false)
 			{ }
 	};
 
+	#ifdef O_TMPFILE
+		/**
+		 * Whether the filesystem that `bufferDir` lives on supports O_TMPFILE.
+		 * Assumed to be true until an attempt to use it fails, after which
+		 * all channels fall back to creating named files.
+		 */
+		static boost::atomic<bool> &anonymousBufferFilesSupported() {
+			static boost::atomic<bool> supported(true);
+			return supported;
+		}
+	#endif
+
 	void createBufferFile() {
 		P_ASSERT_EQ(mode, IN_FILE_MODE);
 		P_ASSERT_EQ(inFileMode->writerState, WS_INACTIVE);
@@ -877,17 +900,20 @@ private:
 
 		FileCreationContext *fcContext = new FileCreationContext(this);
 		fcContext->path = config->bufferDir;
-		fcContext->path.append("/buffer.");
-		fcContext->path.append(toString(rand()));
+		#ifdef O_TMPFILE
+			fcContext->anonymous = anonymousBufferFilesSupported().load(
+				boost::memory_order_relaxed);
+		#endif
+		if (!fcContext->anonymous) {
+			fcContext->path.append("/buffer.");
+			fcContext->path.append(toString(rand()));
+		}
 
 		inFileMode->writerState = WS_CREATING_FILE;
 		inFileMode->writerRequest = fcContext;
 
 		if (config->delayInFileModeSwitching == 0) {
-			FBC_DEBUG("Writer: creating file " << fcContext->path);
-			int result = uv_fs_open(ctx->libuv, &fcContext->req,
-				fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
-				0600, _bufferFileCreated);
+			int result = openBufferFile(fcContext);
 			if (result != 0) {
 				fcContext->req.result = result;
 				ctx->libev->runLater(boost::bind(_bufferFileCreated,
@@ -914,22 +940,40 @@ private:
 	}
 
 	void bufferFileDoneDelaying(FileCreationContext *fcContext) {
-		FBC_DEBUG("Writer: done delaying in-file mode switching. "
-			"Creating file: " << fcContext->path);
-		int result = uv_fs_open(ctx->libuv, &fcContext->req,
-			fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
-			0600, _bufferFileCreated);
+		FBC_DEBUG("Writer: done delaying in-file mode switching");
+		int result = openBufferFile(fcContext);
 		if (result != 0) {
 			fcContext->req.result = result;
 			_bufferFileCreated(&fcContext->req);
 		}
 	}
 
+	int openBufferFile(FileCreationContext *fcContext) {
+		#ifdef O_TMPFILE
+			if (fcContext->anonymous) {
+				FBC_DEBUG("Writer: creating anonymous file in " << fcContext->path);
+				return uv_fs_open(ctx->libuv, &fcContext->req,
+					fcContext->path.c_str(), O_RDWR | O_TMPFILE | O_EXCL,
+					0600, _bufferFileCreated);
+			}
+		#endif
+		FBC_DEBUG("Writer: creating file " << fcContext->path);
+		return uv_fs_open(ctx->libuv, &fcContext->req,
+			fcContext->path.c_str(), O_RDWR | O_CREAT | O_EXCL,
+			0600, _bufferFileCreated);
+	}
+
 	static void _bufferFileCreated(uv_fs_t *req) {
 		FileCreationContext *fcContext = static_cast<FileCreationContext *>(req->data);
 		uv_fs_req_cleanup(req);
 		if (fcContext->isCanceled()) {
-			if (req->result >= 0) {
+			if (req->result >= 0 && fcContext->anonymous) {
+				FBC_DEBUG_FROM_CALLBACK(fcContext,
+					"Writer: creation of anonymous file in " << fcContext->path <<
+					" canceled. Closing file in the background");
+				closeBufferFileInBackground(fcContext);
+				delete fcContext;
+			} else if (req->result >= 0) {
 				FBC_DEBUG_FROM_CALLBACK(fcContext,
 					"Writer: creation of file " << fcContext->path <<
 					"canceled. Deleting file in the background");
@@ -951,17 +995,36 @@ private:
 		inFileMode->writerRequest = NULL;
 
 		if (fcContext->req.result >= 0) {
-			FBC_DEBUG("Writer: file created. Deleting file in the background");
 			P_LOG_FILE_DESCRIPTOR_OPEN4(fcContext->req.result, __FILE__, __LINE__,
 				"FileBufferedChannel buffer file");
 			inFileMode->fd = fcContext->req.result;
-			// Will take care of deleting fcContext
-			unlinkBufferFileInBackground(fcContext);
+			if (fcContext->anonymous) {
+				FBC_DEBUG("Writer: anonymous file created");
+				delete fcContext;
+			} else {
+				FBC_DEBUG("Writer: file created. Deleting file in the background");
+				// Will take care of deleting fcContext
+				unlinkBufferFileInBackground(fcContext);
+			}
 			moveNextBufferToFile();
 		} else {
 			int errcode = -fcContext->req.result;
+			bool anonymous = fcContext->anonymous;
 			delete fcContext;
-			if (errcode == EEXIST) {
+			if (anonymous && (errcode == EOPNOTSUPP || errcode == EISDIR
+				|| errcode == EINVAL))
+			{
+				// Kernel or filesystem doesn't support O_TMPFILE.
+				FBC_DEBUG("Writer: anonymous files not supported, "
+					"retrying with a named file");
+				#ifdef O_TMPFILE
+					anonymousBufferFilesSupported().store(false,
+						boost::memory_order_relaxed);
+				#endif
+				inFileMode->writerState = WS_INACTIVE;
+				createBufferFile();
+				verifyInvariants();
+			} else if (errcode == EEXIST) {
 				FBC_DEBUG("Writer: file already exists, retrying");
 				inFileMode->writerState = WS_INACTIVE;
 				createBufferFile();
@@ -1059,8 +1122,13 @@ private:
 		// Smart pointer to keep fd open until libuv operation
 		// is finished.
 		boost::shared_ptr<InFileMode> inFileMode;
-		MemoryKit::mbuf buffer;
-		uv_buf_t uvBuffer;
+		// The buffers being moved. These are the first `nbuffers`
+		// buffers in the queue, so that they can be written to the
+		// file with a single (vectored) write.
+		MemoryKit::mbuf buffers[MAX_MOVE_BATCH_SIZE];
+		uv_buf_t uvBuffers[MAX_MOVE_BATCH_SIZE];
+		unsigned int nbuffers;
+		size_t size;
 		size_t written;
 
 		MoveContext(FileBufferedChannel *self)
@@ -1083,28 +1151,72 @@ private:
 			return;
 		}
 
-		FBC_DEBUG("Writer: moving next buffer to file: " <<
-			peekBuffer().size() << " bytes");
-
 		MoveContext *moveContext = new MoveContext(this);
 		moveContext->inFileMode = inFileMode;
-		moveContext->buffer = peekBuffer();
+		moveContext->nbuffers = 0;
+		moveContext->size = 0;
 		moveContext->written = 0;
-		moveContext->uvBuffer = uv_buf_init(moveContext->buffer.start,
-			moveContext->buffer.size());
+		collectBuffersToMove(moveContext);
+
+		FBC_DEBUG("Writer: moving next " << moveContext->nbuffers <<
+			" buffer(s) to file: " << moveContext->size << " bytes");
 
 		inFileMode->writerState = WS_MOVING;
 		inFileMode->writerRequest = moveContext;
+		writeBuffersToFile(moveContext);
+		verifyInvariants();
+	}
+
+	/**
+	 * Collects the consecutive non-EOF buffers at the front of the queue
+	 * into `moveContext`, so that they can be moved to the file with a
+	 * single threadpool round trip instead of one per buffer.
+	 */
+	void collectBuffersToMove(MoveContext *moveContext) {
+		deque<MemoryKit::mbuf>::const_iterator it, end = moreBuffers.end();
+
+		addBufferToMove(moveContext, firstBuffer);
+		for (it = moreBuffers.begin();
+		     it != end && !it->empty() && moveContext->nbuffers < MAX_MOVE_BATCH_SIZE;
+		     it++)
+		{
+			addBufferToMove(moveContext, *it);
+		}
+	}
+
+	static void addBufferToMove(MoveContext *moveContext, const MemoryKit::mbuf &buffer) {
+		unsigned int i = moveContext->nbuffers;
+		moveContext->buffers[i] = buffer;
+		moveContext->uvBuffers[i] = uv_buf_init(buffer.start, buffer.size());
+		moveContext->nbuffers++;
+		moveContext->size += buffer.size();
+	}
+
+	/**
+	 * Writes the part of the buffers in `moveContext` that hasn't been
+	 * written yet.
+	 */
+	void writeBuffersToFile(MoveContext *moveContext) {
+		unsigned int i = 0;
+		size_t skip = moveContext->written;
+
+		while (skip >= moveContext->buffers[i].size()) {
+			skip -= moveContext->buffers[i].size();
+			i++;
+		}
+		moveContext->uvBuffers[i] = uv_buf_init(
+			moveContext->buffers[i].start + skip,
+			moveContext->buffers[i].size() - skip);
+
 		int result = uv_fs_write(ctx->libuv, &moveContext->req, inFileMode->fd,
-			&moveContext->uvBuffer, 1,
-			inFileMode->readOffset + inFileMode->written,
+			&moveContext->uvBuffers[i], moveContext->nbuffers - i,
+			inFileMode->readOffset + inFileMode->written + moveContext->written,
 			_bufferWrittenToFile);
 		if (result != 0) {
 			moveContext->req.result = result;
 			ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
 				&moveContext->req));
 		}
-		verifyInvariants();
 	}
 
 	static void _bufferWrittenToFile(uv_fs_t *req) {
@@ -1126,23 +1238,25 @@ private:
 
 		if (moveContext->req.result >= 0) {
 			moveContext->written += moveContext->req.result;
-			assert(moveContext->written <= moveContext->buffer.size());
+			assert(moveContext->written <= moveContext->size);
 
-			if (moveContext->written == moveContext->buffer.size()) {
+			if (moveContext->written == moveContext->size) {
 				// Write completed. Proceed with next buffer.
 				RefGuard guard(hooks, this, __FILE__, __LINE__);
 				unsigned int generation = this->generation;
 
 				FBC_DEBUG("Writer: move complete");
-				assert(peekBuffer().size() == moveContext->buffer.size());
-				inFileMode->written += moveContext->buffer.size();
+				for (unsigned int i = 0; i < moveContext->nbuffers; i++) {
+					assert(peekBuffer().size() == moveContext->buffers[i].size());
+					inFileMode->written += moveContext->buffers[i].size();
 
-				popBuffer();
-				if (generation != this->generation || mode >= ERROR) {
-					// buffersFlushedCallback deinitialized this object, or callback
-					// called a method that encountered an error.
-					delete moveContext;
-					return;
+					popBuffer();
+					if (generation != this->generation || mode >= ERROR) {
+						// buffersFlushedCallback deinitialized this object, or callback
+						// called a method that encountered an error.
+						delete moveContext;
+						return;
+					}
 				}
 
 				inFileMode->writerRequest = NULL;
@@ -1150,19 +1264,8 @@ private:
 				moveNextBufferToFile();
 			} else {
 				FBC_DEBUG("Writer: move incomplete, proceeding " <<
-					"with writing rest of buffer");
-				moveContext->uvBuffer = uv_buf_init(
-					moveContext->buffer.start + moveContext->written,
-					moveContext->buffer.size() - moveContext->written);
-				int result = uv_fs_write(ctx->libuv, &moveContext->req,
-					inFileMode->fd, &moveContext->uvBuffer, 1,
-					inFileMode->readOffset + inFileMode->written,
-					_bufferWrittenToFile);
-				if (result != 0) {
-					moveContext->req.result = result;
-					ctx->libev->runLater(boost::bind(_bufferWrittenToFile,
-						&moveContext->req));
-				}
+					"with writing rest of buffers");
+				writeBuffersToFile(moveContext);
 				verifyInvariants();
 			}
 		} else {
@@ -1529,6 +1632,23 @@ public:
 		return bytesBuffered + getBytesBufferedOnDisk();
 	}
 
+	/**
+	 * Returns the file descriptor of the buffer file, or -1 if we're not
+	 * in the in-file mode or if the file hasn't been created yet. The file
+	 * is written to and read from at explicit offsets, so its file offset
+	 * is unused. Its data starts at the offset at which the reader
+	 * continues, so as long as the reader hasn't consumed anything, the
+	 * file contains all data that has been fed, minus the data that is
+	 * still buffered in memory (see getBytesBuffered()).
+	 */
+	int getBufferFileFd() const {
+		if (mode == IN_FILE_MODE) {
+			return inFileMode->fd;
+		} else {
+			return -1;
+		}
+	}
+
 	bool ended() const {
 		return (hasBuffers() && peekLastBuffer().empty())
 			|| mode >= ERROR || Channel::ended();
@@ -1582,34 +1702,51 @@ public:
 		Channel::hooks = hooks;
 	}
 
-	Json::Value inspectAsJson() const {
-		Json::Value doc = Channel::inspectAsJson();
+	void writeStateAsJson(JsonWriter &writer) const {
+		Channel::writeStateAsJson(writer);
 
 		switch (mode) {
 		case IN_MEMORY_MODE:
-			doc["mode"] = "IN_MEMORY_MODE";
+			writer.member("mode", "IN_MEMORY_MODE");
 			break;
-		case IN_FILE_MODE:
-			doc["mode"] = "IN_FILE_MODE";
-			doc["writer_state"] = getWriterStateString();
-			doc["read_offset"] = byteSizeToJson(inFileMode->readOffset);
-			doc["written"] = signedByteSizeToJson(inFileMode->written);
+		case IN_FILE_MODE: {
+			// Number of buffers that are waiting for the writer,
+			// excluding the batch that is currently being written.
+			unsigned int queueDepth = nbuffers;
+
+			writer.member("mode", "IN_FILE_MODE");
+			writer.member("writer_state", getWriterStateString());
+			writer.key("read_offset");
+			byteSizeToJson(writer, inFileMode->readOffset);
+			writer.key("written");
+			signedByteSizeToJson(writer, inFileMode->written);
+			if (inFileMode->writerState == WS_MOVING) {
+				const MoveContext *moveContext =
+					static_cast<const MoveContext *>(inFileMode->writerRequest);
+				writer.member("writer_batch_nbuffers", moveContext->nbuffers);
+				writer.key("writer_batch_bytes");
+				byteSizeToJson(writer, moveContext->size);
+				writer.key("writer_batch_written");
+				byteSizeToJson(writer, moveContext->written);
+				queueDepth -= moveContext->nbuffers;
+			}
+			writer.member("writer_queue_depth", queueDepth);
 			break;
+		}
 		case ERROR:
-			doc["mode"] = "ERROR";
+			writer.member("mode", "ERROR");
 			break;
 		case ERROR_WAITING:
-			doc["mode"] = "ERROR_WAITING";
+			writer.member("mode", "ERROR_WAITING");
 			break;
 		default:
 			break;
 		}
 
-		doc["reader_state"] = getReaderStateString();
-		doc["nbuffers"] = nbuffers;
-		doc["bytes_buffered"] = byteSizeToJson(getBytesBuffered());
-
-		return doc;
+		writer.member("reader_state", getReaderStateString());
+		writer.member("nbuffers", nbuffers);
+		writer.key("bytes_buffered");
+		byteSizeToJson(writer, getBytesBuffered());
 	}
 };
 
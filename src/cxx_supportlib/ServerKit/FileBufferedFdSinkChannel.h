@@ -32,6 +32,7 @@
 #include <Logging.h>
 #include <MemoryKit/mbuf.h>
 #include <ServerKit/FileBufferedChannel.h>
+#include <ServerKit/Tls.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -43,6 +44,9 @@ public:
 
 private:
 	ev_io watcher;
+	// If not NULL, data is written through this TLS connection instead of
+	// directly to the file descriptor.
+	TlsSession *tlsSession;
 
 	static Channel::Result onDataCallback(Channel *channel, const MemoryKit::mbuf &buffer,
 		int errcode)
@@ -53,9 +57,15 @@ private:
 
 		if (buffer.size() > 0) {
 			ssize_t ret;
-			do {
-				ret = ::write(self->watcher.fd, buffer.start, buffer.size());
-			} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			if (self->tlsSession == NULL) {
+				do {
+					ret = ::write(self->watcher.fd, buffer.start, buffer.size());
+				} while (OXT_UNLIKELY(ret == -1 && errno == EINTR));
+			} else {
+				// If the write doesn't complete, FileBufferedChannel calls us
+				// again with this same buffer, as TLS requires.
+				ret = tlsWrite(self->tlsSession, buffer.start, buffer.size());
+			}
 			if (ret != -1) {
 				return Channel::Result(ret, false);
 			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -95,7 +105,8 @@ public:
 	ErrorCallback errorCallback;
 
 	FileBufferedFdSinkChannel()
-		: errorCallback(NULL)
+		: tlsSession(NULL),
+		  errorCallback(NULL)
 	{
 		FileBufferedChannel::setDataCallback(onDataCallback);
 		watcher.active = false;
@@ -163,14 +174,25 @@ public:
 	 */
 	void reinitialize(int fd) {
 		FileBufferedChannel::reinitialize();
+		tlsSession = NULL;
 		setFd(fd);
 	}
 
+	/**
+	 * Makes this channel write through the given TLS connection, which must
+	 * belong to the file descriptor. May only be called right after
+	 * reinitialize(int). The session is not owned by this channel.
+	 */
+	void setTlsSession(TlsSession *session) {
+		tlsSession = session;
+	}
+
 	void deinitialize() {
 		if (ev_is_active(&watcher)) {
 			ev_io_stop(ctx->libev->getLoop(), &watcher);
 		}
 		watcher.fd = -1;
+		tlsSession = NULL;
 		FileBufferedChannel::deinitialize();
 	}
 
@@ -199,6 +221,25 @@ public:
 		return watcher.fd;
 	}
 
+	/**
+	 * Must be called after the file descriptor has been made to refer to
+	 * another file, e.g. with dup2(), so that the event loop watches the
+	 * new file instead of the old one.
+	 */
+	void watchReplacedFd() {
+		struct ev_loop *loop = ctx->libev->getLoop();
+		bool active = ev_is_active(&watcher);
+
+		if (active) {
+			ev_io_stop(loop, &watcher);
+		}
+		// ev_io_set() tells libev that the fd may refer to another file now.
+		ev_io_set(&watcher, watcher.fd, EV_WRITE);
+		if (active) {
+			ev_io_start(loop, &watcher);
+		}
+	}
+
 	OXT_FORCE_INLINE
 	unsigned int getBytesBuffered() const {
 		return FileBufferedChannel::getBytesBuffered();
@@ -214,6 +255,15 @@ public:
 		return FileBufferedChannel::getTotalBytesBuffered();
 	}
 
+	/**
+	 * Returns whether all data fed so far has been written to the
+	 * file descriptor.
+	 */
+	OXT_FORCE_INLINE
+	bool flushed() const {
+		return FileBufferedChannel::getReaderState() == RS_INACTIVE;
+	}
+
 	OXT_FORCE_INLINE
 	bool ended() const {
 		return FileBufferedChannel::ended();
@@ -259,8 +309,8 @@ public:
 		FileBufferedChannel::setDataFlushedCallback(callback);
 	}
 
-	Json::Value inspectAsJson() const {
-		return FileBufferedChannel::inspectAsJson();
+	void writeStateAsJson(JsonWriter &writer) const {
+		FileBufferedChannel::writeStateAsJson(writer);
 	}
 };
 
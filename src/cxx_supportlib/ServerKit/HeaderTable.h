@@ -32,7 +32,9 @@
 
 #include <DataStructures/LString.h>
 #include <DataStructures/HashedStaticString.h>
+#include <DataStructures/HashTableControlBytes.h>
 #include <StaticString.h>
+#include <Utils/Hasher.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -50,9 +52,69 @@ struct Header {
 	LString origKey;
 	LString val;
 	boost::uint32_t hash;
+	/**
+	 * ID of this header in KNOWN_HEADERS, or 0 if this is not a well-known
+	 * header. Set by HeaderTable::insert().
+	 */
+	boost::uint8_t knownId;
 };
 
 
+/**
+ * The most common request and response header names (downcased). The known
+ * header ID of `KNOWN_HEADERS[i]` is `i + 1`.
+ */
+static const unsigned int KNOWN_HEADER_COUNT = 67;
+extern const HashedStaticString KNOWN_HEADERS[KNOWN_HEADER_COUNT];
+
+/**
+ * A perfect hash table over KNOWN_HEADERS: `KNOWN_HEADER_SLOTS[knownHeaderSlot(hash)]`
+ * is the ID of the only known header that may have that hash, or 0.
+ * KNOWN_HEADER_SLOTS and KNOWN_HEADER_HASH_MULTIPLIER were generated offline,
+ * for both Hasher implementations; if you change KNOWN_HEADERS or a Hasher then
+ * you must regenerate them. HeaderTableTest checks that they are consistent.
+ */
+extern const boost::uint8_t KNOWN_HEADER_SLOTS[512];
+#ifdef PASSENGER_USE_JENKINS_HASH
+	static const boost::uint32_t KNOWN_HEADER_HASH_MULTIPLIER = 0x824faeadu;
+#else
+	static const boost::uint32_t KNOWN_HEADER_HASH_MULTIPLIER = 0xa429eeb5u;
+#endif
+
+OXT_FORCE_INLINE
+inline unsigned int
+knownHeaderSlot(boost::uint32_t hash) {
+	return (boost::uint32_t) (hash * KNOWN_HEADER_HASH_MULTIPLIER) >> 23;
+}
+
+/** Returns the known header ID of the given downcased key, or 0 if it isn't one. */
+OXT_FORCE_INLINE
+inline boost::uint8_t
+lookupKnownHeaderId(const HashedStaticString &key) {
+	boost::uint8_t id = KNOWN_HEADER_SLOTS[knownHeaderSlot(key.hash())];
+	if (id != 0) {
+		const HashedStaticString &name = KNOWN_HEADERS[id - 1];
+		if (name.hash() == key.hash() && name == key) {
+			return id;
+		}
+	}
+	return 0;
+}
+
+OXT_FORCE_INLINE
+inline boost::uint8_t
+lookupKnownHeaderId(const Header *header) {
+	boost::uint8_t id = KNOWN_HEADER_SLOTS[knownHeaderSlot(header->hash)];
+	if (id != 0) {
+		const HashedStaticString &name = KNOWN_HEADERS[id - 1];
+		if (name.hash() == header->hash && psg_lstr_cmp(&header->key, name)) {
+			return id;
+		}
+	}
+	return 0;
+}
+
+
 /**
  * A hash table, optimized for storing HTTP headers. It assumes the following workload:
  *
@@ -63,9 +125,16 @@ struct Header {
  *
  * The hash table uses open addressing and linear probing for cache friendliness. It
  * supports keys that are non-contigunous in memory, through the use of LString.
+ * Probing is accelerated with a SwissTable-style control byte array (see
+ * HashTableControlBytes), so that most non-matching cells, and most misses, are
+ * rejected without dereferencing Header pointers or comparing LStrings.
  *
  * It supports at most 2^16-1 keys.
  *
+ * Headers in KNOWN_HEADERS are additionally indexed by their known header ID, so
+ * looking them up (or finding out that they're absent) never requires probing or
+ * comparing against LString keys.
+ *
  * The hash table automatically doubles in size when it becomes 75% full.
  * The hash table never shrinks in size, even after clear(), unless you explicitly call
  * compact(). This allows you to reuse hash table memory over multiple requests.
@@ -87,9 +156,44 @@ public:
 	};
 
 private:
+	struct KeyMatcher {
+		const Cell *cells;
+		const HashedStaticString &key;
+
+		KeyMatcher(const Cell *_cells, const HashedStaticString &_key)
+			: cells(_cells),
+			  key(_key)
+			{ }
+
+		OXT_FORCE_INLINE
+		bool operator()(unsigned int index) const {
+			const Header *header = cells[index].header;
+			return header->hash == key.hash() && psg_lstr_cmp(&header->key, key);
+		}
+	};
+
+	struct HeaderMatcher {
+		const Cell *cells;
+		const Header *header;
+
+		HeaderMatcher(const Cell *_cells, const Header *_header)
+			: cells(_cells),
+			  header(_header)
+			{ }
+
+		OXT_FORCE_INLINE
+		bool operator()(unsigned int index) const {
+			const Header *other = cells[index].header;
+			return other->hash == header->hash && psg_lstr_cmp(&other->key, &header->key);
+		}
+	};
+
 	Cell *m_cells;
+	/** See HashTableControlBytes. */
+	boost::uint8_t *m_ctrl;
 	boost::uint16_t m_arraySize;
 	boost::uint16_t m_population;
+	Header *m_knownHeaders[KNOWN_HEADER_COUNT + 1];
 
 	bool shouldRepopulateOnInsert() const {
 		return (m_population + 1) * 4 >= m_arraySize * 3;
@@ -123,6 +227,19 @@ private:
 			&& psg_lstr_cmp(&header->key, HTTP_SET_COOKIE);
 	}
 
+	void mergeHeader(Header *existing, Header *header, psg_pool_t *pool) {
+		if (isCookieHeader(header)) {
+			psg_lstr_append(&existing->val, pool, ";", 1);
+		} else if (isSetCookieHeader(header)) {
+			psg_lstr_append(&existing->val, pool, "\n", 1);
+		} else {
+			psg_lstr_append(&existing->val, pool, ",", 1);
+		}
+		psg_lstr_move_and_append(&header->val, pool, &existing->val);
+		psg_lstr_deinit(&header->key);
+		psg_lstr_deinit(&header->origKey);
+	}
+
 	void repopulate(unsigned int desiredSize) {
 		assert((desiredSize & (desiredSize - 1)) == 0);   // Must be a power of 2
 		assert(m_population * 4  <= desiredSize * 3);
@@ -135,6 +252,9 @@ private:
 		m_arraySize = desiredSize;
 		m_cells = new Cell[m_arraySize];
 		memset(m_cells, 0, sizeof(Cell) * m_arraySize);
+		delete[] m_ctrl;
+		m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+		HashTableControlBytes::clear(m_ctrl, m_arraySize);
 
 		if (oldCells == NULL) {
 			return;
@@ -149,6 +269,8 @@ private:
 					if (cellIsEmpty(newCell)) {
 						// Insert here
 						*newCell = *oldCell;
+						HashTableControlBytes::set(m_ctrl, m_arraySize, newCell - m_cells,
+							HashTableControlBytes::tag(newCell->header->hash));
 						break;
 					} else {
 						newCell = PHT_CIRCULAR_NEXT(newCell);
@@ -166,6 +288,13 @@ private:
 		m_population = other.m_population;
 		m_cells      = new Cell[other.m_arraySize];
 		memcpy(m_cells, other.m_cells, other.m_arraySize * sizeof(Cell));
+		if (other.m_ctrl != NULL) {
+			m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+			memcpy(m_ctrl, other.m_ctrl, HashTableControlBytes::allocationSize(m_arraySize));
+		} else {
+			m_ctrl = NULL;
+		}
+		memcpy(m_knownHeaders, other.m_knownHeaders, sizeof(m_knownHeaders));
 	}
 
 public:
@@ -180,10 +309,12 @@ public:
 
 	~HeaderTable() {
 		delete[] m_cells;
+		delete[] m_ctrl;
 	}
 
 	HeaderTable &operator=(const HeaderTable &other) {
 		delete[] m_cells;
+		delete[] m_ctrl;
 		copyFrom(other);
 		return *this;
 	}
@@ -194,11 +325,15 @@ public:
 		m_arraySize = initialSize;
 		if (initialSize == 0) {
 			m_cells = NULL;
+			m_ctrl = NULL;
 		} else {
 			m_cells = new Cell[m_arraySize];
 			memset(m_cells, 0, sizeof(Cell) * m_arraySize);
+			m_ctrl = new boost::uint8_t[HashTableControlBytes::allocationSize(m_arraySize)];
+			HashTableControlBytes::clear(m_ctrl, m_arraySize);
 		}
 		m_population = 0;
+		memset(m_knownHeaders, 0, sizeof(m_knownHeaders));
 	}
 
 	const Cell *lookupCell(const HashedStaticString &key) const {
@@ -209,18 +344,12 @@ public:
 			return NULL;
 		}
 
-		const Cell *cell = PHT_FIRST_CELL(key.hash());
-		while (true) {
-			if (cellIsEmpty(cell)) {
-				// Empty cell found.
-				return NULL;
-			} else if (psg_lstr_cmp(&cell->header->key, key)) {
-				// Non-empty cell found.
-				return cell;
-			} else {
-				// Keep probing.
-				cell = PHT_CIRCULAR_NEXT(cell);
-			}
+		int index = HashTableControlBytes::probe(m_ctrl, m_arraySize, key.hash(),
+			KeyMatcher(m_cells, key));
+		if (index != -1) {
+			return &m_cells[index];
+		} else {
+			return NULL;
 		}
 	}
 
@@ -231,6 +360,11 @@ public:
 
 	OXT_FORCE_INLINE
 	Header *lookupHeader(const HashedStaticString &key) {
+		boost::uint8_t knownId = lookupKnownHeaderId(key);
+		if (knownId != 0) {
+			return m_knownHeaders[knownId];
+		}
+
 		Cell *cell = lookupCell(key);
 		if (cell != NULL) {
 			return cell->header;
@@ -240,6 +374,15 @@ public:
 	}
 
 	const LString *lookup(const HashedStaticString &key) const {
+		boost::uint8_t knownId = lookupKnownHeaderId(key);
+		if (knownId != 0) {
+			if (m_knownHeaders[knownId] != NULL) {
+				return &m_knownHeaders[knownId]->val;
+			} else {
+				return NULL;
+			}
+		}
+
 		const Cell * const cell = lookupCell(key);
 		if (cell != NULL) {
 			return &cell->header->val;
@@ -262,44 +405,44 @@ public:
 		Header *header = *headerPtr;
 		assert(header->key.size < MAX_KEY_LENGTH);
 
+		header->knownId = lookupKnownHeaderId(header);
+		if (header->knownId != 0 && m_knownHeaders[header->knownId] != NULL) {
+			mergeHeader(m_knownHeaders[header->knownId], header, pool);
+			*headerPtr = NULL;
+			return;
+		}
+
 		if (m_cells == NULL) {
 			repopulate(DEFAULT_SIZE);
 		}
 
 		while (true) {
-			Cell *cell = PHT_FIRST_CELL(header->hash);
-			while (true) {
-				if (cellIsEmpty(cell)) {
-					// Cell is empty. Insert here.
-					if (shouldRepopulateOnInsert()) {
-						// Time to resize
-						repopulate(m_arraySize * 2);
-						break;
-					}
-					m_population++;
-
-					cell->header = header;
-					*headerPtr = NULL;
-					return;
-				} else if (psg_lstr_cmp(&cell->header->key, &header->key)) {
-					// Cell matches, so merge value into header.
-					if (isCookieHeader(header)) {
-						psg_lstr_append(&cell->header->val, pool, ";", 1);
-					} else if (isSetCookieHeader(header)) {
-						psg_lstr_append(&cell->header->val, pool, "\n", 1);
-					} else {
-						psg_lstr_append(&cell->header->val, pool, ",", 1);
-					}
-					psg_lstr_move_and_append(&header->val, pool,
-						&cell->header->val);
-					psg_lstr_deinit(&header->key);
-					psg_lstr_deinit(&header->origKey);
-					*headerPtr = NULL;
-					return;
-				} else {
-					cell = PHT_CIRCULAR_NEXT(cell);
-				}
+			unsigned int emptyIndex = 0;
+			int index = HashTableControlBytes::probe(m_ctrl, m_arraySize, header->hash,
+				HeaderMatcher(m_cells, header), &emptyIndex);
+			if (index != -1) {
+				// Cell matches, so merge value into header.
+				mergeHeader(m_cells[index].header, header, pool);
+				*headerPtr = NULL;
+				return;
 			}
+
+			// Found an empty cell. Insert here.
+			if (shouldRepopulateOnInsert()) {
+				// Time to resize
+				repopulate(m_arraySize * 2);
+				continue;
+			}
+			m_population++;
+
+			m_cells[emptyIndex].header = header;
+			HashTableControlBytes::set(m_ctrl, m_arraySize, emptyIndex,
+				HashTableControlBytes::tag(header->hash));
+			if (header->knownId != 0) {
+				m_knownHeaders[header->knownId] = header;
+			}
+			*headerPtr = NULL;
+			return;
 		}
 	}
 
@@ -309,8 +452,8 @@ public:
 		Header *header = (Header *) psg_palloc(pool, sizeof(Header));
 
 		char *downcasedName = (char *) psg_pnalloc(pool, name.size());
-		convertLowerCase((const unsigned char *) name.data(),
-			(unsigned char *) downcasedName, name.size());
+		Hasher hasher;
+		hasher.updateLowerCase(name.data(), name.size(), downcasedName);
 		psg_lstr_init(&header->key);
 		psg_lstr_append(&header->key, pool, downcasedName, name.size());
 
@@ -320,7 +463,7 @@ public:
 		psg_lstr_init(&header->val);
 		psg_lstr_append(&header->val, pool, value.data(), value.size());
 
-		header->hash = HashedStaticString(downcasedName, name.size()).hash();
+		header->hash = hasher.finalize();
 		insert(&header, pool);
 		return header;
 	}
@@ -329,6 +472,10 @@ public:
 		assert(cell >= m_cells && cell - m_cells < m_arraySize);
 		assert(!cellIsEmpty(cell));
 
+		if (cell->header->knownId != 0) {
+			m_knownHeaders[cell->header->knownId] = NULL;
+		}
+
 		// Remove this cell by shuffling neighboring cells so there are no gaps in anyone's probe chain
 		Cell *neighbor = PHT_CIRCULAR_NEXT(cell);
 		while (true) {
@@ -342,6 +489,8 @@ public:
 					psg_lstr_deinit(&cell->header->val);
 					cell->header = NULL;
 				}
+				HashTableControlBytes::set(m_ctrl, m_arraySize, cell - m_cells,
+					HashTableControlBytes::EMPTY);
 				m_population--;
 				return;
 			}
@@ -358,6 +507,8 @@ public:
 					psg_lstr_deinit(&cell->header->val);
 				}
 				*cell = *neighbor;
+				HashTableControlBytes::set(m_ctrl, m_arraySize, cell - m_cells,
+					m_ctrl[neighbor - m_cells]);
 				cell = neighbor;
 				neighbor->header = NULL;
 			}
@@ -376,6 +527,8 @@ public:
 	void clear() {
 		if (m_cells != NULL && m_population != 0) {
 			memset(m_cells, 0, sizeof(Cell) * m_arraySize);
+			HashTableControlBytes::clear(m_ctrl, m_arraySize);
+			memset(m_knownHeaders, 0, sizeof(m_knownHeaders));
 		}
 		m_population = 0;
 	}
@@ -383,8 +536,11 @@ public:
 	void freeMemory() {
 		delete[] m_cells;
 		m_cells = NULL;
+		delete[] m_ctrl;
+		m_ctrl = NULL;
 		m_arraySize  = 0;
 		m_population = 0;
+		memset(m_knownHeaders, 0, sizeof(m_knownHeaders));
 	}
 
 	void compact() {
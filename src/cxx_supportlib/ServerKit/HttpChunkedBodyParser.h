@@ -103,26 +103,71 @@ private:
 	LoggingPrefixFormatter loggingPrefixFormatter;
 	void *userData;
 
-	static bool isHexDigit(char ch) {
-		return (ch >= '0' && ch <= '9')
-			|| (ch >= 'a' && ch <= 'f')
-			|| (ch >= 'A' && ch <= 'F');
-	}
-
-	static int parseHexDigit(char ch) {
-		if (ch >= 'A' && ch <= 'F') {
-			return 10 + ch - 'A';
-		} else if (ch >= 'a' && ch <= 'z') {
-			return 10 + ch - 'a';
-		} else {
-			return ch - '0';
-		}
+	/**
+	 * Returns the value of the given hexadecimal digit, or -1 if it isn't one.
+	 */
+	static int hexDigitValue(char ch) {
+		static const signed char values[256] = {
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+			-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+		};
+		return values[(unsigned char) ch];
 	}
 
 	void logChunkSize() {
 		CBP_DEBUG("chunk size determined: " << state->remainingDataSize << " bytes");
 	}
 
+	/**
+	 * Fast path for the common case in which a complete chunk header without
+	 * extensions ("SIZE\r\n") lies at `current`. Parses it in one go instead of
+	 * going through the state machine once per byte, moves to the EXPECTING_DATA
+	 * state and returns the position after the header.
+	 *
+	 * Returns NULL if the header is incomplete, has extensions or is invalid.
+	 * In that case nothing has been consumed, and the caller must fall back to
+	 * the state machine, which also takes care of reporting errors.
+	 */
+	const char *parseChunkHeader(const char *current, const char *end) {
+		const char *pos = current;
+		boost::uint32_t size = 0;
+		int digit;
+
+		while (pos < end && (digit = hexDigitValue(*pos)) != -1) {
+			if (size >= HttpChunkedBodyParserState::MAX_CHUNK_SIZE) {
+				return NULL;
+			}
+			size = 16 * size + digit;
+			pos++;
+		}
+
+		if (pos == current || end - pos < 2
+		 || pos[0] != HttpChunkedBodyParserState::CR
+		 || pos[1] != HttpChunkedBodyParserState::LF)
+		{
+			return NULL;
+		}
+
+		state->remainingDataSize = size;
+		state->state = HttpChunkedBodyParserState::EXPECTING_DATA;
+		logChunkSize();
+		return pos + 2;
+	}
+
 	HttpChunkedEvent setError(int errcode, const char *bufferStart, const char *current) {
 		CBP_DEBUG("setting error: " << getErrorDesc(errcode));
 		state->state = HttpChunkedBodyParserState::ERROR;
@@ -150,6 +195,7 @@ public:
 		const char *end      = buffer.start + buffer.size();
 		const char *needle;
 		size_t dataSize;
+		int digit;
 
 		assert(!buffer.empty());
 
@@ -181,8 +227,14 @@ public:
 
 			case HttpChunkedBodyParserState::EXPECTING_SIZE_FIRST_DIGIT:
 				CBP_DEBUG("parsing new chunk");
-				if (isHexDigit(*current)) {
-					state->remainingDataSize = parseHexDigit(*current);
+				needle = parseChunkHeader(current, end);
+				if (needle != NULL) {
+					current = needle;
+					break;
+				}
+				digit = hexDigitValue(*current);
+				if (digit != -1) {
+					state->remainingDataSize = digit;
 					state->state = HttpChunkedBodyParserState::EXPECTING_SIZE;
 					current++;
 					break;
@@ -191,12 +243,12 @@ public:
 				}
 
 			case HttpChunkedBodyParserState::EXPECTING_SIZE:
-				if (isHexDigit(*current)) {
+				digit = hexDigitValue(*current);
+				if (digit != -1) {
 					if (state->remainingDataSize >= HttpChunkedBodyParserState::MAX_CHUNK_SIZE) {
 						return setError(CHUNK_SIZE_TOO_LARGE, buffer.start, current);
 					} else {
-						state->remainingDataSize = 16 * state->remainingDataSize +
-							parseHexDigit(*current);
+						state->remainingDataSize = 16 * state->remainingDataSize + digit;
 						current++;
 					}
 				} else if (*current == HttpChunkedBodyParserState::CR) {
@@ -235,7 +287,15 @@ public:
 				}
 
 			case HttpChunkedBodyParserState::EXPECTING_NON_FINAL_CR:
-				if (*current == HttpChunkedBodyParserState::CR) {
+				if (end - current >= 2
+				 && current[0] == HttpChunkedBodyParserState::CR
+				 && current[1] == HttpChunkedBodyParserState::LF)
+				{
+					CBP_DEBUG("done parsing a chunk");
+					state->state = HttpChunkedBodyParserState::EXPECTING_SIZE_FIRST_DIGIT;
+					current += 2;
+					break;
+				} else if (*current == HttpChunkedBodyParserState::CR) {
 					state->state = HttpChunkedBodyParserState::EXPECTING_NON_FINAL_LF;
 					current++;
 					break;
@@ -37,9 +37,9 @@ using namespace std;
 struct HttpChunkedBodyParserState {
 	/***** Types and constants *****/
 
-	// (2^32-1)/10 (409 MB), because `remainingDataSize` is 32-bit. Divided by 10 to
-	// prevent overflow during parsing of the chunk size.
-	static const unsigned int MAX_CHUNK_SIZE = 429496729;
+	// (2^32-1)/16 (256 MB), because `remainingDataSize` is 32-bit. Divided by 16 to
+	// prevent overflow during parsing of the hexadecimal chunk size.
+	static const unsigned int MAX_CHUNK_SIZE = 268435455;
 	static const char CR = '\x0D';
 	static const char LF = '\x0A';
 
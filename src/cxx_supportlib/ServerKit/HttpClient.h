@@ -47,12 +47,26 @@ public:
 	 *         currentRequest->httpState != HttpRequest::IN_FREELIST
 	 */
 	Request *currentRequest;
+	/**
+	 * A request that has ended while its response was still being written
+	 * out, and whose pool must be kept alive until the client output is
+	 * flushed. Only set when the next pipelined request was begun early;
+	 * see HttpServer::endRequest().
+	 */
+	Request *flushingRequest;
 	unsigned int requestsBegun;
+	/**
+	 * Whether the client is connected through a Unix domain socket:
+	 * 1 if so, 0 if not, -1 if not yet determined.
+	 */
+	signed char onUnixSocket;
 
 	BaseHttpClient(void *server)
 		: BaseClient(server),
 		  currentRequest(NULL),
-		  requestsBegun(0)
+		  flushingRequest(NULL),
+		  requestsBegun(0),
+		  onUnixSocket(-1)
 		{ }
 };
 
@@ -207,11 +207,9 @@ private:
 			self->state->hasher.update(data, len);
 		} else {
 			char *downcasedData = (char *) psg_pnalloc(self->pool, len);
-			convertLowerCase((const unsigned char *) data,
-				(unsigned char *) downcasedData, len);
+			self->state->hasher.updateLowerCase(data, len, downcasedData);
 			psg_lstr_append(&self->state->currentHeader->key, self->pool,
 				downcasedData, len);
-			self->state->hasher.update(downcasedData, len);
 		}
 
 		return 0;
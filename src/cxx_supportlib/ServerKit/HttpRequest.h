@@ -103,6 +103,14 @@ public:
 	bool wantKeepAlive: 1;
 	bool responseBegun: 1;
 	bool detectingNextRequestEarlyReadError: 1;
+	// Set by HttpServer::enterTunnelMode() once an upgraded request only
+	// passes data through anymore, after which `pool` is a small pool
+	// that holds little more than `path`, and the header tables are empty.
+	bool tunneling: 1;
+	// Whether everything that the client has sent on this connection so far
+	// may be (the start of) the HTTP/2 connection preface. Only tracked for
+	// the first request of a connection, see HttpServer::endWithHttp2FallbackResponse().
+	bool mayBeHttp2Preface: 1;
 
 	boost::atomic<int> refcount;
 
@@ -140,6 +148,12 @@ public:
 		int parseError;
 	} aux;
 	boost::uint64_t bodyAlreadyRead;
+	/** The value of `bodyAlreadyRead` at the last request body rate check. */
+	boost::uint64_t bodyAlreadyReadAtRateCheck;
+	/** Number of bytes of header data that were fed to the header parser. */
+	unsigned int headerBytesRead;
+	/** Number of bytes that were passed to HttpServer::writeResponse(). */
+	boost::uint64_t responseBytesWritten;
 
 	ev_tstamp lastDataReceiveTime;
 	ev_tstamp lastDataSendTime;
@@ -176,7 +190,9 @@ public:
 		  pool(NULL),
 		  headers(16),
 		  secureHeaders(32),
-		  bodyAlreadyRead(0)
+		  bodyAlreadyRead(0),
+		  headerBytesRead(0),
+		  responseBytesWritten(0)
 	{
 		psg_lstr_init(&path);
 		aux.bodyInfo.contentLength = 0; // Sets the entire union to 0.
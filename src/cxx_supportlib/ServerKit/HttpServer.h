@@ -32,6 +32,7 @@
 #include <oxt/macros.hpp>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <cassert>
 #include <pthread.h>
@@ -71,6 +72,42 @@ public:
 	unsigned int freeRequestCount, requestFreelistLimit;
 	unsigned long totalRequestsBegun, lastTotalRequestsBegun;
 	double requestBeginSpeed1m, requestBeginSpeed1h;
+	/**
+	 * The size with which request palloc pools are created. This is
+	 * periodically recalculated from the pool usage of recent requests.
+	 */
+	size_t requestPoolSize;
+	unsigned long requestPoolUsageSamples, requestPoolMallocs;
+	/**
+	 * Number of responses written, by status class: index 0 counts
+	 * 1xx responses, index 4 counts 5xx responses. Responses that
+	 * subclasses write themselves are counted through recordResponseStatus().
+	 */
+	boost::uint64_t responsesByStatusClass[5];
+	/** Number of upgraded requests that are currently in tunnel mode. */
+	unsigned int tunnelCount;
+	/** Number of clients that were disconnected for sending a request body too slowly. */
+	unsigned long totalClientsTooSlow;
+	/**
+	 * How long, in seconds, a client may take to send the headers of a
+	 * request. For the first request on a connection this is counted from
+	 * the moment the connection was accepted, for later requests from the
+	 * moment their first byte arrived. 0 means no limit.
+	 */
+	unsigned int headerReadTimeout;
+	/**
+	 * How long, in seconds, a connection may stay idle between two requests.
+	 * 0 means no limit.
+	 */
+	unsigned int keepAliveTimeout;
+	/**
+	 * The minimum rate, in bytes per second, at which a client must send
+	 * a request body, measured over REQUEST_BODY_RATE_CHECK_INTERVAL
+	 * seconds. Intervals in which we stopped reading the body ourselves,
+	 * for example because the application doesn't keep up, don't count.
+	 * 0 means no limit.
+	 */
+	unsigned int minRequestBodyRate;
 
 private:
 	/***** Types and nested classes *****/
@@ -107,6 +144,20 @@ private:
 	RequestHooksImpl requestHooksImpl;
 	object_pool<HttpHeaderParserState> headerParserStatePool;
 
+	static const unsigned int REQUEST_POOL_USAGE_HISTORY_SIZE = 256;
+	static const unsigned int REQUEST_POOL_RESIZE_INTERVAL = 16;
+	static const unsigned int REQUEST_POOL_USAGE_PERCENTILE = 95;
+	static const size_t MIN_REQUEST_POOL_SIZE = psg_pagesize;
+	static const size_t MAX_REQUEST_POOL_SIZE = 16 * PSG_DEFAULT_POOL_SIZE;
+	static const size_t TUNNEL_REQUEST_POOL_SIZE = 1024;
+	static const unsigned int REQUEST_BODY_RATE_CHECK_INTERVAL = 10;
+	// The length of "PRI * HTTP/2.0\r\n", see continuesHttp2ConnectionPreface().
+	static const unsigned int HTTP2_CONNECTION_PREFACE_SIZE = 16;
+
+	/** Ring buffer containing the pool usage of the most recent requests. */
+	unsigned int requestPoolUsageHistory[REQUEST_POOL_USAGE_HISTORY_SIZE];
+	unsigned int requestPoolUsagePercentile;
+
 
 	/***** Request object creation and destruction *****/
 
@@ -198,6 +249,94 @@ private:
 	}
 
 
+	/***** Request palloc pool management *****/
+
+	void createRequestPool(Request *req) {
+		req->pool = psg_create_pool(requestPoolSize);
+	}
+
+	/**
+	 * Records how much of the request's pool was used, then resets the pool
+	 * so that it can be reused by the next request. Pools that spilled over
+	 * into additional blocks cannot be reset and are destroyed instead.
+	 */
+	void resetRequestPool(Request *req) {
+		size_t usage = psg_pool_usage(req->pool);
+
+		// Tunnel pools say nothing about how large a request's pool
+		// should be. They're recreated when the request object is reused.
+		if (usage > 0 && !req->tunneling) {
+			recordRequestPoolUsage(usage, psg_pool_used_malloc(req->pool));
+		}
+		if (!psg_reset_pool(req->pool, psg_pool_size(req->pool))) {
+			psg_destroy_pool(req->pool);
+			req->pool = NULL;
+		}
+	}
+
+	void recordRequestPoolUsage(size_t usage, bool usedMalloc) {
+		if (usage > MAX_REQUEST_POOL_SIZE) {
+			usage = MAX_REQUEST_POOL_SIZE;
+		}
+		requestPoolUsageHistory[requestPoolUsageSamples % REQUEST_POOL_USAGE_HISTORY_SIZE] =
+			(unsigned int) usage;
+		requestPoolUsageSamples++;
+		if (usedMalloc) {
+			requestPoolMallocs++;
+		}
+		if (requestPoolUsageSamples % REQUEST_POOL_RESIZE_INTERVAL == 0) {
+			recalculateRequestPoolSize();
+		}
+	}
+
+	/**
+	 * Sizes request pools so that the given percentile of recent requests
+	 * fits inside a single pool block, without calling malloc().
+	 */
+	void recalculateRequestPoolSize() {
+		unsigned int samples[REQUEST_POOL_USAGE_HISTORY_SIZE];
+		unsigned int count = REQUEST_POOL_USAGE_HISTORY_SIZE;
+		if (requestPoolUsageSamples < count) {
+			count = (unsigned int) requestPoolUsageSamples;
+		}
+		unsigned int index = (count - 1) * REQUEST_POOL_USAGE_PERCENTILE / 100;
+
+		std::copy(requestPoolUsageHistory, requestPoolUsageHistory + count, samples);
+		std::nth_element(samples, samples + index, samples + count);
+		requestPoolUsagePercentile = samples[index];
+
+		size_t size = psg_align(requestPoolUsagePercentile + sizeof(psg_pool_t),
+			(size_t) psg_pagesize);
+		if (size < MIN_REQUEST_POOL_SIZE) {
+			size = MIN_REQUEST_POOL_SIZE;
+		} else if (size > MAX_REQUEST_POOL_SIZE) {
+			size = MAX_REQUEST_POOL_SIZE;
+		}
+		requestPoolSize = size;
+	}
+
+	/**
+	 * Pools in the freelist keep their old size until they're checked out.
+	 * At that point they're recreated if they're too small for the current
+	 * request pool size, or more than twice as large.
+	 */
+	bool requestPoolNeedsResize(const psg_pool_t *pool) const {
+		size_t size = psg_pool_size(pool);
+		return size < requestPoolSize || size / 2 > requestPoolSize;
+	}
+
+
+	/**
+	 * Replaces the contents of `str` with a copy allocated from `pool`,
+	 * and unreferences the mbuf_blocks that `str` referenced.
+	 */
+	static void moveStringToPool(LString *str, psg_pool_t *pool) {
+		LString *copy = psg_lstr_null_terminate(str, pool);
+		psg_lstr_deinit(str);
+		*str = *copy;
+	}
+
+
 	/***** Request deinitialization and preparation for next request *****/
 
 	void deinitializeRequestAndAddToFreelist(Client *client, Request *req) {
@@ -223,10 +362,7 @@ private:
 		P_ASSERT_EQ(req->httpState, Request::WAITING_FOR_REFERENCES);
 		assert(req->pool != NULL);
 		c->currentRequest = NULL;
-		if (!psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
-			psg_destroy_pool(req->pool);
-			req->pool = NULL;
-		}
+		resetRequestPool(req);
 		unrefRequest(req, __FILE__, __LINE__);
 		if (keepAlive) {
 			SKC_TRACE(c, 3, "Keeping alive connection, handling next request");
@@ -240,7 +376,35 @@ private:
 		}
 	}
 
-	void handleNextRequest(Client *client) {
+	/**
+	 * Releases the request that was kept around until its response was
+	 * flushed, after the next pipelined request was begun early.
+	 */
+	void releaseFlushingRequest(Client *client) {
+		Request *req = client->flushingRequest;
+		if (req != NULL) {
+			SKC_TRACE(client, 3, "Output of previous request flushed");
+			client->flushingRequest = NULL;
+			resetRequestPool(req);
+			unrefRequest(req, __FILE__, __LINE__);
+		}
+	}
+
+	/**
+	 * Pipelined requests are handled one at a time. Once a request's headers
+	 * (and body, if any) are parsed, any data that follows stays buffered in
+	 * `client->input`, which is stopped by detectNextRequestEarlyReadError().
+	 * Restarting the input here feeds that buffered data to the next request's
+	 * parser without another read() call.
+	 *
+	 * Normally the next request is begun after the current one's output is
+	 * flushed. If the next request is already buffered, endRequest() begins it
+	 * while the output is still being flushed, so that parsing it and routing
+	 * it to the application overlaps with the client receiving the previous
+	 * response. The output is then not reinitialized, so the next response is
+	 * appended to it and responses are still written in request order.
+	 */
+	void handleNextRequest(Client *client, bool reinitializeOutput = true) {
 		Request *req;
 
 		// A request object references its client object.
@@ -249,12 +413,21 @@ private:
 		this->refClient(client, __FILE__, __LINE__);
 
 		client->input.start();
-		client->output.deinitialize();
-		client->output.reinitialize(client->getFd());
+		if (reinitializeOutput) {
+			client->output.deinitialize();
+			client->output.reinitialize(client->getFd());
+			client->output.setTlsSession(client->tlsSession);
+		}
 
 		client->currentRequest = req = checkoutRequestObject(client);
 		req->client = client;
 		reinitializeRequest(client, req);
+
+		if (client->requestsBegun == 0) {
+			this->setClientTimeout(client, headerReadTimeout);
+		} else {
+			this->setClientTimeout(client, keepAliveTimeout);
+		}
 	}
 
 
@@ -268,19 +441,41 @@ private:
 			SKC_TRACE(client, 3, "Parsing " << buffer.size() <<
 				" bytes of HTTP header: \"" << cEscapeString(StaticString(
 					buffer.start, buffer.size())) << "\"");
+			if (req->headerBytesRead == 0 && client->requestsBegun > 0) {
+				// The keep-alive connection is no longer idle.
+				this->setClientTimeout(client, headerReadTimeout);
+			}
+			if (OXT_UNLIKELY(client->requestsBegun == 0)
+			 && req->headerBytesRead < HTTP2_CONNECTION_PREFACE_SIZE)
+			{
+				// The preface may arrive in pieces, and the parser may
+				// reject it before it's complete.
+				req->mayBeHttp2Preface = (req->headerBytesRead == 0 || req->mayBeHttp2Preface)
+					&& continuesHttp2ConnectionPreface(buffer, req->headerBytesRead);
+			}
 			{
 				ret = createRequestHeaderParser(this->getContext(), req).
 					feed(buffer);
 			}
 			if (req->httpState == Request::PARSING_HEADERS) {
 				// Not yet done parsing.
+				req->headerBytesRead += buffer.size();
 				return Channel::Result(buffer.size(), false);
 			}
+			req->headerBytesRead += ret;
 
 			// Done parsing.
 			SKC_TRACE(client, 2, "New request received: #" << (totalRequestsBegun + 1));
 			headerParserStatePool.destroy(req->parserState.headerParser);
 			req->parserState.headerParser = NULL;
+			if (minRequestBodyRate > 0
+			 && (req->httpState == Request::PARSING_BODY
+			  || req->httpState == Request::PARSING_CHUNKED_BODY))
+			{
+				this->setClientTimeout(client, REQUEST_BODY_RATE_CHECK_INTERVAL);
+			} else {
+				this->cancelClientTimeout(client);
+			}
 
 			if (HttpServer::serverState == HttpServer::SHUTTING_DOWN
 			 && shouldDisconnectClientOnShutdown(client))
@@ -317,7 +512,9 @@ private:
 			case Request::ERROR:
 				// Change state so that the response body will be written.
 				req->httpState = Request::COMPLETE;
-				if (req->aux.parseError == HTTP_VERSION_NOT_SUPPORTED) {
+				if (OXT_UNLIKELY(req->mayBeHttp2Preface)) {
+					endWithHttp2FallbackResponse(&client, &req);
+				} else if (req->aux.parseError == HTTP_VERSION_NOT_SUPPORTED) {
 					endWithErrorResponse(&client, &req, 505, "HTTP version not supported\n");
 				} else {
 					endAsBadRequest(&client, &req, getErrorDesc(req->aux.parseError));
@@ -524,6 +721,28 @@ private:
 		}
 	}
 
+	/**
+	 * Called every REQUEST_BODY_RATE_CHECK_INTERVAL seconds while the client
+	 * is sending a request body. Returns whether the client sent enough of
+	 * it since the last check.
+	 */
+	bool checkRequestBodyRate(Client *client, Request *req) {
+		boost::uint64_t received = req->bodyAlreadyRead - req->bodyAlreadyReadAtRateCheck;
+		req->bodyAlreadyReadAtRateCheck = req->bodyAlreadyRead;
+		if (received >= (boost::uint64_t) minRequestBodyRate * REQUEST_BODY_RATE_CHECK_INTERVAL) {
+			return true;
+		} else if (!client->input.isStarted()) {
+			// We're not reading from the client right now, so it's not
+			// the client's fault that the body doesn't come in.
+			return true;
+		} else {
+			SKC_INFO(client, "Disconnecting client because it sent only " <<
+				received << " bytes of request body in the last " <<
+				REQUEST_BODY_RATE_CHECK_INTERVAL << " seconds");
+			return false;
+		}
+	}
+
 	Channel::Result feedBodyChannelError(Client *client, Request *req, int errcode) {
 		if (req->bodyChannel.acceptingInput()) {
 			req->bodyChannel.feedError(errcode);
@@ -556,6 +775,43 @@ private:
 		endRequest(client, req);
 	}
 
+	/**
+	 * HTTP/2 clients that assume prior knowledge (h2c) start the connection
+	 * with a preface that begins with "PRI * HTTP/2.0\r\n", which the HTTP/1
+	 * parser rejects as an invalid method, usually before all of it has
+	 * arrived. Returns whether `buffer`, which was preceded by `offset`
+	 * bytes of the preface, continues it.
+	 */
+	static bool continuesHttp2ConnectionPreface(const MemoryKit::mbuf &buffer,
+		unsigned int offset)
+	{
+		static const char preface[] = "PRI * HTTP/2.0\r\n";
+		size_t size = std::min<size_t>(buffer.size(), HTTP2_CONNECTION_PREFACE_SIZE - offset);
+		return memcmp(buffer.start, preface + offset, size) == 0;
+	}
+
+	/**
+	 * We don't speak HTTP/2, so we tell such clients to fall back to HTTP/1.1
+	 * instead of responding with an HTTP/1 error they can't parse: an empty
+	 * SETTINGS frame (the mandatory server connection preface) followed by a
+	 * GOAWAY frame with error code HTTP_1_1_REQUIRED. See RFC 7540 section 7.
+	 */
+	void endWithHttp2FallbackResponse(Client **client, Request **req) {
+		static const char frames[] =
+			// SETTINGS: length 0, type 0x4, no flags, stream 0
+			"\x00\x00\x00" "\x04" "\x00" "\x00\x00\x00\x00"
+			// GOAWAY: length 8, type 0x7, no flags, stream 0,
+			// last stream ID 0, error code HTTP_1_1_REQUIRED (0xd)
+			"\x00\x00\x08" "\x07" "\x00" "\x00\x00\x00\x00"
+			"\x00\x00\x00\x00" "\x00\x00\x00\x0d";
+
+		SKC_DEBUG(*client, "HTTP/2 connection preface received; "
+			"telling client to use HTTP/1.1 instead");
+		(*req)->wantKeepAlive = false;
+		writeResponse(*client, frames, sizeof(frames) - 1);
+		endRequest(client, req);
+	}
+
 	static HttpHeaderParser<Request> createRequestHeaderParser(Context *ctx,
 		Request *req)
 	{
@@ -624,6 +880,7 @@ private:
 			channel->getHooks()->userData));
 
 		HttpServer *self = static_cast<HttpServer *>(HttpServer::getServerFromClient(client));
+		self->releaseFlushingRequest(client);
 		if (client->currentRequest != NULL
 		 && client->currentRequest->httpState == Request::FLUSHING_OUTPUT)
 		{
@@ -758,6 +1015,7 @@ protected:
 
 		// Handle client being disconnect()'ed without endRequest().
 
+		releaseFlushingRequest(client);
 		if (client->currentRequest != NULL) {
 			Request *req = client->currentRequest;
 			deinitializeRequestAndAddToFreelist(client, req);
@@ -769,6 +1027,7 @@ protected:
 	virtual void deinitializeClient(Client *client) {
 		ParentClass::deinitializeClient(client);
 		client->currentRequest = NULL;
+		client->flushingRequest = NULL;
 	}
 
 	virtual bool shouldDisconnectClientOnShutdown(Client *client) {
@@ -776,6 +1035,33 @@ protected:
 			|| client->currentRequest->upgraded();
 	}
 
+	virtual void onClientTimeout(Client *client) {
+		SKC_LOG_EVENT(HttpServer, client, "onClientTimeout");
+		Request *req = client->currentRequest;
+
+		if (req == NULL || req->httpState == Request::PARSING_HEADERS) {
+			if (req != NULL && req->headerBytesRead > 0) {
+				SKC_INFO(client, "Disconnecting client because it did not send "
+					"the request headers within " << headerReadTimeout << " seconds");
+			} else {
+				SKC_DEBUG(client, "Disconnecting idle client");
+			}
+			ParentClass::onClientTimeout(client);
+		} else if (req->httpState == Request::PARSING_BODY
+			|| req->httpState == Request::PARSING_CHUNKED_BODY)
+		{
+			if (req->bodyFullyRead() || minRequestBodyRate == 0) {
+				// The body has been received in the meantime.
+				return;
+			} else if (checkRequestBodyRate(client, req)) {
+				this->setClientTimeout(client, REQUEST_BODY_RATE_CHECK_INTERVAL);
+			} else {
+				totalClientsTooSlow++;
+				ParentClass::onClientTimeout(client);
+			}
+		}
+	}
+
 	virtual void onUpdateStatistics() {
 		ParentClass::onUpdateStatistics();
 		ev_tstamp now = ev_now(this->getLoop());
@@ -792,6 +1078,13 @@ protected:
 		requestBeginSpeed1h = expMovingAverage(requestBeginSpeed1h,
 			(totalRequestsBegun - lastTotalRequestsBegun) / duration,
 			0.0041520953856636345);
+
+		// Every client has at most one request object, so keep room for
+		// as many request objects as the auto-tuner keeps client objects.
+		if (this->autoTune) {
+			requestFreelistLimit = std::max<unsigned int>(requestFreelistLimit,
+				this->clientFreelistLimit);
+		}
 	}
 
 	virtual void onFinalizeStatisticsUpdate() {
@@ -832,6 +1125,36 @@ protected:
 		return false;
 	}
 
+	/**
+	 * Called by enterTunnelMode() after `req->pool` has been replaced by a
+	 * small tunnel pool, but before the old pool is destroyed. Moves what
+	 * the request still needs into the new pool, and drops references to
+	 * everything else in the old pool. Subclasses that keep pointers into
+	 * the request pool must override this and call the parent method.
+	 */
+	virtual void compactRequestForTunnel(Client *client, Request *req) {
+		moveStringToPool(&req->path, req->pool);
+
+		HeaderTable::Iterator it(req->headers);
+		while (*it != NULL) {
+			psg_lstr_deinit(&it->header->key);
+			psg_lstr_deinit(&it->header->origKey);
+			psg_lstr_deinit(&it->header->val);
+			it.next();
+		}
+
+		it = HeaderTable::Iterator(req->secureHeaders);
+		while (*it != NULL) {
+			psg_lstr_deinit(&it->header->key);
+			psg_lstr_deinit(&it->header->origKey);
+			psg_lstr_deinit(&it->header->val);
+			it.next();
+		}
+
+		req->headers.clear();
+		req->secureHeaders.clear();
+	}
+
 	virtual PassengerLogLevel getClientOutputErrorDisconnectionLogLevel(
 		Client *client, int errcode) const
 	{
@@ -845,6 +1168,7 @@ protected:
 	virtual void reinitializeClient(Client *client, int fd) {
 		ParentClass::reinitializeClient(client, fd);
 		client->requestsBegun = 0;
+		client->onUnixSocket = -1;
 		assert(client->currentRequest == NULL);
 	}
 
@@ -857,17 +1181,25 @@ protected:
 		req->wantKeepAlive = false;
 		req->responseBegun = false;
 		req->detectingNextRequestEarlyReadError = false;
+		req->tunneling = false;
+		req->mayBeHttp2Preface = false;
 		req->parserState.headerParser = headerParserStatePool.construct();
 		createRequestHeaderParser(this->getContext(), req).initialize();
 		if (OXT_UNLIKELY(req->pool == NULL)) {
 			// We assume that most of the time, the pool from the
 			// last request is reset and reused.
-			req->pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+			createRequestPool(req);
+		} else if (OXT_UNLIKELY(requestPoolNeedsResize(req->pool))) {
+			psg_destroy_pool(req->pool);
+			createRequestPool(req);
 		}
 		psg_lstr_init(&req->path);
 		req->bodyChannel.reinitialize();
 		req->aux.bodyInfo.contentLength = 0; // Sets the entire union to 0.
 		req->bodyAlreadyRead = 0;
+		req->bodyAlreadyReadAtRateCheck = 0;
+		req->headerBytesRead = 0;
+		req->responseBytesWritten = 0;
 		req->lastDataReceiveTime = 0;
 		req->lastDataSendTime = 0;
 		req->queryStringIndex = -1;
@@ -905,9 +1237,12 @@ protected:
 			it.next();
 		}
 
-		if (req->pool != NULL && !psg_reset_pool(req->pool, PSG_DEFAULT_POOL_SIZE)) {
-			psg_destroy_pool(req->pool);
-			req->pool = NULL;
+		if (req->pool != NULL) {
+			resetRequestPool(req);
+		}
+		if (req->tunneling) {
+			tunnelCount--;
+			req->tunneling = false;
 		}
 
 		req->httpState = Request::WAITING_FOR_REFERENCES;
@@ -925,6 +1260,68 @@ protected:
 		return _onClientOutputDataFlushed;
 	}
 
+	bool isOnUnixSocket(Client *client) {
+		if (client->onUnixSocket == -1) {
+			union {
+				struct sockaddr_in inaddr;
+				struct sockaddr_in6 inaddr6;
+				struct sockaddr_un unaddr;
+			} u;
+			socklen_t addrlen = sizeof(u);
+
+			if (getsockname(client->getFd(), (struct sockaddr *) &u, &addrlen) == 0) {
+				client->onUnixSocket = u.unaddr.sun_family == AF_UNIX;
+			} else {
+				client->onUnixSocket = 0;
+			}
+		}
+		return client->onUnixSocket == 1;
+	}
+
+	/**
+	 * Subclasses may read the rest of a Content-Length request body from the
+	 * client socket themselves, bypassing `client->input` and `req->bodyChannel`,
+	 * for example to splice it to another socket. While doing so they must keep
+	 * `client->input` stopped, and report every `size` bytes of body that they
+	 * have read and processed with this method. Once the body is fully read,
+	 * this feeds EOF to `req->bodyChannel` and resumes `client->input`, just
+	 * like onClientDataReceived() would have.
+	 */
+	void requestBodyReadExternally(Client *client, Request *req, unsigned int size) {
+		P_ASSERT_EQ(req->bodyType, Request::RBT_CONTENT_LENGTH);
+		req->bodyAlreadyRead += size;
+		req->lastDataReceiveTime = ev_now(this->getLoop());
+		SKC_TRACE(client, 3, "Request body: " <<
+			req->bodyAlreadyRead << " of " <<
+			req->aux.bodyInfo.contentLength << " bytes already read");
+		if (req->bodyFullyRead()) {
+			SKC_TRACE(client, 2, "End of request body reached");
+			req->detectingNextRequestEarlyReadError = true;
+			req->bodyChannel.feed(MemoryKit::mbuf());
+			if (!req->ended()) {
+				client->input.start();
+			}
+		}
+	}
+
+	/**
+	 * Reports an error that occurred while reading the request body
+	 * externally (see requestBodyReadExternally()). An `errcode` of 0
+	 * means that the client sent EOF before the end of the body.
+	 */
+	void requestBodyExternalReadError(Client *client, Request *req, int errcode) {
+		if (errcode == 0) {
+			SKC_DEBUG(client, "Client sent EOF before finishing request body: " <<
+				req->bodyAlreadyRead << " bytes already read, " <<
+				req->aux.bodyInfo.contentLength << " bytes expected");
+			errcode = UNEXPECTED_EOF;
+		} else {
+			SKC_TRACE(client, 2, "Request body receive error: " <<
+				getErrorDesc(errcode) << " (errno=" << errcode << ")");
+		}
+		feedBodyChannelError(client, req, errcode);
+	}
+
 public:
 	HttpServer(Context *context)
 		: ParentClass(context),
@@ -934,14 +1331,49 @@ public:
 		  lastTotalRequestsBegun(0),
 		  requestBeginSpeed1m(-1),
 		  requestBeginSpeed1h(-1),
-		  headerParserStatePool(16, 256)
+		  requestPoolSize(PSG_DEFAULT_POOL_SIZE),
+		  requestPoolUsageSamples(0),
+		  requestPoolMallocs(0),
+		  tunnelCount(0),
+		  totalClientsTooSlow(0),
+		  headerReadTimeout(0),
+		  keepAliveTimeout(0),
+		  minRequestBodyRate(0),
+		  headerParserStatePool(16, 256),
+		  requestPoolUsagePercentile(0)
 	{
 		STAILQ_INIT(&freeRequests);
+		memset(responsesByStatusClass, 0, sizeof(responsesByStatusClass));
 	}
 
 
 	/***** Server management *****/
 
+	/**
+	 * Like BaseServer::createSpareClients(), but also pre-creates a request
+	 * object, including its palloc pool, for every spare client. This way
+	 * the first burst of requests after startup doesn't have to construct
+	 * any request objects.
+	 */
+	virtual void createSpareClients() {
+		ParentClass::createSpareClients();
+		while (freeRequestCount < this->minSpareClients) {
+			Request *request = createNewRequestObject(NULL);
+			if (request == NULL) {
+				break;
+			}
+			createRequestPool(request);
+			if (!addRequestToFreelist(request)) {
+				if (request->pool != NULL) {
+					psg_destroy_pool(request->pool);
+					request->pool = NULL;
+				}
+				delete request;
+				break;
+			}
+		}
+	}
+
 	virtual void compact(int logLevel = LVL_NOTICE) {
 		ParentClass::compact();
 		unsigned int count = freeRequestCount;
@@ -994,15 +1426,59 @@ public:
 		}
 	}
 
+	/**
+	 * Puts an upgraded request, whose response header has been sent, in
+	 * tunnel mode. From then on, the connection only passes data through,
+	 * so the request no longer needs its parsed headers or most of its
+	 * palloc pool. Those are released, and the client's input channel stops
+	 * holding on to read buffers between reads. Long-lived idle connections,
+	 * such as WebSockets, then take up little more than their file
+	 * descriptors and the request object.
+	 *
+	 * The caller must make sure that nothing refers to data in the request
+	 * pool anymore, e.g. output that is still buffered.
+	 */
+	void enterTunnelMode(Client *client, Request *req) {
+		assert(req->upgraded());
+		assert(!req->tunneling);
+		psg_pool_t *oldPool = req->pool;
+
+		req->pool = psg_create_pool(TUNNEL_REQUEST_POOL_SIZE);
+		compactRequestForTunnel(client, req);
+		psg_destroy_pool(oldPool);
+		req->tunneling = true;
+		tunnelCount++;
+		client->input.setReleaseBufferWhenIdle(true);
+		SKC_TRACE(client, 2, "Request entered tunnel mode");
+	}
+
 	bool canKeepAlive(Request *req) const {
 		return req->wantKeepAlive
 			&& req->bodyFullyRead()
 			&& HttpServer::serverState < HttpServer::SHUTTING_DOWN;
 	}
 
+	/**
+	 * Whether endRequest() may begin the next request before the given
+	 * request's output is flushed. Only one such request can be flushing
+	 * at a time, and only when the next request's data has already been
+	 * received, so that idle keep-alive connections don't hold on to the
+	 * previous request's pool.
+	 */
+	bool canBeginNextRequestEarly(Client *client, Request *req) const {
+		return client->flushingRequest == NULL
+			&& req->nextRequestEarlyReadError == 0
+			&& canKeepAlive(req)
+			&& !client->output.ended()
+			&& !client->output.flushed()
+			&& !client->input.isStarted()
+			&& client->input.hasUnconsumedData();
+	}
+
 	void writeResponse(Client *client, const MemoryKit::mbuf &buffer) {
 		client->currentRequest->responseBegun = true;
 		client->currentRequest->lastDataSendTime = ev_now(this->getLoop());
+		client->currentRequest->responseBytesWritten += buffer.size();
 		client->output.feedWithoutRefGuard(buffer);
 	}
 
@@ -1014,9 +1490,31 @@ public:
 		writeResponse(client, data.data(), data.size());
 	}
 
+	void recordResponseStatus(int code) {
+		if (code >= 100 && code <= 599) {
+			responsesByStatusClass[code / 100 - 1]++;
+		}
+	}
+
 	void
 	writeSimpleResponse(Client *client, int code, const HeaderTable *headers,
 		const StaticString &body)
+	{
+		Request *req = client->currentRequest;
+		writeSimpleResponseHeader(client, code, headers, body.size());
+		if (!req->ended() && req->method != HTTP_HEAD) {
+			writeResponse(client, body.data(), body.size());
+		}
+	}
+
+	/**
+	 * Writes the header part of what writeSimpleResponse() writes, for
+	 * responses whose body of `contentLength` bytes the caller writes
+	 * itself with writeResponse().
+	 */
+	void
+	writeSimpleResponseHeader(Client *client, int code, const HeaderTable *headers,
+		boost::uint64_t contentLength)
 	{
 		unsigned int headerBufSize = 300;
 
@@ -1090,7 +1588,7 @@ public:
 		value = (headers != NULL) ? headers->lookup(P_STATIC_STRING("content-length")) : NULL;
 		pos = appendData(pos, end, P_STATIC_STRING("Content-Length: "));
 		if (value == NULL) {
-			pos += snprintf(pos, end - pos, "%u", (unsigned int) body.size());
+			pos += snprintf(pos, end - pos, "%llu", (unsigned long long) contentLength);
 		} else {
 			pos = appendData(pos, end, value);
 		}
@@ -1115,10 +1613,8 @@ public:
 
 		pos = appendData(pos, end, P_STATIC_STRING("\r\n"));
 
+		recordResponseStatus(code);
 		writeResponse(client, header, pos - header);
-		if (!req->ended() && req->method != HTTP_HEAD) {
-			writeResponse(client, body.data(), body.size());
-		}
 	}
 
 	bool endRequest(Client **client, Request **request) {
@@ -1153,6 +1649,15 @@ public:
 		deinitializeRequestAndAddToFreelist(c, req);
 		req->pool = pool;
 
+		if (canBeginNextRequestEarly(c, req)) {
+			// Release the request pool when data flushed
+			SKC_TRACE(c, 2, "Output not yet flushed, beginning next request early");
+			c->flushingRequest = req;
+			c->currentRequest = NULL;
+			handleNextRequest(c, false);
+			return true;
+		}
+
 		if (!c->output.ended()) {
 			c->output.feedWithoutRefGuard(MemoryKit::mbuf());
 		}
@@ -1183,74 +1688,121 @@ public:
 		if (doc.isMember("request_freelist_limit")) {
 			requestFreelistLimit = doc["request_freelist_limit"].asUInt();
 		}
+		// Clients that are already waiting keep their current timeout.
+		if (doc.isMember("client_header_timeout")) {
+			headerReadTimeout = doc["client_header_timeout"].asUInt();
+		}
+		if (doc.isMember("client_keepalive_timeout")) {
+			keepAliveTimeout = doc["client_keepalive_timeout"].asUInt();
+		}
+		if (doc.isMember("client_body_min_rate")) {
+			minRequestBodyRate = doc["client_body_min_rate"].asUInt();
+		}
 	}
 
 	virtual Json::Value getConfigAsJson() const {
 		Json::Value doc = ParentClass::getConfigAsJson();
 		doc["request_freelist_limit"] = requestFreelistLimit;
+		doc["client_header_timeout"] = headerReadTimeout;
+		doc["client_keepalive_timeout"] = keepAliveTimeout;
+		doc["client_body_min_rate"] = minRequestBodyRate;
 		return doc;
 	}
 
-	virtual Json::Value inspectStateAsJson() const {
-		Json::Value doc = ParentClass::inspectStateAsJson();
-		doc["free_request_count"] = freeRequestCount;
-		doc["total_requests_begun"] = (Json::UInt64) totalRequestsBegun;
-		doc["request_begin_speed"]["1m"] = averageSpeedToJson(
+	virtual void writeStateAsJson(JsonWriter &writer) const {
+		ParentClass::writeStateAsJson(writer);
+		writer.member("free_request_count", freeRequestCount);
+		writer.member("tunnel_count", tunnelCount);
+		writer.member("total_requests_begun", (unsigned long long) totalRequestsBegun);
+		writer.member("total_clients_too_slow", (unsigned long long) totalClientsTooSlow);
+		writer.key("request_begin_speed");
+		writer.beginObject();
+		writer.member("1m", averageSpeedToJson(
 			capFloatPrecision(requestBeginSpeed1m * 60),
-			"minute", "1 minute", -1);
-		doc["request_begin_speed"]["1h"] = averageSpeedToJson(
+			"minute", "1 minute", -1));
+		writer.member("1h", averageSpeedToJson(
 			capFloatPrecision(requestBeginSpeed1h * 60),
-			"minute", "1 hour", -1);
-		return doc;
+			"minute", "1 hour", -1));
+		writer.endObject();
+		writer.key("responses_by_status_class");
+		writer.beginObject();
+		for (unsigned int i = 0; i < 5; i++) {
+			char statusClass[] = { char('1' + i), 'x', 'x', '\0' };
+			writer.member(statusClass,
+				(unsigned long long) responsesByStatusClass[i]);
+		}
+		writer.endObject();
+		writer.key("request_pool");
+		writer.beginObject();
+		writer.key("size");
+		byteSizeToJson(writer, requestPoolSize);
+		writer.member("usage_percentile", (unsigned int) REQUEST_POOL_USAGE_PERCENTILE);
+		writer.key("usage_at_percentile");
+		byteSizeToJson(writer, requestPoolUsagePercentile);
+		writer.member("samples", (unsigned long long) requestPoolUsageSamples);
+		writer.member("mallocs", (unsigned long long) requestPoolMallocs);
+		if (requestPoolUsageSamples > 0) {
+			writer.member("malloc_ratio", capFloatPrecision(
+				(double) requestPoolMallocs / requestPoolUsageSamples));
+		}
+		writer.endObject();
 	}
 
-	virtual Json::Value inspectClientStateAsJson(const Client *client) const {
-		Json::Value doc = ParentClass::inspectClientStateAsJson(client);
+	virtual void writeClientStateAsJson(JsonWriter &writer, const Client *client) const {
+		ParentClass::writeClientStateAsJson(writer, client);
 		if (client->currentRequest) {
-			doc["current_request"] = inspectRequestStateAsJson(client->currentRequest);
+			writer.key("current_request");
+			writer.beginObject();
+			writeRequestStateAsJson(writer, client->currentRequest);
+			writer.endObject();
 		}
-		doc["requests_begun"] = client->requestsBegun;
-		doc["lingering_request_count"] = client->lingeringRequestCount;
-		return doc;
+		writer.member("requests_begun", client->requestsBegun);
+		writer.member("lingering_request_count", client->lingeringRequestCount);
 	}
 
-	virtual Json::Value inspectRequestStateAsJson(const Request *req) const {
-		Json::Value doc(Json::objectValue);
+	virtual void writeRequestStateAsJson(JsonWriter &writer, const Request *req) const {
 		assert(req->httpState != Request::IN_FREELIST);
 		const LString::Part *part;
 
-		doc["refcount"] = req->refcount.load(boost::memory_order_relaxed);
-		doc["http_state"] = req->getHttpStateString();
+		writer.member("refcount", req->refcount.load(boost::memory_order_relaxed));
+		writer.member("http_state", req->getHttpStateString());
 
 		if (req->begun()) {
 			ev_tstamp evNow = ev_now(this->getLoop());
 			unsigned long long now = SystemTime::getUsec();
 
-			doc["http_major"] = req->httpMajor;
-			doc["http_minor"] = req->httpMinor;
-			doc["want_keep_alive"] = req->wantKeepAlive;
-			doc["request_body_type"] = req->getBodyTypeString();
-			doc["request_body_fully_read"] = req->bodyFullyRead();
-			doc["request_body_already_read"] = (Json::Value::UInt64) req->bodyAlreadyRead;
-			doc["response_begun"] = req->responseBegun;
-			doc["last_data_receive_time"] = evTimeToJson(req->lastDataReceiveTime, evNow, now);
-			doc["last_data_send_time"] = evTimeToJson(req->lastDataSendTime, evNow, now);
-			doc["method"] = http_method_str(req->method);
+			writer.member("http_major", (int) req->httpMajor);
+			writer.member("http_minor", (int) req->httpMinor);
+			writer.member("want_keep_alive", (bool) req->wantKeepAlive);
+			writer.member("request_body_type", req->getBodyTypeString());
+			writer.member("request_body_fully_read", req->bodyFullyRead());
+			writer.member("request_body_already_read",
+				(unsigned long long) req->bodyAlreadyRead);
+			writer.member("response_begun", (bool) req->responseBegun);
+			if (req->tunneling) {
+				writer.member("tunneling", true);
+			}
+			writer.key("last_data_receive_time");
+			evTimeToJson(writer, req->lastDataReceiveTime, evNow, now);
+			writer.key("last_data_send_time");
+			evTimeToJson(writer, req->lastDataSendTime, evNow, now);
+			writer.member("method", http_method_str(req->method));
 			if (req->httpState != Request::ERROR) {
 				if (req->bodyType == Request::RBT_CONTENT_LENGTH) {
-					doc["content_length"] = (Json::Value::UInt64)
-						req->aux.bodyInfo.contentLength;
+					writer.member("content_length", (unsigned long long)
+						req->aux.bodyInfo.contentLength);
 				} else if (req->bodyType == Request::RBT_CHUNKED) {
-					doc["end_chunk_reached"] = (Json::Value::UInt64)
-						req->aux.bodyInfo.endChunkReached;
+					writer.member("end_chunk_reached", (unsigned long long)
+						req->aux.bodyInfo.endChunkReached);
 				}
 			} else {
-				doc["parse_error"] = getErrorDesc(req->aux.parseError);
+				writer.member("parse_error", getErrorDesc(req->aux.parseError));
 			}
 
 			if (req->nextRequestEarlyReadError != 0) {
-				doc["next_request_early_read_error"] = getErrorDesc(req->nextRequestEarlyReadError)
-					+ string(" (errno=") + toString(req->nextRequestEarlyReadError) + ")";
+				writer.member("next_request_early_read_error",
+					getErrorDesc(req->nextRequestEarlyReadError)
+					+ string(" (errno=") + toString(req->nextRequestEarlyReadError) + ")");
 			}
 
 			string str;
@@ -1260,7 +1812,7 @@ public:
 				str.append(part->data, part->size);
 				part = part->next;
 			}
-			doc["path"] = str;
+			writer.member("path", str);
 
 			const LString *host = req->headers.lookup("host");
 			if (host != NULL) {
@@ -1271,11 +1823,9 @@ public:
 					str.append(part->data, part->size);
 					part = part->next;
 				}
-				doc["host"] = str;
+				writer.member("host", str);
 			}
 		}
-
-		return doc;
 	}
 
 
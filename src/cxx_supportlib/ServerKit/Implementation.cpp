@@ -23,7 +23,9 @@
  *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *  THE SOFTWARE.
  */
+#include <boost/cstdint.hpp>
 #include <DataStructures/HashedStaticString.h>
+#include <ServerKit/HeaderTable.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -36,6 +38,8 @@ extern const HashedStaticString HTTP_CONTENT_LENGTH;
 extern const HashedStaticString HTTP_TRANSFER_ENCODING;
 extern const HashedStaticString HTTP_X_SENDFILE;
 extern const HashedStaticString HTTP_X_ACCEL_REDIRECT;
+extern const HashedStaticString KNOWN_HEADERS[KNOWN_HEADER_COUNT];
+extern const boost::uint8_t KNOWN_HEADER_SLOTS[512];
 extern const char DEFAULT_INTERNAL_SERVER_ERROR_RESPONSE[];
 extern const unsigned int DEFAULT_INTERNAL_SERVER_ERROR_RESPONSE_SIZE;
 
@@ -55,6 +59,148 @@ const HashedStaticString HTTP_TRANSFER_ENCODING("transfer-encoding");
 const HashedStaticString HTTP_X_SENDFILE("x-sendfile");
 const HashedStaticString HTTP_X_ACCEL_REDIRECT("x-accel-redirect");
 
+const HashedStaticString KNOWN_HEADERS[KNOWN_HEADER_COUNT] = {
+	HashedStaticString("accept"),
+	HashedStaticString("accept-charset"),
+	HashedStaticString("accept-encoding"),
+	HashedStaticString("accept-language"),
+	HashedStaticString("accept-ranges"),
+	HashedStaticString("access-control-allow-origin"),
+	HashedStaticString("age"),
+	HashedStaticString("allow"),
+	HashedStaticString("authorization"),
+	HashedStaticString("cache-control"),
+	HashedStaticString("cf-connecting-ip"),
+	HashedStaticString("connection"),
+	HashedStaticString("content-disposition"),
+	HashedStaticString("content-encoding"),
+	HashedStaticString("content-language"),
+	HashedStaticString("content-length"),
+	HashedStaticString("content-location"),
+	HashedStaticString("content-range"),
+	HashedStaticString("content-security-policy"),
+	HashedStaticString("content-type"),
+	HashedStaticString("cookie"),
+	HashedStaticString("date"),
+	HashedStaticString("dnt"),
+	HashedStaticString("etag"),
+	HashedStaticString("expect"),
+	HashedStaticString("expires"),
+	HashedStaticString("forwarded"),
+	HashedStaticString("from"),
+	HashedStaticString("host"),
+	HashedStaticString("if-match"),
+	HashedStaticString("if-modified-since"),
+	HashedStaticString("if-none-match"),
+	HashedStaticString("if-range"),
+	HashedStaticString("if-unmodified-since"),
+	HashedStaticString("keep-alive"),
+	HashedStaticString("last-modified"),
+	HashedStaticString("link"),
+	HashedStaticString("location"),
+	HashedStaticString("origin"),
+	HashedStaticString("pragma"),
+	HashedStaticString("proxy-authorization"),
+	HashedStaticString("range"),
+	HashedStaticString("referer"),
+	HashedStaticString("retry-after"),
+	HashedStaticString("server"),
+	HashedStaticString("set-cookie"),
+	HashedStaticString("strict-transport-security"),
+	HashedStaticString("te"),
+	HashedStaticString("transfer-encoding"),
+	HashedStaticString("upgrade"),
+	HashedStaticString("upgrade-insecure-requests"),
+	HashedStaticString("user-agent"),
+	HashedStaticString("vary"),
+	HashedStaticString("via"),
+	HashedStaticString("www-authenticate"),
+	HashedStaticString("x-accel-redirect"),
+	HashedStaticString("x-content-type-options"),
+	HashedStaticString("x-forwarded-for"),
+	HashedStaticString("x-forwarded-host"),
+	HashedStaticString("x-forwarded-proto"),
+	HashedStaticString("x-frame-options"),
+	HashedStaticString("x-powered-by"),
+	HashedStaticString("x-real-ip"),
+	HashedStaticString("x-request-id"),
+	HashedStaticString("x-requested-with"),
+	HashedStaticString("x-sendfile"),
+	HashedStaticString("x-xss-protection"),
+};
+
+#ifdef PASSENGER_USE_JENKINS_HASH
+const boost::uint8_t KNOWN_HEADER_SLOTS[512] = {
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 55,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0, 12,  0, 36,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0, 58,  0,  0,  0,  0,  0, 61,  0,  0,  0,
+	 0, 14,  0,  0,  0,  0,  0,  0, 17, 54,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0, 31,  0, 33,  0,  0,  0,  0,  0,  0, 13,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0, 66,  0,  0,  0,  0,  0, 44, 47,  0,  0,
+	 0, 34,  0, 15, 25, 53,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0, 19,  0,  0,  0,  0,  0,  0,  0,  0, 20,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	24,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  3,  0,  0,
+	 0,  0,  0,  0,  0, 59,  0,  5,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 27,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 67,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0, 60,  0,  0,  0,  0,  0, 39,  0,  0,  0,  0,  2,
+	 0,  0,  0, 43,  0,  8, 64,  0, 42,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 62, 29, 50,  0,
+	 0,  0,  0,  0,  0, 21,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0, 63,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 35,  0, 16,  0,
+	 4,  0,  0,  0,  0,  0, 41,  0,  0, 56,  0,  0,  0,  0,  0,  0,
+	49,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  6,  0,  0,
+	 0,  0,  0,  0,  0,  1,  0,  0,  0,  0, 10,  0,  0,  9,  0,  0,
+	 0,  0,  0,  0, 57, 52,  0,  0, 22,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0, 45,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 40,
+	 0,  0,  0,  0,  0,  0,  0,  0, 32,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0, 51,  0,  0,  0,  0,  0,  0, 65,  0,  0, 30,  0,  0,  0,
+	 0,  0, 26,  0,  0,  0,  0,  0,  0,  0,  0,  0,  7,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0, 28,  0,  0, 11, 23,  0,  0, 38,
+	 0,  0,  0,  0,  0,  0, 18, 46,  0,  0, 37, 48,  0,  0,  0,  0,
+};
+#else
+const boost::uint8_t KNOWN_HEADER_SLOTS[512] = {
+	 0, 26,  0,  0,  0,  0,  0,  0,  0, 67,  0,  0,  0,  0,  0,  0,
+	 2,  0,  0,  0,  0,  0,  0, 62,  0, 19,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0, 51,  0,  0,  0,  0,  0, 34,  0,  0,  0,  0,  0, 46,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0, 50,  0, 42,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0, 48,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 66,  0,  0,
+	 0,  0,  0, 57,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0, 55,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 12,  0,  0,
+	 0,  3,  0,  0, 29,  0,  0,  0,  0,  0,  0,  0, 36, 15,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 20,
+	 0,  0,  0, 33,  0,  0,  0,  0,  0,  0,  0,  0, 11,  0,  0,  0,
+	 0, 17,  0,  0,  0,  0,  0,  0, 44,  0,  0,  0,  5,  0,  0,  0,
+	 0,  0,  0,  0,  0, 14,  0,  0,  4,  0,  0,  0, 13,  0,  0,  0,
+	 0, 59,  0,  0,  0,  0, 18,  0,  0, 65, 56,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 40,
+	41,  0, 39,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 60, 53,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0, 27,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0, 38,  0,  0,  0,  0,  0,  0,  0, 63, 31,  0,  0, 10,  0,
+	28,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	32,  0,  0, 61,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0, 58,  0,  0,  0,  0,  0,  8, 45,  0,  0,  0, 25,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 52,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0, 35,  0,  0,  0,  0, 64,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0,  0,  0,  0,
+	 0, 23,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0, 49,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 37,
+	21, 54,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  6,  0,  0, 47,  0,  0,  0,  0, 30,  0,  0, 22,  0,
+	 7,  0, 24, 43,  1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  9,  0,
+};
+#endif
+
 
 } // namespace ServerKit
 } // namespace
@@ -0,0 +1,380 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_MESSAGE_CHANNEL_H_
+#define _PASSENGER_SERVER_KIT_MESSAGE_CHANNEL_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <oxt/macros.hpp>
+#include <vector>
+#include <cerrno>
+#include <cassert>
+#include <ev.h>
+#include <MemoryKit/mbuf.h>
+#include <ServerKit/Context.h>
+#include <ServerKit/Errors.h>
+#include <ServerKit/Hooks.h>
+#include <ServerKit/FdSourceChannel.h>
+#include <ServerKit/FileBufferedFdSinkChannel.h>
+#include <MessageReadersWriters.h>
+#include <SmallVector.h>
+#include <StaticString.h>
+#include <Utils/StrIntUtils.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * Exchanges array messages and scalar messages (see MessageReadersWriters.h)
+ * over a file descriptor, on a ServerKit event loop. This is the non-blocking
+ * counterpart of the readArrayMessage()/writeArrayMessage() family of
+ * functions in Utils/MessageIO.h: instead of blocking the calling thread
+ * until a message has arrived or a timeout has passed, a read registers a
+ * callback that is called on the event loop.
+ *
+ *     void onReply(MessageChannel *channel, int errcode) {
+ *         if (errcode == 0) {
+ *             const vector<StaticString> &reply = channel->getArrayMessage();
+ *             ...
+ *         } else {
+ *             P_ERROR("Cannot read reply: " << getErrorDesc(errcode));
+ *             channel->deinitialize();
+ *         }
+ *     }
+ *
+ *     channel.reinitialize(fd);
+ *     StaticString request[] = { "ping" };
+ *     channel.writeArrayMessage(request, 1);
+ *     channel.readArrayMessage(onReply, 5);
+ *
+ * Writes are buffered (in memory, or on disk if there's a lot of data) and
+ * never block, so they can be issued at any time.
+ *
+ * Only one read can be in progress at a time. A read completes with one of
+ * these error codes:
+ *
+ *  - 0: a message has been read. Its contents can be obtained with
+ *    getArrayMessage() or getScalarMessage(), and are only valid until
+ *    the callback returns or the next read is started.
+ *  - `UNEXPECTED_EOF`: the other side closed the connection.
+ *  - `ETIMEDOUT`: no complete message arrived within the timeout.
+ *  - `EMSGSIZE`: the message is larger than the configured maximum size.
+ *  - An errno code, if reading from the file descriptor failed.
+ *
+ * After any error the message stream is no longer usable and the channel
+ * should be deinitialized. The callback may start the next read, or call
+ * deinitialize().
+ *
+ * The file descriptor is not owned by this class. All methods may only be
+ * called from the event loop thread.
+ */
+class MessageChannel: public boost::noncopyable {
+public:
+	typedef void (*Callback)(MessageChannel *channel, int errcode);
+
+private:
+	enum ReadState {
+		NOT_READING,
+		READING_ARRAY_MESSAGE,
+		READING_SCALAR_MESSAGE
+	};
+
+	Context *ctx;
+	Hooks hooks;
+	FdSourceChannel input;
+	FileBufferedFdSinkChannel output;
+	ev_timer timer;
+	ArrayMessage arrayReader;
+	ScalarMessage scalarReader;
+	ReadState readState;
+	Callback readCallback;
+	unsigned int generation;
+
+	static Channel::Result _onInputData(Channel *_channel, const MemoryKit::mbuf &buffer,
+		int errcode)
+	{
+		FdSourceChannel *channel = reinterpret_cast<FdSourceChannel *>(_channel);
+		MessageChannel *self = static_cast<MessageChannel *>(
+			channel->getHooks()->userData);
+		return self->onInputData(buffer, errcode);
+	}
+
+	Channel::Result onInputData(const MemoryKit::mbuf &buffer, int errcode) {
+		size_t consumed;
+
+		if (buffer.empty()) {
+			finishRead(errcode == 0 ? (int) UNEXPECTED_EOF : errcode);
+			return Channel::Result(0, true);
+		}
+
+		switch (readState) {
+		case READING_ARRAY_MESSAGE:
+			consumed = arrayReader.feed(buffer.start, buffer.size());
+			if (!arrayReader.done()) {
+				return Channel::Result(consumed, false);
+			} else if (arrayReader.hasError()) {
+				finishRead(EMSGSIZE);
+				return Channel::Result(consumed, true);
+			}
+			break;
+		case READING_SCALAR_MESSAGE:
+			consumed = scalarReader.feed(buffer.start, buffer.size());
+			if (!scalarReader.done()) {
+				return Channel::Result(consumed, false);
+			} else if (scalarReader.hasError()) {
+				finishRead(EMSGSIZE);
+				return Channel::Result(consumed, true);
+			}
+			break;
+		default:
+			// Data is only delivered while a read is in progress.
+			P_BUG("Unexpected read state " << (int) readState);
+			return Channel::Result(0, false); // Never reached
+		}
+
+		unsigned int generation = this->generation;
+		finishRead(0);
+		if (generation == this->generation && readState == NOT_READING) {
+			// Keep the rest of the data in the channel until the
+			// next read.
+			input.stop();
+		}
+		return Channel::Result(consumed, false);
+	}
+
+	static void onTimeout(EV_P_ ev_timer *timer, int revents) {
+		MessageChannel *self = static_cast<MessageChannel *>(timer->data);
+		self->input.stop();
+		self->finishRead(ETIMEDOUT);
+	}
+
+	static void onOutputError(FileBufferedFdSinkChannel *channel, int errcode) {
+		MessageChannel *self = static_cast<MessageChannel *>(
+			channel->getHooks()->userData);
+		if (self->errorCallback != NULL) {
+			self->errorCallback(self, errcode);
+		}
+	}
+
+	void beginRead(ReadState state, Callback callback, ev_tstamp timeout) {
+		assert(readState == NOT_READING);
+		assert(input.getFd() != -1);
+		readState = state;
+		readCallback = callback;
+		if (timeout > 0) {
+			ev_timer_set(&timer, timeout, 0);
+			ev_timer_start(ctx->libev->getLoop(), &timer);
+		}
+		input.start();
+	}
+
+	/**
+	 * Resets the read state before calling the callback, so that the
+	 * callback can start the next read.
+	 */
+	void finishRead(int errcode) {
+		Callback callback = readCallback;
+
+		if (ev_is_active(&timer)) {
+			ev_timer_stop(ctx->libev->getLoop(), &timer);
+		}
+		readState = NOT_READING;
+		readCallback = NULL;
+		callback(this, errcode);
+	}
+
+	void writeParts(const StaticString parts[], unsigned int count) {
+		unsigned int bufferSize = 0;
+		unsigned int i;
+
+		for (i = 0; i < count; i++) {
+			bufferSize += parts[i].size();
+		}
+
+		MemoryKit::mbuf buffer(MemoryKit::mbuf_get_with_size(&ctx->mbuf_pool, bufferSize));
+		char *pos = buffer.start;
+		const char *end = buffer.start + bufferSize;
+		for (i = 0; i < count; i++) {
+			pos = appendData(pos, end, parts[i].data(), parts[i].size());
+		}
+
+		output.feed(buffer);
+	}
+
+public:
+	/** Called when writing to the file descriptor fails. */
+	Callback errorCallback;
+	/** Not used by MessageChannel itself. */
+	void *userData;
+
+	MessageChannel(Context *context)
+		: ctx(context),
+		  readState(NOT_READING),
+		  readCallback(NULL),
+		  generation(0),
+		  errorCallback(NULL),
+		  userData(NULL)
+	{
+		hooks.impl = NULL;
+		hooks.userData = this;
+
+		input.setContext(context);
+		input.setHooks(&hooks);
+		input.setDataCallback(_onInputData);
+
+		output.setContext(context);
+		output.setHooks(&hooks);
+		output.errorCallback = onOutputError;
+
+		ev_timer_init(&timer, onTimeout, 0, 0);
+		timer.data = this;
+	}
+
+	~MessageChannel() {
+		if (ev_is_active(&timer)) {
+			ev_timer_stop(ctx->libev->getLoop(), &timer);
+		}
+	}
+
+	/**
+	 * Starts using the given file descriptor, which must be non-blocking.
+	 * No read is in progress afterwards.
+	 */
+	void reinitialize(int fd) {
+		input.reinitialize(fd);
+		input.startReadingInNextTick();
+		// Data is only passed to us while a read is in progress.
+		input.stop();
+		output.reinitialize(fd);
+		arrayReader.reset();
+		scalarReader.reset();
+	}
+
+	/**
+	 * Stops using the file descriptor. Cancels the read in progress, if
+	 * any, without calling its callback. Data that hasn't been written yet
+	 * is discarded. May be called from within a callback.
+	 */
+	void deinitialize() {
+		if (ev_is_active(&timer)) {
+			ev_timer_stop(ctx->libev->getLoop(), &timer);
+		}
+		readState = NOT_READING;
+		readCallback = NULL;
+		generation++;
+		input.deinitialize();
+		output.deinitialize();
+		arrayReader.reset();
+		scalarReader.reset();
+	}
+
+	/**
+	 * Allows the owner of this object to keep itself alive while this
+	 * channel calls into it, like how ServerKit clients are reference
+	 * counted. The `hooks` argument passed to `impl` belongs to this
+	 * channel, with `userData` pointing to this channel.
+	 */
+	void setHooksImpl(HooksImpl *impl) {
+		hooks.impl = impl;
+	}
+
+	void setMaxArrayMessageSize(boost::uint16_t size) {
+		arrayReader.setMaxSize(size);
+	}
+
+	void setMaxScalarMessageSize(boost::uint32_t size) {
+		scalarReader.setMaxSize(size);
+	}
+
+	/**
+	 * Reads the next array message and calls `callback` when done. If
+	 * `timeout` is larger than 0, the read fails with ETIMEDOUT if the
+	 * message hasn't arrived within that many seconds.
+	 */
+	void readArrayMessage(Callback callback, ev_tstamp timeout = 0) {
+		arrayReader.reset();
+		beginRead(READING_ARRAY_MESSAGE, callback, timeout);
+	}
+
+	/** Like readArrayMessage(), but for scalar messages. */
+	void readScalarMessage(Callback callback, ev_tstamp timeout = 0) {
+		scalarReader.reset();
+		beginRead(READING_SCALAR_MESSAGE, callback, timeout);
+	}
+
+	bool isReading() const {
+		return readState != NOT_READING;
+	}
+
+	/** The message read by the last successful readArrayMessage() call. */
+	const vector<StaticString> &getArrayMessage() const {
+		return arrayReader.value();
+	}
+
+	/** The message read by the last successful readScalarMessage() call. */
+	const StaticString &getScalarMessage() const {
+		return scalarReader.value();
+	}
+
+	void writeArrayMessage(StaticString args[], unsigned int argsCount) {
+		char headerBuf[sizeof(boost::uint16_t)];
+		unsigned int outputSize = ArrayMessage::outputSize(argsCount);
+		SmallVector<StaticString, 8> out;
+
+		out.resize(outputSize);
+		ArrayMessage::generate(args, argsCount, headerBuf, &out[0], outputSize);
+		writeParts(&out[0], outputSize);
+	}
+
+	void writeScalarMessage(const StaticString &data) {
+		char headerBuf[sizeof(boost::uint32_t)];
+		StaticString out[2];
+
+		ScalarMessage::generate(data, headerBuf, out);
+		writeParts(out, 2);
+	}
+
+	/**
+	 * Returns whether all messages written so far have been written
+	 * to the file descriptor.
+	 */
+	bool flushed() const {
+		return output.flushed();
+	}
+
+	int getFd() const {
+		return input.getFd();
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_MESSAGE_CHANNEL_H_ */
@@ -33,6 +33,7 @@
 #include <oxt/backtrace.hpp>
 #include <oxt/macros.hpp>
 #include <vector>
+#include <algorithm>
 #include <new>
 #include <ev++.h>
 
@@ -56,12 +57,15 @@
 #include <ServerKit/Hooks.h>
 #include <ServerKit/Client.h>
 #include <ServerKit/ClientRef.h>
+#include <ServerKit/Tls.h>
+#include <ServerKit/AutoTuner.h>
 #include <Algorithms/MovingAverage.h>
 #include <Utils.h>
 #include <Utils/ScopeGuard.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/IOUtils.h>
 #include <Utils/SystemTime.h>
+#include <Utils/JsonWriter.h>
 
 namespace Passenger {
 namespace ServerKit {
@@ -177,6 +181,13 @@ using namespace oxt;
  * accepting new clients for a few seconds so that doesn't keep triggering the error
  * in a busy loop.
  *
+ * ### Auto-tuning
+ *
+ * If `autoTune` is set, the accept burst size and the client freelist sizes
+ * are adjusted on every statistics update, based on the accept queue length,
+ * the event loop lag and how often client objects had to be allocated.
+ * See AutoTuner for the policy.
+ *
  * ### Logging
  *
  * Provides basic logging macros that also log the client name.
@@ -205,9 +216,13 @@ public:
 	/***** Configuration *****/
 	unsigned int acceptBurstCount: 7;
 	bool startReadingAfterAccept: 1;
+	bool autoTune: 1;
 	unsigned int minSpareClients: 12;
 	unsigned int clientFreelistLimit: 12;
 	Callback shutdownFinishCallback;
+	// If set, clients are served over TLS. May be shared with servers
+	// in other threads. Must be set before listening.
+	TlsContextPtr tlsContext;
 
 	/***** Working state and statistics (do not modify) *****/
 	State serverState;
@@ -216,6 +231,7 @@ public:
 	unsigned int freeClientCount, activeClientCount, disconnectedClientCount;
 	unsigned int peakActiveClientCount;
 	unsigned long totalClientsAccepted, lastTotalClientsAccepted;
+	unsigned long totalClientsTimedOut;
 	unsigned long long totalBytesConsumed;
 	ev_tstamp lastStatisticsUpdateTime;
 	double clientAcceptSpeed1m, clientAcceptSpeed1h;
@@ -227,6 +243,9 @@ private:
 	bool accept4Available: 1;
 	ev::timer acceptResumptionWatcher;
 	ev::timer statisticsUpdateWatcher;
+	ev_tstamp nextStatisticsUpdateTime;
+	AutoTuner autoTuner;
+	AutoTunerSample autoTunerSample;
 	ev::io endpoints[SERVER_KIT_MAX_SERVER_ENDPOINTS];
 
 
@@ -269,6 +288,10 @@ private:
 			guard.clear();
 		}
 
+		autoTunerSample.acceptEvents++;
+		if (acceptCount == acceptBurstCount) {
+			autoTunerSample.fullAcceptBursts++;
+		}
 		if (acceptCount > 0) {
 			SKS_DEBUG(acceptCount << " new client(s) accepted; there are now " <<
 				activeClientCount << " active client(s)");
@@ -343,12 +366,76 @@ private:
 
 	void onStatisticsUpdateTimeout(ev::timer &timer, int revents) {
 		TRACE_POINT();
+		ev_tstamp now = ev_now(this->getLoop());
+
+		// The first timeout may be late because the loop was started after
+		// the timer, so we don't measure the loop lag until the second one.
+		if (nextStatisticsUpdateTime != 0) {
+			autoTunerSample.loopLag = std::max<double>(now - nextStatisticsUpdateTime, 0);
+		}
 
 		this->onUpdateStatistics();
 		this->onFinalizeStatisticsUpdate();
 
-		timer.repeat = timeToNextMultipleD(5, ev_now(this->getLoop()));
+		timer.repeat = timeToNextMultipleD(5, now);
 		timer.again();
+		nextStatisticsUpdateTime = now + timer.repeat;
+	}
+
+	/**
+	 * Returns the total number of clients waiting in the accept queues of
+	 * the server sockets, or -1 if that can't be determined (e.g. for Unix
+	 * domain sockets, or if clients are fed by an AcceptLoadBalancer).
+	 */
+	int getBacklogDepth() const {
+		int result = -1;
+
+		#if defined(__linux__) && defined(TCP_INFO)
+			for (uint8_t i = 0; i < nEndpoints; i++) {
+				struct tcp_info info;
+				socklen_t len = sizeof(info);
+
+				// For listening sockets, Linux reports the
+				// accept queue length in tcpi_unacked.
+				if (getsockopt(endpoints[i].fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+					result = std::max(result, 0) + (int) info.tcpi_unacked;
+				}
+			}
+		#endif
+
+		return result;
+	}
+
+	void runAutoTuner() {
+		autoTunerSample.backlogDepth = getBacklogDepth();
+		if (!autoTuner.update(acceptBurstCount, minSpareClients, clientFreelistLimit,
+			autoTunerSample))
+		{
+			return;
+		}
+
+		SKS_DEBUG("Auto-tuner: accept burst count " << acceptBurstCount
+			<< " -> " << autoTuner.acceptBurstCount
+			<< ", min spare clients " << minSpareClients
+			<< " -> " << autoTuner.minSpareClients
+			<< ", client freelist limit " << clientFreelistLimit
+			<< " -> " << autoTuner.clientFreelistLimit);
+		acceptBurstCount = autoTuner.acceptBurstCount;
+		minSpareClients = autoTuner.minSpareClients;
+		clientFreelistLimit = autoTuner.clientFreelistLimit;
+		trimFreelist();
+		createSpareClients();
+	}
+
+	// Destroys free client objects until the freelist is within its limit.
+	void trimFreelist() {
+		while (freeClientCount > clientFreelistLimit) {
+			Client *client = STAILQ_FIRST(&freeClients);
+			P_ASSERT_EQ(client->getConnState(), Client::IN_FREELIST);
+			freeClientCount--;
+			STAILQ_REMOVE_HEAD(&freeClients, nextClient.freeClient);
+			delete client;
+		}
 	}
 
 	unsigned int getNextClientNumber() {
@@ -360,6 +447,7 @@ private:
 		if (!STAILQ_EMPTY(&freeClients)) {
 			return checkoutClientObjectFromFreelist();
 		} else {
+			autoTunerSample.clientsAllocated++;
 			return createNewClientObject();
 		}
 	}
@@ -403,6 +491,7 @@ private:
 		} else {
 			SKC_TRACE(client, 3, "Client object destroyed; not added to freelist " <<
 				"because it's full (" << freeClientCount << ")");
+			autoTunerSample.clientsDestroyed++;
 			delete client;
 		}
 
@@ -511,6 +600,12 @@ private:
 		server->onClientOutputError(client, errcode);
 	}
 
+	static void _onClientTimeout(TimerWheelEntry *entry) {
+		Client *client = static_cast<Client *>(static_cast<BaseClient *>(entry->data));
+		BaseServer *server = getServerFromClient(client);
+		server->onClientTimeout(client);
+	}
+
 protected:
 	/***** Hooks *****/
 
@@ -527,6 +622,9 @@ protected:
 		client->output.setContext(ctx);
 		client->output.setHooks(&client->hooks);
 		client->output.errorCallback = _onClientOutputError;
+
+		client->timeoutTimer.callback = _onClientTimeout;
+		client->timeoutTimer.data = static_cast<BaseClient *>(client);
 	}
 
 	virtual void onClientsAccepted(Client **clients, unsigned int size) {
@@ -577,6 +675,15 @@ protected:
 		return Channel::Result(0, true);
 	}
 
+	/**
+	 * Called when the timeout that was set with setClientTimeout() expires.
+	 */
+	virtual void onClientTimeout(Client *client) {
+		SKC_DEBUG(client, "Disconnecting client because it timed out");
+		totalClientsTimedOut++;
+		disconnect(&client);
+	}
+
 	virtual void onClientOutputError(Client *client, int errcode) {
 		SKC_LOG_EVENT(DerivedServer, client, "onClientOutputError");
 		char message[1024];
@@ -609,11 +716,16 @@ protected:
 		clientAcceptSpeed1h = expMovingAverage(clientAcceptSpeed1h,
 			(totalClientsAccepted - lastTotalClientsAccepted) / duration,
 			0.0041520953856636345);
+
+		if (autoTune) {
+			runAutoTuner();
+		}
 	}
 
 	virtual void onFinalizeStatisticsUpdate() {
 		lastTotalClientsAccepted = totalClientsAccepted;
 		lastStatisticsUpdateTime = ev_now(this->getLoop());
+		autoTunerSample = AutoTunerSample();
 	}
 
 	virtual void reinitializeClient(Client *client, int fd) {
@@ -621,11 +733,21 @@ protected:
 		SKC_TRACE(client, 2, "Client associated with file descriptor: " << fd);
 		client->input.reinitialize(fd);
 		client->output.reinitialize(fd);
+		if (tlsContext != NULL) {
+			client->tlsSession = tlsContext->createSession(fd);
+			client->input.setTlsSession(client->tlsSession);
+			client->output.setTlsSession(client->tlsSession);
+		}
 	}
 
 	virtual void deinitializeClient(Client *client) {
+		ctx->timerWheel.cancel(&client->timeoutTimer);
 		client->input.deinitialize();
 		client->output.deinitialize();
+		if (client->tlsSession != NULL) {
+			tlsCloseSession(client->tlsSession);
+			client->tlsSession = NULL;
+		}
 	}
 
 	virtual void onShutdown(bool forceDisconnect) {
@@ -638,6 +760,7 @@ public:
 	BaseServer(Context *context)
 		: acceptBurstCount(32),
 		  startReadingAfterAccept(true),
+		  autoTune(false),
 		  minSpareClients(0),
 		  clientFreelistLimit(0),
 		  shutdownFinishCallback(NULL),
@@ -648,6 +771,7 @@ public:
 		  peakActiveClientCount(0),
 		  totalClientsAccepted(0),
 		  lastTotalClientsAccepted(0),
+		  totalClientsTimedOut(0),
 		  totalBytesConsumed(0),
 		  lastStatisticsUpdateTime(ev_time()),
 		  clientAcceptSpeed1m(-1),
@@ -655,7 +779,8 @@ public:
 		  ctx(context),
 		  nextClientNumber(1),
 		  nEndpoints(0),
-		  accept4Available(true)
+		  accept4Available(true),
+		  nextStatisticsUpdateTime(0)
 	{
 		STAILQ_INIT(&freeClients);
 		TAILQ_INIT(&activeClients);
@@ -683,9 +808,13 @@ public:
 
 	// Pre-create multiple client objects so that they get allocated
 	// near each other in memory. Hopefully increases CPU cache locality.
-	void createSpareClients() {
-		for (unsigned int i = 0; i < minSpareClients; i++) {
+	// Tops up the freelist to `minSpareClients` objects.
+	virtual void createSpareClients() {
+		while (freeClientCount < minSpareClients) {
 			Client *client = createNewClientObject();
+			if (client == NULL) {
+				break;
+			}
 			client->setConnState(Client::IN_FREELIST);
 			STAILQ_INSERT_HEAD(&freeClients, client, nextClient.freeClient);
 			freeClientCount++;
@@ -995,6 +1124,24 @@ public:
 		disconnect(client);
 	}
 
+	/**
+	 * Calls onClientTimeout() once `timeout` seconds have passed, unless
+	 * this is called again for the same client before that, or the client
+	 * disconnects. A `timeout` of 0 cancels the timeout. Timeouts are
+	 * coarse: they may expire up to a second late.
+	 */
+	void setClientTimeout(Client *client, ev_tstamp timeout) {
+		if (timeout > 0) {
+			ctx->timerWheel.schedule(&client->timeoutTimer, timeout);
+		} else {
+			ctx->timerWheel.cancel(&client->timeoutTimer);
+		}
+	}
+
+	void cancelClientTimeout(Client *client) {
+		ctx->timerWheel.cancel(&client->timeoutTimer);
+	}
+
 
 	/***** Introspection *****/
 
@@ -1019,16 +1166,26 @@ public:
 
 	virtual void configure(const Json::Value &doc) {
 		if (doc.isMember("accept_burst_count")) {
-			acceptBurstCount = doc["accept_burst_count"].asUInt();
+			// acceptBurstCount is a 7-bit field.
+			acceptBurstCount = std::max(1u, std::min(doc["accept_burst_count"].asUInt(), 127u));
+			autoTuner.reset();
 		}
 		if (doc.isMember("start_reading_after_accept")) {
 			startReadingAfterAccept = doc["start_reading_after_accept"].asBool();
 		}
 		if (doc.isMember("min_spare_clients")) {
-			minSpareClients = doc["min_spare_clients"].asUInt();
+			// minSpareClients and clientFreelistLimit are 12-bit fields.
+			minSpareClients = std::min(doc["min_spare_clients"].asUInt(), 4095u);
+			createSpareClients();
+			autoTuner.reset();
 		}
 		if (doc.isMember("client_freelist_limit")) {
-			clientFreelistLimit = doc["client_freelist_limit"].asUInt();
+			clientFreelistLimit = std::min(doc["client_freelist_limit"].asUInt(), 4095u);
+			autoTuner.reset();
+		}
+		if (doc.isMember("auto_tune")) {
+			autoTune = doc["auto_tune"].asBool();
+			autoTuner.reset();
 		}
 	}
 
@@ -1038,62 +1195,118 @@ public:
 		doc["start_reading_after_accept"] = startReadingAfterAccept;
 		doc["min_spare_clients"] = minSpareClients;
 		doc["client_freelist_limit"] = clientFreelistLimit;
+		doc["auto_tune"] = autoTune;
 		return doc;
 	}
 
-	virtual Json::Value inspectStateAsJson() const {
-		Json::Value doc = ctx->inspectStateAsJson();
+	/**
+	 * Returns the server state as a Json::Value. This is convenient for
+	 * tests and debugging, but builds a tree of the entire state, which can
+	 * be large when there are many clients. Use writeStateAsJson() to
+	 * produce the state as text.
+	 */
+	Json::Value inspectStateAsJson() const {
+		string str = inspectStateAsJsonString();
+		Json::Value doc;
+		Json::Reader reader;
+		if (!reader.parse(str, doc, false)) {
+			throw RuntimeException("Cannot parse server state JSON: "
+				+ reader.getFormattedErrorMessages());
+		}
+		return doc;
+	}
+
+	/** Returns the server state as an indented JSON document. */
+	string inspectStateAsJsonString() const {
+		string str;
+		JsonWriter writer(str);
+		writer.beginObject();
+		writeStateAsJson(writer);
+		writer.endObject();
+		str.append("\n", 1);
+		return str;
+	}
+
+	/**
+	 * Writes the server state as members of the JSON object that `writer`
+	 * is currently writing. Subclasses that override this must call
+	 * the parent class's implementation.
+	 */
+	virtual void writeStateAsJson(JsonWriter &writer) const {
 		const Client *client;
 
-		doc["pid"] = (unsigned int) getpid();
-		doc["server_state"] = getServerStateString();
-		doc["free_client_count"] = freeClientCount;
-		Json::Value &activeClientsDoc = doc["active_clients"] = Json::Value(Json::objectValue);
-		doc["active_client_count"] = activeClientCount;
-		Json::Value &disconnectedClientsDoc = doc["disconnected_clients"] = Json::Value(Json::objectValue);
-		doc["disconnected_client_count"] = disconnectedClientCount;
-		doc["peak_active_client_count"] = peakActiveClientCount;
-		doc["client_accept_speed"]["1m"] = averageSpeedToJson(
+		writer.members(ctx->inspectStateAsJson());
+		writer.member("pid", (unsigned int) getpid());
+		writer.member("server_state", getServerStateString());
+		writer.member("free_client_count", freeClientCount);
+		writer.member("active_client_count", activeClientCount);
+		writer.member("disconnected_client_count", disconnectedClientCount);
+		writer.member("peak_active_client_count", peakActiveClientCount);
+		writer.key("client_accept_speed");
+		writer.beginObject();
+		writer.member("1m", averageSpeedToJson(
 			capFloatPrecision(clientAcceptSpeed1m * 60),
-			"minute", "1 minute", -1);
-		doc["client_accept_speed"]["1h"] = averageSpeedToJson(
+			"minute", "1 minute", -1));
+		writer.member("1h", averageSpeedToJson(
 			capFloatPrecision(clientAcceptSpeed1h * 60),
-			"minute", "1 hour", -1);
-		doc["total_clients_accepted"] = (Json::UInt64) totalClientsAccepted;
-		doc["total_bytes_consumed"] = (Json::UInt64) totalBytesConsumed;
+			"minute", "1 hour", -1));
+		writer.endObject();
+		writer.member("total_clients_accepted", (unsigned long long) totalClientsAccepted);
+		writer.member("total_clients_timed_out", (unsigned long long) totalClientsTimedOut);
+		writer.member("total_bytes_consumed", (unsigned long long) totalBytesConsumed);
+		if (tlsContext != NULL) {
+			writer.member("tls", tlsContext->inspectStateAsJson());
+		}
+		if (autoTune) {
+			writer.key("auto_tuner");
+			writer.beginObject();
+			writer.member("accept_burst_count", acceptBurstCount);
+			writer.member("min_spare_clients", minSpareClients);
+			writer.member("client_freelist_limit", clientFreelistLimit);
+			autoTuner.writeStateAsJson(writer);
+			writer.endObject();
+		}
 
+		writer.key("active_clients");
+		writer.beginObject();
 		TAILQ_FOREACH (client, &activeClients, nextClient.activeOrDisconnectedClient) {
-			Json::Value subdoc;
 			char clientName[16];
 
 			getClientName(client, clientName, sizeof(clientName));
-			activeClientsDoc[clientName] = inspectClientStateAsJson(client);
+			writer.key(clientName);
+			writer.beginObject();
+			writeClientStateAsJson(writer, client);
+			writer.endObject();
 		}
+		writer.endObject();
 
+		writer.key("disconnected_clients");
+		writer.beginObject();
 		TAILQ_FOREACH (client, &disconnectedClients, nextClient.activeOrDisconnectedClient) {
-			Json::Value subdoc;
 			char clientName[16];
 
 			getClientName(client, clientName, sizeof(clientName));
-			disconnectedClientsDoc[clientName] = inspectClientStateAsJson(client);
+			writer.key(clientName);
+			writer.beginObject();
+			writeClientStateAsJson(writer, client);
+			writer.endObject();
 		}
-
-		return doc;
+		writer.endObject();
 	}
 
-	virtual Json::Value inspectClientStateAsJson(const Client *client) const {
-		Json::Value doc;
+	virtual void writeClientStateAsJson(JsonWriter &writer, const Client *client) const {
 		char clientName[16];
 
 		assert(client->getConnState() != Client::IN_FREELIST);
 		getClientName(client, clientName, sizeof(clientName));
-		doc["connection_state"] = client->getConnStateString();
-		doc["name"] = clientName;
-		doc["number"] = client->number;
-		doc["refcount"] = client->refcount.load(boost::memory_order_relaxed);
-		doc["output_channel_state"] = client->output.inspectAsJson();
-
-		return doc;
+		writer.member("connection_state", client->getConnStateString());
+		writer.member("name", (const char *) clientName);
+		writer.member("number", client->number);
+		writer.member("refcount", client->refcount.load(boost::memory_order_relaxed));
+		writer.key("output_channel_state");
+		writer.beginObject();
+		client->output.writeStateAsJson(writer);
+		writer.endObject();
 	}
 
 
@@ -0,0 +1,303 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_
+#define _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <ev.h>
+
+namespace Passenger {
+namespace ServerKit {
+
+
+struct TimerWheelLink {
+	TimerWheelLink *prev;
+	TimerWheelLink *next;
+};
+
+/**
+ * A timer that can be scheduled on a TimerWheel. Embed it in the object
+ * that the timer belongs to, and set `callback` and `data` before
+ * scheduling it.
+ */
+struct TimerWheelEntry: public TimerWheelLink {
+	typedef void (*Callback)(TimerWheelEntry *entry);
+
+	/** The tick at which this entry expires. */
+	boost::uint64_t expiry;
+	Callback callback;
+	void *data;
+
+	TimerWheelEntry()
+		: expiry(0),
+		  callback(NULL),
+		  data(NULL)
+	{
+		prev = NULL;
+		next = NULL;
+	}
+
+	bool isScheduled() const {
+		return next != NULL;
+	}
+};
+
+/**
+ * A hierarchical timer wheel, for large numbers of coarse timeouts that are
+ * rescheduled much more often than they expire, such as client inactivity
+ * timeouts. Unlike libev timers, which live in a heap, scheduling and
+ * cancelling an entry take constant time, and it only wakes up the event
+ * loop once per tick no matter how many entries there are.
+ *
+ * Time is divided into ticks of `resolution` seconds. Level 0 has a slot for
+ * each of the next SLOTS_PER_LEVEL ticks, level 1 a slot for each range of
+ * SLOTS_PER_LEVEL ticks after that, and so on. Whenever level 0 wraps
+ * around, the entries in the next slot of level 1 are redistributed over
+ * level 0, and so forth. Entries therefore expire up to one tick late, but
+ * never early.
+ *
+ * Not thread-safe: may only be used from the event loop thread.
+ */
+class TimerWheel: public boost::noncopyable {
+public:
+	static const unsigned int LEVEL_BITS = 6;
+	static const unsigned int SLOTS_PER_LEVEL = 1 << LEVEL_BITS;
+	static const unsigned int LEVELS = 4;
+	// 2^24 ticks, a bit over 194 days at a resolution of 1 second.
+	static const boost::uint64_t MAX_TICKS =
+		(boost::uint64_t) 1 << (LEVEL_BITS * LEVELS);
+
+private:
+	struct ev_loop *loop;
+	ev_timer timer;
+	ev_tstamp resolution;
+	/** The tick whose level 0 slot will be processed next. */
+	boost::uint64_t currentTick;
+	unsigned int count;
+	TimerWheelLink slots[LEVELS][SLOTS_PER_LEVEL];
+
+	static void onTimeout(EV_P_ ev_timer *timer, int revents) {
+		TimerWheel *self = static_cast<TimerWheel *>(timer->data);
+		self->advanceTo(self->getNowTick());
+	}
+
+	static void initList(TimerWheelLink *head) {
+		head->prev = head;
+		head->next = head;
+	}
+
+	static void unlink(TimerWheelLink *link) {
+		link->prev->next = link->next;
+		link->next->prev = link->prev;
+		link->prev = NULL;
+		link->next = NULL;
+	}
+
+	static void append(TimerWheelLink *head, TimerWheelLink *link) {
+		link->prev = head->prev;
+		link->next = head;
+		head->prev->next = link;
+		head->prev = link;
+	}
+
+	/** Moves all entries in `from` to the (empty) list `to`. */
+	static void takeOver(TimerWheelLink *from, TimerWheelLink *to) {
+		if (from->next == from) {
+			initList(to);
+		} else {
+			to->next = from->next;
+			to->prev = from->prev;
+			to->next->prev = to;
+			to->prev->next = to;
+			initList(from);
+		}
+	}
+
+	static unsigned int slotIndex(boost::uint64_t tick, unsigned int level) {
+		return (unsigned int) (tick >> (LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+	}
+
+	void insert(TimerWheelEntry *entry) {
+		boost::uint64_t delta;
+		unsigned int level;
+
+		if (entry->expiry < currentTick) {
+			entry->expiry = currentTick;
+		}
+		delta = entry->expiry - currentTick;
+		if (delta >= MAX_TICKS) {
+			entry->expiry = currentTick + MAX_TICKS - 1;
+			delta = MAX_TICKS - 1;
+		}
+		for (level = 0; level < LEVELS - 1; level++) {
+			if (delta < ((boost::uint64_t) 1 << (LEVEL_BITS * (level + 1)))) {
+				break;
+			}
+		}
+		append(&slots[level][slotIndex(entry->expiry, level)], entry);
+	}
+
+	/**
+	 * Redistributes the entries in the given slot over the lower levels.
+	 * Returns the slot index, so that the caller knows whether this level
+	 * wrapped around too.
+	 */
+	unsigned int cascade(unsigned int level) {
+		unsigned int index = slotIndex(currentTick, level);
+		TimerWheelLink list;
+
+		takeOver(&slots[level][index], &list);
+		while (list.next != &list) {
+			TimerWheelEntry *entry = static_cast<TimerWheelEntry *>(list.next);
+			unlink(entry);
+			insert(entry);
+		}
+		return index;
+	}
+
+	void tick() {
+		unsigned int index = slotIndex(currentTick, 0);
+		TimerWheelLink list;
+
+		if (index == 0) {
+			for (unsigned int level = 1; level < LEVELS; level++) {
+				if (cascade(level) != 0) {
+					break;
+				}
+			}
+		}
+
+		takeOver(&slots[0][index], &list);
+		currentTick++;
+
+		// The callbacks may schedule and cancel entries, including
+		// the ones that are still in `list`.
+		while (list.next != &list) {
+			TimerWheelEntry *entry = static_cast<TimerWheelEntry *>(list.next);
+			unlink(entry);
+			count--;
+			entry->callback(entry);
+		}
+	}
+
+	void startTimerIfNecessary() {
+		if (!ev_is_active(&timer)) {
+			currentTick = getNowTick();
+			ev_timer_set(&timer, resolution, resolution);
+			ev_timer_start(loop, &timer);
+		}
+	}
+
+public:
+	/** `resolution` is the length of a tick, in seconds. */
+	TimerWheel(struct ev_loop *_loop, ev_tstamp _resolution = 1)
+		: loop(_loop),
+		  resolution(_resolution),
+		  currentTick(0),
+		  count(0)
+	{
+		for (unsigned int level = 0; level < LEVELS; level++) {
+			for (unsigned int i = 0; i < SLOTS_PER_LEVEL; i++) {
+				initList(&slots[level][i]);
+			}
+		}
+		ev_timer_init(&timer, onTimeout, resolution, resolution);
+		timer.data = this;
+	}
+
+	~TimerWheel() {
+		if (ev_is_active(&timer)) {
+			ev_timer_stop(loop, &timer);
+		}
+	}
+
+	/**
+	 * Schedules `entry` to expire `timeout` seconds from now, rounded up
+	 * to the next tick. If it was already scheduled, it is rescheduled.
+	 */
+	void schedule(TimerWheelEntry *entry, ev_tstamp timeout) {
+		assert(entry->callback != NULL);
+		startTimerIfNecessary();
+		if (entry->isScheduled()) {
+			unlink(entry);
+		} else {
+			count++;
+		}
+		entry->expiry = (boost::uint64_t) std::ceil((ev_now(loop) + timeout) / resolution);
+		insert(entry);
+	}
+
+	/** Does nothing if `entry` isn't scheduled. */
+	void cancel(TimerWheelEntry *entry) {
+		if (entry->isScheduled()) {
+			unlink(entry);
+			count--;
+			if (count == 0) {
+				ev_timer_stop(loop, &timer);
+			}
+		}
+	}
+
+	/**
+	 * Expires all entries that are due at or before the given tick. Called
+	 * every `resolution` seconds by the wheel's own libev timer.
+	 */
+	void advanceTo(boost::uint64_t target) {
+		while (currentTick <= target && count > 0) {
+			tick();
+		}
+		if (count == 0) {
+			ev_timer_stop(loop, &timer);
+		}
+	}
+
+	boost::uint64_t getNowTick() const {
+		return (boost::uint64_t) (ev_now(loop) / resolution);
+	}
+
+	boost::uint64_t getCurrentTick() const {
+		return currentTick;
+	}
+
+	ev_tstamp getResolution() const {
+		return resolution;
+	}
+
+	/** Returns the number of scheduled entries. */
+	unsigned int size() const {
+		return count;
+	}
+};
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_TIMER_WHEEL_H_ */
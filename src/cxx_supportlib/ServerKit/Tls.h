@@ -0,0 +1,360 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2015 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SERVER_KIT_TLS_H_
+#define _PASSENGER_SERVER_KIT_TLS_H_
+
+#include <boost/predef.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <new>
+#include <cerrno>
+#include <cstddef>
+#include <sys/types.h>
+#include <jsoncpp/json.h>
+#include <Exceptions.h>
+#include <Constants.h>
+
+// The Crypto module uses the Security framework on macOS, so OpenSSL
+// isn't linked there, and TLS termination is only available elsewhere.
+#if !BOOST_OS_MACOS
+	#define SERVER_KIT_SUPPORTS_TLS
+	#include <openssl/ssl.h>
+	#include <openssl/err.h>
+#endif
+
+extern "C" {
+	struct ssl_st;
+}
+
+namespace Passenger {
+namespace ServerKit {
+
+using namespace std;
+
+
+/**
+ * A TLS connection of a client. Owned by the client object; the client
+ * channels perform their I/O through it with tlsRead() and tlsWrite().
+ */
+typedef struct ssl_st TlsSession;
+
+
+/**
+ * Server-side TLS configuration: the certificate, key, and session
+ * resumption state. One TlsContext is meant to be shared by all servers
+ * that listen on behalf of the same sockets, even if they run in different
+ * threads, so that they share a single session cache and session ticket
+ * keys. Clients can then resume their session no matter which thread
+ * accepts their next connection.
+ */
+class TlsContext: public boost::noncopyable {
+public:
+	struct Config {
+		string certificateFile;
+		string certificateKeyFile;
+		// Maximum number of sessions in the session cache.
+		unsigned int sessionCacheSize;
+		// In seconds. Applies to session IDs and session tickets alike.
+		unsigned int sessionTimeout;
+		bool sessionTickets;
+		// Whether to let the kernel perform record encryption and
+		// decryption, if both the kernel and OpenSSL support it.
+		bool kernelTls;
+
+		Config()
+			: sessionCacheSize(DEFAULT_TLS_SESSION_CACHE_SIZE),
+			  sessionTimeout(DEFAULT_TLS_SESSION_TIMEOUT),
+			  sessionTickets(true),
+			  kernelTls(false)
+			{ }
+	};
+
+private:
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		SSL_CTX *ctx;
+
+		static string getErrorQueueDescription() {
+			string result;
+			unsigned long e;
+			char buf[256];
+
+			while ((e = ERR_get_error()) != 0) {
+				ERR_error_string_n(e, buf, sizeof(buf));
+				if (!result.empty()) {
+					result.append("; ");
+				}
+				result.append(buf);
+			}
+			if (result.empty()) {
+				result = "unknown error";
+			}
+			return result;
+		}
+
+		void configure(const Config &config) {
+			static const unsigned char sessionIdContext[] = "Passenger";
+
+			#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+				SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+			#else
+				SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3
+					| SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
+			#endif
+			SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+			#ifdef SSL_OP_NO_RENEGOTIATION
+				// The client channels never retry a write because a read is
+				// necessary, so renegotiation must not happen.
+				SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION);
+			#endif
+			if (!config.sessionTickets) {
+				SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+			}
+			#ifdef SSL_OP_ENABLE_KTLS
+				if (config.kernelTls) {
+					SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+				}
+			#endif
+
+			// The output channel may retry a write with a different
+			// buffer that starts with the same data.
+			SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+				| SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+				| SSL_MODE_RELEASE_BUFFERS);
+
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(ctx, config.sessionCacheSize);
+			SSL_CTX_set_timeout(ctx, config.sessionTimeout);
+			SSL_CTX_set_session_id_context(ctx, sessionIdContext,
+				sizeof(sessionIdContext) - 1);
+
+			if (SSL_CTX_use_certificate_chain_file(ctx,
+				config.certificateFile.c_str()) != 1)
+			{
+				throw ConfigurationException("Cannot load TLS certificate "
+					+ config.certificateFile + ": " + getErrorQueueDescription());
+			}
+			if (SSL_CTX_use_PrivateKey_file(ctx, config.certificateKeyFile.c_str(),
+				SSL_FILETYPE_PEM) != 1)
+			{
+				throw ConfigurationException("Cannot load TLS certificate key "
+					+ config.certificateKeyFile + ": " + getErrorQueueDescription());
+			}
+			if (SSL_CTX_check_private_key(ctx) != 1) {
+				throw ConfigurationException("TLS certificate key "
+					+ config.certificateKeyFile + " does not match certificate "
+					+ config.certificateFile);
+			}
+		}
+	#endif
+
+public:
+	/**
+	 * @throws ConfigurationException The certificate or key cannot be
+	 *     loaded, or this platform doesn't support TLS.
+	 */
+	TlsContext(const Config &config) {
+		#ifdef SERVER_KIT_SUPPORTS_TLS
+			#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+				ctx = SSL_CTX_new(TLS_server_method());
+			#else
+				ctx = SSL_CTX_new(SSLv23_server_method());
+			#endif
+			if (ctx == NULL) {
+				throw ConfigurationException("Cannot create a TLS context: "
+					+ getErrorQueueDescription());
+			}
+			try {
+				configure(config);
+			} catch (...) {
+				SSL_CTX_free(ctx);
+				throw;
+			}
+		#else
+			throw ConfigurationException("TLS is not supported on this platform");
+		#endif
+	}
+
+	~TlsContext() {
+		#ifdef SERVER_KIT_SUPPORTS_TLS
+			SSL_CTX_free(ctx);
+		#endif
+	}
+
+	/**
+	 * Creates a TLS connection in server mode on the given non-blocking
+	 * socket. The handshake is performed by the first tlsRead() calls.
+	 *
+	 * @throws std::bad_alloc
+	 */
+	TlsSession *createSession(int fd) {
+		#ifdef SERVER_KIT_SUPPORTS_TLS
+			SSL *ssl = SSL_new(ctx);
+			if (ssl == NULL) {
+				ERR_clear_error();
+				throw std::bad_alloc();
+			}
+			if (SSL_set_fd(ssl, fd) != 1) {
+				ERR_clear_error();
+				SSL_free(ssl);
+				throw std::bad_alloc();
+			}
+			SSL_set_accept_state(ssl);
+			return ssl;
+		#else
+			throw std::bad_alloc();
+		#endif
+	}
+
+	Json::Value inspectStateAsJson() const {
+		Json::Value doc;
+		#ifdef SERVER_KIT_SUPPORTS_TLS
+			doc["session_cache_size"] = (Json::Int64) SSL_CTX_sess_number(ctx);
+			doc["session_cache_limit"] = (Json::Int64) SSL_CTX_sess_get_cache_size(ctx);
+			doc["handshakes"] = (Json::Int64) SSL_CTX_sess_accept_good(ctx);
+			doc["resumed_sessions"] = (Json::Int64) SSL_CTX_sess_hits(ctx);
+			doc["session_cache_misses"] = (Json::Int64) SSL_CTX_sess_misses(ctx);
+			doc["session_cache_timeouts"] = (Json::Int64) SSL_CTX_sess_timeouts(ctx);
+		#endif
+		return doc;
+	}
+};
+
+typedef boost::shared_ptr<TlsContext> TlsContextPtr;
+
+
+#ifdef SERVER_KIT_SUPPORTS_TLS
+	inline ssize_t
+	_tlsTranslateResult(SSL *ssl, int ret) {
+		if (ret > 0) {
+			return ret;
+		}
+
+		int e = errno;
+		switch (SSL_get_error(ssl, ret)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_SYSCALL:
+			ERR_clear_error();
+			if (e == 0) {
+				// The peer closed the connection without a close_notify.
+				return 0;
+			}
+			errno = e;
+			return -1;
+		default:
+			ERR_clear_error();
+			errno = EPROTO;
+			return -1;
+		}
+	}
+#endif
+
+/**
+ * Like read(), but through a TLS connection. Returns -1 with errno set to
+ * EAGAIN if the operation can't progress until the socket becomes readable,
+ * or writable if tlsWantsWrite() returns true.
+ */
+inline ssize_t
+tlsRead(TlsSession *session, void *buf, size_t size) {
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		ERR_clear_error();
+		errno = 0;
+		return _tlsTranslateResult(session, SSL_read(session, buf, size));
+	#else
+		errno = ENOSYS;
+		return -1;
+	#endif
+}
+
+/**
+ * Like write(), but through a TLS connection. Returns -1 with errno set to
+ * EAGAIN if the socket isn't writable. A retry after EAGAIN must pass a
+ * buffer that starts with the same data, and is at least as large.
+ */
+inline ssize_t
+tlsWrite(TlsSession *session, const void *buf, size_t size) {
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		ERR_clear_error();
+		errno = 0;
+		return _tlsTranslateResult(session, SSL_write(session, buf, size));
+	#else
+		errno = ENOSYS;
+		return -1;
+	#endif
+}
+
+/**
+ * Whether the last tlsRead() returned EAGAIN because the TLS connection has
+ * to write to the socket first, which happens during the handshake.
+ */
+inline bool
+tlsWantsWrite(TlsSession *session) {
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		return SSL_want_write(session);
+	#else
+		return false;
+	#endif
+}
+
+/**
+ * Whether the TLS connection has decrypted data that tlsRead() can return
+ * without reading from the socket. The socket does not become readable for
+ * that data, so readers must check this before waiting for readability.
+ */
+inline bool
+tlsHasPendingData(TlsSession *session) {
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		return SSL_pending(session) > 0;
+	#else
+		return false;
+	#endif
+}
+
+/**
+ * Sends a close_notify if the handshake has completed (without waiting for
+ * the peer's), and frees the session. The socket is left open.
+ */
+inline void
+tlsCloseSession(TlsSession *session) {
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		if (SSL_is_init_finished(session)) {
+			SSL_shutdown(session);
+		}
+		ERR_clear_error();
+		SSL_free(session);
+	#endif
+}
+
+
+} // namespace ServerKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SERVER_KIT_TLS_H_ */
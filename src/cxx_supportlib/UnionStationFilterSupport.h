@@ -34,13 +34,11 @@
 
 #include <string>
 #include <set>
-// Checking for _PCREPOSIX_H avoids conflicts with headers provided by Apache.
-// https://code.google.com/p/phusion-passenger/issues/detail?id=651
-#ifndef _PCREPOSIX_H
-	#include <boost/regex.h>
-#endif
+#include <vector>
+#include <boost/regex.hpp>
 #include <cstdio>
 #include <cstring>
+#include <cassert>
 #include <string.h>
 #include <stdlib.h>
 
@@ -486,7 +484,9 @@ public:
 		RESPONSE_TIME_WITHOUT_GC,
 		STATUS,
 		STATUS_CODE,
-		GC_TIME
+		GC_TIME,
+
+		FIELD_COUNT
 	};
 
 	virtual ~Context() { }
@@ -844,9 +844,40 @@ private:
 	typedef boost::shared_ptr<Comparison> ComparisonPtr;
 	typedef boost::shared_ptr<FunctionCall> FunctionCallPtr;
 
+	enum Opcode {
+		/** result = a, converted to a boolean. */
+		LOAD_BOOLEAN,
+		/** result = a matches (or doesn't match) the regexp in b. */
+		MATCH_REGEXP,
+		/** result = a <comparator> b, with a and b being strings. */
+		COMPARE_STRING,
+		/** result = a <comparator> b, with a and b being integers. */
+		COMPARE_INTEGER,
+		/** result = a <comparator> b, with a and b being booleans. */
+		COMPARE_BOOLEAN,
+		/** result = starts_with(a, b) */
+		STARTS_WITH,
+		/** result = has_hint(a) */
+		HAS_HINT,
+		/** result = !result */
+		NOT,
+		/** Continue at 'target' if result is false. */
+		JUMP_IF_FALSE,
+		/** Continue at 'target' if result is true. */
+		JUMP_IF_TRUE
+	};
+
+	struct Instruction;
+	class Evaluation;
+
+	/**
+	 * A node in the syntax tree. The tree owns the parsed values; after
+	 * parsing, it is compiled into a flat program of Instructions which
+	 * refer to those values. Only the program is evaluated.
+	 */
 	struct BooleanComponent {
 		virtual ~BooleanComponent() { }
-		virtual bool evaluate(const Context &ctx) = 0;
+		virtual void compile(vector<Instruction> &program) const = 0;
 	};
 
 	enum LogicalOperator {
@@ -875,24 +906,33 @@ private:
 		BooleanComponentPtr firstExpression;
 		vector<Part> rest;
 
-		virtual bool evaluate(const Context &ctx) {
-			bool result = firstExpression->evaluate(ctx);
-			unsigned int i = 0;
-			bool done = i == rest.size();
-
-			while (!done) {
-				Part &nextPart = rest[i];
-				if (nextPart.theOperator == AND) {
-					result = result && nextPart.expression->evaluate(ctx);
-					done = !result;
+		/**
+		 * Operators are evaluated from left to right, without precedence.
+		 * As soon as an AND yields false, the entire expression is false.
+		 */
+		virtual void compile(vector<Instruction> &program) const {
+			vector<unsigned int> jumpsToEnd;
+			unsigned int i;
+
+			firstExpression->compile(program);
+			for (i = 0; i < rest.size(); i++) {
+				const Part &part = rest[i];
+				if (part.theOperator == AND) {
+					jumpsToEnd.push_back(emitJump(program, JUMP_IF_FALSE));
+					part.expression->compile(program);
+					if (i != rest.size() - 1) {
+						jumpsToEnd.push_back(emitJump(program, JUMP_IF_FALSE));
+					}
 				} else {
-					result = result || nextPart.expression->evaluate(ctx);
+					unsigned int skip = emitJump(program, JUMP_IF_TRUE);
+					part.expression->compile(program);
+					program[skip].target = program.size();
 				}
-				i++;
-				done = done || i == rest.size();
 			}
 
-			return result;
+			for (i = 0; i < jumpsToEnd.size(); i++) {
+				program[jumpsToEnd[i]].target = program.size();
+			}
 		}
 	};
 
@@ -903,8 +943,9 @@ private:
 			: expr(e)
 			{ }
 
-		virtual bool evaluate(const Context &ctx) {
-			return !expr->evaluate(ctx);
+		virtual void compile(vector<Instruction> &program) const {
+			expr->compile(program);
+			emit(program, NOT);
 		}
 	};
 
@@ -923,7 +964,7 @@ private:
 				char stringStorage[sizeof(string)];
 				string *stringPointer;
 				struct {
-					regex_t regexp;
+					boost::regex *regexp;
 					int options;
 				} regexp;
 			} stringOrRegexpValue;
@@ -950,16 +991,12 @@ private:
 			u.stringOrRegexpValue.stringPointer = new (u.stringOrRegexpValue.stringStorage)
 				string(value.data(), value.size());
 			if (regexp) {
-				int options = REG_EXTENDED;
 				u.stringOrRegexpValue.regexp.options = 0;
 				if (caseInsensitive) {
-					options |= REG_ICASE;
 					u.stringOrRegexpValue.regexp.options |=
 						Tokenizer::REGEXP_OPTION_CASE_INSENSITIVE;
 				}
-				regcomp(&u.stringOrRegexpValue.regexp.regexp,
-					u.stringOrRegexpValue.stringPointer->c_str(),
-					options);
+				compileRegexp();
 			}
 		}
 
@@ -988,9 +1025,9 @@ private:
 			return *this;
 		}
 
-		regex_t *getRegexpValue(const Context &ctx) const {
+		const boost::regex *getRegexpValue() const {
 			if (source == REGEXP_LITERAL) {
-				return &storedRegexp();
+				return u.stringOrRegexpValue.regexp.regexp;
 			} else {
 				return NULL;
 			}
@@ -1050,6 +1087,11 @@ private:
 			}
 		}
 
+		const string &getLiteralString() const {
+			assert(source == REGEXP_LITERAL || source == STRING_LITERAL);
+			return storedString();
+		}
+
 		ValueType getType() const {
 			switch (source) {
 			case REGEXP_LITERAL:
@@ -1072,34 +1114,35 @@ private:
 			return *u.stringOrRegexpValue.stringPointer;
 		}
 
-		regex_t &storedRegexp() const {
-			return (regex_t &) u.stringOrRegexpValue.regexp.regexp;
+		/**
+		 * Compiles the stored string with the stored options. Syntax errors
+		 * do not throw; they are reported by the regexp's status().
+		 */
+		void compileRegexp() {
+			boost::regex::flag_type flags = boost::regex::extended | boost::regex::no_except;
+			if (u.stringOrRegexpValue.regexp.options & Tokenizer::REGEXP_OPTION_CASE_INSENSITIVE) {
+				flags |= boost::regex::icase;
+			}
+			u.stringOrRegexpValue.regexp.regexp = new boost::regex(storedString(), flags);
 		}
 
 		void freeStorage() {
 			if (source == REGEXP_LITERAL || source == STRING_LITERAL) {
 				storedString().~string();
 				if (source == REGEXP_LITERAL) {
-					regfree(&storedRegexp());
+					delete u.stringOrRegexpValue.regexp.regexp;
 				}
 			}
 		}
 
 		void initializeFrom(const Value &other) {
-			int options;
 			source = other.source;
 			switch (source) {
 			case REGEXP_LITERAL:
 				u.stringOrRegexpValue.stringPointer = new (u.stringOrRegexpValue.stringStorage)
 					string(other.storedString());
-				options = REG_EXTENDED;
-				if (other.u.stringOrRegexpValue.regexp.options & Tokenizer::REGEXP_OPTION_CASE_INSENSITIVE) {
-					options |= REG_ICASE;
-				}
-				regcomp(&u.stringOrRegexpValue.regexp.regexp,
-					storedString().c_str(),
-					options);
 				u.stringOrRegexpValue.regexp.options = other.u.stringOrRegexpValue.regexp.options;
+				compileRegexp();
 				break;
 			case STRING_LITERAL:
 				u.stringOrRegexpValue.stringPointer = new (u.stringOrRegexpValue.stringStorage)
@@ -1125,8 +1168,8 @@ private:
 			: val(v)
 			{ }
 
-		virtual bool evaluate(const Context &ctx) {
-			return val.getBooleanValue(ctx);
+		virtual void compile(vector<Instruction> &program) const {
+			emit(program, LOAD_BOOLEAN, &val);
 		}
 	};
 
@@ -1135,68 +1178,24 @@ private:
 		Comparator comparator;
 		Value object;
 
-		virtual bool evaluate(const Context &ctx) {
+		virtual void compile(vector<Instruction> &program) const {
+			// The parser has already checked that the types are compatible.
 			switch (subject.getType()) {
 			case STRING_TYPE:
-				return compareStringOrRegexp(subject.getStringValue(ctx), ctx);
+				if (comparator == MATCHES || comparator == NOT_MATCHES) {
+					emit(program, MATCH_REGEXP, &subject, &object, comparator);
+				} else {
+					emit(program, COMPARE_STRING, &subject, &object, comparator);
+				}
+				break;
 			case INTEGER_TYPE:
-				return compareInteger(subject.getIntegerValue(ctx), ctx);
+				emit(program, COMPARE_INTEGER, &subject, &object, comparator);
+				break;
 			case BOOLEAN_TYPE:
-				return compareBoolean(subject.getBooleanValue(ctx), ctx);
-			default:
-				// error
-				return false;
-			}
-		}
-
-	private:
-		bool compareStringOrRegexp(const string &str, const Context &ctx) {
-			switch (comparator) {
-			case MATCHES:
-				return regexec(object.getRegexpValue(ctx), str.c_str(), 0, NULL, 0) == 0;
-			case NOT_MATCHES:
-				return regexec(object.getRegexpValue(ctx), str.c_str(), 0, NULL, 0) != 0;
-			case EQUALS:
-				return str == object.getStringValue(ctx);
-			case NOT_EQUALS:
-				return str != object.getStringValue(ctx);
-			default:
-				// error
-				return false;
-			}
-		}
-
-		bool compareInteger(int value, const Context &ctx) {
-			int value2 = object.getIntegerValue(ctx);
-			switch (comparator) {
-			case EQUALS:
-				return value == value2;
-			case NOT_EQUALS:
-				return value != value2;
-			case GREATER_THAN:
-				return value > value2;
-			case GREATER_THAN_OR_EQUALS:
-				return value >= value2;
-			case LESS_THAN:
-				return value < value2;
-			case LESS_THAN_OR_EQUALS:
-				return value <= value2;
-			default:
-				// error
-				return false;
-			}
-		}
-
-		bool compareBoolean(bool value, const Context &ctx) {
-			bool value2 = object.getBooleanValue(ctx);
-			switch (comparator) {
-			case EQUALS:
-				return value == value2;
-			case NOT_EQUALS:
-				return value != value2;
+				emit(program, COMPARE_BOOLEAN, &subject, &object, comparator);
+				break;
 			default:
-				// error
-				return false;
+				abort();
 			}
 		}
 	};
@@ -1208,9 +1207,8 @@ private:
 	};
 
 	struct StartsWithFunctionCall: public FunctionCall {
-		virtual bool evaluate(const Context &ctx) {
-			return startsWith(arguments[0].getStringValue(ctx),
-				arguments[1].getStringValue(ctx));
+		virtual void compile(vector<Instruction> &program) const {
+			emit(program, STARTS_WITH, &arguments[0], &arguments[1]);
 		}
 
 		virtual void checkArguments() const {
@@ -1222,8 +1220,8 @@ private:
 	};
 
 	struct HasHintFunctionCall: public FunctionCall {
-		virtual bool evaluate(const Context &ctx) {
-			return ctx.hasHint(arguments[0].getStringValue(ctx));
+		virtual void compile(vector<Instruction> &program) const {
+			emit(program, HAS_HINT, &arguments[0]);
 		}
 
 		virtual void checkArguments() const {
@@ -1234,8 +1232,146 @@ private:
 		}
 	};
 
+	struct Instruction {
+		Opcode opcode;
+		Comparator comparator;
+		const Value *a;
+		const Value *b;
+		unsigned int target;
+	};
+
+	/**
+	 * The state of a single run of the program. Context fields are queried
+	 * at most once per run, no matter how often the filter refers to them.
+	 */
+	class Evaluation {
+	private:
+		const Context &ctx;
+		unsigned int fetchedStrings;
+		unsigned int fetchedIntegers;
+		string strings[Context::FIELD_COUNT];
+		int integers[Context::FIELD_COUNT];
+
+	public:
+		Evaluation(const Context &_ctx)
+			: ctx(_ctx),
+			  fetchedStrings(0),
+			  fetchedIntegers(0)
+			{ }
+
+		const string &getString(const Value &value, string &tmp) {
+			switch (value.source) {
+			case Value::REGEXP_LITERAL:
+			case Value::STRING_LITERAL:
+				return value.getLiteralString();
+			case Value::CONTEXT_FIELD_IDENTIFIER: {
+				Context::FieldIdentifier id = value.u.contextFieldIdentifier;
+				if (!(fetchedStrings & (1 << id))) {
+					strings[id] = ctx.queryStringField(id);
+					fetchedStrings |= 1 << id;
+				}
+				return strings[id];
+			}
+			default:
+				tmp = value.getStringValue(ctx);
+				return tmp;
+			}
+		}
+
+		int getInteger(const Value &value) {
+			if (value.source == Value::CONTEXT_FIELD_IDENTIFIER) {
+				Context::FieldIdentifier id = value.u.contextFieldIdentifier;
+				if (!(fetchedIntegers & (1 << id))) {
+					integers[id] = ctx.queryIntField(id);
+					fetchedIntegers |= 1 << id;
+				}
+				return integers[id];
+			} else {
+				return value.getIntegerValue(ctx);
+			}
+		}
+
+		bool getBoolean(const Value &value) {
+			if (value.source == Value::CONTEXT_FIELD_IDENTIFIER) {
+				// Equivalent to Context::queryBoolField().
+				if (value.getType() == STRING_TYPE) {
+					string tmp;
+					return !getString(value, tmp).empty();
+				} else {
+					return getInteger(value) > 0;
+				}
+			} else {
+				return value.getBooleanValue(ctx);
+			}
+		}
+	};
+
+	static void emit(vector<Instruction> &program, Opcode opcode,
+		const Value *a = NULL, const Value *b = NULL,
+		Comparator comparator = UNKNOWN_COMPARATOR)
+	{
+		Instruction instruction;
+		instruction.opcode = opcode;
+		instruction.comparator = comparator;
+		instruction.a = a;
+		instruction.b = b;
+		instruction.target = 0;
+		program.push_back(instruction);
+	}
+
+	/** Emits a jump and returns its address, so that its target can be filled in later. */
+	static unsigned int emitJump(vector<Instruction> &program, Opcode opcode) {
+		emit(program, opcode);
+		return program.size() - 1;
+	}
+
+	static bool compareStrings(Comparator comparator, const string &a, const string &b) {
+		switch (comparator) {
+		case EQUALS:
+			return a == b;
+		case NOT_EQUALS:
+			return a != b;
+		default:
+			// error
+			return false;
+		}
+	}
+
+	static bool compareIntegers(Comparator comparator, int a, int b) {
+		switch (comparator) {
+		case EQUALS:
+			return a == b;
+		case NOT_EQUALS:
+			return a != b;
+		case GREATER_THAN:
+			return a > b;
+		case GREATER_THAN_OR_EQUALS:
+			return a >= b;
+		case LESS_THAN:
+			return a < b;
+		case LESS_THAN_OR_EQUALS:
+			return a <= b;
+		default:
+			// error
+			return false;
+		}
+	}
+
+	static bool compareBooleans(Comparator comparator, bool a, bool b) {
+		switch (comparator) {
+		case EQUALS:
+			return a == b;
+		case NOT_EQUALS:
+			return a != b;
+		default:
+			// error
+			return false;
+		}
+	}
+
 	Tokenizer tokenizer;
 	BooleanComponentPtr root;
+	vector<Instruction> program;
 	Token lookahead;
 	bool debug;
 
@@ -1535,8 +1671,12 @@ private:
 		logMatch(level, "matchLiteral()");
 		if (token.type == Tokenizer::REGEXP) {
 			logMatch(level + 1, "regexp");
-			return Value(true, unescapeCString(token.rawValue.substr(1, token.rawValue.size() - 2)),
+			Value value(true, unescapeCString(token.rawValue.substr(1, token.rawValue.size() - 2)),
 				token.options & Tokenizer::REGEXP_OPTION_CASE_INSENSITIVE);
+			if (value.getRegexpValue()->status() != 0) {
+				raiseSyntaxError("invalid regular expression", token);
+			}
+			return value;
 		} else if (token.type == Tokenizer::STRING) {
 			logMatch(level + 1, "string");
 			return Value(false, unescapeCString(token.rawValue.substr(1, token.rawValue.size() - 2)));
@@ -1586,10 +1726,69 @@ public:
 		root = matchMultiExpression(0);
 		logMatch(0, "end of data");
 		match(Tokenizer::END_OF_DATA);
+		root->compile(program);
 	}
 
 	bool run(const Context &ctx) {
-		return root->evaluate(ctx);
+		Evaluation evaluation(ctx);
+		string tmp1, tmp2;
+		unsigned int pc = 0;
+		bool result = false;
+
+		while (pc < program.size()) {
+			const Instruction &instruction = program[pc];
+			pc++;
+
+			switch (instruction.opcode) {
+			case LOAD_BOOLEAN:
+				result = evaluation.getBoolean(*instruction.a);
+				break;
+			case MATCH_REGEXP:
+				result = boost::regex_search(evaluation.getString(*instruction.a, tmp1),
+					*instruction.b->getRegexpValue());
+				if (instruction.comparator == NOT_MATCHES) {
+					result = !result;
+				}
+				break;
+			case COMPARE_STRING:
+				result = compareStrings(instruction.comparator,
+					evaluation.getString(*instruction.a, tmp1),
+					evaluation.getString(*instruction.b, tmp2));
+				break;
+			case COMPARE_INTEGER:
+				result = compareIntegers(instruction.comparator,
+					evaluation.getInteger(*instruction.a),
+					evaluation.getInteger(*instruction.b));
+				break;
+			case COMPARE_BOOLEAN:
+				result = compareBooleans(instruction.comparator,
+					evaluation.getBoolean(*instruction.a),
+					evaluation.getBoolean(*instruction.b));
+				break;
+			case STARTS_WITH:
+				result = startsWith(evaluation.getString(*instruction.a, tmp1),
+					evaluation.getString(*instruction.b, tmp2));
+				break;
+			case HAS_HINT:
+				result = ctx.hasHint(evaluation.getString(*instruction.a, tmp1));
+				break;
+			case NOT:
+				result = !result;
+				break;
+			case JUMP_IF_FALSE:
+				if (!result) {
+					pc = instruction.target;
+				}
+				break;
+			case JUMP_IF_TRUE:
+				if (result) {
+					pc = instruction.target;
+				}
+				break;
+			}
+		}
+
+		return result;
 	}
 };
 
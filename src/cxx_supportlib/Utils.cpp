@@ -37,10 +37,12 @@
 #include <sys/wait.h>
 #include <sys/resource.h>
 #include <sys/uio.h>
+#include <sys/time.h>
 #include <libgen.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <dirent.h>
+#include <fnmatch.h>
 #include <pwd.h>
 #include <grp.h>
 #include <limits.h>
@@ -59,6 +61,7 @@
 #include <Utils/CachedFileStat.hpp>
 #include <Utils/StrIntUtils.h>
 #include <Utils/IOUtils.h>
+#include <Utils/Timer.h>
 
 #ifndef HOST_NAME_MAX
 	#if defined(_POSIX_HOST_NAME_MAX)
@@ -769,6 +772,145 @@ removeDirTree(const string &path) {
 	}
 }
 
+unsigned int
+touchDirTree(const string &path) {
+	vector<string> dirs;
+	unsigned int count = 0;
+
+	if (utimes(path.c_str(), NULL) == 0) {
+		count++;
+	}
+	dirs.push_back(path);
+
+	// Walk the tree iteratively, so that deep trees can't
+	// overflow the stack of small threads.
+	while (!dirs.empty()) {
+		string dir = dirs.back();
+		dirs.pop_back();
+
+		DIR *dirp = opendir(dir.c_str());
+		if (dirp == NULL) {
+			continue;
+		}
+
+		struct dirent *ent;
+		while ((ent = readdir(dirp)) != NULL) {
+			if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+				continue;
+			}
+
+			string entPath = dir + "/" + ent->d_name;
+			struct stat buf;
+			if (lstat(entPath.c_str(), &buf) == -1 || S_ISLNK(buf.st_mode)) {
+				continue;
+			}
+			if (utimes(entPath.c_str(), NULL) == 0) {
+				count++;
+			}
+			if (S_ISDIR(buf.st_mode)) {
+				dirs.push_back(entPath);
+			}
+		}
+		closedir(dirp);
+	}
+
+	return count;
+}
+
+static bool
+tmpfilesConfigExcludes(const string &config, const string &path) {
+	vector<string> lines;
+	vector<string>::const_iterator it;
+
+	split(config, '\n', lines);
+	for (it = lines.begin(); it != lines.end(); it++) {
+		// Format: "Type Path Mode User Group Age Argument". Types 'x' and
+		// 'X' exclude a path, but only 'x' also excludes its contents.
+		const char *pos = it->c_str();
+		while (*pos == ' ' || *pos == '\t') {
+			pos++;
+		}
+		if (*pos != 'x') {
+			continue;
+		}
+		while (*pos != '\0' && *pos != ' ' && *pos != '\t') {
+			pos++;
+		}
+		while (*pos == ' ' || *pos == '\t') {
+			pos++;
+		}
+		const char *end = pos;
+		while (*end != '\0' && *end != ' ' && *end != '\t') {
+			end++;
+		}
+
+		// Patterns with specifiers such as %t are not supported.
+		string pattern(pos, end - pos);
+		if (pattern.empty() || pattern.find('%') != string::npos) {
+			continue;
+		}
+
+		string current = path;
+		while (true) {
+			if (fnmatch(pattern.c_str(), current.c_str(), 0) == 0) {
+				return true;
+			}
+			if (current == "/" || current == ".") {
+				break;
+			}
+			current = extractDirName(current);
+		}
+	}
+
+	return false;
+}
+
+bool
+isExcludedFromTmpCleaning(const string &path, const vector<string> &configDirs) {
+	static const char * const defaultConfigDirs[] = {
+		"/etc/tmpfiles.d",
+		"/run/tmpfiles.d",
+		"/usr/local/lib/tmpfiles.d",
+		"/usr/lib/tmpfiles.d",
+		"/lib/tmpfiles.d"
+	};
+	vector<string> dirs = configDirs;
+	string absPath = absolutizePath(path);
+
+	if (dirs.empty()) {
+		dirs.assign(defaultConfigDirs, defaultConfigDirs
+			+ sizeof(defaultConfigDirs) / sizeof(defaultConfigDirs[0]));
+	}
+
+	for (unsigned int i = 0; i < dirs.size(); i++) {
+		DIR *dirp = opendir(dirs[i].c_str());
+		if (dirp == NULL) {
+			continue;
+		}
+
+		struct dirent *ent;
+		bool excluded = false;
+		while (!excluded && (ent = readdir(dirp)) != NULL) {
+			size_t len = strlen(ent->d_name);
+			if (len <= 5 || strcmp(ent->d_name + len - 5, ".conf") != 0) {
+				continue;
+			}
+			try {
+				excluded = tmpfilesConfigExcludes(
+					readAll(dirs[i] + "/" + ent->d_name), absPath);
+			} catch (const SystemException &) {
+				// Unreadable file; ignore it.
+			}
+		}
+		closedir(dirp);
+		if (excluded) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void
 prestartWebApps(const ResourceLocator &locator, const string &ruby,
 	const vector<string> &prestartURLs)
@@ -1121,6 +1263,75 @@ asyncFork() {
 	#endif
 }
 
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	#define HAS_PIDFD_OPEN
+#endif
+
+// Returns a file descriptor that becomes readable once the given process
+// has exited, or -1 if that is not supported.
+static int
+openPidFd(pid_t pid) {
+	#ifdef HAS_PIDFD_OPEN
+		return (int) syscall(SYS_pidfd_open, pid, 0);
+	#else
+		return -1;
+	#endif
+}
+
+int
+timedWaitPid(pid_t pid, int *status, unsigned long long timeout) {
+	Timer<SystemTime::GRAN_10MSEC> timer;
+	int ret, fd;
+
+	ret = syscalls::waitpid(pid, status, WNOHANG);
+	if (ret != 0) {
+		return ret;
+	}
+
+	fd = openPidFd(pid);
+	if (fd != -1) {
+		FileDescriptor guard(fd, __FILE__, __LINE__);
+		struct pollfd pfd;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (syscalls::poll(&pfd, 1, (int) std::min<unsigned long long>(timeout, INT_MAX)) != -1) {
+			return syscalls::waitpid(pid, status, WNOHANG);
+		}
+	}
+
+	do {
+		ret = syscalls::waitpid(pid, status, WNOHANG);
+		if (ret > 0 || ret == -1) {
+			return ret;
+		} else {
+			syscalls::usleep(10000);
+		}
+	} while (timer.elapsed() < timeout);
+	return 0; // timed out
+}
+
+void
+waitForProcessExit(pid_t pid) {
+	int fd = openPidFd(pid);
+	if (fd != -1) {
+		FileDescriptor guard(fd, __FILE__, __LINE__);
+		struct pollfd pfd;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (syscalls::poll(&pfd, 1, -1) != -1) {
+			return;
+		}
+	}
+
+	while (syscalls::kill(pid, 0) == 0) {
+		syscalls::usleep(20000);
+	}
+}
+
 // Async-signal safe way to get the current process's hard file descriptor limit.
 static int
 getFileDescriptorLimit() {
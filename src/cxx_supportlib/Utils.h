@@ -296,6 +296,29 @@ void makeDirTree(const string &path, const StaticString &mode = "u=rwx,g=,o=",
  */
 void removeDirTree(const string &path);
 
+/**
+ * Sets the access and modification times of every file and directory in
+ * the given directory tree (including the directory itself) to the current
+ * time, in order to prevent /tmp cleaners from removing them. Symlinks are
+ * not followed. Entries that can't be touched are skipped. Returns the
+ * number of entries that were touched.
+ *
+ * This walks the tree in-process instead of forking `find | xargs touch`.
+ */
+unsigned int touchDirTree(const string &path);
+
+/**
+ * Checks whether systemd-tmpfiles is configured not to clean up the given
+ * directory, i.e. whether one of the tmpfiles.d configuration files in
+ * `configDirs` contains an 'x' line whose path pattern matches the directory
+ * or one of its parents. If so, there's no need to touch the directory
+ * periodically.
+ *
+ * If `configDirs` is not given, the standard tmpfiles.d directories are used.
+ */
+bool isExcludedFromTmpCleaning(const string &path,
+	const vector<string> &configDirs = vector<string>());
+
 void prestartWebApps(const ResourceLocator &locator, const string &ruby,
 	const vector<string> &prestartURLs);
 
@@ -369,6 +392,22 @@ string runCommandAndCaptureOutput(const char **command);
  */
 pid_t asyncFork();
 
+/**
+ * Behaves like `waitpid(pid, status, WNOHANG)`, but waits at most `timeout`
+ * miliseconds for the process to exit. On Linux 5.3 and later this sleeps
+ * on a pidfd until the process exits, so that the caller notices the exit
+ * right away. On other systems it polls waitpid() every 10 miliseconds.
+ */
+int timedWaitPid(pid_t pid, int *status, unsigned long long timeout);
+
+/**
+ * Waits until the given process no longer exists. Unlike waitpid(), this
+ * also works for processes that aren't our children, e.g. because they're
+ * being traced by a debugger. Sleeps on a pidfd where supported, and falls
+ * back to polling kill(pid, 0) every 20 miliseconds otherwise.
+ */
+void waitForProcessExit(pid_t pid);
+
 /**
  * Close all file descriptors that are higher than <em>lastToKeepOpen</em>.
  *
@@ -27,71 +27,80 @@
 #define _PASSENGER_BLOCKING_QUEUE_H_
 
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <queue>
+#include <Utils/MpmcQueue.h>
 
 namespace Passenger {
 
 using namespace std;
 using namespace boost;
 
+/**
+ * A thread-safe FIFO queue whose getters block until an item is available.
+ *
+ * A queue with a maximum size is backed by a lock-free MpmcQueue, so that
+ * tryAdd() and tryGet() never take a lock. Its capacity is rounded up to a
+ * power of two. An unbounded queue (max = 0) is a mutex-protected
+ * std::queue.
+ */
 template<typename T>
 class BlockingQueue {
 private:
+	boost::scoped_ptr< MpmcQueue<T> > bounded;
+
+	// Only used by unbounded queues.
 	mutable boost::timed_mutex lock;
 	boost::condition_variable_any added;
-	boost::condition_variable_any removed;
-	unsigned int max;
 	std::queue<T> queue;
 
-	bool atMaxCapacity() const {
-		return max > 0 && queue.size() >= max;
-	}
-
 public:
 	BlockingQueue(unsigned int max = 0) {
-		this->max = max;
+		if (max > 0) {
+			bounded.reset(new MpmcQueue<T>(max));
+		}
 	}
 
 	unsigned int size() const {
-		boost::lock_guard<boost::timed_mutex> l(lock);
-		return queue.size();
+		if (bounded) {
+			return bounded->size();
+		} else {
+			boost::lock_guard<boost::timed_mutex> l(lock);
+			return queue.size();
+		}
 	}
 
 	void add(const T &item) {
-		boost::unique_lock<boost::timed_mutex> l(lock);
-		while (atMaxCapacity()) {
-			removed.wait(l);
-		}
-		queue.push(item);
-		added.notify_one();
-		if (!atMaxCapacity()) {
-			removed.notify_one();
+		if (bounded) {
+			bounded->add(item);
+		} else {
+			boost::lock_guard<boost::timed_mutex> l(lock);
+			queue.push(item);
+			added.notify_one();
 		}
 	}
 
 	bool tryAdd(const T &item) {
-		boost::lock_guard<boost::timed_mutex> l(lock);
-		if (!atMaxCapacity()) {
-			queue.push(item);
-			added.notify_one();
-			if (!atMaxCapacity()) {
-				removed.notify_one();
-			}
-			return true;
+		if (bounded) {
+			return bounded->tryAdd(item);
 		} else {
-			return false;
+			add(item);
+			return true;
 		}
 	}
 
 	T get() {
+		if (bounded) {
+			return bounded->get();
+		}
+
 		boost::unique_lock<boost::timed_mutex> l(lock);
 		while (queue.empty()) {
 			added.wait(l);
 		}
 		T item = queue.front();
 		queue.pop();
-		removed.notify_one();
 		if (!queue.empty()) {
 			added.notify_one();
 		}
@@ -99,6 +108,10 @@ public:
 	}
 
 	bool timedGet(T &output, unsigned int timeout) {
+		if (bounded) {
+			return bounded->timedGet(output, timeout);
+		}
+
 		boost::unique_lock<boost::timed_mutex> l(lock);
 		posix_time::ptime deadline = posix_time::microsec_clock::local_time() +
 			posix_time::milliseconds(timeout);
@@ -117,7 +130,6 @@ public:
 		if (!queue.empty()) {
 			output = queue.front();
 			queue.pop();
-			removed.notify_one();
 			if (!queue.empty()) {
 				added.notify_one();
 			}
@@ -128,26 +140,38 @@ public:
 	}
 
 	bool tryGet(T &output) {
-		boost::unique_lock<boost::timed_mutex> l(lock);
+		if (bounded) {
+			return bounded->tryGet(output);
+		}
+
+		boost::lock_guard<boost::timed_mutex> l(lock);
 		if (queue.empty()) {
 			return false;
 		} else {
 			output = queue.front();
 			queue.pop();
-			removed.notify_one();
-			if (!queue.empty()) {
-				added.notify_one();
-			}
 			return true;
 		}
 	}
 
-	T peek() {
-		boost::unique_lock<boost::timed_mutex> l(lock);
-		while (queue.empty()) {
-			added.wait(l);
+	/**
+	 * Removes up to `max` items into `output` without blocking.
+	 *
+	 * @return The number of items removed.
+	 */
+	unsigned int tryGetBatch(T *output, unsigned int max) {
+		if (bounded) {
+			return bounded->tryGetBatch(output, max);
+		}
+
+		boost::lock_guard<boost::timed_mutex> l(lock);
+		unsigned int count = 0;
+		while (count < max && !queue.empty()) {
+			output[count] = queue.front();
+			queue.pop();
+			count++;
 		}
-		return queue.front();
+		return count;
 	}
 };
 
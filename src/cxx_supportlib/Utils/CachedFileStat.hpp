@@ -32,15 +32,14 @@
 #include <time.h>
 
 #include <cerrno>
-#include <cassert>
+#include <cstring>
 #include <string>
-#include <boost/shared_ptr.hpp>
-#include <boost/make_shared.hpp>
+#include <vector>
+#include <boost/cstdint.hpp>
 #include <oxt/system_calls.hpp>
 
 #include <StaticString.h>
 #include <Utils/SystemTime.h>
-#include <Utils/StringMap.h>
 
 namespace Passenger {
 
@@ -55,58 +54,47 @@ using namespace boost;
  *
  * The cache has a maximum size, which may be altered during runtime. If a
  * file that wasn't in the cache is being stat()ed, and the cache is full,
- * then the oldest cache entry will be removed.
+ * then an entry that hasn't been used recently is removed.
+ *
+ * The entries are stored inline in a single array, which is looked up through
+ * an open addressing hash table of array indices. A cache hit therefore
+ * doesn't allocate memory or touch reference counts. Entries are evicted
+ * with the CLOCK algorithm: a hit only sets a flag on the entry, and on
+ * eviction a "hand" sweeps over the array, clearing flags, until it finds an
+ * entry without one. The evicted entry's slot is reused for the new entry,
+ * so once the cache is full, its memory usage no longer changes.
  */
 class CachedFileStat {
-public:
-	/** Represents a cached file stat entry. */
-	class Entry {
-	private:
+private:
+	struct Entry {
+		/** This entry's filename. */
+		string filename;
+
+		boost::uint32_t hash;
+
+		/** Whether this entry was used since the clock hand last passed it. */
+		bool referenced;
+
 		/** The last return value of stat(). */
-		int last_result;
+		int lastResult;
 
 		/** The errno set by the last stat() call. */
-		int last_errno;
+		int lastErrno;
 
 		/** The last time a stat() was performed. */
-		time_t last_time;
+		time_t lastTime;
 
-		/**
-		 * Checks whether `interval` seconds have elapsed since `begin`.
-		 * The current time is returned via the `currentTime` argument,
-		 * so that the caller doesn't have to call time() again if it needs the current
-		 * time.
-		 *
-		 * @pre begin <= time(NULL)
-		 * @return Whether `interval` seconds have elapsed since `begin`.
-		 * @throws TimeRetrievalException Something went wrong while retrieving the time.
-		 * @throws boost::thread_interrupted
-		 */
-		bool expired(time_t begin, unsigned int interval, time_t &currentTime) {
-			currentTime = SystemTime::get();
-			return (unsigned int) (currentTime - begin) >= interval;
-		}
-
-	public:
 		/** The cached stat info. */
 		struct stat info;
 
-		/** This entry's filename. */
-		string filename;
-
-		/**
-		 * Creates a new Entry object. The file will not be
-		 * stat()ted until you call refresh().
-		 *
-		 * @param filename The file to stat.
-		 */
-		Entry(const string &_filename)
-			: filename(_filename)
-		{
+		void reset(const StaticString &_filename, boost::uint32_t _hash) {
+			filename.assign(_filename.data(), _filename.size());
+			hash = _hash;
+			referenced = false;
+			lastResult = -1;
+			lastErrno = 0;
+			lastTime = 0;
 			memset(&info, 0, sizeof(struct stat));
-			last_result = -1;
-			last_errno = 0;
-			last_time = 0;
 		}
 
 		/**
@@ -114,10 +102,6 @@ public:
 		 * passed since the last time stat() was called, then the file will be
 		 * re-stat()ted.
 		 *
-		 * The stat information, which may either be the result of a new stat() call
-		 * or just the old cached information, is be available in the <tt>info</tt>
-		 * member.
-		 *
 		 * @return 0 if the stat() call succeeded or if no stat() was performed,
 		 *         -1 if something went wrong while statting the file. In the latter
 		 *         case, <tt>errno</tt> will be populated with an appropriate error code.
@@ -126,35 +110,175 @@ public:
 		 * @throws boost::thread_interrupted
 		 */
 		int refresh(unsigned int throttleRate) {
-			time_t currentTime;
+			time_t currentTime = SystemTime::get();
 
-			if (expired(last_time, throttleRate, currentTime)) {
-				last_result = syscalls::stat(filename.c_str(), &info);
-				last_errno = errno;
-				last_time = currentTime;
-				return last_result;
+			if ((unsigned int) (currentTime - lastTime) >= throttleRate) {
+				lastResult = syscalls::stat(filename.c_str(), &info);
+				lastErrno = errno;
+				lastTime = currentTime;
+				return lastResult;
 			} else {
-				errno = last_errno;
-				return last_result;
+				errno = lastErrno;
+				return lastResult;
 			}
 		}
+
+		bool matches(const StaticString &other, boost::uint32_t otherHash) const {
+			return hash == otherHash
+				&& filename.size() == other.size()
+				&& memcmp(filename.data(), other.data(), other.size()) == 0;
+		}
 	};
 
-	typedef boost::shared_ptr<Entry> EntryPtr;
-	typedef list<EntryPtr> EntryList;
-	typedef StringMap<EntryList::iterator> EntryMap;
+	/**
+	 * A slot in `index`. It contains a copy of the entry's hash, so that
+	 * probing doesn't have to look at entries whose hash is different.
+	 */
+	struct Slot {
+		boost::uint32_t hash;
+		/** The entry number + 1, or EMPTY_SLOT. */
+		boost::uint32_t entry;
+	};
+
+	static const boost::uint32_t EMPTY_SLOT = 0;
+	static const unsigned int MIN_INDEX_SIZE = 16;
 
 	unsigned int maxSize;
-	EntryList entries;
-	EntryMap cache;
+	/** The ring that the clock hand sweeps over. */
+	vector<Entry> entries;
+	/** Open addressing hash table with linear probing. Its size is a power of two. */
+	vector<Slot> index;
+	unsigned int hand;
+
+	static boost::uint32_t hashFilename(const StaticString &filename) {
+		// Processes 8 bytes at a time, because filenames tend to be long and
+		// this runs on every stat(). The MurmurHash3 finalizer at the end makes
+		// sure that the low bits, which select the slot, depend on all bytes.
+		const char *data = filename.data();
+		const char *end = data + filename.size();
+		boost::uint64_t h = filename.size();
+		boost::uint64_t word;
+
+		while (end - data >= 8) {
+			memcpy(&word, data, 8);
+			h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+			h ^= h >> 32;
+			data += 8;
+		}
+		if (data < end) {
+			word = 0;
+			memcpy(&word, data, end - data);
+			h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return (boost::uint32_t) h;
+	}
+
+	static unsigned int indexSizeFor(unsigned int numEntries) {
+		// Keep the load factor at or below 0.5, so that probe sequences stay short.
+		unsigned int size = MIN_INDEX_SIZE;
+		while (size < numEntries * 2) {
+			size *= 2;
+		}
+		return size;
+	}
+
+	/** Returns the number of the entry for `filename`, or -1 if there is none. */
+	int find(const StaticString &filename, boost::uint32_t hash) const {
+		unsigned int mask = index.size() - 1;
+		unsigned int i = hash & mask;
+
+		while (index[i].entry != EMPTY_SLOT) {
+			if (index[i].hash == hash
+			 && entries[index[i].entry - 1].matches(filename, hash))
+			{
+				return index[i].entry - 1;
+			}
+			i = (i + 1) & mask;
+		}
+		return -1;
+	}
+
+	void addToIndex(unsigned int entryNumber) {
+		unsigned int mask = index.size() - 1;
+		boost::uint32_t hash = entries[entryNumber].hash;
+		unsigned int i = hash & mask;
+
+		while (index[i].entry != EMPTY_SLOT) {
+			i = (i + 1) & mask;
+		}
+		index[i].hash = hash;
+		index[i].entry = entryNumber + 1;
+	}
+
+	void removeFromIndex(unsigned int entryNumber) {
+		unsigned int mask = index.size() - 1;
+		unsigned int i = entries[entryNumber].hash & mask;
+
+		while (index[i].entry != entryNumber + 1) {
+			i = (i + 1) & mask;
+		}
+
+		// Shift back the slots after it that would otherwise become
+		// unreachable, instead of leaving a tombstone.
+		unsigned int j = i;
+		while (true) {
+			j = (j + 1) & mask;
+			if (index[j].entry == EMPTY_SLOT) {
+				break;
+			}
+			unsigned int home = index[j].hash & mask;
+			if (((j - home) & mask) >= ((j - i) & mask)) {
+				index[i] = index[j];
+				i = j;
+			}
+		}
+		index[i].entry = EMPTY_SLOT;
+	}
+
+	void rebuildIndex(unsigned int size) {
+		Slot empty = { 0, EMPTY_SLOT };
+		index.assign(size, empty);
+		for (unsigned int i = 0; i < entries.size(); i++) {
+			addToIndex(i);
+		}
+	}
 
+	/**
+	 * Advances the clock hand to an entry that hasn't been used since the
+	 * hand last passed it, and returns that entry's number. Entries in
+	 * `skip`, if given, are never chosen.
+	 */
+	unsigned int advanceHand(const vector<bool> *skip = NULL) {
+		while (true) {
+			unsigned int current = hand;
+			Entry &entry = entries[current];
+			hand = (hand + 1) % entries.size();
+			if (skip != NULL && (*skip)[current]) {
+				continue;
+			} else if (entry.referenced) {
+				entry.referenced = false;
+			} else {
+				return current;
+			}
+		}
+	}
+
+public:
 	/**
 	 * Creates a new CachedFileStat object.
 	 *
 	 * @param maxSize The maximum cache size. A size of 0 means unlimited.
 	 */
-	CachedFileStat(unsigned int maxSize = 0) {
-		this->maxSize = maxSize;
+	CachedFileStat(unsigned int maxSize = 0)
+		: maxSize(maxSize),
+		  hand(0)
+	{
+		rebuildIndex(indexSizeFor(maxSize));
 	}
 
 	/**
@@ -176,54 +300,69 @@ public:
 	 * @throws boost::thread_interrupted
 	 */
 	int stat(const StaticString &filename, struct stat *buf, unsigned int throttleRate = 0) {
-		EntryList::iterator it(cache.get(filename, entries.end()));
-		EntryPtr entry;
+		boost::uint32_t hash = hashFilename(filename);
+		int entryNumber = find(filename, hash);
 		int ret;
 
-		if (it == entries.end()) {
+		if (entryNumber != -1) {
+			// Cache hit.
+			entries[entryNumber].referenced = true;
+		} else if (maxSize != 0 && entries.size() >= maxSize) {
+			// Filename not in cache, and the cache is full. Replace
+			// an entry that hasn't been used recently.
+			entryNumber = advanceHand();
+			removeFromIndex(entryNumber);
+			entries[entryNumber].reset(filename, hash);
+			addToIndex(entryNumber);
+		} else {
 			// Filename not in cache.
-			// If cache is full, remove the least recently used
-			// cache entry.
-			if (maxSize != 0 && cache.size() == maxSize) {
-				EntryList::iterator listEnd(entries.end());
-				listEnd--;
-				string filename2((*listEnd)->filename);
-				entries.pop_back();
-				cache.remove(filename2);
+			entryNumber = entries.size();
+			entries.push_back(Entry());
+			entries.back().reset(filename, hash);
+			if (entries.size() * 2 > index.size()) {
+				rebuildIndex(indexSizeFor(entries.size()));
+			} else {
+				addToIndex(entryNumber);
 			}
-
-			// Add to cache as most recently used.
-			entry = boost::make_shared<Entry>(filename);
-			entries.push_front(entry);
-			cache.set(filename, entries.begin());
-		} else {
-			// Cache hit.
-			entry = *it;
-
-			// Mark this cache item as most recently used.
-			entries.splice(entries.begin(), entries, it);
-			cache.set(filename, entries.begin());
 		}
-		ret = entry->refresh(throttleRate);
-		*buf = entry->info;
+
+		Entry &entry = entries[entryNumber];
+		ret = entry.refresh(throttleRate);
+		*buf = entry.info;
 		return ret;
 	}
 
 	/**
-	 * Change the maximum size of the cache. If the new size is larger
-	 * than the old size, then the oldest entries in the cache are
-	 * removed.
+	 * Change the maximum size of the cache. If the new size is smaller
+	 * than the number of cached entries, then entries that haven't been
+	 * used recently are removed.
 	 *
 	 * A size of 0 means unlimited.
 	 */
 	void setMaxSize(unsigned int maxSize) {
-		if (maxSize != 0) {
-			int toRemove = cache.size() - maxSize;
-			for (int i = 0; i < toRemove; i++) {
-				string filename(entries.back()->filename);
-				entries.pop_back();
-				cache.remove(filename);
+		if (maxSize != 0 && entries.size() > maxSize) {
+			vector<bool> removed(entries.size(), false);
+			unsigned int toRemove = entries.size() - maxSize;
+			unsigned int i;
+
+			for (i = 0; i < toRemove; i++) {
+				removed[advanceHand(&removed)] = true;
+			}
+
+			// Compact the remaining entries, in the order in which the
+			// hand would visit them.
+			vector<Entry> remaining;
+			remaining.reserve(maxSize);
+			for (i = 0; i < entries.size(); i++) {
+				unsigned int j = (hand + i) % entries.size();
+				if (!removed[j]) {
+					remaining.push_back(Entry());
+					std::swap(remaining.back(), entries[j]);
+				}
 			}
+			entries.swap(remaining);
+			hand = 0;
+			rebuildIndex(indexSizeFor(maxSize));
 		}
 		this->maxSize = maxSize;
 	}
@@ -232,7 +371,7 @@ public:
 	 * Returns whether `filename` is in the cache.
 	 */
 	bool knows(const StaticString &filename) const {
-		return cache.has(filename);
+		return find(filename, hashFilename(filename)) != -1;
 	}
 };
 
@@ -51,6 +51,8 @@
 #include <cstring>
 #include <curl/curl.h>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <Exceptions.h>
 #include <Utils.h>
 #include <Utils/StrIntUtils.h>
@@ -198,6 +200,57 @@ setCurlProxy(CURL *curl, const CurlProxyInfo &proxyInfo) {
 	}
 }
 
+/**
+ * A libcurl share handle through which CURL handles share their DNS cache
+ * and their TLS session cache. Handles that are created later, or that are
+ * used by other threads, can then reuse earlier lookups and resume earlier
+ * TLS sessions instead of doing a full handshake. Each CURL handle still
+ * keeps its own keep-alive connections: libcurl does not support sharing
+ * the connection cache between concurrent threads.
+ *
+ * Thread-safe. Must outlive all CURL handles that it is applied to.
+ */
+class CurlShare: public boost::noncopyable {
+private:
+	CURLSH *share;
+	boost::mutex locks[CURL_LOCK_DATA_LAST];
+
+	static void lock(CURL *curl, curl_lock_data data, curl_lock_access access,
+		void *userData)
+	{
+		((CurlShare *) userData)->locks[data].lock();
+	}
+
+	static void unlock(CURL *curl, curl_lock_data data, void *userData) {
+		((CurlShare *) userData)->locks[data].unlock();
+	}
+
+public:
+	CurlShare() {
+		share = curl_share_init();
+		if (share == NULL) {
+			throw RuntimeException("Unable to create a CURL share handle");
+		}
+		curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+		curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+		curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+
+	~CurlShare() {
+		curl_share_cleanup(share);
+	}
+
+	/**
+	 * Makes the given handle use this share. Must be called again after
+	 * curl_easy_reset().
+	 */
+	CURLcode apply(CURL *curl) {
+		return curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	}
+};
+
 inline bool
 isCurlStaticallyLinked() {
 	#ifdef CURL_IS_STATICALLY_LINKED
@@ -30,12 +30,14 @@
 #include <time.h>
 #include <cassert>
 #include <cstring>
+#include <cstddef>
 #include <StaticString.h>
 #include <Utils/StrIntUtils.h>
 
 namespace Passenger {
 
 
+inline bool parseImfFixdate_fixedLength(const char *date, const char *end, struct tm &tm, int &zone);
 inline bool skipImfFixdate_comment(const char **pos, const char *end);
 inline bool parseImfFixdate_dayOfWeek(const char **pos, const char *end, struct tm &tm);
 inline bool parseImfFixdate_date(const char **pos, const char *end, struct tm &tm);
@@ -55,12 +57,16 @@ inline bool parseImfFixdate_zone(const char **pos, const char *end, int &zone);
  */
 inline bool
 parseImfFixdate(const char *date, const char *end, struct tm &tm, int &zone) {
-	// We're not parsing the grammar exactly, but whatever.
-	// It's too complicated and nobody uses CFWS.
-
 	tm.tm_yday = -1;
 	tm.tm_isdst = 0;
 
+	if (parseImfFixdate_fixedLength(date, end, tm, zone)) {
+		return true;
+	}
+
+	// We're not parsing the grammar exactly, but whatever.
+	// It's too complicated and nobody uses CFWS.
+
 	if (!parseImfFixdate_dayOfWeek(&date, end, tm)) {
 		return false;
 	}
@@ -77,27 +83,137 @@ parseImfFixdate(const char *date, const char *end, struct tm &tm, int &zone) {
 /**
  * Converts a parsed IMF-fixdate, as outputted by `parseImfFixdate()`,
  * into a Unix timestamp.
+ *
+ * This is computed directly instead of with mktime(), which consults
+ * the local time zone and is needlessly slow for a date that already
+ * carries its own offset from UTC.
  */
 inline time_t
 parsedDateToTimestamp(struct tm &tm, int zone) {
-	time_t timeUsingLocalTZ = mktime(&tm);
-	// tmUsingLocalTZ now contains tm interpreted as being in our local timezone instead of the intended UTC
-	// Example: 10 UTC interpreted as 10 GMT+1 instead of 11 GMT+1
-
-#if !defined(sun) && !defined(__sun) && !defined(BOOST_OS_MACOS)
-	// tm_gmtoff = "seconds east of UTC", so the example 10 GMT+1 would now be corrected to (10+1) GMT+1
-	timeUsingLocalTZ += tm.tm_gmtoff;
-#else
-	// Solaris doesn't have tm_gmtoff, so we calculate the current offset by converting to UTC (gmtime) and pretending
-	// that is local time again (mktime), resulting in a "corrected" timestamp that we can delta with the original timestamp.
-	// In the example: gmtime(10 GMT+1) = 9 UTC, interpreted as 9 GMT+1 gives use delta (10 - 9) = +1 to correct 10 GMT+1 with.
-	struct tm *tmAsUTC = gmtime(&timeUsingLocalTZ);
-	time_t utcUsingLocalTZ = mktime(tmAsUTC);
-	timeUsingLocalTZ += (timeUsingLocalTZ - utcUsingLocalTZ);
-#endif
-
-	// The final result also needs to take into account the desired zone.
-	return timeUsingLocalTZ - (zone / 100 * 60 * 60 + zone % 100 * 60);
+	static const int daysBeforeMonth[12] = {
+		0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+	};
+	long long year = tm.tm_year + 1900;
+	long long leapDaysBefore = (year - 1) / 4 - (year - 1) / 100 + (year - 1) / 400
+		- (1969 / 4 - 1969 / 100 + 1969 / 400);
+	bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	long long days = (year - 1970) * 365 + leapDaysBefore
+		+ daysBeforeMonth[tm.tm_mon]
+		+ ((leapYear && tm.tm_mon > 1) ? 1 : 0)
+		+ tm.tm_mday - 1;
+
+	return (time_t) (days * 24 * 60 * 60
+		+ tm.tm_hour * 60 * 60 + tm.tm_min * 60 + tm.tm_sec
+		- (zone / 100 * 60 * 60 + zone % 100 * 60));
+}
+
+/**
+ * Packs a three-letter day or month name into an integer, so that
+ * it can be compared against a table of names in a single step.
+ */
+inline unsigned int
+packImfFixdate_name(const char *str) {
+	return ((unsigned int) (unsigned char) str[0] << 16)
+		| ((unsigned int) (unsigned char) str[1] << 8)
+		| (unsigned int) (unsigned char) str[2];
+}
+
+#define PSG_IMF_FIXDATE_NAME(a, b, c) \
+	(((unsigned int) (a) << 16) | ((unsigned int) (b) << 8) | (unsigned int) (c))
+
+/** Returns the index of `str` in the day names table, or -1. */
+inline int
+lookupImfFixdate_dayOfWeek(const char *str) {
+	static const unsigned int names[7] = {
+		PSG_IMF_FIXDATE_NAME('M', 'o', 'n'), PSG_IMF_FIXDATE_NAME('T', 'u', 'e'),
+		PSG_IMF_FIXDATE_NAME('W', 'e', 'd'), PSG_IMF_FIXDATE_NAME('T', 'h', 'u'),
+		PSG_IMF_FIXDATE_NAME('F', 'r', 'i'), PSG_IMF_FIXDATE_NAME('S', 'a', 't'),
+		PSG_IMF_FIXDATE_NAME('S', 'u', 'n')
+	};
+	unsigned int key = packImfFixdate_name(str);
+	for (int i = 0; i < 7; i++) {
+		if (names[i] == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Returns the index of `str` in the month names table, or -1. */
+inline int
+lookupImfFixdate_month(const char *str) {
+	static const unsigned int names[12] = {
+		PSG_IMF_FIXDATE_NAME('J', 'a', 'n'), PSG_IMF_FIXDATE_NAME('F', 'e', 'b'),
+		PSG_IMF_FIXDATE_NAME('M', 'a', 'r'), PSG_IMF_FIXDATE_NAME('A', 'p', 'r'),
+		PSG_IMF_FIXDATE_NAME('M', 'a', 'y'), PSG_IMF_FIXDATE_NAME('J', 'u', 'n'),
+		PSG_IMF_FIXDATE_NAME('J', 'u', 'l'), PSG_IMF_FIXDATE_NAME('A', 'u', 'g'),
+		PSG_IMF_FIXDATE_NAME('S', 'e', 'p'), PSG_IMF_FIXDATE_NAME('O', 'c', 't'),
+		PSG_IMF_FIXDATE_NAME('N', 'o', 'v'), PSG_IMF_FIXDATE_NAME('D', 'e', 'c')
+	};
+	unsigned int key = packImfFixdate_name(str);
+	for (int i = 0; i < 12; i++) {
+		if (names[i] == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+#undef PSG_IMF_FIXDATE_NAME
+
+/**
+ * Parses two decimal digits at `str`. Returns -1 if they are not digits.
+ */
+inline int
+parseImfFixdate_twoDigits(const char *str) {
+	unsigned int d1 = (unsigned char) str[0] - '0';
+	unsigned int d2 = (unsigned char) str[1] - '0';
+	if (d1 > 9 || d2 > 9) {
+		return -1;
+	}
+	return d1 * 10 + d2;
+}
+
+/**
+ * Parses the preferred IMF-fixdate form that RFC 7231 requires senders to
+ * generate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT". Every field is at a
+ * fixed offset, so nothing has to be scanned. Returns false for anything
+ * else, in which case the caller falls back to the general parser.
+ */
+inline bool
+parseImfFixdate_fixedLength(const char *date, const char *end, struct tm &tm, int &zone) {
+	if (end - date != (ptrdiff_t) (sizeof("Sun, 06 Nov 1994 08:49:37 GMT") - 1)
+	 || date[3] != ',' || date[4] != ' ' || date[7] != ' ' || date[11] != ' '
+	 || date[16] != ' ' || date[19] != ':' || date[22] != ':' || date[25] != ' '
+	 || date[26] != 'G' || date[27] != 'M' || date[28] != 'T')
+	{
+		return false;
+	}
+
+	int wday = lookupImfFixdate_dayOfWeek(date);
+	int mday = parseImfFixdate_twoDigits(date + 5);
+	int mon = lookupImfFixdate_month(date + 8);
+	int century = parseImfFixdate_twoDigits(date + 12);
+	int yearInCentury = parseImfFixdate_twoDigits(date + 14);
+	int hour = parseImfFixdate_twoDigits(date + 17);
+	int min = parseImfFixdate_twoDigits(date + 20);
+	int sec = parseImfFixdate_twoDigits(date + 23);
+	if (wday == -1 || mday == -1 || mon == -1 || century == -1
+	 || yearInCentury == -1 || hour == -1 || hour > 23
+	 || min == -1 || min > 59 || sec == -1 || sec > 60)
+	{
+		return false;
+	}
+
+	tm.tm_wday = wday;
+	tm.tm_mday = mday;
+	tm.tm_mon = mon;
+	tm.tm_year = century * 100 + yearInCentury - 1900;
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = sec;
+	zone = 0;
+	return true;
 }
 
 inline void
@@ -140,26 +256,9 @@ parseImfFixdate_dayOfWeek(const char **pos, const char *end, struct tm &tm) {
 		return false;
 	}
 	if (end - *pos >= 3) {
-		StaticString str(*pos, 3);
+		tm.tm_wday = lookupImfFixdate_dayOfWeek(*pos);
 		(*pos) += 3;
-		if (str == P_STATIC_STRING("Mon")) {
-			tm.tm_wday = 0;
-		} else if (str == P_STATIC_STRING("Tue")) {
-			tm.tm_wday = 1;
-		} else if (str == P_STATIC_STRING("Wed")) {
-			tm.tm_wday = 2;
-		} else if (str == P_STATIC_STRING("Thu")) {
-			tm.tm_wday = 3;
-		} else if (str == P_STATIC_STRING("Fri")) {
-			tm.tm_wday = 4;
-		} else if (str == P_STATIC_STRING("Sat")) {
-			tm.tm_wday = 5;
-		} else if (str == P_STATIC_STRING("Sun")) {
-			tm.tm_wday = 6;
-		} else {
-			return false;
-		}
-		return true;
+		return tm.tm_wday != -1;
 	} else {
 		return false;
 	}
@@ -199,36 +298,9 @@ parseImfFixdate_day(const char **pos, const char *end, struct tm &tm) {
 inline bool
 parseImfFixdate_month(const char **pos, const char *end, struct tm &tm) {
 	if (end - *pos >= 3) {
-		StaticString str(*pos, 3);
+		tm.tm_mon = lookupImfFixdate_month(*pos);
 		(*pos) += 3;
-		if (str == P_STATIC_STRING("Jan")) {
-			tm.tm_mon = 0;
-		} else if (str == P_STATIC_STRING("Feb")) {
-			tm.tm_mon = 1;
-		} else if (str == P_STATIC_STRING("Mar")) {
-			tm.tm_mon = 2;
-		} else if (str == P_STATIC_STRING("Apr")) {
-			tm.tm_mon = 3;
-		} else if (str == P_STATIC_STRING("May")) {
-			tm.tm_mon = 4;
-		} else if (str == P_STATIC_STRING("Jun")) {
-			tm.tm_mon = 5;
-		} else if (str == P_STATIC_STRING("Jul")) {
-			tm.tm_mon = 6;
-		} else if (str == P_STATIC_STRING("Aug")) {
-			tm.tm_mon = 7;
-		} else if (str == P_STATIC_STRING("Sep")) {
-			tm.tm_mon = 8;
-		} else if (str == P_STATIC_STRING("Oct")) {
-			tm.tm_mon = 9;
-		} else if (str == P_STATIC_STRING("Nov")) {
-			tm.tm_mon = 10;
-		} else if (str == P_STATIC_STRING("Dec")) {
-			tm.tm_mon = 11;
-		} else {
-			return false;
-		}
-		return true;
+		return tm.tm_mon != -1;
 	} else {
 		return false;
 	}
@@ -27,7 +27,10 @@
 #define _PASSENGER_CHANGE_FILE_CHECKER_H_
 
 #include <string>
+#include <list>
+#include <map>
 #include <cerrno>
+#include <boost/shared_ptr.hpp>
 
 #include <Utils/CachedFileStat.hpp>
 #include <Utils/SystemTime.h>
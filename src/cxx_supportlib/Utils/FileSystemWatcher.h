@@ -0,0 +1,285 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_FILE_SYSTEM_WATCHER_H_
+#define _PASSENGER_FILE_SYSTEM_WATCHER_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <oxt/system_calls.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <cerrno>
+#include <cstddef>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+	#include <sys/inotify.h>
+#endif
+#include <Exceptions.h>
+
+namespace Passenger {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * Watches directories for changes to the files directly inside them, so that
+ * those files don't have to be polled with stat(). Uses inotify. On platforms
+ * without inotify, `isSupported()` returns false, the constructor throws, and
+ * the caller should keep polling.
+ *
+ * Note that on network file systems, changes made by other hosts are not
+ * reported.
+ *
+ * @code
+ * FileSystemWatcher watcher;
+ * watcher.watchDirectory("/webapps/foo/tmp");
+ * vector<FileSystemWatcher::Event> events;
+ * watcher.waitForEvents(events);
+ * @endcode
+ *
+ * Thread-safe. Watching and unwatching directories may happen concurrently
+ * with waiting for events.
+ */
+class FileSystemWatcher: public boost::noncopyable {
+public:
+	struct Event {
+		string dir;
+		/**
+		 * The name of the file in `dir` that changed. If empty, then
+		 * any file in `dir` may have changed, because events were lost.
+		 */
+		string filename;
+		/**
+		 * Whether `dir` is no longer watched, e.g. because it was removed.
+		 * Watching it again requires another call to `watchDirectory()`.
+		 */
+		bool watchLost;
+
+		Event()
+			: watchLost(false)
+			{ }
+	};
+
+private:
+	struct Watch {
+		int wd;
+		unsigned int refcount;
+	};
+
+	typedef map<string, Watch> WatchMap;
+
+	mutable boost::mutex syncher;
+	int fd;
+	WatchMap watches;
+	map<int, string> dirsByWd;
+
+	void removeWatchByWd(int wd, string &dir) {
+		map<int, string>::iterator it = dirsByWd.find(wd);
+		if (it != dirsByWd.end()) {
+			dir = it->second;
+			watches.erase(it->second);
+			dirsByWd.erase(it);
+		}
+	}
+
+	#ifdef __linux__
+		void parseEvents(const char *buf, ssize_t size, vector<Event> &events) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			const char *pos = buf;
+			const char *end = buf + size;
+
+			while (pos < end) {
+				const struct inotify_event *ev = (const struct inotify_event *) pos;
+				pos += sizeof(struct inotify_event) + ev->len;
+
+				if (ev->mask & IN_Q_OVERFLOW) {
+					WatchMap::const_iterator it, w_end = watches.end();
+					for (it = watches.begin(); it != w_end; it++) {
+						Event event;
+						event.dir = it->first;
+						events.push_back(event);
+					}
+				} else if (ev->mask & IN_IGNORED) {
+					Event event;
+					removeWatchByWd(ev->wd, event.dir);
+					if (!event.dir.empty()) {
+						event.watchLost = true;
+						events.push_back(event);
+					}
+				} else if (ev->len > 0) {
+					map<int, string>::const_iterator it = dirsByWd.find(ev->wd);
+					if (it != dirsByWd.end()) {
+						Event event;
+						event.dir = it->second;
+						event.filename = ev->name;
+						events.push_back(event);
+					}
+				}
+			}
+		}
+	#endif
+
+public:
+	/**
+	 * @throws SystemException The watcher could not be initialized.
+	 */
+	FileSystemWatcher()
+		: fd(-1)
+	{
+		#ifdef __linux__
+			fd = inotify_init();
+			if (fd == -1) {
+				int e = errno;
+				throw SystemException("Cannot initialize inotify", e);
+			}
+		#else
+			throw SystemException("Cannot initialize file system watcher", ENOSYS);
+		#endif
+	}
+
+	~FileSystemWatcher() {
+		if (fd != -1) {
+			boost::this_thread::disable_syscall_interruption dsi;
+			syscalls::close(fd);
+		}
+	}
+
+	static bool isSupported() {
+		#ifdef __linux__
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Starts watching the given directory, or increments its reference count
+	 * if it is already watched. Returns false if it cannot be watched, e.g.
+	 * because it doesn't exist.
+	 */
+	bool watchDirectory(const string &dir) {
+		#ifdef __linux__
+			boost::lock_guard<boost::mutex> l(syncher);
+			WatchMap::iterator it = watches.find(dir);
+			if (it != watches.end()) {
+				it->second.refcount++;
+				return true;
+			}
+
+			int wd = inotify_add_watch(fd, dir.c_str(), IN_ONLYDIR
+				| IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE
+				| IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+				| IN_DELETE_SELF | IN_MOVE_SELF);
+			if (wd == -1) {
+				return false;
+			}
+
+			if (dirsByWd.find(wd) != dirsByWd.end()) {
+				// This directory is already watched through another path.
+				// Events are reported for that path only.
+				return false;
+			}
+
+			Watch watch;
+			watch.wd = wd;
+			watch.refcount = 1;
+			watches.insert(make_pair(dir, watch));
+			dirsByWd.insert(make_pair(wd, dir));
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Decrements the reference count of the given directory, and stops
+	 * watching it once nothing refers to it anymore.
+	 */
+	void unwatchDirectory(const string &dir) {
+		#ifdef __linux__
+			boost::lock_guard<boost::mutex> l(syncher);
+			WatchMap::iterator it = watches.find(dir);
+			if (it != watches.end() && --it->second.refcount == 0) {
+				int wd = it->second.wd;
+				dirsByWd.erase(wd);
+				watches.erase(it);
+				inotify_rm_watch(fd, wd);
+			}
+		#endif
+	}
+
+	bool isWatching(const string &dir) const {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return watches.find(dir) != watches.end();
+	}
+
+	/**
+	 * Waits until something changes in one of the watched directories, or
+	 * until `timeout` (in milliseconds; -1 means forever) has passed, and
+	 * appends the events to `events`. Returns whether any events were
+	 * received. Several events may be returned for a single change.
+	 *
+	 * @throws SystemException
+	 * @throws boost::thread_interrupted
+	 */
+	bool waitForEvents(vector<Event> &events, int timeout = -1) {
+		#ifdef __linux__
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+
+			int ret = syscalls::poll(&pfd, 1, timeout);
+			if (ret == -1) {
+				int e = errno;
+				throw SystemException("Cannot poll inotify file descriptor", e);
+			} else if (ret == 0) {
+				return false;
+			}
+
+			char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			ssize_t size = syscalls::read(fd, buf, sizeof(buf));
+			if (size == -1) {
+				int e = errno;
+				throw SystemException("Cannot read from inotify file descriptor", e);
+			}
+
+			size_t oldSize = events.size();
+			parseEvents(buf, size, events);
+			return events.size() > oldSize;
+		#else
+			return false;
+		#endif
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_FILE_SYSTEM_WATCHER_H_ */
@@ -31,9 +31,6 @@
 namespace Passenger {
 
 
-// TODO: use SpookyHash on x86_64
-// TODO: use streaming murmurhash implementation: https://github.com/c9/murmur3
-
 struct JenkinsHash {
 	static const boost::uint32_t EMPTY_STRING_HASH = 0;
 
@@ -44,6 +41,11 @@ struct JenkinsHash {
 		{ }
 
 	void update(const char *data, unsigned int size);
+	/**
+	 * Converts `data` to lowercase like convertLowerCase(), writes the
+	 * result to `output` and hashes it, in a single pass over the data.
+	 */
+	void updateLowerCase(const char *data, unsigned int size, char *output);
 	boost::uint32_t finalize();
 
 	void reset() {
@@ -51,7 +53,51 @@ struct JenkinsHash {
 	}
 };
 
-typedef JenkinsHash Hasher;
+/**
+ * A CRC32C (Castagnoli) checksum followed by the MurmurHash3 finalizer, so that
+ * the low bits are well-distributed enough to be used as hash table indices.
+ * Because a CRC is defined byte by byte, the result does not depend on how the
+ * input is split over update() calls, which the HTTP header parser relies on.
+ *
+ * update() uses the SSE 4.2 `crc32` instruction if the CPU supports it (detected
+ * at runtime) or the ARMv8 CRC32 instructions if the compiler targets them, and
+ * a table-driven implementation otherwise.
+ */
+struct Crc32cHash {
+	static const boost::uint32_t EMPTY_STRING_HASH = 0;
+
+	boost::uint32_t hash;
+
+	Crc32cHash()
+		: hash(0xFFFFFFFF)
+		{ }
+
+	void update(const char *data, unsigned int size);
+	/**
+	 * Converts `data` to lowercase like convertLowerCase(), writes the
+	 * result to `output` and hashes it, in a single pass over the data.
+	 */
+	void updateLowerCase(const char *data, unsigned int size, char *output);
+	/** Like update(), but never uses hardware CRC32 instructions. For unit tests. */
+	void updateWithoutHardwareAcceleration(const char *data, unsigned int size);
+	/** Like updateLowerCase(), but never uses hardware CRC32 instructions. For unit tests. */
+	void updateLowerCaseWithoutHardwareAcceleration(const char *data, unsigned int size,
+		char *output);
+	boost::uint32_t finalize();
+
+	void reset() {
+		hash = 0xFFFFFFFF;
+	}
+
+	static bool hardwareAccelerated();
+};
+
+// Define PASSENGER_USE_JENKINS_HASH to go back to the old hash function.
+#ifdef PASSENGER_USE_JENKINS_HASH
+	typedef JenkinsHash Hasher;
+#else
+	typedef Crc32cHash Hasher;
+#endif
 
 
 } // namespace Passenger
@@ -149,6 +149,7 @@ vector<string> resolveHostname(const string &hostname,
  * @param file The name of the source file that called this function,
  *             for file descriptor logging purposes.
  * @param line The line in the source file that called this function.
+ * @param reusePort Whether to set SO_REUSEPORT on TCP sockets. See reusePortSupported().
  * @return The file descriptor of the newly created server socket.
  * @throws ArgumentException The given address cannot be parsed.
  * @throws RuntimeException Something went wrong.
@@ -160,7 +161,8 @@ int createServer(const StaticString &address,
 	unsigned int backlogSize = 0,
 	bool autoDelete = true,
 	const char *file = __FILE__,
-	unsigned int line = __LINE__);
+	unsigned int line = __LINE__,
+	bool reusePort = false);
 
 /**
  * Create a new Unix server socket which is bounded to <tt>filename</tt>.
@@ -196,6 +198,8 @@ int createUnixServer(const StaticString &filename,
  * @param file The name of the source file that called this function,
  *             for file descriptor logging purposes.
  * @param line The line in the source file that called this function.
+ * @param reusePort Whether to set SO_REUSEPORT on the socket, so that multiple
+ *                  sockets can be bound to the same address. See reusePortSupported().
  * @return The file descriptor of the newly created server socket.
  * @throws SystemException Something went wrong while creating the server socket.
  * @throws ArgumentException The given address cannot be parsed.
@@ -206,7 +210,17 @@ int createTcpServer(const char *address = "0.0.0.0",
 	unsigned short port = 0,
 	unsigned int backlogSize = 0,
 	const char *file = __FILE__,
-	unsigned int line = __LINE__);
+	unsigned int line = __LINE__,
+	bool reusePort = false);
+
+/**
+ * Checks whether this platform allows multiple sockets to be bound
+ * to the same TCP address and port using SO_REUSEPORT, with the kernel
+ * distributing incoming connections among them.
+ *
+ * @ingroup Support
+ */
+bool reusePortSupported();
 
 /**
  * Connect to a server at the given address in a blocking manner.
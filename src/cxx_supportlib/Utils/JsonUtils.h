@@ -130,6 +130,26 @@ getJsonUint64Field(const Json::Value &json, const char *key, unsigned int defaul
 	}
 }
 
+inline bool
+getJsonBoolField(const Json::Value &json, const char *key) {
+	Json::StaticString theKey(key);
+	if (json.isMember(theKey)) {
+		return json[theKey].asBool();
+	} else {
+		throw VariantMap::MissingKeyException(key);
+	}
+}
+
+inline bool
+getJsonBoolField(const Json::Value &json, const char *key, bool defaultValue) {
+	Json::StaticString theKey(key);
+	if (json.isMember(theKey)) {
+		return json[theKey].asBool();
+	} else {
+		return defaultValue;
+	}
+}
+
 inline StaticString
 getJsonStaticStringField(const Json::Value &json, const char *key) {
 	Json::StaticString theKey(key);
@@ -0,0 +1,504 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2010 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_UTILS_JSON_WRITER_H_
+#define _PASSENGER_UTILS_JSON_WRITER_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <jsoncpp/json.h>
+#include <MemoryKit/mbuf.h>
+#include <StaticString.h>
+#include <Utils/StrIntUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Writes a JSON document piece by piece, SAX-style, without building a
+ * Json::Value tree first. Use this for documents whose size depends on the
+ * amount of state, like server state dumps with thousands of clients,
+ * where building a tree would cost an allocation per node.
+ *
+ *     string output;
+ *     JsonWriter writer(output);
+ *     writer.beginObject();
+ *     writer.member("name", "foo");
+ *     writer.key("values");
+ *     writer.beginArray();
+ *     writer.value(1);
+ *     writer.value(2);
+ *     writer.endArray();
+ *     writer.endObject();
+ *
+ * The output goes either to a string or to mbufs. In the latter case the
+ * document never needs to be contiguous in memory, and the mbufs can be
+ * written to a client one by one with writeResponse(). Call finish() after
+ * writing the document in that case.
+ *
+ * By default the output is indented like Json::Value::toStyledString(), so
+ * that it's readable by humans, e.g. in `passenger-status --show=server`.
+ * Unlike toStyledString(), arrays are always written one element per line,
+ * and object members appear in the order in which they are written instead
+ * of sorted by name.
+ */
+class JsonWriter: public boost::noncopyable {
+private:
+	static const unsigned int MAX_DEPTH = 64;
+
+	string *stringOutput;
+	MemoryKit::mbuf_pool *pool;
+	MemoryKit::mbuf current;
+	unsigned int currentSize;
+	boost::uint64_t totalSize;
+
+	bool indent;
+	unsigned int baseDepth;
+	unsigned int depth;
+	// Bit N is set if the container at depth N already has an element.
+	boost::uint64_t hasElements;
+	bool afterKey;
+
+	void flushCurrent() {
+		if (currentSize > 0) {
+			buffers.push_back(MemoryKit::mbuf(current, 0, currentSize));
+		}
+		current = MemoryKit::mbuf();
+		currentSize = 0;
+	}
+
+	void append(const char *data, unsigned int size) {
+		totalSize += size;
+		if (stringOutput != NULL) {
+			stringOutput->append(data, size);
+			return;
+		}
+
+		while (size > 0) {
+			if (current.empty() || currentSize == current.size()) {
+				flushCurrent();
+				current = MemoryKit::mbuf_get(pool);
+			}
+
+			unsigned int n = std::min(size, (unsigned int) current.size() - currentSize);
+			memcpy(current.start + currentSize, data, n);
+			currentSize += n;
+			data += n;
+			size -= n;
+		}
+	}
+
+	void append(const StaticString &data) {
+		append(data.data(), data.size());
+	}
+
+	void appendNewlineAndIndentation() {
+		static const char spaces[] = "                                ";
+		unsigned int size = depth * 3;
+
+		append("\n", 1);
+		while (size > 0) {
+			unsigned int n = std::min(size, (unsigned int) sizeof(spaces) - 1);
+			append(spaces, n);
+			size -= n;
+		}
+	}
+
+	void appendQuoted(const StaticString &str) {
+		const char *pos = str.data();
+		const char *end = str.data() + str.size();
+		const char *runStart = pos;
+
+		append("\"", 1);
+		while (pos < end) {
+			unsigned char ch = (unsigned char) *pos;
+			const char *escaped;
+			char buf[7];
+
+			if (ch >= 0x20 && ch != '"' && ch != '\\') {
+				pos++;
+				continue;
+			}
+
+			switch (ch) {
+			case '"':
+				escaped = "\\\"";
+				break;
+			case '\\':
+				escaped = "\\\\";
+				break;
+			case '\b':
+				escaped = "\\b";
+				break;
+			case '\f':
+				escaped = "\\f";
+				break;
+			case '\n':
+				escaped = "\\n";
+				break;
+			case '\r':
+				escaped = "\\r";
+				break;
+			case '\t':
+				escaped = "\\t";
+				break;
+			default:
+				snprintf(buf, sizeof(buf), "\\u%04x", (unsigned int) ch);
+				escaped = buf;
+				break;
+			}
+			append(runStart, pos - runStart);
+			append(escaped, strlen(escaped));
+			pos++;
+			runStart = pos;
+		}
+		append(runStart, pos - runStart);
+		append("\"", 1);
+	}
+
+	/** Writes the separator that precedes a key, or a value in an array. */
+	void beginElement() {
+		if (afterKey) {
+			afterKey = false;
+			return;
+		}
+		if (depth > baseDepth) {
+			boost::uint64_t bit = (boost::uint64_t) 1 << (depth - 1);
+			if (hasElements & bit) {
+				append(",", 1);
+			} else {
+				hasElements |= bit;
+			}
+			if (indent) {
+				appendNewlineAndIndentation();
+			}
+		}
+	}
+
+	void beginContainer(char ch) {
+		beginElement();
+		append(&ch, 1);
+		depth++;
+		assert(depth <= MAX_DEPTH);
+	}
+
+	void endContainer(char ch) {
+		boost::uint64_t bit = (boost::uint64_t) 1 << (depth - 1);
+		bool nonEmpty = hasElements & bit;
+
+		assert(depth > baseDepth);
+		assert(!afterKey);
+		hasElements &= ~bit;
+		depth--;
+		if (nonEmpty && indent) {
+			appendNewlineAndIndentation();
+		}
+		append(&ch, 1);
+	}
+
+	template<typename IntegerType>
+	void writeUnsigned(IntegerType value) {
+		char buf[sizeof(IntegerType) * 3 + 1];
+		unsigned int size = integerSizeInOtherBase<IntegerType, 10>(value);
+		beginElement();
+		integerToOtherBaseWithSize<IntegerType, 10>(value, buf, size);
+		append(buf, size);
+	}
+
+	template<typename IntegerType>
+	void writeSigned(IntegerType value) {
+		if (value >= 0) {
+			writeUnsigned((unsigned long long) value);
+		} else {
+			char buf[sizeof(IntegerType) * 3 + 2];
+			unsigned long long absValue = 0ull - (unsigned long long) value;
+			unsigned int size = integerSizeInOtherBase<unsigned long long, 10>(absValue);
+			beginElement();
+			buf[0] = '-';
+			integerToOtherBaseWithSize<unsigned long long, 10>(absValue, buf + 1, size);
+			append(buf, size + 1);
+		}
+	}
+
+public:
+	/** Set when writing to mbufs, after finish() is called. */
+	vector<MemoryKit::mbuf> buffers;
+
+	/**
+	 * Writes to the end of `output`.
+	 *
+	 * @param depth When the output is to be embedded in another indented
+	 *              document, the nesting depth at which it is embedded.
+	 */
+	JsonWriter(string &output, bool _indent = true, unsigned int _depth = 0)
+		: stringOutput(&output),
+		  pool(NULL),
+		  currentSize(0),
+		  totalSize(0),
+		  indent(_indent),
+		  baseDepth(_depth),
+		  depth(_depth),
+		  hasElements(0),
+		  afterKey(false)
+		{ }
+
+	/** Writes to mbufs allocated from `pool`, which are put in `buffers`. */
+	JsonWriter(MemoryKit::mbuf_pool *_pool, bool _indent = true)
+		: stringOutput(NULL),
+		  pool(_pool),
+		  currentSize(0),
+		  totalSize(0),
+		  indent(_indent),
+		  baseDepth(0),
+		  depth(0),
+		  hasElements(0),
+		  afterKey(false)
+		{ }
+
+	void beginObject() {
+		beginContainer('{');
+	}
+
+	void endObject() {
+		endContainer('}');
+	}
+
+	void beginArray() {
+		beginContainer('[');
+	}
+
+	void endArray() {
+		endContainer(']');
+	}
+
+	/** Writes the name of the next object member. Follow this with a value. */
+	void key(const StaticString &name) {
+		beginElement();
+		appendQuoted(name);
+		if (indent) {
+			append(" : ", 3);
+		} else {
+			append(":", 1);
+		}
+		afterKey = true;
+	}
+
+	void value(const StaticString &str) {
+		beginElement();
+		appendQuoted(str);
+	}
+
+	void value(const char *str) {
+		value(StaticString(str));
+	}
+
+	void value(const string &str) {
+		value(StaticString(str));
+	}
+
+	void value(bool val) {
+		beginElement();
+		if (val) {
+			append("true", 4);
+		} else {
+			append("false", 5);
+		}
+	}
+
+	void value(int val) {
+		writeSigned(val);
+	}
+
+	void value(long val) {
+		writeSigned(val);
+	}
+
+	void value(long long val) {
+		writeSigned(val);
+	}
+
+	void value(unsigned int val) {
+		writeUnsigned(val);
+	}
+
+	void value(unsigned long val) {
+		writeUnsigned(val);
+	}
+
+	void value(unsigned long long val) {
+		writeUnsigned(val);
+	}
+
+	/** Formats like Json::Value does. */
+	void value(double val) {
+		string str = Json::valueToString(val);
+		beginElement();
+		append(str);
+	}
+
+	/**
+	 * Writes a Json::Value, for parts of a document that are small enough
+	 * that they're still built as a tree.
+	 */
+	void value(const Json::Value &doc) {
+		switch (doc.type()) {
+		case Json::nullValue:
+			nullValue();
+			break;
+		case Json::intValue:
+			value((long long) doc.asLargestInt());
+			break;
+		case Json::uintValue:
+			value((unsigned long long) doc.asLargestUInt());
+			break;
+		case Json::realValue:
+			value(doc.asDouble());
+			break;
+		case Json::stringValue: {
+			const char *begin, *end;
+			doc.getString(&begin, &end);
+			value(StaticString(begin, end - begin));
+			break;
+		}
+		case Json::booleanValue:
+			value(doc.asBool());
+			break;
+		case Json::arrayValue: {
+			Json::Value::const_iterator it, end = doc.end();
+			beginArray();
+			for (it = doc.begin(); it != end; it++) {
+				value(*it);
+			}
+			endArray();
+			break;
+		}
+		case Json::objectValue:
+			beginObject();
+			members(doc);
+			endObject();
+			break;
+		}
+	}
+
+	void nullValue() {
+		beginElement();
+		append("null", 4);
+	}
+
+	/**
+	 * Writes an already encoded JSON value as-is, e.g. a document that
+	 * another JsonWriter produced with a matching `depth`.
+	 */
+	void rawValue(const StaticString &json) {
+		beginElement();
+		append(json);
+	}
+
+	/** Writes all members of the JSON object `doc` into the current object. */
+	void members(const Json::Value &doc) {
+		Json::Value::const_iterator it, end = doc.end();
+		for (it = doc.begin(); it != end; it++) {
+			const char *keyEnd;
+			const char *keyBegin = it.memberName(&keyEnd);
+			key(StaticString(keyBegin, keyEnd - keyBegin));
+			value(*it);
+		}
+	}
+
+	/** Shortcut for writing key(name) followed by value(val). */
+	template<typename T>
+	void member(const StaticString &name, const T &val) {
+		key(name);
+		value(val);
+	}
+
+	/**
+	 * When writing to mbufs, moves the partially filled last mbuf into
+	 * `buffers`. Call this once, after writing the document.
+	 */
+	void finish() {
+		flushCurrent();
+	}
+
+	/** The number of bytes written so far. */
+	boost::uint64_t size() const {
+		return totalSize;
+	}
+};
+
+
+/**
+ * Like byteSizeToJson() in JsonUtils.h, but writes the object to `writer`.
+ */
+inline void
+byteSizeToJson(JsonWriter &writer, size_t size) {
+	char buf[64];
+
+	writer.beginObject();
+	writer.member("bytes", (unsigned long long) size);
+	if (size < 1024) {
+		snprintf(buf, sizeof(buf), "%llu bytes", (unsigned long long) size);
+	} else if (size < 1024 * 1024) {
+		snprintf(buf, sizeof(buf), "%.1f KB", size / 1024.0);
+	} else {
+		snprintf(buf, sizeof(buf), "%.1f MB", size / 1024.0 / 1024.0);
+	}
+	writer.member("human_readable", (const char *) buf);
+	writer.endObject();
+}
+
+/**
+ * Like signedByteSizeToJson() in JsonUtils.h, but writes the object to `writer`.
+ */
+inline void
+signedByteSizeToJson(JsonWriter &writer, long long size) {
+	long long absSize = (size < 0) ? -size : size;
+	char buf[64];
+
+	writer.beginObject();
+	writer.member("bytes", size);
+	if (absSize < 1024) {
+		snprintf(buf, sizeof(buf), "%lld bytes", size);
+	} else if (absSize < 1024 * 1024) {
+		snprintf(buf, sizeof(buf), "%.1f KB", size / 1024.0);
+	} else {
+		snprintf(buf, sizeof(buf), "%.1f MB", size / 1024.0 / 1024.0);
+	}
+	writer.member("human_readable", (const char *) buf);
+	writer.endObject();
+}
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_UTILS_JSON_WRITER_H_ */
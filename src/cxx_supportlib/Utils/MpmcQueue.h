@@ -0,0 +1,378 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2010 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_MPMC_QUEUE_H_
+#define _PASSENGER_MPMC_QUEUE_H_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/move/utility.hpp>
+#include <oxt/macros.hpp>
+#include <cstddef>
+#include <climits>
+#include <ctime>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#ifdef __linux__
+	#include <unistd.h>
+	#include <sys/syscall.h>
+	#include <linux/futex.h>
+#else
+	#include <boost/thread.hpp>
+#endif
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Lets threads sleep until another thread signals that the condition they
+ * wait for may have changed, without the signaling thread taking a lock or
+ * making a system call unless somebody went to sleep since the last signal.
+ *
+ * A waiter calls prepareWait(), rechecks its condition, and then calls
+ * wait() with the returned key if it still has to wait. A notify() that
+ * happens after prepareWait() makes wait() return immediately, so no
+ * wakeups are lost.
+ *
+ * notify() wakes up all waiters, but only the first notify() after a
+ * waiter called prepareWait() does so. Further calls are a single atomic
+ * load until somebody prepares to wait again. This matters when the
+ * woken threads don't get to run right away, e.g. when there are more
+ * threads than CPUs.
+ *
+ * On Linux this is a futex. Elsewhere the sleeping itself is done with a
+ * mutex and condition variable.
+ */
+class QueueWaiter {
+private:
+	boost::atomic<boost::uint32_t> epoch;
+	boost::atomic<bool> armed;
+	#ifndef __linux__
+		boost::mutex syncher;
+		boost::condition_variable cond;
+	#endif
+
+	BOOST_STATIC_ASSERT(sizeof(boost::atomic<boost::uint32_t>) == sizeof(int));
+
+public:
+	QueueWaiter()
+		: epoch(0),
+		  armed(false)
+		{ }
+
+	boost::uint32_t prepareWait() {
+		// The key must be read before arming. Otherwise a notify() could
+		// disarm and bump the epoch in between, and the next notify()
+		// would not wake us up.
+		boost::uint32_t key = epoch.load(boost::memory_order_seq_cst);
+		armed.store(true, boost::memory_order_seq_cst);
+		// Pairs with the fence in notify(): either the waiter's recheck sees
+		// the change, or notify() sees `armed`.
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		return key;
+	}
+
+	/**
+	 * Sleeps until notify() is called or until `timeout` milliseconds
+	 * have passed. A timeout of 0 means no timeout. Spurious wakeups
+	 * are possible.
+	 */
+	void wait(boost::uint32_t key, unsigned int timeout = 0) {
+		#ifdef __linux__
+			struct timespec ts, *tsp = NULL;
+			if (timeout != 0) {
+				ts.tv_sec = timeout / 1000;
+				ts.tv_nsec = (timeout % 1000) * 1000000;
+				tsp = &ts;
+			}
+			// Returns immediately with EAGAIN if `epoch` no longer equals `key`.
+			syscall(SYS_futex, (int *) &epoch, FUTEX_WAIT_PRIVATE, (int) key, tsp, NULL, 0);
+		#else
+			boost::unique_lock<boost::mutex> l(syncher);
+			if (epoch.load(boost::memory_order_relaxed) == key) {
+				if (timeout == 0) {
+					cond.wait(l);
+				} else {
+					cond.timed_wait(l, boost::posix_time::milliseconds(timeout));
+				}
+			}
+		#endif
+	}
+
+	void notify() {
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (!armed.load(boost::memory_order_relaxed)
+		 || !armed.exchange(false, boost::memory_order_seq_cst))
+		{
+			return;
+		}
+		#ifdef __linux__
+			epoch.fetch_add(1, boost::memory_order_seq_cst);
+			syscall(SYS_futex, (int *) &epoch, FUTEX_WAKE_PRIVATE, INT_MAX,
+				NULL, NULL, 0);
+		#else
+			boost::lock_guard<boost::mutex> l(syncher);
+			epoch.fetch_add(1, boost::memory_order_seq_cst);
+			cond.notify_all();
+		#endif
+	}
+};
+
+
+/**
+ * A bounded, lock-free, multi-producer multi-consumer FIFO queue, based on
+ * Dmitry Vyukov's bounded MPMC queue:
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * Every slot has a sequence number that tells producers and consumers
+ * whether it's free or filled for their turn around the ring, so adding and
+ * removing an item only costs one compare-and-swap on the shared position.
+ * tryAdd() and tryGet() never block and never take a lock. The blocking
+ * variants spin on those and sleep on a QueueWaiter when the queue is full
+ * or empty, so they only make system calls when a thread actually has to
+ * sleep or be woken up.
+ *
+ * T must be default constructible and assignable. Removed items are reset
+ * to T() so that the queue does not hold on to their resources.
+ */
+template<typename T>
+class MpmcQueue {
+private:
+	struct Slot {
+		boost::atomic<size_t> sequence;
+		T item;
+	};
+
+	// Keep the producer and consumer positions on different cache lines.
+	static const unsigned int CACHE_LINE_SIZE = 64;
+
+	Slot *slots;
+	size_t mask;
+	char padding1[CACHE_LINE_SIZE];
+	boost::atomic<size_t> addPosition;
+	char padding2[CACHE_LINE_SIZE];
+	boost::atomic<size_t> getPosition;
+	char padding3[CACHE_LINE_SIZE];
+	QueueWaiter notEmpty;
+	QueueWaiter notFull;
+
+	static size_t roundUpToPowerOfTwo(size_t value) {
+		size_t result = 1;
+		while (result < value) {
+			result *= 2;
+		}
+		return result;
+	}
+
+	bool tryAddWithoutNotify(const T &item) {
+		size_t pos = addPosition.load(boost::memory_order_relaxed);
+		Slot *slot;
+
+		while (true) {
+			slot = &slots[pos & mask];
+			size_t seq = slot->sequence.load(boost::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+			if (diff == 0) {
+				if (addPosition.compare_exchange_weak(pos, pos + 1,
+					boost::memory_order_relaxed))
+				{
+					break;
+				}
+			} else if (diff < 0) {
+				// The slot still holds an item from the previous round: full.
+				return false;
+			} else {
+				pos = addPosition.load(boost::memory_order_relaxed);
+			}
+		}
+
+		slot->item = item;
+		slot->sequence.store(pos + 1, boost::memory_order_release);
+		return true;
+	}
+
+	bool tryGetWithoutNotify(T &output) {
+		size_t pos = getPosition.load(boost::memory_order_relaxed);
+		Slot *slot;
+
+		while (true) {
+			slot = &slots[pos & mask];
+			size_t seq = slot->sequence.load(boost::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+			if (diff == 0) {
+				if (getPosition.compare_exchange_weak(pos, pos + 1,
+					boost::memory_order_relaxed))
+				{
+					break;
+				}
+			} else if (diff < 0) {
+				// The slot hasn't been filled for this round yet: empty.
+				return false;
+			} else {
+				pos = getPosition.load(boost::memory_order_relaxed);
+			}
+		}
+
+		output = boost::move(slot->item);
+		slot->item = T();
+		slot->sequence.store(pos + mask + 1, boost::memory_order_release);
+		return true;
+	}
+
+public:
+	/**
+	 * @param capacity The maximum number of items in the queue. Rounded up
+	 *                 to a power of two.
+	 */
+	MpmcQueue(unsigned int capacity)
+		: addPosition(0),
+		  getPosition(0)
+	{
+		size_t size = roundUpToPowerOfTwo(capacity == 0 ? 1 : capacity);
+		slots = new Slot[size];
+		mask = size - 1;
+		for (size_t i = 0; i < size; i++) {
+			slots[i].sequence.store(i, boost::memory_order_relaxed);
+		}
+	}
+
+	~MpmcQueue() {
+		delete[] slots;
+	}
+
+	unsigned int capacity() const {
+		return mask + 1;
+	}
+
+	/**
+	 * The number of items in the queue. Only approximate while other
+	 * threads are adding or removing items.
+	 */
+	unsigned int size() const {
+		size_t get = getPosition.load(boost::memory_order_relaxed);
+		size_t add = addPosition.load(boost::memory_order_relaxed);
+		return (add > get) ? add - get : 0;
+	}
+
+	/**
+	 * Adds an item unless the queue is full. Never blocks and never takes
+	 * a lock.
+	 */
+	bool tryAdd(const T &item) {
+		if (tryAddWithoutNotify(item)) {
+			notEmpty.notify();
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	/** Adds an item, waiting for space if the queue is full. */
+	void add(const T &item) {
+		while (!tryAdd(item)) {
+			boost::uint32_t key = notFull.prepareWait();
+			if (tryAdd(item)) {
+				return;
+			}
+			notFull.wait(key);
+		}
+	}
+
+	/** Removes the oldest item unless the queue is empty. Never blocks. */
+	bool tryGet(T &output) {
+		if (tryGetWithoutNotify(output)) {
+			notFull.notify();
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	/**
+	 * Removes up to `max` of the oldest items into `output`, without
+	 * blocking. Producers waiting for space are only notified once.
+	 *
+	 * @return The number of items removed.
+	 */
+	unsigned int tryGetBatch(T *output, unsigned int max) {
+		unsigned int count = 0;
+		while (count < max && tryGetWithoutNotify(output[count])) {
+			count++;
+		}
+		if (count > 0) {
+			notFull.notify();
+		}
+		return count;
+	}
+
+	/** Removes the oldest item, waiting for one if the queue is empty. */
+	T get() {
+		T item;
+		while (!tryGet(item)) {
+			boost::uint32_t key = notEmpty.prepareWait();
+			if (tryGet(item)) {
+				break;
+			}
+			notEmpty.wait(key);
+		}
+		return item;
+	}
+
+	/**
+	 * Removes the oldest item, waiting at most `timeout` milliseconds for
+	 * one if the queue is empty.
+	 *
+	 * @return Whether an item was removed.
+	 */
+	bool timedGet(T &output, unsigned int timeout) {
+		if (tryGet(output)) {
+			return true;
+		}
+
+		boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time()
+			+ boost::posix_time::milliseconds(timeout);
+
+		while (true) {
+			boost::uint32_t key = notEmpty.prepareWait();
+			if (tryGet(output)) {
+				return true;
+			}
+
+			long long remaining = (deadline
+				- boost::posix_time::microsec_clock::universal_time()).total_milliseconds();
+			if (remaining <= 0) {
+				return false;
+			}
+			notEmpty.wait(key, (unsigned int) remaining);
+		}
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_MPMC_QUEUE_H_ */
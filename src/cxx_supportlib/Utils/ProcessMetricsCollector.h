@@ -30,6 +30,7 @@
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
 #include <oxt/system_calls.hpp>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <map>
@@ -49,10 +50,12 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <cstdlib>
 #include <cerrno>
@@ -75,6 +78,11 @@ using namespace oxt;
 struct ProcessMetrics {
 	pid_t   pid;
 	pid_t   ppid;
+	/** CPU usage in percent. When read from /proc, this is the usage since
+	 * the previous collection by the same ProcessMetricsCollector, or since
+	 * the process started if this is the first collection. Otherwise, it is
+	 * whatever `ps` reports.
+	 */
 	boost::uint8_t cpu;
 	/** Resident Set Size, amount of memory in RAM. Does not include swap.
 	 * -1 if not yet known, 0 if completely swapped out.
@@ -136,6 +144,19 @@ struct ProcessMetrics {
 			return 0;
 		}
 	}
+
+	/**
+	 * Returns the amount of resident memory in KB that this process shares
+	 * with other processes, for example copy-on-write pages inherited from
+	 * the process that forked it. Returns -1 if unknown.
+	 */
+	ssize_t sharedMemory() const {
+		if (rss != -1 && privateDirty != -1 && rss >= privateDirty) {
+			return rss - privateDirty;
+		} else {
+			return -1;
+		}
+	}
 };
 
 class ProcessMetricMap: public map<pid_t, ProcessMetrics> {
@@ -189,11 +210,176 @@ public:
 /**
  * Utility class for collection metrics on processes, such as CPU usage, memory usage,
  * command name, etc.
+ *
+ * On Linux, the metrics are read directly from /proc. Elsewhere, or if /proc
+ * is not mounted, they are obtained by running `ps`.
+ *
+ * A collector remembers the CPU times it saw during the previous collection, so
+ * keep one around to collect metrics periodically. It is not thread-safe.
  */
 class ProcessMetricsCollector {
 private:
+	struct CpuSample {
+		// In clock ticks since boot, to tell a reused PID apart.
+		unsigned long long startTime;
+		// In clock ticks.
+		unsigned long long cpuTime;
+		// In seconds since boot.
+		double uptime;
+	};
+
 	bool canMeasureRealMemory;
+	bool canReadProcFs;
 	string psOutput;
+	mutable map<pid_t, CpuSample> cpuSamples;
+
+	/**
+	 * Reads a small /proc file into the given buffer, NULL terminated.
+	 * Returns the number of bytes read, or -1 if it can't be read
+	 * (e.g. because the process has exited).
+	 */
+	static ssize_t readProcFile(const char *path, char *buf, size_t size) {
+		int fd = syscalls::open(path, O_RDONLY);
+		if (fd == -1) {
+			return -1;
+		}
+		size_t total = 0;
+		ssize_t ret;
+		do {
+			ret = syscalls::read(fd, buf + total, size - 1 - total);
+			if (ret > 0) {
+				total += ret;
+			}
+		} while (ret > 0 && total < size - 1);
+		syscalls::close(fd);
+		if (ret == -1) {
+			return -1;
+		}
+		buf[total] = '\0';
+		return total;
+	}
+
+	static double readUptime() {
+		char buf[128];
+		if (readProcFile("/proc/uptime", buf, sizeof(buf)) <= 0) {
+			throw RuntimeException("Cannot read /proc/uptime");
+		}
+		return atof(buf);
+	}
+
+	/**
+	 * Collects the metrics of a single process from /proc/<pid>/stat and
+	 * /proc/<pid>/cmdline. Returns false if the process doesn't exist.
+	 *
+	 * @throws ParseException
+	 */
+	bool readProcFsMetrics(pid_t pid, double uptime, long ticksPerSecond, long pageSizeKb,
+		map<pid_t, CpuSample> &newCpuSamples, ProcessMetrics &metrics) const
+	{
+		char path[64];
+		char buf[1024 * 4];
+		struct stat st;
+
+		snprintf(path, sizeof(path), "/proc/%d", (int) pid);
+		if (stat(path, &st) == -1) {
+			return false;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+		if (readProcFile(path, buf, sizeof(buf)) <= 0) {
+			return false;
+		}
+
+		// The command name is in parentheses and may contain spaces and
+		// parentheses itself, so parse the fields after the last ')'.
+		const char *commStart = strchr(buf, '(');
+		const char *commEnd = strrchr(buf, ')');
+		if (commStart == NULL || commEnd == NULL || commEnd < commStart) {
+			throw ParseException();
+		}
+		const char *pos = commEnd + 1;
+		unsigned long long fields[22];
+		readNextWord(&pos); // state
+		for (unsigned int i = 1; i < sizeof(fields) / sizeof(fields[0]); i++) {
+			fields[i] = (unsigned long long) readNextWordAsLongLong(&pos);
+		}
+
+		metrics.pid  = pid;
+		metrics.ppid = (pid_t) fields[1];
+		metrics.processGroupId = (pid_t) fields[2];
+		metrics.uid  = st.st_uid;
+		metrics.vmsize = (ssize_t) (fields[20] / 1024);
+		metrics.rss  = (ssize_t) (fields[21] * pageSizeKb);
+
+		CpuSample sample;
+		sample.cpuTime   = fields[11] + fields[12];
+		sample.startTime = fields[19];
+		sample.uptime    = uptime;
+
+		map<pid_t, CpuSample>::const_iterator it = cpuSamples.find(pid);
+		unsigned long long prevCpuTime;
+		double elapsed;
+		if (it != cpuSamples.end() && it->second.startTime == sample.startTime) {
+			prevCpuTime = it->second.cpuTime;
+			elapsed = uptime - it->second.uptime;
+		} else {
+			prevCpuTime = 0;
+			elapsed = uptime - (double) sample.startTime / ticksPerSecond;
+		}
+		if (elapsed > 0 && sample.cpuTime >= prevCpuTime) {
+			double percentage = (sample.cpuTime - prevCpuTime) * 100.0
+				/ ticksPerSecond / elapsed;
+			metrics.cpu = (boost::uint8_t) std::min(percentage, 255.0);
+		} else {
+			metrics.cpu = 0;
+		}
+		newCpuSamples[pid] = sample;
+
+		// Like `ps`, show the arguments separated by spaces, or the
+		// bracketed command name if there are none.
+		snprintf(path, sizeof(path), "/proc/%d/cmdline", (int) pid);
+		ssize_t size = readProcFile(path, buf, sizeof(buf));
+		if (size > 0) {
+			while (size > 0 && buf[size - 1] == '\0') {
+				size--;
+			}
+			for (ssize_t i = 0; i < size; i++) {
+				if (buf[i] == '\0') {
+					buf[i] = ' ';
+				}
+			}
+			metrics.command.assign(buf, size);
+		}
+		if (metrics.command.empty()) {
+			metrics.command = "[";
+			metrics.command.append(commStart + 1, commEnd - commStart - 1);
+			metrics.command.append("]");
+		}
+		return true;
+	}
+
+	template<typename Collection, typename ConstIterator>
+	ProcessMetricMap collectFromProcFs(const Collection &pids) const {
+		ProcessMetricMap result;
+		map<pid_t, CpuSample> newCpuSamples;
+		double uptime = readUptime();
+		long ticksPerSecond = sysconf(_SC_CLK_TCK);
+		long pageSizeKb = sysconf(_SC_PAGESIZE) / 1024;
+		ConstIterator it;
+
+		for (it = pids.begin(); it != pids.end(); it++) {
+			ProcessMetrics metrics;
+			if (readProcFsMetrics(*it, uptime, ticksPerSecond, pageSizeKb,
+				newCpuSamples, metrics))
+			{
+				result[metrics.pid] = metrics;
+			}
+		}
+
+		// Forget about processes that we weren't asked about this time.
+		cpuSamples.swap(newCpuSamples);
+		return result;
+	}
 
 	template<typename Collection, typename ConstIterator>
 	ProcessMetricMap parsePsOutput(const string &output, const Collection &allowedPids) const {
@@ -256,9 +442,14 @@ public:
 		#else
 			canMeasureRealMemory = fileExists("/proc/self/smaps");
 		#endif
+		#ifdef __linux__
+			canReadProcFs = fileExists("/proc/self/stat");
+		#else
+			canReadProcFs = false;
+		#endif
 	}
 
-	/** Mock 'ps' output, used by unit tests. */
+	/** Mock 'ps' output, used by unit tests. Disables reading from /proc. */
 	void setPsOutput(const string &data) {
 		this->psOutput = data;
 	}
@@ -269,7 +460,7 @@ public:
 	 *
 	 * Returns a map which maps a given PID to its collected metrics.
 	 *
-	 * @throws ParseException The ps output cannot be parsed.
+	 * @throws ParseException The ps output or a /proc file cannot be parsed.
 	 * @throws SystemException
 	 * @throws RuntimeException
 	 */
@@ -279,6 +470,25 @@ public:
 			return ProcessMetricMap();
 		}
 
+		ProcessMetricMap result;
+		if (canReadProcFs && psOutput.empty()) {
+			result = collectFromProcFs<Collection, ConstIterator>(pids);
+		} else {
+			result = collectFromPs<Collection, ConstIterator>(pids);
+		}
+		if (canMeasureRealMemory) {
+			ProcessMetricMap::iterator it;
+			for (it = result.begin(); it != result.end(); it++) {
+				ProcessMetrics &metric = it->second;
+				measureRealMemory(metric.pid, metric.pss,
+					metric.privateDirty, metric.swap);
+			}
+		}
+		return result;
+	}
+
+	template<typename Collection, typename ConstIterator>
+	ProcessMetricMap collectFromPs(const Collection &pids) const {
 		ConstIterator it;
 		// The list of PIDs must follow -p without a space.
 		// https://groups.google.com/forum/#!topic/phusion-passenger/WKXy61nJBMA
@@ -316,17 +526,7 @@ public:
 		}
 		pidsArg.resize(0);
 		fmtArg.resize(0);
-		ProcessMetricMap result = parsePsOutput<Collection, ConstIterator>(psOutput, pids);
-		psOutput.resize(0);
-		if (canMeasureRealMemory) {
-			ProcessMetricMap::iterator it;
-			for (it = result.begin(); it != result.end(); it++) {
-				ProcessMetrics &metric = it->second;
-				measureRealMemory(metric.pid, metric.pss,
-					metric.privateDirty, metric.swap);
-			}
-		}
-		return result;
+		return parsePsOutput<Collection, ConstIterator>(psOutput, pids);
 	}
 
 	ProcessMetricMap collect(const vector<pid_t> &pids) const {
@@ -345,6 +545,8 @@ public:
 	 *
 	 * At this time only OS X and recent Linux versions (>= 2.6.25) support
 	 * measuring the proportional set size. Usually root privileges are required.
+	 * On Linux >= 4.14, the totals are read from /proc/<pid>/smaps_rollup, which
+	 * is much cheaper than summing every mapping in /proc/<pid>/smaps.
 	 *
 	 * pss, privateDirty and swap can each be individually set to -1 if that
 	 * part cannot be measured, e.g. because we do not have permission
@@ -408,9 +610,13 @@ public:
 		#else
 			string smapsFilename = "/proc/";
 			smapsFilename.append(toString(pid));
-			smapsFilename.append("/smaps");
+			smapsFilename.append("/smaps_rollup");
 
 			FILE *f = syscalls::fopen(smapsFilename.c_str(), "r");
+			if (f == NULL && errno == ENOENT) {
+				smapsFilename.resize(smapsFilename.size() - sizeof("_rollup") + 1);
+				f = syscalls::fopen(smapsFilename.c_str(), "r");
+			}
 			if (f == NULL) {
 				error:
 				pss = -1;
@@ -0,0 +1,638 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SHM_RING_H_
+#define _PASSENGER_SHM_RING_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+#include <oxt/system_calls.hpp>
+#include <oxt/macros.hpp>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+
+namespace Passenger {
+
+using namespace std;
+using namespace oxt;
+
+
+/**
+ * A view on a single-producer, single-consumer byte ring in memory that is
+ * shared with another process. See ShmRingFile for how the rings are laid
+ * out and used.
+ *
+ * The ring header, in native byte order:
+ *
+ *     offset  type     written by  field
+ *     0       uint32   producer    tail
+ *     4       uint32   producer    producer_waiting
+ *     8       uint32   producer    closed
+ *     64      uint32   consumer    head
+ *     68      uint32   consumer    consumer_waiting
+ *
+ * `head` and `tail` are free running byte counters that wrap around at
+ * 2^32; the ring contains `tail - head` bytes, starting at offset
+ * `head % capacity` of the data area that follows the header. They are
+ * on separate cache lines, so that the producer and the consumer don't
+ * invalidate each other's cache line on every update.
+ *
+ * A side that is about to sleep until the other side has freed space or
+ * written data sets its `*_waiting` flag, issues a full memory barrier and
+ * checks the ring again. The other side issues a full memory barrier after
+ * updating the ring, and rings the doorbell if the flag is set. A side that
+ * cannot issue memory barriers, such as a loader written in a scripting
+ * language, must instead keep its flag set permanently and ring the
+ * doorbell after every update, or bound its sleep with a timeout.
+ *
+ * The other side can write anything to the header, so nothing read from it
+ * is trusted. If `tail - head` is ever larger than the capacity, the ring is
+ * marked as corrupted: from then on it's treated as full and empty, and the
+ * user of the ring must give up on the connection. See isCorrupted().
+ */
+class ShmRing {
+public:
+	static const unsigned int HEADER_SIZE = 128;
+
+private:
+	struct Header {
+		volatile boost::uint32_t tail;
+		volatile boost::uint32_t producerWaiting;
+		volatile boost::uint32_t closed;
+		char padding1[52];
+		volatile boost::uint32_t head;
+		volatile boost::uint32_t consumerWaiting;
+		char padding2[56];
+	};
+
+	Header *header;
+	char *data;
+	boost::uint32_t capacity;
+	mutable bool corrupted;
+
+	/**
+	 * Returns the number of bytes in the ring, given values of `tail` and
+	 * `head` that were each read once. Marks the ring as corrupted, and
+	 * returns the capacity, if they don't make sense.
+	 */
+	boost::uint32_t used(boost::uint32_t tail, boost::uint32_t head) const {
+		boost::uint32_t result = tail - head;
+		if (OXT_UNLIKELY(result > capacity)) {
+			corrupted = true;
+			return capacity;
+		}
+		return result;
+	}
+
+public:
+	ShmRing()
+		: header(NULL),
+		  data(NULL),
+		  capacity(0),
+		  corrupted(false)
+		{ }
+
+	/**
+	 * `addr` points to the ring header. `capacity` must be a power of two.
+	 */
+	ShmRing(void *addr, boost::uint32_t _capacity)
+		: header((Header *) addr),
+		  data((char *) addr + HEADER_SIZE),
+		  capacity(_capacity),
+		  corrupted(false)
+		{ }
+
+	/** Empties the ring. Neither side may be using it. */
+	void reset() {
+		memset(header, 0, sizeof(Header));
+		corrupted = false;
+	}
+
+	/**
+	 * Whether the other side has corrupted the ring header. Checked by
+	 * writable(), write(), readable() and read(), which then act as if the
+	 * ring is full and empty. The connection must then be treated as
+	 * failed with a protocol error, because data may have been lost.
+	 */
+	bool isCorrupted() const {
+		return corrupted;
+	}
+
+	boost::uint32_t getCapacity() const {
+		return capacity;
+	}
+
+
+	/***** Producer side *****/
+
+	size_t writable() const {
+		boost::uint32_t tail = header->tail;
+		boost::uint32_t head = header->head;
+		if (OXT_UNLIKELY(corrupted)) {
+			return 0;
+		}
+		return capacity - used(tail, head);
+	}
+
+	/**
+	 * Copies as much of the given data into the ring as fits, and returns
+	 * the number of bytes copied.
+	 */
+	size_t write(const char *buf, size_t size) {
+		boost::uint32_t tail = header->tail;
+		boost::uint32_t head = header->head;
+		// The consumer must be done reading the space that we're about to reuse.
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		size_t n = std::min<size_t>(size, capacity - used(tail, head));
+		if (n == 0 || OXT_UNLIKELY(corrupted)) {
+			return 0;
+		}
+
+		boost::uint32_t offset = tail & (capacity - 1);
+		size_t first = std::min<size_t>(n, capacity - offset);
+		memcpy(data + offset, buf, first);
+		memcpy(data, buf + first, std::min<size_t>(n - first, capacity));
+		boost::atomic_thread_fence(boost::memory_order_release);
+		header->tail = tail + (boost::uint32_t) n;
+		return n;
+	}
+
+	/**
+	 * Like write(), but gathers the data from the given buffers.
+	 */
+	size_t writev(const struct iovec *iov, unsigned int iovcnt) {
+		size_t total = 0;
+		for (unsigned int i = 0; i < iovcnt; i++) {
+			size_t ret = write((const char *) iov[i].iov_base, iov[i].iov_len);
+			total += ret;
+			if (ret < iov[i].iov_len) {
+				break;
+			}
+		}
+		return total;
+	}
+
+	/** Tells the consumer that no more data will follow. */
+	void close() {
+		boost::atomic_thread_fence(boost::memory_order_release);
+		header->closed = 1;
+	}
+
+	/**
+	 * Whether the doorbell must be rung after write() or close(),
+	 * because the consumer is waiting for data.
+	 */
+	bool consumerNeedsWakeup() const {
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		return header->consumerWaiting != 0;
+	}
+
+	/**
+	 * Announces that the producer is going to wait until the consumer
+	 * frees space. Returns false, without announcing anything, if space
+	 * has been freed in the meantime.
+	 */
+	bool prepareToWaitForSpace() {
+		header->producerWaiting = 1;
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (writable() > 0) {
+			header->producerWaiting = 0;
+			return false;
+		} else {
+			return true;
+		}
+	}
+
+	void stopWaitingForSpace() {
+		header->producerWaiting = 0;
+	}
+
+
+	/***** Consumer side *****/
+
+	size_t readable() const {
+		boost::uint32_t tail = header->tail;
+		boost::uint32_t head = header->head;
+		if (OXT_UNLIKELY(corrupted)) {
+			return 0;
+		}
+		boost::uint32_t result = used(tail, head);
+		return corrupted ? 0 : result;
+	}
+
+	/**
+	 * Moves up to `size` bytes out of the ring, and returns the number of
+	 * bytes moved.
+	 */
+	size_t read(char *buf, size_t size) {
+		boost::uint32_t tail = header->tail;
+		boost::uint32_t head = header->head;
+		// The producer's writes of the data must be visible to us.
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		size_t n = std::min<size_t>(size, used(tail, head));
+		if (n == 0 || OXT_UNLIKELY(corrupted)) {
+			return 0;
+		}
+
+		boost::uint32_t offset = head & (capacity - 1);
+		size_t first = std::min<size_t>(n, capacity - offset);
+		memcpy(buf, data + offset, first);
+		memcpy(buf + first, data, std::min<size_t>(n - first, capacity));
+		boost::atomic_thread_fence(boost::memory_order_release);
+		header->head = head + (boost::uint32_t) n;
+		return n;
+	}
+
+	/**
+	 * Whether the producer has closed the ring and all data has been read.
+	 */
+	bool atEof() const {
+		if (header->closed == 0) {
+			return false;
+		}
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		return readable() == 0;
+	}
+
+	/**
+	 * Whether the doorbell must be rung after read(), because the
+	 * producer is waiting for space.
+	 */
+	bool producerNeedsWakeup() const {
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		return header->producerWaiting != 0;
+	}
+
+	/**
+	 * Announces that the consumer is going to wait until the producer
+	 * writes data or closes the ring. Returns false, without announcing
+	 * anything, if that has happened in the meantime.
+	 */
+	bool prepareToWaitForData() {
+		header->consumerWaiting = 1;
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (readable() > 0 || header->closed != 0) {
+			header->consumerWaiting = 0;
+			return false;
+		} else {
+			return true;
+		}
+	}
+
+	void stopWaitingForData() {
+		header->consumerWaiting = 0;
+	}
+};
+
+/**
+ * A pair of rings in a ShmRingFile, through which the creator of the file
+ * and its peer exchange the data of one connection. Checked out with
+ * ShmRingFile::checkoutSlot(), and checked in again once the connection
+ * has been closed.
+ */
+class ShmRingSlot: public boost::noncopyable {
+private:
+	friend class ShmRingFile;
+
+	volatile boost::uint32_t *busy;
+	boost::atomic<bool> inUse;
+	boost::atomic<bool> *fileDisabled;
+
+public:
+	unsigned int index;
+	/** Data from the creator to the peer. */
+	ShmRing outgoing;
+	/** Data from the peer to the creator. */
+	ShmRing incoming;
+
+	ShmRingSlot()
+		: busy(NULL),
+		  inUse(false),
+		  fileDisabled(NULL),
+		  index(0)
+		{ }
+
+	/**
+	 * If the peer corrupted one of the rings, this disables the whole
+	 * ShmRingFile: the peer can't be trusted with shared memory anymore.
+	 */
+	void checkin() {
+		if (OXT_UNLIKELY(outgoing.isCorrupted() || incoming.isCorrupted())) {
+			fileDisabled->store(true, boost::memory_order_relaxed);
+		}
+		inUse.store(false, boost::memory_order_release);
+	}
+};
+
+/**
+ * Rings the doorbell on the given connection: a single byte that tells the
+ * other side to look at the rings. Returns 0 on success, or an errno code.
+ * A full socket buffer counts as success, because the other side then has
+ * unread doorbell bytes anyway.
+ */
+inline int
+ringShmRingDoorbell(int fd) {
+	char c = 0;
+	ssize_t ret;
+
+	do {
+		ret = ::send(fd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		return errno;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Reads all doorbell bytes that are pending on the given non-blocking
+ * connection. Returns 0 on success, or an errno code. `eof` is set if
+ * the other side closed the connection.
+ */
+inline int
+drainShmRingDoorbells(int fd, bool &eof) {
+	char buf[64];
+	ssize_t ret;
+
+	eof = false;
+	while (true) {
+		do {
+			ret = ::read(fd, buf, sizeof(buf));
+		} while (ret == -1 && errno == EINTR);
+		if (ret == (ssize_t) sizeof(buf)) {
+			continue;
+		} else if (ret > 0) {
+			return 0;
+		} else if (ret == 0) {
+			eof = true;
+			return 0;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		} else {
+			return errno;
+		}
+	}
+}
+
+/**
+ * A file of shared memory rings, through which the Core exchanges session
+ * data with an application process without copying it through the
+ * kernel, as an alternative to the process's session socket.
+ *
+ * The spawner creates the file and passes its path to the process in the
+ * "shm_ring_file" spawn request option. A process that supports this maps
+ * the file, and adds the `shm_ring` flag to the session socket that it
+ * advertises. The spawner then removes the file, so that it disappears
+ * once both sides have closed it.
+ *
+ * The Core still connects to the session socket for every session, and
+ * first sends the index of the slot that the session uses, as a 32-bit
+ * big endian number, or 0xFFFFFFFF if all slots are in use. In the latter
+ * case the session data goes over the socket as usual. Otherwise all
+ * session data goes through the slot's rings, and the socket only carries
+ * doorbell bytes, which tell the other side to look at the rings, and
+ * tells both sides when the other side has gone away.
+ *
+ * The layout, in native byte order:
+ *
+ *     offset  type       field
+ *     0       char[4]    magic: "PSGR"
+ *     4       uint32     version: 1
+ *     8       uint32     slot_count
+ *     12      uint32     ring_capacity (a power of two)
+ *     64      slot[slot_count]
+ *
+ * Each slot is SLOT_HEADER_SIZE + 2 * (ShmRing::HEADER_SIZE + ring_capacity)
+ * bytes. It starts with a uint32 `busy` flag, followed by the ring from the
+ * Core to the process and the ring from the process to the Core. The Core
+ * sets `busy` and empties the rings before it hands out a slot. The process
+ * clears `busy` when it's done with the slot, after which it must not
+ * touch it anymore. The Core doesn't reuse the slot before then, so a
+ * process that hangs on to a connection can't receive another session's
+ * data.
+ *
+ * If the process corrupts a ring header, the session fails, and no more
+ * slots are handed out: all later sessions go over the socket.
+ */
+class ShmRingFile: public boost::noncopyable {
+public:
+	static const unsigned int HEADER_SIZE = 64;
+	static const unsigned int SLOT_HEADER_SIZE = 64;
+	static const boost::uint32_t DEFAULT_RING_CAPACITY = 64 * 1024;
+
+private:
+	struct Header {
+		char magic[4];
+		boost::uint32_t version;
+		boost::uint32_t slotCount;
+		boost::uint32_t ringCapacity;
+	};
+
+	char *base;
+	size_t size;
+	string path;
+	boost::mutex lock;
+	ShmRingSlot *slots;
+	unsigned int slotCount;
+	unsigned int nextSlot;
+	boost::atomic<bool> disabled;
+
+	ShmRingFile()
+		: base(NULL),
+		  size(0),
+		  slots(NULL),
+		  slotCount(0),
+		  nextSlot(0),
+		  disabled(false)
+		{ }
+
+	char *getSlotAddress(unsigned int index, boost::uint32_t ringCapacity) const {
+		return base + HEADER_SIZE + (size_t) index * getSlotSize(ringCapacity);
+	}
+
+public:
+	static size_t getSlotSize(boost::uint32_t ringCapacity) {
+		return SLOT_HEADER_SIZE + 2 * (ShmRing::HEADER_SIZE + (size_t) ringCapacity);
+	}
+
+	/**
+	 * Creates a file in the given directory, owned by the given user.
+	 * `ringCapacity` must be a power of two, and at least 64.
+	 *
+	 * @throws SystemException
+	 */
+	static boost::shared_ptr<ShmRingFile> create(const string &dir, unsigned int slotCount,
+		boost::uint32_t ringCapacity, uid_t uid, gid_t gid)
+	{
+		boost::shared_ptr<ShmRingFile> file(new ShmRingFile());
+		char filename[PATH_MAX];
+
+		assert(slotCount > 0);
+		assert(ringCapacity >= 64 && (ringCapacity & (ringCapacity - 1)) == 0);
+
+		snprintf(filename, PATH_MAX, "%s/passenger.rings.XXXXXX", dir.c_str());
+		FileDescriptor fd(mkstemp(filename), __FILE__, __LINE__);
+		if (fd == -1) {
+			int e = errno;
+			throw SystemException("Cannot create a shared memory ring file in " + dir, e);
+		}
+		file->path = filename;
+
+		file->size = HEADER_SIZE + slotCount * getSlotSize(ringCapacity);
+		if (ftruncate(fd, file->size) == -1) {
+			int e = errno;
+			throw SystemException("Cannot resize " + file->path, e);
+		}
+		if (geteuid() == 0 && fchown(fd, uid, gid) == -1) {
+			int e = errno;
+			throw SystemException("Cannot change the owner of " + file->path, e);
+		}
+
+		void *addr = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED) {
+			int e = errno;
+			throw SystemException("Cannot map " + file->path, e);
+		}
+		file->base = (char *) addr;
+
+		// The file is zero-filled, so all slots start out idle and empty.
+		Header *header = (Header *) file->base;
+		memcpy(header->magic, "PSGR", 4);
+		header->version = 1;
+		header->slotCount = slotCount;
+		header->ringCapacity = ringCapacity;
+
+		file->slotCount = slotCount;
+		file->slots = new ShmRingSlot[slotCount];
+		for (unsigned int i = 0; i < slotCount; i++) {
+			char *slotAddr = file->getSlotAddress(i, ringCapacity);
+			ShmRingSlot &slot = file->slots[i];
+			slot.index = i;
+			slot.busy = (volatile boost::uint32_t *) slotAddr;
+			slot.fileDisabled = &file->disabled;
+			slot.outgoing = ShmRing(slotAddr + SLOT_HEADER_SIZE, ringCapacity);
+			slot.incoming = ShmRing(slotAddr + SLOT_HEADER_SIZE
+				+ ShmRing::HEADER_SIZE + ringCapacity, ringCapacity);
+		}
+		return file;
+	}
+
+	~ShmRingFile() {
+		removeFile();
+		delete[] slots;
+		if (base != NULL) {
+			munmap(base, size);
+		}
+	}
+
+	const string &getPath() const {
+		return path;
+	}
+
+	/**
+	 * Removes the file. The rings stay mapped.
+	 */
+	void removeFile() {
+		if (!path.empty()) {
+			boost::this_thread::disable_syscall_interruption dsi;
+			syscalls::unlink(path.c_str());
+			path.clear();
+		}
+	}
+
+	unsigned int getSlotCount() const {
+		return slotCount;
+	}
+
+	boost::uint32_t getRingCapacity() const {
+		return ((const Header *) base)->ringCapacity;
+	}
+
+	/**
+	 * Whether a slot was checked in with a corrupted ring, after which
+	 * checkoutSlot() doesn't hand out slots anymore.
+	 */
+	bool isDisabled() const {
+		return disabled.load(boost::memory_order_relaxed);
+	}
+
+	/**
+	 * Hands out a slot that neither side is using, with empty rings.
+	 * Returns NULL if there is none, or if the file has been disabled.
+	 * Thread-safe.
+	 */
+	ShmRingSlot *checkoutSlot() {
+		boost::lock_guard<boost::mutex> l(lock);
+		if (OXT_UNLIKELY(isDisabled())) {
+			return NULL;
+		}
+		for (unsigned int i = 0; i < slotCount; i++) {
+			ShmRingSlot *slot = &slots[(nextSlot + i) % slotCount];
+			if (!slot->inUse.load(boost::memory_order_acquire) && *slot->busy == 0) {
+				// The process must be done with the rings before we reset them.
+				boost::atomic_thread_fence(boost::memory_order_acquire);
+				slot->outgoing.reset();
+				slot->incoming.reset();
+				*slot->busy = 1;
+				slot->inUse.store(true, boost::memory_order_relaxed);
+				nextSlot = (slot->index + 1) % slotCount;
+				return slot;
+			}
+		}
+		return NULL;
+	}
+
+	/**
+	 * Does what the peer does when it's done with a slot. For use in tests,
+	 * which play the role of the peer.
+	 */
+	void releaseSlotAsPeer(unsigned int index) {
+		boost::atomic_thread_fence(boost::memory_order_release);
+		*slots[index].busy = 0;
+	}
+};
+
+typedef boost::shared_ptr<ShmRingFile> ShmRingFilePtr;
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_SHM_RING_H_ */
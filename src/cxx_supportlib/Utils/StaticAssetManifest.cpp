@@ -0,0 +1,134 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <jsoncpp/json.h>
+#include <Exceptions.h>
+#include <Utils/IOUtils.h>
+#include "StaticAssetManifest.h"
+#include "StaticAssetManifest.hpp"
+
+namespace Passenger {
+
+
+bool
+StaticAssetManifest::load(const string &assetsDir) {
+	string manifestPath = findManifestFile(assetsDir);
+	if (manifestPath.empty()) {
+		clear();
+		return false;
+	}
+
+	Json::Value doc;
+	Json::Reader reader;
+	if (!reader.parse(readAll(manifestPath), doc, false) || !doc.isObject()) {
+		throw RuntimeException("Cannot parse " + manifestPath + ": "
+			+ reader.getFormattedErrorMessages());
+	}
+
+	const Json::Value &files = doc["files"];
+	clear();
+	if (files.isObject()) {
+		Json::Value::const_iterator it, end = files.end();
+		for (it = files.begin(); it != end; it++) {
+			string name = it.name();
+			struct stat buf;
+
+			// Never let a manifest point outside the asset directory.
+			if (name.empty() || name[0] == '/' || name.find("..") != string::npos) {
+				continue;
+			}
+
+			string filename = assetsDir + "/" + name;
+			if (!fileExists(filename, buf)) {
+				continue;
+			}
+
+			StaticAsset asset;
+			asset.exists = true;
+			asset.size = buf.st_size;
+			asset.mtime = buf.st_mtime;
+			asset.hasGzipVariant = fileExists(filename + ".gz", buf);
+			asset.hasBrotliVariant = fileExists(filename + ".br", buf);
+			assets.set(name, asset);
+		}
+	}
+
+	path = manifestPath;
+	return true;
+}
+
+
+} // namespace Passenger
+
+
+using namespace Passenger;
+
+extern "C" {
+
+PP_StaticAssetManifestRegistry *
+pp_static_asset_manifest_registry_new(unsigned int throttle_rate) {
+	try {
+		return new StaticAssetManifestRegistry(throttle_rate);
+	} catch (const std::bad_alloc &) {
+		return 0;
+	}
+}
+
+void
+pp_static_asset_manifest_registry_free(PP_StaticAssetManifestRegistry *registry) {
+	delete (StaticAssetManifestRegistry *) registry;
+}
+
+void
+pp_static_asset_manifest_registry_set_throttle_rate(PP_StaticAssetManifestRegistry *registry,
+	unsigned int throttle_rate)
+{
+	((StaticAssetManifestRegistry *) registry)->setThrottleRate(throttle_rate);
+}
+
+int
+pp_static_asset_manifest_registry_lookup(PP_StaticAssetManifestRegistry *registry,
+	const char *doc_root, unsigned int doc_root_len,
+	const char *filename, unsigned int filename_len,
+	PP_StaticAsset *asset)
+{
+	try {
+		StaticAsset result = ((StaticAssetManifestRegistry *) registry)->lookup(
+			StaticString(doc_root, doc_root_len),
+			StaticString(filename, filename_len));
+		if (!result.exists) {
+			return 0;
+		}
+		asset->size = result.size;
+		asset->mtime = result.mtime;
+		asset->has_gzip_variant = result.hasGzipVariant;
+		asset->has_brotli_variant = result.hasBrotliVariant;
+		return 1;
+	} catch (const std::exception &) {
+		return 0;
+	}
+}
+
+} // extern "C"
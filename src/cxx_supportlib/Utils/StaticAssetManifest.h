@@ -0,0 +1,65 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_STATIC_ASSET_MANIFEST_H_
+#define _PASSENGER_STATIC_ASSET_MANIFEST_H_
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** C bindings for Passenger::StaticAssetManifestRegistry. */
+
+typedef void PP_StaticAssetManifestRegistry;
+
+typedef struct {
+	unsigned long long size;
+	time_t mtime;
+	int    has_gzip_variant;
+	int    has_brotli_variant;
+} PP_StaticAsset;
+
+PP_StaticAssetManifestRegistry *pp_static_asset_manifest_registry_new(unsigned int throttle_rate);
+void pp_static_asset_manifest_registry_free(PP_StaticAssetManifestRegistry *registry);
+void pp_static_asset_manifest_registry_set_throttle_rate(PP_StaticAssetManifestRegistry *registry,
+	unsigned int throttle_rate);
+/**
+ * Returns 1 and fills `asset` if `filename` is listed in an asset manifest,
+ * 0 otherwise (including on errors).
+ */
+int  pp_static_asset_manifest_registry_lookup(PP_StaticAssetManifestRegistry *registry,
+	const char *doc_root, unsigned int doc_root_len,
+	const char *filename, unsigned int filename_len,
+	PP_StaticAsset *asset);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PASSENGER_STATIC_ASSET_MANIFEST_H_ */
@@ -0,0 +1,308 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_STATIC_ASSET_MANIFEST_HPP_
+#define _PASSENGER_STATIC_ASSET_MANIFEST_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <oxt/system_calls.hpp>
+
+#include <StaticString.h>
+#include <Logging.h>
+#include <Utils/StringMap.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+
+namespace Passenger {
+
+using namespace std;
+using namespace oxt;
+
+
+/** Information about a single precompiled asset. */
+struct StaticAsset {
+	/** False if the asset is not listed in the manifest. */
+	bool exists;
+	bool hasGzipVariant;
+	bool hasBrotliVariant;
+	unsigned long long size;
+	time_t mtime;
+
+	StaticAsset()
+		: exists(false),
+		  hasGzipVariant(false),
+		  hasBrotliVariant(false),
+		  size(0),
+		  mtime(0)
+		{ }
+};
+
+
+/**
+ * The precompiled assets of a single application, as listed in the asset
+ * manifest that Sprockets writes to the `public/assets` directory during
+ * `rake assets:precompile`. Looking up an asset in here answers "does this
+ * URI map to a static file?" without stat()ing anything.
+ *
+ * The sizes and mtimes in the manifest itself are not trusted: every listed
+ * file is stat()ed once while loading, together with its precompressed
+ * `.gz` and `.br` siblings, and files that no longer exist are left out.
+ */
+class StaticAssetManifest {
+private:
+	StringMap<StaticAsset> assets;
+	string path;
+
+	static bool isManifestFilename(const StaticString &name) {
+		if (name.size() < sizeof(".json") - 1
+		 || name.substr(name.size() - sizeof(".json") + 1) != ".json")
+		{
+			return false;
+		}
+		return name == ".manifest.json"
+			|| startsWith(name, ".sprockets-manifest-")
+			|| startsWith(name, "manifest-");
+	}
+
+	static bool fileExists(const string &filename, struct stat &buf) {
+		return syscalls::stat(filename.c_str(), &buf) == 0 && S_ISREG(buf.st_mode);
+	}
+
+public:
+	/**
+	 * Returns the path of the manifest file in the given asset directory,
+	 * or the empty string if there is none. If there are multiple (Sprockets
+	 * leaves old ones behind when the manifest's name changes), then the most
+	 * recently modified one is returned.
+	 */
+	static string findManifestFile(const string &assetsDir) {
+		DIR *dir = opendir(assetsDir.c_str());
+		struct dirent *ent;
+		struct stat buf;
+		string result;
+		time_t resultMtime = 0;
+
+		if (dir == NULL) {
+			return string();
+		}
+		while ((ent = readdir(dir)) != NULL) {
+			if (isManifestFilename(ent->d_name)) {
+				string filename = assetsDir + "/" + ent->d_name;
+				if (fileExists(filename, buf)
+				 && (result.empty() || buf.st_mtime > resultMtime))
+				{
+					result = filename;
+					resultMtime = buf.st_mtime;
+				}
+			}
+		}
+		closedir(dir);
+		return result;
+	}
+
+	/**
+	 * Loads the manifest in the given asset directory, replacing any
+	 * previously loaded information. Returns false if the directory
+	 * doesn't contain a manifest.
+	 *
+	 * @throws SystemException The manifest cannot be read.
+	 * @throws RuntimeException The manifest is not valid.
+	 * @throws boost::thread_interrupted
+	 */
+	bool load(const string &assetsDir);
+
+	void clear() {
+		assets = StringMap<StaticAsset>();
+		path.clear();
+	}
+
+	/**
+	 * Looks up an asset by its path relative to the asset directory,
+	 * e.g. "application-0123abcd.js".
+	 */
+	StaticAsset lookup(const StaticString &relativePath) const {
+		return assets.get(relativePath);
+	}
+
+	/** The path of the loaded manifest file, or the empty string. */
+	const string &getPath() const {
+		return path;
+	}
+
+	unsigned int size() const {
+		return assets.size();
+	}
+};
+
+
+/**
+ * Keeps track of the asset manifests of all applications that requests
+ * are made to. A manifest is reloaded when its asset directory or the
+ * manifest file changes, which is checked at most once every `throttleRate`
+ * seconds. This class is thread-safe.
+ */
+class StaticAssetManifestRegistry {
+private:
+	struct Entry {
+		time_t lastCheckTime;
+		time_t dirMtime;
+		time_t manifestMtime;
+		StaticAssetManifest manifest;
+
+		Entry()
+			: lastCheckTime(0),
+			  dirMtime(0),
+			  manifestMtime(0)
+			{ }
+	};
+
+	typedef boost::shared_ptr<Entry> EntryPtr;
+
+	/** Entries are never evicted individually; see lookup(). */
+	static const unsigned int MAX_ENTRIES = 1024;
+
+	mutable boost::mutex syncher;
+	StringMap<EntryPtr> entries;
+	unsigned int throttleRate;
+
+	static bool expired(time_t begin, unsigned int interval, time_t &currentTime) {
+		currentTime = SystemTime::get();
+		return (unsigned int) (currentTime - begin) >= interval;
+	}
+
+	void refresh(Entry &entry, const string &assetsDir, time_t currentTime) {
+		struct stat buf;
+
+		entry.lastCheckTime = currentTime;
+		if (syscalls::stat(assetsDir.c_str(), &buf) == -1) {
+			entry.dirMtime = 0;
+			entry.manifest.clear();
+			return;
+		}
+
+		if (buf.st_mtime == entry.dirMtime) {
+			// Manifests are usually replaced by renaming a new file over
+			// the old one, which changes the directory's mtime. But the
+			// change may have happened in the same second as the last check.
+			if (entry.manifest.getPath().empty()
+			 || (syscalls::stat(entry.manifest.getPath().c_str(), &buf) == 0
+			     && buf.st_mtime == entry.manifestMtime))
+			{
+				return;
+			}
+		} else {
+			entry.dirMtime = buf.st_mtime;
+		}
+
+		try {
+			if (entry.manifest.load(assetsDir)
+			 && syscalls::stat(entry.manifest.getPath().c_str(), &buf) == 0)
+			{
+				entry.manifestMtime = buf.st_mtime;
+			} else {
+				entry.manifestMtime = 0;
+			}
+		} catch (const std::exception &e) {
+			P_WARN("Cannot load the asset manifest in " << assetsDir
+				<< ": " << e.what());
+			entry.manifest.clear();
+			entry.manifestMtime = 0;
+		}
+	}
+
+public:
+	StaticAssetManifestRegistry(unsigned int _throttleRate = 1)
+		: throttleRate(_throttleRate)
+		{ }
+
+	void setThrottleRate(unsigned int value) {
+		boost::lock_guard<boost::mutex> l(syncher);
+		throttleRate = value;
+	}
+
+	/**
+	 * Looks up the file `filename`, which lives under the document root
+	 * `docRoot`, in the manifest of the first `assets` directory below the
+	 * document root. Returns an asset whose `exists` member is false if the
+	 * file isn't listed in any manifest; callers should then fall back to
+	 * checking the filesystem.
+	 *
+	 * @throws TimeRetrievalException
+	 * @throws boost::thread_interrupted
+	 */
+	StaticAsset lookup(const StaticString &docRoot, const StaticString &filename) {
+		if (!startsWith(filename, docRoot)) {
+			return StaticAsset();
+		}
+
+		string::size_type pos = docRoot.empty() ? 0 : docRoot.size() - 1;
+		pos = filename.find("/assets/", pos);
+		if (pos == string::npos) {
+			return StaticAsset();
+		}
+		StaticString assetsDir = filename.substr(0, pos + sizeof("/assets") - 1);
+		StaticString relativePath = filename.substr(pos + sizeof("/assets/") - 1);
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		EntryPtr entry = entries.get(assetsDir);
+		time_t currentTime;
+
+		if (!entry) {
+			string assetsDirStr = assetsDir;
+			struct stat buf;
+
+			// Only remember directories that exist, so that requests
+			// for arbitrary URIs can't grow the registry.
+			if (syscalls::stat(assetsDirStr.c_str(), &buf) == -1
+			 || !S_ISDIR(buf.st_mode))
+			{
+				return StaticAsset();
+			}
+			if (entries.size() >= MAX_ENTRIES) {
+				entries = StringMap<EntryPtr>();
+			}
+			entry = boost::make_shared<Entry>();
+			entries.set(assetsDir, entry);
+			refresh(*entry, assetsDirStr, SystemTime::get());
+		} else if (expired(entry->lastCheckTime, throttleRate, currentTime)) {
+			refresh(*entry, assetsDir, currentTime);
+		}
+
+		return entry->manifest.lookup(relativePath);
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_STATIC_ASSET_MANIFEST_HPP_ */
@@ -35,6 +35,12 @@
 #include <Utils/SystemTime.h>
 #include <Utils/StrIntUtils.h>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+#endif
+
 namespace Passenger {
 
 string
@@ -375,6 +381,19 @@ reverseString(char *str, unsigned int size) {
 	}
 }
 
+const char decimalDigitPairs[200] = {
+	'0','0', '0','1', '0','2', '0','3', '0','4', '0','5', '0','6', '0','7', '0','8', '0','9',
+	'1','0', '1','1', '1','2', '1','3', '1','4', '1','5', '1','6', '1','7', '1','8', '1','9',
+	'2','0', '2','1', '2','2', '2','3', '2','4', '2','5', '2','6', '2','7', '2','8', '2','9',
+	'3','0', '3','1', '3','2', '3','3', '3','4', '3','5', '3','6', '3','7', '3','8', '3','9',
+	'4','0', '4','1', '4','2', '4','3', '4','4', '4','5', '4','6', '4','7', '4','8', '4','9',
+	'5','0', '5','1', '5','2', '5','3', '5','4', '5','5', '5','6', '5','7', '5','8', '5','9',
+	'6','0', '6','1', '6','2', '6','3', '6','4', '6','5', '6','6', '6','7', '6','8', '6','9',
+	'7','0', '7','1', '7','2', '7','3', '7','4', '7','5', '7','6', '7','7', '7','8', '7','9',
+	'8','0', '8','1', '8','2', '8','3', '8','4', '8','5', '8','6', '8','7', '8','8', '8','9',
+	'9','0', '9','1', '9','2', '9','3', '9','4', '9','5', '9','6', '9','7', '9','8', '9','9'
+};
+
 static const char hex_chars[] = {
 	'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
 	'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
@@ -417,6 +436,11 @@ uintToString(unsigned int value, char *output, unsigned int outputSize) {
 	return integerToOtherBase<unsigned int, 10>(value, output, outputSize);
 }
 
+void
+uintToStringWithSize(unsigned int value, char *output, unsigned int size) {
+	integerToOtherBaseWithSize<unsigned int, 10>(value, output, size);
+}
+
 string
 integerToHex(long long value) {
 	char buf[sizeof(long long) * 2 + 1];
@@ -493,6 +517,21 @@ atol(const string &s) {
 			0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 		};
 
+		#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+			// 16 bytes at a time. The remainder is handled below.
+			const uint8x16_t upperA = vdupq_n_u8('A');
+			const uint8x16_t alphabetSize = vdupq_n_u8(26);
+			const uint8x16_t caseBit = vdupq_n_u8(0x20);
+			while (len >= 16) {
+				uint8x16_t chars = vld1q_u8(data);
+				uint8x16_t isUpper = vcltq_u8(vsubq_u8(chars, upperA), alphabetSize);
+				vst1q_u8(output, vorrq_u8(chars, vandq_u8(isUpper, caseBit)));
+				data += 16;
+				output += 16;
+				len -= 16;
+			}
+		#endif
+
 		const unsigned char *end = data + len;
 		const size_t imax = len / 4;
 		size_t i;
@@ -512,6 +551,69 @@ atol(const string &s) {
 	}
 #endif
 
+static inline unsigned char
+asciiToLower(unsigned char c) {
+	return c | ((unsigned char) (c - 'A') < 26 ? 0x20 : 0);
+}
+
+bool
+equalsCaseInsensitive(const StaticString &a, const StaticString &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+
+	const unsigned char *x = (const unsigned char *) a.data();
+	const unsigned char *y = (const unsigned char *) b.data();
+	size_t len = a.size();
+
+	#ifdef __SSE2__
+		const __m128i offset = _mm_set1_epi8((char) (0x80 - 'A'));
+		const __m128i limit = _mm_set1_epi8((char) (-0x80 + 26));
+		const __m128i caseBit = _mm_set1_epi8(0x20);
+		while (len >= 16) {
+			__m128i cx = _mm_loadu_si128((const __m128i *) x);
+			__m128i cy = _mm_loadu_si128((const __m128i *) y);
+			cx = _mm_or_si128(cx, _mm_and_si128(
+				_mm_cmplt_epi8(_mm_add_epi8(cx, offset), limit), caseBit));
+			cy = _mm_or_si128(cy, _mm_and_si128(
+				_mm_cmplt_epi8(_mm_add_epi8(cy, offset), limit), caseBit));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(cx, cy)) != 0xFFFF) {
+				return false;
+			}
+			x += 16;
+			y += 16;
+			len -= 16;
+		}
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		const uint8x16_t upperA = vdupq_n_u8('A');
+		const uint8x16_t alphabetSize = vdupq_n_u8(26);
+		const uint8x16_t caseBit = vdupq_n_u8(0x20);
+		while (len >= 16) {
+			uint8x16_t cx = vld1q_u8(x);
+			uint8x16_t cy = vld1q_u8(y);
+			cx = vorrq_u8(cx, vandq_u8(vcltq_u8(vsubq_u8(cx, upperA), alphabetSize), caseBit));
+			cy = vorrq_u8(cy, vandq_u8(vcltq_u8(vsubq_u8(cy, upperA), alphabetSize), caseBit));
+			uint64x2_t equal = vreinterpretq_u64_u8(vceqq_u8(cx, cy));
+			if ((vgetq_lane_u64(equal, 0) & vgetq_lane_u64(equal, 1)) != ~(boost::uint64_t) 0) {
+				return false;
+			}
+			x += 16;
+			y += 16;
+			len -= 16;
+		}
+	#endif
+
+	while (len > 0) {
+		if (asciiToLower(*x) != asciiToLower(*y)) {
+			return false;
+		}
+		x++;
+		y++;
+		len--;
+	}
+	return true;
+}
+
 bool
 constantTimeCompare(const StaticString &a, const StaticString &b) {
 	// http://blog.jasonmooberry.com/2010/10/constant-time-string-comparison/
@@ -36,6 +36,7 @@
 #include <cstddef>
 #include <ctime>
 #include <boost/move/utility.hpp>
+#include <boost/type_traits/make_unsigned.hpp>
 #include <oxt/macros.hpp>
 #include <StaticString.h>
 
@@ -273,25 +274,93 @@ void toHex(const StaticString & restrict_ref data, char * restrict output, bool
 void reverseString(char *str, unsigned int size);
 
 /**
- * Calculates the size (in characters) of an integer when converted
- * to another base.
+ * The decimal representations of 00-99, concatenated. Used for formatting
+ * integers two digits at a time.
+ */
+extern const char decimalDigitPairs[200];
+
+/**
+ * Calculates the size (in characters) of a non-negative integer when
+ * converted to another base. Supported radices are 2-36.
  */
 template<typename IntegerType, int radix>
 unsigned int
 integerSizeInOtherBase(IntegerType value) {
-	IntegerType remainder = value;
-	unsigned int size = 0;
-
-	do {
-		remainder = remainder / radix;
-		size++;
-	} while (remainder != 0);
+	typedef typename boost::make_unsigned<IntegerType>::type UnsignedType;
+	UnsignedType remainder = (UnsignedType) value;
+	unsigned int size = 1;
+
+	if (radix == 10) {
+		// Four digits per division.
+		while (true) {
+			if (remainder < 10) {
+				return size;
+			} else if (remainder < 100) {
+				return size + 1;
+			} else if (remainder < 1000) {
+				return size + 2;
+			} else if (remainder < 10000) {
+				return size + 3;
+			}
+			remainder /= 10000;
+			size += 4;
+		}
+	} else {
+		while (remainder >= (UnsignedType) radix) {
+			remainder /= radix;
+			size++;
+		}
+		return size;
+	}
+}
 
-	return size;
+/**
+ * Convert the given non-negative integer to some other radix, writing exactly
+ * `size` characters to `output`, where `size` is the value's
+ * integerSizeInOtherBase(). Unlike integerToOtherBase(), this does not
+ * NULL terminate the output and does not check the output size. Use this
+ * when the size was already calculated, e.g. to size an output buffer.
+ * Supported radices are 2-36.
+ */
+template<typename IntegerType, int radix>
+void
+integerToOtherBaseWithSize(IntegerType value, char *output, unsigned int size) {
+	static const char chars[] = {
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+		'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
+		'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't',
+		'u', 'v', 'w', 'x', 'y', 'z'
+	};
+	typedef typename boost::make_unsigned<IntegerType>::type UnsignedType;
+	UnsignedType remainder = (UnsignedType) value;
+	char *pos = output + size;
+
+	if (radix == 10) {
+		while (remainder >= 100) {
+			unsigned int index = (unsigned int) (remainder % 100) * 2;
+			remainder /= 100;
+			pos -= 2;
+			pos[0] = decimalDigitPairs[index];
+			pos[1] = decimalDigitPairs[index + 1];
+		}
+		if (remainder >= 10) {
+			pos -= 2;
+			pos[0] = decimalDigitPairs[remainder * 2];
+			pos[1] = decimalDigitPairs[remainder * 2 + 1];
+		} else {
+			pos[-1] = chars[remainder];
+		}
+	} else {
+		do {
+			pos--;
+			*pos = chars[remainder % radix];
+			remainder /= radix;
+		} while (pos > output);
+	}
 }
 
 /**
- * Convert the given integer to some other radix, placing
+ * Convert the given non-negative integer to some other radix, placing
  * the result into the given output buffer. The output buffer
  * will be NULL terminated. Supported radices are 2-36.
  *
@@ -304,42 +373,9 @@ integerSizeInOtherBase(IntegerType value) {
 template<typename IntegerType, int radix>
 unsigned int
 integerToOtherBase(IntegerType value, char *output, unsigned int outputSize) {
-	static const char chars[] = {
-		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
-		'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
-		'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't',
-		'u', 'v', 'w', 'x', 'y', 'z'
-	};
-	IntegerType remainder = value;
-	unsigned int size = 0;
-
-	if (outputSize >= 4) {
-		if (value < radix) {
-			output[0] = chars[value];
-			output[1] = '\0';
-			return 1;
-		} else if (value < radix * radix) {
-			output[0] = chars[value / radix];
-			output[1] = chars[value % radix];
-			output[2] = '\0';
-			return 2;
-		} else if ((long long) value < radix * radix * radix) {
-			output[0] = chars[value / radix / radix];
-			output[1] = chars[value / radix % radix];
-			output[2] = chars[value % radix];
-			output[3] = '\0';
-			return 3;
-		}
-	}
-
-	do {
-		output[size] = chars[remainder % radix];
-		remainder = remainder / radix;
-		size++;
-	} while (remainder != 0 && size < outputSize - 1);
-
-	if (remainder == 0) {
-		reverseString(output, size);
+	unsigned int size = integerSizeInOtherBase<IntegerType, radix>(value);
+	if (size < outputSize) {
+		integerToOtherBaseWithSize<IntegerType, radix>(value, output, size);
 		output[size] = '\0';
 		return size;
 	} else {
@@ -365,6 +401,11 @@ integerToHex(IntegerType value, char *output) {
 
 unsigned int uintSizeAsString(unsigned int value);
 unsigned int uintToString(unsigned int value, char *output, unsigned int outputSize);
+/**
+ * Like uintToString(), but writes exactly `size` characters without a
+ * terminating NULL. `size` must be uintSizeAsString(value).
+ */
+void uintToStringWithSize(unsigned int value, char *output, unsigned int size);
 
 /**
  * Convert the given integer to a hexadecimal string.
@@ -417,10 +458,21 @@ roundUp(IntegerType number, IntegerType multiple) {
 }
 
 /**
- * Converts the given character array to lowercase.
+ * Converts the given character array to lowercase. Only ASCII letters are
+ * converted. Uses SSE2 or NEON where available.
+ *
+ * To convert a string to lowercase and hash the result, use
+ * Hasher::updateLowerCase() instead, which does both in a single pass.
  */
 void convertLowerCase(const unsigned char * restrict data, unsigned char * restrict output, size_t len);
 
+/**
+ * Checks whether the two strings are equal, ignoring differences in the case
+ * of ASCII letters. Unlike strncasecmp(), this doesn't depend on the locale.
+ * Uses SSE2 or NEON where available.
+ */
+bool equalsCaseInsensitive(const StaticString &a, const StaticString &b);
+
 /**
  * Compare two strings using a constant time algorithm to avoid timing attacks.
  */
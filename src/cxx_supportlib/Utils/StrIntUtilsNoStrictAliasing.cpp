@@ -28,6 +28,10 @@
 #include <cstddef>
 #include <Utils/StrIntUtils.h>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
 namespace Passenger {
 
 using namespace std;
@@ -109,6 +113,24 @@ convertLowerCase(const unsigned char * restrict data,
 		0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 	};
 
+	#ifdef __SSE2__
+		// 16 bytes at a time. The remainder is handled below.
+		const __m128i offset = _mm_set1_epi8((char) (0x80 - 'A'));
+		const __m128i limit = _mm_set1_epi8((char) (-0x80 + 26));
+		const __m128i caseBit = _mm_set1_epi8(0x20);
+		while (len >= 16) {
+			__m128i chars = _mm_loadu_si128((const __m128i *) data);
+			// Shift 'A'..'Z' to the bottom of the signed range, so that a
+			// single signed comparison selects them.
+			__m128i isUpper = _mm_cmplt_epi8(_mm_add_epi8(chars, offset), limit);
+			_mm_storeu_si128((__m128i *) output,
+				_mm_or_si128(chars, _mm_and_si128(isUpper, caseBit)));
+			data += 16;
+			output += 16;
+			len -= 16;
+		}
+	#endif
+
 	#if defined(__x86_64__)
 		size_t i;
 		boost::uint64_t eax, ebx;
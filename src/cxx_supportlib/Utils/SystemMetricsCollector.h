@@ -29,6 +29,7 @@
 #include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
 #include <boost/typeof/typeof.hpp>
+#include <boost/noncopyable.hpp>
 #include <ostream>
 #include <iomanip>
 #include <algorithm>
@@ -44,6 +45,9 @@
 #include <sys/utsname.h>
 #ifdef __linux__
 	#include <sys/sysinfo.h>
+	#include <fcntl.h>
+	#include <sched.h>
+	#include <cerrno>
 	#include <Exceptions.h>
 	#include <Utils/StringScanning.h>
 	#include <Utils/IOUtils.h>
@@ -363,6 +367,17 @@ public:
 	/** Kernel version number, or the empty string if this information cannot be queried. */
 	string kernelVersion;
 
+	/** Memory limit and usage of the cgroup that we're in (for example the
+	 * container), in KB. -1 if there is no limit or if this information
+	 * cannot be queried.
+	 */
+	ssize_t cgroupMemoryLimit;
+	ssize_t cgroupMemoryUsage;
+	/** Number of CPUs that the cgroup may use, according to its CFS quota.
+	 * -1 if there is no quota or if this information cannot be queried.
+	 */
+	double cgroupCpuQuota;
+
 	SystemMetrics()
 		:
 		  #ifdef __linux__
@@ -380,7 +395,10 @@ public:
 		  boottime(-1),
 		  forkRate(-2),
 		  swapInRate(-2),
-		  swapOutRate(-2)
+		  swapOutRate(-2),
+		  cgroupMemoryLimit(-1),
+		  cgroupMemoryUsage(-1),
+		  cgroupCpuQuota(-1)
 		{ }
 
 	unsigned int ncpus() const {
@@ -647,6 +665,10 @@ public:
 			stream << "Swap used         : " << formatWidth(kbToMb(swapUsed), 6) << " MB ("
 				<< formatPercent0(options, swapUsedPct, 1, 90) << ")" << endl;
 			stream << "Swap free         : " << formatWidth(kbToMb(swapFree()), 6) << " MB" << endl;
+			if (cgroupMemoryLimit != -1) {
+				stream << "Cgroup limit      : " << formatWidth(kbToMb(cgroupMemoryLimit), 6) << " MB" << endl;
+				stream << "Cgroup used       : " << formatWidth(kbToMb(cgroupMemoryUsage), 6) << " MB" << endl;
+			}
 
 			if (swapInRate != -2) {
 				stream << "Swap in           : ";
@@ -725,6 +747,9 @@ public:
 		if (options.cpu) {
 			stream << "<cpu_metrics>";
 			stream << "<ncpus>" << (int) ncpus() << "</ncpus>";
+			if (cgroupCpuQuota != -1) {
+				stream << "<cgroup_cpu_quota>" << cgroupCpuQuota << "</cgroup_cpu_quota>";
+			}
 			if (ncpus() != 0) {
 				stream << "<average>";
 					stream << "<usage>" << avgCpuUsage() << "</usage>";
@@ -764,6 +789,10 @@ public:
 			stream << "<swap_free>" << swapFree() << "</swap_free>";
 			stream << "<swap_in_rate>" << swapInRate << "</swap_in_rate>";
 			stream << "<swap_out_rate>" << swapOutRate << "</swap_out_rate>";
+			if (cgroupMemoryLimit != -1) {
+				stream << "<cgroup_memory_limit>" << cgroupMemoryLimit << "</cgroup_memory_limit>";
+				stream << "<cgroup_memory_usage>" << cgroupMemoryUsage << "</cgroup_memory_usage>";
+			}
 			stream << "</memory_metrics>";
 		}
 
@@ -789,7 +818,7 @@ public:
  * beginning and end of a time interval. The metrics object remembers the
  * number of CPU ticks that was queried last time.
  */
-class SystemMetricsCollector {
+class SystemMetricsCollector: public boost::noncopyable {
 private:
 	#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
 		int pageSize;
@@ -902,6 +931,99 @@ private:
 	#endif
 
 	#ifdef __linux__
+		/**
+		 * A file in /proc or /sys that is kept open between collections, and
+		 * re-read from the start with pread(). That is a lot cheaper than
+		 * opening the file every time. Files that do not exist (such as the
+		 * files of the cgroup version that the system doesn't use) are only
+		 * tried once.
+		 */
+		struct KernelFile {
+			const char *path;
+			int fd;
+			bool missing;
+
+			KernelFile(const char *_path)
+				: path(_path),
+				  fd(-1),
+				  missing(false)
+				{ }
+
+			~KernelFile() {
+				close();
+			}
+
+			void close() {
+				if (fd != -1) {
+					::close(fd);
+					fd = -1;
+				}
+			}
+		};
+
+		mutable KernelFile procMeminfo, procStat, procVmstat;
+		mutable KernelFile cgroup2MemoryMax, cgroup2MemoryCurrent, cgroup2CpuMax;
+		mutable KernelFile cgroup1MemoryLimit, cgroup1MemoryUsage;
+		mutable KernelFile cgroup1CpuQuota, cgroup1CpuPeriod;
+
+		/**
+		 * Reads the entire file into `contents`. Returns false if the file
+		 * cannot be opened or read.
+		 */
+		bool readKernelFile(KernelFile &file, string &contents) const {
+			char buf[1024 * 8];
+			off_t offset = 0;
+			ssize_t ret;
+
+			if (file.missing) {
+				return false;
+			}
+			if (file.fd == -1) {
+				do {
+					file.fd = ::open(file.path, O_RDONLY | O_CLOEXEC);
+				} while (file.fd == -1 && errno == EINTR);
+				if (file.fd == -1) {
+					file.missing = errno == ENOENT;
+					return false;
+				}
+			}
+
+			contents.clear();
+			while (true) {
+				do {
+					ret = ::pread(file.fd, buf, sizeof(buf), offset);
+				} while (ret == -1 && errno == EINTR);
+				if (ret == -1) {
+					file.close();
+					return false;
+				} else if (ret == 0) {
+					return true;
+				}
+				contents.append(buf, ret);
+				offset += ret;
+			}
+		}
+
+		/**
+		 * Reads a file that contains a single number, such as a cgroup limit.
+		 * Returns -1 if the file cannot be read, contains "max", or contains
+		 * an unreasonably large number (which is how cgroup v1 says "unlimited").
+		 */
+		long long readKernelFileAsNumber(KernelFile &file) const {
+			string contents;
+			if (!readKernelFile(file, contents)) {
+				return -1;
+			}
+
+			char *end;
+			long long result = strtoll(contents.c_str(), &end, 10);
+			if (end == contents.c_str() || result < 0 || result >= (1LL << 62)) {
+				return -1;
+			} else {
+				return result;
+			}
+		}
+
 		void readNextWordAndAssertEqual(const char **data, const StaticString &expected) const {
 			if (readNextWord(data) != expected) {
 				throw ParseException();
@@ -910,13 +1032,7 @@ private:
 
 		void queryMemInfo(SystemMetrics &metrics) const {
 			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/meminfo");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
+			if (readKernelFile(procMeminfo, contents)) {
 				try {
 					parseMemInfo(metrics, contents);
 				} catch (const ParseException &) {
@@ -985,13 +1101,7 @@ private:
 
 		void queryProcStat(SystemMetrics &metrics) const {
 			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/stat");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
+			if (readKernelFile(procStat, contents)) {
 				try {
 					parseProcStat(metrics, contents);
 				} catch (const ParseException &) {
@@ -1064,13 +1174,7 @@ private:
 
 		void queryProcVmstat(SystemMetrics &metrics) const {
 			string contents;
-			bool hasContents = false;
-			try {
-				contents = readAll("/proc/vmstat");
-				hasContents = true;
-			} catch (const SystemException &) {
-			}
-			if (hasContents) {
+			if (readKernelFile(procVmstat, contents)) {
 				try {
 					parseProcVmstat(metrics, contents);
 				} catch (const ParseException &) {
@@ -1111,6 +1215,52 @@ private:
 			}
 		}
 
+		/**
+		 * Queries the limits of the cgroup that this process is in, as seen
+		 * through /sys/fs/cgroup. Inside a container that is the container's
+		 * own cgroup.
+		 */
+		void queryCgroupLimits(SystemMetrics &metrics) const {
+			long long limit, usage, quota, period;
+			string contents;
+
+			limit = readKernelFileAsNumber(cgroup2MemoryMax);
+			if (limit != -1 || !cgroup2MemoryMax.missing) {
+				usage = readKernelFileAsNumber(cgroup2MemoryCurrent);
+			} else {
+				limit = readKernelFileAsNumber(cgroup1MemoryLimit);
+				usage = readKernelFileAsNumber(cgroup1MemoryUsage);
+			}
+			if (limit == -1) {
+				metrics.cgroupMemoryLimit = -1;
+				metrics.cgroupMemoryUsage = -1;
+			} else {
+				metrics.cgroupMemoryLimit = limit / 1024;
+				metrics.cgroupMemoryUsage = (usage == -1) ? -1 : usage / 1024;
+			}
+
+			// cgroup v2's cpu.max contains "<quota> <period>", where quota may be "max".
+			if (readKernelFile(cgroup2CpuMax, contents)) {
+				const char *data = contents.c_str();
+				char *end;
+				quota = strtoll(data, &end, 10);
+				if (end == data) {
+					quota = -1;
+					period = -1;
+				} else {
+					period = strtoll(end, NULL, 10);
+				}
+			} else {
+				quota = readKernelFileAsNumber(cgroup1CpuQuota);
+				period = readKernelFileAsNumber(cgroup1CpuPeriod);
+			}
+			if (quota > 0 && period > 0) {
+				metrics.cgroupCpuQuota = (double) quota / period;
+			} else {
+				metrics.cgroupCpuQuota = -1;
+			}
+		}
+
 		void queryBoottimeFromSysinfo(SystemMetrics &metrics) const {
 			if (metrics.boottime == -1) {
 				struct sysinfo info;
@@ -1399,7 +1549,20 @@ private:
 	}
 
 public:
-	SystemMetricsCollector() {
+	SystemMetricsCollector()
+		#ifdef __linux__
+			: procMeminfo("/proc/meminfo"),
+			  procStat("/proc/stat"),
+			  procVmstat("/proc/vmstat"),
+			  cgroup2MemoryMax("/sys/fs/cgroup/memory.max"),
+			  cgroup2MemoryCurrent("/sys/fs/cgroup/memory.current"),
+			  cgroup2CpuMax("/sys/fs/cgroup/cpu.max"),
+			  cgroup1MemoryLimit("/sys/fs/cgroup/memory/memory.limit_in_bytes"),
+			  cgroup1MemoryUsage("/sys/fs/cgroup/memory/memory.usage_in_bytes"),
+			  cgroup1CpuQuota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us"),
+			  cgroup1CpuPeriod("/sys/fs/cgroup/cpu/cpu.cfs_period_us")
+		#endif
+	{
 		#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
 			pageSize = getpagesize();
 		#endif
@@ -1448,6 +1611,7 @@ public:
 			queryProcVmstat(metrics);
 			queryBoottimeFromSysinfo(metrics);
 			queryLoadAvg(metrics);
+			queryCgroupLimits(metrics);
 		#elif defined(__APPLE__)
 			collectOSX(metrics);
 			queryBoottimeFromSysctl(metrics);
@@ -1459,8 +1623,44 @@ public:
 		#endif
 		queryOsRelease(metrics);
 	}
+
+	/**
+	 * Only collects the cgroup limits, which are also collected by `collect()`.
+	 */
+	void collectCgroupLimits(SystemMetrics &metrics) const {
+		#ifdef __linux__
+			queryCgroupLimits(metrics);
+		#endif
+	}
 };
 
+/**
+ * Returns the number of CPUs that this process can actually use: the number
+ * of CPUs in the system, limited by our CPU affinity mask and by the CPU
+ * quota of our cgroup (rounded up). Inside a container, that is usually a
+ * lot less than the number of CPUs of the host. Always returns at least 1.
+ */
+inline unsigned int
+getUsableCpuCount() {
+	unsigned int result = boost::thread::hardware_concurrency();
+
+	#ifdef __linux__
+		cpu_set_t cpus;
+		if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0) {
+			result = std::min<unsigned int>(result, CPU_COUNT(&cpus));
+		}
+
+		SystemMetricsCollector collector;
+		SystemMetrics metrics;
+		collector.collectCgroupLimits(metrics);
+		if (metrics.cgroupCpuQuota > 0) {
+			result = std::min<unsigned int>(result, (unsigned int) ceil(metrics.cgroupCpuQuota));
+		}
+	#endif
+
+	return std::max(result, 1u);
+}
+
 } // namespace Passenger
 
 #endif /* _PASSENGER_SYSTEM_METRICS_COLLECTOR_H_ */
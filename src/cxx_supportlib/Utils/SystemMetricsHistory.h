@@ -0,0 +1,215 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SYSTEM_METRICS_HISTORY_H_
+#define _PASSENGER_SYSTEM_METRICS_HISTORY_H_
+
+#include <vector>
+#include <ctime>
+#include <jsoncpp/json.h>
+#include <Utils/SystemMetricsCollector.h>
+#include <Utils/JsonUtils.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A fixed-size history of SystemMetrics samples, oldest first. When the
+ * history is full, adding a sample overwrites the oldest one. Samples are
+ * stored in a compact form, and their storage is reused, so after the
+ * history has filled up, adding samples does not allocate memory (unless
+ * the number of CPUs changes).
+ *
+ * Not thread-safe.
+ */
+class SystemMetricsHistory {
+public:
+	struct Sample {
+		time_t time;
+		/** Per-core CPU usage in hundredths of a percent, or -1 if unknown. */
+		vector<short> cpuUsages;
+		/** In hundredths of a percent, or -1 if unknown. */
+		short avgCpuUsage;
+		float loadAverage1;
+		/** Memory sizes are in KB, and are -1 if unknown. */
+		ssize_t ramTotal;
+		ssize_t ramUsed;
+		ssize_t swapUsed;
+		ssize_t cgroupMemoryLimit;
+		ssize_t cgroupMemoryUsage;
+		float cgroupCpuQuota;
+	};
+
+private:
+	vector<Sample> samples;
+	unsigned int capacity;
+	unsigned int start;
+	unsigned int count;
+
+	static short toHundredths(double percent) {
+		if (percent < 0) {
+			return -1;
+		} else {
+			return (short) (percent * 100 + 0.5);
+		}
+	}
+
+	static Json::Value hundredthsToJson(short value) {
+		if (value < 0) {
+			return Json::Value(Json::nullValue);
+		} else {
+			return value / 100.0;
+		}
+	}
+
+	static Json::Value sizeToJson(ssize_t value) {
+		if (value < 0) {
+			return Json::Value(Json::nullValue);
+		} else {
+			return (Json::Int64) value;
+		}
+	}
+
+public:
+	/** By default, one hour of samples taken every 5 seconds. */
+	SystemMetricsHistory(unsigned int _capacity = 720)
+		: capacity(_capacity),
+		  start(0),
+		  count(0)
+	{
+		samples.resize(capacity);
+	}
+
+	void add(const SystemMetrics &metrics, time_t now) {
+		if (capacity == 0) {
+			return;
+		}
+
+		Sample *sample;
+		if (count < capacity) {
+			sample = &samples[(start + count) % capacity];
+			count++;
+		} else {
+			sample = &samples[start];
+			start = (start + 1) % capacity;
+		}
+
+		sample->time = now;
+		sample->cpuUsages.resize(metrics.cpuUsages.size());
+		for (unsigned int i = 0; i < metrics.cpuUsages.size(); i++) {
+			sample->cpuUsages[i] = toHundredths(metrics.cpuUsages[i].usage());
+		}
+		sample->avgCpuUsage = toHundredths(metrics.avgCpuUsage());
+		sample->loadAverage1 = metrics.loadAverage1;
+		sample->ramTotal = metrics.ramTotal;
+		sample->ramUsed = metrics.ramUsed;
+		sample->swapUsed = metrics.swapUsed;
+		sample->cgroupMemoryLimit = metrics.cgroupMemoryLimit;
+		sample->cgroupMemoryUsage = metrics.cgroupMemoryUsage;
+		sample->cgroupCpuQuota = metrics.cgroupCpuQuota;
+	}
+
+	unsigned int size() const {
+		return count;
+	}
+
+	/** Returns the sample at the given index, where 0 is the oldest sample. */
+	const Sample &get(unsigned int index) const {
+		return samples[(start + index) % capacity];
+	}
+
+	/**
+	 * Returns the average of the CPU usage of the samples that were
+	 * taken at or after `since`, as a percentage (0..100), or -1 if there
+	 * are no such samples.
+	 */
+	double avgCpuUsageSince(time_t since) const {
+		double total = 0;
+		unsigned int n = 0;
+
+		for (unsigned int i = 0; i < count; i++) {
+			const Sample &sample = get(i);
+			if (sample.time >= since && sample.avgCpuUsage >= 0) {
+				total += sample.avgCpuUsage;
+				n++;
+			}
+		}
+		if (n == 0) {
+			return -1;
+		} else {
+			return total / n / 100.0;
+		}
+	}
+
+	/**
+	 * Returns the samples that were taken at or after `since`, oldest first.
+	 * Unknown values are null. CPU usages are percentages, memory sizes
+	 * are in KB.
+	 */
+	Json::Value inspectAsJson(time_t since) const {
+		Json::Value doc(Json::arrayValue);
+
+		for (unsigned int i = 0; i < count; i++) {
+			const Sample &sample = get(i);
+			if (sample.time < since) {
+				continue;
+			}
+
+			Json::Value sampleDoc;
+			Json::Value cpusDoc(Json::arrayValue);
+			sampleDoc["time"] = (Json::Int64) sample.time;
+			sampleDoc["cpu_usage"] = hundredthsToJson(sample.avgCpuUsage);
+			for (unsigned int j = 0; j < sample.cpuUsages.size(); j++) {
+				cpusDoc.append(hundredthsToJson(sample.cpuUsages[j]));
+			}
+			sampleDoc["cpu_usages"] = cpusDoc;
+			if (sample.loadAverage1 >= 0) {
+				sampleDoc["load_average_1"] = capFloatPrecision(sample.loadAverage1);
+			} else {
+				sampleDoc["load_average_1"] = Json::Value(Json::nullValue);
+			}
+			sampleDoc["ram_total"] = sizeToJson(sample.ramTotal);
+			sampleDoc["ram_used"] = sizeToJson(sample.ramUsed);
+			sampleDoc["swap_used"] = sizeToJson(sample.swapUsed);
+			if (sample.cgroupMemoryLimit >= 0) {
+				sampleDoc["cgroup_memory_limit"] = sizeToJson(sample.cgroupMemoryLimit);
+				sampleDoc["cgroup_memory_usage"] = sizeToJson(sample.cgroupMemoryUsage);
+			}
+			if (sample.cgroupCpuQuota >= 0) {
+				sampleDoc["cgroup_cpu_quota"] = capFloatPrecision(sample.cgroupCpuQuota);
+			}
+			doc.append(sampleDoc);
+		}
+
+		return doc;
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_SYSTEM_METRICS_HISTORY_H_ */
@@ -34,6 +34,11 @@ namespace Passenger {
 		bool hasForcedUsecValue = false;
 		unsigned long long forcedUsecValue = 0;
 
+		#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+			__thread unsigned long long cachedUsec = 0;
+			__thread unsigned long long cachedMonotonicUsec = 0;
+		#endif
+
 		#if BOOST_OS_MACOS
 			mach_timebase_info_data_t timeInfo;
 		#elif defined(SYSTEM_TIME_HAVE_MONOTONIC_CLOCK)
@@ -64,6 +64,11 @@ namespace SystemTimeData {
 	extern bool hasForcedUsecValue;
 	extern unsigned long long forcedUsecValue;
 
+	#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+		extern __thread unsigned long long cachedUsec;
+		extern __thread unsigned long long cachedMonotonicUsec;
+	#endif
+
 	#if BOOST_OS_MACOS
 		extern mach_timebase_info_data_t timeInfo;
 	#elif defined(SYSTEM_TIME_HAVE_MONOTONIC_CLOCK)
@@ -324,6 +329,70 @@ public:
 		return _getMonotonicUsec<granularity>();
 	}
 
+	/**
+	 * Stores the current wall clock time and monotonic time in a cache
+	 * that belongs to the calling thread. Event loops call this once per
+	 * iteration, so that code that runs in the loop and can tolerate the
+	 * time being a little out of date can use `getCachedUsec()` and
+	 * `getCachedMonotonicUsec()` instead of querying the clock every time.
+	 *
+	 * Without support for thread-local variables, this does nothing and
+	 * the cached variants query the clock like their uncached counterparts.
+	 *
+	 * @throws TimeRetrievalException Something went wrong while retrieving the time.
+	 */
+	static void updateCache() {
+		#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+			SystemTimeData::cachedUsec = getUsec();
+			SystemTimeData::cachedMonotonicUsec = getMonotonicUsec();
+		#endif
+	}
+
+	/**
+	 * Forgets the calling thread's cached time, so that the cached variants
+	 * query the clock again until the next `updateCache()`.
+	 */
+	static void clearCache() {
+		#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+			SystemTimeData::cachedUsec = 0;
+			SystemTimeData::cachedMonotonicUsec = 0;
+		#endif
+	}
+
+	/**
+	 * Like `getUsec()`, but returns the time at which the calling thread
+	 * last called `updateCache()`, if any.
+	 *
+	 * @throws TimeRetrievalException Something went wrong while retrieving the time.
+	 */
+	static unsigned long long getCachedUsec() {
+		#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+			if (SystemTimeData::cachedUsec != 0
+			 && OXT_LIKELY(!SystemTimeData::hasForcedUsecValue))
+			{
+				return SystemTimeData::cachedUsec;
+			}
+		#endif
+		return getUsec();
+	}
+
+	/**
+	 * Like `getMonotonicUsec()`, but returns the time at which the calling
+	 * thread last called `updateCache()`, if any.
+	 *
+	 * @throws TimeRetrievalException Something went wrong while retrieving the time.
+	 */
+	static MonotonicTimeUsec getCachedMonotonicUsec() {
+		#ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
+			if (SystemTimeData::cachedMonotonicUsec != 0
+			 && OXT_LIKELY(!SystemTimeData::hasForcedUsecValue))
+			{
+				return SystemTimeData::cachedMonotonicUsec;
+			}
+		#endif
+		return getMonotonicUsec();
+	}
+
 	/**
 	 * Force get() to return the given value.
 	 */
@@ -0,0 +1,274 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_THREAD_CACHED_OBJECT_POOL_H_
+#define _PASSENGER_THREAD_CACHED_OBJECT_POOL_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <oxt/macros.hpp>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+namespace Passenger {
+
+using namespace std;
+
+
+struct ThreadCachedObjectPoolThreadCache {
+	unsigned int poolId;
+	void *slab;
+};
+
+/**
+ * The slab that the calling thread last used, and the ID of the pool that
+ * it belongs to. Looking this up is much cheaper than a
+ * boost::thread_specific_ptr lookup. Pool IDs are never reused, so a stale
+ * entry never matches.
+ */
+inline ThreadCachedObjectPoolThreadCache &
+_getThreadCachedObjectPoolThreadCache() {
+	static __thread ThreadCachedObjectPoolThreadCache cache = { 0, NULL };
+	return cache;
+}
+
+inline unsigned int
+_generateThreadCachedObjectPoolId() {
+	static boost::atomic<unsigned int> lastId(0);
+	return lastId.fetch_add(1, boost::memory_order_relaxed) + 1;
+}
+
+
+/**
+ * A drop-in replacement for boost::object_pool's malloc() and free(), for
+ * objects that are allocated and freed by multiple threads. Like with
+ * object_pool, malloc() returns uninitialized memory: construct the object
+ * with placement new, and destroy it explicitly before calling free().
+ *
+ * Every thread allocates from its own slab, so malloc() never takes a lock
+ * and objects allocated by the same thread are close together. An object
+ * may be freed by any thread. If that isn't the thread that allocated it,
+ * it's pushed onto the owning slab's lock-free remote free list, which the
+ * owner takes over as a whole once its local free list runs out.
+ *
+ * When a thread exits, its slab becomes idle and is adopted by the next
+ * thread that starts using the pool, so short-lived threads don't leak
+ * memory. The memory is released when both the pool and all threads that
+ * used it are gone. You must free all objects before destroying the pool.
+ */
+template<typename T>
+class ThreadCachedObjectPool: public boost::noncopyable {
+private:
+	struct Slab;
+
+	struct Block {
+		Slab *owner;
+		Block *next;
+		typename boost::aligned_storage<sizeof(T),
+			boost::alignment_of<T>::value>::type storage;
+	};
+
+	struct Slab {
+		/** Only accessed by the thread that owns the slab. */
+		Block *freeList;
+		/** Blocks freed by other threads. */
+		boost::atomic<Block *> remoteFreeList;
+		vector<Block *> chunks;
+		unsigned int nextChunkSize;
+
+		Slab(unsigned int initialChunkSize)
+			: freeList(NULL),
+			  remoteFreeList(NULL),
+			  nextChunkSize(initialChunkSize)
+			{ }
+
+		~Slab() {
+			for (unsigned int i = 0; i < chunks.size(); i++) {
+				delete[] chunks[i];
+			}
+		}
+	};
+
+	/**
+	 * The slabs, which may outlive the pool itself until all threads that
+	 * used it have exited.
+	 */
+	struct Shared {
+		boost::mutex syncher;
+		vector<Slab *> slabs;
+		vector<Slab *> idleSlabs;
+
+		~Shared() {
+			for (unsigned int i = 0; i < slabs.size(); i++) {
+				delete slabs[i];
+			}
+		}
+	};
+
+	struct ThreadRef {
+		boost::shared_ptr<Shared> shared;
+		Slab *slab;
+	};
+
+	const unsigned int id;
+	const unsigned int initialChunkSize;
+	const unsigned int maxChunkSize;
+	boost::shared_ptr<Shared> shared;
+	boost::thread_specific_ptr<ThreadRef> threadRef;
+
+	static void releaseThreadRef(ThreadRef *ref) {
+		ThreadCachedObjectPoolThreadCache &cache = _getThreadCachedObjectPoolThreadCache();
+		if (cache.slab == ref->slab) {
+			// Objects freed later on during thread exit must not go to
+			// the local free list of a slab that we no longer own.
+			cache.poolId = 0;
+			cache.slab = NULL;
+		}
+		{
+			boost::lock_guard<boost::mutex> l(ref->shared->syncher);
+			ref->shared->idleSlabs.push_back(ref->slab);
+		}
+		delete ref;
+	}
+
+	static Block *getBlock(T *object) {
+		return (Block *) ((char *) object - offsetof(Block, storage));
+	}
+
+	Slab *getThreadSlab() {
+		ThreadCachedObjectPoolThreadCache &cache = _getThreadCachedObjectPoolThreadCache();
+		if (OXT_LIKELY(cache.poolId == id)) {
+			return static_cast<Slab *>(cache.slab);
+		} else {
+			return lookupThreadSlab(cache);
+		}
+	}
+
+	Slab *lookupThreadSlab(ThreadCachedObjectPoolThreadCache &cache) {
+		ThreadRef *ref = threadRef.get();
+
+		// The thread_specific_ptr may still hold a reference from a
+		// destroyed pool that lived at the same address.
+		if (ref == NULL || ref->shared != shared) {
+			ref = new ThreadRef();
+			ref->shared = shared;
+			ref->slab = adoptOrCreateSlab();
+			threadRef.reset(ref);
+		}
+
+		cache.poolId = id;
+		cache.slab = ref->slab;
+		return ref->slab;
+	}
+
+	Slab *adoptOrCreateSlab() {
+		boost::lock_guard<boost::mutex> l(shared->syncher);
+		if (shared->idleSlabs.empty()) {
+			Slab *slab = new Slab(initialChunkSize);
+			shared->slabs.push_back(slab);
+			return slab;
+		} else {
+			Slab *slab = shared->idleSlabs.back();
+			shared->idleSlabs.pop_back();
+			return slab;
+		}
+	}
+
+	void refill(Slab *slab) {
+		slab->freeList = slab->remoteFreeList.exchange(NULL,
+			boost::memory_order_acquire);
+		if (slab->freeList != NULL) {
+			return;
+		}
+
+		unsigned int size = slab->nextChunkSize;
+		Block *chunk = new Block[size];
+		slab->chunks.push_back(chunk);
+		for (unsigned int i = 0; i < size; i++) {
+			chunk[i].owner = slab;
+			chunk[i].next = (i + 1 < size) ? &chunk[i + 1] : NULL;
+		}
+		slab->freeList = chunk;
+		if (slab->nextChunkSize < maxChunkSize) {
+			slab->nextChunkSize = std::min(slab->nextChunkSize * 2, maxChunkSize);
+		}
+	}
+
+public:
+	ThreadCachedObjectPool(unsigned int _initialChunkSize = 32,
+		unsigned int _maxChunkSize = 0)
+		: id(_generateThreadCachedObjectPoolId()),
+		  initialChunkSize(_initialChunkSize),
+		  maxChunkSize(_maxChunkSize == 0 ? _initialChunkSize : _maxChunkSize),
+		  shared(boost::make_shared<Shared>()),
+		  threadRef(releaseThreadRef)
+		{ }
+
+	T *malloc() {
+		Slab *slab = getThreadSlab();
+		if (OXT_UNLIKELY(slab->freeList == NULL)) {
+			refill(slab);
+		}
+		Block *block = slab->freeList;
+		slab->freeList = block->next;
+		return reinterpret_cast<T *>(&block->storage);
+	}
+
+	void free(T *object) {
+		Block *block = getBlock(object);
+		Slab *slab = block->owner;
+		ThreadCachedObjectPoolThreadCache &cache = _getThreadCachedObjectPoolThreadCache();
+
+		if (OXT_LIKELY(cache.poolId == id && cache.slab == slab)) {
+			block->next = slab->freeList;
+			slab->freeList = block;
+		} else {
+			// The owner only ever takes over the entire list, so there
+			// is no ABA problem here.
+			Block *head = slab->remoteFreeList.load(boost::memory_order_relaxed);
+			do {
+				block->next = head;
+			} while (!slab->remoteFreeList.compare_exchange_weak(head, block,
+				boost::memory_order_release, boost::memory_order_relaxed));
+		}
+	}
+
+	/** Returns the number of slabs, including idle ones. For unit tests. */
+	unsigned int getSlabCount() const {
+		boost::lock_guard<boost::mutex> l(shared->syncher);
+		return shared->slabs.size();
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_THREAD_CACHED_OBJECT_POOL_H_ */
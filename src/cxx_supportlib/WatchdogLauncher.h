@@ -275,25 +275,6 @@ private:
 		}
 	}
 
-	/**
-	 * Behaves like `waitpid(pid, status, WNOHANG)`, but waits at most
-	 * `timeout` miliseconds for the process to exit.
-	 */
-	static int timedWaitPid(pid_t pid, int *status, unsigned long long timeout) {
-		Timer<SystemTime::GRAN_10MSEC> timer;
-		int ret;
-
-		do {
-			ret = syscalls::waitpid(pid, status, WNOHANG);
-			if (ret > 0 || ret == -1) {
-				return ret;
-			} else {
-				syscalls::usleep(10000);
-			}
-		} while (timer.elapsed() < timeout);
-		return 0; // timed out
-	}
-
 public:
 	/**
 	 * Construct a WatchdogLauncher object. The watchdog won't be started
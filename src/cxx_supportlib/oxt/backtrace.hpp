@@ -122,6 +122,10 @@
  * <h2>Compilation options</h2>
  * Define OXT_DISABLE_BACKTRACES to disable backtrace support. The backtrace
  * functions as provided by this header will become empty stubs.
+ *
+ * Define OXT_LIGHTWEIGHT_BACKTRACES to make TRACE_POINT() as cheap as a
+ * thread-local pointer store, at the cost of backtraces of other running
+ * threads being best-effort. See detail/backtrace_enabled.hpp.
  */
 
 #if defined(NDEBUG) || defined(OXT_DISABLE_BACKTRACES)
@@ -28,9 +28,31 @@
 #define OXT_BACKTRACE_IS_ENABLED
 
 #include <boost/current_function.hpp>
+#include "../macros.hpp"
+
+/*
+ * In lightweight mode, each thread's backtrace is an intrusive linked list
+ * of trace_points, headed by a __thread pointer. Pushing and popping a
+ * trace point is then a single thread-local pointer store, without the
+ * spin lock and the vector of the default mode. The price is that other
+ * threads read that list without synchronization, so backtraces of
+ * running threads (e.g. in oxt::thread::all_backtraces()) are best-effort,
+ * and their data functions are not called. Backtraces of the calling
+ * thread, including those captured by tracable_exception, are exact.
+ */
+#if defined(OXT_LIGHTWEIGHT_BACKTRACES) && defined(OXT_THREAD_LOCAL_KEYWORD_SUPPORTED)
+	#define OXT_BACKTRACE_IS_LIGHTWEIGHT
+#endif
 
 namespace oxt {
 
+struct trace_point;
+
+#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+	/** The innermost trace_point of the calling thread. */
+	extern __thread trace_point *current_trace_point;
+#endif
+
 /**
  * A single point in a backtrace. Creating this object will cause it
  * to push itself to the thread's backtrace list. This backtrace list
@@ -57,15 +79,71 @@ struct trace_point {
 	unsigned short line;
 	bool m_detached;
 	bool m_hasDataFunc;
+	#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+		trace_point *m_prev;
+	#endif
+
+	#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+		trace_point(const char *_function, const char *_source, unsigned short _line,
+			const char *_data = 0)
+			: function(_function),
+			  source(_source),
+			  line(_line),
+			  m_detached(false),
+			  m_hasDataFunc(false),
+			  m_prev(current_trace_point)
+		{
+			u.data = _data;
+			current_trace_point = this;
+		}
+
+		trace_point(const char *_function, const char *_source, unsigned short _line,
+			DataFunction _dataFunc, void *_userData, bool _detached = false)
+			: function(_function),
+			  source(_source),
+			  line(_line),
+			  m_detached(_detached),
+			  m_hasDataFunc(true),
+			  m_prev(current_trace_point)
+		{
+			u.dataFunc.func = _dataFunc;
+			u.dataFunc.userData = _userData;
+			if (!_detached) {
+				current_trace_point = this;
+			}
+		}
+
+		trace_point(const char *_function, const char *_source, unsigned short _line,
+			const char *_data, const detached &detached_tag)
+			: function(_function),
+			  source(_source),
+			  line(_line),
+			  m_detached(true),
+			  m_hasDataFunc(false),
+			  m_prev(0)
+		{
+			u.data = _data;
+		}
+
+		~trace_point() {
+			if (OXT_LIKELY(!m_detached)) {
+				current_trace_point = m_prev;
+			}
+		}
+	#else
+		trace_point(const char *function, const char *source, unsigned short line,
+			const char *data = 0);
+		trace_point(const char *function, const char *source, unsigned short line,
+			DataFunction dataFunc, void *userData, bool detached = false);
+		trace_point(const char *function, const char *source, unsigned short line,
+			const char *data, const detached &detached_tag);
+		~trace_point();
+	#endif
 
-	trace_point(const char *function, const char *source, unsigned short line,
-		const char *data = 0);
-	trace_point(const char *function, const char *source, unsigned short line,
-		DataFunction dataFunc, void *userData, bool detached = false);
-	trace_point(const char *function, const char *source, unsigned short line,
-		const char *data, const detached &detached_tag);
-	~trace_point();
-	void update(const char *source, unsigned short line);
+	void update(const char *source, unsigned short line) {
+		this->source = source;
+		this->line = line;
+	}
 };
 
 #define TRACE_POINT() oxt::trace_point __p(BOOST_CURRENT_FUNCTION, __FILE__, __LINE__)
@@ -71,7 +71,10 @@ struct thread_local_context {
 	 */
 	spin_lock syscall_interruption_lock;
 
-	#ifdef OXT_BACKTRACE_IS_ENABLED
+	#if defined(OXT_BACKTRACE_IS_LIGHTWEIGHT)
+		/** Points to the thread's `current_trace_point`. */
+		trace_point **backtrace_top;
+	#elif defined(OXT_BACKTRACE_IS_ENABLED)
 		std::vector<trace_point *> backtrace_list;
 		spin_lock backtrace_lock;
 	#endif
@@ -42,6 +42,7 @@
 	#include <cstring>
 #endif
 #include <cstring>
+#include <algorithm>
 
 
 namespace oxt {
@@ -60,6 +61,9 @@ static global_context_t *global_context = NULL;
 #ifdef OXT_THREAD_LOCAL_KEYWORD_SUPPORTED
 	static __thread thread_local_context_ptr *local_context = NULL;
 	__thread void *thread_signature = NULL;
+	#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+		__thread trace_point *current_trace_point = NULL;
+	#endif
 
 	static void
 	init_thread_local_context_support() {
@@ -69,6 +73,9 @@ static global_context_t *global_context = NULL;
 	void
 	set_thread_local_context(const thread_local_context_ptr &ctx) {
 		local_context = new thread_local_context_ptr(ctx);
+		#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+			ctx->backtrace_top = &current_trace_point;
+		#endif
 	}
 
 	static void
@@ -133,6 +140,26 @@ static global_context_t *global_context = NULL;
 
 #ifdef OXT_BACKTRACE_IS_ENABLED
 
+#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+
+/**
+ * Returns the given thread's trace points, outermost first. Only exact
+ * if `ctx` belongs to the calling thread.
+ */
+static vector<trace_point *>
+lightweight_backtrace_list(const thread_local_context *ctx) {
+	vector<trace_point *> result;
+	trace_point *p = (ctx->backtrace_top == NULL) ? NULL : *ctx->backtrace_top;
+	while (p != NULL) {
+		result.push_back(p);
+		p = p->m_prev;
+	}
+	std::reverse(result.begin(), result.end());
+	return result;
+}
+
+#else
+
 trace_point::trace_point(const char *_function, const char *_source, unsigned short _line,
 	const char *_data)
 	: function(_function),
@@ -194,21 +221,22 @@ trace_point::~trace_point() {
 	}
 }
 
-void
-trace_point::update(const char *source, unsigned short line) {
-	this->source = source;
-	this->line = line;
-}
+#endif /* OXT_BACKTRACE_IS_LIGHTWEIGHT */
 
 
 tracable_exception::tracable_exception() {
 	thread_local_context *ctx = get_thread_local_context();
 	if (OXT_LIKELY(ctx != NULL)) {
-		spin_lock::scoped_lock l(ctx->backtrace_lock);
-		vector<trace_point *>::const_iterator it, end = ctx->backtrace_list.end();
+		#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+			const vector<trace_point *> backtrace_list = lightweight_backtrace_list(ctx);
+		#else
+			spin_lock::scoped_lock l(ctx->backtrace_lock);
+			const vector<trace_point *> &backtrace_list = ctx->backtrace_list;
+		#endif
+		vector<trace_point *>::const_iterator it, end = backtrace_list.end();
 
-		backtrace_copy.reserve(ctx->backtrace_list.size());
-		for (it = ctx->backtrace_list.begin(); it != end; it++) {
+		backtrace_copy.reserve(backtrace_list.size());
+		for (it = backtrace_list.begin(); it != end; it++) {
 			trace_point *p;
 			if ((*it)->m_hasDataFunc) {
 				p = new trace_point(
@@ -273,7 +301,7 @@ tracable_exception::~tracable_exception() throw() {
 
 template<typename Collection>
 static string
-format_backtrace(const Collection &backtrace_list) {
+format_backtrace(const Collection &backtrace_list, bool call_data_functions = true) {
 	if (backtrace_list.empty()) {
 		return "     (empty)";
 	} else {
@@ -294,7 +322,7 @@ format_backtrace(const Collection &backtrace_list) {
 				}
 				result << " (" << source << ":" << p->line << ")";
 				if (p->m_hasDataFunc) {
-					if (p->u.dataFunc.func != NULL) {
+					if (p->u.dataFunc.func != NULL && call_data_functions) {
 						char buf[64];
 
 						memset(buf, 0, sizeof(buf));
@@ -370,7 +398,9 @@ thread_local_context::thread_local_context()
 		tid = syscall(SYS_gettid);
 	#endif
 	syscall_interruption_lock.lock();
-	#ifdef OXT_BACKTRACE_IS_ENABLED
+	#if defined(OXT_BACKTRACE_IS_LIGHTWEIGHT)
+		backtrace_top = NULL;
+	#elif defined(OXT_BACKTRACE_IS_ENABLED)
 		backtrace_list.reserve(50);
 	#endif
 }
@@ -437,7 +467,10 @@ thread::name() const throw() {
 
 std::string
 thread::backtrace() const throw() {
-	#ifdef OXT_BACKTRACE_IS_ENABLED
+	#if defined(OXT_BACKTRACE_IS_LIGHTWEIGHT)
+		return format_backtrace(lightweight_backtrace_list(context.get()),
+			context.get() == get_thread_local_context());
+	#elif defined(OXT_BACKTRACE_IS_ENABLED)
 		spin_lock::scoped_lock l(context->backtrace_lock);
 		return format_backtrace(context->backtrace_list);
 	#else
@@ -465,8 +498,13 @@ thread::all_backtraces() throw() {
 				#endif
 				result << "):" << endl;
 
-				spin_lock::scoped_lock l(ctx->backtrace_lock);
-				std::string bt = format_backtrace(ctx->backtrace_list);
+				#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+					std::string bt = format_backtrace(lightweight_backtrace_list(ctx.get()),
+						ctx.get() == get_thread_local_context());
+				#else
+					spin_lock::scoped_lock l(ctx->backtrace_lock);
+					std::string bt = format_backtrace(ctx->backtrace_list);
+				#endif
 				result << bt;
 				if (bt.empty() || bt[bt.size() - 1] != '\n') {
 					result << endl;
@@ -487,8 +525,12 @@ thread::current_backtrace() throw() {
 	#ifdef OXT_BACKTRACE_IS_ENABLED
 		thread_local_context *ctx = get_thread_local_context();
 		if (OXT_LIKELY(ctx != NULL)) {
-			spin_lock::scoped_lock l(ctx->backtrace_lock);
-			return format_backtrace(ctx->backtrace_list);
+			#ifdef OXT_BACKTRACE_IS_LIGHTWEIGHT
+				return format_backtrace(lightweight_backtrace_list(ctx));
+			#else
+				spin_lock::scoped_lock l(ctx->backtrace_lock);
+				return format_backtrace(ctx->backtrace_list);
+			#endif
 		} else {
 			return "(OXT not initialized)";
 		}
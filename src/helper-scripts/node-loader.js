@@ -118,6 +118,7 @@ vm.runInThisContext = function() {
 };
 
 var LineReader = require('phusion_passenger/line_reader').LineReader;
+var AppMetricsPage = require('phusion_passenger/app_metrics_page').AppMetricsPage;
 var ustLog = require('phusion_passenger/ustrouter_connector');
 
 var instrumentModulePaths = [ 'phusion_passenger/log_express', 'phusion_passenger/log_mongodb'];
@@ -333,6 +334,14 @@ function doneListening(server, callback) {
 	server.emit('listening');
 }
 
+function getLocalRemoteAddress() {
+	return '127.0.0.1';
+}
+
+function getLocalRemotePort() {
+	return 0;
+}
+
 function installServer() {
 	var server = this;
 	if (!PhusionPassenger._appInstalled) {
@@ -342,15 +351,30 @@ function installServer() {
 		// Ensure that req.connection.remoteAddress and remotePort return something
 		// instead of undefined. Apps like Etherpad expect it.
 		// See https://github.com/phusion/passenger/issues/1224
-		addListenerAtBeginning(server, 'request', function(req) {
-			req.connection.__defineGetter__('remoteAddress', function() {
-				return '127.0.0.1';
+		// The Passenger core keeps connections alive across requests, so we
+		// do this once per connection instead of once per request.
+		addListenerAtBeginning(server, 'connection', function(socket) {
+			Object.defineProperty(socket, 'remoteAddress', {
+				get: getLocalRemoteAddress,
+				configurable: true
 			});
-			req.connection.__defineGetter__('remotePort', function() {
-				return 0;
+			Object.defineProperty(socket, 'remotePort', {
+				get: getLocalRemotePort,
+				configurable: true
 			});
 		});
 
+		// The Passenger core decides when to close idle keep-alive connections.
+		// If Node closed them on its own (after 5 seconds by default), the core
+		// could send a request on a connection that is just being closed.
+		if (server.keepAliveTimeout !== undefined) {
+			server.keepAliveTimeout = 0;
+		}
+
+		if (PhusionPassenger.options.metrics_file) {
+			installAppMetricsPage(server);
+		}
+
 		var listenTries = 0;
 		doListen(server, listenTries, extractCallback(arguments));
 
@@ -366,6 +390,25 @@ function installServer() {
 	}
 }
 
+function installAppMetricsPage(server) {
+	var page = AppMetricsPage.open(PhusionPassenger.options.metrics_file);
+	if (!page) {
+		return;
+	}
+	addListenerAtBeginning(server, 'request', function(req, res) {
+		var finished = false;
+		function requestFinished() {
+			if (!finished) {
+				finished = true;
+				page.requestFinished();
+			}
+		}
+		page.requestBegan();
+		res.once('finish', requestFinished);
+		res.once('close', requestFinished);
+	});
+}
+
 function listenAndMaybeInstall(port) {
 	if (port === 'passenger' || port == '/passenger') {
 		if (!PhusionPassenger._appInstalled) {
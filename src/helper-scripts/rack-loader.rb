@@ -125,8 +125,10 @@ def self.load_app
     load_app
     LoaderSharedHelpers.before_handling_requests(false, options)
     handler = RequestHandler.new(STDIN, options.merge("app" => app))
+    warmup_duration = LoaderSharedHelpers.warm_up_request_handler(handler)
     LoaderSharedHelpers.advertise_readiness
     LoaderSharedHelpers.advertise_sockets(STDOUT, handler)
+    LoaderSharedHelpers.advertise_warmup_duration(STDOUT, warmup_duration)
     puts "!> "
     handler.main_loop
     handler.cleanup
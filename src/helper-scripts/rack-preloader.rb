@@ -111,6 +111,7 @@ def self.preload_app
         TOPLEVEL_BINDING, rackup_file)
 
       LoaderSharedHelpers.after_loading_app_code(options)
+      PreloaderSharedHelpers.run_warmup_script(options)
     rescue Exception => e
       LoaderSharedHelpers.about_to_abort(options, e)
       puts "!> Error"
@@ -133,6 +134,7 @@ def self.negotiate_spawn_command
 
         LoaderSharedHelpers.before_handling_requests(true, options)
         handler = RequestHandler.new(STDIN, options.merge("app" => app))
+        warmup_duration = LoaderSharedHelpers.warm_up_request_handler(handler)
       rescue Exception => e
         LoaderSharedHelpers.about_to_abort(options, e)
         puts "!> Error"
@@ -143,6 +145,7 @@ def self.negotiate_spawn_command
 
       LoaderSharedHelpers.advertise_readiness
       LoaderSharedHelpers.advertise_sockets(STDOUT, handler)
+      LoaderSharedHelpers.advertise_warmup_duration(STDOUT, warmup_duration)
       puts "!> "
       return handler
     end
@@ -24,7 +24,11 @@
 #  THE SOFTWARE.
 
 import sys, os, re, imp, threading, signal, traceback, socket, select, struct, logging, errno
-import tempfile
+import tempfile, inspect, mmap, gc, time, io
+try:
+	import asyncio
+except ImportError:
+	asyncio = None
 
 options = {}
 
@@ -114,8 +118,35 @@ def debug_and_exit(sig, frame):
 	# handler and no SIGQUIT handler.
 	signal.signal(signal.SIGABRT, debug_and_exit)
 
-def advertise_sockets(socket_filename):
-	print("!> socket: main;unix:%s;session;1" % socket_filename)
+# The number of threads that handle WSGI requests, set with the
+# PASSENGER_PYTHON_THREADS environment variable. Each thread handles one
+# request at a time.
+def get_thread_count():
+	try:
+		return max(int(os.environ.get('PASSENGER_PYTHON_THREADS', '1')), 1)
+	except ValueError:
+		abort("PASSENGER_PYTHON_THREADS must be a number")
+
+# Whether the app is an ASGI app instead of a WSGI app. ASGI apps are async
+# callables, which we detect automatically. Set PASSENGER_PYTHON_INTERFACE to
+# 'asgi' or 'wsgi' if detection doesn't work for your app.
+def is_asgi_app(app):
+	interface = os.environ.get('PASSENGER_PYTHON_INTERFACE', '')
+	if interface == 'asgi':
+		return True
+	elif interface == 'wsgi' or not hasattr(inspect, 'iscoroutinefunction'):
+		return False
+	else:
+		return inspect.iscoroutinefunction(app) or \
+			inspect.iscoroutinefunction(getattr(app, '__call__', None))
+
+# The concurrency tells the Passenger core how many requests this process
+# can handle at the same time, where 0 means unlimited.
+def advertise_sockets(socket_filename, concurrency, shm_ring = False):
+	if shm_ring:
+		print("!> socket: main;unix:%s;session;%d;shm_ring" % (socket_filename, concurrency))
+	else:
+		print("!> socket: main;unix:%s;session;%d" % (socket_filename, concurrency))
 	print("!> ")
 
 if sys.version_info[0] >= 3:
@@ -138,12 +169,326 @@ def str_to_bytes(s):
 		return s
 
 
+# Publishes metrics about this process, such as its garbage collection
+# activity, through the file that the Passenger core passed to us in the
+# 'metrics_file' spawn option. The core has mapped that file into memory and
+# reads it without communicating with us. See
+# src/agent/Core/SpawningKit/AppMetricsPage.h for the layout.
+class AppMetricsPage:
+	FIELDS_OFFSET = 8
+	FIELDS_FORMAT = '=QQQQQLL'
+	FLAGS_OFFSET = 56
+	FLAG_GC_IN_PROGRESS = 1
+
+	def __init__(self, path, threads_total):
+		fd = os.open(path, os.O_RDWR)
+		try:
+			self.map = mmap.mmap(fd, 4096, mmap.MAP_SHARED,
+				mmap.PROT_READ | mmap.PROT_WRITE)
+		finally:
+			os.close(fd)
+		self.lock = threading.Lock()
+		self.sequence = 0
+		self.threads_busy = 0
+		self.threads_total = threads_total
+		self.gc_count = 0
+		self.gc_time = 0
+		self.gc_start_time = None
+		self.update()
+		struct.pack_into('=4sL', self.map, 0, b'PSGM', 1)
+		if hasattr(gc, 'callbacks'):
+			gc.callbacks.append(self.gc_callback)
+
+	def request_began(self):
+		with self.lock:
+			self.threads_busy += 1
+			self.write_fields()
+
+	def request_finished(self):
+		with self.lock:
+			self.threads_busy -= 1
+			self.write_fields()
+
+	def update(self):
+		with self.lock:
+			self.write_fields()
+
+	# Called by the garbage collector, possibly while this thread holds
+	# the lock, so it must not take it. The flags are not protected by the
+	# sequence number, and the counters are published by the next update.
+	def gc_callback(self, phase, info):
+		if phase == 'start':
+			self.gc_start_time = time.time()
+			struct.pack_into('=L', self.map, self.FLAGS_OFFSET, self.FLAG_GC_IN_PROGRESS)
+		elif self.gc_start_time is not None:
+			struct.pack_into('=L', self.map, self.FLAGS_OFFSET, 0)
+			self.gc_count += 1
+			self.gc_time += int((time.time() - self.gc_start_time) * 1000000)
+			self.gc_start_time = None
+
+	def write_fields(self):
+		# Odd sequence numbers tell the core that the fields are being
+		# changed, so that it doesn't read a half-written update.
+		struct.pack_into('=Q', self.map, self.FIELDS_OFFSET, self.sequence + 1)
+		struct.pack_into(self.FIELDS_FORMAT, self.map, self.FIELDS_OFFSET,
+			self.sequence + 1, int(time.time() * 1000000), self.gc_count,
+			self.gc_time, 0, self.threads_busy, self.threads_total)
+		self.sequence += 2
+		struct.pack_into('=Q', self.map, self.FIELDS_OFFSET, self.sequence)
+
+def open_app_metrics_page(threads_total):
+	if 'metrics_file' not in options:
+		return None
+	try:
+		return AppMetricsPage(options['metrics_file'], threads_total)
+	except (OSError, IOError, mmap.error):
+		return None
+
+
+# Shared memory rings through which the Passenger core may exchange session
+# data with this process, instead of through the session socket. The core
+# created the file and passed its path in the 'shm_ring_file' spawn option.
+# See src/cxx_supportlib/Utils/ShmRing.h for the layout and the protocol.
+#
+# The ring positions and flags are read and written with native 32-bit
+# struct formats, which the core sees as single loads and stores.
+class ShmRingFile:
+	HEADER_SIZE = 64
+	SLOT_HEADER_SIZE = 64
+	RING_HEADER_SIZE = 128
+
+	def __init__(self, path):
+		fd = os.open(path, os.O_RDWR)
+		try:
+			size = os.fstat(fd).st_size
+			self.map = mmap.mmap(fd, size, mmap.MAP_SHARED,
+				mmap.PROT_READ | mmap.PROT_WRITE)
+		finally:
+			os.close(fd)
+		magic, version, self.slot_count, self.capacity = \
+			struct.unpack_from('=4sLLL', self.map, 0)
+		if magic != b'PSGR' or version != 1:
+			raise ValueError("Unsupported shared memory ring file")
+		self.slot_size = self.SLOT_HEADER_SIZE + \
+			2 * (self.RING_HEADER_SIZE + self.capacity)
+
+	def slot_offset(self, index):
+		return self.HEADER_SIZE + index * self.slot_size
+
+	def ring(self, index, direction):
+		return ShmRing(self.map, self.slot_offset(index) + self.SLOT_HEADER_SIZE +
+			direction * (self.RING_HEADER_SIZE + self.capacity), self.capacity)
+
+	def release_slot(self, index):
+		struct.pack_into('I', self.map, self.slot_offset(index), 0)
+
+class ShmRing:
+	TAIL = 0
+	PRODUCER_WAITING = 4
+	CLOSED = 8
+	HEAD = 64
+	CONSUMER_WAITING = 68
+
+	def __init__(self, map, offset, capacity):
+		self.map = map
+		self.offset = offset
+		self.data = offset + ShmRingFile.RING_HEADER_SIZE
+		self.capacity = capacity
+
+	def get(self, field):
+		return struct.unpack_from('I', self.map, self.offset + field)[0]
+
+	def set(self, field, value):
+		struct.pack_into('I', self.map, self.offset + field, value & 0xFFFFFFFF)
+
+	def readable(self):
+		return (self.get(self.TAIL) - self.get(self.HEAD)) & 0xFFFFFFFF
+
+	def writable(self):
+		return self.capacity - self.readable()
+
+	def read(self, size):
+		head = self.get(self.HEAD)
+		n = min(size, (self.get(self.TAIL) - head) & 0xFFFFFFFF)
+		start = head % self.capacity
+		first = min(n, self.capacity - start)
+		data = self.map[self.data + start:self.data + start + first]
+		if n > first:
+			data += self.map[self.data:self.data + n - first]
+		self.set(self.HEAD, head + n)
+		return data
+
+	def write(self, data, offset):
+		tail = self.get(self.TAIL)
+		n = min(len(data) - offset,
+			self.capacity - ((tail - self.get(self.HEAD)) & 0xFFFFFFFF))
+		start = tail % self.capacity
+		first = min(n, self.capacity - start)
+		self.map[self.data + start:self.data + start + first] = \
+			data[offset:offset + first]
+		if n > first:
+			self.map[self.data:self.data + n - first] = \
+				data[offset + first:offset + n]
+		self.set(self.TAIL, tail + n)
+		return n
+
+	def at_eof(self):
+		return self.get(self.CLOSED) != 0 and self.readable() == 0
+
+def open_shm_ring_file():
+	if 'shm_ring_file' not in options:
+		return None
+	try:
+		return ShmRingFile(options['shm_ring_file'])
+	except (OSError, IOError, ValueError, mmap.error):
+		return None
+
+# A session socket whose data goes through a slot of the ShmRingFile. Only
+# implements the socket methods that RequestHandler uses.
+class ShmRingConnection:
+	# We don't rely on the core's doorbells alone while waiting, in case
+	# the platform reorders our flag updates despite memory_barrier().
+	WAIT_TIMEOUT = 0.05
+
+	def __init__(self, sock, ring_file, index):
+		self.sock = sock
+		self.ring_file = ring_file
+		self.index = index
+		self.input = ring_file.ring(index, 0)
+		self.output = ring_file.ring(index, 1)
+		self.barrier_lock = threading.Lock()
+		self.peer_closed = False
+		self.closed = False
+
+	# Python has no memory barriers, but taking and releasing a lock
+	# issues one on the platforms that Passenger supports.
+	def memory_barrier(self):
+		self.barrier_lock.acquire()
+		self.barrier_lock.release()
+
+	def fileno(self):
+		return self.sock.fileno()
+
+	def ring_doorbell(self):
+		self.sock.sendall(b'\0')
+
+	def wait_for_doorbell(self):
+		if select.select([self.sock], [], [], self.WAIT_TIMEOUT)[0]:
+			if not self.sock.recv(64):
+				self.peer_closed = True
+
+	def wake_consumer(self):
+		self.memory_barrier()
+		if self.output.get(ShmRing.CONSUMER_WAITING):
+			self.ring_doorbell()
+
+	def recv(self, size):
+		while True:
+			data = self.input.read(size)
+			if data:
+				self.memory_barrier()
+				if self.input.get(ShmRing.PRODUCER_WAITING):
+					self.ring_doorbell()
+				return data
+			elif self.input.at_eof() or self.peer_closed:
+				return b''
+			self.input.set(ShmRing.CONSUMER_WAITING, 1)
+			self.memory_barrier()
+			if self.input.readable() == 0 and self.input.get(ShmRing.CLOSED) == 0:
+				self.wait_for_doorbell()
+			self.input.set(ShmRing.CONSUMER_WAITING, 0)
+
+	def sendall(self, data):
+		offset = 0
+		while offset < len(data):
+			n = self.output.write(data, offset)
+			offset += n
+			if n > 0:
+				self.wake_consumer()
+			else:
+				self.output.set(ShmRing.PRODUCER_WAITING, 1)
+				self.memory_barrier()
+				if self.output.writable() == 0 and not self.peer_closed:
+					self.wait_for_doorbell()
+				self.output.set(ShmRing.PRODUCER_WAITING, 0)
+				if self.peer_closed:
+					raise IOError(errno.EPIPE, os.strerror(errno.EPIPE))
+
+	def makefile(self, mode = 'rb', bufsize = -1):
+		return io.BufferedReader(ShmRingInput(self), max(bufsize, 512))
+
+	def shutdown(self, how):
+		if how != socket.SHUT_RD and self.output.get(ShmRing.CLOSED) == 0:
+			self.output.set(ShmRing.CLOSED, 1)
+			self.wake_consumer()
+
+	def close(self):
+		if self.closed:
+			return
+		self.closed = True
+		try:
+			self.shutdown(socket.SHUT_WR)
+		except (IOError, socket.error):
+			pass
+		# We must not touch the slot after this.
+		self.memory_barrier()
+		self.ring_file.release_slot(self.index)
+		self.sock.close()
+
+class ShmRingInput(io.RawIOBase):
+	def __init__(self, connection):
+		self.connection = connection
+
+	def readable(self):
+		return True
+
+	def readinto(self, buf):
+		data = self.connection.recv(len(buf))
+		buf[:len(data)] = data
+		return len(data)
+
+
+def parse_session_header(buf):
+	headers = buf.split(b"\0")
+	headers.pop() # Remove trailing "\0"
+	env = {}
+	i = 0
+	while i < len(headers):
+		env[bytes_to_str(headers[i])] = bytes_to_str(headers[i + 1])
+		i += 2
+	return env
+
+
 class RequestHandler:
-	def __init__(self, server_socket, owner_pipe, app):
+	def __init__(self, server_socket, owner_pipe, app, thread_count = 1,
+		metrics_page = None, shm_ring_file = None):
 		self.server = server_socket
 		self.owner_pipe = owner_pipe
 		self.app = app
-	
+		self.thread_count = thread_count
+		self.metrics_page = metrics_page
+		self.shm_ring_file = shm_ring_file
+
+	def run(self):
+		if self.thread_count == 1:
+			self.main_loop()
+			return
+
+		# All threads accept connections on the same server socket, so it must
+		# be non-blocking: otherwise a thread that lost the race for a connection
+		# blocks in accept() and doesn't notice that it should shut down.
+		self.server.setblocking(False)
+		threads = []
+		for i in range(self.thread_count):
+			thread = threading.Thread(target = self.main_loop,
+				name = "Worker %d" % (i + 1))
+			thread.daemon = True
+			thread.start()
+			threads.append(thread)
+		for thread in threads:
+			while thread.is_alive():
+				thread.join(1)
+
 	def main_loop(self):
 		done = False
 		try:
@@ -153,6 +498,8 @@ def main_loop(self):
 					done = True
 					break
 				socket_hijacked = False
+				if self.metrics_page:
+					self.metrics_page.request_began()
 				try:
 					try:
 						env, input_stream = self.parse_request(client)
@@ -170,6 +517,8 @@ def main_loop(self):
 					except Exception:
 						logging.exception("WSGI application raised an exception!")
 				finally:
+					if self.metrics_page:
+						self.metrics_page.request_finished()
 					if not socket_hijacked:
 						try:
 							# Shutdown the socket like this just in case the app
@@ -185,11 +534,37 @@ def main_loop(self):
 			pass
 
 	def accept_connection(self):
-		result = select.select([self.owner_pipe, self.server.fileno()], [], [])[0]
-		if self.server.fileno() in result:
-			return self.server.accept()
-		else:
-			return (None, None)
+		while True:
+			result = select.select([self.owner_pipe, self.server.fileno()], [], [])[0]
+			if self.server.fileno() not in result:
+				return (None, None)
+			try:
+				client, address = self.server.accept()
+			except socket.error as e:
+				if e.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+					# Another thread accepted the connection.
+					continue
+				raise
+			client.setblocking(True)
+			if self.shm_ring_file:
+				client = self.attach_shm_ring(client)
+			return (client, address)
+
+	# The core starts every connection with the index of the ring slot that
+	# it uses, or 0xFFFFFFFF if the data goes over the socket.
+	def attach_shm_ring(self, client):
+		buf = b''
+		while len(buf) < 4:
+			tmp = client.recv(4 - len(buf))
+			if len(tmp) == 0:
+				break
+			buf += tmp
+		if len(buf) < 4:
+			return client
+		index = struct.unpack('>I', buf)[0]
+		if index >= self.shm_ring_file.slot_count:
+			return client
+		return ShmRingConnection(client, self.shm_ring_file, index)
 	
 	def parse_request(self, client):
 		buf = b''
@@ -206,22 +581,18 @@ def parse_request(self, client):
 			if len(tmp) == 0:
 				return (None, None)
 			buf += tmp
-		
-		headers = buf.split(b"\0")
-		headers.pop() # Remove trailing "\0"
-		env = {}
-		i = 0
-		while i < len(headers):
-			env[bytes_to_str(headers[i])] = bytes_to_str(headers[i + 1])
-			i += 2
-
-		return (env, client)
+
+		return (parse_session_header(buf), client)
 	
 	if hasattr(socket, '_fileobject'):
 		def wrap_input_socket(self, sock):
+			if isinstance(sock, ShmRingConnection):
+				return sock.makefile('rb', 512)
 			return socket._fileobject(sock, 'rb', 512)
 	else:
 		def wrap_input_socket(self, sock):
+			if isinstance(sock, ShmRingConnection):
+				return sock.makefile('rb', 512)
 			return socket.socket.makefile(sock, 'rb', 512)
 
 	def process_request(self, env, input_stream, output_stream):
@@ -235,7 +606,7 @@ def process_request(self, env, input_stream, output_stream):
 		env['wsgi.input']        = self.wrap_input_socket(input_stream)
 		env['wsgi.errors']       = sys.stderr
 		env['wsgi.version']      = (1, 0)
-		env['wsgi.multithread']  = False
+		env['wsgi.multithread']  = self.thread_count > 1
 		env['wsgi.multiprocess'] = True
 		env['wsgi.run_once']	 = False
 		if env.get('HTTPS','off') in ('on', '1', 'true', 'yes'):
@@ -254,12 +625,13 @@ def write(data):
 				elif not headers_sent:
 					# Before the first output, send the stored headers.
 					status, response_headers = headers_sent[:] = headers_set
-					output_stream.sendall(str_to_bytes(
+					header_data = [str_to_bytes(
 						'HTTP/1.1 %s\r\nStatus: %s\r\nConnection: close\r\n' %
-						(status, status)))
+						(status, status))]
 					for header in response_headers:
-						output_stream.sendall(str_to_bytes('%s: %s\r\n' % header))
-					output_stream.sendall(b'\r\n')
+						header_data.append(str_to_bytes('%s: %s\r\n' % header))
+					header_data.append(b'\r\n')
+					output_stream.sendall(b''.join(header_data))
 				if not is_head:
 					output_stream.sendall(data)
 			except IOError:
@@ -315,6 +687,252 @@ def process_ping(self, env, input_stream, output_stream):
 		output_stream.sendall(b"pong")
 
 
+if asyncio is not None:
+	# Serves an ASGI app on an asyncio event loop, so that a single process
+	# handles many concurrent requests. Only HTTP is supported: there's no
+	# lifespan protocol, and WebSocket requests get an error.
+	#
+	# This code doesn't use the async/await syntax, because this file must
+	# remain parseable by Python 2. The receive and send callables return
+	# futures instead, which the app can await just the same.
+	class AsgiSessionProtocol(asyncio.Protocol):
+		def __init__(self, handler):
+			self.handler = handler
+			self.loop = handler.loop
+			self.transport = None
+			self.buf = b''
+			self.header_size = None
+			self.env = None
+			self.body_remaining = None
+			self.body_chunks = []
+			self.body_complete = False
+			self.body_delivered = False
+			self.disconnected = False
+			self.receive_waiter = None
+			self.write_waiter = None
+			self.response_started = False
+			self.response_complete = False
+			self.status = None
+			self.response_headers = None
+			self.task = None
+
+		def connection_made(self, transport):
+			self.transport = transport
+
+		def data_received(self, data):
+			if self.env is None:
+				self.buf += data
+				if self.header_size is None:
+					if len(self.buf) < 4:
+						return
+					self.header_size = struct.unpack('>I', self.buf[0:4])[0]
+					self.buf = self.buf[4:]
+				if len(self.buf) < self.header_size:
+					return
+				data = self.buf[self.header_size:]
+				self.env = parse_session_header(self.buf[0:self.header_size])
+				self.buf = None
+				self.start_request()
+			self.add_body_data(data)
+
+		def eof_received(self):
+			self.body_complete = True
+			self.wake_receive_waiter()
+			return True
+
+		def connection_lost(self, exc):
+			self.disconnected = True
+			self.body_complete = True
+			self.wake_receive_waiter()
+			if self.write_waiter is not None and not self.write_waiter.done():
+				self.write_waiter.set_result(None)
+
+		def pause_writing(self):
+			self.write_waiter = self.loop.create_future()
+
+		def resume_writing(self):
+			if self.write_waiter is not None and not self.write_waiter.done():
+				self.write_waiter.set_result(None)
+			self.write_waiter = None
+
+		def start_request(self):
+			env = self.env
+			if env['REQUEST_METHOD'] == 'ping':
+				self.transport.write(b"pong")
+				self.transport.close()
+				return
+
+			if 'CONTENT_LENGTH' in env:
+				self.body_remaining = int(env['CONTENT_LENGTH'])
+				self.body_complete = self.body_remaining == 0
+			elif 'HTTP_TRANSFER_ENCODING' not in env:
+				self.body_complete = True
+
+			headers = []
+			for key, value in env.items():
+				if key.startswith('HTTP_'):
+					name = key[5:].replace('_', '-').lower()
+				elif key in ('CONTENT_TYPE', 'CONTENT_LENGTH'):
+					name = key.replace('_', '-').lower()
+				else:
+					continue
+				headers.append((str_to_bytes(name), str_to_bytes(value)))
+
+			if env.get('HTTPS', 'off') in ('on', '1', 'true', 'yes'):
+				scheme = 'https'
+			else:
+				scheme = 'http'
+			request_uri = env.get('REQUEST_URI', env.get('PATH_INFO', '/'))
+			scope = {
+				'type': 'http',
+				'asgi': { 'version': '3.0', 'spec_version': '2.1' },
+				'http_version': env.get('SERVER_PROTOCOL', 'HTTP/1.1')[5:],
+				'method': env['REQUEST_METHOD'],
+				'scheme': scheme,
+				'path': env.get('PATH_INFO', '/'),
+				'raw_path': str_to_bytes(request_uri.split('?', 1)[0]),
+				'query_string': str_to_bytes(env.get('QUERY_STRING', '')),
+				'root_path': env.get('SCRIPT_NAME', ''),
+				'headers': headers,
+				'server': (env.get('SERVER_NAME', ''), int(env.get('SERVER_PORT', '0') or 0))
+			}
+			if 'REMOTE_ADDR' in env:
+				scope['client'] = (env['REMOTE_ADDR'], int(env.get('REMOTE_PORT', '0') or 0))
+
+			self.task = asyncio.ensure_future(
+				self.handler.app(scope, self.receive, self.send), loop = self.loop)
+			self.task.add_done_callback(self.request_done)
+
+		def add_body_data(self, data):
+			if len(data) == 0 or self.body_complete:
+				return
+			if self.body_remaining is not None:
+				data = data[0:self.body_remaining]
+				self.body_remaining -= len(data)
+				self.body_complete = self.body_remaining == 0
+			self.body_chunks.append(data)
+			self.wake_receive_waiter()
+
+		def wake_receive_waiter(self):
+			if self.receive_waiter is not None and not self.receive_waiter.done():
+				event = self.next_receive_event()
+				if event is not None:
+					self.receive_waiter.set_result(event)
+					self.receive_waiter = None
+
+		# Returns the next event for the app's receive callable, or None if
+		# the app has to wait for more data.
+		def next_receive_event(self):
+			if not self.body_delivered:
+				if not self.body_chunks and not self.body_complete:
+					return None
+				body = b''.join(self.body_chunks)
+				self.body_chunks = []
+				self.body_delivered = self.body_complete
+				return { 'type': 'http.request', 'body': body,
+					'more_body': not self.body_complete }
+			elif self.disconnected:
+				return { 'type': 'http.disconnect' }
+			else:
+				# The entire request body has been delivered. Wait
+				# until the connection is closed.
+				return None
+
+		def receive(self):
+			future = self.loop.create_future()
+			event = self.next_receive_event()
+			if event is None:
+				self.receive_waiter = future
+			else:
+				future.set_result(event)
+			return future
+
+		def send(self, message):
+			message_type = message['type']
+			if message_type == 'http.response.start':
+				if self.response_started:
+					raise AssertionError("Response already started")
+				self.response_started = True
+				self.status = message['status']
+				self.response_headers = message.get('headers', [])
+			elif message_type == 'http.response.body':
+				if not self.response_started:
+					raise AssertionError("http.response.body before http.response.start")
+				if self.response_complete:
+					raise AssertionError("Response already completed")
+				if self.status is not None:
+					self.write_response_header()
+				if self.env['REQUEST_METHOD'] != 'HEAD' and not self.disconnected:
+					self.transport.write(message.get('body', b''))
+				if not message.get('more_body', False):
+					self.response_complete = True
+					if not self.disconnected:
+						self.transport.close()
+			else:
+				raise AssertionError("Unsupported ASGI message type: %s" % message_type)
+
+			future = self.loop.create_future()
+			if self.write_waiter is None:
+				future.set_result(None)
+			else:
+				# Wait until the Passenger core has read the response data that
+				# we've buffered so far.
+				self.write_waiter.add_done_callback(lambda f: future.set_result(None))
+			return future
+
+		def write_response_header(self):
+			status = str(self.status)
+			data = [str_to_bytes('HTTP/1.1 %s Whatever\r\nStatus: %s\r\nConnection: close\r\n' %
+				(status, status))]
+			for name, value in self.response_headers:
+				data.append(name)
+				data.append(b': ')
+				data.append(value)
+				data.append(b'\r\n')
+			data.append(b'\r\n')
+			self.transport.write(b''.join(data))
+			self.status = None
+
+		def request_done(self, task):
+			if not task.cancelled() and task.exception() is not None:
+				e = task.exception()
+				logging.error("ASGI application raised an exception!",
+					exc_info = (type(e), e, e.__traceback__))
+				if not self.response_started and not self.disconnected:
+					self.send({ 'type': 'http.response.start', 'status': 500,
+						'headers': [(b'content-type', b'text/plain')] })
+					self.send({ 'type': 'http.response.body',
+						'body': b'Internal Server Error' })
+			if not self.disconnected:
+				self.transport.close()
+
+
+	class AsgiRequestHandler:
+		def __init__(self, server_socket, owner_pipe, app):
+			self.server = server_socket
+			self.owner_pipe = owner_pipe
+			self.app = app
+			self.loop = asyncio.new_event_loop()
+
+		def run(self):
+			loop = self.loop
+			asyncio.set_event_loop(loop)
+			server = loop.run_until_complete(loop.create_unix_server(
+				lambda: AsgiSessionProtocol(self), sock = self.server))
+			# The owner pipe becomes readable when the Passenger core wants
+			# us to shut down.
+			loop.add_reader(self.owner_pipe.fileno(), loop.stop)
+			try:
+				loop.run_forever()
+			except KeyboardInterrupt:
+				pass
+			finally:
+				loop.remove_reader(self.owner_pipe.fileno())
+				server.close()
+				loop.run_until_complete(server.wait_closed())
+				loop.close()
+
+
 if __name__ == "__main__":
 	logging.basicConfig(
 		level = logging.WARNING,
@@ -325,10 +943,22 @@ def process_ping(self, env, input_stream, output_stream):
 	app_module = load_app()
 	socket_filename, server_socket = create_server_socket()
 	install_signal_handlers()
-	handler = RequestHandler(server_socket, sys.stdin, app_module.application)
+	if is_asgi_app(app_module.application):
+		if asyncio is None:
+			abort("ASGI applications require Python 3 with asyncio")
+		handler = AsgiRequestHandler(server_socket, sys.stdin, app_module.application)
+		concurrency = 0
+		# Only publishes garbage collection activity.
+		metrics_page = open_app_metrics_page(0)
+		shm_ring_file = None
+	else:
+		concurrency = get_thread_count()
+		shm_ring_file = open_shm_ring_file()
+		handler = RequestHandler(server_socket, sys.stdin, app_module.application,
+			concurrency, open_app_metrics_page(concurrency), shm_ring_file)
 	print("!> Ready")
-	advertise_sockets(socket_filename)
-	handler.main_loop()
+	advertise_sockets(socket_filename, concurrency, shm_ring_file is not None)
+	handler.run()
 	try:
 		os.remove(socket_filename)
 	except OSError:
@@ -138,6 +138,116 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
         len += sizeof("\r\n") - 1;
     }
 
+    if (conf->spawn_concurrency != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->spawn_concurrency);
+        len += sizeof("!~PASSENGER_SPAWN_CONCURRENCY: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->rolling_restart_batch_size != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rolling_restart_batch_size);
+        len += sizeof("!~PASSENGER_ROLLING_RESTART_BATCH_SIZE: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->target_utilization != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->target_utilization);
+        len += sizeof("!~PASSENGER_TARGET_UTILIZATION: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->preloader_standby_processes != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->preloader_standby_processes);
+        len += sizeof("!~PASSENGER_PRELOADER_STANDBY_PROCESSES: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->recycle_jitter != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->recycle_jitter);
+        len += sizeof("!~PASSENGER_RECYCLE_JITTER: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->capacity_weight != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->capacity_weight);
+        len += sizeof("!~PASSENGER_CAPACITY_WEIGHT: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->max_out_of_band_work_percentage != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->max_out_of_band_work_percentage);
+        len += sizeof("!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->out_of_band_work_max_utilization != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->out_of_band_work_max_utilization);
+        len += sizeof("!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->out_of_band_work_idle_interval != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->out_of_band_work_idle_interval);
+        len += sizeof("!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->warmup_time != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->warmup_time);
+        len += sizeof("!~PASSENGER_WARMUP_TIME: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->memory_limit != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->memory_limit);
+        len += sizeof("!~PASSENGER_MEMORY_LIMIT: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
     if (conf->max_instances_per_app != NGX_CONF_UNSET) {
         end = ngx_snprintf(int_buf,
             sizeof(int_buf) - 1,
@@ -235,6 +345,26 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
             : sizeof("f\r\n") - 1;
     }
 
+    if (conf->preloader_compact_heap != NGX_CONF_UNSET) {
+        len += sizeof("!~PASSENGER_PRELOADER_COMPACT_HEAP: ") - 1;
+        len += conf->preloader_compact_heap
+            ? sizeof("t\r\n") - 1
+            : sizeof("f\r\n") - 1;
+    }
+
+    if (conf->preloader_warmup_script.data != NULL) {
+        len += sizeof("!~PASSENGER_PRELOADER_WARMUP_SCRIPT: ") - 1;
+        len += conf->preloader_warmup_script.len;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->rolling_restarts != NGX_CONF_UNSET) {
+        len += sizeof("!~PASSENGER_ROLLING_RESTARTS: ") - 1;
+        len += conf->rolling_restarts
+            ? sizeof("t\r\n") - 1
+            : sizeof("f\r\n") - 1;
+    }
+
     if (conf->union_station_key.data != NULL) {
         len += sizeof("!~UNION_STATION_KEY: ") - 1;
         len += conf->union_station_key.len;
@@ -251,6 +381,46 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
         len += sizeof("\r\n") - 1;
     }
 
+    if (conf->request_queue_target_delay != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->request_queue_target_delay);
+        len += sizeof("!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->rate_limit != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rate_limit);
+        len += sizeof("!~PASSENGER_RATE_LIMIT: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->rate_limit_burst != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rate_limit_burst);
+        len += sizeof("!~PASSENGER_RATE_LIMIT_BURST: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
+    if (conf->max_requests_in_flight != NGX_CONF_UNSET) {
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->max_requests_in_flight);
+        len += sizeof("!~PASSENGER_MAX_REQUESTS_IN_FLIGHT: ") - 1;
+        len += end - int_buf;
+        len += sizeof("\r\n") - 1;
+    }
+
     if (conf->request_queue_overflow_status_code != NGX_CONF_UNSET) {
         end = ngx_snprintf(int_buf,
             sizeof(int_buf) - 1,
@@ -436,6 +606,127 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
         pos = ngx_copy(pos, int_buf, end - int_buf);
         pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
     }
+    if (conf->spawn_concurrency != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_SPAWN_CONCURRENCY: ",
+            sizeof("!~PASSENGER_SPAWN_CONCURRENCY: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->spawn_concurrency);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->rolling_restart_batch_size != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_ROLLING_RESTART_BATCH_SIZE: ",
+            sizeof("!~PASSENGER_ROLLING_RESTART_BATCH_SIZE: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rolling_restart_batch_size);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->target_utilization != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_TARGET_UTILIZATION: ",
+            sizeof("!~PASSENGER_TARGET_UTILIZATION: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->target_utilization);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->preloader_standby_processes != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_PRELOADER_STANDBY_PROCESSES: ",
+            sizeof("!~PASSENGER_PRELOADER_STANDBY_PROCESSES: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->preloader_standby_processes);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->recycle_jitter != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_RECYCLE_JITTER: ",
+            sizeof("!~PASSENGER_RECYCLE_JITTER: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->recycle_jitter);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->capacity_weight != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_CAPACITY_WEIGHT: ",
+            sizeof("!~PASSENGER_CAPACITY_WEIGHT: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->capacity_weight);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->max_out_of_band_work_percentage != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE: ",
+            sizeof("!~PASSENGER_MAX_OUT_OF_BAND_WORK_PERCENTAGE: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->max_out_of_band_work_percentage);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->out_of_band_work_max_utilization != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION: ",
+            sizeof("!~PASSENGER_OUT_OF_BAND_WORK_MAX_UTILIZATION: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->out_of_band_work_max_utilization);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->out_of_band_work_idle_interval != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL: ",
+            sizeof("!~PASSENGER_OUT_OF_BAND_WORK_IDLE_INTERVAL: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->out_of_band_work_idle_interval);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->warmup_time != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_WARMUP_TIME: ",
+            sizeof("!~PASSENGER_WARMUP_TIME: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->warmup_time);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->memory_limit != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_MEMORY_LIMIT: ",
+            sizeof("!~PASSENGER_MEMORY_LIMIT: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->memory_limit);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
     if (conf->max_instances_per_app != NGX_CONF_UNSET) {
         pos = ngx_copy(pos,
             "!~PASSENGER_MAX_PROCESSES: ",
@@ -566,6 +857,35 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
             pos = ngx_copy(pos, "f\r\n", sizeof("f\r\n") - 1);
         }
     }
+    if (conf->preloader_compact_heap != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_PRELOADER_COMPACT_HEAP: ",
+            sizeof("!~PASSENGER_PRELOADER_COMPACT_HEAP: ") - 1);
+        if (conf->preloader_compact_heap) {
+            pos = ngx_copy(pos, "t\r\n", sizeof("t\r\n") - 1);
+        } else {
+            pos = ngx_copy(pos, "f\r\n", sizeof("f\r\n") - 1);
+        }
+    }
+    if (conf->preloader_warmup_script.data != NULL) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_PRELOADER_WARMUP_SCRIPT: ",
+            sizeof("!~PASSENGER_PRELOADER_WARMUP_SCRIPT: ") - 1);
+        pos = ngx_copy(pos,
+            conf->preloader_warmup_script.data,
+            conf->preloader_warmup_script.len);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->rolling_restarts != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_ROLLING_RESTARTS: ",
+            sizeof("!~PASSENGER_ROLLING_RESTARTS: ") - 1);
+        if (conf->rolling_restarts) {
+            pos = ngx_copy(pos, "t\r\n", sizeof("t\r\n") - 1);
+        } else {
+            pos = ngx_copy(pos, "f\r\n", sizeof("f\r\n") - 1);
+        }
+    }
 
     if (conf->union_station_key.data != NULL) {
         pos = ngx_copy(pos,
@@ -587,6 +907,50 @@ generated_cache_location_part(ngx_conf_t *cf, passenger_loc_conf_t *conf) {
         pos = ngx_copy(pos, int_buf, end - int_buf);
         pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
     }
+    if (conf->request_queue_target_delay != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY: ",
+            sizeof("!~PASSENGER_REQUEST_QUEUE_TARGET_DELAY: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->request_queue_target_delay);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->rate_limit != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_RATE_LIMIT: ",
+            sizeof("!~PASSENGER_RATE_LIMIT: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rate_limit);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->rate_limit_burst != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_RATE_LIMIT_BURST: ",
+            sizeof("!~PASSENGER_RATE_LIMIT_BURST: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->rate_limit_burst);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->max_requests_in_flight != NGX_CONF_UNSET) {
+        pos = ngx_copy(pos,
+            "!~PASSENGER_MAX_REQUESTS_IN_FLIGHT: ",
+            sizeof("!~PASSENGER_MAX_REQUESTS_IN_FLIGHT: ") - 1);
+        end = ngx_snprintf(int_buf,
+            sizeof(int_buf) - 1,
+            "%d",
+            conf->max_requests_in_flight);
+        pos = ngx_copy(pos, int_buf, end - int_buf);
+        pos = ngx_copy(pos, (const u_char *) "\r\n", sizeof("\r\n") - 1);
+    }
     if (conf->request_queue_overflow_status_code != NGX_CONF_UNSET) {
         pos = ngx_copy(pos,
             "!~PASSENGER_REQUEST_QUEUE_OVERFLOW_STATUS_CODE: ",
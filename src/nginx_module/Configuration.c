@@ -37,6 +37,7 @@
 #include "ngx_http_passenger_module.h"
 #include "Configuration.h"
 #include "ContentHandler.h"
+#include "SharedStatCache.h"
 #include "cxx_supportlib/Constants.h"
 #include "cxx_supportlib/UnionStationFilterSupport.h"
 #include "cxx_supportlib/vendor-modified/modp_b64.h"
@@ -122,6 +123,7 @@ passenger_create_main_conf(ngx_conf_t *cf)
     conf->pool_idle_time = NGX_CONF_UNSET_UINT;
     conf->response_buffer_high_watermark = NGX_CONF_UNSET_UINT;
     conf->stat_throttle_rate = NGX_CONF_UNSET_UINT;
+    conf->stat_cache_zone = NULL;
     conf->core_file_descriptor_ulimit = NGX_CONF_UNSET_UINT;
     conf->user_switching = NGX_CONF_UNSET;
     conf->show_version_in_header = NGX_CONF_UNSET;
@@ -392,6 +394,68 @@ passenger_create_loc_conf(ngx_conf_t *cf)
 
 #include "CacheLocationConfig.c"
 
+/**
+ * Appends the other headers that only depend on the location configuration,
+ * i.e. the Union Station filters and the environment variables, to
+ * conf->options_cache. The content handler can then send all of them as a
+ * single buffer, without copying them into every request.
+ */
+static ngx_int_t
+append_static_headers_to_options_cache(ngx_conf_t *cf, passenger_loc_conf_t *conf)
+{
+    ngx_uint_t  i;
+    ngx_str_t  *union_station_filters = NULL;
+    ngx_uint_t  union_station_filters_count = 0;
+    size_t      len;
+    u_char     *buf, *pos;
+
+    if (conf->union_station_filters != NGX_CONF_UNSET_PTR
+     && conf->union_station_filters != NULL)
+    {
+        union_station_filters = (ngx_str_t *) conf->union_station_filters->elts;
+        union_station_filters_count = conf->union_station_filters->nelts;
+    }
+
+    len = conf->options_cache.len;
+    for (i = 0; i < union_station_filters_count; i++) {
+        len += sizeof("!~UNION_STATION_FILTERS: \r\n") - 1
+            + union_station_filters[i].len;
+    }
+    if (conf->env_vars_cache.data != NULL) {
+        len += sizeof("!~PASSENGER_ENV_VARS: \r\n") - 1
+            + conf->env_vars_cache.len;
+    }
+
+    if (len == conf->options_cache.len) {
+        return NGX_OK;
+    }
+
+    buf = pos = ngx_pnalloc(cf->pool, len);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    pos = ngx_copy(pos, conf->options_cache.data, conf->options_cache.len);
+    for (i = 0; i < union_station_filters_count; i++) {
+        pos = ngx_copy(pos, "!~UNION_STATION_FILTERS: ",
+            sizeof("!~UNION_STATION_FILTERS: ") - 1);
+        pos = ngx_copy(pos, union_station_filters[i].data,
+            union_station_filters[i].len);
+        pos = ngx_copy(pos, "\r\n", sizeof("\r\n") - 1);
+    }
+    if (conf->env_vars_cache.data != NULL) {
+        pos = ngx_copy(pos, "!~PASSENGER_ENV_VARS: ",
+            sizeof("!~PASSENGER_ENV_VARS: ") - 1);
+        pos = ngx_copy(pos, conf->env_vars_cache.data, conf->env_vars_cache.len);
+        pos = ngx_copy(pos, "\r\n", sizeof("\r\n") - 1);
+    }
+
+    conf->options_cache.data = buf;
+    conf->options_cache.len = pos - buf;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 cache_loc_conf_options(ngx_conf_t *cf, passenger_loc_conf_t *conf)
 {
@@ -464,7 +528,7 @@ cache_loc_conf_options(ngx_conf_t *cf, passenger_loc_conf_t *conf)
         free(unencoded_buf);
     }
 
-    return NGX_OK;
+    return append_static_headers_to_options_cache(cf, conf);
 }
 
 #include "MergeLocationConfig.c"
@@ -1308,6 +1372,8 @@ passenger_enabled(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         if (passenger_conf->upstream_config.upstream == NULL) {
             return NGX_CONF_ERROR;
         }
+        passenger_conf->upstream_config.upstream->peer.init_upstream =
+            passenger_init_upstream_keepalive;
 
         clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
         clcf->handler = passenger_content_handler;
@@ -1391,6 +1457,38 @@ passenger_use_global_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
+static char *
+passenger_stat_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    passenger_main_conf_t *main_conf = conf;
+    ngx_str_t             *value;
+    ssize_t                size;
+
+    if (main_conf->stat_cache_zone != NULL) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+    size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "invalid passenger_stat_cache_zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+            "passenger_stat_cache_zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    main_conf->stat_cache_zone = pp_shared_stat_cache_add(cf, size);
+    if (main_conf->stat_cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
 static char *
 set_null_terminated_keyval_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1553,6 +1651,13 @@ const ngx_command_t passenger_commands[] = {
       offsetof(passenger_main_conf_t, stat_throttle_rate),
       NULL },
 
+    { ngx_string("passenger_stat_cache_zone"),
+      NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+      passenger_stat_cache_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("passenger_show_version_in_header"),
       NGX_HTTP_MAIN_CONF | NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -31,6 +31,7 @@
 #include "ContentHandler.h"
 #include "StaticContentHandler.h"
 #include "Configuration.h"
+#include "SharedStatCache.h"
 #include "cxx_supportlib/Constants.h"
 
 
@@ -56,16 +57,28 @@ static void finalize_request(ngx_http_request_t *r, ngx_int_t rc);
 static FileType
 get_file_type(const u_char *filename, unsigned int throttle_rate) {
     struct stat buf;
+    mode_t mode;
     int ret;
 
-    ret = pp_cached_file_stat_perform(pp_stat_cache,
-                                      (const char *) filename,
-                                      &buf,
-                                      throttle_rate);
+    if (passenger_main_conf.stat_cache_zone != NULL) {
+        /* The shared cache exists to save stat() calls, so it honors
+         * passenger_stat_throttle_rate even where the caller asks for
+         * fresh results.
+         */
+        ret = pp_shared_stat_cache_perform(passenger_main_conf.stat_cache_zone,
+            filename, ngx_strlen(filename), &mode,
+            ngx_max(throttle_rate, passenger_main_conf.stat_throttle_rate));
+    } else {
+        ret = pp_cached_file_stat_perform(pp_stat_cache,
+                                          (const char *) filename,
+                                          &buf,
+                                          throttle_rate);
+        mode = (ret == 0) ? buf.st_mode : 0;
+    }
     if (ret == 0) {
-        if (S_ISREG(buf.st_mode)) {
+        if (S_ISREG(mode)) {
             return FT_FILE;
-        } else if (S_ISDIR(buf.st_mode)) {
+        } else if (S_ISDIR(mode)) {
             return FT_DIRECTORY;
         } else {
             return FT_OTHER;
@@ -80,6 +93,20 @@ file_exists(const u_char *filename, unsigned int throttle_rate) {
     return get_file_type(filename, throttle_rate) == FT_FILE;
 }
 
+/**
+ * Checks whether the given file is listed in the application's asset manifest,
+ * which allows us to skip stat()ing it.
+ */
+static int
+is_precompiled_asset(ngx_str_t *path, u_char *path_last, size_t root_len) {
+    PP_StaticAsset asset;
+
+    return pp_static_asset_manifest_registry_lookup(pp_static_asset_manifests,
+        (const char *) path->data, root_len,
+        (const char *) path->data, path_last - path->data,
+        &asset);
+}
+
 static int
 mapped_filename_equals(const u_char *filename, size_t filename_len, ngx_str_t *str)
 {
@@ -234,6 +261,410 @@ set_upstream_server_address(ngx_http_upstream_t *upstream, ngx_http_upstream_con
     }
 }
 
+/* Maximum number of idle connections to the Passenger core that each Nginx
+ * worker process keeps around for reuse.
+ */
+#define KEEPALIVE_MAX_CACHED_CONNECTIONS 32
+
+typedef struct {
+    ngx_queue_t        queue;
+    ngx_connection_t  *connection;
+} keepalive_cache_item_t;
+
+typedef struct {
+    ngx_http_upstream_t     *upstream;
+    void                    *data;
+    ngx_event_get_peer_pt    original_get_peer;
+    ngx_event_free_peer_pt   original_free_peer;
+} keepalive_peer_data_t;
+
+/* Per worker process. Idle connections are kept in `keepalive_cache`, most
+ * recently used first, and unused items are kept in `keepalive_free`.
+ */
+static ngx_http_upstream_init_peer_pt keepalive_original_init_peer;
+static keepalive_cache_item_t keepalive_items[KEEPALIVE_MAX_CACHED_CONNECTIONS];
+static ngx_queue_t  keepalive_cache;
+static ngx_queue_t  keepalive_free;
+static ngx_flag_t   keepalive_initialized = 0;
+
+static void
+keepalive_close(ngx_connection_t *c)
+{
+    if (c->pool != NULL) {
+        ngx_destroy_pool(c->pool);
+    }
+    ngx_close_connection(c);
+}
+
+static void
+keepalive_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "Passenger core keepalive dummy handler");
+}
+
+/**
+ * Called when an idle connection becomes readable, which means that the
+ * Passenger core closed it, or when Nginx closes idle connections because it
+ * is shutting down.
+ */
+static void
+keepalive_close_handler(ngx_event_t *ev)
+{
+    ngx_connection_t        *c;
+    keepalive_cache_item_t  *item;
+    ssize_t                  n;
+    char                     buf[1];
+
+    c = ev->data;
+
+    if (c->close || c->read->timedout) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+    keepalive_close(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&keepalive_free, &item->queue);
+}
+
+static ngx_int_t
+get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
+{
+    keepalive_peer_data_t   *kp = data;
+    keepalive_cache_item_t  *item;
+    ngx_queue_t             *q;
+    ngx_connection_t        *c;
+    ngx_int_t                rc;
+
+    rc = kp->original_get_peer(pc, kp->data);
+    if (rc != NGX_OK || ngx_queue_empty(&keepalive_cache)) {
+        return rc;
+    }
+
+    q = ngx_queue_head(&keepalive_cache);
+    item = ngx_queue_data(q, keepalive_cache_item_t, queue);
+    c = item->connection;
+
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&keepalive_free, q);
+
+    c->idle = 0;
+    c->sent = 0;
+    c->log = pc->log;
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+    if (c->pool != NULL) {
+        c->pool->log = pc->log;
+    }
+
+    pc->connection = c;
+    pc->cached = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "reusing Passenger core connection %p", c);
+
+    return NGX_DONE;
+}
+
+static void
+free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state)
+{
+    keepalive_peer_data_t   *kp = data;
+    keepalive_cache_item_t  *item;
+    ngx_queue_t             *q;
+    ngx_connection_t        *c;
+    ngx_http_upstream_t     *u;
+
+    u = kp->upstream;
+    c = pc->connection;
+
+    if (state & NGX_PEER_FAILED
+        || c == NULL
+        || c->read->eof
+        || c->read->error
+        || c->read->timedout
+        || c->write->error
+        || c->write->timedout
+        || !u->keepalive
+        || ngx_terminate
+        || ngx_exiting)
+    {
+        goto invalid;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        goto invalid;
+    }
+
+    if (ngx_queue_empty(&keepalive_free)) {
+        q = ngx_queue_last(&keepalive_cache);
+        ngx_queue_remove(q);
+        item = ngx_queue_data(q, keepalive_cache_item_t, queue);
+        keepalive_close(item->connection);
+    } else {
+        q = ngx_queue_head(&keepalive_free);
+        ngx_queue_remove(q);
+        item = ngx_queue_data(q, keepalive_cache_item_t, queue);
+    }
+
+    ngx_queue_insert_head(&keepalive_cache, q);
+    item->connection = c;
+    pc->connection = NULL;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = keepalive_dummy_handler;
+    c->read->handler = keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    if (c->pool != NULL) {
+        c->pool->log = ngx_cycle->log;
+    }
+
+    if (c->read->ready) {
+        keepalive_close_handler(c->read);
+    }
+
+invalid:
+
+    kp->original_free_peer(pc, kp->data, state);
+}
+
+static ngx_int_t
+init_keepalive_peer(ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us)
+{
+    keepalive_peer_data_t  *kp;
+    ngx_uint_t              i;
+
+    if (!keepalive_initialized) {
+        ngx_queue_init(&keepalive_cache);
+        ngx_queue_init(&keepalive_free);
+        for (i = 0; i < KEEPALIVE_MAX_CACHED_CONNECTIONS; i++) {
+            ngx_queue_insert_head(&keepalive_free, &keepalive_items[i].queue);
+        }
+        keepalive_initialized = 1;
+    }
+
+    kp = ngx_palloc(r->pool, sizeof(keepalive_peer_data_t));
+    if (kp == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (keepalive_original_init_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    kp->upstream = r->upstream;
+    kp->data = r->upstream->peer.data;
+    kp->original_get_peer = r->upstream->peer.get;
+    kp->original_free_peer = r->upstream->peer.free;
+
+    r->upstream->peer.data = kp;
+    r->upstream->peer.get = get_keepalive_peer;
+    r->upstream->peer.free = free_keepalive_peer;
+
+    return NGX_OK;
+}
+
+/**
+ * Makes Nginx keep connections to the Passenger core alive between requests,
+ * similar to what the 'keepalive' directive of the upstream keepalive module
+ * does for regular upstreams. The Passenger core upstream is defined
+ * implicitly by passenger_enabled, so that directive can't be used for it.
+ *
+ * A connection is only reused if the response body has been received
+ * completely (see keepalive_input_filter_init()) and the Passenger core did
+ * not ask to close it.
+ */
+ngx_int_t
+passenger_init_upstream_keepalive(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    keepalive_original_init_peer = us->peer.init;
+    us->peer.init = init_keepalive_peer;
+
+    return NGX_OK;
+}
+
+/**
+ * Determines the length of the response body. The Passenger core dechunks
+ * responses for us (see the 'D' flag), and closes the connection after
+ * responses whose length isn't known in advance.
+ */
+static ngx_int_t
+keepalive_input_filter_init(void *data)
+{
+    ngx_http_request_t   *r = data;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    if (u->headers_in.status_n == NGX_HTTP_NO_CONTENT
+        || u->headers_in.status_n == NGX_HTTP_NOT_MODIFIED
+        || r->method == NGX_HTTP_HEAD
+        || u->headers_in.content_length_n == 0)
+    {
+        u->pipe->length = 0;
+        u->length = 0;
+        u->keepalive = !u->headers_in.connection_close;
+    } else {
+        /* Content-Length or connection close */
+        u->pipe->length = u->headers_in.content_length_n;
+        u->length = u->headers_in.content_length_n;
+    }
+
+    return NGX_OK;
+}
+
+/**
+ * Like ngx_event_pipe_copy_input_filter(), but stops at the end of the
+ * response body so that the connection can be reused.
+ */
+static ngx_int_t
+keepalive_pipe_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    ngx_buf_t           *b;
+    ngx_chain_t         *cl;
+    ngx_http_request_t  *r;
+
+    if (buf->pos == buf->last) {
+        return NGX_OK;
+    }
+
+    cl = ngx_chain_get_free_buf(p->pool, &p->free);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = cl->buf;
+
+    ngx_memcpy(b, buf, sizeof(ngx_buf_t));
+    b->shadow = buf;
+    b->tag = p->tag;
+    b->last_shadow = 1;
+    b->recycled = 1;
+    buf->shadow = b;
+
+    if (p->in) {
+        *p->last_in = cl;
+    } else {
+        p->in = cl;
+    }
+    p->last_in = &cl->next;
+
+    if (p->length == -1) {
+        return NGX_OK;
+    }
+
+    if (b->last - b->pos > p->length) {
+        ngx_log_error(NGX_LOG_WARN, p->log, 0,
+                      "Passenger core sent more data than specified in "
+                      "\"Content-Length\" header");
+
+        b->last = b->pos + p->length;
+        p->upstream_done = 1;
+
+        return NGX_OK;
+    }
+
+    p->length -= b->last - b->pos;
+
+    if (p->length == 0) {
+        r = p->input_ctx;
+        p->upstream_done = 1;
+        r->upstream->keepalive = !r->upstream->headers_in.connection_close;
+    }
+
+    return NGX_OK;
+}
+
+/**
+ * Like Nginx's default non-buffered input filter, but marks the connection
+ * as reusable at the end of the response body.
+ */
+static ngx_int_t
+keepalive_non_buffered_input_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t   *r = data;
+    ngx_buf_t            *b;
+    ngx_chain_t          *cl, **ll;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    *ll = cl;
+
+    cl->buf->flush = 1;
+    cl->buf->memory = 1;
+
+    b = &u->buffer;
+
+    cl->buf->pos = b->last;
+    b->last += bytes;
+    cl->buf->last = b->last;
+    cl->buf->tag = u->output.tag;
+
+    if (u->length == -1) {
+        return NGX_OK;
+    }
+
+    if (bytes > u->length) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "Passenger core sent more data than specified in "
+                      "\"Content-Length\" header");
+
+        cl->buf->last = cl->buf->pos + u->length;
+        u->length = 0;
+
+        return NGX_OK;
+    }
+
+    u->length -= bytes;
+
+    if (u->length == 0) {
+        u->keepalive = !u->headers_in.connection_close;
+    }
+
+    return NGX_OK;
+}
+
 /**
  * If the Passenger core socket cannot be connected to then we want Nginx to print
  * the proper socket filename in the error message. The socket filename is stored
@@ -250,12 +681,15 @@ fix_peer_address(ngx_http_request_t *r) {
     const char                       *core_address;
     unsigned int                      core_address_len;
 
-    if (r->upstream->peer.get != ngx_http_upstream_get_round_robin_peer) {
+    if (r->upstream->peer.get == get_keepalive_peer) {
+        rrp = ((keepalive_peer_data_t *) r->upstream->peer.data)->data;
+    } else if (r->upstream->peer.get == ngx_http_upstream_get_round_robin_peer) {
+        rrp = r->upstream->peer.data;
+    } else {
         /* This function only supports the round-robin upstream method. */
         return;
     }
 
-    rrp        = r->upstream->peer.data;
     peers      = rrp->peers;
     core_address =
         psg_watchdog_launcher_get_core_address(psg_watchdog_launcher,
@@ -501,7 +935,6 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
         } while (0)
 
     ngx_uint_t       total_size = 0;
-    ngx_str_t       *union_station_filters;
     ngx_uint_t       i;
     ngx_list_part_t *part;
     ngx_table_elt_t *header;
@@ -527,7 +960,7 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
         total_size += r->args.len + 1;
     }
 
-    PUSH_STATIC_STR(" HTTP/1.1\r\nConnection: close\r\n");
+    PUSH_STATIC_STR(" HTTP/1.1\r\nConnection: keep-alive\r\n");
 
     part = &r->headers_in.headers.part;
     header = part->elts;
@@ -705,34 +1138,9 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
     total_size += state->app_type.len;
     PUSH_STATIC_STR("\r\n");
 
-    if (slcf->union_station_filters != NGX_CONF_UNSET_PTR
-     && slcf->union_station_filters->nelts > 0)
-    {
-        union_station_filters = (ngx_str_t *) slcf->union_station_filters->elts;
-        for (i = 0; i < slcf->union_station_filters->nelts; i++) {
-            PUSH_STATIC_STR("!~UNION_STATION_FILTERS: ");
-            if (b != NULL) {
-                b->last = ngx_copy(b->last, union_station_filters[i].data,
-                    union_station_filters[i].len);
-            }
-            total_size += union_station_filters[i].len;
-            PUSH_STATIC_STR("\r\n");
-        }
-    }
-
-    if (b != NULL) {
-        b->last = ngx_copy(b->last, slcf->options_cache.data, slcf->options_cache.len);
-    }
-    total_size += slcf->options_cache.len;
-
-    if (slcf->env_vars_cache.data != NULL) {
-        PUSH_STATIC_STR("!~PASSENGER_ENV_VARS: ");
-        if (b != NULL) {
-            b->last = ngx_copy(b->last, slcf->env_vars_cache.data, slcf->env_vars_cache.len);
-        }
-        total_size += slcf->env_vars_cache.len;
-        PUSH_STATIC_STR("\r\n");
-    }
+    /* The headers that only depend on the location configuration are in
+     * slcf->options_cache, which create_request() sends as a separate buffer.
+     */
 
     /* D = Dechunk response
      *     Prevent Nginx from rechunking the response.
@@ -747,13 +1155,41 @@ construct_request_buffer(ngx_http_request_t *r, passenger_loc_conf_t *slcf,
             PUSH_STATIC_STR("S");
         }
     #endif
-    PUSH_STATIC_STR("\r\n\r\n");
+    PUSH_STATIC_STR("\r\n");
 
     return total_size;
 
     #undef PUSH_STATIC_STR
 }
 
+/**
+ * Appends a chain link to <tt>cl</tt> with a buffer that points to the given
+ * data, which must outlive the request. Returns the new chain link.
+ */
+static ngx_chain_t *
+append_memory_buffer(ngx_http_request_t *r, ngx_chain_t *cl, u_char *data, size_t len)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->memory = 1;
+    b->start = b->pos = data;
+    b->end = b->last = data + len;
+
+    cl->next = ngx_alloc_chain_link(r->pool);
+    if (cl->next == NULL) {
+        return NULL;
+    }
+    cl = cl->next;
+    cl->buf = b;
+    cl->next = NULL;
+    return cl;
+}
+
 static ngx_int_t
 create_request(ngx_http_request_t *r)
 {
@@ -762,7 +1198,7 @@ create_request(ngx_http_request_t *r)
     buffer_construction_state      state;
     ngx_uint_t                     request_size;
     ngx_buf_t                     *b;
-    ngx_chain_t                   *cl, *body;
+    ngx_chain_t                   *cl, *header, *body;
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_passenger_module);
     context = ngx_http_get_module_ctx(r, ngx_http_passenger_module);
@@ -786,13 +1222,32 @@ create_request(ngx_http_request_t *r)
         return NGX_ERROR;
     }
     cl->buf = b;
+    header = cl;
 
     construct_request_buffer(r, slcf, context, &state, b);
 
+    /* Pass the pre-rendered location configuration headers without copying
+     * them, followed by the end of the header.
+     */
+
+    if (slcf->options_cache.len > 0) {
+        cl = append_memory_buffer(r, cl, slcf->options_cache.data,
+            slcf->options_cache.len);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    cl = append_memory_buffer(r, cl, (u_char *) "\r\n", sizeof("\r\n") - 1);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+    b = cl->buf;
+
     /* Pass request body */
 
     body = r->upstream->request_bufs;
-    r->upstream->request_bufs = cl;
+    r->upstream->request_bufs = header;
 
     while (body) {
         b = ngx_alloc_buf(r->pool);
@@ -1344,7 +1799,10 @@ passenger_content_handler(ngx_http_request_t *r)
      * maps to an existing file.
      */
     path_last = ngx_http_map_uri_to_path(r, &path, &root_len, 0);
-    if (path_last != NULL && file_exists(path.data, 0)) {
+    if (path_last != NULL
+     && (is_precompiled_asset(&path, path_last, root_len)
+         || file_exists(path.data, 0)))
+    {
         return NGX_DECLINED;
     }
 
@@ -1479,9 +1937,13 @@ passenger_content_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    u->pipe->input_filter = ngx_event_pipe_copy_input_filter;
+    u->pipe->input_filter = keepalive_pipe_input_filter;
     u->pipe->input_ctx = r;
 
+    u->input_filter_init = keepalive_input_filter_init;
+    u->input_filter = keepalive_non_buffered_input_filter;
+    u->input_filter_ctx = r;
+
     rc = ngx_http_read_client_request_body(r, ngx_http_upstream_init);
 
     fix_peer_address(r);
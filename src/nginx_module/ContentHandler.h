@@ -52,6 +52,8 @@ typedef struct {
 
 
 ngx_int_t passenger_content_handler(ngx_http_request_t *r);
+ngx_int_t passenger_init_upstream_keepalive(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
 
 
 #endif /* _PASSENGER_NGINX_CONTENT_HANDLER_H_ */
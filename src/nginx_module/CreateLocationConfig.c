@@ -58,6 +58,17 @@ generated_set_conf_part(passenger_loc_conf_t  *conf) {
     conf->environment.len  = 0;
     conf->friendly_error_pages = NGX_CONF_UNSET;
     conf->min_instances = NGX_CONF_UNSET;
+    conf->spawn_concurrency = NGX_CONF_UNSET;
+    conf->rolling_restart_batch_size = NGX_CONF_UNSET;
+    conf->target_utilization = NGX_CONF_UNSET;
+    conf->preloader_standby_processes = NGX_CONF_UNSET;
+    conf->recycle_jitter = NGX_CONF_UNSET;
+    conf->capacity_weight = NGX_CONF_UNSET;
+    conf->max_out_of_band_work_percentage = NGX_CONF_UNSET;
+    conf->out_of_band_work_max_utilization = NGX_CONF_UNSET;
+    conf->out_of_band_work_idle_interval = NGX_CONF_UNSET;
+    conf->warmup_time = NGX_CONF_UNSET;
+    conf->memory_limit = NGX_CONF_UNSET;
     conf->max_instances_per_app = NGX_CONF_UNSET;
     conf->max_requests = NGX_CONF_UNSET;
     conf->start_timeout = NGX_CONF_UNSET;
@@ -84,9 +95,17 @@ generated_set_conf_part(passenger_loc_conf_t  *conf) {
     conf->spawn_method.data = NULL;
     conf->spawn_method.len  = 0;
     conf->load_shell_envvars = NGX_CONF_UNSET;
+    conf->preloader_compact_heap = NGX_CONF_UNSET;
+    conf->preloader_warmup_script.data = NULL;
+    conf->preloader_warmup_script.len  = 0;
+    conf->rolling_restarts = NGX_CONF_UNSET;
     conf->union_station_key.data = NULL;
     conf->union_station_key.len  = 0;
     conf->max_request_queue_size = NGX_CONF_UNSET;
+    conf->request_queue_target_delay = NGX_CONF_UNSET;
+    conf->rate_limit = NGX_CONF_UNSET;
+    conf->rate_limit_burst = NGX_CONF_UNSET;
+    conf->max_requests_in_flight = NGX_CONF_UNSET;
     conf->request_queue_overflow_status_code = NGX_CONF_UNSET;
     conf->restart_dir.data = NULL;
     conf->restart_dir.len  = 0;
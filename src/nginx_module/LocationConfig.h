@@ -62,15 +62,32 @@ typedef struct {
     ngx_uint_t headers_hash_max_size;
     ngx_array_t *headers_source;
     ngx_int_t load_shell_envvars;
+    ngx_int_t preloader_compact_heap;
+    ngx_int_t rolling_restarts;
     ngx_int_t max_instances_per_app;
     ngx_int_t max_preloader_idle_time;
     ngx_int_t max_request_queue_size;
     ngx_int_t max_requests;
+    ngx_int_t memory_limit;
     ngx_int_t min_instances;
     ngx_int_t request_queue_overflow_status_code;
+    ngx_int_t request_queue_target_delay;
+    ngx_int_t rate_limit;
+    ngx_int_t rate_limit_burst;
+    ngx_int_t max_requests_in_flight;
     ngx_int_t socket_backlog;
+    ngx_int_t spawn_concurrency;
+    ngx_int_t rolling_restart_batch_size;
     ngx_int_t start_timeout;
     ngx_int_t sticky_sessions;
+    ngx_int_t target_utilization;
+    ngx_int_t preloader_standby_processes;
+    ngx_int_t recycle_jitter;
+    ngx_int_t capacity_weight;
+    ngx_int_t max_out_of_band_work_percentage;
+    ngx_int_t out_of_band_work_max_utilization;
+    ngx_int_t out_of_band_work_idle_interval;
+    ngx_int_t warmup_time;
     ngx_array_t *union_station_filters;
     ngx_int_t union_station_support;
     ngx_str_t app_group_name;
@@ -82,6 +99,7 @@ typedef struct {
     ngx_str_t group;
     ngx_str_t meteor_app_settings;
     ngx_str_t nodejs;
+    ngx_str_t preloader_warmup_script;
     ngx_str_t python;
     ngx_str_t restart_dir;
     ngx_str_t ruby;
@@ -81,6 +81,39 @@ generated_merge_part(passenger_loc_conf_t *conf, passenger_loc_conf_t *prev, ngx
     ngx_conf_merge_value(conf->min_instances,
         prev->min_instances,
         NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->spawn_concurrency,
+        prev->spawn_concurrency,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->rolling_restart_batch_size,
+        prev->rolling_restart_batch_size,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->target_utilization,
+        prev->target_utilization,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->preloader_standby_processes,
+        prev->preloader_standby_processes,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->recycle_jitter,
+        prev->recycle_jitter,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->capacity_weight,
+        prev->capacity_weight,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->max_out_of_band_work_percentage,
+        prev->max_out_of_band_work_percentage,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->out_of_band_work_max_utilization,
+        prev->out_of_band_work_max_utilization,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->out_of_band_work_idle_interval,
+        prev->out_of_band_work_idle_interval,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->warmup_time,
+        prev->warmup_time,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->memory_limit,
+        prev->memory_limit,
+        NGX_CONF_UNSET);
     ngx_conf_merge_value(conf->max_instances_per_app,
         prev->max_instances_per_app,
         NGX_CONF_UNSET);
@@ -144,12 +177,33 @@ generated_merge_part(passenger_loc_conf_t *conf, passenger_loc_conf_t *prev, ngx
     ngx_conf_merge_value(conf->load_shell_envvars,
         prev->load_shell_envvars,
         NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->preloader_compact_heap,
+        prev->preloader_compact_heap,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_str_value(conf->preloader_warmup_script,
+        prev->preloader_warmup_script,
+        NULL);
+    ngx_conf_merge_value(conf->rolling_restarts,
+        prev->rolling_restarts,
+        NGX_CONF_UNSET);
     ngx_conf_merge_str_value(conf->union_station_key,
         prev->union_station_key,
         NULL);
     ngx_conf_merge_value(conf->max_request_queue_size,
         prev->max_request_queue_size,
         NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->request_queue_target_delay,
+        prev->request_queue_target_delay,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->rate_limit,
+        prev->rate_limit,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->rate_limit_burst,
+        prev->rate_limit_burst,
+        NGX_CONF_UNSET);
+    ngx_conf_merge_value(conf->max_requests_in_flight,
+        prev->max_requests_in_flight,
+        NGX_CONF_UNSET);
     ngx_conf_merge_value(conf->request_queue_overflow_status_code,
         prev->request_queue_overflow_status_code,
         NGX_CONF_UNSET);
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) 2007 Manlio Perillo (manlio.perillo@gmail.com)
+ * Copyright (c) 2017 Phusion Holding B.V.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ngx_http_passenger_module.h"
+#include "SharedStatCache.h"
+
+
+typedef struct {
+    ngx_rbtree_t       rbtree;
+    ngx_rbtree_node_t  sentinel;
+    /** Most recently used entries are at the head. */
+    ngx_queue_t        queue;
+} shared_stat_cache_sh_t;
+
+typedef struct {
+    shared_stat_cache_sh_t *sh;
+    ngx_slab_pool_t        *shpool;
+} shared_stat_cache_ctx_t;
+
+typedef struct {
+    /** Keyed by the filename. Must be the first member. */
+    ngx_str_node_t  sn;
+    ngx_queue_t     queue;
+    time_t          last_check;
+    /** The errno of the last stat() call, or 0 if it succeeded. */
+    ngx_err_t       err;
+    mode_t          mode;
+    u_char          filename[1];
+} shared_stat_cache_node_t;
+
+
+static ngx_int_t
+init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    shared_stat_cache_ctx_t *octx = data;
+    shared_stat_cache_ctx_t *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx != NULL) {
+        /* Nginx is reloading and kept the zone from the previous cycle. */
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(shared_stat_cache_sh_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_queue_init(&ctx->sh->queue);
+
+    return NGX_OK;
+}
+
+ngx_shm_zone_t *
+pp_shared_stat_cache_add(ngx_conf_t *cf, size_t size)
+{
+    static ngx_str_t         name = ngx_string("passenger_stat_cache");
+    shared_stat_cache_ctx_t *ctx;
+    ngx_shm_zone_t          *shm_zone;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(shared_stat_cache_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_passenger_module);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    shm_zone->init = init_zone;
+    shm_zone->data = ctx;
+
+    return shm_zone;
+}
+
+/* The functions below must be called with the zone's mutex held. */
+
+static shared_stat_cache_node_t *
+lookup_node(shared_stat_cache_ctx_t *ctx, ngx_str_t *filename, uint32_t hash)
+{
+    return (shared_stat_cache_node_t *) ngx_str_rbtree_lookup(
+        &ctx->sh->rbtree, filename, hash);
+}
+
+static void
+touch_node(shared_stat_cache_ctx_t *ctx, shared_stat_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&ctx->sh->queue, &node->queue);
+}
+
+static void
+evict_node(shared_stat_cache_ctx_t *ctx, shared_stat_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&ctx->sh->rbtree, &node->sn.node);
+    ngx_slab_free_locked(ctx->shpool, node);
+}
+
+static shared_stat_cache_node_t *
+allocate_node(shared_stat_cache_ctx_t *ctx, size_t filename_len)
+{
+    shared_stat_cache_node_t *node;
+    size_t                    size;
+
+    size = offsetof(shared_stat_cache_node_t, filename) + filename_len;
+    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    while (node == NULL && !ngx_queue_empty(&ctx->sh->queue)) {
+        evict_node(ctx, ngx_queue_data(ngx_queue_last(&ctx->sh->queue),
+            shared_stat_cache_node_t, queue));
+        node = ngx_slab_alloc_locked(ctx->shpool, size);
+    }
+
+    return node;
+}
+
+static void
+store_result(shared_stat_cache_ctx_t *ctx, ngx_str_t *filename, uint32_t hash,
+    time_t now, ngx_err_t err, mode_t mode)
+{
+    shared_stat_cache_node_t *node;
+
+    /* Another worker may have added or evicted the entry while
+     * we were stat()ing, so look it up again.
+     */
+    node = lookup_node(ctx, filename, hash);
+    if (node == NULL) {
+        node = allocate_node(ctx, filename->len);
+        if (node == NULL) {
+            return;
+        }
+
+        ngx_memcpy(node->filename, filename->data, filename->len);
+        node->sn.node.key = hash;
+        node->sn.str.data = node->filename;
+        node->sn.str.len  = filename->len;
+        ngx_rbtree_insert(&ctx->sh->rbtree, &node->sn.node);
+        ngx_queue_insert_head(&ctx->sh->queue, &node->queue);
+    } else {
+        touch_node(ctx, node);
+    }
+
+    node->last_check = now;
+    node->err = err;
+    node->mode = mode;
+}
+
+int
+pp_shared_stat_cache_perform(ngx_shm_zone_t *zone, const u_char *filename,
+    size_t len, mode_t *mode, unsigned int throttle_rate)
+{
+    shared_stat_cache_ctx_t  *ctx = zone->data;
+    shared_stat_cache_node_t *node;
+    ngx_str_t                 key;
+    uint32_t                  hash;
+    time_t                    now;
+    ngx_err_t                 err;
+    struct stat               buf;
+
+    key.data = (u_char *) filename;
+    key.len  = len;
+    hash = ngx_crc32_short(key.data, key.len);
+    now  = ngx_time();
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    node = lookup_node(ctx, &key, hash);
+    if (node != NULL) {
+        if ((unsigned int) (now - node->last_check) < throttle_rate) {
+            touch_node(ctx, node);
+            err = node->err;
+            *mode = node->mode;
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            goto done;
+        }
+
+        /* Let the other workers keep using the old result until
+         * we've refreshed it, instead of all of them stat()ing at once.
+         */
+        node->last_check = now;
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    /* Never stat() with the mutex held: on network filesystems
+     * a single stat() can block for a long time.
+     */
+    if (stat((const char *) filename, &buf) == 0) {
+        err = 0;
+        *mode = buf.st_mode;
+    } else {
+        err = ngx_errno;
+        *mode = 0;
+    }
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+    store_result(ctx, &key, hash, now, err, *mode);
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+done:
+    if (err != 0) {
+        ngx_set_errno(err);
+        return -1;
+    } else {
+        return 0;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) 2007 Manlio Perillo (manlio.perillo@gmail.com)
+ * Copyright (c) 2017 Phusion Holding B.V.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PASSENGER_NGINX_SHARED_STAT_CACHE_H_
+#define _PASSENGER_NGINX_SHARED_STAT_CACHE_H_
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <sys/types.h>
+
+
+/**
+ * A stat() cache that lives in a shared memory zone, so that all Nginx
+ * workers share the same cached results and the same throttle windows.
+ * Without it, every worker stats the same page cache files and public
+ * directories independently, which multiplies the number of stat() calls
+ * by the number of workers. That hurts on network filesystems.
+ *
+ * Only the information that the content handler needs (the file type) is
+ * cached. Entries are invalidated purely by time: an entry is re-stat()ed
+ * once `throttle_rate` seconds have passed since it was last checked. When
+ * the zone is full, the least recently used entries are evicted.
+ */
+
+/**
+ * Registers the shared memory zone that backs the cache. Must be called
+ * during configuration parsing. Returns NULL on error.
+ */
+ngx_shm_zone_t *pp_shared_stat_cache_add(ngx_conf_t *cf, size_t size);
+
+/**
+ * Stats the given file through the cache in `zone`. `filename` must be
+ * NUL-terminated. On success, returns 0 and stores the file's mode in
+ * `mode`. On failure, returns -1 and sets errno, just like stat().
+ */
+int pp_shared_stat_cache_perform(ngx_shm_zone_t *zone, const u_char *filename,
+    size_t len, mode_t *mode, unsigned int throttle_rate);
+
+
+#endif /* _PASSENGER_NGINX_SHARED_STAT_CACHE_H_ */
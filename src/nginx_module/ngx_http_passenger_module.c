@@ -60,6 +60,7 @@ ngx_str_t                 pp_schema_string;
 ngx_str_t                 pp_placeholder_upstream_address;
 PP_CachedFileStat        *pp_stat_cache;
 PP_AppTypeDetector       *pp_app_type_detector;
+PP_StaticAssetManifestRegistry *pp_static_asset_manifests = NULL;
 PsgWatchdogLauncher      *psg_watchdog_launcher = NULL;
 ngx_cycle_t              *pp_current_cycle;
 
@@ -244,6 +245,8 @@ start_watchdog(ngx_cycle_t *cycle) {
 
     pp_app_type_detector_set_throttle_rate(pp_app_type_detector,
         passenger_main_conf.stat_throttle_rate);
+    pp_static_asset_manifest_registry_set_throttle_rate(pp_static_asset_manifests,
+        passenger_main_conf.stat_throttle_rate);
 
     prestart_uris = (ngx_str_t *) passenger_main_conf.prestart_uris->elts;
     prestart_uris_ary = calloc(sizeof(char *), passenger_main_conf.prestart_uris->nelts);
@@ -397,6 +400,11 @@ pre_config_init(ngx_conf_t *cf)
     pp_placeholder_upstream_address.len  = sizeof("unix:/passenger_core") - 1;
     pp_stat_cache = pp_cached_file_stat_new(1024);
     pp_app_type_detector = pp_app_type_detector_new(DEFAULT_STAT_THROTTLE_RATE);
+    if (pp_static_asset_manifests == NULL) {
+        /* Kept across reloads so that loaded manifests stay cached. */
+        pp_static_asset_manifests = pp_static_asset_manifest_registry_new(
+            DEFAULT_STAT_THROTTLE_RATE);
+    }
     psg_watchdog_launcher = psg_watchdog_launcher_new(IM_NGINX, &error_message);
 
     if (psg_watchdog_launcher == NULL) {
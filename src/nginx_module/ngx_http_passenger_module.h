@@ -33,6 +33,7 @@
 #include "cxx_supportlib/WatchdogLauncher.h"
 #include "cxx_supportlib/AppTypes.h"
 #include "cxx_supportlib/Utils/CachedFileStat.h"
+#include "cxx_supportlib/Utils/StaticAssetManifest.h"
 
 /**
  * The Nginx version number as an integer.
@@ -57,6 +58,9 @@ extern PP_CachedFileStat        *pp_stat_cache;
 
 extern PP_AppTypeDetector       *pp_app_type_detector;
 
+/** Asset manifests of the apps served, used to recognize static files without stat(). */
+extern PP_StaticAssetManifestRegistry *pp_static_asset_manifests;
+
 extern PsgWatchdogLauncher      *psg_watchdog_launcher;
 
 extern ngx_cycle_t              *pp_current_cycle;
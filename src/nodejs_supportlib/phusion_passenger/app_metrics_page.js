@@ -0,0 +1,169 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2016 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+var fs = require('fs');
+var os = require('os');
+
+var FIELDS_OFFSET = 8;
+var FIELDS_SIZE = 48;
+var UPDATE_INTERVAL = 1000;
+
+function allocBuffer(size) {
+	if (Buffer.alloc) {
+		return Buffer.alloc(size);
+	} else {
+		var buf = new Buffer(size);
+		buf.fill(0);
+		return buf;
+	}
+}
+
+/**
+ * Publishes metrics about this process, such as its garbage collection
+ * activity, through the file that the Passenger core passed to us in the
+ * 'metrics_file' spawn option. The core has mapped that file into memory
+ * and reads it without communicating with us. See
+ * src/agent/Core/SpawningKit/AppMetricsPage.h for the layout.
+ *
+ * The metrics are written once per second, instead of on every request,
+ * to keep the per-request overhead low. Garbage collection runs are only
+ * known after they have finished, so the "garbage collection in progress"
+ * flag is never set.
+ */
+function AppMetricsPage(fd) {
+	this.fd = fd;
+	this.sequence = 0;
+	this.requestsBusy = 0;
+	this.gcCount = 0;
+	this.gcTime = 0;
+	this.littleEndian = os.endianness() === 'LE';
+	this.buffer = allocBuffer(FIELDS_SIZE);
+	this.installGcObserver();
+	this.update();
+
+	var header = allocBuffer(8);
+	header.write('PSGM', 0, 4, 'binary');
+	this.writeUInt32(header, 1, 4);
+	fs.writeSync(fd, header, 0, header.length, 0);
+
+	var timer = setInterval(this.update.bind(this), UPDATE_INTERVAL);
+	if (timer.unref) {
+		timer.unref();
+	}
+}
+
+/**
+ * Opens the file at the given path. Returns null if that's not possible,
+ * in which case the process just doesn't publish metrics.
+ */
+AppMetricsPage.open = function(path) {
+	try {
+		return new AppMetricsPage(fs.openSync(path, 'r+'));
+	} catch (e) {
+		return null;
+	}
+};
+
+AppMetricsPage.prototype.installGcObserver = function() {
+	var perfHooks;
+	try {
+		perfHooks = require('perf_hooks');
+	} catch (e) {
+		return;
+	}
+	if (!perfHooks.PerformanceObserver) {
+		return;
+	}
+
+	var self = this;
+	try {
+		var observer = new perfHooks.PerformanceObserver(function(list) {
+			list.getEntries().forEach(function(entry) {
+				self.gcCount++;
+				// In usec.
+				self.gcTime += Math.round(entry.duration * 1000);
+			});
+		});
+		observer.observe({ entryTypes: ['gc'] });
+	} catch (e) {
+		// This Node version doesn't report garbage collection runs.
+	}
+};
+
+AppMetricsPage.prototype.requestBegan = function() {
+	this.requestsBusy++;
+};
+
+AppMetricsPage.prototype.requestFinished = function() {
+	this.requestsBusy--;
+};
+
+AppMetricsPage.prototype.writeUInt32 = function(buf, value, offset) {
+	if (this.littleEndian) {
+		buf.writeUInt32LE(value, offset);
+	} else {
+		buf.writeUInt32BE(value, offset);
+	}
+};
+
+AppMetricsPage.prototype.writeUInt64 = function(buf, value, offset) {
+	var high = Math.floor(value / 0x100000000);
+	var low = value % 0x100000000;
+	if (this.littleEndian) {
+		buf.writeUInt32LE(low, offset);
+		buf.writeUInt32LE(high, offset + 4);
+	} else {
+		buf.writeUInt32BE(high, offset);
+		buf.writeUInt32BE(low, offset + 4);
+	}
+};
+
+AppMetricsPage.prototype.update = function() {
+	var buf = this.buffer;
+	var heapUsed = process.memoryUsage().heapUsed;
+
+	// Odd sequence numbers tell the core that the fields are being
+	// changed, so that it doesn't read a half-written update.
+	this.writeUInt64(buf, this.sequence + 1, 0);
+	this.writeUInt64(buf, Date.now() * 1000, 8);
+	this.writeUInt64(buf, this.gcCount, 16);
+	this.writeUInt64(buf, this.gcTime, 24);
+	this.writeUInt64(buf, heapUsed, 32);
+	this.writeUInt32(buf, Math.max(this.requestsBusy, 0), 40);
+	// Node handles any number of requests concurrently.
+	this.writeUInt32(buf, 0, 44);
+	try {
+		fs.writeSync(this.fd, buf, 0, FIELDS_SIZE, FIELDS_OFFSET);
+		this.sequence += 2;
+		this.writeUInt64(buf, this.sequence, 0);
+		fs.writeSync(this.fd, buf, 0, 8, FIELDS_OFFSET);
+	} catch (e) {
+		// The core is gone or the file is unusable. There is nobody
+		// to report this to.
+	}
+};
+
+exports.AppMetricsPage = AppMetricsPage;
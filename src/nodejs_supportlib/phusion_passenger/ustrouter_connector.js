@@ -52,11 +52,13 @@ var pendingTxnBuf;
 var pendingTxnBufMaxLength;
 var connTimeoutMs;
 var autoRetryAfterMs;
+var pushScheduled;
 
 setDefaults();
 function setDefaults() {
 	routerState = -1;
 	pendingTxnBuf = [];
+	pushScheduled = false;
 	pendingTxnBufMaxLength = 5000;
 	connTimeoutMs = 10000;
 	autoRetryAfterMs = 30000;
@@ -184,6 +186,7 @@ exports.deferIfPendingTxns = function(txnId, deferThis, deferFn, deferArgs) {
 // Example categories are "requests", "exceptions". The lineArray is a specific format parsed by Union STation.
 // txnIfContinue is an optional txnId and attaches the log to an existing transaction with the specified txnId.
 // N.B. transactions will be dropped if the outgoing buffer limit is reached.
+// The logs are sent asynchronously, so this doesn't cost the request any I/O.
 exports.logToUstTransaction = function(category, lineArray, txnIfContinue) {
 	if (!this.isEnabled()) {
 		return;
@@ -202,9 +205,21 @@ exports.logToUstTransaction = function(category, lineArray, txnIfContinue) {
 		log.debug("Dropping Union Station log due to outgoing buffer limit (" + pendingTxnBufMaxLength + ") reached");
 	}
 
-	pushPendingData();
+	schedulePushPendingData();
 };
 
+// Calls pushPendingData() once, after the current event loop iteration. Requests
+// that log in the same iteration then only cause a single push.
+function schedulePushPendingData() {
+	if (!pushScheduled) {
+		pushScheduled = true;
+		setImmediate(function() {
+			pushScheduled = false;
+			pushPendingData();
+		});
+	}
+}
+
 function verifyOk(rcvString, topic) {
 	if ("status" != rcvString[0] || "ok" != rcvString[1]) {
 		log.error("Error with " + topic + ": [" + rcvString + "], will auto-retry.");
@@ -263,14 +278,19 @@ function pushPendingData() {
 				}
 			}
 
+			// Send the logs and the close command in a single write.
+			var buffers = [];
+			var logCommand = "log\0" + txn.txnId + "\0" + codify.toCode(txn.timestamp) + "\0";
 			for (var i = 0; i < txn.logBuf.length; i++) {
-				writeLenArray(routerConn, "log\0" + txn.txnId + "\0" + codify.toCode(txn.timestamp) + "\0");
-				writeLenString(routerConn, txn.logBuf[i]);
+				buffers.push(lenArrayToBuffer(logCommand));
+				buffers.push(lenStringToBuffer(txn.logBuf[i]));
 			}
+			buffers.push(lenArrayToBuffer("closeTransaction\0" + txn.txnId + "\0" +
+				codify.toCode(getWallclockMicrosec()) + "\0true\0"));
 
 			changeState(7); // expect ok in onData()..
 			setWatchdog(connTimeoutMs);
-			writeLenArray(routerConn, "closeTransaction\0" + txn.txnId + "\0" + codify.toCode(getWallclockMicrosec()) + "\0true\0");
+			routerConn.write(Buffer.concat(buffers));
 			log.debug("wrote log and close for " + txn.txnId);
 			break;
 
@@ -422,18 +442,30 @@ function changeState(newRouterState, optReason) {
 	routerState = newRouterState;
 }
 
+// Both functions prefix the string with its length, in bytes, so that a
+// message can be written with a single write() call.
+function lenStringToBuffer(str) {
+	var len = Buffer.byteLength(str);
+	var buf = new Buffer(4 + len);
+	nbo.htonl(buf, 0, len);
+	buf.write(str, 4);
+	return buf;
+}
+
+function lenArrayToBuffer(str) {
+	var len = Buffer.byteLength(str);
+	var buf = new Buffer(2 + len);
+	nbo.htons(buf, 0, len);
+	buf.write(str, 2);
+	return buf;
+}
+
 function writeLenString(c, str) {
-	var len = new Buffer(4);
-	nbo.htonl(len, 0, str.length);
-	c.write(len);
-	c.write(str);
+	c.write(lenStringToBuffer(str));
 }
 
 function writeLenArray(c, str) {
-	var len = new Buffer(2);
-	nbo.htons(len, 0, str.length);
-	c.write(len);
-	c.write(str);
+	c.write(lenArrayToBuffer(str));
 }
 
 if (process.env.NODE_ENV === 'test') {
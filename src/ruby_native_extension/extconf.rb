@@ -39,9 +39,11 @@
 have_header('ruby/version.h')
 have_header('ruby/io.h')
 have_header('ruby/thread.h')
+have_header('ruby/encoding.h')
 have_var('ruby_version')
 have_func('rb_thread_io_blocking_region', 'ruby/io.h')
 have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
 
 with_cflags($CFLAGS) do
 	create_makefile('passenger_native_support')
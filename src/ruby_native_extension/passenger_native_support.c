@@ -40,6 +40,9 @@
 #ifdef HAVE_RUBY_THREAD_H
 	#include "ruby/thread.h"
 #endif
+#ifdef HAVE_RUBY_ENCODING_H
+	#include "ruby/encoding.h"
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -52,6 +55,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -82,6 +86,12 @@
 	/* MacRuby compatibility */
 	#define RUBY_UBF_IO RB_UBF_DFL
 #endif
+#ifndef SIZET2NUM
+	#define SIZET2NUM(v) ULL2NUM(v)
+#endif
+#ifndef SSIZET2NUM
+	#define SSIZET2NUM(v) LL2NUM(v)
+#endif
 #ifndef IOV_MAX
 	/* Linux doesn't define IOV_MAX in limits.h for some reason. */
 	#define IOV_MAX sysconf(_SC_IOV_MAX)
@@ -94,6 +104,7 @@
 static VALUE mPassenger;
 static VALUE mNativeSupport;
 static VALUE S_ProcessTimes;
+static VALUE cIOVector;
 #ifdef HAVE_KQUEUE
 	static VALUE cFileSystemWatcher;
 #endif
@@ -146,6 +157,69 @@ split_by_null_into_hash(VALUE self, VALUE data) {
 	return result;
 }
 
+/**
+ * Returns a frozen string with the given contents, for use as a hash key.
+ * On Rubies that support it, the string is deduplicated, so that the keys
+ * of all request environments share the same string objects.
+ */
+static VALUE
+make_frozen_key(VALUE data, const char *cdata, const char *begin, const char *end) {
+	#ifdef HAVE_RB_ENC_INTERNED_STR
+		return rb_enc_interned_str(begin, end - begin, rb_enc_get(data));
+	#else
+		VALUE key = rb_str_substr(data, begin - cdata, end - begin);
+		OBJ_FREEZE(key);
+		return key;
+	#endif
+}
+
+/**
+ * call-seq: split_by_null_into_env(data, base_env)
+ *
+ * Like split_by_null_into_hash, but for parsing a request header into a
+ * request environment. The result is a copy of +base_env+ (which may be nil)
+ * with the keys and values from +data+ added to it. Keys are frozen, so
+ * that the Hash doesn't have to copy them, and deduplicated where the Ruby
+ * version allows. Values share memory with +data+.
+ */
+static VALUE
+split_by_null_into_env(VALUE self, VALUE data, VALUE base_env) {
+	const char *cdata   = RSTRING_PTR(data);
+	unsigned long len   = RSTRING_LEN(data);
+	const char *begin   = cdata;
+	const char *current = cdata;
+	const char *end     = cdata + len;
+	const char *key_begin, *key_end;
+	VALUE result;
+
+	if (NIL_P(base_env)) {
+		result = rb_hash_new();
+	} else {
+		result = rb_hash_dup(base_env);
+	}
+	while (current < end) {
+		if (*current == '\0') {
+			key_begin = begin;
+			key_end   = current;
+			begin = current = current + 1;
+			while (current < end) {
+				if (*current == '\0') {
+					rb_hash_aset(result,
+						make_frozen_key(data, cdata, key_begin, key_end),
+						rb_str_substr(data, begin - cdata, current - begin));
+					begin = current = current + 1;
+					break;
+				} else {
+					current++;
+				}
+			}
+		} else {
+			current++;
+		}
+	}
+	return result;
+}
+
 typedef struct {
 	/* The IO vectors in this group. */
 	struct iovec *io_vectors;
@@ -218,6 +292,66 @@ update_group_written_info(IOVectorGroup *group, ssize_t bytes_written) {
 	#endif
 #endif
 
+/* Writes all data in the given groups, one writev() call per group, retrying
+ * after partial writes. Raises an exception if writing fails.
+ */
+static void
+write_iovector_groups(int fd_num, IOVectorGroup *groups, unsigned int ngroups) {
+	unsigned int i;
+	ssize_t ret;
+	int done, e;
+	#ifndef TRAP_BEG
+		WritevWrapperData writev_wrapper_data;
+	#endif
+
+	for (i = 0; i < ngroups; i++) {
+		/* Wait until the file descriptor becomes writable before writing things. */
+		rb_thread_fd_writable(fd_num);
+
+		done = 0;
+		while (!done) {
+			#ifdef TRAP_BEG
+				TRAP_BEG;
+				ret = writev(fd_num, groups[i].io_vectors, groups[i].count);
+				TRAP_END;
+			#else
+				writev_wrapper_data.filedes = fd_num;
+				writev_wrapper_data.iov     = groups[i].io_vectors;
+				writev_wrapper_data.iovcnt  = groups[i].count;
+				#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+					ret = (ssize_t) rb_thread_call_without_gvl(writev_wrapper,
+						&writev_wrapper_data, RUBY_UBF_IO, NULL);
+				#elif defined(HAVE_RB_THREAD_IO_BLOCKING_REGION)
+					ret = (ssize_t) rb_thread_io_blocking_region(writev_wrapper,
+						&writev_wrapper_data, fd_num);
+				#else
+					ret = (ssize_t) rb_thread_blocking_region(writev_wrapper,
+						&writev_wrapper_data, RUBY_UBF_IO, 0);
+				#endif
+			#endif
+			if (ret == -1) {
+				/* If the error is something like EAGAIN, yield to another
+				 * thread until the file descriptor becomes writable again.
+				 * In case of other errors, raise an exception.
+				 */
+				if (!rb_io_wait_writable(fd_num)) {
+					rb_sys_fail("writev()");
+				}
+			} else if (ret < groups[i].total_size) {
+				/* Not everything in this group has been written. Retry without
+				 * writing the bytes that been successfully written.
+				 */
+				e = errno;
+				update_group_written_info(&groups[i], ret);
+				errno = e;
+				rb_io_wait_writable(fd_num);
+			} else {
+				done = 1;
+			}
+		}
+	}
+}
+
 static VALUE
 f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 	VALUE components, str;
@@ -225,11 +359,6 @@ f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 	IOVectorGroup *groups;
 	unsigned int i, j, group_offset, vector_offset;
 	unsigned long long ssize_max;
-	ssize_t ret;
-	int done, fd_num, e;
-	#ifndef TRAP_BEG
-		WritevWrapperData writev_wrapper_data;
-	#endif
 
 	/* First determine the number of components that we have. */
 	total_components   = 0;
@@ -316,54 +445,7 @@ f_generic_writev(VALUE fd, VALUE *array_of_components, unsigned int count) {
 		rb_raise(rb_eArgError, "The total size of the components may not be larger than SSIZE_MAX.");
 	}
 
-	/* Write the data. */
-	fd_num = NUM2INT(fd);
-	for (i = 0; i < ngroups; i++) {
-		/* Wait until the file descriptor becomes writable before writing things. */
-		rb_thread_fd_writable(fd_num);
-
-		done = 0;
-		while (!done) {
-			#ifdef TRAP_BEG
-				TRAP_BEG;
-				ret = writev(fd_num, groups[i].io_vectors, groups[i].count);
-				TRAP_END;
-			#else
-				writev_wrapper_data.filedes = fd_num;
-				writev_wrapper_data.iov     = groups[i].io_vectors;
-				writev_wrapper_data.iovcnt  = groups[i].count;
-				#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
-					ret = (ssize_t) rb_thread_call_without_gvl(writev_wrapper,
-						&writev_wrapper_data, RUBY_UBF_IO, NULL);
-				#elif defined(HAVE_RB_THREAD_IO_BLOCKING_REGION)
-					ret = (ssize_t) rb_thread_io_blocking_region(writev_wrapper,
-						&writev_wrapper_data, fd_num);
-				#else
-					ret = (ssize_t) rb_thread_blocking_region(writev_wrapper,
-						&writev_wrapper_data, RUBY_UBF_IO, 0);
-				#endif
-			#endif
-			if (ret == -1) {
-				/* If the error is something like EAGAIN, yield to another
-				 * thread until the file descriptor becomes writable again.
-				 * In case of other errors, raise an exception.
-				 */
-				if (!rb_io_wait_writable(fd_num)) {
-					rb_sys_fail("writev()");
-				}
-			} else if (ret < groups[i].total_size) {
-				/* Not everything in this group has been written. Retry without
-				 * writing the bytes that been successfully written.
-				 */
-				e = errno;
-				update_group_written_info(&groups[i], ret);
-				errno = e;
-				rb_io_wait_writable(fd_num);
-			} else {
-				done = 1;
-			}
-		}
-	}
+	write_iovector_groups(NUM2INT(fd), groups, ngroups);
 	return INT2NUM(total_size);
 }
 
@@ -410,6 +492,364 @@ f_writev3(VALUE self, VALUE fd, VALUE components1, VALUE components2, VALUE comp
 	return f_generic_writev(fd, array_of_components, 3);
 }
 
+typedef struct {
+	/* The strings that io_vectors point to. Marked so that they're neither
+	 * garbage collected nor moved while they're in the vector.
+	 */
+	VALUE *strings;
+
+	struct iovec *io_vectors;
+
+	/* The index of the first vector that hasn't been completely written. */
+	unsigned int start;
+
+	/* The number of vectors, including those that have been written. */
+	unsigned int count;
+
+	/* The number of vectors that fit in the allocated memory. */
+	unsigned int capacity;
+
+	/* The combined size of the vectors that haven't been written. */
+	size_t total_size;
+} IOVector;
+
+static void
+iovector_mark(void *obj) {
+	IOVector *vec = (IOVector *) obj;
+	unsigned int i;
+
+	for (i = 0; i < vec->count; i++) {
+		rb_gc_mark(vec->strings[i]);
+	}
+}
+
+static void
+iovector_free(void *obj) {
+	IOVector *vec = (IOVector *) obj;
+	xfree(vec->strings);
+	xfree(vec->io_vectors);
+	xfree(vec);
+}
+
+static VALUE
+iovector_alloc(VALUE klass) {
+	IOVector *vec = ALLOC(IOVector);
+	memset(vec, 0, sizeof(IOVector));
+	return Data_Wrap_Struct(klass, iovector_mark, iovector_free, vec);
+}
+
+static void
+iovector_reset(IOVector *vec) {
+	vec->start = 0;
+	vec->count = 0;
+	vec->total_size = 0;
+}
+
+/*
+ * call-seq: iovector << string
+ *
+ * Appends the given string to the vector without copying its data. The
+ * string should not be modified until the vector has been written or
+ * cleared; if it is, the vector keeps the old contents.
+ */
+static VALUE
+iovector_push(VALUE self, VALUE str) {
+	IOVector *vec;
+	unsigned int capacity;
+
+	Data_Get_Struct(self, IOVector, vec);
+	str = rb_str_new_frozen(rb_obj_as_string(str));
+	if (RSTRING_LEN(str) == 0) {
+		return self;
+	}
+	if ((unsigned long long) vec->total_size + RSTRING_LEN(str) > (unsigned long long) SSIZE_MAX) {
+		rb_raise(rb_eArgError, "The total size of the vector may not be larger than SSIZE_MAX.");
+	}
+
+	if (vec->count == vec->capacity) {
+		capacity = (vec->capacity == 0) ? 16 : vec->capacity * 2;
+		REALLOC_N(vec->strings, VALUE, capacity);
+		REALLOC_N(vec->io_vectors, struct iovec, capacity);
+		vec->capacity = capacity;
+	}
+	vec->strings[vec->count] = str;
+	vec->io_vectors[vec->count].iov_base = (char *) RSTRING_PTR(str);
+	vec->io_vectors[vec->count].iov_len  = RSTRING_LEN(str);
+	vec->count++;
+	vec->total_size += RSTRING_LEN(str);
+	return self;
+}
+
+/*
+ * Removes all strings from the vector. The allocated memory is kept, so
+ * that the vector can be reused without allocating again.
+ */
+static VALUE
+iovector_clear(VALUE self) {
+	IOVector *vec;
+	Data_Get_Struct(self, IOVector, vec);
+	iovector_reset(vec);
+	return self;
+}
+
+/*
+ * The number of strings that haven't been written.
+ */
+static VALUE
+iovector_size(VALUE self) {
+	IOVector *vec;
+	Data_Get_Struct(self, IOVector, vec);
+	return UINT2NUM(vec->count - vec->start);
+}
+
+/*
+ * The number of bytes that haven't been written.
+ */
+static VALUE
+iovector_bytesize(VALUE self) {
+	IOVector *vec;
+	Data_Get_Struct(self, IOVector, vec);
+	return SIZET2NUM(vec->total_size);
+}
+
+static VALUE
+iovector_empty_p(VALUE self) {
+	IOVector *vec;
+	Data_Get_Struct(self, IOVector, vec);
+	return (vec->start == vec->count) ? Qtrue : Qfalse;
+}
+
+typedef struct {
+	int fd;
+	IOVector *vec;
+} WritevIOVectorData;
+
+static VALUE
+writev_iovector_body(VALUE arg) {
+	WritevIOVectorData *data = (WritevIOVectorData *) arg;
+	IOVector *vec = data->vec;
+	IOVectorGroup *groups;
+	unsigned int i, ngroups, remaining;
+	size_t total_size = vec->total_size;
+
+	remaining = vec->count - vec->start;
+	ngroups = (remaining + IOV_MAX - 1) / IOV_MAX;
+	groups = alloca(ngroups * sizeof(IOVectorGroup));
+	if (groups == NULL) {
+		rb_raise(rb_eNoMemError, "Insufficient stack space.");
+	}
+	for (i = 0; i < ngroups; i++) {
+		unsigned int j;
+
+		groups[i].io_vectors = vec->io_vectors + vec->start + i * IOV_MAX;
+		groups[i].count = MIN(remaining - i * IOV_MAX, (unsigned int) IOV_MAX);
+		groups[i].total_size = 0;
+		for (j = 0; j < groups[i].count; j++) {
+			groups[i].total_size += groups[i].io_vectors[j].iov_len;
+		}
+	}
+
+	write_iovector_groups(data->fd, groups, ngroups);
+	return SIZET2NUM(total_size);
+}
+
+static VALUE
+writev_iovector_ensure(VALUE arg) {
+	WritevIOVectorData *data = (WritevIOVectorData *) arg;
+	iovector_reset(data->vec);
+	return Qnil;
+}
+
+/**
+ * Writes all strings in the given IOVector to the given file descriptor, like
+ * #writev does, and clears the vector. The vector is also cleared if writing
+ * fails. Returns the number of bytes written.
+ *
+ * Unlike #writev, the iovec array is built while the strings are appended to
+ * the vector, and its memory is reused when the vector is reused. This
+ * makes it cheaper to write many small chunks.
+ *
+ *   vec = IOVector.new
+ *   vec << "hello " << "world" << "\n"
+ *   writev_iovector(@socket.fileno, vec)
+ */
+static VALUE
+f_writev_iovector(VALUE self, VALUE fd, VALUE iovector) {
+	WritevIOVectorData data;
+
+	if (!rb_obj_is_kind_of(iovector, cIOVector)) {
+		rb_raise(rb_eTypeError, "Expected an IOVector");
+	}
+	data.fd = NUM2INT(fd);
+	Data_Get_Struct(iovector, IOVector, data.vec);
+	if (data.vec->start == data.vec->count) {
+		iovector_reset(data.vec);
+		return INT2NUM(0);
+	}
+	return rb_ensure(writev_iovector_body, (VALUE) &data,
+		writev_iovector_ensure, (VALUE) &data);
+}
+
+/**
+ * Performs a single writev() call with the strings in the given IOVector
+ * that haven't been written yet, without waiting for the file descriptor
+ * to become writable, and without releasing the global interpreter lock.
+ * The written data is removed from the vector. Returns the number of bytes
+ * written, or :wait_writable if the file descriptor isn't writable.
+ *
+ * The file descriptor must be in non-blocking mode. This allows writing
+ * from a fiber that runs under a fiber scheduler, which waits by calling
+ * IO#wait_writable:
+ *
+ *   while !vec.empty?
+ *     if writev_iovector_nonblock(io.fileno, vec) == :wait_writable
+ *       io.wait_writable
+ *     end
+ *   end
+ */
+static VALUE
+f_writev_iovector_nonblock(VALUE self, VALUE fd, VALUE iovector) {
+	IOVector *vec;
+	unsigned int count;
+	ssize_t ret;
+	size_t remaining;
+	struct iovec *current;
+
+	if (!rb_obj_is_kind_of(iovector, cIOVector)) {
+		rb_raise(rb_eTypeError, "Expected an IOVector");
+	}
+	Data_Get_Struct(iovector, IOVector, vec);
+	count = MIN(vec->count - vec->start, (unsigned int) IOV_MAX);
+	if (count == 0) {
+		iovector_reset(vec);
+		return INT2NUM(0);
+	}
+
+	ret = writev(NUM2INT(fd), vec->io_vectors + vec->start, count);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return ID2SYM(rb_intern("wait_writable"));
+		} else if (errno == EINTR) {
+			return INT2NUM(0);
+		} else {
+			rb_sys_fail("writev()");
+		}
+	}
+
+	/* Remove the written data from the vector. */
+	remaining = (size_t) ret;
+	vec->total_size -= remaining;
+	while (remaining > 0) {
+		current = &vec->io_vectors[vec->start];
+		if (current->iov_len <= remaining) {
+			remaining -= current->iov_len;
+			vec->start++;
+		} else {
+			current->iov_base = ((char *) current->iov_base) + remaining;
+			current->iov_len -= remaining;
+			remaining = 0;
+		}
+	}
+	if (vec->start == vec->count) {
+		iovector_reset(vec);
+	}
+	return SSIZET2NUM(ret);
+}
+
+typedef struct {
+	VALUE output;
+	VALUE content_length;
+	int has_transfer_encoding;
+} ResponseHeaderState;
+
+static int
+str_equals_ignore_case(VALUE str, const char *expected, size_t expected_len) {
+	return (size_t) RSTRING_LEN(str) == expected_len
+		&& strncasecmp(RSTRING_PTR(str), expected, expected_len) == 0;
+}
+
+static int
+generate_response_header_line(VALUE key, VALUE value, VALUE arg) {
+	ResponseHeaderState *state = (ResponseHeaderState *) arg;
+	const char *data, *end, *line_end;
+
+	if (TYPE(key) != T_STRING) {
+		key = rb_obj_as_string(key);
+	}
+	if (TYPE(value) != T_STRING) {
+		if (RSTRING_LEN(key) == sizeof("rack.hijack") - 1
+		 && memcmp(RSTRING_PTR(key), "rack.hijack", sizeof("rack.hijack") - 1) == 0)
+		{
+			return ST_CONTINUE;
+		}
+		value = rb_obj_as_string(value);
+	}
+
+	if (str_equals_ignore_case(key, "content-length", sizeof("content-length") - 1)) {
+		if (NIL_P(state->content_length)) {
+			state->content_length = value;
+		}
+	} else if (str_equals_ignore_case(key, "transfer-encoding", sizeof("transfer-encoding") - 1)) {
+		state->has_transfer_encoding = 1;
+	}
+
+	/* Multiple values are separated by newlines. Like String#split,
+	 * ignore trailing empty values.
+	 */
+	data = RSTRING_PTR(value);
+	end  = data + RSTRING_LEN(value);
+	while (end > data && end[-1] == '\n') {
+		end--;
+	}
+	while (data < end) {
+		line_end = memchr(data, '\n', end - data);
+		if (line_end == NULL) {
+			line_end = end;
+		}
+		rb_str_buf_cat(state->output, RSTRING_PTR(key), RSTRING_LEN(key));
+		rb_str_buf_cat(state->output, ": ", 2);
+		rb_str_buf_cat(state->output, data, line_end - data);
+		rb_str_buf_cat(state->output, "\r\n", 2);
+		data = line_end + 1;
+	}
+	return ST_CONTINUE;
+}
+
+/**
+ * call-seq: generate_rack_response_header(status, headers)
+ *
+ * Serializes a Rack response status and headers Hash into an HTTP response
+ * header (without the terminating empty line), in a single String. Header
+ * values containing newlines are output as multiple header lines. The
+ * "rack.hijack" entry is skipped unless its value is a String.
+ *
+ * Returns a 3-element array: an array containing the serialized header
+ * (to which more header data may be appended before passing it to #writev),
+ * the value of the Content-Length header or nil, and whether there is a
+ * Transfer-Encoding header. Header names are matched case-insensitively.
+ */
+static VALUE
+generate_rack_response_header(VALUE self, VALUE status, VALUE headers) {
+	ResponseHeaderState state;
+	VALUE status_str;
+
+	Check_Type(headers, T_HASH);
+	status_str = rb_obj_as_string(status);
+	state.output = rb_str_buf_new(1024);
+	state.content_length = Qnil;
+	state.has_transfer_encoding = 0;
+
+	rb_str_buf_cat(state.output, "HTTP/1.1 ", sizeof("HTTP/1.1 ") - 1);
+	rb_str_buf_cat(state.output, RSTRING_PTR(status_str), RSTRING_LEN(status_str));
+	rb_str_buf_cat(state.output, " Whatever\r\n", sizeof(" Whatever\r\n") - 1);
+	rb_hash_foreach(headers, generate_response_header_line, (VALUE) &state);
+
+	return rb_ary_new3(3,
+		rb_ary_new3(1, state.output),
+		state.content_length,
+		state.has_transfer_encoding ? Qtrue : Qfalse);
+}
+
 static VALUE
 process_times(VALUE self) {
 	struct rusage usage;
@@ -977,13 +1417,29 @@ Init_passenger_native_support() {
 
 	rb_define_singleton_method(mNativeSupport, "disable_stdio_buffering", disable_stdio_buffering, 0);
 	rb_define_singleton_method(mNativeSupport, "split_by_null_into_hash", split_by_null_into_hash, 1);
+	rb_define_singleton_method(mNativeSupport, "split_by_null_into_env", split_by_null_into_env, 2);
 	rb_define_singleton_method(mNativeSupport, "writev", f_writev, 2);
 	rb_define_singleton_method(mNativeSupport, "writev2", f_writev2, 3);
 	rb_define_singleton_method(mNativeSupport, "writev3", f_writev3, 4);
+	rb_define_singleton_method(mNativeSupport, "writev_iovector", f_writev_iovector, 2);
+	rb_define_singleton_method(mNativeSupport, "writev_iovector_nonblock", f_writev_iovector_nonblock, 2);
+	rb_define_singleton_method(mNativeSupport, "generate_rack_response_header", generate_rack_response_header, 2);
 	rb_define_singleton_method(mNativeSupport, "process_times", process_times, 0);
 	rb_define_singleton_method(mNativeSupport, "detach_process", detach_process, 1);
 	rb_define_singleton_method(mNativeSupport, "freeze_process", freeze_process, 0);
 
+	/*
+	 * A reusable list of strings to write with #writev_iovector or
+	 * #writev_iovector_nonblock. Not thread-safe.
+	 */
+	cIOVector = rb_define_class_under(mNativeSupport, "IOVector", rb_cObject);
+	rb_define_alloc_func(cIOVector, iovector_alloc);
+	rb_define_method(cIOVector, "<<", iovector_push, 1);
+	rb_define_method(cIOVector, "clear", iovector_clear, 0);
+	rb_define_method(cIOVector, "size", iovector_size, 0);
+	rb_define_method(cIOVector, "bytesize", iovector_bytesize, 0);
+	rb_define_method(cIOVector, "empty?", iovector_empty_p, 0);
+
 	#ifdef HAVE_KQUEUE
 		cFileSystemWatcher = rb_define_class_under(mNativeSupport,
 			"FileSystemWatcher", rb_cObject);
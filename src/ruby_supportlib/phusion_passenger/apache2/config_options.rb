@@ -90,6 +90,83 @@
     :header  => "PASSENGER_MIN_PROCESSES",
     :desc => "The minimum number of application instances to keep when cleaning idle instances."
   },
+  {
+    :name => "PassengerSpawnConcurrency",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 1,
+    :desc => "The maximum number of application instances that may be spawned at the same time."
+  },
+  {
+    :name => "PassengerTargetUtilization",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The percentage of time that application instances should be busy. Instances are spawned ahead of demand to maintain it."
+  },
+  {
+    :name => "PassengerPreloaderStandbyProcesses",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The number of application instances that the preloader keeps forked ahead of time, so that spawning only needs to activate one of them. While nonzero, the preloader is never shut down for being idle."
+  },
+  {
+    :name => "PassengerRecycleJitter",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "Lowers the max requests and memory limits of each application instance by a random percentage up to this value, so that instances are not recycled at the same time."
+  },
+  {
+    :name => "PassengerCapacityWeight",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 1,
+    :desc => "The weight of this application when the capacity of a full pool is shared between applications."
+  },
+  {
+    :name => "PassengerMaxOutOfBandWorkPercentage",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The percentage of application instances that may be performing out-of-band work at the same time."
+  },
+  {
+    :name => "PassengerOutOfBandWorkMaxUtilization",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "Out-of-band work is deferred while the utilization of application instances, as a percentage, is above this value."
+  },
+  {
+    :name => "PassengerOutOfBandWorkIdleInterval",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The minimum number of seconds between out-of-band work that Passenger gives idle application instances while the load is low, without them requesting it. 0 disables this."
+  },
+  {
+    :name => "PassengerMemoryLimit",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The maximum amount of memory in MB that an application instance may use."
+  },
+  {
+    :name => "PassengerWarmupTime",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 0,
+    :desc => "The number of seconds during which a newly spawned application instance receives a ramped share of the traffic."
+  },
+  {
+    :name => "PassengerRollingRestartBatchSize",
+    :type => :integer,
+    :context => ["OR_LIMIT", "ACCESS_CONF", "RSRC_CONF"],
+    :min_value => 1,
+    :desc => "The maximum number of application instances that are replaced at the same time during a rolling restart."
+  },
   {
     :name => "PassengerMaxInstancesPerApp",
     :type => :integer,
@@ -151,6 +228,34 @@
     :context   => ["OR_ALL"],
     :desc      => "The maximum number of queued requests."
   },
+  {
+    :name      => "PassengerRequestQueueTargetDelay",
+    :type      => :integer,
+    :min_value => 0,
+    :context   => ["OR_ALL"],
+    :desc      => "The target time that requests may wait in the request queue. When exceeded for too long, requests that waited longer are rejected."
+  },
+  {
+    :name      => "PassengerRateLimit",
+    :type      => :integer,
+    :min_value => 0,
+    :context   => ["OR_ALL"],
+    :desc      => "The number of requests per second, per rate limit key, above which requests are answered with 429 Too Many Requests. 0 disables this."
+  },
+  {
+    :name      => "PassengerRateLimitBurst",
+    :type      => :integer,
+    :min_value => 0,
+    :context   => ["OR_ALL"],
+    :desc      => "The number of requests per rate limit key that may arrive at once before PassengerRateLimit applies. 0 means the same as PassengerRateLimit."
+  },
+  {
+    :name      => "PassengerMaxRequestsInFlight",
+    :type      => :integer,
+    :min_value => 0,
+    :context   => ["OR_ALL"],
+    :desc      => "The number of requests per rate limit key that may be in flight at once. Requests beyond it are answered with 429 Too Many Requests. 0 disables this."
+  },
   {
     :name      => "PassengerMaxPreloaderIdleTime",
     :type      => :integer,
@@ -163,6 +268,21 @@
     :type => :flag,
     :desc => "Whether to load environment variables from the shell before running the application."
   },
+  {
+    :name => "PassengerPreloaderCompactHeap",
+    :type => :flag,
+    :desc => "Whether the preloader should compact its heap before forking application instances, so that more memory stays shared with them."
+  },
+  {
+    :name => "PassengerPreloaderWarmupScript",
+    :type => :string,
+    :desc => "A script that the preloader should load before forking application instances, e.g. to eager load code or to prime caches."
+  },
+  {
+    :name => "PassengerRollingRestarts",
+    :type => :flag,
+    :desc => "Whether to turn on rolling restarts"
+  },
   {
     :name    => "PassengerBufferUpload",
     :type    => :flag,
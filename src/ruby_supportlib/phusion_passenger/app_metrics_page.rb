@@ -0,0 +1,133 @@
+# encoding: binary
+#  Phusion Passenger - https://www.phusionpassenger.com/
+#  Copyright (c) 2016 Phusion Holding B.V.
+#
+#  "Passenger", "Phusion Passenger" and "Union Station" are registered
+#  trademarks of Phusion Holding B.V.
+#
+#  Permission is hereby granted, free of charge, to any person obtaining a copy
+#  of this software and associated documentation files (the "Software"), to deal
+#  in the Software without restriction, including without limitation the rights
+#  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+#  copies of the Software, and to permit persons to whom the Software is
+#  furnished to do so, subject to the following conditions:
+#
+#  The above copyright notice and this permission notice shall be included in
+#  all copies or substantial portions of the Software.
+#
+#  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+#  THE SOFTWARE.
+
+PhusionPassenger.require_passenger_lib 'ruby_core_io_enhancements'
+
+module PhusionPassenger
+
+  # Publishes metrics about this process, such as its garbage collection
+  # activity, through the file that the Passenger core passed to us in the
+  # "metrics_file" spawn option. The core has mapped that file into memory
+  # and reads it without communicating with us. This is the Ruby
+  # implementation of the writing side of src/agent/Core/SpawningKit/AppMetricsPage.h;
+  # see that file for the layout.
+  #
+  # Ruby code can't run during garbage collection, so the "garbage
+  # collection in progress" flag is never set.
+  class AppMetricsPage
+    HEADER = ["PSGM", 1].pack("a4L")         # :nodoc:
+    SEQUENCE_OFFSET = 8                      # :nodoc:
+    FIELDS_FORMAT = "QQQQQLLL"               # :nodoc:
+    GC_STAT_SUPPORTS_TIME = GC.respond_to?(:stat) && GC.stat.has_key?(:time)     # :nodoc:
+    GC_STAT_SUPPORTS_HEAP = GC.respond_to?(:stat) && GC.stat.has_key?(:heap_live_slots)  # :nodoc:
+    if defined?(GC::INTERNAL_CONSTANTS)
+      SLOT_SIZE = GC::INTERNAL_CONSTANTS[:RVALUE_SIZE] ||
+        GC::INTERNAL_CONSTANTS[:BASE_SLOT_SIZE] || 40  # :nodoc:
+    else
+      SLOT_SIZE = 40                         # :nodoc:
+    end
+
+    # Opens the file at the given path. Returns nil if that's not possible,
+    # in which case the process just doesn't publish metrics.
+    def self.open(path, threads_total)
+      file = File.open(path, File::WRONLY)
+      file.binmode
+      file.close_on_exec!
+      new(file, threads_total)
+    rescue SystemCallError
+      nil
+    end
+
+    def initialize(file, threads_total)
+      @file = file
+      @mutex = Mutex.new
+      @sequence = 0
+      @threads_busy = 0
+      @threads_total = threads_total
+      update
+      @mutex.synchronize do
+        @file.sysseek(0)
+        @file.syswrite(HEADER)
+      end
+    end
+
+    def request_began
+      @mutex.synchronize do
+        @threads_busy += 1
+        write_fields
+      end
+    end
+
+    def request_finished
+      @mutex.synchronize do
+        @threads_busy -= 1 if @threads_busy > 0
+        write_fields
+      end
+    end
+
+    def update
+      @mutex.synchronize do
+        write_fields
+      end
+    end
+
+    def close
+      @file.close rescue nil
+    end
+
+  private
+    def write_fields
+      if GC_STAT_SUPPORTS_TIME || GC_STAT_SUPPORTS_HEAP
+        stat = GC.stat
+      end
+      # In msec.
+      gc_time = GC_STAT_SUPPORTS_TIME ? stat[:time] : 0
+      heap_size = GC_STAT_SUPPORTS_HEAP ? stat[:heap_live_slots] * SLOT_SIZE : 0
+      now = Time.now
+      fields = [
+        @sequence + 1,
+        now.to_i * 1_000_000 + now.usec,
+        GC.count,
+        gc_time * 1000,
+        heap_size,
+        @threads_busy,
+        @threads_total,
+        0
+      ]
+
+      # Odd sequence numbers tell the core that the fields are being
+      # changed, so that it doesn't read a half-written update.
+      @file.sysseek(SEQUENCE_OFFSET)
+      @file.syswrite(fields.pack(FIELDS_FORMAT))
+      @sequence += 2
+      @file.sysseek(SEQUENCE_OFFSET)
+      @file.syswrite([@sequence].pack("Q"))
+    rescue SystemCallError, IOError
+      # The core is gone or the file is unusable. There is nobody
+      # to report this to.
+    end
+  end
+
+end # module PhusionPassenger
@@ -298,15 +298,26 @@ def locate_source_file(path)
     :source   => 'Crypto.cpp',
     :category => :other,
     :cflags   => PhusionPassenger::PlatformInfo.crypto_extra_cflags
+  define_component 'RandomGenerator.o',
+    :source   => 'RandomGenerator.cpp',
+    :category => :other,
+    :optimize => true
   define_component 'Utils/CachedFileStat.o',
     :source   => 'Utils/CachedFileStat.cpp',
     :category => :other
+  define_component 'Utils/StaticAssetManifest.o',
+    :source   => 'Utils/StaticAssetManifest.cpp',
+    :category => :other
   define_component 'Utils/LargeFiles.o',
     :source   => 'Utils/LargeFiles.cpp',
     :category => :other
   define_component 'WatchdogLauncher.o',
     :source   => 'WatchdogLauncher.cpp',
     :category => :other
+  define_component 'MemoryKit/hugepage.o',
+    :source   => 'MemoryKit/hugepage.cpp',
+    :category => :other,
+    :optimize => true
   define_component 'MemoryKit/mbuf.o',
     :source   => 'MemoryKit/mbuf.cpp',
     :category => :other,
@@ -356,4 +367,5 @@ def locate_source_file(path)
 # A subset of the objects are linked to the Nginx binary. This defines
 # what those objects are.
 NGINX_LIBS_SELECTOR = [:base, 'WatchdogLauncher.o', 'AppTypes.o',
-  'Utils/CachedFileStat.o', 'UnionStationFilterSupport.o']
+  'Utils/CachedFileStat.o', 'Utils/StaticAssetManifest.o', 'jsoncpp.o',
+  'UnionStationFilterSupport.o']
@@ -58,16 +58,42 @@ module SharedConstants
     # Apache's unixd.h also defines DEFAULT_USER, so we avoid naming clash here.
     PASSENGER_DEFAULT_USER = "nobody"
     DEFAULT_CONCURRENCY_MODEL = "process"
+    # Number of client and request objects that each Core thread preallocates
+    # at startup, so that the first burst of traffic doesn't have to.
+    DEFAULT_CORE_SPARE_CLIENTS = 128
     DEFAULT_STICKY_SESSIONS_COOKIE_NAME = "_passenger_route"
+    DEFAULT_ROUTING_POLICY = "least-busy"
     DEFAULT_APP_THREAD_COUNT = 1
     DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK = 1024 * 1024 * 128
+    # With request body buffering, a session is checked out once this many
+    # bytes have been buffered, and the rest of the body is streamed to the
+    # app, unless the client uploaded them slower than the given rate
+    # (bytes per second).
+    DEFAULT_REQUEST_BODY_PREBUFFER_SIZE = 1024 * 64
+    DEFAULT_REQUEST_BODY_SLOW_RATE = 1024 * 256
+    # Clients that don't send a request's headers within this many
+    # seconds are disconnected.
+    DEFAULT_CLIENT_HEADER_TIMEOUT = 60
+    # Responses up to this size are always buffered completely. Beyond it,
+    # the response buffer high watermark follows the client's drain rate.
+    DEFAULT_RESPONSE_BUFFER_FULL_BUFFERING_SIZE = 1024 * 1024 * 8
+    # Per Core thread.
+    DEFAULT_TURBOCACHE_ENTRIES = 8
+    DEFAULT_TURBOCACHE_MAX_BODY_SIZE = 1024 * 32
     DEFAULT_MAX_REQUEST_QUEUE_SIZE = 100
     DEFAULT_STAT_THROTTLE_RATE = 10
+    DEFAULT_TLS_SESSION_CACHE_SIZE = 1024 * 20
+    DEFAULT_TLS_SESSION_TIMEOUT = 300
+    # Number of records in the request trace file (64 bytes each).
+    DEFAULT_REQUEST_TRACE_ENTRIES = 1024 * 64
     DEFAULT_ANALYTICS_LOG_USER = DEFAULT_WEB_APP_USER
     DEFAULT_ANALYTICS_LOG_GROUP = ""
     DEFAULT_ANALYTICS_LOG_PERMISSIONS = "u=rwx,g=rx,o=rx"
     DEFAULT_UNION_STATION_GATEWAY_ADDRESS = "gateway.unionstationapp.com"
     DEFAULT_UNION_STATION_GATEWAY_PORT = 443
+    DEFAULT_UNION_STATION_SLOW_REQUEST_THRESHOLD = 2000
+    DEFAULT_UNION_STATION_SPILL_LIMIT = 64
+    DEFAULT_UNION_STATION_UPLOAD_WORKERS = 4
     DEFAULT_HTTP_SERVER_LISTEN_ADDRESS = "tcp://127.0.0.1:3000"
     DEFAULT_UST_ROUTER_LISTEN_ADDRESS = "tcp://127.0.0.1:9344"
     DEFAULT_LVE_MIN_UID = 500
@@ -80,6 +106,11 @@ module SharedConstants
     # also introduce context switching and smaller transfer writes. The size is picked 
     # to balance this out.
     DEFAULT_MBUF_CHUNK_SIZE = 1024 * 4
+    # How often, in seconds, free mbufs that weren't needed recently are released.
+    DEFAULT_MBUF_POOL_TRIM_INTERVAL = 60
+    # How many bytes of Union Station log messages the Core buffers per UstRouter
+    # connection before it drops them, rather than making the event loop wait.
+    DEFAULT_UST_ROUTER_LOG_BUFFER_SIZE = 64 * 1024
     # Affects input and output buffering (between app and client). Threshold is picked
     # such that it fits most output (i.e. html page size, not assets), and allows for
     # high concurrency with low mem overhead. On the upload side there is a penalty 
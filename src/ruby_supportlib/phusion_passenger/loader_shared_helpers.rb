@@ -350,10 +350,26 @@ def advertise_readiness
       puts "!> Ready"
     end
 
+    # Warms up the given request handler before the process advertises
+    # readiness, so that the Passenger core only routes requests to this
+    # process once it is able to handle them immediately. Returns the time
+    # spent, in microseconds.
+    def warm_up_request_handler(request_handler)
+      start_time = Time.now
+      request_handler.prestart_threads
+      ((Time.now - start_time) * 1_000_000).to_i
+    end
+
+    def advertise_warmup_duration(output, duration)
+      output.puts "!> warmup_duration: #{duration}"
+    end
+
     def advertise_sockets(output, request_handler)
       request_handler.server_sockets.each_pair do |name, options|
         concurrency = PhusionPassenger.advertised_concurrency_level || options[:concurrency]
-        output.puts "!> socket: #{name};#{options[:address]};#{options[:protocol]};#{concurrency}"
+        line = "!> socket: #{name};#{options[:address]};#{options[:protocol]};#{concurrency}"
+        line << ";body_fd" if options[:request_body_fd]
+        output.puts line
       end
     end
 
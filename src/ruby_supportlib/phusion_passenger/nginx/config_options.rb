@@ -153,6 +153,50 @@
     :type   => :integer,
     :header => 'PASSENGER_MIN_PROCESSES'
   },
+  {
+    :name   => 'passenger_spawn_concurrency',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_target_utilization',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_preloader_standby_processes',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_recycle_jitter',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_capacity_weight',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_max_out_of_band_work_percentage',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_out_of_band_work_max_utilization',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_out_of_band_work_idle_interval',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_memory_limit',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_warmup_time',
+    :type   => :integer
+  },
+  {
+    :name   => 'passenger_rolling_restart_batch_size',
+    :type   => :integer
+  },
   {
     :name     => 'passenger_max_instances_per_app',
     :context  => [:main],
@@ -297,6 +341,18 @@
     :name  => 'passenger_load_shell_envvars',
     :type  => :flag
   },
+  {
+    :name  => 'passenger_preloader_compact_heap',
+    :type  => :flag
+  },
+  {
+    :name  => 'passenger_preloader_warmup_script',
+    :type  => :string
+  },
+  {
+    :name  => 'passenger_rolling_restarts',
+    :type  => :flag
+  },
   {
     :name  => 'union_station_key',
     :type  => :string
@@ -305,6 +361,22 @@
     :name  => 'passenger_max_request_queue_size',
     :type  => :integer
   },
+  {
+    :name  => 'passenger_request_queue_target_delay',
+    :type  => :integer
+  },
+  {
+    :name  => 'passenger_rate_limit',
+    :type  => :integer
+  },
+  {
+    :name  => 'passenger_rate_limit_burst',
+    :type  => :integer
+  },
+  {
+    :name  => 'passenger_max_requests_in_flight',
+    :type  => :integer
+  },
   {
     :name  => 'passenger_request_queue_overflow_status_code',
     :type  => :integer
@@ -364,12 +436,6 @@
     :function => 'passenger_enterprise_only',
     :field    => nil
   },
-  {
-    :name     => 'passenger_memory_limit',
-    :type     => :integer,
-    :function => 'passenger_enterprise_only',
-    :field    => nil
-  },
   {
     :name     => 'passenger_concurrency_model',
     :type     => :string,
@@ -382,12 +448,6 @@
     :function => 'passenger_enterprise_only',
     :field    => nil
   },
-  {
-    :name     => 'passenger_rolling_restarts',
-    :type     => :flag,
-    :function => 'passenger_enterprise_only',
-    :field    => nil
-  },
   {
     :name     => 'passenger_resist_deployment_errors',
     :type     => :flag,
@@ -505,6 +505,15 @@ def self.has_accept4?
     end
     memoize :has_accept4?, true
 
+    # Whether the SystemTap/DTrace user space static probe macros are available.
+    def self.has_sys_sdt_h?
+      return try_compile("Checking for sys/sdt.h", :c, %Q{
+        #include <sys/sdt.h>
+        void foo(void) { DTRACE_PROBE1(passenger, foo, 1); }
+      })
+    end
+    memoize :has_sys_sdt_h?, true
+
     # C compiler flags that should be passed in order to enable debugging information.
     def self.debugging_cflags
       # According to OpenBSD's pthreads man page, pthreads do not work
@@ -37,6 +37,17 @@ def self.crypto_libs
     end
     memoize :crypto_libs
 
+    # ServerKit's TLS support is only compiled in on non-macOS platforms,
+    # where it is backed by OpenSSL's libssl.
+    def self.ssl_libs
+      if os_name_simple == "macosx"
+        return ''
+      else
+        return ' -lssl'
+      end
+    end
+    memoize :ssl_libs
+
     def self.crypto_extra_cflags
       if os_name_simple == "macosx"
         return ' -Wno-deprecated-declarations'
@@ -147,6 +147,7 @@ def self.default_extra_c_or_cxxflags(cc_or_cxx)
       flags << debugging_cflags
       flags << '-DHAS_ALLOCA_H' if has_alloca_h?
       flags << '-DHAVE_ACCEPT4' if has_accept4?
+      flags << '-DHAS_SYS_SDT_H' if has_sys_sdt_h?
       flags << '-DHAS_SFENCE' if supports_sfence_instruction?
       flags << '-DHAS_LFENCE' if supports_lfence_instruction?
       flags << "-DPASSENGER_DEBUG -DBOOST_DISABLE_ASSERTS"
@@ -48,7 +48,17 @@ def init(options)
       return options
     end
 
-    def accept_and_process_next_client(server_socket)
+    # Loads the script configured with the `preloader_warmup_script` option,
+    # if any. This is done once, before forking any processes, so that the
+    # work that it does (e.g. eager loading constants or priming caches) is
+    # shared with all processes forked from this preloader.
+    def run_warmup_script(options)
+      script = options["preloader_warmup_script"]
+      return if script.nil? || script.empty?
+      load(File.expand_path(script, options["app_root"]))
+    end
+
+    def accept_and_process_next_client(server_socket, options = {})
       original_pid = Process.pid
       client = server_socket.accept
       client.binmode
@@ -65,7 +75,12 @@ def accept_and_process_next_client(server_socket)
         end
 
         # Improve copy-on-write friendliness.
-        GC.start
+        if LoaderSharedHelpers.to_boolean(options["preloader_compact_heap"]) &&
+           GC.respond_to?(:compact)
+          GC.compact
+        else
+          GC.start
+        end
 
         pid = fork
         if pid.nil?
@@ -137,7 +152,7 @@ def run_main_loop(options)
         # https://code.google.com/p/phusion-passenger/issues/detail?id=915
         ios = Kernel.select([server, STDIN])[0]
         if ios.include?(server)
-          result, client = accept_and_process_next_client(server)
+          result, client = accept_and_process_next_client(server, options)
           if result == :forked
             STDIN.reopen(client)
             STDOUT.reopen(client)
@@ -33,6 +33,14 @@ class OutOfBandGc
       #
       #   OutOfBandGc.new(app, frequency, logger = nil)
       #   OutOfBandGc.new(app, options = {})
+      #
+      # Strategies:
+      #
+      #  * :counting - Requests out-of-band GC every :frequency requests.
+      #  * :gctools_oobgc - Requests out-of-band GC when GC::OOB wants to.
+      #  * :idle_windows - Never requests out-of-band GC, but runs GC in the
+      #    idle windows that Passenger gives this process while the load is
+      #    low. Requires the out_of_band_work_idle_interval option to be set.
       def initialize(app, *args)
         @app = app
         if args.size == 0 || (args.size == 1 && args[0].is_a?(Hash))
@@ -62,6 +70,9 @@ def call(env)
             headers['!~Request-OOB-Work'] = 'true'
           end
 
+        when :idle_windows
+          # The Passenger core decides when to perform out-of-band work.
+
         else
           raise "Unrecognized Out-Of-Band GC strategy #{@strategy.inspect}"
         end
@@ -82,13 +93,10 @@ def initialize_with_options(options)
           if !@frequency || @frequency < 1
             raise ArgumentError, "The :frequency option must be a number that is at least 1."
           end
-          ::PhusionPassenger.on_event(:oob_work) do
-            t0 = Time.now
-            disabled = GC.enable
-            GC.start
-            GC.disable if disabled
-            @logger.info "Out Of Band GC finished in #{Time.now - t0} sec" if @logger
-          end
+          install_gc_start_handler
+
+        when :idle_windows
+          install_gc_start_handler
 
         when :gctools_oobgc
           if !defined?(::GC::OOB)
@@ -121,6 +129,16 @@ def initialize_with_options(options)
         end
       end
 
+      def install_gc_start_handler
+        ::PhusionPassenger.on_event(:oob_work) do
+          t0 = Time.now
+          disabled = GC.enable
+          GC.start
+          GC.disable if disabled
+          @logger.info "Out Of Band GC finished in #{Time.now - t0} sec" if @logger
+        end
+      end
+
       def initialize_legacy(frequency, logger = nil)
         initialize_with_options(
           :strategy => :counting,
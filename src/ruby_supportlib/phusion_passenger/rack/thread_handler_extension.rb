@@ -24,6 +24,7 @@
 #  THE SOFTWARE.
 
 PhusionPassenger.require_passenger_lib 'utils/tee_input'
+PhusionPassenger.require_passenger_lib 'utils/native_support_utils'
 
 module PhusionPassenger
   module Rack
@@ -45,9 +46,7 @@ module ThreadHandlerExtension
       SCRIPT_NAME        = "SCRIPT_NAME"         # :nodoc:
       REQUEST_METHOD = "REQUEST_METHOD"          # :nodoc:
       TRANSFER_ENCODING_HEADER  = "Transfer-Encoding"   # :nodoc:
-      TRANSFER_ENCODING_HEADERS = ["Transfer-Encoding", "Transfer-encoding", "transfer-encoding"] # :nodoc:
       CONTENT_LENGTH_HEADER     = "Content-Length"      # :nodoc:
-      CONTENT_LENGTH_HEADERS    = ["Content-Length", "Content-length", "content-length"] # :nodoc:
       X_SENDFILE_HEADER         = "X-Sendfile"          # :nodoc:
       X_ACCEL_REDIRECT_HEADER   = "X-Accel-Redirect"    # :nodoc:
       CONTENT_LENGTH_HEADER_AND_SEPARATOR      = "Content-Length: " # :nodoc
@@ -61,26 +60,40 @@ module ThreadHandlerExtension
       ON             = "on"     # :nodoc:
       ONE            = "1"      # :nodoc:
       CRLF           = "\r\n"   # :nodoc:
-      NEWLINE        = "\n"     # :nodoc:
       STATUS         = "Status: "         # :nodoc:
-      NAME_VALUE_SEPARATOR = ": "         # :nodoc:
       TERMINATION_CHUNK    = "0\r\n\r\n"  # :nodoc:
 
+      # The env entries that don't change between requests. Session protocol
+      # requests start out with these entries already in place.
+      def base_request_env
+        {
+          RACK_VERSION      => RACK_VERSION_VALUE,
+          RACK_ERRORS       => STDERR,
+          RACK_MULTITHREAD  => @request_handler.concurrency > 1,
+          RACK_MULTIPROCESS => true,
+          RACK_RUN_ONCE     => false,
+          RACK_HIJACK_P     => true
+        }
+      end
+
       def process_request(env, connection, socket_wrapper, full_http_response)
-        rewindable_input = PhusionPassenger::Utils::TeeInput.new(connection, env)
+        rewindable_input = receive_request_body_file(connection, env) ||
+          PhusionPassenger::Utils::TeeInput.new(connection, env)
         begin
-          env[RACK_VERSION]      = RACK_VERSION_VALUE
-          env[RACK_INPUT]        = rewindable_input
-          env[RACK_ERRORS]       = STDERR
-          env[RACK_MULTITHREAD]  = @request_handler.concurrency > 1
-          env[RACK_MULTIPROCESS] = true
-          env[RACK_RUN_ONCE]     = false
+          if !@base_env
+            env[RACK_VERSION]      = RACK_VERSION_VALUE
+            env[RACK_ERRORS]       = STDERR
+            env[RACK_MULTITHREAD]  = @request_handler.concurrency > 1
+            env[RACK_MULTIPROCESS] = true
+            env[RACK_RUN_ONCE]     = false
+            env[RACK_HIJACK_P]     = true
+          end
+          env[RACK_INPUT] = rewindable_input
           if env[HTTPS] == YES || env[HTTPS] == ON || env[HTTPS] == ONE
             env[RACK_URL_SCHEME] = HTTPS_DOWNCASE
           else
             env[RACK_URL_SCHEME] = HTTP
           end
-          env[RACK_HIJACK_P] = true
           env[RACK_HIJACK] = lambda do
             env[RACK_HIJACK_IO] ||= begin
               connection.stop_simulating_eof!
@@ -130,7 +143,8 @@ def process_request(env, connection, socket_wrapper, full_http_response)
             # On any other exception, we don't know what state we're
             # in and we don't know whether we can recover from it.
             begin
-              headers_output = generate_headers_array(status, headers)
+              headers_output = Utils::NativeSupportUtils.
+                generate_rack_response_header(status, headers)[0]
               headers_output << CONNECTION_CLOSE_CRLF2
               connection.writev(headers_output)
               connection.flush
@@ -181,7 +195,8 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
         end
 
         # Generate preliminary headers and determine whether we need to output a body.
-        headers_output = generate_headers_array(status, headers)
+        headers_output, content_length_header, has_transfer_encoding =
+          Utils::NativeSupportUtils.generate_rack_response_header(status, headers)
 
 
         # Determine how big the body is, determine whether we should try to keep-alive
@@ -202,12 +217,12 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
         # time that the body we write out is guaranteed to match what the headers say.
         # Otherwise we disable keep-alive to prevent the app from being able to mess
         # up the keep-alive connection.
-        if header = lookup_header(headers, CONTENT_LENGTH_HEADERS)
+        if content_length_header
           # Easiest case: app has a Content-Length header. The headers
           # need no fixing.
           message_length_type = :content_length
-          content_length = header.to_i
-          if lookup_header(headers, TRANSFER_ENCODING_HEADERS)
+          content_length = content_length_header.to_i
+          if has_transfer_encoding
             # Disallowed by the HTTP spec
             raise "Response object may not contain both Content-Length and Transfer-Encoding"
           end
@@ -227,7 +242,7 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
               end
             end
           end
-        elsif lookup_header(headers, TRANSFER_ENCODING_HEADERS)
+        elsif has_transfer_encoding
           # App has a Transfer-Encoding header. We assume that the app
           # has already chunked the body. The headers need no fixing.
           message_length_type = :chunked_by_app
@@ -237,10 +252,6 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
             # just to be safe.
             @can_keepalive = false
           end
-          if lookup_header(headers, CONTENT_LENGTH_HEADERS)
-            # Disallowed by the HTTP spec
-            raise "Response object may not contain both Content-Length and Transfer-Encoding"
-          end
         elsif status_code_allows_body?(status)
           # This is a response for which a body is allowed, although the request
           # may be one which does not expect a body (HEAD requests).
@@ -295,7 +306,7 @@ def process_body(env, connection, socket_wrapper, status, is_head_request, heade
             body.each do |part|
               size = bytesize(part.to_s)
               if size != 0
-                connection.writev(chunk_data(part.to_s, size))
+                write_chunk(connection, part.to_s, size)
               end
             end
             connection.write(TERMINATION_CHUNK)
@@ -327,38 +338,6 @@ def close_body(body, env, socket_wrapper)
         end
       end
 
-      def generate_headers_array(status, headers)
-        status_str = status.to_s
-        result = ["HTTP/1.1 #{status_str} Whatever\r\n"]
-        headers.each do |key, values|
-          if values.is_a?(String)
-            values = values.split(NEWLINE)
-          elsif key == RACK_HIJACK
-            # We do not check for this key name in every loop
-            # iteration as an optimization.
-            next
-          else
-            values = values.to_s.split(NEWLINE)
-          end
-          values.each do |value|
-            result << key
-            result << NAME_VALUE_SEPARATOR
-            result << value
-            result << CRLF
-          end
-        end
-        return result
-      end
-
-      def lookup_header(haystack, needles)
-        needles.each do |needle|
-          if result = haystack[needle]
-            return result
-          end
-        end
-        nil
-      end
-
       def status_code_allows_body?(status)
         status < 100 || (status >= 200 && status != 204 && status != 304)
       end
@@ -371,6 +350,29 @@ def chunk_data(data, size)
         [size.to_s(16), CRLF, data, CRLF]
       end
 
+      if defined?(PhusionPassenger::NativeSupport::IOVector)
+        # Writes a chunk through an IOVector that is reused between chunks,
+        # so that streaming many small chunks doesn't allocate an array for
+        # each of them.
+        def write_chunk(connection, data, size)
+          if connection.respond_to?(:writev_iovector)
+            iovector = (@chunk_iovector ||= PhusionPassenger::NativeSupport::IOVector.new)
+            iovector << size.to_s(16) << CRLF << data << CRLF
+            begin
+              connection.writev_iovector(iovector)
+            ensure
+              iovector.clear
+            end
+          else
+            connection.writev(chunk_data(data, size))
+          end
+        end
+      else
+        def write_chunk(connection, data, size)
+          connection.writev(chunk_data(data, size))
+        end
+      end
+
       # Called when body is written out successfully. Indicates that we should
       # keep-alive the connection if we can.
       def signal_keep_alive_allowed!
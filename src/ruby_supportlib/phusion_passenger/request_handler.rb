@@ -33,6 +33,7 @@
 PhusionPassenger.require_passenger_lib 'utils'
 PhusionPassenger.require_passenger_lib 'ruby_core_enhancements'
 PhusionPassenger.require_passenger_lib 'ruby_core_io_enhancements'
+PhusionPassenger.require_passenger_lib 'app_metrics_page'
 PhusionPassenger.require_passenger_lib 'request_handler/thread_handler'
 
 module PhusionPassenger
@@ -106,7 +107,10 @@ def initialize(owner_pipe, options = {})
         :address     => @main_socket_address,
         :socket      => @main_socket,
         :protocol    => @force_http_session ? :http_session : :session,
-        :concurrency => @concurrency
+        :concurrency => @concurrency,
+        # Large buffered request bodies can be passed to us as a file
+        # descriptor. See ThreadHandler#receive_request_body_file.
+        :request_body_fd => should_use_unix_sockets? && !@force_http_session
       }
 
       @http_socket_address, @http_socket = create_tcp_socket
@@ -125,7 +129,11 @@ def initialize(owner_pipe, options = {})
       @main_loop_thread_cond = ConditionVariable.new
       @threads = []
       @threads_mutex = Mutex.new
+      @threads_prestarted = false
       @main_loop_running  = false
+      if options["metrics_file"]
+        @app_metrics_page = AppMetricsPage.open(options["metrics_file"], @concurrency)
+      end
 
       #############
     end
@@ -163,6 +171,7 @@ def cleanup
         end
       end
       @owner_pipe.close rescue nil
+      @app_metrics_page.close if @app_metrics_page
     end
 
     # Check whether the main loop's currently running.
@@ -172,6 +181,15 @@ def main_loop_running?
       end
     end
 
+    # Starts the request handling threads ahead of #main_loop, so that a freshly
+    # spawned process has a ready thread pool by the time it reports that it is
+    # ready. The next #main_loop call uses these threads instead of starting
+    # new ones.
+    def prestart_threads
+      start_threads
+      @threads_prestarted = true
+    end
+
     # Enter the request handler's main loop.
     def main_loop
       debug("Entering request handler main loop")
@@ -198,7 +216,11 @@ def main_loop
         end
 
         install_useful_signal_handlers
-        start_threads
+        if @threads_prestarted
+          @threads_prestarted = false
+        else
+          start_threads
+        end
         wait_until_termination_requested
         wait_until_all_threads_are_idle
         terminate_threads
@@ -369,7 +391,8 @@ def start_threads
         :app_group_name   => @app_group_name,
         :connect_password => @connect_password,
         :union_station_core => @union_station_core,
-        :keepalive_enabled  => @keepalive
+        :keepalive_enabled  => @keepalive,
+        :app_metrics_page   => @app_metrics_page
       }
       main_socket_options = common_options.merge(
         :server_socket => @main_socket,
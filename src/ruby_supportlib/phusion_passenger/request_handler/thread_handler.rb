@@ -45,6 +45,7 @@ class Interrupted < StandardError
       PING           = 'PING'.freeze
       OOBW           = 'OOBW'.freeze
       PASSENGER_CONNECT_PASSWORD  = 'PASSENGER_CONNECT_PASSWORD'.freeze
+      PASSENGER_REQUEST_BODY_FD   = 'PASSENGER_REQUEST_BODY_FD'.freeze
       CONTENT_LENGTH = 'CONTENT_LENGTH'.freeze
       TRANSFER_ENCODING = 'TRANSFER_ENCODING'.freeze
 
@@ -71,12 +72,16 @@ def initialize(request_handler, options = {})
           :app,
           :union_station_core,
           :connect_password,
-          :keepalive_enabled
+          :keepalive_enabled,
+          :app_metrics_page
         )
 
         @stats_mutex   = Mutex.new
         @interruptable = false
         @iteration     = 0
+        if respond_to?(:base_request_env, true)
+          @base_env = base_request_env.freeze
+        end
 
         if @protocol == :session
           metaclass = class << self; self; end
@@ -221,7 +226,7 @@ def parse_session_request(connection, channel, buffer)
         if headers_data.nil?
           return
         end
-        headers = Utils::NativeSupportUtils.split_by_null_into_hash(headers_data)
+        headers = Utils::NativeSupportUtils.split_by_null_into_env(headers_data, @base_env)
         if @connect_password && headers[PASSENGER_CONNECT_PASSWORD] != @connect_password
           warn "*** Passenger RequestHandler warning: " <<
             "someone tried to connect with an invalid connect password."
@@ -239,7 +244,7 @@ def parse_session_request(connection, channel, buffer)
       # HTTP parser and is not intended to be complete, fast or secure, since the HTTP server
       # socket is intended to be used for debugging purposes only.
       def parse_http_request(connection, channel, buffer)
-        headers = {}
+        headers = @base_env ? @base_env.dup : {}
 
         data = ""
         while data !~ /\r\n\r\n/ && data.size < MAX_HEADER_SIZE
@@ -300,15 +305,38 @@ def process_ping(env, connection)
         connection.write("pong")
       end
 
+      # The Core sends OOBW requests when this process asked for out-of-band
+      # work, and in idle windows. The response tells it how long the work
+      # took, in microseconds, which it uses for scheduling idle windows.
       def process_oobw(env, connection)
+        start_time = Time.now
         PhusionPassenger.call_event(:oob_work)
-        connection.write("oobw done")
+        duration = ((Time.now - start_time) * 1_000_000).to_i
+        connection.write("oobw done #{duration}")
       end
 
     # def process_request(env, connection, socket_wrapper, full_http_response)
     #   raise NotImplementedError, "Override with your own implementation!"
     # end
 
+    # Optional. Returns a Hash with the environment entries that are the same
+    # for every request. Request environments are created as copies of it.
+    # def base_request_env
+    #   { ... }
+    # end
+
+      # If the Core buffered the request body in a file and passes that file
+      # to us instead of sending the body over the connection, receives it
+      # and returns it as a File positioned at the start of the body.
+      # Returns nil otherwise.
+      def receive_request_body_file(connection, headers)
+        if headers[PASSENGER_REQUEST_BODY_FD]
+          file = connection.to_io.recv_io(File)
+          file.binmode
+          file
+        end
+      end
+
       def prepare_request(connection, headers)
         transfer_encoding = headers[TRANSFER_ENCODING]
         content_length = headers[CONTENT_LENGTH]
@@ -325,6 +353,10 @@ def prepare_request(connection, headers)
           @ush_reporter = UnionStationHooks.begin_rack_request(headers)
         end
 
+        if @app_metrics_page
+          @app_metrics_page.request_began
+        end
+
         #################
       end
 
@@ -338,6 +370,10 @@ def finalize_request(connection, headers, has_error)
           @ush_reporter = nil
         end
 
+        if @app_metrics_page
+          @app_metrics_page.request_finished
+        end
+
         if !has_error && @keepalive_performed && connection
           trace(3, "Keep-aliving connection.")
           @last_connection = connection
@@ -59,6 +59,42 @@ def writev3(components, components2, components3)
       return PhusionPassenger::NativeSupport.writev3(fileno,
         components, components2, components3)
     end
+
+    if defined?(PhusionPassenger::NativeSupport::IOVector)
+      FIBER_SCHEDULER_SUPPORTED = Fiber.respond_to?(:scheduler) &&
+        IO.method_defined?(:nonblock?) && IO.method_defined?(:wait_writable) # :nodoc:
+
+      # Writes all strings in the given PhusionPassenger::NativeSupport::IOVector,
+      # and clears it. Unlike #writev, the vector can be reused so that
+      # writing many small chunks doesn't allocate and walk an array every
+      # time.
+      #
+      # When called from a fiber that runs under a fiber scheduler, and
+      # the IO object is in non-blocking mode, this waits for the IO object
+      # to become writable through the scheduler instead of blocking the
+      # thread.
+      #
+      #   vec = PhusionPassenger::NativeSupport::IOVector.new
+      #   vec << "hello " << "world" << "\n"
+      #   io.writev_iovector(vec)
+      def writev_iovector(iovector)
+        if FIBER_SCHEDULER_SUPPORTED && Fiber.scheduler && nonblock?
+          written = 0
+          while !iovector.empty?
+            result = PhusionPassenger::NativeSupport.writev_iovector_nonblock(
+              fileno, iovector)
+            if result == :wait_writable
+              wait_writable
+            else
+              written += result
+            end
+          end
+          return written
+        else
+          return PhusionPassenger::NativeSupport.writev_iovector(fileno, iovector)
+        end
+      end
+    end
   else
     def writev(components)
       return write(components.pack('a*' * components.size))
@@ -119,20 +119,17 @@ module Standalone
       {
         :name      => :ssl,
         :type      => :boolean,
-        :desc      => "Enable SSL support (Nginx\n" \
-                      'engine only)'
+        :desc      => 'Enable SSL support'
       },
       {
         :name      => :ssl_certificate,
         :type      => :path,
-        :desc      => "Specify the SSL certificate path\n" \
-                      '(Nginx engine only)'
+        :desc      => 'Specify the SSL certificate path'
       },
       {
         :name      => :ssl_certificate_key,
         :type      => :path,
-        :desc      => "Specify the SSL key path (Nginx\n" \
-                      'engine only)'
+        :desc      => 'Specify the SSL key path'
       },
       {
         :name      => :ssl_port,
@@ -283,6 +280,19 @@ module Standalone
         :desc      => "Load shell startup files before loading\n" \
                       'application'
       },
+      {
+        :name      => :preloader_compact_heap,
+        :type      => :boolean,
+        :desc      => "Compact the preloader's heap before\n" \
+                      "forking, so that more memory stays\n" \
+                      'shared with processes'
+      },
+      {
+        :name      => :preloader_warmup_script,
+        :type      => :path,
+        :desc      => "Script that the preloader loads before\n" \
+                      'forking processes'
+      },
       {
         :name      => :app_file_descriptor_ulimit,
         :type      => :integer,
@@ -328,6 +338,81 @@ module Standalone
         :desc      => "Minimum number of processes per\n" \
                       'application. Default: 1'
       },
+      {
+        :name      => :spawn_concurrency,
+        :type      => :integer,
+        :min       => 1,
+        :desc      => "Maximum number of processes per\n" \
+                      "application that may be spawned at the\n" \
+                      'same time. Default: 1'
+      },
+      {
+        :name      => :target_utilization,
+        :type      => :integer,
+        :min       => 0,
+        :desc      => "Spawn processes ahead of demand, based\n" \
+                      "on the request rate, so that processes\n" \
+                      "are busy for this percentage of the\n" \
+                      'time. Default: 0 (disabled)'
+      },
+      {
+        :name      => :preloader_standby_processes,
+        :type      => :integer,
+        :type_desc => 'PERCENT',
+        :min       => 0,
+        :desc      => "Keep this many processes forked ahead\n" \
+                      "of time by the preloader, so that\n" \
+                      "spawning only needs to activate one\n" \
+                      'of them. Default: 0'
+      },
+      {
+        :name      => :recycle_jitter,
+        :type      => :integer,
+        :type_desc => 'PERCENT',
+        :min       => 0,
+        :desc      => "Lower the max requests and memory limits\n" \
+                      "of each process by a random percentage\n" \
+                      "up to this value, so that processes\n" \
+                      "aren't recycled at the same time.\n" \
+                      'Default: 0'
+      },
+      {
+        :name      => :capacity_weight,
+        :type      => :integer,
+        :min       => 1,
+        :desc      => "The weight of this application when the\n" \
+                      "capacity of a full pool is shared\n" \
+                      'between applications. Default: 1'
+      },
+      {
+        :name      => :max_out_of_band_work_percentage,
+        :type      => :integer,
+        :type_desc => 'PERCENT',
+        :min       => 0,
+        :desc      => "Allow this percentage of the processes\n" \
+                      "to perform out-of-band work at the same\n" \
+                      'time. Default: 0 (one process at a time)'
+      },
+      {
+        :name      => :out_of_band_work_max_utilization,
+        :type      => :integer,
+        :type_desc => 'PERCENT',
+        :min       => 0,
+        :desc      => "Defer out-of-band work while the\n" \
+                      "utilization of the processes is above\n" \
+                      "this percentage. Default: 0 (only while\n" \
+                      'requests are queued)'
+      },
+      {
+        :name      => :out_of_band_work_idle_interval,
+        :type      => :integer,
+        :type_desc => 'SECONDS',
+        :min       => 0,
+        :desc      => "Give idle processes out-of-band work\n" \
+                      "at most once per this many seconds\n" \
+                      "while the load is low. Default: 0\n" \
+                      '(only when processes request it)'
+      },
       {
         :name      => :pool_idle_time,
         :type      => :integer,
@@ -368,13 +453,35 @@ module Standalone
         :name      => :memory_limit,
         :type      => :integer,
         :type_desc => 'MB',
-        :desc      => "Restart application processes that go over\n" \
-                      "the given memory limit (Enterprise only)"
+        :min       => 0,
+        :desc      => "Replace application processes that go\n" \
+                      "over the given memory limit. Default: 0\n" \
+                      '(no limit)'
       },
       {
         :name      => :rolling_restarts,
         :type      => :boolean,
-        :desc      => "Enable rolling restarts (Enterprise only)"
+        :desc      => "Restart application processes one batch\n" \
+                      "at a time, so that old processes keep\n" \
+                      "handling requests until their successors\n" \
+                      'are ready'
+      },
+      {
+        :name      => :rolling_restart_batch_size,
+        :type      => :integer,
+        :min       => 1,
+        :desc      => "The maximum number of processes that are\n" \
+                      "replaced at the same time during a\n" \
+                      "rolling restart. Default: 1"
+      },
+      {
+        :name      => :warmup_time,
+        :type      => :integer,
+        :type_desc => 'SECONDS',
+        :min       => 0,
+        :desc      => "Ramp up the traffic to newly spawned\n" \
+                      "processes over this many seconds.\n" \
+                      "Default: 0 (disabled)"
       },
       {
         :name      => :resist_deployment_errors,
@@ -407,6 +514,43 @@ module Standalone
         :min       => 0,
         :desc      => "Specify request queue size. Default: #{DEFAULT_MAX_REQUEST_QUEUE_SIZE}"
       },
+      {
+        :name      => :request_queue_target_delay,
+        :type      => :integer,
+        :type_desc => 'MSEC',
+        :min       => 0,
+        :desc      => "Reject queued requests that waited\n" \
+                      "longer than this, once the queue has\n" \
+                      "been slow for a while.\n" \
+                      'Default: 0 (disabled)'
+      },
+      {
+        :name      => :rate_limit,
+        :type      => :integer,
+        :type_desc => 'NUMBER',
+        :min       => 0,
+        :desc      => "Answer requests with 429 Too Many\n" \
+                      "Requests once more than this many per\n" \
+                      "second arrive. Default: 0 (disabled)"
+      },
+      {
+        :name      => :rate_limit_burst,
+        :type      => :integer,
+        :type_desc => 'NUMBER',
+        :min       => 0,
+        :desc      => "Number of requests that may arrive at\n" \
+                      "once before --rate-limit applies.\n" \
+                      "Default: the rate limit"
+      },
+      {
+        :name      => :max_requests_in_flight,
+        :type      => :integer,
+        :type_desc => 'NUMBER',
+        :min       => 0,
+        :desc      => "Answer requests with 429 Too Many\n" \
+                      "Requests while this many are in flight.\n" \
+                      "Default: 0 (disabled)"
+      },
       {
         :name      => :sticky_sessions,
         :type      => :boolean,
@@ -418,12 +562,37 @@ module Standalone
         :desc      => "Cookie name to use for sticky sessions.\n" \
                       "Default: #{DEFAULT_STICKY_SESSIONS_COOKIE_NAME}"
       },
+      {
+        :name      => :serve_x_sendfile,
+        :type      => :boolean,
+        :desc      => "Serve files named by X-Sendfile response\n" \
+                      'headers directly (Builtin engine only)'
+      },
+      {
+        :name      => :serve_static_files,
+        :type      => :boolean,
+        :desc      => "Serve files in the app's public directory\n" \
+                      'directly (Builtin engine only)'
+      },
+      {
+        :name      => :response_compression,
+        :type      => :boolean,
+        :desc      => "Gzip-compress textual responses for\n" \
+                      'clients that accept it (Builtin engine only)'
+      },
       {
         :name      => :vary_turbocache_by_cookie,
         :type_desc => 'NAME',
         :desc      => "Vary the turbocache by the cookie of the\n" \
                       'given name'
       },
+      {
+        :name      => :request_priority_header,
+        :type_desc => 'NAME',
+        :desc      => "Prioritize requests that wait for a\n" \
+                      "process by the value (0-3) of this\n" \
+                      'header (Builtin engine only)'
+      },
       {
         :name      => :turbocaching,
         :type      => :boolean,
@@ -437,6 +606,48 @@ module Standalone
           options[:turbocaching] = false
         end
       },
+      {
+        :name      => :turbocache_entries,
+        :type      => :integer,
+        :type_desc => 'NUMBER',
+        :desc      => "Number of responses that each thread's\n" \
+                      "turbocache can hold (Builtin engine only).\n" \
+                      "Default: #{DEFAULT_TURBOCACHE_ENTRIES}"
+      },
+      {
+        :name      => :turbocache_max_body_size,
+        :type      => :integer,
+        :type_desc => 'BYTES',
+        :desc      => "Maximum size of a response body that may\n" \
+                      "be turbocached (Builtin engine only).\n" \
+                      "Default: #{DEFAULT_TURBOCACHE_MAX_BODY_SIZE}"
+      },
+      {
+        :name      => :shared_turbocache_size,
+        :type      => :integer,
+        :type_desc => 'BYTES',
+        :desc      => "Back the per-thread turbocaches with a\n" \
+                      "cache of the given size that is shared by\n" \
+                      "all threads (Builtin engine only).\n" \
+                      'Default: 0 (disabled)'
+      },
+      {
+        :name      => :turbocache_coalescing_timeout,
+        :type      => :integer,
+        :type_desc => 'MSEC',
+        :desc      => "Let turbocacheable requests wait up to this\n" \
+                      "long for an identical request that is\n" \
+                      "already being forwarded to the application\n" \
+                      "(Builtin engine only). Default: 0 (disabled)"
+      },
+      {
+        :name      => :turbocache_snapshot,
+        :type      => :path,
+        :type_desc => 'PATH',
+        :desc      => "Save the turbocache to files starting with\n" \
+                      "this path on shutdown, and load it again on\n" \
+                      "startup (Builtin engine only)"
+      },
       {
         :name      => :unlimited_concurrency_paths,
         :type      => :array,
@@ -464,6 +675,40 @@ module Standalone
         :cli_parser => lambda do |options, value|
           options[:abort_websockets_on_process_shutdown] = false
         end
+      },
+      {
+        :name      => :websocket_drain_time,
+        :type      => :integer,
+        :type_desc => 'SECONDS',
+        :desc      => "Spread the disconnection of a restarted\n" \
+                      "process's WebSocket connections randomly\n" \
+                      "over this many seconds (Builtin engine\n" \
+                      "only). Default: 0 (all at once)"
+      },
+      {
+        :name      => :client_header_timeout,
+        :type      => :integer,
+        :type_desc => 'SECONDS',
+        :desc      => "Disconnect clients that don't send a\n" \
+                      "request's headers within this time\n" \
+                      "(Builtin engine only). Default: " \
+                      "#{DEFAULT_CLIENT_HEADER_TIMEOUT}"
+      },
+      {
+        :name      => :client_keepalive_timeout,
+        :type      => :integer,
+        :type_desc => 'SECONDS',
+        :desc      => "Disconnect keep-alive connections that\n" \
+                      "stay idle this long (Builtin engine\n" \
+                      "only). Default: 0 (no limit)"
+      },
+      {
+        :name      => :client_body_min_rate,
+        :type      => :integer,
+        :type_desc => 'BYTES_PER_SEC',
+        :desc      => "Disconnect clients that upload request\n" \
+                      "bodies slower than this (Builtin engine\n" \
+                      "only). Default: 0 (no limit)"
       }
     ]
 
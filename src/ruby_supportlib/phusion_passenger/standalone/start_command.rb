@@ -188,9 +188,6 @@ def sanity_check_options_and_set_defaults
           # We explicitly check that some options are set and warn the user about this,
           # in case they are using the builtin engine. We don't warn about options
           # that begin with --nginx- because that should be obvious.
-          check_nginx_option_used_with_builtin_engine(:ssl, "--ssl")
-          check_nginx_option_used_with_builtin_engine(:ssl_certificate, "--ssl-certificate")
-          check_nginx_option_used_with_builtin_engine(:ssl_certificate_key, "--ssl-certificate-key")
           check_nginx_option_used_with_builtin_engine(:ssl_port, "--ssl-port")
           check_nginx_option_used_with_builtin_engine(:static_files_dir, "--static-files-dir")
         end
@@ -150,23 +150,56 @@ def build_daemon_controller_options
           if @options[:abort_websockets_on_process_shutdown] == false
             command << " --no-abort-websockets-on-process-shutdown"
           end
+          add_param(command, :websocket_drain_time, "--websocket-drain-time")
+          add_param(command, :client_header_timeout, "--client-header-timeout")
+          add_param(command, :client_keepalive_timeout, "--client-keepalive-timeout")
+          add_param(command, :client_body_min_rate, "--client-body-min-rate")
           add_param(command, :force_max_concurrent_requests_per_process, "--force-max-concurrent-requests-per-process")
           add_flag_param(command, :load_shell_envvars, "--load-shell-envvars")
+          add_flag_param(command, :preloader_compact_heap, "--preloader-compact-heap")
+          add_param(command, :preloader_warmup_script, "--preloader-warmup-script")
           add_param(command, :max_pool_size, "--max-pool-size")
           add_param(command, :min_instances, "--min-instances")
+          add_param(command, :spawn_concurrency, "--spawn-concurrency")
+          add_param(command, :target_utilization, "--target-utilization")
+          add_param(command, :preloader_standby_processes, "--preloader-standby-processes")
+          add_param(command, :recycle_jitter, "--recycle-jitter")
+          add_param(command, :capacity_weight, "--capacity-weight")
+          add_param(command, :max_out_of_band_work_percentage, "--max-out-of-band-work-percentage")
+          add_param(command, :out_of_band_work_max_utilization, "--out-of-band-work-max-utilization")
+          add_param(command, :out_of_band_work_idle_interval, "--out-of-band-work-idle-interval")
           add_param(command, :pool_idle_time, "--pool-idle-time")
           add_param(command, :max_preloader_idle_time, "--max-preloader-idle-time")
           add_param(command, :max_request_queue_size, "--max-request-queue-size")
+          add_param(command, :request_queue_target_delay, "--request-queue-target-delay")
+          add_param(command, :rate_limit, "--rate-limit")
+          add_param(command, :rate_limit_burst, "--rate-limit-burst")
+          add_param(command, :max_requests_in_flight, "--max-requests-in-flight")
           add_enterprise_param(command, :concurrency_model, "--concurrency-model")
           add_enterprise_param(command, :thread_count, "--app-thread-count")
           add_param(command, :max_requests, "--max-requests")
           add_enterprise_param(command, :max_request_time, "--max-request-time")
-          add_enterprise_param(command, :memory_limit, "--memory-limit")
-          add_enterprise_flag_param(command, :rolling_restarts, "--rolling-restarts")
+          add_param(command, :memory_limit, "--memory-limit")
+          add_flag_param(command, :rolling_restarts, "--rolling-restarts")
+          add_param(command, :rolling_restart_batch_size, "--rolling-restart-batch-size")
+          add_param(command, :warmup_time, "--warmup-time")
           add_enterprise_flag_param(command, :resist_deployment_errors, "--resist-deployment-errors")
           add_enterprise_flag_param(command, :debugger, "--debugger")
           add_flag_param(command, :sticky_sessions, "--sticky-sessions")
+          add_flag_param(command, :serve_x_sendfile, "--serve-x-sendfile")
+          add_flag_param(command, :serve_static_files, "--serve-static-files")
+          if @options[:ssl]
+            add_param(command, :ssl_certificate, "--tls-certificate")
+            add_param(command, :ssl_certificate_key, "--tls-certificate-key")
+          end
+          add_flag_param(command, :response_compression, "--response-compression")
           add_param(command, :vary_turbocache_by_cookie, "--vary-turbocache-by-cookie")
+          add_param(command, :request_priority_header, "--request-priority-header")
+          add_param(command, :turbocache_entries, "--turbocache-entries")
+          add_param(command, :turbocache_max_body_size, "--turbocache-max-body-size")
+          add_param(command, :shared_turbocache_size, "--shared-turbocache-size")
+          add_param(command, :turbocache_coalescing_timeout, "--turbocache-coalescing-timeout")
+          add_param(command, :turbocache_snapshot, "--turbocache-snapshot")
           add_param(command, :sticky_sessions_cookie_name, "--sticky-sessions-cookie-name")
           add_param(command, :union_station_gateway_address, "--union-station-gateway-address")
           add_param(command, :union_station_gateway_port, "--union-station-gateway-port")
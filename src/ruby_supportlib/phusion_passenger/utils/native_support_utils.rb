@@ -38,12 +38,33 @@ def split_by_null_into_hash(data)
           return PhusionPassenger::NativeSupport.split_by_null_into_hash(data)
         end
 
+        # Like split_by_null_into_hash, but returns a copy of +base_env+ (which may be nil)
+        # with the keys and values from +data+ added to it. Keys are frozen and, where
+        # the Ruby version allows, deduplicated.
+        def split_by_null_into_env(data, base_env)
+          return PhusionPassenger::NativeSupport.split_by_null_into_env(data, base_env)
+        end
+
+        # Serializes a Rack response status and headers Hash. Returns an array
+        # containing an array of header strings (suitable for passing to IO#writev),
+        # the Content-Length header value or nil, and whether a Transfer-Encoding
+        # header is present. Header names are matched case-insensitively.
+        def generate_rack_response_header(status, headers)
+          return PhusionPassenger::NativeSupport.generate_rack_response_header(status, headers)
+        end
+
         # Wrapper for getrusage().
         def process_times
           return PhusionPassenger::NativeSupport.process_times
         end
       else
         NULL = "\0".freeze
+        NEWLINE = "\n".freeze
+        CRLF = "\r\n".freeze
+        NAME_VALUE_SEPARATOR = ": ".freeze
+        RACK_HIJACK = "rack.hijack".freeze
+        CONTENT_LENGTH = "content-length".freeze
+        TRANSFER_ENCODING = "transfer-encoding".freeze
 
         class ProcessTimes < Struct.new(:utime, :stime)
         end
@@ -54,6 +75,45 @@ def split_by_null_into_hash(data)
           return Hash[*args]
         end
 
+        def split_by_null_into_env(data, base_env)
+          result = base_env ? base_env.dup : {}
+          args = data.split(NULL, -1)
+          args.pop
+          i = 0
+          while i < args.size - 1
+            result[args[i].freeze] = args[i + 1]
+            i += 2
+          end
+          return result
+        end
+
+        def generate_rack_response_header(status, headers)
+          output = ["HTTP/1.1 #{status} Whatever\r\n"]
+          content_length = nil
+          has_transfer_encoding = false
+          headers.each do |key, values|
+            key = key.to_s
+            if !values.is_a?(String)
+              # We do not check for this key name in every loop
+              # iteration as an optimization.
+              next if key == RACK_HIJACK
+              values = values.to_s
+            end
+            if key.casecmp(CONTENT_LENGTH) == 0
+              content_length ||= values
+            elsif key.casecmp(TRANSFER_ENCODING) == 0
+              has_transfer_encoding = true
+            end
+            values.split(NEWLINE).each do |value|
+              output << key
+              output << NAME_VALUE_SEPARATOR
+              output << value
+              output << CRLF
+            end
+          end
+          return [output, content_length, has_transfer_encoding]
+        end
+
         def process_times
           times = Process.times
           return ProcessTimes.new((times.utime * 1_000_000).to_i,
@@ -141,6 +141,12 @@ def writev3(components, components2, components3)
         raise annotate(e)
       end if IO.method_defined?(:writev3)
 
+      def writev_iovector(iovector)
+        @socket.writev_iovector(iovector)
+      rescue => e
+        raise annotate(e)
+      end if IO.method_defined?(:writev_iovector)
+
       def send(*args)
         @socket.send(*args)
       rescue => e
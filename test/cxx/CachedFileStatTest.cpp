@@ -1,6 +1,8 @@
 #include "TestSupport.h"
 #include "Utils/CachedFileStat.hpp"
 #include "Utils/SystemTime.h"
+#include "Utils/Timer.h"
+#include "Utils/StrIntUtils.h"
 #include <sys/types.h>
 #include <utime.h>
 
@@ -399,4 +401,85 @@ namespace tut {
 		ensure("(4)", stat.knows("test4.txt"));
 		ensure("(5)", stat.knows("test5.txt"));
 	}
+
+	TEST_METHOD(17) {
+		// When the cache is full, entries that were used again since they
+		// were added survive entries that weren't.
+		SystemTime::force(1);
+		CachedFileStat stat(3);
+		stat.stat("test.txt", &buf, 1);
+		stat.stat("test2.txt", &buf, 1);
+		stat.stat("test3.txt", &buf, 1);
+		stat.stat("test.txt", &buf, 1);
+		stat.stat("test4.txt", &buf, 1);
+		ensure("(1)", stat.knows("test.txt"));
+		ensure("(2)", !stat.knows("test2.txt"));
+		ensure("(3)", stat.knows("test3.txt"));
+		ensure("(4)", stat.knows("test4.txt"));
+	}
+
+	TEST_METHOD(18) {
+		// Entries stay findable after many evictions.
+		SystemTime::force(1);
+		CachedFileStat stat(64);
+		unsigned int i, known = 0;
+
+		for (i = 0; i < 1000; i++) {
+			stat.stat("test-" + toString(i) + ".txt", &buf, 1);
+			ensure("(1)", stat.knows("test-" + toString(i) + ".txt"));
+		}
+		for (i = 0; i < 1000; i++) {
+			if (stat.knows("test-" + toString(i) + ".txt")) {
+				known++;
+			}
+		}
+		ensure_equals("(2)", known, 64u);
+		for (i = 1000 - 64; i < 1000; i++) {
+			ensure("(3)", stat.knows("test-" + toString(i) + ".txt"));
+		}
+	}
+
+
+	/************ Benchmarks ************/
+
+	// These only measure something when PASSENGER_BENCHMARK is set.
+
+	static void runBenchmark(const char *name, unsigned int maxSize,
+		unsigned int numFiles, unsigned int iterations)
+	{
+		CachedFileStat stat(maxSize);
+		vector<string> filenames;
+		struct stat buf;
+		unsigned int i;
+
+		for (i = 0; i < numFiles; i++) {
+			filenames.push_back("/nonexistant/passenger-benchmark/file-" + toString(i));
+		}
+
+		Timer<> timer;
+		for (i = 0; i < iterations; i++) {
+			stat.stat(filenames[i % numFiles], &buf, 1);
+		}
+		fprintf(stderr, "CachedFileStat %s: %.1f nsec per stat()\n", name,
+			timer.usecElapsed() * 1000.0 / iterations);
+	}
+
+	TEST_METHOD(20) {
+		// Cache hits: a working set that fits in the cache.
+		if (getenv("PASSENGER_BENCHMARK") == NULL) {
+			return;
+		}
+		SystemTime::force(1);
+		runBenchmark("hits", 1024, 100, 5000000);
+	}
+
+	TEST_METHOD(21) {
+		// Cache misses: a working set larger than the cache, so that every
+		// stat() evicts an entry.
+		if (getenv("PASSENGER_BENCHMARK") == NULL) {
+			return;
+		}
+		SystemTime::force(1);
+		runBenchmark("evictions", 1024, 2048, 1000000);
+	}
 }
@@ -27,4 +27,54 @@ namespace tut {
 		ensure_equals(options2.appRoot, "appRoot");
 		ensure_equals(options2.processTitle, "processTitle");
 	}
+
+	TEST_METHOD(2) {
+		// Test that persist() shares the storage of already persisted strings,
+		// and only copies the strings that were changed since.
+		char appRoot[] = "appRoot";
+		char hostName[] = "hostName";
+
+		Options options;
+		options.appRoot = appRoot;
+		boost::shared_ptr<Options> options2 = boost::make_shared<Options>(
+			options.copyAndPersist());
+
+		Options options3 = *options2;
+		options3.hostName = hostName;
+		Options options4 = options3.copyAndPersist();
+		ensure_equals("(1)", options4.appRoot.data(), options2->appRoot.data());
+		ensure("(2)", options4.hostName.data() != hostName);
+
+		options2.reset();
+		options3 = Options();
+		hostName[0] = 'x';
+		ensure_equals("(3)", options4.appRoot, "appRoot");
+		ensure_equals("(4)", options4.hostName, "hostName");
+	}
+
+	TEST_METHOD(3) {
+		// Test that fromJson() restores what toJson() stored, except for
+		// the per-request fields.
+		Options options;
+		options.appRoot = "/webapps/foo";
+		options.appGroupName = "foo (production)";
+		options.environmentVariables = "Rk9PAGJhcgA=";
+		options.hostName = "www.foo.com";
+		options.minProcesses = 3;
+		options.rollingRestart = true;
+		options.maxPreloaderIdleTime = -1;
+
+		Json::Value doc;
+		options.toJson(doc);
+		Options options2 = Options::fromJson(doc);
+		ensure_equals("(1)", options2.appRoot, "/webapps/foo");
+		ensure_equals("(2)", options2.appRoot.hash(), options.appRoot.hash());
+		ensure_equals("(3)", options2.getAppGroupName(), "foo (production)");
+		ensure_equals("(4)", options2.environmentVariables, "Rk9PAGJhcgA=");
+		ensure("(5)", options2.hostName.empty());
+		ensure_equals("(6)", options2.minProcesses, 3u);
+		ensure("(7)", options2.rollingRestart);
+		ensure_equals("(8)", options2.maxPreloaderIdleTime, -1l);
+		ensure_equals("(9)", options2.spawnMethod, options.spawnMethod);
+	}
 }
@@ -186,6 +186,10 @@ namespace tut {
 		void disableProcess(ProcessPtr process, AtomicInt *result) {
 			*result = (int) pool->disableProcess(process->getGupid());
 		}
+
+		static bool alwaysCancelled(void *userData) {
+			return true;
+		}
 	};
 
 	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ApplicationPool_PoolTest, 100);
@@ -597,6 +601,92 @@ namespace tut {
 		ensure_equals(pool->getGroupCount(), 0u);
 	}
 
+	TEST_METHOD(15) {
+		// If targetUtilization is set, then processes are spawned ahead of
+		// demand based on the arrival rate and the average service time,
+		// even though no requests are waiting for a process.
+		Options options = createOptions();
+		options.minProcesses = 0;
+		options.targetUtilization = 50;
+		pool->setMax(4);
+		unsigned long long now = 1000000000;
+		SystemTime::forceAll(now);
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		clearAllSessions();
+
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("stub/rack");
+			// 10 requests per second that take 75 msec each keep 0.75
+			// processes busy, so 2 are needed for a utilization of 50%.
+			group->autoscaler.avgServiceTime = 75000;
+			for (unsigned int i = 1; i <= 3; i++) {
+				SystemTime::forceAll(now + i * 1000000);
+				group->autoscaler.arrivals += 10;
+				group->updateAutoscaler(now + i * 1000000);
+			}
+			ensure_equals(group->autoscaler.desiredProcessCount, 2u);
+			ensure(group->autoscalerWantsMoreProcesses());
+
+			stringstream stream;
+			group->inspectXml(stream, false);
+			ensure(containsSubstring(stream.str(),
+				"<desired_process_count>2</desired_process_count>"));
+		}
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("stub/rack");
+			ensure(!group->autoscalerWantsMoreProcesses());
+			ensure_equals(group->getWaitlist.size(), 0u);
+		}
+	}
+
+	TEST_METHOD(16) {
+		// If targetUtilization is set, then idle processes are only shut down
+		// after the predicted demand has stayed lower than the process count
+		// for AUTOSCALER_SCALE_DOWN_DELAY.
+		ensureMinProcesses(3);
+		Pool::GarbageCollectorState state;
+		state.now = 1000000000;
+		state.nextGcRunTime = 0;
+		SystemTime::forceAll(state.now);
+
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("stub/rack");
+			group->options.minProcesses = 1;
+			group->options.targetUtilization = 50;
+
+			pool->autoscaleProcessesInGroup(state, group);
+			ensure_equals(group->enabledCount, 3);
+			ensure_equals(group->autoscaler.scaleDownPendingSince, state.now);
+
+			state.now += 10000000;
+			SystemTime::forceAll(state.now);
+			pool->autoscaleProcessesInGroup(state, group);
+			ensure_equals(group->enabledCount, 3);
+
+			state.now += 25000000;
+			SystemTime::forceAll(state.now);
+			pool->autoscaleProcessesInGroup(state, group);
+			ensure_equals(group->enabledCount, 1);
+			ensure_equals(group->autoscaler.scaleDownPendingSince, 0ull);
+		}
+		Pool::runAllActions(state.actions);
+	}
+
 	TEST_METHOD(17) {
 		// Test that restartGroupByName() spawns more processes to ensure
 		// that minProcesses and other constraints are met.
@@ -633,6 +723,32 @@ namespace tut {
 		ensure_equals(pool->getProcessCount(), 1u);
 	}
 
+	TEST_METHOD(19) {
+		// If spawnConcurrency is larger than 1, then up to that
+		// many processes are spawned at the same time for the waiters.
+		Options options = createOptions();
+		options.minProcesses = 0;
+		options.spawnConcurrency = 3;
+		pool->setMax(5);
+		spawningKitConfig->spawnTime = 100000;
+
+		for (unsigned int i = 0; i < 4; i++) {
+			pool->asyncGet(options, callback);
+		}
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("stub/rack");
+			ensure_equals(group->processesBeingSpawned, 3);
+			ensure_equals(group->getWaitlist.size(), 4u);
+			ensure_equals(pool->capacityUsedUnlocked(), 3u);
+		}
+
+		EVENTUALLY(5,
+			result = number == 4;
+		);
+		ensure(pool->getProcessCount() <= 4u);
+	}
+
 
 	/*********** Test asyncGet() behavior on multiple Groups ***********/
 
@@ -914,6 +1030,178 @@ namespace tut {
 		);
 	}
 
+	TEST_METHOD(26) {
+		// Waiters with a higher priority are served before waiters
+		// with a lower priority, regardless of arrival order.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		pool->setMax(1);
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		Options lowOptions = options;
+		lowOptions.priority = 0;
+		Options highOptions = options;
+		highOptions.priority = 2;
+		pool->asyncGet(lowOptions, callback);
+		pool->asyncGet(highOptions, callback);
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("test");
+			ensure_equals(group->getWaitlist.size(), 2u);
+			ensure_equals(group->getWaitlist.front().options->priority, 2u);
+		}
+
+		session1.reset();
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("test");
+			ensure_equals(group->getWaitlist.size(), 1u);
+			ensure_equals(group->getWaitlist.front().options->priority, 0u);
+		}
+
+		clearAllSessions();
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+	}
+
+	TEST_METHOD(27) {
+		// Waiters whose callback reports that they are cancelled are
+		// rejected instead of being assigned a session.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		pool->setMax(1);
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		GetCallback cancelledCallback = callback;
+		cancelledCallback.isCancelled = alwaysCancelled;
+		pool->asyncGet(options, cancelledCallback);
+		session1.reset();
+
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		LockGuard l(syncher);
+		ensure(currentSession == NULL);
+		ensure(dynamic_pointer_cast<GetAbortedException>(currentException) != NULL);
+	}
+
+	TEST_METHOD(28) {
+		// When the request queue is full, a new waiter makes room for itself
+		// by rejecting the newest waiter of a lower priority.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.maxRequestQueueSize = 1;
+		pool->setMax(1);
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		Options highOptions = options;
+		highOptions.priority = 1;
+		pool->asyncGet(options, callback);
+		pool->asyncGet(highOptions, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		{
+			LockGuard l(syncher);
+			ensure(dynamic_pointer_cast<RequestQueueFullException>(currentException) != NULL);
+		}
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("test");
+			ensure_equals(group->getWaitlist.size(), 1u);
+			ensure_equals(group->getWaitlist.front().options->priority, 1u);
+		}
+
+		// A waiter of the same priority is rejected instead.
+		pool->asyncGet(highOptions, callback);
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+		LockGuard l(pool->syncher);
+		ensure_equals(pool->groups.lookupCopy("test")->getWaitlist.size(), 1u);
+	}
+
+	TEST_METHOD(29) {
+		// When requestQueueTargetDelay is set and the oldest waiter has waited
+		// for longer than that plus the shed interval, all waiters that waited
+		// for longer than the target delay are rejected.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.requestQueueTargetDelay = 100;
+		pool->setMax(1);
+
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		unsigned long long t0 = SystemTime::getUsec();
+		SystemTime::forceUsec(t0);
+		pool->asyncGet(options, callback);
+		SystemTime::forceUsec(t0 + 150000);
+		pool->asyncGet(options, callback);
+		SHOULD_NEVER_HAPPEN(100,
+			result = number > 1;
+		);
+
+		SystemTime::forceUsec(t0 + 210000);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		{
+			LockGuard l(syncher);
+			ensure(dynamic_pointer_cast<RequestQueueFullException>(currentException) != NULL);
+		}
+		{
+			LockGuard l(pool->syncher);
+			GroupPtr group = pool->groups.lookupCopy("test");
+			ensure_equals(group->getWaitlist.size(), 2u);
+			stringstream xml;
+			group->inspectXml(xml);
+			ensure(containsSubstring(xml.str(), "<shed>1</shed>"));
+		}
+
+		// The remaining waiters are served and their queue times recorded.
+		retainSessions = true;
+		session1.reset();
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+		clearAllSessions();
+		EVENTUALLY(5,
+			result = number == 4;
+		);
+		LockGuard l(pool->syncher);
+		GroupPtr group = pool->groups.lookupCopy("test");
+		ensure_equals(group->requestQueue.queueTimeSamples, 3ull);
+		ensure(group->getQueueTimePercentile(100) >= 60000u);
+	}
+
 
 	/*********** Test detachProcess() ***********/
 
@@ -1371,86 +1659,579 @@ namespace tut {
 		}
 	}
 
-
-	/*********** Other tests ***********/
-
-	TEST_METHOD(60) {
-		// The pool is considered to be at full capacity if and only
-		// if all Groups are at full capacity.
+	TEST_METHOD(45) {
+		// A process that goes over the memory limit is only disabled after
+		// a successor has been spawned, and is detached after its sessions
+		// have finished.
 		Options options = createOptions();
-		Options options2 = createOptions();
-		options2.appGroupName = "test";
+		options.memoryLimit = 100;
+		SessionPtr session1 = pool->get(options, &ticket);
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		GroupPtr group = process1->getGroup()->shared_from_this();
+
+		{
+			boost::container::vector<Callback> actions;
+			LockGuard l(pool->syncher);
+			process1->metrics.privateDirty = 200 * 1024;
+			process1->metrics.swap = 0;
+			group->recycleProcessesOverMemoryLimit(actions);
+			ensure(process1->overMemoryLimit);
+			ensure_equals(process1->enabled, Process::ENABLED);
+		}
 
-		pool->setMax(2);
-		pool->asyncGet(options, callback);
 		EVENTUALLY(5,
-			result = number == 1;
+			LockGuard l(pool->syncher);
+			result = group->enabledCount == 1
+				&& process1->enabled == Process::DISABLING;
 		);
+		{
+			LockGuard l(pool->syncher);
+			ensure(group->enabledProcesses[0] != process1);
+			ensure(!group->enabledProcesses[0]->overMemoryLimit);
+		}
 
-		pool->asyncGet(options2, callback);
+		session1.reset();
 		EVENTUALLY(5,
-			result = number == 2;
+			LockGuard l(pool->syncher);
+			result = process1->enabled == Process::DETACHED;
 		);
-
-		ensure_equals(pool->getProcessCount(), 2u);
-		ensure(pool->atFullCapacity());
-		clearAllSessions();
-		pool->detachGroupByName("test");
-		ensure(!pool->atFullCapacity());
+		LockGuard l(pool->syncher);
+		ensure_equals(group->getProcessCount(), 1u);
 	}
 
-	TEST_METHOD(61) {
-		// If the pool is at full capacity, then increasing 'max' will cause
-		// new processes to be spawned. Any queued get requests are processed
-		// as those new processes become available or as existing processes
-		// become available.
+	TEST_METHOD(46) {
+		// If there's no room for a successor then a process that goes over
+		// the memory limit is disabled right away, and replaced after it
+		// has been detached.
 		Options options = createOptions();
-		retainSessions = true;
-		pool->setMax(1);
-
-		pool->asyncGet(options, callback);
-		pool->asyncGet(options, callback);
+		options.minProcesses = 2;
+		options.memoryLimit = 100;
+		pool->setMax(2);
 		pool->asyncGet(options, callback);
 		EVENTUALLY(5,
-			result = number == 1;
+			result = pool->getProcessCount() == 2;
 		);
+		currentSession.reset();
+
+		ProcessPtr process1;
+		GroupPtr group;
+		{
+			boost::container::vector<Callback> actions;
+			ScopedLock l(pool->syncher);
+			group = pool->groups.lookupCopy(options.getAppGroupName());
+			process1 = group->enabledProcesses[0];
+			process1->metrics.privateDirty = 200 * 1024;
+			process1->metrics.swap = 0;
+			group->recycleProcessesOverMemoryLimit(actions);
+			ensure_equals(process1->enabled, Process::DISABLED);
+			l.unlock();
+			Group::runAllActions(actions);
+		}
 
-		pool->setMax(4);
 		EVENTUALLY(5,
-			result = number == 3;
+			LockGuard l(pool->syncher);
+			result = process1->enabled == Process::DETACHED
+				&& group->enabledCount == 2;
 		);
-		ensure_equals(pool->getProcessCount(), 3u);
 	}
 
-	TEST_METHOD(62) {
-		// Each spawned process has a GUPID, which can be looked up
-		// through findProcessByGupid().
+	TEST_METHOD(47) {
+		// A rolling restart keeps the old processes around until their
+		// successors have been attached, and replaces them at most
+		// rollingRestartBatchSize at a time.
 		Options options = createOptions();
+		options.minProcesses = 3;
+		options.rollingRestartBatchSize = 2;
 		pool->asyncGet(options, callback);
 		EVENTUALLY(5,
-			result = number == 1;
+			result = pool->getProcessCount() == 3;
 		);
-		string gupid = currentSession->getProcess()->getGupid().toString();
-		ensure(!gupid.empty());
-		ensure_equals(currentSession->getProcess(),
-			pool->findProcessByGupid(gupid).get());
-	}
+		currentSession.reset();
 
-	TEST_METHOD(63) {
-		// findProcessByGupid() returns a NULL pointer if there is
-		// no matching process.
-		ensure(pool->findProcessByGupid("none") == NULL);
-	}
+		GroupPtr group = pool->groups.lookupCopy(options.getAppGroupName());
+		vector<ProcessPtr> oldProcesses;
+		{
+			LockGuard l(pool->syncher);
+			oldProcesses.assign(group->enabledProcesses.begin(),
+				group->enabledProcesses.end());
+		}
 
-	TEST_METHOD(64) {
-		// Test process idle cleaning.
-		Options options = createOptions();
-		pool->setMaxIdleTime(50000);
-		SessionPtr session1 = pool->get(options, &ticket);
-		SessionPtr session2 = pool->get(options, &ticket);
-		ensure_equals(pool->getProcessCount(), 2u);
+		Pool::RestartOptions restartOptions = Pool::RestartOptions::makeAuthorized();
+		restartOptions.method = RM_ROLLING;
+		ensure(pool->restartGroupByName(options.getAppGroupName(), restartOptions));
+		{
+			LockGuard l(pool->syncher);
+			ensure(!group->restarting());
+			ensure_equals(group->enabledCount, 3);
+		}
 
-		session2.reset();
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->getProcessCount() == 3
+				&& group->enabledCount == 3
+				&& group->findEnabledOutdatedProcess() == NULL
+				&& !group->spawning();
+			for (unsigned int i = 0; i < oldProcesses.size(); i++) {
+				result = result && oldProcesses[i]->enabled == Process::DETACHED;
+			}
+		);
+	}
+
+	TEST_METHOD(48) {
+		// If there's no room for successors then a rolling restart disables
+		// outdated processes right away, but never the last enabled one,
+		// and replaces them after they have been detached.
+		Options options = createOptions();
+		options.minProcesses = 3;
+		options.rollingRestart = true;
+		options.rollingRestartBatchSize = 2;
+		pool->setMax(3);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 3;
+		);
+		currentSession.reset();
+
+		GroupPtr group;
+		vector<ProcessPtr> oldProcesses;
+		{
+			boost::container::vector<Callback> actions;
+			ScopedLock l(pool->syncher);
+			group = pool->groups.lookupCopy(options.getAppGroupName());
+			oldProcesses.assign(group->enabledProcesses.begin(),
+				group->enabledProcesses.end());
+			group->markAllProcessesOutdated();
+			group->replaceOutdatedProcesses(actions);
+			ensure_equals(group->enabledCount, 1);
+			ensure_equals(group->countOutdatedProcessesBeingReplaced(), 2u);
+			l.unlock();
+			Group::runAllActions(actions);
+		}
+
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->enabledCount == 3
+				&& group->findEnabledOutdatedProcess() == NULL
+				&& !group->spawning();
+			for (unsigned int i = 0; i < oldProcesses.size(); i++) {
+				result = result && oldProcesses[i]->enabled == Process::DETACHED;
+			}
+		);
+	}
+
+	TEST_METHOD(49) {
+		// While a process is warming up, it receives a share of the
+		// requests that is proportional to its warm-up weight.
+		unsigned long long now = SystemTime::getUsec();
+		Options options = createOptions();
+		options.warmupTime = 10;
+		spawningKitConfig->concurrency = 0;
+		SystemTime::forceAll(now);
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process1 = session->getProcess()->shared_from_this();
+		GroupPtr group = process1->getGroup()->shared_from_this();
+		session.reset();
+
+		// Process 2 is spawned 100 seconds later.
+		SystemTime::forceAll(now + 100000000);
+		options.minProcesses = 2;
+		pool->get(options, &ticket).reset();
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		ProcessPtr process2;
+		{
+			LockGuard l(pool->syncher);
+			process2 = group->enabledProcesses[1];
+			ensure_equals(group->warmupEndTime, now + 110000000);
+		}
+
+		// 3 seconds into its warm-up, process 2 has a weight of 0.3,
+		// so it only gets a request once process 1 has 3 sessions.
+		retainSessions = true;
+		options.currentTime = now + 103000000;
+		for (int i = 0; i < 3; i++) {
+			sessions.push_back(pool->get(options, &ticket));
+			ensure_equals(sessions.back()->getPid(), process1->getPid());
+		}
+		sessions.push_back(pool->get(options, &ticket));
+		ensure_equals(sessions.back()->getPid(), process2->getPid());
+
+		// Once warm, the routing policy picks the least busy process again.
+		options.currentTime = now + 111000000;
+		sessions.push_back(pool->get(options, &ticket));
+		ensure_equals(sessions.back()->getPid(), process2->getPid());
+	}
+
+
+	TEST_METHOD(52) {
+		// Sessions that are closed in a batch are only accounted for when
+		// the batch is processed, after which get waiters are assigned.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		pool->setMax(1);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		ProcessPtr process = session1->getProcess()->shared_from_this();
+		currentSession.reset();
+		ensure(process->isTotallyBusy());
+
+		pool->asyncGet(options, callback);
+		ensure_equals("callback is not yet called", number, 1);
+
+		SessionCloseBatch batch;
+		session1->closeInBatch(true, false, batch);
+		session1.reset();
+		ensure("the session counts as closed", batch.sessions[0]->isClosed());
+		ensure_equals("callback is not yet called", number, 1);
+		ensure_equals(process->sessions, 1);
+
+		pool->closeSessions(batch);
+		ensure(batch.empty());
+		ensure_equals("callback is called after the batch is processed",
+			number, 2);
+		ensure_equals("the get wait list has been processed",
+			pool->groups.lookupCopy("test")->getWaitlist.size(), 0u);
+		ensure_equals(process->sessions, 1);
+		ensure_equals(process->processed, 1u);
+	}
+
+
+	TEST_METHOD(53) {
+		// The garbage collector skips groups until the earliest time at
+		// which they may have idle processes to clean.
+		Options options = createOptions();
+		pool->setMaxIdleTime(60000000);
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 2u);
+		GroupPtr group = session1->getGroup()->shared_from_this();
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		ProcessPtr process2 = session2->getProcess()->shared_from_this();
+		session2.reset();
+
+		pool->realGarbageCollect();
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(group->nextGarbageCollectionTime,
+				std::min(process1->lastUsed, process2->lastUsed) + 60000000);
+			// Pretend that process 2 has been idle for a long time.
+			process2->setLastUsed(0);
+			group->nextGarbageCollectionTime = SystemTime::getUsec() + 60000000;
+		}
+		pool->realGarbageCollect();
+		ensure_equals("The group is not examined before it's due",
+			pool->getProcessCount(), 2u);
+
+		// Changing the idle time makes all groups due again.
+		pool->setMaxIdleTime(60000000);
+		pool->realGarbageCollect();
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 1;
+		);
+	}
+
+
+	TEST_METHOD(54) {
+		// findMatchingGroup() caches its result in the options' group
+		// lookup cache, until a group is added or removed.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		options.enableGroupLookupCache();
+		Options copy = options;
+		pool->get(copy, &ticket).reset();
+
+		LockGuard l(pool->syncher);
+		Group *group = pool->findMatchingGroup(copy);
+		ensure(group != NULL);
+		ensure_equals(options.ownGroupLookupCache.group, group);
+		ensure_equals(options.ownGroupLookupCache.generation, pool->groupsGeneration);
+
+		options.ownGroupLookupCache.group = NULL;
+		ensure("The group table is not consulted while the cache is valid",
+			pool->findMatchingGroup(copy) == NULL);
+		pool->groupsGeneration++;
+		ensure_equals(pool->findMatchingGroup(copy), group);
+	}
+
+
+	TEST_METHOD(55) {
+		// Out-of-band work is deferred while the group's utilization is
+		// above outOfBandWorkMaxUtilization, and maxOutOfBandWorkPercentage
+		// lets a fraction of the processes perform it concurrently.
+		Options options = createOptions();
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 2u);
+		GroupPtr group = session1->getGroup()->shared_from_this();
+		{
+			LockGuard l(pool->syncher);
+			ensure(!group->oobwDeferredByLoad());
+			group->options.outOfBandWorkMaxUtilization = 40;
+			ensure(group->oobwDeferredByLoad());
+		}
+
+		session2.reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure("Utilization is 50%", group->oobwDeferredByLoad());
+			group->options.outOfBandWorkMaxUtilization = 60;
+			ensure(!group->oobwDeferredByLoad());
+
+			group->options.maxOutOfBandWorkInstances = 0;
+			ensure(!group->oobwAllowed());
+			group->options.maxOutOfBandWorkPercentage = 50;
+			ensure(group->oobwAllowed());
+		}
+	}
+
+
+	TEST_METHOD(56) {
+		// When capacity has to be freed, idle processes are taken from the
+		// group that is the furthest over its weighted fair share, and
+		// groups at their reserved minimum are left alone if possible.
+		Options options = createOptions();
+		pool->setMax(4);
+		options.appRoot = "/foo";
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		SessionPtr session3 = pool->get(options, &ticket);
+		options.appRoot = "/bar";
+		SessionPtr session4 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 4u);
+		GroupPtr foo = session1->getGroup()->shared_from_this();
+		GroupPtr bar = session4->getGroup()->shared_from_this();
+		ProcessPtr barProcess = session4->getProcess()->shared_from_this();
+		session1.reset();
+		session2.reset();
+		session3.reset();
+		session4.reset();
+
+		LockGuard l(pool->syncher);
+		barProcess->setLastUsed(0);
+		ProcessPtr process = pool->findProcessToFreeCapacity();
+		ensure(process != NULL);
+		ensure_equals("(1)", process->getGroup(), foo.get());
+		ensure_equals("(2)", pool->findProcessToFreeCapacity(foo.get()), barProcess);
+
+		bar->options.capacityWeight = 3;
+		ensure_equals("(3)", pool->fairCapacityShare(bar.get(),
+			pool->totalCapacityWeightUnlocked()), 3u);
+		process = pool->findProcessToFreeCapacity();
+		ensure_equals("(4)", process->getGroup(), foo.get());
+
+		// Freed capacity goes to the group that uses the least
+		// capacity relative to its weight first.
+		ensure("(5)", Pool::usesLessCapacityByWeight(bar.get(), foo.get()));
+		bar->options.capacityWeight = 1;
+		foo->options.capacityWeight = 4;
+		ensure("(6)", Pool::usesLessCapacityByWeight(foo.get(), bar.get()));
+	}
+
+	TEST_METHOD(57) {
+		// Processes that stop making progress or fail health checks are
+		// ejected from routing for a while, at most half of a group's
+		// processes at a time, and readmitted once they're healthy again.
+		ensure_equals(Pool::parseHealthCheckResponseStatus("HTTP/1.1 204 No Content\r\n\r\n"), 204);
+		ensure_equals(Pool::parseHealthCheckResponseStatus("Status: 503 Unavailable\r\nFoo: bar\r\n\r\n"), 503);
+		ensure_equals(Pool::parseHealthCheckResponseStatus("Foo: bar\r\n\r\n"), -1);
+
+		Options options = createOptions();
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 2u);
+		GroupPtr group = session1->getGroup()->shared_from_this();
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		ProcessPtr process2 = session2->getProcess()->shared_from_this();
+		unsigned long long now = SystemTime::getUsec();
+		{
+			LockGuard l(pool->syncher);
+			ensure(!group->healthCheckingEnabled());
+			ensure(!group->processUnresponsive(process1.get(), now + 60000000));
+			group->options.unresponsiveProcessTimeout = 30;
+			ensure(group->healthCheckingEnabled());
+			ensure(!group->processUnresponsive(process1.get(), now));
+			ensure(group->processUnresponsive(process1.get(), now + 60000000));
+		}
+
+		session1.reset();
+		session2.reset();
+		boost::container::vector<Callback> actions;
+		ScopedLock l(pool->syncher);
+		ensure("(1)", !group->processUnresponsive(process1.get(), now + 60000000));
+		ensure("(2)", group->ejectProcess(process1, now, "unhealthy", actions));
+		ensure_equals("(3)", process1->enabled, Process::DISABLED);
+		ensure_equals("(4)", process1->ejectedUntil,
+			now + (unsigned long long) options.healthCheckEjectionTime * 1000000);
+		ensure_equals("(5)", group->countEjectedProcesses(), 1u);
+		ensure("(6)", !group->ejectProcess(process2, now, "unhealthy", actions));
+		ensure_equals("(7)", process2->enabled, Process::ENABLED);
+
+		group->healthCheckFinished(process1, true, now, actions);
+		ensure_equals("(8)", process1->enabled, Process::ENABLED);
+		ensure_equals("(9)", process1->ejectedUntil, 0ull);
+		ensure_equals("(10)", process1->ejectionCount, 1u);
+		l.unlock();
+		Group::runAllActions(actions);
+	}
+
+	TEST_METHOD(58) {
+		// The consistent-hash routing policy routes requests with the same
+		// routing hash to the same process, unless it's overloaded.
+		Options options = createOptions();
+		options.routingPolicy = "consistent-hash";
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		SessionPtr session3 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 3u);
+		GroupPtr group = session1->getGroup()->shared_from_this();
+		session1.reset();
+		session2.reset();
+		session3.reset();
+
+		ProcessPtr process;
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals(group->hashRing.size(), 3u * Group::HASH_RING_VIRTUAL_NODES);
+			process = group->findEnabledProcessByConsistentHash(1234)->shared_from_this();
+		}
+
+		options.routingHash = 1234;
+		session1 = pool->get(options, &ticket);
+		ensure_equals("(1)", session1->getProcess(), process.get());
+		session1.reset();
+		session1 = pool->get(options, &ticket);
+		ensure_equals("(2)", session1->getProcess(), process.get());
+
+		session2 = pool->get(options, &ticket);
+		ensure("(3)", session2->getProcess() != process.get());
+
+		LockGuard l(pool->syncher);
+		ensure_equals("(4)", group->nEnabledProcessSessions, 2u);
+	}
+
+	TEST_METHOD(59) {
+		// A process that reaches its (jittered) maximum number of requests
+		// keeps serving requests until its successor has been attached,
+		// and is only shut down after that.
+		Options options = createOptions();
+		options.maxRequests = 3;
+		options.recycleJitter = 50;
+		pool->setMax(2);
+
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		GroupPtr group = process->getGroup()->shared_from_this();
+		session.reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure(process->recycleThreshold >= 50);
+			ensure(process->recycleThreshold <= 100);
+			ensure(group->getMaxRequests(process.get()) >= 1);
+			ensure(group->getMaxRequests(process.get()) <= 3);
+			// Make the outcome of this test deterministic.
+			process->recycleThreshold = 100;
+		}
+
+		pool->get(options, &ticket).reset();
+		pool->get(options, &ticket).reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure("(1)", process->reachedMaxRequests);
+		}
+
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = process->enabled == Process::DETACHED
+				&& group->enabledCount == 1;
+		);
+		LockGuard l(pool->syncher);
+		ensure("(2)", group->enabledProcesses[0] != process);
+		ensure("(3)", !group->enabledProcesses[0]->reachedMaxRequests);
+	}
+
+	/*********** Other tests ***********/
+
+	TEST_METHOD(60) {
+		// The pool is considered to be at full capacity if and only
+		// if all Groups are at full capacity.
+		Options options = createOptions();
+		Options options2 = createOptions();
+		options2.appGroupName = "test";
+
+		pool->setMax(2);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+
+		ensure_equals(pool->getProcessCount(), 2u);
+		ensure(pool->atFullCapacity());
+		clearAllSessions();
+		pool->detachGroupByName("test");
+		ensure(!pool->atFullCapacity());
+	}
+
+	TEST_METHOD(61) {
+		// If the pool is at full capacity, then increasing 'max' will cause
+		// new processes to be spawned. Any queued get requests are processed
+		// as those new processes become available or as existing processes
+		// become available.
+		Options options = createOptions();
+		retainSessions = true;
+		pool->setMax(1);
+
+		pool->asyncGet(options, callback);
+		pool->asyncGet(options, callback);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+
+		pool->setMax(4);
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+		ensure_equals(pool->getProcessCount(), 3u);
+	}
+
+	TEST_METHOD(62) {
+		// Each spawned process has a GUPID, which can be looked up
+		// through findProcessByGupid().
+		Options options = createOptions();
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		string gupid = currentSession->getProcess()->getGupid().toString();
+		ensure(!gupid.empty());
+		ensure_equals(currentSession->getProcess(),
+			pool->findProcessByGupid(gupid).get());
+	}
+
+	TEST_METHOD(63) {
+		// findProcessByGupid() returns a NULL pointer if there is
+		// no matching process.
+		ensure(pool->findProcessByGupid("none") == NULL);
+	}
+
+	TEST_METHOD(64) {
+		// Test process idle cleaning.
+		Options options = createOptions();
+		pool->setMaxIdleTime(50000);
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 2u);
+
+		session2.reset();
 
 		// One of the processes still has a session open and should
 		// not be idle cleaned.
@@ -2001,6 +2782,165 @@ namespace tut {
 		currentSession.reset();
 	}
 
+	TEST_METHOD(80) {
+		// With spawn workers, the spawn loops of multiple groups are run
+		// by the shared workers instead of by threads of their own.
+		Options options1 = createOptions();
+		options1.appGroupName = "test1";
+		options1.minProcesses = 2;
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		options2.minProcesses = 2;
+		pool->setMax(4);
+		pool->setSpawnWorkerCount(1);
+
+		pool->asyncGet(options1, callback);
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(10,
+			result = number == 2 && pool->getProcessCount() == 4;
+		);
+		GroupPtr group1 = pool->groups.lookupCopy("test1");
+		GroupPtr group2 = pool->groups.lookupCopy("test2");
+		ensure_equals(group1->interruptableThreads.num_threads(), 0u);
+		ensure_equals(group2->interruptableThreads.num_threads(), 0u);
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+	}
+
+	TEST_METHOD(81) {
+		// The prespawn manifest lists the groups and their process counts.
+		// Prespawning a group from the manifest recreates it, and spawns
+		// processes until it has as many as before.
+		ensureMinProcesses(2);
+		Json::Value manifest;
+		{
+			LockGuard l(pool->syncher);
+			manifest = pool->createPrespawnManifest();
+		}
+		ensure_equals("(1)", manifest["groups"].size(), 1u);
+		Json::Value entry = manifest["groups"][0];
+		ensure_equals("(2)", entry["options"]["app_root"].asString(), "stub/rack");
+		ensure_equals("(3)", entry["process_count"].asUInt(), 2u);
+
+		pool->detachGroupByName("stub/rack");
+		ensure_equals("(4)", pool->getProcessCount(), 0u);
+		entry["options"]["min_processes"] = 0;
+		ensure("(5)", pool->prespawnGroup(entry));
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		GroupPtr group = pool->groups.lookupCopy("stub/rack");
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = !group->spawning() && group->prespawnTarget == 0;
+		);
+		ensure_equals("(6)", group->options.minProcesses, 0u);
+	}
+
+	TEST_METHOD(82) {
+		// A snapshot is a copy of the pool state that can be formatted
+		// as text, XML or JSON without holding the pool lock.
+		ensureMinProcesses(2);
+		Pool::Snapshot snapshot;
+		pool->takeSnapshot(snapshot);
+		ensure_equals("(1)", snapshot.processCount, 2u);
+		ensure_equals("(2)", snapshot.groups.size(), 1u);
+		ensure_equals("(3)", snapshot.groups[0].processes.size(), 2u);
+		ensure_equals("(4)", snapshot.groups[0].enabledCount, 2u);
+
+		Pool::ToXmlOptions options(Pool::ToXmlOptions::makeAuthorized());
+		ensure("(5)", containsSubstring(Pool::toXml(snapshot, options),
+			"<process_count>2</process_count>"));
+
+		Json::Value doc;
+		Json::Reader reader;
+		ensure("(6)", reader.parse(Pool::toJson(snapshot, options), doc));
+		ensure_equals("(7)", doc["process_count"].asUInt(), 2u);
+		ensure_equals("(8)", doc["groups"][0]["name"].asString(), "stub/rack");
+		ensure_equals("(9)", doc["groups"][0]["processes"].size(), 2u);
+		ensure("(10)", doc["groups"][0].isMember("secret"));
+
+		options.secrets = false;
+		ensure("(11)", reader.parse(Pool::toJson(snapshot, options), doc));
+		ensure("(12)", !doc["groups"][0].isMember("secret"));
+	}
+
+	TEST_METHOD(83) {
+		// Group::readCgroupMemoryUsage() supports both cgroup v2 and v1,
+		// and returns -1 if the memory usage cannot be read.
+		TempDir dir("tmp.cgroup");
+		ensure_equals("(1)", Group::readCgroupMemoryUsage("tmp.cgroup"), (ssize_t) -1);
+
+		createFile("tmp.cgroup/memory.usage_in_bytes", "2048\n");
+		ensure_equals("(2)", Group::readCgroupMemoryUsage("tmp.cgroup"), (ssize_t) 2);
+
+		createFile("tmp.cgroup/memory.current", "4096\n");
+		ensure_equals("(3)", Group::readCgroupMemoryUsage("tmp.cgroup"), (ssize_t) 4);
+
+		createFile("tmp.cgroup/memory.current", "garbage\n");
+		ensure_equals("(4)", Group::readCgroupMemoryUsage("tmp.cgroup"), (ssize_t) -1);
+	}
+
+	TEST_METHOD(84) {
+		// If outOfBandWorkIdleInterval is set, idle processes that are due
+		// are given out-of-band work, as long as another enabled process
+		// remains and they have been idle for as long as their last
+		// out-of-band work took.
+		Options options = createOptions();
+		initPoolDebugging();
+		debug->restarting = false;
+		debug->spawning = false;
+		debug->oobw = true;
+		SessionPtr session1 = pool->get(options, &ticket);
+		SessionPtr session2 = pool->get(options, &ticket);
+		SessionPtr session3 = pool->get(options, &ticket);
+		ensure_equals(pool->getProcessCount(), 3u);
+		GroupPtr group = session1->getGroup()->shared_from_this();
+		ProcessPtr process1 = session1->getProcess()->shared_from_this();
+		ProcessPtr process2 = session2->getProcess()->shared_from_this();
+		ProcessPtr process3 = session3->getProcess()->shared_from_this();
+		session2.reset();
+		session3.reset();
+
+		unsigned long long now;
+		{
+			LockGuard l(pool->syncher);
+			now = process1->getSpawnEndTime();
+			ensure_equals("(1)", group->offerIdleOobwWindows(now), 0ull);
+
+			group->options.outOfBandWorkIdleInterval = 10;
+			ensure_equals("Not due yet", group->offerIdleOobwWindows(now),
+				process1->getSpawnEndTime() + 10000000);
+			ensure_equals("(2)", process2->oobwStatus, Process::OOBW_NOT_ACTIVE);
+
+			now += 20000000;
+			process2->lastOobwDuration = 30000000;
+			ensure_equals("process1 is busy, process2 has not been idle for long enough",
+				group->offerIdleOobwWindows(now),
+				now + Group::OOBW_IDLE_WINDOW_RETRY_INTERVAL);
+			ensure_equals("(3)", process1->oobwStatus, Process::OOBW_NOT_ACTIVE);
+			ensure_equals("(4)", process2->oobwStatus, Process::OOBW_NOT_ACTIVE);
+			ensure_equals("(5)", process3->oobwStatus, Process::OOBW_IN_PROGRESS);
+			ensure_equals("(6)", process3->enabled, Process::DISABLED);
+
+			now += 20000000;
+			group->offerIdleOobwWindows(now);
+			ensure_equals("Only one process at a time", process2->oobwStatus,
+				Process::OOBW_NOT_ACTIVE);
+		}
+		debug->debugger->recv("OOBW request about to start");
+		debug->messages->send("Proceed with OOBW request");
+		debug->debugger->recv("OOBW request finished");
+
+		{
+			LockGuard l(pool->syncher);
+			ensure_equals("(7)", process3->oobwStatus, Process::OOBW_NOT_ACTIVE);
+			ensure_equals("(8)", process3->enabled, Process::ENABLED);
+			ensure_equals("(9)", process3->oobwCount, 1u);
+		}
+	}
+
 	// TODO: Persistent connections.
 	// TODO: If one closes the session before it has reached EOF, and process's maximum concurrency
 	//       has already been reached, then the pool should ping the process so that it can detect
@@ -2027,6 +2967,134 @@ namespace tut {
 		pool->get(options, &ticket).reset();
 	}
 
+	TEST_METHOD(86) {
+		// If restart file watching is enabled, then restart.txt is only
+		// checked after its directory has changed, regardless of
+		// statThrottleRate. Directories that cannot be watched are polled.
+		if (!FileSystemWatcher::isSupported()) {
+			return;
+		}
+		TempDir dir("tmp.restart");
+		makeDirTree("tmp.restart/tmp");
+		char *realDir = realpath("tmp.restart", NULL);
+		string appRoot = realDir;
+		free(realDir);
+		Options options = createOptions();
+		options.appRoot = appRoot;
+		options.statThrottleRate = 100;
+		ensure(pool->enableRestartFileWatching());
+
+		SessionPtr session = pool->get(options, &ticket);
+		GroupPtr group = session->getGroup()->shared_from_this();
+		session.reset();
+		{
+			LockGuard l(pool->syncher);
+			ensure("(1)", group->restartFileWatched);
+			ensure("(2)", !group->needsRestart(options));
+		}
+
+		touchFile("tmp.restart/tmp/restart.txt", 1);
+		EVENTUALLY(5,
+			LockGuard l(pool->syncher);
+			result = group->restartFileChanged;
+		);
+		{
+			LockGuard l(pool->syncher);
+			ensure("(3)", group->needsRestart(options));
+			ensure("(4)", !group->needsRestart(options));
+		}
+
+		string otherAppRoot = appRoot + "/nonexistent";
+		options.appRoot = otherAppRoot;
+		session = pool->get(options, &ticket);
+		LockGuard l(pool->syncher);
+		ensure("(5)", !session->getGroup()->restartFileWatched);
+	}
+
+
+	/*********** Test tenants ***********/
+
+	TEST_METHOD(87) {
+		// The groups of a tenant do not spawn more processes than the
+		// tenant's limit, except that every group may have one process.
+		pool->setMax(4);
+		pool->setTenantMaxProcesses("a", 2);
+		Options options1 = createOptions();
+		options1.tenant = "a";
+		options1.minProcesses = 3;
+		pool->asyncGet(options1, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		currentSession.reset();
+		SHOULD_NEVER_HAPPEN(200,
+			result = pool->getProcessCount() > 2;
+		);
+
+		Options options2 = createOptions();
+		options2.appRoot = "bar";
+		options2.tenant = "a";
+		SessionPtr session = pool->get(options2, &ticket);
+		ensure_equals(pool->getProcessCount(), 3u);
+	}
+
+	TEST_METHOD(88) {
+		// Tenants that use the same app group name get separate groups.
+		Options options = createOptions();
+		options.tenant = "a";
+		SessionPtr session1 = pool->get(options, &ticket);
+
+		options.tenant = "b";
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure(session1->getGroup() != session2->getGroup());
+		ensure_equals(pool->getGroupCount(), 2u);
+		ensure_equals(session2->getGroup()->getName(), "stub/rack");
+		ensure_equals(session2->getGroup()->getKey(), string("b\0stub/rack", 11));
+	}
+
+	TEST_METHOD(89) {
+		// Get waiters only copy the Options if the caller doesn't
+		// guarantee that they outlive the callback.
+		Options options = createOptions();
+		options.appGroupName = "test";
+		pool->setMax(1);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		SessionPtr session1 = currentSession;
+		currentSession.reset();
+
+		pool->asyncGet(options, callback);
+		GroupPtr group = pool->groups.lookupCopy("test");
+		ensure_equals(group->getWaitlist.size(), 1u);
+		ensure("(1)", group->getWaitlist.front().options != &options);
+		ensure("(2)", group->getWaitlist.front().ownOptions != NULL);
+
+		GetCallback callback2 = callback;
+		callback2.optionsOutliveCallback = true;
+		pool->asyncGet(options, callback2);
+		ensure_equals(group->getWaitlist.size(), 2u);
+		GetWaitlist::const_iterator it = group->getWaitlist.begin();
+		it++;
+		ensure("(3)", it->options == &options);
+		ensure("(4)", it->ownOptions == NULL);
+
+		session1.reset();
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		currentSession.reset();
+		EVENTUALLY(5,
+			result = number == 3;
+		);
+		currentSession.reset();
+		ensure_equals(group->getWaitlist.size(), 0u);
+	}
+
 
 	/*****************************/
 }
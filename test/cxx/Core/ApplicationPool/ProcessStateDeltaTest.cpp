@@ -0,0 +1,137 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/ProcessStateDelta.h>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+using namespace std;
+
+namespace tut {
+	struct Core_ApplicationPool_ProcessStateDeltaTest {
+		ProcessStateDeltaEncoder encoder;
+		GroupStateRecord state, decoded;
+		string record;
+
+		Core_ApplicationPool_ProcessStateDeltaTest() {
+			state.fields[GroupStateRecord::ENABLED_COUNT] = 2;
+			state.fields[GroupStateRecord::CGROUP_MEMORY_USAGE] = -1;
+			addProcess("gupid-1", 1001);
+			addProcess("gupid-2", 1002);
+		}
+
+		ProcessStateRecord &addProcess(const string &gupid, pid_t pid) {
+			state.processes.push_back(ProcessStateRecord());
+			ProcessStateRecord &process = state.processes.back();
+			process.gupid = gupid;
+			process.fields[ProcessStateRecord::PID] = pid;
+			process.fields[ProcessStateRecord::SPAWN_END_TIME] = 1450000000000000ull;
+			process.fields[ProcessStateRecord::RSS] = -1;
+			return process;
+		}
+
+		bool encode() {
+			bool result = encoder.encode("/app", state, record);
+			encoder.endCycle();
+			return result;
+		}
+
+		void ensureDecodedEqualsState() {
+			ensure("The record is well-formed", ProcessStateDeltaDecoder::apply(record, decoded));
+			ensure_equals(decoded.processes.size(), state.processes.size());
+			ensure(memcmp(decoded.fields, state.fields, sizeof(state.fields)) == 0);
+			for (unsigned int i = 0; i < state.processes.size(); i++) {
+				ensure_equals(decoded.processes[i].gupid, state.processes[i].gupid);
+				ensure(memcmp(decoded.processes[i].fields, state.processes[i].fields,
+					sizeof(state.processes[i].fields)) == 0);
+			}
+		}
+
+		ProcessStateDeltaEncoder::RecordType recordType() const {
+			return (ProcessStateDeltaEncoder::RecordType) record[1];
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_ProcessStateDeltaTest);
+
+	TEST_METHOD(1) {
+		set_test_name("The first record of a group is a full record");
+		ensure(encode());
+		ensure_equals(recordType(), ProcessStateDeltaEncoder::FULL);
+		ensureDecodedEqualsState();
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Nothing is encoded if nothing changed");
+		ensure(encode());
+		ensure(!encode());
+		ensure(record.empty());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Deltas only contain the processes and fields that changed");
+		string full;
+
+		encode();
+		full = record;
+		ensureDecodedEqualsState();
+
+		state.processes[1].fields[ProcessStateRecord::SESSIONS] = 3;
+		ensure(encode());
+		ensure_equals(recordType(), ProcessStateDeltaEncoder::DELTA);
+		ensure("The delta is much smaller than a full record",
+			record.size() * 2 < full.size());
+		ensure("The unchanged process isn't in the delta",
+			record.find("gupid-1") == string::npos);
+		ensureDecodedEqualsState();
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Deltas contain added and removed processes");
+		encode();
+		ensureDecodedEqualsState();
+
+		state.processes.erase(state.processes.begin());
+		addProcess("gupid-3", 1003).fields[ProcessStateRecord::CPU] = 50;
+		state.fields[GroupStateRecord::PROCESSES_BEING_SPAWNED] = 1;
+		ensure(encode());
+		ensure_equals(recordType(), ProcessStateDeltaEncoder::DELTA);
+		ensureDecodedEqualsState();
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("A full record is produced every FULL_RECORD_INTERVAL records");
+		encode();
+		for (unsigned int i = 1; i < ProcessStateDeltaEncoder::FULL_RECORD_INTERVAL - 1; i++) {
+			state.fields[GroupStateRecord::CAPACITY_USED] = i;
+			ensure(encode());
+			ensure_equals(recordType(), ProcessStateDeltaEncoder::DELTA);
+		}
+		ensure("Unchanged records count too", !encode());
+		ensure(encode());
+		ensure_equals(recordType(), ProcessStateDeltaEncoder::FULL);
+		ensureDecodedEqualsState();
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Groups that weren't encoded during a cycle are forgotten");
+		encode();
+		ensure(!encoder.encode("/app", state, record));
+		ensure(encoder.encode("/other", state, record));
+		encoder.endCycle();
+		ensure_equals(encoder.getGroupCount(), 2u);
+
+		encoder.encode("/other", state, record);
+		encoder.endCycle();
+		ensure_equals(encoder.getGroupCount(), 1u);
+		ensure(encode());
+		ensure_equals(recordType(), ProcessStateDeltaEncoder::FULL);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("Truncated and corrupted records are rejected");
+		encode();
+		ensure(!ProcessStateDeltaDecoder::apply(StaticString(record.data(),
+			record.size() - 1), decoded));
+		record[0] = 2;
+		ensure(!ProcessStateDeltaDecoder::apply(record, decoded));
+	}
+}
@@ -78,7 +78,9 @@ namespace tut {
 			gatheredOutput.append(data, size);
 		}
 
-		ProcessPtr createProcess() {
+		ProcessPtr createProcess(const SpawningKit::AppMetricsPagePtr &appMetricsPage =
+			SpawningKit::AppMetricsPagePtr())
+		{
 			SpawningKit::Result result;
 
 			result["type"] = "dummy";
@@ -89,6 +91,7 @@ namespace tut {
 			result["spawn_start_time"] = 0;
 			result.adminSocket = adminSocket[0];
 			result.errorPipe = errorPipe[0];
+			result.appMetricsPage = appMetricsPage;
 
 			ProcessPtr process(context.getProcessObjectPool().construct(
 				&groupInfo, result), false);
@@ -204,4 +207,121 @@ namespace tut {
 				&& gatheredOutput.find("errorPipe 2\n") != string::npos;
 		);
 	}
+
+	TEST_METHOD(6) {
+		set_test_name("sessionClosed() keeps a moving average of the session duration");
+		ProcessPtr process = createProcess();
+		ensure(process->avgResponseTime < 0);
+
+		SessionPtr session = process->newSession(SystemTime::getUsec() - 1000000);
+		process->sessionClosed(session.get());
+		ensure("The first sample is taken as-is", process->avgResponseTime >= 1000000);
+
+		double prevAverage = process->avgResponseTime;
+		session = process->newSession();
+		process->sessionClosed(session.get());
+		ensure("Short sessions lower the average", process->avgResponseTime < prevAverage);
+		ensure("The average moves gradually", process->avgResponseTime > prevAverage / 2);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("Socket::checkoutConnection() does not reuse pooled connections "
+			"that the app has closed");
+		// The fixture's socket addresses are only used as labels, so they
+		// don't bother converting the port to host byte order. We really
+		// connect here.
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		getsockname(server1, (struct sockaddr *) &addr, &len);
+		string address = "tcp://127.0.0.1:" + toString(ntohs(addr.sin_port));
+		Socket socket(123, "main1", address, "session", 3);
+
+		Connection connection = socket.checkoutConnection();
+		FileDescriptor serverSide(syscalls::accept(server1, NULL, NULL), __FILE__, __LINE__);
+		connection.fail = false;
+		connection.wantKeepAlive = true;
+		socket.checkinConnection(connection);
+		ensure_equals(socket.totalConnections, 1);
+		ensure_equals(socket.totalIdleConnections, 1);
+
+		serverSide.close();
+		connection = socket.checkoutConnection();
+		ensure_equals(socket.totalConnections, 1);
+		ensure_equals(socket.totalIdleConnections, 0);
+
+		unsigned long long timeout = 1000000;
+		ensure("A new connection was established", waitUntilReadable(server1, &timeout));
+		connection.fail = true;
+		socket.checkinConnection(connection);
+		ensure_equals(socket.totalConnections, 0);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("The routing table entry tracks the process's state as sessions are opened and closed");
+		ProcessPtr process = createProcess();
+		ProcessRoutingTable table;
+		table.add(process->getStickySessionId(), process->busyness(),
+			process->canBeRoutedTo(), process->lastUsed);
+		process->setIndex(0);
+		process->setRoutingTable(&table);
+
+		SessionPtr session1 = process->newSession(1000);
+		SessionPtr session2 = process->newSession(2000);
+		ensure(process->busyness() > 0);
+		ensure_equals(table.getBusyness(0), process->busyness());
+		ensure_equals(table.lastUsed[0], 2000ull);
+		ensure_equals(table.routable[0], (boost::uint8_t) process->canBeRoutedTo());
+
+		process->sessionClosed(session1.get());
+		ensure_equals(table.getBusyness(0), process->busyness());
+		process->forceMaxConcurrency(0);
+		ensure_equals(table.getBusyness(0), 1);
+		ensure(table.routable[0]);
+		process->sessionClosed(session2.get());
+		ensure_equals(table.getBusyness(0), 0);
+		process->setLastUsed(0);
+		ensure_equals(table.lastUsed[0], 0ull);
+		process->setRoutingTable(NULL);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("The process's published metrics are read from its AppMetricsPage");
+		SpawningKit::AppMetricsPagePtr page = SpawningKit::AppMetricsPage::create(
+			getSystemTempDir(), getuid(), getgid());
+		ensure(!page->isInitialized());
+
+		// Write the page the way an application process would.
+		FileDescriptor fd(open(page->getPath().c_str(), O_WRONLY), __FILE__, __LINE__);
+		ensure(fd != -1);
+		page->removeFile();
+		boost::uint64_t fields[5] = { 2, 1000, 3, 4000, 5000 };
+		boost::uint32_t threads[3] = { 1, 4, 0 };
+		ensure_equals(pwrite(fd, "PSGM\x01\0\0\0", 8, 0), (ssize_t) 8);
+		ensure_equals(pwrite(fd, fields, sizeof(fields), 8), (ssize_t) sizeof(fields));
+		ensure_equals(pwrite(fd, threads, sizeof(threads), 48), (ssize_t) sizeof(threads));
+		ensure(page->isInitialized());
+
+		ProcessPtr process = createProcess(page);
+		SpawningKit::AppMetrics appMetrics;
+		ensure(process->getAppMetrics(appMetrics));
+		ensure_equals(appMetrics.updatedAt, 1000ull);
+		ensure_equals(appMetrics.gcCount, 3ull);
+		ensure_equals(appMetrics.gcTime, 4000ull);
+		ensure_equals(appMetrics.heapSize, 5000ull);
+		ensure_equals(appMetrics.threadsBusy, 1u);
+		ensure_equals(appMetrics.threadsTotal, 4u);
+		ensure(!process->isCollectingGarbage());
+
+		threads[2] = SpawningKit::AppMetricsPage::FLAG_GC_IN_PROGRESS;
+		ensure_equals(pwrite(fd, &threads[2], 4, 56), (ssize_t) 4);
+		ensure(process->isCollectingGarbage());
+
+		// A sequence number that is odd means that an update is in progress.
+		fields[0] = 3;
+		ensure_equals(pwrite(fd, fields, 8, 8), (ssize_t) 8);
+		ensure(!process->getAppMetrics(appMetrics));
+
+		ensure(!createProcess()->isCollectingGarbage());
+		ensure(!createProcess()->getAppMetrics(appMetrics));
+	}
 }
@@ -1,9 +1,11 @@
 #include <TestSupport.h>
+#include <zlib.h>
 #include <Constants.h>
 #include <Utils/IOUtils.h>
 #include <Utils/BufferedIO.h>
 #include <Utils/MessageIO.h>
 #include <Core/ApplicationPool/TestSession.h>
+#include <Core/ApplicationPool/Process.h>
 #include <Core/Controller.h>
 
 using namespace std;
@@ -18,6 +20,7 @@ namespace tut {
 			virtual void asyncGetFromApplicationPool(Request *req,
 				ApplicationPool2::GetCallback callback)
 			{
+				checkedOutOptions.push_back(req->options);
 				callback(sessionToReturn, exceptionToReturn);
 				sessionToReturn.reset();
 			}
@@ -25,6 +28,7 @@ namespace tut {
 		public:
 			ApplicationPool2::AbstractSessionPtr sessionToReturn;
 			ApplicationPool2::ExceptionPtr exceptionToReturn;
+			vector< boost::shared_ptr<ApplicationPool2::Options> > checkedOutOptions;
 
 			MyController(ServerKit::Context *context, const VariantMap *agentsOptions)
 				: Core::Controller(context, agentsOptions)
@@ -60,6 +64,9 @@ namespace tut {
 			options.setInt("default_server_port", 80);
 			options.set("server_software", PROGRAM_NAME);
 			options.set("sticky_sessions_cookie_name", DEFAULT_STICKY_SESSIONS_COOKIE_NAME);
+			options.set("routing_policy", DEFAULT_ROUTING_POLICY);
+			options.setBool("serve_x_sendfile", false);
+			options.setBool("response_compression", false);
 			options.setBool("user_switching", false);
 			options.setInt("min_instances", 1);
 			options.setInt("max_preloader_idle_time", DEFAULT_MAX_PRELOADER_IDLE_TIME);
@@ -88,6 +95,10 @@ namespace tut {
 			}
 			safelyClose(serverSocket);
 			unlink("tmp.server");
+			unlink("stub/rack/tmp.xsendfile");
+			unlink("stub/rack/public/tmp.static.css");
+			unlink("stub/rack/public/tmp.static.css.gz");
+			unlink("tmp.trace");
 			setLogLevel(DEFAULT_LOG_LEVEL);
 			bg.stop();
 		}
@@ -119,6 +130,31 @@ namespace tut {
 			writeExact(clientConnection, data);
 		}
 
+		void sendRequestWithFd(const StaticString &data, int fd) {
+			struct msghdr msg;
+			struct iovec iov;
+			union {
+				struct cmsghdr header;
+				char data[CMSG_SPACE(sizeof(int))];
+			} control;
+			struct cmsghdr *controlHeader;
+
+			memset(&msg, 0, sizeof(msg));
+			memset(&control, 0, sizeof(control));
+			iov.iov_base = (void *) data.data();
+			iov.iov_len = data.size();
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control.data;
+			msg.msg_controllen = sizeof(control.data);
+			controlHeader = CMSG_FIRSTHDR(&msg);
+			controlHeader->cmsg_level = SOL_SOCKET;
+			controlHeader->cmsg_type = SCM_RIGHTS;
+			controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(controlHeader), &fd, sizeof(int));
+			ensure_equals(sendmsg(clientConnection, &msg, 0), (ssize_t) data.size());
+		}
+
 		void sendRequestAndWait(const StaticString &data) {
 			unsigned long long totalBytesConsumed = getTotalBytesConsumed();
 			sendRequest(data);
@@ -246,9 +282,150 @@ namespace tut {
 		string readResponseBody() {
 			return clientConnectionIO.readAll();
 		}
+
+		string dechunk(const string &body) {
+			string result;
+			string::size_type pos = 0;
+			while (true) {
+				string::size_type lineEnd = body.find("\r\n", pos);
+				ensure("Chunk size line is terminated", lineEnd != string::npos);
+				unsigned int size = hexToUint(body.substr(pos, lineEnd - pos));
+				pos = lineEnd + 2;
+				if (size == 0) {
+					ensure_equals("Chunked body is terminated",
+						body.substr(pos), string("\r\n"));
+					return result;
+				}
+				result.append(body, pos, size);
+				pos += size;
+				ensure_equals("Chunk is terminated", body.substr(pos, 2), string("\r\n"));
+				pos += 2;
+			}
+		}
+
+		string gunzip(const string &data) {
+			z_stream stream;
+			char buf[1024 * 16];
+			string result;
+			int ret;
+
+			memset(&stream, 0, sizeof(stream));
+			ensure_equals(inflateInit2(&stream, 15 + 16), Z_OK);
+			stream.next_in = (Bytef *) data.data();
+			stream.avail_in = data.size();
+			do {
+				stream.next_out = (Bytef *) buf;
+				stream.avail_out = sizeof(buf);
+				ret = inflate(&stream, Z_NO_FLUSH);
+				result.append(buf, sizeof(buf) - stream.avail_out);
+			} while (ret == Z_OK);
+			inflateEnd(&stream);
+			ensure_equals("The gzip stream is complete", ret, Z_STREAM_END);
+			return result;
+		}
+
+		unsigned int getCoalescedRequestCount() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getCoalescedRequestCount,
+				this, &result));
+			return result;
+		}
+
+		void _getCoalescedRequestCount(unsigned int *result) {
+			*result = controller->inspectStateAsJson()["turbocaching"]
+				["coalesced_requests"].asUInt();
+		}
+
+		unsigned int getTunnelCount() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getTunnelCount,
+				this, &result));
+			return result;
+		}
+
+		void _getTunnelCount(unsigned int *result) {
+			*result = controller->tunnelCount;
+		}
+
+		Json::Value configure(const Json::Value &config) {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_configure,
+				this, config, &result));
+			return result;
+		}
+
+		void _configure(Json::Value config, Json::Value *result) {
+			controller->configure(config);
+			*result = controller->getConfigAsJson();
+			(*result)["free_client_count"] = controller->freeClientCount;
+		}
+
+		Json::Value getTurboCacheStatistics() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getTurboCacheStatistics,
+				this, &result));
+			return result;
+		}
+
+		void _getTurboCacheStatistics(Json::Value *result) {
+			*result = controller->inspectStateAsJson()["turbocaching"]["statistics"];
+		}
+
+		Json::Value getRequestStages() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getRequestStages,
+				this, &result));
+			return result;
+		}
+
+		void _getRequestStages(Json::Value *result) {
+			*result = controller->inspectRequestStagesAsJson();
+		}
+
+		Json::Value getEventLoopState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getEventLoopState,
+				this, &result));
+			return result;
+		}
+
+		void _getEventLoopState(Json::Value *result) {
+			*result = controller->inspectEventLoopAsJson();
+		}
+
+		Json::Value getActiveClientState() {
+			Json::Value result;
+			bg.safe->runSync(boost::bind(&Core_ControllerTest::_getActiveClientState,
+				this, &result));
+			return result;
+		}
+
+		void _getActiveClientState(Json::Value *result) {
+			Json::Value clients = controller->inspectStateAsJson()["active_clients"];
+			if (!clients.empty()) {
+				*result = clients[clients.getMemberNames()[0]];
+			}
+		}
+
+		void writePeerData(unsigned int size) {
+			string chunk(64 * 1024, 'x');
+			while (size > 0) {
+				unsigned int n = std::min<unsigned int>(size, chunk.size());
+				writeExact(testSession.peerFd(), chunk.data(), n);
+				size -= n;
+			}
+		}
+
+		string compressibleBody() {
+			string result;
+			for (int i = 0; i < 100; i++) {
+				result.append("{\"hello\": \"world\"}\n");
+			}
+			return result;
+		}
 	};
 
-	DEFINE_TEST_GROUP(Core_ControllerTest);
+	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ControllerTest, 110);
 
 
 	/***** Passing request information to the app *****/
@@ -292,6 +469,32 @@ namespace tut {
 			"GET /hello?foo=bar HTTP/1.1\r\n"));
 	}
 
+	TEST_METHOD(3) {
+		set_test_name("Session protocol: request headers, including large ones, are passed");
+
+		init();
+		useTestSessionObject();
+
+		string cookie(40000, 'x');
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"X-Foo: bar\r\n"
+			"Cookie: " + cookie + "\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		ensure("(1)", containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("HTTP_X_FOO\0bar\0")));
+		ensure("(2)", containsSubstring(peerRequestHeader,
+			"HTTP_COOKIE" + string(1, '\0') + cookie + string(1, '\0')));
+		ensure("(3)", containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("SERVER_NAME\0localhost\0")));
+	}
+
 
 	/***** Application response body handling *****/
 
@@ -407,6 +610,36 @@ namespace tut {
 		ensure_equals(body, "hello");
 	}
 
+	TEST_METHOD(14) {
+		set_test_name("A Date header is added if the application response doesn't have one");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+
+		string header = readResponseHeader();
+		string::size_type pos = header.find("\r\nDate: ");
+		ensure("(1)", pos != string::npos);
+		string date = header.substr(pos + sizeof("\r\nDate: ") - 1,
+			header.find("\r\n", pos + 2) - pos - sizeof("\r\nDate: ") + 1);
+		ensure_equals("(2)", date.size(), sizeof("Thu, 01 Jan 1970 00:00:00 GMT") - 1);
+		ensure("(3)", date.substr(date.size() - 4) == " GMT");
+	}
+
 
 	/***** Application connection keep-alive *****/
 
@@ -853,4 +1086,1493 @@ namespace tut {
 		string header = readResponseHeader();
 		ensure(containsSubstring(header, "HTTP/1.1 502"));
 	}
+
+
+	/***** X-Sendfile handling *****/
+
+	TEST_METHOD(50) {
+		set_test_name("If serve_x_sendfile is enabled, it serves the file named by X-Sendfile");
+
+		createFile("stub/rack/tmp.xsendfile", "hello world");
+		options.setBool("serve_x_sendfile", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"X-Sendfile: " + absolutizePath("stub/rack/tmp.xsendfile") + "\r\n\r\n");
+
+		string header = readResponseHeader();
+		string body = readResponseBody();
+		ensure(containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure(containsSubstring(header, "Content-Length: 11\r\n"));
+		ensure(!containsSubstring(header, "X-Sendfile"));
+		ensure_equals(body, "hello world");
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("If serve_x_sendfile is enabled, it honors Range requests");
+
+		createFile("stub/rack/tmp.xsendfile", "hello world");
+		options.setBool("serve_x_sendfile", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Range: bytes=6-\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"X-Sendfile: " + absolutizePath("stub/rack/tmp.xsendfile") + "\r\n\r\n");
+
+		string header = readResponseHeader();
+		string body = readResponseBody();
+		ensure(containsSubstring(header, "HTTP/1.1 206 Partial Content\r\n"));
+		ensure(containsSubstring(header, "Content-Range: bytes 6-10/11\r\n"));
+		ensure_equals(body, "world");
+	}
+
+	TEST_METHOD(52) {
+		set_test_name("If serve_x_sendfile is enabled, it refuses to serve files outside the app root");
+
+		options.setBool("serve_x_sendfile", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		setLogLevel(LVL_CRIT);
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"X-Sendfile: /etc/passwd\r\n\r\n");
+
+		string header = readResponseHeader();
+		ensure(containsSubstring(header, "HTTP/1.1 403"));
+	}
+
+	/***** Response compression *****/
+
+	TEST_METHOD(60) {
+		set_test_name("If response_compression is enabled, it gzip-compresses textual"
+			" response bodies for clients that accept gzip");
+
+		options.setBool("response_compression", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Accept-Encoding: deflate, gzip;q=0.5\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		string body = compressibleBody();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Type: application/json; charset=utf-8\r\n"
+			"ETag: \"1234\"\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n"
+			+ body);
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "Content-Encoding: gzip\r\n"));
+		ensure("(2)", containsSubstring(header, "Vary: Accept-Encoding\r\n"));
+		ensure("(3)", containsSubstring(header, "Transfer-Encoding: chunked\r\n"));
+		ensure("(4)", containsSubstring(header, "ETag: W/\"1234\"\r\n"));
+		ensure("(5)", !containsSubstring(header, "Content-Length"));
+		string compressed = dechunk(readResponseBody());
+		ensure("(6)", compressed.size() < body.size());
+		ensure_equals("(7)", gunzip(compressed), body);
+	}
+
+	TEST_METHOD(61) {
+		set_test_name("If response_compression is enabled, it gzip-compresses"
+			" chunked response bodies");
+
+		options.setBool("response_compression", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Accept-Encoding: gzip\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Type: text/html\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n"
+			"5\r\nhello\r\n"
+			"1\r\n \r\n"
+			"5\r\nworld\r\n"
+			"0\r\n\r\n");
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "Content-Encoding: gzip\r\n"));
+		ensure("(2)", containsSubstring(header, "Transfer-Encoding: chunked\r\n"));
+		ensure_equals("(3)", gunzip(dechunk(readResponseBody())), string("hello world"));
+	}
+
+	TEST_METHOD(62) {
+		set_test_name("If response_compression is enabled, it doesn't compress responses"
+			" for clients that refuse gzip");
+
+		options.setBool("response_compression", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Accept-Encoding: *, gzip;q=0\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		string body = compressibleBody();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n"
+			+ body);
+
+		string header = readResponseHeader();
+		ensure("(1)", !containsSubstring(header, "Content-Encoding"));
+		ensure("(2)", containsSubstring(header, "Content-Length: " + toString(body.size()) + "\r\n"));
+		ensure_equals("(3)", readResponseBody(), body);
+	}
+
+	TEST_METHOD(63) {
+		set_test_name("If response_compression is enabled, it doesn't compress"
+			" non-textual or already encoded responses");
+
+		options.setBool("response_compression", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Accept-Encoding: gzip\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		string body = compressibleBody();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Type: image/png\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n\r\n"
+			+ body);
+
+		string header = readResponseHeader();
+		ensure("(1)", !containsSubstring(header, "Content-Encoding"));
+		ensure_equals("(2)", readResponseBody(), body);
+	}
+
+
+	/***** Turbocaching *****/
+
+	TEST_METHOD(70) {
+		set_test_name("Conditional requests for turbocached responses"
+			" are answered with 304 Not Modified");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Cache-Control: public,max-age=99999\r\n"
+			"Content-Type: text/plain\r\n"
+			"ETag: \"abc\"\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"If-None-Match: \"abc\"\r\n"
+			"\r\n");
+
+		string header = readResponseHeader();
+		ensure("(2)", startsWith(header, "HTTP/1.1 304 Not Modified\r\n"));
+		ensure("(3)", containsSubstring(header, "ETag: \"abc\"\r\n"));
+		ensure("(4)", containsSubstring(header, "Cache-Control: public,max-age=99999\r\n"));
+		ensure("(5)", !containsSubstring(header, "Content-Type"));
+		ensure("(6)", !containsSubstring(header, "Content-Length"));
+		ensure_equals("(7)", readResponseBody(), "");
+	}
+
+	TEST_METHOD(71) {
+		set_test_name("If turbocache_coalescing_timeout is set, identical turbocacheable"
+			" requests wait for the first one and are answered from its response");
+
+		options.setUint("turbocache_coalescing_timeout", 5000);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		FileDescriptor otherConnection(connectToUnixServer("tmp.server",
+			__FILE__, __LINE__), NULL, 0);
+		BufferedIO otherConnectionIO(otherConnection);
+		writeExact(otherConnection,
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		EVENTUALLY(5,
+			result = getCoalescedRequestCount() == 1;
+		);
+
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Cache-Control: public,max-age=99999\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello");
+
+		string header = readHeader(otherConnectionIO);
+		ensure("(2)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(3)", containsSubstring(header, "Age: "));
+		ensure_equals("(4)", otherConnectionIO.readAll(), "hello");
+	}
+
+	TEST_METHOD(72) {
+		set_test_name("The X-Passenger-Purge response header is not forwarded to the client");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"X-Passenger-Purge: /foo, /bar*\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", !containsSubstring(header, "X-Passenger-Purge"));
+		ensure_equals("(3)", readResponseBody(), "ok");
+	}
+
+	TEST_METHOD(73) {
+		set_test_name("Turbocaching statistics are kept per application group");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello?foo=bar HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Cache-Control: private\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello");
+
+		EVENTUALLY(5,
+			result = getTurboCacheStatistics().size() == 1;
+		);
+		Json::Value stats = getTurboCacheStatistics();
+		Json::Value group = stats[stats.getMemberNames()[0]];
+		ensure_equals("(2)", group["fetches"].asUInt(), 1u);
+		ensure_equals("(3)", group["hits"].asUInt(), 0u);
+		ensure_equals("(4)", group["stores"].asUInt(), 1u);
+		ensure_equals("(5)", group["store_successes"].asUInt(), 0u);
+		ensure_equals("(6)", group["store_failures"]["cache_control_disallows_storing"].asUInt(), 1u);
+		ensure_equals("(7)", group["top_uncacheable_paths"][0u]["path"].asString(), "/hello");
+		ensure_equals("(8)", group["top_uncacheable_paths"][0u]["count"].asUInt(), 1u);
+	}
+
+	TEST_METHOD(74) {
+		set_test_name("Range requests for turbocached responses are answered"
+			" from the cached body");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Cache-Control: public,max-age=99999\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 11\r\n\r\n"
+			"hello world");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello world");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Range: bytes=6-\r\n"
+			"\r\n");
+
+		string header = readResponseHeader();
+		ensure("(2)", startsWith(header, "HTTP/1.1 206 Partial Content\r\n"));
+		ensure("(3)", containsSubstring(header, "Content-Range: bytes 6-10/11\r\n"));
+		ensure("(4)", containsSubstring(header, "Content-Length: 5\r\n"));
+		ensure("(5)", containsSubstring(header, "Content-Type: text/plain\r\n"));
+		ensure("(6)", !containsSubstring(header, "200 OK"));
+		ensure_equals("(7)", readResponseBody(), "world");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Range: bytes=20-30\r\n"
+			"\r\n");
+
+		header = readResponseHeader();
+		ensure("(10)", startsWith(header, "HTTP/1.1 416 Requested Range Not Satisfiable\r\n"));
+		ensure("(11)", containsSubstring(header, "Content-Range: bytes */11\r\n"));
+		ensure_equals("(12)", readResponseBody(), "");
+	}
+
+	TEST_METHOD(75) {
+		set_test_name("The durations of request processing stages are recorded"
+			" per application group");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello");
+
+		EVENTUALLY(5,
+			result = getRequestStages().size() == 1;
+		);
+		Json::Value stages = getRequestStages();
+		Json::Value group = stages[stages.getMemberNames()[0]];
+		ensure_equals("(2)", group["header_parse"]["count"].asUInt(), 1u);
+		ensure_equals("(3)", group["session_checkout"]["count"].asUInt(), 1u);
+		ensure_equals("(4)", group["app_connect"]["count"].asUInt(), 1u);
+		ensure_equals("(5)", group["app_first_byte"]["count"].asUInt(), 1u);
+		ensure_equals("(6)", group["response_transfer"]["count"].asUInt(), 1u);
+		ensure("(7)", group["app_first_byte"]["p99"].asUInt64()
+			<= group["app_first_byte"]["max"].asUInt64());
+	}
+
+	TEST_METHOD(76) {
+		set_test_name("Event loop iterations and their durations are recorded");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello");
+		readResponseHeader();
+		ensure_equals("(1)", readResponseBody(), "hello");
+
+		Json::Value state = getEventLoopState();
+		ensure("(2)", state["iterations"].asUInt64() > 0);
+		ensure("(3)", state["blocked_time"].asUInt64() > 0);
+		ensure("(4)", state["callbacks_per_iteration"].asDouble() > 0);
+		ensure("(5)", state["utilization"].asDouble() <= 100);
+		ensure("(6)", state["iteration_time"]["p50"].asUInt64()
+			<= state["iteration_time"]["max"].asUInt64());
+	}
+
+	TEST_METHOD(77) {
+		set_test_name("Requests share the pool options of their application, which"
+			" are only replaced when a request changes the per-request sent ones");
+
+		init();
+		// Every checkout fails, so that each request ends with an error response.
+		setLogLevel(LVL_ERROR);
+		controller->exceptionToReturn = boost::make_shared<RequestQueueFullException>(1);
+		for (int i = 0; i < 3; i++) {
+			connectToServer();
+			if (i < 2) {
+				sendRequest(
+					"GET /hello HTTP/1.1\r\n"
+					"Host: localhost\r\n"
+					"Connection: close\r\n"
+					"\r\n");
+			} else {
+				sendRequest(
+					"GET /hello HTTP/1.1\r\n"
+					"Host: localhost\r\n"
+					"Connection: close\r\n"
+					"!~: \r\n"
+					"!~PASSENGER_MAX_REQUESTS: 10\r\n"
+					"\r\n");
+			}
+			ensure(startsWith(readResponseHeader(), "HTTP/1.1 503"));
+		}
+
+		ensure_equals("(1)", controller->checkedOutOptions.size(), 3u);
+		ensure("(2)", controller->checkedOutOptions[0] == controller->checkedOutOptions[1]);
+		ensure_equals("(3)", controller->checkedOutOptions[0]->maxRequests, 0ul);
+		ensure("(4)", controller->checkedOutOptions[2] != controller->checkedOutOptions[1]);
+		ensure_equals("(5)", controller->checkedOutOptions[2]->maxRequests, 10ul);
+		ensure_equals("(6)", controller->checkedOutOptions[2]->getAppGroupName(),
+			controller->checkedOutOptions[0]->getAppGroupName());
+	}
+
+	TEST_METHOD(78) {
+		set_test_name("Upgraded connections enter tunnel mode once the response"
+			" header has been sent, and keep passing data in both directions");
+
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: upgrade\r\n"
+			"Upgrade: text\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		writeExact(testSession.peerFd(),
+			"HTTP/1.1 101 Switching Protocols\r\n"
+			"Connection: upgrade\r\n"
+			"Upgrade: text\r\n\r\n");
+
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 101 Switching Protocols\r\n"));
+		EVENTUALLY(5,
+			result = getTunnelCount() == 1;
+		);
+
+		writeExact(clientConnection, "ping");
+		shutdown(clientConnection, SHUT_WR);
+		ensure_equals("(2)", testSession.getPeerBufferedIO().readAll(), "ping");
+		sendPeerResponse("pong");
+		ensure_equals("(3)", readResponseBody(), "pong");
+		EVENTUALLY(5,
+			result = getTunnelCount() == 0;
+		);
+	}
+
+	TEST_METHOD(79) {
+		set_test_name("Request body buffering: if the client sends the first part of"
+			" the body quickly, a session is checked out right away and the rest"
+			" of the body is streamed to the app");
+
+		options.setUint("request_body_prebuffer_size", 5);
+		options.setUint("request_body_slow_rate", 0);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 10\r\n"
+			"!~: \r\n"
+			"!~FLAGS: B\r\n"
+			"\r\n"
+			"hello");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		ensure("(1)", containsSubstring(peerRequestHeader, "content-length: 10\r\n"));
+
+		char buf[11];
+		unsigned int size;
+		size = testSession.getPeerBufferedIO().read(buf, 5);
+		ensure_equals("(2)", string(buf, size), "hello");
+		sendRequest("world");
+		size = testSession.getPeerBufferedIO().read(buf, 5);
+		ensure_equals("(3)", string(buf, size), "world");
+
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		ensure("(4)", containsSubstring(readResponseHeader(), "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(5)", readResponseBody(), "ok");
+	}
+
+	TEST_METHOD(80) {
+		set_test_name("Request body buffering: if the client sends the first part of"
+			" the body slowly, the entire body is buffered before a session"
+			" is checked out");
+
+		options.setUint("request_body_prebuffer_size", 5);
+		options.setUint("request_body_slow_rate", 1000 * 1000 * 1000);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 10\r\n"
+			"!~: \r\n"
+			"!~FLAGS: B\r\n"
+			"\r\n");
+		syscalls::usleep(20000);
+		sendRequest("hello");
+		SHOULD_NEVER_HAPPEN(100,
+			result = testSession.fd() != -1;
+		);
+		sendRequest("world");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		char buf[11];
+		unsigned int size = testSession.getPeerBufferedIO().read(buf, 10);
+		ensure_equals("(1)", string(buf, size), "helloworld");
+	}
+
+	TEST_METHOD(81) {
+		set_test_name("Pool options that were derived from a symlinked document root"
+			" are recomputed when the symlink starts referring to another release");
+
+		TempDir tempDir("tmp.docroot");
+		string root = absolutizePath("tmp.docroot");
+		makeDirTree(root + "/release1/public");
+		makeDirTree(root + "/release2/public");
+		ensure("(1)", symlink((root + "/release1/public").c_str(),
+			(root + "/public").c_str()) == 0);
+
+		options.setBool("multi_app", true);
+		options.setInt("stat_throttle_rate", 0);
+		init();
+		setLogLevel(LVL_ERROR);
+		controller->exceptionToReturn = boost::make_shared<RequestQueueFullException>(1);
+		for (int i = 0; i < 3; i++) {
+			if (i == 2) {
+				unlink((root + "/public").c_str());
+				ensure("(2)", symlink((root + "/release2/public").c_str(),
+					(root + "/public").c_str()) == 0);
+			}
+			connectToServer();
+			sendRequest(
+				"GET /foo/hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n"
+				"!~: \r\n"
+				"!~PASSENGER_APP_GROUP_NAME: docroot\r\n"
+				"!~PASSENGER_APP_TYPE: rack\r\n"
+				"!~SCRIPT_NAME: /foo\r\n"
+				"!~DOCUMENT_ROOT: " + root + "/public\r\n"
+				"\r\n");
+			ensure(startsWith(readResponseHeader(), "HTTP/1.1 503"));
+		}
+
+		ensure_equals("(3)", controller->checkedOutOptions.size(), 3u);
+		ensure("(4)", controller->checkedOutOptions[0] == controller->checkedOutOptions[1]);
+		ensure_equals("(5)", string(controller->checkedOutOptions[0]->appRoot),
+			root + "/release1");
+		ensure("(6)", controller->checkedOutOptions[2] != controller->checkedOutOptions[1]);
+		ensure_equals("(7)", string(controller->checkedOutOptions[2]->appRoot),
+			root + "/release2");
+	}
+
+	TEST_METHOD(82) {
+		set_test_name("Response headers built from precompiled fragments contain"
+			" the status line, Date, Connection and X-Powered-By headers");
+
+		init();
+		useTestSessionObject();
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.0\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 404 Not Found\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"no");
+
+		string header = readResponseHeader();
+		ensure("(1)", startsWith(header,
+			"HTTP/1.0 404 Not Found\r\nStatus: 404 Not Found\r\n"));
+		ensure("(2)", containsSubstring(header, "\r\nDate: "));
+		ensure("(3)", containsSubstring(header, " GMT\r\nContent-Length: 2\r\n"));
+		ensure("(4)", containsSubstring(header,
+			"Content-Length: 2\r\nX-Powered-By: " PROGRAM_NAME " "));
+		ensure("(5)", !containsSubstring(header, "Connection:"));
+		ensure_equals("(6)", readResponseBody(), "no");
+	}
+
+	TEST_METHOD(83) {
+		set_test_name("Status codes without a known reason phrase get a generic one");
+
+		init();
+		useTestSessionObject();
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 299 Whatever\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+
+		string header = readResponseHeader();
+		ensure("(1)", startsWith(header,
+			"HTTP/1.1 299 Unknown Reason-Phrase\r\nStatus: 299\r\n"));
+		ensure("(2)", containsSubstring(header, "Connection: close\r\nX-Powered-By: "));
+		ensure_equals("(3)", readResponseBody(), "ok");
+	}
+
+	TEST_METHOD(84) {
+		set_test_name("Responses larger than the full buffering size are throttled while"
+			" the client does not keep up, and the client's drain rate is measured");
+
+		options.setUint("response_buffer_full_buffering_size", 128 * 1024);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		const unsigned int bodySize = 8 * 1024 * 1024;
+		string chunk(64 * 1024, 'x');
+		unsigned int written = 0;
+		writeExact(testSession.peerFd(), "HTTP/1.1 200 OK\r\n"
+			"Content-Length: " + toString(bodySize) + "\r\n\r\n");
+		setNonBlocking(testSession.peerFd());
+		for (int i = 0; i < 30; i++) {
+			ssize_t ret;
+			do {
+				ret = write(testSession.peerFd(), chunk.data(),
+					std::min<size_t>(chunk.size(), bodySize - written));
+				if (ret > 0) {
+					written += ret;
+				}
+			} while (ret > 0 && written < bodySize);
+			syscalls::usleep(10000);
+		}
+		setBlocking(testSession.peerFd());
+		ensure("(1)", written < bodySize / 2);
+
+		TempThread thr(boost::bind(&Core_ControllerTest::writePeerData, this,
+			bodySize - written));
+		readResponseHeader();
+		string body(bodySize, '\0');
+		ensure_equals("(2)", clientConnectionIO.read(&body[0], bodySize), bodySize);
+		thr.join();
+
+		Json::Value state = getActiveClientState();
+		ensure("(3)", state.isMember("response_drain_rate"));
+		ensure("(4)", state["response_drain_rate"].asDouble() > 0);
+	}
+
+	TEST_METHOD(85) {
+		set_test_name("The session is released once the app response body has been"
+			" received completely, even if the client has not read it yet");
+
+		options.setUint("response_buffer_full_buffering_size", 16 * 1024);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		const unsigned int bodySize = 16 * 1024 + 256 * 1024;
+		writeExact(testSession.peerFd(), "HTTP/1.1 200 OK\r\n"
+			"Content-Length: " + toString(bodySize) + "\r\n\r\n");
+		TempThread thr(boost::bind(&Core_ControllerTest::writePeerData, this,
+			bodySize));
+		EVENTUALLY(5,
+			result = testSession.isClosed();
+		);
+		thr.join();
+
+		readResponseHeader();
+		string body(bodySize, '\0');
+		ensure_equals(clientConnectionIO.read(&body[0], bodySize), bodySize);
+	}
+
+	TEST_METHOD(86) {
+		set_test_name("Large Content-Length request bodies are spliced to the application");
+
+		init();
+		useTestSessionObject();
+
+		const unsigned int bodySize = 1024 * 1024;
+		string body;
+		body.reserve(bodySize);
+		for (unsigned int i = 0; i < bodySize; i++) {
+			body.append(1, (char) ('a' + i % 23));
+		}
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Content-Length: " + toString(bodySize) + "\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+
+		BufferedIO &peerIO = testSession.getPeerBufferedIO();
+		string received(bodySize, '\0');
+		TempThread thr(boost::bind(&Core_ControllerTest::sendRequest, this,
+			StaticString(body.data(), bodySize / 2)));
+		ensure_equals("(1)", peerIO.read(&received[0], bodySize / 2), bodySize / 2);
+		thr.join();
+
+		Json::Value state = getActiveClientState();
+		ensure("(2)", state["current_request"]["flags"]["splicing_request_body"].asBool());
+
+		TempThread thr2(boost::bind(&Core_ControllerTest::sendRequest, this,
+			StaticString(body.data() + bodySize / 2, bodySize - bodySize / 2)));
+		ensure_equals("(3)", peerIO.read(&received[bodySize / 2], bodySize - bodySize / 2),
+			bodySize - bodySize / 2);
+		thr2.join();
+		ensure("(4)", received == body);
+
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		string header = readResponseHeader();
+		char response[2];
+		ensure("(5)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(6)", clientConnectionIO.read(response, 2), 2u);
+		ensure_equals("(7)", StaticString(response, 2), StaticString("ok"));
+	}
+	TEST_METHOD(87) {
+		set_test_name("Requests for probe paths are answered without checking out a session");
+
+		vector<string> probePaths;
+		probePaths.push_back("/health");
+		options.setStrSet("probe_paths", probePaths);
+		init();
+
+		connectToServer();
+		sendRequest(
+			"GET /health?verbose=1 HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		char body[3];
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(header, "Content-Length: 3\r\n"));
+		ensure_equals("(3)", clientConnectionIO.read(body, 3), 3u);
+		ensure_equals("(4)", StaticString(body, 3), StaticString("ok\n"));
+
+		sendRequest(
+			"HEAD /health HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		header = readResponseHeader();
+		ensure("(5)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(6)", clientConnectionIO.readAll(), "");
+		ensure_equals("(7)", controller->checkedOutOptions.size(), 0u);
+	}
+
+	TEST_METHOD(88) {
+		set_test_name("Requests for other paths or with other methods are forwarded to the app");
+
+		vector<string> probePaths;
+		probePaths.push_back("/health");
+		options.setStrSet("probe_paths", probePaths);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"POST /health HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		ensure_equals(controller->checkedOutOptions.size(), 1u);
+	}
+
+	/***** Static file serving *****/
+
+	TEST_METHOD(89) {
+		set_test_name("If serve_static_files is enabled, it serves files in the public directory "
+			"without checking out a session");
+
+		createFile("stub/rack/public/tmp.static.css", "body {}");
+		options.setBool("serve_static_files", true);
+		init();
+
+		connectToServer();
+		sendRequest(
+			"GET /tmp.static.css?v=1 HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		char body[7];
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(header, "Content-Type: text/css\r\n"));
+		ensure("(3)", containsSubstring(header, "Content-Length: 7\r\n"));
+		ensure("(4)", containsSubstring(header, "Last-Modified: "));
+		ensure_equals("(5)", clientConnectionIO.read(body, 7), 7u);
+		ensure_equals("(6)", StaticString(body, 7), StaticString("body {}"));
+
+		string etag = header.substr(header.find("ETag: ") + sizeof("ETag: ") - 1);
+		etag = etag.substr(0, etag.find("\r\n"));
+		sendRequest(
+			"GET /tmp.static.css HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"If-None-Match: " + etag + "\r\n"
+			"\r\n");
+		header = readResponseHeader();
+		ensure("(7)", containsSubstring(header, "HTTP/1.1 304 Not Modified\r\n"));
+		ensure_equals("(8)", clientConnectionIO.readAll(), "");
+		ensure_equals("(9)", controller->checkedOutOptions.size(), 0u);
+	}
+
+	TEST_METHOD(90) {
+		set_test_name("If serve_static_files is enabled, it serves precompressed variants "
+			"to clients that accept gzip");
+
+		createFile("stub/rack/public/tmp.static.css", "body {}");
+		createFile("stub/rack/public/tmp.static.css.gz", "gzipped");
+		options.setBool("serve_static_files", true);
+		init();
+
+		connectToServer();
+		sendRequest(
+			"GET /tmp.static.css HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Accept-Encoding: gzip, deflate\r\n"
+			"\r\n");
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(header, "Content-Type: text/css\r\n"));
+		ensure("(3)", containsSubstring(header, "Content-Encoding: gzip\r\n"));
+		ensure("(4)", containsSubstring(header, "Vary: Accept-Encoding\r\n"));
+		ensure_equals("(5)", clientConnectionIO.readAll(), "gzipped");
+	}
+
+	TEST_METHOD(91) {
+		set_test_name("If serve_static_files is enabled, requests for nonexistent files "
+			"are forwarded to the app");
+
+		options.setBool("serve_static_files", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /tmp.nonexistent.css HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		ensure_equals(controller->checkedOutOptions.size(), 1u);
+	}
+
+	TEST_METHOD(92) {
+		set_test_name("If the web server sends the F flag, X-Sendfile file bodies are"
+			" delegated to the web server with an X-Passenger-File header");
+
+		createFile("stub/rack/tmp.xsendfile", "hello world");
+		options.setBool("serve_x_sendfile", true);
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Range: bytes=6-\r\n"
+			"!~: \r\n"
+			"!~FLAGS: F\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"X-Sendfile: " + absolutizePath("stub/rack/tmp.xsendfile") + "\r\n\r\n");
+
+		string header = readResponseHeader();
+		string body = readResponseBody();
+		ensure(containsSubstring(header, "HTTP/1.1 206 Partial Content\r\n"));
+		ensure(containsSubstring(header, "Content-Length: 5\r\n"));
+		ensure(containsSubstring(header, "X-Passenger-File: 6 5 "
+			+ absolutizePath("stub/rack/tmp.xsendfile") + "\r\n"));
+		ensure_equals(body, "");
+	}
+
+	TEST_METHOD(93) {
+		set_test_name("X-Passenger-File headers from the app are not forwarded");
+
+		init();
+		useTestSessionObject();
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"!~: \r\n"
+			"!~FLAGS: F\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 2\r\n"
+			"X-Passenger-File: 0 11 /etc/passwd\r\n\r\n"
+			"ok");
+
+		string header = readResponseHeader();
+		string body = readResponseBody();
+		ensure(!containsSubstring(header, "X-Passenger-File"));
+		ensure_equals(body, "ok");
+	}
+
+	TEST_METHOD(94) {
+		set_test_name("Request body buffering: a buffered body that was moved to"
+			" a buffer file is passed to apps that accept it as a file descriptor");
+
+		context.defaultFileBufferedChannelConfig.threshold = 1024;
+		init();
+		useTestSessionObject();
+		testSession.setAcceptsRequestBodyFd(true);
+
+		string body;
+		for (unsigned int i = 0; i < 4096; i++) {
+			body.append(toString(i));
+		}
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n"
+			"!~: \r\n"
+			"!~FLAGS: B\r\n"
+			"\r\n" + body);
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		ensure("(1)", containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("PASSENGER_REQUEST_BODY_FD\0" "1\0")));
+		FileDescriptor bodyFd(readFileDescriptor(testSession.peerFd()), NULL, 0);
+		ensure_equals("(2)", readAll(bodyFd), body);
+		ensure_equals("(3)", readAll(testSession.peerFd()), "");
+
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		ensure("(4)", containsSubstring(readResponseHeader(), "HTTP/1.1 200 OK\r\n"));
+		ensure_equals("(5)", readResponseBody(), "ok");
+	}
+
+	TEST_METHOD(95) {
+		set_test_name("Request body buffering: a buffered body that was moved to"
+			" a buffer file is sent over the socket to apps that don't accept it"
+			" as a file descriptor");
+
+		context.defaultFileBufferedChannelConfig.threshold = 1024;
+		init();
+		useTestSessionObject();
+
+		string body;
+		for (unsigned int i = 0; i < 4096; i++) {
+			body.append(toString(i));
+		}
+
+		connectToServer();
+		sendRequest(
+			"POST /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: " + toString(body.size()) + "\r\n"
+			"!~: \r\n"
+			"!~FLAGS: B\r\n"
+			"\r\n" + body);
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		ensure("(1)", !containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("PASSENGER_REQUEST_BODY_FD")));
+		ensure_equals("(2)", readAll(testSession.peerFd()), body);
+	}
+
+
+	/***** Request tracing *****/
+
+	TEST_METHOD(96) {
+		set_test_name("If request tracing is enabled, it records the sizes, timings"
+			" and routing decision of requests");
+
+		RequestTraceRecorderPtr recorder = boost::make_shared<RequestTraceRecorder>(
+			"tmp.trace", 4, 1);
+		controller = new MyController(&context, &options);
+		controller->requestTraceRecorder = recorder;
+		controller->listen(serverSocket);
+		startLoop();
+		useTestSessionObject();
+
+		string request =
+			"POST /hello?secret=1 HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 3\r\n"
+			"\r\n";
+		connectToServer();
+		sendRequest(request + "abc");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		writeExact(testSession.peerFd(),
+			"HTTP/1.1 201 Created\r\n"
+			"Content-Length: 2\r\n"
+			"\r\n"
+			"ok");
+		string response = clientConnectionIO.readAll();
+		EVENTUALLY(5,
+			result = recorder->getRecordCount() == 1;
+		);
+
+		RequestTraceRecord record;
+		memcpy(&record, readAll("tmp.trace").data() + 32, sizeof(record));
+		ensure_equals("(1)", record.sequence, 1u);
+		ensure_equals("(2)", (int) record.method, (int) HTTP_POST);
+		ensure_equals("(3)", record.headerSize, request.size());
+		ensure_equals("(4)", record.requestBodySize, 3u);
+		ensure_equals("(5)", record.responseSize, response.size());
+		ensure_equals("(6)", record.statusCode, 201);
+		ensure_equals("(7)", record.pid, 123);
+		ensure_equals("(8)", record.pathHash, recorder->hash("/hello", 6));
+		ensure_equals("(9)", (int) record.flags,
+			RequestTraceRecorder::RTF_CHECKED_OUT | RequestTraceRecorder::RTF_APP_RESPONDED);
+		ensure("(10)", record.arrivalTime <= SystemTime::getUsec());
+	}
+
+	TEST_METHOD(97) {
+		set_test_name("configure() changes buffer, turbocache and freelist settings"
+			" of a running Controller");
+
+		init();
+		Json::Value config;
+		config["response_buffer_high_watermark"] = 1234;
+		config["request_body_prebuffer_size"] = 2345;
+		config["file_buffer_threshold"] = 4321;
+		config["turbocache_max_body_size"] = 99;
+		config["turbocache_coalescing_timeout"] = 250;
+		config["min_spare_clients"] = 5;
+		config["accept_burst_count"] = 1000;
+
+		Json::Value result = configure(config);
+		ensure_equals("(1)", result["response_buffer_high_watermark"].asUInt(), 1234u);
+		ensure_equals("(2)", result["request_body_prebuffer_size"].asUInt(), 2345u);
+		ensure_equals("(3)", result["file_buffer_threshold"].asUInt(), 4321u);
+		ensure_equals("(4)", result["turbocache_max_body_size"].asUInt(), 99u);
+		ensure_equals("(5)", result["turbocache_coalescing_timeout"].asUInt(), 250u);
+		// The freelist is topped up right away.
+		ensure_equals("(6)", result["free_client_count"].asUInt(), 5u);
+		// Values are clamped to what the fields can hold.
+		ensure_equals("(7)", result["accept_burst_count"].asUInt(), 127u);
+	}
+
+	TEST_METHOD(98) {
+		set_test_name("If websocket_drain_time is set, upgraded connections to a detached"
+			" process are disconnected within the drain window, and the progress"
+			" is reported by the process");
+
+		SpawningKit::ConfigPtr spawningKitConfig = boost::make_shared<SpawningKit::Config>();
+		spawningKitConfig->resourceLocator = resourceLocator;
+		spawningKitConfig->finalize();
+		ApplicationPool2::Context poolContext;
+		poolContext.setSpawningKitFactory(boost::make_shared<SpawningKit::Factory>(
+			spawningKitConfig));
+		poolContext.finalize();
+		ApplicationPool2::BasicGroupInfo groupInfo;
+		groupInfo.context = &poolContext;
+		groupInfo.group = NULL;
+		groupInfo.name = "test";
+		SpawningKit::Result spawnResult;
+		spawnResult["type"] = "dummy";
+		spawnResult["pid"] = 123;
+		spawnResult["gupid"] = "gupid-123";
+		spawnResult["sockets"] = Json::Value(Json::arrayValue);
+		spawnResult["spawner_creation_time"] = 0;
+		spawnResult["spawn_start_time"] = 0;
+		ApplicationPool2::ProcessPtr process(poolContext.getProcessObjectPool().construct(
+			&groupInfo, spawnResult), false);
+		process->shutdownNotRequired();
+
+		options.setUint("websocket_drain_time", 1);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: upgrade\r\n"
+			"Upgrade: text\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		writeExact(testSession.peerFd(),
+			"HTTP/1.1 101 Switching Protocols\r\n"
+			"Connection: upgrade\r\n"
+			"Upgrade: text\r\n\r\n");
+		string header = readResponseHeader();
+		ensure("(1)", containsSubstring(header, "HTTP/1.1 101 Switching Protocols\r\n"));
+		EVENTUALLY(5,
+			result = getTunnelCount() == 1;
+		);
+
+		bg.safe->runSync(boost::bind(&MyController::disconnectLongRunningConnections,
+			controller, process, true));
+		EVENTUALLY(5,
+			result = process->drainedConnections.load() == 1;
+		);
+		ensure_equals("(2)", process->drainingConnections.load(), 0u);
+		ensure_equals("(3)", readResponseBody(), "");
+
+		stringstream xml;
+		process->inspectXml(xml, false);
+		ensure("(4)", containsSubstring(xml.str(),
+			"<draining_connections>0</draining_connections>"
+			"<drained_connections>1</drained_connections>"));
+	}
+
+	TEST_METHOD(99) {
+		set_test_name("A request that the web server hands off together with the client"
+			" connection is answered on that connection, which is then closed");
+
+		options.setBool("accept_client_handoff", true);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		SocketPair browser = createUnixSocketPair(__FILE__, __LINE__);
+		connectToServer();
+		sendRequestWithFd(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: keep-alive\r\n"
+			"!~: \r\n"
+			"!~FLAGS: CH\r\n"
+			"\r\n",
+			browser.second);
+		// Like the web server, we don't keep any copies.
+		browser.second.close();
+		clientConnection.close();
+
+		waitUntilSessionInitiated();
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+
+		string response = readAll(browser.first);
+		ensure("(1)", startsWith(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(response, "Connection: close\r\n"));
+		ensure_equals("(3)", response.substr(response.find("\r\n\r\n") + 4), "ok");
+	}
+
+	TEST_METHOD(100) {
+		set_test_name("A handed off request without a client connection is refused");
+
+		options.setBool("accept_client_handoff", true);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"!~: \r\n"
+			"!~FLAGS: CH\r\n"
+			"\r\n");
+		setLogLevel(LVL_CRIT);
+		ensure_equals("(1)", readResponseBody(), "");
+		ensure_equals("(2)", controller->checkedOutOptions.size(), 0u);
+	}
+
+	/***** Rate limiting *****/
+
+	TEST_METHOD(101) {
+		set_test_name("Requests that exceed the rate limit of their rate limit key are"
+			" answered with 429 Too Many Requests without checking out a session");
+
+		options.set("rate_limit_key", "header:X-Client");
+		// Allows a burst of 2 requests, and refills too slowly for this test.
+		options.setUint("rate_limit", 1);
+		options.setUint("rate_limit_burst", 2);
+		controller = new MyController(&context, &options);
+		controller->rateLimiter = boost::make_shared<RateLimiter>(1);
+		controller->listen(serverSocket);
+		startLoop();
+		// Every checkout fails, so that each request ends with an error response.
+		setLogLevel(LVL_ERROR);
+		controller->exceptionToReturn = boost::make_shared<RequestQueueFullException>(1);
+
+		for (int i = 0; i < 4; i++) {
+			connectToServer();
+			sendRequest(
+				"GET /hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n"
+				"X-Client: " + string(i < 3 ? "a" : "b") + "\r\n"
+				"\r\n");
+			string header = readResponseHeader();
+			if (i == 2) {
+				ensure("(1)", startsWith(header, "HTTP/1.1 429 Too Many Requests\r\n"));
+				ensure("(2)", containsSubstring(header, "Retry-After: 1\r\n"));
+				ensure_equals("(3)", readResponseBody(), "Too many requests\n");
+			} else {
+				ensure("(4)", startsWith(header, "HTTP/1.1 503"));
+			}
+		}
+		ensure_equals("(5)", controller->checkedOutOptions.size(), 3u);
+	}
+
+	TEST_METHOD(102) {
+		set_test_name("Requests beyond the maximum number in flight per rate limit key"
+			" are answered with 429 Too Many Requests until a request ends");
+
+		options.setUint("max_requests_in_flight", 1);
+		controller = new MyController(&context, &options);
+		controller->rateLimiter = boost::make_shared<RateLimiter>(1);
+		controller->listen(serverSocket);
+		startLoop();
+		useTestSessionObject();
+
+		string request =
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n";
+		FileDescriptor first = connectToServer();
+		sendRequest(request);
+		waitUntilSessionInitiated();
+
+		connectToServer();
+		sendRequest(request);
+		ensure("(1)", startsWith(readResponseHeader(), "HTTP/1.1 429 Too Many Requests\r\n"));
+
+		readPeerRequestHeader();
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		ensure("(2)", startsWith(readAll(first), "HTTP/1.1 200 OK\r\n"));
+
+		setLogLevel(LVL_ERROR);
+		controller->exceptionToReturn = boost::make_shared<RequestQueueFullException>(1);
+		connectToServer();
+		sendRequest(request);
+		ensure("(3)", startsWith(readResponseHeader(), "HTTP/1.1 503"));
+		ensure_equals("(4)", controller->checkedOutOptions.size(), 2u);
+	}
+
+	TEST_METHOD(103) {
+		set_test_name("App groups can set their own rate limits, and rate limit keys"
+			" are counted separately per app group");
+
+		options.setBool("multi_app", true);
+		options.set("rate_limit_key", "header:X-Client");
+		controller = new MyController(&context, &options);
+		controller->rateLimiter = boost::make_shared<RateLimiter>(1);
+		controller->listen(serverSocket);
+		startLoop();
+		setLogLevel(LVL_ERROR);
+		controller->exceptionToReturn = boost::make_shared<RequestQueueFullException>(1);
+
+		for (int i = 0; i < 4; i++) {
+			connectToServer();
+			sendRequest(
+				"GET /hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n"
+				"X-Client: a\r\n"
+				"!~: \r\n"
+				"!~PASSENGER_APP_GROUP_NAME: " + string(i < 3 ? "limited" : "other") + "\r\n"
+				"!~PASSENGER_APP_ROOT: stub/rack\r\n"
+				"!~PASSENGER_APP_TYPE: rack\r\n"
+				"!~PASSENGER_RATE_LIMIT: " + string(i < 3 ? "1" : "0") + "\r\n"
+				"!~PASSENGER_RATE_LIMIT_BURST: 2\r\n"
+				"\r\n");
+			string header = readResponseHeader();
+			if (i == 2) {
+				ensure("(1)", startsWith(header, "HTTP/1.1 429 Too Many Requests\r\n"));
+			} else {
+				ensure("(2)", startsWith(header, "HTTP/1.1 503"));
+			}
+		}
+		ensure_equals("(3)", controller->checkedOutOptions.size(), 3u);
+	}
+
+	TEST_METHOD(104) {
+		set_test_name("Keys that don't fit in the RateLimiter's table are denied, not let through");
+
+		RateLimiter limiter(1);
+		MonotonicTimeUsec now = 1000000;
+		unsigned int i;
+
+		// Entries with leased slots can't be taken over by other keys.
+		for (i = 0; i < RateLimiter::STRIPES * RateLimiter::SLOTS_PER_STRIPE * 4; i++) {
+			string key = "key" + toString(i);
+			limiter.leaseSlots(key, 1, now);
+		}
+		ensure_equals("(1)", limiter.inspectStateAsJson()["entries"].asUInt(),
+			RateLimiter::STRIPES * RateLimiter::SLOTS_PER_STRIPE);
+		ensure_equals("(2)", limiter.leaseSlots(string("new"), 1, now), 0u);
+		ensure_equals("(3)", limiter.leaseTokens(string("new"), 1, 1, now), 0u);
+		ensure("(4)", limiter.inspectStateAsJson()["overflow_denied_leases"].asUInt() > 0);
+
+		// Once a key returns its slot, its entry can be reused.
+		for (i = 0; i < RateLimiter::STRIPES * RateLimiter::SLOTS_PER_STRIPE * 4; i++) {
+			string key = "key" + toString(i);
+			limiter.returnLeases(key, 0, 1, now);
+		}
+		ensure_equals("(5)", limiter.leaseSlots(string("new"), 1, now), 1u);
+	}
 }
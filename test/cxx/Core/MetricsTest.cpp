@@ -0,0 +1,84 @@
+#include <TestSupport.h>
+#include <Core/Metrics.h>
+
+using namespace Passenger;
+using namespace Passenger::Core;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct Core_MetricsTest {
+		struct mbuf_pool pool;
+
+		Core_MetricsTest() {
+			pool.mbuf_block_chunk_size = 128;
+			mbuf_pool_init(&pool);
+		}
+
+		~Core_MetricsTest() {
+			mbuf_pool_deinit(&pool);
+		}
+
+		string render(const MetricsWriter &writer) {
+			string result;
+			vector<mbuf>::const_iterator it;
+			for (it = writer.buffers.begin(); it != writer.buffers.end(); it++) {
+				result.append(it->start, it->size());
+			}
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_MetricsTest);
+
+	TEST_METHOD(1) {
+		set_test_name("It renders headers and samples in the text exposition format");
+		MetricsWriter writer(&pool);
+		writer.writeHeader("foo_total", "counter", "Foos.");
+		writer.writeSample("foo_total", 1);
+		writer.writeSample("foo_total", "thread", "2", 34);
+		writer.writeSample("foo_total", "thread", "2", "status", "5xx", 18446744073709551615ull);
+		writer.finish();
+
+		ensure_equals(render(writer),
+			"# HELP foo_total Foos.\n"
+			"# TYPE foo_total counter\n"
+			"foo_total 1\n"
+			"foo_total{thread=\"2\"} 34\n"
+			"foo_total{thread=\"2\",status=\"5xx\"} 18446744073709551615\n");
+		ensure_equals(writer.size(), (boost::uint64_t) render(writer).size());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It escapes backslashes, double quotes and newlines in label values");
+		MetricsWriter writer(&pool);
+		writer.writeSample("foo", "group", "a\\b\"c\nd", 1);
+		writer.finish();
+		ensure_equals(render(writer), "foo{group=\"a\\\\b\\\"c\\nd\"} 1\n");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Output that does not fit in a single mbuf spans multiple mbufs");
+		MetricsWriter writer(&pool);
+		string expected;
+
+		for (unsigned int i = 0; i < 100; i++) {
+			writer.writeSample("passenger_group_sessions", "group", "/app" + toString(i), i);
+			expected.append("passenger_group_sessions{group=\"/app" + toString(i)
+				+ "\"} " + toString(i) + "\n");
+		}
+		writer.finish();
+
+		ensure("(1)", writer.buffers.size() > 1);
+		ensure_equals("(2)", render(writer), expected);
+		ensure_equals("(3)", writer.size(), (boost::uint64_t) expected.size());
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Writing nothing produces no mbufs");
+		MetricsWriter writer(&pool);
+		writer.finish();
+		ensure_equals(writer.buffers.size(), 0u);
+		ensure_equals(writer.size(), (boost::uint64_t) 0);
+	}
+}
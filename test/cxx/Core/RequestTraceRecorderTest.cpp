@@ -0,0 +1,76 @@
+#include <TestSupport.h>
+#include <Core/RequestTraceRecorder.h>
+#include <Utils/IOUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::Core;
+using namespace std;
+
+namespace tut {
+	struct Core_RequestTraceRecorderTest {
+		~Core_RequestTraceRecorderTest() {
+			unlink("tmp.trace");
+		}
+
+		RequestTraceRecord makeRecord(unsigned int i) {
+			RequestTraceRecord record;
+			memset(&record, 0, sizeof(record));
+			record.arrivalTime = 1000 + i;
+			record.responseSize = i * 10;
+			record.method = 1;
+			return record;
+		}
+
+		RequestTraceRecord readRecord(const string &data, unsigned int slot) {
+			RequestTraceRecord record;
+			memcpy(&record, data.data() + 32 + slot * sizeof(RequestTraceRecord),
+				sizeof(record));
+			return record;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_RequestTraceRecorderTest);
+
+	TEST_METHOD(1) {
+		set_test_name("It creates a file with a header and room for the given number of records");
+		RequestTraceRecorder recorder("tmp.trace", 4, 10);
+		string data = readAll("tmp.trace");
+		boost::uint32_t fields[4];
+
+		ensure_equals("(1)", data.size(), 32 + 4 * sizeof(RequestTraceRecord));
+		ensure_equals("(2)", data.substr(0, 8), "PSGTRACE");
+		memcpy(fields, data.data() + 8, sizeof(fields));
+		ensure_equals("(3)", fields[0], 1u);
+		ensure_equals("(4)", fields[1], 64u);
+		ensure_equals("(5)", fields[2], 4u);
+		ensure_equals("(6)", fields[3], 10u);
+		ensure_equals("(7)", readRecord(data, 0).sequence, 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Records are numbered, and overwrite the oldest ones once the file is full");
+		RequestTraceRecorder recorder("tmp.trace", 4, 1);
+		for (unsigned int i = 1; i <= 6; i++) {
+			recorder.record(makeRecord(i));
+		}
+		ensure_equals("(1)", recorder.getRecordCount(), 6u);
+
+		string data = readAll("tmp.trace");
+		ensure_equals("(2)", readRecord(data, 0).sequence, 5u);
+		ensure_equals("(3)", readRecord(data, 0).arrivalTime, 1005u);
+		ensure_equals("(4)", readRecord(data, 1).sequence, 6u);
+		ensure_equals("(5)", readRecord(data, 1).responseSize, 60u);
+		ensure_equals("(6)", readRecord(data, 2).sequence, 3u);
+		ensure_equals("(7)", readRecord(data, 3).sequence, 4u);
+		ensure_equals("(8)", readRecord(data, 3).method, 1);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Hashes are salted per recorder");
+		RequestTraceRecorder recorder1("tmp.trace", 1, 1);
+		RequestTraceRecorder recorder2("tmp.trace", 1, 1);
+		ensure_equals("(1)", recorder1.hash("/foo", 4), recorder1.hash("/foo", 4));
+		ensure("(2)", recorder1.hash("/foo", 4) != recorder1.hash("/bar", 4));
+		ensure("(3)", recorder1.hash("/foo", 4) != recorder2.hash("/foo", 4));
+	}
+}
@@ -5,6 +5,7 @@
 #include <Core/Controller/Request.h>
 #include <Core/Controller/AppResponse.h>
 #include <Core/ResponseCache.h>
+#include <Core/SharedResponseCache.h>
 
 using namespace Passenger;
 using namespace Passenger::Core;
@@ -18,8 +19,12 @@ namespace tut {
 		ResponseCacheType responseCache;
 		Request req;
 		StaticString defaultVaryTurbocacheByCookie;
+		SharedResponseCache sharedCache;
+		ResponseCacheType otherResponseCache;
 
-		Core_ResponseCacheTest() {
+		Core_ResponseCacheTest()
+			: sharedCache(1024 * 1024)
+		{
 			req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 			reset();
 		}
@@ -62,7 +67,10 @@ namespace tut {
 			req.appResponseInitialized = false;
 			req.strip100ContinueHeader = false;
 			req.hasPragmaHeader = false;
+			req.acceptsGzip = false;
+			req.compressResponse = false;
 			req.host = createHostString();
+			req.tenant = StaticString();
 			req.bodyBytesBuffered = 0;
 			req.cacheKey = HashedStaticString();
 			req.cacheControl = NULL;
@@ -84,6 +92,7 @@ namespace tut {
 			req.appResponse.cacheControl  = NULL;
 			req.appResponse.expiresHeader = NULL;
 			req.appResponse.lastModifiedHeader = NULL;
+			req.appResponse.varyHeader = NULL;
 			req.appResponse.headerCacheBuffers = NULL;
 			req.appResponse.nHeaderCacheBuffers = 0;
 			psg_lstr_init(&req.appResponse.bodyCacheBuffer);
@@ -145,6 +154,30 @@ namespace tut {
 			req.appResponse.bodyType = AppResponse::RBT_CONTENT_LENGTH;
 			req.appResponse.aux.bodyInfo.contentLength = body.size();
 		}
+
+		void useSharedCache() {
+			responseCache.setSharedCache(&sharedCache);
+			otherResponseCache.setSharedCache(&sharedCache);
+		}
+
+		// Stores a cacheable response with the given header and body data,
+		// like Controller::storeAppResponseInTurboCache() does.
+		void storeWithData(ResponseCacheType &cache, const string &header,
+			const string &body)
+		{
+			initCacheableResponse();
+			initResponseBody(body);
+			ensure("(storeWithData 1)", cache.prepareRequest(this, &req));
+			ensure("(storeWithData 2)", cache.requestAllowsStoring(&req));
+			ensure("(storeWithData 3)", cache.prepareRequestForStoring(&req));
+
+			ResponseCacheType::Entry entry(cache.store(&req, time(NULL),
+				header.size(), body.size()));
+			ensure("(storeWithData 4)", entry.valid());
+			memcpy(entry.body->httpHeaderData, header.data(), header.size());
+			memcpy(entry.body->httpBodyData, body.data(), body.size());
+			cache.storeInSharedCache(entry);
+		}
 	};
 
 	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ResponseCacheTest, 100);
@@ -230,6 +263,26 @@ namespace tut {
 		ensure("(3)", !entry2.valid());
 	}
 
+	TEST_METHOD(12) {
+		set_test_name("Tenants don't fetch each other's entries");
+		req.tenant = "a";
+		storeWithData(responseCache, "content-length: 5\r\n", "hello");
+
+		reset();
+		req.tenant = "b";
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", !responseCache.fetch(&req, time(NULL)).valid());
+
+		reset();
+		ensure("(3)", responseCache.prepareRequest(this, &req));
+		ensure("(4)", !responseCache.fetch(&req, time(NULL)).valid());
+
+		reset();
+		req.tenant = "a";
+		ensure("(5)", responseCache.prepareRequest(this, &req));
+		ensure("(6)", responseCache.fetch(&req, time(NULL)).valid());
+	}
+
 
 	/***** Checking whether request should be fetched from cache *****/
 
@@ -410,10 +463,10 @@ namespace tut {
 	}
 
 	TEST_METHOD(48) {
-		set_test_name("It fails if the response has a Vary header");
+		set_test_name("It fails if the response has a Vary: * header");
 		initCacheableResponse();
 		insertAppResponseHeader(createHeader(
-			"vary", "foo"),
+			"vary", "accept-language, *"),
 			req.pool);
 		ensure("(1)", responseCache.prepareRequest(this, &req));
 		ensure("(2)", responseCache.requestAllowsStoring(&req));
@@ -564,4 +617,603 @@ namespace tut {
 		ResponseCacheType::Entry entry2(responseCache.fetch(&req, time(NULL)));
 		ensure("(22)", !entry2.valid());
 	}
+
+	TEST_METHOD(63) {
+		set_test_name("Gzip and identity variants are cached separately, and are invalidated together");
+		string responseHeadersStr =
+			"content-length: 5\r\n"
+			"cache-control: public,max-age=99999\r\n";
+		string responseBodyStr = "hello";
+		initCacheableResponse();
+		initResponseBody(responseBodyStr);
+		req.acceptsGzip = true;
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", responseCache.requestAllowsStoring(&req));
+		ensure("(3)", responseCache.prepareRequestForStoring(&req));
+		ensure("(4)", responseCache.store(&req, time(NULL),
+			responseHeadersStr.size(), responseBodyStr.size()).valid());
+
+
+		reset();
+		ensure("(10)", responseCache.prepareRequest(this, &req));
+		ensure("(11)", !responseCache.fetch(&req, time(NULL)).valid());
+
+
+		reset();
+		req.method = HTTP_POST;
+		ensure("(20)", responseCache.prepareRequest(this, &req));
+		ensure("(21)", responseCache.requestAllowsInvalidating(&req));
+		responseCache.invalidate(&req);
+
+
+		reset();
+		req.acceptsGzip = true;
+		ensure("(30)", responseCache.prepareRequest(this, &req));
+		ensure("(31)", !responseCache.fetch(&req, time(NULL)).valid());
+	}
+
+
+	/***** Shared cache *****/
+
+	TEST_METHOD(70) {
+		set_test_name("A response stored in one cache can be fetched from another "
+			"cache through the shared cache");
+		useSharedCache();
+		storeWithData(responseCache,
+			"content-length: 5\r\n"
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+
+		reset();
+		ensure("(1)", otherResponseCache.prepareRequest(this, &req));
+		ensure("(2)", otherResponseCache.requestAllowsFetching(&req));
+		ResponseCacheType::Entry entry(otherResponseCache.fetch(&req, time(NULL)));
+		ensure("(3)", entry.valid());
+		ensure_equals("(4)", StaticString(entry.body->httpBodyData,
+			entry.body->httpBodySize), StaticString("hello"));
+		ensure_equals("(5)", StaticString(entry.body->httpHeaderData,
+			entry.body->httpHeaderSize),
+			StaticString("content-length: 5\r\n"
+				"cache-control: public,max-age=99999\r\n"));
+		ensure_equals("(6)", otherResponseCache.getHits(), 1u);
+
+		// The entry has been copied into the other cache.
+		otherResponseCache.setSharedCache(NULL);
+		reset();
+		ensure("(10)", otherResponseCache.prepareRequest(this, &req));
+		ensure("(11)", otherResponseCache.fetch(&req, time(NULL)).valid());
+	}
+
+	TEST_METHOD(71) {
+		set_test_name("Invalidation also invalidates the shared cache");
+		useSharedCache();
+		storeWithData(responseCache,
+			"content-length: 5\r\n"
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+
+		reset();
+		req.method = HTTP_POST;
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", responseCache.requestAllowsInvalidating(&req));
+		responseCache.invalidate(&req);
+
+		reset();
+		ensure("(10)", otherResponseCache.prepareRequest(this, &req));
+		ensure("(11)", !otherResponseCache.fetch(&req, time(NULL)).valid());
+	}
+
+	TEST_METHOD(72) {
+		set_test_name("The shared cache stays within its memory budget");
+		SharedResponseCache smallCache(SharedResponseCache::STRIPES * 100);
+		ResponseCacheType::Body body;
+		string key;
+
+		ensure(body.reserveBodyData(200));
+		body.expiryDate = time(NULL) + 1000;
+		body.httpHeaderSize = 10;
+		body.httpBodySize = 40;
+		for (unsigned int i = 0; i < 1000; i++) {
+			key = "key" + toString(i);
+			smallCache.store(HashedStaticString(key), time(NULL), body);
+		}
+		Json::Value doc = smallCache.inspectStateAsJson();
+		ensure("(1)", doc["memory_usage"]["bytes"].asUInt()
+			<= doc["memory_limit"]["bytes"].asUInt());
+		ensure("(2)", doc["evictions"].asUInt() > 0);
+
+		// Too large to ever fit.
+		body.httpBodySize = 200;
+		smallCache.store(HashedStaticString("large"), time(NULL), body);
+		time_t date;
+		ensure("(3)", !smallCache.fetch(HashedStaticString("large"), time(NULL),
+			ResponseCacheType::DEFAULT_MAX_BODY_SIZE, date, body));
+	}
+
+
+	/***** Capacity *****/
+
+	TEST_METHOD(73) {
+		set_test_name("The number of entries and the maximum body size are configurable");
+		ResponseCacheType largeCache(16, 256 * 1024);
+		string body(100 * 1024, 'x');
+
+		ensure_equals("(1)", largeCache.getMaxEntries(), 16u);
+		ensure_equals("(2)", largeCache.getMaxBodySize(), 256u * 1024);
+
+		initCacheableResponse();
+		initResponseBody(body);
+		ensure("(3)", responseCache.prepareRequest(this, &req));
+		ensure("(4)", responseCache.prepareRequestForStoring(&req));
+		ensure("(5)", !responseCache.store(&req, time(NULL), 10, body.size()).valid());
+
+		reset();
+		storeWithData(largeCache,
+			"cache-control: public,max-age=99999\r\n",
+			body);
+
+		reset();
+		ensure("(10)", largeCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(largeCache.fetch(&req, time(NULL)));
+		ensure("(11)", entry.valid());
+		ensure_equals("(12)", StaticString(entry.body->httpBodyData,
+			entry.body->httpBodySize), StaticString(body));
+	}
+
+	TEST_METHOD(74) {
+		set_test_name("eraseExpired() only erases stale entries");
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+		ensure_equals("(1)", responseCache.eraseExpired(time(NULL)), 1u);
+		ensure_equals("(2)", responseCache.eraseExpired(time(NULL) + 100000), 0u);
+
+		reset();
+		ensure("(3)", responseCache.prepareRequest(this, &req));
+		ensure("(4)", !responseCache.fetch(&req, time(NULL)).valid());
+	}
+
+
+	/***** Conditional requests *****/
+
+	TEST_METHOD(75) {
+		set_test_name("requestIsNotModified() compares If-None-Match against the ETag");
+		insertAppResponseHeader(createHeader("etag", "\"abc\""), req.pool);
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+
+		reset();
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(responseCache.fetch(&req, time(NULL)));
+		ensure("(2)", entry.valid());
+		ensure("(3)", !responseCache.requestIsNotModified(&req, entry));
+
+		insertReqHeader(createHeader("if-none-match", "\"xyz\", W/\"abc\""), req.pool);
+		ensure("(4)", responseCache.requestIsNotModified(&req, entry));
+
+		reset();
+		insertReqHeader(createHeader("if-none-match", "\"xyz\""), req.pool);
+		ensure("(5)", !responseCache.requestIsNotModified(&req, entry));
+
+		reset();
+		insertReqHeader(createHeader("if-none-match", "*"), req.pool);
+		ensure("(6)", responseCache.requestIsNotModified(&req, entry));
+	}
+
+	TEST_METHOD(76) {
+		set_test_name("requestIsNotModified() compares If-Modified-Since against Last-Modified");
+		insertAppResponseHeader(createHeader("last-modified",
+			"Tue, 01 Jan 2013 00:00:00 GMT"), req.pool);
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+
+		reset();
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(responseCache.fetch(&req, time(NULL)));
+		ensure("(2)", entry.valid());
+
+		insertReqHeader(createHeader("if-modified-since",
+			"Wed, 02 Jan 2013 00:00:00 GMT"), req.pool);
+		ensure("(3)", responseCache.requestIsNotModified(&req, entry));
+
+		reset();
+		insertReqHeader(createHeader("if-modified-since",
+			"Mon, 31 Dec 2012 00:00:00 GMT"), req.pool);
+		ensure("(4)", !responseCache.requestIsNotModified(&req, entry));
+
+		// If-None-Match takes precedence.
+		reset();
+		insertReqHeader(createHeader("if-modified-since",
+			"Wed, 02 Jan 2013 00:00:00 GMT"), req.pool);
+		insertReqHeader(createHeader("if-none-match", "\"xyz\""), req.pool);
+		ensure("(5)", !responseCache.requestIsNotModified(&req, entry));
+	}
+
+	TEST_METHOD(77) {
+		set_test_name("Stale entries are revalidated by a single request"
+			" if stale-while-revalidate is set");
+		time_t now = time(NULL);
+
+		insertAppResponseHeader(createHeader("cache-control",
+			"public,max-age=10,stale-while-revalidate=100"), req.pool);
+		initResponseBody("hello");
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", responseCache.prepareRequestForStoring(&req));
+		ensure("(3)", responseCache.store(&req, now, 1, 5).valid());
+
+		reset();
+		ensure("(10)", responseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(responseCache.fetch(&req, now + 20));
+		ensure("(11)", !entry.valid());
+		ensure_equals("(12)", entry.cacheMissReason,
+			ResponseCacheType::Entry::REVALIDATING);
+
+		// Requests are served the stale entry during revalidation.
+		reset();
+		ensure("(20)", responseCache.prepareRequest(this, &req));
+		ensure("(21)", responseCache.fetch(&req, now + 20).valid());
+
+		// But not after the stale-while-revalidate window.
+		reset();
+		ensure("(30)", responseCache.prepareRequest(this, &req));
+		entry = responseCache.fetch(&req, now + 200);
+		ensure("(31)", !entry.valid());
+		ensure_equals("(32)", entry.cacheMissReason,
+			ResponseCacheType::Entry::NOT_FRESH);
+	}
+
+
+	/***** Purging *****/
+
+	TEST_METHOD(78) {
+		set_test_name("purge() erases entries by host and path");
+		const char *paths[] = { "/foo", "/foo/bar", "/baz" };
+		unsigned int i;
+
+		useSharedCache();
+		for (i = 0; i < 3; i++) {
+			reset();
+			psg_lstr_init(&req.path);
+			psg_lstr_append(&req.path, req.pool, paths[i]);
+			storeWithData(responseCache,
+				"cache-control: public,max-age=99999\r\n",
+				"hello");
+		}
+
+		ensure_equals("(1)", responseCache.purge("bar.com", "/foo"), 0u);
+		ensure_equals("(2)", responseCache.purge("foo.com", "/fo"), 0u);
+		ensure_equals("(3)", responseCache.purge("foo.com", "/foo"), 1u);
+		ensure_equals("(4)", responseCache.purge("", "/foo*"), 1u);
+		ensure_equals("(5)", responseCache.purge("", ""), 1u);
+
+		// The shared cache has been purged too.
+		for (i = 0; i < 3; i++) {
+			reset();
+			psg_lstr_init(&req.path);
+			psg_lstr_append(&req.path, req.pool, paths[i]);
+			ensure("(10)", otherResponseCache.prepareRequest(this, &req));
+			ensure("(11)", !otherResponseCache.fetch(&req, time(NULL)).valid());
+		}
+	}
+
+
+	/***** Vary *****/
+
+	TEST_METHOD(80) {
+		set_test_name("Responses with a Vary header are stored per variant");
+		const char *languages[] = { "en", "nl", "de" };
+		unsigned int i;
+
+		for (i = 0; i < 3; i++) {
+			reset();
+			insertReqHeader(createHeader("accept-language", languages[i]), req.pool);
+			insertAppResponseHeader(createHeader("vary", "Accept-Language"), req.pool);
+			storeWithData(responseCache,
+				"cache-control: public,max-age=99999\r\n",
+				languages[i]);
+		}
+
+		for (i = 0; i < 3; i++) {
+			reset();
+			insertReqHeader(createHeader("accept-language", languages[i]), req.pool);
+			ensure("(1)", responseCache.prepareRequest(this, &req));
+			ResponseCacheType::Entry entry(responseCache.fetch(&req, time(NULL)));
+			ensure("(2)", entry.valid());
+			ensure_equals("(3)", StaticString(entry.body->httpBodyData,
+				entry.body->httpBodySize), StaticString(languages[i]));
+		}
+
+		// Values are compared case-insensitively and without whitespace.
+		reset();
+		insertReqHeader(createHeader("accept-language", " NL"), req.pool);
+		ensure("(10)", responseCache.prepareRequest(this, &req));
+		ensure("(11)", responseCache.fetch(&req, time(NULL)).valid());
+
+		reset();
+		insertReqHeader(createHeader("accept-language", "fr"), req.pool);
+		ensure("(20)", responseCache.prepareRequest(this, &req));
+		ensure("(21)", !responseCache.fetch(&req, time(NULL)).valid());
+
+		reset();
+		ensure("(30)", responseCache.prepareRequest(this, &req));
+		ensure("(31)", !responseCache.fetch(&req, time(NULL)).valid());
+	}
+
+	TEST_METHOD(81) {
+		set_test_name("The number of variants per key is bounded");
+		unsigned int maxVariants = ResponseCacheType::MAX_VARIANTS;
+		unsigned int i;
+
+		for (i = 0; i < maxVariants + 2; i++) {
+			reset();
+			insertReqHeader(createHeader("x-variant", toString(i)), req.pool);
+			insertAppResponseHeader(createHeader("vary", "x-variant"), req.pool);
+			storeWithData(responseCache,
+				"cache-control: public,max-age=99999\r\n",
+				"hello");
+		}
+
+		unsigned int hits = 0;
+		for (i = 0; i < maxVariants + 2; i++) {
+			reset();
+			insertReqHeader(createHeader("x-variant", toString(i)), req.pool);
+			ensure("(1)", responseCache.prepareRequest(this, &req));
+			if (responseCache.fetch(&req, time(NULL)).valid()) {
+				hits++;
+			}
+		}
+		ensure_equals("(2)", hits, maxVariants);
+	}
+
+	TEST_METHOD(82) {
+		set_test_name("Invalidation erases all variants");
+		const char *languages[] = { "en", "nl" };
+		unsigned int i;
+
+		for (i = 0; i < 2; i++) {
+			reset();
+			insertReqHeader(createHeader("accept-language", languages[i]), req.pool);
+			insertAppResponseHeader(createHeader("vary", "accept-language"), req.pool);
+			storeWithData(responseCache,
+				"cache-control: public,max-age=99999\r\n",
+				"hello");
+		}
+
+		reset();
+		req.method = HTTP_POST;
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		responseCache.invalidate(&req);
+
+		for (i = 0; i < 2; i++) {
+			reset();
+			insertReqHeader(createHeader("accept-language", languages[i]), req.pool);
+			ensure("(2)", responseCache.prepareRequest(this, &req));
+			ensure("(3)", !responseCache.fetch(&req, time(NULL)).valid());
+		}
+	}
+
+
+	/***** Store failure reasons *****/
+
+	TEST_METHOD(85) {
+		set_test_name("prepareRequestForStoring() and store() report why they failed");
+		ResponseCacheType::StoreFailureReason reason;
+
+		req.appResponse.statusCode = 500;
+		initCacheableResponse();
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", !responseCache.prepareRequestForStoring(&req, &reason));
+		ensure_equals("(3)", reason, ResponseCacheType::UNCACHEABLE_STATUS_CODE);
+
+		reset();
+		initUncacheableResponse();
+		ensure("(10)", responseCache.prepareRequest(this, &req));
+		ensure("(11)", !responseCache.prepareRequestForStoring(&req, &reason));
+		ensure_equals("(12)", reason, ResponseCacheType::CACHE_CONTROL_DISALLOWS_STORING);
+
+		reset();
+		insertAppResponseHeader(createHeader("x-sendfile", "/foo"), req.pool);
+		initCacheableResponse();
+		ensure("(20)", responseCache.prepareRequest(this, &req));
+		ensure("(21)", !responseCache.prepareRequestForStoring(&req, &reason));
+		ensure_equals("(22)", reason, ResponseCacheType::SENDFILE_RESPONSE);
+
+		reset();
+		ensure("(30)", responseCache.prepareRequest(this, &req));
+		ensure("(31)", !responseCache.prepareRequestForStoring(&req, &reason));
+		ensure_equals("(32)", reason, ResponseCacheType::NO_FRESHNESS_INFORMATION);
+
+		reset();
+		initCacheableResponse();
+		ensure("(40)", responseCache.prepareRequest(this, &req));
+		ensure("(41)", responseCache.prepareRequestForStoring(&req, &reason));
+		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL), 10,
+			responseCache.getMaxBodySize() + 1));
+		ensure("(42)", !entry.valid());
+		ensure_equals("(43)", entry.storeFailureReason, ResponseCacheType::BODY_TOO_LARGE);
+		ensure_equals("(44)", ResponseCacheType::getStoreFailureReasonString(
+			entry.storeFailureReason), string("body_too_large"));
+	}
+
+
+	/***** Admission *****/
+
+	TEST_METHOD(86) {
+		set_test_name("Once the cache is full, new entries only replace"
+			" entries whose keys are fetched less often");
+		unsigned int maxEntries = responseCache.getMaxEntries();
+		unsigned int i;
+
+		for (i = 0; i < maxEntries; i++) {
+			string path = "/" + toString(i);
+			reset();
+			psg_lstr_init(&req.path);
+			psg_lstr_append(&req.path, req.pool, path.data(), path.size());
+			ensure("(1)", responseCache.prepareRequest(this, &req));
+			ensure("(2)", !responseCache.fetch(&req, time(NULL)).valid());
+			storeWithData(responseCache,
+				"cache-control: public,max-age=99999\r\n",
+				"hello");
+		}
+
+		// A key that has been fetched only once is not admitted.
+		reset();
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool, "/new");
+		initCacheableResponse();
+		initResponseBody("hello");
+		ensure("(10)", responseCache.prepareRequest(this, &req));
+		ensure("(11)", !responseCache.fetch(&req, time(NULL)).valid());
+		ensure("(12)", responseCache.prepareRequestForStoring(&req));
+		ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL), 1, 5));
+		ensure("(13)", !entry.valid());
+		ensure_equals("(14)", entry.storeFailureReason, ResponseCacheType::NOT_ADMITTED);
+
+		// But it is once it has been fetched more often than the oldest entry.
+		ensure("(20)", !responseCache.fetch(&req, time(NULL)).valid());
+		ensure("(21)", responseCache.store(&req, time(NULL), 1, 5).valid());
+		ensure("(22)", responseCache.fetch(&req, time(NULL)).valid());
+	}
+
+
+	/***** Snapshots *****/
+
+	TEST_METHOD(87) {
+		set_test_name("Snapshots contain the entries that may still be served,"
+			" and can be loaded into another cache");
+
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool, "/long");
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"long body");
+
+		reset();
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool, "/short");
+		insertAppResponseHeader(createHeader(
+			"cache-control", "public,max-age=10"),
+			req.pool);
+		initResponseBody("short body");
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ensure("(2)", responseCache.prepareRequestForStoring(&req));
+		ensure("(3)", responseCache.store(&req, time(NULL), 0, 10).valid());
+
+		string snapshot = responseCache.saveSnapshot(time(NULL) + 1000);
+		ensure_equals("(4)", otherResponseCache.loadSnapshot(snapshot, time(NULL)), 1u);
+
+		reset();
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool, "/long");
+		ensure("(10)", otherResponseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(otherResponseCache.fetch(&req, time(NULL)));
+		ensure("(11)", entry.valid());
+		ensure_equals("(12)", StaticString(entry.body->httpHeaderData,
+			entry.body->httpHeaderSize), "cache-control: public,max-age=99999\r\n");
+		ensure_equals("(13)", StaticString(entry.body->httpBodyData,
+			entry.body->httpBodySize), "long body");
+
+		reset();
+		psg_lstr_init(&req.path);
+		psg_lstr_append(&req.path, req.pool, "/short");
+		ensure("(20)", otherResponseCache.prepareRequest(this, &req));
+		ensure("(21)", !otherResponseCache.fetch(&req, time(NULL)).valid());
+	}
+
+	TEST_METHOD(88) {
+		set_test_name("Loading a snapshot stops at malformed data and"
+			" skips entries that expired in the mean time");
+
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"hello");
+		string snapshot = responseCache.saveSnapshot(time(NULL));
+
+		ensure_equals("(1)", otherResponseCache.loadSnapshot("garbage", time(NULL)), 0u);
+		ensure_equals("(2)", otherResponseCache.loadSnapshot(
+			snapshot.substr(0, snapshot.size() - 1), time(NULL)), 0u);
+		ensure_equals("(3)", otherResponseCache.loadSnapshot(snapshot,
+			time(NULL) + 999999), 0u);
+		ensure_equals("(4)", otherResponseCache.loadSnapshot(snapshot, time(NULL)), 1u);
+	}
+
+
+	/***** Byte ranges *****/
+
+	TEST_METHOD(89) {
+		set_test_name("getRequestedByteRange() honors a single byte range,"
+			" unless If-Range does not match the entry's strong ETag");
+		boost::uint64_t start, end;
+
+		insertAppResponseHeader(createHeader("etag", "\"abc\""), req.pool);
+		storeWithData(responseCache,
+			"cache-control: public,max-age=99999\r\n",
+			"hello world");
+
+		reset();
+		ensure("(1)", responseCache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(responseCache.fetch(&req, time(NULL)));
+		ensure("(2)", entry.valid());
+		ensure_equals("(3)", responseCache.getRequestedByteRange(&req, entry, start, end), 0);
+
+		insertReqHeader(createHeader("range", "bytes=-5"), req.pool);
+		ensure_equals("(10)", responseCache.getRequestedByteRange(&req, entry, start, end), 1);
+		ensure_equals("(11)", start, 6u);
+		ensure_equals("(12)", end, 10u);
+
+		insertReqHeader(createHeader("if-range", "\"xyz\""), req.pool);
+		ensure_equals("(20)", responseCache.getRequestedByteRange(&req, entry, start, end), 0);
+
+		reset();
+		insertReqHeader(createHeader("range", "bytes=2-4"), req.pool);
+		insertReqHeader(createHeader("if-range", "\"abc\""), req.pool);
+		ensure("(30)", responseCache.prepareRequest(this, &req));
+		ensure_equals("(31)", responseCache.getRequestedByteRange(&req, entry, start, end), 1);
+		ensure_equals("(32)", start, 2u);
+		ensure_equals("(33)", end, 4u);
+
+		reset();
+		insertReqHeader(createHeader("range", "bytes=11-"), req.pool);
+		ensure("(40)", responseCache.prepareRequest(this, &req));
+		ensure_equals("(41)", responseCache.getRequestedByteRange(&req, entry, start, end), -1);
+
+		reset();
+		insertReqHeader(createHeader("range", "bytes=0-1,3-4"), req.pool);
+		ensure("(50)", responseCache.prepareRequest(this, &req));
+		ensure_equals("(51)", responseCache.getRequestedByteRange(&req, entry, start, end), 0);
+	}
+
+
+	/***** Memory *****/
+
+	TEST_METHOD(90) {
+		set_test_name("A cache backed by huge pages keeps small bodies in its mapping,"
+			" and allocates larger ones separately");
+		ResponseCacheType cache(8, 16, true);
+		ensure("(1)", cache.getHugePageBacking() != MemoryKit::HUGEPAGE_BACKING_NONE);
+		ensure_equals("(2)", cache.getHugePageMappingSize() % HUGEPAGE_SIZE, 0u);
+
+		storeWithData(cache, "cache-control: public,max-age=99999\r\n", "hello");
+		reset();
+		ensure("(3)", cache.prepareRequest(this, &req));
+		ResponseCacheType::Entry entry(cache.fetch(&req, time(NULL)));
+		ensure("(4)", entry.valid());
+		ensure("(5)", entry.body->httpBodyData == entry.body->reservedBodyData);
+		ensure_equals("(6)", StaticString(entry.body->httpBodyData,
+			entry.body->httpBodySize), "hello");
+
+		reset();
+		cache.setMaxBodySize(1024);
+		storeWithData(cache, "cache-control: public,max-age=99999\r\n",
+			"a body that is larger than the reserved space");
+		reset();
+		ensure("(7)", cache.prepareRequest(this, &req));
+		entry = cache.fetch(&req, time(NULL));
+		ensure("(8)", entry.valid());
+		ensure("(9)", entry.body->httpBodyData != entry.body->reservedBodyData);
+		ensure_equals("(10)", StaticString(entry.body->httpBodyData,
+			entry.body->httpBodySize), "a body that is larger than the reserved space");
+	}
 }
@@ -0,0 +1,130 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/CpuPlacement.h>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+using namespace std;
+
+namespace tut {
+	struct Core_SpawningKit_CpuPlacementTest {
+		CpuTopology topology;
+		CpuList coreCpus;
+
+		Core_SpawningKit_CpuPlacementTest() {
+			// Two NUMA nodes with 4 CPUs each.
+			CpuTopology::NumaNode node;
+			for (unsigned int i = 0; i < 8; i++) {
+				topology.usableCpus.push_back(i);
+			}
+			node.id = 0;
+			parseCpuList("0-3", node.cpus);
+			topology.numaNodes.push_back(node);
+			node.id = 1;
+			parseCpuList("4-7", node.cpus);
+			topology.numaNodes.push_back(node);
+		}
+
+		CpuPlacement place(CpuAffinityPolicy policy, unsigned int sequenceNumber) {
+			return computeCpuPlacement(policy, sequenceNumber, topology, coreCpus);
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_CpuPlacementTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Parsing and formatting CPU lists");
+		CpuList cpus;
+
+		ensure(parseCpuList("0-3,8,10-11\n", cpus));
+		ensure_equals(cpus.size(), 7u);
+		ensure_equals(cpus[4], 8u);
+		ensure_equals(formatCpuList(cpus), "0-3,8,10-11");
+
+		ensure(parseCpuList("5,1,2", cpus));
+		ensure_equals(formatCpuList(cpus), "1-2,5");
+
+		ensure(parseCpuList("", cpus));
+		ensure(cpus.empty());
+		ensure_equals(formatCpuList(cpus), "");
+
+		ensure(!parseCpuList("3-1", cpus));
+		ensure(!parseCpuList("a", cpus));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Parsing policy names");
+		ensure_equals(parseCpuAffinityPolicy("round-robin"), CPU_AFFINITY_ROUND_ROBIN);
+		ensure_equals(parseCpuAffinityPolicy("numa-node"), CPU_AFFINITY_NUMA_NODE);
+		ensure_equals(parseCpuAffinityPolicy("exclude-core"), CPU_AFFINITY_EXCLUDE_CORE);
+		ensure_equals(parseCpuAffinityPolicy("none"), CPU_AFFINITY_NONE);
+		ensure_equals(parseCpuAffinityPolicy(""), CPU_AFFINITY_NONE);
+		ensure_equals(getCpuAffinityPolicyName(CPU_AFFINITY_NUMA_NODE), "numa-node");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The round-robin policy pins each process to the next CPU, "
+			"skipping the Core's CPUs");
+		ensure(place(CPU_AFFINITY_NONE, 0).cpus.empty());
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_ROUND_ROBIN, 0).cpus), "0");
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_ROUND_ROBIN, 9).cpus), "1");
+
+		parseCpuList("0-1", coreCpus);
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_ROUND_ROBIN, 0).cpus), "2");
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_ROUND_ROBIN, 6).cpus), "2");
+		ensure_equals(place(CPU_AFFINITY_ROUND_ROBIN, 0).numaNode, -1);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("The numa-node policy pins each process to the next node "
+			"that has CPUs left after excluding the Core's");
+		CpuPlacement placement = place(CPU_AFFINITY_NUMA_NODE, 1);
+		ensure_equals(formatCpuList(placement.cpus), "4-7");
+		ensure_equals(placement.numaNode, 1);
+
+		parseCpuList("0-1", coreCpus);
+		placement = place(CPU_AFFINITY_NUMA_NODE, 2);
+		ensure_equals(formatCpuList(placement.cpus), "2-3");
+		ensure_equals(placement.numaNode, 0);
+
+		parseCpuList("0-3", coreCpus);
+		placement = place(CPU_AFFINITY_NUMA_NODE, 2);
+		ensure_equals(formatCpuList(placement.cpus), "4-7");
+		ensure_equals(placement.numaNode, 1);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("The exclude-core policy allows all CPUs but the Core's, "
+			"unless the Core uses all of them");
+		parseCpuList("0-2", coreCpus);
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_EXCLUDE_CORE, 3).cpus), "3-7");
+
+		parseCpuList("0-7", coreCpus);
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_EXCLUDE_CORE, 0).cpus), "0-7");
+		ensure_equals(formatCpuList(place(CPU_AFFINITY_ROUND_ROBIN, 3).cpus), "3");
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Setting and reading back the affinity of a process");
+		CpuTopology real = CpuTopology::detect();
+		CpuList cpus;
+		if (real.usableCpus.empty()) {
+			return;
+		}
+
+		ensure(!real.numaNodes.empty());
+		ensure(getProcessCpuAffinity(getpid(), cpus));
+		ensure_equals(formatCpuList(cpus), formatCpuList(real.usableCpus));
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			pause();
+			_exit(0);
+		}
+		CpuList first(1, real.usableCpus[0]);
+		ensure_equals(setProcessCpuAffinity(pid, first), 0);
+		ensure(getProcessCpuAffinity(pid, cpus));
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		ensure_equals(formatCpuList(cpus), formatCpuList(first));
+	}
+}
@@ -235,4 +235,23 @@ namespace tut {
 			result = gatheredOutput.find("hello world!\n") != string::npos;
 		);
 	}
+
+	TEST_METHOD(86) {
+		set_test_name("Processes are forked ahead of time when preloaderStandbyProcesses is "
+			"set, and spawning activates those standby processes");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		options.preloaderStandbyProcesses = 2;
+		boost::shared_ptr<SmartSpawner> spawner = createSpawner(options);
+
+		result = spawner->spawn(options);
+		ensure_equals(spawner->getStandbyProcessCount(), 2u);
+
+		result = spawner->spawn(options);
+		ensure_equals("The standby pool is topped up again",
+			spawner->getStandbyProcessCount(), 2u);
+		ensure(result["pid"].asInt() > 0);
+	}
 }
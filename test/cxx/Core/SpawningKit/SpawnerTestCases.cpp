@@ -780,3 +780,21 @@
 
 		ensure_equals(groups, defaultGroups);
 	}
+
+	TEST_METHOD(70) {
+		set_test_name("It reports the time spent in each spawn phase");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		result = spawner->spawn(options);
+
+		ensure(result["spawn_phases"].isObject());
+		for (unsigned int i = 0; i < SPAWN_PHASE_COUNT; i++) {
+			ensure(result["spawn_phases"].isMember(getSpawnPhaseName((SpawnPhase) i)));
+		}
+		ensure(result["spawn_phases"]["negotiation"].asUInt64() > 0);
+		ensure(result["spawn_phases"]["negotiation"].asUInt64()
+			<= SystemTime::getUsec() - result["spawn_start_time"].asUInt64());
+	}
@@ -0,0 +1,75 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/UserDatabaseCache.h>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+
+namespace tut {
+	struct Core_SpawningKit_UserDatabaseCacheTest {
+		UserDatabaseCache::UserInfo userInfo;
+		UserDatabaseCache::GroupInfo groupInfo;
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_UserDatabaseCacheTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Looking up users by name and UID");
+		UserDatabaseCache cache;
+		ensure(cache.lookupUserByName("root", userInfo));
+		ensure_equals(userInfo.uid, (uid_t) 0);
+		ensure_equals(userInfo.name, "root");
+		ensure(cache.lookupUserByUid(0, userInfo));
+		ensure_equals(userInfo.name, "root");
+		ensure(!cache.lookupUserByName("nonexistant_user_for_passenger_tests", userInfo));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Looking up groups by name and GID");
+		UserDatabaseCache cache;
+		ensure(cache.lookupGroupByGid(0, groupInfo));
+		ensure(cache.lookupGroupByName(groupInfo.name, groupInfo));
+		ensure_equals(groupInfo.gid, (gid_t) 0);
+		ensure(!cache.lookupGroupByName("nonexistant_group_for_passenger_tests", groupInfo));
+		ensure_equals(cache.lookupGid("nonexistant_group_for_passenger_tests"), (gid_t) -1);
+		ensure_equals(cache.lookupGid("123456789"), (gid_t) 123456789);
+		ensure_equals(cache.getGroupName(123456789), "123456789");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Found and not found entries are cached");
+		UserDatabaseCache cache;
+		cache.lookupUserByName("root", userInfo);
+		cache.lookupUserByName("nonexistant_user_for_passenger_tests", userInfo);
+		ensure_equals(cache.getMissCount(), 2u);
+
+		ensure(cache.lookupUserByName("root", userInfo));
+		ensure(!cache.lookupUserByName("nonexistant_user_for_passenger_tests", userInfo));
+		ensure_equals(cache.getLookupCount(), 4u);
+		ensure_equals(cache.getMissCount(), 2u);
+
+		cache.clear();
+		cache.lookupUserByName("root", userInfo);
+		ensure_equals(cache.getMissCount(), 3u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Expired found entries are returned while being refreshed in the background");
+		UserDatabaseCache cache(0);
+		ensure(cache.lookupUserByName("root", userInfo));
+		ensure(cache.lookupUserByName("root", userInfo));
+		ensure_equals(userInfo.name, "root");
+		ensure_equals(cache.getMissCount(), 1u);
+		EVENTUALLY(5,
+			result = cache.getRefreshCount() == 1;
+		);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Expired not found entries are resolved again synchronously");
+		UserDatabaseCache cache(0);
+		ensure(!cache.lookupUserByName("nonexistant_user_for_passenger_tests", userInfo));
+		ensure(!cache.lookupUserByName("nonexistant_user_for_passenger_tests", userInfo));
+		ensure_equals(cache.getMissCount(), 2u);
+		ensure_equals(cache.getRefreshCount(), 0u);
+	}
+}
@@ -1,6 +1,7 @@
 #include <TestSupport.h>
 #include <Core/UnionStation/Context.h>
 #include <Core/UnionStation/Transaction.h>
+#include <Core/UnionStation/StopwatchLog.h>
 #include <MessageClient.h>
 #include <UstRouter/Controller.h>
 #include <Utils/MessageIO.h>
@@ -45,6 +46,8 @@ namespace tut {
 			controllerOptions.set("ust_router_password", "1234");
 			controllerOptions.setBool("ust_router_dev_mode", true);
 			controllerOptions.set("ust_router_dump_dir", tmpdir.getPath());
+			// Most tests inspect the dump file right after logging.
+			controllerOptions.setUint("ust_router_dump_buffer_size", 0);
 
 			context = boost::make_shared<Context>(socketAddress, "test", "1234",
 				"localhost");
@@ -120,6 +123,26 @@ namespace tut {
 			return client;
 		}
 
+		void appendBatchRecord(string &output, const char *field, ...) {
+			vector<string> fields;
+			va_list ap;
+
+			va_start(ap, field);
+			while (field != NULL) {
+				fields.push_back(field);
+				field = va_arg(ap, const char *);
+			}
+			va_end(ap);
+
+			boost::uint16_t count = htons(fields.size());
+			output.append((const char *) &count, sizeof(count));
+			for (unsigned int i = 0; i < fields.size(); i++) {
+				boost::uint32_t len = htonl(fields[i].size());
+				output.append((const char *) &len, sizeof(len));
+				output.append(fields[i]);
+			}
+		}
+
 		void waitForDumpFile(const string &category = "requests") {
 			EVENTUALLY(5,
 				result = fileExists(getDumpFilePath(category));
@@ -564,5 +587,166 @@ namespace tut {
 		ensureSubstringNotInDumpFile("transaction 2\n");
 	}
 
+	TEST_METHOD(23) {
+		set_test_name("Buffered log messages are written out by the flusher thread");
+		init();
+		SystemTime::forceAll(YESTERDAY);
+		context->setBufferedLogging(1024 * 64);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		log->message("hello");
+		log->message("world");
+		log.reset();
+
+		ensureSubstringInDumpFile("hello\n");
+		ensureSubstringInDumpFile("world\n");
+		ensure_equals(context->getDroppedMessageCount(), 0ull);
+	}
+
+	TEST_METHOD(24) {
+		set_test_name("Log messages that don't fit in the write buffer are dropped");
+		init();
+		SystemTime::forceAll(YESTERDAY);
+		context->setBufferedLogging(128);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		log->message("hello");
+		log->message(string(100, 'x'));
+		log.reset();
+
+		ensureSubstringInDumpFile("hello\n");
+		ensure_equals(context->getDroppedMessageCount(), 1ull);
+		ensureSubstringNotInDumpFile(string(100, 'x'));
+	}
+
+	TEST_METHOD(25) {
+		set_test_name("A batch can open, log to and close multiple transactions");
+		init();
+
+		MessageClient client = createConnection();
+		vector<string> args;
+		string batch;
+
+		SystemTime::forceAll(TODAY);
+
+		appendBatchRecord(batch, "openTransaction", TODAY_TXN_ID, "foobar", "",
+			"requests", TODAY_TIMESTAMP_STR, "-", "true", NULL);
+		appendBatchRecord(batch, "openTransaction", "cjb8n-efgh", "foobar", "",
+			"requests", TODAY_TIMESTAMP_STR, "-", "true", NULL);
+		appendBatchRecord(batch, "log", TODAY_TXN_ID, "1000", "hello", NULL);
+		appendBatchRecord(batch, "log", "cjb8n-efgh", "1000", "world", NULL);
+		appendBatchRecord(batch, "closeTransaction", TODAY_TXN_ID, "1000", NULL);
+		appendBatchRecord(batch, "closeTransaction", "cjb8n-efgh", "1000", NULL);
+		client.write("batch", NULL);
+		client.writeScalar(batch);
+
+		// Batch records are not acknowledged, so the next reply is the pong.
+		client.write("ping", NULL);
+		ensure(client.read(args));
+		ensure_equals(args.size(), 1u);
+		ensure_equals(args[0], "pong");
+
+		ensureSubstringInDumpFile("hello\n");
+		ensureSubstringInDumpFile("world\n");
+	}
+
+	TEST_METHOD(26) {
+		set_test_name("A malformed batch disconnects the client");
+		init();
+
+		MessageClient client = createConnection();
+		vector<string> args;
+		string batch;
+
+		appendBatchRecord(batch, "closeTransaction", TODAY_TXN_ID, "1000", NULL);
+		batch.resize(batch.size() - 1);
+		client.write("batch", NULL);
+		client.writeScalar(batch);
+
+		ensure(!client.read(args));
+	}
+
+	TEST_METHOD(27) {
+		set_test_name("Dump file data is buffered until the sink is flushed");
+		controllerOptions.setUint("ust_router_dump_buffer_size", 1024 * 64);
+		controllerOptions.setInt("analytics_sink_flush_timer_interval", 1);
+		init();
+		SystemTime::forceAll(YESTERDAY);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		log->message("hello");
+		log.reset();
+
+		waitForDumpFile();
+		ensureSubstringNotInDumpFile("hello\n");
+		ensureSubstringInDumpFile("hello\n");
+	}
+
+	TEST_METHOD(28) {
+		set_test_name("Dump file data is written once the buffer is full");
+		controllerOptions.setUint("ust_router_dump_buffer_size", 128);
+		controllerOptions.setInt("analytics_sink_flush_timer_interval", 60 * 60);
+		init();
+		SystemTime::forceAll(YESTERDAY);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		log->message("hello");
+		log.reset();
+		ensureSubstringNotInDumpFile("hello\n");
+
+		log = context->newTransaction("foobar");
+		log->message(string(128, 'x'));
+		log.reset();
+		ensureSubstringInDumpFile("hello\n");
+		ensureSubstringInDumpFile(string(128, 'x'));
+	}
+
+	TEST_METHOD(29) {
+		set_test_name("Dump files are rotated once they reach the rotation size");
+		controllerOptions.setULL("ust_router_dump_rotate_size", 1);
+		init();
+		SystemTime::forceAll(YESTERDAY);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		log->message("hello");
+		log.reset();
+
+		EVENTUALLY(5,
+			string path = getDumpFilePath() + ".1";
+			result = fileExists(path) && readAll(path).find("hello\n") != string::npos;
+		);
+		ensure_equals(readDumpFile(), "");
+	}
+
+	TEST_METHOD(30) {
+		set_test_name("StopwatchLog logs the begin and end of a section with its timings");
+		init();
+		SystemTime::forceAll(YESTERDAY);
+
+		TransactionPtr log = context->newTransaction("foobar");
+		{
+			StopwatchLog succeeded(log, "succeeded", NULL);
+			succeeded.success();
+		}
+		{
+			StopwatchLog failed(log, "failed", NULL);
+		}
+		log.reset();
+
+		ensureSubstringInDumpFile("BEGIN: succeeded (");
+		ensureSubstringInDumpFile("END: succeeded (");
+		ensureSubstringInDumpFile("BEGIN: failed (");
+		ensureSubstringInDumpFile("FAIL: failed (");
+		string data = readDumpFile();
+		string::size_type pos = data.find("END: succeeded (");
+		string::size_type closePos = data.find(")", pos);
+		ensure(closePos != string::npos);
+		vector<string> timings;
+		split(data.substr(pos + sizeof("END: succeeded (") - 1,
+			closePos - pos - sizeof("END: succeeded (") + 1), ',', timings);
+		ensure_equals("Monotonic time, user time and system time are logged",
+			timings.size(), 3u);
+	}
+
 	/************************************/
 }
@@ -372,4 +372,45 @@ namespace tut {
 		ensure_equals(str2.start->next->next, str2.end);
 		ensure_equals(StaticString(str2.end->data, str2.end->size), "world");
 	}
+
+	TEST_METHOD(49) {
+		set_test_name("psg_lstr_flatten does nothing on single-part strings");
+
+		psg_lstr_append(&str, pool, "hello");
+		LString::Part *part = str.start;
+		ensure_equals(psg_lstr_flatten(&str, pool), &str);
+		ensure_equals(str.start, part);
+		ensure_equals(str.end, part);
+		ensure_equals(StaticString(str.start->data, str.size), "hello");
+	}
+
+	TEST_METHOD(50) {
+		set_test_name("psg_lstr_flatten turns multi-part strings into a single part");
+
+		psg_lstr_append(&str, pool, "hello");
+		psg_lstr_append(&str, pool, " ");
+		psg_lstr_append(&str, pool, "world");
+		ensure_equals(psg_lstr_flatten(&str, pool), &str);
+
+		ensure_equals(str.size, 11u);
+		ensure_equals(str.start, str.end);
+		ensure_equals<void *>(str.start->next, NULL);
+		ensure_equals(StaticString(str.start->data, str.start->size), "hello world");
+		ensure_equals(str.start->data[11], '\0');
+	}
+
+	TEST_METHOD(51) {
+		set_test_name("psg_lstr_flatten only copies the first time");
+
+		psg_lstr_append(&str, pool, "hello");
+		psg_lstr_append(&str, pool, "world");
+		psg_lstr_flatten(&str, pool);
+		LString::Part *part = str.start;
+		const char *data = str.start->data;
+
+		psg_lstr_flatten(&str, pool);
+		ensure_equals(str.start, part);
+		ensure_equals(str.start->data, data);
+		ensure_equals(psg_lstr_make_contiguous(&str, pool), &str);
+	}
 }
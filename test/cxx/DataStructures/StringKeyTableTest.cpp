@@ -1,5 +1,7 @@
 #include <TestSupport.h>
 #include <string>
+#include <map>
+#include <cstdlib>
 #include <DataStructures/StringKeyTable.h>
 
 using namespace Passenger;
@@ -259,4 +261,44 @@ namespace tut {
 		ensure("3: a is in the table", t.lookup("b", &result));
 		ensure_equals("3: b's value is 3", result->value, 3);
 	}
+
+	TEST_METHOD(12) {
+		set_test_name("Lookups stay consistent with a reference map across random inserts, "
+			"erases, resizes and clears");
+		std::map<string, string> reference;
+		StringKeyTable<string> t(1);
+		unsigned int seed = 1234;
+
+		for (unsigned int round = 0; round < 3; round++) {
+			for (unsigned int i = 0; i < 3000; i++) {
+				string key = "key" + toString(rand_r(&seed) % 500);
+				if (rand_r(&seed) % 3 == 0) {
+					ensure_equals(key.c_str(), t.erase(key), reference.erase(key) > 0);
+				} else {
+					string val = toString(i);
+					t.insert(key, val);
+					reference[key] = val;
+				}
+			}
+
+			ensure_equals(t.size(), reference.size());
+			for (unsigned int i = 0; i < 600; i++) {
+				string key = "key" + toString(i);
+				std::map<string, string>::const_iterator it = reference.find(key);
+				if (it == reference.end()) {
+					ensure(key.c_str(), !t.lookup(key, &value));
+				} else {
+					ensure(key.c_str(), t.lookup(key, &value));
+					ensure_equals(key.c_str(), *value, it->second);
+				}
+			}
+
+			StringKeyTable<string> copy(t);
+			ensure_equals(copy.lookupCopy(reference.begin()->first),
+				reference.begin()->second);
+
+			t.clear();
+			reference.clear();
+		}
+	}
 }
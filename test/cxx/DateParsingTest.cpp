@@ -122,4 +122,44 @@ namespace tut {
 		ensure_equals(zone, +200);
 		ensure_equals(parsedDateToTimestamp(tm, zone), 1414285200);
 	}
+
+	TEST_METHOD(9) {
+		set_test_name("Leap years");
+		parse("Tue, 29 Feb 2000 12:00:00 GMT");
+		ensure_equals(parsedDateToTimestamp(tm, zone), 951825600);
+		parse("Mon, 01 Mar 2100 00:00:00 GMT");
+		ensure_equals(parsedDateToTimestamp(tm, zone), 4107542400ll);
+		parse("Wed, 31 Dec 1969 23:59:59 GMT");
+		ensure_equals(parsedDateToTimestamp(tm, zone), -1);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("Dates that are not in the fixed-length form are handled by the general parser");
+		parse("Sun,  6 Nov 1994 08:49:37 GMT");
+		ensure_equals(tm.tm_mday, 6);
+		ensure_equals(parsedDateToTimestamp(tm, zone), 784111777);
+		parse("Sun, 06 Nov 1994 08:49:37 UTC");
+		ensure_equals(parsedDateToTimestamp(tm, zone), 784111777);
+	}
+
+
+	/***** Invalid dates *****/
+
+	TEST_METHOD(11) {
+		const char *dates[] = {
+			"Xyz, 06 Nov 1994 08:49:37 GMT",
+			"Sun, 06 Nov 1994 24:49:37 GMT",
+			"Sun, 06 Nov 1994 08:60:37 GMT",
+			"Sun, 06 Nov 1994 08:49:61 GMT",
+			"Sun, 06 Nox 1994 08:49:37 GMT",
+			"Sun, 0x Nov 1994 08:49:37 GMT",
+			"Sun, 06 Nov 19x4 08:49:37 GMT",
+			"Sun, 06 Nov 1994 08:49:37 XYZ",
+			NULL
+		};
+		for (unsigned int i = 0; dates[i] != NULL; i++) {
+			const char *end = dates[i] + strlen(dates[i]);
+			ensure(dates[i], !parseImfFixdate(dates[i], end, tm, zone));
+		}
+	}
 }
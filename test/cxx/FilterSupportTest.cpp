@@ -349,6 +349,31 @@ namespace tut {
 		ensure("(2)", eval("!false"));
 	}
 
+	TEST_METHOD(34) {
+		// Test function calls
+		ctx.uri = "/api/users";
+		ctx.hints.insert("denied");
+		ensure("(1)", eval("starts_with(uri, '/api')"));
+		ensure("(2)", !eval("starts_with(uri, '/admin')"));
+		ensure("(3)", eval("has_hint('denied')"));
+		ensure("(4)", !eval("has_hint('foo')"));
+		ensure("(5)", eval("!has_hint('foo') && starts_with(uri, '/api')"));
+	}
+
+	TEST_METHOD(35) {
+		// A field that is referred to multiple times has the same value
+		// each time, and a filter sees new values when it is run again.
+		Filter f("uri =~ /^\\/foo/ && uri != '/foobar' && response_time > 5 && response_time < 20");
+		ctx.uri = "/foo";
+		ctx.responseTime = 10;
+		ensure("(1)", f.run(ctx));
+		ctx.uri = "/foobar";
+		ensure("(2)", !f.run(ctx));
+		ctx.uri = "/foo";
+		ctx.responseTime = 30;
+		ensure("(3)", !f.run(ctx));
+	}
+
 
 	/******** Error tests *******/
 
@@ -390,6 +415,12 @@ namespace tut {
 		ensure(!validate("/abc/"));
 	}
 
+	TEST_METHOD(42) {
+		// Regular expressions must be valid.
+		ensure(!validate("uri =~ /(abc/"));
+		ensure(validate("uri =~ /(abc)/"));
+	}
+
 
 	/******** ContextFromLog tests *******/
 
@@ -893,4 +893,37 @@ namespace tut {
 			ensure(timeout <= 2000);
 		}
 	}
+
+	/***** Test createTcpServer() *****/
+
+	TEST_METHOD(90) {
+		set_test_name("createTcpServer() with reusePort allows binding multiple sockets to the same port");
+		if (!reusePortSupported()) {
+			return;
+		}
+
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		FileDescriptor server1(createTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__, true),
+			NULL, 0);
+		getsockname(server1, (struct sockaddr *) &addr, &len);
+		FileDescriptor server2(createTcpServer("127.0.0.1", ntohs(addr.sin_port), 0,
+			__FILE__, __LINE__, true), NULL, 0);
+		ensure(server2 != -1);
+	}
+
+	TEST_METHOD(91) {
+		set_test_name("createTcpServer() without reusePort does not allow binding multiple sockets to the same port");
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		FileDescriptor server1(createTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__),
+			NULL, 0);
+		getsockname(server1, (struct sockaddr *) &addr, &len);
+		try {
+			createTcpServer("127.0.0.1", ntohs(addr.sin_port), 0, __FILE__, __LINE__);
+			fail("SystemException expected");
+		} catch (const SystemException &e) {
+			ensure_equals(e.code(), EADDRINUSE);
+		}
+	}
 }
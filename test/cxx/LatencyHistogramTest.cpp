@@ -0,0 +1,77 @@
+#include <TestSupport.h>
+#include <Algorithms/LatencyHistogram.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct LatencyHistogramTest {
+		LatencyHistogram histogram;
+	};
+
+	DEFINE_TEST_GROUP(LatencyHistogramTest);
+
+	TEST_METHOD(1) {
+		set_test_name("An empty histogram reports zeroes");
+		ensure_equals(histogram.getCount(), 0ull);
+		ensure_equals(histogram.getAverage(), 0ull);
+		ensure_equals(histogram.getMax(), 0ull);
+		ensure_equals(histogram.getPercentile(99), 0ull);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("It keeps the count, average and maximum");
+		histogram.record(10);
+		histogram.record(20);
+		histogram.record(30);
+		ensure_equals("(1)", histogram.getCount(), 3ull);
+		ensure_equals("(2)", histogram.getAverage(), 20ull);
+		ensure_equals("(3)", histogram.getMax(), 30ull);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Percentiles are accurate to within a quarter of their magnitude");
+		for (unsigned int i = 1; i <= 10000; i++) {
+			histogram.record(i * 100);
+		}
+
+		boost::uint64_t p50 = histogram.getPercentile(50);
+		boost::uint64_t p99 = histogram.getPercentile(99);
+		ensure("(1)", p50 >= 500000 && p50 <= 500000 * 5 / 4);
+		ensure("(2)", p99 >= 990000 && p99 <= 990000 * 5 / 4);
+		ensure_equals("(3)", histogram.getPercentile(100), 1000000ull);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Small values are recorded exactly");
+		histogram.record(0);
+		histogram.record(1);
+		histogram.record(2);
+		histogram.record(3);
+		ensure_equals("(1)", histogram.getPercentile(25), 0ull);
+		ensure_equals("(2)", histogram.getPercentile(50), 1ull);
+		ensure_equals("(3)", histogram.getPercentile(75), 2ull);
+		ensure_equals("(4)", histogram.getPercentile(100), 3ull);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Very large values end up in the last bucket");
+		histogram.record(1ull << 40);
+		ensure_equals("(1)", histogram.getCount(), 1ull);
+		ensure_equals("(2)", histogram.getPercentile(50), 1ull << 40);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("merge() combines two histograms");
+		LatencyHistogram other;
+		histogram.record(100);
+		other.record(300);
+		other.record(5000);
+		histogram.merge(other);
+		ensure_equals("(1)", histogram.getCount(), 3ull);
+		ensure_equals("(2)", histogram.getMax(), 5000ull);
+		ensure_equals("(3)", histogram.getAverage(), 1800ull);
+		ensure("(4)", histogram.getPercentile(50) >= 300);
+		ensure("(5)", histogram.getPercentile(50) < 400);
+	}
+}
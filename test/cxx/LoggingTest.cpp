@@ -0,0 +1,110 @@
+#include <TestSupport.h>
+#include <Logging.h>
+#include <Utils/IOUtils.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct LoggingTest {
+		string logFile;
+
+		LoggingTest() {
+			logFile = "tmp.logging.log";
+			unlink(logFile.c_str());
+			setLogFileWithoutRedirectingStderr(logFile);
+		}
+
+		~LoggingTest() {
+			stopAsyncLogging();
+			setLogFileWithoutRedirectingStderr("/dev/stderr");
+			unlink(logFile.c_str());
+		}
+
+		string readLog() {
+			return readAll(logFile);
+		}
+
+		static void logFromThread(int id) {
+			for (int i = 0; i < 50; i++) {
+				P_WARN("thread " << id << " message " << i);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(LoggingTest);
+
+	TEST_METHOD(1) {
+		set_test_name("In asynchronous mode, log entries are written by the background thread, in order");
+		startAsyncLogging(1024 * 16);
+		ensure(isAsyncLoggingEnabled());
+		for (int i = 0; i < 10; i++) {
+			P_WARN("message " << i);
+		}
+		stopAsyncLogging();
+		ensure(!isAsyncLoggingEnabled());
+
+		string log = readLog();
+		string::size_type pos = 0;
+		for (int i = 0; i < 10; i++) {
+			pos = log.find("message " + toString(i) + "\n", pos);
+			ensure("message " + toString(i) + " is logged", pos != string::npos);
+		}
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Log entries that do not fit in the ring buffer are dropped and counted");
+		boost::uint64_t droppedBefore = getDroppedLogEntryCount();
+		string message(900, 'x');
+
+		startAsyncLogging(4096);
+		for (int i = 0; i < 100; i++) {
+			P_WARN(message);
+		}
+		stopAsyncLogging();
+
+		ensure(getDroppedLogEntryCount() > droppedBefore);
+		ensure(containsSubstring(readLog(), "were dropped because its log buffer was full"));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Log entries larger than a quarter of the ring buffer are written synchronously");
+		string message(2000, 'y');
+
+		startAsyncLogging(4096);
+		P_WARN(message);
+		ensure(containsSubstring(readLog(), message));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Threads that log get their own ring buffer");
+		startAsyncLogging(1024 * 16);
+		TempThread thr1(boost::bind(logFromThread, 1));
+		TempThread thr2(boost::bind(logFromThread, 2));
+		thr1.join();
+		thr2.join();
+		stopAsyncLogging();
+
+		string log = readLog();
+		ensure(containsSubstring(log, "thread 1 message 49\n"));
+		ensure(containsSubstring(log, "thread 2 message 49\n"));
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("P_LOG_RATE_LIMITED logs at most once per interval and reports suppressed entries");
+		for (int i = 0; i < 5; i++) {
+			P_WARN_RATE_LIMITED(3600, "rate limited message");
+		}
+		string log = readLog();
+		ensure_equals(log.find("rate limited message"), log.rfind("rate limited message"));
+
+		LogRateLimiter limiter;
+		unsigned int suppressed = 99;
+		ensure("(1)", limiter.shouldLog(0, &suppressed));
+		ensure_equals("(2)", suppressed, 0u);
+		ensure("(3)", !limiter.shouldLog(3600, &suppressed));
+		ensure("(4)", !limiter.shouldLog(3600, &suppressed));
+		ensure("(5)", limiter.shouldLog(0, &suppressed));
+		ensure_equals("(6)", suppressed, 2u);
+	}
+}
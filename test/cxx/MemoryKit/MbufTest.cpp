@@ -1,5 +1,6 @@
 #include <TestSupport.h>
 #include <boost/move/move.hpp>
+#include <vector>
 #include <Constants.h>
 #include <MemoryKit/mbuf.h>
 
@@ -264,4 +265,92 @@ namespace tut {
 		ensure_equals("(5)", pool.nfree_mbuf_blockq, 0u);
 		ensure_equals("(6)", pool.nactive_mbuf_blockq, 0u);
 	}
+
+	TEST_METHOD(24) {
+		set_test_name("mbuf_get_with_size_class");
+		{
+			mbuf small(mbuf_get_with_size_class(&pool, 0));
+			mbuf large(mbuf_get_with_size_class(&pool, MBUF_SIZE_CLASS_COUNT - 1));
+			ensure_equals("(1)", small.size(), 1024 - MBUF_BLOCK_HSIZE);
+			ensure_equals("(2)", large.size(), 65536 - MBUF_BLOCK_HSIZE);
+			ensure_equals("(3)", pool.size_classes[0].nactive_mbuf_blockq, 1u);
+			ensure_equals("(4)", pool.size_classes[MBUF_SIZE_CLASS_COUNT - 1].nactive_mbuf_blockq, 1u);
+			ensure_equals("(5)", pool.nactive_mbuf_blockq, 0u);
+		}
+		ensure_equals("(6)", pool.size_classes[0].nfree_mbuf_blockq, 1u);
+		ensure_equals("(7)", pool.size_classes[0].nactive_mbuf_blockq, 0u);
+		ensure_equals("(8)", pool.nfree_mbuf_blockq, 0u);
+
+		struct mbuf_block *block = STAILQ_FIRST(&pool.size_classes[0].free_mbuf_blockq);
+		{
+			mbuf buffer(mbuf_get_with_size_class(&pool, 0));
+			ensure("(9)", buffer.mbuf_block == block);
+		}
+
+		ensure_equals("(10)", mbuf_pool_compact(&pool), 2u);
+		ensure_equals("(11)", pool.size_classes[0].nfree_mbuf_blockq, 0u);
+		ensure_equals("(12)", pool.size_classes[MBUF_SIZE_CLASS_COUNT - 1].nfree_mbuf_blockq, 0u);
+	}
+
+	TEST_METHOD(25) {
+		set_test_name("mbuf_pool_trim() gradually releases blocks that weren't needed since the last trim");
+		{
+			mbuf buffers[4];
+			for (unsigned int i = 0; i < 4; i++) {
+				buffers[i] = mbuf_get(&pool);
+			}
+		}
+		ensure_equals("(1)", pool.nfree_mbuf_blockq, 4u);
+
+		// The blocks were in use during this period.
+		ensure_equals("(2)", mbuf_pool_trim(&pool), 0u);
+		ensure_equals("(3)", pool.nfree_mbuf_blockq, 4u);
+
+		// Nobody needed them during this period, so half of them are released.
+		ensure_equals("(4)", mbuf_pool_trim(&pool), 2u);
+		ensure_equals("(5)", pool.nfree_mbuf_blockq, 2u);
+
+		// One block is needed during this period, so only the other one is
+		// eligible for release.
+		{
+			mbuf buffer(mbuf_get(&pool));
+		}
+		ensure_equals("(6)", mbuf_pool_trim(&pool), 1u);
+		ensure_equals("(7)", pool.nfree_mbuf_blockq, 1u);
+
+		ensure_equals("(8)", mbuf_pool_trim(&pool), 1u);
+		ensure_equals("(9)", pool.nfree_mbuf_blockq, 0u);
+	}
+
+	TEST_METHOD(26) {
+		set_test_name("Blocks are carved out of the huge page arena while it has room, "
+			"and stay on the freelist when trimming and compacting");
+		mbuf_pool_enable_hugepages(&pool, HUGEPAGE_SIZE);
+		unsigned int blocksPerRegion = HUGEPAGE_SIZE / pool.mbuf_block_chunk_size;
+		vector<struct mbuf_block *> blocks;
+
+		for (unsigned int i = 0; i < blocksPerRegion + 1; i++) {
+			blocks.push_back(mbuf_block_get(&pool));
+		}
+		ensure("(1)", blocks[0]->in_arena);
+		ensure("(2)", blocks[blocksPerRegion - 1]->in_arena);
+		ensure("(3)", !blocks[blocksPerRegion]->in_arena);
+		ensure_equals("(4)", pool.narena_mbuf_blockq, blocksPerRegion);
+		ensure_equals("(5)", pool.arena.nregions, 1u);
+		ensure_equals("(6)", pool.arena.mapped_size, (size_t) HUGEPAGE_SIZE);
+		ensure_equals("(7)", pool.arena.nfailed_allocs, 1u);
+
+		for (unsigned int i = 0; i < blocks.size(); i++) {
+			mbuf_block_unref(blocks[i]);
+		}
+		ensure_equals("(8)", pool.nfree_mbuf_blockq, blocksPerRegion + 1);
+		ensure_equals("(9)", mbuf_pool_trim(&pool), 0u);
+		ensure_equals("(10)", mbuf_pool_trim(&pool), 1u);
+		ensure_equals("(11)", mbuf_pool_compact(&pool), 0u);
+		ensure_equals("(12)", pool.nfree_mbuf_blockq, blocksPerRegion);
+
+		struct mbuf_block *block = mbuf_block_get(&pool);
+		ensure("(13)", block->in_arena);
+		mbuf_block_unref(block);
+	}
 }
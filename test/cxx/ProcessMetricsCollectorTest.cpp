@@ -120,4 +120,65 @@ namespace tut {
 			ensure(swap < 10000 || swap == -1);
 		#endif
 	}
+
+	TEST_METHOD(4) {
+		// The shared memory is the part of the RSS that isn't private dirty.
+		ProcessMetrics metrics;
+		ensure_equals(metrics.sharedMemory(), (ssize_t) -1);
+		metrics.rss = 4096;
+		ensure_equals(metrics.sharedMemory(), (ssize_t) -1);
+		metrics.privateDirty = 1024;
+		ensure_equals(metrics.sharedMemory(), (ssize_t) 3072);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("On Linux, metrics are read from /proc");
+		#ifdef __linux__
+			child = spawnChild(10);
+			usleep(500000);
+			vector<pid_t> pids;
+			pids.push_back(getpid());
+			pids.push_back(child);
+			pids.push_back(999999);
+			ProcessMetricMap result = collector.collect(pids);
+
+			ensure_equals(result.size(), 2u);
+			ensure_equals(result[child].pid, child);
+			ensure_equals(result[child].ppid, getpid());
+			ensure_equals(result[child].processGroupId, getpgrp());
+			ensure_equals(result[child].uid, geteuid());
+			ensure("RSS is at least the allocated memory", result[child].rss > 10000);
+			ensure("VM size is at least the RSS", result[child].vmsize >= result[child].rss);
+			ensure(result[child].command.find("../buildout/test/allocate_memory 10")
+				!= string::npos);
+			ensure_equals(result[getpid()].ppid, getppid());
+		#endif
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("On Linux, CPU usage is measured since the previous collection");
+		#ifdef __linux__
+			child = fork();
+			if (child == 0) {
+				volatile unsigned long long counter = 0;
+				while (true) {
+					counter++;
+				}
+			}
+			vector<pid_t> pids;
+			pids.push_back(child);
+
+			collector.collect(pids);
+			usleep(1000000);
+			ProcessMetricMap result = collector.collect(pids);
+			ensure("(1)", result[child].cpu >= 50);
+
+			kill(child, SIGSTOP);
+			usleep(100000);
+			collector.collect(pids);
+			usleep(1000000);
+			result = collector.collect(pids);
+			ensure_equals("(2)", result[child].cpu, 0u);
+		#endif
+	}
 }
@@ -0,0 +1,99 @@
+#include "TestSupport.h"
+#include "RandomGenerator.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct RandomGeneratorTest {
+		RandomGenerator generator;
+	};
+
+	DEFINE_TEST_GROUP(RandomGeneratorTest);
+
+	static void generateInThread(string *result) {
+		RandomGenerator generator;
+		*result = generator.generateByteString(32);
+	}
+
+	TEST_METHOD(1) {
+		set_test_name("chacha20Block() matches the test vector in RFC 7539 section 2.3.2");
+		const boost::uint32_t input[16] = {
+			0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+			0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c,
+			0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c,
+			0x00000001, 0x09000000, 0x4a000000, 0x00000000
+		};
+		unsigned char output[64];
+
+		chacha20Block(input, output);
+		ensure_equals(toHex(StaticString((const char *) output, sizeof(output))),
+			"10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+			"d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e");
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Consecutive calls return different data");
+		string a = generator.generateByteString(32);
+		string b = generator.generateByteString(32);
+		ensure_equals(a.size(), 32u);
+		ensure(a != b);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Requests larger than the internal buffer are filled completely");
+		string data = generator.generateByteString(100000);
+		unsigned int zeroes = 0;
+
+		for (unsigned int i = 0; i < data.size(); i++) {
+			if (data[i] == '\0') {
+				zeroes++;
+			}
+		}
+		// About 1 in 256 bytes is expected to be zero.
+		ensure("(1)", zeroes > 100000 / 256 / 2);
+		ensure("(2)", zeroes < 100000 / 256 * 2);
+		ensure("(3)", data.substr(50000, 32) != data.substr(90000, 32));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Different threads generate different data");
+		string a, b;
+		{
+			TempThread thr1(boost::bind(generateInThread, &a));
+			TempThread thr2(boost::bind(generateInThread, &b));
+			thr1.join();
+			thr2.join();
+		}
+		ensure_equals(a.size(), 32u);
+		ensure(a != b);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("A forked child does not generate the same data as its parent");
+		int fds[2];
+		char childData[32];
+
+		// Make sure that this thread's generator has been seeded before forking.
+		generator.generateByteString(1);
+
+		ensure_equals(pipe(fds), 0);
+		pid_t pid = fork();
+		if (pid == 0) {
+			RandomGenerator childGenerator;
+			string data = childGenerator.generateByteString(sizeof(childData));
+			write(fds[1], data.data(), data.size());
+			_exit(0);
+		}
+		close(fds[1]);
+		string parentData = generator.generateByteString(sizeof(childData));
+		ensure_equals(readExact(fds[0], childData, sizeof(childData)), sizeof(childData));
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+		ensure(parentData != string(childData, sizeof(childData)));
+	}
+}
@@ -140,6 +140,16 @@ namespace tut {
 			channel.feed(buf);
 		}
 
+		void feedChannelAndLogState(const string &data) {
+			bg.safe->runLater(boost::bind(&ServerKit_ChannelTest::realFeedChannelAndLogState,
+				this, data));
+		}
+
+		void realFeedChannelAndLogState(string data) {
+			realFeedChannel(data);
+			logChannelState();
+		}
+
 		void feedChannelError(int errcode) {
 			bg.safe->runLater(boost::bind(&ServerKit_ChannelTest::realFeedChannelError,
 				this, errcode));
@@ -1470,4 +1480,61 @@ namespace tut {
 		ensure(!channelIsAcceptingInput());
 		ensure(!channelMayAcceptInputLater());
 	}
+
+
+	/***** Per-iteration budget *****/
+
+	TEST_METHOD(80) {
+		set_test_name("Once the callback has been called channelCallBudget times in "
+			"an event loop iteration, the remainder of the buffer is passed to it in a later iteration");
+
+		context.channelCallBudget = 2;
+		{
+			LOCK();
+			toConsume = 1;
+		}
+		feedChannelAndLogState("abcd");
+		EVENTUALLY(5,
+			LOCK();
+			result = idleCount > 0;
+		);
+		{
+			LOCK();
+			ensure_equals(log,
+				"Data: abcd\n"
+				"Data: bcd\n"
+				"State: " + toString((int) Channel::PLANNING_TO_CALL) + "\n"
+				"Data: cd\n"
+				"Data: d\n");
+			ensure_equals(idleCount, 1u);
+			ensure_equals(bytesConsumed, 4u);
+		}
+	}
+
+	TEST_METHOD(81) {
+		set_test_name("Once the callback has consumed channelByteBudget bytes in "
+			"an event loop iteration, the remainder of the buffer is passed to it in a later iteration");
+
+		context.channelCallBudget = 0;
+		context.channelByteBudget = 2;
+		{
+			LOCK();
+			toConsume = 2;
+		}
+		feedChannelAndLogState("abcdef");
+		EVENTUALLY(5,
+			LOCK();
+			result = idleCount > 0;
+		);
+		{
+			LOCK();
+			ensure_equals(log,
+				"Data: abcdef\n"
+				"State: " + toString((int) Channel::PLANNING_TO_CALL) + "\n"
+				"Data: cdef\n"
+				"Data: ef\n");
+			ensure_equals(idleCount, 1u);
+			ensure_equals(bytesConsumed, 6u);
+		}
+	}
 }
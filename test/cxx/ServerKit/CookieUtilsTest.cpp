@@ -288,4 +288,46 @@ namespace tut {
 		ensure("(1)", result != NULL);
 		ensure("(2)", psg_lstr_cmp(result, &value));
 	}
+
+	TEST_METHOD(37) {
+		set_test_name("Cookie names that are a prefix of another cookie's name");
+		psg_lstr_append(&header, pool, "foobar=1; xfoo=2; foo=bar");
+
+		result = findCookie(pool, &header, &name);
+		ensure("(1)", result != NULL);
+		ensure("(2)", psg_lstr_cmp(result, &value));
+	}
+
+	TEST_METHOD(38) {
+		set_test_name("Whitespace around cookie names and values is stripped");
+		psg_lstr_append(&header, pool, "hello=world;  foo =  bar ;a=b");
+
+		result = findCookie(pool, &header, &name);
+		ensure("(1)", result != NULL);
+		ensure("(2)", psg_lstr_cmp(result, &value));
+	}
+
+	TEST_METHOD(39) {
+		set_test_name("Cookie not found");
+		psg_lstr_append(&header, pool, "hello=world; foo; fo=bar; foobar");
+
+		result = findCookie(pool, &header, &name);
+		ensure_equals<void *>("(1)", result, NULL);
+	}
+
+	TEST_METHOD(40) {
+		set_test_name("findCookies() looks up multiple cookies in one pass");
+		StaticString data = "a=1; foo=bar; b=2; foo=baz; c=3";
+		CookieTarget targets[3];
+
+		targets[0] = CookieTarget("c");
+		targets[1] = CookieTarget("foo");
+		targets[2] = CookieTarget("d");
+		ensure_equals(findCookies(data.data(), data.size(), targets, 3), 2u);
+		ensure("(1)", targets[0].found);
+		ensure_equals(targets[0].value, "3");
+		ensure("(2)", targets[1].found);
+		ensure_equals(targets[1].value, "bar");
+		ensure("(3)", !targets[2].found);
+	}
 }
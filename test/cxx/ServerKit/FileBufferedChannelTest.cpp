@@ -845,6 +845,41 @@ namespace tut {
 		);
 	}
 
+	TEST_METHOD(39) {
+		set_test_name("It moves many memory buffers to disk in order");
+
+		string expected;
+
+		toConsume = -1;
+		context.defaultFileBufferedChannelConfig.threshold = 1;
+		startLoop();
+
+		feedChannel("hello");
+		for (unsigned int i = 0; i < 40; i++) {
+			feedChannel(toString(i) + ",");
+			expected.append(toString(i) + ",");
+		}
+		EVENTUALLY(5,
+			result = getChannelMode() == FileBufferedChannel::IN_FILE_MODE;
+		);
+		EVENTUALLY(5,
+			result = getChannelBytesBuffered() == 0
+				&& getChannelWriterState() == FileBufferedChannel::WS_INACTIVE;
+		);
+
+		{
+			LOCK();
+			toConsume = CONSUME_FULLY;
+		}
+		channelConsumed(sizeof("hello") - 1, false);
+		EVENTUALLY(5,
+			LOCK();
+			result = log ==
+				"Data: hello\n"
+				"Data: " + expected + "\n";
+		);
+	}
+
 
 	/***** Switching from in-file mode to in-memory mode *****/
 
@@ -1,5 +1,7 @@
 #include <TestSupport.h>
 #include <ServerKit/HeaderTable.h>
+#include <map>
+#include <cstdlib>
 
 using namespace Passenger;
 using namespace Passenger::ServerKit;
@@ -191,4 +193,85 @@ namespace tut {
 
 		ensure_equals<void *>("(3)", table.lookup("Content-Length"), NULL);
 	}
+
+	TEST_METHOD(11) {
+		set_test_name("The known header perfect hash table matches KNOWN_HEADERS");
+		unsigned int i, slotsUsed = 0;
+
+		for (i = 0; i < KNOWN_HEADER_COUNT; i++) {
+			ensure_equals(KNOWN_HEADERS[i].data(),
+				(unsigned int) lookupKnownHeaderId(KNOWN_HEADERS[i]), i + 1);
+		}
+		for (i = 0; i < 512; i++) {
+			if (KNOWN_HEADER_SLOTS[i] != 0) {
+				slotsUsed++;
+			}
+		}
+		ensure_equals(slotsUsed, KNOWN_HEADER_COUNT);
+		ensure_equals((unsigned int) lookupKnownHeaderId("hello"), 0u);
+		ensure_equals((unsigned int) lookupKnownHeaderId("Content-Length"), 0u);
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("Known headers can be looked up, merged, erased and cleared");
+
+		insertHeader(createHeader("content-length", "5"), pool);
+		insertHeader(createHeader("x-foo", "bar"), pool);
+		insertHeader(createHeader("cookie", "a"), pool);
+		insertHeader(createHeader("cookie", "b"), pool);
+		ensure_equals(table.size(), 3u);
+		ensure("(1)", psg_lstr_cmp(table.lookup("content-length"), "5"));
+		ensure("(2)", psg_lstr_cmp(table.lookup("x-foo"), "bar"));
+		ensure("(3)", psg_lstr_cmp(table.lookup("cookie"), "a;b"));
+		ensure_equals<void *>("(4)", table.lookup("host"), NULL);
+		ensure("(5)", table.lookupHeader("content-length")->knownId != 0);
+		ensure_equals("(6)", (unsigned int) table.lookupHeader("x-foo")->knownId, 0u);
+
+		HeaderTable copy(table);
+		ensure("(7)", psg_lstr_cmp(copy.lookup("cookie"), "a;b"));
+
+		table.erase("content-length");
+		ensure_equals(table.size(), 2u);
+		ensure_equals<void *>("(8)", table.lookup("content-length"), NULL);
+		ensure("(9)", psg_lstr_cmp(table.lookup("cookie"), "a;b"));
+
+		table.clear();
+		ensure_equals<void *>("(10)", table.lookup("cookie"), NULL);
+		insertHeader(createHeader("cookie", "c"), pool);
+		ensure("(11)", psg_lstr_cmp(table.lookup("cookie"), "c"));
+	}
+
+	TEST_METHOD(13) {
+		set_test_name("Lookups stay consistent with a reference map across random inserts, "
+			"erases, resizes and clears");
+		std::map<string, string> reference;
+		unsigned int seed = 1234;
+
+		table = HeaderTable(1);
+		for (unsigned int round = 0; round < 3; round++) {
+			for (unsigned int i = 0; i < 3000; i++) {
+				string key = "x-header-" + toString(rand_r(&seed) % 500);
+				if (rand_r(&seed) % 3 == 0) {
+					table.erase(key);
+					reference.erase(key);
+				} else if (reference.find(key) == reference.end()) {
+					insertHeader(createHeader(psg_pstrdup(pool, key), "v"), pool);
+					reference[key] = "v";
+				}
+			}
+
+			ensure_equals(table.size(), reference.size());
+			for (unsigned int i = 0; i < 600; i++) {
+				string key = "x-header-" + toString(i);
+				if (reference.find(key) == reference.end()) {
+					ensure(key.c_str(), table.lookup(key) == NULL);
+				} else {
+					ensure(key.c_str(), psg_lstr_cmp(table.lookup(key), "v"));
+				}
+			}
+
+			table.clear();
+			reference.clear();
+		}
+	}
 }
@@ -12,6 +12,7 @@
 #include <Utils.h>
 #include <Utils/IOUtils.h>
 #include <Utils/BufferedIO.h>
+#include <cstdlib>
 
 using namespace Passenger;
 using namespace Passenger::ServerKit;
@@ -127,6 +128,18 @@ namespace tut {
 			}
 		}
 
+		void testDeferredLargeResponse(MyClient *client, MyRequest *req) {
+			refRequest(req, __FILE__, __LINE__);
+			getContext()->libev->runLater(boost::bind(
+				&MyServer::sendDeferredLargeResponse, this, client, req));
+			// Continues in sendDeferredLargeResponse()
+		}
+
+		void sendDeferredLargeResponse(MyClient *client, MyRequest *req) {
+			testLargeResponse(client, req);
+			unrefRequest(req, __FILE__, __LINE__);
+		}
+
 		void testPath(MyClient *client, MyRequest *req) {
 			if (req->path.start->next == NULL) {
 				writeSimpleResponse(client, 200, NULL, "Contiguous: 1");
@@ -138,6 +151,13 @@ namespace tut {
 			}
 		}
 
+		void testTunnel(MyClient *client, MyRequest *req) {
+			if (req->upgraded()) {
+				enterTunnelMode(client, req);
+			}
+			testBody(client, req);
+		}
+
 		void testHalfClose(MyClient *client, MyRequest *req) {
 			req->testingHalfClose = true;
 			// Continues in onRequestEarlyHalfClose()
@@ -168,8 +188,12 @@ namespace tut {
 				testBodyStop(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/large_response")) {
 				testLargeResponse(client, req);
+			} else if (psg_lstr_cmp(&req->path, "/deferred_large_response")) {
+				testDeferredLargeResponse(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/path_test")) {
 				testPath(client, req);
+			} else if (psg_lstr_cmp(&req->path, "/tunnel_test")) {
+				testTunnel(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/half_close_test")) {
 				testHalfClose(client, req);
 			} else if (psg_lstr_cmp(&req->path, "/early_read_error_detection_test")) {
@@ -189,6 +213,10 @@ namespace tut {
 			} else if (errcode == 0) {
 				// EOF
 				req->body.insert(0, toString(req->body.size()) + " bytes: ");
+				if (req->tunneling) {
+					req->body.insert(0, "Tunneled " + toString(req->headers.size()) +
+						" headers of " + string(req->path.start->data, req->path.size) + "\n");
+				}
 				if (!req->testingHalfClose) {
 					writeSimpleResponse(client, 200, NULL, req->body);
 					endRequest(&client, &req);
@@ -397,6 +425,17 @@ namespace tut {
 			*result = server->activeClientCount;
 		}
 
+		unsigned int getTunnelCount() {
+			unsigned int result;
+			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getTunnelCount,
+				this, &result));
+			return result;
+		}
+
+		void _getTunnelCount(unsigned int *result) {
+			*result = server->tunnelCount;
+		}
+
 		unsigned int getNumRequestsWaitingToStartAcceptingBody() {
 			unsigned int result;
 			bg.safe->runSync(boost::bind(
@@ -433,6 +472,51 @@ namespace tut {
 			*result = server->clientDataErrors;
 		}
 
+		void getRequestPoolStats(size_t *size, unsigned long *samples, unsigned long *mallocs) {
+			bg.safe->runSync(boost::bind(
+				&ServerKit_HttpServerTest::_getRequestPoolStats,
+				this, size, samples, mallocs));
+		}
+
+		void _getRequestPoolStats(size_t *size, unsigned long *samples, unsigned long *mallocs) {
+			*size = server->requestPoolSize;
+			*samples = server->requestPoolUsageSamples;
+			*mallocs = server->requestPoolMallocs;
+		}
+
+		void _createSpareClients(unsigned int count) {
+			server->minSpareClients = count;
+			server->createSpareClients();
+		}
+
+		void _getFreelistStats(unsigned int *freeClients, unsigned int *freeRequests,
+			unsigned int *requestsWithPool)
+		{
+			MyRequest *request;
+
+			*freeClients = server->freeClientCount;
+			*freeRequests = server->freeRequestCount;
+			*requestsWithPool = 0;
+			STAILQ_FOREACH(request, &server->freeRequests, nextRequest.freeRequest) {
+				if (request->pool != NULL) {
+					(*requestsWithPool)++;
+				}
+			}
+		}
+
+		void sendRequestWithManyHeaders() {
+			string request = "GET / HTTP/1.1\r\nConnection: close\r\n";
+			for (unsigned int i = 0; i < 300; i++) {
+				request.append("X-Header-" + toString(i) + ": value\r\n");
+			}
+			request.append("\r\n");
+
+			connectToServer();
+			sendRequest(request);
+			readAll(fd);
+			fd.close();
+		}
+
 		void startAcceptingBody() {
 			bg.safe->runLater(boost::bind(&ServerKit_HttpServerTest::_startAcceptingBody,
 				this));
@@ -480,7 +564,7 @@ namespace tut {
 		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(ServerKit_HttpServerTest, 110);
 
 
 	/***** Valid HTTP header parsing *****/
@@ -614,6 +698,30 @@ namespace tut {
 		ensure(containsSubstring(response, "Contiguous: 1"));
 	}
 
+	TEST_METHOD(6) {
+		set_test_name("Long header values are parsed correctly, regardless of "
+			"how they are split into parts and how lines are terminated");
+
+		connectToServer();
+		sendRequestAndWait(
+			"GET / HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+			"Foo: 0123456789abcdefghijklmnopqrstuvwxyz");
+		ensure(!hasResponseData());
+		sendRequestAndWait("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+		ensure(!hasResponseData());
+		sendRequest(
+			"!\n"
+			"Host: foo\r\n\r\n");
+
+		string response = readAll(fd);
+		ensure(containsSubstring(response,
+			"hello /\n"
+			"Foo: 0123456789abcdefghijklmnopqrstuvwxyz"
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!"));
+	}
+
 
 	/***** Invalid HTTP header parsing *****/
 
@@ -654,6 +762,43 @@ namespace tut {
 			"invalid HTTP method"));
 	}
 
+	TEST_METHOD(10) {
+		set_test_name("HTTP/2 clients are told to fall back to HTTP/1.1");
+
+		connectToServer();
+		sendRequest("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+		string response = readAll(fd);
+		ensure_equals(response, string(
+			"\x00\x00\x00" "\x04" "\x00" "\x00\x00\x00\x00"
+			"\x00\x00\x08" "\x07" "\x00" "\x00\x00\x00\x00"
+			"\x00\x00\x00\x00" "\x00\x00\x00\x0d", 26));
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("HTTP/2 clients are told to fall back to HTTP/1.1 "
+			"if the preface arrives in pieces");
+
+		connectToServer();
+		sendRequestAndWait("PR");
+		sendRequest("I * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+		string response = readAll(fd);
+		ensure_equals(response, string(
+			"\x00\x00\x00" "\x04" "\x00" "\x00\x00\x00\x00"
+			"\x00\x00\x08" "\x07" "\x00" "\x00\x00\x00\x00"
+			"\x00\x00\x00\x00" "\x00\x00\x00\x0d", 26));
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("Other invalid methods that start like the HTTP/2 preface "
+			"still get an HTTP/1 error");
+
+		connectToServer();
+		sendRequestAndWait("PR");
+		sendRequest("OX / HTTP/1.1\r\n\r\n");
+		string response = readAll(fd);
+		ensure(containsSubstring(response, "HTTP/1.0 400 Bad Request\r\n"));
+	}
+
 
 	/***** Invalid request *****/
 
@@ -1022,6 +1167,26 @@ namespace tut {
 		ensure("(3)", !containsSubstring(response, "!"));
 	}
 
+	TEST_METHOD(39) {
+		set_test_name("Multiple chunks with mixed-case sizes and chunk extensions");
+
+		connectToServer();
+		sendRequest(
+			"GET /body_test HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n"
+			"A\r\n"
+			"0123456789\r\n"
+			"b;name=value\r\n"
+			"abcdefghijk\r\n"
+			"01\r\n"
+			"!\r\n"
+			"0\r\n\r\n");
+		string response = readAll(fd);
+		ensure("(1)", containsSubstring(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(response, "22 bytes: 0123456789abcdefghijk!"));
+	}
+
 
 	/***** Upgrade handling *****/
 
@@ -1160,6 +1325,31 @@ namespace tut {
 		ensure("(1)", containsSubstring(response, "HTTP/1.1 400 Bad Request\r\n"));
 	}
 
+	TEST_METHOD(48) {
+		set_test_name("In tunnel mode, the request's headers are released, "
+			"but its path is kept and data keeps flowing");
+
+		connectToServer();
+		sendRequestAndWait(
+			"GET /tunnel_test HTTP/1.1\r\n"
+			"Connection: upgrade\r\n"
+			"Upgrade: raw\r\n"
+			"Foo: bar\r\n\r\n"
+			"hm");
+		ensure_equals("(1)", getTunnelCount(), 1u);
+		sendRequestAndWait("ok");
+		sendRequest("!!!");
+		syscalls::shutdown(fd, SHUT_WR);
+
+		string response = readAll(fd);
+		ensure("(2)", containsSubstring(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(3)", containsSubstring(response, "Tunneled 0 headers of /tunnel_test\n"));
+		ensure("(4)", containsSubstring(response, "7 bytes: hmok!!!"));
+		EVENTUALLY(5,
+			result = getTunnelCount() == 0;
+		);
+	}
+
 
 	/***** Secure headers handling *****/
 
@@ -1431,6 +1621,73 @@ namespace tut {
 		);
 	}
 
+	TEST_METHOD(66) {
+		set_test_name("Pipelined requests, with and without bodies, are handled "
+			"and responded to in order");
+
+		connectToServer();
+		sendRequest(
+			"POST /body_test HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Content-Length: 5\r\n\r\n"
+			"hello"
+			"POST /body_test HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Transfer-Encoding: chunked\r\n\r\n"
+			"3\r\nabc\r\n"
+			"0\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+
+		string response = readAll(fd);
+		string::size_type pos1 = response.find("5 bytes: hello");
+		string::size_type pos2 = response.find("3 bytes: abc");
+		string::size_type pos3 = response.find("hello /foo");
+		ensure("(1)", pos1 != string::npos);
+		ensure("(2)", pos2 != string::npos);
+		ensure("(3)", pos3 != string::npos);
+		ensure("(4)", pos1 < pos2);
+		ensure("(5)", pos2 < pos3);
+		ensure_equals("(6)", getTotalRequestsBegun(), 3ul);
+	}
+
+	TEST_METHOD(67) {
+		set_test_name("If a request ends asynchronously with unflushed output data, and the "
+			"next request is already received, it begins the next request before the "
+			"output is flushed, and still responds in order");
+
+		connectToServer();
+		sendRequest(
+			"GET /deferred_large_response HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n"
+			"Size: 10000000\r\n\r\n"
+			"GET /foo HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		EVENTUALLY(5,
+			result = getTotalRequestsBegun() == 2;
+		);
+
+		string data = readAll(fd);
+		string response2 =
+			"HTTP/1.1 200 OK\r\n"
+			"Status: 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Date: Thu, 11 Sep 2014 12:54:09 GMT\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 10\r\n\r\n"
+			"hello /foo";
+
+		string body = stripHeaders(data);
+		ensure(startsWith(data, "HTTP/1.1 200 OK\r\n"));
+		ensure_equals(body.size(), 10000000u + response2.size());
+		ensure_equals(body.substr(10000000), response2);
+	}
+
 
 	/***** Early half-close detection *****/
 
@@ -1727,4 +1984,171 @@ namespace tut {
 			result = getActiveClientCount() == 0;
 		);
 	}
+
+	TEST_METHOD(98) {
+		set_test_name("Request pools are resized based on the pool usage of recent requests");
+
+		size_t size;
+		unsigned long samples, mallocs, mallocsBefore;
+
+		startLoop();
+		getRequestPoolStats(&size, &samples, &mallocs);
+		ensure_equals("(1)", size, (size_t) PSG_DEFAULT_POOL_SIZE);
+
+		for (unsigned int i = 0; i < 16; i++) {
+			sendRequestWithManyHeaders();
+		}
+		EVENTUALLY(5,
+			getRequestPoolStats(&size, &samples, &mallocs);
+			result = samples >= 16;
+		);
+		ensure("(2)", size > PSG_DEFAULT_POOL_SIZE);
+		ensure("(3)", mallocs > 0);
+
+		// Subsequent requests like these fit in the resized pools.
+		mallocsBefore = mallocs;
+		for (unsigned int i = 0; i < 16; i++) {
+			sendRequestWithManyHeaders();
+		}
+		EVENTUALLY(5,
+			getRequestPoolStats(&size, &samples, &mallocs);
+			result = samples >= 32;
+		);
+		ensure_equals("(4)", mallocs, mallocsBefore);
+	}
+
+	TEST_METHOD(99) {
+		set_test_name("createSpareClients() preallocates client and request objects");
+
+		unsigned int freeClients, freeRequests, requestsWithPool;
+
+		startLoop();
+		bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_createSpareClients,
+			this, 8));
+		bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getFreelistStats,
+			this, &freeClients, &freeRequests, &requestsWithPool));
+		ensure_equals("(1)", freeClients, 8u);
+		ensure_equals("(2)", freeRequests, 8u);
+		ensure_equals("(3)", requestsWithPool, 8u);
+
+		// The preallocated objects are used for subsequent requests.
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Host: foo\r\n\r\n");
+		ensure("(4)", containsSubstring(readAll(fd), "hello /hello"));
+		EVENTUALLY(5,
+			bg.safe->runSync(boost::bind(&ServerKit_HttpServerTest::_getFreelistStats,
+				this, &freeClients, &freeRequests, &requestsWithPool));
+			result = freeRequests == 8;
+		);
+	}
+
+	#ifdef SERVER_KIT_SUPPORTS_TLS
+		TEST_METHOD(100) {
+			set_test_name("TLS termination");
+
+			TempDir tmpdir("tmp.tls");
+			int ret = ::system("openssl req -x509 -newkey rsa:2048 -nodes -days 1"
+				" -subj /CN=localhost -keyout tmp.tls/key.pem -out tmp.tls/cert.pem"
+				" >/dev/null 2>&1");
+			if (ret != 0) {
+				// The openssl command is not available.
+				return;
+			}
+
+			TlsContext::Config config;
+			config.certificateFile = "tmp.tls/cert.pem";
+			config.certificateKeyFile = "tmp.tls/key.pem";
+			server->tlsContext = boost::make_shared<TlsContext>(config);
+
+			connectToServer();
+			SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+			SSL *ssl = SSL_new(ctx);
+			SSL_set_fd(ssl, fd);
+			ensure_equals("(1)", SSL_connect(ssl), 1);
+
+			StaticString request(
+				"GET /hello HTTP/1.1\r\n"
+				"Connection: close\r\n"
+				"Host: foo\r\n\r\n");
+			ensure_equals("(2)", SSL_write(ssl, request.data(), request.size()),
+				(int) request.size());
+
+			string response;
+			char buf[1024];
+			while ((ret = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+				response.append(buf, ret);
+			}
+			SSL_free(ssl);
+			SSL_CTX_free(ctx);
+
+			ensure("(3)", startsWith(response, "HTTP/1.1 200 OK\r\n"));
+			ensure("(4)", containsSubstring(response, "hello /hello"));
+		}
+
+		TEST_METHOD(101) {
+			set_test_name("TlsContext throws a ConfigurationException if the certificate cannot be loaded");
+
+			TlsContext::Config config;
+			config.certificateFile = "tmp.nonexistant/cert.pem";
+			config.certificateKeyFile = "tmp.nonexistant/key.pem";
+			try {
+				TlsContext context(config);
+				fail("ConfigurationException expected");
+			} catch (const ConfigurationException &) {
+				// Pass.
+			}
+		}
+	#endif
+
+	TEST_METHOD(102) {
+		set_test_name("Clients that don't send complete request headers in time are disconnected");
+
+		server->headerReadTimeout = 1;
+		connectToServer();
+		sendRequest(
+			"GET / HTTP/1.1\r\n"
+			"Host: foo\r\n");
+		ensure_equals(readAll(fd), "");
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+		ensure_equals(server->totalClientsTimedOut, 1u);
+	}
+
+	TEST_METHOD(103) {
+		set_test_name("Idle keep-alive connections are disconnected after the keep-alive timeout");
+
+		server->keepAliveTimeout = 1;
+		connectToServer();
+		sendRequest(
+			"GET / HTTP/1.1\r\n"
+			"Connection: keep-alive\r\n"
+			"Host: foo\r\n\r\n");
+		string response = readAll(fd);
+		ensure("(1)", startsWith(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(response, "Connection: keep-alive\r\n"));
+		EVENTUALLY(5,
+			result = getActiveClientCount() == 0;
+		);
+	}
+
+	TEST_METHOD(104) {
+		set_test_name("Clients are not timed out while their request is being processed");
+
+		server->headerReadTimeout = 1;
+		connectToServer();
+		sendRequestAndWait(
+			"GET /body_test HTTP/1.1\r\n"
+			"Connection: close\r\n"
+			"Content-Length: 3\r\n\r\n"
+			"h");
+		usleep(2500000);
+		sendRequest("ey");
+		string response = readAll(fd);
+		ensure("(1)", containsSubstring(response, "HTTP/1.1 200 OK\r\n"));
+		ensure("(2)", containsSubstring(response, "3 bytes: hey"));
+	}
 }
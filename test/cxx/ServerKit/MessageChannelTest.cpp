@@ -0,0 +1,221 @@
+#include <TestSupport.h>
+#include <BackgroundEventLoop.h>
+#include <ServerKit/MessageChannel.h>
+#include <Utils/IOUtils.h>
+#include <Utils/MessageIO.h>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_MessageChannelTest {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		MessageChannel channel;
+		SocketPair sockets;
+		boost::mutex syncher;
+		vector<string> log;
+		bool readAgain;
+
+		ServerKit_MessageChannelTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  channel(&context),
+			  readAgain(false)
+		{
+			sockets = createUnixSocketPair(__FILE__, __LINE__);
+			setNonBlocking(sockets.first);
+			channel.userData = this;
+			channel.reinitialize(sockets.first);
+			bg.start();
+		}
+
+		~ServerKit_MessageChannelTest() {
+			bg.safe->runSync(boost::bind(&MessageChannel::deinitialize, &channel));
+			bg.stop();
+		}
+
+		static void onArrayMessage(MessageChannel *channel, int errcode) {
+			ServerKit_MessageChannelTest *self =
+				static_cast<ServerKit_MessageChannelTest *>(channel->userData);
+			boost::lock_guard<boost::mutex> l(self->syncher);
+
+			if (errcode == 0) {
+				const vector<StaticString> &message = channel->getArrayMessage();
+				string str = "array:";
+				for (unsigned int i = 0; i < message.size(); i++) {
+					if (i > 0) {
+						str.append(",");
+					}
+					str.append(message[i].data(), message[i].size());
+				}
+				self->log.push_back(str);
+				if (self->readAgain) {
+					channel->readArrayMessage(onArrayMessage);
+				}
+			} else {
+				self->log.push_back("error:" + toString(errcode));
+			}
+		}
+
+		static void onScalarMessage(MessageChannel *channel, int errcode) {
+			ServerKit_MessageChannelTest *self =
+				static_cast<ServerKit_MessageChannelTest *>(channel->userData);
+			boost::lock_guard<boost::mutex> l(self->syncher);
+
+			if (errcode == 0) {
+				self->log.push_back("scalar:" + channel->getScalarMessage().toString());
+			} else {
+				self->log.push_back("error:" + toString(errcode));
+			}
+		}
+
+		void channelReadArrayMessage(ev_tstamp timeout = 0) {
+			bg.safe->runSync(boost::bind(&MessageChannel::readArrayMessage, &channel,
+				onArrayMessage, timeout));
+		}
+
+		void channelReadScalarMessage() {
+			bg.safe->runSync(boost::bind(&MessageChannel::readScalarMessage, &channel,
+				onScalarMessage, 0));
+		}
+
+		void realWriteArrayMessage(vector<string> args) {
+			vector<StaticString> args2(args.begin(), args.end());
+			channel.writeArrayMessage(&args2[0], args2.size());
+		}
+
+		void channelWriteArrayMessage(const string &arg1, const string &arg2) {
+			vector<string> args;
+			args.push_back(arg1);
+			args.push_back(arg2);
+			bg.safe->runSync(boost::bind(
+				&ServerKit_MessageChannelTest::realWriteArrayMessage, this, args));
+		}
+
+		unsigned int logSize() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return log.size();
+		}
+
+		string logEntry(unsigned int i) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return log[i];
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_MessageChannelTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Reading an array message");
+		channelReadArrayMessage();
+		writeArrayMessage(sockets.second, "hello", "world", NULL);
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		ensure_equals(logEntry(0), "array:hello,world");
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Messages that arrive in pieces");
+		string data;
+		data.append("\0\x0c" "hello\0", 8);
+		channelReadArrayMessage();
+
+		writeExact(sockets.second, data.data(), 3);
+		SHOULD_NEVER_HAPPEN(50,
+			result = logSize() > 0;
+		);
+		writeExact(sockets.second, data.data() + 3, data.size() - 3);
+		writeExact(sockets.second, "world\0", 6);
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		ensure_equals(logEntry(0), "array:hello,world");
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Messages that arrive together are delivered one read at a time");
+		writeArrayMessage(sockets.second, "a", NULL);
+		writeArrayMessage(sockets.second, "b", NULL);
+		writeScalarMessage(sockets.second, "c");
+
+		channelReadArrayMessage();
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		SHOULD_NEVER_HAPPEN(50,
+			result = logSize() > 1;
+		);
+
+		channelReadArrayMessage();
+		EVENTUALLY(5,
+			result = logSize() == 2;
+		);
+		channelReadScalarMessage();
+		EVENTUALLY(5,
+			result = logSize() == 3;
+		);
+		ensure_equals(logEntry(0), "array:a");
+		ensure_equals(logEntry(1), "array:b");
+		ensure_equals(logEntry(2), "scalar:c");
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("The callback can start the next read");
+		readAgain = true;
+		channelReadArrayMessage();
+		writeArrayMessage(sockets.second, "a", NULL);
+		writeArrayMessage(sockets.second, "b", NULL);
+		EVENTUALLY(5,
+			result = logSize() == 2;
+		);
+		ensure_equals(logEntry(0), "array:a");
+		ensure_equals(logEntry(1), "array:b");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Timeouts");
+		channelReadArrayMessage(0.05);
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		ensure_equals(logEntry(0), "error:" + toString(ETIMEDOUT));
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("EOF");
+		channelReadArrayMessage();
+		sockets.second.close();
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		ensure_equals(logEntry(0), "error:" + toString((int) UNEXPECTED_EOF));
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("Messages that are too large");
+		channel.setMaxArrayMessageSize(4);
+		channelReadArrayMessage();
+		writeArrayMessage(sockets.second, "hello", NULL);
+		EVENTUALLY(5,
+			result = logSize() == 1;
+		);
+		ensure_equals(logEntry(0), "error:" + toString(EMSGSIZE));
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("Writing messages");
+		channelWriteArrayMessage("hello", "world");
+
+		vector<string> message = readArrayMessage(sockets.second);
+		ensure_equals(message.size(), 2u);
+		ensure_equals(message[0], "hello");
+		ensure_equals(message[1], "world");
+
+		bg.safe->runSync(boost::bind(&MessageChannel::writeScalarMessage, &channel,
+			StaticString("scalar")));
+		ensure_equals(readScalarMessage(sockets.second), "scalar");
+	}
+}
@@ -423,4 +423,96 @@ namespace tut {
 			result = !clientIsConnected(client.get());
 		);
 	}
+
+
+	/***** Auto-tuning *****/
+
+	TEST_METHOD(29) {
+		set_test_name("The auto-tuner raises the accept burst count when clients are waiting,"
+			" and lowers it when the event loop lags");
+
+		AutoTuner tuner;
+		AutoTunerSample sample;
+
+		sample.acceptEvents = 10;
+		sample.fullAcceptBursts = 8;
+		ensure("(1)", tuner.update(32, 0, 0, sample));
+		ensure_equals("(2)", tuner.acceptBurstCount, 64u);
+		ensure("(3)", tuner.update(100, 0, 0, sample));
+		ensure_equals("(4)", tuner.acceptBurstCount, 127u);
+		ensure("(5)", !tuner.update(127, 0, 0, sample));
+
+		sample = AutoTunerSample();
+		sample.backlogDepth = 3;
+		ensure("(6)", tuner.update(32, 0, 0, sample));
+		ensure_equals("(7)", tuner.acceptBurstCount, 64u);
+
+		sample.loopLag = 0.2;
+		ensure("(8)", tuner.update(64, 0, 0, sample));
+		ensure_equals("(9)", tuner.acceptBurstCount, 32u);
+		ensure("(10)", tuner.update(5, 0, 0, sample));
+		ensure_equals("(11)", tuner.acceptBurstCount, (unsigned int) AutoTuner::MIN_ACCEPT_BURST_COUNT);
+
+		// Once the loop recovers, the burst count goes back up to the
+		// value that it had when the tuner started.
+		sample = AutoTunerSample();
+		ensure("(12)", tuner.update(4, 0, 0, sample));
+		ensure_equals("(13)", tuner.acceptBurstCount, 8u);
+		tuner.update(16, 0, 0, sample);
+		ensure_equals("(14)", tuner.acceptBurstCount, 32u);
+		ensure("(15)", !tuner.update(32, 0, 0, sample));
+	}
+
+	TEST_METHOD(30) {
+		set_test_name("The auto-tuner grows the freelists when client objects had to be allocated,"
+			" and decays them back to the baseline afterwards");
+
+		AutoTuner tuner;
+		AutoTunerSample sample;
+
+		sample.clientsAllocated = 100;
+		ensure("(1)", tuner.update(32, 10, 50, sample));
+		ensure_equals("(2)", tuner.minSpareClients, 110u);
+		ensure_equals("(3)", tuner.clientFreelistLimit, 110u);
+
+		sample.clientsDestroyed = 20;
+		ensure("(4)", tuner.update(32, 110, 110, sample));
+		ensure_equals("(5)", tuner.minSpareClients, 210u);
+		ensure_equals("(6)", tuner.clientFreelistLimit, 230u);
+
+		sample.clientsAllocated = 5000;
+		tuner.update(32, 210, 230, sample);
+		ensure_equals("(7)", tuner.minSpareClients, (unsigned int) AutoTuner::MAX_FREELIST_SIZE);
+		ensure_equals("(8)", tuner.clientFreelistLimit, (unsigned int) AutoTuner::MAX_FREELIST_SIZE);
+
+		unsigned int minSpareClients = tuner.minSpareClients;
+		unsigned int clientFreelistLimit = tuner.clientFreelistLimit;
+		sample = AutoTunerSample();
+		for (unsigned int i = 0; i < AutoTuner::DECAY_INTERVALS - 1; i++) {
+			ensure("(9)", !tuner.update(32, minSpareClients, clientFreelistLimit, sample));
+		}
+		ensure("(10)", tuner.update(32, minSpareClients, clientFreelistLimit, sample));
+		ensure("(11)", tuner.minSpareClients < minSpareClients);
+		ensure("(12)", tuner.clientFreelistLimit >= tuner.minSpareClients);
+
+		for (unsigned int i = 0; i < 100 * AutoTuner::DECAY_INTERVALS; i++) {
+			tuner.update(32, tuner.minSpareClients, tuner.clientFreelistLimit, sample);
+		}
+		ensure_equals("(13)", tuner.minSpareClients, 10u);
+		ensure_equals("(14)", tuner.clientFreelistLimit, 50u);
+	}
+
+	TEST_METHOD(31) {
+		set_test_name("The auto-tuner state is reported in the server state");
+
+		Json::Value config;
+		config["auto_tune"] = true;
+		server->configure(config);
+		ensure("(1)", server->getConfigAsJson()["auto_tune"].asBool());
+
+		Json::Value doc = server->inspectStateAsJson();
+		ensure("(2)", doc.isMember("auto_tuner"));
+		ensure_equals("(3)", doc["auto_tuner"]["accept_burst_count"].asUInt(), 32u);
+		ensure_equals("(4)", doc["auto_tuner"]["accept_decision"].asString(), "none");
+	}
 }
@@ -0,0 +1,415 @@
+#include <TestSupport.h>
+#include <BackgroundEventLoop.h>
+#include <ServerKit/FdSourceChannel.h>
+#include <ServerKit/FdSinkChannel.h>
+#include <Utils/ShmRing.h>
+#include <Utils/StrIntUtils.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_ShmRingTest: public ServerKit::Hooks {
+		BackgroundEventLoop bg;
+		ServerKit::Context context;
+		FdSourceChannel source;
+		FdSinkChannel sink;
+		ShmRingFilePtr file;
+		ShmRingSlot *slot;
+		int fds[2];
+		boost::mutex syncher;
+		string log;
+		// A ring of 64 bytes followed by 16 guard bytes, whose header
+		// the tests corrupt the way a misbehaving app could.
+		boost::uint32_t ringMemory[(ShmRing::HEADER_SIZE + 64 + 16) / 4];
+
+		ServerKit_ShmRingTest()
+			: bg(false, true),
+			  context(bg.safe, bg.libuv_loop),
+			  source(&context),
+			  sink(&context)
+		{
+			Hooks::impl = NULL;
+			Hooks::userData = NULL;
+			source.setHooks(this);
+			source.setDataCallback(onSourceData);
+			file = ShmRingFile::create("/tmp", 2, 64, getuid(), getgid());
+			file->removeFile();
+			slot = NULL;
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+				int e = errno;
+				throw SystemException("socketpair() failed", e);
+			}
+			setNonBlocking(fds[0]);
+			bg.start();
+		}
+
+		~ServerKit_ShmRingTest() {
+			bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::deinitializeChannels,
+				this));
+			bg.stop();
+			if (fds[0] != -1) {
+				close(fds[0]);
+			}
+			if (fds[1] != -1) {
+				close(fds[1]);
+			}
+		}
+
+		void deinitializeChannels() {
+			source.deinitialize();
+			sink.deinitialize();
+		}
+
+		static Channel::Result onSourceData(Channel *channel, const mbuf &buffer, int errcode) {
+			ServerKit_ShmRingTest *self = (ServerKit_ShmRingTest *) channel->hooks;
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			if (errcode != 0) {
+				self->log.append("Error: " + toString(errcode) + "\n");
+			} else if (buffer.empty()) {
+				self->log.append("EOF\n");
+			} else {
+				self->log.append("Data: " + string(buffer.start, buffer.size()) + "\n");
+			}
+			return Channel::Result(buffer.size(), false);
+		}
+
+		string getLog() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return log;
+		}
+
+		void startSource() {
+			source.reinitialize(fds[0], slot);
+			source.startReading();
+		}
+
+		void feedSink(string data) {
+			if (data.empty()) {
+				sink.feed(mbuf());
+			} else {
+				mbuf buf = mbuf_get(&context.mbuf_pool);
+				memcpy(buf.start, data.data(), data.size());
+				sink.feed(mbuf(buf, 0, (unsigned int) data.size()));
+			}
+		}
+
+		void sinkHasError(bool *result) {
+			*result = sink.hasError();
+		}
+
+		/** Reads everything that the app side can read from the outgoing ring. */
+		string readOutgoing() {
+			char buf[256];
+			size_t n = slot->outgoing.read(buf, sizeof(buf));
+			if (slot->outgoing.producerNeedsWakeup()) {
+				ringShmRingDoorbell(fds[1]);
+			}
+			return string(buf, n);
+		}
+
+		ShmRing createCorruptibleRing() {
+			memset(ringMemory, 'G', sizeof(ringMemory));
+			ShmRing ring(ringMemory, 64);
+			ring.reset();
+			return ring;
+		}
+
+		void setRingTail(boost::uint32_t value) {
+			ringMemory[0] = value;
+		}
+
+		void setRingHead(boost::uint32_t value) {
+			ringMemory[64 / 4] = value;
+		}
+
+		bool ringGuardIntact() const {
+			const char *guard = (const char *) ringMemory + ShmRing::HEADER_SIZE + 64;
+			return string(guard, 16) == string(16, 'G');
+		}
+
+		void writeIncoming(const StaticString &data) {
+			ensure_equals(slot->incoming.write(data.data(), data.size()), data.size());
+			if (slot->incoming.consumerNeedsWakeup()) {
+				ringShmRingDoorbell(fds[1]);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_ShmRingTest);
+
+	/***** ShmRing *****/
+
+	TEST_METHOD(1) {
+		set_test_name("Data wraps around the end of the ring");
+		ShmRing &ring = file->checkoutSlot()->outgoing;
+		char buf[64];
+
+		ensure_equals(ring.getCapacity(), 64u);
+		ensure_equals(ring.write(string(40, 'a').data(), 40), 40u);
+		ensure_equals(ring.read(buf, 40), 40u);
+
+		string data;
+		for (unsigned int i = 0; i < 64; i++) {
+			data.append(1, (char) ('0' + i % 10));
+		}
+		ensure_equals("It accepts no more than the capacity",
+			ring.write(data.data(), 70), 64u);
+		ensure_equals(ring.writable(), 0u);
+		ensure_equals(ring.readable(), 64u);
+		ensure_equals(ring.read(buf, sizeof(buf)), 64u);
+		ensure_equals(string(buf, 64), data);
+		ensure_equals(ring.readable(), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("The waiting flags are only set if there is reason to wait");
+		ShmRing &ring = file->checkoutSlot()->outgoing;
+		char buf[64];
+
+		ensure(!ring.consumerNeedsWakeup());
+		ensure("An empty ring makes the consumer wait", ring.prepareToWaitForData());
+		ensure(ring.consumerNeedsWakeup());
+		ring.write("x", 1);
+		ensure("Data makes the consumer stop waiting", !ring.prepareToWaitForData());
+		ensure(!ring.consumerNeedsWakeup());
+
+		ensure("A ring with space doesn't make the producer wait",
+			!ring.prepareToWaitForSpace());
+		ensure(!ring.producerNeedsWakeup());
+		ring.write(string(63, 'y').data(), 63);
+		ensure(ring.prepareToWaitForSpace());
+		ensure(ring.producerNeedsWakeup());
+		ring.read(buf, 1);
+		ring.stopWaitingForSpace();
+		ensure(!ring.producerNeedsWakeup());
+
+		ring.read(buf, sizeof(buf));
+		ring.close();
+		ensure(ring.atEof());
+		ensure("A closed ring doesn't make the consumer wait", !ring.prepareToWaitForData());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Slots are only reused once both sides are done with them");
+		ShmRingSlot *slot1 = file->checkoutSlot();
+		ShmRingSlot *slot2 = file->checkoutSlot();
+
+		ensure(slot1 != NULL);
+		ensure(slot2 != NULL);
+		ensure(slot1 != slot2);
+		ensure_equals(file->checkoutSlot(), (ShmRingSlot *) NULL);
+
+		slot1->outgoing.write("abc", 3);
+		slot1->checkin();
+		ensure("The peer still uses the slot",
+			file->checkoutSlot() == NULL);
+		file->releaseSlotAsPeer(slot1->index);
+		ensure_equals(file->checkoutSlot(), slot1);
+		ensure_equals("The rings are emptied", slot1->outgoing.readable(), 0u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("A corrupted ring header is detected instead of trusted");
+		ShmRing ring = createCorruptibleRing();
+		string data(200, 'x');
+		char buf[200];
+
+		// The consumer claims to have read more than was ever written.
+		setRingHead(0x80000000);
+		ensure_equals(ring.writable(), 0u);
+		ensure_equals("Nothing is written", ring.write(data.data(), data.size()), 0u);
+		ensure(ring.isCorrupted());
+		ensure("Nothing is written past the ring", ringGuardIntact());
+
+		ring.reset();
+		ensure(!ring.isCorrupted());
+		// The producer claims to have written more than fits.
+		setRingTail(1000);
+		ensure_equals(ring.readable(), 0u);
+		ensure_equals("Nothing is read", ring.read(buf, sizeof(buf)), 0u);
+		ensure(ring.isCorrupted());
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Checking in a slot with a corrupted ring disables the file");
+		ShmRingSlot *slot1 = file->checkoutSlot();
+		char buf[64];
+
+		slot1->incoming = createCorruptibleRing();
+		setRingTail(1000);
+		slot1->incoming.read(buf, sizeof(buf));
+		ensure(!file->isDisabled());
+		slot1->checkin();
+		ensure(file->isDisabled());
+		ensure_equals("No more slots are handed out",
+			file->checkoutSlot(), (ShmRingSlot *) NULL);
+	}
+
+	/***** FdSourceChannel *****/
+
+	TEST_METHOD(10) {
+		set_test_name("FdSourceChannel reads from the incoming ring when the doorbell rings");
+		slot = file->checkoutSlot();
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::startSource, this));
+
+		writeIncoming("hello");
+		EVENTUALLY(5,
+			result = getLog() == "Data: hello\n";
+		);
+
+		slot->incoming.close();
+		if (slot->incoming.consumerNeedsWakeup()) {
+			ringShmRingDoorbell(fds[1]);
+		}
+		EVENTUALLY(5,
+			result = getLog() == "Data: hello\nEOF\n";
+		);
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("FdSourceChannel picks up data that was written before it started");
+		slot = file->checkoutSlot();
+		slot->incoming.write("early", 5);
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::startSource, this));
+		EVENTUALLY(5,
+			result = getLog() == "Data: early\n";
+		);
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("FdSourceChannel passes on the remaining ring data, then EOF, "
+			"if the peer closes the connection");
+		slot = file->checkoutSlot();
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::startSource, this));
+		SHOULD_NEVER_HAPPEN(50,
+			result = !getLog().empty();
+		);
+
+		// Written without ringing the doorbell.
+		slot->incoming.write("abc", 3);
+		close(fds[1]);
+		fds[1] = -1;
+		EVENTUALLY(5,
+			result = getLog() == "Data: abc\nEOF\n";
+		);
+	}
+
+	TEST_METHOD(13) {
+		set_test_name("FdSourceChannel reports a protocol error if the peer corrupts "
+			"the incoming ring");
+		slot = file->checkoutSlot();
+		slot->incoming = createCorruptibleRing();
+		setRingTail(1000);
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::startSource, this));
+		ringShmRingDoorbell(fds[1]);
+		EVENTUALLY(5,
+			result = getLog() == "Error: " + toString(EPROTO) + "\n";
+		);
+	}
+
+	/***** FdSinkChannel *****/
+
+	TEST_METHOD(20) {
+		set_test_name("FdSinkChannel waits for the doorbell when the outgoing ring is full");
+		slot = file->checkoutSlot();
+		string data(100, 'x');
+		data.replace(64, 36, string(36, 'y'));
+
+		bg.safe->runSync(boost::bind(&FdSinkChannel::reinitialize, &sink, fds[0], slot));
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::feedSink, this, data));
+		ensure_equals(slot->outgoing.readable(), 64u);
+		ensure(slot->outgoing.producerNeedsWakeup());
+
+		ensure_equals(readOutgoing(), string(64, 'x'));
+		EVENTUALLY(5,
+			result = slot->outgoing.readable() == 36;
+		);
+		ensure_equals(readOutgoing(), string(36, 'y'));
+
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::feedSink, this, string()));
+		ensure(slot->outgoing.atEof());
+	}
+
+	TEST_METHOD(21) {
+		set_test_name("FdSinkChannel::writev() writes to the outgoing ring");
+		slot = file->checkoutSlot();
+		struct iovec iov[2];
+		char buf[8];
+
+		setNonBlocking(fds[1]);
+		bg.safe->runSync(boost::bind(&FdSinkChannel::reinitialize, &sink, fds[0], slot));
+		iov[0].iov_base = (void *) "foo";
+		iov[0].iov_len = 3;
+		iov[1].iov_base = (void *) "bar";
+		iov[1].iov_len = 3;
+		ensure_equals(sink.writev(iov, 2), (ssize_t) 6);
+		ensure_equals(readOutgoing(), "foobar");
+		ensure("No doorbell is rung if the peer isn't waiting",
+			read(fds[1], buf, sizeof(buf)) == -1 && errno == EAGAIN);
+
+		slot->outgoing.prepareToWaitForData();
+		ensure_equals(sink.writev(iov, 1), (ssize_t) 3);
+		ensure_equals("The doorbell is rung if the peer is waiting",
+			read(fds[1], buf, sizeof(buf)), (ssize_t) 1);
+	}
+
+	TEST_METHOD(22) {
+		set_test_name("FdSinkChannel reports an error if the peer closes the connection "
+			"while the outgoing ring is full");
+		slot = file->checkoutSlot();
+		bool hasError = false;
+
+		bg.safe->runSync(boost::bind(&FdSinkChannel::reinitialize, &sink, fds[0], slot));
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::feedSink, this,
+			string(100, 'x')));
+		close(fds[1]);
+		fds[1] = -1;
+		EVENTUALLY(5,
+			bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::sinkHasError,
+				this, &hasError));
+			result = hasError;
+		);
+	}
+
+	TEST_METHOD(23) {
+		set_test_name("FdSinkChannel::writev() doesn't write past the outgoing ring "
+			"if the peer corrupts it");
+		slot = file->checkoutSlot();
+		slot->outgoing = createCorruptibleRing();
+		string data(100000, 'x');
+		struct iovec iov;
+
+		setNonBlocking(fds[1]);
+		bg.safe->runSync(boost::bind(&FdSinkChannel::reinitialize, &sink, fds[0], slot));
+		setRingHead(0x1000);
+		iov.iov_base = (void *) data.data();
+		iov.iov_len = data.size();
+		errno = 0;
+		ensure_equals(sink.writev(&iov, 1), (ssize_t) -1);
+		ensure_equals(errno, EPROTO);
+		ensure(ringGuardIntact());
+	}
+
+	TEST_METHOD(24) {
+		set_test_name("FdSinkChannel reports a protocol error if the peer corrupts "
+			"the outgoing ring");
+		slot = file->checkoutSlot();
+		slot->outgoing = createCorruptibleRing();
+		bool hasError = false;
+
+		bg.safe->runSync(boost::bind(&FdSinkChannel::reinitialize, &sink, fds[0], slot));
+		setRingHead(0x1000);
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::feedSink, this,
+			string(100, 'x')));
+		bg.safe->runSync(boost::bind(&ServerKit_ShmRingTest::sinkHasError,
+			this, &hasError));
+		ensure(hasError);
+		ensure(ringGuardIntact());
+	}
+}
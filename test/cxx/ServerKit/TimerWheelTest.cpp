@@ -0,0 +1,146 @@
+#include <TestSupport.h>
+#include <ServerKit/TimerWheel.h>
+#include <vector>
+
+using namespace Passenger;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+namespace tut {
+	struct ServerKit_TimerWheelTest {
+		struct ev_loop *loop;
+		TimerWheel *wheel;
+		TimerWheelEntry entries[4];
+		vector<int> fired;
+		vector<boost::uint64_t> firedTicks;
+		TimerWheelEntry *entryToCancel;
+		bool reschedule;
+
+		ServerKit_TimerWheelTest() {
+			loop = ev_loop_new(EVFLAG_AUTO);
+			wheel = new TimerWheel(loop);
+			for (unsigned int i = 0; i < 4; i++) {
+				entries[i].callback = onTimeout;
+				entries[i].data = this;
+			}
+			entryToCancel = NULL;
+			reschedule = false;
+		}
+
+		~ServerKit_TimerWheelTest() {
+			delete wheel;
+			ev_loop_destroy(loop);
+		}
+
+		static void onTimeout(TimerWheelEntry *entry) {
+			ServerKit_TimerWheelTest *self = (ServerKit_TimerWheelTest *) entry->data;
+			self->fired.push_back(entry - self->entries);
+			// The wheel already moved on to the next tick.
+			self->firedTicks.push_back(self->wheel->getCurrentTick() - 1);
+			if (self->entryToCancel != NULL) {
+				self->wheel->cancel(self->entryToCancel);
+			}
+			if (self->reschedule) {
+				self->reschedule = false;
+				self->wheel->schedule(entry, 10);
+			}
+		}
+
+		boost::uint64_t now() {
+			return wheel->getNowTick();
+		}
+	};
+
+	DEFINE_TEST_GROUP(ServerKit_TimerWheelTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Initial state");
+		ensure_equals(wheel->size(), 0u);
+		ensure(!entries[0].isScheduled());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("An entry expires once its timeout has passed, but not before");
+		boost::uint64_t start = now();
+
+		wheel->schedule(&entries[0], 5);
+		ensure(entries[0].isScheduled());
+		ensure_equals(wheel->size(), 1u);
+
+		wheel->advanceTo(start + 4);
+		ensure_equals(fired.size(), 0u);
+
+		wheel->advanceTo(start + 6);
+		ensure_equals(fired.size(), 1u);
+		ensure_equals(fired[0], 0);
+		ensure(!entries[0].isScheduled());
+		ensure_equals(wheel->size(), 0u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Cancelled entries don't expire");
+		boost::uint64_t start = now();
+
+		wheel->schedule(&entries[0], 5);
+		wheel->schedule(&entries[1], 5);
+		wheel->cancel(&entries[0]);
+		ensure(!entries[0].isScheduled());
+		ensure_equals(wheel->size(), 1u);
+
+		wheel->advanceTo(start + 10);
+		ensure_equals(fired.size(), 1u);
+		ensure_equals(fired[0], 1);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Rescheduling an entry replaces its previous expiry");
+		boost::uint64_t start = now();
+
+		wheel->schedule(&entries[0], 5);
+		wheel->schedule(&entries[0], 30);
+		ensure_equals(wheel->size(), 1u);
+
+		wheel->advanceTo(start + 20);
+		ensure_equals(fired.size(), 0u);
+		wheel->advanceTo(start + 31);
+		ensure_equals(fired.size(), 1u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Entries on higher levels expire exactly at their tick");
+
+		wheel->schedule(&entries[0], 100);
+		wheel->schedule(&entries[1], 5000);
+		wheel->schedule(&entries[2], 300000);
+		wheel->schedule(&entries[3], 63);
+
+		wheel->advanceTo(entries[2].expiry + 10);
+		ensure_equals(fired.size(), 4u);
+		ensure_equals(fired[0], 3);
+		ensure_equals(firedTicks[0], entries[3].expiry);
+		ensure_equals(fired[1], 0);
+		ensure_equals(firedTicks[1], entries[0].expiry);
+		ensure_equals(fired[2], 1);
+		ensure_equals(firedTicks[2], entries[1].expiry);
+		ensure_equals(fired[3], 2);
+		ensure_equals(firedTicks[3], entries[2].expiry);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Callbacks may reschedule their entry, and cancel entries "
+			"that expire in the same tick");
+		boost::uint64_t start = now();
+
+		wheel->schedule(&entries[0], 5);
+		wheel->schedule(&entries[1], 5);
+		entryToCancel = &entries[1];
+		reschedule = true;
+
+		wheel->advanceTo(start + 6);
+		ensure_equals(fired.size(), 1u);
+		ensure_equals(fired[0], 0);
+		ensure(entries[0].isScheduled());
+		ensure(!entries[1].isScheduled());
+		ensure_equals(wheel->size(), 1u);
+	}
+}
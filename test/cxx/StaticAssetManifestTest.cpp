@@ -0,0 +1,139 @@
+#include "TestSupport.h"
+#include "Utils/StaticAssetManifest.hpp"
+#include "Utils/SystemTime.h"
+#include <Utils.h>
+
+using namespace std;
+using namespace Passenger;
+
+namespace tut {
+	struct StaticAssetManifestTest {
+		TempDir tmpDir;
+		string publicDir, assetsDir;
+
+		StaticAssetManifestTest()
+			: tmpDir("tmp.assets")
+		{
+			publicDir = absolutizePath("tmp.assets");
+			assetsDir = publicDir + "/assets";
+			makeDirTree(assetsDir);
+		}
+
+		~StaticAssetManifestTest() {
+			SystemTime::release();
+		}
+
+		void writeManifest(const string &name, const string &files) {
+			createFile(assetsDir + "/" + name, "{ \"files\": { " + files + " }, \"assets\": {} }");
+		}
+	};
+
+	DEFINE_TEST_GROUP(StaticAssetManifestTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Loading a manifest records the listed files that exist, with their precompressed variants");
+		createFile(assetsDir + "/application-abc.js", "hello");
+		createFile(assetsDir + "/application-abc.js.gz", "x");
+		createFile(assetsDir + "/application-abc.css", "world!");
+		createFile(assetsDir + "/application-abc.css.br", "x");
+		writeManifest(".sprockets-manifest-0123.json",
+			"\"application-abc.js\": { \"size\": 5 }, "
+			"\"application-abc.css\": { \"size\": 6 }, "
+			"\"removed-abc.js\": { \"size\": 1 }");
+
+		StaticAssetManifest manifest;
+		ensure(manifest.load(assetsDir));
+		ensure_equals(manifest.getPath(), assetsDir + "/.sprockets-manifest-0123.json");
+		ensure_equals(manifest.size(), 2u);
+
+		StaticAsset asset = manifest.lookup("application-abc.js");
+		ensure(asset.exists);
+		ensure_equals(asset.size, 5ull);
+		ensure(asset.hasGzipVariant);
+		ensure(!asset.hasBrotliVariant);
+
+		asset = manifest.lookup("application-abc.css");
+		ensure(asset.exists);
+		ensure_equals(asset.size, 6ull);
+		ensure(!asset.hasGzipVariant);
+		ensure(asset.hasBrotliVariant);
+
+		ensure(!manifest.lookup("removed-abc.js").exists);
+		ensure(!manifest.lookup("unlisted.js").exists);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Loading fails if the directory doesn't contain a manifest");
+		createFile(assetsDir + "/application-abc.js", "hello");
+		StaticAssetManifest manifest;
+		ensure(!manifest.load(assetsDir));
+		ensure(manifest.getPath().empty());
+		ensure(!manifest.lookup("application-abc.js").exists);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Manifest entries that point outside the asset directory are ignored");
+		createFile(publicDir + "/secret.txt", "hello");
+		writeManifest("manifest-0123.json",
+			"\"../secret.txt\": {}, "
+			"\"" + publicDir + "/secret.txt\": {}");
+
+		StaticAssetManifest manifest;
+		ensure(manifest.load(assetsDir));
+		ensure_equals(manifest.size(), 0u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("The registry looks up files in the asset directory below the document root");
+		makeDirTree(assetsDir + "/admin");
+		createFile(assetsDir + "/admin/app-abc.js", "hello");
+		createFile(assetsDir + "/other.js", "hello");
+		writeManifest(".sprockets-manifest-0123.json", "\"admin/app-abc.js\": {}");
+
+		StaticAssetManifestRegistry registry(1);
+		ensure(registry.lookup(publicDir, assetsDir + "/admin/app-abc.js").exists);
+		ensure(registry.lookup(publicDir + "/", assetsDir + "/admin/app-abc.js").exists);
+		ensure("Unlisted files are not found",
+			!registry.lookup(publicDir, assetsDir + "/other.js").exists);
+		ensure("Files outside the document root are not found",
+			!registry.lookup("/nonexistant", assetsDir + "/admin/app-abc.js").exists);
+		ensure("Files outside any asset directory are not found",
+			!registry.lookup(publicDir, publicDir + "/admin/app-abc.js").exists);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("The registry reloads the manifest once the throttle rate has passed");
+		createFile(assetsDir + "/a.js", "hello");
+		createFile(assetsDir + "/b.js", "hello");
+		writeManifest(".sprockets-manifest-0123.json", "\"a.js\": {}");
+
+		StaticAssetManifestRegistry registry(3);
+		SystemTime::force(100);
+		ensure(registry.lookup(publicDir, assetsDir + "/a.js").exists);
+		ensure(!registry.lookup(publicDir, assetsDir + "/b.js").exists);
+
+		writeManifest(".sprockets-manifest-0123.json", "\"b.js\": {}");
+		touchFile((assetsDir + "/.sprockets-manifest-0123.json").c_str(), time(NULL) + 10);
+		SystemTime::force(101);
+		ensure("The cached manifest is used until the throttle rate has passed",
+			registry.lookup(publicDir, assetsDir + "/a.js").exists);
+
+		SystemTime::force(103);
+		ensure(!registry.lookup(publicDir, assetsDir + "/a.js").exists);
+		ensure(registry.lookup(publicDir, assetsDir + "/b.js").exists);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("The registry forgets the manifest once it's removed");
+		createFile(assetsDir + "/a.js", "hello");
+		writeManifest(".sprockets-manifest-0123.json", "\"a.js\": {}");
+
+		StaticAssetManifestRegistry registry(1);
+		SystemTime::force(100);
+		ensure(registry.lookup(publicDir, assetsDir + "/a.js").exists);
+
+		removeDirTree(assetsDir);
+		SystemTime::force(101);
+		ensure(!registry.lookup(publicDir, assetsDir + "/a.js").exists);
+	}
+}
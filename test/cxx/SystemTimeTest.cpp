@@ -7,7 +7,8 @@ using namespace std;
 namespace tut {
 	struct SystemTimeTest {
 		~SystemTimeTest() {
-			SystemTime::release();
+			SystemTime::releaseAll();
+			SystemTime::clearCache();
 		}
 	};
 
@@ -34,4 +35,33 @@ namespace tut {
 		time_t now = SystemTime::get();
 		ensure(now >= begin && now <= begin + 2);
 	}
+
+	TEST_METHOD(3) {
+		set_test_name("The cached time stays the same until the cache is updated");
+		SystemTime::updateCache();
+		unsigned long long usec = SystemTime::getCachedUsec();
+		MonotonicTimeUsec monotonicUsec = SystemTime::getCachedMonotonicUsec();
+		usleep(2000);
+		ensure_equals(SystemTime::getCachedUsec(), usec);
+		ensure_equals(SystemTime::getCachedMonotonicUsec(), monotonicUsec);
+
+		SystemTime::updateCache();
+		ensure(SystemTime::getCachedUsec() > usec);
+		ensure(SystemTime::getCachedMonotonicUsec() > monotonicUsec);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Forced times take precedence over the cache");
+		SystemTime::updateCache();
+		SystemTime::forceUsec(1);
+		ensure_equals(SystemTime::getCachedUsec(), 1ull);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Without a cache, the clock is queried");
+		SystemTime::clearCache();
+		unsigned long long usec = SystemTime::getCachedUsec();
+		usleep(2000);
+		ensure(SystemTime::getCachedUsec() > usec);
+	}
 }
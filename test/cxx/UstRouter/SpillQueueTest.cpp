@@ -0,0 +1,177 @@
+#include "TestSupport.h"
+#include <UstRouter/SpillQueue.h>
+
+using namespace Passenger;
+using namespace Passenger::UstRouter;
+using namespace std;
+
+namespace tut {
+	struct UstRouter_SpillQueueTest {
+		TempDir tmpdir;
+
+		UstRouter_SpillQueueTest()
+			: tmpdir("tmp.spill")
+		{ }
+
+		string segmentPath(unsigned int number) {
+			char name[32];
+			snprintf(name, sizeof(name), "tmp.spill/segment-%010u", number);
+			return name;
+		}
+	};
+
+	DEFINE_TEST_GROUP(UstRouter_SpillQueueTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Records are popped in the order in which they were pushed");
+		SpillQueue queue("tmp.spill", 1024 * 1024, 64);
+		string record;
+
+		ensure("(1)", queue.empty());
+		ensure("(2)", !queue.pop(record));
+
+		for (unsigned int i = 0; i < 10; i++) {
+			ensure(queue.push("record " + toString(i)));
+		}
+		ensure_equals("(3)", queue.count(), 10u);
+
+		for (unsigned int i = 0; i < 10; i++) {
+			ensure("(4)", queue.pop(record));
+			ensure_equals("(5)", record, "record " + toString(i));
+		}
+		ensure("(6)", queue.empty());
+		ensure("(7)", !queue.pop(record));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Pushing and popping can be interleaved");
+		SpillQueue queue("tmp.spill", 1024 * 1024, 64);
+		string record;
+
+		ensure(queue.push("a"));
+		ensure(queue.push("b"));
+		ensure("(1)", queue.pop(record));
+		ensure_equals("(2)", record, "a");
+		ensure(queue.push("c"));
+		ensure("(3)", queue.pop(record));
+		ensure_equals("(4)", record, "b");
+		ensure("(5)", queue.pop(record));
+		ensure_equals("(6)", record, "c");
+		ensure("(7)", !queue.pop(record));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Records are preserved on disk");
+		string record;
+
+		{
+			SpillQueue queue("tmp.spill", 1024 * 1024, 64);
+			for (unsigned int i = 0; i < 10; i++) {
+				ensure(queue.push("record " + toString(i)));
+			}
+			ensure(queue.pop(record));
+		}
+
+		SpillQueue queue("tmp.spill", 1024 * 1024, 64);
+		ensure_equals("(1)", queue.count(), 10u);
+		for (unsigned int i = 0; i < 10; i++) {
+			ensure("(2)", queue.pop(record));
+			ensure_equals("(3)", record, "record " + toString(i));
+		}
+		ensure("(4)", !queue.pop(record));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Consumed segments are deleted");
+		SpillQueue queue("tmp.spill", 1024 * 1024, 64);
+		string record;
+
+		ensure(queue.push(string(50, 'x')));
+		ensure(queue.push(string(50, 'y')));
+		ensure("(1)", fileExists(segmentPath(0)));
+		ensure("(2)", fileExists(segmentPath(1)));
+
+		ensure(queue.pop(record));
+		ensure(queue.pop(record));
+		ensure(!queue.pop(record));
+		ensure("(3)", !fileExists(segmentPath(0)));
+		ensure("(4)", !fileExists(segmentPath(1)));
+		ensure_equals("(5)", queue.size(), 0u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("The oldest segments are dropped when the size limit is reached");
+		// Every record takes 62 bytes, so each segment holds one record.
+		SpillQueue queue("tmp.spill", 200, 64);
+		string record;
+
+		for (unsigned int i = 0; i < 5; i++) {
+			ensure(queue.push(string(49, 'a' + i) + "!"));
+		}
+		ensure_equals("(1)", queue.count(), 3u);
+		ensure_equals("(2)", queue.dropped(), 2u);
+		ensure("(3)", queue.size() <= 200);
+
+		ensure(queue.pop(record));
+		ensure_equals("(4)", record, string(49, 'c') + "!");
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Records larger than the size limit are rejected");
+		SpillQueue queue("tmp.spill", 100, 64);
+		ensure("(1)", !queue.push(string(100, 'x')));
+		ensure("(2)", queue.empty());
+		ensure_equals("(3)", queue.dropped(), 1u);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("Corrupt records are skipped together with the rest of their segment");
+		string record;
+
+		{
+			SpillQueue queue("tmp.spill", 1024 * 1024, 1024);
+			ensure(queue.push("record 1"));
+			ensure(queue.push("record 2"));
+			ensure(queue.push("record 3"));
+		}
+		{
+			SpillQueue queue("tmp.spill", 1024 * 1024, 1024);
+			ensure(queue.push("record 4"));
+		}
+
+		// Corrupt the data of "record 2".
+		string contents = readAll(segmentPath(0));
+		contents[contents.find("record 2") + 7] = 'X';
+		createFile(segmentPath(0), contents);
+
+		SpillQueue queue("tmp.spill", 1024 * 1024, 1024);
+		ensure_equals("(1)", queue.count(), 4u);
+		ensure("(2)", queue.pop(record));
+		ensure_equals("(3)", record, "record 1");
+		ensure("(4)", queue.pop(record));
+		ensure_equals("(5)", record, "record 4");
+		ensure("(6)", !queue.pop(record));
+		ensure_equals("(7)", queue.corrupted(), 2u);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("A truncated record at the end of a segment is ignored");
+		string record;
+
+		{
+			SpillQueue queue("tmp.spill", 1024 * 1024, 1024);
+			ensure(queue.push("record 1"));
+			ensure(queue.push("record 2"));
+		}
+
+		string contents = readAll(segmentPath(0));
+		createFile(segmentPath(0), contents.substr(0, contents.size() - 3));
+
+		SpillQueue queue("tmp.spill", 1024 * 1024, 1024);
+		ensure_equals("(1)", queue.count(), 1u);
+		ensure("(2)", queue.pop(record));
+		ensure_equals("(3)", record, "record 1");
+		ensure("(4)", !queue.pop(record));
+		ensure_equals("(5)", queue.corrupted(), 0u);
+	}
+}
@@ -7,7 +7,15 @@ using namespace std;
 
 namespace tut {
 	struct UstRouter_TransactionTest {
+		struct MemoryKit::mbuf_pool pool;
+
 		UstRouter_TransactionTest() {
+			pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
+			MemoryKit::mbuf_pool_init(&pool);
+		}
+
+		~UstRouter_TransactionTest() {
+			MemoryKit::mbuf_pool_deinit(&pool);
 		}
 	};
 
@@ -15,7 +23,7 @@ namespace tut {
 
 	TEST_METHOD(1) {
 		set_test_name("Constructor");
-		Transaction t("txnId", "groupName", "nodeName", "category",
+		Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
 			"unionStationKey", 1234, "filters");
 		ensure_equals("(1)", t.getTxnId(), "txnId");
 		ensure_equals("(2)", t.getGroupName(), "groupName");
@@ -28,7 +36,7 @@ namespace tut {
 
 	TEST_METHOD(2) {
 		set_test_name("Appending body data");
-		Transaction t("txnId", "groupName", "nodeName", "category",
+		Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
 			"unionStationKey", 1234, "filters");
 
 		t.append("timestamp1", "body1");
@@ -40,7 +48,7 @@ namespace tut {
 
 	TEST_METHOD(3) {
 		set_test_name("Move constructor");
-		Transaction t("txnId", "groupName", "nodeName", "category",
+		Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
 			"unionStationKey", 1234, "filters");
 		t.append("timestamp1", "body1");
 		t.append("timestamp2", "body2");
@@ -68,12 +76,12 @@ namespace tut {
 
 	TEST_METHOD(4) {
 		set_test_name("Move assignment");
-		Transaction t("txnId", "groupName", "nodeName", "category",
+		Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
 			"unionStationKey", 1234, "filters");
 		t.append("timestamp1", "body1");
 		t.append("timestamp2", "body2");
 
-		Transaction t2("txnId2", "groupName2", "nodeName2", "category2",
+		Transaction t2(&pool, "txnId2", "groupName2", "nodeName2", "category2",
 			"unionStationKey2", 4321, "filters2");
 		t2 = boost::move(t);
 
@@ -98,7 +106,7 @@ namespace tut {
 
 	TEST_METHOD(5) {
 		set_test_name("Expanding the storage area");
-		Transaction t("txnId", "groupName", "nodeName", "category",
+		Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
 			"unionStationKey", 1234, "filters", 128);
 		string body1(1024, 'x');
 		string body2(1024, 'y');
@@ -116,4 +124,29 @@ namespace tut {
 			"txnId timestamp1 0 " + body1 + "\n"
 			"txnId timestamp2 1 " + body2 + "\n");
 	}
+
+	TEST_METHOD(6) {
+		set_test_name("Body buffers outlive the transaction");
+		MemoryKit::mbuf buffer;
+		string body, expected;
+
+		{
+			Transaction t(&pool, "txnId", "groupName", "nodeName", "category",
+				"unionStationKey", 1234, "filters", 128);
+			t.append("timestamp1", string(1024 * 8, 'x'));
+			expected = t.getBody();
+			ensure("(1)", t.getBodyBufferCount() > 1);
+			ensure_equals("(2)", t.getBodySize(), expected.size());
+
+			for (unsigned int i = 0; i < t.getBodyBufferCount(); i++) {
+				body.append(t.getBodyData(i).data(), t.getBodyData(i).size());
+			}
+			ensure_equals("(3)", body, expected);
+
+			buffer = t.getBodyBuffer(0);
+		}
+
+		ensure_equals("(4)", StaticString(buffer.start, buffer.size()),
+			StaticString(expected.data(), buffer.size()));
+	}
 }
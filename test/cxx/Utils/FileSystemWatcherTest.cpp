@@ -0,0 +1,96 @@
+#include <TestSupport.h>
+#include <Utils/FileSystemWatcher.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct FileSystemWatcherTest {
+		TempDir tmpDir;
+		string dir;
+		vector<FileSystemWatcher::Event> events;
+
+		FileSystemWatcherTest()
+			: tmpDir("tmp.watcher"),
+			  dir("tmp.watcher/dir")
+		{
+			makeDirTree(dir);
+		}
+
+		bool receivedEventFor(const string &filename) {
+			vector<FileSystemWatcher::Event>::const_iterator it;
+			for (it = events.begin(); it != events.end(); it++) {
+				if (it->dir == dir && it->filename == filename) {
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	DEFINE_TEST_GROUP(FileSystemWatcherTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Changes to files in a watched directory are reported");
+		if (!FileSystemWatcher::isSupported()) {
+			return;
+		}
+		FileSystemWatcher watcher;
+		ensure(watcher.watchDirectory(dir));
+
+		touchFile("tmp.watcher/dir/restart.txt");
+		ensure("(1)", watcher.waitForEvents(events, 1000));
+		ensure("(2)", receivedEventFor("restart.txt"));
+
+		events.clear();
+		touchFile("tmp.watcher/dir/restart.txt", 1);
+		ensure("(3)", watcher.waitForEvents(events, 1000));
+		ensure("(4)", receivedEventFor("restart.txt"));
+
+		events.clear();
+		touchFile("tmp.watcher/other.txt");
+		ensure("Files outside the watched directory are not reported",
+			!watcher.waitForEvents(events, 50));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("A directory is watched until it has been unwatched as often as it was watched");
+		if (!FileSystemWatcher::isSupported()) {
+			return;
+		}
+		FileSystemWatcher watcher;
+		ensure(watcher.watchDirectory(dir));
+		ensure(watcher.watchDirectory(dir));
+
+		watcher.unwatchDirectory(dir);
+		ensure("(1)", watcher.isWatching(dir));
+		touchFile("tmp.watcher/dir/restart.txt");
+		ensure("(2)", watcher.waitForEvents(events, 1000));
+
+		watcher.unwatchDirectory(dir);
+		ensure("(3)", !watcher.isWatching(dir));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Removing a watched directory is reported as a lost watch");
+		if (!FileSystemWatcher::isSupported()) {
+			return;
+		}
+		FileSystemWatcher watcher;
+		ensure(watcher.watchDirectory(dir));
+		ensure("Nonexistent directories cannot be watched",
+			!watcher.watchDirectory("tmp.watcher/nonexistent"));
+
+		removeDirTree(dir);
+		bool watchLost = false;
+		EVENTUALLY(5,
+			events.clear();
+			watcher.waitForEvents(events, 100);
+			for (unsigned int i = 0; i < events.size(); i++) {
+				watchLost = watchLost || (events[i].dir == dir && events[i].watchLost);
+			}
+			result = watchLost;
+		);
+		ensure(!watcher.isWatching(dir));
+	}
+}
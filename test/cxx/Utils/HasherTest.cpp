@@ -0,0 +1,154 @@
+#include <TestSupport.h>
+#include <Utils/Hasher.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/Timer.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct HasherTest {
+		string data;
+		string mixedCaseData;
+
+		HasherTest() {
+			for (unsigned int i = 0; i < 100; i++) {
+				data.append(1, (char) ('a' + i % 26));
+			}
+			for (unsigned int i = 0; i < 100; i++) {
+				mixedCaseData.append(1, (char) ((i % 3 == 0 ? '@' : '`') + i % 28));
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(HasherTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Crc32cHash computes CRC32C checksums");
+		Crc32cHash h;
+
+		h.update("123456789", 9);
+		ensure_equals(~h.hash, 0xE3069283u);
+
+		h.reset();
+		h.updateWithoutHardwareAcceleration("123456789", 9);
+		ensure_equals(~h.hash, 0xE3069283u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("The empty string hashes to EMPTY_STRING_HASH");
+		Hasher h;
+		ensure_equals(h.finalize(), (boost::uint32_t) Hasher::EMPTY_STRING_HASH);
+		h.update("", 0);
+		ensure_equals(h.finalize(), (boost::uint32_t) Hasher::EMPTY_STRING_HASH);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The result does not depend on how the input is split over update() calls");
+		Hasher h;
+
+		h.update(data.data(), data.size());
+		boost::uint32_t expected = h.finalize();
+
+		for (unsigned int i = 0; i <= data.size(); i++) {
+			h.reset();
+			h.update(data.data(), i);
+			h.update(data.data() + i, data.size() - i);
+			ensure_equals(("Split at " + toString(i)).c_str(), h.finalize(), expected);
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("The hardware accelerated and the software implementations agree");
+		Crc32cHash hw, sw;
+
+		for (unsigned int offset = 0; offset < 8; offset++) {
+			for (unsigned int size = 0; size + offset <= data.size(); size++) {
+				hw.reset();
+				sw.reset();
+				hw.update(data.data() + offset, size);
+				sw.updateWithoutHardwareAcceleration(data.data() + offset, size);
+				ensure_equals(("Offset " + toString(offset) + ", size " + toString(size)).c_str(),
+					hw.finalize(), sw.finalize());
+			}
+		}
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("updateLowerCase() downcases the data and hashes the downcased result");
+		string expectedOutput(mixedCaseData.size(), '\0');
+		convertLowerCase((const unsigned char *) mixedCaseData.data(),
+			(unsigned char *) &expectedOutput[0], mixedCaseData.size());
+
+		for (unsigned int offset = 0; offset < 8; offset++) {
+			for (unsigned int size = 0; size + offset <= mixedCaseData.size(); size++) {
+				string message = "Offset " + toString(offset) + ", size " + toString(size);
+				string output(size, '\0');
+				Hasher expected, actual;
+				Crc32cHash sw;
+
+				expected.update(expectedOutput.data() + offset, size);
+				actual.updateLowerCase(mixedCaseData.data() + offset, size, &output[0]);
+				ensure_equals((message + " (output)").c_str(), output,
+					expectedOutput.substr(offset, size));
+				ensure_equals((message + " (hash)").c_str(), actual.finalize(),
+					expected.finalize());
+
+				sw.updateLowerCaseWithoutHardwareAcceleration(mixedCaseData.data() + offset,
+					size, &output[0]);
+				ensure_equals((message + " (software output)").c_str(), output,
+					expectedOutput.substr(offset, size));
+				expected.reset();
+				expected.update(expectedOutput.data() + offset, size);
+				ensure_equals((message + " (software hash)").c_str(), sw.finalize(),
+					expected.finalize());
+			}
+		}
+	}
+
+
+	/************ Benchmarks ************/
+
+	// These only measure something when PASSENGER_BENCHMARK is set.
+
+	TEST_METHOD(20) {
+		if (getenv("PASSENGER_BENCHMARK") == NULL) {
+			return;
+		}
+
+		static const char *names[] = { "Host", "User-Agent", "Accept",
+			"Accept-Language", "Accept-Encoding", "Cookie", "Connection",
+			"X-Forwarded-For", "X-Forwarded-Proto", "Upgrade-Insecure-Requests" };
+		const unsigned int count = sizeof(names) / sizeof(const char *);
+		const unsigned int iterations = 1000000;
+		char output[64];
+		boost::uint32_t result = 0;
+		unsigned int i, j;
+		Hasher h;
+		Timer<> timer;
+
+		for (i = 0; i < iterations; i++) {
+			for (j = 0; j < count; j++) {
+				size_t len = strlen(names[j]);
+				convertLowerCase((const unsigned char *) names[j],
+					(unsigned char *) output, len);
+				h.reset();
+				h.update(output, len);
+				result ^= h.finalize();
+			}
+		}
+		fprintf(stderr, "convertLowerCase + update: %.1f nsec per header name\n",
+			timer.usecElapsed() * 1000.0 / (iterations * count));
+
+		timer.start();
+		for (i = 0; i < iterations; i++) {
+			for (j = 0; j < count; j++) {
+				h.reset();
+				h.updateLowerCase(names[j], strlen(names[j]), output);
+				result ^= h.finalize();
+			}
+		}
+		fprintf(stderr, "updateLowerCase: %.1f nsec per header name (%u)\n",
+			timer.usecElapsed() * 1000.0 / (iterations * count), result);
+	}
+}
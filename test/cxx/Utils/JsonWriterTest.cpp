@@ -0,0 +1,149 @@
+#include <TestSupport.h>
+#include <Constants.h>
+#include <Utils/JsonWriter.h>
+#include <jsoncpp/json.h>
+
+using namespace Passenger;
+using namespace Passenger::MemoryKit;
+using namespace std;
+
+namespace tut {
+	struct JsonWriterTest {
+		struct mbuf_pool pool;
+		string output;
+
+		JsonWriterTest() {
+			pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
+			mbuf_pool_init(&pool);
+		}
+
+		~JsonWriterTest() {
+			mbuf_pool_deinit(&pool);
+		}
+
+		static Json::Value parse(const string &str) {
+			Json::Reader reader;
+			Json::Value doc;
+			if (!reader.parse(str, doc, false)) {
+				fail(("Invalid JSON: " + str).c_str());
+			}
+			return doc;
+		}
+
+		static string concat(const vector<mbuf> &buffers) {
+			string result;
+			for (unsigned int i = 0; i < buffers.size(); i++) {
+				result.append(buffers[i].start, buffers[i].size());
+			}
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(JsonWriterTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Compact output");
+		JsonWriter writer(output, false);
+
+		writer.beginObject();
+		writer.member("a", 1);
+		writer.key("b");
+		writer.beginArray();
+		writer.value(true);
+		writer.nullValue();
+		writer.value(-12345678901ll);
+		writer.beginObject();
+		writer.endObject();
+		writer.beginArray();
+		writer.endArray();
+		writer.endArray();
+		writer.member("c", "str");
+		writer.endObject();
+
+		ensure_equals(output,
+			"{\"a\":1,\"b\":[true,null,-12345678901,{},[]],\"c\":\"str\"}");
+		ensure_equals(writer.size(), (boost::uint64_t) output.size());
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Indented objects are formatted like Json::Value::toStyledString()");
+		JsonWriter writer(output);
+		Json::Value doc;
+
+		doc["a"] = 1;
+		doc["b"] = 2.5;
+		doc["c"]["d"] = false;
+
+		writer.beginObject();
+		writer.members(doc);
+		writer.endObject();
+		output.append("\n");
+
+		ensure_equals(output, doc.toStyledString());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Strings are escaped");
+		JsonWriter writer(output, false);
+		const char str[] = "quote\" backslash\\ newline\n tab\t ctrl\x01 nul\0 end";
+
+		writer.value(StaticString(str, sizeof(str) - 1));
+
+		ensure_equals(parse("[" + output + "]")[0u].asString(),
+			string(str, sizeof(str) - 1));
+		ensure("Control characters are escaped", output.find('\x01') == string::npos);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Integer limits");
+		JsonWriter writer(output, false);
+
+		writer.beginArray();
+		writer.value(0);
+		writer.value((long long) -9223372036854775807ll - 1);
+		writer.value(18446744073709551615ull);
+		writer.endArray();
+
+		ensure_equals(output, "[0,-9223372036854775808,18446744073709551615]");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("A document written at a given depth can be embedded with rawValue()");
+		string inner;
+		JsonWriter innerWriter(inner, true, 1);
+		innerWriter.beginObject();
+		innerWriter.member("x", 1);
+		innerWriter.endObject();
+
+		JsonWriter writer(output);
+		writer.beginObject();
+		writer.key("inner");
+		writer.rawValue(inner);
+		writer.endObject();
+		output.append("\n");
+
+		Json::Value doc;
+		doc["inner"]["x"] = 1;
+		ensure_equals(output, doc.toStyledString());
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Writing to mbufs produces the same output as writing to a string");
+		JsonWriter writer(&pool, false);
+		JsonWriter stringWriter(output, false);
+
+		writer.beginArray();
+		stringWriter.beginArray();
+		for (unsigned int i = 0; i < 10000; i++) {
+			writer.value(i);
+			stringWriter.value(i);
+		}
+		writer.endArray();
+		stringWriter.endArray();
+		writer.finish();
+
+		ensure("Multiple mbufs were used", writer.buffers.size() > 1);
+		ensure_equals(concat(writer.buffers), output);
+		ensure_equals(writer.size(), (boost::uint64_t) output.size());
+	}
+}
@@ -0,0 +1,194 @@
+#include <TestSupport.h>
+#include <Utils/MpmcQueue.h>
+#include <Utils/BlockingQueue.h>
+#include <Utils/Timer.h>
+#include <oxt/thread.hpp>
+#include <boost/bind.hpp>
+#include <vector>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct MpmcQueueTest {
+		MpmcQueue<string> queue;
+		boost::atomic<unsigned long long> sum;
+		vector<oxt::thread *> threads;
+
+		MpmcQueueTest()
+			: queue(4),
+			  sum(0)
+			{ }
+
+		~MpmcQueueTest() {
+			joinThreads();
+		}
+
+		void joinThreads() {
+			for (unsigned int i = 0; i < threads.size(); i++) {
+				threads[i]->join();
+				delete threads[i];
+			}
+			threads.clear();
+		}
+
+		template<typename Queue>
+		static void produce(Queue *q, unsigned int count) {
+			for (unsigned int i = 1; i <= count; i++) {
+				q->add(i);
+			}
+		}
+
+		template<typename Queue>
+		static void consume(Queue *q, unsigned int count,
+			boost::atomic<unsigned long long> *sum)
+		{
+			unsigned long long localSum = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				localSum += q->get();
+			}
+			sum->fetch_add(localSum);
+		}
+
+		template<typename Queue>
+		void runProducersAndConsumers(Queue &q, unsigned int producers,
+			unsigned int consumers, unsigned int itemsPerProducer)
+		{
+			unsigned int i;
+			unsigned int total = producers * itemsPerProducer;
+
+			sum = 0;
+			for (i = 0; i < consumers; i++) {
+				threads.push_back(new oxt::thread(boost::bind(consume<Queue>,
+					&q, total / consumers, &sum)));
+			}
+			for (i = 0; i < producers; i++) {
+				threads.push_back(new oxt::thread(boost::bind(produce<Queue>,
+					&q, itemsPerProducer)));
+			}
+			joinThreads();
+		}
+	};
+
+	DEFINE_TEST_GROUP(MpmcQueueTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Items are removed in the order they were added");
+		string item;
+
+		ensure(queue.tryAdd("a"));
+		ensure(queue.tryAdd("b"));
+		ensure_equals(queue.size(), 2u);
+		ensure(queue.tryGet(item));
+		ensure_equals(item, "a");
+		ensure(queue.tryAdd("c"));
+		ensure_equals(queue.get(), "b");
+		ensure_equals(queue.get(), "c");
+		ensure_equals(queue.size(), 0u);
+		ensure(!queue.tryGet(item));
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("The capacity is rounded up to a power of two and tryAdd() fails when full");
+		MpmcQueue<int> q(5);
+		ensure_equals(q.capacity(), 8u);
+		for (int i = 0; i < 8; i++) {
+			ensure("(1)", q.tryAdd(i));
+		}
+		ensure("(2)", !q.tryAdd(8));
+
+		int item;
+		ensure("(3)", q.tryGet(item));
+		ensure_equals(item, 0);
+		ensure("(4)", q.tryAdd(8));
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The queue keeps working after wrapping around many times");
+		string item;
+		for (unsigned int i = 0; i < 1000; i++) {
+			ensure(queue.tryAdd(toString(i)));
+			ensure(queue.tryAdd(toString(i + 1)));
+			ensure(queue.tryGet(item));
+			ensure_equals(item, toString(i));
+			ensure(queue.tryGet(item));
+			ensure_equals(item, toString(i + 1));
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("tryGetBatch() removes up to the given number of items");
+		string items[4];
+		queue.add("a");
+		queue.add("b");
+		queue.add("c");
+		ensure_equals(queue.tryGetBatch(items, 2), 2u);
+		ensure_equals(items[0], "a");
+		ensure_equals(items[1], "b");
+		ensure_equals(queue.tryGetBatch(items, 4), 1u);
+		ensure_equals(items[0], "c");
+		ensure_equals(queue.tryGetBatch(items, 4), 0u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("timedGet() returns false after the timeout if the queue stays empty");
+		string item;
+		Timer<> timer;
+		ensure(!queue.timedGet(item, 30));
+		ensure(timer.elapsed() >= 25);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("get() and add() block until another thread adds or removes an item");
+		MpmcQueue<unsigned int> q(2);
+		runProducersAndConsumers(q, 1, 1, 1000);
+		ensure_equals(sum.load(), 1000ull * 1001 / 2);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("No items are lost or duplicated with multiple producers and consumers");
+		MpmcQueue<unsigned int> q(16);
+		runProducersAndConsumers(q, 4, 4, 20000);
+		ensure_equals(sum.load(), 4ull * 20000 * 20001 / 2);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("BlockingQueue works with and without a maximum size");
+		BlockingQueue<unsigned int> bounded(16), unbounded;
+		runProducersAndConsumers(bounded, 2, 2, 10000);
+		ensure_equals("(1)", sum.load(), 2ull * 10000 * 10001 / 2);
+		runProducersAndConsumers(unbounded, 2, 2, 10000);
+		ensure_equals("(2)", sum.load(), 2ull * 10000 * 10001 / 2);
+
+		unsigned int item;
+		ensure("(3)", bounded.tryAdd(1));
+		ensure("(4)", bounded.timedGet(item, 10));
+		ensure("(5)", !bounded.timedGet(item, 10));
+	}
+
+
+	/************ Benchmarks ************/
+
+	// These only measure something when PASSENGER_BENCHMARK is set.
+
+	TEST_METHOD(20) {
+		// MpmcQueue versus a mutex-protected queue, 4 producers and 4 consumers.
+		if (getenv("PASSENGER_BENCHMARK") == NULL) {
+			return;
+		}
+
+		const unsigned int itemsPerProducer = 1000000;
+		MpmcQueue<unsigned int> lockFree(1024);
+		BlockingQueue<unsigned int> locked;
+		Timer<> timer;
+
+		runProducersAndConsumers(lockFree, 4, 4, itemsPerProducer);
+		fprintf(stderr, "MpmcQueue: %.1f nsec per item\n",
+			timer.usecElapsed() * 1000.0 / (4 * itemsPerProducer));
+
+		timer.start();
+		runProducersAndConsumers(locked, 4, 4, itemsPerProducer);
+		fprintf(stderr, "Mutex-protected queue: %.1f nsec per item\n",
+			timer.usecElapsed() * 1000.0 / (4 * itemsPerProducer));
+	}
+}
@@ -1,5 +1,7 @@
 #include <TestSupport.h>
 #include <Utils/StrIntUtils.h>
+#include <Utils/Timer.h>
+#include <cctype>
 
 using namespace Passenger;
 using namespace std;
@@ -42,4 +44,82 @@ namespace tut {
 		string result = escapeHTML(s);
 		ensure_equals(result, "h?llo");
 	}
+
+	TEST_METHOD(5) {
+		set_test_name("convertLowerCase() only converts ASCII letters, at any length and alignment");
+		string data;
+		for (unsigned int i = 0; i < 256; i++) {
+			data.append(1, (char) i);
+		}
+		data.append(data);
+
+		for (unsigned int offset = 0; offset < 16; offset++) {
+			for (unsigned int len = 0; offset + len <= data.size(); len += 7) {
+				const unsigned char *input = (const unsigned char *) data.data() + offset;
+				string output(len, '\0');
+				convertLowerCase(input, (unsigned char *) &output[0], len);
+				for (unsigned int i = 0; i < len; i++) {
+					unsigned char expected = (input[i] >= 'A' && input[i] <= 'Z')
+						? input[i] + ('a' - 'A')
+						: input[i];
+					ensure_equals(("Offset " + toString(offset) + ", length "
+						+ toString(len) + ", index " + toString(i)).c_str(),
+						(unsigned char) output[i], expected);
+				}
+			}
+		}
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("equalsCaseInsensitive()");
+		ensure(equalsCaseInsensitive("", ""));
+		ensure(equalsCaseInsensitive("Content-Type", "content-type"));
+		ensure(equalsCaseInsensitive("X-FORWARDED-PROTO", "x-forwarded-proto"));
+		ensure(equalsCaseInsensitive("x-gzip", "X-GZip"));
+		ensure(!equalsCaseInsensitive("gzip", "x-gzip"));
+		ensure(!equalsCaseInsensitive("Content-Type", "Content-Typf"));
+		ensure(!equalsCaseInsensitive("Content-Length-Abc", "Content-Length-Abd"));
+		// '@' and '`', '[' and '{' differ only in bit 0x20 but are not letters.
+		ensure(!equalsCaseInsensitive("@@@@@@@@@@@@@@@@@@", "``````````````````"));
+		ensure(!equalsCaseInsensitive("[", "{"));
+		ensure(!equalsCaseInsensitive("\xC0", "\xE0"));
+	}
+
+
+	/************ Benchmarks ************/
+
+	// These only measure something when PASSENGER_BENCHMARK is set.
+
+	TEST_METHOD(20) {
+		if (getenv("PASSENGER_BENCHMARK") == NULL) {
+			return;
+		}
+
+		static const char *names[] = { "Host", "User-Agent", "Accept",
+			"Accept-Language", "Accept-Encoding", "Cookie", "Connection",
+			"X-Forwarded-For", "X-Forwarded-Proto", "Upgrade-Insecure-Requests" };
+		const unsigned int count = sizeof(names) / sizeof(const char *);
+		const unsigned int iterations = 1000000;
+		char output[64];
+		unsigned int i, j, matches = 0;
+		Timer<> timer;
+
+		for (i = 0; i < iterations; i++) {
+			for (j = 0; j < count; j++) {
+				convertLowerCase((const unsigned char *) names[j],
+					(unsigned char *) output, strlen(names[j]));
+			}
+		}
+		fprintf(stderr, "convertLowerCase: %.1f nsec per header name\n",
+			timer.usecElapsed() * 1000.0 / (iterations * count));
+
+		timer.start();
+		for (i = 0; i < iterations; i++) {
+			for (j = 0; j < count; j++) {
+				matches += equalsCaseInsensitive(names[j], names[(i + j) % count]);
+			}
+		}
+		fprintf(stderr, "equalsCaseInsensitive: %.1f nsec per comparison (%u matches)\n",
+			timer.usecElapsed() * 1000.0 / (iterations * count), matches);
+	}
 }
@@ -0,0 +1,97 @@
+#include <TestSupport.h>
+#include <Utils/SystemMetricsHistory.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct SystemMetricsHistoryTest {
+		SystemMetrics metrics;
+
+		SystemMetricsHistoryTest() {
+			metrics.ramTotal = 1024;
+		}
+	};
+
+	DEFINE_TEST_GROUP(SystemMetricsHistoryTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Samples are kept oldest first");
+		SystemMetricsHistory history(3);
+
+		for (int i = 0; i < 2; i++) {
+			metrics.ramUsed = i;
+			history.add(metrics, 100 + i);
+		}
+		ensure_equals("(1)", history.size(), 2u);
+		ensure_equals("(2)", history.get(0).time, (time_t) 100);
+		ensure_equals("(3)", history.get(0).ramUsed, (ssize_t) 0);
+		ensure_equals("(4)", history.get(1).time, (time_t) 101);
+		ensure_equals("(5)", history.get(1).ramUsed, (ssize_t) 1);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("When full, adding a sample overwrites the oldest one");
+		SystemMetricsHistory history(3);
+
+		for (int i = 0; i < 5; i++) {
+			history.add(metrics, 100 + i);
+		}
+		ensure_equals("(1)", history.size(), 3u);
+		ensure_equals("(2)", history.get(0).time, (time_t) 102);
+		ensure_equals("(3)", history.get(1).time, (time_t) 103);
+		ensure_equals("(4)", history.get(2).time, (time_t) 104);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("inspectAsJson() only returns samples that are recent enough,"
+			" and reports unknown values as null");
+		SystemMetricsHistory history(10);
+
+		history.add(metrics, 100);
+		history.add(metrics, 200);
+		metrics.cgroupMemoryLimit = 2048;
+		metrics.cgroupMemoryUsage = 512;
+		history.add(metrics, 300);
+
+		Json::Value doc = history.inspectAsJson(200);
+		ensure_equals("(1)", doc.size(), 2u);
+		ensure_equals("(2)", doc[0]["time"].asInt(), 200);
+		ensure_equals("(3)", doc[0]["ram_total"].asInt(), 1024);
+		ensure("(4)", doc[0]["ram_used"].isNull());
+		ensure("(5)", doc[0]["cpu_usage"].isNull());
+		ensure("(6)", !doc[0].isMember("cgroup_memory_limit"));
+		ensure_equals("(7)", doc[1]["cgroup_memory_limit"].asInt(), 2048);
+		ensure_equals("(8)", doc[1]["cgroup_memory_usage"].asInt(), 512);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("avgCpuUsageSince() averages the known CPU usages of recent samples");
+		SystemMetricsHistory history(10);
+
+		ensure_equals("(1)", history.avgCpuUsageSince(0), -1.0);
+		history.add(metrics, 100);
+		ensure_equals("(2)", history.avgCpuUsageSince(0), -1.0);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Samples from a real collector contain memory information"
+			" and, after two collections, CPU usages");
+		SystemMetricsCollector collector;
+		SystemMetricsHistory history(10);
+		SystemMetrics realMetrics;
+
+		collector.collect(realMetrics);
+		usleep(20000);
+		collector.collect(realMetrics);
+		history.add(realMetrics, 100);
+
+		#ifdef __linux__
+			ensure("(1)", history.get(0).ramTotal > 0);
+			ensure("(2)", history.get(0).ramUsed > 0);
+			ensure("(3)", !history.get(0).cpuUsages.empty());
+			ensure("(4)", history.get(0).avgCpuUsage >= 0);
+			ensure("(5)", history.avgCpuUsageSince(0) >= 0);
+		#endif
+	}
+}
@@ -0,0 +1,139 @@
+#include <TestSupport.h>
+#include <Utils/ThreadCachedObjectPool.h>
+#include <oxt/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <set>
+#include <vector>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct Object {
+		int value;
+		char padding[40];
+	};
+
+	typedef ThreadCachedObjectPool<Object> Pool;
+
+	struct ThreadCachedObjectPoolTest {
+		boost::scoped_ptr<Pool> pool;
+
+		ThreadCachedObjectPoolTest() {
+			pool.reset(new Pool(4, 16));
+		}
+
+		static void allocate(Pool *pool, vector<Object *> *result, unsigned int count) {
+			for (unsigned int i = 0; i < count; i++) {
+				Object *object = pool->malloc();
+				object->value = i;
+				result->push_back(object);
+			}
+		}
+
+		static void freeAll(Pool *pool, vector<Object *> *objects) {
+			for (unsigned int i = 0; i < objects->size(); i++) {
+				pool->free((*objects)[i]);
+			}
+			objects->clear();
+		}
+
+		static void allocateAndFree(Pool *pool, unsigned int count) {
+			vector<Object *> objects;
+			allocate(pool, &objects, count);
+			freeAll(pool, &objects);
+		}
+
+		static void runInThread(const boost::function<void ()> &func) {
+			oxt::thread thr(func);
+			thr.join();
+		}
+
+		static void churn(Pool *pool, boost::atomic<unsigned int> *errors) {
+			for (unsigned int i = 0; i < 1000; i++) {
+				vector<Object *> objects;
+				allocate(pool, &objects, 10);
+				for (unsigned int j = 0; j < objects.size(); j++) {
+					if (objects[j]->value != (int) j) {
+						errors->fetch_add(1);
+					}
+				}
+				freeAll(pool, &objects);
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(ThreadCachedObjectPoolTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Objects freed by the allocating thread are reused by that thread");
+		vector<Object *> objects;
+
+		allocate(pool.get(), &objects, 3);
+		set<Object *> allocated(objects.begin(), objects.end());
+		ensure_equals(allocated.size(), 3u);
+		freeAll(pool.get(), &objects);
+
+		allocate(pool.get(), &objects, 3);
+		for (unsigned int i = 0; i < objects.size(); i++) {
+			ensure(allocated.find(objects[i]) != allocated.end());
+		}
+		freeAll(pool.get(), &objects);
+		ensure_equals(pool->getSlabCount(), 1u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Objects freed by another thread go back to the allocating thread");
+		vector<Object *> objects;
+
+		allocate(pool.get(), &objects, 4);
+		set<Object *> allocated(objects.begin(), objects.end());
+		runInThread(boost::bind(freeAll, pool.get(), &objects));
+
+		// The slab's single chunk of 4 objects is used up, so these can
+		// only come from the remote free list.
+		allocate(pool.get(), &objects, 4);
+		for (unsigned int i = 0; i < objects.size(); i++) {
+			ensure(allocated.find(objects[i]) != allocated.end());
+		}
+		freeAll(pool.get(), &objects);
+		ensure_equals("Freeing doesn't create a slab", pool->getSlabCount(), 1u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The slab of an exited thread is adopted by the next thread");
+		runInThread(boost::bind(allocateAndFree, pool.get(), 10));
+		runInThread(boost::bind(allocateAndFree, pool.get(), 10));
+		runInThread(boost::bind(allocateAndFree, pool.get(), 10));
+		ensure_equals(pool->getSlabCount(), 1u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("A pool may be destroyed before the threads that used it exit, "
+			"and a new pool at the same address is not confused with it");
+		allocateAndFree(pool.get(), 10);
+		pool.reset();
+		pool.reset(new Pool(4, 16));
+		allocateAndFree(pool.get(), 10);
+		ensure_equals(pool->getSlabCount(), 1u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Concurrent use by multiple threads");
+		boost::atomic<unsigned int> errors(0);
+		vector<oxt::thread *> threads;
+		vector<Object *> objects;
+
+		allocate(pool.get(), &objects, 100);
+		for (unsigned int i = 0; i < 4; i++) {
+			threads.push_back(new oxt::thread(boost::bind(churn, pool.get(), &errors)));
+		}
+		freeAll(pool.get(), &objects);
+		for (unsigned int i = 0; i < threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		ensure_equals(errors.load(), 0u);
+	}
+}
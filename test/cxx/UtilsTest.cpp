@@ -2,8 +2,11 @@
 #include <Utils.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/MemZeroGuard.h>
+#include <Utils/Timer.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <limits.h>
@@ -669,4 +672,122 @@ namespace tut {
 			// Pass.
 		}
 	}
+
+	TEST_METHOD(57) {
+		// Test integerSizeInOtherBase() and integerToOtherBaseWithSize()
+		// against snprintf() around every power of ten.
+		unsigned long long values[3 * 20 + 1];
+		unsigned long long power = 1;
+		unsigned int i, count = 0;
+		char buf[32], expected[32];
+
+		for (i = 0; i < 20; i++) {
+			values[count++] = power - 1;
+			values[count++] = power;
+			values[count++] = power + 7;
+			power *= 10;
+		}
+		values[count++] = ~0ULL;
+
+		for (i = 0; i < count; i++) {
+			snprintf(expected, sizeof(expected), "%llu", values[i]);
+			unsigned int size = integerSizeInOtherBase<unsigned long long, 10>(values[i]);
+			ensure_equals(expected, size, (unsigned int) strlen(expected));
+
+			memset(buf, 'x', sizeof(buf));
+			integerToOtherBaseWithSize<unsigned long long, 10>(values[i], buf, size);
+			ensure_equals(expected, buf[size], 'x');
+			ensure_equals(expected, string(buf, size), string(expected));
+
+			snprintf(expected, sizeof(expected), "%llx", values[i]);
+			size = integerSizeInOtherBase<unsigned long long, 16>(values[i]);
+			ensure_equals(expected, size, (unsigned int) strlen(expected));
+			integerToOtherBaseWithSize<unsigned long long, 16>(values[i], buf, size);
+			ensure_equals(expected, string(buf, size), string(expected));
+		}
+
+		memset(buf, 'x', sizeof(buf));
+		uintToStringWithSize(4294967295u, buf, uintSizeAsString(4294967295u));
+		ensure_equals(string(buf, 11), "4294967295x");
+	}
+
+	/***** Test timedWaitPid() *****/
+
+	TEST_METHOD(58) {
+		// It returns as soon as the process exits.
+		pid_t pid = fork();
+		if (pid == 0) {
+			usleep(50000);
+			_exit(3);
+		}
+
+		Timer<> timer;
+		int status;
+		ensure_equals(timedWaitPid(pid, &status, 5000), pid);
+		ensure("(1)", timer.elapsed() < 2500);
+		ensure("(2)", WIFEXITED(status));
+		ensure_equals(WEXITSTATUS(status), 3);
+	}
+
+	TEST_METHOD(59) {
+		// It returns 0 if the process doesn't exit in time.
+		pid_t pid = fork();
+		if (pid == 0) {
+			usleep(5000000);
+			_exit(0);
+		}
+
+		int status;
+		ensure_equals(timedWaitPid(pid, &status, 20), 0);
+		kill(pid, SIGKILL);
+		ensure_equals(timedWaitPid(pid, &status, 5000), pid);
+		ensure("(1)", WIFSIGNALED(status));
+	}
+
+	/***** Test touchDirTree() *****/
+
+	TEST_METHOD(60) {
+		// It touches the directory and everything in it, but doesn't follow symlinks.
+		makeDirTree("tmp.dir/foo/bar");
+		symlink("../../tmp.dir2.outside", "tmp.dir/foo/link");
+		const char *paths[] = { "tmp.dir/foo/file", "tmp.dir/foo/bar/file",
+			"tmp.dir", "tmp.dir/foo", "tmp.dir/foo/bar", "tmp.dir2.outside" };
+		for (unsigned int i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+			touchFile(paths[i], 1000000);
+		}
+
+		ensure_equals(touchDirTree("tmp.dir"), 5u);
+		struct stat buf;
+		for (unsigned int i = 0; i < 5; i++) {
+			stat(paths[i], &buf);
+			ensure(paths[i], buf.st_mtime > 1000000);
+		}
+		stat("tmp.dir2.outside", &buf);
+		unlink("tmp.dir2.outside");
+		ensure_equals(buf.st_mtime, (time_t) 1000000);
+	}
+
+	/***** Test isExcludedFromTmpCleaning() *****/
+
+	TEST_METHOD(61) {
+		// It checks the 'x' lines of the tmpfiles.d configuration files.
+		vector<string> configDirs;
+		configDirs.push_back(cwd + "/tmp.dir/nonexistant");
+		configDirs.push_back(cwd + "/tmp.dir/tmpfiles.d");
+		makeDirTree("tmp.dir/tmpfiles.d");
+		writeFile("tmp.dir/tmpfiles.d/foo.conf",
+			"# comment\n"
+			"d /tmp 1777 root root 10d\n"
+			"X /tmp/only-this-dir\n"
+			"x /tmp/%u-dir\n"
+			"x  /tmp/passenger.*\n");
+		writeFile("tmp.dir/tmpfiles.d/bar.txt", "x /tmp/ignored\n");
+
+		ensure("(1)", isExcludedFromTmpCleaning("/tmp/passenger.abcd", configDirs));
+		ensure("(2)", isExcludedFromTmpCleaning("/tmp/passenger.abcd/agents.s", configDirs));
+		ensure("(3)", !isExcludedFromTmpCleaning("/tmp/other", configDirs));
+		ensure("(4)", !isExcludedFromTmpCleaning("/tmp/only-this-dir", configDirs));
+		ensure("(5)", !isExcludedFromTmpCleaning("/tmp/ignored", configDirs));
+		ensure("(6)", !isExcludedFromTmpCleaning("/tmp", configDirs));
+	}
 }
@@ -0,0 +1,199 @@
+#include "BenchSupport.h"
+#include <oxt/initialize.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <Utils/SystemTime.h>
+#include <jsoncpp/json.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::Bench;
+
+struct Result {
+	string name;
+	boost::uint64_t iterations;
+	double nsPerIteration;
+	double bytesPerSecond;
+	double itemsPerSecond;
+};
+
+static const char *filter = NULL;
+static double minTime = 0.5;
+static unsigned int repetitions = 3;
+static bool jsonOutput = false;
+
+
+static void
+usage(int exitCode) {
+	printf("Usage: ./main [options]\n");
+	printf("Runs the C++ micro-benchmarks.\n\n");
+	printf("Options:\n");
+	printf("  -f SUBSTRING    Only run the benchmarks whose name contains SUBSTRING.\n");
+	printf("  -t SECONDS      Minimum time that each repetition of a benchmark should\n");
+	printf("                  run. Default: %.1f\n", minTime);
+	printf("  -r NUMBER       Number of repetitions. The median is reported. Default: %u\n",
+		repetitions);
+	printf("  -j              Print the results as JSON, so that they can be stored and\n");
+	printf("                  compared with the results of other commits.\n");
+	printf("  -l              List all benchmarks.\n");
+	printf("  -h              Print this usage information.\n");
+	exit(exitCode);
+}
+
+static const char *
+requireArgument(int argc, char *argv[], int i) {
+	if (i + 1 >= argc) {
+		fprintf(stderr, "*** ERROR: The %s option requires an argument.\n", argv[i]);
+		exit(1);
+	}
+	return argv[i + 1];
+}
+
+static void
+listBenchmarks() {
+	const vector<Benchmark> &benchmarks = registeredBenchmarks();
+	for (unsigned int i = 0; i < benchmarks.size(); i++) {
+		printf("%s\n", benchmarks[i].name);
+	}
+	exit(0);
+}
+
+static void
+parseOptions(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			usage(0);
+		} else if (strcmp(argv[i], "-l") == 0) {
+			listBenchmarks();
+		} else if (strcmp(argv[i], "-f") == 0) {
+			filter = requireArgument(argc, argv, i);
+			i++;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			minTime = atof(requireArgument(argc, argv, i));
+			i++;
+		} else if (strcmp(argv[i], "-r") == 0) {
+			repetitions = std::max(1, atoi(requireArgument(argc, argv, i)));
+			i++;
+		} else if (strcmp(argv[i], "-j") == 0) {
+			jsonOutput = true;
+		} else {
+			fprintf(stderr, "*** ERROR: Unknown option: %s\n", argv[i]);
+			fprintf(stderr, "Please pass -h for a list of valid options.\n");
+			exit(1);
+		}
+	}
+}
+
+/**
+ * Runs the benchmark with increasing iteration counts until one run
+ * lasts at least `minTime` seconds, and returns the measurement of
+ * that run.
+ */
+static Result
+runOnce(const Benchmark &benchmark) {
+	boost::uint64_t minTimeNsec = (boost::uint64_t) (minTime * 1000000000.0);
+	boost::uint64_t iterations = 1;
+
+	while (true) {
+		State state(iterations);
+		benchmark.function(state);
+
+		boost::uint64_t elapsed = std::max<boost::uint64_t>(state.elapsedNsec(), 1);
+		if (elapsed >= minTimeNsec || iterations >= 1000000000ull) {
+			Result result;
+			double seconds = elapsed / 1000000000.0;
+			result.name = benchmark.name;
+			result.iterations = iterations;
+			result.nsPerIteration = (double) elapsed / iterations;
+			result.bytesPerSecond = state.getBytesProcessed() / seconds;
+			result.itemsPerSecond = state.getItemsProcessed() / seconds;
+			return result;
+		}
+
+		// Aim a bit past the minimum time, but don't grow by more
+		// than 10x at a time in case the first runs were noisy.
+		double multiplier = 1.4 * minTimeNsec / elapsed;
+		multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+		iterations = (boost::uint64_t) (iterations * multiplier);
+	}
+}
+
+static bool
+compareByNsPerIteration(const Result &a, const Result &b) {
+	return a.nsPerIteration < b.nsPerIteration;
+}
+
+static Result
+run(const Benchmark &benchmark) {
+	vector<Result> results;
+	for (unsigned int i = 0; i < repetitions; i++) {
+		results.push_back(runOnce(benchmark));
+	}
+	std::sort(results.begin(), results.end(), compareByNsPerIteration);
+	return results[results.size() / 2];
+}
+
+static void
+printResult(const Result &result) {
+	printf("%-45s %12llu %14.1f ns", result.name.c_str(),
+		(unsigned long long) result.iterations, result.nsPerIteration);
+	if (result.bytesPerSecond > 0) {
+		printf(" %10.1f MB/s", result.bytesPerSecond / (1024 * 1024));
+	}
+	if (result.itemsPerSecond > 0) {
+		printf(" %10.2f M items/s", result.itemsPerSecond / 1000000);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+int
+main(int argc, char *argv[]) {
+	oxt::initialize();
+	SystemTime::initialize();
+	parseOptions(argc, argv);
+
+	const vector<Benchmark> &benchmarks = registeredBenchmarks();
+	Json::Value doc;
+	doc["min_time"] = minTime;
+	doc["repetitions"] = repetitions;
+	doc["benchmarks"] = Json::Value(Json::arrayValue);
+
+	if (!jsonOutput) {
+		printf("%-45s %12s %17s\n", "Benchmark", "Iterations", "Time");
+		printf("%s\n", string(76, '-').c_str());
+	}
+	for (unsigned int i = 0; i < benchmarks.size(); i++) {
+		if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL) {
+			continue;
+		}
+
+		Result result = run(benchmarks[i]);
+		if (jsonOutput) {
+			Json::Value entry;
+			entry["name"] = result.name;
+			entry["iterations"] = (Json::UInt64) result.iterations;
+			entry["ns_per_iteration"] = result.nsPerIteration;
+			if (result.bytesPerSecond > 0) {
+				entry["bytes_per_second"] = result.bytesPerSecond;
+			}
+			if (result.itemsPerSecond > 0) {
+				entry["items_per_second"] = result.itemsPerSecond;
+			}
+			doc["benchmarks"].append(entry);
+		} else {
+			printResult(result);
+		}
+	}
+
+	if (jsonOutput) {
+		printf("%s", doc.toStyledString().c_str());
+	}
+	oxt::shutdown();
+	return 0;
+}
@@ -0,0 +1,167 @@
+#ifndef _PASSENGER_BENCH_SUPPORT_H_
+#define _PASSENGER_BENCH_SUPPORT_H_
+
+/*
+ * A minimal micro-benchmark harness in the style of Google Benchmark.
+ *
+ * A benchmark is a function that takes a State and runs its measured code
+ * in a `while (state.keepRunning())` loop. The runner picks the number of
+ * iterations so that each benchmark runs for at least the configured
+ * minimum time, and reports the time per iteration:
+ *
+ *     static void
+ *     MemoryKit_mbuf_get(Bench::State &state) {
+ *         while (state.keepRunning()) {
+ *             ...
+ *         }
+ *     }
+ *     BENCHMARK(MemoryKit_mbuf_get);
+ */
+
+#include <oxt/macros.hpp>
+#include <boost/cstdint.hpp>
+#include <vector>
+#include <time.h>
+
+namespace Passenger {
+namespace Bench {
+
+using namespace std;
+
+
+inline boost::uint64_t
+monotonicNsec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (boost::uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Prevents the compiler from optimizing away the computation of `value`.
+ */
+template<typename T>
+inline void
+doNotOptimize(const T &value) {
+	__asm__ __volatile__("" : : "r"(&value) : "memory");
+}
+
+/**
+ * Forces all pending memory writes to be considered observable.
+ */
+inline void
+clobberMemory() {
+	__asm__ __volatile__("" : : : "memory");
+}
+
+
+class State {
+private:
+	boost::uint64_t maxIterations;
+	boost::uint64_t iteration;
+	boost::uint64_t startTime;
+	boost::uint64_t elapsed;
+	boost::uint64_t bytesProcessed;
+	boost::uint64_t itemsProcessed;
+	bool running;
+
+public:
+	State(boost::uint64_t _maxIterations)
+		: maxIterations(_maxIterations),
+		  iteration(0),
+		  startTime(0),
+		  elapsed(0),
+		  bytesProcessed(0),
+		  itemsProcessed(0),
+		  running(false)
+		{ }
+
+	bool keepRunning() {
+		if (OXT_LIKELY(iteration < maxIterations)) {
+			if (OXT_UNLIKELY(iteration == 0)) {
+				resumeTiming();
+			}
+			iteration++;
+			return true;
+		} else {
+			pauseTiming();
+			return false;
+		}
+	}
+
+	/**
+	 * Excludes the code that follows from the measurement, until
+	 * resumeTiming() is called. Use for per-iteration setup that is
+	 * too expensive to be part of the measurement; the calls themselves
+	 * cost about as much as reading the clock twice.
+	 */
+	void pauseTiming() {
+		if (running) {
+			elapsed += monotonicNsec() - startTime;
+			running = false;
+		}
+	}
+
+	void resumeTiming() {
+		if (!running) {
+			startTime = monotonicNsec();
+			running = true;
+		}
+	}
+
+	boost::uint64_t iterations() const {
+		return maxIterations;
+	}
+
+	boost::uint64_t elapsedNsec() const {
+		return elapsed;
+	}
+
+	/** Total number of bytes processed over all iterations. */
+	void setBytesProcessed(boost::uint64_t bytes) {
+		bytesProcessed = bytes;
+	}
+
+	boost::uint64_t getBytesProcessed() const {
+		return bytesProcessed;
+	}
+
+	/** Total number of items processed over all iterations. */
+	void setItemsProcessed(boost::uint64_t items) {
+		itemsProcessed = items;
+	}
+
+	boost::uint64_t getItemsProcessed() const {
+		return itemsProcessed;
+	}
+};
+
+typedef void (*Function)(State &state);
+
+struct Benchmark {
+	const char *name;
+	Function function;
+};
+
+inline vector<Benchmark> &
+registeredBenchmarks() {
+	static vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+struct Registrar {
+	Registrar(const char *name, Function function) {
+		Benchmark benchmark;
+		benchmark.name = name;
+		benchmark.function = function;
+		registeredBenchmarks().push_back(benchmark);
+	}
+};
+
+
+} // namespace Bench
+} // namespace Passenger
+
+#define BENCHMARK(function) \
+	static Passenger::Bench::Registrar _benchmarkRegistrar_ ## function(#function, function)
+
+#endif /* _PASSENGER_BENCH_SUPPORT_H_ */
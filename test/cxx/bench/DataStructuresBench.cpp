@@ -0,0 +1,157 @@
+#include "BenchSupport.h"
+#include <string>
+#include <vector>
+#include <DataStructures/StringKeyTable.h>
+#include <DataStructures/LString.h>
+#include <DataStructures/HashedStaticString.h>
+#include <MemoryKit/palloc.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::Bench;
+using namespace std;
+
+
+namespace {
+	// Key sets are stored in a static so that the hashes are computed
+	// outside of the measurements.
+	struct Keys {
+		vector<string> strings;
+		vector<string> missingStrings;
+		vector<HashedStaticString> keys;
+		vector<HashedStaticString> missingKeys;
+
+		Keys() {
+			for (unsigned int i = 0; i < 64; i++) {
+				strings.push_back("/apps/app-" + toString(i) + "/config");
+				missingStrings.push_back("/apps/app-" + toString(i) + "/missing");
+			}
+			for (unsigned int i = 0; i < 64; i++) {
+				keys.push_back(strings[i]);
+				missingKeys.push_back(missingStrings[i]);
+			}
+		}
+	};
+
+	const Keys &getKeys() {
+		static Keys keys;
+		return keys;
+	}
+}
+
+
+/***** StringKeyTable *****/
+
+static void
+DataStructures_StringKeyTable_insert(State &state) {
+	const Keys &keys = getKeys();
+	while (state.keepRunning()) {
+		StringKeyTable<int> table;
+		for (unsigned int i = 0; i < keys.keys.size(); i++) {
+			table.insert(keys.keys[i], i);
+		}
+		doNotOptimize(table);
+	}
+	state.setItemsProcessed(state.iterations() * keys.keys.size());
+}
+BENCHMARK(DataStructures_StringKeyTable_insert);
+
+static void
+DataStructures_StringKeyTable_lookupHit(State &state) {
+	const Keys &keys = getKeys();
+	StringKeyTable<int> table;
+	for (unsigned int i = 0; i < keys.keys.size(); i++) {
+		table.insert(keys.keys[i], i);
+	}
+
+	unsigned int i = 0;
+	while (state.keepRunning()) {
+		int *value;
+		doNotOptimize(table.lookup(keys.keys[i], &value));
+		i = (i + 1) % keys.keys.size();
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(DataStructures_StringKeyTable_lookupHit);
+
+static void
+DataStructures_StringKeyTable_lookupMiss(State &state) {
+	const Keys &keys = getKeys();
+	StringKeyTable<int> table;
+	for (unsigned int i = 0; i < keys.keys.size(); i++) {
+		table.insert(keys.keys[i], i);
+	}
+
+	unsigned int i = 0;
+	while (state.keepRunning()) {
+		int *value;
+		doNotOptimize(table.lookup(keys.missingKeys[i], &value));
+		i = (i + 1) % keys.missingKeys.size();
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(DataStructures_StringKeyTable_lookupMiss);
+
+
+/***** LString *****/
+
+static void
+DataStructures_LString_appendAndMakeContiguous(State &state) {
+	// Builds a string out of pieces like the header parser does
+	// when a header arrives over several reads.
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	const char piece[] = "text/html,application/xhtml+xml";
+	unsigned int n = 0;
+
+	while (state.keepRunning()) {
+		LString str;
+		psg_lstr_init(&str);
+		for (unsigned int i = 0; i < 4; i++) {
+			psg_lstr_append(&str, pool, piece, sizeof(piece) - 1);
+		}
+		doNotOptimize(psg_lstr_make_contiguous(&str, pool));
+		psg_lstr_deinit(&str);
+		if (OXT_UNLIKELY(++n == 64)) {
+			psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+			n = 0;
+		}
+	}
+	psg_destroy_pool(pool);
+	state.setBytesProcessed(state.iterations() * 4 * (sizeof(piece) - 1));
+}
+BENCHMARK(DataStructures_LString_appendAndMakeContiguous);
+
+static void
+DataStructures_LString_cmp(State &state) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	LString str;
+	psg_lstr_init(&str);
+	psg_lstr_append(&str, pool, "application/x-www-");
+	psg_lstr_append(&str, pool, "form-urlencoded");
+	StaticString other("application/x-www-form-urlencoded");
+
+	while (state.keepRunning()) {
+		doNotOptimize(psg_lstr_cmp(&str, other));
+	}
+	psg_lstr_deinit(&str);
+	psg_destroy_pool(pool);
+	state.setBytesProcessed(state.iterations() * other.size());
+}
+BENCHMARK(DataStructures_LString_cmp);
+
+static void
+DataStructures_LString_hash(State &state) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	LString str;
+	psg_lstr_init(&str);
+	psg_lstr_append(&str, pool, "Mozilla/5.0 (X11; Linux x86_64) ");
+	psg_lstr_append(&str, pool, "AppleWebKit/537.36 (KHTML, like Gecko)");
+
+	while (state.keepRunning()) {
+		doNotOptimize(psg_lstr_hash(&str));
+	}
+	state.setBytesProcessed(state.iterations() * str.size);
+	psg_lstr_deinit(&str);
+	psg_destroy_pool(pool);
+}
+BENCHMARK(DataStructures_LString_hash);
@@ -0,0 +1,125 @@
+#include "BenchSupport.h"
+#include <Constants.h>
+#include <MemoryKit/mbuf.h>
+#include <MemoryKit/palloc.h>
+
+using namespace Passenger;
+using namespace Passenger::Bench;
+using namespace Passenger::MemoryKit;
+
+
+namespace {
+	struct MbufPool {
+		struct mbuf_pool pool;
+
+		MbufPool() {
+			pool.mbuf_block_chunk_size = DEFAULT_MBUF_CHUNK_SIZE;
+			mbuf_pool_init(&pool);
+		}
+
+		~MbufPool() {
+			mbuf_pool_deinit(&pool);
+		}
+	};
+}
+
+
+/***** mbuf *****/
+
+static void
+MemoryKit_mbuf_get_put(State &state) {
+	MbufPool p;
+	while (state.keepRunning()) {
+		mbuf buffer(mbuf_get(&p.pool));
+		doNotOptimize(buffer.start);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(MemoryKit_mbuf_get_put);
+
+static void
+MemoryKit_mbuf_get_put_batch(State &state) {
+	// Holds on to several buffers at once, like a client
+	// connection that has a number of writes outstanding.
+	MbufPool p;
+	mbuf buffers[16];
+	while (state.keepRunning()) {
+		for (unsigned int i = 0; i < 16; i++) {
+			buffers[i] = mbuf_get(&p.pool);
+		}
+		for (unsigned int i = 0; i < 16; i++) {
+			buffers[i] = mbuf();
+		}
+	}
+	state.setItemsProcessed(state.iterations() * 16);
+}
+BENCHMARK(MemoryKit_mbuf_get_put_batch);
+
+static void
+MemoryKit_mbuf_get_with_size(State &state) {
+	MbufPool p;
+	while (state.keepRunning()) {
+		mbuf buffer(mbuf_get_with_size(&p.pool, 32 * 1024));
+		doNotOptimize(buffer.start);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(MemoryKit_mbuf_get_with_size);
+
+static void
+MemoryKit_mbuf_subset(State &state) {
+	MbufPool p;
+	mbuf buffer(mbuf_get(&p.pool));
+	while (state.keepRunning()) {
+		mbuf subset(buffer, 10, 100);
+		doNotOptimize(subset.start);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(MemoryKit_mbuf_subset);
+
+
+/***** palloc *****/
+
+static void
+MemoryKit_palloc_small(State &state) {
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	unsigned int n = 0;
+	while (state.keepRunning()) {
+		doNotOptimize(psg_palloc(pool, 32));
+		if (OXT_UNLIKELY(++n == 1024)) {
+			psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+			n = 0;
+		}
+	}
+	psg_destroy_pool(pool);
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(MemoryKit_palloc_small);
+
+static void
+MemoryKit_palloc_large(State &state) {
+	// Allocations larger than the pool's block size go through malloc.
+	psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+	unsigned int n = 0;
+	while (state.keepRunning()) {
+		doNotOptimize(psg_palloc(pool, PSG_DEFAULT_POOL_SIZE * 2));
+		if (OXT_UNLIKELY(++n == 64)) {
+			psg_reset_pool(pool, PSG_DEFAULT_POOL_SIZE);
+			n = 0;
+		}
+	}
+	psg_destroy_pool(pool);
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(MemoryKit_palloc_large);
+
+static void
+MemoryKit_palloc_create_destroy(State &state) {
+	while (state.keepRunning()) {
+		psg_pool_t *pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+		doNotOptimize(psg_palloc(pool, 32));
+		psg_destroy_pool(pool);
+	}
+}
+BENCHMARK(MemoryKit_palloc_create_destroy);
@@ -0,0 +1,606 @@
+/*
+ * Replays a request arrival trace against a real ApplicationPool2::Pool whose
+ * processes are spawned by the dummy spawner, and reports the queue time
+ * percentiles and the utilization of the processes. This makes it possible
+ * to evaluate settings like max_pool_size, min_instances and the routing
+ * policy offline, before trying them in production.
+ *
+ * The pool runs for real: it uses its own threads and the wall clock. Each
+ * request holds on to its session for its service time, and the dummy
+ * spawner takes the configured spawn time to spawn a process. To shorten
+ * long traces, --speedup compresses arrival times, service times and spawn
+ * times, but not the pool's own timers (e.g. the garbage collector and
+ * --max-idle-time), so results for idle process shutdown are only accurate
+ * without speedup.
+ *
+ * Run with -h for the options. Trace files contain one request per line:
+ *
+ *     ARRIVAL_TIME_SEC [SERVICE_TIME_MS [ROUTING_KEY]]
+ *
+ * Requests without a service time get one from --service-time.
+ */
+
+#include <oxt/initialize.hpp>
+#include <oxt/thread.hpp>
+#include <oxt/system_calls.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <signal.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include <Core/ApplicationPool/Pool.h>
+#include <Core/SpawningKit/Factory.h>
+#include <Logging.h>
+#include <ResourceLocator.h>
+#include <Utils.h>
+#include <Utils/Hasher.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+#include <jsoncpp/json.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+
+
+/***** Configuration *****/
+
+struct Distribution {
+	enum Type {
+		CONSTANT,
+		EXPONENTIAL,
+		UNIFORM,
+		LOGNORMAL
+	};
+
+	Type type;
+	double a;
+	double b;
+};
+
+static string passengerRoot = ".";
+static string traceFile;
+static double rate = 50;
+static double duration = 10;
+static Distribution serviceTime = { Distribution::EXPONENTIAL, 50, 0 };
+static double spawnTime = 500;
+static unsigned int maxPoolSize = 6;
+static unsigned int minProcesses = 1;
+static unsigned int maxProcesses = 0;
+static unsigned int concurrency = 1;
+static unsigned int maxQueueSize = 100;
+static unsigned long long maxIdleTime = 0;
+static string routingPolicy;
+static double speedup = 1;
+static unsigned short seed[3] = { 1, 2, 3 };
+static bool jsonOutput = false;
+static bool verbose = false;
+
+
+static void
+usage(int exitCode) {
+	printf("Usage: ./pool_simulator [options]\n");
+	printf("Replays a request trace against a Pool with dummy processes, and reports\n");
+	printf("queue times and utilization.\n\n");
+	printf("Workload:\n");
+	printf("  --trace FILE            Replay the arrivals in FILE. Each line contains\n");
+	printf("                          ARRIVAL_TIME_SEC [SERVICE_TIME_MS [ROUTING_KEY]].\n");
+	printf("  --rate N                Without a trace: Poisson arrivals at N requests\n");
+	printf("                          per second. Default: %.0f\n", rate);
+	printf("  --duration SEC          Without a trace: length of the run. Default: %.0f\n",
+		duration);
+	printf("  --service-time DIST     Service time distribution in milliseconds:\n");
+	printf("                          const:MS, exp:MEAN, uniform:MIN:MAX or\n");
+	printf("                          lognormal:MEDIAN:SIGMA. Default: exp:50\n");
+	printf("  --seed N                Random seed. Default: 1\n\n");
+	printf("Pool:\n");
+	printf("  --max-pool-size N       Default: %u\n", maxPoolSize);
+	printf("  --min-processes N       Default: %u\n", minProcesses);
+	printf("  --max-processes N       Maximum processes for the app; 0 = unlimited.\n");
+	printf("                          Default: %u\n", maxProcesses);
+	printf("  --concurrency N         Concurrent sessions per process. Default: %u\n",
+		concurrency);
+	printf("  --max-queue-size N      Default: %u\n", maxQueueSize);
+	printf("  --max-idle-time SEC     Idle process shutdown; 0 = never. Default: 0\n");
+	printf("  --routing-policy NAME   least-busy, p2c, ewma or consistent-hash.\n");
+	printf("  --spawn-time MS         Time it takes to spawn a process. Default: %.0f\n\n",
+		spawnTime);
+	printf("Other:\n");
+	printf("  --speedup N             Run N times faster than the trace's timeline.\n");
+	printf("                          Default: 1\n");
+	printf("  --passenger-root DIR    Default: the current directory\n");
+	printf("  -j                      Print the report as JSON.\n");
+	printf("  -v                      Log pool activity.\n");
+	printf("  -h                      Print this usage information.\n");
+	exit(exitCode);
+}
+
+static Distribution
+parseDistribution(const string &spec) {
+	vector<string> parts;
+	Distribution result;
+
+	split(spec, ':', parts);
+	if (parts.size() == 2 && parts[0] == "const") {
+		result.type = Distribution::CONSTANT;
+	} else if (parts.size() == 2 && parts[0] == "exp") {
+		result.type = Distribution::EXPONENTIAL;
+	} else if (parts.size() == 3 && parts[0] == "uniform") {
+		result.type = Distribution::UNIFORM;
+	} else if (parts.size() == 3 && parts[0] == "lognormal") {
+		result.type = Distribution::LOGNORMAL;
+	} else {
+		fprintf(stderr, "*** ERROR: Invalid distribution: %s\n", spec.c_str());
+		exit(1);
+	}
+	result.a = atof(parts[1].c_str());
+	result.b = (parts.size() == 3) ? atof(parts[2].c_str()) : 0;
+	return result;
+}
+
+static const char *
+requireArgument(int argc, char *argv[], int i) {
+	if (i + 1 >= argc) {
+		fprintf(stderr, "*** ERROR: The %s option requires an argument.\n", argv[i]);
+		exit(1);
+	}
+	return argv[i + 1];
+}
+
+static void
+parseOptions(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-h" || arg == "--help") {
+			usage(0);
+		} else if (arg == "-j") {
+			jsonOutput = true;
+		} else if (arg == "-v") {
+			verbose = true;
+		} else {
+			const char *value = requireArgument(argc, argv, i);
+			i++;
+			if (arg == "--trace") {
+				traceFile = value;
+			} else if (arg == "--rate") {
+				rate = atof(value);
+			} else if (arg == "--duration") {
+				duration = atof(value);
+			} else if (arg == "--service-time") {
+				serviceTime = parseDistribution(value);
+			} else if (arg == "--seed") {
+				seed[0] = (unsigned short) atoi(value);
+			} else if (arg == "--max-pool-size") {
+				maxPoolSize = std::max(1, atoi(value));
+			} else if (arg == "--min-processes") {
+				minProcesses = atoi(value);
+			} else if (arg == "--max-processes") {
+				maxProcesses = atoi(value);
+			} else if (arg == "--concurrency") {
+				concurrency = atoi(value);
+			} else if (arg == "--max-queue-size") {
+				maxQueueSize = atoi(value);
+			} else if (arg == "--max-idle-time") {
+				maxIdleTime = (unsigned long long) (atof(value) * 1000000);
+			} else if (arg == "--routing-policy") {
+				routingPolicy = value;
+			} else if (arg == "--spawn-time") {
+				spawnTime = atof(value);
+			} else if (arg == "--speedup") {
+				speedup = std::max(0.001, atof(value));
+			} else if (arg == "--passenger-root") {
+				passengerRoot = value;
+			} else {
+				fprintf(stderr, "*** ERROR: Unknown option: %s\n", arg.c_str());
+				fprintf(stderr, "Please pass -h for a list of valid options.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+
+/***** Workload *****/
+
+struct Arrival {
+	/** Seconds since the start of the trace. */
+	double time;
+	/** Milliseconds. */
+	double serviceTime;
+	boost::uint32_t routingHash;
+};
+
+static double
+sample(const Distribution &dist) {
+	switch (dist.type) {
+	case Distribution::CONSTANT:
+		return dist.a;
+	case Distribution::EXPONENTIAL:
+		return -dist.a * log(1 - erand48(seed));
+	case Distribution::UNIFORM:
+		return dist.a + (dist.b - dist.a) * erand48(seed);
+	case Distribution::LOGNORMAL: {
+		// Box-Muller transform.
+		double u1 = 1 - erand48(seed);
+		double u2 = erand48(seed);
+		double z = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+		return dist.a * exp(dist.b * z);
+	}
+	default:
+		abort();
+	}
+}
+
+static boost::uint32_t
+hashRoutingKey(const string &key) {
+	Hasher h;
+	h.update(key.data(), key.size());
+	boost::uint32_t result = h.finalize();
+	// 0 means that there's no routing key.
+	return (result == 0) ? 1 : result;
+}
+
+static vector<Arrival>
+loadTrace(const string &path) {
+	ifstream f(path.c_str());
+	if (!f) {
+		fprintf(stderr, "*** ERROR: Cannot open %s\n", path.c_str());
+		exit(1);
+	}
+
+	vector<Arrival> result;
+	string line;
+	while (getline(f, line)) {
+		vector<string> fields;
+		line = strip(line);
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		split(replaceAll(line, "\t", " "), ' ', fields);
+		fields.erase(std::remove(fields.begin(), fields.end(), string()), fields.end());
+
+		Arrival arrival;
+		arrival.time = atof(fields[0].c_str());
+		arrival.serviceTime = (fields.size() > 1)
+			? atof(fields[1].c_str())
+			: sample(serviceTime);
+		arrival.routingHash = (fields.size() > 2) ? hashRoutingKey(fields[2]) : 0;
+		result.push_back(arrival);
+	}
+	return result;
+}
+
+static vector<Arrival>
+generatePoissonArrivals() {
+	vector<Arrival> result;
+	double time = 0;
+	while (true) {
+		time += -log(1 - erand48(seed)) / rate;
+		if (time >= duration) {
+			break;
+		}
+
+		Arrival arrival;
+		arrival.time = time;
+		arrival.serviceTime = sample(serviceTime);
+		arrival.routingHash = 0;
+		result.push_back(arrival);
+	}
+	return result;
+}
+
+
+/***** Simulation *****/
+
+class Simulation;
+
+struct PendingRequest {
+	Simulation *simulation;
+	MonotonicTimeUsec issuedAt;
+	double serviceTime;
+};
+
+class Simulation {
+private:
+	typedef multimap<MonotonicTimeUsec, SessionPtr> CompletionMap;
+
+	PoolPtr pool;
+	Options options;
+	unsigned int total;
+
+	boost::mutex syncher;
+	boost::condition_variable cond;
+	CompletionMap completions;
+	bool quit;
+	vector<double> queueTimes;
+	map<pid_t, unsigned int> requestsPerProcess;
+	unsigned int errors;
+	unsigned int finished;
+	unsigned int activeSessions;
+
+	// Utilization samples.
+	unsigned long long samples;
+	unsigned long long busySum;
+	unsigned long long capacitySum;
+	unsigned long long processSum;
+	unsigned int maxProcessCount;
+
+	static void onSession(const AbstractSessionPtr &session, const ExceptionPtr &e,
+		void *userData)
+	{
+		PendingRequest *req = static_cast<PendingRequest *>(userData);
+		req->simulation->handleSession(req, static_pointer_cast<Session>(session), e);
+		delete req;
+	}
+
+	void handleSession(PendingRequest *req, const SessionPtr &session,
+		const ExceptionPtr &e)
+	{
+		MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+		boost::lock_guard<boost::mutex> l(syncher);
+
+		if (session == NULL) {
+			errors++;
+			finished++;
+			if (verbose) {
+				P_WARN("Request failed: " << e->what());
+			}
+			cond.notify_all();
+			return;
+		}
+
+		// Convert back to the trace's timeline.
+		queueTimes.push_back((now - req->issuedAt) * speedup / 1000.0);
+		requestsPerProcess[session->getPid()]++;
+		activeSessions++;
+		MonotonicTimeUsec completeAt = now +
+			(MonotonicTimeUsec) (req->serviceTime * 1000 / speedup);
+		completions.insert(make_pair(completeAt, session));
+		cond.notify_all();
+	}
+
+	void completionThreadMain() {
+		boost::unique_lock<boost::mutex> l(syncher);
+		while (!quit) {
+			if (completions.empty()) {
+				cond.wait(l);
+				continue;
+			}
+
+			MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+			CompletionMap::iterator it = completions.begin();
+			if (it->first > now) {
+				cond.timed_wait(l, boost::posix_time::microseconds(it->first - now));
+				continue;
+			}
+
+			SessionPtr session = it->second;
+			completions.erase(it);
+			activeSessions--;
+			finished++;
+			cond.notify_all();
+
+			l.unlock();
+			session->close(true);
+			session.reset();
+			l.lock();
+		}
+	}
+
+	void samplerThreadMain() {
+		while (true) {
+			unsigned int processCount = pool->getProcessCount();
+			{
+				boost::lock_guard<boost::mutex> l(syncher);
+				if (quit) {
+					return;
+				}
+				samples++;
+				busySum += activeSessions;
+				capacitySum += processCount * std::max(concurrency, 1u);
+				processSum += processCount;
+				maxProcessCount = std::max(maxProcessCount, processCount);
+			}
+			usleep(10000);
+		}
+	}
+
+	static double percentile(const vector<double> &sorted, double p) {
+		if (sorted.empty()) {
+			return 0;
+		}
+		int index = (int) ceil(p / 100.0 * sorted.size()) - 1;
+		return sorted[std::max(index, 0)];
+	}
+
+public:
+	Simulation(const PoolPtr &_pool, const Options &_options)
+		: pool(_pool),
+		  options(_options),
+		  total(0),
+		  quit(false),
+		  errors(0),
+		  finished(0),
+		  activeSessions(0),
+		  samples(0),
+		  busySum(0),
+		  capacitySum(0),
+		  processSum(0),
+		  maxProcessCount(0)
+		{ }
+
+	void run(const vector<Arrival> &arrivals) {
+		oxt::thread completionThread(
+			boost::bind(&Simulation::completionThreadMain, this),
+			"Simulation completions", 1024 * 128);
+		oxt::thread samplerThread(
+			boost::bind(&Simulation::samplerThreadMain, this),
+			"Simulation sampler", 1024 * 128);
+
+		total = arrivals.size();
+		MonotonicTimeUsec start = SystemTime::getMonotonicUsec();
+		for (unsigned int i = 0; i < arrivals.size(); i++) {
+			MonotonicTimeUsec target = start +
+				(MonotonicTimeUsec) (arrivals[i].time * 1000000 / speedup);
+			MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+			if (target > now) {
+				usleep(target - now);
+			}
+
+			PendingRequest *req = new PendingRequest();
+			req->simulation = this;
+			req->issuedAt = SystemTime::getMonotonicUsec();
+			req->serviceTime = arrivals[i].serviceTime;
+
+			GetCallback callback;
+			callback.func = onSession;
+			callback.userData = req;
+			options.routingHash = arrivals[i].routingHash;
+			pool->asyncGet(options, callback);
+		}
+
+		{
+			boost::unique_lock<boost::mutex> l(syncher);
+			while (finished < total) {
+				cond.wait(l);
+			}
+			quit = true;
+			cond.notify_all();
+		}
+		completionThread.join();
+		samplerThread.join();
+	}
+
+	Json::Value report(const vector<Arrival> &arrivals) {
+		Json::Value doc;
+		vector<double> sorted = queueTimes;
+		std::sort(sorted.begin(), sorted.end());
+
+		doc["requests"] = total;
+		doc["served"] = (Json::UInt) queueTimes.size();
+		doc["errors"] = errors;
+		doc["trace_duration_sec"] = arrivals.empty() ? 0 : arrivals.back().time;
+
+		Json::Value &queueTime = doc["queue_time_ms"];
+		queueTime["p50"] = percentile(sorted, 50);
+		queueTime["p90"] = percentile(sorted, 90);
+		queueTime["p99"] = percentile(sorted, 99);
+		queueTime["max"] = percentile(sorted, 100);
+
+		doc["utilization"] = (capacitySum == 0) ? 0.0
+			: (double) busySum / capacitySum;
+		doc["average_processes"] = (samples == 0) ? 0.0
+			: (double) processSum / samples;
+		doc["max_processes"] = maxProcessCount;
+		doc["processes_used"] = (Json::UInt) requestsPerProcess.size();
+
+		unsigned int minRequests = 0, maxRequests = 0;
+		map<pid_t, unsigned int>::const_iterator it;
+		for (it = requestsPerProcess.begin(); it != requestsPerProcess.end(); it++) {
+			if (it == requestsPerProcess.begin() || it->second < minRequests) {
+				minRequests = it->second;
+			}
+			maxRequests = std::max(maxRequests, it->second);
+		}
+		doc["requests_per_process"]["min"] = minRequests;
+		doc["requests_per_process"]["max"] = maxRequests;
+		return doc;
+	}
+};
+
+static void
+printReport(const Json::Value &doc) {
+	printf("Requests:             %u (%u served, %u errors)\n",
+		doc["requests"].asUInt(), doc["served"].asUInt(), doc["errors"].asUInt());
+	printf("Trace duration:       %.1f sec\n", doc["trace_duration_sec"].asDouble());
+	printf("Queue time (ms):      p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+		doc["queue_time_ms"]["p50"].asDouble(),
+		doc["queue_time_ms"]["p90"].asDouble(),
+		doc["queue_time_ms"]["p99"].asDouble(),
+		doc["queue_time_ms"]["max"].asDouble());
+	printf("Utilization:          %.1f%%\n", doc["utilization"].asDouble() * 100);
+	printf("Processes:            %.1f on average, %u at most, %u used\n",
+		doc["average_processes"].asDouble(), doc["max_processes"].asUInt(),
+		doc["processes_used"].asUInt());
+	printf("Requests per process: %u - %u\n",
+		doc["requests_per_process"]["min"].asUInt(),
+		doc["requests_per_process"]["max"].asUInt());
+}
+
+int
+main(int argc, char *argv[]) {
+	signal(SIGPIPE, SIG_IGN);
+	oxt::initialize();
+	oxt::setup_syscall_interruption_support();
+	SystemTime::initialize();
+	parseOptions(argc, argv);
+	setLogLevel(verbose ? LVL_INFO : LVL_ERROR);
+
+	vector<Arrival> arrivals = traceFile.empty()
+		? generatePoissonArrivals()
+		: loadTrace(traceFile);
+
+	ResourceLocator resourceLocator(absolutizePath(passengerRoot));
+	SpawningKit::ConfigPtr config = boost::make_shared<SpawningKit::Config>();
+	config->resourceLocator = &resourceLocator;
+	config->concurrency = concurrency;
+	config->spawnTime = (unsigned int) (spawnTime * 1000 / speedup);
+	config->finalize();
+
+	SpawningKit::FactoryPtr factory = boost::make_shared<SpawningKit::Factory>(config);
+	PoolPtr pool = boost::make_shared<Pool>(factory);
+	pool->initialize();
+	pool->setMax(maxPoolSize);
+	if (maxIdleTime > 0) {
+		pool->setMaxIdleTime(maxIdleTime);
+	}
+
+	struct passwd *pw = getpwuid(getuid());
+	struct group *gr = getgrgid(getgid());
+	string user = pw ? pw->pw_name : toString(getuid());
+	string group = gr ? gr->gr_name : toString(getgid());
+	string appRoot = absolutizePath(".");
+
+	Options options;
+	options.spawnMethod = "dummy";
+	options.appRoot = appRoot;
+	options.startCommand = "ruby\t" "start.rb";
+	options.startupFile = "start.rb";
+	options.loadShellEnvvars = false;
+	options.user = user;
+	options.defaultUser = user;
+	options.defaultGroup = group;
+	options.minProcesses = minProcesses;
+	options.maxProcesses = maxProcesses;
+	options.maxRequestQueueSize = maxQueueSize;
+	options.routingPolicy = routingPolicy;
+
+	Simulation simulation(pool, options);
+	simulation.run(arrivals);
+	Json::Value doc = simulation.report(arrivals);
+
+	pool->destroy();
+	pool.reset();
+
+	if (jsonOutput) {
+		printf("%s", doc.toStyledString().c_str());
+	} else {
+		printReport(doc);
+	}
+	oxt::shutdown();
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include "BenchSupport.h"
+#include <time.h>
+#include <cstring>
+#include <string>
+#include <MemoryKit/palloc.h>
+#include <Core/Controller/Request.h>
+#include <Core/Controller/AppResponse.h>
+#include <Core/ResponseCache.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace Passenger;
+using namespace Passenger::Bench;
+using namespace Passenger::Core;
+using namespace Passenger::ServerKit;
+using namespace std;
+
+
+namespace {
+	typedef ResponseCache<Request> ResponseCacheType;
+
+	// Sets up requests the same way as test/cxx/Core/ResponseCacheTest.cpp.
+	struct ResponseCacheFixture {
+		ResponseCacheType responseCache;
+		Request req;
+		StaticString defaultVaryTurbocacheByCookie;
+
+		ResponseCacheFixture() {
+			req.pool = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
+		}
+
+		~ResponseCacheFixture() {
+			psg_destroy_pool(req.pool);
+		}
+
+		void reset(const StaticString &path) {
+			req.headers.clear();
+			req.secureHeaders.clear();
+			psg_reset_pool(req.pool, PSG_DEFAULT_POOL_SIZE);
+			req.httpMajor = 1;
+			req.httpMinor = 1;
+			req.httpState = Request::COMPLETE;
+			req.bodyType  = Request::RBT_NO_BODY;
+			req.method    = HTTP_GET;
+			req.client    = NULL;
+			psg_lstr_init(&req.path);
+			psg_lstr_append(&req.path, req.pool, path.data(), path.size());
+			req.queryStringIndex = -1;
+			req.https     = false;
+			req.hasPragmaHeader = false;
+			req.acceptsGzip = false;
+			req.host = psg_lstr_create(req.pool, "www.example.com");
+			req.cacheKey = HashedStaticString();
+			req.cacheControl = NULL;
+			req.varyCookie = NULL;
+
+			req.appResponse.headers.clear();
+			req.appResponse.secureHeaders.clear();
+			req.appResponse.httpState  = AppResponse::COMPLETE;
+			req.appResponse.bodyType   = AppResponse::RBT_CONTENT_LENGTH;
+			req.appResponse.aux.bodyInfo.contentLength = 5;
+			req.appResponse.statusCode = 200;
+			req.appResponse.date       = NULL;
+			req.appResponse.setCookie  = NULL;
+			req.appResponse.cacheControl  = NULL;
+			req.appResponse.expiresHeader = NULL;
+			req.appResponse.lastModifiedHeader = NULL;
+			req.appResponse.varyHeader = NULL;
+		}
+
+		void store(const StaticString &path) {
+			reset(path);
+			req.appResponse.headers.insert(req.pool, "Date", createTodayString());
+			req.appResponse.headers.insert(req.pool, "Cache-Control",
+				"public,max-age=99999");
+
+			string header = "content-length: 5\r\n";
+			if (!responseCache.prepareRequest(this, &req)
+			 || !responseCache.requestAllowsStoring(&req)
+			 || !responseCache.prepareRequestForStoring(&req))
+			{
+				fprintf(stderr, "*** ERROR: response is not cacheable\n");
+				abort();
+			}
+			ResponseCacheType::Entry entry(responseCache.store(&req, time(NULL),
+				header.size(), 5));
+			memcpy(entry.body->httpHeaderData, header.data(), header.size());
+			memcpy(entry.body->httpBodyData, "hello", 5);
+		}
+
+		StaticString createTodayString() {
+			time_t the_time = time(NULL);
+			struct tm the_tm;
+			gmtime_r(&the_time, &the_tm);
+			char *buf = (char *) psg_pnalloc(req.pool, 64);
+			size_t size = strftime(buf, 64, "%a, %d %b %Y %H:%M:%S GMT", &the_tm);
+			return StaticString(buf, size);
+		}
+	};
+
+	void benchmarkFetch(State &state, bool hit) {
+		ResponseCacheFixture f;
+		for (unsigned int i = 0; i < 8; i++) {
+			f.store("/articles/" + toString(i));
+		}
+
+		f.reset(hit ? "/articles/3" : "/articles/missing");
+		if (!f.responseCache.prepareRequest(&f, &f.req)
+		 || !f.responseCache.requestAllowsFetching(&f.req))
+		{
+			fprintf(stderr, "*** ERROR: request cannot be fetched from the cache\n");
+			abort();
+		}
+
+		ev_tstamp now = time(NULL);
+		while (state.keepRunning()) {
+			ResponseCacheType::Entry entry(f.responseCache.fetch(&f.req, now));
+			doNotOptimize(entry);
+		}
+		state.setItemsProcessed(state.iterations());
+	}
+}
+
+static void
+Core_ResponseCache_prepareRequest(State &state) {
+	ResponseCacheFixture f;
+	f.reset("/articles/2016/05/passenger-5-1");
+	unsigned int n = 0;
+	while (state.keepRunning()) {
+		doNotOptimize(f.responseCache.prepareRequest(&f, &f.req));
+		if (OXT_UNLIKELY(++n == 256)) {
+			state.pauseTiming();
+			f.reset("/articles/2016/05/passenger-5-1");
+			n = 0;
+			state.resumeTiming();
+		}
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(Core_ResponseCache_prepareRequest);
+
+static void
+Core_ResponseCache_fetchHit(State &state) {
+	benchmarkFetch(state, true);
+}
+BENCHMARK(Core_ResponseCache_fetchHit);
+
+static void
+Core_ResponseCache_fetchMiss(State &state) {
+	benchmarkFetch(state, false);
+}
+BENCHMARK(Core_ResponseCache_fetchMiss);
@@ -240,6 +240,87 @@ def log(message)
     end
   end
 
+  describe "PassengerAsyncHandoff" do
+    ['event', 'prefork'].each do |mpm|
+      context "with the #{mpm} MPM" do
+        before :all do
+          create_apache2_controller
+          @mpm_available = @apache2.mpm_available?(mpm)
+          if @mpm_available
+            @server = "http://1.passenger.test:#{@apache2.port}"
+            @stub = RackStub.new('rack')
+            @apache2.set(:mpm => mpm)
+            @apache2 << "PassengerMaxPoolSize 1"
+            @apache2 << "PassengerAsyncHandoff on"
+            @apache2.set_vhost("1.passenger.test", "#{@stub.full_app_root}/public")
+            @apache2.start
+          end
+        end
+
+        after :all do
+          @stub.destroy if @stub
+          @apache2.stop if @apache2
+        end
+
+        before :each do
+          if @mpm_available
+            @stub.reset
+          else
+            pending "Apache can't be started with mod_mpm_#{mpm}"
+          end
+        end
+
+        def handed_off?
+          File.open("test.log", "rb") do |f|
+            f.seek(@test_log_pos)
+            f.read.include?("Took over the client connection that the web server handed off")
+          end
+        end
+
+        it "lets the Passenger core respond to the client directly" do
+          response = get_response('/')
+          response.code.should == "200"
+          response.body.should == "front page"
+          eventually do
+            handed_off?
+          end
+        end
+
+        it "closes handed off connections after the response" do
+          socket = TCPSocket.new('1.passenger.test', @apache2.port)
+          begin
+            socket.write("GET / HTTP/1.1\r\n" +
+              "Host: 1.passenger.test:#{@apache2.port}\r\n" +
+              "Connection: keep-alive\r\n\r\n")
+            response = Timeout.timeout(10) do
+              socket.read
+            end
+          ensure
+            socket.close
+          end
+          header, body = response.split("\r\n\r\n", 2)
+          header.should =~ /\AHTTP\/1\.1 200 /
+          header.should =~ /^Connection: close\r?$/i
+          body.should == "front page"
+        end
+
+        it "does not hand off requests with a body" do
+          post('/parameters', 'first' => 'one').should ==
+            "Method: POST\nFirst: one\nSecond: \n"
+          should_never_happen(0.5) do
+            handed_off?
+          end
+        end
+
+        it "keeps serving requests after handing off connections" do
+          20.times do
+            get('/').should == "front page"
+          end
+        end
+      end
+    end
+  end
+
   describe "compatibility with other modules" do
     before :all do
       create_apache2_controller
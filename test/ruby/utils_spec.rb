@@ -35,6 +35,36 @@ module PhusionPassenger
     split_by_null_into_hash("\0\0").should == { "" => "" }
   end
 
+  specify "#split_by_null_into_env works" do
+    base_env = { "rack.run_once" => false }.freeze
+    split_by_null_into_env("", nil).should == {}
+    split_by_null_into_env("foo\0bar\0", nil).should == { "foo" => "bar" }
+    split_by_null_into_env("foo\0\0bar\0baz\0", base_env).should ==
+      { "rack.run_once" => false, "foo" => "", "bar" => "baz" }
+    split_by_null_into_env("foo\0bar\0", base_env).keys.last.should be_frozen
+    base_env.should == { "rack.run_once" => false }
+  end
+
+  specify "#generate_rack_response_header works" do
+    output, content_length, has_transfer_encoding = generate_rack_response_header(200,
+      "Content-Type" => "text/plain",
+      "Set-Cookie" => "a=1\nb=2",
+      "content-length" => "5",
+      "rack.hijack" => lambda { })
+    output.join.should == "HTTP/1.1 200 Whatever\r\n" +
+      "Content-Type: text/plain\r\n" +
+      "Set-Cookie: a=1\r\n" +
+      "Set-Cookie: b=2\r\n" +
+      "content-length: 5\r\n"
+    content_length.should == "5"
+    has_transfer_encoding.should be_false
+
+    output, content_length, has_transfer_encoding = generate_rack_response_header(200,
+      "Transfer-encoding" => "chunked")
+    content_length.should be_nil
+    has_transfer_encoding.should be_true
+  end
+
   ######################
 end
 
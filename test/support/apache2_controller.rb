@@ -200,6 +200,21 @@ def set_vhost(domain, document_root)
     vhosts << vhost
   end
 
+  # Checks whether the MPM with the given name (e.g. 'event' or 'prefork')
+  # can be selected with `set(:mpm => name)`. That's only possible if Apache
+  # loads its MPM as a module, unless the given MPM is the built-in one.
+  def mpm_available?(name)
+    if has_builtin_module?("#{name}.c")
+      return true
+    elsif has_builtin_module?('prefork.c') ||
+          has_builtin_module?('worker.c') ||
+          has_builtin_module?('event.c')
+      return false
+    else
+      return has_module?("mod_mpm_#{name}.so")
+    end
+  end
+
   # Checks whether this Apache instance is running.
   def running?
     if File.exist?("#{@server_root}/httpd.pid")